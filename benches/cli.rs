@@ -0,0 +1,143 @@
+//! End-to-end throughput of `dsrs` on log-like corpora, against `sort -u`,
+//! to catch regressions in reading, line splitting and the FFI that the
+//! per-sketch benches miss. Run with `cargo bench --bench cli`.
+//!
+//! Each corpus is lines like `user42 GET /item/7 200`, whose user and item
+//! are drawn from a Zipf distribution of exponent `s` over a million of
+//! each, so that both the distinct lines and the keys of `--key` are as
+//! skewed as logs usually are. Corpora of each size in `CLI_BENCH_MB`
+//! (64 and 512 by default) and each `s` in `SKEWS` are generated from a
+//! fixed seed into `target/cli-bench`, and kept there for later runs.
+//!
+//! Each command reads a corpus on stdin, and the best of `RUNS` is printed
+//! in GB/s of input, as a table.
+
+use std::env;
+use std::fs::{self, File};
+use std::io::{BufWriter, Write};
+use std::path::{Path, PathBuf};
+use std::process::{Command, Stdio};
+use std::time::Instant;
+
+use rand::prelude::*;
+
+/// Zipf exponents of the corpora, from uniform to heavily skewed.
+const SKEWS: [f64; 3] = [0.0, 0.8, 1.2];
+
+/// Distinct users, and items, of each corpus.
+const DISTINCT: usize = 1000 * 1000;
+
+const RUNS: usize = 3;
+
+/// Shell pipelines timed on each corpus, which read it on stdin and find
+/// `dsrs` in `$DSRS`.
+const COMMANDS: [(&str, &str); 5] = [
+    ("dsrs", "\"$DSRS\""),
+    ("dsrs --key", "\"$DSRS\" --key"),
+    (
+        "dsrs --raw | dsrs --merge",
+        "\"$DSRS\" --raw | \"$DSRS\" --merge",
+    ),
+    ("dsrs --hh 10", "\"$DSRS\" --hh 10"),
+    ("sort -u | wc -l", "LC_ALL=C sort -u | wc -l"),
+];
+
+/// Draws ranks from 0 to `n` with probability proportional to
+/// `1 / (rank + 1)^s`, by binary search of the cumulative weights.
+struct Zipf {
+    cumulative: Vec<f64>,
+}
+
+impl Zipf {
+    fn new(n: usize, s: f64) -> Self {
+        let mut total = 0.0;
+        let cumulative = (1..=n)
+            .map(|rank| {
+                total += (rank as f64).powf(-s);
+                total
+            })
+            .collect();
+        Self { cumulative }
+    }
+
+    fn sample(&self, rng: &mut impl Rng) -> usize {
+        let total = *self.cumulative.last().expect("nonempty");
+        let u = rng.gen::<f64>() * total;
+        self.cumulative.partition_point(|&c| c < u)
+    }
+}
+
+/// Returns the corpus of about `mb` megabytes at skew `s`, generating it
+/// unless an earlier run did.
+fn corpus(dir: &Path, mb: u64, s: f64) -> PathBuf {
+    let path = dir.join(format!("corpus-{}mb-s{}.txt", mb, s));
+    if path.exists() {
+        return path;
+    }
+    let partial = path.with_extension("partial");
+    let zipf = Zipf::new(DISTINCT, s);
+    let mut rng = StdRng::seed_from_u64(mb ^ s.to_bits());
+    let mut out = BufWriter::new(File::create(&partial).expect("corpus created"));
+    let mut written = 0;
+    while written < mb << 20 {
+        let user = zipf.sample(&mut rng);
+        let item = zipf.sample(&mut rng);
+        let status = if rng.gen_ratio(1, 50) { 404 } else { 200 };
+        let line = format!("user{} GET /item/{} {}\n", user, item, status);
+        out.write_all(line.as_bytes()).expect("corpus written");
+        written += line.len() as u64;
+    }
+    out.flush().expect("corpus written");
+    fs::rename(&partial, &path).expect("corpus renamed");
+    path
+}
+
+/// Returns the least seconds that `command` took of `RUNS`, reading `input`.
+fn time(command: &str, input: &Path) -> f64 {
+    (0..RUNS)
+        .map(|_| {
+            let start = Instant::now();
+            let status = Command::new("sh")
+                .arg("-c")
+                .arg(command)
+                .env("DSRS", env!("CARGO_BIN_EXE_dsrs"))
+                .stdin(File::open(input).expect("corpus opened"))
+                .stdout(Stdio::null())
+                .status()
+                .expect("command ran");
+            assert!(status.success(), "{} failed", command);
+            start.elapsed().as_secs_f64()
+        })
+        .fold(f64::INFINITY, f64::min)
+}
+
+fn main() {
+    let sizes: Vec<u64> = env::var("CLI_BENCH_MB")
+        .unwrap_or_else(|_| "64,512".to_string())
+        .split(',')
+        .map(|mb| mb.trim().parse().expect("CLI_BENCH_MB"))
+        .collect();
+    let dir = Path::new(env!("CARGO_MANIFEST_DIR"))
+        .join("target")
+        .join("cli-bench");
+    fs::create_dir_all(&dir).expect("corpus directory created");
+
+    println!("mb\tskew\tcommand\tseconds\tgb_per_s");
+    for &mb in &sizes {
+        for &s in SKEWS.iter() {
+            let input = corpus(&dir, mb, s);
+            let bytes = fs::metadata(&input).expect("corpus exists").len();
+            for (name, command) in COMMANDS.iter() {
+                let seconds = time(command, &input);
+                println!(
+                    "{}\t{}\t{}\t{:.3}\t{:.3}",
+                    mb,
+                    s,
+                    name,
+                    seconds,
+                    bytes as f64 / seconds / 1e9
+                );
+            }
+        }
+    }
+}
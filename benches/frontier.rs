@@ -0,0 +1,172 @@
+//! Accuracy against throughput of the distinct counting sketches, to pick
+//! an algorithm and `lg_k` by measurement rather than by default. For CPC,
+//! theta and each HLL type at several `lg_k`, distinct keys are fed up to
+//! each cardinality from 1e3 to `FRONTIER_MAX_N` (1e9 by default), and the
+//! mean time per update, the heap bytes of the sketch and the largest
+//! relative error of `FRONTIER_TRIALS` (3 by default) independent trials
+//! are printed as a table, one row per configuration and cardinality.
+//!
+//! Each trial is one pass over its keys, checked at each cardinality on
+//! the way, but the full default run still makes tens of billions of
+//! updates and takes a while, so it is not one of the criterion benches.
+
+use std::env;
+use std::time::{Duration, Instant};
+
+use dsrs::{CpcSketch, HllSketch, HllType, ThetaResizeFactor, ThetaSketch};
+
+const LG_KS: [u8; 4] = [10, 12, 14, 16];
+
+/// Keys are updated in batches of this many, as `dsrs` does.
+const BATCH: u64 = 4096;
+
+/// A distinct counting sketch, updated a batch of keys at a time so that
+/// the dynamic dispatch here is not what is measured.
+trait Counter {
+    fn update_batch(&mut self, keys: &[u64]);
+    fn estimate(&self) -> f64;
+    fn memory_usage_bytes(&self) -> usize;
+}
+
+impl Counter for CpcSketch {
+    fn update_batch(&mut self, keys: &[u64]) {
+        self.update_u64_batch(keys)
+    }
+    fn estimate(&self) -> f64 {
+        CpcSketch::estimate(self)
+    }
+    fn memory_usage_bytes(&self) -> usize {
+        CpcSketch::memory_usage_bytes(self)
+    }
+}
+
+impl Counter for ThetaSketch {
+    fn update_batch(&mut self, keys: &[u64]) {
+        self.update_u64_batch(keys)
+    }
+    fn estimate(&self) -> f64 {
+        ThetaSketch::estimate(self)
+    }
+    fn memory_usage_bytes(&self) -> usize {
+        ThetaSketch::memory_usage_bytes(self)
+    }
+}
+
+impl Counter for HllSketch {
+    fn update_batch(&mut self, keys: &[u64]) {
+        self.update_u64_batch(keys)
+    }
+    fn estimate(&self) -> f64 {
+        HllSketch::estimate(self)
+    }
+    fn memory_usage_bytes(&self) -> usize {
+        HllSketch::memory_usage_bytes(self)
+    }
+}
+
+struct Config {
+    algo: &'static str,
+    lg_k: u8,
+    new: Box<dyn Fn() -> Box<dyn Counter>>,
+}
+
+fn configs() -> Vec<Config> {
+    let mut configs = Vec::new();
+    for lg_k in LG_KS.iter().copied() {
+        configs.push(Config {
+            algo: "cpc",
+            lg_k,
+            new: Box::new(move || Box::new(CpcSketch::with_lg_k(lg_k).unwrap())),
+        });
+        configs.push(Config {
+            algo: "theta",
+            lg_k,
+            new: Box::new(move || {
+                Box::new(ThetaSketch::with_params(lg_k, ThetaResizeFactor::X8, 1.0).unwrap())
+            }),
+        });
+        let hlls = [
+            ("hll4", HllType::Hll4),
+            ("hll6", HllType::Hll6),
+            ("hll8", HllType::Hll8),
+        ];
+        for (algo, tgt_type) in hlls.iter().copied() {
+            configs.push(Config {
+                algo,
+                lg_k,
+                new: Box::new(move || Box::new(HllSketch::new(lg_k, tgt_type).unwrap())),
+            });
+        }
+    }
+    configs
+}
+
+/// What was measured of a configuration at one cardinality, over all
+/// trials so far.
+#[derive(Default)]
+struct Point {
+    updating: Duration,
+    updates: u64,
+    bytes: usize,
+    max_relerr: f64,
+}
+
+/// Feeds one trial's distinct keys to a sketch made by `config`, adding
+/// what is measured at each of `cardinalities`, in increasing order, to
+/// the matching `points`.
+fn run_trial(config: &Config, trial: u64, cardinalities: &[u64], points: &mut [Point]) {
+    let mut sketch = (config.new)();
+    // trials get disjoint keys, so their errors are independent
+    let mut next = trial << 40;
+    let mut updating = Duration::default();
+    let mut keys = Vec::with_capacity(BATCH as usize);
+    for (&n, point) in cardinalities.iter().zip(points.iter_mut()) {
+        let end = (trial << 40) + n;
+        while next < end {
+            keys.clear();
+            keys.extend(next..end.min(next + BATCH));
+            next += keys.len() as u64;
+            let start = Instant::now();
+            sketch.update_batch(&keys);
+            updating += start.elapsed();
+        }
+        let relerr = (sketch.estimate() - n as f64).abs() / n as f64;
+        point.updating += updating;
+        point.updates += n;
+        point.bytes = point.bytes.max(sketch.memory_usage_bytes());
+        point.max_relerr = point.max_relerr.max(relerr);
+    }
+}
+
+fn env_or(name: &str, default: u64) -> u64 {
+    env::var(name)
+        .map(|v| v.parse::<f64>().expect(name) as u64)
+        .unwrap_or(default)
+}
+
+fn main() {
+    let max_n = env_or("FRONTIER_MAX_N", 1_000_000_000);
+    let trials = env_or("FRONTIER_TRIALS", 3);
+    let cardinalities: Vec<u64> = std::iter::successors(Some(1000), |n| Some(n * 10))
+        .take_while(|&n| n <= max_n)
+        .collect();
+
+    println!("algo\tlg_k\tn\tns_per_update\tbytes\tmax_relerr");
+    for config in configs() {
+        let mut points: Vec<Point> = cardinalities.iter().map(|_| Point::default()).collect();
+        for trial in 0..trials {
+            run_trial(&config, trial, &cardinalities, &mut points);
+        }
+        for (n, point) in cardinalities.iter().zip(points.iter()) {
+            println!(
+                "{}\t{}\t{}\t{:.2}\t{}\t{:.5}",
+                config.algo,
+                config.lg_k,
+                n,
+                point.updating.as_nanos() as f64 / point.updates as f64,
+                point.bytes,
+                point.max_relerr
+            );
+        }
+    }
+}
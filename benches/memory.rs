@@ -0,0 +1,213 @@
+//! Heap footprint of the distinct counting sketches at each cardinality,
+//! for sizing keyed jobs. Needs the allocations counted, so run it with
+//! `cargo bench --bench memory --features alloc-stats`.
+//!
+//! For CPC, theta and each HLL type, a sketch of `n` distinct keys is
+//! built for `n` from 1 to 1e7, and read back from its compact
+//! serialization, and `MERGE_INPUTS` such serializations are merged. Each
+//! is printed as one JSON object per line, e.g.
+//!
+//! ```text
+//! {"algo":"cpc","lg_k":11,"n":1000,"form":"update","live_bytes":..,"peak_bytes":..,"reported_bytes":..,"serialized_bytes":..}
+//! ```
+//!
+//! where `form` is `update` for the sketch as built, `compact` for the one
+//! read back and `merge` for the union's result. `live_bytes` are the
+//! bytes its allocations still hold once it is done, `peak_bytes` the most
+//! they held on the way, both as counted by the counting allocator;
+//! `reported_bytes` is its own `memory_usage_bytes()`, and
+//! `serialized_bytes` the size of its serialization, or null for a theta
+//! sketch being updated, which has none.
+
+use std::any::Any;
+use std::ops::Range;
+
+use dsrs::alloc_stats;
+use dsrs::{
+    CpcSketch, CpcUnion, HllSketch, HllType, HllUnion, StaticThetaSketch, ThetaSketch, ThetaUnion,
+};
+
+/// Sketches merged for each `merge` row, each of `n` keys of their own.
+const MERGE_INPUTS: u64 = 16;
+
+const HLL_LG_K: u8 = 12;
+
+/// A sketch kept alive while its footprint is measured, with what it
+/// reports of itself.
+struct Held {
+    _sketch: Box<dyn Any>,
+    reported_bytes: usize,
+    serialized_bytes: Option<usize>,
+}
+
+struct Algo {
+    name: &'static str,
+    lg_k: u8,
+    /// Index of its family in [`alloc_stats::FAMILIES`].
+    family: usize,
+    /// Builds the update form of a sketch of the keys.
+    build: Box<dyn Fn(Range<u64>) -> Held>,
+    /// Serializes the keys' sketch compactly, as it is stored and merged.
+    compact: Box<dyn Fn(Range<u64>) -> Vec<u8>>,
+    /// Reads back a compact serialization.
+    read: Box<dyn Fn(&[u8]) -> Held>,
+    /// Merges compact serializations into one sketch.
+    merge: Box<dyn Fn(&[Vec<u8>]) -> Held>,
+}
+
+fn held<T: 'static>(sketch: T, reported_bytes: usize, serialized: Option<&[u8]>) -> Held {
+    Held {
+        _sketch: Box::new(sketch),
+        reported_bytes,
+        serialized_bytes: serialized.map(<[u8]>::len),
+    }
+}
+
+fn cpc() -> Algo {
+    let build = |keys: Range<u64>| {
+        let mut sketch = CpcSketch::new();
+        keys.for_each(|key| sketch.update_u64(key));
+        sketch
+    };
+    Algo {
+        name: "cpc",
+        lg_k: CpcSketch::DEFAULT_LG_K,
+        family: 0,
+        build: Box::new(move |keys| {
+            let sketch = build(keys);
+            let bytes = sketch.memory_usage_bytes();
+            let serialized = sketch.serialize();
+            held(sketch, bytes, Some(serialized.as_ref()))
+        }),
+        compact: Box::new(move |keys| build(keys).serialize().as_ref().to_vec()),
+        read: Box::new(|buf| {
+            let sketch = CpcSketch::deserialize(buf).unwrap();
+            let bytes = sketch.memory_usage_bytes();
+            held(sketch, bytes, Some(buf))
+        }),
+        merge: Box::new(|bufs| {
+            let mut union = CpcUnion::new();
+            bufs.iter()
+                .for_each(|buf| union.merge_serialized(buf).unwrap());
+            let sketch = union.sketch();
+            let bytes = sketch.memory_usage_bytes();
+            let serialized = sketch.serialize();
+            held(sketch, bytes, Some(serialized.as_ref()))
+        }),
+    }
+}
+
+fn theta() -> Algo {
+    let build = |keys: Range<u64>| {
+        let mut sketch = ThetaSketch::new();
+        keys.for_each(|key| sketch.update_u64(key));
+        sketch
+    };
+    Algo {
+        name: "theta",
+        lg_k: ThetaSketch::DEFAULT_LG_K,
+        family: 1,
+        build: Box::new(move |keys| {
+            let sketch = build(keys);
+            let bytes = sketch.memory_usage_bytes();
+            held(sketch, bytes, None)
+        }),
+        compact: Box::new(move |keys| build(keys).as_static().serialize().as_ref().to_vec()),
+        read: Box::new(|buf| {
+            let sketch = StaticThetaSketch::deserialize(buf).unwrap();
+            let bytes = sketch.memory_usage_bytes();
+            held(sketch, bytes, Some(buf))
+        }),
+        merge: Box::new(|bufs| {
+            let mut union = ThetaUnion::new();
+            bufs.iter()
+                .for_each(|buf| union.merge_serialized(buf).unwrap());
+            let sketch = union.into_sketch();
+            let bytes = sketch.memory_usage_bytes();
+            let serialized = sketch.serialize();
+            held(sketch, bytes, Some(serialized.as_ref()))
+        }),
+    }
+}
+
+fn hll(name: &'static str, tgt_type: HllType) -> Algo {
+    let build = move |keys: Range<u64>| {
+        let mut sketch = HllSketch::new(HLL_LG_K, tgt_type).unwrap();
+        keys.for_each(|key| sketch.update_u64(key));
+        sketch
+    };
+    Algo {
+        name,
+        lg_k: HLL_LG_K,
+        family: 2,
+        build: Box::new(move |keys| {
+            let sketch = build(keys);
+            let bytes = sketch.memory_usage_bytes();
+            let serialized = sketch.serialize_updatable();
+            held(sketch, bytes, Some(serialized.as_ref()))
+        }),
+        compact: Box::new(move |keys| build(keys).serialize().as_ref().to_vec()),
+        read: Box::new(|buf| {
+            let sketch = HllSketch::deserialize(buf).unwrap();
+            let bytes = sketch.memory_usage_bytes();
+            held(sketch, bytes, Some(buf))
+        }),
+        merge: Box::new(move |bufs| {
+            let mut union = HllUnion::new(HLL_LG_K).unwrap();
+            bufs.iter()
+                .for_each(|buf| union.merge_serialized(buf).unwrap());
+            let sketch = union.sketch(tgt_type);
+            let bytes = sketch.memory_usage_bytes();
+            let serialized = sketch.serialize();
+            held(sketch, bytes, Some(serialized.as_ref()))
+        }),
+    }
+}
+
+/// Runs `f` and prints the footprint of what it holds, as counted for
+/// `algo`'s family on this thread.
+fn report(algo: &Algo, n: u64, form: &str, f: impl FnOnce() -> Held) {
+    alloc_stats::reset_peak_live_bytes();
+    let live_before = alloc_stats::live_bytes(algo.family);
+    let peak_before = alloc_stats::peak_live_bytes(algo.family);
+    let held = f();
+    let live_bytes = alloc_stats::live_bytes(algo.family) - live_before;
+    let peak_bytes = alloc_stats::peak_live_bytes(algo.family) - peak_before;
+    let serialized_bytes = held
+        .serialized_bytes
+        .map_or("null".to_string(), |b| b.to_string());
+    println!(
+        "{{\"algo\":\"{}\",\"lg_k\":{},\"n\":{},\"form\":\"{}\",\"live_bytes\":{},\"peak_bytes\":{},\"reported_bytes\":{},\"serialized_bytes\":{}}}",
+        algo.name, algo.lg_k, n, form, live_bytes, peak_bytes, held.reported_bytes, serialized_bytes
+    );
+}
+
+fn main() {
+    assert!(
+        alloc_stats::ENABLED,
+        "run with --features alloc-stats to count allocations"
+    );
+    let algos = [
+        cpc(),
+        theta(),
+        hll("hll4", HllType::Hll4),
+        hll("hll6", HllType::Hll6),
+        hll("hll8", HllType::Hll8),
+    ];
+    let cardinalities =
+        std::iter::successors(Some(1), |n| Some(n * 10)).take_while(|&n| n <= 10_000_000);
+    for n in cardinalities {
+        for algo in algos.iter() {
+            report(algo, n, "update", || (algo.build)(0..n));
+            let compact = (algo.compact)(0..n);
+            report(algo, n, "compact", || (algo.read)(&compact));
+            drop(compact);
+            // inputs are serialized outside the measurement, as they
+            // would arrive to be merged
+            let inputs: Vec<Vec<u8>> = (0..MERGE_INPUTS)
+                .map(|i| (algo.compact)(i * n..(i + 1) * n))
+                .collect();
+            report(algo, n, "merge", || (algo.merge)(&inputs));
+        }
+    }
+}
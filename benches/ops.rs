@@ -0,0 +1,425 @@
+//! Per-operation throughput of every bridged sketch, reported in elements
+//! per second, to catch regressions in the wrappers and the C++ underneath.
+
+use criterion::{
+    criterion_group, criterion_main, BatchSize, BenchmarkId, Criterion, SamplingMode, Throughput,
+};
+use rand::prelude::*;
+
+use dsrs::{
+    seed_compaction_rng, CpcSketch, CpcUnion, HhSketch, HllSketch, HllType, HllUnion,
+    KllDoubleSketch, KllFloatSketch, NativeHhSketch, ReqSketch, StaticThetaSketch,
+    ThetaIntersection, ThetaSketch, ThetaUnion,
+};
+
+/// Sizes of the inputs to each benchmark, in elements.
+const SIZES: [u64; 3] = [1000, 100 * 1000, 1000 * 1000];
+
+/// Text-like lines of 20 to 120 bytes, packed into one buffer as for
+/// `update_batch`, drawn uniformly from `distinct` possible lines.
+struct Lines {
+    buf: Vec<u8>,
+    ends: Vec<usize>,
+}
+
+impl Lines {
+    fn uniform(n: u64, distinct: u64) -> Self {
+        let mut rng = StdRng::seed_from_u64(1234);
+        Self::from_ids((0..n).map(|_| rng.gen_range(0..distinct)))
+    }
+
+    /// Lines whose popularity is skewed like a power law, as heavy hitter
+    /// inputs usually are.
+    fn skewed(n: u64, distinct: u64) -> Self {
+        let mut rng = StdRng::seed_from_u64(1234);
+        Self::from_ids((0..n).map(|_| {
+            let u: f64 = rng.gen();
+            (u.powi(4) * distinct as f64) as u64
+        }))
+    }
+
+    fn from_ids(ids: impl Iterator<Item = u64>) -> Self {
+        let mut buf = Vec::new();
+        let mut ends = Vec::new();
+        for id in ids {
+            let mut rng = StdRng::seed_from_u64(id);
+            let len = rng.gen_range(20..120);
+            buf.extend((0..len).map(|_| rng.gen_range(b' '..=b'~')));
+            ends.push(buf.len());
+        }
+        Self { buf, ends }
+    }
+
+    fn iter(&self) -> impl Iterator<Item = &[u8]> {
+        let starts = std::iter::once(0).chain(self.ends.iter().copied());
+        starts
+            .zip(self.ends.iter())
+            .map(move |(s, &e)| &self.buf[s..e])
+    }
+}
+
+/// Latency-like values, log-normally distributed with a long right tail.
+fn latencies(n: u64) -> Vec<f32> {
+    let mut rng = StdRng::seed_from_u64(1234);
+    (0..n)
+        .map(|_| {
+            // Box-Muller for a standard normal
+            let (u, v): (f64, f64) = (rng.gen(), rng.gen());
+            let z = (-2.0 * (1.0 - u).ln()).sqrt() * (std::f64::consts::TAU * v).cos();
+            (z * 0.75 + 3.0).exp() as f32
+        })
+        .collect()
+}
+
+/// The ranks a tail-latency report asks for.
+const FRACTIONS: [f64; 5] = [0.5, 0.9, 0.99, 0.999, 0.9999];
+
+fn theta_of(keys: impl Iterator<Item = u64>) -> StaticThetaSketch {
+    let mut theta = ThetaSketch::new();
+    keys.for_each(|key| theta.update_u64(key));
+    theta.as_static()
+}
+
+fn bench_updates(c: &mut Criterion) {
+    let mut group = c.benchmark_group("update");
+    group.sampling_mode(SamplingMode::Flat);
+    group.sample_size(10);
+    for sz in SIZES.iter().copied() {
+        group.throughput(Throughput::Elements(sz));
+        let keys: Vec<u64> = (0..sz).collect();
+        let lines = Lines::uniform(sz, sz / 2);
+        group.bench_with_input(BenchmarkId::new("cpc-u64", sz), &keys, |b, keys| {
+            b.iter(|| {
+                let mut cpc = CpcSketch::new();
+                keys.iter().for_each(|&k| cpc.update_u64(k));
+                cpc
+            })
+        });
+        group.bench_with_input(BenchmarkId::new("cpc-lines", sz), &lines, |b, lines| {
+            b.iter(|| {
+                let mut cpc = CpcSketch::new();
+                lines.iter().for_each(|line| cpc.update(line));
+                cpc
+            })
+        });
+        group.bench_with_input(BenchmarkId::new("cpc-batch", sz), &lines, |b, lines| {
+            b.iter(|| {
+                let mut cpc = CpcSketch::new();
+                cpc.update_batch(&lines.buf, &lines.ends);
+                cpc
+            })
+        });
+        group.bench_with_input(BenchmarkId::new("theta-u64", sz), &keys, |b, keys| {
+            b.iter(|| {
+                let mut theta = ThetaSketch::new();
+                keys.iter().for_each(|&k| theta.update_u64(k));
+                theta
+            })
+        });
+        group.bench_with_input(BenchmarkId::new("theta-lines", sz), &lines, |b, lines| {
+            b.iter(|| {
+                let mut theta = ThetaSketch::new();
+                lines.iter().for_each(|line| theta.update(line));
+                theta
+            })
+        });
+        group.bench_with_input(BenchmarkId::new("theta-batch", sz), &lines, |b, lines| {
+            b.iter(|| {
+                let mut theta = ThetaSketch::new();
+                theta.update_batch(&lines.buf, &lines.ends);
+                theta
+            })
+        });
+        for &(name, tgt_type) in &[("hll4-lines", HllType::Hll4), ("hll8-lines", HllType::Hll8)] {
+            group.bench_with_input(BenchmarkId::new(name, sz), &lines, |b, lines| {
+                b.iter(|| {
+                    let mut hll = HllSketch::new(11, tgt_type).unwrap();
+                    lines.iter().for_each(|line| hll.update(line));
+                    hll
+                })
+            });
+        }
+    }
+    group.finish();
+}
+
+fn bench_set_ops(c: &mut Criterion) {
+    let mut group = c.benchmark_group("set-ops");
+    group.sampling_mode(SamplingMode::Flat);
+    group.sample_size(10);
+    // Each op combines 16 sketches; throughput counts sketches combined.
+    let nsketches = 16;
+    group.throughput(Throughput::Elements(nsketches));
+    for sz in SIZES.iter().copied() {
+        // half-overlapping key ranges
+        let thetas: Vec<_> = (0..nsketches)
+            .map(|i| theta_of((i * sz / 2)..(i * sz / 2 + sz)))
+            .collect();
+        group.bench_with_input(BenchmarkId::new("theta-union", sz), &thetas, |b, thetas| {
+            b.iter_batched(
+                || thetas.clone(),
+                |thetas| {
+                    let mut union = ThetaUnion::new();
+                    thetas.into_iter().for_each(|s| union.merge(s));
+                    union.sketch()
+                },
+                BatchSize::SmallInput,
+            )
+        });
+        group.bench_with_input(
+            BenchmarkId::new("theta-intersection", sz),
+            &thetas,
+            |b, thetas| {
+                b.iter_batched(
+                    || thetas.clone(),
+                    |thetas| {
+                        let mut intersection = ThetaIntersection::new();
+                        thetas.into_iter().for_each(|s| intersection.merge(s));
+                        intersection.sketch()
+                    },
+                    BatchSize::SmallInput,
+                )
+            },
+        );
+        group.bench_with_input(
+            BenchmarkId::new("theta-set-difference", sz),
+            &thetas,
+            |b, thetas| {
+                b.iter_batched(
+                    || thetas[0].clone(),
+                    |mut diff| {
+                        thetas[1..].iter().for_each(|s| diff.set_difference(s));
+                        diff
+                    },
+                    BatchSize::SmallInput,
+                )
+            },
+        );
+
+        let cpcs: Vec<_> = (0..nsketches)
+            .map(|i| {
+                let mut cpc = CpcSketch::new();
+                ((i * sz / 2)..(i * sz / 2 + sz)).for_each(|k| cpc.update_u64(k));
+                cpc.serialize().as_ref().to_vec()
+            })
+            .collect();
+        group.bench_with_input(BenchmarkId::new("cpc-union", sz), &cpcs, |b, cpcs| {
+            b.iter_batched(
+                || {
+                    cpcs.iter()
+                        .map(|bytes| CpcSketch::deserialize(bytes).unwrap())
+                        .collect::<Vec<_>>()
+                },
+                |cpcs| {
+                    let mut union = CpcUnion::new();
+                    cpcs.into_iter().for_each(|s| union.merge(s));
+                    union.sketch()
+                },
+                BatchSize::SmallInput,
+            )
+        });
+        group.bench_with_input(BenchmarkId::new("cpc-union-many", sz), &cpcs, |b, cpcs| {
+            let slices: Vec<&[u8]> = cpcs.iter().map(|bytes| bytes.as_slice()).collect();
+            b.iter(|| CpcUnion::union_many(&slices, 4).unwrap())
+        });
+
+        let hlls: Vec<_> = (0..nsketches)
+            .map(|i| {
+                let mut hll = HllSketch::new(11, HllType::Hll4).unwrap();
+                ((i * sz / 2)..(i * sz / 2 + sz)).for_each(|k| hll.update_u64(k));
+                hll.serialize().as_ref().to_vec()
+            })
+            .collect();
+        group.bench_with_input(BenchmarkId::new("hll-union", sz), &hlls, |b, hlls| {
+            b.iter_batched(
+                || {
+                    hlls.iter()
+                        .map(|bytes| HllSketch::deserialize(bytes).unwrap())
+                        .collect::<Vec<_>>()
+                },
+                |hlls| {
+                    let mut union = HllUnion::new(11).unwrap();
+                    hlls.into_iter().for_each(|s| union.merge(s));
+                    union.sketch(HllType::Hll4)
+                },
+                BatchSize::SmallInput,
+            )
+        });
+    }
+    group.finish();
+}
+
+fn bench_hh(c: &mut Criterion) {
+    let mut group = c.benchmark_group("heavy-hitters");
+    group.sampling_mode(SamplingMode::Flat);
+    group.sample_size(10);
+    let lg2_k = 10;
+    for sz in SIZES.iter().copied() {
+        group.throughput(Throughput::Elements(sz));
+        let lines = Lines::skewed(sz, sz / 2);
+        group.bench_with_input(BenchmarkId::new("hh-update", sz), &lines, |b, lines| {
+            b.iter(|| {
+                let mut hh = HhSketch::new(lg2_k);
+                lines.iter().for_each(|line| hh.update(line, 1));
+                hh
+            })
+        });
+        group.bench_with_input(
+            BenchmarkId::new("native-hh-update", sz),
+            &lines,
+            |b, lines| {
+                b.iter(|| {
+                    let mut hh = NativeHhSketch::new(lg2_k);
+                    lines.iter().for_each(|line| hh.update(line, 1));
+                    hh
+                })
+            },
+        );
+
+        let mut hh = HhSketch::new(lg2_k);
+        let mut native = NativeHhSketch::new(lg2_k);
+        for line in lines.iter() {
+            hh.update(line, 1);
+            native.update(line, 1);
+        }
+        // throughput here counts the stream the estimate summarizes
+        group.bench_function(BenchmarkId::new("hh-estimate", sz), |b| {
+            b.iter(|| hh.estimate_no_fn().len())
+        });
+        group.bench_function(BenchmarkId::new("native-hh-estimate", sz), |b| {
+            b.iter(|| native.estimate_no_fn().len())
+        });
+    }
+    group.finish();
+}
+
+fn bench_quantiles(c: &mut Criterion) {
+    // the same compactions every run
+    seed_compaction_rng(Some(1234));
+    let mut group = c.benchmark_group("quantiles");
+    group.sampling_mode(SamplingMode::Flat);
+    group.sample_size(10);
+    for sz in SIZES.iter().copied() {
+        group.throughput(Throughput::Elements(sz));
+        let floats = latencies(sz);
+        let doubles: Vec<f64> = floats.iter().map(|&x| f64::from(x)).collect();
+        group.bench_with_input(BenchmarkId::new("kll-f32-batch", sz), &floats, |b, xs| {
+            b.iter(|| {
+                let mut kll = KllFloatSketch::new(200).unwrap();
+                kll.update_batch(xs);
+                kll
+            })
+        });
+        group.bench_with_input(BenchmarkId::new("kll-f64-batch", sz), &doubles, |b, xs| {
+            b.iter(|| {
+                let mut kll = KllDoubleSketch::new(200).unwrap();
+                kll.update_batch(xs);
+                kll
+            })
+        });
+        group.bench_with_input(BenchmarkId::new("req-hra-batch", sz), &floats, |b, xs| {
+            b.iter(|| {
+                let mut req = ReqSketch::new(12, true).unwrap();
+                req.update_batch(xs);
+                req
+            })
+        });
+
+        // Queries go to a fresh copy each time, so any sorting the first
+        // query after an update does is included.
+        let mut kll = KllFloatSketch::new(200).unwrap();
+        kll.update_batch(&floats);
+        let mut req = ReqSketch::new(12, true).unwrap();
+        req.update_batch(&floats);
+        group.throughput(Throughput::Elements(FRACTIONS.len() as u64));
+        group.bench_function(BenchmarkId::new("kll-f32-query", sz), |b| {
+            b.iter_batched(
+                || kll.clone(),
+                |kll| kll.quantiles(&FRACTIONS).unwrap(),
+                BatchSize::SmallInput,
+            )
+        });
+        group.bench_function(BenchmarkId::new("req-hra-query", sz), |b| {
+            b.iter_batched(
+                || req.clone(),
+                |req| req.quantiles(&FRACTIONS).unwrap(),
+                BatchSize::SmallInput,
+            )
+        });
+    }
+    group.finish();
+}
+
+fn bench_serde(c: &mut Criterion) {
+    let mut group = c.benchmark_group("serde");
+    group.sampling_mode(SamplingMode::Flat);
+    group.sample_size(10);
+    // Each iteration round-trips 100 sketches.
+    let nrounds = 100;
+    group.throughput(Throughput::Elements(nrounds));
+    for sz in SIZES.iter().copied() {
+        let mut cpc = CpcSketch::new();
+        let mut hll = HllSketch::new(11, HllType::Hll4).unwrap();
+        (0..sz).for_each(|k| {
+            cpc.update_u64(k);
+            hll.update_u64(k);
+        });
+        let theta = theta_of(0..sz);
+        let floats = latencies(sz);
+        let mut kll = KllFloatSketch::new(200).unwrap();
+        kll.update_batch(&floats);
+        let mut req = ReqSketch::new(12, true).unwrap();
+        req.update_batch(&floats);
+        group.bench_function(BenchmarkId::new("cpc", sz), |b| {
+            b.iter(|| {
+                for _ in 0..nrounds {
+                    let bytes = cpc.serialize();
+                    CpcSketch::deserialize(bytes.as_ref()).unwrap();
+                }
+            })
+        });
+        group.bench_function(BenchmarkId::new("hll", sz), |b| {
+            b.iter(|| {
+                for _ in 0..nrounds {
+                    let bytes = hll.serialize();
+                    HllSketch::deserialize(bytes.as_ref()).unwrap();
+                }
+            })
+        });
+        group.bench_function(BenchmarkId::new("theta", sz), |b| {
+            b.iter(|| {
+                for _ in 0..nrounds {
+                    let bytes = theta.serialize();
+                    StaticThetaSketch::deserialize(bytes.as_ref()).unwrap();
+                }
+            })
+        });
+        group.bench_function(BenchmarkId::new("kll-f32", sz), |b| {
+            b.iter(|| {
+                for _ in 0..nrounds {
+                    let bytes = kll.serialize();
+                    KllFloatSketch::deserialize(bytes.as_ref()).unwrap();
+                }
+            })
+        });
+        group.bench_function(BenchmarkId::new("req-hra", sz), |b| {
+            b.iter(|| {
+                for _ in 0..nrounds {
+                    let bytes = req.serialize();
+                    ReqSketch::deserialize(bytes.as_ref()).unwrap();
+                }
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(
+    benches,
+    bench_updates,
+    bench_set_ops,
+    bench_hh,
+    bench_quantiles,
+    bench_serde
+);
+criterion_main!(benches);
@@ -129,5 +129,29 @@ fn bench_speed(c: &mut Criterion) {
     }
 }
 
-criterion_group!(benches, bench_speed);
+/// Times a full serialize/deserialize round-trip, which is what every
+/// line of `dsrs --merge` input pays for (modulo base64).
+fn bench_serde(c: &mut Criterion) {
+    let mut group = c.benchmark_group("serde-roundtrip");
+    group.sampling_mode(SamplingMode::Flat);
+    group.sample_size(10);
+    for sz in [100, 10 * 1000, 1000 * 1000].iter().copied() {
+        let mut sketch = CpcSketch::new();
+        for key in 0..sz {
+            sketch.update_u64(key);
+        }
+        group.bench_with_input(BenchmarkId::new("dsrs::CpcSketch", sz), &sketch, |b, s| {
+            b.iter(|| {
+                for _ in 0..1000 {
+                    let bytes = s.serialize();
+                    let cpy = CpcSketch::deserialize(bytes.as_ref()).unwrap();
+                    assert_eq!(cpy.estimate(), s.estimate());
+                }
+            })
+        });
+    }
+    group.finish();
+}
+
+criterion_group!(benches, bench_speed, bench_serde);
 criterion_main!(benches);
@@ -1,3 +1,4 @@
+use std::env;
 use std::path::PathBuf;
 
 fn main() {
@@ -5,15 +6,50 @@ fn main() {
     let src = PathBuf::from("src");
     let mut bridge = cxx_build::bridge(src.join("bridge.rs"));
 
-    assert!(bridge.is_flag_supported("-std=c++11").expect("supported"));
+    // the vendored headers only need C++11, which older toolchains are kept
+    // building with; the cpp17 feature is for those that have C++17
+    let std = if env::var_os("CARGO_FEATURE_CPP17").is_some() {
+        "-std=c++17"
+    } else {
+        "-std=c++11"
+    };
+    assert!(bridge.is_flag_supported(std).expect("supported"));
+    // the C++ objects are left as LLVM bitcode for the linker to optimize
+    // together with the Rust code, when that is built with -Clinker-plugin-lto
+    // (see scripts/release-build.sh); the clang must share rustc's LLVM
+    if env::var_os("CARGO_FEATURE_CROSS_LANG_LTO").is_some() {
+        assert!(
+            bridge.get_compiler().is_like_clang(),
+            "cross-lang-lto needs CXX to be clang++"
+        );
+        bridge.flag("-flto=thin");
+    }
+    // see datasketches-cpp/alloc_stats.hpp
+    if env::var_os("CARGO_FEATURE_ALLOC_STATS").is_some() {
+        bridge.define("DSRS_ALLOC_STATS", None);
+    }
+    // see datasketches-cpp/common/include/event_counters.hpp
+    if env::var_os("CARGO_FEATURE_EVENT_STATS").is_some() {
+        bridge.define("DSRS_EVENT_STATS", None);
+    }
     bridge
         .files(&[
+            datasketches.join("key_hash.cpp"),
             datasketches.join("cpc.cpp"),
             datasketches.join("theta.cpp"),
+            datasketches.join("hll.cpp"),
             datasketches.join("hh.cpp"),
+            datasketches.join("count_min.cpp"),
+            datasketches.join("bloom.cpp"),
+            datasketches.join("tuple.cpp"),
+            datasketches.join("kll.cpp"),
+            datasketches.join("req.cpp"),
+            datasketches.join("var_opt.cpp"),
         ])
         .include(datasketches.join("common").join("include"))
-        .flag_if_supported("-std=c++11")
+        // the tuple sketches build on the theta ones, which they include by name
+        .include(datasketches.join("theta").join("include"))
+        .flag_if_supported(std)
         .cpp_link_stdlib("stdc++")
         .static_flag(true)
         .compile("libdatasketches.a");
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <vector>
+
+// When built with DSRS_ALLOC_STATS, the sketches behind the bridge allocate
+// through counting_allocator, which counts the allocations of each family of
+// sketches and the bytes they ask for. Counts are kept per thread and only
+// added to the global ones when the thread exits, so counting costs no
+// shared writes; totals read on one thread take in the threads that have
+// exited, such as the workers of a finished reduction, and the reading one.
+//
+// The bytes still allocated, which are live, are counted the same way. Their
+// peak is only kept for each thread, as the peak of a sum across threads
+// would need the shared writes; measured on a single thread, such as around
+// a merge, it is the peak of the sketches it builds.
+//
+// Without DSRS_ALLOC_STATS, sketch_allocator is just the allocator it wraps
+// and the totals stay 0.
+enum class alloc_family : uint8_t {
+  CPC,
+  THETA,
+  HLL,
+  KLL,
+  REQ,
+  HH,
+};
+
+static const size_t NUM_ALLOC_FAMILIES = static_cast<size_t>(alloc_family::HH) + 1;
+
+namespace alloc_stats_detail {
+
+struct global_counts {
+  std::atomic<uint64_t> allocations[NUM_ALLOC_FAMILIES];
+  std::atomic<uint64_t> bytes[NUM_ALLOC_FAMILIES];
+  std::atomic<int64_t> live_bytes[NUM_ALLOC_FAMILIES];
+};
+
+// zero-initialized, as it has static storage
+inline global_counts& global() {
+  static global_counts counts;
+  return counts;
+}
+
+struct thread_counts {
+  uint64_t allocations[NUM_ALLOC_FAMILIES] = {};
+  uint64_t bytes[NUM_ALLOC_FAMILIES] = {};
+  // negative when this thread frees more than it allocated
+  int64_t live_bytes[NUM_ALLOC_FAMILIES] = {};
+  int64_t peak_live_bytes[NUM_ALLOC_FAMILIES] = {};
+
+  ~thread_counts() {
+    global_counts& to = global();
+    for (size_t i = 0; i < NUM_ALLOC_FAMILIES; ++i) {
+      to.allocations[i].fetch_add(allocations[i], std::memory_order_relaxed);
+      to.bytes[i].fetch_add(bytes[i], std::memory_order_relaxed);
+      to.live_bytes[i].fetch_add(live_bytes[i], std::memory_order_relaxed);
+    }
+  }
+};
+
+inline thread_counts& local() {
+  static thread_local thread_counts counts;
+  return counts;
+}
+
+} // namespace alloc_stats_detail
+
+inline void record_allocation(alloc_family family, size_t bytes) {
+  alloc_stats_detail::thread_counts& counts = alloc_stats_detail::local();
+  counts.allocations[static_cast<size_t>(family)] += 1;
+  counts.bytes[static_cast<size_t>(family)] += bytes;
+  int64_t& live = counts.live_bytes[static_cast<size_t>(family)];
+  live += static_cast<int64_t>(bytes);
+  int64_t& peak = counts.peak_live_bytes[static_cast<size_t>(family)];
+  if (live > peak) peak = live;
+}
+
+inline void record_deallocation(alloc_family family, size_t bytes) {
+  alloc_stats_detail::local().live_bytes[static_cast<size_t>(family)] -= static_cast<int64_t>(bytes);
+}
+
+// Allocations made by sketches of family so far, by exited threads and this
+// one. Families past the last one have none.
+inline uint64_t allocations_of(uint8_t family) {
+  if (family >= NUM_ALLOC_FAMILIES) return 0;
+  return alloc_stats_detail::global().allocations[family].load(std::memory_order_relaxed)
+      + alloc_stats_detail::local().allocations[family];
+}
+
+// Bytes asked for by those allocations.
+inline uint64_t allocated_bytes_of(uint8_t family) {
+  if (family >= NUM_ALLOC_FAMILIES) return 0;
+  return alloc_stats_detail::global().bytes[family].load(std::memory_order_relaxed)
+      + alloc_stats_detail::local().bytes[family];
+}
+
+// Bytes allocated by sketches of family and not yet freed, by exited threads
+// and this one.
+inline int64_t live_bytes_of(uint8_t family) {
+  if (family >= NUM_ALLOC_FAMILIES) return 0;
+  return alloc_stats_detail::global().live_bytes[family].load(std::memory_order_relaxed)
+      + alloc_stats_detail::local().live_bytes[family];
+}
+
+// The most bytes this thread has had live for family since the last
+// reset_peak_live_bytes() on it, counting only its own allocations and frees.
+inline int64_t peak_live_bytes_of(uint8_t family) {
+  if (family >= NUM_ALLOC_FAMILIES) return 0;
+  return alloc_stats_detail::local().peak_live_bytes[family];
+}
+
+// Restarts the peaks of this thread from the bytes it has live now.
+inline void reset_peak_live_bytes() {
+  alloc_stats_detail::thread_counts& counts = alloc_stats_detail::local();
+  for (size_t i = 0; i < NUM_ALLOC_FAMILIES; ++i) counts.peak_live_bytes[i] = counts.live_bytes[i];
+}
+
+// Allocator that counts each allocation as one of family before handing it
+// to Base, which must be stateless.
+template<typename T, alloc_family F, template<typename> class Base = std::allocator>
+class counting_allocator {
+public:
+  using value_type = T;
+
+  // needed, as F keeps the default rebind from applying
+  template<typename U>
+  struct rebind {
+    using other = counting_allocator<U, F, Base>;
+  };
+
+  counting_allocator() noexcept {}
+  template<typename U>
+  counting_allocator(const counting_allocator<U, F, Base>&) noexcept {}
+
+  T* allocate(size_t n) {
+    record_allocation(F, n * sizeof(T));
+    return Base<T>().allocate(n);
+  }
+
+  void deallocate(T* p, size_t n) {
+    record_deallocation(F, n * sizeof(T));
+    Base<T>().deallocate(p, n);
+  }
+
+  template<typename U>
+  bool operator==(const counting_allocator<U, F, Base>&) const noexcept {
+    return true;
+  }
+  template<typename U>
+  bool operator!=(const counting_allocator<U, F, Base>&) const noexcept {
+    return false;
+  }
+};
+
+// Moves a vector returned by a sketch, such as its serialized bytes, into one
+// with the default allocator, which takes a copy only if it was allocated by a
+// counting_allocator.
+template<typename T>
+std::vector<T> into_std_vector(std::vector<T>&& v) {
+  return std::move(v);
+}
+template<typename T, typename A>
+std::vector<T> into_std_vector(std::vector<T, A>&& v) {
+  return std::vector<T>(v.begin(), v.end());
+}
+
+#ifdef DSRS_ALLOC_STATS
+template<typename T, alloc_family F, template<typename> class Base = std::allocator>
+using sketch_allocator = counting_allocator<T, F, Base>;
+#else
+template<typename T, alloc_family F, template<typename> class Base = std::allocator>
+using sketch_allocator = Base<T>;
+#endif
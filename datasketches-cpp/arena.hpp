@@ -0,0 +1,155 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <new>
+#include <type_traits>
+#include <vector>
+
+#include "alloc_stats.hpp"
+#include "huge_pages.hpp"
+
+// A pool for the many small, long-lived buffers of keyed sketches. Requests are
+// rounded up to a power-of-two size class and carved out of large blocks;
+// deallocated chunks go on a free list per class for reuse by later requests of
+// the same class, e.g. when a sketch grows its table. Blocks are only returned
+// to the system all at once, on destruction of the arena.
+//
+// Requests larger than the biggest size class go straight to the system, and
+// those of huge_pages.hpp's size to huge_pages_allocate().
+class arena {
+public:
+  arena():
+    cur_{nullptr}, left_{0}, free_{} {
+  }
+
+  arena(const arena&) = delete;
+  arena& operator=(const arena&) = delete;
+
+  ~arena() {
+    for (void* block : blocks_) std::free(block);
+  }
+
+  void* allocate(size_t bytes) {
+    if (bytes >= HUGE_PAGE_SIZE) return huge_pages_allocate(bytes);
+    if (bytes > MAX_CHUNK) return ::operator new(bytes);
+    const unsigned cls = size_class(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_[cls] != nullptr) {
+      free_chunk* chunk = free_[cls];
+      free_[cls] = chunk->next;
+      return chunk;
+    }
+    const size_t chunk_bytes = MIN_CHUNK << cls;
+    if (left_ < chunk_bytes) {
+      // The tail of the old block is given up; it is less than MAX_CHUNK.
+      cur_ = static_cast<char*>(std::malloc(BLOCK_SIZE));
+      if (cur_ == nullptr) throw std::bad_alloc();
+      blocks_.push_back(cur_);
+      left_ = BLOCK_SIZE;
+    }
+    void* p = cur_;
+    cur_ += chunk_bytes;
+    left_ -= chunk_bytes;
+    return p;
+  }
+
+  void deallocate(void* p, size_t bytes) {
+    if (bytes >= HUGE_PAGE_SIZE) {
+      huge_pages_deallocate(p, bytes);
+      return;
+    }
+    if (bytes > MAX_CHUNK) {
+      ::operator delete(p);
+      return;
+    }
+    const unsigned cls = size_class(bytes);
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_chunk* chunk = static_cast<free_chunk*>(p);
+    chunk->next = free_[cls];
+    free_[cls] = chunk;
+  }
+
+private:
+  struct free_chunk {
+    free_chunk* next;
+  };
+
+  // Chunks are multiples of MIN_CHUNK from a malloc'd block, which keeps them
+  // aligned for any fundamental type.
+  static const size_t MIN_CHUNK = 16;
+  static const unsigned NUM_CLASSES = 13;
+  static const size_t MAX_CHUNK = MIN_CHUNK << (NUM_CLASSES - 1); // 64KB
+  static const size_t BLOCK_SIZE = 1 << 20;
+
+  static unsigned size_class(size_t bytes) {
+    unsigned cls = 0;
+    while ((MIN_CHUNK << cls) < bytes) ++cls;
+    return cls;
+  }
+
+  // Guards everything below. Sketches sharing an arena may be updated and
+  // dropped from different threads, although keyed jobs keep one per thread.
+  std::mutex mutex_;
+  std::vector<void*> blocks_;
+  char* cur_;
+  size_t left_;
+  free_chunk* free_[NUM_CLASSES];
+};
+
+// Allocator over a shared arena. Default-constructed allocators, which is what
+// the sketch templates use for their own internal temporaries, have no arena
+// and fall back to huge_page_allocator.
+template<typename T>
+class arena_allocator {
+public:
+  using value_type = T;
+  using propagate_on_container_copy_assignment = std::true_type;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  arena_allocator() noexcept {}
+  explicit arena_allocator(std::shared_ptr<arena> pool) noexcept:
+    arena_{std::move(pool)} {
+  }
+  template<typename U>
+  arena_allocator(const arena_allocator<U>& other) noexcept:
+    arena_{other.arena_} {
+  }
+
+  T* allocate(size_t n) {
+#ifdef DSRS_ALLOC_STATS
+    // the CPC sketches are the only ones to allocate from arenas
+    record_allocation(alloc_family::CPC, n * sizeof(T));
+#endif
+    if (!arena_) return huge_page_allocator<T>().allocate(n);
+    return static_cast<T*>(arena_->allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+#ifdef DSRS_ALLOC_STATS
+    record_deallocation(alloc_family::CPC, n * sizeof(T));
+#endif
+    if (!arena_) {
+      huge_page_allocator<T>().deallocate(p, n);
+      return;
+    }
+    arena_->deallocate(p, n * sizeof(T));
+  }
+
+  template<typename U>
+  bool operator==(const arena_allocator<U>& other) const noexcept {
+    return arena_ == other.arena_;
+  }
+  template<typename U>
+  bool operator!=(const arena_allocator<U>& other) const noexcept {
+    return arena_ != other.arena_;
+  }
+
+private:
+  template<typename U> friend class arena_allocator;
+  // Keeps the arena alive for as long as any memory from it is.
+  std::shared_ptr<arena> arena_;
+};
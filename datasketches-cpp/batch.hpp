@@ -0,0 +1,16 @@
+#pragma once
+
+#include <cstddef>
+
+#include "rust/cxx.h"
+
+// True if the (already validated) ends of update_bytes_batch describe keys that
+// are all exactly 16 bytes long, so the 16-byte batched hash can be used.
+inline bool all_16_byte_keys(rust::Slice<const size_t> ends) {
+  size_t expected = 0;
+  for (const size_t end : ends) {
+    expected += 16;
+    if (end != expected) return false;
+  }
+  return !ends.empty();
+}
@@ -0,0 +1,75 @@
+#include <cstdint>
+
+#include "rust/cxx.h"
+#include "bloom/include/bloom_filter.hpp"
+
+#include "batch.hpp"
+#include "bloom.hpp"
+
+OpaqueBloomFilter::OpaqueBloomFilter(filter&& inner):
+  inner_{std::move(inner)} {
+}
+
+bool OpaqueBloomFilter::contains(rust::Slice<const uint8_t> buf) const {
+  return this->inner_.contains(buf.data(), buf.size());
+}
+
+void OpaqueBloomFilter::contains_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, rust::Slice<uint8_t> found) const {
+  this->inner_.contains_batch(buf.data(), ends.data(), ends.size(), found.data());
+}
+
+double OpaqueBloomFilter::estimate() const {
+  return this->inner_.get_estimate();
+}
+
+uint8_t OpaqueBloomFilter::get_lg_num_blocks() const {
+  return this->inner_.get_lg_num_blocks();
+}
+
+void OpaqueBloomFilter::update(rust::Slice<const uint8_t> buf) {
+  this->inner_.update(buf.data(), buf.size());
+}
+
+void OpaqueBloomFilter::update_u64(uint64_t value) {
+  this->inner_.update(&value, sizeof(value));
+}
+
+void OpaqueBloomFilter::update_u64_batch(rust::Slice<const uint64_t> values) {
+  this->inner_.update_batch(values.data(), values.size());
+}
+
+void OpaqueBloomFilter::update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends) {
+  if (all_16_byte_keys(ends)) {
+    this->inner_.update_batch_16(buf.data(), ends.size());
+    return;
+  }
+  this->inner_.update_batch(buf.data(), ends.data(), ends.size());
+}
+
+void OpaqueBloomFilter::merge(const OpaqueBloomFilter& other) {
+  this->inner_.merge(other.inner_);
+}
+
+std::unique_ptr<OpaqueBloomFilter> OpaqueBloomFilter::clone() const {
+  filter copy = this->inner_;
+  return std::unique_ptr<OpaqueBloomFilter>(new OpaqueBloomFilter(std::move(copy)));
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueBloomFilter::serialize() const {
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(v.begin(), v.end()));
+}
+
+std::unique_ptr<OpaqueBloomFilter> new_opaque_bloom_filter(uint8_t lg_num_blocks) {
+  OpaqueBloomFilter::filter inner(lg_num_blocks);
+  return std::unique_ptr<OpaqueBloomFilter>(new OpaqueBloomFilter(std::move(inner)));
+}
+
+uint8_t suggest_bloom_lg_num_blocks(uint64_t num_items, uint32_t bits_per_item) {
+  return OpaqueBloomFilter::filter::suggest_lg_num_blocks(num_items, bits_per_item);
+}
+
+std::unique_ptr<OpaqueBloomFilter> deserialize_opaque_bloom_filter(rust::Slice<const uint8_t> buf) {
+  auto inner = OpaqueBloomFilter::filter::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueBloomFilter>(new OpaqueBloomFilter(std::move(inner)));
+}
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "rust/cxx.h"
+#include "bloom/include/bloom_filter.hpp"
+
+class OpaqueBloomFilter {
+public:
+  typedef datasketches::bloom_filter<> filter;
+  bool contains(rust::Slice<const uint8_t> buf) const;
+  // Key i spans [ends[i-1], ends[i]) of buf, with ends[-1] taken as 0, and
+  // found has room for all of them.
+  void contains_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, rust::Slice<uint8_t> found) const;
+  double estimate() const;
+  uint8_t get_lg_num_blocks() const;
+  void update(rust::Slice<const uint8_t> buf);
+  void update_u64(uint64_t value);
+  void update_u64_batch(rust::Slice<const uint64_t> values);
+  void update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends);
+  void merge(const OpaqueBloomFilter& other);
+  std::unique_ptr<OpaqueBloomFilter> clone() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize() const;
+private:
+  OpaqueBloomFilter(filter&& inner);
+  friend std::unique_ptr<OpaqueBloomFilter> new_opaque_bloom_filter(uint8_t lg_num_blocks);
+  friend std::unique_ptr<OpaqueBloomFilter> deserialize_opaque_bloom_filter(rust::Slice<const uint8_t> buf);
+  filter inner_;
+};
+
+std::unique_ptr<OpaqueBloomFilter> new_opaque_bloom_filter(uint8_t lg_num_blocks);
+// The lg_num_blocks of the smallest filter with bits_per_item bits for each of num_items.
+uint8_t suggest_bloom_lg_num_blocks(uint64_t num_items, uint32_t bits_per_item);
+std::unique_ptr<OpaqueBloomFilter> deserialize_opaque_bloom_filter(rust::Slice<const uint8_t> buf);
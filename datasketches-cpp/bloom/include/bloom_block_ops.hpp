@@ -0,0 +1,261 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Kernels setting and testing the bits of items in the 64-byte blocks of a
+// bloom_filter. An item's block is picked by the low bits of h1, and one bit in
+// each of the block's 8 words by the top 6 bits of the low half of h2 times one
+// of 8 odd constants, so that the 8 bits of an item are computed, and set or
+// tested, as one vector.
+//
+// Also counting the bits set, from which the filter estimates how many items it
+// holds.
+//
+// On x86-64 (GCC/Clang) AVX2 and AVX-512 kernels are picked at runtime, once for
+// each chunk of hashes, as cpu_features.hpp describes; on AArch64 NEON is always
+// there. Every kernel computes exactly what the portable loop does.
+
+#ifndef BLOOM_BLOCK_OPS_HPP_
+#define BLOOM_BLOCK_OPS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "MurmurHash3.h"
+#include "cpu_features.hpp"
+
+namespace datasketches {
+
+namespace bloom_ops {
+
+static const unsigned WORDS_PER_BLOCK = 8;
+
+// those of the split block Bloom filters of Parquet and Impala
+alignas(32) static const uint32_t SALTS[WORDS_PER_BLOCK] = {
+  0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU, 0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+inline uint64_t* block_of(uint64_t* blocks, uint64_t block_mask, const HashState& hashes) {
+  return blocks + (hashes.h1 & block_mask) * WORDS_PER_BLOCK;
+}
+
+inline const uint64_t* block_of(const uint64_t* blocks, uint64_t block_mask, const HashState& hashes) {
+  return blocks + (hashes.h1 & block_mask) * WORDS_PER_BLOCK;
+}
+
+inline uint64_t portable_bit(uint32_t key, unsigned word) {
+  return static_cast<uint64_t>(1) << ((key * SALTS[word]) >> 26);
+}
+
+inline void portable_insert(uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t* block = block_of(blocks, block_mask, hashes[i]);
+    const uint32_t key = static_cast<uint32_t>(hashes[i].h2);
+    for (unsigned w = 0; w < WORDS_PER_BLOCK; ++w) block[w] |= portable_bit(key, w);
+  }
+}
+
+inline void portable_check(const uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n, uint8_t* found) {
+  for (size_t i = 0; i < n; ++i) {
+    const uint64_t* block = block_of(blocks, block_mask, hashes[i]);
+    const uint32_t key = static_cast<uint32_t>(hashes[i].h2);
+    uint64_t missing = 0;
+    for (unsigned w = 0; w < WORDS_PER_BLOCK; ++w) missing |= portable_bit(key, w) & ~block[w];
+    found[i] = missing == 0;
+  }
+}
+
+inline uint64_t portable_count_bits(const uint64_t* words, size_t n) {
+  uint64_t count = 0;
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t w = words[i] - ((words[i] >> 1) & 0x5555555555555555ULL);
+    w = (w & 0x3333333333333333ULL) + ((w >> 2) & 0x3333333333333333ULL);
+    w = (w + (w >> 4)) & 0x0f0f0f0f0f0f0f0fULL;
+    count += (w * 0x0101010101010101ULL) >> 56;
+  }
+  return count;
+}
+
+#ifdef DATASKETCHES_X86
+
+#define BLOOM_AVX2 __attribute__((target("avx2")))
+#define BLOOM_AVX512 __attribute__((target("avx512f")))
+#define BLOOM_POPCNT __attribute__((target("popcnt")))
+
+// GCC's own AVX-512 intrinsic headers trip -W(maybe-)uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// the bit of each word of the block, as a word per lane
+BLOOM_AVX2 inline __m256i avx2_bit_indices(uint32_t key) {
+  const __m256i salts = _mm256_load_si256(reinterpret_cast<const __m256i*>(SALTS));
+  return _mm256_srli_epi32(_mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(key)), salts), 26);
+}
+
+BLOOM_AVX2 inline void avx2_masks(uint32_t key, __m256i& lo, __m256i& hi) {
+  const __m256i bits = avx2_bit_indices(key);
+  const __m256i one = _mm256_set1_epi64x(1);
+  lo = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_castsi256_si128(bits)));
+  hi = _mm256_sllv_epi64(one, _mm256_cvtepu32_epi64(_mm256_extracti128_si256(bits, 1)));
+}
+
+BLOOM_AVX2 inline void avx2_insert(uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    __m256i* block = reinterpret_cast<__m256i*>(block_of(blocks, block_mask, hashes[i]));
+    __m256i lo, hi;
+    avx2_masks(static_cast<uint32_t>(hashes[i].h2), lo, hi);
+    _mm256_store_si256(block, _mm256_or_si256(_mm256_load_si256(block), lo));
+    _mm256_store_si256(block + 1, _mm256_or_si256(_mm256_load_si256(block + 1), hi));
+  }
+}
+
+BLOOM_AVX2 inline void avx2_check(const uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n, uint8_t* found) {
+  for (size_t i = 0; i < n; ++i) {
+    const __m256i* block = reinterpret_cast<const __m256i*>(block_of(blocks, block_mask, hashes[i]));
+    __m256i lo, hi;
+    avx2_masks(static_cast<uint32_t>(hashes[i].h2), lo, hi);
+    // testc is 1 when every bit of the mask is set in the block
+    found[i] = _mm256_testc_si256(_mm256_load_si256(block), lo) & _mm256_testc_si256(_mm256_load_si256(block + 1), hi);
+  }
+}
+
+BLOOM_AVX512 inline __m512i avx512_mask(uint32_t key) {
+  const __m256i salts = _mm256_load_si256(reinterpret_cast<const __m256i*>(SALTS));
+  const __m256i products = _mm256_mullo_epi32(_mm256_set1_epi32(static_cast<int>(key)), salts);
+  return _mm512_sllv_epi64(_mm512_set1_epi64(1), _mm512_cvtepu32_epi64(_mm256_srli_epi32(products, 26)));
+}
+
+BLOOM_AVX512 inline void avx512_insert(uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t* block = block_of(blocks, block_mask, hashes[i]);
+    const __m512i mask = avx512_mask(static_cast<uint32_t>(hashes[i].h2));
+    _mm512_store_si512(block, _mm512_or_si512(_mm512_load_si512(block), mask));
+  }
+}
+
+BLOOM_AVX512 inline void avx512_check(const uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n, uint8_t* found) {
+  for (size_t i = 0; i < n; ++i) {
+    const uint64_t* block = block_of(blocks, block_mask, hashes[i]);
+    const __m512i missing = _mm512_andnot_si512(_mm512_load_si512(block), avx512_mask(static_cast<uint32_t>(hashes[i].h2)));
+    found[i] = _mm512_test_epi64_mask(missing, missing) == 0;
+  }
+}
+
+BLOOM_POPCNT inline uint64_t popcnt_count_bits(const uint64_t* words, size_t n) {
+  uint64_t count = 0;
+  for (size_t i = 0; i < n; ++i) count += static_cast<uint64_t>(__builtin_popcountll(words[i]));
+  return count;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#undef BLOOM_AVX2
+#undef BLOOM_AVX512
+#undef BLOOM_POPCNT
+
+#endif // DATASKETCHES_X86
+
+#ifdef DATASKETCHES_NEON
+
+// the masks of words 2j and 2j + 1 of the block, in masks[j]
+inline void neon_masks(uint32_t key, uint64x2_t* masks) {
+  const uint32x4_t k = vdupq_n_u32(key);
+  const uint32x4_t lo = vshrq_n_u32(vmulq_u32(k, vld1q_u32(SALTS)), 26);
+  const uint32x4_t hi = vshrq_n_u32(vmulq_u32(k, vld1q_u32(SALTS + 4)), 26);
+  const uint64x2_t one = vdupq_n_u64(1);
+  masks[0] = vshlq_u64(one, vreinterpretq_s64_u64(vmovl_u32(vget_low_u32(lo))));
+  masks[1] = vshlq_u64(one, vreinterpretq_s64_u64(vmovl_high_u32(lo)));
+  masks[2] = vshlq_u64(one, vreinterpretq_s64_u64(vmovl_u32(vget_low_u32(hi))));
+  masks[3] = vshlq_u64(one, vreinterpretq_s64_u64(vmovl_high_u32(hi)));
+}
+
+inline void neon_insert(uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n) {
+  for (size_t i = 0; i < n; ++i) {
+    uint64_t* block = block_of(blocks, block_mask, hashes[i]);
+    uint64x2_t masks[4];
+    neon_masks(static_cast<uint32_t>(hashes[i].h2), masks);
+    for (unsigned j = 0; j < 4; ++j) vst1q_u64(block + 2 * j, vorrq_u64(vld1q_u64(block + 2 * j), masks[j]));
+  }
+}
+
+inline void neon_check(const uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n, uint8_t* found) {
+  for (size_t i = 0; i < n; ++i) {
+    const uint64_t* block = block_of(blocks, block_mask, hashes[i]);
+    uint64x2_t masks[4];
+    neon_masks(static_cast<uint32_t>(hashes[i].h2), masks);
+    uint64x2_t missing = vdupq_n_u64(0);
+    for (unsigned j = 0; j < 4; ++j) missing = vorrq_u64(missing, vbicq_u64(masks[j], vld1q_u64(block + 2 * j)));
+    found[i] = vmaxvq_u32(vreinterpretq_u32_u64(missing)) == 0;
+  }
+}
+
+inline uint64_t neon_count_bits(const uint64_t* words, size_t n) {
+  uint64_t count = 0;
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) count += vaddlvq_u8(vcntq_u8(vreinterpretq_u8_u64(vld1q_u64(words + i))));
+  return count + portable_count_bits(words + i, n - i);
+}
+
+#endif // DATASKETCHES_NEON
+
+} // namespace bloom_ops
+
+// Sets the bits of the item of each of the n hashes in the 64-byte aligned
+// blocks, of which there are block_mask + 1.
+inline void bloom_insert(uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n) {
+#if defined(DATASKETCHES_X86)
+  const cpu::isa best = cpu::best_isa();
+  if (best >= cpu::isa::AVX512) return bloom_ops::avx512_insert(blocks, block_mask, hashes, n);
+  if (best >= cpu::isa::AVX2) return bloom_ops::avx2_insert(blocks, block_mask, hashes, n);
+#elif defined(DATASKETCHES_NEON)
+  return bloom_ops::neon_insert(blocks, block_mask, hashes, n);
+#endif
+  bloom_ops::portable_insert(blocks, block_mask, hashes, n);
+}
+
+// Sets found[i] to 1 if every bit of the item of hashes[i] is set, and to 0 otherwise.
+inline void bloom_check(const uint64_t* blocks, uint64_t block_mask, const HashState* hashes, size_t n, uint8_t* found) {
+#if defined(DATASKETCHES_X86)
+  const cpu::isa best = cpu::best_isa();
+  if (best >= cpu::isa::AVX512) return bloom_ops::avx512_check(blocks, block_mask, hashes, n, found);
+  if (best >= cpu::isa::AVX2) return bloom_ops::avx2_check(blocks, block_mask, hashes, n, found);
+#elif defined(DATASKETCHES_NEON)
+  return bloom_ops::neon_check(blocks, block_mask, hashes, n, found);
+#endif
+  bloom_ops::portable_check(blocks, block_mask, hashes, n, found);
+}
+
+// The number of bits set in the n words.
+inline uint64_t bloom_count_bits(const uint64_t* words, size_t n) {
+#if defined(DATASKETCHES_X86)
+  // POPCNT comes with AVX2
+  if (cpu::best_isa() >= cpu::isa::AVX2) return bloom_ops::popcnt_count_bits(words, n);
+#elif defined(DATASKETCHES_NEON)
+  return bloom_ops::neon_count_bits(words, n);
+#endif
+  return bloom_ops::portable_count_bits(words, n);
+}
+
+} /* namespace datasketches */
+
+#endif
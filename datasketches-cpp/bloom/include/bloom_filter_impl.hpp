@@ -0,0 +1,252 @@
+#ifndef _BLOOM_FILTER_IMPL_HPP_
+#define _BLOOM_FILTER_IMPL_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <stdexcept>
+
+#include "bloom_block_ops.hpp"
+#include "memory_operations.hpp"
+#include "MurmurHash3_batch.h"
+
+namespace datasketches {
+
+template<typename A>
+bloom_filter<A>::bloom_filter(uint8_t lg_num_blocks, uint64_t seed, const A& allocator):
+lg_num_blocks_(lg_num_blocks),
+seed_(seed),
+words_(allocator)
+{
+  if (lg_num_blocks > MAX_LG_NUM_BLOCKS) {
+    throw std::invalid_argument("lg_num_blocks must not exceed " + std::to_string(MAX_LG_NUM_BLOCKS) + ": " + std::to_string(lg_num_blocks));
+  }
+  words_.resize((static_cast<size_t>(1) << lg_num_blocks) * WORDS_PER_BLOCK + WORDS_PER_BLOCK, 0);
+}
+
+template<typename A>
+uint8_t bloom_filter<A>::suggest_lg_num_blocks(uint64_t num_items, unsigned bits_per_item) {
+  if (bits_per_item == 0) throw std::invalid_argument("bits_per_item must be positive");
+  const uint64_t bits_per_block = BLOCK_BYTES * 8;
+  uint8_t lg_num_blocks = 0;
+  while (lg_num_blocks < MAX_LG_NUM_BLOCKS
+      && (bits_per_block << lg_num_blocks) / bits_per_item < num_items) {
+    ++lg_num_blocks;
+  }
+  return lg_num_blocks;
+}
+
+template<typename A>
+uint8_t bloom_filter<A>::get_lg_num_blocks() const {
+  return lg_num_blocks_;
+}
+
+template<typename A>
+uint64_t bloom_filter<A>::get_seed() const {
+  return seed_;
+}
+
+template<typename A>
+bool bloom_filter<A>::is_empty() const {
+  const size_t num_words = (static_cast<size_t>(1) << lg_num_blocks_) * WORDS_PER_BLOCK;
+  const uint64_t* words = blocks();
+  return std::all_of(words, words + num_words, [](uint64_t word) { return word == 0; });
+}
+
+template<typename A>
+uint64_t bloom_filter<A>::get_num_bits_set() const {
+  const size_t num_words = (static_cast<size_t>(1) << lg_num_blocks_) * WORDS_PER_BLOCK;
+  return bloom_count_bits(blocks(), num_words);
+}
+
+template<typename A>
+double bloom_filter<A>::get_estimate() const {
+  const double num_bits = static_cast<double>(BLOCK_BYTES * 8) * (static_cast<uint64_t>(1) << lg_num_blocks_);
+  const double num_zeros = num_bits - static_cast<double>(get_num_bits_set());
+  // a full filter is estimated as if one bit were still clear
+  return num_bits / WORDS_PER_BLOCK * std::log(num_bits / std::max(num_zeros, 1.0));
+}
+
+template<typename A>
+uint64_t* bloom_filter<A>::blocks() {
+  return const_cast<uint64_t*>(static_cast<const bloom_filter*>(this)->blocks());
+}
+
+template<typename A>
+const uint64_t* bloom_filter<A>::blocks() const {
+  // recomputed rather than stored, so that copies and moves need no fixing up
+  const size_t misalignment = reinterpret_cast<uintptr_t>(words_.data()) % BLOCK_BYTES;
+  return words_.data() + (misalignment == 0 ? 0 : (BLOCK_BYTES - misalignment) / sizeof(uint64_t));
+}
+
+template<typename A>
+uint64_t bloom_filter<A>::block_mask() const {
+  return (static_cast<uint64_t>(1) << lg_num_blocks_) - 1;
+}
+
+template<typename A>
+HashState bloom_filter<A>::hash(const void* data, size_t length) const {
+  HashState hashes;
+  MurmurHash3_x64_128(data, length, seed_, hashes);
+  return hashes;
+}
+
+template<typename A>
+void bloom_filter<A>::prefetch(const HashState* hashes, size_t n) const {
+#if defined(__GNUC__)
+  for (size_t i = 0; i < n; ++i) __builtin_prefetch(bloom_ops::block_of(blocks(), block_mask(), hashes[i]));
+#else
+  unused(hashes);
+  unused(n);
+#endif
+}
+
+template<typename A>
+void bloom_filter<A>::update(const void* data, size_t length) {
+  const HashState hashes = hash(data, length);
+  bloom_ops::portable_insert(blocks(), block_mask(), &hashes, 1);
+}
+
+template<typename A>
+void bloom_filter<A>::update(const std::string& item) {
+  update(item.data(), item.size());
+}
+
+template<typename A>
+void bloom_filter<A>::update_batch(const uint8_t* data, const size_t* ends, size_t num) {
+  HashState hashes[CHUNK_SIZE];
+  size_t start = 0;
+  while (num > 0) {
+    const size_t chunk = num < CHUNK_SIZE ? num : CHUNK_SIZE;
+    for (size_t i = 0; i < chunk; ++i) {
+      hashes[i] = hash(data + start, ends[i] - start);
+      start = ends[i];
+    }
+    prefetch(hashes, chunk);
+    bloom_insert(blocks(), block_mask(), hashes, chunk);
+    ends += chunk;
+    num -= chunk;
+  }
+}
+
+template<typename A>
+void bloom_filter<A>::update_batch(const uint64_t* values, size_t n) {
+  HashState hashes[CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = n < CHUNK_SIZE ? n : CHUNK_SIZE;
+    MurmurHash3_x64_128_batch_u64(values, chunk, seed_, hashes);
+    prefetch(hashes, chunk);
+    bloom_insert(blocks(), block_mask(), hashes, chunk);
+    values += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+void bloom_filter<A>::update_batch_16(const void* keys, size_t n) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(keys);
+  HashState hashes[CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = n < CHUNK_SIZE ? n : CHUNK_SIZE;
+    MurmurHash3_x64_128_batch_16(bytes, chunk, seed_, hashes);
+    prefetch(hashes, chunk);
+    bloom_insert(blocks(), block_mask(), hashes, chunk);
+    bytes += 16 * chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+bool bloom_filter<A>::contains(const void* data, size_t length) const {
+  const HashState hashes = hash(data, length);
+  uint8_t found;
+  bloom_ops::portable_check(blocks(), block_mask(), &hashes, 1, &found);
+  return found != 0;
+}
+
+template<typename A>
+bool bloom_filter<A>::contains(const std::string& item) const {
+  return contains(item.data(), item.size());
+}
+
+template<typename A>
+void bloom_filter<A>::contains_batch(const uint8_t* data, const size_t* ends, size_t num, uint8_t* found) const {
+  HashState hashes[CHUNK_SIZE];
+  size_t start = 0;
+  while (num > 0) {
+    const size_t chunk = num < CHUNK_SIZE ? num : CHUNK_SIZE;
+    for (size_t i = 0; i < chunk; ++i) {
+      hashes[i] = hash(data + start, ends[i] - start);
+      start = ends[i];
+    }
+    prefetch(hashes, chunk);
+    bloom_check(blocks(), block_mask(), hashes, chunk, found);
+    ends += chunk;
+    found += chunk;
+    num -= chunk;
+  }
+}
+
+template<typename A>
+void bloom_filter<A>::merge(const bloom_filter& other) {
+  if (lg_num_blocks_ != other.lg_num_blocks_) {
+    throw std::invalid_argument("incompatible filter sizes: lg_num_blocks " + std::to_string(lg_num_blocks_)
+        + " and " + std::to_string(other.lg_num_blocks_));
+  }
+  if (seed_ != other.seed_) throw std::invalid_argument("incompatible seeds");
+  const size_t num_words = (static_cast<size_t>(1) << lg_num_blocks_) * WORDS_PER_BLOCK;
+  uint64_t* words = blocks();
+  const uint64_t* others = other.blocks();
+  for (size_t i = 0; i < num_words; ++i) words[i] |= others[i];
+}
+
+template<typename A>
+auto bloom_filter<A>::serialize(unsigned header_size_bytes) const -> vector_bytes {
+  const size_t block_bytes = (static_cast<size_t>(1) << lg_num_blocks_) * BLOCK_BYTES;
+  vector_bytes bytes(header_size_bytes + HEADER_BYTES + block_bytes, 0, words_.get_allocator());
+  uint8_t* ptr = bytes.data() + header_size_bytes;
+  const uint8_t serial_version = SERIAL_VERSION;
+  ptr += copy_to_mem(serial_version, ptr);
+  const uint8_t family = FAMILY_ID;
+  ptr += copy_to_mem(family, ptr);
+  ptr += copy_to_mem(lg_num_blocks_, ptr);
+  ptr += sizeof(uint8_t) * 3; // unused
+  const uint16_t seed_hash = compute_seed_hash(seed_);
+  ptr += copy_to_mem(seed_hash, ptr);
+  copy_to_mem(blocks(), ptr, block_bytes);
+  return bytes;
+}
+
+template<typename A>
+bloom_filter<A> bloom_filter<A>::deserialize(const void* bytes, size_t size, uint64_t seed, const A& allocator) {
+  ensure_minimum_memory(size, HEADER_BYTES);
+  const char* ptr = static_cast<const char*>(bytes);
+  uint8_t serial_version;
+  ptr += copy_from_mem(ptr, serial_version);
+  uint8_t family_id;
+  ptr += copy_from_mem(ptr, family_id);
+  uint8_t lg_num_blocks;
+  ptr += copy_from_mem(ptr, lg_num_blocks);
+  ptr += sizeof(uint8_t) * 3; // unused
+  uint16_t seed_hash;
+  ptr += copy_from_mem(ptr, seed_hash);
+
+  if (serial_version != SERIAL_VERSION) {
+    throw std::invalid_argument("Possible corruption: serial version must be " + std::to_string(SERIAL_VERSION) + ": " + std::to_string(serial_version));
+  }
+  if (family_id != FAMILY_ID) {
+    throw std::invalid_argument("Possible corruption: family ID must be " + std::to_string(FAMILY_ID) + ": " + std::to_string(family_id));
+  }
+  if (seed_hash != compute_seed_hash(seed)) {
+    throw std::invalid_argument("Incompatible seed hashes: " + std::to_string(seed_hash) + ", " + std::to_string(compute_seed_hash(seed)));
+  }
+  // checks the size before the length it implies
+  bloom_filter filter(lg_num_blocks, seed, allocator);
+  const size_t block_bytes = (static_cast<size_t>(1) << lg_num_blocks) * BLOCK_BYTES;
+  ensure_minimum_memory(size, HEADER_BYTES + block_bytes);
+  copy_from_mem(ptr, filter.blocks(), block_bytes);
+  return filter;
+}
+
+} /* namespace datasketches */
+
+#endif
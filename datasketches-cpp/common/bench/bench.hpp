@@ -0,0 +1,99 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// A small harness for timing the sketch templates themselves, without the
+// Rust bridge in front of them. Each benchmark is a setup, which is not
+// timed, and a body run on what it returns, which is; the body is run until
+// min_seconds of it have been timed, and the mean time of each of the
+// operations it does is reported.
+
+#ifndef BENCH_HPP_
+#define BENCH_HPP_
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <string>
+
+namespace datasketches {
+namespace bench {
+
+// Keeps the compiler from dropping the computation of value as unused.
+template<typename T>
+inline void do_not_optimize(const T& value) {
+  asm volatile("" : : "r,m"(value) : "memory");
+}
+
+// A fast, seeded stream of 64-bit values for inputs, so that runs see the
+// same ones.
+class xorshift {
+public:
+  explicit xorshift(uint64_t seed): state_(seed * 0x9E3779B97F4A7C15ULL + 1) {}
+  uint64_t operator()() {
+    state_ ^= state_ << 13;
+    state_ ^= state_ >> 7;
+    state_ ^= state_ << 17;
+    return state_;
+  }
+private:
+  uint64_t state_;
+};
+
+class runner {
+public:
+  // Only benchmarks whose names contain filter are run.
+  runner(std::string filter, double min_seconds):
+  filter_(std::move(filter)), min_seconds_(min_seconds) {
+    std::printf("%-48s %12s %12s %8s\n", "benchmark", "ns/op", "Mops/s", "runs");
+  }
+
+  // Times body(setup()) for name, which does ops operations each run.
+  template<typename Setup, typename Body>
+  void run(const std::string& name, uint64_t ops, Setup setup, Body body) {
+    if (name.find(filter_) == std::string::npos) return;
+    using clock = std::chrono::steady_clock;
+    // one run untimed, to warm the caches and any lazily built tables
+    {
+      auto state = setup();
+      body(state);
+    }
+    double seconds = 0;
+    uint64_t runs = 0;
+    while (seconds < min_seconds_) {
+      auto state = setup();
+      const auto start = clock::now();
+      body(state);
+      seconds += std::chrono::duration<double>(clock::now() - start).count();
+      ++runs;
+    }
+    const double ns_per_op = seconds * 1e9 / static_cast<double>(runs * ops);
+    std::printf("%-48s %12.2f %12.2f %8llu\n", name.c_str(), ns_per_op, 1e3 / ns_per_op,
+        static_cast<unsigned long long>(runs));
+    std::fflush(stdout);
+  }
+
+private:
+  std::string filter_;
+  double min_seconds_;
+};
+
+} /* namespace bench */
+} /* namespace datasketches */
+
+#endif
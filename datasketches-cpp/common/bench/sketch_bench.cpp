@@ -0,0 +1,226 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Microbenchmarks of the sketch templates, as the bridge instantiates them
+// but with the default allocator. Built and run by scripts/cpp-bench.sh:
+//
+//   sketch_bench [--filter s] [--min-time seconds] [--lg-k a,b,..] [--k a,b,..] [--n a,b,..]
+//
+// The hashed sketches and the frequent items map are run at each lg_k, the
+// quantiles sketches at each k, and all of them at each n items.
+
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "bench.hpp"
+
+#include "cpc_sketch.hpp"
+#include "cpc_compressor.hpp"
+#include "theta_sketch.hpp"
+#include "hll.hpp"
+#include "kll_sketch.hpp"
+#include "req_sketch.hpp"
+#include "reverse_purge_hash_map.hpp"
+
+// size_t keys of the frequent items map are taken to be interned by the
+// Rust side, which frees them when they are purged; the keys here own
+// themselves.
+void remove_from_hashset(size_t, size_t) noexcept {}
+
+namespace datasketches {
+namespace bench {
+
+using cpc = cpc_sketch_alloc<std::allocator<uint8_t>>;
+using theta = update_theta_sketch_alloc<std::allocator<uint64_t>>;
+using hll = hll_sketch_alloc<std::allocator<uint8_t>>;
+using kll = kll_sketch<float>;
+using req = req_sketch<float>;
+using hh_map = reverse_purge_hash_map<size_t>;
+
+static const unsigned NUM_QUERIES = 1000;
+
+static std::string label(const std::string& name, const char* param, unsigned value, uint64_t n) {
+  return name + "/" + param + "=" + std::to_string(value) + "/n=" + std::to_string(n);
+}
+
+static void bench_cpc(runner& r, uint8_t lg_k, uint64_t n) {
+  r.run(label("cpc/update", "lg_k", lg_k, n), n,
+      [&] { return cpc(lg_k); },
+      [&](cpc& sketch) {
+        for (uint64_t i = 0; i < n; ++i) sketch.update(i);
+        do_not_optimize(sketch);
+      });
+
+  using allocator = std::allocator<uint8_t>;
+  cpc full(lg_k);
+  for (uint64_t i = 0; i < n; ++i) full.update(i);
+  const cpc_compressor<allocator>& compressor = get_compressor<allocator>();
+  r.run(label("cpc/compress", "lg_k", lg_k, n), 1,
+      [&] { return compressed_state<allocator>(allocator()); },
+      [&](compressed_state<allocator>& state) {
+        compressor.compress(full, state);
+        do_not_optimize(state);
+      });
+
+  compressed_state<allocator> compressed((allocator()));
+  compressor.compress(full, compressed);
+  r.run(label("cpc/uncompress", "lg_k", lg_k, n), 1,
+      [&] { return uncompressed_state<allocator>(allocator()); },
+      [&](uncompressed_state<allocator>& state) {
+        compressor.uncompress(compressed, state, lg_k, full.get_num_coupons());
+        do_not_optimize(state);
+      });
+}
+
+static void bench_theta(runner& r, uint8_t lg_k, uint64_t n) {
+  r.run(label("theta/update", "lg_k", lg_k, n), n,
+      [&] { return theta::builder().set_lg_k(lg_k).build(); },
+      [&](theta& sketch) {
+        for (uint64_t i = 0; i < n; ++i) sketch.update(i);
+        do_not_optimize(sketch);
+      });
+
+  // trim() rebuilds the table down to the nominal entries, which only has
+  // work to do once n is past them
+  theta full = theta::builder().set_lg_k(lg_k).build();
+  for (uint64_t i = 0; i < n; ++i) full.update(i);
+  r.run(label("theta/rebuild", "lg_k", lg_k, n), 1,
+      [&] { return full; },
+      [&](theta& sketch) {
+        sketch.trim();
+        do_not_optimize(sketch);
+      });
+}
+
+static void bench_hll(runner& r, uint8_t lg_k, uint64_t n) {
+  const std::pair<target_hll_type, const char*> types[] = {
+    {HLL_4, "hll/update/hll4"},
+    {HLL_6, "hll/update/hll6"},
+    {HLL_8, "hll/update/hll8"},
+  };
+  for (const auto& type : types) {
+    r.run(label(type.second, "lg_k", lg_k, n), n,
+        [&] { return hll(lg_k, type.first); },
+        [&](hll& sketch) {
+          for (uint64_t i = 0; i < n; ++i) sketch.update(i);
+          do_not_optimize(sketch);
+        });
+  }
+}
+
+// Runs update and quantile queries of the quantiles sketch Sketch, which is
+// built from its k alone.
+template<typename Sketch>
+static void bench_quantiles(runner& r, const std::string& name, uint16_t k, uint64_t n) {
+  r.run(label(name + "/update", "k", k, n), n,
+      [&] { return Sketch(k); },
+      [&](Sketch& sketch) {
+        xorshift values(n);
+        for (uint64_t i = 0; i < n; ++i) sketch.update(static_cast<float>(values() >> 40));
+        do_not_optimize(sketch);
+      });
+
+  Sketch full(k);
+  xorshift values(n);
+  for (uint64_t i = 0; i < n; ++i) full.update(static_cast<float>(values() >> 40));
+  r.run(label(name + "/quantile", "k", k, n), NUM_QUERIES,
+      [] { return 0; },
+      [&](int&) {
+        for (unsigned i = 0; i < NUM_QUERIES; ++i) {
+          do_not_optimize(full.get_quantile(static_cast<double>(i) / NUM_QUERIES));
+        }
+      });
+  r.run(label(name + "/rank", "k", k, n), NUM_QUERIES,
+      [] { return 0; },
+      [&](int&) {
+        xorshift queries(n + 1);
+        for (unsigned i = 0; i < NUM_QUERIES; ++i) {
+          do_not_optimize(full.get_rank(static_cast<float>(queries() >> 40)));
+        }
+      });
+}
+
+static void bench_hh(runner& r, uint8_t lg_k, uint64_t n) {
+  // keys are drawn from 4 times as many as the map holds, so that it fills
+  // and purges as the heavy hitters' do
+  const uint64_t distinct = uint64_t(4) << lg_k;
+  r.run(label("hh/adjust_or_insert", "lg_k", lg_k, n), n,
+      [&] { return hh_map(3, 0, lg_k, std::allocator<size_t>()); },
+      [&](hh_map& map) {
+        xorshift keys(lg_k);
+        uint64_t offset = 0;
+        for (uint64_t i = 0; i < n; ++i) offset += map.adjust_or_insert(static_cast<size_t>(keys() % distinct), 1);
+        do_not_optimize(offset);
+      });
+}
+
+static std::vector<uint64_t> parse_list(const char* arg) {
+  std::vector<uint64_t> values;
+  std::stringstream ss(arg);
+  std::string value;
+  while (std::getline(ss, value, ',')) values.push_back(std::stoull(value));
+  return values;
+}
+
+} /* namespace bench */
+} /* namespace datasketches */
+
+int main(int argc, char** argv) {
+  using namespace datasketches::bench;
+  std::string filter;
+  double min_seconds = 0.5;
+  std::vector<uint64_t> lg_ks = {10, 12, 16};
+  std::vector<uint64_t> ks = {100, 200};
+  std::vector<uint64_t> ns = {1000, 100000, 1000000};
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string flag = argv[i];
+    if (flag == "--filter") filter = argv[i + 1];
+    else if (flag == "--min-time") min_seconds = std::atof(argv[i + 1]);
+    else if (flag == "--lg-k") lg_ks = parse_list(argv[i + 1]);
+    else if (flag == "--k") ks = parse_list(argv[i + 1]);
+    else if (flag == "--n") ns = parse_list(argv[i + 1]);
+    else {
+      std::cerr << "unknown flag " << flag << std::endl;
+      return 1;
+    }
+  }
+  if (argc % 2 == 0) {
+    std::cerr << "flag " << argv[argc - 1] << " has no value" << std::endl;
+    return 1;
+  }
+
+  runner r(filter, min_seconds);
+  for (uint64_t n : ns) {
+    for (uint64_t lg_k : lg_ks) {
+      bench_cpc(r, static_cast<uint8_t>(lg_k), n);
+      bench_theta(r, static_cast<uint8_t>(lg_k), n);
+      bench_hll(r, static_cast<uint8_t>(lg_k), n);
+      bench_hh(r, static_cast<uint8_t>(lg_k), n);
+    }
+    for (uint64_t k : ks) {
+      bench_quantiles<kll>(r, "kll", static_cast<uint16_t>(k), n);
+      bench_quantiles<req>(r, "req", static_cast<uint16_t>(k), n);
+    }
+  }
+  return 0;
+}
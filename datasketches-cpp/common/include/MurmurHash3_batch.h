@@ -0,0 +1,197 @@
+// Multi-lane variants of MurmurHash3_x64_128 for batches of fixed-width keys.
+//
+// Every function here is bit-identical to calling MurmurHash3_x64_128 on each
+// key in turn with the same seed: hashing a uint64_t value means hashing its
+// 8 native bytes, exactly as the sketches' update(uint64_t) overloads do.
+//
+// Keys are hashed several at a time so the independent multiply chains overlap.
+// For 16-byte keys on x86-64 (GCC/Clang) an AVX-512DQ kernel with 8 lanes of
+// native 64-bit multiplies is picked at runtime, so the library still builds
+// without any -m flags. 8-byte keys always use the portable interleaved
+// kernel: their hash is too short for the lane shuffles to pay off, and
+// emulated 64-bit multiplies (AVX2, NEON) lose to scalar code for both widths.
+
+#ifndef _MURMURHASH3_BATCH_H_
+#define _MURMURHASH3_BATCH_H_
+
+#include <cstddef>
+
+#include "MurmurHash3.h"
+#include "cpu_features.hpp"
+
+namespace murmur_batch {
+
+static const uint64_t C1 = BIG_CONSTANT(0x87c37b91114253d5);
+static const uint64_t C2 = BIG_CONSTANT(0x4cf5ad432745937f);
+
+// number of keys hashed together by the portable kernel
+static const size_t PORTABLE_LANES = 4;
+
+// size of the on-stack HashState scratch buffers used by batched sketch updates
+static const size_t CHUNK_SIZE = 64;
+
+FORCE_INLINE uint64_t load_le64(const uint8_t* p) {
+  uint64_t res;
+  memcpy(&res, p, sizeof(res));
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  res = __builtin_bswap64(res);
+#endif
+  return res;
+}
+
+// the hash reads the native bytes of the value as a little-endian word
+FORCE_INLINE uint64_t native_to_le64(uint64_t value) {
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+  return __builtin_bswap64(value);
+#else
+  return value;
+#endif
+}
+
+FORCE_INLINE void finalize(uint64_t& h1, uint64_t& h2, uint64_t len) {
+  h1 ^= len;
+  h2 ^= len;
+  h1 += h2;
+  h2 += h1;
+  h1 = fmix64(h1);
+  h2 = fmix64(h2);
+  h1 += h2;
+  h2 += h1;
+}
+
+// 8-byte key: no body blocks, tail is k1 only
+FORCE_INLINE void hash_u64(uint64_t value, uint64_t seed, HashState& out) {
+  uint64_t k1 = native_to_le64(value);
+  uint64_t h1 = seed;
+  uint64_t h2 = seed;
+  k1 *= C1; k1 = ROTL64(k1, 31); k1 *= C2; h1 ^= k1;
+  finalize(h1, h2, 8);
+  out.h1 = h1;
+  out.h2 = h2;
+}
+
+// 16-byte key: one body block, empty tail
+FORCE_INLINE void hash_16(const uint8_t* key, uint64_t seed, HashState& out) {
+  uint64_t k1 = load_le64(key);
+  uint64_t k2 = load_le64(key + 8);
+  uint64_t h1 = seed;
+  uint64_t h2 = seed;
+  k1 *= C1; k1 = ROTL64(k1, 31); k1 *= C2; h1 ^= k1;
+  h1 = ROTL64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+  k2 *= C2; k2 = ROTL64(k2, 33); k2 *= C1; h2 ^= k2;
+  h2 = ROTL64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+  finalize(h1, h2, 16);
+  out.h1 = h1;
+  out.h2 = h2;
+}
+
+// Portable kernels: the lane loops have no cross-lane dependencies, so the
+// compiler can keep PORTABLE_LANES multiply chains in flight (or vectorize).
+inline void portable_u64(const uint64_t* values, size_t n, uint64_t seed, HashState* out) {
+  size_t i = 0;
+  for (; i + PORTABLE_LANES <= n; i += PORTABLE_LANES) {
+    for (size_t l = 0; l < PORTABLE_LANES; ++l) hash_u64(values[i + l], seed, out[i + l]);
+  }
+  for (; i < n; ++i) hash_u64(values[i], seed, out[i]);
+}
+
+inline void portable_16(const uint8_t* keys, size_t n, uint64_t seed, HashState* out) {
+  size_t i = 0;
+  for (; i + PORTABLE_LANES <= n; i += PORTABLE_LANES) {
+    for (size_t l = 0; l < PORTABLE_LANES; ++l) hash_16(keys + 16 * (i + l), seed, out[i + l]);
+  }
+  for (; i < n; ++i) hash_16(keys + 16 * i, seed, out[i]);
+}
+
+#ifdef DATASKETCHES_X86
+
+#define MURMUR_AVX512 __attribute__((target("avx512f,avx512dq")))
+
+// GCC's own AVX-512 intrinsic headers trip -Wmaybe-uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+MURMUR_AVX512 inline __m512i avx512_fmix64(__m512i k) {
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  k = _mm512_mullo_epi64(k, _mm512_set1_epi64(static_cast<long long>(BIG_CONSTANT(0xff51afd7ed558ccd))));
+  k = _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+  k = _mm512_mullo_epi64(k, _mm512_set1_epi64(static_cast<long long>(BIG_CONSTANT(0xc4ceb9fe1a85ec53))));
+  return _mm512_xor_si512(k, _mm512_srli_epi64(k, 33));
+}
+
+MURMUR_AVX512 inline void avx512_finalize_store(__m512i h1, __m512i h2, uint64_t len, HashState* out) {
+  const __m512i vlen = _mm512_set1_epi64(static_cast<long long>(len));
+  h1 = _mm512_xor_si512(h1, vlen);
+  h2 = _mm512_xor_si512(h2, vlen);
+  h1 = _mm512_add_epi64(h1, h2);
+  h2 = _mm512_add_epi64(h2, h1);
+  h1 = avx512_fmix64(h1);
+  h2 = avx512_fmix64(h2);
+  h1 = _mm512_add_epi64(h1, h2);
+  h2 = _mm512_add_epi64(h2, h1);
+  // pairs (h1[j], h2[j]) land at 64-bit slot 2j of the output
+  const __m512i lo_idx = _mm512_set_epi64(11, 3, 10, 2, 9, 1, 8, 0);
+  const __m512i hi_idx = _mm512_set_epi64(15, 7, 14, 6, 13, 5, 12, 4);
+  _mm512_storeu_si512(out, _mm512_permutex2var_epi64(h1, lo_idx, h2));
+  _mm512_storeu_si512(out + 4, _mm512_permutex2var_epi64(h1, hi_idx, h2));
+}
+
+MURMUR_AVX512 inline void avx512_16(const uint8_t* keys, size_t n, uint64_t seed, HashState* out) {
+  const __m512i vseed = _mm512_set1_epi64(static_cast<long long>(seed));
+  const __m512i c1 = _mm512_set1_epi64(static_cast<long long>(C1));
+  const __m512i c2 = _mm512_set1_epi64(static_cast<long long>(C2));
+  const __m512i even_idx = _mm512_set_epi64(14, 12, 10, 8, 6, 4, 2, 0);
+  const __m512i odd_idx = _mm512_set_epi64(15, 13, 11, 9, 7, 5, 3, 1);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m512i v0 = _mm512_loadu_si512(keys + 16 * i);
+    const __m512i v1 = _mm512_loadu_si512(keys + 16 * i + 64);
+    __m512i k1 = _mm512_permutex2var_epi64(v0, even_idx, v1);
+    __m512i k2 = _mm512_permutex2var_epi64(v0, odd_idx, v1);
+    __m512i h1 = vseed;
+    __m512i h2 = vseed;
+
+    k1 = _mm512_mullo_epi64(k1, c1); k1 = _mm512_rol_epi64(k1, 31); k1 = _mm512_mullo_epi64(k1, c2);
+    h1 = _mm512_xor_si512(h1, k1);
+    h1 = _mm512_rol_epi64(h1, 27);
+    h1 = _mm512_add_epi64(h1, h2);
+    h1 = _mm512_add_epi64(_mm512_add_epi64(_mm512_slli_epi64(h1, 2), h1), _mm512_set1_epi64(0x52dce729));
+
+    k2 = _mm512_mullo_epi64(k2, c2); k2 = _mm512_rol_epi64(k2, 33); k2 = _mm512_mullo_epi64(k2, c1);
+    h2 = _mm512_xor_si512(h2, k2);
+    h2 = _mm512_rol_epi64(h2, 31);
+    h2 = _mm512_add_epi64(h2, h1);
+    h2 = _mm512_add_epi64(_mm512_add_epi64(_mm512_slli_epi64(h2, 2), h2), _mm512_set1_epi64(0x38495ab5));
+
+    avx512_finalize_store(h1, h2, 16, out + i);
+  }
+  portable_16(keys + 16 * i, n - i, seed, out + i);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#undef MURMUR_AVX512
+
+#endif // DATASKETCHES_X86
+
+} // namespace murmur_batch
+
+// Hashes n uint64_t values, writing the i-th result to out[i].
+inline void MurmurHash3_x64_128_batch_u64(const uint64_t* values, size_t n, uint64_t seed, HashState* out) {
+  murmur_batch::portable_u64(values, n, seed, out);
+}
+
+// Hashes n consecutive 16-byte keys starting at keys, writing the i-th result to out[i].
+inline void MurmurHash3_x64_128_batch_16(const void* keys, size_t n, uint64_t seed, HashState* out) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(keys);
+#ifdef DATASKETCHES_X86
+  if (datasketches::cpu::best_isa() >= datasketches::cpu::isa::AVX512) return murmur_batch::avx512_16(bytes, n, seed, out);
+#endif
+  murmur_batch::portable_16(bytes, n, seed, out);
+}
+
+#endif // _MURMURHASH3_BATCH_H_
@@ -22,6 +22,9 @@
 
 #include <algorithm>
 #include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <stdexcept>
 
 /*
  * This class enables the estimation of error bounds given a sample set size, the sampling
@@ -295,19 +298,56 @@ class binomial_bounds {
 
 public:
   static double get_lower_bound(unsigned long long num_samples, double theta, unsigned num_std_devs) {
-    check_theta(theta);
-    check_num_std_devs(num_std_devs);
-    const double estimate = num_samples / theta;
-    const double lb = compute_approx_binomial_lower_bound(num_samples, theta, num_std_devs);
-    return std::min(estimate, std::max(static_cast<double>(num_samples), lb));
+    const uint64_t samples = num_samples;
+    double bound;
+    get_lower_bounds(&samples, &theta, 1, num_std_devs, &bound);
+    return bound;
   }
 
   static double get_upper_bound(unsigned long long num_samples, double theta, unsigned num_std_devs) {
-    check_theta(theta);
+    const uint64_t samples = num_samples;
+    double bound;
+    get_upper_bounds(&samples, &theta, 1, num_std_devs, &bound);
+    return bound;
+  }
+
+  /**
+   * Computes get_lower_bound() of each of n sketches into bounds, given their numbers of
+   * samples and thetas. num_std_devs is checked once for the batch, and a sketch with the
+   * same number of samples and theta as the one before it, as exact sketches of the same
+   * count and sketches of one union often have, reuses its bound.
+   */
+  static void get_lower_bounds(const uint64_t* num_samples, const double* thetas, size_t n,
+      unsigned num_std_devs, double* bounds) {
+    check_num_std_devs(num_std_devs);
+    for (size_t i = 0; i < n; ++i) {
+      if (i > 0 && num_samples[i] == num_samples[i - 1] && thetas[i] == thetas[i - 1]) {
+        bounds[i] = bounds[i - 1];
+        continue;
+      }
+      check_theta(thetas[i]);
+      const double estimate = num_samples[i] / thetas[i];
+      const double lb = compute_approx_binomial_lower_bound(num_samples[i], thetas[i], num_std_devs);
+      bounds[i] = std::min(estimate, std::max(static_cast<double>(num_samples[i]), lb));
+    }
+  }
+
+  /**
+   * Computes get_upper_bound() of each of n sketches into bounds, as get_lower_bounds() does.
+   */
+  static void get_upper_bounds(const uint64_t* num_samples, const double* thetas, size_t n,
+      unsigned num_std_devs, double* bounds) {
     check_num_std_devs(num_std_devs);
-    const double estimate = num_samples / theta;
-    const double ub = compute_approx_binomial_upper_bound(num_samples, theta, num_std_devs);
-    return std::max(estimate, ub);
+    for (size_t i = 0; i < n; ++i) {
+      if (i > 0 && num_samples[i] == num_samples[i - 1] && thetas[i] == thetas[i - 1]) {
+        bounds[i] = bounds[i - 1];
+        continue;
+      }
+      check_theta(thetas[i]);
+      const double estimate = num_samples[i] / thetas[i];
+      const double ub = compute_approx_binomial_upper_bound(num_samples[i], thetas[i], num_std_devs);
+      bounds[i] = std::max(estimate, ub);
+    }
   }
 
 private:
@@ -0,0 +1,123 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _BIT_PACKING_HPP_
+#define _BIT_PACKING_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+namespace datasketches {
+
+// Bit streams for the compressed serialized forms. Values of a fixed width of 1 to 64
+// bits are written back to back, most significant bit first, as the compressed formats
+// of the other DataSketches libraries lay them out. A block of 8 values therefore takes
+// exactly as many bytes as each value has bits, and the next block starts on a byte.
+
+/**
+ * Writes the low bits of value starting at the given bit offset (0 to 7) of *ptr, whose
+ * bits before the offset are kept, and advances ptr past every byte completed.
+ * @return the bit offset into *ptr after the value
+ */
+static inline uint8_t pack_bits(uint64_t value, uint8_t bits, uint8_t*& ptr, uint8_t offset) {
+  if (offset > 0) {
+    const uint8_t chunk_bits = 8 - offset;
+    const uint8_t mask = (1 << chunk_bits) - 1;
+    if (bits < chunk_bits) {
+      *ptr |= (value << (chunk_bits - bits)) & mask;
+      return offset + bits;
+    }
+    *ptr++ |= (value >> (bits - chunk_bits)) & mask;
+    bits -= chunk_bits;
+  }
+  while (bits >= 8) {
+    *ptr++ = static_cast<uint8_t>(value >> (bits - 8));
+    bits -= 8;
+  }
+  if (bits > 0) {
+    *ptr = static_cast<uint8_t>(value << (8 - bits));
+    return bits;
+  }
+  return 0;
+}
+
+/**
+ * Reads a value of the given width starting at the given bit offset (0 to 7) of *ptr,
+ * and advances ptr past every byte finished.
+ * @return the bit offset into *ptr after the value
+ */
+static inline uint8_t unpack_bits(uint64_t& value, uint8_t bits, const uint8_t*& ptr, uint8_t offset) {
+  const uint8_t avail_bits = 8 - offset;
+  const uint8_t chunk_bits = avail_bits < bits ? avail_bits : bits;
+  const uint8_t mask = (1 << chunk_bits) - 1;
+  value = (*ptr >> (avail_bits - chunk_bits)) & mask;
+  ptr += avail_bits == chunk_bits;
+  offset = (offset + chunk_bits) & 7;
+  bits -= chunk_bits;
+  while (bits >= 8) {
+    value <<= 8;
+    value |= *ptr++;
+    bits -= 8;
+  }
+  if (bits > 0) {
+    value <<= bits;
+    value |= *ptr >> (8 - bits);
+    return bits;
+  }
+  return offset;
+}
+
+/**
+ * Writes a block of 8 values of the given width into the bits bytes at ptr.
+ */
+static inline void pack_bits_block8(const uint64_t* values, uint8_t* ptr, uint8_t bits) {
+  uint8_t offset = 0;
+  for (unsigned i = 0; i < 8; ++i) offset = pack_bits(values[i], bits, ptr, offset);
+}
+
+// written out byte by byte so that it is correct on any host, but compilers turn it
+// into a single load and byte swap
+static inline uint64_t load_big_endian_u64(const uint8_t* ptr) {
+  uint64_t value = 0;
+  for (unsigned i = 0; i < 8; ++i) value = (value << 8) | ptr[i];
+  return value;
+}
+
+/**
+ * Reads a block of 8 values of the given width from the bits bytes at ptr. Values of
+ * up to 57 bits fit in a word loaded from the byte they start in, so each is cut out
+ * of one unaligned load with two shifts, with no loop over its bytes and no branches.
+ * That load may reach up to 8 bytes past the block, so blocks closer than that to end,
+ * the end of the readable bytes, are read with unpack_bits() instead.
+ */
+static inline void unpack_bits_block8(uint64_t* values, const uint8_t* ptr, uint8_t bits, const uint8_t* end) {
+  if (bits <= 57 && static_cast<size_t>(end - ptr) >= 8 + ((7u * bits) >> 3)) {
+    for (unsigned i = 0; i < 8; ++i) {
+      const unsigned start = i * bits;
+      values[i] = (load_big_endian_u64(ptr + (start >> 3)) << (start & 7)) >> (64 - bits);
+    }
+    return;
+  }
+  uint8_t offset = 0;
+  for (unsigned i = 0; i < 8; ++i) offset = unpack_bits(values[i], bits, ptr, offset);
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -21,6 +21,7 @@
 #define _BOUNDS_BINOMIAL_PROPORTIONS_HPP_
 
 #include <cmath>
+#include <cstddef>
 #include <stdexcept>
 
 namespace datasketches {
@@ -111,15 +112,7 @@ public:
    * unknown success probability.
    */
   static inline double approximate_lower_bound_on_p(uint64_t n, uint64_t k, double num_std_devs) {
-    check_inputs(n, k);
-    if (n == 0) { return 0.0; } // the coin was never flipped, so we know nothing
-    else if (k == 0) { return 0.0; }
-    else if (k == 1) { return (exact_lower_bound_on_p_k_eq_1(n, delta_of_num_stdevs(num_std_devs))); }
-    else if (k == n) { return (exact_lower_bound_on_p_k_eq_n(n, delta_of_num_stdevs(num_std_devs))); }
-    else {
-      double x = abramowitz_stegun_formula_26p5p22((n - k) + 1.0, static_cast<double>(k), (-1.0 * num_std_devs));
-      return (1.0 - x); // which is p
-    }
+    return lower_bound_on_p(n, k, num_std_devs, [num_std_devs] { return delta_of_num_stdevs(num_std_devs); });
   }
 
   /**
@@ -146,19 +139,30 @@ public:
    * unknown success probability.
    */
   static inline double approximate_upper_bound_on_p(uint64_t n, uint64_t k, double num_std_devs) {
-    check_inputs(n, k);
-    if (n == 0) { return 1.0; } // the coin was never flipped, so we know nothing
-    else if (k == n) { return 1.0; }
-    else if (k == (n - 1)) {
-      return (exact_upper_bound_on_p_k_eq_minusone(n, delta_of_num_stdevs(num_std_devs)));
-    }
-    else if (k == 0) {
-      return (exact_upper_bound_on_p_k_eq_zero(n, delta_of_num_stdevs(num_std_devs)));
-    }
-    else {
-      double x = abramowitz_stegun_formula_26p5p22(static_cast<double>(n - k), k + 1.0, num_std_devs);
-      return (1.0 - x); // which is p
-    }
+    return upper_bound_on_p(n, k, num_std_devs, [num_std_devs] { return delta_of_num_stdevs(num_std_devs); });
+  }
+
+  /**
+   * Computes approximate_lower_bound_on_p() of each of count pairs (n[i], k[i]) into bounds,
+   * at the same num_std_devs, which is converted to a tail probability once for the batch
+   * rather than once per pair.
+   */
+  static inline void approximate_lower_bounds_on_p(const uint64_t* n, const uint64_t* k, size_t count,
+      double num_std_devs, double* bounds) {
+    const double delta = delta_of_num_stdevs(num_std_devs);
+    const auto get_delta = [delta] { return delta; };
+    for (size_t i = 0; i < count; ++i) bounds[i] = lower_bound_on_p(n[i], k[i], num_std_devs, get_delta);
+  }
+
+  /**
+   * Computes approximate_upper_bound_on_p() of each of count pairs (n[i], k[i]) into bounds,
+   * as approximate_lower_bounds_on_p() does.
+   */
+  static inline void approximate_upper_bounds_on_p(const uint64_t* n, const uint64_t* k, size_t count,
+      double num_std_devs, double* bounds) {
+    const double delta = delta_of_num_stdevs(num_std_devs);
+    const auto get_delta = [delta] { return delta; };
+    for (size_t i = 0; i < count; ++i) bounds[i] = upper_bound_on_p(n[i], k[i], num_std_devs, get_delta);
   }
 
   /**
@@ -197,6 +201,37 @@ private:
     if (k > n) { throw std::invalid_argument("K cannot exceed N"); }
   }
 
+  // get_delta() returns delta_of_num_stdevs(num_std_devs), which only the special cases need
+  template<typename GetDelta>
+  static inline double lower_bound_on_p(uint64_t n, uint64_t k, double num_std_devs, GetDelta get_delta) {
+    check_inputs(n, k);
+    if (n == 0) { return 0.0; } // the coin was never flipped, so we know nothing
+    else if (k == 0) { return 0.0; }
+    else if (k == 1) { return (exact_lower_bound_on_p_k_eq_1(n, get_delta())); }
+    else if (k == n) { return (exact_lower_bound_on_p_k_eq_n(n, get_delta())); }
+    else {
+      double x = abramowitz_stegun_formula_26p5p22((n - k) + 1.0, static_cast<double>(k), (-1.0 * num_std_devs));
+      return (1.0 - x); // which is p
+    }
+  }
+
+  template<typename GetDelta>
+  static inline double upper_bound_on_p(uint64_t n, uint64_t k, double num_std_devs, GetDelta get_delta) {
+    check_inputs(n, k);
+    if (n == 0) { return 1.0; } // the coin was never flipped, so we know nothing
+    else if (k == n) { return 1.0; }
+    else if (k == (n - 1)) {
+      return (exact_upper_bound_on_p_k_eq_minusone(n, get_delta()));
+    }
+    else if (k == 0) {
+      return (exact_upper_bound_on_p_k_eq_zero(n, get_delta()));
+    }
+    else {
+      double x = abramowitz_stegun_formula_26p5p22(static_cast<double>(n - k), k + 1.0, num_std_devs);
+      return (1.0 - x); // which is p
+    }
+  }
+
   //@formatter:off
   // Abramowitz and Stegun formula 7.1.28, p. 88; Claims accuracy of about 7 decimal digits */
   static inline double erf_of_nonneg(double x) {
@@ -232,7 +267,13 @@ private:
     return (1.0 - (1.0 / sum16));
   }
 
+  // The whole numbers of standard deviations most callers pass are looked up, each
+  // computed as any other kappa is once, so that the results are the same.
   static inline double delta_of_num_stdevs(double kappa) {
+    static const double deltas[] = { normal_cdf(-1.0), normal_cdf(-2.0), normal_cdf(-3.0) };
+    if (kappa == 1.0) return deltas[0];
+    if (kappa == 2.0) return deltas[1];
+    if (kappa == 3.0) return deltas[2];
     return (normal_cdf(-1.0 * kappa));
   }
 
@@ -26,6 +26,9 @@
 
 namespace datasketches {
 
+// GCC and Clang compile the builtins below to one instruction (lzcnt/tzcnt or
+// bsr/bsf on x86-64, clz on AArch64), which these tables stand in for elsewhere.
+// The builtins are undefined at 0, which counts as all zeros either way.
 static const uint8_t byte_leading_zeros_table[256] = {
     8, 7, 6, 6, 5, 5, 5, 5, 4, 4, 4, 4, 4, 4, 4, 4,
     3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3, 3,
@@ -73,6 +76,9 @@ static const uint64_t FCLZ_MASK_16 = 0x000000000000ffff;
 static const uint64_t FCLZ_MASK_08 = 0x00000000000000ff;
 
 static inline uint8_t count_leading_zeros_in_u64(uint64_t input) {
+#if defined(__GNUC__)
+  return input == 0 ? 64 : static_cast<uint8_t>(__builtin_clzll(input));
+#else
   if (input > FCLZ_MASK_56)
     return      byte_leading_zeros_table[(input >> 56) & FCLZ_MASK_08];
   if (input > FCLZ_MASK_48)
@@ -89,24 +95,33 @@ static inline uint8_t count_leading_zeros_in_u64(uint64_t input) {
     return 48 + byte_leading_zeros_table[(input >>  8) & FCLZ_MASK_08];
   if (true)
     return 56 + byte_leading_zeros_table[(input      ) & FCLZ_MASK_08];
+#endif
 }
 
 static inline uint8_t count_trailing_zeros_in_u32(uint32_t input) {
+#if defined(__GNUC__)
+  return input == 0 ? 32 : static_cast<uint8_t>(__builtin_ctz(input));
+#else
   for (int i = 0; i < 4; i++) {
     const int byte = input & 0xff;
     if (byte != 0) return static_cast<uint8_t>((i << 3) + byte_trailing_zeros_table[byte]);
     input >>= 8;
   }
   return 32;
+#endif
 }
 
 static inline uint8_t count_trailing_zeros_in_u64(uint64_t input) {
+#if defined(__GNUC__)
+  return input == 0 ? 64 : static_cast<uint8_t>(__builtin_ctzll(input));
+#else
   for (int i = 0; i < 8; i++) {
     const int byte = input & 0xff;
     if (byte != 0) return static_cast<uint8_t>((i << 3) + byte_trailing_zeros_table[byte]);
     input >>= 8;
   }
   return 64;
+#endif
 }
 
 } /* namespace datasketches */
@@ -0,0 +1,78 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// The instruction sets the vectorized kernels (hashing, HLL registers, CPC bit
+// matrices, theta screening) are picked from.
+//
+// The library is built without any -m flags, so one binary runs on any CPU of
+// its architecture. On x86-64 (GCC/Clang) each kernel is compiled for its own
+// instruction set with a target attribute, and its public entry point branches
+// on best_isa(), detected once per process; the branch always goes the same way,
+// so it costs less than calling through a function pointer and leaves the
+// portable path inlinable. On AArch64 NEON is part of the baseline and is used
+// unconditionally.
+
+#ifndef CPU_FEATURES_HPP_
+#define CPU_FEATURES_HPP_
+
+#if defined(__GNUC__) && defined(__x86_64__)
+#define DATASKETCHES_X86 1
+#include <immintrin.h>
+#elif defined(__ARM_NEON) && defined(__aarch64__)
+#define DATASKETCHES_NEON 1
+#include <arm_neon.h>
+#endif
+
+namespace datasketches {
+
+namespace cpu {
+
+#ifdef DATASKETCHES_X86
+
+// Each level includes the ones before it, so a kernel is usable whenever
+// best_isa() >= the level it was compiled for:
+// AVX2 with POPCNT, which every AVX2 CPU also has;
+// AVX512 with the F and DQ subsets, which every AVX-512 CPU but the Xeon Phi has;
+// AVX512_POPCNT adding VPOPCNTDQ (Ice Lake and later).
+enum class isa { PORTABLE, AVX2, AVX512, AVX512_POPCNT };
+
+inline isa detect_isa() {
+  // also checks that the OS saves the wider registers across context switches
+  __builtin_cpu_init();
+  if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("popcnt")) return isa::PORTABLE;
+  if (!__builtin_cpu_supports("avx512f") || !__builtin_cpu_supports("avx512dq")) return isa::AVX2;
+  // GCC before 11 cannot name this feature in __builtin_cpu_supports
+#if defined(__clang__) || __GNUC__ >= 11
+  if (__builtin_cpu_supports("avx512vpopcntdq")) return isa::AVX512_POPCNT;
+#endif
+  return isa::AVX512;
+}
+
+inline isa best_isa() {
+  static const isa detected = detect_isa();
+  return detected;
+}
+
+#endif // DATASKETCHES_X86
+
+} // namespace cpu
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,92 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Counts of the internal transitions behind slow updates: theta hash tables
+// resized or rebuilt, frequent items maps purged, CPC windows moved, and HLL
+// sketches promoted from a list to a set or to registers.
+//
+// Events are only counted when built with DSRS_EVENT_STATS; otherwise
+// DATASKETCHES_COUNT_EVENT expands to nothing. Each thread counts its own,
+// which are added to the totals when it exits, so counting costs no shared
+// writes.
+
+#ifndef EVENT_COUNTERS_HPP_
+#define EVENT_COUNTERS_HPP_
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace datasketches {
+
+enum class sketch_event: uint8_t {
+  THETA_RESIZE,
+  THETA_REBUILD,
+  FI_PURGE,
+  CPC_MOVE_WINDOW,
+  HLL_LIST_TO_SET,
+  HLL_TO_ARRAY,
+};
+
+static const size_t NUM_SKETCH_EVENTS = static_cast<size_t>(sketch_event::HLL_TO_ARRAY) + 1;
+
+namespace events {
+
+// zero-initialized, as it has static storage
+inline std::atomic<uint64_t>* totals() {
+  static std::atomic<uint64_t> counts[NUM_SKETCH_EVENTS];
+  return counts;
+}
+
+struct thread_counts {
+  uint64_t counts[NUM_SKETCH_EVENTS] = {};
+
+  ~thread_counts() {
+    for (size_t i = 0; i < NUM_SKETCH_EVENTS; ++i) {
+      totals()[i].fetch_add(counts[i], std::memory_order_relaxed);
+    }
+  }
+};
+
+inline thread_counts& local() {
+  static thread_local thread_counts counts;
+  return counts;
+}
+
+} // namespace events
+
+inline void count_event(sketch_event event) {
+  events::local().counts[static_cast<size_t>(event)] += 1;
+}
+
+// Events so far, counted by threads that have exited and by this one.
+inline uint64_t event_count(sketch_event event) {
+  const size_t i = static_cast<size_t>(event);
+  return events::totals()[i].load(std::memory_order_relaxed) + events::local().counts[i];
+}
+
+} /* namespace datasketches */
+
+#ifdef DSRS_EVENT_STATS
+#define DATASKETCHES_COUNT_EVENT(event) ::datasketches::count_event(::datasketches::sketch_event::event)
+#else
+#define DATASKETCHES_COUNT_EVENT(event) ((void) 0)
+#endif
+
+#endif
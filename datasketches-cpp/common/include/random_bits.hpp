@@ -0,0 +1,124 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef RANDOM_BITS_HPP_
+#define RANDOM_BITS_HPP_
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+
+namespace datasketches {
+
+// The coin flips of KLL and REQ compactions. Each thread draws from its own
+// generator, so sketches updated on different threads share no state, and a
+// draw of 64 bits serves the next 64 flips.
+//
+// The generator is splitmix64: a Weyl sequence through a 64-bit mixer, which
+// passes BigCrush, accepts any seed and needs no 128-bit multiply.
+class random_bits {
+public:
+  explicit random_bits(uint64_t seed): state_(seed), bits_(0), left_(0) {}
+
+  void reseed(uint64_t seed) {
+    state_ = seed;
+    left_ = 0;
+  }
+
+  uint64_t next_u64() {
+    uint64_t z = (state_ += 0x9e3779b97f4a7c15ULL);
+    z = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    z = (z ^ (z >> 27)) * 0x94d049bb133111ebULL;
+    return z ^ (z >> 31);
+  }
+
+  // 0 or 1
+  uint32_t next_bit() {
+    if (left_ == 0) {
+      bits_ = next_u64();
+      left_ = 64;
+    }
+    const uint32_t bit = static_cast<uint32_t>(bits_ & 1);
+    bits_ >>= 1;
+    --left_;
+    return bit;
+  }
+
+private:
+  uint64_t state_;
+  uint64_t bits_;
+  uint8_t left_;
+};
+
+// The seed of seed_random_bits(), or 0 if none was set.
+inline std::atomic<uint64_t>& random_bits_seed() {
+  static std::atomic<uint64_t> seed{0};
+  return seed;
+}
+
+// Threads seeded since the last seed_random_bits().
+inline std::atomic<uint64_t>& random_bits_threads() {
+  static std::atomic<uint64_t> threads{0};
+  return threads;
+}
+
+// A seed apart from those of the threads seeded before it, from a seed the
+// threads share.
+inline uint64_t next_thread_random_bits_seed(uint64_t seed) {
+  const uint64_t thread = random_bits_threads().fetch_add(1, std::memory_order_relaxed);
+  return seed ^ (thread * 0xd6e8feb86659fd93ULL);
+}
+
+inline uint64_t clock_random_bits_seed() {
+  return static_cast<uint64_t>(std::chrono::system_clock::now().time_since_epoch().count());
+}
+
+// Seeds a thread's generator on its first draw: from seed_random_bits(), if it
+// was called, and otherwise from the clock, apart for every thread even if they
+// start within one tick.
+inline uint64_t initial_random_bits_seed() {
+  const uint64_t seed = random_bits_seed().load(std::memory_order_relaxed);
+  return next_thread_random_bits_seed(seed != 0 ? seed : clock_random_bits_seed());
+}
+
+inline random_bits& thread_random_bits() {
+  static thread_local random_bits bits(initial_random_bits_seed());
+  return bits;
+}
+
+// Makes compactions reproducible for benchmarks and tests. The seed is
+// process-wide: it reseeds this thread's generator and seeds every thread that
+// draws its first bit after this, each from the seed and the order in which it
+// drew, so threads never draw the same bits. Threads that drew before keep
+// their generators. A seed of 0 restores seeding from the clock.
+inline void seed_random_bits(uint64_t seed) {
+  random_bits& bits = thread_random_bits(); // seeded first, so it does not count
+  random_bits_seed().store(seed, std::memory_order_relaxed);
+  random_bits_threads().store(0, std::memory_order_relaxed);
+  bits.reseed(next_thread_random_bits_seed(seed != 0 ? seed : clock_random_bits_seed()));
+}
+
+// Reseeds only this thread's generator, leaving every other thread's as is.
+inline void seed_thread_random_bits(uint64_t seed) {
+  thread_random_bits().reseed(seed);
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -118,11 +118,10 @@ struct serde<std::string> {
         uint32_t length;
         is.read((char*)&length, sizeof(length));
         if (!is.good()) { break; }
-        std::string str;
-        str.reserve(length);
-        for (uint32_t j = 0; j < length; j++) {
-          str.push_back(static_cast<char>(is.get()));
-        }
+        // read in one call rather than a character at a time; strings are contiguous
+        // from C++11 on, so &str[0] may be written through
+        std::string str(length, '\0');
+        if (length > 0) is.read(&str[0], length);
         if (!is.good()) { break; }
         new (&items[i]) std::string(std::move(str));
       }
@@ -0,0 +1,121 @@
+#ifndef _COUNT_MIN_SKETCH_HPP_
+#define _COUNT_MIN_SKETCH_HPP_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "common_defs.hpp"
+#include "MurmurHash3.h"
+
+namespace datasketches {
+
+/*
+ * A count-min sketch answers point queries for the total weight of any item, retained or
+ * not, in fixed memory. Unlike frequent_items_sketch, it never drops an item: estimates
+ * only ever overcount, by the weight of other items colliding with the queried one.
+ *
+ * This is a blocked variant. The counters are split into cache-line-sized blocks, and
+ * an item's hash picks one block, then one counter in each of num_hashes disjoint
+ * stripes of that block. So an update or query touches a single cache line, rather
+ * than one per row as in the textbook layout, which has num_hashes rows each spread
+ * over all of memory.
+ *
+ * With B blocks of C counters each, every stripe spans C / num_hashes counters, so the
+ * rows have the same width, w = B * C / num_hashes, as a textbook sketch of the same
+ * memory. An estimate overcounts by at most e/w of the total weight in each row with
+ * probability 1 - 1/e, but since the rows share a block their collisions are not
+ * independent, and the usual 1 - e^-num_hashes confidence only holds loosely.
+ *
+ * W is the counter type, which must be unsigned and divide the block size.
+ */
+template<typename W = uint64_t, typename A = std::allocator<W>>
+class count_min_sketch {
+public:
+  static const size_t BLOCK_BYTES = 64;
+  static const uint8_t COUNTERS_PER_BLOCK = BLOCK_BYTES / sizeof(W);
+  static const uint8_t MAX_LG_NUM_BLOCKS = 26;
+
+  /**
+   * Constructs an empty sketch of 2^lg_num_blocks blocks of 64 bytes.
+   * @param lg_num_blocks log2 of the number of blocks, at most MAX_LG_NUM_BLOCKS
+   * @param num_hashes counters per item, which must divide COUNTERS_PER_BLOCK
+   * @param seed for the hash function, which sketches must share to be merged
+   */
+  count_min_sketch(uint8_t lg_num_blocks, uint8_t num_hashes, uint64_t seed = DEFAULT_SEED, const A& allocator = A());
+
+  uint8_t get_lg_num_blocks() const;
+  uint8_t get_num_hashes() const;
+  uint64_t get_seed() const;
+  bool is_empty() const;
+
+  /**
+   * @return total weight of all updates, which bounds every estimate
+   */
+  W get_total_weight() const;
+
+  /**
+   * Adds weight to the item of the given bytes.
+   */
+  void update(const void* data, size_t length, W weight = 1);
+  void update(const std::string& item, W weight = 1);
+
+  /**
+   * Adds weight to each of num items packed into data, item i spanning
+   * [ends[i-1], ends[i]) with ends[-1] taken as 0. Items are hashed a block at a
+   * time and their cache lines prefetched before any is updated, so that the
+   * misses overlap.
+   */
+  void update_batch(const uint8_t* data, const size_t* ends, size_t num, W weight = 1);
+
+  /**
+   * @return an upper bound on the total weight of the item of the given bytes
+   */
+  W get_estimate(const void* data, size_t length) const;
+  W get_estimate(const std::string& item) const;
+
+  /**
+   * Adds the counters of other, which must have the same shape and seed, to this one's.
+   */
+  void merge(const count_min_sketch& other);
+
+  using vector_bytes = std::vector<uint8_t, typename std::allocator_traits<A>::template rebind_alloc<uint8_t>>;
+
+  /**
+   * Serializes the sketch: its shape, seed hash, total weight and every counter.
+   */
+  vector_bytes serialize(unsigned header_size_bytes = 0) const;
+
+  /**
+   * Deserializes a sketch serialized with the same seed.
+   */
+  static count_min_sketch deserialize(const void* bytes, size_t size, uint64_t seed = DEFAULT_SEED, const A& allocator = A());
+
+private:
+  static const uint8_t SERIAL_VERSION = 1;
+  // Not a family of the DataSketches libraries, whose serialized forms these are not.
+  static const uint8_t FAMILY_ID = 0xc1;
+  static const size_t HEADER_BYTES = 16;
+  static const size_t PREFETCH_BLOCK = 32;
+
+  uint8_t lg_num_blocks_;
+  uint8_t num_hashes_;
+  uint64_t seed_;
+  W total_weight_;
+  // One block more than needed, so that the blocks can start on a cache line.
+  std::vector<W, A> counters_;
+
+  W* blocks();
+  const W* blocks() const;
+  HashState hash(const void* data, size_t length) const;
+  // The first counter of the block of the item of the given hash.
+  size_t block_of(const HashState& hashes) const;
+  void add(const HashState& hashes, W weight);
+};
+
+} /* namespace datasketches */
+
+#include "count_min_sketch_impl.hpp"
+
+#endif
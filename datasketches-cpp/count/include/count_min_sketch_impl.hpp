@@ -0,0 +1,229 @@
+#ifndef _COUNT_MIN_SKETCH_IMPL_HPP_
+#define _COUNT_MIN_SKETCH_IMPL_HPP_
+
+#include <cstring>
+#include <stdexcept>
+#include <type_traits>
+
+#include "memory_operations.hpp"
+
+namespace datasketches {
+
+template<typename W, typename A>
+count_min_sketch<W, A>::count_min_sketch(uint8_t lg_num_blocks, uint8_t num_hashes, uint64_t seed, const A& allocator):
+lg_num_blocks_(lg_num_blocks),
+num_hashes_(num_hashes),
+seed_(seed),
+total_weight_(0),
+counters_(allocator)
+{
+  static_assert(std::is_unsigned<W>::value, "counters must be unsigned");
+  static_assert(BLOCK_BYTES % sizeof(W) == 0, "counters must divide the block size");
+  if (lg_num_blocks > MAX_LG_NUM_BLOCKS) {
+    throw std::invalid_argument("lg_num_blocks must not exceed " + std::to_string(MAX_LG_NUM_BLOCKS) + ": " + std::to_string(lg_num_blocks));
+  }
+  if (num_hashes == 0 || COUNTERS_PER_BLOCK % num_hashes != 0) {
+    throw std::invalid_argument("num_hashes must divide " + std::to_string(COUNTERS_PER_BLOCK) + ": " + std::to_string(num_hashes));
+  }
+  counters_.resize((static_cast<size_t>(1) << lg_num_blocks) * COUNTERS_PER_BLOCK + COUNTERS_PER_BLOCK, 0);
+}
+
+template<typename W, typename A>
+uint8_t count_min_sketch<W, A>::get_lg_num_blocks() const {
+  return lg_num_blocks_;
+}
+
+template<typename W, typename A>
+uint8_t count_min_sketch<W, A>::get_num_hashes() const {
+  return num_hashes_;
+}
+
+template<typename W, typename A>
+uint64_t count_min_sketch<W, A>::get_seed() const {
+  return seed_;
+}
+
+template<typename W, typename A>
+bool count_min_sketch<W, A>::is_empty() const {
+  return total_weight_ == 0;
+}
+
+template<typename W, typename A>
+W count_min_sketch<W, A>::get_total_weight() const {
+  return total_weight_;
+}
+
+template<typename W, typename A>
+W* count_min_sketch<W, A>::blocks() {
+  return const_cast<W*>(static_cast<const count_min_sketch*>(this)->blocks());
+}
+
+template<typename W, typename A>
+const W* count_min_sketch<W, A>::blocks() const {
+  // recomputed rather than stored, so that copies and moves need no fixing up
+  const size_t misalignment = reinterpret_cast<uintptr_t>(counters_.data()) % BLOCK_BYTES;
+  return counters_.data() + (misalignment == 0 ? 0 : (BLOCK_BYTES - misalignment) / sizeof(W));
+}
+
+template<typename W, typename A>
+HashState count_min_sketch<W, A>::hash(const void* data, size_t length) const {
+  HashState hashes;
+  MurmurHash3_x64_128(data, length, seed_, hashes);
+  return hashes;
+}
+
+template<typename W, typename A>
+size_t count_min_sketch<W, A>::block_of(const HashState& hashes) const {
+  return (hashes.h1 & ((static_cast<size_t>(1) << lg_num_blocks_) - 1)) * COUNTERS_PER_BLOCK;
+}
+
+// The item's counter in stripe i of its block is picked by the i-th group of
+// bits of h2. Stripes are powers of two, since blocks are, so groups never
+// straddle a stripe.
+
+template<typename W, typename A>
+void count_min_sketch<W, A>::add(const HashState& hashes, W weight) {
+  W* counters = blocks() + block_of(hashes);
+  const unsigned stripe = COUNTERS_PER_BLOCK / num_hashes_;
+  const unsigned bits = log2(stripe);
+  uint64_t choices = hashes.h2;
+  for (unsigned i = 0; i < num_hashes_; ++i) {
+    counters[i * stripe + (choices & (stripe - 1))] += weight;
+    choices >>= bits;
+  }
+  total_weight_ += weight;
+}
+
+template<typename W, typename A>
+void count_min_sketch<W, A>::update(const void* data, size_t length, W weight) {
+  if (weight == 0) return;
+  add(hash(data, length), weight);
+}
+
+template<typename W, typename A>
+void count_min_sketch<W, A>::update(const std::string& item, W weight) {
+  update(item.data(), item.size(), weight);
+}
+
+template<typename W, typename A>
+void count_min_sketch<W, A>::update_batch(const uint8_t* data, const size_t* ends, size_t num, W weight) {
+  if (weight == 0) return;
+  HashState hashes[PREFETCH_BLOCK];
+  size_t start = 0;
+  size_t i = 0;
+  while (i < num) {
+    const size_t block = num - i < PREFETCH_BLOCK ? num - i : PREFETCH_BLOCK;
+    for (size_t j = 0; j < block; ++j) {
+      const size_t end = ends[i++];
+      hashes[j] = hash(data + start, end - start);
+      start = end;
+#if defined(__GNUC__)
+      __builtin_prefetch(blocks() + block_of(hashes[j]), 1);
+#endif
+    }
+    for (size_t j = 0; j < block; ++j) add(hashes[j], weight);
+  }
+}
+
+template<typename W, typename A>
+W count_min_sketch<W, A>::get_estimate(const void* data, size_t length) const {
+  const HashState hashes = hash(data, length);
+  const W* counters = blocks() + block_of(hashes);
+  const unsigned stripe = COUNTERS_PER_BLOCK / num_hashes_;
+  const unsigned bits = log2(stripe);
+  uint64_t choices = hashes.h2;
+  W estimate = counters[choices & (stripe - 1)];
+  for (unsigned i = 1; i < num_hashes_; ++i) {
+    choices >>= bits;
+    const W counter = counters[i * stripe + (choices & (stripe - 1))];
+    if (counter < estimate) estimate = counter;
+  }
+  return estimate;
+}
+
+template<typename W, typename A>
+W count_min_sketch<W, A>::get_estimate(const std::string& item) const {
+  return get_estimate(item.data(), item.size());
+}
+
+template<typename W, typename A>
+void count_min_sketch<W, A>::merge(const count_min_sketch& other) {
+  if (lg_num_blocks_ != other.lg_num_blocks_ || num_hashes_ != other.num_hashes_) {
+    throw std::invalid_argument("incompatible sketch shapes: lg_num_blocks " + std::to_string(lg_num_blocks_)
+        + " and " + std::to_string(other.lg_num_blocks_) + ", num_hashes " + std::to_string(num_hashes_)
+        + " and " + std::to_string(other.num_hashes_));
+  }
+  if (seed_ != other.seed_) throw std::invalid_argument("incompatible seeds");
+  const size_t num_counters = (static_cast<size_t>(1) << lg_num_blocks_) * COUNTERS_PER_BLOCK;
+  W* counters = blocks();
+  const W* others = other.blocks();
+  for (size_t i = 0; i < num_counters; ++i) counters[i] += others[i];
+  total_weight_ += other.total_weight_;
+}
+
+template<typename W, typename A>
+auto count_min_sketch<W, A>::serialize(unsigned header_size_bytes) const -> vector_bytes {
+  const size_t counter_bytes = (static_cast<size_t>(1) << lg_num_blocks_) * BLOCK_BYTES;
+  vector_bytes bytes(header_size_bytes + HEADER_BYTES + counter_bytes, 0, counters_.get_allocator());
+  uint8_t* ptr = bytes.data() + header_size_bytes;
+  const uint8_t serial_version = SERIAL_VERSION;
+  ptr += copy_to_mem(serial_version, ptr);
+  const uint8_t family = FAMILY_ID;
+  ptr += copy_to_mem(family, ptr);
+  ptr += copy_to_mem(lg_num_blocks_, ptr);
+  ptr += copy_to_mem(num_hashes_, ptr);
+  const uint8_t bytes_per_counter = sizeof(W);
+  ptr += copy_to_mem(bytes_per_counter, ptr);
+  ptr += sizeof(uint8_t); // unused
+  const uint16_t seed_hash = compute_seed_hash(seed_);
+  ptr += copy_to_mem(seed_hash, ptr);
+  const uint64_t total_weight = total_weight_;
+  ptr += copy_to_mem(total_weight, ptr);
+  copy_to_mem(blocks(), ptr, counter_bytes);
+  return bytes;
+}
+
+template<typename W, typename A>
+count_min_sketch<W, A> count_min_sketch<W, A>::deserialize(const void* bytes, size_t size, uint64_t seed, const A& allocator) {
+  ensure_minimum_memory(size, HEADER_BYTES);
+  const char* ptr = static_cast<const char*>(bytes);
+  uint8_t serial_version;
+  ptr += copy_from_mem(ptr, serial_version);
+  uint8_t family_id;
+  ptr += copy_from_mem(ptr, family_id);
+  uint8_t lg_num_blocks;
+  ptr += copy_from_mem(ptr, lg_num_blocks);
+  uint8_t num_hashes;
+  ptr += copy_from_mem(ptr, num_hashes);
+  uint8_t bytes_per_counter;
+  ptr += copy_from_mem(ptr, bytes_per_counter);
+  ptr += sizeof(uint8_t); // unused
+  uint16_t seed_hash;
+  ptr += copy_from_mem(ptr, seed_hash);
+  uint64_t total_weight;
+  ptr += copy_from_mem(ptr, total_weight);
+
+  if (serial_version != SERIAL_VERSION) {
+    throw std::invalid_argument("Possible corruption: serial version must be " + std::to_string(SERIAL_VERSION) + ": " + std::to_string(serial_version));
+  }
+  if (family_id != FAMILY_ID) {
+    throw std::invalid_argument("Possible corruption: family ID must be " + std::to_string(FAMILY_ID) + ": " + std::to_string(family_id));
+  }
+  if (bytes_per_counter != sizeof(W)) {
+    throw std::invalid_argument("Possible corruption: counters must take " + std::to_string(sizeof(W)) + " bytes: " + std::to_string(bytes_per_counter));
+  }
+  if (seed_hash != compute_seed_hash(seed)) {
+    throw std::invalid_argument("Incompatible seed hashes: " + std::to_string(seed_hash) + ", " + std::to_string(compute_seed_hash(seed)));
+  }
+  // checks the shape before the size it implies
+  count_min_sketch sketch(lg_num_blocks, num_hashes, seed, allocator);
+  const size_t counter_bytes = (static_cast<size_t>(1) << lg_num_blocks) * BLOCK_BYTES;
+  ensure_minimum_memory(size, HEADER_BYTES + counter_bytes);
+  copy_from_mem(ptr, sketch.blocks(), counter_bytes);
+  sketch.total_weight_ = static_cast<W>(total_weight);
+  return sketch;
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,58 @@
+#include <cstdint>
+
+#include "rust/cxx.h"
+#include "count/include/count_min_sketch.hpp"
+
+#include "count_min.hpp"
+
+OpaqueCountMinSketch::OpaqueCountMinSketch(cmsketch&& sketch):
+  inner_{std::move(sketch)} {
+}
+
+uint64_t OpaqueCountMinSketch::estimate(rust::Slice<const uint8_t> buf) const {
+  return this->inner_.get_estimate(buf.data(), buf.size());
+}
+
+uint64_t OpaqueCountMinSketch::get_total_weight() const {
+  return this->inner_.get_total_weight();
+}
+
+uint8_t OpaqueCountMinSketch::get_lg_num_blocks() const {
+  return this->inner_.get_lg_num_blocks();
+}
+
+uint8_t OpaqueCountMinSketch::get_num_hashes() const {
+  return this->inner_.get_num_hashes();
+}
+
+void OpaqueCountMinSketch::update(rust::Slice<const uint8_t> buf, uint64_t weight) {
+  this->inner_.update(buf.data(), buf.size(), weight);
+}
+
+void OpaqueCountMinSketch::update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, uint64_t weight) {
+  this->inner_.update_batch(buf.data(), ends.data(), ends.size(), weight);
+}
+
+void OpaqueCountMinSketch::merge(const OpaqueCountMinSketch& other) {
+  this->inner_.merge(other.inner_);
+}
+
+std::unique_ptr<OpaqueCountMinSketch> OpaqueCountMinSketch::clone() const {
+  cmsketch copy = this->inner_;
+  return std::unique_ptr<OpaqueCountMinSketch>(new OpaqueCountMinSketch(std::move(copy)));
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueCountMinSketch::serialize() const {
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(v.begin(), v.end()));
+}
+
+std::unique_ptr<OpaqueCountMinSketch> new_opaque_count_min_sketch(uint8_t lg_num_blocks, uint8_t num_hashes) {
+  OpaqueCountMinSketch::cmsketch sketch(lg_num_blocks, num_hashes);
+  return std::unique_ptr<OpaqueCountMinSketch>(new OpaqueCountMinSketch(std::move(sketch)));
+}
+
+std::unique_ptr<OpaqueCountMinSketch> deserialize_opaque_count_min_sketch(rust::Slice<const uint8_t> buf) {
+  auto sketch = OpaqueCountMinSketch::cmsketch::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueCountMinSketch>(new OpaqueCountMinSketch(std::move(sketch)));
+}
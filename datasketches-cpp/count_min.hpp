@@ -0,0 +1,31 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "rust/cxx.h"
+#include "count/include/count_min_sketch.hpp"
+
+class OpaqueCountMinSketch {
+public:
+  typedef datasketches::count_min_sketch<uint64_t> cmsketch;
+  uint64_t estimate(rust::Slice<const uint8_t> buf) const;
+  uint64_t get_total_weight() const;
+  uint8_t get_lg_num_blocks() const;
+  uint8_t get_num_hashes() const;
+  void update(rust::Slice<const uint8_t> buf, uint64_t weight);
+  // Key i spans [ends[i-1], ends[i]) of buf, with ends[-1] taken as 0.
+  void update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, uint64_t weight);
+  void merge(const OpaqueCountMinSketch& other);
+  std::unique_ptr<OpaqueCountMinSketch> clone() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize() const;
+private:
+  OpaqueCountMinSketch(cmsketch&& sketch);
+  friend std::unique_ptr<OpaqueCountMinSketch> new_opaque_count_min_sketch(uint8_t lg_num_blocks, uint8_t num_hashes);
+  friend std::unique_ptr<OpaqueCountMinSketch> deserialize_opaque_count_min_sketch(rust::Slice<const uint8_t> buf);
+  cmsketch inner_;
+};
+
+std::unique_ptr<OpaqueCountMinSketch> new_opaque_count_min_sketch(uint8_t lg_num_blocks, uint8_t num_hashes);
+std::unique_ptr<OpaqueCountMinSketch> deserialize_opaque_count_min_sketch(rust::Slice<const uint8_t> buf);
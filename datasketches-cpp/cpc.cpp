@@ -1,79 +1,162 @@
 #include <cstdint>
-#include <ios>
-#include <sstream>
-#include <iostream>
 
 #include "rust/cxx.h"
 #include "cpc/include/cpc_sketch.hpp"
 
+#include "batch.hpp"
 #include "cpc.hpp"
+#include "dsrs/src/bridge.rs.h"
 
-OpaqueCpcSketch::OpaqueCpcSketch():
-  inner_{} {
+OpaqueCpcSketch::OpaqueCpcSketch(uint8_t lg_k):
+  inner_{lg_k},
+  estimate_{0},
+  dirty_{true} {
 }
 
-OpaqueCpcSketch::OpaqueCpcSketch(datasketches::cpc_sketch&& cpc):
-  inner_{std::move(cpc)} {
+OpaqueCpcSketch::OpaqueCpcSketch(cpc_sketch&& cpc):
+  inner_{std::move(cpc)},
+  estimate_{0},
+  dirty_{true} {
 }
 
-OpaqueCpcSketch::OpaqueCpcSketch(std::istream& is):
-  inner_{datasketches::cpc_sketch::deserialize(is)} {
+
+bool OpaqueCpcSketch::is_dirty() const {
+  return this->dirty_.load(std::memory_order_acquire);
 }
 
+void OpaqueCpcSketch::update_u64_batch(rust::Slice<const uint64_t> values) {
+  this->dirty_.store(true, std::memory_order_relaxed);
+  this->inner_.update_batch(values.data(), values.size());
+}
 
-double OpaqueCpcSketch::estimate() const {
-  return this->inner_.get_estimate();
+void OpaqueCpcSketch::update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends) {
+  this->dirty_.store(true, std::memory_order_relaxed);
+  const uint8_t* data = buf.data();
+  if (all_16_byte_keys(ends)) {
+    this->inner_.update_batch_16(data, ends.size());
+    return;
+  }
+  size_t start = 0;
+  for (const size_t end : ends) {
+    this->inner_.update(data + start, end - start);
+    start = end;
+  }
 }
 
-void OpaqueCpcSketch::update(rust::Slice<const uint8_t> buf) {
-  this->inner_.update(buf.data(), buf.size());
+void OpaqueCpcSketch::update_hashed(KeyHash hash) {
+  this->dirty_.store(true, std::memory_order_relaxed);
+  this->inner_.update_hashes(&hash, 1);
+}
+
+void OpaqueCpcSketch::update_hashed_batch(rust::Slice<const KeyHash> hashes) {
+  this->dirty_.store(true, std::memory_order_relaxed);
+  this->inner_.update_hashes(hashes.data(), hashes.size());
+}
+
+void OpaqueCpcSketch::update_coupons(rust::Slice<const uint32_t> coupons) {
+  this->dirty_.store(true, std::memory_order_relaxed);
+  this->inner_.update_coupons(coupons.data(), coupons.size());
+}
+
+void OpaqueCpcSketch::reset() {
+  this->dirty_.store(true, std::memory_order_relaxed);
+  this->inner_.reset();
 }
 
-void OpaqueCpcSketch::update_u64(uint64_t value) {
-  this->inner_.update(value);
+uint8_t OpaqueCpcSketch::get_lg_k() const {
+  return this->inner_.get_lg_k();
 }
 
 std::unique_ptr<std::vector<uint8_t>> OpaqueCpcSketch::serialize() const {
-  // TODO: could use a custom streambuf to avoid the
-  // stream -> vec copy https://stackoverflow.com/a/13059195/1779853
-  std::stringstream s{};
-  auto start = s.tellg();
-  this->inner_.serialize(s);
-  s.seekg(0, std::ios::end);
-  auto stop = s.tellg();
+  // vector_bytes uses the sketch's arena_allocator, so it takes one copy into
+  // a std::vector, but still no intermediate stream.
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(v.begin(), v.end()));
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueCpcSketch::serialize_without_hip() const {
+  auto v = this->inner_.serialize(0, false);
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(v.begin(), v.end()));
+}
+
+size_t OpaqueCpcSketch::get_serialized_size_bytes(bool with_hip) const {
+  return this->inner_.get_serialized_size_bytes(with_hip);
+}
 
-  std::vector<uint8_t> v(std::size_t(stop-start));
-  s.seekg(0, std::ios::beg);
-  s.read(reinterpret_cast<char*>(v.data()), std::streamsize(v.size()));
+size_t OpaqueCpcSketch::get_memory_usage_bytes() const {
+  return this->inner_.get_memory_usage_bytes();
+}
 
-  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(std::move(v)));
+size_t OpaqueCpcSketch::serialize_into(rust::Slice<uint8_t> buf, bool with_hip) const {
+  return this->inner_.serialize_into(buf.data(), buf.size(), with_hip);
 }
 
-std::unique_ptr<OpaqueCpcSketch> new_opaque_cpc_sketch() {
-  return std::unique_ptr<OpaqueCpcSketch>(new OpaqueCpcSketch{});
+std::unique_ptr<OpaqueCpcSketch> new_opaque_cpc_sketch(uint8_t lg_k) {
+  return std::unique_ptr<OpaqueCpcSketch>(new OpaqueCpcSketch{lg_k});
 }
 
 std::unique_ptr<OpaqueCpcSketch> deserialize_opaque_cpc_sketch(rust::Slice<const uint8_t> buf) {
-  // TODO: could use a custom streambuf to avoid the slice -> stream copy
-  std::stringstream s{};
-  s.write(const_cast<char*>(reinterpret_cast<const char*>(buf.data())), std::streamsize(buf.size()));
-  s.seekg(0, std::ios::beg);
-  return std::unique_ptr<OpaqueCpcSketch>(new OpaqueCpcSketch{s});
+  // Parses straight out of the Rust-owned slice, no stream copy.
+  auto cpc = cpc_sketch::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueCpcSketch>(new OpaqueCpcSketch{std::move(cpc)});
+}
+
+double estimate_serialized_cpc_sketch(rust::Slice<const uint8_t> buf) {
+  return cpc_sketch::get_serialized_estimate(buf.data(), buf.size());
 }
 
-OpaqueCpcUnion::OpaqueCpcUnion():
-  inner_{} {
+EstimateBounds bounds_serialized_cpc_sketch(rust::Slice<const uint8_t> buf, uint8_t kappa) {
+  EstimateBounds result;
+  cpc_sketch::get_serialized_bounds(buf.data(), buf.size(), kappa, result.estimate, result.lower_bound, result.upper_bound);
+  return result;
+}
+
+uint32_t cpc_coupon(rust::Slice<const uint8_t> buf, uint8_t lg_k) {
+  return cpc_sketch::get_coupon(buf.data(), buf.size(), lg_k);
+}
+
+void init_cpc() {
+  datasketches::cpc_init<cpc_sketch::allocator_type>();
+}
+
+OpaqueCpcUnion::OpaqueCpcUnion(uint8_t lg_k):
+  inner_{lg_k} {
 }
 
 std::unique_ptr<OpaqueCpcSketch> OpaqueCpcUnion::sketch() const {
-  return std::unique_ptr<OpaqueCpcSketch>(new OpaqueCpcSketch{this->inner_.get_result()});
+  if (!this->result_) this->result_.reset(new cpc_sketch{this->inner_.get_result()});
+  return std::unique_ptr<OpaqueCpcSketch>(new OpaqueCpcSketch{cpc_sketch{*this->result_}});
 }
 
 void OpaqueCpcUnion::merge(std::unique_ptr<OpaqueCpcSketch> to_add) {
+  this->result_.reset();
   this->inner_.update(std::move(to_add->inner_));
 }
 
+void OpaqueCpcUnion::merge_serialized(rust::Slice<const uint8_t> buf) {
+  this->result_.reset();
+  // Merges from the compressed form, without building the sketch.
+  this->inner_.update(buf.data(), buf.size());
+}
+
+void OpaqueCpcUnion::reset() {
+  this->result_.reset();
+  this->inner_.reset();
+}
+
+std::unique_ptr<OpaqueCpcUnion> new_opaque_cpc_union(uint8_t lg_k) {
+  return std::unique_ptr<OpaqueCpcUnion>(new OpaqueCpcUnion{lg_k});
+}
+
+OpaqueCpcArena::OpaqueCpcArena():
+  arena_{std::make_shared<arena>()} {
+}
+
+std::unique_ptr<OpaqueCpcSketch> OpaqueCpcArena::sketch(uint8_t lg_k) const {
+  cpc_sketch cpc(lg_k, datasketches::DEFAULT_SEED, arena_allocator<uint8_t>(this->arena_));
+  return std::unique_ptr<OpaqueCpcSketch>(new OpaqueCpcSketch{std::move(cpc)});
+}
 
-std::unique_ptr<OpaqueCpcUnion> new_opaque_cpc_union() {
-  return std::unique_ptr<OpaqueCpcUnion>(new OpaqueCpcUnion{});
+std::unique_ptr<OpaqueCpcArena> new_opaque_cpc_arena() {
+  return std::unique_ptr<OpaqueCpcArena>(new OpaqueCpcArena{});
 }
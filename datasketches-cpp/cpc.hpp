@@ -1,7 +1,7 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
-#include <iostream>
 #include <vector>
 #include <memory>
 
@@ -9,33 +9,122 @@
 #include "cpc/include/cpc_sketch.hpp"
 #include "cpc/include/cpc_union.hpp"
 
+#include "arena.hpp"
+
+struct EstimateBounds;
+struct KeyHash;
+
+// Sketches are either on the heap, like the stock cpc_sketch, or in an
+// OpaqueCpcArena; both kinds share one type so they can be merged together.
+using cpc_sketch = datasketches::cpc_sketch_alloc<arena_allocator<uint8_t>>;
+using cpc_union = datasketches::cpc_union_alloc<arena_allocator<uint8_t>>;
+
 class OpaqueCpcSketch {
 public:
-  double estimate() const;
-  void update(rust::Slice<const uint8_t> buf);
-  void update_u64(uint64_t value);
+  // Cached between updates, for callers polling far more often than they update.
+  double estimate() const noexcept;
+  // Whether the sketch was updated since estimate() last computed its estimate.
+  bool is_dirty() const;
+  void update(rust::Slice<const uint8_t> buf) noexcept;
+  void update_u64(uint64_t value) noexcept;
+  void update_u64_batch(rust::Slice<const uint64_t> values);
+  // Key i spans [ends[i-1], ends[i]) of buf, with ends[-1] taken as 0.
+  void update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends);
+  // In place of update(), with the hash_key() of its buf.
+  void update_hashed(KeyHash hash);
+  // In place of update_bytes_batch(), with the hash_keys() of its keys.
+  void update_hashed_batch(rust::Slice<const KeyHash> hashes);
+  // Replays coupons from cpc_coupon(), in the order of the updates they came from.
+  void update_coupons(rust::Slice<const uint32_t> coupons);
+  // Empties the sketch, keeping its buffers (and arena, if any) for reuse.
+  void reset();
+  uint8_t get_lg_k() const;
   std::unique_ptr<std::vector<uint8_t>> serialize() const;
+  // As serialize(), but without the HIP state that unions ignore.
+  std::unique_ptr<std::vector<uint8_t>> serialize_without_hip() const;
+  size_t get_serialized_size_bytes(bool with_hip) const;
+  // Heap bytes held by the sketch's table and window, wherever they came from.
+  size_t get_memory_usage_bytes() const;
+  // Writes serialize() (or serialize_without_hip()) into buf only if it fits,
+  // and returns its size either way.
+  size_t serialize_into(rust::Slice<uint8_t> buf, bool with_hip) const;
 private:
-  OpaqueCpcSketch();
-  OpaqueCpcSketch(datasketches::cpc_sketch&& cpc);
-  OpaqueCpcSketch(std::istream& is);
-  friend std::unique_ptr<OpaqueCpcSketch> new_opaque_cpc_sketch();
+  OpaqueCpcSketch(uint8_t lg_k);
+  OpaqueCpcSketch(cpc_sketch&& cpc);
+  friend std::unique_ptr<OpaqueCpcSketch> new_opaque_cpc_sketch(uint8_t lg_k);
   friend std::unique_ptr<OpaqueCpcSketch> deserialize_opaque_cpc_sketch(rust::Slice<const uint8_t> buf);
   friend class OpaqueCpcUnion;
-  datasketches::cpc_sketch inner_;
+  friend class OpaqueCpcArena;
+  cpc_sketch inner_;
+  // The last estimate(), which stays valid until the next update. Atomic so
+  // that a sketch can be queried and serialized from many threads at once.
+  mutable std::atomic<double> estimate_;
+  mutable std::atomic<bool> dirty_;
 };
 
-std::unique_ptr<OpaqueCpcSketch> new_opaque_cpc_sketch();
+// The calls made once per value are defined here rather than in cpc.cpp, so
+// that the shims cxx generates around them, which include this header, inline
+// them, and a call from Rust is one call rather than two even without
+// cross-language LTO. cxx terminates on any exception escaping a call that is
+// not declared to return a Result, so noexcept only states what holds anyway.
+
+inline double OpaqueCpcSketch::estimate() const noexcept {
+  // threads racing to fill the cache each store the same estimate
+  if (this->dirty_.load(std::memory_order_acquire)) {
+    this->estimate_.store(this->inner_.get_estimate(), std::memory_order_relaxed);
+    this->dirty_.store(false, std::memory_order_release);
+  }
+  return this->estimate_.load(std::memory_order_relaxed);
+}
+
+inline void OpaqueCpcSketch::update(rust::Slice<const uint8_t> buf) noexcept {
+  this->dirty_.store(true, std::memory_order_relaxed);
+  this->inner_.update(buf.data(), buf.size());
+}
+
+inline void OpaqueCpcSketch::update_u64(uint64_t value) noexcept {
+  this->dirty_.store(true, std::memory_order_relaxed);
+  this->inner_.update(value);
+}
+
+std::unique_ptr<OpaqueCpcSketch> new_opaque_cpc_sketch(uint8_t lg_k);
 std::unique_ptr<OpaqueCpcSketch> deserialize_opaque_cpc_sketch(rust::Slice<const uint8_t> buf);
+// Equals deserialize_opaque_cpc_sketch(buf)->estimate(), from the preamble alone.
+double estimate_serialized_cpc_sketch(rust::Slice<const uint8_t> buf);
+// The estimate and kappa-sigma bounds of deserialize_opaque_cpc_sketch(buf), from the preamble alone.
+EstimateBounds bounds_serialized_cpc_sketch(rust::Slice<const uint8_t> buf, uint8_t kappa);
+// The coupon that OpaqueCpcSketch::update(buf) inserts into a sketch with this lg_k.
+uint32_t cpc_coupon(rust::Slice<const uint8_t> buf, uint8_t lg_k);
+// Makes the compressor's decoding tables, all of which are otherwise made on first use.
+void init_cpc();
 
 class OpaqueCpcUnion {
 public:
+  // Kept until the next merge, so asking again only copies it.
   std::unique_ptr<OpaqueCpcSketch> sketch() const;
   void merge(std::unique_ptr<OpaqueCpcSketch> to_add);
+  void merge_serialized(rust::Slice<const uint8_t> buf);
+  void reset();
+private:
+  OpaqueCpcUnion(uint8_t lg_k);
+  cpc_union inner_;
+  // The last sketch(), or null once a merge may have changed it.
+  mutable std::unique_ptr<cpc_sketch> result_;
+  friend std::unique_ptr<OpaqueCpcUnion> new_opaque_cpc_union(uint8_t lg_k);
+};
+
+std::unique_ptr<OpaqueCpcUnion> new_opaque_cpc_union(uint8_t lg_k);
+
+// A pool shared by many sketches, which all free their memory back into it.
+// The pool itself is released once it and all sketches allocated from it are
+// gone.
+class OpaqueCpcArena {
+public:
+  std::unique_ptr<OpaqueCpcSketch> sketch(uint8_t lg_k) const;
 private:
-  OpaqueCpcUnion();
-  datasketches::cpc_union inner_;
-  friend std::unique_ptr<OpaqueCpcUnion> new_opaque_cpc_union();
+  OpaqueCpcArena();
+  friend std::unique_ptr<OpaqueCpcArena> new_opaque_cpc_arena();
+  std::shared_ptr<arena> arena_;
 };
 
-std::unique_ptr<OpaqueCpcUnion> new_opaque_cpc_union();
+std::unique_ptr<OpaqueCpcArena> new_opaque_cpc_arena();
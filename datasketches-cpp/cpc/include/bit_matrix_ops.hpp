@@ -0,0 +1,339 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Row kernels over CPC bit matrices (one uint64_t row per slot, k rows), used
+// when merging windowed sketches into a union and when summarizing a matrix.
+//
+// On x86-64 (GCC/Clang) AVX2 and AVX-512 kernels are picked at runtime, as
+// cpu_features.hpp describes, so the library still builds without any -m flags;
+// on AArch64 NEON is always there. Every kernel computes exactly what the
+// portable loop does.
+
+#ifndef BIT_MATRIX_OPS_HPP_
+#define BIT_MATRIX_OPS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "cpc_util.hpp"
+#include "cpu_features.hpp"
+
+namespace datasketches {
+
+namespace matrix_ops {
+
+static const uint64_t LOW_BIT_OF_EACH_BYTE = 0x0101010101010101ULL;
+
+// Column counts are gathered in byte-wide lanes, which must be flushed before
+// they can overflow.
+static const size_t MAX_BLOCK_ROWS = 255;
+
+// acc[b] holds in byte j the count of column 8j + b
+inline void add_byte_counts(const uint64_t* acc, uint32_t* counts) {
+  for (unsigned b = 0; b < 8; ++b) {
+    for (unsigned j = 0; j < 8; ++j) counts[8 * j + b] += (acc[b] >> (8 * j)) & 0xff;
+  }
+}
+
+inline void portable_or(uint64_t* dst, const uint64_t* src, size_t n) {
+  for (size_t i = 0; i < n; ++i) dst[i] |= src[i];
+}
+
+inline void portable_or_window(uint64_t* dst, const uint8_t* window, size_t n, uint8_t offset, uint64_t fill) {
+  for (size_t i = 0; i < n; ++i) dst[i] |= fill | (static_cast<uint64_t>(window[i]) << offset);
+}
+
+inline void portable_count_columns(const uint64_t* rows, size_t n, uint32_t* counts) {
+  size_t i = 0;
+  while (i < n) {
+    const size_t end = n - i > MAX_BLOCK_ROWS ? i + MAX_BLOCK_ROWS : n;
+    uint64_t acc[8] = {0, 0, 0, 0, 0, 0, 0, 0};
+    for (; i < end; ++i) {
+      for (unsigned b = 0; b < 8; ++b) acc[b] += (rows[i] >> b) & LOW_BIT_OF_EACH_BYTE;
+    }
+    add_byte_counts(acc, counts);
+  }
+}
+
+#ifdef DATASKETCHES_X86
+
+#define BIT_MATRIX_AVX2 __attribute__((target("avx2")))
+#define BIT_MATRIX_AVX512 __attribute__((target("avx512f")))
+#define BIT_MATRIX_AVX512_POPCNT __attribute__((target("avx512f,avx512vpopcntdq")))
+
+// GCC's own AVX-512 intrinsic headers trip -W(maybe-)uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+BIT_MATRIX_AVX2 inline void avx2_or(uint64_t* dst, const uint64_t* src, size_t n) {
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    __m256i* d = reinterpret_cast<__m256i*>(dst + i);
+    const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d), s));
+  }
+  portable_or(dst + i, src + i, n - i);
+}
+
+BIT_MATRIX_AVX512 inline void avx512_or(uint64_t* dst, const uint64_t* src, size_t n) {
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m512i s = _mm512_loadu_si512(src + i);
+    _mm512_storeu_si512(dst + i, _mm512_or_si512(_mm512_loadu_si512(dst + i), s));
+  }
+  portable_or(dst + i, src + i, n - i);
+}
+
+BIT_MATRIX_AVX2 inline void avx2_or_window(uint64_t* dst, const uint8_t* window, size_t n, uint8_t offset, uint64_t fill) {
+  const __m128i shift = _mm_cvtsi32_si128(offset);
+  const __m256i f = _mm256_set1_epi64x(static_cast<long long>(fill));
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    int32_t bytes;
+    memcpy(&bytes, window + i, sizeof(bytes));
+    const __m256i w = _mm256_sll_epi64(_mm256_cvtepu8_epi64(_mm_cvtsi32_si128(bytes)), shift);
+    __m256i* d = reinterpret_cast<__m256i*>(dst + i);
+    _mm256_storeu_si256(d, _mm256_or_si256(_mm256_loadu_si256(d), _mm256_or_si256(w, f)));
+  }
+  portable_or_window(dst + i, window + i, n - i, offset, fill);
+}
+
+BIT_MATRIX_AVX512 inline void avx512_or_window(uint64_t* dst, const uint8_t* window, size_t n, uint8_t offset, uint64_t fill) {
+  const __m128i shift = _mm_cvtsi32_si128(offset);
+  const __m512i f = _mm512_set1_epi64(static_cast<long long>(fill));
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m128i bytes = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(window + i));
+    const __m512i w = _mm512_sll_epi64(_mm512_cvtepu8_epi64(bytes), shift);
+    _mm512_storeu_si512(dst + i, _mm512_or_si512(_mm512_loadu_si512(dst + i), _mm512_or_si512(w, f)));
+  }
+  portable_or_window(dst + i, window + i, n - i, offset, fill);
+}
+
+// The byte lanes of the accumulators never carry into each other within a
+// block, so plain 64-bit adds do.
+BIT_MATRIX_AVX2 inline void avx2_count_columns(const uint64_t* rows, size_t n, uint32_t* counts) {
+  const __m256i ones = _mm256_set1_epi64x(static_cast<long long>(LOW_BIT_OF_EACH_BYTE));
+  size_t i = 0;
+  while (n - i >= 4) {
+    const size_t end = i + 4 * (((n - i) / 4) > MAX_BLOCK_ROWS ? MAX_BLOCK_ROWS : (n - i) / 4);
+    __m256i acc[8];
+    for (unsigned b = 0; b < 8; ++b) acc[b] = _mm256_setzero_si256();
+    for (; i < end; i += 4) {
+      const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i));
+      for (unsigned b = 0; b < 8; ++b) {
+        acc[b] = _mm256_add_epi64(acc[b], _mm256_and_si256(_mm256_srli_epi64(r, static_cast<int>(b)), ones));
+      }
+    }
+    uint64_t lanes[8][4];
+    for (unsigned b = 0; b < 8; ++b) _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes[b]), acc[b]);
+    for (unsigned l = 0; l < 4; ++l) {
+      uint64_t lane_acc[8];
+      for (unsigned b = 0; b < 8; ++b) lane_acc[b] = lanes[b][l];
+      add_byte_counts(lane_acc, counts);
+    }
+  }
+  portable_count_columns(rows + i, n - i, counts);
+}
+
+BIT_MATRIX_AVX512 inline void avx512_count_columns(const uint64_t* rows, size_t n, uint32_t* counts) {
+  const __m512i ones = _mm512_set1_epi64(static_cast<long long>(LOW_BIT_OF_EACH_BYTE));
+  size_t i = 0;
+  while (n - i >= 8) {
+    const size_t end = i + 8 * (((n - i) / 8) > MAX_BLOCK_ROWS ? MAX_BLOCK_ROWS : (n - i) / 8);
+    __m512i acc[8];
+    for (unsigned b = 0; b < 8; ++b) acc[b] = _mm512_setzero_si512();
+    for (; i < end; i += 8) {
+      const __m512i r = _mm512_loadu_si512(rows + i);
+      for (unsigned b = 0; b < 8; ++b) {
+        acc[b] = _mm512_add_epi64(acc[b], _mm512_and_si512(_mm512_srli_epi64(r, b), ones));
+      }
+    }
+    uint64_t lanes[8][8];
+    for (unsigned b = 0; b < 8; ++b) _mm512_storeu_si512(lanes[b], acc[b]);
+    for (unsigned l = 0; l < 8; ++l) {
+      uint64_t lane_acc[8];
+      for (unsigned b = 0; b < 8; ++b) lane_acc[b] = lanes[b][l];
+      add_byte_counts(lane_acc, counts);
+    }
+  }
+  portable_count_columns(rows + i, n - i, counts);
+}
+
+// Nibble lookup with a byte shuffle, summed per 64-bit lane with psadbw
+// (Mula, Kurz and Lemire, "Faster Population Counts Using AVX2 Instructions").
+BIT_MATRIX_AVX2 inline uint64_t avx2_count_bits(const uint64_t* rows, size_t n) {
+  const __m256i lookup = _mm256_setr_epi8(
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+      0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+  __m256i total = _mm256_setzero_si256();
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256i r = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(rows + i));
+    const __m256i lo = _mm256_and_si256(r, low_nibbles);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(r, 4), low_nibbles);
+    const __m256i bytes = _mm256_add_epi8(_mm256_shuffle_epi8(lookup, lo), _mm256_shuffle_epi8(lookup, hi));
+    total = _mm256_add_epi64(total, _mm256_sad_epu8(bytes, _mm256_setzero_si256()));
+  }
+  uint64_t lanes[4];
+  _mm256_storeu_si256(reinterpret_cast<__m256i*>(lanes), total);
+  uint64_t count = lanes[0] + lanes[1] + lanes[2] + lanes[3];
+  for (; i < n; ++i) count += warren_bit_count(rows[i]);
+  return count;
+}
+
+BIT_MATRIX_AVX512_POPCNT inline uint64_t avx512_count_bits(const uint64_t* rows, size_t n) {
+  __m512i total = _mm512_setzero_si512();
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) total = _mm512_add_epi64(total, _mm512_popcnt_epi64(_mm512_loadu_si512(rows + i)));
+  uint64_t count = static_cast<uint64_t>(_mm512_reduce_add_epi64(total));
+  for (; i < n; ++i) count += warren_bit_count(rows[i]);
+  return count;
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#undef BIT_MATRIX_AVX2
+#undef BIT_MATRIX_AVX512
+#undef BIT_MATRIX_AVX512_POPCNT
+
+#endif // DATASKETCHES_X86
+
+#ifdef DATASKETCHES_NEON
+
+inline void neon_or(uint64_t* dst, const uint64_t* src, size_t n) {
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) vst1q_u64(dst + i, vorrq_u64(vld1q_u64(dst + i), vld1q_u64(src + i)));
+  portable_or(dst + i, src + i, n - i);
+}
+
+inline void neon_or_window(uint64_t* dst, const uint8_t* window, size_t n, uint8_t offset, uint64_t fill) {
+  const int64x2_t shift = vdupq_n_s64(offset);
+  const uint64x2_t f = vdupq_n_u64(fill);
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const uint16x8_t w16 = vmovl_u8(vld1_u8(window + i));
+    const uint32x4_t w32[2] = {vmovl_u16(vget_low_u16(w16)), vmovl_u16(vget_high_u16(w16))};
+    for (unsigned h = 0; h < 2; ++h) {
+      const uint64x2_t lo = vorrq_u64(vshlq_u64(vmovl_u32(vget_low_u32(w32[h])), shift), f);
+      const uint64x2_t hi = vorrq_u64(vshlq_u64(vmovl_u32(vget_high_u32(w32[h])), shift), f);
+      uint64_t* d = dst + i + 4 * h;
+      vst1q_u64(d, vorrq_u64(vld1q_u64(d), lo));
+      vst1q_u64(d + 2, vorrq_u64(vld1q_u64(d + 2), hi));
+    }
+  }
+  portable_or_window(dst + i, window + i, n - i, offset, fill);
+}
+
+inline void neon_count_columns(const uint64_t* rows, size_t n, uint32_t* counts) {
+  const uint64x2_t ones = vdupq_n_u64(LOW_BIT_OF_EACH_BYTE);
+  size_t i = 0;
+  while (n - i >= 2) {
+    const size_t end = i + 2 * (((n - i) / 2) > MAX_BLOCK_ROWS ? MAX_BLOCK_ROWS : (n - i) / 2);
+    uint64x2_t acc[8];
+    for (unsigned b = 0; b < 8; ++b) acc[b] = vdupq_n_u64(0);
+    for (; i < end; i += 2) {
+      const uint64x2_t r = vld1q_u64(rows + i);
+      for (unsigned b = 0; b < 8; ++b) {
+        acc[b] = vaddq_u64(acc[b], vandq_u64(vshlq_u64(r, vdupq_n_s64(-static_cast<int64_t>(b))), ones));
+      }
+    }
+    for (unsigned l = 0; l < 2; ++l) {
+      uint64_t lane_acc[8];
+      for (unsigned b = 0; b < 8; ++b) lane_acc[b] = l == 0 ? vgetq_lane_u64(acc[b], 0) : vgetq_lane_u64(acc[b], 1);
+      add_byte_counts(lane_acc, counts);
+    }
+  }
+  portable_count_columns(rows + i, n - i, counts);
+}
+
+inline uint64_t neon_count_bits(const uint64_t* rows, size_t n) {
+  uint64x2_t total = vdupq_n_u64(0);
+  size_t i = 0;
+  for (; i + 2 <= n; i += 2) {
+    const uint8x16_t bytes = vcntq_u8(vreinterpretq_u8_u64(vld1q_u64(rows + i)));
+    total = vpadalq_u32(total, vpaddlq_u16(vpaddlq_u8(bytes)));
+  }
+  uint64_t count = vaddvq_u64(total);
+  for (; i < n; ++i) count += warren_bit_count(rows[i]);
+  return count;
+}
+
+#endif // DATASKETCHES_NEON
+
+} // namespace matrix_ops
+
+// dst[i] |= src[i] for the n rows
+inline void or_rows(uint64_t* dst, const uint64_t* src, size_t n) {
+#if defined(DATASKETCHES_X86)
+  const cpu::isa best = cpu::best_isa();
+  if (best >= cpu::isa::AVX512) return matrix_ops::avx512_or(dst, src, n);
+  if (best >= cpu::isa::AVX2) return matrix_ops::avx2_or(dst, src, n);
+#elif defined(DATASKETCHES_NEON)
+  return matrix_ops::neon_or(dst, src, n);
+#endif
+  matrix_ops::portable_or(dst, src, n);
+}
+
+// dst[i] |= fill | window[i] << offset for the n rows, offset < 57
+inline void or_window_rows(uint64_t* dst, const uint8_t* window, size_t n, uint8_t offset, uint64_t fill = 0) {
+#if defined(DATASKETCHES_X86)
+  const cpu::isa best = cpu::best_isa();
+  if (best >= cpu::isa::AVX512) return matrix_ops::avx512_or_window(dst, window, n, offset, fill);
+  if (best >= cpu::isa::AVX2) return matrix_ops::avx2_or_window(dst, window, n, offset, fill);
+#elif defined(DATASKETCHES_NEON)
+  return matrix_ops::neon_or_window(dst, window, n, offset, fill);
+#endif
+  matrix_ops::portable_or_window(dst, window, n, offset, fill);
+}
+
+// Adds to counts[c], for each of the 64 columns c, the number of the n rows with bit c set.
+inline void count_bits_set_in_columns(const uint64_t* rows, size_t n, uint32_t* counts) {
+#if defined(DATASKETCHES_X86)
+  const cpu::isa best = cpu::best_isa();
+  if (best >= cpu::isa::AVX512) return matrix_ops::avx512_count_columns(rows, n, counts);
+  if (best >= cpu::isa::AVX2) return matrix_ops::avx2_count_columns(rows, n, counts);
+#elif defined(DATASKETCHES_NEON)
+  return matrix_ops::neon_count_columns(rows, n, counts);
+#endif
+  matrix_ops::portable_count_columns(rows, n, counts);
+}
+
+// Same as count_bits_set_in_matrix()
+inline uint32_t count_bits_set_in_rows(const uint64_t* rows, uint32_t n) {
+#if defined(DATASKETCHES_X86)
+  const cpu::isa best = cpu::best_isa();
+  if (best >= cpu::isa::AVX512_POPCNT) return static_cast<uint32_t>(matrix_ops::avx512_count_bits(rows, n));
+  if (best >= cpu::isa::AVX2) return static_cast<uint32_t>(matrix_ops::avx2_count_bits(rows, n));
+#elif defined(DATASKETCHES_NEON)
+  return static_cast<uint32_t>(matrix_ops::neon_count_bits(rows, n));
+#endif
+  return count_bits_set_in_matrix(rows, n);
+}
+
+} /* namespace datasketches */
+
+#endif
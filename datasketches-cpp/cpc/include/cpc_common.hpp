@@ -23,6 +23,7 @@
 #include <memory>
 
 #include "MurmurHash3.h"
+#include "MurmurHash3_batch.h"
 
 namespace datasketches {
 
@@ -22,6 +22,8 @@
 #ifndef CPC_COMPRESSOR_HPP_
 #define CPC_COMPRESSOR_HPP_
 
+#include <mutex>
+
 #include "cpc_common.hpp"
 
 namespace datasketches {
@@ -50,6 +52,16 @@ public:
   void compress(const cpc_sketch_alloc<A>& source, compressed_state<A>& target) const;
   void uncompress(const compressed_state<A>& source, uncompressed_state<A>& target, uint8_t lg_k, uint32_t num_coupons) const;
 
+  // Like uncompress(), but leaves the surprising values as pairs instead of building a table.
+  // The pairs are in the sketch's own column numbering and sorted by row. The window is left
+  // empty for the sparse flavor and for the hybrid flavor, whose window bits are among the pairs.
+  void uncompress_rows(const compressed_state<A>& source, vector_u8<A>& window, vector_u32<A>& pairs,
+      uint8_t lg_k, uint32_t num_coupons) const;
+
+  // Makes the window decoding tables of every phase now, rather than on first use of each,
+  // so that no later uncompress has to wait for another thread making them.
+  void make_all_window_decoding_tables() const;
+
   // methods below are public for testing
 
   // This returns the number of compressed words that were actually used. It is the caller's
@@ -66,7 +78,8 @@ public:
       uint32_t num_bytes_to_decode,
       const uint16_t* decoding_table,
       const uint32_t* compressed_words,
-      uint32_t num_compressed_words // input
+      uint32_t num_compressed_words, // input
+      const uint32_t* multi_decoding_table = nullptr // optional, see make_multi_decoding_table
   ) const;
 
   // Here "pairs" refers to row-column pairs that specify
@@ -89,8 +102,10 @@ public:
   ) const;
 
 private:
-  // These decoding tables are created at library startup time by inverting the encoding tables
-  uint16_t* decoding_tables_for_high_entropy_byte[22] = {
+  // These decoding tables are created by inverting the encoding tables. The ones for windows are
+  // the bulk of the work and are only made on first use of their phase, see get_window_decoding_tables;
+  // the rest are made at library startup time.
+  mutable uint16_t* decoding_tables_for_high_entropy_byte[22] = {
     // sixteen tables for the steady state (chosen based on the "phase" of C/K)
     NULL, NULL, NULL, NULL,
     NULL, NULL, NULL, NULL,
@@ -99,7 +114,15 @@ private:
     // six more tables for the gradual transition between warmup mode and the steady state.
     NULL, NULL, NULL, NULL, NULL, NULL
   };
+  // The same tables in the form made by make_multi_decoding_table, for decoding whole windows
+  mutable uint32_t* multi_decoding_tables_for_high_entropy_byte[22] = {
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
+    NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
+  };
+  mutable std::once_flag window_decoding_tables_made[22];
   uint16_t* length_limited_unary_decoding_table65;
+  // Decodes the x_delta and y_delta_hi of a pair at once, see make_pair_prefix_decoding_table
+  uint32_t* pair_prefix_decoding_table;
   uint8_t* column_permutations_for_decoding[16] = {
     NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL,
     NULL, NULL, NULL, NULL, NULL, NULL, NULL, NULL
@@ -110,6 +133,9 @@ private:
   ~cpc_compressor();
 
   void make_decoding_tables(); // call this at startup
+  void make_window_decoding_tables(uint8_t phase) const;
+  // The two decoding tables for windows of the given phase, made on the first call for it
+  void get_window_decoding_tables(uint8_t phase, const uint16_t*& decoding_table, const uint32_t*& multi_decoding_table) const;
   void free_decoding_tables(); // call this at the end
 
   void compress_sparse_flavor(const cpc_sketch_alloc<A>& source, compressed_state<A>& target) const;
@@ -121,9 +147,13 @@ private:
   void uncompress_hybrid_flavor(const compressed_state<A>& source, uncompressed_state<A>& target, uint8_t lg_k) const;
   void uncompress_pinned_flavor(const compressed_state<A>& source, uncompressed_state<A>& target, uint8_t lg_k, uint32_t num_coupons) const;
   void uncompress_sliding_flavor(const compressed_state<A>& source, uncompressed_state<A>& target, uint8_t lg_k, uint32_t num_coupons) const;
+  void uncompress_pinned_rows(const compressed_state<A>& source, vector_u8<A>& window, vector_u32<A>& pairs, uint8_t lg_k, uint32_t num_coupons) const;
+  void uncompress_sliding_rows(const compressed_state<A>& source, vector_u8<A>& window, vector_u32<A>& pairs, uint8_t lg_k, uint32_t num_coupons) const;
 
   uint8_t* make_inverse_permutation(const uint8_t* permu, unsigned length);
-  uint16_t* make_decoding_table(const uint16_t* encoding_table, unsigned num_byte_values);
+  static uint16_t* make_decoding_table(const uint16_t* encoding_table, unsigned num_byte_values);
+  static uint32_t* make_multi_decoding_table(const uint16_t* decoding_table);
+  static uint32_t* make_pair_prefix_decoding_table(const uint16_t* x_delta_decoding_table);
   void validate_decoding_table(const uint16_t* decoding_table, const uint16_t* encoding_table) const;
 
   void compress_surprising_values(const vector_u32<A>& pairs, uint8_t lg_k, compressed_state<A>& result) const;
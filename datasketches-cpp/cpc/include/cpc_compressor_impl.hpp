@@ -81,6 +81,50 @@ uint16_t* cpc_compressor<A>::make_decoding_table(const uint16_t* encoding_table,
   return decoding_table;
 }
 
+/* Given a size-4096 decoding table, this builds one that decodes as many whole codewords
+   as fit in each 12-bit peek, up to three. Entries hold the decoded bytes in the low 24 bits,
+   first byte lowest, the total length of their codewords in the next 4 bits and their number in the
+   top bits. Every entry decodes at least one byte, since no codeword is longer than 12 bits. */
+template<typename A>
+uint32_t* cpc_compressor<A>::make_multi_decoding_table(const uint16_t* decoding_table) {
+  uint32_t* multi_decoding_table = new uint32_t[4096]; // use new for global initialization
+  for (uint32_t peek12 = 0; peek12 < 4096; peek12++) {
+    uint32_t decoded_bytes = 0;
+    uint8_t total_length = 0;
+    uint8_t num_decoded = 0;
+    while (num_decoded < 3) {
+      // a prefix code word is recognized by its own bits alone, so zeros past the peek do not matter
+      const uint16_t lookup = decoding_table[peek12 >> total_length];
+      const uint8_t code_word_length = lookup >> 8;
+      if (total_length + code_word_length > 12) break;
+      decoded_bytes |= static_cast<uint32_t>(lookup & 0xff) << (8 * num_decoded);
+      total_length += code_word_length;
+      num_decoded++;
+    }
+    multi_decoding_table[peek12] = decoded_bytes | (static_cast<uint32_t>(total_length) << 24) | (static_cast<uint32_t>(num_decoded) << 28);
+  }
+  return multi_decoding_table;
+}
+
+/* Given the size-4096 decoding table for x_delta, this builds one that also decodes the unary
+   y_delta_hi that follows it when both fit in the 12-bit peek. Entries hold x_delta in the low
+   byte, y_delta_hi in the next and the total length of the two codewords in the third, which is
+   zero for peeks that end before the unary codeword does. */
+template<typename A>
+uint32_t* cpc_compressor<A>::make_pair_prefix_decoding_table(const uint16_t* x_delta_decoding_table) {
+  uint32_t* pair_prefix_decoding_table = new uint32_t[4096]; // use new for global initialization
+  for (uint32_t peek12 = 0; peek12 < 4096; peek12++) {
+    const uint16_t lookup = x_delta_decoding_table[peek12];
+    const uint8_t code_word_length = lookup >> 8;
+    const uint32_t rest = peek12 >> code_word_length;
+    const uint8_t golomb_hi = count_trailing_zeros_in_u32(rest);
+    const uint8_t total_length = code_word_length + golomb_hi + 1;
+    pair_prefix_decoding_table[peek12] = total_length > 12 ? 0 :
+        (lookup & 0xff) | (static_cast<uint32_t>(golomb_hi) << 8) | (static_cast<uint32_t>(total_length) << 16);
+  }
+  return pair_prefix_decoding_table;
+}
+
 template<typename A>
 void cpc_compressor<A>::validate_decoding_table(const uint16_t* decoding_table, const uint16_t* encoding_table) const {
   for (int decode_this = 0; decode_this < 4096; decode_this++) {
@@ -104,25 +148,47 @@ void cpc_compressor<A>::make_decoding_tables() {
       length_limited_unary_decoding_table65,
       length_limited_unary_encoding_table65
   );
-
-  for (int i = 0; i < (16 + 6); i++) {
-    decoding_tables_for_high_entropy_byte[i] = make_decoding_table(encoding_tables_for_high_entropy_byte[i], 256);
-    validate_decoding_table(
-        decoding_tables_for_high_entropy_byte[i],
-        encoding_tables_for_high_entropy_byte[i]
-    );
-  }
+  pair_prefix_decoding_table = make_pair_prefix_decoding_table(length_limited_unary_decoding_table65);
 
   for (int i = 0; i < 16; i++) {
     column_permutations_for_decoding[i] = make_inverse_permutation(column_permutations_for_encoding[i], 56);
   }
 }
 
+template<typename A>
+void cpc_compressor<A>::make_window_decoding_tables(uint8_t phase) const {
+  uint16_t* decoding_table = make_decoding_table(encoding_tables_for_high_entropy_byte[phase], 256);
+  validate_decoding_table(decoding_table, encoding_tables_for_high_entropy_byte[phase]);
+  multi_decoding_tables_for_high_entropy_byte[phase] = make_multi_decoding_table(decoding_table);
+  decoding_tables_for_high_entropy_byte[phase] = decoding_table;
+}
+
+template<typename A>
+void cpc_compressor<A>::get_window_decoding_tables(uint8_t phase, const uint16_t*& decoding_table,
+    const uint32_t*& multi_decoding_table) const {
+  if (phase >= 22) throw std::logic_error("phase >= 22");
+  // call_once publishes the tables to every thread that gets past it
+  std::call_once(window_decoding_tables_made[phase], &cpc_compressor<A>::make_window_decoding_tables, this, phase);
+  decoding_table = decoding_tables_for_high_entropy_byte[phase];
+  multi_decoding_table = multi_decoding_tables_for_high_entropy_byte[phase];
+}
+
+template<typename A>
+void cpc_compressor<A>::make_all_window_decoding_tables() const {
+  const uint16_t* decoding_table;
+  const uint32_t* multi_decoding_table;
+  for (uint8_t phase = 0; phase < 22; phase++) {
+    get_window_decoding_tables(phase, decoding_table, multi_decoding_table);
+  }
+}
+
 template<typename A>
 void cpc_compressor<A>::free_decoding_tables() {
   delete[] length_limited_unary_decoding_table65;
+  delete[] pair_prefix_decoding_table;
   for (int i = 0; i < (16 + 6); i++) {
     delete[] decoding_tables_for_high_entropy_byte[i];
+    delete[] multi_decoding_tables_for_high_entropy_byte[i];
   }
   for (int i = 0; i < 16; i++) {
     delete[] column_permutations_for_decoding[i];
@@ -179,11 +245,35 @@ void cpc_compressor<A>::uncompress(const compressed_state<A>& source, uncompress
   }
 }
 
+template<typename A>
+void cpc_compressor<A>::uncompress_rows(const compressed_state<A>& source, vector_u8<A>& window, vector_u32<A>& pairs,
+    uint8_t lg_k, uint32_t num_coupons) const {
+  window.clear();
+  pairs.clear();
+  switch (cpc_sketch_alloc<A>::determine_flavor(lg_k, num_coupons)) {
+    case cpc_sketch_alloc<A>::flavor::EMPTY:
+      break;
+    case cpc_sketch_alloc<A>::flavor::SPARSE:
+    case cpc_sketch_alloc<A>::flavor::HYBRID:
+      if (source.window_data.size() > 0) throw std::logic_error("window is not expected");
+      if (source.table_data.size() == 0) throw std::logic_error("table is expected");
+      pairs = uncompress_surprising_values(source.table_data.data(), source.table_data_words, source.table_num_entries,
+          lg_k, source.table_data.get_allocator());
+      break;
+    case cpc_sketch_alloc<A>::flavor::PINNED:
+      uncompress_pinned_rows(source, window, pairs, lg_k, num_coupons);
+      break;
+    case cpc_sketch_alloc<A>::flavor::SLIDING:
+      uncompress_sliding_rows(source, window, pairs, lg_k, num_coupons);
+      break;
+    default: throw std::logic_error("Unknown sketch flavor");
+  }
+}
+
 template<typename A>
 void cpc_compressor<A>::compress_sparse_flavor(const cpc_sketch_alloc<A>& source, compressed_state<A>& result) const {
   if (source.sliding_window.size() > 0) throw std::logic_error("unexpected sliding window");
-  vector_u32<A> pairs = source.surprising_value_table.unwrapping_get_items();
-  u32_table<A>::introspective_insertion_sort(pairs.data(), 0, pairs.size());
+  vector_u32<A> pairs = source.surprising_value_table.unwrapping_get_items(); // sorted
   compress_surprising_values(pairs, source.get_lg_k(), result);
 }
 
@@ -203,9 +293,8 @@ void cpc_compressor<A>::compress_hybrid_flavor(const cpc_sketch_alloc<A>& source
   if (source.sliding_window.size() == 0) throw std::logic_error("no sliding window");
   if (source.window_offset != 0) throw std::logic_error("window_offset != 0");
   const uint32_t k = 1 << source.get_lg_k();
-  vector_u32<A> pairs_from_table = source.surprising_value_table.unwrapping_get_items();
+  vector_u32<A> pairs_from_table = source.surprising_value_table.unwrapping_get_items(); // sorted
   const uint32_t num_pairs_from_table = static_cast<uint32_t>(pairs_from_table.size());
-  if (num_pairs_from_table > 0) u32_table<A>::introspective_insertion_sort(pairs_from_table.data(), 0, num_pairs_from_table);
   const uint32_t num_pairs_from_window = source.get_num_coupons() - num_pairs_from_table; // because the window offset is zero
 
   vector_u32<A> all_pairs = tricky_get_pairs_from_window(source.sliding_window.data(), k, num_pairs_from_window, num_pairs_from_table, source.get_allocator());
@@ -261,7 +350,7 @@ void cpc_compressor<A>::compress_pinned_flavor(const cpc_sketch_alloc<A>& source
       pairs[i] -= 8;
     }
 
-    if (pairs.size() > 0) u32_table<A>::introspective_insertion_sort(pairs.data(), 0, pairs.size());
+    // still sorted, as the columns all moved alike
     compress_surprising_values(pairs, source.get_lg_k(), result);
   }
 }
@@ -269,21 +358,30 @@ void cpc_compressor<A>::compress_pinned_flavor(const cpc_sketch_alloc<A>& source
 template<typename A>
 void cpc_compressor<A>::uncompress_pinned_flavor(const compressed_state<A>& source, uncompressed_state<A>& target,
     uint8_t lg_k, uint32_t num_coupons) const {
-  if (source.window_data.size() == 0) throw std::logic_error("window is expected");
-  uncompress_sliding_window(source.window_data.data(), source.window_data_words, target.window, lg_k, num_coupons);
-  const uint32_t num_pairs = source.table_num_entries;
-  if (num_pairs == 0) {
+  vector_u32<A> pairs(source.table_data.get_allocator());
+  uncompress_pinned_rows(source, target.window, pairs, lg_k, num_coupons);
+  if (pairs.size() == 0) {
     target.table = u32_table<A>(2, 6 + lg_k, source.table_data.get_allocator());
   } else {
+    target.table = u32_table<A>::make_from_pairs(pairs.data(), static_cast<uint32_t>(pairs.size()), lg_k, pairs.get_allocator());
+  }
+}
+
+template<typename A>
+void cpc_compressor<A>::uncompress_pinned_rows(const compressed_state<A>& source, vector_u8<A>& window,
+    vector_u32<A>& pairs, uint8_t lg_k, uint32_t num_coupons) const {
+  if (source.window_data.size() == 0) throw std::logic_error("window is expected");
+  uncompress_sliding_window(source.window_data.data(), source.window_data_words, window, lg_k, num_coupons);
+  const uint32_t num_pairs = source.table_num_entries;
+  if (num_pairs > 0) {
     if (source.table_data.size() == 0) throw std::logic_error("table is expected");
-    vector_u32<A> pairs = uncompress_surprising_values(source.table_data.data(), source.table_data_words, num_pairs,
+    pairs = uncompress_surprising_values(source.table_data.data(), source.table_data_words, num_pairs,
         lg_k, source.table_data.get_allocator());
     // undo the compressor's 8-column shift
     for (uint32_t i = 0; i < num_pairs; i++) {
       if ((pairs[i] & 63) >= 56) throw std::logic_error("(pairs[i] & 63) >= 56");
       pairs[i] += 8;
     }
-    target.table = u32_table<A>::make_from_pairs(pairs.data(), num_pairs, lg_k, pairs.get_allocator());
   }
 }
 
@@ -313,6 +411,9 @@ void cpc_compressor<A>::compress_sliding_flavor(const cpc_sketch_alloc<A>& sourc
       pairs[i] = (row << 6) | col;
     }
 
+    // The pairs are still sorted by row, with only the few columns within each row out of order,
+    // so insertion sort takes about 1ns a pair, around 1% of compressing. An LSD radix sort of the
+    // lg_k + 6 bits of the pairs, or a bitmask of the columns of each row, measured 2-20x slower.
     if (pairs.size() > 0) u32_table<A>::introspective_insertion_sort(pairs.data(), 0, pairs.size());
     compress_surprising_values(pairs, source.get_lg_k(), result);
   }
@@ -321,14 +422,24 @@ void cpc_compressor<A>::compress_sliding_flavor(const cpc_sketch_alloc<A>& sourc
 template<typename A>
 void cpc_compressor<A>::uncompress_sliding_flavor(const compressed_state<A>& source, uncompressed_state<A>& target,
     uint8_t lg_k, uint32_t num_coupons) const {
-  if (source.window_data.size() == 0) throw std::logic_error("window is expected");
-  uncompress_sliding_window(source.window_data.data(), source.window_data_words, target.window, lg_k, num_coupons);
-  const uint32_t num_pairs = source.table_num_entries;
-  if (num_pairs == 0) {
+  vector_u32<A> pairs(source.table_data.get_allocator());
+  uncompress_sliding_rows(source, target.window, pairs, lg_k, num_coupons);
+  if (pairs.size() == 0) {
     target.table = u32_table<A>(2, 6 + lg_k, source.table_data.get_allocator());
   } else {
+    target.table = u32_table<A>::make_from_pairs(pairs.data(), static_cast<uint32_t>(pairs.size()), lg_k, pairs.get_allocator());
+  }
+}
+
+template<typename A>
+void cpc_compressor<A>::uncompress_sliding_rows(const compressed_state<A>& source, vector_u8<A>& window,
+    vector_u32<A>& pairs, uint8_t lg_k, uint32_t num_coupons) const {
+  if (source.window_data.size() == 0) throw std::logic_error("window is expected");
+  uncompress_sliding_window(source.window_data.data(), source.window_data_words, window, lg_k, num_coupons);
+  const uint32_t num_pairs = source.table_num_entries;
+  if (num_pairs > 0) {
     if (source.table_data.size() == 0) throw std::logic_error("table is expected");
-    vector_u32<A> pairs = uncompress_surprising_values(source.table_data.data(), source.table_data_words, num_pairs,
+    pairs = uncompress_surprising_values(source.table_data.data(), source.table_data_words, num_pairs,
         lg_k, source.table_data.get_allocator());
 
     const uint8_t pseudo_phase = determine_pseudo_phase(lg_k, num_coupons);
@@ -348,8 +459,6 @@ void cpc_compressor<A>::uncompress_sliding_flavor(const compressed_state<A>& sou
       col = (col + (offset + 8)) & 63;
       pairs[i] = (row << 6) | col;
     }
-
-    target.table = u32_table<A>::make_from_pairs(pairs.data(), num_pairs, lg_k, pairs.get_allocator());
   }
 }
 
@@ -402,7 +511,10 @@ void cpc_compressor<A>::uncompress_sliding_window(const uint32_t* data, uint32_t
   const uint32_t k = 1 << lg_k;
   window.resize(k); // zeroing not needed here (unlike the Hybrid Flavor)
   const uint8_t pseudo_phase = determine_pseudo_phase(lg_k, num_coupons);
-  low_level_uncompress_bytes(window.data(), k, decoding_tables_for_high_entropy_byte[pseudo_phase], data, data_words);
+  const uint16_t* decoding_table;
+  const uint32_t* multi_decoding_table;
+  get_window_decoding_tables(pseudo_phase, decoding_table, multi_decoding_table);
+  low_level_uncompress_bytes(window.data(), k, decoding_table, data, data_words, multi_decoding_table);
 }
 
 template<typename A>
@@ -467,6 +579,34 @@ static inline void maybe_fill_bitbuf(uint64_t& bitbuf, uint8_t& bufbits, const u
   }
 }
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+// On little-endian machines the words are the bitstream in byte order, so the decoders read most
+// of it with unaligned 8-byte loads instead of a word at a time. A load must fit in the words.
+#define CPC_FAST_BITSTREAM 1
+
+// The bitstream from bit_index on, with at least 57 valid bits
+static inline uint64_t peek_bitstream(const uint32_t* wordarr, size_t bit_index) {
+  uint64_t bits;
+  memcpy(&bits, reinterpret_cast<const uint8_t*>(wordarr) + (bit_index >> 3), sizeof(bits));
+  return bits >> (bit_index & 7);
+}
+
+static inline bool can_peek_bitstream(uint32_t num_words, size_t bit_index) {
+  return (bit_index >> 3) + sizeof(uint64_t) <= static_cast<size_t>(num_words) * sizeof(uint32_t);
+}
+
+// Sets up the word at a time bit buffer to carry on from bit_index
+static inline void resume_bitbuf(uint64_t& bitbuf, uint8_t& bufbits, const uint32_t* wordarr, uint32_t& wordindex, size_t bit_index) {
+  wordindex = static_cast<uint32_t>(bit_index >> 5);
+  bitbuf = 0;
+  bufbits = 0;
+  if ((bit_index & 31) != 0) {
+    bitbuf = wordarr[wordindex++] >> (bit_index & 31);
+    bufbits = 32 - (bit_index & 31);
+  }
+}
+#endif
+
 // This returns the number of compressed words that were actually used.
 // It is the caller's responsibility to ensure that the compressed_words array is long enough.
 template<typename A>
@@ -507,7 +647,8 @@ void cpc_compressor<A>::low_level_uncompress_bytes(
     uint32_t num_bytes_to_decode,
     const uint16_t* decoding_table,
     const uint32_t* compressed_words, // input
-    uint32_t num_compressed_words
+    uint32_t num_compressed_words,
+    const uint32_t* multi_decoding_table
 ) const {
   uint32_t word_index = 0;
   uint64_t bitbuf = 0;
@@ -517,7 +658,30 @@ void cpc_compressor<A>::low_level_uncompress_bytes(
   if (decoding_table == nullptr) throw std::logic_error("decoding_table == NULL");
   if (compressed_words == nullptr) throw std::logic_error("compressed_words == NULL");
 
-  for (uint32_t byte_index = 0; byte_index < num_bytes_to_decode; byte_index++) {
+  uint32_t byte_index = 0;
+#if defined(CPC_FAST_BITSTREAM)
+  // Each peek has enough bits for four 12-bit lookups, and the multi-symbol table decodes up to
+  // three bytes per lookup, which shortens the chain of dependent loads.
+  if (multi_decoding_table != nullptr) {
+    size_t bit_index = 0;
+    // four lookups decode at most 12 bytes, and each one stores 4
+    while (byte_index + 16 <= num_bytes_to_decode && can_peek_bitstream(num_compressed_words, bit_index)) {
+      uint64_t bits = peek_bitstream(compressed_words, bit_index);
+      for (unsigned i = 0; i < 4; i++) {
+        const uint32_t lookup = multi_decoding_table[bits & 0xfff];
+        const uint8_t total_length = (lookup >> 24) & 0xf;
+        memcpy(byte_array + byte_index, &lookup, sizeof(lookup)); // the top byte is overwritten later
+        byte_index += lookup >> 28;
+        bits >>= total_length;
+        bit_index += total_length;
+      }
+    }
+    // the rest is decoded as below
+    resume_bitbuf(bitbuf, bufbits, compressed_words, word_index, bit_index);
+  }
+#endif
+
+  for (; byte_index < num_bytes_to_decode; byte_index++) {
     maybe_fill_bitbuf(bitbuf, bufbits, compressed_words, word_index, 12); // ensure 12 bits in bit buffer
 
     const size_t peek12 = bitbuf & 0xfff; // These 12 bits will include an entire Huffman codeword.
@@ -633,7 +797,60 @@ void cpc_compressor<A>::low_level_uncompress_pairs(
   // y_delta_hi (unary)
   // y_delta_lo (basebits)
 
-  for (uint32_t pair_index = 0; pair_index < num_pairs_to_decode; pair_index++) {
+  uint32_t pair_index = 0;
+#if defined(CPC_FAST_BITSTREAM)
+  // Pairs are decoded from a peek for as long as they fit in its 57 bits, which is all but always,
+  // so that the fields need no refill checks of their own.
+  size_t bit_index = 0;
+  uint64_t bits = 0;
+  uint8_t peeked_bits = 0;
+  while (pair_index < num_pairs_to_decode) {
+    if (peeked_bits < 32) {
+      if (!can_peek_bitstream(num_compressed_words, bit_index)) break;
+      bits = peek_bitstream(compressed_words, bit_index);
+      peeked_bits = 57;
+    }
+    const uint32_t prefix_lookup = pair_prefix_decoding_table[bits & 0xfff];
+    int8_t x_delta;
+    uint8_t golomb_hi;
+    uint8_t prefix_length;
+    if (prefix_lookup != 0) {
+      x_delta = prefix_lookup & 0xff;
+      golomb_hi = (prefix_lookup >> 8) & 0xff;
+      prefix_length = static_cast<uint8_t>(prefix_lookup >> 16);
+    } else {
+      const uint16_t lookup = length_limited_unary_decoding_table65[bits & 0xfff];
+      const uint8_t code_word_length = lookup >> 8;
+      x_delta = lookup & 0xff;
+      const uint64_t rest = bits >> code_word_length;
+      golomb_hi = rest == 0 ? 64 : count_trailing_zeros_in_u64(rest);
+      prefix_length = code_word_length + golomb_hi + 1;
+    }
+    const uint8_t pair_length = prefix_length + num_base_bits;
+    if (pair_length > peeked_bits) {
+      if (peeked_bits == 57) break; // too long for any peek, left to the loop below
+      peeked_bits = 0; // peek again from this pair on
+      continue;
+    }
+    bits >>= prefix_length;
+    const uint64_t golomb_lo = bits & golomb_lo_mask;
+    bits >>= num_base_bits;
+    peeked_bits -= pair_length;
+    bit_index += pair_length;
+    const int64_t y_delta = (static_cast<uint64_t>(golomb_hi) << num_base_bits) | golomb_lo;
+
+    // as below
+    if (y_delta > 0) predicted_col_index = 0;
+    const uint32_t row_index = static_cast<uint32_t>(predicted_row_index + y_delta);
+    const uint8_t col_index = predicted_col_index + x_delta;
+    pair_array[pair_index++] = (row_index << 6) | col_index;
+    predicted_row_index = row_index;
+    predicted_col_index = col_index + 1;
+  }
+  resume_bitbuf(bitbuf, bufbits, compressed_words, word_index, bit_index);
+#endif
+
+  for (; pair_index < num_pairs_to_decode; pair_index++) {
     maybe_fill_bitbuf(bitbuf, bufbits, compressed_words, word_index, 12); // ensure 12 bits in bit buffer
     const size_t peek12 = bitbuf & 0xfff;
     const uint16_t lookup = length_limited_unary_decoding_table65[peek12];
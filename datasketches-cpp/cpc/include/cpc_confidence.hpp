@@ -29,10 +29,10 @@
 namespace datasketches {
 
 // ln 2.0
-static const double ICON_ERROT_CONSTANT = 0.693147180559945286;
+static constexpr double ICON_ERROT_CONSTANT = 0.693147180559945286;
 
 //  1,    2,    3, // kappa
-static const int16_t ICON_LOW_SIDE_DATA [33] = {   // Empirically measured at N = 1000 * K.
+static constexpr int16_t ICON_LOW_SIDE_DATA [33] = {   // Empirically measured at N = 1000 * K.
  6037, 5720, 5328, // 4 1000000
  6411, 6262, 5682, // 5 1000000
  6724, 6403, 6127, // 6 1000000
@@ -47,7 +47,7 @@ static const int16_t ICON_LOW_SIDE_DATA [33] = {   // Empirically measured at N
 };                 // lgK numtrials
 
 //  1,    2,    3, // kappa
-static const int16_t ICON_HIGH_SIDE_DATA [33] = {   // Empirically measured at N = 1000 * K.
+static constexpr int16_t ICON_HIGH_SIDE_DATA [33] = {   // Empirically measured at N = 1000 * K.
  8031, 8559, 9309, // 4 1000000
  7084, 7959, 8660, // 5 1000000
  7141, 7514, 7876, // 6 1000000
@@ -62,10 +62,10 @@ static const int16_t ICON_HIGH_SIDE_DATA [33] = {   // Empirically measured at N
 };                 // lgK numtrials
 
 // sqrt((ln 2.0) / 2.0)
-static const double HIP_ERROR_CONSTANT = 0.588705011257737332;
+static constexpr double HIP_ERROR_CONSTANT = 0.588705011257737332;
 
 //  1,    2,    3, // kappa
-static const int16_t HIP_LOW_SIDE_DATA [33] = {   // Empirically measured at N = 1000 * K.
+static constexpr int16_t HIP_LOW_SIDE_DATA [33] = {   // Empirically measured at N = 1000 * K.
  5871, 5247, 4826, // 4 1000000
  5877, 5403, 5070, // 5 1000000
  5873, 5533, 5304, // 6 1000000
@@ -80,7 +80,7 @@ static const int16_t HIP_LOW_SIDE_DATA [33] = {   // Empirically measured at N =
 };                 // lgK numtrials
 
 //  1,    2,    3, // kappa
-static const int16_t HIP_HIGH_SIDE_DATA [33] = {   // Empirically measured at N = 1000 * K.
+static constexpr int16_t HIP_HIGH_SIDE_DATA [33] = {   // Empirically measured at N = 1000 * K.
  5855, 6688, 7391, // 4 1000000
  5886, 6444, 6923, // 5 1000000
  5885, 6254, 6594, // 6 1000000
@@ -94,72 +94,119 @@ static const int16_t HIP_HIGH_SIDE_DATA [33] = {   // Empirically measured at N
  5880, 5914, 5953, // 14 1000297
 };                 // lgK numtrials
 
-template<typename A>
-double get_icon_confidence_lb(const cpc_sketch_alloc<A>& sketch, int kappa) {
-  if (sketch.get_num_coupons() == 0) return 0.0;
-  const int lg_k = sketch.get_lg_k();
-  const long k = 1 << lg_k;
+// sqrt(2^lg_k) as sqrt() rounds it, which scaling the rounded sqrt(2) by a power
+// of two reproduces exactly
+constexpr double cpc_sqrt_k(uint8_t lg_k) {
+  return ((lg_k & 1) ? 1.4142135623730951 : 1.0) * static_cast<double>(static_cast<uint64_t>(1) << (lg_k / 2));
+}
+
+// kappa times the relative error of a bound, from the empirical side table up to
+// lg_k 14 and the asymptotic constant above it
+constexpr double cpc_confidence_eps(const int16_t* side_data, double asymptotic, uint8_t lg_k, int kappa) {
+  return kappa * (((lg_k <= 14) ? side_data[3 * (lg_k - 4) + (kappa - 1)] / 10000.0 : asymptotic) / cpc_sqrt_k(lg_k));
+}
+
+// The eps of each bound, for kappa 1, 2 and 3
+struct cpc_confidence_epsilons {
+  double icon_lb[3];
+  double icon_ub[3];
+  double hip_lb[3];
+  double hip_ub[3];
+};
+
+// The lower bounds take the high side data, and the upper bounds the low side.
+constexpr cpc_confidence_epsilons cpc_confidence_epsilons_for(uint8_t lg_k) {
+  return cpc_confidence_epsilons{
+    {cpc_confidence_eps(ICON_HIGH_SIDE_DATA, ICON_ERROT_CONSTANT, lg_k, 1),
+     cpc_confidence_eps(ICON_HIGH_SIDE_DATA, ICON_ERROT_CONSTANT, lg_k, 2),
+     cpc_confidence_eps(ICON_HIGH_SIDE_DATA, ICON_ERROT_CONSTANT, lg_k, 3)},
+    {cpc_confidence_eps(ICON_LOW_SIDE_DATA, ICON_ERROT_CONSTANT, lg_k, 1),
+     cpc_confidence_eps(ICON_LOW_SIDE_DATA, ICON_ERROT_CONSTANT, lg_k, 2),
+     cpc_confidence_eps(ICON_LOW_SIDE_DATA, ICON_ERROT_CONSTANT, lg_k, 3)},
+    {cpc_confidence_eps(HIP_HIGH_SIDE_DATA, HIP_ERROR_CONSTANT, lg_k, 1),
+     cpc_confidence_eps(HIP_HIGH_SIDE_DATA, HIP_ERROR_CONSTANT, lg_k, 2),
+     cpc_confidence_eps(HIP_HIGH_SIDE_DATA, HIP_ERROR_CONSTANT, lg_k, 3)},
+    {cpc_confidence_eps(HIP_LOW_SIDE_DATA, HIP_ERROR_CONSTANT, lg_k, 1),
+     cpc_confidence_eps(HIP_LOW_SIDE_DATA, HIP_ERROR_CONSTANT, lg_k, 2),
+     cpc_confidence_eps(HIP_LOW_SIDE_DATA, HIP_ERROR_CONSTANT, lg_k, 3)}
+  };
+}
+
+// Every eps, computed at compile time and indexed by lg_k - 4, so that a bound
+// takes one load instead of a table lookup, a square root and two divisions.
+static constexpr cpc_confidence_epsilons CPC_CONFIDENCE_EPSILONS[] = {
+  cpc_confidence_epsilons_for(4), cpc_confidence_epsilons_for(5), cpc_confidence_epsilons_for(6),
+  cpc_confidence_epsilons_for(7), cpc_confidence_epsilons_for(8), cpc_confidence_epsilons_for(9),
+  cpc_confidence_epsilons_for(10), cpc_confidence_epsilons_for(11), cpc_confidence_epsilons_for(12),
+  cpc_confidence_epsilons_for(13), cpc_confidence_epsilons_for(14), cpc_confidence_epsilons_for(15),
+  cpc_confidence_epsilons_for(16), cpc_confidence_epsilons_for(17), cpc_confidence_epsilons_for(18),
+  cpc_confidence_epsilons_for(19), cpc_confidence_epsilons_for(20), cpc_confidence_epsilons_for(21),
+  cpc_confidence_epsilons_for(22), cpc_confidence_epsilons_for(23), cpc_confidence_epsilons_for(24),
+  cpc_confidence_epsilons_for(25), cpc_confidence_epsilons_for(26)
+};
+
+inline const cpc_confidence_epsilons& get_confidence_epsilons(uint8_t lg_k, int kappa) {
   if (lg_k < 4) throw std::logic_error("lgk < 4");
+  if (lg_k > 26) throw std::logic_error("lgk > 26");
   if (kappa < 1 || kappa > 3) throw std::invalid_argument("kappa must be between 1 and 3");
-  double x = ICON_ERROT_CONSTANT;
-  if (lg_k <= 14) x = ((double) ICON_HIGH_SIDE_DATA[3 * (lg_k - 4) + (kappa - 1)]) / 10000.0;
-  const double rel = x / sqrt(k);
-  const double eps = kappa * rel;
-  const double est = sketch.get_icon_estimate();
-  double result = est / (1.0 + eps);
-  const double check = sketch.get_num_coupons();
+  return CPC_CONFIDENCE_EPSILONS[lg_k - 4];
+}
+
+// The bounds below only need a sketch's lg_k, coupon count and estimate, so they
+// also serve cpc_sketch_alloc::get_serialized_bounds(), which has no sketch.
+
+inline double get_icon_confidence_lb(uint8_t lg_k, uint32_t num_coupons, double icon_estimate, int kappa) {
+  if (num_coupons == 0) return 0.0;
+  const double eps = get_confidence_epsilons(lg_k, kappa).icon_lb[kappa - 1];
+  double result = icon_estimate / (1.0 + eps);
+  const double check = num_coupons;
+  if (result < check) result = check;
+  return result;
+}
+
+inline double get_icon_confidence_ub(uint8_t lg_k, uint32_t num_coupons, double icon_estimate, int kappa) {
+  if (num_coupons == 0) return 0.0;
+  const double eps = get_confidence_epsilons(lg_k, kappa).icon_ub[kappa - 1];
+  const double result = icon_estimate / (1.0 - eps);
+  return ceil(result); // widening for coverage
+}
+
+inline double get_hip_confidence_lb(uint8_t lg_k, uint32_t num_coupons, double hip_estimate, int kappa) {
+  if (num_coupons == 0) return 0.0;
+  const double eps = get_confidence_epsilons(lg_k, kappa).hip_lb[kappa - 1];
+  double result = hip_estimate / (1.0 + eps);
+  const double check = (double) num_coupons;
   if (result < check) result = check;
   return result;
 }
 
+inline double get_hip_confidence_ub(uint8_t lg_k, uint32_t num_coupons, double hip_estimate, int kappa) {
+  if (num_coupons == 0) return 0.0;
+  const double eps = get_confidence_epsilons(lg_k, kappa).hip_ub[kappa - 1];
+  const double result = hip_estimate / (1.0 - eps);
+  return ceil(result); // widening for coverage
+}
+
+template<typename A>
+double get_icon_confidence_lb(const cpc_sketch_alloc<A>& sketch, int kappa) {
+  if (sketch.get_num_coupons() == 0) return 0.0;
+  return get_icon_confidence_lb(sketch.get_lg_k(), sketch.get_num_coupons(), sketch.get_icon_estimate(), kappa);
+}
+
 template<typename A>
 double get_icon_confidence_ub(const cpc_sketch_alloc<A>& sketch, int kappa) {
   if (sketch.get_num_coupons() == 0) return 0.0;
-  const int lg_k = sketch.get_lg_k();
-  const long k = 1 << lg_k;
-  if (lg_k < 4) throw std::logic_error("lgk < 4");
-  if (kappa < 1 || kappa > 3) throw std::invalid_argument("kappa must be between 1 and 3");
-  double x = ICON_ERROT_CONSTANT;
-  if (lg_k <= 14) x = ((double) ICON_LOW_SIDE_DATA[3 * (lg_k - 4) + (kappa - 1)]) / 10000.0;
-  const double rel = x / sqrt(k);
-  const double eps = kappa * rel;
-  const double est = sketch.get_icon_estimate();
-  const double result = est / (1.0 - eps);
-  return ceil(result); // widening for coverage
+  return get_icon_confidence_ub(sketch.get_lg_k(), sketch.get_num_coupons(), sketch.get_icon_estimate(), kappa);
 }
 
 template<typename A>
 double get_hip_confidence_lb(const cpc_sketch_alloc<A>& sketch, int kappa) {
-  if (sketch.get_num_coupons() == 0) return 0.0;
-  const int lg_k = sketch.get_lg_k();
-  const long k = 1 << lg_k;
-  if (lg_k < 4) throw std::logic_error("lgk < 4");
-  if (kappa < 1 || kappa > 3) throw std::invalid_argument("kappa must be between 1 and 3");
-  double x = HIP_ERROR_CONSTANT;
-  if (lg_k <= 14) x = ((double) HIP_HIGH_SIDE_DATA[3 * (lg_k - 4) + (kappa - 1)]) / 10000.0;
-  const double rel = x / (sqrt((double) k));
-  const double eps = ((double) kappa) * rel;
-  const double est = sketch.get_hip_estimate();
-  double result = est / (1.0 + eps);
-  const double check = (double) sketch.get_num_coupons();
-  if (result < check) result = check;
-  return result;
+  return get_hip_confidence_lb(sketch.get_lg_k(), sketch.get_num_coupons(), sketch.get_hip_estimate(), kappa);
 }
 
 template<typename A>
 double get_hip_confidence_ub(const cpc_sketch_alloc<A>& sketch, int kappa) {
-  if (sketch.get_num_coupons() == 0) return 0.0;
-  const int lg_k = sketch.get_lg_k();
-  const long k = 1 << lg_k;
-  if (lg_k < 4) throw std::logic_error("lgk < 4");
-  if (kappa < 1 || kappa > 3) throw std::invalid_argument("kappa must be between 1 and 3");
-  double x = HIP_ERROR_CONSTANT;
-  if (lg_k <= 14) x = ((double) HIP_LOW_SIDE_DATA[3 * (lg_k - 4) + (kappa - 1)]) / 10000.0;
-  const double rel = x / sqrt(k);
-  const double eps = kappa * rel;
-  const double est = sketch.get_hip_estimate();
-  const double result = est / (1.0 - eps);
-  return ceil(result); // widening for coverage
+  return get_hip_confidence_ub(sketch.get_lg_k(), sketch.get_num_coupons(), sketch.get_hip_estimate(), kappa);
 }
 
 } /* namespace datasketches */
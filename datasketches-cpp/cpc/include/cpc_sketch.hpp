@@ -55,8 +55,8 @@ using cpc_sketch = cpc_sketch_alloc<std::allocator<uint8_t>>;
 // call this before anything else if you want to control the initialization time
 // for instance, to have this happen outside of a transaction context
 // otherwise initialization happens on the first use (serialization or deserialization)
-// it is safe to call more than once assuming no race conditions
-// this is not thread safe! neither is the rest of the library
+// it is safe to call more than once, and from several threads at once: the compressor is
+// a function-local static and its lazily made tables are made under std::call_once
 template<typename A> void cpc_init();
 
 template<typename A>
@@ -194,6 +194,73 @@ public:
    */
   void update(const void* value, size_t size);
 
+  /**
+   * Update this sketch with n uint64_t values.
+   * Equivalent to calling update(uint64_t) on each value in turn,
+   * but the hashes are computed several at a time.
+   * @param values pointer to the values
+   * @param n number of values
+   */
+  void update_batch(const uint64_t* values, size_t n);
+
+  /**
+   * Update this sketch with n consecutive 16-byte keys.
+   * Equivalent to calling update(const void*, size_t) on each 16-byte key in turn,
+   * but the hashes are computed several at a time.
+   * @param keys pointer to the first key
+   * @param n number of keys
+   */
+  void update_batch_16(const void* keys, size_t n);
+
+  /**
+   * Update this sketch with n items already hashed by MurmurHash3_x64_128 with this
+   * sketch's seed. Equivalent to calling update(const void*, size_t) on each
+   * item in turn, so an item hashed once can update several sketches.
+   * @param hashes pointer to the hashes, of any type with the h1 and h2 of HashState
+   * @param n number of hashes
+   */
+  template<typename H>
+  void update_hashes(const H* hashes, size_t n);
+
+  /**
+   * Computes the coupon that update(const void*, size_t) derives from the given value
+   * for a sketch with the given lg_k and seed, so that updates can be held back as
+   * coupons and replayed with update_coupon() later.
+   * @param value pointer to the data
+   * @param size of the data in bytes
+   * @param lg_k base 2 logarithm of the number of bins in the sketch
+   * @param seed for hash function
+   * @return the coupon
+   */
+  static uint32_t get_coupon(const void* value, size_t size, uint8_t lg_k = CPC_DEFAULT_LG_K, uint64_t seed = DEFAULT_SEED);
+
+  /**
+   * Update this sketch with a coupon from get_coupon() for this sketch's lg_k and seed.
+   * Replaying the coupons of a sequence of updates in their original order leaves
+   * this sketch in exactly the state those updates would have.
+   * @param coupon to update the sketch with
+   */
+  void update_coupon(uint32_t coupon);
+
+  /**
+   * Update this sketch with n coupons, as update_coupon() on each in turn would.
+   * The promotion out of sparse mode and the window moves that fall due during the
+   * batch are put off to its end and done in one rebuild, however many there are,
+   * rather than each rebuilding the window and the surprising values. Only the
+   * moves that refresh kxp still happen in place, so the result is exactly that of
+   * the unbatched updates. Long batches are split, since a window left behind for
+   * long fills the table with surprises that moving it would have dropped.
+   * @param coupons pointer to the first coupon
+   * @param n number of coupons
+   */
+  void update_coupons(const uint32_t* coupons, size_t n);
+
+  /**
+   * Resets this sketch to the empty state, keeping lg_k, the seed, and the
+   * memory of its table and window for reuse.
+   */
+  void reset();
+
   /**
    * Returns a human-readable summary of this sketch
    */
@@ -215,8 +282,39 @@ public:
    * It is an uninitialized space of a given size.
    * This header is used in Datasketches PostgreSQL extension.
    * @param header_size_bytes space to reserve in front of the sketch
+   * @param with_hip if false, the HIP estimator state is left out, as it is
+   * from the result of a union, which saves 16 bytes. Merging the deserialized
+   * sketch is the same as merging this one, since unions ignore that state,
+   * but its own estimates fall back to the less accurate ICON estimator.
    */
-  vector_bytes serialize(unsigned header_size_bytes = 0) const;
+  vector_bytes serialize(unsigned header_size_bytes = 0, bool with_hip = true) const;
+
+  /**
+   * Computes the size of the array serialize() would return with no header. The sketch
+   * has to be compressed to find out, so this costs about as much as serializing it.
+   * @param with_hip as for serialize()
+   * @return size in bytes
+   */
+  size_t get_serialized_size_bytes(bool with_hip = true) const;
+
+  /**
+   * Computes the heap memory held by the sketch: the capacity of its table of surprising
+   * values and of its sliding window, which may exceed what they use after a reset.
+   * @return size in bytes
+   */
+  size_t get_memory_usage_bytes() const;
+
+  /**
+   * This method serializes the sketch as serialize() does with no header, but into a
+   * given buffer, so that one buffer can be reused across many sketches. Nothing is
+   * written unless the whole sketch fits, and in any case the size it takes is returned,
+   * so a caller can grow the buffer and try again without a separate size query.
+   * @param dst buffer to write to
+   * @param capacity the size of the buffer
+   * @param with_hip as for serialize()
+   * @return the serialized size in bytes, which was written only if at most capacity
+   */
+  size_t serialize_into(void* dst, size_t capacity, bool with_hip = true) const;
 
   /**
    * This method deserializes a sketch from a given stream.
@@ -235,6 +333,34 @@ public:
    */
   static cpc_sketch_alloc<A> deserialize(const void* bytes, size_t size, uint64_t seed = DEFAULT_SEED, const A& allocator = A());
 
+  /**
+   * This method computes the estimate of a serialized sketch without deserializing it.
+   * Only the preamble is read, since it holds everything the estimate needs, but the
+   * whole array is validated as by deserialize() except for its compressed contents.
+   * The result equals deserialize(bytes, size, seed).get_estimate().
+   * @param bytes pointer to the array of bytes
+   * @param size the size of the array
+   * @param seed the seed for the hash function that was used to create the sketch
+   * @return estimate of the distinct count of the input stream
+   */
+  static double get_serialized_estimate(const void* bytes, size_t size, uint64_t seed = DEFAULT_SEED);
+
+  /**
+   * This method computes the estimate and bounds of a serialized sketch without
+   * deserializing it, reading and validating the array as get_serialized_estimate() does.
+   * The results equal those of get_estimate(), get_lower_bound(kappa) and
+   * get_upper_bound(kappa) on deserialize(bytes, size, seed).
+   * @param bytes pointer to the array of bytes
+   * @param size the size of the array
+   * @param kappa given number of standard deviations from the mean: 1, 2 or 3
+   * @param estimate set to the estimate of the distinct count of the input stream
+   * @param lower_bound set to the approximate lower error bound
+   * @param upper_bound set to the approximate upper error bound
+   * @param seed the seed for the hash function that was used to create the sketch
+   */
+  static void get_serialized_bounds(const void* bytes, size_t size, unsigned kappa,
+      double& estimate, double& lower_bound, double& upper_bound, uint64_t seed = DEFAULT_SEED);
+
   // for internal use
   uint32_t get_num_coupons() const;
 
@@ -276,12 +402,18 @@ private:
   cpc_sketch_alloc(uint8_t lg_k, uint32_t num_coupons, uint8_t first_interesting_column, u32_table<A>&& table,
       vector_u8<A>&& window, bool has_hip, double kxp, double hip_est_accum, uint64_t seed);
 
+  // update_coupons() defers window moves for at most this many coupons at a time
+  static const size_t MAX_COUPON_BATCH = 4096;
+
+  void update_coupon_batch(const uint32_t* coupons, size_t n);
   inline void row_col_update(uint32_t row_col);
   inline void update_sparse(uint32_t row_col);
   inline void update_windowed(uint32_t row_col);
   inline void update_hip(uint32_t row_col);
   void promote_sparse_to_windowed();
   void move_window();
+  // rebuilds a sparse or windowed sketch around a window at new_offset
+  void set_window_offset(uint8_t new_offset);
   void refresh_kxp(const uint64_t* bit_matrix);
 
   friend double get_hip_confidence_lb<A>(const cpc_sketch_alloc<A>& sketch, int kappa);
@@ -300,6 +432,27 @@ private:
   vector_u64<A> build_bit_matrix() const;
 
   static uint8_t get_preamble_ints(uint32_t num_coupons, bool has_hip, bool has_table, bool has_window);
+  // validates a serialized sketch as deserialize() does, but reads only its preamble
+  static void read_serialized_preamble(const void* bytes, size_t size, uint64_t seed,
+      uint8_t& lg_k, uint32_t& num_coupons, bool& has_hip, double& hip_est_accum);
+
+  // a serialized sketch as read by deserialize(), before it is uncompressed
+  struct compressed_sketch {
+    explicit compressed_sketch(const A& allocator): state(allocator) {}
+    uint8_t lg_k;
+    uint8_t first_interesting_column;
+    uint32_t num_coupons;
+    bool has_hip;
+    double kxp;
+    double hip_est_accum;
+    compressed_state<A> state;
+  };
+  static void read_compressed(const void* bytes, size_t size, uint64_t seed, compressed_sketch& result);
+  static cpc_sketch_alloc<A> uncompress(compressed_sketch&& compressed, uint64_t seed, const A& allocator);
+  void compress(compressed_state<A>& compressed) const;
+  size_t get_compressed_size_bytes(const compressed_state<A>& compressed, bool has_hip) const;
+  // lays out the compressed sketch as serialize() does, in exactly size bytes at dst
+  void copy_compressed_to_mem(const compressed_state<A>& compressed, bool has_hip, uint8_t* dst, size_t size) const;
   inline void write_hip(std::ostream& os) const;
   inline size_t copy_hip_to_mem(void* dst) const;
 
@@ -20,6 +20,7 @@
 #ifndef CPC_SKETCH_IMPL_HPP_
 #define CPC_SKETCH_IMPL_HPP_
 
+#include <algorithm>
 #include <stdexcept>
 #include <cmath>
 #include <cstring>
@@ -32,12 +33,16 @@
 #include "icon_estimator.hpp"
 #include "serde.hpp"
 #include "count_zeros.hpp"
+#include "bit_matrix_ops.hpp"
+#include "event_counters.hpp"
 
 namespace datasketches {
 
 template<typename A>
 void cpc_init() {
-  get_compressor<A>(); // this initializes a global static instance of the compressor on the first use
+  // this initializes a global static instance of the compressor on the first use,
+  // along with all of its decoding tables
+  get_compressor<A>().make_all_window_decoding_tables();
 }
 
 template<typename A>
@@ -194,6 +199,130 @@ void cpc_sketch_alloc<A>::update(const void* value, size_t size) {
   row_col_update(row_col_from_two_hashes(hashes.h1, hashes.h2, lg_k));
 }
 
+template<typename A>
+void cpc_sketch_alloc<A>::update_batch(const uint64_t* values, size_t n) {
+  HashState hashes[murmur_batch::CHUNK_SIZE];
+  uint32_t row_cols[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    MurmurHash3_x64_128_batch_u64(values, chunk, seed, hashes);
+    for (size_t i = 0; i < chunk; ++i) row_cols[i] = row_col_from_two_hashes(hashes[i].h1, hashes[i].h2, lg_k);
+    update_coupons(row_cols, chunk);
+    values += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::update_batch_16(const void* keys, size_t n) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(keys);
+  HashState hashes[murmur_batch::CHUNK_SIZE];
+  uint32_t row_cols[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    MurmurHash3_x64_128_batch_16(bytes, chunk, seed, hashes);
+    for (size_t i = 0; i < chunk; ++i) row_cols[i] = row_col_from_two_hashes(hashes[i].h1, hashes[i].h2, lg_k);
+    update_coupons(row_cols, chunk);
+    bytes += 16 * chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+template<typename H>
+void cpc_sketch_alloc<A>::update_hashes(const H* hashes, size_t n) {
+  uint32_t row_cols[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    for (size_t i = 0; i < chunk; ++i) row_cols[i] = row_col_from_two_hashes(hashes[i].h1, hashes[i].h2, lg_k);
+    update_coupons(row_cols, chunk);
+    hashes += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+uint32_t cpc_sketch_alloc<A>::get_coupon(const void* value, size_t size, uint8_t lg_k, uint64_t seed) {
+  HashState hashes;
+  MurmurHash3_x64_128(value, size, seed, hashes);
+  return row_col_from_two_hashes(hashes.h1, hashes.h2, lg_k);
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::update_coupon(uint32_t coupon) {
+  row_col_update(coupon);
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::update_coupons(const uint32_t* coupons, size_t n) {
+  while (n > 0) {
+    const size_t batch = n < MAX_COUPON_BATCH ? n : MAX_COUPON_BATCH;
+    update_coupon_batch(coupons, batch);
+    coupons += batch;
+    n -= batch;
+  }
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::update_coupon_batch(const uint32_t* coupons, size_t n) {
+  const uint64_t k = 1 << lg_k;
+  // Until the end of the batch, the window stays where it was, or absent if the sketch
+  // was sparse. Any offset represents the bit matrix exactly, so novel coupons are told
+  // apart as they would be at the due one; the table just holds more surprises.
+  bool windowed = sliding_window.size() > 0;
+  uint8_t due_offset = window_offset;
+  // the lowest column of the novel coupons since the last due move
+  uint8_t min_col_since_move = 64;
+  for (size_t i = 0; i < n; ++i) {
+    const uint32_t row_col = coupons[i];
+    const uint8_t col = row_col & 63;
+    if (col < first_interesting_column) continue;
+    bool is_novel;
+    if (sliding_window.size() == 0 || col >= window_offset + 8) {
+      is_novel = surprising_value_table.maybe_insert(row_col);
+    } else if (col < window_offset) {
+      is_novel = surprising_value_table.maybe_delete(row_col); // inverted logic
+    } else {
+      const uint32_t row = row_col >> 6;
+      const uint8_t old_bits = sliding_window[row];
+      sliding_window[row] = old_bits | (1 << (col - window_offset));
+      is_novel = sliding_window[row] != old_bits;
+    }
+    if (!is_novel) continue;
+    num_coupons++;
+    update_hip(row_col);
+    if (col < min_col_since_move) min_col_since_move = col;
+    // the same thresholds as update_sparse() and update_windowed()
+    const uint64_t c8 = static_cast<uint64_t>(num_coupons) << 3;
+    if (!windowed) {
+      windowed = (c8 << 2) >= 3 * k;
+    } else if (c8 >= (27 + (static_cast<uint64_t>(due_offset) << 3)) * k) {
+      due_offset++;
+      min_col_since_move = 64;
+      // kxp must be refreshed at the same coupon as it would be unbatched
+      if ((due_offset & 0x7) == 0) set_window_offset(due_offset);
+    }
+  }
+  if (windowed && (sliding_window.size() == 0 || due_offset != window_offset)) {
+    set_window_offset(due_offset);
+    // Unbatched, the last move would have set first_interesting_column from the early
+    // zeros of its time, which also include those the coupons since then filled in.
+    if (min_col_since_move < first_interesting_column) first_interesting_column = min_col_since_move;
+  }
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::reset() {
+  was_merged = false;
+  num_coupons = 0;
+  surprising_value_table.clear();
+  sliding_window.clear();
+  window_offset = 0;
+  first_interesting_column = 0;
+  kxp = 1 << lg_k;
+  hip_est_accum = 0;
+}
+
 template<typename A>
 void cpc_sketch_alloc<A>::row_col_update(uint32_t row_col) {
   const uint8_t col = row_col & 63;
@@ -309,19 +438,27 @@ void cpc_sketch_alloc<A>::promote_sparse_to_windowed() {
 
 template<typename A>
 void cpc_sketch_alloc<A>::move_window() {
+  DATASKETCHES_COUNT_EVENT(CPC_MOVE_WINDOW);
   const uint8_t new_offset = window_offset + 1;
   if (new_offset > 56) throw std::logic_error("new_offset > 56");
   if (new_offset != determine_correct_offset(lg_k, num_coupons)) throw std::logic_error("new_offset is wrong");
 
   if (sliding_window.size() == 0) throw std::logic_error("no sliding window");
+  set_window_offset(new_offset);
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::set_window_offset(uint8_t new_offset) {
+  if (sliding_window.size() > 0 && new_offset == window_offset) return;
   const uint32_t k = 1 << lg_k;
 
   // Construct the full-sized bit matrix that corresponds to the sketch
   vector_u64<A> bit_matrix = build_bit_matrix();
 
   // refresh the KXP register on every 8th window shift.
-  if ((new_offset & 0x7) == 0) refresh_kxp(bit_matrix.data());
+  if (new_offset / 8 > window_offset / 8) refresh_kxp(bit_matrix.data());
 
+  sliding_window.resize(k); // every row is overwritten below
   surprising_value_table.clear(); // the new number of surprises will be about the same
 
   const uint64_t mask_for_clearing_window = (static_cast<uint64_t>(0xff) << new_offset) ^ UINT64_MAX;
@@ -363,12 +500,15 @@ void cpc_sketch_alloc<A>::refresh_kxp(const uint64_t* bit_matrix) {
   double byte_sums[8]; // allocating on the stack
   std::fill(byte_sums, &byte_sums[8], 0);
 
-  for (size_t i = 0; i < k; i++) {
-    uint64_t word = bit_matrix[i];
-    for (unsigned j = 0; j < 8; j++) {
-      const uint8_t byte = word & 0xff;
-      byte_sums[j] += KXP_BYTE_TABLE[byte];
-      word >>= 8;
+  // Summing KXP_BYTE_TABLE[byte j of each row] is the same as weighting the
+  // number of rows with a zero in each of the 8 columns of byte j. Either way
+  // every partial sum is a multiple of 1/256 below 2^26, so both are exact
+  // and give identical byte sums; the column counts just vectorize.
+  uint32_t column_counts[64] = {0};
+  count_bits_set_in_columns(bit_matrix, k, column_counts);
+  for (unsigned j = 0; j < 8; j++) {
+    for (unsigned b = 0; b < 8; b++) {
+      byte_sums[j] += (k - column_counts[8 * j + b]) * INVERSE_POWERS_OF_2[b + 1];
     }
   }
 
@@ -458,19 +598,60 @@ void cpc_sketch_alloc<A>::serialize(std::ostream& os) const {
 }
 
 template<typename A>
-vector_u8<A> cpc_sketch_alloc<A>::serialize(unsigned header_size_bytes) const {
+vector_u8<A> cpc_sketch_alloc<A>::serialize(unsigned header_size_bytes, bool with_hip) const {
+  compressed_state<A> compressed(sliding_window.get_allocator());
+  compress(compressed);
+  const bool has_hip = with_hip && !was_merged;
+  const size_t size = get_compressed_size_bytes(compressed, has_hip);
+  vector_u8<A> bytes(header_size_bytes + size, 0, sliding_window.get_allocator());
+  copy_compressed_to_mem(compressed, has_hip, bytes.data() + header_size_bytes, size);
+  return bytes;
+}
+
+template<typename A>
+size_t cpc_sketch_alloc<A>::get_serialized_size_bytes(bool with_hip) const {
   compressed_state<A> compressed(sliding_window.get_allocator());
+  compress(compressed);
+  return get_compressed_size_bytes(compressed, with_hip && !was_merged);
+}
+
+template<typename A>
+size_t cpc_sketch_alloc<A>::get_memory_usage_bytes() const {
+  return surprising_value_table.get_memory_usage_bytes() + sliding_window.capacity();
+}
+
+template<typename A>
+size_t cpc_sketch_alloc<A>::serialize_into(void* dst, size_t capacity, bool with_hip) const {
+  compressed_state<A> compressed(sliding_window.get_allocator());
+  compress(compressed);
+  const bool has_hip = with_hip && !was_merged;
+  const size_t size = get_compressed_size_bytes(compressed, has_hip);
+  if (size <= capacity) copy_compressed_to_mem(compressed, has_hip, static_cast<uint8_t*>(dst), size);
+  return size;
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::compress(compressed_state<A>& compressed) const {
   compressed.table_data_words = 0;
   compressed.table_num_entries = 0;
   compressed.window_data_words = 0;
   get_compressor<A>().compress(*this, compressed);
-  const bool has_hip = !was_merged;
+}
+
+template<typename A>
+size_t cpc_sketch_alloc<A>::get_compressed_size_bytes(const compressed_state<A>& compressed, bool has_hip) const {
+  const bool has_table = compressed.table_data.size() > 0;
+  const bool has_window = compressed.window_data.size() > 0;
+  const uint8_t preamble_ints = get_preamble_ints(num_coupons, has_hip, has_table, has_window);
+  return (preamble_ints + compressed.table_data_words + compressed.window_data_words) * sizeof(uint32_t);
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::copy_compressed_to_mem(const compressed_state<A>& compressed, bool has_hip, uint8_t* dst, size_t size) const {
   const bool has_table = compressed.table_data.size() > 0;
   const bool has_window = compressed.window_data.size() > 0;
   const uint8_t preamble_ints = get_preamble_ints(num_coupons, has_hip, has_table, has_window);
-  const size_t size = header_size_bytes + (preamble_ints + compressed.table_data_words + compressed.window_data_words) * sizeof(uint32_t);
-  vector_u8<A> bytes(size, 0, sliding_window.get_allocator());
-  uint8_t* ptr = bytes.data() + header_size_bytes;
+  uint8_t* ptr = dst;
   ptr += copy_to_mem(preamble_ints, ptr);
   const uint8_t serial_version = SERIAL_VERSION;
   ptr += copy_to_mem(serial_version, ptr);
@@ -511,8 +692,7 @@ vector_u8<A> cpc_sketch_alloc<A>::serialize(unsigned header_size_bytes) const {
       ptr += copy_to_mem(compressed.table_data.data(), ptr, compressed.table_data_words * sizeof(uint32_t));
     }
   }
-  if (ptr != bytes.data() + size) throw std::logic_error("serialized size mismatch");
-  return bytes;
+  if (ptr != dst + size) throw std::logic_error("serialized size mismatch");
 }
 
 template<typename A>
@@ -591,6 +771,22 @@ cpc_sketch_alloc<A> cpc_sketch_alloc<A>::deserialize(std::istream& is, uint64_t
 
 template<typename A>
 cpc_sketch_alloc<A> cpc_sketch_alloc<A>::deserialize(const void* bytes, size_t size, uint64_t seed, const A& allocator) {
+  compressed_sketch compressed(allocator);
+  read_compressed(bytes, size, seed, compressed);
+  return uncompress(std::move(compressed), seed, allocator);
+}
+
+template<typename A>
+cpc_sketch_alloc<A> cpc_sketch_alloc<A>::uncompress(compressed_sketch&& compressed, uint64_t seed, const A& allocator) {
+  uncompressed_state<A> uncompressed(allocator);
+  get_compressor<A>().uncompress(compressed.state, uncompressed, compressed.lg_k, compressed.num_coupons);
+  return cpc_sketch_alloc(compressed.lg_k, compressed.num_coupons, compressed.first_interesting_column,
+      std::move(uncompressed.table), std::move(uncompressed.window), compressed.has_hip, compressed.kxp,
+      compressed.hip_est_accum, seed);
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::read_compressed(const void* bytes, size_t size, uint64_t seed, compressed_sketch& result) {
   ensure_minimum_memory(size, 8);
   const char* ptr = static_cast<const char*>(bytes);
   const char* base = static_cast<const char*>(bytes);
@@ -612,7 +808,7 @@ cpc_sketch_alloc<A> cpc_sketch_alloc<A>::deserialize(const void* bytes, size_t s
   const bool has_table = flags_byte & (1 << flags::HAS_TABLE);
   const bool has_window = flags_byte & (1 << flags::HAS_WINDOW);
   ensure_minimum_memory(size, preamble_ints << 2);
-  compressed_state<A> compressed(allocator);
+  compressed_state<A>& compressed = result.state;
   compressed.table_data_words = 0;
   compressed.table_num_entries = 0;
   compressed.window_data_words = 0;
@@ -675,10 +871,127 @@ cpc_sketch_alloc<A> cpc_sketch_alloc<A>::deserialize(const void* bytes, size_t s
     throw std::invalid_argument("Incompatible seed hashes: " + std::to_string(seed_hash) + ", "
         + std::to_string(compute_seed_hash(seed)));
   }
-  uncompressed_state<A> uncompressed(allocator);
-  get_compressor<A>().uncompress(compressed, uncompressed, lg_k, num_coupons);
-  return cpc_sketch_alloc(lg_k, num_coupons, first_interesting_column, std::move(uncompressed.table),
-      std::move(uncompressed.window), has_hip, kxp, hip_est_accum, seed);
+  result.lg_k = lg_k;
+  result.first_interesting_column = first_interesting_column;
+  result.num_coupons = num_coupons;
+  result.has_hip = has_hip;
+  result.kxp = kxp;
+  result.hip_est_accum = hip_est_accum;
+}
+
+template<typename A>
+double cpc_sketch_alloc<A>::get_serialized_estimate(const void* bytes, size_t size, uint64_t seed) {
+  uint8_t lg_k;
+  uint32_t num_coupons;
+  bool has_hip;
+  double hip_est_accum;
+  read_serialized_preamble(bytes, size, seed, lg_k, num_coupons, has_hip, hip_est_accum);
+  // as in get_estimate(), where a sketch without HIP state was merged
+  if (has_hip) return hip_est_accum;
+  return compute_icon_estimate(lg_k, num_coupons);
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::get_serialized_bounds(const void* bytes, size_t size, unsigned kappa,
+    double& estimate, double& lower_bound, double& upper_bound, uint64_t seed) {
+  if (kappa < 1 || kappa > 3) {
+    throw std::invalid_argument("kappa must be 1, 2 or 3");
+  }
+  uint8_t lg_k;
+  uint32_t num_coupons;
+  bool has_hip;
+  double hip_est_accum;
+  read_serialized_preamble(bytes, size, seed, lg_k, num_coupons, has_hip, hip_est_accum);
+  if (has_hip) {
+    estimate = hip_est_accum;
+    lower_bound = get_hip_confidence_lb(lg_k, num_coupons, estimate, kappa);
+    upper_bound = get_hip_confidence_ub(lg_k, num_coupons, estimate, kappa);
+  } else {
+    estimate = compute_icon_estimate(lg_k, num_coupons);
+    lower_bound = get_icon_confidence_lb(lg_k, num_coupons, estimate, kappa);
+    upper_bound = get_icon_confidence_ub(lg_k, num_coupons, estimate, kappa);
+  }
+}
+
+template<typename A>
+void cpc_sketch_alloc<A>::read_serialized_preamble(const void* bytes, size_t size, uint64_t seed,
+    uint8_t& lg_k, uint32_t& num_coupons, bool& has_hip, double& hip_est_accum) {
+  ensure_minimum_memory(size, 8);
+  const char* ptr = static_cast<const char*>(bytes);
+  const char* base = static_cast<const char*>(bytes);
+  uint8_t preamble_ints;
+  ptr += copy_from_mem(ptr, preamble_ints);
+  uint8_t serial_version;
+  ptr += copy_from_mem(ptr, serial_version);
+  uint8_t family_id;
+  ptr += copy_from_mem(ptr, family_id);
+  ptr += copy_from_mem(ptr, lg_k);
+  ptr += sizeof(uint8_t); // first_interesting_column
+  uint8_t flags_byte;
+  ptr += copy_from_mem(ptr, flags_byte);
+  uint16_t seed_hash;
+  ptr += copy_from_mem(ptr, seed_hash);
+  has_hip = flags_byte & (1 << flags::HAS_HIP);
+  const bool has_table = flags_byte & (1 << flags::HAS_TABLE);
+  const bool has_window = flags_byte & (1 << flags::HAS_WINDOW);
+  ensure_minimum_memory(size, preamble_ints << 2);
+  num_coupons = 0;
+  hip_est_accum = 0;
+  // the preamble is laid out as in deserialize(), but the compressed data
+  // words that follow it are only accounted for
+  size_t expected_size = ptr - base;
+  if (has_table || has_window) {
+    check_memory_size(ptr - base + sizeof(num_coupons), size);
+    ptr += copy_from_mem(ptr, num_coupons);
+    // past num_coupons, the preamble is sizes of the data, preceded by the
+    // number of table entries when both are present, and the HIP state
+    const char* hip_ptr = nullptr;
+    if (has_table && has_window) {
+      ptr += sizeof(uint32_t); // table_num_entries
+      if (has_hip) {
+        hip_ptr = ptr;
+        ptr += sizeof(double) * 2;
+      }
+    }
+    uint32_t table_data_words = 0;
+    uint32_t window_data_words = 0;
+    if (has_table) {
+      check_memory_size(ptr - base + sizeof(table_data_words), size);
+      ptr += copy_from_mem(ptr, table_data_words);
+    }
+    if (has_window) {
+      check_memory_size(ptr - base + sizeof(window_data_words), size);
+      ptr += copy_from_mem(ptr, window_data_words);
+    }
+    if (has_hip && !(has_table && has_window)) {
+      hip_ptr = ptr;
+      ptr += sizeof(double) * 2;
+    }
+    if (has_hip) {
+      check_memory_size(hip_ptr - base + sizeof(double) * 2, size);
+      copy_from_mem(hip_ptr + sizeof(double), hip_est_accum); // after kxp
+    }
+    expected_size = (ptr - base) + (static_cast<size_t>(table_data_words) + window_data_words) * sizeof(uint32_t);
+  }
+  if (size != expected_size) throw std::logic_error("deserialized size mismatch");
+
+  uint8_t expected_preamble_ints = get_preamble_ints(num_coupons, has_hip, has_table, has_window);
+  if (preamble_ints != expected_preamble_ints) {
+    throw std::invalid_argument("Possible corruption: preamble ints: expected "
+        + std::to_string(expected_preamble_ints) + ", got " + std::to_string(preamble_ints));
+  }
+  if (serial_version != SERIAL_VERSION) {
+    throw std::invalid_argument("Possible corruption: serial version: expected "
+        + std::to_string(SERIAL_VERSION) + ", got " + std::to_string(serial_version));
+  }
+  if (family_id != FAMILY) {
+    throw std::invalid_argument("Possible corruption: family: expected "
+        + std::to_string(FAMILY) + ", got " + std::to_string(family_id));
+  }
+  if (seed_hash != compute_seed_hash(seed)) {
+    throw std::invalid_argument("Incompatible seed hashes: " + std::to_string(seed_hash) + ", "
+        + std::to_string(compute_seed_hash(seed)));
+  }
 }
 
 template<typename A>
@@ -689,7 +1002,7 @@ uint32_t cpc_sketch_alloc<A>::get_num_coupons() const {
 template<typename A>
 bool cpc_sketch_alloc<A>::validate() const {
   vector_u64<A> bit_matrix = build_bit_matrix();
-  const uint64_t num_bits_set = count_bits_set_in_matrix(bit_matrix.data(), 1ULL << lg_k);
+  const uint64_t num_bits_set = count_bits_set_in_rows(bit_matrix.data(), 1 << lg_k);
   return num_bits_set == num_coupons;
 }
 
@@ -769,9 +1082,8 @@ vector_u64<A> cpc_sketch_alloc<A>::build_bit_matrix() const {
   if (num_coupons == 0) return matrix;
 
   if (sliding_window.size() > 0) { // In other words, we are in window mode, not sparse mode
-    for (size_t i = 0; i < k; i++) { // set the window bits, trusting the sketch's current offset
-      matrix[i] |= static_cast<uint64_t>(sliding_window[i]) << window_offset;
-    }
+    // set the window bits, trusting the sketch's current offset
+    or_window_rows(matrix.data(), sliding_window.data(), k, window_offset);
   }
 
   const uint32_t* slots = surprising_value_table.get_slots();
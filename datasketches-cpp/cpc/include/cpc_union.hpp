@@ -66,17 +66,34 @@ public:
    */
   void update(cpc_sketch_alloc<A>&& sketch);
 
+  /**
+   * This method is to update the union with a serialized sketch, which is
+   * equivalent to update(cpc_sketch_alloc<A>::deserialize(bytes, size, seed)).
+   * Sketches past the sparse flavor are merged in straight from their compressed
+   * window and surprising values, without building the sketch and its table.
+   * @param bytes pointer to the array of bytes
+   * @param size the size of the array
+   */
+  void update(const void* bytes, size_t size);
+
   /**
    * This method produces a copy of the current state of the union as a sketch.
    * @return the result of the union
    */
   cpc_sketch_alloc<A> get_result() const;
 
+  /**
+   * Resets this union to the empty state with its original lg_k, reusing its
+   * accumulator when the union has not grown past it.
+   */
+  void reset();
+
 private:
   typedef typename std::allocator_traits<A>::template rebind_alloc<uint8_t> AllocU8;
   typedef typename std::allocator_traits<A>::template rebind_alloc<uint64_t> AllocU64;
   typedef typename std::allocator_traits<A>::template rebind_alloc<cpc_sketch_alloc<A>> AllocCpc;
 
+  uint8_t initial_lg_k; // lg_k shrinks to that of the smallest sketch merged in
   uint8_t lg_k;
   uint64_t seed;
   cpc_sketch_alloc<A>* accumulator;
@@ -90,6 +107,8 @@ private:
   void switch_to_bit_matrix();
   void walk_table_updating_sketch(const u32_table<A>& table);
   void or_table_into_matrix(const u32_table<A>& table);
+  void or_pairs_into_matrix(const vector_u32<A>& pairs);
+  void or_sliding_rows_into_matrix(const vector_u8<A>& sliding_window, const vector_u32<A>& pairs, uint8_t offset, uint8_t src_lg_k);
   void or_window_into_matrix(const vector_u8<A>& sliding_window, uint8_t offset, uint8_t src_lg_k);
   void or_matrix_into_matrix(const vector_u64<A>& src_matrix, uint8_t src_lg_k);
   void reduce_k(uint8_t new_lg_k);
@@ -21,11 +21,13 @@
 #define CPC_UNION_IMPL_HPP_
 
 #include "count_zeros.hpp"
+#include "bit_matrix_ops.hpp"
 
 namespace datasketches {
 
 template<typename A>
 cpc_union_alloc<A>::cpc_union_alloc(uint8_t lg_k, uint64_t seed, const A& allocator):
+initial_lg_k(lg_k),
 lg_k(lg_k),
 seed(seed),
 accumulator(nullptr),
@@ -39,6 +41,7 @@ bit_matrix(allocator)
 
 template<typename A>
 cpc_union_alloc<A>::cpc_union_alloc(const cpc_union_alloc<A>& other):
+initial_lg_k(other.initial_lg_k),
 lg_k(other.lg_k),
 seed(other.seed),
 accumulator(other.accumulator),
@@ -51,6 +54,7 @@ bit_matrix(other.bit_matrix)
 
 template<typename A>
 cpc_union_alloc<A>::cpc_union_alloc(cpc_union_alloc<A>&& other) noexcept:
+initial_lg_k(other.initial_lg_k),
 lg_k(other.lg_k),
 seed(other.seed),
 accumulator(other.accumulator),
@@ -70,6 +74,7 @@ cpc_union_alloc<A>::~cpc_union_alloc() {
 template<typename A>
 cpc_union_alloc<A>& cpc_union_alloc<A>::operator=(const cpc_union_alloc<A>& other) {
   cpc_union_alloc<A> copy(other);
+  initial_lg_k = copy.initial_lg_k;
   std::swap(lg_k, copy.lg_k);
   seed = copy.seed;
   std::swap(accumulator, copy.accumulator);
@@ -79,6 +84,7 @@ cpc_union_alloc<A>& cpc_union_alloc<A>::operator=(const cpc_union_alloc<A>& othe
 
 template<typename A>
 cpc_union_alloc<A>& cpc_union_alloc<A>::operator=(cpc_union_alloc<A>&& other) noexcept {
+  initial_lg_k = other.initial_lg_k;
   std::swap(lg_k, other.lg_k);
   seed = other.seed;
   std::swap(accumulator, other.accumulator);
@@ -96,6 +102,49 @@ void cpc_union_alloc<A>::update(cpc_sketch_alloc<A>&& sketch) {
   internal_update(std::forward<cpc_sketch_alloc<A>>(sketch));
 }
 
+template<typename A>
+void cpc_union_alloc<A>::update(const void* bytes, size_t size) {
+  const A allocator(bit_matrix.get_allocator());
+  typename cpc_sketch_alloc<A>::compressed_sketch compressed(allocator);
+  cpc_sketch_alloc<A>::read_compressed(bytes, size, seed, compressed);
+  const uint8_t src_lg_k = compressed.lg_k;
+  const uint32_t num_coupons = compressed.num_coupons;
+  const auto src_flavor = cpc_sketch_alloc<A>::determine_flavor(src_lg_k, num_coupons);
+  if (cpc_sketch_alloc<A>::flavor::EMPTY == src_flavor) return;
+
+  // Sparse sketches merge from their table (Case A) or are small to begin with,
+  // so the compressed path only pays off once they have a window.
+  if (cpc_sketch_alloc<A>::flavor::SPARSE == src_flavor) {
+    internal_update(cpc_sketch_alloc<A>::uncompress(std::move(compressed), seed, allocator));
+    return;
+  }
+
+  // the same preparation as internal_update() for a source past SPARSE mode
+  if (src_lg_k < lg_k) reduce_k(src_lg_k);
+  if (src_lg_k < lg_k) throw std::logic_error("sketch lg_k < union lg_k");
+  if (accumulator != nullptr) {
+    if (bit_matrix.size() > 0) throw std::logic_error("union bit matrix is not expected");
+    const auto dst_flavor = accumulator->determine_flavor();
+    if (cpc_sketch_alloc<A>::flavor::EMPTY != dst_flavor && cpc_sketch_alloc<A>::flavor::SPARSE != dst_flavor) {
+      throw std::logic_error("wrong flavor");
+    }
+    switch_to_bit_matrix();
+  }
+  if (bit_matrix.size() == 0) throw std::logic_error("union bit_matrix is expected");
+
+  vector_u8<A> sliding_window(allocator);
+  vector_u32<A> pairs(allocator);
+  get_compressor<A>().uncompress_rows(compressed.state, sliding_window, pairs, src_lg_k, num_coupons);
+  const uint8_t offset = cpc_sketch_alloc<A>::determine_correct_offset(src_lg_k, num_coupons);
+  if (cpc_sketch_alloc<A>::flavor::SLIDING == src_flavor) { // Case D
+    or_sliding_rows_into_matrix(sliding_window, pairs, offset, src_lg_k);
+    return;
+  }
+  // Case C, where the hybrid flavor's window bits are among the pairs
+  if (sliding_window.size() > 0) or_window_into_matrix(sliding_window, offset, src_lg_k);
+  or_pairs_into_matrix(pairs);
+}
+
 template<typename A>
 template<typename S>
 void cpc_union_alloc<A>::internal_update(S&& sketch) {
@@ -192,7 +241,7 @@ cpc_sketch_alloc<A> cpc_union_alloc<A>::get_result_from_accumulator() const {
 template<typename A>
 cpc_sketch_alloc<A> cpc_union_alloc<A>::get_result_from_bit_matrix() const {
   const uint32_t k = 1 << lg_k;
-  const uint32_t num_coupons = count_bits_set_in_matrix(bit_matrix.data(), k);
+  const uint32_t num_coupons = count_bits_set_in_rows(bit_matrix.data(), k);
 
   const auto flavor = cpc_sketch_alloc<A>::determine_flavor(lg_k, num_coupons);
   if (flavor != cpc_sketch_alloc<A>::flavor::HYBRID && flavor != cpc_sketch_alloc<A>::flavor::PINNED
@@ -239,6 +288,20 @@ cpc_sketch_alloc<A> cpc_union_alloc<A>::get_result_from_bit_matrix() const {
   return cpc_sketch_alloc<A>(lg_k, num_coupons, first_interesting_column, std::move(table), std::move(sliding_window), false, 0, 0, seed);
 }
 
+template<typename A>
+void cpc_union_alloc<A>::reset() {
+  const A allocator(bit_matrix.get_allocator());
+  bit_matrix.clear();
+  if (accumulator == nullptr) {
+    accumulator = new (AllocCpc().allocate(1)) cpc_sketch_alloc<A>(initial_lg_k, seed, allocator);
+  } else if (accumulator->get_lg_k() != initial_lg_k) {
+    *accumulator = cpc_sketch_alloc<A>(initial_lg_k, seed, allocator);
+  } else {
+    accumulator->reset();
+  }
+  lg_k = initial_lg_k;
+}
+
 template<typename A>
 void cpc_union_alloc<A>::switch_to_bit_matrix() {
   bit_matrix = accumulator->build_bit_matrix();
@@ -284,23 +347,87 @@ void cpc_union_alloc<A>::or_table_into_matrix(const u32_table<A>& table) {
   }
 }
 
+template<typename A>
+void cpc_union_alloc<A>::or_pairs_into_matrix(const vector_u32<A>& pairs) {
+  const uint64_t dest_mask = (1 << lg_k) - 1;  // downsamples when dst lgK < sr LgK
+  for (const uint32_t row_col: pairs) {
+    const uint8_t col = row_col & 63;
+    const uint32_t row = row_col >> 6;
+    bit_matrix[row & dest_mask] |= static_cast<uint64_t>(1) << col; // set the bit
+  }
+}
+
+// The rows of sketch.build_bit_matrix() for a sliding sketch, built one at a time
+// from pairs sorted by row instead of in a matrix of their own.
+template<typename A>
+void cpc_union_alloc<A>::or_sliding_rows_into_matrix(const vector_u8<A>& sliding_window, const vector_u32<A>& pairs,
+    uint8_t offset, uint8_t src_lg_k) {
+  if (lg_k > src_lg_k) throw std::logic_error("dst LgK > src LgK");
+  if (offset > 56) throw std::logic_error("offset > 56");
+  // downsamples when dst lgK < src LgK, a block of k source rows at a time as in or_window_into_matrix()
+  const uint32_t k = 1 << lg_k;
+  const uint64_t dst_mask = k - 1;
+  const uint32_t src_k = 1 << src_lg_k;
+  // default rows have the "early zone" filled with ones, see build_bit_matrix()
+  const uint64_t default_row = (static_cast<uint64_t>(1) << offset) - 1;
+  // Rows are OR'ed in whole with their defaults, and surprising values are applied after:
+  // the 1s past the window are simply OR'ed in too, but a row missing a value in the early zone
+  // is put back together from what the union held before.
+  vector_u64<A> kept_rows(bit_matrix.get_allocator());
+  size_t next_pair = 0;
+  for (uint32_t src_row = 0; src_row < src_k; src_row += k) {
+    size_t end_pair = next_pair;
+    uint32_t prev_row = src_row;
+    uint32_t last_kept_row = UINT32_MAX;
+    for (; end_pair < pairs.size() && (pairs[end_pair] >> 6) < src_row + k; end_pair++) {
+      const uint32_t row = pairs[end_pair] >> 6;
+      if (row < prev_row) throw std::logic_error("surprising values are not sorted by row");
+      prev_row = row;
+      if ((pairs[end_pair] & 63) < offset && row != last_kept_row) {
+        kept_rows.push_back(bit_matrix[row & dst_mask]);
+        last_kept_row = row;
+      }
+    }
+    or_window_rows(bit_matrix.data(), sliding_window.data() + src_row, k, offset, default_row);
+    size_t next_kept = 0;
+    while (next_pair < end_pair) {
+      const uint32_t row = pairs[next_pair] >> 6;
+      uint64_t flips = 0;
+      for (; next_pair < end_pair && (pairs[next_pair] >> 6) == row; next_pair++) {
+        flips |= static_cast<uint64_t>(1) << (pairs[next_pair] & 63);
+      }
+      if ((flips & default_row) != 0) {
+        const uint64_t pattern = default_row | (static_cast<uint64_t>(sliding_window[row]) << offset);
+        bit_matrix[row & dst_mask] = kept_rows[next_kept++] | (pattern ^ flips);
+      } else {
+        bit_matrix[row & dst_mask] |= flips;
+      }
+    }
+    kept_rows.clear();
+  }
+  if (next_pair != pairs.size()) throw std::logic_error("surprising values are not sorted by row");
+}
+
 template<typename A>
 void cpc_union_alloc<A>::or_window_into_matrix(const vector_u8<A>& sliding_window, uint8_t offset, uint8_t src_lg_k) {
   if (lg_k > src_lg_k) throw std::logic_error("dst LgK > src LgK");
-  const uint64_t dst_mask = (1 << lg_k) - 1; // downsamples when dst lgK < src LgK
+  // downsamples when dst lgK < src LgK: source row r goes to r mod k, so each
+  // block of k source rows is OR'ed over the whole destination
+  const uint32_t k = 1 << lg_k;
   const uint32_t src_k = 1 << src_lg_k;
-  for (uint32_t src_row = 0; src_row < src_k; src_row++) {
-    bit_matrix[src_row & dst_mask] |= static_cast<uint64_t>(sliding_window[src_row]) << offset;
+  for (uint32_t src_row = 0; src_row < src_k; src_row += k) {
+    or_window_rows(bit_matrix.data(), sliding_window.data() + src_row, k, offset);
   }
 }
 
 template<typename A>
 void cpc_union_alloc<A>::or_matrix_into_matrix(const vector_u64<A>& src_matrix, uint8_t src_lg_k) {
   if (lg_k > src_lg_k) throw std::logic_error("dst LgK > src LgK");
-  const uint64_t dst_mask = (1 << lg_k) - 1; // downsamples when dst lgK < src LgK
+  // downsamples when dst lgK < src LgK, as in or_window_into_matrix()
+  const uint32_t k = 1 << lg_k;
   const uint32_t src_k = 1 << src_lg_k;
-  for (uint32_t src_row = 0; src_row < src_k; src_row++) {
-    bit_matrix[src_row & dst_mask] |= src_matrix[src_row];
+  for (uint32_t src_row = 0; src_row < src_k; src_row += k) {
+    or_rows(bit_matrix.data(), src_matrix.data() + src_row, k);
   }
 }
 
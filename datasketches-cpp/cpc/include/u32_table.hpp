@@ -45,6 +45,8 @@ public:
   inline uint32_t get_num_items() const;
   inline const uint32_t* get_slots() const;
   inline uint8_t get_lg_size() const;
+  // heap bytes held by the slots, including any reserved beyond lg_size
+  inline size_t get_memory_usage_bytes() const;
   inline void clear();
 
   // returns true iff the item was new and was therefore added to the table
@@ -54,6 +56,7 @@ public:
 
   static u32_table make_from_pairs(const uint32_t* pairs, uint32_t num_pairs, uint8_t lg_k, const A& allocator);
 
+  // the items in ascending order
   vector_u32<A> unwrapping_get_items() const;
 
   static void merge(
@@ -73,6 +76,7 @@ private:
   vector_u32<A> slots;
 
   inline uint32_t lookup(uint32_t item) const;
+  inline void insert_at(uint32_t index, uint32_t item);
   inline void must_insert(uint32_t item);
   inline void rebuild(uint8_t new_lg_size);
 };
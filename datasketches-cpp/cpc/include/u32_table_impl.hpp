@@ -62,6 +62,11 @@ uint8_t u32_table<A>::get_lg_size() const {
   return lg_size;
 }
 
+template<typename A>
+size_t u32_table<A>::get_memory_usage_bytes() const {
+  return slots.capacity() * sizeof(uint32_t);
+}
+
 template<typename A>
 void u32_table<A>::clear() {
   std::fill(slots.begin(), slots.end(), UINT32_MAX);
@@ -72,8 +77,7 @@ template<typename A>
 bool u32_table<A>::maybe_insert(uint32_t item) {
   const uint32_t index = lookup(item);
   if (slots[index] == item) return false;
-  if (slots[index] != UINT32_MAX) throw std::logic_error("could not insert");
-  slots[index] = item;
+  insert_at(index, item);
   num_items++;
   if (U32_TABLE_UPSIZE_DENOM * num_items > U32_TABLE_UPSIZE_NUMER * (1 << lg_size)) {
     rebuild(lg_size + 1);
@@ -84,8 +88,7 @@ bool u32_table<A>::maybe_insert(uint32_t item) {
 template<typename A>
 bool u32_table<A>::maybe_delete(uint32_t item) {
   const uint32_t index = lookup(item);
-  if (slots[index] == UINT32_MAX) return false;
-  if (slots[index] != item) throw std::logic_error("item does not exist");
+  if (slots[index] != item) return false;
   if (num_items == 0) throw std::logic_error("delete error");
   // delete the item
   slots[index] = UINT32_MAX;
@@ -115,7 +118,8 @@ u32_table<A> u32_table<A>::make_from_pairs(const uint32_t* pairs, uint32_t num_p
   while (U32_TABLE_UPSIZE_DENOM * num_pairs > U32_TABLE_UPSIZE_NUMER * (1 << lg_num_slots)) lg_num_slots++;
   u32_table<A> table(lg_num_slots, 6 + lg_k, allocator);
   // Note: there is a possible "snowplow effect" here because the caller is passing in a sorted pairs array
-  // However, we are starting out with the correct final table size, so the problem might not occur
+  // However, we are starting out with the correct final table size, so the problem might not occur.
+  // Sorted pairs are also the cheap order to insert in: each one goes after everything already there
   for (size_t i = 0; i < num_pairs; i++) {
     table.must_insert(pairs[i]);
   }
@@ -123,6 +127,11 @@ u32_table<A> u32_table<A>::make_from_pairs(const uint32_t* pairs, uint32_t num_p
   return table;
 }
 
+// The table is ordered (Amble and Knuth, 1974): every slot on the probe path of an item
+// holds a smaller one. Since the hash is just the high bits of the item, this keeps the slots
+// sorted apart from the items that wrapped around, see unwrapping_get_items(), and lets a lookup
+// stop at the first larger item instead of running on to an empty slot.
+// This returns the slot holding the item, or else the slot it would be inserted at.
 template<typename A>
 uint32_t u32_table<A>::lookup(uint32_t item) const {
   const uint32_t size = 1 << lg_size;
@@ -130,19 +139,33 @@ uint32_t u32_table<A>::lookup(uint32_t item) const {
   const uint8_t shift = num_valid_bits - lg_size;
   uint32_t probe = item >> shift;
   if (probe > mask) throw std::logic_error("probe out of range");
-  while (slots[probe] != item && slots[probe] != UINT32_MAX) {
+  // the empty marker is larger than any item
+  while (slots[probe] < item) {
     probe = (probe + 1) & mask;
   }
   return probe;
 }
 
+// Puts the item into the given slot from lookup(), moving larger items along its cluster
+// to keep the table ordered. Counts and resizing must be handled by the caller
+template<typename A>
+void u32_table<A>::insert_at(uint32_t index, uint32_t item) {
+  const uint32_t mask = (1 << lg_size) - 1;
+  uint32_t probe = index;
+  while (slots[probe] != UINT32_MAX) {
+    if (slots[probe] > item) std::swap(slots[probe], item);
+    probe = (probe + 1) & mask;
+    if (probe == index) throw std::logic_error("could not insert");
+  }
+  slots[probe] = item;
+}
+
 // counts and resizing must be handled by the caller
 template<typename A>
 void u32_table<A>::must_insert(uint32_t item) {
   const uint32_t index = lookup(item);
   if (slots[index] == item) throw std::logic_error("item exists");
-  if (slots[index] != UINT32_MAX) throw std::logic_error("could not insert");
-  slots[index] = item;
+  insert_at(index, item);
 }
 
 template<typename A>
@@ -161,27 +184,25 @@ void u32_table<A>::rebuild(uint8_t new_lg_size) {
   }
 }
 
-// While extracting the items from a linear probing hashtable,
-// this will usually undo the wrap-around provided that the table
-// isn't too full. Experiments suggest that for sufficiently large tables
-// the load factor would have to be over 90 percent before this would fail frequently,
-// and even then the subsequent sort would fix things up.
-// The result is nearly sorted, so make sure to use an efficient sort for that case
+// The table being ordered, the items come out of the slots sorted except for the ones that
+// wrapped around: these are in the region before the first empty slot and past their home slot,
+// which is at the end, and they are the largest items, so they are moved to the end of the result.
 template<typename A>
 vector_u32<A> u32_table<A>::unwrapping_get_items() const {
   if (num_items == 0) return vector_u32<A>(slots.get_allocator());
   const uint32_t table_size = 1 << lg_size;
+  const uint8_t shift = num_valid_bits - lg_size;
   vector_u32<A> result(num_items, 0, slots.get_allocator());
   size_t i = 0;
   size_t l = 0;
-  size_t r = num_items - 1;
+  size_t num_wrapped = 0;
 
   // special rules for the region before the first empty slot
-  uint32_t hi_bit = 1 << (num_valid_bits - 1);
   while (i < table_size && slots[i] != UINT32_MAX) {
-    const uint32_t item = slots[i++];
-    if (item & hi_bit) { result[r--] = item; } // this item was probably wrapped, so move to end
-    else               { result[l++] = item; }
+    const uint32_t item = slots[i];
+    if ((item >> shift) > i) { result[num_items - 1 - num_wrapped++] = item; } // reversed, see below
+    else                     { result[l++] = item; }
+    i++;
   }
 
   // the rest of the table is processed normally
@@ -189,7 +210,8 @@ vector_u32<A> u32_table<A>::unwrapping_get_items() const {
     const uint32_t item = slots[i++];
     if (item != UINT32_MAX) result[l++] = item;
   }
-  if (l != r + 1) throw std::logic_error("unwrapping error");
+  if (l + num_wrapped != num_items) throw std::logic_error("unwrapping error");
+  std::reverse(result.begin() + l, result.end());
   return result;
 }
 
@@ -82,6 +82,25 @@ public:
    */
   void update(T&& item, W weight = 1);
 
+  /**
+   * Update this sketch with each of n items, all with the same positive weight, like
+   * update() one at a time. For large maps, the slots of a block of items are prefetched
+   * before any of them is updated, so that the misses overlap.
+   * @param items array of n items
+   * @param n number of items
+   * @param weight the amount by which the weight of each item should be increased
+   */
+  void update_batch(const T* items, size_t n, W weight = 1);
+
+  /**
+   * Update this sketch with each of n items and its own weight, like update() one at a
+   * time, prefetching as the other update_batch() does.
+   * @param items array of n items
+   * @param weights array of n weights, of which zeros are no-ops
+   * @param n number of items
+   */
+  void update_batch(const T* items, const W* weights, size_t n);
+
   /**
    * This function merges the other sketch into this one.
    * The other sketch may be of a different size.
@@ -96,6 +115,19 @@ public:
    */
   void merge(frequent_items_sketch&& other);
 
+  /**
+   * This function merges the other sketch into this one, like merge(), but updates
+   * this sketch with convert(item) for each item of the other sketch, for items
+   * whose meaning depends on the sketch holding them. Each item is converted right
+   * before this sketch is updated with it.
+   * The other sketch may also be of other item and weight types, whose weights are
+   * cast to W, so the caller must make sure that the merged total weight fits.
+   * @param other sketch to be merged into this (lvalue)
+   * @param convert function from an item of other to the equivalent item of this sketch
+   */
+  template<typename T2, typename W2, typename H2, typename E2, typename S2, typename A2, typename F>
+  void merge(const frequent_items_sketch<T2, W2, H2, E2, S2, A2>& other, F convert);
+
   /**
    * @return true if this sketch is empty
    */
@@ -155,6 +187,17 @@ public:
    */
   double get_epsilon() const;
 
+  /**
+   * @return log2 of the maximum size of the internal hash map, as given at construction
+   */
+  uint8_t get_lg_max_map_size() const;
+
+  /**
+   * @return heap memory held by the internal hash map, not counting any memory the
+   * items themselves point to, in bytes
+   */
+  size_t get_memory_usage_bytes() const;
+
   /**
    * Returns epsilon used to compute <i>a priori</i> error.
    * This is just the value <i>3.5 / maxMapSize</i>.
@@ -222,6 +265,16 @@ public:
    */
   vector_row get_frequent_items(frequent_items_error_type err_type, W threshold) const;
 
+  /**
+   * Returns the rows of get_frequent_items(err_type) with the k highest estimates, in the
+   * same order, selecting them before sorting only those.
+   *
+   * @param error_type determines whether no false positives or no false negatives are desired.
+   * @param k maximum number of rows returned
+   * @return an array of at most k frequent items
+   */
+  vector_row get_top_frequent_items(frequent_items_error_type err_type, size_t k) const;
+
   /**
    * Computes size needed to serialize the current state of the sketch.
    * This can be expensive since every item needs to be looked at.
@@ -253,17 +306,19 @@ public:
   /**
    * This method deserializes a sketch from a given stream.
    * @param is input stream
+   * @param hashset_addr passed to the key hooks of the sketch, as in the constructor
    * @return an instance of the sketch
    */
-  static frequent_items_sketch deserialize(std::istream& is, const A& allocator = A());
+  static frequent_items_sketch deserialize(std::istream& is, size_t hashset_addr, const A& allocator = A());
 
   /**
    * This method deserializes a sketch from a given array of bytes.
    * @param bytes pointer to the array of bytes
    * @param size the size of the array
+   * @param hashset_addr passed to the key hooks of the sketch, as in the constructor
    * @return an instance of the sketch
    */
-  static frequent_items_sketch deserialize(const void* bytes, size_t size, const A& allocator = A());
+  static frequent_items_sketch deserialize(const void* bytes, size_t size, size_t hashset_addr, const A& allocator = A());
 
   /**
    * Returns a human readable summary of this sketch
@@ -271,15 +326,20 @@ public:
    */
   string<A> to_string(bool print_items = false) const;
 
-  void set_weights(W total_weight, W offset) { this->total_weight = total_weight; this->offset = offset; }
-  W get_offset() const { return this->offset; }
-
 private:
+  // for merges from sketches of other item and weight types
+  template<typename T2, typename W2, typename H2, typename E2, typename S2, typename A2>
+  friend class frequent_items_sketch;
+
   static const uint8_t SERIAL_VERSION = 1;
   static const uint8_t FAMILY_ID = 10;
   static const uint8_t PREAMBLE_LONGS_EMPTY = 1;
   static const uint8_t PREAMBLE_LONGS_NONEMPTY = 4;
   static constexpr double EPSILON_FACTOR = 3.5;
+  // maps of up to 2^PREFETCH_LG_SIZE slots (100KB or so) are not prefetched
+  static const uint8_t PREFETCH_LG_SIZE = 12;
+  // items whose slots update_batch() prefetches at a time
+  static const size_t PREFETCH_BLOCK = 32;
   enum flags { IS_EMPTY };
   W total_weight;
   W offset;
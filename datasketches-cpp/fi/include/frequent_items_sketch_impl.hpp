@@ -84,6 +84,56 @@ void frequent_items_sketch<T, W, H, E, S, A>::merge(frequent_items_sketch&& othe
   total_weight = merged_total_weight;
 }
 
+template<typename T, typename W, typename H, typename E, typename S, typename A>
+void frequent_items_sketch<T, W, H, E, S, A>::update_batch(const T* items, size_t n, W weight) {
+  check_weight(weight);
+  if (weight == 0) return;
+  while (n > 0) {
+    const size_t block = n < PREFETCH_BLOCK ? n : PREFETCH_BLOCK;
+    // checked per block, since the map may grow midway
+    if (map.get_lg_cur_size() > PREFETCH_LG_SIZE) {
+      for (size_t i = 0; i < block; ++i) map.prefetch(items[i]);
+    }
+    for (size_t i = 0; i < block; ++i) {
+      total_weight += weight;
+      offset += map.adjust_or_insert(items[i], weight);
+    }
+    items += block;
+    n -= block;
+  }
+}
+
+template<typename T, typename W, typename H, typename E, typename S, typename A>
+void frequent_items_sketch<T, W, H, E, S, A>::update_batch(const T* items, const W* weights, size_t n) {
+  for (size_t i = 0; i < n; ++i) check_weight(weights[i]);
+  while (n > 0) {
+    const size_t block = n < PREFETCH_BLOCK ? n : PREFETCH_BLOCK;
+    if (map.get_lg_cur_size() > PREFETCH_LG_SIZE) {
+      for (size_t i = 0; i < block; ++i) map.prefetch(items[i]);
+    }
+    for (size_t i = 0; i < block; ++i) {
+      if (weights[i] == 0) continue;
+      total_weight += weights[i];
+      offset += map.adjust_or_insert(items[i], weights[i]);
+    }
+    items += block;
+    weights += block;
+    n -= block;
+  }
+}
+
+template<typename T, typename W, typename H, typename E, typename S, typename A>
+template<typename T2, typename W2, typename H2, typename E2, typename S2, typename A2, typename F>
+void frequent_items_sketch<T, W, H, E, S, A>::merge(const frequent_items_sketch<T2, W2, H2, E2, S2, A2>& other, F convert) {
+  if (other.is_empty()) return;
+  const W merged_total_weight = total_weight + static_cast<W>(other.get_total_weight()); // for correction at the end
+  for (auto it: other.map) {
+    update(convert(it.first), static_cast<W>(it.second));
+  }
+  offset += static_cast<W>(other.offset);
+  total_weight = merged_total_weight;
+}
+
 template<typename T, typename W, typename H, typename E, typename S, typename A>
 bool frequent_items_sketch<T, W, H, E, S, A>::is_empty() const {
   return map.get_num_active() == 0;
@@ -127,6 +177,16 @@ double frequent_items_sketch<T, W, H, E, S, A>::get_epsilon() const {
   return EPSILON_FACTOR / (1 << map.get_lg_max_size());
 }
 
+template<typename T, typename W, typename H, typename E, typename S, typename A>
+size_t frequent_items_sketch<T, W, H, E, S, A>::get_memory_usage_bytes() const {
+  return map.get_memory_usage_bytes();
+}
+
+template<typename T, typename W, typename H, typename E, typename S, typename A>
+uint8_t frequent_items_sketch<T, W, H, E, S, A>::get_lg_max_map_size() const {
+  return map.get_lg_max_size();
+}
+
 template<typename T, typename W, typename H, typename E, typename S, typename A>
 double frequent_items_sketch<T, W, H, E, S, A>::get_epsilon(uint8_t lg_max_map_size) {
   return EPSILON_FACTOR / (1 << lg_max_map_size);
@@ -160,6 +220,27 @@ frequent_items_sketch<T, W, H, E, S, A>::get_frequent_items(frequent_items_error
   return items;
 }
 
+template<typename T, typename W, typename H, typename E, typename S, typename A>
+typename frequent_items_sketch<T, W, H, E, S, A>::vector_row
+frequent_items_sketch<T, W, H, E, S, A>::get_top_frequent_items(frequent_items_error_type err_type, size_t k) const {
+  const W threshold = get_maximum_error();
+  vector_row items(map.get_allocator());
+  for (auto it: map) {
+    const W lb = it.second;
+    const W ub = it.second + offset;
+    if ((err_type == NO_FALSE_NEGATIVES && ub > threshold) || (err_type == NO_FALSE_POSITIVES && lb > threshold)) {
+      items.push_back(row(&it.first, it.second, offset));
+    }
+  }
+  auto by_estimate = [](const row& a, const row& b) { return a.get_estimate() > b.get_estimate(); };
+  if (items.size() > k) {
+    std::nth_element(items.begin(), items.begin() + k, items.end(), by_estimate);
+    items.erase(items.begin() + k, items.end());
+  }
+  std::sort(items.begin(), items.end(), by_estimate);
+  return items;
+}
+
 template<typename T, typename W, typename H, typename E, typename S, typename A>
 void frequent_items_sketch<T, W, H, E, S, A>::serialize(std::ostream& os) const {
   const uint8_t preamble_longs = is_empty() ? PREAMBLE_LONGS_EMPTY : PREAMBLE_LONGS_NONEMPTY;
@@ -284,7 +365,7 @@ private:
 };
 
 template<typename T, typename W, typename H, typename E, typename S, typename A>
-frequent_items_sketch<T, W, H, E, S, A> frequent_items_sketch<T, W, H, E, S, A>::deserialize(std::istream& is, const A& allocator) {
+frequent_items_sketch<T, W, H, E, S, A> frequent_items_sketch<T, W, H, E, S, A>::deserialize(std::istream& is, size_t hashset_addr, const A& allocator) {
   const auto preamble_longs = read<uint8_t>(is);
   const auto serial_version = read<uint8_t>(is);
   const auto family_id = read<uint8_t>(is);
@@ -300,7 +381,7 @@ frequent_items_sketch<T, W, H, E, S, A> frequent_items_sketch<T, W, H, E, S, A>:
   check_family_id(family_id);
   check_size(lg_cur_size, lg_max_size);
 
-  frequent_items_sketch<T, W, H, E, S, A> sketch(lg_max_size, lg_cur_size, allocator);
+  frequent_items_sketch<T, W, H, E, S, A> sketch(lg_max_size, hashset_addr, lg_cur_size, allocator);
   if (!is_empty) {
     const auto num_items = read<uint32_t>(is);
     read<uint32_t>(is); // unused
@@ -327,7 +408,7 @@ frequent_items_sketch<T, W, H, E, S, A> frequent_items_sketch<T, W, H, E, S, A>:
 }
 
 template<typename T, typename W, typename H, typename E, typename S, typename A>
-frequent_items_sketch<T, W, H, E, S, A> frequent_items_sketch<T, W, H, E, S, A>::deserialize(const void* bytes, size_t size, const A& allocator) {
+frequent_items_sketch<T, W, H, E, S, A> frequent_items_sketch<T, W, H, E, S, A>::deserialize(const void* bytes, size_t size, size_t hashset_addr, const A& allocator) {
   ensure_minimum_memory(size, 8);
   const char* ptr = static_cast<const char*>(bytes);
   const char* base = static_cast<const char*>(bytes);
@@ -353,7 +434,7 @@ frequent_items_sketch<T, W, H, E, S, A> frequent_items_sketch<T, W, H, E, S, A>:
   check_size(lg_cur_size, lg_max_size);
   ensure_minimum_memory(size, 1ULL << preamble_longs);
 
-  frequent_items_sketch<T, W, H, E, S, A> sketch(lg_max_size, lg_cur_size, allocator);
+  frequent_items_sketch<T, W, H, E, S, A> sketch(lg_max_size, hashset_addr, lg_cur_size, allocator);
   if (!is_empty) {
     uint32_t num_items;
     ptr += copy_from_mem(ptr, num_items);
@@ -37,7 +37,6 @@ template<typename K, typename V = uint64_t, typename H = std::hash<K>, typename
 class reverse_purge_hash_map {
 public:
   using AllocV = typename std::allocator_traits<A>::template rebind_alloc<V>;
-  using AllocU16 = typename std::allocator_traits<A>::template rebind_alloc<uint16_t>;
 
   reverse_purge_hash_map(uint8_t lg_size, size_t hashset_addr, uint8_t lg_max_size, const A& allocator);
   reverse_purge_hash_map(const reverse_purge_hash_map& other);
@@ -49,11 +48,17 @@ public:
   template<typename FwdK>
   V adjust_or_insert(FwdK&& key, V value);
 
+  // Fetches the slot that key hashes to into the cache, ahead of an
+  // adjust_or_insert() of a batch of keys.
+  inline void prefetch(const K& key) const;
+
   V get(const K& key) const;
   uint8_t get_lg_cur_size() const;
   uint8_t get_lg_max_size() const;
   uint32_t get_capacity() const;
   uint32_t get_num_active() const;
+  // heap bytes held by the slots, active or not
+  size_t get_memory_usage_bytes() const;
   const A& get_allocator() const;
 
   class iterator;
@@ -65,18 +70,29 @@ private:
   static constexpr uint32_t DRIFT_LIMIT = 1024 * 1024 * 1024; // used only for stress testing
   static constexpr uint32_t MAX_SAMPLE_SIZE = 1024; // number of samples to compute approximate median during purge
 
+  // A key along with its value and state, the distance it drifted from its
+  // hash, which is 0 for an empty slot. Keeping them together rather than in
+  // three arrays lets a probe touch one cache line. The key is only
+  // constructed while the slot is active.
+  struct slot {
+    union { K key; };
+    V value;
+    uint16_t state;
+    slot(): state(0) {}
+    ~slot() {}
+  };
+  using AllocSlot = typename std::allocator_traits<A>::template rebind_alloc<slot>;
+
   A allocator_;
   size_t hashset_addr_;
   uint8_t lg_cur_size_;
   uint8_t lg_max_size_;
   uint32_t num_active_;
-  K* keys_;
-  V* values_;
-  uint16_t* states_;
+  slot* slots_;
 
+  slot* allocate_slots(uint32_t size);
   inline bool is_active(uint32_t probe) const;
   void subtract_and_keep_positive_only(V amount);
-  void hash_delete(uint32_t probe);
   uint32_t internal_adjust_or_insert(const K& key, V value);
   V resize_or_purge_if_needed();
   void resize(uint8_t lg_new_size);
@@ -85,8 +101,13 @@ private:
 
 // This iterator uses strides based on golden ratio to avoid clustering during merge
 template<typename K, typename V, typename H, typename E, typename A>
-class reverse_purge_hash_map<K, V, H, E, A>::iterator: public std::iterator<std::input_iterator_tag, K> {
+class reverse_purge_hash_map<K, V, H, E, A>::iterator {
 public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = K;
+  using difference_type = std::ptrdiff_t;
+  using pointer = K*;
+  using reference = K&;
   friend class reverse_purge_hash_map<K, V, H, E, A>;
   iterator& operator++() {
     ++count;
@@ -102,7 +123,7 @@ public:
   bool operator==(const iterator& rhs) const { return count == rhs.count; }
   bool operator!=(const iterator& rhs) const { return count != rhs.count; }
   const std::pair<K&, V> operator*() const {
-    return std::pair<K&, V>(map->keys_[index], map->values_[index]);
+    return std::pair<K&, V>(map->slots_[index].key, map->slots_[index].value);
   }
 private:
   static constexpr double GOLDEN_RATIO_RECIPROCAL = 0.6180339887498949; // = (sqrt(5) - 1) / 2
@@ -26,11 +26,27 @@
 #include <cmath>
 
 #include "MurmurHash3.h"
+#include "event_counters.hpp"
 
 void remove_from_hashset(size_t,size_t) noexcept;
 
 namespace datasketches {
 
+// Key ownership hooks, called with the map's hashset_addr_ right after a new key
+// is stored in the map and right before a purged key is dropped from it. Keys
+// that own themselves need neither; key types whose storage is owned elsewhere
+// overload these, found by argument-dependent lookup.
+template<typename K>
+inline void on_key_inserted(size_t, K&) {}
+
+template<typename K>
+inline void on_key_removed(size_t, const K&) {}
+
+// size_t keys are addresses of keys interned on the Rust side.
+inline void on_key_removed(size_t hashset_addr, size_t key) {
+  remove_from_hashset(hashset_addr, key);
+}
+
 // clang++ seems to require this declaration for CMAKE_BUILD_TYPE='Debug"
 template<typename K, typename V, typename H, typename E, typename A>
 constexpr uint32_t reverse_purge_hash_map<K, V, H, E, A>::MAX_SAMPLE_SIZE;
@@ -42,16 +58,8 @@ hashset_addr_(hashset_addr),
 lg_cur_size_(lg_cur_size),
 lg_max_size_(lg_max_size),
 num_active_(0),
-keys_(allocator_.allocate(1ULL << lg_cur_size)),
-values_(nullptr),
-states_(nullptr)
-{
-  AllocV av(allocator_);
-  values_ = av.allocate(1ULL << lg_cur_size);
-  AllocU16 au16(allocator_);
-  states_ = au16.allocate(1ULL << lg_cur_size);
-  std::fill(states_, states_ + (1ULL << lg_cur_size), static_cast<uint16_t>(0));
-}
+slots_(allocate_slots(1 << lg_cur_size))
+{}
 
 template<typename K, typename V, typename H, typename E, typename A>
 reverse_purge_hash_map<K, V, H, E, A>::reverse_purge_hash_map(const reverse_purge_hash_map<K, V, H, E, A>& other):
@@ -60,26 +68,20 @@ hashset_addr_(other.hashset_addr_),
 lg_cur_size_(other.lg_cur_size_),
 lg_max_size_(other.lg_max_size_),
 num_active_(other.num_active_),
-keys_(allocator_.allocate(1ULL << lg_cur_size_)),
-values_(nullptr),
-states_(nullptr)
+slots_(allocate_slots(1 << lg_cur_size_))
 {
-  AllocV av(allocator_);
-  values_ = av.allocate(1ULL << lg_cur_size_);
-  AllocU16 au16(allocator_);
-  states_ = au16.allocate(1ULL << lg_cur_size_);
   const uint32_t size = 1 << lg_cur_size_;
   if (num_active_ > 0) {
     auto num = num_active_;
     for (uint32_t i = 0; i < size; i++) {
-      if (other.states_[i] > 0) {
-        new (&keys_[i]) K(other.keys_[i]);
-        values_[i] = other.values_[i];
+      if (other.is_active(i)) {
+        new (&slots_[i].key) K(other.slots_[i].key);
+        slots_[i].value = other.slots_[i].value;
+        slots_[i].state = other.slots_[i].state;
+        if (--num == 0) break;
       }
-      if (--num == 0) break;
     }
   }
-  std::copy(other.states_, other.states_ + size, states_);
 }
 
 template<typename K, typename V, typename H, typename E, typename A>
@@ -89,13 +91,9 @@ hashset_addr_(other.hashset_addr_),
 lg_cur_size_(other.lg_cur_size_),
 lg_max_size_(other.lg_max_size_),
 num_active_(other.num_active_),
-keys_(nullptr),
-values_(nullptr),
-states_(nullptr)
+slots_(nullptr)
 {
-  std::swap(keys_, other.keys_);
-  std::swap(values_, other.values_);
-  std::swap(states_, other.states_);
+  std::swap(slots_, other.slots_);
   other.num_active_ = 0;
 }
 
@@ -105,21 +103,14 @@ reverse_purge_hash_map<K, V, H, E, A>::~reverse_purge_hash_map() {
   if (num_active_ > 0) {
     for (uint32_t i = 0; i < size; i++) {
       if (is_active(i)) {
-        keys_[i].~K();
+        slots_[i].key.~K();
         if (--num_active_ == 0) break;
       }
     }
   }
-  if (keys_ != nullptr) {
-    allocator_.deallocate(keys_, size);
-  }
-  if (values_ != nullptr) {
-    AllocV av(allocator_);
-    av.deallocate(values_, size);
-  }
-  if (states_ != nullptr) {
-    AllocU16 au16(allocator_);
-    au16.deallocate(states_, size);
+  if (slots_ != nullptr) {
+    AllocSlot as(allocator_);
+    as.deallocate(slots_, size);
   }
 }
 
@@ -129,9 +120,7 @@ reverse_purge_hash_map<K, V, H, E, A>& reverse_purge_hash_map<K, V, H, E, A>::op
   std::swap(lg_cur_size_, other.lg_cur_size_);
   std::swap(lg_max_size_, other.lg_max_size_);
   std::swap(num_active_, other.num_active_);
-  std::swap(keys_, other.keys_);
-  std::swap(values_, other.values_);
-  std::swap(states_, other.states_);
+  std::swap(slots_, other.slots_);
   return *this;
 }
 
@@ -141,9 +130,7 @@ reverse_purge_hash_map<K, V, H, E, A>& reverse_purge_hash_map<K, V, H, E, A>::op
   std::swap(lg_cur_size_, other.lg_cur_size_);
   std::swap(lg_max_size_, other.lg_max_size_);
   std::swap(num_active_, other.num_active_);
-  std::swap(keys_, other.keys_);
-  std::swap(values_, other.values_);
-  std::swap(states_, other.states_);
+  std::swap(slots_, other.slots_);
   return *this;
 }
 
@@ -153,18 +140,29 @@ V reverse_purge_hash_map<K, V, H, E, A>::adjust_or_insert(FwdK&& key, V value) {
   const uint32_t num_active_before = num_active_;
   const uint32_t index = internal_adjust_or_insert(key, value);
   if (num_active_ > num_active_before) {
-    new (&keys_[index]) K(std::forward<FwdK>(key));
+    new (&slots_[index].key) K(std::forward<FwdK>(key));
+    on_key_inserted(hashset_addr_, slots_[index].key);
     return resize_or_purge_if_needed();
   }
   return 0;
 }
 
+template<typename K, typename V, typename H, typename E, typename A>
+void reverse_purge_hash_map<K, V, H, E, A>::prefetch(const K& key) const {
+#if defined(__GNUC__)
+  const uint32_t mask = (1 << lg_cur_size_) - 1;
+  __builtin_prefetch(&slots_[fmix64(H()(key)) & mask]);
+#else
+  (void) key;
+#endif
+}
+
 template<typename K, typename V, typename H, typename E, typename A>
 V reverse_purge_hash_map<K, V, H, E, A>::get(const K& key) const {
   const uint32_t mask = (1 << lg_cur_size_) - 1;
   uint32_t probe = fmix64(H()(key)) & mask;
   while (is_active(probe)) {
-    if (E()(keys_[probe], key)) return values_[probe];
+    if (E()(slots_[probe].key, key)) return slots_[probe].value;
     probe = (probe + 1) & mask;
   }
   return 0;
@@ -190,6 +188,11 @@ uint32_t reverse_purge_hash_map<K, V, H, E, A>::get_num_active() const {
   return num_active_;
 }
 
+template<typename K, typename V, typename H, typename E, typename A>
+size_t reverse_purge_hash_map<K, V, H, E, A>::get_memory_usage_bytes() const {
+  return slots_ == nullptr ? 0 : sizeof(slot) << lg_cur_size_;
+}
+
 template<typename K, typename V, typename H, typename E, typename A>
 const A& reverse_purge_hash_map<K, V, H, E, A>::get_allocator() const {
   return allocator_;
@@ -210,68 +213,7 @@ typename reverse_purge_hash_map<K, V, H, E, A>::iterator reverse_purge_hash_map<
 
 template<typename K, typename V, typename H, typename E, typename A>
 bool reverse_purge_hash_map<K, V, H, E, A>::is_active(uint32_t index) const {
-  return states_[index] > 0;
-}
-
-template<typename K, typename V, typename H, typename E, typename A>
-void reverse_purge_hash_map<K, V, H, E, A>::subtract_and_keep_positive_only(V amount) {
-  // starting from the back, find the first empty cell,
-  // which establishes the high end of a cluster.
-  uint32_t first_probe = (1 << lg_cur_size_) - 1;
-  while (is_active(first_probe)) first_probe--;
-  // when we find the next non-empty cell, we know we are at the high end of a cluster
-  // work towards the front, delete any non-positive entries.
-  for (uint32_t probe = first_probe; probe-- > 0;) {
-    if (is_active(probe)) {
-      if (values_[probe] <= amount) {
-        hash_delete(probe); // does the work of deletion and moving higher items towards the front
-        num_active_--;
-      } else {
-        values_[probe] -= amount;
-      }
-    }
-  }
-  // now work on the first cluster that was skipped
-  for (uint32_t probe = (1 << lg_cur_size_); probe-- > first_probe;) {
-    if (is_active(probe)) {
-      if (values_[probe] <= amount) {
-        hash_delete(probe);
-        num_active_--;
-      } else {
-        values_[probe] -= amount;
-      }
-    }
-  }
-}
-
-template<typename K, typename V, typename H, typename E, typename A>
-void reverse_purge_hash_map<K, V, H, E, A>::hash_delete(uint32_t delete_index) {
-  // Looks ahead in the table to search for another
-  // item to move to this location
-  // if none are found, the status is changed
-  states_[delete_index] = 0; // mark as empty
-  remove_from_hashset(hashset_addr_, keys_[delete_index]);
-  keys_[delete_index].~K();
-  uint16_t drift = 1;
-  const uint32_t mask = (1 << lg_cur_size_) - 1;
-  uint32_t probe = (delete_index + drift) & mask; // map length must be a power of 2
-  // advance until we find a free location replacing locations as needed
-  while (is_active(probe)) {
-    if (states_[probe] > drift) {
-      // move current element
-      new (&keys_[delete_index]) K(std::move(keys_[probe]));
-      values_[delete_index] = values_[probe];
-      states_[delete_index] = states_[probe] - drift;
-      states_[probe] = 0; // mark as empty
-      keys_[probe].~K();
-      drift = 0;
-      delete_index = probe;
-    }
-    probe = (probe + 1) & mask;
-    drift++;
-    // only used for theoretical analysis
-    if (drift >= DRIFT_LIMIT) throw std::logic_error("drift: " + std::to_string(drift) + " >= DRIFT_LIMIT");
-  }
+  return slots_[index].state > 0;
 }
 
 template<typename K, typename V, typename H, typename E, typename A>
@@ -280,9 +222,9 @@ uint32_t reverse_purge_hash_map<K, V, H, E, A>::internal_adjust_or_insert(const
   uint32_t index = fmix64(H()(key)) & mask;
   uint16_t drift = 1;
   while (is_active(index)) {
-    if (E()(keys_[index], key)) {
+    if (E()(slots_[index].key, key)) {
       // adjusting the value of an existing key
-      values_[index] += value;
+      slots_[index].value += value;
       return index;
     }
     index = (index + 1) & mask;
@@ -294,8 +236,8 @@ uint32_t reverse_purge_hash_map<K, V, H, E, A>::internal_adjust_or_insert(const
   if (num_active_ > get_capacity()) {
     throw std::logic_error("num_active " + std::to_string(num_active_) + " > capacity " + std::to_string(get_capacity()));
   }
-  values_[index] = value;
-  states_[index] = drift;
+  slots_[index].value = value;
+  slots_[index].state = drift;
   num_active_++;
   return index;
 }
@@ -319,31 +261,61 @@ V reverse_purge_hash_map<K, V, H, E, A>::resize_or_purge_if_needed() {
 template<typename K, typename V, typename H, typename E, typename A>
 void reverse_purge_hash_map<K, V, H, E, A>::resize(uint8_t lg_new_size) {
   const uint32_t old_size = 1 << lg_cur_size_;
-  K* old_keys = keys_;
-  V* old_values = values_;
-  uint16_t* old_states = states_;
-  const uint32_t new_size = 1 << lg_new_size;
-  keys_ = allocator_.allocate(new_size);
-  AllocV av(allocator_);
-  values_ = av.allocate(new_size);
-  AllocU16 au16(allocator_);
-  states_ = au16.allocate(new_size);
-  std::fill(states_, states_ + new_size, static_cast<uint16_t>(0));
+  slot* old_slots = slots_;
+  slots_ = allocate_slots(1 << lg_new_size);
   num_active_ = 0;
   lg_cur_size_ = lg_new_size;
   for (uint32_t i = 0; i < old_size; i++) {
-    if (old_states[i] > 0) {
-      adjust_or_insert(std::move(old_keys[i]), old_values[i]);
-      old_keys[i].~K();
+    if (old_slots[i].state > 0) {
+      // keys are moved, not inserted anew, so this skips on_key_inserted
+      const uint32_t index = internal_adjust_or_insert(old_slots[i].key, old_slots[i].value);
+      new (&slots_[index].key) K(std::move(old_slots[i].key));
+      old_slots[i].key.~K();
+    }
+  }
+  AllocSlot as(allocator_);
+  as.deallocate(old_slots, old_size);
+}
+
+template<typename K, typename V, typename H, typename E, typename A>
+void reverse_purge_hash_map<K, V, H, E, A>::subtract_and_keep_positive_only(V amount) {
+  // One pass over the table, starting past an empty slot so that every
+  // cluster is seen from its start. By the time a survivor is reached, the
+  // slots before it are settled, so it moves back to the first slot freed
+  // on its probe path, if any. Deleting entries one at a time would instead
+  // shift the rest of a cluster back on every delete.
+  const uint32_t mask = (1 << lg_cur_size_) - 1;
+  uint32_t start = 0;
+  while (is_active(start)) start++;
+  for (uint32_t n = 1; n <= mask + 1; n++) {
+    const uint32_t probe = (start + n) & mask;
+    slot& current = slots_[probe];
+    if (current.state == 0) continue;
+    if (current.value <= amount) {
+      on_key_removed(hashset_addr_, current.key);
+      current.key.~K();
+      current.state = 0;
+      num_active_--;
+      continue;
+    }
+    current.value -= amount;
+    const uint32_t home = (probe - (current.state - 1)) & mask;
+    uint32_t index = home;
+    while (index != probe && is_active(index)) index = (index + 1) & mask;
+    if (index != probe) {
+      slot& target = slots_[index];
+      new (&target.key) K(std::move(current.key));
+      target.value = current.value;
+      target.state = static_cast<uint16_t>(((index - home) & mask) + 1);
+      current.key.~K();
+      current.state = 0;
     }
   }
-  allocator_.deallocate(old_keys, old_size);
-  av.deallocate(old_values, old_size);
-  au16.deallocate(old_states, old_size);
 }
 
 template<typename K, typename V, typename H, typename E, typename A>
 V reverse_purge_hash_map<K, V, H, E, A>::purge() {
+  DATASKETCHES_COUNT_EVENT(FI_PURGE);
   const uint32_t limit = std::min(MAX_SAMPLE_SIZE, num_active_);
   uint32_t num_samples = 0;
   uint32_t i = 0;
@@ -351,7 +323,7 @@ V reverse_purge_hash_map<K, V, H, E, A>::purge() {
   V* samples = av.allocate(limit);
   while (num_samples < limit) {
     if (is_active(i)) {
-      samples[num_samples++] = values_[i];
+      samples[num_samples++] = slots_[i].value;
     }
     i++;
   }
@@ -362,6 +334,14 @@ V reverse_purge_hash_map<K, V, H, E, A>::purge() {
   return median;
 }
 
+template<typename K, typename V, typename H, typename E, typename A>
+auto reverse_purge_hash_map<K, V, H, E, A>::allocate_slots(uint32_t size) -> slot* {
+  AllocSlot as(allocator_);
+  slot* slots = as.allocate(size);
+  for (uint32_t i = 0; i < size; i++) new (&slots[i]) slot();
+  return slots;
+}
+
 } /* namespace datasketches */
 
 # endif
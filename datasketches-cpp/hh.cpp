@@ -1,12 +1,15 @@
+#include <algorithm>
 #include <cstdint>
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <stdexcept>
 
 #include "rust/cxx.h"
 
 #include "dsrs/src/bridge.rs.h"
 #include "fi/include/frequent_items_sketch.hpp"
+#include "MurmurHash3.h"
 #include "hh.hpp"
 
 std::unique_ptr<std::vector<ThinHeavyHitterRow>> convert_to_thin(OpaqueHhSketch::hhsketch::vector_row v) {
@@ -34,28 +37,356 @@ void OpaqueHhSketch::update(size_t value, uint64_t weight) {
   this->inner_.update(value, weight);
 }
 
-OpaqueHhSketch::OpaqueHhSketch(hhsketch&& sketch):
-  inner_{sketch} {
+OpaqueHhSketch::OpaqueHhSketch(hhsketch&& sketch, size_t hashset_addr):
+  inner_{sketch},
+  hashset_addr_{hashset_addr} {
 }
 
-std::unique_ptr<std::vector<ThinHeavyHitterRow>> OpaqueHhSketch::state() const {
-  return convert_to_thin(this->inner_.get_frequent_items(datasketches::NO_FALSE_NEGATIVES, 0));
+void OpaqueHhSketch::merge(const OpaqueHhSketch& other) {
+  // The other sketch's items are addresses of keys in its own hashset, so each
+  // is interned into this one's right before it is looked up. Interning them
+  // all up front would not do: a purge midway could free a key still to come.
+  size_t hashset_addr = this->hashset_addr_;
+  this->inner_.merge(other.inner_, [hashset_addr](size_t key) {
+    return intern_into_hashset(hashset_addr, key);
+  });
 }
 
-void OpaqueHhSketch::set_weights(uint64_t total_weight, uint64_t offset) {
-  this->inner_.set_weights(total_weight, offset);
+size_t OpaqueHhSketch::get_memory_usage_bytes() const {
+  return this->inner_.get_memory_usage_bytes();
 }
 
-uint64_t OpaqueHhSketch::get_total_weight() const {
+std::unique_ptr<OpaqueHhSketch> new_opaque_hh_sketch(uint8_t lg2_k, size_t hashset_addr) {
+  OpaqueHhSketch::hhsketch sketch(lg2_k, hashset_addr);
+  auto ptr = new OpaqueHhSketch(std::move(sketch), hashset_addr);
+  return std::unique_ptr<OpaqueHhSketch>(ptr);
+}
+
+void on_key_inserted(size_t key_arena, hh_key& key) {
+  auto pool = reinterpret_cast<arena*>(key_arena);
+  auto data = static_cast<uint8_t*>(pool->allocate(key.size));
+  std::memcpy(data, key.data, key.size);
+  key.data = data;
+}
+
+void on_key_removed(size_t key_arena, const hh_key& key) {
+  reinterpret_cast<arena*>(key_arena)->deallocate(const_cast<uint8_t*>(key.data), key.size);
+}
+
+size_t hh_key_serde::serialize(void* ptr, size_t capacity, const hh_key* items, unsigned num) const {
+  uint8_t* out = static_cast<uint8_t*>(ptr);
+  size_t bytes_written = 0;
+  for (unsigned i = 0; i < num; ++i) {
+    const uint32_t length = static_cast<uint32_t>(items[i].size);
+    datasketches::check_memory_size(bytes_written + sizeof(length) + length, capacity);
+    std::memcpy(out + bytes_written, &length, sizeof(length));
+    std::memcpy(out + bytes_written + sizeof(length), items[i].data, length);
+    bytes_written += sizeof(length) + length;
+  }
+  return bytes_written;
+}
+
+size_t hh_key_serde::deserialize(const void* ptr, size_t capacity, hh_key* items, unsigned num) const {
+  const uint8_t* in = static_cast<const uint8_t*>(ptr);
+  size_t bytes_read = 0;
+  for (unsigned i = 0; i < num; ++i) {
+    uint32_t length;
+    datasketches::check_memory_size(bytes_read + sizeof(length), capacity);
+    std::memcpy(&length, in + bytes_read, sizeof(length));
+    bytes_read += sizeof(length);
+    datasketches::check_memory_size(bytes_read + length, capacity);
+    HashState hashes;
+    MurmurHash3_x64_128(in + bytes_read, length, datasketches::DEFAULT_SEED, hashes);
+    new (&items[i]) hh_key{in + bytes_read, length, hashes.h1};
+    bytes_read += length;
+  }
+  return bytes_read;
+}
+
+std::unique_ptr<std::vector<HeavyHitterRow>> convert_to_rows(OpaqueNativeHhSketch::hhsketch::vector_row v) {
+  std::vector<HeavyHitterRow> result(v.size());
+  for (std::size_t i = 0; i < v.size(); ++i) {
+    auto& row = v[i];
+    auto& target = result[i];
+    target.addr = reinterpret_cast<size_t>(row.get_item().data);
+    target.len = row.get_item().size;
+    target.lb = row.get_lower_bound();
+    target.ub = row.get_upper_bound();
+  }
+  auto ptr = new std::vector<HeavyHitterRow>(std::move(result));
+  return std::unique_ptr<std::vector<HeavyHitterRow>>(ptr);
+}
+
+OpaqueNativeHhSketch::OpaqueNativeHhSketch(uint8_t lg2_k):
+  keys_{new arena{}},
+  inner_{lg2_k, reinterpret_cast<size_t>(keys_.get())} {
+}
+
+OpaqueNativeHhSketch::OpaqueNativeHhSketch(std::unique_ptr<arena>&& keys, hhsketch&& sketch):
+  keys_{std::move(keys)},
+  inner_{std::move(sketch)} {
+}
+
+std::unique_ptr<std::vector<HeavyHitterRow>> OpaqueNativeHhSketch::estimate_no_fp() const {
+  return convert_to_rows(this->inner_.get_frequent_items(datasketches::NO_FALSE_POSITIVES));
+}
+
+std::unique_ptr<std::vector<HeavyHitterRow>> OpaqueNativeHhSketch::estimate_no_fn() const {
+  return convert_to_rows(this->inner_.get_frequent_items(datasketches::NO_FALSE_NEGATIVES));
+}
+
+std::unique_ptr<std::vector<HeavyHitterRow>> OpaqueNativeHhSketch::top_no_fn(size_t k) const {
+  return convert_to_rows(this->inner_.get_top_frequent_items(datasketches::NO_FALSE_NEGATIVES, k));
+}
+
+void OpaqueNativeHhSketch::update(rust::Slice<const uint8_t> value, uint64_t weight) {
+  HashState hashes;
+  MurmurHash3_x64_128(value.data(), value.size(), datasketches::DEFAULT_SEED, hashes);
+  this->inner_.update(hh_key{value.data(), value.size(), hashes.h1}, weight);
+}
+
+void OpaqueNativeHhSketch::update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, rust::Slice<const uint64_t> weights) {
+  // Keys are hashed a block at a time, so that the sketch can prefetch the
+  // slots of the whole block before looking any of them up.
+  static const size_t BLOCK = 32;
+  hh_key keys[BLOCK];
+  const uint8_t* data = buf.data();
+  size_t start = 0;
+  size_t i = 0;
+  while (i < ends.size()) {
+    const size_t block = std::min(ends.size() - i, BLOCK);
+    for (size_t j = 0; j < block; ++j) {
+      const size_t end = ends[i++];
+      HashState hashes;
+      MurmurHash3_x64_128(data + start, end - start, datasketches::DEFAULT_SEED, hashes);
+      keys[j] = hh_key{data + start, end - start, hashes.h1};
+      start = end;
+    }
+    if (weights.empty()) {
+      this->inner_.update_batch(keys, block, 1);
+    } else {
+      this->inner_.update_batch(keys, weights.data() + i - block, block);
+    }
+  }
+}
+
+void OpaqueNativeHhSketch::merge(const OpaqueNativeHhSketch& other) {
+  // Merged keys are copied into this sketch's arena as they are inserted.
+  this->inner_.merge(other.inner_);
+}
+
+std::unique_ptr<OpaqueNativeHhSketch> OpaqueNativeHhSketch::clone() const {
+  auto ptr = new OpaqueNativeHhSketch(this->inner_.get_lg_max_map_size());
+  ptr->merge(*this);
+  return std::unique_ptr<OpaqueNativeHhSketch>(ptr);
+}
+
+size_t OpaqueNativeHhSketch::get_memory_usage_bytes() const {
+  return this->inner_.get_memory_usage_bytes();
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueNativeHhSketch::serialize() const {
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(v.begin(), v.end()));
+}
+
+std::unique_ptr<OpaqueNativeHhSketch> new_opaque_native_hh_sketch(uint8_t lg2_k) {
+  return std::unique_ptr<OpaqueNativeHhSketch>(new OpaqueNativeHhSketch(lg2_k));
+}
+
+std::unique_ptr<OpaqueNativeHhSketch> deserialize_opaque_native_hh_sketch(rust::Slice<const uint8_t> buf) {
+  // The keys are copied out of buf into the arena as they are inserted, and
+  // the arena must outlive the sketch even if deserializing it throws.
+  std::unique_ptr<arena> keys(new arena{});
+  auto sketch = OpaqueNativeHhSketch::hhsketch::deserialize(buf.data(), buf.size(), reinterpret_cast<size_t>(keys.get()));
+  return std::unique_ptr<OpaqueNativeHhSketch>(new OpaqueNativeHhSketch(std::move(keys), std::move(sketch)));
+}
+
+OpaqueHhDictionary::OpaqueHhDictionary():
+  keys_{},
+  entries_{},
+  free_ids_{},
+  index_(16, 0),
+  num_keys_{0},
+  key_bytes_{0} {
+}
+
+uint32_t* OpaqueHhDictionary::find_slot(const hh_key& key) {
+  const size_t mask = this->index_.size() - 1;
+  for (size_t i = key.hash & mask;; i = (i + 1) & mask) {
+    uint32_t& slot = this->index_[i];
+    if (slot == 0) return &slot;
+    const entry& e = this->entries_[slot - 1];
+    if (e.hash == key.hash && e.size == key.size && std::memcmp(e.data, key.data, key.size) == 0) return &slot;
+  }
+}
+
+void OpaqueHhDictionary::grow_index() {
+  std::vector<uint32_t> old(this->index_.size() * 2, 0);
+  std::swap(old, this->index_);
+  const size_t mask = this->index_.size() - 1;
+  for (uint32_t slot : old) {
+    if (slot == 0) continue;
+    size_t i = this->entries_[slot - 1].hash & mask;
+    while (this->index_[i] != 0) i = (i + 1) & mask;
+    this->index_[i] = slot;
+  }
+}
+
+uint32_t OpaqueHhDictionary::intern(const hh_key& key) {
+  uint32_t* slot = this->find_slot(key);
+  if (*slot != 0) return *slot - 1;
+  uint32_t id;
+  if (!this->free_ids_.empty()) {
+    id = this->free_ids_.back();
+    this->free_ids_.pop_back();
+  } else {
+    // ids are stored in the index plus one
+    if (this->entries_.size() >= UINT32_MAX) throw std::length_error("heavy hitter dictionary is full");
+    id = static_cast<uint32_t>(this->entries_.size());
+    this->entries_.push_back(entry{});
+  }
+  auto data = static_cast<uint8_t*>(this->keys_.allocate(key.size));
+  std::memcpy(data, key.data, key.size);
+  this->entries_[id] = entry{data, key.hash, static_cast<uint32_t>(key.size), 0};
+  *slot = id + 1;
+  this->num_keys_++;
+  this->key_bytes_ += key.size;
+  if (2 * this->num_keys_ > this->index_.size()) this->grow_index();
+  return id;
+}
+
+void OpaqueHhDictionary::release(uint32_t id) {
+  entry& e = this->entries_[id];
+  if (--e.refs > 0) return;
+  // Deletes by shifting back the rest of the cluster, each entry to the hole
+  // unless the hole is before its home slot.
+  const size_t mask = this->index_.size() - 1;
+  size_t hole = e.hash & mask;
+  while (this->index_[hole] != id + 1) hole = (hole + 1) & mask;
+  for (size_t i = (hole + 1) & mask; this->index_[i] != 0; i = (i + 1) & mask) {
+    const size_t home = this->entries_[this->index_[i] - 1].hash & mask;
+    if (((i - home) & mask) >= ((i - hole) & mask)) {
+      this->index_[hole] = this->index_[i];
+      hole = i;
+    }
+  }
+  this->index_[hole] = 0;
+  this->keys_.deallocate(const_cast<uint8_t*>(e.data), e.size);
+  this->num_keys_--;
+  this->key_bytes_ -= e.size;
+  this->free_ids_.push_back(id);
+}
+
+size_t OpaqueHhDictionary::get_memory_usage_bytes() const {
+  return this->entries_.capacity() * sizeof(entry)
+    + (this->free_ids_.capacity() + this->index_.capacity()) * sizeof(uint32_t)
+    + this->key_bytes_;
+}
+
+std::unique_ptr<OpaqueHhDictionary> new_opaque_hh_dictionary() {
+  return std::unique_ptr<OpaqueHhDictionary>(new OpaqueHhDictionary());
+}
+
+void on_key_inserted(size_t dictionary, hh_id& key) {
+  reinterpret_cast<OpaqueHhDictionary*>(dictionary)->retain(key.id);
+}
+
+void on_key_removed(size_t dictionary, const hh_id& key) {
+  reinterpret_cast<OpaqueHhDictionary*>(dictionary)->release(key.id);
+}
+
+OpaqueCompactHhSketch::OpaqueCompactHhSketch(uint8_t lg2_k, OpaqueHhDictionary* dictionary):
+  dictionary_{dictionary},
+  inner_{lg2_k, reinterpret_cast<size_t>(dictionary)} {
+}
+
+std::unique_ptr<std::vector<HeavyHitterRow>> OpaqueCompactHhSketch::convert_to_rows(hhsketch::vector_row v) const {
+  std::vector<HeavyHitterRow> result(v.size());
+  for (std::size_t i = 0; i < v.size(); ++i) {
+    auto& row = v[i];
+    auto& target = result[i];
+    const hh_key key = this->dictionary_->get(row.get_item().id);
+    target.addr = reinterpret_cast<size_t>(key.data);
+    target.len = key.size;
+    target.lb = row.get_lower_bound();
+    target.ub = row.get_upper_bound();
+  }
+  auto ptr = new std::vector<HeavyHitterRow>(std::move(result));
+  return std::unique_ptr<std::vector<HeavyHitterRow>>(ptr);
+}
+
+std::unique_ptr<std::vector<HeavyHitterRow>> OpaqueCompactHhSketch::estimate_no_fp() const {
+  return this->convert_to_rows(this->inner_.get_frequent_items(datasketches::NO_FALSE_POSITIVES));
+}
+
+std::unique_ptr<std::vector<HeavyHitterRow>> OpaqueCompactHhSketch::estimate_no_fn() const {
+  return this->convert_to_rows(this->inner_.get_frequent_items(datasketches::NO_FALSE_NEGATIVES));
+}
+
+std::unique_ptr<std::vector<HeavyHitterRow>> OpaqueCompactHhSketch::top_no_fn(size_t k) const {
+  return this->convert_to_rows(this->inner_.get_top_frequent_items(datasketches::NO_FALSE_NEGATIVES, k));
+}
+
+void OpaqueCompactHhSketch::check_total_weight(uint64_t more) const {
+  if (more > UINT32_MAX - this->inner_.get_total_weight()) {
+    throw std::overflow_error("total weight of compact heavy hitter sketch overflows 32 bits");
+  }
+}
+
+void OpaqueCompactHhSketch::update(rust::Slice<const uint8_t> value, uint32_t weight) {
+  // a key interned for a zero weight would never be inserted, nor freed
+  if (weight == 0) return;
+  this->check_total_weight(weight);
+  HashState hashes;
+  MurmurHash3_x64_128(value.data(), value.size(), datasketches::DEFAULT_SEED, hashes);
+  const uint32_t id = this->dictionary_->intern(hh_key{value.data(), value.size(), hashes.h1});
+  this->inner_.update(hh_id{id}, weight);
+}
+
+void OpaqueCompactHhSketch::merge(const OpaqueCompactHhSketch& other) {
+  this->check_total_weight(other.inner_.get_total_weight());
+  if (other.dictionary_ == this->dictionary_) {
+    this->inner_.merge(other.inner_);
+    return;
+  }
+  // As in OpaqueHhSketch::merge(), each key is interned right before it is
+  // looked up, since a purge midway could free a key interned earlier.
+  OpaqueHhDictionary* dictionary = this->dictionary_;
+  const OpaqueHhDictionary* from = other.dictionary_;
+  this->inner_.merge(other.inner_, [dictionary, from](const hh_id& key) {
+    return hh_id{dictionary->intern(from->get(key.id))};
+  });
+}
+
+void OpaqueCompactHhSketch::merge_native(const OpaqueNativeHhSketch& other) {
+  this->check_total_weight(other.inner_.get_total_weight());
+  OpaqueHhDictionary* dictionary = this->dictionary_;
+  this->inner_.merge(other.inner_, [dictionary](const hh_key& key) {
+    return hh_id{dictionary->intern(key)};
+  });
+}
+
+std::unique_ptr<OpaqueNativeHhSketch> OpaqueCompactHhSketch::to_native() const {
+  // Merging into an empty sketch of the same size keeps every key, along
+  // with the weights and offset, so the copy estimates the same.
+  std::unique_ptr<OpaqueNativeHhSketch> native(new OpaqueNativeHhSketch(this->inner_.get_lg_max_map_size()));
+  const OpaqueHhDictionary* dictionary = this->dictionary_;
+  native->inner_.merge(this->inner_, [dictionary](const hh_id& key) {
+    return dictionary->get(key.id);
+  });
+  return native;
+}
+
+uint64_t OpaqueCompactHhSketch::get_total_weight() const {
   return this->inner_.get_total_weight();
 }
 
-uint64_t OpaqueHhSketch::get_offset() const {
-  return this->inner_.get_offset();
+size_t OpaqueCompactHhSketch::get_memory_usage_bytes() const {
+  return this->inner_.get_memory_usage_bytes();
 }
 
-std::unique_ptr<OpaqueHhSketch> new_opaque_hh_sketch(uint8_t lg2_k, size_t hashset_addr) {
-  OpaqueHhSketch::hhsketch sketch(lg2_k, hashset_addr);
-  auto ptr = new OpaqueHhSketch(std::move(sketch));
-  return std::unique_ptr<OpaqueHhSketch>(ptr);
+std::unique_ptr<OpaqueCompactHhSketch> new_opaque_compact_hh_sketch(uint8_t lg2_k, size_t dictionary_addr) {
+  auto dictionary = reinterpret_cast<OpaqueHhDictionary*>(dictionary_addr);
+  return std::unique_ptr<OpaqueCompactHhSketch>(new OpaqueCompactHhSketch(lg2_k, dictionary));
 }
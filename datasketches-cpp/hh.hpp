@@ -1,6 +1,7 @@
 #pragma once
 
 #include <cstdint>
+#include <cstring>
 #include <vector>
 #include <memory>
 
@@ -8,22 +9,193 @@
 
 #include "fi/include/frequent_items_sketch.hpp"
 
+#include "arena.hpp"
+
 struct ThinHeavyHitterRow;
+struct HeavyHitterRow;
 
 class OpaqueHhSketch {
 public:
-  typedef datasketches::frequent_items_sketch<size_t> hhsketch;
+  typedef datasketches::frequent_items_sketch<size_t, uint64_t, std::hash<size_t>, std::equal_to<size_t>, datasketches::serde<size_t>, sketch_allocator<size_t, alloc_family::HH>> hhsketch;
   std::unique_ptr<std::vector<ThinHeavyHitterRow>> estimate_no_fp() const;
   std::unique_ptr<std::vector<ThinHeavyHitterRow>> estimate_no_fn() const;
   void update(size_t value, uint64_t weight);
-  std::unique_ptr<std::vector<ThinHeavyHitterRow>> state() const;
-  void set_weights(uint64_t total_weight, uint64_t offset);
-  uint64_t get_total_weight() const;
-  uint64_t get_offset() const;
+  void merge(const OpaqueHhSketch& other);
+  // Heap bytes held by the sketch's map, not counting the keys it refers to.
+  size_t get_memory_usage_bytes() const;
 private:
-  OpaqueHhSketch(hhsketch&& theta);
+  OpaqueHhSketch(hhsketch&& theta, size_t hashset_addr);
   friend std::unique_ptr<OpaqueHhSketch> new_opaque_hh_sketch(uint8_t lg2_k, size_t hashset_addr);
   hhsketch inner_;
+  size_t hashset_addr_;
 };
 
 std::unique_ptr<OpaqueHhSketch> new_opaque_hh_sketch(uint8_t lg2_k, size_t hashset_addr);
+
+// A byte string key of OpaqueNativeHhSketch, carrying its hash so it is only
+// computed once. Keys are views: the ones stored in a sketch point into its
+// key arena, moved there by on_key_inserted(), while the key a sketch is
+// updated with points into the caller's buffer.
+struct hh_key {
+  const uint8_t* data;
+  size_t size;
+  uint64_t hash;
+};
+
+struct hh_key_hash {
+  size_t operator()(const hh_key& key) const { return key.hash; }
+};
+
+struct hh_key_equal {
+  bool operator()(const hh_key& a, const hh_key& b) const {
+    return a.hash == b.hash && a.size == b.size && std::memcmp(a.data, b.data, a.size) == 0;
+  }
+};
+
+// Serializes each key as its 32-bit length and bytes, like serde<std::string>.
+// Deserialized keys point into the serialized bytes, and are rehashed.
+struct hh_key_serde {
+  size_t size_of_item(const hh_key& key) const { return sizeof(uint32_t) + key.size; }
+  size_t serialize(void* ptr, size_t capacity, const hh_key* items, unsigned num) const;
+  size_t deserialize(const void* ptr, size_t capacity, hh_key* items, unsigned num) const;
+};
+
+// The sketch's hashset_addr is the address of its key arena.
+void on_key_inserted(size_t key_arena, hh_key& key);
+void on_key_removed(size_t key_arena, const hh_key& key);
+
+// Heavy hitters over byte strings which, unlike OpaqueHhSketch, owns its keys,
+// so updates and purges never call back into Rust.
+class OpaqueNativeHhSketch {
+public:
+  typedef datasketches::frequent_items_sketch<hh_key, uint64_t, hh_key_hash, hh_key_equal, hh_key_serde, sketch_allocator<hh_key, alloc_family::HH, huge_page_allocator>> hhsketch;
+  // Row keys point into the sketch and are only valid until it is next updated.
+  std::unique_ptr<std::vector<HeavyHitterRow>> estimate_no_fp() const;
+  std::unique_ptr<std::vector<HeavyHitterRow>> estimate_no_fn() const;
+  // The rows of estimate_no_fn() with the k highest estimates, highest first.
+  std::unique_ptr<std::vector<HeavyHitterRow>> top_no_fn(size_t k) const;
+  void update(rust::Slice<const uint8_t> value, uint64_t weight);
+  // The ends are validated on the Rust side, as for the other sketches' update_bytes_batch,
+  // and so are the weights, which are either one per key or empty, for unit weights.
+  void update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, rust::Slice<const uint64_t> weights);
+  void merge(const OpaqueNativeHhSketch& other);
+  std::unique_ptr<OpaqueNativeHhSketch> clone() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize() const;
+  // Heap bytes held by the sketch's map, not counting its key arena.
+  size_t get_memory_usage_bytes() const;
+private:
+  OpaqueNativeHhSketch(uint8_t lg2_k);
+  OpaqueNativeHhSketch(std::unique_ptr<arena>&& keys, hhsketch&& sketch);
+  OpaqueNativeHhSketch(const OpaqueNativeHhSketch&) = delete;
+  OpaqueNativeHhSketch& operator=(const OpaqueNativeHhSketch&) = delete;
+  friend std::unique_ptr<OpaqueNativeHhSketch> new_opaque_native_hh_sketch(uint8_t lg2_k);
+  friend std::unique_ptr<OpaqueNativeHhSketch> deserialize_opaque_native_hh_sketch(rust::Slice<const uint8_t> buf);
+  friend class OpaqueCompactHhSketch;
+  // Declared first so that it is destroyed after the keys pointing into it.
+  std::unique_ptr<arena> keys_;
+  hhsketch inner_;
+};
+
+std::unique_ptr<OpaqueNativeHhSketch> new_opaque_native_hh_sketch(uint8_t lg2_k);
+std::unique_ptr<OpaqueNativeHhSketch> deserialize_opaque_native_hh_sketch(rust::Slice<const uint8_t> buf);
+
+// Interns the keys of many OpaqueCompactHhSketch under 32-bit ids, so that a
+// key held by several sketches is stored once, and a sketch's slots hold ids
+// rather than key views. Each key counts the sketches holding it, and is freed
+// once none do, its id then going to the next new key.
+class OpaqueHhDictionary {
+public:
+  OpaqueHhDictionary();
+  OpaqueHhDictionary(const OpaqueHhDictionary&) = delete;
+  OpaqueHhDictionary& operator=(const OpaqueHhDictionary&) = delete;
+  // Returns the id of key, copying it in if new. A new key is held by no
+  // sketch until one inserts it, so it must be, right away.
+  uint32_t intern(const hh_key& key);
+  void retain(uint32_t id) { entries_[id].refs++; }
+  void release(uint32_t id);
+  // The key points into the dictionary, and is valid until its id is released.
+  hh_key get(uint32_t id) const {
+    const entry& e = entries_[id];
+    return hh_key{e.data, e.size, e.hash};
+  }
+  size_t get_num_keys() const { return num_keys_; }
+  // Heap bytes held by the dictionary, including its keys.
+  size_t get_memory_usage_bytes() const;
+private:
+  struct entry {
+    const uint8_t* data;
+    uint64_t hash;
+    uint32_t size;
+    uint32_t refs;
+  };
+  // Linear probing over id + 1, 0 being empty, kept at most half full.
+  uint32_t* find_slot(const hh_key& key);
+  void grow_index();
+  arena keys_;
+  std::vector<entry> entries_;
+  std::vector<uint32_t> free_ids_;
+  std::vector<uint32_t> index_;
+  size_t num_keys_;
+  size_t key_bytes_;
+};
+
+std::unique_ptr<OpaqueHhDictionary> new_opaque_hh_dictionary();
+
+// A key of OpaqueCompactHhSketch, the id of a byte string in the dictionary
+// whose address is the sketch's hashset_addr.
+struct hh_id {
+  uint32_t id;
+};
+
+struct hh_id_hash {
+  size_t operator()(const hh_id& key) const { return key.id; }
+};
+
+struct hh_id_equal {
+  bool operator()(const hh_id& a, const hh_id& b) const { return a.id == b.id; }
+};
+
+void on_key_inserted(size_t dictionary, hh_id& key);
+void on_key_removed(size_t dictionary, const hh_id& key);
+
+// Heavy hitters over byte strings, like OpaqueNativeHhSketch, but with 32-bit
+// weights and keys interned in an OpaqueHhDictionary shared with other
+// sketches, for slots of 12 bytes rather than the 24 of OpaqueHhSketch or the
+// 40 of OpaqueNativeHhSketch. Meant for a sketch per key of a keyed job, of
+// which there may be millions. The dictionary must outlive
+// the sketch, and must not be used from another thread while it is. Dropping
+// a sketch does not release its keys, as its dictionary is meant to be
+// dropped along with all of its sketches.
+//
+// The total weight of a sketch must fit in 32 bits, and updates and merges
+// that would overflow it throw. Sketches are serialized as
+// OpaqueNativeHhSketch, by way of one.
+class OpaqueCompactHhSketch {
+public:
+  typedef datasketches::frequent_items_sketch<hh_id, uint32_t, hh_id_hash, hh_id_equal, datasketches::serde<hh_id>, sketch_allocator<hh_id, alloc_family::HH, huge_page_allocator>> hhsketch;
+  // Row keys point into the dictionary and are only valid until it is next
+  // used by any sketch.
+  std::unique_ptr<std::vector<HeavyHitterRow>> estimate_no_fp() const;
+  std::unique_ptr<std::vector<HeavyHitterRow>> estimate_no_fn() const;
+  // The rows of estimate_no_fn() with the k highest estimates, highest first.
+  std::unique_ptr<std::vector<HeavyHitterRow>> top_no_fn(size_t k) const;
+  void update(rust::Slice<const uint8_t> value, uint32_t weight);
+  // The other sketch may use another dictionary.
+  void merge(const OpaqueCompactHhSketch& other);
+  void merge_native(const OpaqueNativeHhSketch& other);
+  std::unique_ptr<OpaqueNativeHhSketch> to_native() const;
+  uint64_t get_total_weight() const;
+  // Heap bytes held by the sketch's map, not counting its dictionary.
+  size_t get_memory_usage_bytes() const;
+private:
+  OpaqueCompactHhSketch(uint8_t lg2_k, OpaqueHhDictionary* dictionary);
+  OpaqueCompactHhSketch(const OpaqueCompactHhSketch&) = delete;
+  OpaqueCompactHhSketch& operator=(const OpaqueCompactHhSketch&) = delete;
+  friend std::unique_ptr<OpaqueCompactHhSketch> new_opaque_compact_hh_sketch(uint8_t lg2_k, size_t dictionary_addr);
+  void check_total_weight(uint64_t more) const;
+  std::unique_ptr<std::vector<HeavyHitterRow>> convert_to_rows(hhsketch::vector_row v) const;
+  OpaqueHhDictionary* dictionary_;
+  hhsketch inner_;
+};
+
+std::unique_ptr<OpaqueCompactHhSketch> new_opaque_compact_hh_sketch(uint8_t lg2_k, size_t dictionary_addr);
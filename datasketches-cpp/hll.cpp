@@ -0,0 +1,278 @@
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <stdexcept>
+
+#include "rust/cxx.h"
+#include "dsrs/src/bridge.rs.h"
+#include "hll/include/hll.hpp"
+#include "hll/include/hll_register_ops.hpp"
+
+#include "batch.hpp"
+#include "hll.hpp"
+
+static datasketches::target_hll_type to_target_type(HllType tgt_type) {
+  switch (tgt_type) {
+    case HllType::Hll4: return datasketches::HLL_4;
+    case HllType::Hll6: return datasketches::HLL_6;
+    case HllType::Hll8: return datasketches::HLL_8;
+  }
+  throw std::invalid_argument("unknown HLL target type");
+}
+
+static HllType from_target_type(datasketches::target_hll_type tgt_type) {
+  switch (tgt_type) {
+    case datasketches::HLL_4: return HllType::Hll4;
+    case datasketches::HLL_6: return HllType::Hll6;
+    case datasketches::HLL_8: return HllType::Hll8;
+  }
+  throw std::invalid_argument("unknown HLL target type");
+}
+
+OpaqueHllSketch::OpaqueHllSketch(uint8_t lg_k, datasketches::target_hll_type tgt_type):
+  inner_{lg_k, tgt_type} {
+}
+
+OpaqueHllSketch::OpaqueHllSketch(hll_sketch&& hll):
+  inner_{std::move(hll)} {
+}
+
+double OpaqueHllSketch::estimate() const {
+  return this->inner_.get_estimate();
+}
+
+void OpaqueHllSketch::update(rust::Slice<const uint8_t> buf) {
+  this->inner_.update(buf.data(), buf.size());
+}
+
+void OpaqueHllSketch::update_u64(uint64_t value) {
+  this->inner_.update(value);
+}
+
+void OpaqueHllSketch::update_u64_batch(rust::Slice<const uint64_t> values) {
+  this->inner_.update_batch(values.data(), values.size());
+}
+
+void OpaqueHllSketch::update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends) {
+  const uint8_t* data = buf.data();
+  if (all_16_byte_keys(ends)) {
+    this->inner_.update_batch_16(data, ends.size());
+    return;
+  }
+  size_t start = 0;
+  for (const size_t end : ends) {
+    this->inner_.update(data + start, end - start);
+    start = end;
+  }
+}
+
+void OpaqueHllSketch::update_hashed(KeyHash hash) {
+  this->inner_.update_hashes(&hash, 1);
+}
+
+void OpaqueHllSketch::update_hashed_batch(rust::Slice<const KeyHash> hashes) {
+  this->inner_.update_hashes(hashes.data(), hashes.size());
+}
+
+void OpaqueHllSketch::reset() {
+  this->inner_.reset();
+}
+
+uint8_t OpaqueHllSketch::get_lg_config_k() const {
+  return this->inner_.get_lg_config_k();
+}
+
+size_t OpaqueHllSketch::get_memory_usage_bytes() const {
+  return this->inner_.get_memory_usage_bytes();
+}
+
+HllType OpaqueHllSketch::get_target_type() const {
+  return from_target_type(this->inner_.get_target_type());
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueHllSketch::serialize_compact() const {
+  auto v = this->inner_.serialize_compact();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueHllSketch::serialize_updatable() const {
+  auto v = this->inner_.serialize_updatable();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
+}
+
+std::unique_ptr<OpaqueHllSketch> new_opaque_hll_sketch(uint8_t lg_k, HllType tgt_type) {
+  return std::unique_ptr<OpaqueHllSketch>(new OpaqueHllSketch{lg_k, to_target_type(tgt_type)});
+}
+
+std::unique_ptr<OpaqueHllSketch> deserialize_opaque_hll_sketch(rust::Slice<const uint8_t> buf) {
+  // the vendored factory reads the first byte before any length check
+  if (buf.empty()) throw std::invalid_argument("cannot deserialize HLL sketch from empty buffer");
+  auto hll = hll_sketch::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueHllSketch>(new OpaqueHllSketch{std::move(hll)});
+}
+
+double estimate_serialized_hll_sketch(rust::Slice<const uint8_t> buf) {
+  return hll_sketch::get_serialized_estimate(buf.data(), buf.size());
+}
+
+EstimateBounds bounds_serialized_hll_sketch(rust::Slice<const uint8_t> buf, uint8_t num_std_dev) {
+  EstimateBounds result;
+  hll_sketch::get_serialized_bounds(buf.data(), buf.size(), num_std_dev,
+      result.estimate, result.lower_bound, result.upper_bound);
+  return result;
+}
+
+OpaqueHllUnion::OpaqueHllUnion(uint8_t lg_max_k):
+  inner_{lg_max_k} {
+}
+
+std::unique_ptr<OpaqueHllSketch> OpaqueHllUnion::sketch(HllType tgt_type) const {
+  return std::unique_ptr<OpaqueHllSketch>(new OpaqueHllSketch{this->inner_.get_result(to_target_type(tgt_type))});
+}
+
+void OpaqueHllUnion::merge(std::unique_ptr<OpaqueHllSketch> to_add) {
+  this->inner_.update(std::move(to_add->inner_));
+}
+
+void OpaqueHllUnion::merge_serialized(rust::Slice<const uint8_t> buf) {
+  if (buf.empty()) throw std::invalid_argument("cannot deserialize HLL sketch from empty buffer");
+  this->inner_.update_serialized(buf.data(), buf.size());
+}
+
+void OpaqueHllUnion::reset() {
+  this->inner_.reset();
+}
+
+std::unique_ptr<OpaqueHllUnion> new_opaque_hll_union(uint8_t lg_max_k) {
+  return std::unique_ptr<OpaqueHllUnion>(new OpaqueHllUnion{lg_max_k});
+}
+
+// Raises the register of hash in the row of 2^lg_k registers at regs to the
+// value HllUtil::coupon would pack next to the register's index.
+static inline void update_register(uint8_t* regs, uint8_t lg_k, const KeyHash& hash) {
+  const uint64_t slot = hash.h1 & ((1 << lg_k) - 1);
+  const uint8_t lz = datasketches::count_leading_zeros_in_u64(hash.h2);
+  const uint8_t value = (lz > 62 ? 62 : lz) + 1;
+  if (value > regs[slot]) regs[slot] = value;
+}
+
+// An HLL_8 sketch of the 2^lg_k registers at regs, deserialized from the image
+// an HLL_8 sketch in HLL mode would serialize to. Rows keep no HIP accumulator,
+// so the image is flagged out of order, and estimates come from the registers.
+// A row of zeros gives an empty sketch, in list mode, unless hll_mode is set.
+static hll_sketch registers_sketch(uint8_t lg_k, const uint8_t* regs, bool hll_mode) {
+  namespace hc = datasketches::hll_constants;
+  const size_t k = size_t(1) << lg_k;
+  const datasketches::hll_register_sums sums = datasketches::sum_registers(regs, k);
+  if (sums.num_zeros == k && !hll_mode) return hll_sketch(lg_k, datasketches::HLL_8);
+  std::vector<uint8_t> image(hc::HLL_BYTE_ARR_START + k, 0);
+  image[hc::PREAMBLE_INTS_BYTE] = hc::HLL_PREINTS;
+  image[hc::SER_VER_BYTE] = hc::SER_VER;
+  image[hc::FAMILY_BYTE] = hc::FAMILY_ID;
+  image[hc::LG_K_BYTE] = lg_k;
+  image[hc::FLAGS_BYTE] = hc::COMPACT_FLAG_MASK | hc::OUT_OF_ORDER_FLAG_MASK;
+  image[hc::MODE_BYTE] = datasketches::HLL | (datasketches::HLL_8 << 2);
+  std::memcpy(image.data() + hc::KXQ0_DOUBLE, &sums.kxq0, sizeof(double));
+  std::memcpy(image.data() + hc::KXQ1_DOUBLE, &sums.kxq1, sizeof(double));
+  std::memcpy(image.data() + hc::CUR_MIN_COUNT_INT, &sums.num_zeros, sizeof(uint32_t));
+  std::copy(regs, regs + k, image.begin() + hc::HLL_BYTE_ARR_START);
+  return hll_sketch::deserialize(image.data(), image.size());
+}
+
+OpaqueHllMatrix::OpaqueHllMatrix(uint8_t lg_k, size_t num_rows):
+  lg_k_{lg_k},
+  registers_(num_rows << lg_k, 0) {
+}
+
+size_t OpaqueHllMatrix::num_rows() const {
+  return this->registers_.size() >> this->lg_k_;
+}
+
+uint8_t OpaqueHllMatrix::get_lg_config_k() const {
+  return this->lg_k_;
+}
+
+void OpaqueHllMatrix::add_rows(size_t n) {
+  this->registers_.resize(this->registers_.size() + (n << this->lg_k_), 0);
+}
+
+void OpaqueHllMatrix::update_hashed_batch(rust::Slice<const uint32_t> rows, rust::Slice<const KeyHash> hashes) {
+  uint8_t* regs = this->registers_.data();
+  for (size_t i = 0; i < hashes.size(); ++i) {
+    update_register(regs + (static_cast<size_t>(rows[i]) << this->lg_k_), this->lg_k_, hashes[i]);
+  }
+}
+
+void OpaqueHllMatrix::merge(const OpaqueHllMatrix& other) {
+  if (other.lg_k_ != this->lg_k_) {
+    throw std::invalid_argument("cannot merge HLL matrices of different lg_k");
+  }
+  if (other.registers_.size() > this->registers_.size()) {
+    this->registers_.resize(other.registers_.size(), 0);
+  }
+  datasketches::max_registers(this->registers_.data(), other.registers_.data(), other.registers_.size());
+}
+
+hll_sketch OpaqueHllMatrix::row_sketch(size_t row) const {
+  return registers_sketch(this->lg_k_, this->registers_.data() + (row << this->lg_k_), false);
+}
+
+double OpaqueHllMatrix::estimate(size_t row) const {
+  return this->row_sketch(row).get_estimate();
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueHllMatrix::serialize_row(size_t row, HllType tgt_type) const {
+  const hll_sketch hll(this->row_sketch(row), to_target_type(tgt_type));
+  auto v = hll.serialize_compact();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
+}
+
+void OpaqueHllMatrix::reset() {
+  std::fill(this->registers_.begin(), this->registers_.end(), 0);
+}
+
+std::unique_ptr<OpaqueHllMatrix> new_opaque_hll_matrix(uint8_t lg_k, size_t num_rows) {
+  if (lg_k < datasketches::hll_constants::MIN_LOG_K || lg_k > datasketches::hll_constants::MAX_LOG_K) {
+    throw std::invalid_argument("lg_k must be between 4 and 21");
+  }
+  return std::unique_ptr<OpaqueHllMatrix>(new OpaqueHllMatrix{lg_k, num_rows});
+}
+
+// The lg_k of a row of num_registers registers.
+static uint8_t registers_lg_k(size_t num_registers) {
+  namespace hc = datasketches::hll_constants;
+  for (uint8_t lg_k = hc::MIN_LOG_K; lg_k <= hc::MAX_LOG_K; ++lg_k) {
+    if (num_registers == size_t(1) << lg_k) return lg_k;
+  }
+  throw std::invalid_argument("HLL registers must number 2^lg_k for lg_k between 4 and 21");
+}
+
+void update_hll_registers(rust::Slice<uint8_t> registers, rust::Slice<const KeyHash> hashes) {
+  const uint8_t lg_k = registers_lg_k(registers.size());
+  for (const KeyHash& hash: hashes) update_register(registers.data(), lg_k, hash);
+}
+
+void merge_serialized_hll_registers(rust::Slice<uint8_t> registers, rust::Slice<const uint8_t> buf) {
+  namespace hc = datasketches::hll_constants;
+  const uint8_t lg_k = registers_lg_k(registers.size());
+  const datasketches::HllImage<std::allocator<uint8_t>> src(buf.data(), buf.size());
+  if (src.getLgConfigK() < lg_k) {
+    throw std::invalid_argument("cannot merge an HLL sketch of smaller lg_k into registers");
+  }
+  // the row goes in first, in HLL mode, so that the union stays in HLL mode at lg_k
+  hll_union u(lg_k);
+  u.update(registers_sketch(lg_k, registers.data(), true));
+  u.update_serialized(buf.data(), buf.size());
+  const auto image = u.get_result(datasketches::HLL_8).serialize_updatable();
+  std::copy(image.begin() + hc::HLL_BYTE_ARR_START, image.end(), registers.begin());
+}
+
+double estimate_hll_registers(rust::Slice<const uint8_t> registers) {
+  return registers_sketch(registers_lg_k(registers.size()), registers.data(), false).get_estimate();
+}
+
+std::unique_ptr<std::vector<uint8_t>> serialize_hll_registers(rust::Slice<const uint8_t> registers, HllType tgt_type) {
+  const auto row = registers_sketch(registers_lg_k(registers.size()), registers.data(), false);
+  auto v = hll_sketch(row, to_target_type(tgt_type)).serialize_compact();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
+}
@@ -0,0 +1,102 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "rust/cxx.h"
+#include "hll/include/hll.hpp"
+#include "alloc_stats.hpp"
+#include "huge_pages.hpp"
+
+using hll_sketch = datasketches::hll_sketch_alloc<sketch_allocator<uint8_t, alloc_family::HLL>>;
+using hll_union = datasketches::hll_union_alloc<sketch_allocator<uint8_t, alloc_family::HLL>>;
+
+enum class HllType : uint8_t;
+struct EstimateBounds;
+struct KeyHash;
+
+class OpaqueHllSketch {
+public:
+  double estimate() const;
+  void update(rust::Slice<const uint8_t> buf);
+  void update_u64(uint64_t value);
+  void update_u64_batch(rust::Slice<const uint64_t> values);
+  void update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends);
+  // In place of update(), with the hash_key() of its buf.
+  void update_hashed(KeyHash hash);
+  // In place of update_bytes_batch(), with the hash_keys() of its keys.
+  void update_hashed_batch(rust::Slice<const KeyHash> hashes);
+  void reset();
+  uint8_t get_lg_config_k() const;
+  HllType get_target_type() const;
+  // Heap bytes held by the coupons or registers, and any aux map.
+  size_t get_memory_usage_bytes() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize_compact() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize_updatable() const;
+private:
+  OpaqueHllSketch(uint8_t lg_k, datasketches::target_hll_type tgt_type);
+  OpaqueHllSketch(hll_sketch&& hll);
+  friend std::unique_ptr<OpaqueHllSketch> new_opaque_hll_sketch(uint8_t lg_k, HllType tgt_type);
+  friend std::unique_ptr<OpaqueHllSketch> deserialize_opaque_hll_sketch(rust::Slice<const uint8_t> buf);
+  friend class OpaqueHllUnion;
+  hll_sketch inner_;
+};
+
+std::unique_ptr<OpaqueHllSketch> new_opaque_hll_sketch(uint8_t lg_k, HllType tgt_type);
+std::unique_ptr<OpaqueHllSketch> deserialize_opaque_hll_sketch(rust::Slice<const uint8_t> buf);
+double estimate_serialized_hll_sketch(rust::Slice<const uint8_t> buf);
+EstimateBounds bounds_serialized_hll_sketch(rust::Slice<const uint8_t> buf, uint8_t num_std_dev);
+
+class OpaqueHllUnion {
+public:
+  std::unique_ptr<OpaqueHllSketch> sketch(HllType tgt_type) const;
+  void merge(std::unique_ptr<OpaqueHllSketch> to_add);
+  // Deserializes onto the stack rather than into a heap OpaqueHllSketch.
+  void merge_serialized(rust::Slice<const uint8_t> buf);
+  void reset();
+private:
+  OpaqueHllUnion(uint8_t lg_max_k);
+  hll_union inner_;
+  friend std::unique_ptr<OpaqueHllUnion> new_opaque_hll_union(uint8_t lg_max_k);
+};
+
+std::unique_ptr<OpaqueHllUnion> new_opaque_hll_union(uint8_t lg_max_k);
+
+// The registers of many HLL sketches of one lg_k, a row each, back to back in
+// one array of a byte per register, as an HLL_8 sketch holds them. Rows have
+// no header, list or set mode, or HIP accumulator of their own, so each takes
+// exactly 2^lg_k bytes, and whole matrices merge with one bytewise maximum.
+// Rows must be below num_rows().
+class OpaqueHllMatrix {
+public:
+  size_t num_rows() const;
+  uint8_t get_lg_config_k() const;
+  // Appends n empty rows.
+  void add_rows(size_t n);
+  // Updates row rows[i] with hashes[i], as update_hashed() would a sketch.
+  void update_hashed_batch(rust::Slice<const uint32_t> rows, rust::Slice<const KeyHash> hashes);
+  // Merges row i of other into row i, first adding rows to match other's.
+  void merge(const OpaqueHllMatrix& other);
+  double estimate(size_t row) const;
+  std::unique_ptr<std::vector<uint8_t>> serialize_row(size_t row, HllType tgt_type) const;
+  void reset();
+private:
+  OpaqueHllMatrix(uint8_t lg_k, size_t num_rows);
+  hll_sketch row_sketch(size_t row) const;
+  uint8_t lg_k_;
+  // Large matrices are probed at random, so they are backed by huge pages
+  // once those are enabled.
+  std::vector<uint8_t, huge_page_allocator<uint8_t>> registers_;
+  friend std::unique_ptr<OpaqueHllMatrix> new_opaque_hll_matrix(uint8_t lg_k, size_t num_rows);
+};
+
+std::unique_ptr<OpaqueHllMatrix> new_opaque_hll_matrix(uint8_t lg_k, size_t num_rows);
+
+// The same operations on a single row held by the caller, such as a slot of
+// a file mapped into memory. The row's length must be 2^lg_k for a valid lg_k.
+void update_hll_registers(rust::Slice<uint8_t> registers, rust::Slice<const KeyHash> hashes);
+// Merges a serialized sketch of at least the row's lg_k into the row.
+void merge_serialized_hll_registers(rust::Slice<uint8_t> registers, rust::Slice<const uint8_t> buf);
+double estimate_hll_registers(rust::Slice<const uint8_t> registers);
+std::unique_ptr<std::vector<uint8_t>> serialize_hll_registers(rust::Slice<const uint8_t> registers, HllType tgt_type);
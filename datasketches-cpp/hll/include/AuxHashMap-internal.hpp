@@ -22,15 +22,22 @@
 
 #include "HllUtil.hpp"
 #include "AuxHashMap.hpp"
+#include "count_zeros.hpp"
+
+#include <cstring>
 
 namespace datasketches {
 
 template<typename A>
 AuxHashMap<A>::AuxHashMap(uint8_t lgAuxArrInts, uint8_t lgConfigK, const A& allocator):
 lgConfigK(lgConfigK),
+lgInitAuxArrInts(lgAuxArrInts),
 lgAuxArrInts(lgAuxArrInts),
 auxCount(0),
-entries(1ULL << lgAuxArrInts, 0, allocator)
+lgGroups(0),
+tags(aux_tag_ops::GROUP_LANES, 0, allocator),
+coupons(aux_tag_ops::GROUP_LANES, 0, allocator),
+order(allocator)
 {}
 
 template<typename A>
@@ -40,7 +47,7 @@ AuxHashMap<A>* AuxHashMap<A>::newAuxHashMap(uint8_t lgAuxArrInts, uint8_t lgConf
 
 template<typename A>
 AuxHashMap<A>* AuxHashMap<A>::newAuxHashMap(const AuxHashMap& that) {
-  return new (ahmAlloc(that.entries.get_allocator()).allocate(1)) AuxHashMap<A>(that);
+  return new (ahmAlloc(that.coupons.get_allocator()).allocate(1)) AuxHashMap<A>(that);
 }
 
 template<typename A>
@@ -139,7 +146,7 @@ AuxHashMap<A>* AuxHashMap<A>::deserialize(std::istream& is, uint8_t lgConfigK,
 template<typename A>
 std::function<void(AuxHashMap<A>*)> AuxHashMap<A>::make_deleter() {
   return [](AuxHashMap<A>* ptr) {
-    ahmAlloc alloc(ptr->entries.get_allocator());
+    ahmAlloc alloc(ptr->coupons.get_allocator());
     ptr->~AuxHashMap();
     alloc.deallocate(ptr, 1);
   };
@@ -147,7 +154,7 @@ std::function<void(AuxHashMap<A>*)> AuxHashMap<A>::make_deleter() {
 
 template<typename A>
 AuxHashMap<A>* AuxHashMap<A>::copy() const {
-  return new (ahmAlloc(entries.get_allocator()).allocate(1)) AuxHashMap<A>(*this);
+  return new (ahmAlloc(coupons.get_allocator()).allocate(1)) AuxHashMap<A>(*this);
 }
 
 template<typename A>
@@ -156,8 +163,13 @@ uint32_t AuxHashMap<A>::getAuxCount() const {
 }
 
 template<typename A>
-uint32_t* AuxHashMap<A>::getAuxIntArr(){
-  return entries.data();
+const uint32_t* AuxHashMap<A>::getAuxLanes() const {
+  return coupons.data();
+}
+
+template<typename A>
+uint32_t AuxHashMap<A>::getAuxLaneCount() const {
+  return static_cast<uint32_t>(coupons.size());
 }
 
 template<typename A>
@@ -175,26 +187,39 @@ uint32_t AuxHashMap<A>::getUpdatableSizeBytes() const {
   return 4 << lgAuxArrInts;
 }
 
+template<typename A>
+size_t AuxHashMap<A>::getMemoryUsageBytes() const {
+  return tags.capacity() * sizeof(uint16_t) + coupons.capacity() * sizeof(uint32_t)
+      + order.capacity() * sizeof(uint32_t);
+}
+
 template<typename A>
 void AuxHashMap<A>::mustAdd(uint32_t slotNo, uint8_t value) {
-  const int32_t index = find(entries.data(), lgAuxArrInts, lgConfigK, slotNo);
-  const uint32_t entry_pair = HllUtil<A>::pair(slotNo, value);
-  if (index >= 0) {
+  const int32_t lane = findLane(slotNo);
+  if (lane >= 0) {
     throw std::invalid_argument("Found a slotNo that should not be there: SlotNo: "
                                 + std::to_string(slotNo) + ", Value: " + std::to_string(value));
   }
 
-  // found empty entry
-  entries[~index] = entry_pair;
+  // found empty lane
+  tags[~lane] = laneTag(slotNo);
+  coupons[~lane] = HllUtil<A>::pair(slotNo, value);
+  order.push_back(~lane);
   ++auxCount;
-  checkGrow();
+  // the serialized table grows just as it did when it was probed directly
+  if ((hll_constants::RESIZE_DENOM * auxCount) > (hll_constants::RESIZE_NUMER * (1 << lgAuxArrInts))) {
+    ++lgAuxArrInts;
+  }
+  if ((hll_constants::RESIZE_DENOM * auxCount) > (hll_constants::RESIZE_NUMER * tags.size())) {
+    growGroups();
+  }
 }
 
 template<typename A>
 uint8_t AuxHashMap<A>::mustFindValueFor(uint32_t slotNo) const {
-  const int32_t index = find(entries.data(), lgAuxArrInts, lgConfigK, slotNo);
-  if (index >= 0) {
-    return HllUtil<A>::getValue(entries[index]);
+  const int32_t lane = findLane(slotNo);
+  if (lane >= 0) {
+    return HllUtil<A>::getValue(coupons[lane]);
   }
 
   throw std::invalid_argument("slotNo not found: " + std::to_string(slotNo));
@@ -202,9 +227,9 @@ uint8_t AuxHashMap<A>::mustFindValueFor(uint32_t slotNo) const {
 
 template<typename A>
 void AuxHashMap<A>::mustReplace(uint32_t slotNo, uint8_t value) {
-  const int32_t idx = find(entries.data(), lgAuxArrInts, lgConfigK, slotNo);
-  if (idx >= 0) {
-    entries[idx] = HllUtil<A>::pair(slotNo, value);
+  const int32_t lane = findLane(slotNo);
+  if (lane >= 0) {
+    coupons[lane] = HllUtil<A>::pair(slotNo, value);
     return;
   }
 
@@ -212,27 +237,71 @@ void AuxHashMap<A>::mustReplace(uint32_t slotNo, uint8_t value) {
                               + ", Value: " + std::to_string(value));
 }
 
+// The group of a slot is in its low bits and its tag in the ones above, both
+// hash bits. The top bit of a tag is always set, so that no tag is empty.
 template<typename A>
-void AuxHashMap<A>::checkGrow() {
-  if ((hll_constants::RESIZE_DENOM * auxCount) > (hll_constants::RESIZE_NUMER * (1 << lgAuxArrInts))) {
-    growAuxSpace();
+uint16_t AuxHashMap<A>::laneTag(uint32_t slotNo) const {
+  return static_cast<uint16_t>((slotNo >> lgGroups) | 0x8000);
+}
+
+// Groups fill their lanes in order, so one with an empty lane ends the probe.
+// The table is at most 3/4 full, so there always is one.
+template<typename A>
+int32_t AuxHashMap<A>::findLane(uint32_t slotNo) const {
+  const uint32_t configKmask = (1 << lgConfigK) - 1;
+  const uint32_t groupMask = (1 << lgGroups) - 1;
+  const uint16_t tag = laneTag(slotNo);
+  uint32_t group = slotNo & groupMask;
+  while (true) {
+    const uint32_t first = group * aux_tag_ops::GROUP_LANES;
+    // tags may be truncated, so a match is confirmed on the coupon
+    for (uint32_t matches = match_aux_tags(tags.data() + first, tag); matches != 0; matches &= matches - 1) {
+      const uint32_t lane = first + count_trailing_zeros_in_u32(matches);
+      if ((coupons[lane] & configKmask) == slotNo) return lane;
+    }
+    const uint32_t empty = match_aux_tags(tags.data() + first, 0);
+    if (empty != 0) return ~static_cast<int32_t>(first + count_trailing_zeros_in_u32(empty));
+    group = (group + 1) & groupMask;
   }
 }
 
 template<typename A>
-void AuxHashMap<A>::growAuxSpace() {
-  const int configKmask = (1 << lgConfigK) - 1;
-  const int newArrLen = 1 << ++lgAuxArrInts;
-  vector_int entries_new(newArrLen, 0, entries.get_allocator());
-  for (size_t i = 0; i < entries.size(); ++i) {
-    const uint32_t fetched = entries[i];
-    if (fetched != hll_constants::EMPTY) {
-      // find empty in new array
-      const int32_t idx = find(entries_new.data(), lgAuxArrInts, lgConfigK, fetched & configKmask);
-      entries_new[~idx] = fetched;
+void AuxHashMap<A>::growGroups() {
+  const uint32_t configKmask = (1 << lgConfigK) - 1;
+  const vector_int old = std::move(coupons);
+  ++lgGroups;
+  tags.assign(aux_tag_ops::GROUP_LANES << lgGroups, 0);
+  coupons.assign(aux_tag_ops::GROUP_LANES << lgGroups, 0);
+  for (uint32_t& lane: order) {
+    const uint32_t coupon = old[lane];
+    lane = ~findLane(coupon & configKmask);
+    tags[lane] = laneTag(coupon & configKmask);
+    coupons[lane] = coupon;
+  }
+}
+
+// Adds the coupons in their order to a table of the size this one started at,
+// growing and rehashing it as mustAdd used to, so that an image read back and
+// written again comes out the same.
+template<typename A>
+void AuxHashMap<A>::writeUpdatable(void* dst) const {
+  const uint32_t configKmask = (1 << lgConfigK) - 1;
+  uint8_t lgArrInts = lgInitAuxArrInts;
+  vector_int table(1ULL << lgArrInts, 0, coupons.get_allocator());
+  for (uint32_t i = 0; i < auxCount; ++i) {
+    const uint32_t coupon = coupons[order[i]];
+    table[~find(table.data(), lgArrInts, lgConfigK, coupon & configKmask)] = coupon;
+    if ((hll_constants::RESIZE_DENOM * (i + 1)) > (hll_constants::RESIZE_NUMER * (1 << lgArrInts))) {
+      vector_int grown(1ULL << ++lgArrInts, 0, coupons.get_allocator());
+      for (const uint32_t fetched: table) {
+        if (fetched != hll_constants::EMPTY) {
+          grown[~find(grown.data(), lgArrInts, lgConfigK, fetched & configKmask)] = fetched;
+        }
+      }
+      table = std::move(grown);
     }
   }
-  entries = std::move(entries_new);
+  std::memcpy(dst, table.data(), table.size() * sizeof(uint32_t));
 }
 
 //Searches the Aux arr hash table for an empty or a matching slotNo depending on the context.
@@ -262,12 +331,12 @@ int32_t AuxHashMap<A>::find(const uint32_t* auxArr, uint8_t lgAuxArrInts, uint8_
 
 template<typename A>
 coupon_iterator<A> AuxHashMap<A>::begin(bool all) const {
-  return coupon_iterator<A>(entries.data(), 1ULL << lgAuxArrInts, 0, all);
+  return coupon_iterator<A>(coupons.data(), coupons.size(), 0, all);
 }
 
 template<typename A>
 coupon_iterator<A> AuxHashMap<A>::end() const {
-  return coupon_iterator<A>(entries.data(), 1ULL << lgAuxArrInts, 1ULL << lgAuxArrInts, false);
+  return coupon_iterator<A>(coupons.data(), coupons.size(), coupons.size(), false);
 }
 
 }
@@ -25,9 +25,20 @@
 #include <functional>
 
 #include "coupon_iterator.hpp"
+#include "aux_tag_ops.hpp"
 
 namespace datasketches {
 
+// The exceptions of an HLL_4 sketch: slots whose value is too far above curMin
+// for their 4 bits, kept as coupons of the slot and its actual value.
+//
+// Coupons sit in lanes, in groups of 16 found from the low bits of the slot, and
+// each lane has a 16-bit tag of the slot's higher bits: a whole group's tags are
+// compared against the one looked for at once with SIMD (see aux_tag_ops.hpp),
+// rather than a table probed one entry at a time. The double-hashed table of
+// 2^lgAuxArrInts ints that updatable images hold is sized as it always was, and
+// laid out only when one is serialized, by adding the coupons to it in the
+// order they were added here.
 template<typename A>
 class AuxHashMap final {
   public:
@@ -48,10 +59,16 @@ class AuxHashMap final {
     AuxHashMap* copy() const;
     uint32_t getUpdatableSizeBytes() const;
     uint32_t getCompactSizeBytes() const;
+    size_t getMemoryUsageBytes() const;
 
     uint32_t getAuxCount() const;
-    uint32_t* getAuxIntArr();
+    // The getAuxLaneCount() lanes, holding the coupons among EMPTY ones. An
+    // EMPTY coupon has value 0, so merges can take the maximum over them all.
+    const uint32_t* getAuxLanes() const;
+    uint32_t getAuxLaneCount() const;
     uint8_t getLgAuxArrInts() const;
+    // Writes the getUpdatableSizeBytes() bytes of the table an updatable image holds.
+    void writeUpdatable(void* dst) const;
 
     coupon_iterator<A> begin(bool all = false) const;
     coupon_iterator<A> end() const;
@@ -64,17 +81,29 @@ class AuxHashMap final {
     typedef typename std::allocator_traits<A>::template rebind_alloc<AuxHashMap<A>> ahmAlloc;
 
     using vector_int = std::vector<uint32_t, typename std::allocator_traits<A>::template rebind_alloc<uint32_t>>;
+    using vector_u16 = std::vector<uint16_t, typename std::allocator_traits<A>::template rebind_alloc<uint16_t>>;
 
-    // static so it can be used when resizing
-    static int32_t find(const uint32_t* auxArr, uint8_t lgAuxArrInts, uint8_t lgConfigK, uint32_t slotNo);
+    // Returns the lane holding slotNo, or if none does, the one's complement of
+    // the empty lane it would go in.
+    int32_t findLane(uint32_t slotNo) const;
+    uint16_t laneTag(uint32_t slotNo) const;
+    void growGroups();
 
-    void checkGrow();
-    void growAuxSpace();
+    // The double-hashed probe of the serialized table, as in earlier versions:
+    // returns the index of slotNo, or the one's complement of an empty one.
+    static int32_t find(const uint32_t* auxArr, uint8_t lgAuxArrInts, uint8_t lgConfigK, uint32_t slotNo);
 
     const uint8_t lgConfigK;
+    // the size of the serialized table, when it was created and now
+    uint8_t lgInitAuxArrInts;
     uint8_t lgAuxArrInts;
     uint32_t auxCount;
-    vector_int entries;
+    // 2^lgGroups groups of lanes, each with a coupon and its tag, both 0 if empty
+    uint8_t lgGroups;
+    vector_u16 tags;
+    vector_int coupons;
+    // the lane of each coupon, in the order they were added
+    vector_int order;
 };
 
 }
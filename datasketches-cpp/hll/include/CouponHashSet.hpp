@@ -29,6 +29,8 @@ class CouponHashSet : public CouponList<A> {
   public:
     static CouponHashSet* newSet(const void* bytes, size_t len, const A& allocator);
     static CouponHashSet* newSet(std::istream& is, const A& allocator);
+    static void getSerializedBounds(const void* bytes, size_t len, uint8_t numStdDev,
+                                    double& estimate, double& lowerBound, double& upperBound);
     CouponHashSet(uint8_t lgConfigK, target_hll_type tgtHllType, const A& allocator);
     CouponHashSet(const CouponHashSet& that, target_hll_type tgtHllType);
 
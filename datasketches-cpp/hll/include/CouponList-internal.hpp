@@ -118,6 +118,60 @@ CouponList<A>* CouponList<A>::newList(const void* bytes, size_t len, const A& al
   return sketch;
 }
 
+template<typename A>
+void CouponList<A>::getSerializedBounds(const void* bytes, size_t len, uint8_t numStdDev,
+                                        double& estimate, double& lowerBound, double& upperBound) {
+  HllUtil<A>::checkNumStdDev(numStdDev);
+  if (len < hll_constants::LIST_INT_ARR_START) {
+    throw std::out_of_range("Input data length insufficient to hold CouponHashSet");
+  }
+
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  if (data[hll_constants::PREAMBLE_INTS_BYTE] != hll_constants::LIST_PREINTS) {
+    throw std::invalid_argument("Incorrect number of preInts in input stream");
+  }
+  if (data[hll_constants::SER_VER_BYTE] != hll_constants::SER_VER) {
+    throw std::invalid_argument("Wrong ser ver in input stream");
+  }
+  if (data[hll_constants::FAMILY_BYTE] != hll_constants::FAMILY_ID) {
+    throw std::invalid_argument("Input stream is not an HLL sketch");
+  }
+
+  hll_mode mode = HllSketchImpl<A>::extractCurMode(data[hll_constants::MODE_BYTE]);
+  if (mode != LIST) {
+    throw std::invalid_argument("Calling list constructor with non-list mode data");
+  }
+
+  const uint8_t lgK = data[hll_constants::LG_K_BYTE];
+  const bool compact = ((data[hll_constants::FLAGS_BYTE] & hll_constants::COMPACT_FLAG_MASK) ? true : false);
+
+  const uint32_t couponCount = data[hll_constants::LIST_COUNT_BYTE];
+  const uint32_t couponsInArray = (compact ? couponCount : (1 << HllUtil<A>::computeLgArrInts(LIST, couponCount, lgK)));
+  const size_t expectedLength = hll_constants::LIST_INT_ARR_START + (couponsInArray * sizeof(uint32_t));
+  if (len < expectedLength) {
+    throw std::out_of_range("Byte array too short for sketch. Expected " + std::to_string(expectedLength)
+                                + ", found: " + std::to_string(len));
+  }
+
+  couponBounds(couponCount, numStdDev, estimate, lowerBound, upperBound);
+}
+
+template<typename A>
+double CouponList<A>::couponEstimate(uint32_t couponCount) {
+  const double est = CubicInterpolation<A>::usingXAndYTables(couponCount);
+  return fmax(est, couponCount);
+}
+
+// the same arithmetic as getLowerBound() and getUpperBound(), which only need the count
+template<typename A>
+void CouponList<A>::couponBounds(uint32_t couponCount, uint8_t numStdDev,
+                                 double& estimate, double& lowerBound, double& upperBound) {
+  const double est = CubicInterpolation<A>::usingXAndYTables(couponCount);
+  estimate = fmax(est, couponCount);
+  lowerBound = fmax(est / (1.0 + (numStdDev * hll_constants::COUPON_RSE)), couponCount);
+  upperBound = fmax(est / (1.0 - (numStdDev * hll_constants::COUPON_RSE)), couponCount);
+}
+
 template<typename A>
 CouponList<A>* CouponList<A>::newList(std::istream& is, const A& allocator) {
   uint8_t listHeader[8];
@@ -293,8 +347,7 @@ double CouponList<A>::getCompositeEstimate() const { return getEstimate(); }
 
 template<typename A>
 double CouponList<A>::getEstimate() const {
-  const double est = CubicInterpolation<A>::usingXAndYTables(couponCount_);
-  return fmax(est, couponCount_);
+  return couponEstimate(couponCount_);
 }
 
 template<typename A>
@@ -331,6 +384,11 @@ uint32_t CouponList<A>::getCompactSerializationBytes() const {
   return getMemDataStart() + (couponCount_ << 2);
 }
 
+template<typename A>
+size_t CouponList<A>::getMemoryUsageBytes() const {
+  return coupons_.capacity() * sizeof(uint32_t);
+}
+
 template<typename A>
 uint32_t CouponList<A>::getMemDataStart() const {
   return hll_constants::LIST_INT_ARR_START;
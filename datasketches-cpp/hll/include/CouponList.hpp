@@ -38,6 +38,8 @@ class CouponList : public HllSketchImpl<A> {
 
     static CouponList* newList(const void* bytes, size_t len, const A& allocator);
     static CouponList* newList(std::istream& is, const A& allocator);
+    static void getSerializedBounds(const void* bytes, size_t len, uint8_t numStdDev,
+                                    double& estimate, double& lowerBound, double& upperBound);
     virtual vector_u8<A> serialize(bool compact, unsigned header_size_bytes) const;
     virtual void serialize(std::ostream& os, bool compact) const;
 
@@ -67,9 +69,13 @@ class CouponList : public HllSketchImpl<A> {
 
     HllSketchImpl<A>* promoteHeapListToSet(CouponList& list);
     HllSketchImpl<A>* promoteHeapListOrSetToHll(CouponList& src);
+    static double couponEstimate(uint32_t couponCount);
+    static void couponBounds(uint32_t couponCount, uint8_t numStdDev,
+                             double& estimate, double& lowerBound, double& upperBound);
 
     virtual uint32_t getUpdatableSerializationBytes() const;
     virtual uint32_t getCompactSerializationBytes() const;
+    virtual size_t getMemoryUsageBytes() const;
     virtual uint32_t getMemDataStart() const;
     virtual uint8_t getPreInts() const;
     virtual bool isCompact() const;
@@ -126,6 +126,18 @@ HllSketchImpl<A>* Hll4Array<A>::couponUpdate(uint32_t coupon) {
   return this;
 }
 
+template<typename A>
+void Hll4Array<A>::couponUpdateBlock(const uint32_t* coupons, size_t n) {
+  this->prefetchSlots(coupons, n, 1);
+  const uint32_t configKmask = (1 << this->lgConfigK_) - 1;
+  for (size_t i = 0; i < n; ++i) {
+    const uint8_t newValue = HllUtil<A>::getValue(coupons[i]);
+    // curMin can rise within the block, so it is reread for each coupon
+    if (newValue <= this->curMin_) continue;
+    internalHll4Update(HllUtil<A>::getLow26(coupons[i]) & configKmask, newValue);
+  }
+}
+
 template<typename A>
 void Hll4Array<A>::internalCouponUpdate(uint32_t coupon) {
   const uint8_t newValue = HllUtil<A>::getValue(coupon);
@@ -47,6 +47,7 @@ class Hll4Array final : public HllArray<A> {
     virtual uint32_t getHllByteArrBytes() const;
 
     virtual HllSketchImpl<A>* couponUpdate(uint32_t coupon) final;
+    virtual void couponUpdateBlock(const uint32_t* coupons, size_t n) final;
     void mergeHll(const HllArray<A>& src);
 
     virtual AuxHashMap<A>* getAuxHashMap() const;
@@ -20,7 +20,11 @@
 #ifndef _HLL8ARRAY_INTERNAL_HPP_
 #define _HLL8ARRAY_INTERNAL_HPP_
 
+#include <algorithm>
+
 #include "Hll8Array.hpp"
+#include "HllImage.hpp"
+#include "hll_register_ops.hpp"
 
 namespace datasketches {
 
@@ -71,6 +75,12 @@ HllSketchImpl<A>* Hll8Array<A>::couponUpdate(uint32_t coupon) {
   return this;
 }
 
+template<typename A>
+void Hll8Array<A>::couponUpdateBlock(const uint32_t* coupons, size_t n) {
+  this->prefetchSlots(coupons, n, 0);
+  for (size_t i = 0; i < n; ++i) internalCouponUpdate(coupons[i]);
+}
+
 template<typename A>
 void Hll8Array<A>::internalCouponUpdate(uint32_t coupon) {
   const uint32_t configKmask = (1 << this->lgConfigK_) - 1;
@@ -142,6 +152,65 @@ void Hll8Array<A>::mergeHll(const HllArray<A>& src) {
   }
 }
 
+template<typename A>
+void Hll8Array<A>::unionHll(const HllArray<A>& src) {
+  unionRegisters(src.getHllByteArr().data(), src.getTgtHllType(), src.getLgConfigK(), src.getCurMin());
+  // HLL_4 exceptions were unpacked as lower bounds; their values are in the aux map
+  const AuxHashMap<A>* aux = src.getAuxHashMap();
+  if (aux != nullptr) {
+    const uint32_t* lanes = aux->getAuxLanes();
+    for (uint32_t i = 0; i < aux->getAuxLaneCount(); ++i) unionException(lanes[i]);
+  }
+  refreshRegisterSums();
+}
+
+template<typename A>
+void Hll8Array<A>::unionImage(const HllImage<A>& src) {
+  unionRegisters(src.getHllByteArr(), src.getTgtHllType(), src.getLgConfigK(), src.getCurMin());
+  src.forEachCoupon([this](uint32_t coupon) { unionException(coupon); });
+  refreshRegisterSums();
+}
+
+template<typename A>
+void Hll8Array<A>::unionRegisters(const uint8_t* packed, target_hll_type srcType, uint8_t srcLgK, uint8_t srcCurMin) {
+  // at this point src_k >= dst_k, and both are powers of 2 of at least 16
+  const uint32_t src_k = 1 << srcLgK;
+  const uint32_t dst_k = 1 << this->getLgConfigK();
+  uint8_t* dst = this->hllByteArr_.data();
+  if (srcType == target_hll_type::HLL_8) {
+    for (uint32_t i = 0; i < src_k; i += dst_k) {
+      max_registers(dst, packed + i, dst_k);
+    }
+  } else {
+    // unpack a block at a time, which never straddles a fold onto dst
+    const uint32_t block = dst_k < UNPACK_BLOCK ? dst_k : UNPACK_BLOCK;
+    uint8_t values[UNPACK_BLOCK];
+    for (uint32_t i = 0; i < src_k; i += block) {
+      if (srcType == target_hll_type::HLL_6) {
+        unpack_hll6_registers(packed + 3 * (i >> 2), block, values);
+      } else {
+        unpack_hll4_registers(packed + (i >> 1), block, srcCurMin, values);
+      }
+      max_registers(dst + (i & (dst_k - 1)), values, block);
+    }
+  }
+}
+
+template<typename A>
+void Hll8Array<A>::unionException(uint32_t coupon) {
+  const uint32_t j = HllUtil<A>::getLow26(coupon) & ((1 << this->getLgConfigK()) - 1);
+  const uint8_t new_v = HllUtil<A>::getValue(coupon);
+  if (new_v > this->hllByteArr_[j]) this->hllByteArr_[j] = new_v;
+}
+
+template<typename A>
+void Hll8Array<A>::refreshRegisterSums() {
+  const hll_register_sums sums = sum_registers(this->hllByteArr_.data(), 1 << this->getLgConfigK());
+  this->kxq0_ = sums.kxq0;
+  this->kxq1_ = sums.kxq1;
+  this->numAtCurMin_ = sums.num_zeros;
+}
+
 }
 
 #endif // _HLL8ARRAY_INTERNAL_HPP_
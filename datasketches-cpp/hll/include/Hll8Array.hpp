@@ -27,6 +27,9 @@ namespace datasketches {
 template<typename A>
 class Hll8Iterator;
 
+template<typename A>
+class HllImage;
+
 template<typename A>
 class Hll8Array final : public HllArray<A> {
   public:
@@ -41,13 +44,29 @@ class Hll8Array final : public HllArray<A> {
     inline void putSlot(uint32_t slotNo, uint8_t value);
 
     virtual HllSketchImpl<A>* couponUpdate(uint32_t coupon) final;
+    virtual void couponUpdateBlock(const uint32_t* coupons, size_t n) final;
     void mergeList(const CouponList<A>& src);
     void mergeHll(const HllArray<A>& src);
+    // As mergeHll, but for a union's gadget, whose HIP accumulator is about to be
+    // dropped: registers are merged in bulk, and kxq and the number of zeros are
+    // recomputed once at the end rather than tracked per changed register.
+    void unionHll(const HllArray<A>& src);
+    // As unionHll, reading an HLL mode image in place
+    void unionImage(const HllImage<A>& src);
 
     virtual uint32_t getHllByteArrBytes() const;
 
   private:
+    // registers of an HLL_4 or HLL_6 source unpacked at a time by unionHll
+    static const uint32_t UNPACK_BLOCK = 256;
+
     inline void internalCouponUpdate(uint32_t coupon);
+
+    // the steps of unionHll: registers of a source of no smaller lg_k folded
+    // onto these, then its HLL_4 exceptions, then kxq and zeros recomputed
+    void unionRegisters(const uint8_t* packed, target_hll_type srcType, uint8_t srcLgK, uint8_t srcCurMin);
+    inline void unionException(uint32_t coupon);
+    void refreshRegisterSums();
 };
 
 }
@@ -132,6 +132,67 @@ HllArray<A>* HllArray<A>::newHll(const void* bytes, size_t len, const A& allocat
   return sketch;
 }
 
+template<typename A>
+void HllArray<A>::getSerializedBounds(const void* bytes, size_t len, uint8_t numStdDev,
+                                      double& estimate, double& lowerBound, double& upperBound) {
+  HllUtil<A>::checkNumStdDev(numStdDev);
+  if (len < hll_constants::HLL_BYTE_ARR_START) {
+    throw std::out_of_range("Input data length insufficient to hold HLL array");
+  }
+
+  const uint8_t* data = static_cast<const uint8_t*>(bytes);
+  if (data[hll_constants::PREAMBLE_INTS_BYTE] != hll_constants::HLL_PREINTS) {
+    throw std::invalid_argument("Incorrect number of preInts in input stream");
+  }
+  if (data[hll_constants::SER_VER_BYTE] != hll_constants::SER_VER) {
+    throw std::invalid_argument("Wrong ser ver in input stream");
+  }
+  if (data[hll_constants::FAMILY_BYTE] != hll_constants::FAMILY_ID) {
+    throw std::invalid_argument("Input array is not an HLL sketch");
+  }
+
+  const hll_mode mode = HllSketchImpl<A>::extractCurMode(data[hll_constants::MODE_BYTE]);
+  if (mode != HLL) {
+    throw std::invalid_argument("Calling HLL array constructor with non-HLL mode data");
+  }
+
+  const target_hll_type tgtHllType = HllSketchImpl<A>::extractTgtHllType(data[hll_constants::MODE_BYTE]);
+  const bool oooFlag = ((data[hll_constants::FLAGS_BYTE] & hll_constants::OUT_OF_ORDER_FLAG_MASK) ? true : false);
+  const bool compactFlag = ((data[hll_constants::FLAGS_BYTE] & hll_constants::COMPACT_FLAG_MASK) ? true : false);
+
+  const uint8_t lgK = data[hll_constants::LG_K_BYTE];
+  const uint8_t curMin = data[hll_constants::HLL_CUR_MIN_BYTE];
+
+  const uint32_t arrayBytes = hllArrBytes(tgtHllType, lgK);
+  if (len < static_cast<size_t>(hll_constants::HLL_BYTE_ARR_START + arrayBytes)) {
+    throw std::out_of_range("Input array too small to hold sketch image");
+  }
+
+  uint32_t auxCount;
+  std::memcpy(&auxCount, data + hll_constants::AUX_COUNT_INT, sizeof(int));
+  if (auxCount > 0) {
+    // the exceptions never change the estimate, but their image must be present
+    const size_t offset = hll_constants::HLL_BYTE_ARR_START + arrayBytes;
+    const size_t auxInts = compactFlag ? auxCount : (size_t(1) << data[hll_constants::LG_ARR_BYTE]);
+    if (len - offset < auxInts * sizeof(uint32_t)) {
+      throw std::out_of_range("Input array too small to hold AuxHashMap image");
+    }
+  }
+
+  uint32_t numAtCurMin;
+  std::memcpy(&numAtCurMin, data + hll_constants::CUR_MIN_COUNT_INT, sizeof(int));
+  if (!oooFlag) {
+    std::memcpy(&estimate, data + hll_constants::HIP_ACCUM_DOUBLE, sizeof(double));
+  } else {
+    double kxq0, kxq1;
+    std::memcpy(&kxq0, data + hll_constants::KXQ0_DOUBLE, sizeof(double));
+    std::memcpy(&kxq1, data + hll_constants::KXQ1_DOUBLE, sizeof(double));
+    estimate = compositeEstimate(lgK, kxq0, kxq1, curMin, numAtCurMin);
+  }
+  lowerBound = HllArray<A>::lowerBound(lgK, oooFlag, estimate, curMin, numAtCurMin, numStdDev);
+  upperBound = HllArray<A>::upperBound(lgK, oooFlag, estimate, numStdDev);
+}
+
 template<typename A>
 HllArray<A>* HllArray<A>::newHll(std::istream& is, const A& allocator) {
   uint8_t listHeader[8];
@@ -227,7 +288,7 @@ vector_u8<A> HllArray<A>::serialize(bool compact, unsigned header_size_bytes) co
           bytes += sizeof(coupon);
         }
       } else {
-        std::memcpy(bytes, auxHashMap->getAuxIntArr(), auxHashMap->getUpdatableSizeBytes());
+        auxHashMap->writeUpdatable(bytes);
       }
     } else if (!compact) {
       // if updatable, we write even if currently unused so the binary can be wrapped
@@ -284,7 +345,9 @@ void HllArray<A>::serialize(std::ostream& os, bool compact) const {
           write(os, coupon);
         }
       } else {
-        write(os, auxHashMap->getAuxIntArr(), auxHashMap->getUpdatableSizeBytes());
+        vector_u8<A> table(auxHashMap->getUpdatableSizeBytes(), 0, getAllocator());
+        auxHashMap->writeUpdatable(table.data());
+        write(os, table.data(), table.size());
       }
     } else if (!compact) {
       // if updatable, we write even if currently unused so the binary can be wrapped      
@@ -320,48 +383,43 @@ double HllArray<A>::getEstimate() const {
 template<typename A>
 double HllArray<A>::getLowerBound(uint8_t numStdDev) const {
   HllUtil<A>::checkNumStdDev(numStdDev);
-  const uint32_t configK = 1 << this->lgConfigK_;
-  const double numNonZeros = ((curMin_ == 0) ? (configK - numAtCurMin_) : configK);
+  const double estimate = oooFlag_ ? getCompositeEstimate() : hipAccum_;
+  return lowerBound(this->lgConfigK_, oooFlag_, estimate, curMin_, numAtCurMin_, numStdDev);
+}
 
-  double estimate;
-  double rseFactor;
-  if (oooFlag_) {
-    estimate = getCompositeEstimate();
-    rseFactor = hll_constants::HLL_NON_HIP_RSE_FACTOR;
-  } else {
-    estimate = hipAccum_;
-    rseFactor = hll_constants::HLL_HIP_RSE_FACTOR;
-  }
+template<typename A>
+double HllArray<A>::getUpperBound(uint8_t numStdDev) const {
+  HllUtil<A>::checkNumStdDev(numStdDev);
+  const double estimate = oooFlag_ ? getCompositeEstimate() : hipAccum_;
+  return upperBound(this->lgConfigK_, oooFlag_, estimate, numStdDev);
+}
+
+template<typename A>
+double HllArray<A>::lowerBound(uint8_t lgConfigK, bool oooFlag, double estimate,
+                               uint8_t curMin, uint32_t numAtCurMin, uint8_t numStdDev) {
+  const uint32_t configK = 1 << lgConfigK;
+  const double numNonZeros = ((curMin == 0) ? (configK - numAtCurMin) : configK);
+  const double rseFactor = oooFlag ? hll_constants::HLL_NON_HIP_RSE_FACTOR : hll_constants::HLL_HIP_RSE_FACTOR;
 
   double relErr;
-  if (this->lgConfigK_ > 12) {
+  if (lgConfigK > 12) {
     relErr = (numStdDev * rseFactor) / sqrt(configK);
   } else {
-    relErr = HllUtil<A>::getRelErr(false, oooFlag_, this->lgConfigK_, numStdDev);
+    relErr = HllUtil<A>::getRelErr(false, oooFlag, lgConfigK, numStdDev);
   }
   return fmax(estimate / (1.0 + relErr), numNonZeros);
 }
 
 template<typename A>
-double HllArray<A>::getUpperBound(uint8_t numStdDev) const {
-  HllUtil<A>::checkNumStdDev(numStdDev);
-  const uint32_t configK = 1 << this->lgConfigK_;
-
-  double estimate;
-  double rseFactor;
-  if (oooFlag_) {
-    estimate = getCompositeEstimate();
-    rseFactor = hll_constants::HLL_NON_HIP_RSE_FACTOR;
-  } else {
-    estimate = hipAccum_;
-    rseFactor = hll_constants::HLL_HIP_RSE_FACTOR;
-  }
+double HllArray<A>::upperBound(uint8_t lgConfigK, bool oooFlag, double estimate, uint8_t numStdDev) {
+  const uint32_t configK = 1 << lgConfigK;
+  const double rseFactor = oooFlag ? hll_constants::HLL_NON_HIP_RSE_FACTOR : hll_constants::HLL_HIP_RSE_FACTOR;
 
   double relErr;
-  if (this->lgConfigK_ > 12) {
+  if (lgConfigK > 12) {
     relErr = (-1.0) * (numStdDev * rseFactor) / sqrt(configK);
   } else {
-    relErr = HllUtil<A>::getRelErr(true, oooFlag_, this->lgConfigK_, numStdDev);
+    relErr = HllUtil<A>::getRelErr(true, oooFlag, lgConfigK, numStdDev);
   }
   return estimate / (1.0 + relErr);
 }
@@ -375,11 +433,17 @@ double HllArray<A>::getUpperBound(uint8_t numStdDev) const {
 // Original C: again-two-registers.c hhb_get_composite_estimate L1489
 template<typename A>
 double HllArray<A>::getCompositeEstimate() const {
-  const double rawEst = getHllRawEstimate();
+  return compositeEstimate(this->lgConfigK_, kxq0_, kxq1_, curMin_, numAtCurMin_);
+}
 
-  const double* xArr = CompositeInterpolationXTable<A>::get_x_arr(this->lgConfigK_);
+template<typename A>
+double HllArray<A>::compositeEstimate(uint8_t lgConfigK, double kxq0, double kxq1,
+                                      uint8_t curMin, uint32_t numAtCurMin) {
+  const double rawEst = getHllRawEstimate(lgConfigK, kxq0, kxq1);
+
+  const double* xArr = CompositeInterpolationXTable<A>::get_x_arr(lgConfigK);
   const uint32_t xArrLen = CompositeInterpolationXTable<A>::get_x_arr_length();
-  const double yStride = CompositeInterpolationXTable<A>::get_y_stride(this->lgConfigK_);
+  const double yStride = CompositeInterpolationXTable<A>::get_y_stride(lgConfigK);
 
   if (rawEst < xArr[0]) {
     return 0;
@@ -398,9 +462,9 @@ double HllArray<A>::getCompositeEstimate() const {
   // We need to completely avoid the linear_counting estimator if it might have a crazy value.
   // Empirical evidence suggests that the threshold 3*k will keep us safe if 2^4 <= k <= 2^21.
 
-  if (adjEst > (3 << this->lgConfigK_)) { return adjEst; }
+  if (adjEst > (3 << lgConfigK)) { return adjEst; }
 
-  const double linEst = getHllBitMapEstimate();
+  const double linEst = getHllBitMapEstimate(lgConfigK, curMin, numAtCurMin);
 
   // Bias is created when the value of an estimator is compared with a threshold to decide whether
   // to use that estimator or a different one.
@@ -412,10 +476,10 @@ double HllArray<A>::getCompositeEstimate() const {
   // The following constants comes from empirical measurements of the crossover point
   // between the average error of the linear estimator and the adjusted hll estimator
   double crossOver = 0.64;
-  if (this->lgConfigK_ == 4)      { crossOver = 0.718; }
-  else if (this->lgConfigK_ == 5) { crossOver = 0.672; }
+  if (lgConfigK == 4)      { crossOver = 0.718; }
+  else if (lgConfigK == 5) { crossOver = 0.672; }
 
-  return (avgEst > (crossOver * (1 << this->lgConfigK_))) ? adjEst : linEst;
+  return (avgEst > (crossOver * (1 << lgConfigK))) ? adjEst : linEst;
 }
 
 template<typename A>
@@ -443,6 +507,11 @@ uint32_t HllArray<A>::getNumAtCurMin() const {
   return numAtCurMin_;
 }
 
+template<typename A>
+const vector_u8<A>& HllArray<A>::getHllByteArr() const {
+  return hllByteArr_;
+}
+
 template<typename A>
 void HllArray<A>::putKxQ0(double kxq0) {
   kxq0_ = kxq0;
@@ -551,11 +620,33 @@ uint8_t HllArray<A>::getPreInts() const {
   return hll_constants::HLL_PREINTS;
 }
 
+template<typename A>
+size_t HllArray<A>::getMemoryUsageBytes() const {
+  AuxHashMap<A>* auxHashMap = getAuxHashMap();
+  const size_t auxBytes = ((auxHashMap == nullptr) ? 0 : auxHashMap->getMemoryUsageBytes());
+  return hllByteArr_.capacity() + auxBytes;
+}
+
 template<typename A>
 AuxHashMap<A>* HllArray<A>::getAuxHashMap() const {
   return nullptr;
 }
 
+template<typename A>
+void HllArray<A>::couponUpdateBlock(const uint32_t* coupons, size_t n) {
+  for (size_t i = 0; i < n; ++i) couponUpdate(coupons[i]);
+}
+
+template<typename A>
+void HllArray<A>::prefetchSlots(const uint32_t* coupons, size_t n, uint8_t lgSlotsPerByte) const {
+  if (hllByteArr_.size() <= (1u << PREFETCH_LG_BYTES)) return;
+  const uint32_t configKmask = (1 << this->lgConfigK_) - 1;
+  for (size_t i = 0; i < n; ++i) {
+    if (HllUtil<A>::getValue(coupons[i]) <= curMin_) continue;
+    __builtin_prefetch(&hllByteArr_[(HllUtil<A>::getLow26(coupons[i]) & configKmask) >> lgSlotsPerByte]);
+  }
+}
+
 template<typename A>
 void HllArray<A>::hipAndKxQIncrementalUpdate(uint8_t oldValue, uint8_t newValue) {
   const uint32_t configK = 1 << this->getLgConfigK();
@@ -575,9 +666,9 @@ void HllArray<A>::hipAndKxQIncrementalUpdate(uint8_t oldValue, uint8_t newValue)
  */
 //In C: again-two-registers.c hhb_get_improved_linear_counting_estimate L1274
 template<typename A>
-double HllArray<A>::getHllBitMapEstimate() const {
-  const uint32_t configK = 1 << this->lgConfigK_;
-  const uint32_t numUnhitBuckets = curMin_ == 0 ? numAtCurMin_ : 0;
+double HllArray<A>::getHllBitMapEstimate(uint8_t lgConfigK, uint8_t curMin, uint32_t numAtCurMin) {
+  const uint32_t configK = 1 << lgConfigK;
+  const uint32_t numUnhitBuckets = curMin == 0 ? numAtCurMin : 0;
 
   //This will eventually go away.
   if (numUnhitBuckets == 0) {
@@ -590,14 +681,14 @@ double HllArray<A>::getHllBitMapEstimate() const {
 
 //In C: again-two-registers.c hhb_get_raw_estimate L1167
 template<typename A>
-double HllArray<A>::getHllRawEstimate() const {
-  const uint32_t configK = 1 << this->lgConfigK_;
+double HllArray<A>::getHllRawEstimate(uint8_t lgConfigK, double kxq0, double kxq1) {
+  const uint32_t configK = 1 << lgConfigK;
   double correctionFactor;
-  if (this->lgConfigK_ == 4) { correctionFactor = 0.673; }
-  else if (this->lgConfigK_ == 5) { correctionFactor = 0.697; }
-  else if (this->lgConfigK_ == 6) { correctionFactor = 0.709; }
+  if (lgConfigK == 4) { correctionFactor = 0.673; }
+  else if (lgConfigK == 5) { correctionFactor = 0.697; }
+  else if (lgConfigK == 6) { correctionFactor = 0.709; }
   else { correctionFactor = 0.7213 / (1.0 + (1.079 / configK)); }
-  const double hyperEst = (correctionFactor * configK * configK) / (kxq0_ + kxq1_);
+  const double hyperEst = (correctionFactor * configK * configK) / (kxq0 + kxq1);
   return hyperEst;
 }
 
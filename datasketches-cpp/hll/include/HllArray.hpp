@@ -35,6 +35,8 @@ class HllArray : public HllSketchImpl<A> {
 
     static HllArray* newHll(const void* bytes, size_t len, const A& allocator);
     static HllArray* newHll(std::istream& is, const A& allocator);
+    static void getSerializedBounds(const void* bytes, size_t len, uint8_t numStdDev,
+                                    double& estimate, double& lowerBound, double& upperBound);
 
     virtual vector_u8<A> serialize(bool compact, unsigned header_size_bytes) const;
     virtual void serialize(std::ostream& os, bool compact) const;
@@ -46,6 +48,8 @@ class HllArray : public HllSketchImpl<A> {
     virtual HllArray* copyAs(target_hll_type tgtHllType) const;
 
     virtual HllSketchImpl<A>* couponUpdate(uint32_t coupon) = 0;
+    // couponUpdate() on each of n coupons in order, with no empty coupons among them
+    virtual void couponUpdateBlock(const uint32_t* coupons, size_t n);
 
     virtual double getEstimate() const;
     virtual double getCompositeEstimate() const;
@@ -61,9 +65,11 @@ class HllArray : public HllSketchImpl<A> {
     inline double getHipAccum() const;
 
     virtual uint32_t getHllByteArrBytes() const = 0;
+    inline const vector_u8<A>& getHllByteArr() const;
 
     virtual uint32_t getUpdatableSerializationBytes() const;
     virtual uint32_t getCompactSerializationBytes() const;
+    virtual size_t getMemoryUsageBytes() const;
 
     virtual bool isOutOfOrderFlag() const;
     virtual bool isEmpty() const;
@@ -98,8 +104,18 @@ class HllArray : public HllSketchImpl<A> {
 
   protected:
     void hipAndKxQIncrementalUpdate(uint8_t oldValue, uint8_t newValue);
-    double getHllBitMapEstimate() const;
-    double getHllRawEstimate() const;
+    // the slots of the coupons to update in a block, if the registers are too big to stay in cache
+    void prefetchSlots(const uint32_t* coupons, size_t n, uint8_t lgSlotsPerByte) const;
+
+    // register arrays of up to 2^PREFETCH_LG_BYTES bytes (128KB) are not prefetched
+    static const uint8_t PREFETCH_LG_BYTES = 17;
+    static double compositeEstimate(uint8_t lgConfigK, double kxq0, double kxq1,
+                                    uint8_t curMin, uint32_t numAtCurMin);
+    static double getHllBitMapEstimate(uint8_t lgConfigK, uint8_t curMin, uint32_t numAtCurMin);
+    static double getHllRawEstimate(uint8_t lgConfigK, double kxq0, double kxq1);
+    static double lowerBound(uint8_t lgConfigK, bool oooFlag, double estimate,
+                             uint8_t curMin, uint32_t numAtCurMin, uint8_t numStdDev);
+    static double upperBound(uint8_t lgConfigK, bool oooFlag, double estimate, uint8_t numStdDev);
 
     double hipAccum_;
     double kxq0_;
@@ -113,8 +129,13 @@ class HllArray : public HllSketchImpl<A> {
 };
 
 template<typename A>
-class HllArray<A>::const_iterator: public std::iterator<std::input_iterator_tag, uint32_t> {
+class HllArray<A>::const_iterator {
 public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = uint32_t;
+  using difference_type = std::ptrdiff_t;
+  using pointer = uint32_t*;
+  using reference = uint32_t&;
   const_iterator(const uint8_t* array, uint32_t array_slze, uint32_t index, target_hll_type hll_type, const AuxHashMap<A>* exceptions, uint8_t offset, bool all);
   const_iterator& operator++();
   bool operator!=(const const_iterator& other) const;
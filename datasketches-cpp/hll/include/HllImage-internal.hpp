@@ -0,0 +1,121 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _HLLIMAGE_INTERNAL_HPP_
+#define _HLLIMAGE_INTERNAL_HPP_
+
+#include "HllImage.hpp"
+#include "HllArray.hpp"
+#include "HllSketchImpl.hpp"
+
+#include <cstring>
+#include <stdexcept>
+#include <string>
+
+namespace datasketches {
+
+template<typename A>
+HllImage<A>::HllImage(const void* bytes, size_t len):
+data_(static_cast<const uint8_t*>(bytes)),
+mode_(LIST),
+tgtHllType_(HLL_4),
+lgConfigK_(0),
+curMin_(0),
+empty_(false),
+coupons_(nullptr),
+couponSlots_(0)
+{
+  if (len < hll_constants::LIST_INT_ARR_START) {
+    throw std::out_of_range("Input data length insufficient to hold HLL sketch");
+  }
+  if (data_[hll_constants::SER_VER_BYTE] != hll_constants::SER_VER) {
+    throw std::invalid_argument("Wrong ser ver in input stream");
+  }
+  if (data_[hll_constants::FAMILY_BYTE] != hll_constants::FAMILY_ID) {
+    throw std::invalid_argument("Input stream is not an HLL sketch");
+  }
+  mode_ = HllSketchImpl<A>::extractCurMode(data_[hll_constants::MODE_BYTE]);
+  tgtHllType_ = HllSketchImpl<A>::extractTgtHllType(data_[hll_constants::MODE_BYTE]);
+  lgConfigK_ = HllUtil<A>::checkLgK(data_[hll_constants::LG_K_BYTE]);
+  const bool compact = (data_[hll_constants::FLAGS_BYTE] & hll_constants::COMPACT_FLAG_MASK) != 0;
+
+  const uint8_t expectedPreInts = mode_ == LIST ? hll_constants::LIST_PREINTS
+      : mode_ == SET ? hll_constants::HASH_SET_PREINTS : hll_constants::HLL_PREINTS;
+  if (data_[hll_constants::PREAMBLE_INTS_BYTE] != expectedPreInts) {
+    throw std::invalid_argument("Incorrect number of preInts in input stream");
+  }
+
+  size_t couponStart;
+  if (mode_ == LIST) {
+    // a list is filled from the front, so only its first couponCount ints are coupons
+    couponStart = hll_constants::LIST_INT_ARR_START;
+    couponSlots_ = data_[hll_constants::LIST_COUNT_BYTE];
+    empty_ = (data_[hll_constants::FLAGS_BYTE] & hll_constants::EMPTY_FLAG_MASK) || couponSlots_ == 0;
+    if (empty_) couponSlots_ = 0;
+  } else if (mode_ == SET) {
+    if (len < hll_constants::HASH_SET_INT_ARR_START) {
+      throw std::out_of_range("Input data length insufficient to hold CouponHashSet");
+    }
+    if (lgConfigK_ <= 7) {
+      throw std::invalid_argument("Attempt to deserialize invalid CouponHashSet with lgConfigK <= 7. Found: "
+                                  + std::to_string(lgConfigK_));
+    }
+    uint32_t couponCount;
+    std::memcpy(&couponCount, data_ + hll_constants::HASH_SET_COUNT_INT, sizeof(couponCount));
+    uint8_t lgArrInts = data_[hll_constants::LG_ARR_BYTE];
+    if (lgArrInts < hll_constants::LG_INIT_SET_SIZE) {
+      lgArrInts = HllUtil<A>::computeLgArrInts(SET, couponCount, lgConfigK_);
+    }
+    couponStart = hll_constants::HASH_SET_INT_ARR_START;
+    couponSlots_ = compact ? couponCount : (1 << lgArrInts);
+    empty_ = couponCount == 0;
+  } else {
+    if (len < hll_constants::HLL_BYTE_ARR_START) {
+      throw std::out_of_range("Input data length insufficient to hold HLL array");
+    }
+    curMin_ = data_[hll_constants::HLL_CUR_MIN_BYTE];
+    uint32_t auxCount;
+    std::memcpy(&auxCount, data_ + hll_constants::AUX_COUNT_INT, sizeof(auxCount));
+    couponStart = hll_constants::HLL_BYTE_ARR_START + HllArray<A>::hllArrBytes(tgtHllType_, lgConfigK_);
+    // an updatable image keeps the whole exception table, sized in the LgArr byte
+    if (auxCount > 0) couponSlots_ = compact ? auxCount : (1 << data_[hll_constants::LG_ARR_BYTE]);
+  }
+
+  const size_t expectedLength = couponStart + couponSlots_ * sizeof(uint32_t);
+  if (len < expectedLength) {
+    throw std::out_of_range("Byte array too short for sketch. Expected " + std::to_string(expectedLength)
+                                + ", found: " + std::to_string(len));
+  }
+  coupons_ = data_ + couponStart;
+}
+
+template<typename A>
+template<typename F>
+void HllImage<A>::forEachCoupon(F f) const {
+  const uint8_t* ptr = coupons_;
+  for (uint32_t i = 0; i < couponSlots_; ++i, ptr += sizeof(uint32_t)) {
+    uint32_t coupon;
+    std::memcpy(&coupon, ptr, sizeof(coupon));
+    if (coupon != hll_constants::EMPTY) f(coupon);
+  }
+}
+
+}
+
+#endif // _HLLIMAGE_INTERNAL_HPP_
@@ -0,0 +1,68 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef _HLLIMAGE_HPP_
+#define _HLLIMAGE_HPP_
+
+#include "HllUtil.hpp"
+#include "hll.hpp" // for TgtHllType
+
+namespace datasketches {
+
+// A read-only view of a serialized sketch, compact or updatable, which reads
+// its registers and coupons where they lie instead of copying them into a
+// sketch as hll_sketch_alloc::deserialize does. The bytes must outlive it.
+template<typename A>
+class HllImage {
+  public:
+    // Checks the preamble, and that len covers all the image points at,
+    // throwing as deserialize does when either is wrong.
+    HllImage(const void* bytes, size_t len);
+
+    hll_mode getCurMode() const { return mode_; }
+    target_hll_type getTgtHllType() const { return tgtHllType_; }
+    uint8_t getLgConfigK() const { return lgConfigK_; }
+    bool isEmpty() const { return empty_; }
+
+    // In HLL mode, the packed registers and the offset they are stored from
+    uint8_t getCurMin() const { return curMin_; }
+    const uint8_t* getHllByteArr() const { return data_ + hll_constants::HLL_BYTE_ARR_START; }
+
+    // Calls f on each coupon of a LIST or SET image, or in HLL mode on each
+    // HLL_4 exception, as a coupon of its slot and value. Coupons may be
+    // unaligned, so each is copied out.
+    template<typename F>
+    void forEachCoupon(F f) const;
+
+  private:
+    const uint8_t* data_;
+    hll_mode mode_;
+    target_hll_type tgtHllType_;
+    uint8_t lgConfigK_;
+    uint8_t curMin_;
+    bool empty_;
+    // the coupons, or HLL_4 exceptions, and the slots they are stored in,
+    // of which the empty ones of a hash table are skipped
+    const uint8_t* coupons_;
+    uint32_t couponSlots_;
+};
+
+}
+
+#endif // _HLLIMAGE_HPP_
@@ -26,7 +26,9 @@
 #include "CouponList.hpp"
 #include "HllArray.hpp"
 #include "common_defs.hpp"
+#include "MurmurHash3_batch.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
@@ -64,6 +66,32 @@ hll_sketch_alloc<A> hll_sketch_alloc<A>::deserialize(const void* bytes, size_t l
   return hll_sketch_alloc<A>(impl);
 }
 
+template<typename A>
+double hll_sketch_alloc<A>::get_serialized_estimate(const void* bytes, size_t len) {
+  double estimate, lower_bound, upper_bound;
+  get_serialized_bounds(bytes, len, 1, estimate, lower_bound, upper_bound);
+  return estimate;
+}
+
+template<typename A>
+void hll_sketch_alloc<A>::get_serialized_bounds(const void* bytes, size_t len, uint8_t num_std_dev,
+                                                double& estimate, double& lower_bound, double& upper_bound) {
+  if (len < 1) {
+    throw std::out_of_range("Input data length insufficient to hold HLL sketch");
+  }
+  // dispatch on the preamble ints as HllSketchImplFactory::deserialize() does
+  const uint8_t preInts = static_cast<const uint8_t*>(bytes)[0];
+  if (preInts == hll_constants::HLL_PREINTS) {
+    HllArray<A>::getSerializedBounds(bytes, len, num_std_dev, estimate, lower_bound, upper_bound);
+  } else if (preInts == hll_constants::HASH_SET_PREINTS) {
+    CouponHashSet<A>::getSerializedBounds(bytes, len, num_std_dev, estimate, lower_bound, upper_bound);
+  } else if (preInts == hll_constants::LIST_PREINTS) {
+    CouponList<A>::getSerializedBounds(bytes, len, num_std_dev, estimate, lower_bound, upper_bound);
+  } else {
+    throw std::invalid_argument("Attempt to deserialize unknown object type");
+  }
+}
+
 template<typename A>
 hll_sketch_alloc<A>::~hll_sketch_alloc() {
   if (sketch_impl != nullptr) {
@@ -211,6 +239,61 @@ void hll_sketch_alloc<A>::update(const void* data, size_t lengthBytes) {
   coupon_update(HllUtil<A>::coupon(hashResult));
 }
 
+template<typename A>
+void hll_sketch_alloc<A>::update_batch(const uint64_t* values, size_t n) {
+  HashState hashes[murmur_batch::CHUNK_SIZE];
+  uint32_t coupons[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    MurmurHash3_x64_128_batch_u64(values, chunk, DEFAULT_SEED, hashes);
+    for (size_t i = 0; i < chunk; ++i) coupons[i] = HllUtil<A>::coupon(hashes[i]);
+    coupon_update_block(coupons, chunk);
+    values += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+void hll_sketch_alloc<A>::update_batch_16(const void* keys, size_t n) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(keys);
+  HashState hashes[murmur_batch::CHUNK_SIZE];
+  uint32_t coupons[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    MurmurHash3_x64_128_batch_16(bytes, chunk, DEFAULT_SEED, hashes);
+    for (size_t i = 0; i < chunk; ++i) coupons[i] = HllUtil<A>::coupon(hashes[i]);
+    coupon_update_block(coupons, chunk);
+    bytes += 16 * chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+template<typename H>
+void hll_sketch_alloc<A>::update_hashes(const H* hashes, size_t n) {
+  uint32_t coupons[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    for (size_t i = 0; i < chunk; ++i) {
+      HashState hash;
+      hash.h1 = hashes[i].h1;
+      hash.h2 = hashes[i].h2;
+      coupons[i] = HllUtil<A>::coupon(hash);
+    }
+    coupon_update_block(coupons, chunk);
+    hashes += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+void hll_sketch_alloc<A>::coupon_update_block(const uint32_t* coupons, size_t n) {
+  size_t i = 0;
+  while (i < n && sketch_impl->getCurMode() != HLL) coupon_update(coupons[i++]);
+  // HLL mode is final, so the array takes the rest without being replaced
+  if (i < n) static_cast<HllArray<A>*>(sketch_impl)->couponUpdateBlock(coupons + i, n - i);
+}
+
 template<typename A>
 void hll_sketch_alloc<A>::coupon_update(uint32_t coupon) {
   if (coupon == hll_constants::EMPTY) { return; }
@@ -396,6 +479,11 @@ uint32_t hll_sketch_alloc<A>::get_compact_serialization_bytes() const {
   return sketch_impl->getCompactSerializationBytes();
 }
 
+template<typename A>
+size_t hll_sketch_alloc<A>::get_memory_usage_bytes() const {
+  return sketch_impl->getMemoryUsageBytes();
+}
+
 template<typename A>
 bool hll_sketch_alloc<A>::is_compact() const {
   return sketch_impl->isCompact();
@@ -61,6 +61,8 @@ class HllSketchImpl {
 
     virtual uint32_t getUpdatableSerializationBytes() const = 0;
     virtual uint32_t getCompactSerializationBytes() const = 0;
+    // heap bytes held by the coupon or register arrays, and any aux map
+    virtual size_t getMemoryUsageBytes() const = 0;
 
     virtual bool isCompact() const = 0;
     virtual bool isEmpty() const = 0;
@@ -70,6 +72,9 @@ class HllSketchImpl {
     bool isStartFullSize() const;
 
   protected:
+    // which reads the mode byte of the images it views
+    template<typename> friend class HllImage;
+
     static target_hll_type extractTgtHllType(uint8_t modeByte);
     static hll_mode extractCurMode(uint8_t modeByte);
     uint8_t makeFlagsByte(bool compact) const;
@@ -28,6 +28,7 @@
 #include "Hll4Array.hpp"
 #include "Hll6Array.hpp"
 #include "Hll8Array.hpp"
+#include "event_counters.hpp"
 
 namespace datasketches {
 
@@ -47,10 +48,13 @@ public:
   static Hll4Array<A>* convertToHll4(const HllArray<A>& srcHllArr);
   static Hll6Array<A>* convertToHll6(const HllArray<A>& srcHllArr);
   static Hll8Array<A>* convertToHll8(const HllArray<A>& srcHllArr);
+
+  static const size_t PROMOTE_BLOCK = 64;
 };
 
 template<typename A>
 CouponHashSet<A>* HllSketchImplFactory<A>::promoteListToSet(const CouponList<A>& list) {
+  DATASKETCHES_COUNT_EVENT(HLL_LIST_TO_SET);
   using ChsAlloc = typename std::allocator_traits<A>::template rebind_alloc<CouponHashSet<A>>;
   CouponHashSet<A>* chSet = new (ChsAlloc(list.getAllocator()).allocate(1)) CouponHashSet<A>(list.getLgConfigK(), list.getTgtHllType(), list.getAllocator());
   for (const auto coupon: list) {
@@ -61,11 +65,23 @@ CouponHashSet<A>* HllSketchImplFactory<A>::promoteListToSet(const CouponList<A>&
 
 template<typename A>
 HllArray<A>* HllSketchImplFactory<A>::promoteListOrSetToHll(const CouponList<A>& src) {
+  DATASKETCHES_COUNT_EVENT(HLL_TO_ARRAY);
   HllArray<A>* tgtHllArr = HllSketchImplFactory<A>::newHll(src.getLgConfigK(), src.getTgtHllType(), false, src.getAllocator());
   tgtHllArr->putKxQ0(1 << src.getLgConfigK());
+  // the HIP accumulator is replaced below, so it is not tracked meanwhile
+  tgtHllArr->putOutOfOrderFlag(true);
+  // the coupons go in blocks, in the same order as one at a time, so that
+  // the array can prefetch their registers
+  uint32_t block[PROMOTE_BLOCK];
+  size_t n = 0;
   for (const auto coupon: src) {
-    tgtHllArr->couponUpdate(coupon);
+    block[n++] = coupon;
+    if (n == PROMOTE_BLOCK) {
+      tgtHllArr->couponUpdateBlock(block, n);
+      n = 0;
+    }
   }
+  tgtHllArr->couponUpdateBlock(block, n);
   tgtHllArr->putHipAccum(src.getEstimate());
   tgtHllArr->putOutOfOrderFlag(false);
   return tgtHllArr;
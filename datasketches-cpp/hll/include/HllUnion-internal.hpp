@@ -24,6 +24,7 @@
 
 #include "HllSketchImpl.hpp"
 #include "HllArray.hpp"
+#include "HllImage.hpp"
 #include "HllUtil.hpp"
 
 #include <stdexcept>
@@ -59,6 +60,35 @@ void hll_union_alloc<A>::update(hll_sketch_alloc<A>&& sketch) {
   union_impl(sketch, lg_max_k_);
 }
 
+template<typename A>
+void hll_union_alloc<A>::update_serialized(const void* bytes, size_t len) {
+  const HllImage<A> image(bytes, len);
+  if (image.isEmpty()) return;
+  if (image.getCurMode() != HLL) {
+    // coupons land in the gadget just as union_impl would put them there
+    HllSketchImpl<A>* dst_impl = gadget_.sketch_impl;
+    image.forEachCoupon([&dst_impl](uint32_t coupon) {
+      dst_impl = leak_free_coupon_update(dst_impl, coupon); //assignment required
+    });
+    gadget_.sketch_impl = dst_impl;
+    return;
+  }
+  HllSketchImpl<A>* dst_impl = gadget_.sketch_impl;
+  if (dst_impl->isEmpty() || dst_impl->getCurMode() != HLL) {
+    // the gadget is replaced by a copy of the source anyway
+    update(hll_sketch_alloc<A>::deserialize(bytes, len, dst_impl->getAllocator()));
+    return;
+  }
+  if (image.getLgConfigK() < dst_impl->getLgConfigK()) {
+    dst_impl = copy_or_downsample(dst_impl, image.getLgConfigK());
+    gadget_.sketch_impl->get_deleter()(gadget_.sketch_impl); // gadget to be replaced
+    gadget_.sketch_impl = dst_impl;
+  }
+  static_cast<Hll8Array<A>*>(dst_impl)->unionImage(image);
+  dst_impl->putOutOfOrderFlag(true);
+  static_cast<Hll8Array<A>*>(dst_impl)->putHipAccum(0);
+}
+
 template<typename A>
 void hll_union_alloc<A>::update(const std::string& datum) {
   gadget_.update(datum);
@@ -246,7 +276,7 @@ void hll_union_alloc<A>::union_impl(const hll_sketch_alloc<A>& sketch, uint8_t l
         gadget_.sketch_impl->get_deleter()(gadget_.sketch_impl); // gadget to be replaced
       }
       const HllArray<A>* src = static_cast<const HllArray<A>*>(src_impl);
-      static_cast<Hll8Array<A>*>(dst_impl)->mergeHll(*src);
+      static_cast<Hll8Array<A>*>(dst_impl)->unionHll(*src);
       dst_impl->putOutOfOrderFlag(true);
       static_cast<Hll8Array<A>*>(dst_impl)->putHipAccum(0);
     }
@@ -0,0 +1,103 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// The probe of AuxHashMap, which keeps a 16-bit tag per HLL_4 exception in
+// groups of 16 and compares a whole group against the tag it looks for at once:
+// in one instruction with AVX2, two with SSE2 (always there on x86-64) or NEON.
+//
+// Unlike the other kernels, this one is not picked at runtime: it is a handful
+// of instructions on every update that hits an exception, and a call into an
+// AVX2 function that cannot be inlined costs more than the second SSE2 compare
+// it saves. AVX2 is used when the library is built for it (-mavx2 or
+// -march=native).
+
+#ifndef AUX_TAG_OPS_HPP_
+#define AUX_TAG_OPS_HPP_
+
+#include <cstdint>
+
+#include "cpu_features.hpp"
+
+namespace datasketches {
+
+namespace aux_tag_ops {
+
+static const unsigned GROUP_LANES = 16;
+
+inline uint32_t portable_match(const uint16_t* tags, uint16_t tag) {
+  uint32_t mask = 0;
+  for (unsigned i = 0; i < GROUP_LANES; ++i) mask |= static_cast<uint32_t>(tags[i] == tag) << i;
+  return mask;
+}
+
+#ifdef DATASKETCHES_X86
+
+inline uint32_t sse2_match(const uint16_t* tags, uint16_t tag) {
+  const __m128i needle = _mm_set1_epi16(static_cast<short>(tag));
+  const __m128i lo = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tags)), needle);
+  const __m128i hi = _mm_cmpeq_epi16(_mm_loadu_si128(reinterpret_cast<const __m128i*>(tags + 8)), needle);
+  return static_cast<uint32_t>(_mm_movemask_epi8(_mm_packs_epi16(lo, hi)));
+}
+
+#ifdef __AVX2__
+
+// Packing works within each 128-bit half, so lanes 0-7 land in bits 0-7 of the
+// byte mask and lanes 8-15 in bits 16-23.
+inline uint32_t avx2_match(const uint16_t* tags, uint16_t tag) {
+  const __m256i eq = _mm256_cmpeq_epi16(_mm256_loadu_si256(reinterpret_cast<const __m256i*>(tags)),
+                                        _mm256_set1_epi16(static_cast<short>(tag)));
+  const uint32_t bytes = static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_packs_epi16(eq, eq)));
+  return (bytes & 0xff) | ((bytes >> 8) & 0xff00);
+}
+
+#endif // __AVX2__
+
+#endif // DATASKETCHES_X86
+
+#ifdef DATASKETCHES_NEON
+
+inline uint32_t neon_match(const uint16_t* tags, uint16_t tag) {
+  static const uint16_t BITS[8] = {1, 2, 4, 8, 16, 32, 64, 128};
+  const uint16x8_t bits = vld1q_u16(BITS);
+  const uint16x8_t needle = vdupq_n_u16(tag);
+  const uint32_t lo = vaddvq_u16(vandq_u16(vceqq_u16(vld1q_u16(tags), needle), bits));
+  const uint32_t hi = vaddvq_u16(vandq_u16(vceqq_u16(vld1q_u16(tags + 8), needle), bits));
+  return lo | (hi << 8);
+}
+
+#endif // DATASKETCHES_NEON
+
+} // namespace aux_tag_ops
+
+// Bit i of the result is set if tags[i] == tag, for the GROUP_LANES tags of a group.
+inline uint32_t match_aux_tags(const uint16_t* tags, uint16_t tag) {
+#if defined(DATASKETCHES_X86) && defined(__AVX2__)
+  return aux_tag_ops::avx2_match(tags, tag);
+#elif defined(DATASKETCHES_X86)
+  return aux_tag_ops::sse2_match(tags, tag);
+#elif defined(DATASKETCHES_NEON)
+  return aux_tag_ops::neon_match(tags, tag);
+#else
+  return aux_tag_ops::portable_match(tags, tag);
+#endif
+}
+
+} /* namespace datasketches */
+
+#endif
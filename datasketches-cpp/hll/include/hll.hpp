@@ -149,6 +149,32 @@ class hll_sketch_alloc final {
      */
     static hll_sketch_alloc deserialize(const void* bytes, size_t len, const A& allocator = A());
 
+    /**
+     * Computes the cardinality estimate of a serialized sketch without reconstructing it.
+     * Only the header is read, since it holds everything the estimate needs, but the
+     * whole array is validated as by deserialize() except for the register contents.
+     * The result equals deserialize(bytes, len).get_estimate().
+     * @param bytes An input array with a binary image of a sketch
+     * @param len Length of the input array, in bytes
+     * @return the cardinality estimate
+     */
+    static double get_serialized_estimate(const void* bytes, size_t len);
+
+    /**
+     * Computes the estimate and bounds of a serialized sketch without reconstructing it,
+     * reading and validating the array as get_serialized_estimate() does. The results
+     * equal those of get_estimate(), get_lower_bound() and get_upper_bound() on
+     * deserialize(bytes, len).
+     * @param bytes An input array with a binary image of a sketch
+     * @param len Length of the input array, in bytes
+     * @param num_std_dev Number of standard deviations for the bounds, from 1 to 3
+     * @param estimate Set to the cardinality estimate
+     * @param lower_bound Set to the approximate lower bound
+     * @param upper_bound Set to the approximate upper bound
+     */
+    static void get_serialized_bounds(const void* bytes, size_t len, uint8_t num_std_dev,
+                                      double& estimate, double& lower_bound, double& upper_bound);
+
     //! Class destructor
     virtual ~hll_sketch_alloc();
 
@@ -281,6 +307,34 @@ class hll_sketch_alloc final {
      */
     void update(const void* data, size_t length_bytes);
 
+    /**
+     * Update this sketch with n uint64_t values.
+     * Equivalent to calling update(uint64_t) on each value in turn,
+     * but the hashes are computed several at a time.
+     * @param values pointer to the values
+     * @param n number of values
+     */
+    void update_batch(const uint64_t* values, size_t n);
+
+    /**
+     * Update this sketch with n consecutive 16-byte keys.
+     * Equivalent to calling update(const void*, size_t) on each 16-byte key in turn,
+     * but the hashes are computed several at a time.
+     * @param keys pointer to the first key
+     * @param n number of keys
+     */
+    void update_batch_16(const void* keys, size_t n);
+
+    /**
+     * Update this sketch with n items already hashed by MurmurHash3_x64_128 with this
+     * sketch's seed, which is always DEFAULT_SEED. Equivalent to calling update(const void*, size_t) on each
+     * item in turn, so an item hashed once can update several sketches.
+     * @param hashes pointer to the hashes, of any type with the h1 and h2 of HashState
+     * @param n number of hashes
+     */
+    template<typename H>
+    void update_hashes(const H* hashes, size_t n);
+
     /**
      * Returns the current cardinality estimate
      * @return the cardinality estimate
@@ -352,6 +406,13 @@ class hll_sketch_alloc final {
      */
     uint32_t get_updatable_serialization_bytes() const;
 
+    /**
+     * Returns the heap memory held by the sketch's coupon list or set, or by its
+     * register array and any auxiliary exceptions map for HLL_4.
+     * @return Size of the sketch's arrays in memory, in bytes.
+     */
+    size_t get_memory_usage_bytes() const;
+
     /**
      * Returns the maximum size in bytes that this sketch can grow to
      * given lg_config_k.  However, for the HLL_4 sketch type, this
@@ -382,6 +443,9 @@ class hll_sketch_alloc final {
     explicit hll_sketch_alloc(HllSketchImpl<A>* that);
 
     void coupon_update(uint32_t coupon);
+    // coupon_update() on each coupon in turn, handing the run that follows
+    // the switch to HLL mode to the array in one call
+    void coupon_update_block(const uint32_t* coupons, size_t n);
 
     std::string type_as_string() const;
     std::string mode_as_string() const;
@@ -511,6 +575,16 @@ class hll_union_alloc {
      * @param The given sketch.
      */
     void update(hll_sketch_alloc<A>&& sketch);
+
+    /**
+     * Update this union operator with the sketch serialized in the given bytes,
+     * compact or updatable, as update(deserialize(bytes, len)) would.
+     * Registers and coupons are read in place rather than copied into a sketch
+     * first, except for the sketch that starts the union off.
+     * @param bytes The serialized sketch.
+     * @param len The length of the serialized sketch in bytes.
+     */
+    void update_serialized(const void* bytes, size_t len);
   
     /**
      * Present the given std::string as a potential unique item.
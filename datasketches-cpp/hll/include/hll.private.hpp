@@ -11,6 +11,7 @@
 #include "Hll6Array.hpp"
 #include "Hll8Array.hpp"
 #include "HllArray.hpp"
+#include "HllImage.hpp"
 #include "HllSketchImpl.hpp"
 #include "HllSketchImplFactory.hpp"
 #include "HllUtil.hpp"
@@ -24,6 +25,7 @@
 #include "Hll6Array-internal.hpp"
 #include "Hll8Array-internal.hpp"
 #include "HllArray-internal.hpp"
+#include "HllImage-internal.hpp"
 #include "HllSketch-internal.hpp"
 #include "HllSketchImpl-internal.hpp"
 #include "HllUnion-internal.hpp"
@@ -0,0 +1,285 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Kernels over HLL register arrays, used when a union merges a sketch's
+// registers into its HLL_8 gadget: unpacking HLL_4 and HLL_6 registers to one
+// byte each, taking the bytewise maximum, and summarizing the result.
+//
+// On x86-64 (GCC/Clang) AVX2 kernels are picked at runtime, so the library
+// still builds without any -m flags; on AArch64 NEON is always there. Every
+// kernel computes exactly what the portable loop does.
+
+#ifndef HLL_REGISTER_OPS_HPP_
+#define HLL_REGISTER_OPS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#include "cpu_features.hpp"
+
+namespace datasketches {
+
+// The terms of the raw HLL estimate over a register array: the sums of
+// 2^-register over the registers below 32 and those from 32 up, kept apart as
+// HllArray does for precision, and the number of registers still zero.
+struct hll_register_sums {
+  double kxq0;
+  double kxq1;
+  uint32_t num_zeros;
+};
+
+namespace register_ops {
+
+// The sums are accumulated in four lanes, register i going to lane i % 4, so
+// that every kernel adds the same terms in the same order.
+static const unsigned SUM_LANES = 4;
+
+inline void portable_max(uint8_t* dst, const uint8_t* src, size_t n) {
+  for (size_t i = 0; i < n; ++i) dst[i] = src[i] > dst[i] ? src[i] : dst[i];
+}
+
+// Register i is nibble i % 2 of byte i / 2, low nibble first. n is even.
+inline void portable_unpack4(const uint8_t* packed, size_t n, uint8_t cur_min, uint8_t* out) {
+  for (size_t i = 0; i < n; i += 2) {
+    const uint8_t byte = packed[i >> 1];
+    out[i] = static_cast<uint8_t>((byte & 0x0f) + cur_min);
+    out[i + 1] = static_cast<uint8_t>((byte >> 4) + cur_min);
+  }
+}
+
+// Registers 4j to 4j + 3 are the 24 bits of bytes 3j to 3j + 2, low bits
+// first. n is a multiple of 4.
+inline void portable_unpack6(const uint8_t* packed, size_t n, uint8_t* out) {
+  for (size_t i = 0; i < n; i += 4) {
+    const uint8_t* p = packed + 3 * (i >> 2);
+    const uint32_t bits = p[0] | (static_cast<uint32_t>(p[1]) << 8) | (static_cast<uint32_t>(p[2]) << 16);
+    out[i] = bits & 0x3f;
+    out[i + 1] = (bits >> 6) & 0x3f;
+    out[i + 2] = (bits >> 12) & 0x3f;
+    out[i + 3] = (bits >> 18) & 0x3f;
+  }
+}
+
+// 2^-v for a register value v < 64, built from its exponent bits
+inline double inv_pow2(uint8_t v) {
+  const uint64_t bits = static_cast<uint64_t>(1023 - v) << 52;
+  double d;
+  memcpy(&d, &bits, sizeof(d));
+  return d;
+}
+
+// Continues the lane sums from register offset, a multiple of SUM_LANES.
+inline void portable_sums(const uint8_t* regs, size_t offset, size_t n, double* lanes0, double* lanes1, uint32_t& num_zeros) {
+  for (size_t i = offset; i < n; ++i) {
+    const uint8_t v = regs[i];
+    const double p = inv_pow2(v);
+    lanes0[i % SUM_LANES] += v < 32 ? p : 0.0;
+    lanes1[i % SUM_LANES] += v < 32 ? 0.0 : p;
+    num_zeros += v == 0;
+  }
+}
+
+inline hll_register_sums finish_sums(const double* lanes0, const double* lanes1, uint32_t num_zeros) {
+  return {(lanes0[0] + lanes0[1]) + (lanes0[2] + lanes0[3]),
+          (lanes1[0] + lanes1[1]) + (lanes1[2] + lanes1[3]),
+          num_zeros};
+}
+
+#ifdef DATASKETCHES_X86
+
+#define HLL_REGISTER_AVX2 __attribute__((target("avx2,popcnt")))
+
+HLL_REGISTER_AVX2 inline void avx2_max(uint8_t* dst, const uint8_t* src, size_t n) {
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    __m256i* d = reinterpret_cast<__m256i*>(dst + i);
+    const __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src + i));
+    _mm256_storeu_si256(d, _mm256_max_epu8(_mm256_loadu_si256(d), s));
+  }
+  portable_max(dst + i, src + i, n - i);
+}
+
+// Unpacking within each 128-bit lane leaves registers 0-15 and 32-47 in one
+// vector and 16-31 and 48-63 in the other, which the permutes put in order.
+HLL_REGISTER_AVX2 inline void avx2_unpack4(const uint8_t* packed, size_t n, uint8_t cur_min, uint8_t* out) {
+  const __m256i low_nibbles = _mm256_set1_epi8(0x0f);
+  const __m256i min = _mm256_set1_epi8(static_cast<char>(cur_min));
+  size_t i = 0;
+  for (; i + 64 <= n; i += 64) {
+    const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(packed + (i >> 1)));
+    const __m256i lo = _mm256_and_si256(bytes, low_nibbles);
+    const __m256i hi = _mm256_and_si256(_mm256_srli_epi16(bytes, 4), low_nibbles);
+    const __m256i a = _mm256_unpacklo_epi8(lo, hi);
+    const __m256i b = _mm256_unpackhi_epi8(lo, hi);
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), _mm256_add_epi8(_mm256_permute2x128_si256(a, b, 0x20), min));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i + 32), _mm256_add_epi8(_mm256_permute2x128_si256(a, b, 0x31), min));
+  }
+  portable_unpack4(packed + (i >> 1), n - i, cur_min, out + i);
+}
+
+// Each 128-bit lane takes 12 packed bytes, spreads every 3 of them into a
+// 32-bit word, and shifts out its 4 registers, one per byte of the word.
+// Loads are 16 bytes wide, so the last groups are left to the portable loop.
+HLL_REGISTER_AVX2 inline void avx2_unpack6(const uint8_t* packed, size_t n, uint8_t* out) {
+  const __m256i spread = _mm256_setr_epi8(
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1,
+      0, 1, 2, -1, 3, 4, 5, -1, 6, 7, 8, -1, 9, 10, 11, -1);
+  const __m256i mask = _mm256_set1_epi32(0x3f);
+  size_t i = 0;
+  for (; i + 40 <= n; i += 32) {
+    const uint8_t* p = packed + 3 * (i >> 2);
+    const __m128i lo = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+    const __m128i hi = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p + 12));
+    const __m256i words = _mm256_shuffle_epi8(_mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1), spread);
+    const __m256i r0 = _mm256_and_si256(words, mask);
+    const __m256i r1 = _mm256_and_si256(_mm256_srli_epi32(words, 6), mask);
+    const __m256i r2 = _mm256_and_si256(_mm256_srli_epi32(words, 12), mask);
+    const __m256i r3 = _mm256_and_si256(_mm256_srli_epi32(words, 18), mask);
+    const __m256i regs = _mm256_or_si256(_mm256_or_si256(r0, _mm256_slli_epi32(r1, 8)),
+                                         _mm256_or_si256(_mm256_slli_epi32(r2, 16), _mm256_slli_epi32(r3, 24)));
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), regs);
+  }
+  portable_unpack6(packed + 3 * (i >> 2), n - i, out + i);
+}
+
+// 2^-v is built from its exponent bits, four registers widened to 64-bit lanes
+// at a time, and lane l of each accumulator only ever sees registers i % 4 = l.
+HLL_REGISTER_AVX2 inline hll_register_sums avx2_sums(const uint8_t* regs, size_t n) {
+  const __m256i bias = _mm256_set1_epi64x(1023);
+  const __m256i split = _mm256_set1_epi64x(32);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256d acc0 = _mm256_setzero_pd();
+  __m256d acc1 = _mm256_setzero_pd();
+  uint32_t num_zeros = 0;
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const __m256i bytes = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(regs + i));
+    num_zeros += _mm_popcnt_u32(static_cast<uint32_t>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(bytes, zero))));
+    for (unsigned j = 0; j < 32; j += 4) {
+      int32_t four;
+      memcpy(&four, regs + i + j, sizeof(four));
+      const __m256i v = _mm256_cvtepu8_epi64(_mm_cvtsi32_si128(four));
+      const __m256d p = _mm256_castsi256_pd(_mm256_slli_epi64(_mm256_sub_epi64(bias, v), 52));
+      const __m256d low = _mm256_castsi256_pd(_mm256_cmpgt_epi64(split, v));
+      acc0 = _mm256_add_pd(acc0, _mm256_and_pd(low, p));
+      acc1 = _mm256_add_pd(acc1, _mm256_andnot_pd(low, p));
+    }
+  }
+  double lanes0[SUM_LANES];
+  double lanes1[SUM_LANES];
+  _mm256_storeu_pd(lanes0, acc0);
+  _mm256_storeu_pd(lanes1, acc1);
+  portable_sums(regs, i, n, lanes0, lanes1, num_zeros);
+  return finish_sums(lanes0, lanes1, num_zeros);
+}
+
+#undef HLL_REGISTER_AVX2
+
+#endif // DATASKETCHES_X86
+
+#ifdef DATASKETCHES_NEON
+
+inline void neon_max(uint8_t* dst, const uint8_t* src, size_t n) {
+  size_t i = 0;
+  for (; i + 16 <= n; i += 16) vst1q_u8(dst + i, vmaxq_u8(vld1q_u8(dst + i), vld1q_u8(src + i)));
+  portable_max(dst + i, src + i, n - i);
+}
+
+inline void neon_unpack4(const uint8_t* packed, size_t n, uint8_t cur_min, uint8_t* out) {
+  const uint8x16_t min = vdupq_n_u8(cur_min);
+  size_t i = 0;
+  for (; i + 32 <= n; i += 32) {
+    const uint8x16_t bytes = vld1q_u8(packed + (i >> 1));
+    const uint8x16x2_t regs = vzipq_u8(vandq_u8(bytes, vdupq_n_u8(0x0f)), vshrq_n_u8(bytes, 4));
+    vst1q_u8(out + i, vaddq_u8(regs.val[0], min));
+    vst1q_u8(out + i + 16, vaddq_u8(regs.val[1], min));
+  }
+  portable_unpack4(packed + (i >> 1), n - i, cur_min, out + i);
+}
+
+// As avx2_unpack6, a table lookup with out of range indices giving zero bytes.
+inline void neon_unpack6(const uint8_t* packed, size_t n, uint8_t* out) {
+  static const uint8_t SPREAD[16] = {0, 1, 2, 0xff, 3, 4, 5, 0xff, 6, 7, 8, 0xff, 9, 10, 11, 0xff};
+  const uint8x16_t spread = vld1q_u8(SPREAD);
+  const uint32x4_t mask = vdupq_n_u32(0x3f);
+  size_t i = 0;
+  for (; i + 24 <= n; i += 16) {
+    const uint32x4_t words = vreinterpretq_u32_u8(vqtbl1q_u8(vld1q_u8(packed + 3 * (i >> 2)), spread));
+    const uint32x4_t r0 = vandq_u32(words, mask);
+    const uint32x4_t r1 = vandq_u32(vshrq_n_u32(words, 6), mask);
+    const uint32x4_t r2 = vandq_u32(vshrq_n_u32(words, 12), mask);
+    const uint32x4_t r3 = vandq_u32(vshrq_n_u32(words, 18), mask);
+    const uint32x4_t regs = vorrq_u32(vorrq_u32(r0, vshlq_n_u32(r1, 8)), vorrq_u32(vshlq_n_u32(r2, 16), vshlq_n_u32(r3, 24)));
+    vst1q_u8(out + i, vreinterpretq_u8_u32(regs));
+  }
+  portable_unpack6(packed + 3 * (i >> 2), n - i, out + i);
+}
+
+#endif // DATASKETCHES_NEON
+
+} // namespace register_ops
+
+// dst[i] = max(dst[i], src[i]) for the n registers
+inline void max_registers(uint8_t* dst, const uint8_t* src, size_t n) {
+#if defined(DATASKETCHES_X86)
+  if (cpu::best_isa() >= cpu::isa::AVX2) return register_ops::avx2_max(dst, src, n);
+#elif defined(DATASKETCHES_NEON)
+  return register_ops::neon_max(dst, src, n);
+#endif
+  register_ops::portable_max(dst, src, n);
+}
+
+// Writes the first n HLL_4 registers to out, one per byte, each offset by
+// cur_min. Registers holding AUX_TOKEN come out as AUX_TOKEN + cur_min, a lower
+// bound on their actual value in the aux map. n is even.
+inline void unpack_hll4_registers(const uint8_t* packed, size_t n, uint8_t cur_min, uint8_t* out) {
+#if defined(DATASKETCHES_X86)
+  if (cpu::best_isa() >= cpu::isa::AVX2) return register_ops::avx2_unpack4(packed, n, cur_min, out);
+#elif defined(DATASKETCHES_NEON)
+  return register_ops::neon_unpack4(packed, n, cur_min, out);
+#endif
+  register_ops::portable_unpack4(packed, n, cur_min, out);
+}
+
+// Writes the first n HLL_6 registers to out, one per byte. n is a multiple of 4.
+inline void unpack_hll6_registers(const uint8_t* packed, size_t n, uint8_t* out) {
+#if defined(DATASKETCHES_X86)
+  if (cpu::best_isa() >= cpu::isa::AVX2) return register_ops::avx2_unpack6(packed, n, out);
+#elif defined(DATASKETCHES_NEON)
+  return register_ops::neon_unpack6(packed, n, out);
+#endif
+  register_ops::portable_unpack6(packed, n, out);
+}
+
+// Sums 2^-register over the n HLL_8 registers and counts the zero ones.
+inline hll_register_sums sum_registers(const uint8_t* regs, size_t n) {
+#if defined(DATASKETCHES_X86)
+  if (cpu::best_isa() >= cpu::isa::AVX2) return register_ops::avx2_sums(regs, n);
+#endif
+  double lanes0[register_ops::SUM_LANES] = {0, 0, 0, 0};
+  double lanes1[register_ops::SUM_LANES] = {0, 0, 0, 0};
+  uint32_t num_zeros = 0;
+  register_ops::portable_sums(regs, 0, n, lanes0, lanes1, num_zeros);
+  return register_ops::finish_sums(lanes0, lanes1, num_zeros);
+}
+
+} /* namespace datasketches */
+
+#endif
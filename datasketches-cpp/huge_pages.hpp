@@ -0,0 +1,111 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <new>
+#include <type_traits>
+
+#ifdef __linux__
+#include <sys/mman.h>
+#endif
+
+// Tables of at least HUGE_PAGE_SIZE bytes, such as the registers of an HLL
+// matrix or the map of a heavy hitters sketch, are probed at random, so once
+// they outgrow what the TLB covers in 4KB pages nearly every probe also misses
+// the TLB. Once huge pages are enabled, such tables are mapped on their own and
+// backed by 2MB pages: explicit ones, from the pool reserved through
+// vm.nr_hugepages, if there are any left, and otherwise transparent ones.
+//
+// Mappings are rounded up to and aligned on HUGE_PAGE_SIZE whether or not huge
+// pages are enabled, so that tables allocated before enabling them are freed
+// the same way.
+static const size_t HUGE_PAGE_SIZE = size_t(1) << 21;
+
+inline std::atomic<bool>& huge_pages_enabled() {
+  static std::atomic<bool> enabled{false};
+  return enabled;
+}
+
+// Backs tables allocated from now on with huge pages, or stops doing so.
+inline void set_huge_pages(bool enabled) {
+  huge_pages_enabled().store(enabled, std::memory_order_relaxed);
+}
+
+inline size_t huge_page_length(size_t bytes) {
+  return (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+}
+
+// Allocates bytes, which must be at least HUGE_PAGE_SIZE, for
+// huge_pages_deallocate() to free.
+inline void* huge_pages_allocate(size_t bytes) {
+#ifdef __linux__
+  const size_t length = huge_page_length(bytes);
+  const bool enabled = huge_pages_enabled().load(std::memory_order_relaxed);
+#ifdef MAP_HUGETLB
+  if (enabled) {
+    void* p = mmap(nullptr, length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+    if (p != MAP_FAILED) return p;
+  }
+#endif
+  // Mapping a page more than needed leaves room to trim the ends to alignment,
+  // which transparent huge pages need.
+  void* mapped = mmap(nullptr, length + HUGE_PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+  if (mapped == MAP_FAILED) throw std::bad_alloc();
+  char* base = static_cast<char*>(mapped);
+  char* p = reinterpret_cast<char*>(huge_page_length(reinterpret_cast<uintptr_t>(base)));
+  if (p != base) munmap(base, p - base);
+  munmap(p + length, base + HUGE_PAGE_SIZE - p);
+#ifdef MADV_HUGEPAGE
+  // Failure, e.g. with transparent huge pages disabled, leaves small pages.
+  if (enabled) madvise(p, length, MADV_HUGEPAGE);
+#endif
+  return p;
+#else
+  return ::operator new(bytes);
+#endif
+}
+
+inline void huge_pages_deallocate(void* p, size_t bytes) {
+#ifdef __linux__
+  munmap(p, huge_page_length(bytes));
+#else
+  ::operator delete(p);
+#endif
+}
+
+// Allocator that maps requests of at least HUGE_PAGE_SIZE bytes with
+// huge_pages_allocate() and leaves smaller ones to std::allocator.
+template<typename T>
+class huge_page_allocator {
+public:
+  using value_type = T;
+
+  huge_page_allocator() noexcept {}
+  template<typename U>
+  huge_page_allocator(const huge_page_allocator<U>&) noexcept {}
+
+  T* allocate(size_t n) {
+    if (n > SIZE_MAX / sizeof(T)) throw std::bad_alloc();
+    if (n * sizeof(T) < HUGE_PAGE_SIZE) return std::allocator<T>().allocate(n);
+    return static_cast<T*>(huge_pages_allocate(n * sizeof(T)));
+  }
+
+  void deallocate(T* p, size_t n) {
+    if (n * sizeof(T) < HUGE_PAGE_SIZE) {
+      std::allocator<T>().deallocate(p, n);
+      return;
+    }
+    huge_pages_deallocate(p, n * sizeof(T));
+  }
+
+  template<typename U>
+  bool operator==(const huge_page_allocator<U>&) const noexcept {
+    return true;
+  }
+  template<typename U>
+  bool operator!=(const huge_page_allocator<U>&) const noexcept {
+    return false;
+  }
+};
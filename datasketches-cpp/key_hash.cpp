@@ -0,0 +1,36 @@
+#include <algorithm>
+#include <cstdint>
+
+#include "rust/cxx.h"
+#include "MurmurHash3_batch.h"
+#include "common_defs.hpp"
+
+#include "batch.hpp"
+#include "key_hash.hpp"
+#include "dsrs/src/bridge.rs.h"
+
+KeyHash hash_key(rust::Slice<const uint8_t> buf) {
+  HashState hash;
+  MurmurHash3_x64_128(buf.data(), buf.size(), datasketches::DEFAULT_SEED, hash);
+  return KeyHash{hash.h1, hash.h2};
+}
+
+void hash_keys(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, rust::Slice<KeyHash> hashes) {
+  const uint8_t* data = buf.data();
+  HashState chunk_hashes[murmur_batch::CHUNK_SIZE];
+  if (all_16_byte_keys(ends)) {
+    for (size_t i = 0; i < ends.size(); i += murmur_batch::CHUNK_SIZE) {
+      const size_t chunk = std::min(ends.size() - i, murmur_batch::CHUNK_SIZE);
+      MurmurHash3_x64_128_batch_16(data + 16 * i, chunk, datasketches::DEFAULT_SEED, chunk_hashes);
+      for (size_t j = 0; j < chunk; ++j) hashes[i + j] = KeyHash{chunk_hashes[j].h1, chunk_hashes[j].h2};
+    }
+    return;
+  }
+  size_t start = 0;
+  for (size_t i = 0; i < ends.size(); ++i) {
+    HashState hash;
+    MurmurHash3_x64_128(data + start, ends[i] - start, datasketches::DEFAULT_SEED, hash);
+    hashes[i] = KeyHash{hash.h1, hash.h2};
+    start = ends[i];
+  }
+}
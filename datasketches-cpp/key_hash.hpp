@@ -0,0 +1,14 @@
+#pragma once
+
+#include <cstdint>
+
+#include "rust/cxx.h"
+
+struct KeyHash;
+
+// The MurmurHash3_x64_128 of buf with DEFAULT_SEED, the seed of every CPC, theta
+// and HLL sketch here, whose update_hashed() takes it in place of buf.
+KeyHash hash_key(rust::Slice<const uint8_t> buf);
+// Writes the hash of key i, spanning [ends[i-1], ends[i]) of buf, to hashes[i].
+// The ends are validated on the Rust side, and hashes has room for all of them.
+void hash_keys(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, rust::Slice<KeyHash> hashes);
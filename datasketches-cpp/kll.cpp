@@ -0,0 +1,283 @@
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "rust/cxx.h"
+#include "kll/include/kll_sketch.hpp"
+#include "kll/include/kll_sorted_view.hpp"
+#include "kll/include/kll_wrapped_sketch.hpp"
+#include "kll/include/kolmogorov_smirnov.hpp"
+
+#include "kll.hpp"
+
+template<typename T>
+OpaqueKllSketch<T>::OpaqueKllSketch(uint16_t k):
+  inner_{k} {
+}
+
+template<typename T>
+OpaqueKllSketch<T>::OpaqueKllSketch(kll_sketch<T>&& kll):
+  inner_{std::move(kll)} {
+}
+
+template<typename T>
+bool OpaqueKllSketch<T>::is_empty() const {
+  return this->inner_.is_empty();
+}
+
+template<typename T>
+uint16_t OpaqueKllSketch<T>::get_k() const {
+  return this->inner_.get_k();
+}
+
+template<typename T>
+uint64_t OpaqueKllSketch<T>::get_n() const {
+  return this->inner_.get_n();
+}
+
+template<typename T>
+uint32_t OpaqueKllSketch<T>::get_num_retained() const {
+  return this->inner_.get_num_retained();
+}
+
+template<typename T>
+size_t OpaqueKllSketch<T>::get_memory_usage_bytes() const {
+  std::lock_guard<std::mutex> lock(this->view_mutex_);
+  const size_t view = this->view_ ? this->view_->get_memory_usage_bytes() : 0;
+  return this->inner_.get_memory_usage_bytes() + view;
+}
+
+template<typename T>
+bool OpaqueKllSketch<T>::is_estimation_mode() const {
+  return this->inner_.is_estimation_mode();
+}
+
+template<typename T>
+T OpaqueKllSketch<T>::get_min_value() const {
+  return this->inner_.get_min_value();
+}
+
+template<typename T>
+T OpaqueKllSketch<T>::get_max_value() const {
+  return this->inner_.get_max_value();
+}
+
+template<typename T>
+double OpaqueKllSketch<T>::get_normalized_rank_error(bool pmf) const {
+  return this->inner_.get_normalized_rank_error(pmf);
+}
+
+template<typename T>
+void OpaqueKllSketch<T>::update(T value) {
+  this->view_.reset();
+  this->inner_.update(value);
+}
+
+template<typename T>
+void OpaqueKllSketch<T>::update_batch(rust::Slice<const T> values) {
+  this->view_.reset();
+  this->inner_.update(values.data(), values.size());
+}
+
+template<typename T>
+void OpaqueKllSketch<T>::merge(const OpaqueKllSketch& other) {
+  this->view_.reset();
+  this->inner_.merge(other.inner_);
+}
+
+template<typename T>
+void OpaqueKllSketch<T>::merge_wrapped(const OpaqueWrappedKllSketch<T>& other) {
+  this->view_.reset();
+  this->inner_.merge(other.inner_);
+}
+
+template<typename T>
+void OpaqueKllSketch<T>::merge_serialized(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends) {
+  std::vector<kll_sketch<T>> others;
+  others.reserve(ends.size());
+  size_t start = 0;
+  for (const size_t end : ends) {
+    others.push_back(kll_sketch<T>::deserialize(buf.data() + start, end - start));
+    start = end;
+  }
+  this->view_.reset();
+  this->inner_.merge(others.begin(), others.end());
+}
+
+// Updates and merges drop the view, but they take the sketch mutably, so a view once built
+// outlives every query that could be reading it.
+template<typename T>
+const kll_sorted_view<T>& OpaqueKllSketch<T>::sorted_view() const {
+  std::lock_guard<std::mutex> lock(this->view_mutex_);
+  if (!this->view_) this->view_.reset(new kll_sorted_view<T>{this->inner_});
+  return *this->view_;
+}
+
+template<typename T>
+T OpaqueKllSketch<T>::get_quantile(double fraction) const {
+  return this->sorted_view().get_quantile(fraction);
+}
+
+template<typename T>
+std::unique_ptr<std::vector<T>> OpaqueKllSketch<T>::get_quantiles(rust::Slice<const double> fractions) const {
+  auto quantiles = this->sorted_view().get_quantiles(fractions.data(), fractions.size());
+  return std::unique_ptr<std::vector<T>>(new std::vector<T>(into_std_vector(std::move(quantiles))));
+}
+
+template<typename T>
+double OpaqueKllSketch<T>::get_rank(T value) const {
+  return this->sorted_view().get_rank(value);
+}
+
+template<typename T>
+std::unique_ptr<std::vector<double>> OpaqueKllSketch<T>::get_cdf(rust::Slice<const T> split_points) const {
+  auto cdf = this->sorted_view().get_CDF(split_points.data(), split_points.size());
+  return std::unique_ptr<std::vector<double>>(new std::vector<double>(into_std_vector(std::move(cdf))));
+}
+
+template<typename T>
+std::unique_ptr<std::vector<double>> OpaqueKllSketch<T>::get_pmf(rust::Slice<const T> split_points) const {
+  auto pmf = this->sorted_view().get_PMF(split_points.data(), split_points.size());
+  return std::unique_ptr<std::vector<double>>(new std::vector<double>(into_std_vector(std::move(pmf))));
+}
+
+template<typename T>
+double OpaqueKllSketch<T>::ks_delta(const OpaqueKllSketch& other) const {
+  return datasketches::kolmogorov_smirnov::delta(this->sorted_view(), other.sorted_view());
+}
+
+template<typename T>
+double OpaqueKllSketch<T>::ks_threshold(const OpaqueKllSketch& other, double p) const {
+  return datasketches::kolmogorov_smirnov::threshold(this->inner_, other.inner_, p);
+}
+
+template<typename T>
+bool OpaqueKllSketch<T>::ks_test(const OpaqueKllSketch& other, double p) const {
+  return this->ks_delta(other) > this->ks_threshold(other, p);
+}
+
+template<typename T>
+std::unique_ptr<OpaqueKllSketch<T>> OpaqueKllSketch<T>::clone() const {
+  auto copy = this->inner_;
+  return std::unique_ptr<OpaqueKllSketch<T>>(new OpaqueKllSketch<T>{std::move(copy)});
+}
+
+template<typename T>
+std::unique_ptr<std::vector<uint8_t>> OpaqueKllSketch<T>::serialize() const {
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
+}
+
+template<typename T>
+OpaqueWrappedKllSketch<T>::OpaqueWrappedKllSketch(const wrapped_kll_sketch<T>& kll):
+  inner_{kll} {
+}
+
+template<typename T>
+bool OpaqueWrappedKllSketch<T>::is_empty() const {
+  return this->inner_.is_empty();
+}
+
+template<typename T>
+uint64_t OpaqueWrappedKllSketch<T>::get_n() const {
+  return this->inner_.get_n();
+}
+
+template<typename T>
+uint32_t OpaqueWrappedKllSketch<T>::get_num_retained() const {
+  return this->inner_.get_num_retained();
+}
+
+template<typename T>
+T OpaqueWrappedKllSketch<T>::get_min_value() const {
+  return this->inner_.get_min_value();
+}
+
+template<typename T>
+T OpaqueWrappedKllSketch<T>::get_max_value() const {
+  return this->inner_.get_max_value();
+}
+
+template<typename T>
+T OpaqueWrappedKllSketch<T>::get_quantile(double fraction) const {
+  return this->inner_.get_quantile(fraction);
+}
+
+template<typename T>
+double OpaqueWrappedKllSketch<T>::get_rank(T value) const {
+  return this->inner_.get_rank(value);
+}
+
+template<>
+std::unique_ptr<std::vector<uint8_t>> OpaqueKllSketch<uint32_t>::serialize_compressed() const {
+  auto v = this->inner_.serialize_compressed();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
+}
+
+template<>
+std::unique_ptr<std::vector<uint8_t>> OpaqueKllSketch<uint64_t>::serialize_compressed() const {
+  auto v = this->inner_.serialize_compressed();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
+}
+
+template class OpaqueKllSketch<double>;
+template class OpaqueKllSketch<float>;
+template class OpaqueKllSketch<uint32_t>;
+template class OpaqueKllSketch<uint64_t>;
+template class OpaqueWrappedKllSketch<double>;
+template class OpaqueWrappedKllSketch<float>;
+
+std::unique_ptr<OpaqueKllDoubleSketch> new_opaque_kll_double_sketch(uint16_t k) {
+  return std::unique_ptr<OpaqueKllDoubleSketch>(new OpaqueKllDoubleSketch{k});
+}
+
+std::unique_ptr<OpaqueKllDoubleSketch> deserialize_opaque_kll_double_sketch(rust::Slice<const uint8_t> buf) {
+  auto kll = kll_sketch<double>::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueKllDoubleSketch>(new OpaqueKllDoubleSketch{std::move(kll)});
+}
+
+std::unique_ptr<OpaqueKllFloatSketch> new_opaque_kll_float_sketch(uint16_t k) {
+  return std::unique_ptr<OpaqueKllFloatSketch>(new OpaqueKllFloatSketch{k});
+}
+
+std::unique_ptr<OpaqueKllFloatSketch> deserialize_opaque_kll_float_sketch(rust::Slice<const uint8_t> buf) {
+  auto kll = kll_sketch<float>::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueKllFloatSketch>(new OpaqueKllFloatSketch{std::move(kll)});
+}
+
+std::unique_ptr<OpaqueKllU32Sketch> new_opaque_kll_u32_sketch(uint16_t k) {
+  return std::unique_ptr<OpaqueKllU32Sketch>(new OpaqueKllU32Sketch{k});
+}
+
+std::unique_ptr<OpaqueKllU32Sketch> deserialize_opaque_kll_u32_sketch(rust::Slice<const uint8_t> buf) {
+  auto kll = kll_sketch<uint32_t>::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueKllU32Sketch>(new OpaqueKllU32Sketch{std::move(kll)});
+}
+
+std::unique_ptr<OpaqueKllU64Sketch> new_opaque_kll_u64_sketch(uint16_t k) {
+  return std::unique_ptr<OpaqueKllU64Sketch>(new OpaqueKllU64Sketch{k});
+}
+
+std::unique_ptr<OpaqueKllU64Sketch> deserialize_opaque_kll_u64_sketch(rust::Slice<const uint8_t> buf) {
+  auto kll = kll_sketch<uint64_t>::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueKllU64Sketch>(new OpaqueKllU64Sketch{std::move(kll)});
+}
+
+std::unique_ptr<OpaqueWrappedKllDoubleSketch> wrap_opaque_kll_double_sketch(rust::Slice<const uint8_t> buf) {
+  auto wrapped = wrapped_kll_sketch<double>::wrap(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueWrappedKllDoubleSketch>(new OpaqueWrappedKllDoubleSketch{wrapped});
+}
+
+std::unique_ptr<OpaqueWrappedKllFloatSketch> wrap_opaque_kll_float_sketch(rust::Slice<const uint8_t> buf) {
+  auto wrapped = wrapped_kll_sketch<float>::wrap(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueWrappedKllFloatSketch>(new OpaqueWrappedKllFloatSketch{wrapped});
+}
+
+void seed_compaction_bits(uint64_t seed) {
+  datasketches::seed_random_bits(seed);
+}
+
+void seed_thread_compaction_bits(uint64_t seed) {
+  datasketches::seed_thread_random_bits(seed);
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "rust/cxx.h"
+#include "kll/include/kll_sketch.hpp"
+#include "kll/include/kll_sorted_view.hpp"
+#include "kll/include/kll_wrapped_sketch.hpp"
+#include "kll/include/kolmogorov_smirnov.hpp"
+
+#include "alloc_stats.hpp"
+
+template<typename T>
+using kll_sketch = datasketches::kll_sketch<T, std::less<T>, datasketches::serde<T>, sketch_allocator<T, alloc_family::KLL>>;
+template<typename T>
+using kll_sorted_view = datasketches::kll_sorted_view<T, std::less<T>, sketch_allocator<T, alloc_family::KLL>>;
+template<typename T>
+using wrapped_kll_sketch = datasketches::wrapped_kll_sketch<T>;
+
+template<typename T> class OpaqueWrappedKllSketch;
+
+// A KLL quantiles sketch of T, which is double, float, uint32_t or uint64_t. Queries go through a sorted view
+// of the retained items, built on the first query after an update and kept until the next.
+// The sketch is shared between threads for queries, so the view is built under a lock.
+template<typename T>
+class OpaqueKllSketch {
+public:
+  bool is_empty() const;
+  uint16_t get_k() const;
+  uint64_t get_n() const;
+  uint32_t get_num_retained() const;
+  // Heap bytes held by the sketch and by its sorted view, if one is built.
+  size_t get_memory_usage_bytes() const;
+  bool is_estimation_mode() const;
+  T get_min_value() const;
+  T get_max_value() const;
+  double get_normalized_rank_error(bool pmf) const;
+  // NaN values are ignored.
+  void update(T value);
+  void update_batch(rust::Slice<const T> values);
+  void merge(const OpaqueKllSketch& other);
+  void merge_wrapped(const OpaqueWrappedKllSketch<T>& other);
+  // Sketch i is serialized in [ends[i-1], ends[i]) of buf, with ends[-1] taken as 0.
+  // All are deserialized before any is merged, so a bad one leaves this sketch as it was.
+  void merge_serialized(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends);
+  T get_quantile(double fraction) const;
+  std::unique_ptr<std::vector<T>> get_quantiles(rust::Slice<const double> fractions) const;
+  double get_rank(T value) const;
+  // split_points must be unique and increasing.
+  std::unique_ptr<std::vector<double>> get_cdf(rust::Slice<const T> split_points) const;
+  std::unique_ptr<std::vector<double>> get_pmf(rust::Slice<const T> split_points) const;
+  // The Kolmogorov-Smirnov test of this sketch and other, with the delta taken from the
+  // sorted views of both, as datasketches::kolmogorov_smirnov defines them.
+  double ks_delta(const OpaqueKllSketch& other) const;
+  double ks_threshold(const OpaqueKllSketch& other, double p) const;
+  bool ks_test(const OpaqueKllSketch& other, double p) const;
+  std::unique_ptr<OpaqueKllSketch> clone() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize() const;
+  // Defined for the sketches of unsigned integers alone.
+  std::unique_ptr<std::vector<uint8_t>> serialize_compressed() const;
+private:
+  OpaqueKllSketch(uint16_t k);
+  OpaqueKllSketch(kll_sketch<T>&& kll);
+  friend std::unique_ptr<OpaqueKllSketch<double>> new_opaque_kll_double_sketch(uint16_t k);
+  friend std::unique_ptr<OpaqueKllSketch<double>> deserialize_opaque_kll_double_sketch(rust::Slice<const uint8_t> buf);
+  friend std::unique_ptr<OpaqueKllSketch<float>> new_opaque_kll_float_sketch(uint16_t k);
+  friend std::unique_ptr<OpaqueKllSketch<float>> deserialize_opaque_kll_float_sketch(rust::Slice<const uint8_t> buf);
+  friend std::unique_ptr<OpaqueKllSketch<uint32_t>> new_opaque_kll_u32_sketch(uint16_t k);
+  friend std::unique_ptr<OpaqueKllSketch<uint32_t>> deserialize_opaque_kll_u32_sketch(rust::Slice<const uint8_t> buf);
+  friend std::unique_ptr<OpaqueKllSketch<uint64_t>> new_opaque_kll_u64_sketch(uint16_t k);
+  friend std::unique_ptr<OpaqueKllSketch<uint64_t>> deserialize_opaque_kll_u64_sketch(rust::Slice<const uint8_t> buf);
+  const kll_sorted_view<T>& sorted_view() const;
+  kll_sketch<T> inner_;
+  mutable std::mutex view_mutex_;
+  mutable std::unique_ptr<kll_sorted_view<T>> view_;
+};
+
+// A view of a serialized KLL sketch of T that reads the levels and items from the Rust-owned
+// buffer in place; the buffer must outlive it. Queries search the levels without allocating.
+template<typename T>
+class OpaqueWrappedKllSketch {
+public:
+  bool is_empty() const;
+  uint64_t get_n() const;
+  uint32_t get_num_retained() const;
+  T get_min_value() const;
+  T get_max_value() const;
+  T get_quantile(double fraction) const;
+  double get_rank(T value) const;
+private:
+  OpaqueWrappedKllSketch(const wrapped_kll_sketch<T>& kll);
+  friend std::unique_ptr<OpaqueWrappedKllSketch<double>> wrap_opaque_kll_double_sketch(rust::Slice<const uint8_t> buf);
+  friend std::unique_ptr<OpaqueWrappedKllSketch<float>> wrap_opaque_kll_float_sketch(rust::Slice<const uint8_t> buf);
+  friend class OpaqueKllSketch<T>;
+  wrapped_kll_sketch<T> inner_;
+};
+
+using OpaqueKllDoubleSketch = OpaqueKllSketch<double>;
+using OpaqueKllFloatSketch = OpaqueKllSketch<float>;
+using OpaqueKllU32Sketch = OpaqueKllSketch<uint32_t>;
+using OpaqueKllU64Sketch = OpaqueKllSketch<uint64_t>;
+using OpaqueWrappedKllDoubleSketch = OpaqueWrappedKllSketch<double>;
+using OpaqueWrappedKllFloatSketch = OpaqueWrappedKllSketch<float>;
+
+std::unique_ptr<OpaqueKllDoubleSketch> new_opaque_kll_double_sketch(uint16_t k);
+std::unique_ptr<OpaqueKllDoubleSketch> deserialize_opaque_kll_double_sketch(rust::Slice<const uint8_t> buf);
+std::unique_ptr<OpaqueKllFloatSketch> new_opaque_kll_float_sketch(uint16_t k);
+std::unique_ptr<OpaqueKllFloatSketch> deserialize_opaque_kll_float_sketch(rust::Slice<const uint8_t> buf);
+std::unique_ptr<OpaqueKllU32Sketch> new_opaque_kll_u32_sketch(uint16_t k);
+std::unique_ptr<OpaqueKllU32Sketch> deserialize_opaque_kll_u32_sketch(rust::Slice<const uint8_t> buf);
+std::unique_ptr<OpaqueKllU64Sketch> new_opaque_kll_u64_sketch(uint16_t k);
+std::unique_ptr<OpaqueKllU64Sketch> deserialize_opaque_kll_u64_sketch(rust::Slice<const uint8_t> buf);
+std::unique_ptr<OpaqueWrappedKllDoubleSketch> wrap_opaque_kll_double_sketch(rust::Slice<const uint8_t> buf);
+std::unique_ptr<OpaqueWrappedKllFloatSketch> wrap_opaque_kll_float_sketch(rust::Slice<const uint8_t> buf);
+
+// Seeds the coin flips of KLL and REQ compactions, which otherwise differ from run to run,
+// on every thread; 0 restores seeding from the clock.
+void seed_compaction_bits(uint64_t seed);
+// Seeds the coin flips of this thread's compactions only.
+void seed_thread_compaction_bits(uint64_t seed);
@@ -20,14 +20,11 @@
 #ifndef KLL_HELPER_HPP_
 #define KLL_HELPER_HPP_
 
-#include <random>
 #include <stdexcept>
-#include <chrono>
 
-namespace datasketches {
+#include "random_bits.hpp"
 
-static std::independent_bits_engine<std::mt19937, 1, uint32_t>
-  random_bit(static_cast<uint32_t>(std::chrono::system_clock::now().time_since_epoch().count()));
+namespace datasketches {
 
 #ifdef KLL_VALIDATION
 extern uint32_t kll_next_offset;
@@ -52,6 +49,13 @@ class kll_helper {
     static inline uint16_t int_cap_aux_aux(uint16_t k, uint8_t depth);
     static inline uint64_t sum_the_sample_weights(uint8_t num_levels, const uint32_t* levels);
 
+    // Varints of the compressed format: 7 bits per byte, least significant first,
+    // with the high bit set on every byte but the last.
+    static inline size_t varint_size(uint64_t value);
+    static inline uint8_t* write_varint(uint64_t value, uint8_t* ptr);
+    // reads a varint from [ptr, end), returning the byte after it
+    static inline const uint8_t* read_varint(const uint8_t* ptr, const uint8_t* end, uint64_t& value);
+
     /*
      * This version is for floating point types
      * Checks the sequential validity of the given array of values.
@@ -84,6 +88,14 @@ class kll_helper {
       }
     }
 
+    /*
+     * Sorts buf[start, start + length) according to C.
+     * Long runs of 32 or 64-bit floating point or unsigned items in ascending order are radix
+     * sorted on their bits, everything else goes through std::sort.
+     */
+    template <typename T, typename C>
+    static void sort_level(T* buf, uint32_t start, uint32_t length);
+
     template <typename T>
     static void randomly_halve_down(T* buf, uint32_t start, uint32_t length);
 
@@ -94,7 +106,13 @@ class kll_helper {
     // assumes that destination has initialized objects
     // does not destroy the originals after the move
     template <typename T, typename C>
-    static void merge_sorted_arrays(T* buf, uint32_t start_a, uint32_t len_a, uint32_t start_b, uint32_t len_b, uint32_t start_c);
+    static typename std::enable_if<!std::is_arithmetic<T>::value, void>::type
+    merge_sorted_arrays(T* buf, uint32_t start_a, uint32_t len_a, uint32_t start_b, uint32_t len_b, uint32_t start_c);
+
+    // same as above for arithmetic types, selecting each output item without a branch
+    template <typename T, typename C>
+    static typename std::enable_if<std::is_arithmetic<T>::value, void>::type
+    merge_sorted_arrays(T* buf, uint32_t start_a, uint32_t len_a, uint32_t start_b, uint32_t len_b, uint32_t start_c);
 
     // this version is to merge from two different buffers into a third buffer
     // initializes objects is the destination buffer
@@ -136,8 +154,41 @@ class kll_helper {
     template<typename T>
     static void move_construct(T* src, size_t src_first, size_t src_last, T* dst, size_t dst_first, bool destroy);
 
-#ifdef KLL_VALIDATION
   private:
+    // arithmetic items in ascending order are sorted by rank up to this length
+    static const uint32_t MAX_RANK_SORT_LENGTH = 24;
+    // and 32 or 64-bit floating point or unsigned ones are radix sorted from this one
+    static const uint32_t MIN_RADIX_SORT_LENGTH = 96;
+
+    template <typename T, typename C>
+    static void sort_level(T* buf, uint32_t start, uint32_t length, std::true_type);
+
+    template <typename T, typename C>
+    static void sort_level(T* buf, uint32_t start, uint32_t length, std::false_type);
+
+    template <typename T>
+    static void rank_sort(T* buf, uint32_t start, uint32_t length);
+
+    template <typename T>
+    static void radix_sort(T* buf, uint32_t start, uint32_t length, std::true_type);
+
+    template <typename T>
+    static void radix_sort(T* buf, uint32_t start, uint32_t length, std::false_type);
+
+    // map the bits of an item to a radix sort key, whose unsigned order is the items' order
+    template <typename K>
+    static inline K to_radix_key(K bits, std::true_type is_floating_point);
+
+    template <typename K>
+    static inline K to_radix_key(K bits, std::false_type is_floating_point);
+
+    template <typename K>
+    static inline K from_radix_key(K key, std::true_type is_floating_point);
+
+    template <typename K>
+    static inline K from_radix_key(K key, std::false_type is_floating_point);
+
+#ifdef KLL_VALIDATION
 
     static inline uint32_t deterministic_offset();
 #endif
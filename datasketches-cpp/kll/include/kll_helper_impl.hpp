@@ -21,6 +21,10 @@
 #define KLL_HELPER_IMPL_HPP_
 
 #include <algorithm>
+#include <cstring>
+#include <functional>
+#include <type_traits>
+#include <vector>
 
 namespace datasketches {
 
@@ -89,6 +93,147 @@ uint64_t kll_helper::sum_the_sample_weights(uint8_t num_levels, const uint32_t*
   return total;
 }
 
+size_t kll_helper::varint_size(uint64_t value) {
+  size_t size = 1;
+  while (value >= 0x80) {
+    value >>= 7;
+    size++;
+  }
+  return size;
+}
+
+uint8_t* kll_helper::write_varint(uint64_t value, uint8_t* ptr) {
+  while (value >= 0x80) {
+    *ptr++ = static_cast<uint8_t>(value | 0x80);
+    value >>= 7;
+  }
+  *ptr++ = static_cast<uint8_t>(value);
+  return ptr;
+}
+
+const uint8_t* kll_helper::read_varint(const uint8_t* ptr, const uint8_t* end, uint64_t& value) {
+  value = 0;
+  for (unsigned shift = 0; shift < 64; shift += 7) {
+    if (ptr == end) throw std::out_of_range("Insufficient buffer size detected: varint runs past the end");
+    const uint8_t byte = *ptr++;
+    value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+    if ((byte & 0x80) == 0) return ptr;
+  }
+  throw std::invalid_argument("Possible corruption: varint longer than 64 bits");
+}
+
+template <typename T, typename C>
+void kll_helper::sort_level(T* buf, uint32_t start, uint32_t length) {
+  sort_level<T, C>(buf, start, length, std::integral_constant<bool,
+      std::is_arithmetic<T>::value && std::is_same<C, std::less<T>>::value>());
+}
+
+template <typename T, typename C>
+void kll_helper::sort_level(T* buf, uint32_t start, uint32_t length, std::false_type) {
+  std::sort(&buf[start], &buf[start + length], C());
+}
+
+template <typename T, typename C>
+void kll_helper::sort_level(T* buf, uint32_t start, uint32_t length, std::true_type) {
+  if (length <= MAX_RANK_SORT_LENGTH) {
+    rank_sort(buf, start, length);
+  } else if (length < MIN_RADIX_SORT_LENGTH) {
+    std::sort(&buf[start], &buf[start + length]);
+  } else {
+    radix_sort(buf, start, length, std::integral_constant<bool,
+        (std::is_floating_point<T>::value || std::is_unsigned<T>::value)
+        && (sizeof(T) == sizeof(uint32_t) || sizeof(T) == sizeof(uint64_t))>());
+  }
+}
+
+// Places each item at its rank, the number of items that must precede it,
+// counting equal items only if they come first. This takes a quadratic number of comparisons,
+// but they are independent and branch-free, so the inner loop vectorizes and,
+// for the handful of items level zero holds once the sketch has many levels,
+// beats the mispredicted branches of the insertion sort std::sort falls back to.
+template <typename T>
+void kll_helper::rank_sort(T* buf, uint32_t start, uint32_t length) {
+  T items[MAX_RANK_SORT_LENGTH];
+  std::copy(&buf[start], &buf[start + length], items);
+  for (uint32_t i = 0; i < length; i++) {
+    const T item = items[i];
+    size_t rank = 0;
+    for (uint32_t j = 0; j < length; j++) rank += (items[j] < item) | ((items[j] == item) & (j < i));
+    buf[start + rank] = item;
+  }
+}
+
+template <typename T>
+void kll_helper::radix_sort(T* buf, uint32_t start, uint32_t length, std::false_type) {
+  std::sort(&buf[start], &buf[start + length]);
+}
+
+// LSD radix sort, one byte per pass, of the bits of the items mapped so that unsigned order
+// is numeric order, see to_radix_key().
+// Items are never NaN here, and passes over a byte that all keys share are skipped,
+// which for values of similar magnitude is most of the high bytes.
+template <typename T>
+void kll_helper::radix_sort(T* buf, uint32_t start, uint32_t length, std::true_type) {
+  using K = typename std::conditional<sizeof(T) == sizeof(uint32_t), uint32_t, uint64_t>::type;
+  static_assert(sizeof(K) == sizeof(T), "unsupported item size");
+  using is_floating_point = std::is_floating_point<T>;
+
+  std::vector<K> keys(2 * length);
+  K* src = keys.data();
+  K* dst = src + length;
+  uint32_t counts[sizeof(K)][256] = {};
+  for (uint32_t i = 0; i < length; i++) {
+    K bits;
+    std::memcpy(&bits, &buf[start + i], sizeof(K));
+    const K key = to_radix_key<K>(bits, is_floating_point());
+    src[i] = key;
+    for (unsigned pass = 0; pass < sizeof(K); pass++) counts[pass][(key >> (8 * pass)) & 0xff]++;
+  }
+  for (unsigned pass = 0; pass < sizeof(K); pass++) {
+    const unsigned shift = 8 * pass;
+    uint32_t* count = counts[pass];
+    if (count[(src[0] >> shift) & 0xff] == length) continue;
+    uint32_t offset = 0;
+    for (unsigned byte = 0; byte < 256; byte++) {
+      const uint32_t c = count[byte];
+      count[byte] = offset;
+      offset += c;
+    }
+    for (uint32_t i = 0; i < length; i++) dst[count[(src[i] >> shift) & 0xff]++] = src[i];
+    std::swap(src, dst);
+  }
+  for (uint32_t i = 0; i < length; i++) {
+    const K bits = from_radix_key<K>(src[i], is_floating_point());
+    std::memcpy(&buf[start + i], &bits, sizeof(K));
+  }
+}
+
+// IEEE 754 values: negatives have all bits flipped, non-negatives just the sign bit
+template <typename K>
+K kll_helper::to_radix_key(K bits, std::true_type) {
+  const unsigned sign_shift = sizeof(K) * 8 - 1;
+  const K sign = K(1) << sign_shift;
+  return bits ^ ((K(0) - (bits >> sign_shift)) | sign);
+}
+
+// unsigned integers: their bits as they are
+template <typename K>
+K kll_helper::to_radix_key(K bits, std::false_type) {
+  return bits;
+}
+
+template <typename K>
+K kll_helper::from_radix_key(K key, std::true_type) {
+  const unsigned sign_shift = sizeof(K) * 8 - 1;
+  const K sign = K(1) << sign_shift;
+  return key ^ (((key >> sign_shift) - 1) | sign);
+}
+
+template <typename K>
+K kll_helper::from_radix_key(K key, std::false_type) {
+  return key;
+}
+
 template <typename T>
 void kll_helper::randomly_halve_down(T* buf, uint32_t start, uint32_t length) {
   if (!is_even(length)) throw std::invalid_argument("length must be even");
@@ -96,12 +241,11 @@ void kll_helper::randomly_halve_down(T* buf, uint32_t start, uint32_t length) {
 #ifdef KLL_VALIDATION
   const uint32_t offset = deterministic_offset();
 #else
-  const uint32_t offset = random_bit();
+  const uint32_t offset = thread_random_bits().next_bit();
 #endif
-  uint32_t j = start + offset;
-  for (uint32_t i = start; i < (start + half_length); i++) {
-    if (i != j) buf[i] = std::move(buf[j]);
-    j += 2;
+  // only the first kept item can already be in place, so the loop itself does not branch
+  for (uint32_t i = (offset == 0) ? 1 : 0; i < half_length; i++) {
+    buf[start + i] = std::move(buf[start + offset + 2 * i]);
   }
 }
 
@@ -112,12 +256,11 @@ void kll_helper::randomly_halve_up(T* buf, uint32_t start, uint32_t length) {
 #ifdef KLL_VALIDATION
   const uint32_t offset = deterministic_offset();
 #else
-  const uint32_t offset = random_bit();
+  const uint32_t offset = thread_random_bits().next_bit();
 #endif
-  uint32_t j = (start + length) - 1 - offset;
-  for (uint32_t i = (start + length) - 1; i >= (start + half_length); i--) {
-    if (i != j) buf[i] = std::move(buf[j]);
-    j -= 2;
+  const uint32_t last = (start + length) - 1;
+  for (uint32_t i = (offset == 0) ? 1 : 0; i < half_length; i++) {
+    buf[last - i] = std::move(buf[last - offset - 2 * i]);
   }
 }
 
@@ -125,7 +268,8 @@ void kll_helper::randomly_halve_up(T* buf, uint32_t start, uint32_t length) {
 // assumes that destination has initialized objects
 // does not destroy the originals after the move
 template <typename T, typename C>
-void kll_helper::merge_sorted_arrays(T* buf, uint32_t start_a, uint32_t len_a, uint32_t start_b, uint32_t len_b, uint32_t start_c) {
+typename std::enable_if<!std::is_arithmetic<T>::value, void>::type
+kll_helper::merge_sorted_arrays(T* buf, uint32_t start_a, uint32_t len_a, uint32_t start_b, uint32_t len_b, uint32_t start_c) {
   const uint32_t len_c = len_a + len_b;
   const uint32_t lim_a = start_a + len_a;
   const uint32_t lim_b = start_b + len_b;
@@ -152,6 +296,30 @@ void kll_helper::merge_sorted_arrays(T* buf, uint32_t start_a, uint32_t len_a, u
   if (a != lim_a || b != lim_b) throw std::logic_error("inconsistent state");
 }
 
+// The output never overtakes b while a has items left, since start_b = start_c + len_a,
+// so every slot can be written unconditionally with whichever head is smaller.
+template <typename T, typename C>
+typename std::enable_if<std::is_arithmetic<T>::value, void>::type
+kll_helper::merge_sorted_arrays(T* buf, uint32_t start_a, uint32_t len_a, uint32_t start_b, uint32_t len_b, uint32_t start_c) {
+  if (start_b != start_c + len_a) throw std::logic_error("inconsistent state");
+  const uint32_t lim_a = start_a + len_a;
+  const uint32_t lim_b = start_b + len_b;
+
+  uint32_t a = start_a;
+  uint32_t b = start_b;
+  uint32_t c = start_c;
+  while (a != lim_a && b != lim_b) {
+    const T item_a = buf[a];
+    const T item_b = buf[b];
+    const bool take_a = C()(item_a, item_b);
+    buf[c++] = take_a ? item_a : item_b;
+    a += take_a;
+    b += !take_a;
+  }
+  // whatever is left of b is already in place
+  while (a != lim_a) buf[c++] = buf[a++];
+}
+
 // this version is to merge from two different buffers into a third buffer
 // initializes objects is the destination buffer
 // moves objects from buf_a and destroys the originals
@@ -248,7 +416,7 @@ kll_helper::compress_result kll_helper::general_compress(uint16_t k, uint8_t m,
 
       // level zero might not be sorted, so we must sort it if we wish to compact it
       if ((current_level == 0) && !is_level_zero_sorted) {
-        std::sort(&items[adj_beg], &items[adj_beg + adj_pop], C());
+        sort_level<T, C>(items, adj_beg, adj_pop);
       }
 
       if (pop_above == 0) { // Level above is empty, so halve up
@@ -153,6 +153,8 @@ template<typename A> using vector_u32 = std::vector<uint32_t, AllocU32<A>>;
 template<typename A> using AllocD = typename std::allocator_traits<A>::template rebind_alloc<double>;
 template<typename A> using vector_d = std::vector<double, AllocD<A>>;
 
+template<typename T, typename C> class wrapped_kll_sketch;
+
 template <typename T, typename C = std::less<T>, typename S = serde<T>, typename A = std::allocator<T>>
 class kll_sketch {
   public:
@@ -185,6 +187,14 @@ class kll_sketch {
      */
     void update(T&& value);
 
+    /**
+     * Updates this sketch with the given data items, as calling update() on each in turn would.
+     * Level zero is filled in bulk between compactions.
+     * @param values pointer to the array of items
+     * @param size the number of items in the array
+     */
+    void update(const T* values, size_t size);
+
     /**
      * Merges another sketch into this one.
      * This method takes lvalue.
@@ -199,6 +209,24 @@ class kll_sketch {
      */
     void merge(kll_sketch&& other);
 
+    /**
+     * Merges a view of a serialized sketch into this one, reading its items in place.
+     * Defined in kll_wrapped_sketch.hpp, which must be included to use it.
+     * @param other view to merge into this one
+     */
+    void merge(const wrapped_kll_sketch<T, C>& other);
+
+    /**
+     * Merges all the sketches in a range into this one.
+     * Consecutive sketches small enough to fit together within a couple of times the size of this one
+     * have their levels appended to one work buffer that is compressed once,
+     * rather than once per sketch as merging them in turn would. Larger ones are merged in turn.
+     * @param first iterator to the first sketch to merge
+     * @param last iterator past the last sketch to merge
+     */
+    template<typename Iterator>
+    void merge(Iterator first, Iterator last);
+
     /**
      * Returns true if this sketch is empty.
      * @return empty flag
@@ -386,6 +414,14 @@ class kll_sketch {
     template<typename TT = T, typename std::enable_if<!std::is_arithmetic<TT>::value, int>::type = 0>
     size_t get_serialized_size_bytes() const;
 
+    /**
+     * Computes the heap memory held by the sketch: its items array, including the space
+     * reserved for items to come, its levels, and its min and max values. Memory that
+     * items of other than arithmetic types point to is not counted.
+     * @return size in bytes
+     */
+    size_t get_memory_usage_bytes() const;
+
     /**
      * Returns upper bound on the serialized size of a sketch given a parameter <em>k</em> and stream
      * length. The resulting size is an overestimate to make sure actual sketches don't exceed it.
@@ -432,6 +468,19 @@ class kll_sketch {
      */
     vector_bytes serialize(unsigned header_size_bytes = 0) const;
 
+    /**
+     * This method serializes a sketch of unsigned integers as a vector of bytes in the
+     * compressed format, which writes each level sorted, as the varint-encoded differences
+     * between its consecutive items, instead of sizeof(T) bytes per item. Values of similar
+     * magnitude take a byte or two each. Empty and single-item sketches, and ones the format
+     * would not make smaller, are serialized as by serialize(), which deserialize() from bytes
+     * tells apart.
+     * Compressed sketches cannot be read from a stream or wrapped, since their items must be
+     * decoded.
+     * @param header_size_bytes space to reserve in front of the sketch
+     */
+    vector_bytes serialize_compressed(unsigned header_size_bytes = 0) const;
+
     /**
      * This method deserializes a sketch from a given stream.
      * @param is input stream
@@ -490,6 +539,11 @@ class kll_sketch {
 
     static const uint8_t SERIAL_VERSION_1 = 1;
     static const uint8_t SERIAL_VERSION_2 = 2;
+    // The varint layout of serialize_compressed(), which only this library reads.
+    // DataSketches libraries use serial versions 1 and 2 for compact sketches and
+    // Java uses 3 for updatable ones, so this is kept far outside their range for
+    // no upstream image to be mistaken for it, or it for one of theirs.
+    static const uint8_t SERIAL_VERSION_COMPRESSED = 0xD5;
     static const uint8_t FAMILY = 15;
 
     enum flags { IS_EMPTY, IS_LEVEL_ZERO_SORTED, IS_SINGLE_ITEM };
@@ -497,6 +551,8 @@ class kll_sketch {
     static const uint8_t PREAMBLE_INTS_SHORT = 2; // for empty and single item
     static const uint8_t PREAMBLE_INTS_FULL = 5;
 
+    static const uint8_t MERGE_GROUP_FACTOR = 2;
+
     A allocator_;
     uint16_t k_;
     uint8_t m_; // minimum buffer "width"
@@ -511,6 +567,7 @@ class kll_sketch {
     bool is_level_zero_sorted_;
 
     friend class kll_quantile_calculator<T, C, A>;
+    template<typename TT, typename CC> friend class wrapped_kll_sketch;
 
     // for deserialization
     class item_deleter;
@@ -539,6 +596,9 @@ class kll_sketch {
     template<typename O> void merge_higher_levels(O&& other, uint64_t final_n);
     void populate_work_arrays(const kll_sketch& other, T* workbuf, uint32_t* worklevels, uint8_t provisional_num_levels);
     void populate_work_arrays(kll_sketch&& other, T* workbuf, uint32_t* worklevels, uint8_t provisional_num_levels);
+    void populate_work_arrays(const wrapped_kll_sketch<T, C>& other, T* workbuf, uint32_t* worklevels, uint8_t provisional_num_levels);
+    template<typename Iterator> void merge_group(Iterator first, Iterator last);
+    void move_from_work_arrays(T* workbuf, const uint32_t* outlevels, const kll_helper::compress_result& result);
     void assert_correct_total_weight() const;
     uint32_t safe_level_size(uint8_t level) const;
     uint32_t get_num_retained_above_level_zero() const;
@@ -548,6 +608,13 @@ class kll_sketch {
     static void check_serial_version(uint8_t serial_version);
     static void check_family_id(uint8_t family_id);
 
+    // only unsigned integers in ascending order are written in the compressed format
+    using is_compressible = std::integral_constant<bool,
+        std::is_integral<T>::value && std::is_unsigned<T>::value && !std::is_same<T, bool>::value
+        && std::is_same<C, std::less<T>>::value>;
+    static kll_sketch deserialize_compressed(const void* bytes, size_t size, const A& allocator, std::true_type);
+    static kll_sketch deserialize_compressed(const void* bytes, size_t size, const A& allocator, std::false_type);
+
     // implementations for floating point types
     template<typename TT = T, typename std::enable_if<std::is_floating_point<TT>::value, int>::type = 0>
     static TT get_invalid_value() {
@@ -573,8 +640,13 @@ class kll_sketch {
 };
 
 template<typename T, typename C, typename S, typename A>
-class kll_sketch<T, C, S, A>::const_iterator: public std::iterator<std::input_iterator_tag, T> {
+class kll_sketch<T, C, S, A>::const_iterator {
 public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T*;
+  using reference = T&;
   friend class kll_sketch<T, C, S, A>;
   const_iterator& operator++();
   const_iterator& operator++(int);
@@ -22,6 +22,7 @@
 
 #include <iostream>
 #include <iomanip>
+#include <iterator>
 #include <sstream>
 
 #include "memory_operations.hpp"
@@ -161,6 +162,33 @@ void kll_sketch<T, C, S, A>::update(T&& value) {
   new (&items_[index]) T(std::move(value));
 }
 
+template<typename T, typename C, typename S, typename A>
+void kll_sketch<T, C, S, A>::update(const T* values, size_t size) {
+  size_t i = 0;
+  while (i < size && is_empty()) update(values[i++]);
+  if (i == size) return;
+  T min_value(*min_value_);
+  T max_value(*max_value_);
+  while (i < size) {
+    if (levels_[0] == 0) compress_while_updating();
+    // fill the free slots below level zero top down, into the same places as update() would
+    uint32_t index = levels_[0];
+    const size_t lim = i + std::min<size_t>(index, size - i);
+    for (; i < lim; i++) {
+      const T& value = values[i];
+      if (!check_update_value(value)) continue;
+      if (C()(value, min_value)) min_value = value;
+      if (C()(max_value, value)) max_value = value;
+      new (&items_[--index]) T(value);
+    }
+    n_ += levels_[0] - index;
+    levels_[0] = index;
+    is_level_zero_sorted_ = false;
+  }
+  *min_value_ = std::move(min_value);
+  *max_value_ = std::move(max_value);
+}
+
 template<typename T, typename C, typename S, typename A>
 void kll_sketch<T, C, S, A>::update_min_max(const T& value) {
   if (is_empty()) {
@@ -228,6 +256,109 @@ void kll_sketch<T, C, S, A>::merge(kll_sketch&& other) {
   assert_correct_total_weight();
 }
 
+template<typename T, typename C, typename S, typename A>
+template<typename Iterator>
+void kll_sketch<T, C, S, A>::merge(Iterator first, Iterator last) {
+  while (first != last) {
+    // sketches are merged in groups whose work buffer stays within a small multiple of this sketch,
+    // past which merging their sorted runs costs more than compressing once per sketch
+    const uint32_t budget = MERGE_GROUP_FACTOR * std::max<uint32_t>(items_size_, k_);
+    uint32_t group_items = get_num_retained();
+    Iterator group_last = first;
+    do {
+      group_items += group_last->get_num_retained();
+      ++group_last;
+    } while (group_last != last && group_items + group_last->get_num_retained() <= budget);
+    if (std::next(first) == group_last) {
+      merge(*first);
+    } else {
+      merge_group(first, group_last);
+    }
+    first = group_last;
+  }
+}
+
+template<typename T, typename C, typename S, typename A>
+template<typename Iterator>
+void kll_sketch<T, C, S, A>::merge_group(Iterator first, Iterator last) {
+  uint64_t final_n = n_;
+  uint32_t tmp_num_items = get_num_retained();
+  uint8_t provisional_num_levels = num_levels_;
+  for (Iterator it = first; it != last; ++it) {
+    const kll_sketch& other = *it;
+    if (other.is_empty()) continue;
+    if (m_ != other.m_) {
+      throw std::invalid_argument("incompatible M: " + std::to_string(m_) + " and " + std::to_string(other.m_));
+    }
+    if (final_n == 0) {
+      min_value_ = new (allocator_.allocate(1)) T(*other.min_value_);
+      max_value_ = new (allocator_.allocate(1)) T(*other.max_value_);
+    } else {
+      if (C()(*other.min_value_, *min_value_)) *min_value_ = *other.min_value_;
+      if (C()(*max_value_, *other.max_value_)) *max_value_ = *other.max_value_;
+    }
+    final_n += other.n_;
+    tmp_num_items += other.get_num_retained();
+    provisional_num_levels = std::max(provisional_num_levels, other.num_levels_);
+    if (other.is_estimation_mode()) min_k_ = std::min(min_k_, other.min_k_);
+  }
+  if (final_n == n_) return;
+
+  A alloc(allocator_);
+  auto tmp_items_deleter = [tmp_num_items, &alloc](T* ptr) { alloc.deallocate(ptr, tmp_num_items); }; // no destructor needed
+  const std::unique_ptr<T, decltype(tmp_items_deleter)> workbuf(allocator_.allocate(tmp_num_items), tmp_items_deleter);
+  const uint8_t ub = kll_helper::ub_on_num_levels(final_n);
+  const size_t work_levels_size = ub + 2; // ub+1 does not work
+  vector_u32<A> worklevels(work_levels_size, 0, allocator_);
+  vector_u32<A> outlevels(work_levels_size, 0, allocator_);
+  vector_u32<A> runs(allocator_);
+
+  // every level of every sketch is appended to the same level of the work buffer,
+  // level zero unsorted and the sorted levels above it merged run by run
+  for (uint8_t lvl = 0; lvl < provisional_num_levels; lvl++) {
+    uint32_t end = worklevels[lvl];
+    runs.assign(1, end);
+    const uint32_t self_pop = safe_level_size(lvl);
+    if (self_pop > 0) {
+      kll_helper::move_construct<T>(items_, levels_[lvl], levels_[lvl] + self_pop, workbuf.get(), end, true);
+      end += self_pop;
+      runs.push_back(end);
+    }
+    for (Iterator it = first; it != last; ++it) {
+      const kll_sketch& other = *it;
+      const uint32_t other_pop = other.is_empty() ? 0 : other.safe_level_size(lvl);
+      if (other_pop > 0) {
+        kll_helper::copy_construct<T>(other.items_, other.levels_[lvl], other.levels_[lvl] + other_pop, workbuf.get(), end);
+        end += other_pop;
+        runs.push_back(end);
+      }
+    }
+    worklevels[lvl + 1] = end;
+    if (lvl == 0) continue;
+    // merge adjacent runs pairwise until one is left
+    while (runs.size() > 2) {
+      size_t kept = 1;
+      for (size_t i = 2; i < runs.size(); i += 2) {
+        std::inplace_merge(workbuf.get() + runs[i - 2], workbuf.get() + runs[i - 1], workbuf.get() + runs[i], C());
+        runs[kept++] = runs[i];
+      }
+      if (runs.size() % 2 == 0) runs[kept++] = runs.back();
+      runs.resize(kept);
+    }
+  }
+
+  const kll_helper::compress_result result = kll_helper::general_compress<T, C>(k_, m_, provisional_num_levels, workbuf.get(),
+      worklevels.data(), outlevels.data(), false);
+
+  // ub can sometimes be much bigger
+  if (result.final_num_levels > ub) throw std::logic_error("merge error");
+
+  move_from_work_arrays(workbuf.get(), outlevels.data(), result);
+  n_ = final_n;
+  is_level_zero_sorted_ = false;
+  assert_correct_total_weight();
+}
+
 template<typename T, typename C, typename S, typename A>
 bool kll_sketch<T, C, S, A>::is_empty() const {
   return n_ == 0;
@@ -356,6 +487,14 @@ double kll_sketch<T, C, S, A>::get_normalized_rank_error(bool pmf) const {
   return get_normalized_rank_error(min_k_, pmf);
 }
 
+template<typename T, typename C, typename S, typename A>
+size_t kll_sketch<T, C, S, A>::get_memory_usage_bytes() const {
+  size_t size = items_size_ * sizeof(T) + levels_.capacity() * sizeof(uint32_t);
+  if (min_value_ != nullptr) size += sizeof(T);
+  if (max_value_ != nullptr) size += sizeof(T);
+  return size;
+}
+
 // implementation for fixed-size arithmetic types (integral and floating point)
 template<typename T, typename C, typename S, typename A>
 template<typename TT, typename std::enable_if<std::is_arithmetic<TT>::value, int>::type>
@@ -476,6 +615,66 @@ vector_u8<A> kll_sketch<T, C, S, A>::serialize(unsigned header_size_bytes) const
   return bytes;
 }
 
+template<typename T, typename C, typename S, typename A>
+vector_u8<A> kll_sketch<T, C, S, A>::serialize_compressed(unsigned header_size_bytes) const {
+  static_assert(is_compressible::value, "only sketches of unsigned integers in ascending order can be compressed");
+  if (is_empty() || n_ == 1) return serialize(header_size_bytes);
+  // level zero may be unsorted, so it is written from a sorted copy
+  std::vector<T, A> level_zero(&items_[levels_[0]], &items_[levels_[1]], allocator_);
+  if (!is_level_zero_sorted_) kll_helper::sort_level<T, C>(level_zero.data(), 0, static_cast<uint32_t>(level_zero.size()));
+  auto level_items = [this, &level_zero](uint8_t lvl) -> const T* {
+    return lvl == 0 ? level_zero.data() : &items_[levels_[lvl]];
+  };
+
+  // each level's items are written as differences from the one before, the first from the minimum
+  size_t size = header_size_bytes + DATA_START;
+  size += kll_helper::varint_size(*min_value_) + kll_helper::varint_size(*max_value_ - *min_value_);
+  for (uint8_t lvl = 0; lvl < num_levels_; lvl++) {
+    const uint32_t level_size = levels_[lvl + 1] - levels_[lvl];
+    size += kll_helper::varint_size(level_size);
+    const T* items = level_items(lvl);
+    T previous = *min_value_;
+    for (uint32_t i = 0; i < level_size; i++) {
+      size += kll_helper::varint_size(items[i] - previous);
+      previous = items[i];
+    }
+  }
+  // values spread over most of the range of T take as many bytes or more
+  if (size >= header_size_bytes + get_serialized_size_bytes()) return serialize(header_size_bytes);
+
+  vector_u8<A> bytes(size, 0, allocator_);
+  uint8_t* ptr = bytes.data() + header_size_bytes;
+  const uint8_t preamble_ints(PREAMBLE_INTS_FULL);
+  ptr += copy_to_mem(preamble_ints, ptr);
+  const uint8_t serial_version(SERIAL_VERSION_COMPRESSED);
+  ptr += copy_to_mem(serial_version, ptr);
+  const uint8_t family(FAMILY);
+  ptr += copy_to_mem(family, ptr);
+  const uint8_t flags_byte(1 << flags::IS_LEVEL_ZERO_SORTED);
+  ptr += copy_to_mem(flags_byte, ptr);
+  ptr += copy_to_mem(k_, ptr);
+  ptr += copy_to_mem(m_, ptr);
+  ptr += sizeof(uint8_t); // unused
+  ptr += copy_to_mem(n_, ptr);
+  ptr += copy_to_mem(min_k_, ptr);
+  ptr += copy_to_mem(num_levels_, ptr);
+  ptr += sizeof(uint8_t); // unused
+  for (uint8_t lvl = 0; lvl < num_levels_; lvl++) ptr = kll_helper::write_varint(levels_[lvl + 1] - levels_[lvl], ptr);
+  ptr = kll_helper::write_varint(*min_value_, ptr);
+  ptr = kll_helper::write_varint(*max_value_ - *min_value_, ptr);
+  for (uint8_t lvl = 0; lvl < num_levels_; lvl++) {
+    const T* items = level_items(lvl);
+    T previous = *min_value_;
+    for (uint32_t i = 0; i < levels_[lvl + 1] - levels_[lvl]; i++) {
+      ptr = kll_helper::write_varint(items[i] - previous, ptr);
+      previous = items[i];
+    }
+  }
+  const size_t delta = ptr - bytes.data();
+  if (delta != size) throw std::logic_error("serialized size mismatch: " + std::to_string(delta) + " != " + std::to_string(size));
+  return bytes;
+}
+
 template<typename T, typename C, typename S, typename A>
 kll_sketch<T, C, S, A> kll_sketch<T, C, S, A>::deserialize(std::istream& is, const A& allocator) {
   const auto preamble_ints = read<uint8_t>(is);
@@ -571,6 +770,7 @@ kll_sketch<T, C, S, A> kll_sketch<T, C, S, A>::deserialize(const void* bytes, si
   ptr += copy_from_mem(ptr, m);
   ptr += sizeof(uint8_t); // skip unused byte
 
+  if (serial_version == SERIAL_VERSION_COMPRESSED) return deserialize_compressed(bytes, size, allocator, is_compressible());
   check_m(m);
   check_preamble_ints(preamble_ints, flags_byte);
   check_serial_version(serial_version);
@@ -639,6 +839,93 @@ kll_sketch<T, C, S, A> kll_sketch<T, C, S, A>::deserialize(const void* bytes, si
       std::move(min_value), std::move(max_value), is_level_zero_sorted);
 }
 
+template<typename T, typename C, typename S, typename A>
+kll_sketch<T, C, S, A> kll_sketch<T, C, S, A>::deserialize_compressed(const void* bytes, size_t size,
+    const A& allocator, std::true_type) {
+  ensure_minimum_memory(size, DATA_START);
+  const uint8_t* ptr = static_cast<const uint8_t*>(bytes);
+  const uint8_t* end_ptr = ptr + size;
+  uint8_t preamble_ints;
+  ptr += copy_from_mem(ptr, preamble_ints);
+  ptr += sizeof(uint8_t); // serial version, already checked
+  uint8_t family_id;
+  ptr += copy_from_mem(ptr, family_id);
+  uint8_t flags_byte;
+  ptr += copy_from_mem(ptr, flags_byte);
+  uint16_t k;
+  ptr += copy_from_mem(ptr, k);
+  uint8_t m;
+  ptr += copy_from_mem(ptr, m);
+  ptr += sizeof(uint8_t); // skip unused byte
+  uint64_t n;
+  ptr += copy_from_mem(ptr, n);
+  uint16_t min_k;
+  ptr += copy_from_mem(ptr, min_k);
+  uint8_t num_levels;
+  ptr += copy_from_mem(ptr, num_levels);
+  ptr += sizeof(uint8_t); // skip unused byte
+
+  check_m(m);
+  check_family_id(family_id);
+  // empty and single-item sketches are never compressed
+  if (preamble_ints != PREAMBLE_INTS_FULL || (flags_byte & ((1 << flags::IS_EMPTY) | (1 << flags::IS_SINGLE_ITEM)))) {
+    throw std::invalid_argument("Possible corruption: compressed sketches must have a full preamble");
+  }
+  if (num_levels == 0) throw std::invalid_argument("Possible corruption: no levels");
+
+  // the items end at the capacity as in the other formats, so the level sizes place them
+  const uint32_t capacity(kll_helper::compute_total_capacity(k, m, num_levels));
+  vector_u32<A> levels(num_levels + 1, 0, allocator);
+  uint64_t num_items = 0;
+  for (uint8_t lvl = 0; lvl < num_levels; lvl++) {
+    uint64_t level_size;
+    ptr = kll_helper::read_varint(ptr, end_ptr, level_size);
+    num_items += level_size;
+    if (level_size > capacity || num_items > capacity) {
+      throw std::invalid_argument("Possible corruption: more items than the capacity " + std::to_string(capacity));
+    }
+    levels[lvl + 1] = static_cast<uint32_t>(level_size);
+  }
+  if (num_items == 0) throw std::invalid_argument("Possible corruption: no items in a sketch that is not empty");
+  levels[0] = capacity - static_cast<uint32_t>(num_items);
+  for (uint8_t lvl = 0; lvl < num_levels; lvl++) levels[lvl + 1] += levels[lvl];
+
+  uint64_t min_value;
+  ptr = kll_helper::read_varint(ptr, end_ptr, min_value);
+  uint64_t max_value;
+  ptr = kll_helper::read_varint(ptr, end_ptr, max_value);
+  max_value += min_value;
+  if (max_value < min_value || max_value > std::numeric_limits<T>::max()) {
+    throw std::invalid_argument("Possible corruption: maximum out of range");
+  }
+  A alloc(allocator);
+  auto items_buffer_deleter = [capacity, &alloc](T* ptr) { alloc.deallocate(ptr, capacity); };
+  std::unique_ptr<T, decltype(items_buffer_deleter)> items_buffer(alloc.allocate(capacity), items_buffer_deleter);
+  for (uint8_t lvl = 0; lvl < num_levels; lvl++) {
+    uint64_t previous = min_value;
+    for (uint32_t i = levels[lvl]; i < levels[lvl + 1]; i++) {
+      uint64_t delta;
+      ptr = kll_helper::read_varint(ptr, end_ptr, delta);
+      const uint64_t item = previous + delta;
+      if (item < previous || item > max_value) throw std::invalid_argument("Possible corruption: item out of range");
+      items_buffer.get()[i] = static_cast<T>(item);
+      previous = item;
+    }
+  }
+  const size_t delta = ptr - static_cast<const uint8_t*>(bytes);
+  if (delta != size) throw std::logic_error("deserialized size mismatch: " + std::to_string(delta) + " != " + std::to_string(size));
+  std::unique_ptr<T, items_deleter> items(items_buffer.release(), items_deleter(levels[0], capacity, allocator));
+  std::unique_ptr<T, item_deleter> min(new (alloc.allocate(1)) T(static_cast<T>(min_value)), item_deleter(allocator));
+  std::unique_ptr<T, item_deleter> max(new (alloc.allocate(1)) T(static_cast<T>(max_value)), item_deleter(allocator));
+  return kll_sketch(k, min_k, n, num_levels, std::move(levels), std::move(items), capacity,
+      std::move(min), std::move(max), true);
+}
+
+template<typename T, typename C, typename S, typename A>
+kll_sketch<T, C, S, A> kll_sketch<T, C, S, A>::deserialize_compressed(const void*, size_t, const A&, std::false_type) {
+  throw std::invalid_argument("Possible corruption: only sketches of unsigned integers are compressed");
+}
+
 /*
  * Gets the normalized rank error given k and pmf.
  * k - the configuration parameter
@@ -699,7 +986,7 @@ void kll_sketch<T, C, S, A>::compress_while_updating(void) {
   // level zero might not be sorted, so we must sort it if we wish to compact it
   // sort_level_zero() is not used here because of the adjustment for odd number of items
   if ((level == 0) && !is_level_zero_sorted_) {
-    std::sort(&items_[adj_beg], &items_[adj_beg + adj_pop], C());
+    kll_helper::sort_level<T, C>(items_, adj_beg, adj_pop);
   }
   if (pop_above == 0) {
     kll_helper::randomly_halve_up(items_, adj_beg, adj_pop);
@@ -780,7 +1067,7 @@ void kll_sketch<T, C, S, A>::add_empty_top_level_to_completely_full_sketch() {
 template<typename T, typename C, typename S, typename A>
 void kll_sketch<T, C, S, A>::sort_level_zero() {
   if (!is_level_zero_sorted_) {
-    std::sort(&items_[levels_[0]], &items_[levels_[1]], C());
+    kll_helper::sort_level<T, C>(items_, levels_[0], levels_[1] - levels_[0]);
     is_level_zero_sorted_ = true;
   }
 }
@@ -889,6 +1176,11 @@ void kll_sketch<T, C, S, A>::merge_higher_levels(O&& other, uint64_t final_n) {
   // ub can sometimes be much bigger
   if (result.final_num_levels > ub) throw std::logic_error("merge error");
 
+  move_from_work_arrays(workbuf.get(), outlevels.data(), result);
+}
+
+template<typename T, typename C, typename S, typename A>
+void kll_sketch<T, C, S, A>::move_from_work_arrays(T* workbuf, const uint32_t* outlevels, const kll_helper::compress_result& result) {
   // now we need to transfer the results back into "this" sketch
   if (result.final_capacity != items_size_) {
     allocator_.deallocate(items_, items_size_);
@@ -896,7 +1188,7 @@ void kll_sketch<T, C, S, A>::merge_higher_levels(O&& other, uint64_t final_n) {
     items_ = allocator_.allocate(items_size_);
   }
   const uint32_t free_space_at_bottom = result.final_capacity - result.final_num_items;
-  kll_helper::move_construct<T>(workbuf.get(), outlevels[0], outlevels[0] + result.final_num_items, items_, free_space_at_bottom, true);
+  kll_helper::move_construct<T>(workbuf, outlevels[0], outlevels[0] + result.final_num_items, items_, free_space_at_bottom, true);
 
   const size_t new_levels_size = result.final_num_levels + 1;
   if (levels_.size() < new_levels_size) {
@@ -0,0 +1,78 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef KLL_SORTED_VIEW_HPP_
+#define KLL_SORTED_VIEW_HPP_
+
+#include <vector>
+
+#include "kll_sketch.hpp"
+
+namespace datasketches {
+
+class kolmogorov_smirnov;
+
+/**
+ * The retained items of a kll_sketch, merged into one sorted array with the total weight
+ * of the items preceding each. This is what get_quantile() and get_quantiles() build for
+ * every call through kll_quantile_calculator, and building it once makes any number of
+ * quantile, rank, CDF and PMF queries binary searches over it.
+ *
+ * The queries give the same results as those of the sketch the view was made from, and
+ * the view does not change with the sketch, which can be updated or dropped meanwhile.
+ */
+template<typename T, typename C = std::less<T>, typename A = std::allocator<T>>
+class kll_sorted_view {
+public:
+  template<typename S>
+  explicit kll_sorted_view(const kll_sketch<T, C, S, A>& sketch, const A& allocator = A());
+
+  bool is_empty() const;
+  uint64_t get_n() const;
+  uint32_t get_num_retained() const;
+  // heap bytes held by the items and their weights
+  size_t get_memory_usage_bytes() const;
+
+  // queries of an empty view return NaN or empty vectors, as those of an empty sketch do
+  T get_quantile(double fraction) const;
+  std::vector<T, A> get_quantiles(const double* fractions, uint32_t size) const;
+  double get_rank(const T& value) const;
+  vector_d<A> get_PMF(const T* split_points, uint32_t size) const;
+  vector_d<A> get_CDF(const T* split_points, uint32_t size) const;
+
+private:
+  using AllocU64 = typename std::allocator_traits<A>::template rebind_alloc<uint64_t>;
+
+  uint64_t n_;
+  std::vector<T, A> min_max_;
+  std::vector<T, A> items_;
+  // the total weight of the items before each of items_
+  std::vector<uint64_t, AllocU64> preceding_weights_;
+
+  uint64_t get_weight_less_than(const T& value) const;
+
+  friend class kolmogorov_smirnov;
+  vector_d<A> get_weights_less_than(const T* split_points, uint32_t size) const;
+};
+
+} /* namespace datasketches */
+
+#include "kll_sorted_view_impl.hpp"
+
+#endif
@@ -0,0 +1,144 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef KLL_SORTED_VIEW_IMPL_HPP_
+#define KLL_SORTED_VIEW_IMPL_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+
+#include "kll_helper.hpp"
+
+namespace datasketches {
+
+template<typename T, typename C, typename A>
+template<typename S>
+kll_sorted_view<T, C, A>::kll_sorted_view(const kll_sketch<T, C, S, A>& sketch, const A& allocator):
+n_(sketch.get_n()),
+min_max_(allocator),
+items_(allocator),
+preceding_weights_(AllocU64(allocator))
+{
+  if (sketch.is_empty()) return;
+  min_max_.push_back(sketch.get_min_value());
+  min_max_.push_back(sketch.get_max_value());
+  // the calculator sorts a copy of an unsorted level zero, and leaves the sketch as it is
+  const kll_quantile_calculator<T, C, A> calculator(sketch);
+  const size_t num_items = std::distance(calculator.begin(), calculator.end());
+  items_.reserve(num_items);
+  preceding_weights_.reserve(num_items);
+  for (const auto& entry: calculator) {
+    items_.push_back(entry.first);
+    preceding_weights_.push_back(entry.second);
+  }
+}
+
+template<typename T, typename C, typename A>
+bool kll_sorted_view<T, C, A>::is_empty() const {
+  return n_ == 0;
+}
+
+template<typename T, typename C, typename A>
+uint64_t kll_sorted_view<T, C, A>::get_n() const {
+  return n_;
+}
+
+template<typename T, typename C, typename A>
+uint32_t kll_sorted_view<T, C, A>::get_num_retained() const {
+  return static_cast<uint32_t>(items_.size());
+}
+
+template<typename T, typename C, typename A>
+size_t kll_sorted_view<T, C, A>::get_memory_usage_bytes() const {
+  return (min_max_.capacity() + items_.capacity()) * sizeof(T) + preceding_weights_.capacity() * sizeof(uint64_t);
+}
+
+template<typename T, typename C, typename A>
+T kll_sorted_view<T, C, A>::get_quantile(double fraction) const {
+  if (is_empty()) return std::numeric_limits<T>::quiet_NaN();
+  if (fraction == 0.0) return min_max_[0];
+  if (fraction == 1.0) return min_max_[1];
+  if ((fraction < 0.0) || (fraction > 1.0)) {
+    throw std::invalid_argument("Fraction cannot be less than zero or greater than 1.0");
+  }
+  // as kll_quantile_calculator::get_quantile: the item whose weight covers the position
+  uint64_t pos = static_cast<uint64_t>(std::floor(fraction * n_));
+  if (pos == n_) pos = n_ - 1;
+  const auto it = std::upper_bound(preceding_weights_.begin(), preceding_weights_.end(), pos);
+  return items_[std::distance(preceding_weights_.begin(), it) - 1];
+}
+
+template<typename T, typename C, typename A>
+std::vector<T, A> kll_sorted_view<T, C, A>::get_quantiles(const double* fractions, uint32_t size) const {
+  std::vector<T, A> quantiles(items_.get_allocator());
+  if (is_empty()) return quantiles;
+  quantiles.reserve(size);
+  for (uint32_t i = 0; i < size; i++) quantiles.push_back(get_quantile(fractions[i]));
+  return quantiles;
+}
+
+template<typename T, typename C, typename A>
+uint64_t kll_sorted_view<T, C, A>::get_weight_less_than(const T& value) const {
+  const auto it = std::lower_bound(items_.begin(), items_.end(), value, C());
+  return it == items_.end() ? n_ : preceding_weights_[std::distance(items_.begin(), it)];
+}
+
+template<typename T, typename C, typename A>
+double kll_sorted_view<T, C, A>::get_rank(const T& value) const {
+  if (is_empty()) return std::numeric_limits<double>::quiet_NaN();
+  return static_cast<double>(get_weight_less_than(value)) / n_;
+}
+
+template<typename T, typename C, typename A>
+vector_d<A> kll_sorted_view<T, C, A>::get_weights_less_than(const T* split_points, uint32_t size) const {
+  kll_helper::validate_values<T, C>(split_points, size);
+  vector_d<A> weights(size + 1, 0, items_.get_allocator());
+  // the split points increase, so each search starts where the one before ended
+  auto from = items_.cbegin();
+  for (uint32_t i = 0; i < size; i++) {
+    from = std::lower_bound(from, items_.cend(), split_points[i], C());
+    weights[i] = static_cast<double>(from == items_.cend() ? n_ : preceding_weights_[std::distance(items_.cbegin(), from)]);
+  }
+  weights[size] = static_cast<double>(n_);
+  return weights;
+}
+
+template<typename T, typename C, typename A>
+vector_d<A> kll_sorted_view<T, C, A>::get_PMF(const T* split_points, uint32_t size) const {
+  if (is_empty()) return vector_d<A>(items_.get_allocator());
+  vector_d<A> buckets = get_weights_less_than(split_points, size);
+  // the weights are integers, so their differences and ratios round as the sketch's do
+  for (uint32_t i = size; i > 0; i--) buckets[i] = (buckets[i] - buckets[i - 1]) / n_;
+  buckets[0] /= n_;
+  return buckets;
+}
+
+template<typename T, typename C, typename A>
+vector_d<A> kll_sorted_view<T, C, A>::get_CDF(const T* split_points, uint32_t size) const {
+  if (is_empty()) return vector_d<A>(items_.get_allocator());
+  vector_d<A> buckets = get_weights_less_than(split_points, size);
+  for (uint32_t i = 0; i <= size; i++) buckets[i] /= n_;
+  return buckets;
+}
+
+} /* namespace datasketches */
+
+#endif
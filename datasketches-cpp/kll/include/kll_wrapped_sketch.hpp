@@ -0,0 +1,101 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef KLL_WRAPPED_SKETCH_HPP_
+#define KLL_WRAPPED_SKETCH_HPP_
+
+#include <type_traits>
+
+#include "kll_sketch.hpp"
+
+namespace datasketches {
+
+/**
+ * Read-only view of a serialized kll_sketch of an arithmetic type, which reads the levels
+ * and items straight from the serialized bytes instead of copying them into a sketch.
+ * The bytes must outlive the view.
+ *
+ * Ranks and quantiles are answered without allocating, with the same results as those of
+ * the deserialized sketch, and the view can be merged into a kll_sketch as a sketch can.
+ * Each query searches the levels in place rather than a merged sorted array, so a sketch
+ * or kll_sorted_view answers many queries of the same data faster.
+ */
+template<typename T, typename C = std::less<T>>
+class wrapped_kll_sketch {
+  static_assert(std::is_arithmetic<T>::value, "items are read in place, so they must be of an arithmetic type");
+public:
+  /**
+   * This method wraps a serialized sketch as an array of bytes.
+   * @param bytes pointer to the array of bytes, which need not be aligned
+   * @param size the size of the array
+   * @return an instance of the view
+   */
+  static wrapped_kll_sketch wrap(const void* bytes, size_t size);
+
+  bool is_empty() const;
+  uint16_t get_k() const;
+  uint64_t get_n() const;
+  uint32_t get_num_retained() const;
+  bool is_estimation_mode() const;
+
+  // as those of kll_sketch, which throw for an empty sketch of a type other than floating point
+  T get_min_value() const;
+  T get_max_value() const;
+  T get_quantile(double fraction) const;
+  double get_rank(T value) const;
+
+private:
+  using sketch = kll_sketch<T, C>;
+
+  uint16_t k_;
+  uint8_t m_;
+  uint16_t min_k_;
+  uint64_t n_;
+  uint8_t num_levels_;
+  // the serialized levels, or null for a single item, whose level zero holds just that item
+  const char* levels_;
+  // the total capacity, which is the derived last level
+  uint32_t capacity_;
+  // the items from levels[0] on
+  const char* items_;
+  uint32_t first_;
+  T min_value_;
+  T max_value_;
+  bool is_level_zero_sorted_;
+
+  template<typename TT, typename CC, typename SS, typename AA> friend class kll_sketch;
+
+  wrapped_kll_sketch(uint16_t k, uint8_t m);
+
+  uint32_t level(uint8_t lvl) const;
+  uint32_t safe_level_size(uint8_t lvl) const;
+  uint32_t get_num_retained_above_level_zero() const;
+  T item(uint32_t index) const;
+  // the first index in [from, to) of a sorted level whose item fails the predicate
+  template<typename P>
+  uint32_t partition_point(uint32_t from, uint32_t to, P predicate) const;
+  uint32_t count_less_than(uint8_t lvl, T value) const;
+  uint64_t get_weight_less_than(T value) const;
+};
+
+} /* namespace datasketches */
+
+#include "kll_wrapped_sketch_impl.hpp"
+
+#endif
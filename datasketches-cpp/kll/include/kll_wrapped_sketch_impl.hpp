@@ -0,0 +1,355 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef KLL_WRAPPED_SKETCH_IMPL_HPP_
+#define KLL_WRAPPED_SKETCH_IMPL_HPP_
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "kll_helper.hpp"
+#include "memory_operations.hpp"
+
+namespace datasketches {
+
+template<typename T, typename C>
+wrapped_kll_sketch<T, C>::wrapped_kll_sketch(uint16_t k, uint8_t m):
+k_(k),
+m_(m),
+min_k_(k),
+n_(0),
+num_levels_(1),
+levels_(nullptr),
+capacity_(0),
+items_(nullptr),
+first_(0),
+min_value_(),
+max_value_(),
+is_level_zero_sorted_(false)
+{}
+
+template<typename T, typename C>
+wrapped_kll_sketch<T, C> wrapped_kll_sketch<T, C>::wrap(const void* bytes, size_t size) {
+  ensure_minimum_memory(size, 8);
+  const char* ptr = static_cast<const char*>(bytes);
+  uint8_t preamble_ints;
+  ptr += copy_from_mem(ptr, preamble_ints);
+  uint8_t serial_version;
+  ptr += copy_from_mem(ptr, serial_version);
+  uint8_t family_id;
+  ptr += copy_from_mem(ptr, family_id);
+  uint8_t flags_byte;
+  ptr += copy_from_mem(ptr, flags_byte);
+  uint16_t k;
+  ptr += copy_from_mem(ptr, k);
+  uint8_t m;
+  ptr += copy_from_mem(ptr, m);
+  ptr += sizeof(uint8_t); // skip unused byte
+
+  if (serial_version == sketch::SERIAL_VERSION_COMPRESSED) {
+    throw std::invalid_argument("compressed sketches cannot be wrapped, they must be deserialized");
+  }
+  sketch::check_m(m);
+  sketch::check_preamble_ints(preamble_ints, flags_byte);
+  sketch::check_serial_version(serial_version);
+  sketch::check_family_id(family_id);
+  ensure_minimum_memory(size, 1ULL << preamble_ints);
+
+  wrapped_kll_sketch wrapped(k, m);
+  const bool is_empty(flags_byte & (1 << sketch::flags::IS_EMPTY));
+  if (is_empty) return wrapped;
+
+  const bool is_single_item(flags_byte & (1 << sketch::flags::IS_SINGLE_ITEM)); // used in serial version 2
+  const size_t end = size;
+  if (is_single_item) {
+    wrapped.n_ = 1;
+  } else {
+    ensure_minimum_memory(size, sketch::DATA_START);
+    ptr += copy_from_mem(ptr, wrapped.n_);
+    ptr += copy_from_mem(ptr, wrapped.min_k_);
+    ptr += copy_from_mem(ptr, wrapped.num_levels_);
+    ptr += sizeof(uint8_t); // skip unused byte
+    if (wrapped.num_levels_ == 0) throw std::invalid_argument("Possible corruption: no levels");
+  }
+  wrapped.capacity_ = kll_helper::compute_total_capacity(k, m, wrapped.num_levels_);
+  if (is_single_item) {
+    wrapped.first_ = wrapped.capacity_ - 1;
+  } else {
+    // the last level is not serialized because it can be derived
+    ensure_minimum_memory(end - (ptr - static_cast<const char*>(bytes)), sizeof(uint32_t) * wrapped.num_levels_ + 2 * sizeof(T));
+    wrapped.levels_ = ptr;
+    ptr += sizeof(uint32_t) * wrapped.num_levels_;
+    copy_from_mem(wrapped.levels_, wrapped.first_);
+    // every query reads the levels, so they are checked once here
+    for (uint8_t lvl = 0; lvl < wrapped.num_levels_; ++lvl) {
+      if (wrapped.level(lvl + 1) < wrapped.level(lvl)) {
+        throw std::invalid_argument("Possible corruption: levels must not decrease");
+      }
+    }
+    ptr += copy_from_mem(ptr, wrapped.min_value_);
+    ptr += copy_from_mem(ptr, wrapped.max_value_);
+  }
+  wrapped.items_ = ptr;
+  const size_t delta = (ptr - static_cast<const char*>(bytes)) + sizeof(T) * wrapped.get_num_retained();
+  if (delta != size) throw std::logic_error("wrapped size mismatch: " + std::to_string(delta) + " != " + std::to_string(size));
+  wrapped.is_level_zero_sorted_ = (flags_byte & (1 << sketch::flags::IS_LEVEL_ZERO_SORTED)) > 0;
+  if (is_single_item) {
+    wrapped.min_value_ = wrapped.item(wrapped.first_);
+    wrapped.max_value_ = wrapped.min_value_;
+  }
+  return wrapped;
+}
+
+template<typename T, typename C>
+bool wrapped_kll_sketch<T, C>::is_empty() const {
+  return n_ == 0;
+}
+
+template<typename T, typename C>
+uint16_t wrapped_kll_sketch<T, C>::get_k() const {
+  return k_;
+}
+
+template<typename T, typename C>
+uint64_t wrapped_kll_sketch<T, C>::get_n() const {
+  return n_;
+}
+
+template<typename T, typename C>
+uint32_t wrapped_kll_sketch<T, C>::get_num_retained() const {
+  return capacity_ - first_;
+}
+
+template<typename T, typename C>
+bool wrapped_kll_sketch<T, C>::is_estimation_mode() const {
+  return num_levels_ > 1;
+}
+
+template<typename T, typename C>
+T wrapped_kll_sketch<T, C>::get_min_value() const {
+  if (is_empty()) return sketch::get_invalid_value();
+  return min_value_;
+}
+
+template<typename T, typename C>
+T wrapped_kll_sketch<T, C>::get_max_value() const {
+  if (is_empty()) return sketch::get_invalid_value();
+  return max_value_;
+}
+
+template<typename T, typename C>
+T wrapped_kll_sketch<T, C>::get_quantile(double fraction) const {
+  if (is_empty()) return sketch::get_invalid_value();
+  if (fraction == 0.0) return min_value_;
+  if (fraction == 1.0) return max_value_;
+  if ((fraction < 0.0) || (fraction > 1.0)) {
+    throw std::invalid_argument("Fraction cannot be less than zero or greater than 1.0");
+  }
+  // as kll_quantile_calculator::get_quantile: the greatest item with no more than the
+  // position's weight below it. That weight grows with the item, so the items are searched
+  // as if merged: each pivot splits the items between the bounds found so far, taken from
+  // the level holding the most of them. The least item has no weight below it, so the lower
+  // bound is always found.
+  uint64_t pos = static_cast<uint64_t>(std::floor(fraction * n_));
+  if (pos == n_) pos = n_ - 1;
+  bool has_lower = false;
+  bool has_upper = false;
+  T lower = min_value_;
+  T upper = max_value_;
+  const auto between = [&](T value) {
+    return (!has_lower || C()(lower, value)) && (!has_upper || C()(value, upper));
+  };
+  while (true) {
+    uint32_t most = 0;
+    T pivot = lower;
+    for (uint8_t lvl = 0; lvl < num_levels_; ++lvl) {
+      const uint32_t from = level(lvl);
+      const uint32_t to = level(lvl + 1);
+      if (lvl == 0 && !is_level_zero_sorted_) {
+        uint32_t num = 0;
+        for (uint32_t i = from; i < to; ++i) {
+          if (between(item(i))) ++num;
+        }
+        if (num <= most) continue;
+        most = num;
+        // the middle one in the order they are stored in, which is as good as any
+        uint32_t skip = num / 2;
+        for (uint32_t i = from; i < to; ++i) {
+          if (between(item(i)) && skip-- == 0) {
+            pivot = item(i);
+            break;
+          }
+        }
+      } else {
+        const uint32_t begin = has_lower ? partition_point(from, to, [&](T value) { return !C()(lower, value); }) : from;
+        const uint32_t end = has_upper ? partition_point(begin, to, [&](T value) { return C()(value, upper); }) : to;
+        if (end - begin <= most) continue;
+        most = end - begin;
+        pivot = item(begin + most / 2);
+      }
+    }
+    if (most == 0) return lower;
+    if (get_weight_less_than(pivot) <= pos) {
+      lower = pivot;
+      has_lower = true;
+    } else {
+      upper = pivot;
+      has_upper = true;
+    }
+  }
+}
+
+template<typename T, typename C>
+double wrapped_kll_sketch<T, C>::get_rank(T value) const {
+  if (is_empty()) return std::numeric_limits<double>::quiet_NaN();
+  return static_cast<double>(get_weight_less_than(value)) / n_;
+}
+
+template<typename T, typename C>
+uint32_t wrapped_kll_sketch<T, C>::level(uint8_t lvl) const {
+  if (lvl == num_levels_) return capacity_;
+  if (lvl == 0) return first_;
+  uint32_t index;
+  copy_from_mem(levels_ + sizeof(uint32_t) * lvl, index);
+  return index;
+}
+
+template<typename T, typename C>
+uint32_t wrapped_kll_sketch<T, C>::safe_level_size(uint8_t lvl) const {
+  if (lvl >= num_levels_) return 0;
+  return level(lvl + 1) - level(lvl);
+}
+
+template<typename T, typename C>
+uint32_t wrapped_kll_sketch<T, C>::get_num_retained_above_level_zero() const {
+  if (num_levels_ == 1) return 0;
+  return capacity_ - level(1);
+}
+
+template<typename T, typename C>
+T wrapped_kll_sketch<T, C>::item(uint32_t index) const {
+  T value;
+  copy_from_mem(items_ + sizeof(T) * (index - first_), value);
+  return value;
+}
+
+template<typename T, typename C>
+uint32_t wrapped_kll_sketch<T, C>::count_less_than(uint8_t lvl, T value) const {
+  const uint32_t from = level(lvl);
+  const uint32_t to = level(lvl + 1);
+  if (lvl == 0 && !is_level_zero_sorted_) {
+    uint32_t count = 0;
+    for (uint32_t i = from; i < to; ++i) {
+      if (C()(item(i), value)) ++count;
+    }
+    return count;
+  }
+  return partition_point(from, to, [&](T other) { return C()(other, value); }) - from;
+}
+
+template<typename T, typename C>
+template<typename P>
+uint32_t wrapped_kll_sketch<T, C>::partition_point(uint32_t from, uint32_t to, P predicate) const {
+  while (from < to) {
+    const uint32_t mid = from + (to - from) / 2;
+    if (predicate(item(mid))) from = mid + 1;
+    else to = mid;
+  }
+  return from;
+}
+
+template<typename T, typename C>
+uint64_t wrapped_kll_sketch<T, C>::get_weight_less_than(T value) const {
+  uint64_t total = 0;
+  for (uint8_t lvl = 0; lvl < num_levels_; ++lvl) {
+    total += static_cast<uint64_t>(count_less_than(lvl, value)) << lvl;
+  }
+  return total;
+}
+
+// kll_sketch members that take a wrapped sketch, declared in kll_sketch.hpp
+
+template<typename T, typename C, typename S, typename A>
+void kll_sketch<T, C, S, A>::merge(const wrapped_kll_sketch<T, C>& other) {
+  if (other.is_empty()) return;
+  if (m_ != other.m_) {
+    throw std::invalid_argument("incompatible M: " + std::to_string(m_) + " and " + std::to_string(other.m_));
+  }
+  if (is_empty()) {
+    min_value_ = new (allocator_.allocate(1)) T(other.min_value_);
+    max_value_ = new (allocator_.allocate(1)) T(other.max_value_);
+  } else {
+    if (C()(other.min_value_, *min_value_)) *min_value_ = other.min_value_;
+    if (C()(*max_value_, other.max_value_)) *max_value_ = other.max_value_;
+  }
+  const uint64_t final_n = n_ + other.n_;
+  for (uint32_t i = other.level(0); i < other.level(1); i++) {
+    const uint32_t index = internal_update();
+    new (&items_[index]) T(other.item(i));
+  }
+  if (other.num_levels_ >= 2) merge_higher_levels(other, final_n);
+  n_ = final_n;
+  if (other.is_estimation_mode()) min_k_ = std::min(min_k_, other.min_k_);
+  assert_correct_total_weight();
+}
+
+// this leaves items_ uninitialized (all objects moved out and destroyed)
+// this version copies items out of the serialized sketch
+template<typename T, typename C, typename S, typename A>
+void kll_sketch<T, C, S, A>::populate_work_arrays(const wrapped_kll_sketch<T, C>& other, T* workbuf, uint32_t* worklevels, uint8_t provisional_num_levels) {
+  worklevels[0] = 0;
+
+  // the level zero data from "other" was already inserted into "this"
+  kll_helper::move_construct<T>(items_, levels_[0], levels_[1], workbuf, 0, true);
+  worklevels[1] = safe_level_size(0);
+
+  for (uint8_t lvl = 1; lvl < provisional_num_levels; lvl++) {
+    const uint32_t self_pop = safe_level_size(lvl);
+    const uint32_t other_pop = other.safe_level_size(lvl);
+    worklevels[lvl + 1] = worklevels[lvl] + self_pop + other_pop;
+
+    if ((self_pop > 0) && (other_pop == 0)) {
+      kll_helper::move_construct<T>(items_, levels_[lvl], levels_[lvl] + self_pop, workbuf, worklevels[lvl], true);
+    } else if ((self_pop == 0) && (other_pop > 0)) {
+      const uint32_t other_beg = other.level(lvl);
+      for (uint32_t i = 0; i < other_pop; i++) new (&workbuf[worklevels[lvl] + i]) T(other.item(other_beg + i));
+    } else if ((self_pop > 0) && (other_pop > 0)) {
+      // as kll_helper::merge_sorted_arrays, with the other level read in place
+      uint32_t a = levels_[lvl];
+      uint32_t b = other.level(lvl);
+      const uint32_t lim_a = a + self_pop;
+      const uint32_t lim_b = b + other_pop;
+      for (uint32_t c = worklevels[lvl]; c < worklevels[lvl + 1]; c++) {
+        if (a != lim_a && (b == lim_b || C()(items_[a], other.item(b)))) {
+          new (&workbuf[c]) T(std::move(items_[a]));
+          items_[a++].~T();
+        } else {
+          new (&workbuf[c]) T(other.item(b++));
+        }
+      }
+    }
+  }
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -20,6 +20,8 @@
 #ifndef KOLMOGOROV_SMIRNOV_HPP_
 #define KOLMOGOROV_SMIRNOV_HPP_
 
+#include "kll_sorted_view.hpp"
+
 namespace datasketches {
 
 class kolmogorov_smirnov {
@@ -33,6 +35,17 @@ public:
   template<typename Sketch>
   static double delta(const Sketch& sketch1, const Sketch& sketch2);
 
+  /**
+   * Computes the same delta from sorted views of the two sketches, in one pass over both,
+   * without building the quantile calculators the sketch overload does. Views kept across
+   * many tests, such as those of one sketch tested against many others, are built once.
+   * @param view1 sorted view of KLL sketch 1
+   * @param view2 sorted view of KLL sketch 2
+   * @return the raw delta between the two sketches
+   */
+  template<typename T, typename C, typename A>
+  static double delta(const kll_sorted_view<T, C, A>& view1, const kll_sorted_view<T, C, A>& view2);
+
   /**
    * Computes the adjusted delta area threshold for the Kolmogorov-Smirnov Test.
    * Adjusts the computed threshold by the error epsilons of the two given sketches.
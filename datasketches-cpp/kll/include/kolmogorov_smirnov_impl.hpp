@@ -20,6 +20,9 @@
 #ifndef KOLMOGOROV_SMIRNOV_IMPL_HPP_
 #define KOLMOGOROV_SMIRNOV_IMPL_HPP_
 
+#include <algorithm>
+#include <cmath>
+
 namespace datasketches {
 
 // type resolver
@@ -57,6 +60,39 @@ double kolmogorov_smirnov::delta(const Sketch& sketch1, const Sketch& sketch2) {
   return delta;
 }
 
+template<typename T, typename C, typename A>
+double kolmogorov_smirnov::delta(const kll_sorted_view<T, C, A>& view1, const kll_sorted_view<T, C, A>& view2) {
+  // as the sketch overload, with indices into the views' arrays for the calculators' iterators
+  const auto& items1 = view1.items_;
+  const auto& items2 = view2.items_;
+  const auto& weights1 = view1.preceding_weights_;
+  const auto& weights2 = view2.preceding_weights_;
+  const size_t size1 = items1.size();
+  const size_t size2 = items2.size();
+  const auto n1 = view1.get_n();
+  const auto n2 = view2.get_n();
+  size_t i1 = 0;
+  size_t i2 = 0;
+  double delta = 0;
+  while (i1 != size1 && i2 != size2) {
+    const double norm_cum_wt1 = static_cast<double>(weights1[i1]) / n1;
+    const double norm_cum_wt2 = static_cast<double>(weights2[i2]) / n2;
+    delta = std::max(delta, std::abs(norm_cum_wt1 - norm_cum_wt2));
+    if (C()(items1[i1], items2[i2])) {
+      ++i1;
+    } else if (C()(items2[i2], items1[i1])) {
+      ++i2;
+    } else {
+      ++i1;
+      ++i2;
+    }
+  }
+  const double norm_cum_wt1 = i1 == size1 ? 1 : static_cast<double>(weights1[i1]) / n1;
+  const double norm_cum_wt2 = i2 == size2 ? 1 : static_cast<double>(weights2[i2]) / n2;
+  delta = std::max(delta, std::abs(norm_cum_wt1 - norm_cum_wt2));
+  return delta;
+}
+
 template<typename Sketch>
 double kolmogorov_smirnov::threshold(const Sketch& sketch1, const Sketch& sketch2, double p) {
   const double r1 = sketch1.get_num_retained();
@@ -0,0 +1,182 @@
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "rust/cxx.h"
+#include "req/include/req_sketch.hpp"
+#include "req/include/req_sorted_view.hpp"
+#include "req/include/req_wrapped_sketch.hpp"
+
+#include "req.hpp"
+
+OpaqueReqSketch::OpaqueReqSketch(uint16_t k, bool hra):
+  inner_{k, hra} {
+}
+
+OpaqueReqSketch::OpaqueReqSketch(req_sketch&& req):
+  inner_{std::move(req)} {
+}
+
+bool OpaqueReqSketch::is_empty() const {
+  return this->inner_.is_empty();
+}
+
+uint16_t OpaqueReqSketch::get_k() const {
+  return this->inner_.get_k();
+}
+
+bool OpaqueReqSketch::is_hra() const {
+  return this->inner_.is_HRA();
+}
+
+uint64_t OpaqueReqSketch::get_n() const {
+  return this->inner_.get_n();
+}
+
+uint32_t OpaqueReqSketch::get_num_retained() const {
+  return this->inner_.get_num_retained();
+}
+
+size_t OpaqueReqSketch::get_memory_usage_bytes() const {
+  std::lock_guard<std::mutex> lock(this->view_mutex_);
+  const size_t view = this->view_ ? this->view_->get_memory_usage_bytes() : 0;
+  return this->inner_.get_memory_usage_bytes() + view;
+}
+
+bool OpaqueReqSketch::is_estimation_mode() const {
+  return this->inner_.is_estimation_mode();
+}
+
+float OpaqueReqSketch::get_min_value() const {
+  return this->inner_.get_min_value();
+}
+
+float OpaqueReqSketch::get_max_value() const {
+  return this->inner_.get_max_value();
+}
+
+void OpaqueReqSketch::update(float value) {
+  this->view_.reset();
+  this->inner_.update(value);
+}
+
+void OpaqueReqSketch::update_batch(rust::Slice<const float> values) {
+  this->view_.reset();
+  this->inner_.update(values.data(), values.size());
+}
+
+void OpaqueReqSketch::merge(const OpaqueReqSketch& other) {
+  this->view_.reset();
+  this->inner_.merge(other.inner_);
+}
+
+void OpaqueReqSketch::merge_wrapped(const OpaqueWrappedReqSketch& other) {
+  this->view_.reset();
+  this->inner_.merge(other.inner_);
+}
+
+// Updates and merges drop the view, but they take the sketch mutably, so a view once built
+// outlives every query that could be reading it.
+const req_sorted_view& OpaqueReqSketch::sorted_view() const {
+  std::lock_guard<std::mutex> lock(this->view_mutex_);
+  if (!this->view_) this->view_.reset(new req_sorted_view{this->inner_});
+  return *this->view_;
+}
+
+float OpaqueReqSketch::get_quantile(double rank) const {
+  return this->sorted_view().get_quantile(rank);
+}
+
+std::unique_ptr<std::vector<float>> OpaqueReqSketch::get_quantiles(rust::Slice<const double> ranks) const {
+  auto quantiles = this->sorted_view().get_quantiles(ranks.data(), ranks.size());
+  return std::unique_ptr<std::vector<float>>(new std::vector<float>(into_std_vector(std::move(quantiles))));
+}
+
+double OpaqueReqSketch::get_rank(float value) const {
+  return this->sorted_view().get_rank(value);
+}
+
+double OpaqueReqSketch::get_rank_lower_bound(double rank, uint8_t num_std_dev) const {
+  return this->inner_.get_rank_lower_bound(rank, num_std_dev);
+}
+
+double OpaqueReqSketch::get_rank_upper_bound(double rank, uint8_t num_std_dev) const {
+  return this->inner_.get_rank_upper_bound(rank, num_std_dev);
+}
+
+std::unique_ptr<std::vector<double>> OpaqueReqSketch::get_cdf(rust::Slice<const float> split_points) const {
+  auto cdf = this->sorted_view().get_CDF(split_points.data(), split_points.size());
+  return std::unique_ptr<std::vector<double>>(new std::vector<double>(into_std_vector(std::move(cdf))));
+}
+
+std::unique_ptr<std::vector<double>> OpaqueReqSketch::get_pmf(rust::Slice<const float> split_points) const {
+  auto pmf = this->sorted_view().get_PMF(split_points.data(), split_points.size());
+  return std::unique_ptr<std::vector<double>>(new std::vector<double>(into_std_vector(std::move(pmf))));
+}
+
+std::unique_ptr<OpaqueReqSketch> OpaqueReqSketch::clone() const {
+  auto copy = this->inner_;
+  return std::unique_ptr<OpaqueReqSketch>(new OpaqueReqSketch{std::move(copy)});
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueReqSketch::serialize() const {
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
+}
+
+std::unique_ptr<OpaqueReqSketch> new_opaque_req_sketch(uint16_t k, bool hra) {
+  // the sketch itself would silently round an odd k down and clamp it below
+  if (k < datasketches::req_constants::MIN_K || k > 1024 || k % 2 != 0) {
+    throw std::invalid_argument("k must be even and in [4, 1024], got " + std::to_string(k));
+  }
+  return std::unique_ptr<OpaqueReqSketch>(new OpaqueReqSketch{k, hra});
+}
+
+std::unique_ptr<OpaqueReqSketch> deserialize_opaque_req_sketch(rust::Slice<const uint8_t> buf) {
+  auto req = req_sketch::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueReqSketch>(new OpaqueReqSketch{std::move(req)});
+}
+
+OpaqueWrappedReqSketch::OpaqueWrappedReqSketch(const wrapped_req_sketch& req):
+  inner_{req} {
+}
+
+bool OpaqueWrappedReqSketch::is_empty() const {
+  return this->inner_.is_empty();
+}
+
+bool OpaqueWrappedReqSketch::is_hra() const {
+  return this->inner_.is_HRA();
+}
+
+uint64_t OpaqueWrappedReqSketch::get_n() const {
+  return this->inner_.get_n();
+}
+
+uint32_t OpaqueWrappedReqSketch::get_num_retained() const {
+  return this->inner_.get_num_retained();
+}
+
+float OpaqueWrappedReqSketch::get_min_value() const {
+  return this->inner_.get_min_value();
+}
+
+float OpaqueWrappedReqSketch::get_max_value() const {
+  return this->inner_.get_max_value();
+}
+
+float OpaqueWrappedReqSketch::get_quantile(double rank) const {
+  return this->inner_.get_quantile(rank);
+}
+
+double OpaqueWrappedReqSketch::get_rank(float value) const {
+  return this->inner_.get_rank(value);
+}
+
+std::unique_ptr<OpaqueWrappedReqSketch> wrap_opaque_req_sketch(rust::Slice<const uint8_t> buf) {
+  auto wrapped = wrapped_req_sketch::wrap(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueWrappedReqSketch>(new OpaqueWrappedReqSketch{wrapped});
+}
@@ -0,0 +1,87 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <mutex>
+
+#include "rust/cxx.h"
+#include "req/include/req_sketch.hpp"
+#include "req/include/req_sorted_view.hpp"
+#include "req/include/req_wrapped_sketch.hpp"
+
+#include "alloc_stats.hpp"
+
+using req_sketch = datasketches::req_sketch<float, std::less<float>, datasketches::serde<float>, sketch_allocator<float, alloc_family::REQ>>;
+using req_sorted_view = datasketches::req_sorted_view<float, std::less<float>, sketch_allocator<float, alloc_family::REQ>>;
+using wrapped_req_sketch = datasketches::wrapped_req_sketch<float>;
+
+class OpaqueWrappedReqSketch;
+
+// A REQ relative-error quantiles sketch of floats. In high rank accuracy (HRA) mode
+// the error shrinks toward rank 1, so the tail quantiles are the accurate ones. Queries go
+// through a sorted view of the retained items, built on the first query after an update and
+// kept until the next. The sketch is shared between threads for queries, so the view is
+// built under a lock.
+class OpaqueReqSketch {
+public:
+  bool is_empty() const;
+  uint16_t get_k() const;
+  bool is_hra() const;
+  uint64_t get_n() const;
+  uint32_t get_num_retained() const;
+  // Heap bytes held by the sketch and by its sorted view, if one is built.
+  size_t get_memory_usage_bytes() const;
+  bool is_estimation_mode() const;
+  float get_min_value() const;
+  float get_max_value() const;
+  // NaN values are ignored.
+  void update(float value);
+  void update_batch(rust::Slice<const float> values);
+  // Throws unless both sketches are in the same (HRA or LRA) mode.
+  void merge(const OpaqueReqSketch& other);
+  void merge_wrapped(const OpaqueWrappedReqSketch& other);
+  float get_quantile(double rank) const;
+  std::unique_ptr<std::vector<float>> get_quantiles(rust::Slice<const double> ranks) const;
+  double get_rank(float value) const;
+  double get_rank_lower_bound(double rank, uint8_t num_std_dev) const;
+  double get_rank_upper_bound(double rank, uint8_t num_std_dev) const;
+  // split_points must be unique and increasing.
+  std::unique_ptr<std::vector<double>> get_cdf(rust::Slice<const float> split_points) const;
+  std::unique_ptr<std::vector<double>> get_pmf(rust::Slice<const float> split_points) const;
+  std::unique_ptr<OpaqueReqSketch> clone() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize() const;
+private:
+  OpaqueReqSketch(uint16_t k, bool hra);
+  OpaqueReqSketch(req_sketch&& req);
+  friend std::unique_ptr<OpaqueReqSketch> new_opaque_req_sketch(uint16_t k, bool hra);
+  friend std::unique_ptr<OpaqueReqSketch> deserialize_opaque_req_sketch(rust::Slice<const uint8_t> buf);
+  const req_sorted_view& sorted_view() const;
+  req_sketch inner_;
+  mutable std::mutex view_mutex_;
+  mutable std::unique_ptr<req_sorted_view> view_;
+};
+
+std::unique_ptr<OpaqueReqSketch> new_opaque_req_sketch(uint16_t k, bool hra);
+std::unique_ptr<OpaqueReqSketch> deserialize_opaque_req_sketch(rust::Slice<const uint8_t> buf);
+
+// A view of a serialized REQ sketch that reads the compactors from the Rust-owned buffer in
+// place; the buffer must outlive it. Queries search the compactors without allocating.
+class OpaqueWrappedReqSketch {
+public:
+  bool is_empty() const;
+  bool is_hra() const;
+  uint64_t get_n() const;
+  uint32_t get_num_retained() const;
+  float get_min_value() const;
+  float get_max_value() const;
+  float get_quantile(double rank) const;
+  double get_rank(float value) const;
+private:
+  OpaqueWrappedReqSketch(const wrapped_req_sketch& req);
+  friend std::unique_ptr<OpaqueWrappedReqSketch> wrap_opaque_req_sketch(rust::Slice<const uint8_t> buf);
+  friend class OpaqueReqSketch;
+  wrapped_req_sketch inner_;
+};
+
+std::unique_ptr<OpaqueWrappedReqSketch> wrap_opaque_req_sketch(rust::Slice<const uint8_t> buf);
@@ -20,18 +20,12 @@
 #ifndef REQ_COMMON_HPP_
 #define REQ_COMMON_HPP_
 
-#include <random>
-#include <chrono>
-
 #include "serde.hpp"
 #include "common_defs.hpp"
+#include "random_bits.hpp"
 
 namespace datasketches {
 
-// TODO: have a common random bit with KLL
-static std::independent_bits_engine<std::mt19937, 1, unsigned>
-  req_random_bit(static_cast<unsigned>(std::chrono::system_clock::now().time_since_epoch().count()));
-
 namespace req_constants {
   static const uint16_t MIN_K = 4;
   static const uint8_t INIT_NUM_SECTIONS = 3;
@@ -41,6 +41,8 @@ public:
   bool is_sorted() const;
   uint32_t get_num_items() const;
   uint32_t get_nom_capacity() const;
+  // heap bytes held by the items array, including room for items to come
+  size_t get_memory_usage_bytes() const;
   uint8_t get_lg_weight() const;
   const T* begin() const;
   const T* end() const;
@@ -53,9 +55,18 @@ public:
   template<typename FwdT>
   void append(FwdT&& item);
 
+  // copies all of [from, to) in, leaving the items already here as the sorted run
+  // the next sort merges the new ones into
+  template<typename InIter>
+  void append(InIter from, InIter to);
+
   template<typename FwdC>
   void merge(FwdC&& other);
 
+  // as merge(), with the items of the other compactor copied bytewise from where they were
+  // serialized, which only arithmetic types allow
+  void merge_serialized(uint8_t lg_weight, uint64_t state, bool sorted, const char* items, uint32_t num_items);
+
   void sort();
 
   std::pair<uint32_t, uint32_t> compact(req_compactor& next);
@@ -100,6 +111,7 @@ private:
   bool hra_;
   bool coin_; // random bit for compaction
   bool sorted_;
+  uint32_t num_sorted_; // length of the sorted run the unsorted items were appended to
   float section_size_raw_;
   uint32_t section_size_;
   uint8_t num_sections_;
@@ -115,6 +127,9 @@ private:
 
   static uint32_t nearest_even(float value);
 
+  template<typename TT = T, typename std::enable_if<std::is_arithmetic<TT>::value, int>::type = 0>
+  static void promote_evens_or_odds(TT* from, TT* to, bool flag, TT* dst);
+
   template<typename InIter, typename OutIter>
   static void promote_evens_or_odds(InIter from, InIter to, bool flag, OutIter dst);
 
@@ -23,6 +23,8 @@
 #include <stdexcept>
 #include <cmath>
 #include <algorithm>
+#include <cstring>
+#include <type_traits>
 
 #include "count_zeros.hpp"
 #include "conditional_forward.hpp"
@@ -38,6 +40,7 @@ lg_weight_(lg_weight),
 hra_(hra),
 coin_(false),
 sorted_(sorted),
+num_sorted_(0),
 section_size_raw_(static_cast<float>(section_size)),
 section_size_(section_size),
 num_sections_(req_constants::INIT_NUM_SECTIONS),
@@ -62,6 +65,7 @@ lg_weight_(other.lg_weight_),
 hra_(other.hra_),
 coin_(other.coin_),
 sorted_(other.sorted_),
+num_sorted_(other.num_sorted_),
 section_size_raw_(other.section_size_raw_),
 section_size_(other.section_size_),
 num_sections_(other.num_sections_),
@@ -85,6 +89,7 @@ lg_weight_(other.lg_weight_),
 hra_(other.hra_),
 coin_(other.coin_),
 sorted_(other.sorted_),
+num_sorted_(other.num_sorted_),
 section_size_raw_(other.section_size_raw_),
 section_size_(other.section_size_),
 num_sections_(other.num_sections_),
@@ -104,6 +109,7 @@ req_compactor<T, C, A>& req_compactor<T, C, A>::operator=(const req_compactor& o
   std::swap(hra_, copy.hra_);
   std::swap(coin_, copy.coin_);
   std::swap(sorted_, copy.sorted_);
+  std::swap(num_sorted_, copy.num_sorted_);
   std::swap(section_size_raw_, copy.section_size_raw_);
   std::swap(section_size_, copy.section_size_);
   std::swap(num_sections_, copy.num_sections_);
@@ -121,6 +127,7 @@ req_compactor<T, C, A>& req_compactor<T, C, A>::operator=(req_compactor&& other)
   std::swap(hra_, other.hra_);
   std::swap(coin_, other.coin_);
   std::swap(sorted_, other.sorted_);
+  std::swap(num_sorted_, other.num_sorted_);
   std::swap(section_size_raw_, other.section_size_raw_);
   std::swap(section_size_, other.section_size_);
   std::swap(num_sections_, other.num_sections_);
@@ -146,6 +153,11 @@ uint32_t req_compactor<T, C, A>::get_nom_capacity() const {
   return req_constants::MULTIPLIER * num_sections_ * section_size_;
 }
 
+template<typename T, typename C, typename A>
+size_t req_compactor<T, C, A>::get_memory_usage_bytes() const {
+  return capacity_ * sizeof(T);
+}
+
 template<typename T, typename C, typename A>
 uint8_t req_compactor<T, C, A>::get_lg_weight() const {
   return lg_weight_;
@@ -167,10 +179,30 @@ void req_compactor<T, C, A>::append(FwdT&& item) {
   if (num_items_ == capacity_) grow(capacity_ + get_nom_capacity());
   const uint32_t i = hra_ ? capacity_ - num_items_ - 1 : num_items_;
   new (items_ + i) T(std::forward<FwdT>(item));
+  if (sorted_) num_sorted_ = num_items_;
   ++num_items_;
   if (num_items_ > 1) sorted_ = false;
 }
 
+template<typename T, typename C, typename A>
+template<typename InIter>
+void req_compactor<T, C, A>::append(InIter from, InIter to) {
+  const uint32_t num = static_cast<uint32_t>(std::distance(from, to));
+  if (num == 0) return;
+  ensure_space(num);
+  if (sorted_) num_sorted_ = num_items_;
+  // same layout as appending one at a time: HRA items grow down from the end
+  if (hra_) {
+    T* dst = begin();
+    for (auto it = from; it != to; ++it) new (--dst) T(*it);
+  } else {
+    T* dst = end();
+    for (auto it = from; it != to; ++it, ++dst) new (dst) T(*it);
+  }
+  num_items_ += num;
+  if (num_items_ > 1) sorted_ = false;
+}
+
 template<typename T, typename C, typename A>
 void req_compactor<T, C, A>::grow(uint32_t new_capacity) {
   T* new_items = allocator_.allocate(new_capacity);
@@ -228,10 +260,31 @@ void req_compactor<T, C, A>::merge(FwdC&& other) {
   num_items_ += other.get_num_items();
 }
 
+template<typename T, typename C, typename A>
+void req_compactor<T, C, A>::merge_serialized(uint8_t lg_weight, uint64_t state, bool sorted, const char* items, uint32_t num_items) {
+  static_assert(std::is_arithmetic<T>::value, "only arithmetic items can be copied bytewise");
+  if (lg_weight_ != lg_weight) throw std::logic_error("weight mismatch");
+  state_ |= state;
+  while (ensure_enough_sections()) {}
+  ensure_space(num_items);
+  sort();
+  auto offset = hra_ ? capacity_ - num_items_ : num_items_;
+  auto from = hra_ ? begin() - num_items : end();
+  auto to = from + num_items;
+  std::memcpy(from, items, num_items * sizeof(T));
+  if (!sorted) std::sort(from, to, C());
+  if (num_items_ > 0) std::inplace_merge(hra_ ? from : begin(), items_ + offset, hra_ ? end() : to, C());
+  num_items_ += num_items;
+}
+
 template<typename T, typename C, typename A>
 void req_compactor<T, C, A>::sort() {
   if (!sorted_) {
-    std::sort(begin(), end(), C());
+    // only the items appended since the last sort need sorting, then they
+    // are merged with the sorted run, which is at the end in HRA mode
+    T* middle = hra_ ? end() - num_sorted_ : begin() + num_sorted_;
+    std::sort(hra_ ? begin() : middle, hra_ ? middle : end(), C());
+    if (num_sorted_ > 0) std::inplace_merge(begin(), middle, end(), C());
     sorted_ = true;
   }
 }
@@ -245,7 +298,7 @@ std::pair<uint32_t, uint32_t> req_compactor<T, C, A>::compact(req_compactor& nex
   if (compaction_range.second - compaction_range.first < 2) throw std::logic_error("compaction range error");
 
   if ((state_ & 1) == 1) { coin_ = !coin_; } // for odd flip coin;
-  else { coin_ = req_random_bit(); } // random coin flip
+  else { coin_ = thread_random_bits().next_bit(); } // random coin flip
 
   const auto num = (compaction_range.second - compaction_range.first) / 2;
   next.ensure_space(num);
@@ -294,6 +347,17 @@ uint32_t req_compactor<T, C, A>::nearest_even(float value) {
   return static_cast<uint32_t>(round(value / 2)) << 1;
 }
 
+// implementation for fixed-size arithmetic types (integral and floating point)
+// a strided copy without the iterator bookkeeping, which compilers vectorize
+template<typename T, typename C, typename A>
+template<typename TT, typename std::enable_if<std::is_arithmetic<TT>::value, int>::type>
+void req_compactor<T, C, A>::promote_evens_or_odds(TT* from, TT* to, bool odds, TT* dst) {
+  const TT* src = from + (odds ? 1 : 0);
+  const size_t num = (to - src + 1) / 2;
+  for (size_t i = 0; i < num; ++i) dst[i] = src[2 * i];
+}
+
+// implementation for all other types
 template<typename T, typename C, typename A>
 template<typename InIter, typename OutIter>
 void req_compactor<T, C, A>::promote_evens_or_odds(InIter from, InIter to, bool odds, OutIter dst) {
@@ -451,8 +515,9 @@ req_compactor<T, C, A>::req_compactor(bool hra, uint8_t lg_weight, bool sorted,
 allocator_(allocator),
 lg_weight_(lg_weight),
 hra_(hra),
-coin_(req_random_bit()),
+coin_(thread_random_bits().next_bit()),
 sorted_(sorted),
+num_sorted_(0),
 section_size_raw_(section_size_raw),
 section_size_(nearest_even(section_size_raw)),
 num_sections_(num_sections),
@@ -26,6 +26,8 @@
 
 namespace datasketches {
 
+template<typename T, typename C> class wrapped_req_sketch;
+
 template<
   typename T,
   typename Comparator = std::less<T>,
@@ -94,9 +96,26 @@ public:
   template<typename FwdT>
   void update(FwdT&& item);
 
+  /**
+   * Updates this sketch with the given items, as calling update() on each in turn would.
+   * The runs between compactions are appended to the lowest level in bulk.
+   * @param values pointer to the array of items
+   * @param size the number of items in the array
+   */
+  void update(const T* values, size_t size);
+
   template<typename FwdSk>
   void merge(FwdSk&& other);
 
+  /**
+   * Merges a view of a serialized sketch into this one, copying its items straight from the bytes.
+   * Defined in req_wrapped_sketch.hpp, which must be included to use it.
+   * The view is taken by value, which is cheap, so that this overload rather than the template
+   * above is chosen for views of any kind.
+   * @param other view to merge into this one
+   */
+  void merge(wrapped_req_sketch<T, Comparator> other);
+
   /**
    * Returns the min value of the stream.
    * For floating point types: if the sketch is empty this returns NaN.
@@ -234,6 +253,14 @@ public:
   template<typename TT = T, typename std::enable_if<!std::is_arithmetic<TT>::value, int>::type = 0>
   size_t get_serialized_size_bytes() const;
 
+  /**
+   * Computes the heap memory held by the sketch: its compactors and their items arrays,
+   * including the space reserved for items to come, and its min and max values.
+   * Memory that items of other than arithmetic types point to is not counted.
+   * @return size in bytes
+   */
+  size_t get_memory_usage_bytes() const;
+
   /**
    * This method serializes the sketch into a given stream in a binary form
    * @param os output stream
@@ -290,6 +317,8 @@ private:
   T* min_value_;
   T* max_value_;
 
+  template<typename TT, typename CC> friend class wrapped_req_sketch;
+
   static const bool LAZY_COMPRESSION = false;
 
   static const uint8_t SERIAL_VERSION = 1;
@@ -372,8 +401,13 @@ private:
 };
 
 template<typename T, typename C, typename S, typename A>
-class req_sketch<T, C, S, A>::const_iterator: public std::iterator<std::input_iterator_tag, T> {
+class req_sketch<T, C, S, A>::const_iterator {
 public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T*;
+  using reference = T&;
   const_iterator& operator++();
   const_iterator& operator++(int);
   bool operator==(const const_iterator& other) const;
@@ -160,6 +160,30 @@ void req_sketch<T, C, S, A>::update(FwdT&& item) {
   if (num_retained_ == max_nom_size_) compress();
 }
 
+template<typename T, typename C, typename S, typename A>
+void req_sketch<T, C, S, A>::update(const T* values, size_t size) {
+  size_t i = 0;
+  while (i < size && is_empty()) update(values[i++]);
+  while (i < size) {
+    if (num_retained_ >= max_nom_size_) {
+      update(values[i++]);
+      continue;
+    }
+    // a run ends at the next compaction or at a value update() would skip
+    const size_t lim = i + std::min<size_t>(max_nom_size_ - num_retained_, size - i);
+    size_t j = i;
+    for (; j < lim && check_update_value(values[j]); ++j) {
+      if (C()(values[j], *min_value_)) *min_value_ = values[j];
+      if (C()(*max_value_, values[j])) *max_value_ = values[j];
+    }
+    compactors_[0].append(values + i, values + j);
+    num_retained_ += static_cast<uint32_t>(j - i);
+    n_ += j - i;
+    if (num_retained_ == max_nom_size_) compress();
+    i = j < lim ? j + 1 : j;
+  }
+}
+
 template<typename T, typename C, typename S, typename A>
 template<typename FwdSk>
 void req_sketch<T, C, S, A>::merge(FwdSk&& other) {
@@ -308,6 +332,15 @@ double req_sketch<T, C, S, A>::get_rank_upper_bound(double rank, uint8_t num_std
   return get_rank_ub(get_k(), get_num_levels(), rank, num_std_dev, get_n(), hra_);
 }
 
+template<typename T, typename C, typename S, typename A>
+size_t req_sketch<T, C, S, A>::get_memory_usage_bytes() const {
+  size_t size = compactors_.capacity() * sizeof(Compactor);
+  for (const auto& compactor: compactors_) size += compactor.get_memory_usage_bytes();
+  if (min_value_ != nullptr) size += sizeof(T);
+  if (max_value_ != nullptr) size += sizeof(T);
+  return size;
+}
+
 template<typename T, typename C, typename S, typename A>
 double req_sketch<T, C, S, A>::get_RSE(uint16_t k, double rank, bool hra, uint64_t n) {
   return get_rank_lb(k, 2, rank, 1, n, hra);
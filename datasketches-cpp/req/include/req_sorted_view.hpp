@@ -0,0 +1,110 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef REQ_SORTED_VIEW_HPP_
+#define REQ_SORTED_VIEW_HPP_
+
+#include <cmath>
+#include <stdexcept>
+#include <type_traits>
+#include <vector>
+
+#include "req_sketch.hpp"
+
+namespace datasketches {
+
+/**
+ * The retained items of a req_sketch, merged into one sorted array with the cumulative
+ * weight up to each. The sketch builds a req_quantile_calculator for every quantile query
+ * and sums a binary search of each compactor for every rank, and so for every split point
+ * of a CDF or PMF; building this once makes any number of those queries binary searches
+ * of one array, and the split points of a CDF or PMF, being increasing, one forward walk.
+ *
+ * The queries give the same results as those of the sketch the view was made from, with
+ * the same inclusive template parameter, and the view does not change with the sketch,
+ * which can be updated or dropped meanwhile.
+ */
+template<typename T, typename C = std::less<T>, typename A = std::allocator<T>>
+class req_sorted_view {
+public:
+  using AllocDouble = typename std::allocator_traits<A>::template rebind_alloc<double>;
+  using vector_double = std::vector<double, AllocDouble>;
+
+  template<typename S>
+  explicit req_sorted_view(const req_sketch<T, C, S, A>& sketch, const A& allocator = A());
+
+  bool is_empty() const;
+  uint64_t get_n() const;
+  uint32_t get_num_retained() const;
+  // heap bytes held by the items and their weights
+  size_t get_memory_usage_bytes() const;
+
+  // queries of an empty view return NaN or empty vectors, as those of an empty sketch do
+  template<bool inclusive = false>
+  T get_quantile(double rank) const;
+  template<bool inclusive = false>
+  std::vector<T, A> get_quantiles(const double* ranks, uint32_t size) const;
+  template<bool inclusive = false>
+  double get_rank(const T& item) const;
+  template<bool inclusive = false>
+  vector_double get_PMF(const T* split_points, uint32_t size) const;
+  template<bool inclusive = false>
+  vector_double get_CDF(const T* split_points, uint32_t size) const;
+
+private:
+  using AllocU64 = typename std::allocator_traits<A>::template rebind_alloc<uint64_t>;
+
+  uint64_t n_;
+  std::vector<T, A> min_max_;
+  std::vector<T, A> items_;
+  // cumulative_weights_[i] is the total weight of the first i items, so it has one more
+  // entry than items_ and ends with n_
+  std::vector<uint64_t, AllocU64> cumulative_weights_;
+
+  template<bool inclusive>
+  size_t get_num_before(typename std::vector<T, A>::const_iterator from, const T& item) const;
+
+  template<typename TT = T, typename std::enable_if<std::is_floating_point<TT>::value, int>::type = 0>
+  static void check_split_points(const T* values, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+      if (std::isnan(values[i])) {
+        throw std::invalid_argument("Values must not be NaN");
+      }
+      if ((i < (size - 1)) && !(C()(values[i], values[i + 1]))) {
+        throw std::invalid_argument("Values must be unique and monotonically increasing");
+      }
+    }
+  }
+
+  template<typename TT = T, typename std::enable_if<!std::is_floating_point<TT>::value, int>::type = 0>
+  static void check_split_points(const T* values, uint32_t size) {
+    for (uint32_t i = 0; i < size; i++) {
+      if ((i < (size - 1)) && !(C()(values[i], values[i + 1]))) {
+        throw std::invalid_argument("Values must be unique and monotonically increasing");
+      }
+    }
+  }
+};
+
+} /* namespace datasketches */
+
+#include "req_sorted_view_impl.hpp"
+
+#endif
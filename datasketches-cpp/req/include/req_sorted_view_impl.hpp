@@ -0,0 +1,166 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef REQ_SORTED_VIEW_IMPL_HPP_
+#define REQ_SORTED_VIEW_IMPL_HPP_
+
+#include <algorithm>
+#include <limits>
+#include <utility>
+
+namespace datasketches {
+
+template<typename T, typename C, typename A>
+template<typename S>
+req_sorted_view<T, C, A>::req_sorted_view(const req_sketch<T, C, S, A>& sketch, const A& allocator):
+n_(sketch.get_n()),
+min_max_(allocator),
+items_(allocator),
+cumulative_weights_(AllocU64(allocator))
+{
+  if (sketch.is_empty()) return;
+  min_max_.push_back(sketch.get_min_value());
+  min_max_.push_back(sketch.get_max_value());
+  // the sketch's iterator reads the compactors as they are, so level zero may be unsorted
+  // and the items are sorted here rather than merged, which leaves the sketch untouched.
+  // The iterator goes up the levels, and a stable sort keeps equal items in that order,
+  // as the calculator's merges do: exclusive quantiles depend on it.
+  using Entry = std::pair<T, uint64_t>;
+  using AllocEntry = typename std::allocator_traits<A>::template rebind_alloc<Entry>;
+  std::vector<Entry, AllocEntry> entries{AllocEntry(allocator)};
+  entries.reserve(sketch.get_num_retained());
+  for (auto it = sketch.begin(); it != sketch.end(); ++it) {
+    const auto entry = *it;
+    entries.push_back(Entry(entry.first, entry.second));
+  }
+  std::stable_sort(entries.begin(), entries.end(), [](const Entry& a, const Entry& b) { return C()(a.first, b.first); });
+  items_.reserve(entries.size());
+  cumulative_weights_.reserve(entries.size() + 1);
+  uint64_t subtotal = 0;
+  cumulative_weights_.push_back(subtotal);
+  for (auto& entry: entries) {
+    items_.push_back(std::move(entry.first));
+    subtotal += entry.second;
+    cumulative_weights_.push_back(subtotal);
+  }
+}
+
+template<typename T, typename C, typename A>
+bool req_sorted_view<T, C, A>::is_empty() const {
+  return n_ == 0;
+}
+
+template<typename T, typename C, typename A>
+uint64_t req_sorted_view<T, C, A>::get_n() const {
+  return n_;
+}
+
+template<typename T, typename C, typename A>
+uint32_t req_sorted_view<T, C, A>::get_num_retained() const {
+  return static_cast<uint32_t>(items_.size());
+}
+
+template<typename T, typename C, typename A>
+size_t req_sorted_view<T, C, A>::get_memory_usage_bytes() const {
+  return (min_max_.capacity() + items_.capacity()) * sizeof(T) + cumulative_weights_.capacity() * sizeof(uint64_t);
+}
+
+template<typename T, typename C, typename A>
+template<bool inclusive>
+T req_sorted_view<T, C, A>::get_quantile(double rank) const {
+  if (is_empty()) return std::numeric_limits<T>::quiet_NaN();
+  if (rank == 0.0) return min_max_[0];
+  if (rank == 1.0) return min_max_[1];
+  if ((rank < 0.0) || (rank > 1.0)) {
+    throw std::invalid_argument("Rank cannot be less than zero or greater than 1.0");
+  }
+  // as req_quantile_calculator::get_quantile: the first item whose cumulative weight, with
+  // its own weight if inclusive, reaches the rank's, or else the last item
+  const uint64_t weight = static_cast<uint64_t>(rank * n_);
+  const auto first = cumulative_weights_.begin() + (inclusive ? 1 : 0);
+  const auto last = first + items_.size();
+  const auto it = std::lower_bound(first, last, weight);
+  if (it == last) return items_.back();
+  return items_[std::distance(first, it)];
+}
+
+template<typename T, typename C, typename A>
+template<bool inclusive>
+std::vector<T, A> req_sorted_view<T, C, A>::get_quantiles(const double* ranks, uint32_t size) const {
+  std::vector<T, A> quantiles(items_.get_allocator());
+  if (is_empty()) return quantiles;
+  quantiles.reserve(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    const double rank = ranks[i];
+    if ((rank < 0.0) || (rank > 1.0)) {
+      throw std::invalid_argument("rank cannot be less than zero or greater than 1.0");
+    }
+    quantiles.push_back(get_quantile<inclusive>(rank));
+  }
+  return quantiles;
+}
+
+template<typename T, typename C, typename A>
+template<bool inclusive>
+size_t req_sorted_view<T, C, A>::get_num_before(typename std::vector<T, A>::const_iterator from, const T& item) const {
+  const auto it = inclusive ?
+      std::upper_bound(from, items_.end(), item, C()) :
+      std::lower_bound(from, items_.end(), item, C());
+  return std::distance(items_.begin(), it);
+}
+
+template<typename T, typename C, typename A>
+template<bool inclusive>
+double req_sorted_view<T, C, A>::get_rank(const T& item) const {
+  if (is_empty()) return std::numeric_limits<double>::quiet_NaN();
+  return static_cast<double>(cumulative_weights_[get_num_before<inclusive>(items_.begin(), item)]) / n_;
+}
+
+template<typename T, typename C, typename A>
+template<bool inclusive>
+auto req_sorted_view<T, C, A>::get_CDF(const T* split_points, uint32_t size) const -> vector_double {
+  vector_double buckets(items_.get_allocator());
+  if (is_empty()) return buckets;
+  check_split_points(split_points, size);
+  buckets.reserve(size + 1);
+  // the split points increase, so each search starts where the one before ended
+  size_t num_before = 0;
+  for (uint32_t i = 0; i < size; ++i) {
+    num_before = get_num_before<inclusive>(items_.begin() + num_before, split_points[i]);
+    buckets.push_back(static_cast<double>(cumulative_weights_[num_before]) / n_);
+  }
+  buckets.push_back(1);
+  return buckets;
+}
+
+template<typename T, typename C, typename A>
+template<bool inclusive>
+auto req_sorted_view<T, C, A>::get_PMF(const T* split_points, uint32_t size) const -> vector_double {
+  auto buckets = get_CDF<inclusive>(split_points, size);
+  if (is_empty()) return buckets;
+  for (uint32_t i = size; i > 0; --i) {
+    buckets[i] -= buckets[i - 1];
+  }
+  return buckets;
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,122 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef REQ_WRAPPED_SKETCH_HPP_
+#define REQ_WRAPPED_SKETCH_HPP_
+
+#include <type_traits>
+
+#include "req_sketch.hpp"
+
+namespace datasketches {
+
+/**
+ * Read-only view of a serialized req_sketch of an arithmetic type, which reads the compactors
+ * straight from the serialized bytes instead of copying them into a sketch.
+ * The bytes must outlive the view.
+ *
+ * Ranks and quantiles are answered without allocating, with the same results as those of
+ * the deserialized sketch, and the view can be merged into a req_sketch, which copies its
+ * items into the compactors bytewise.
+ * Each query searches the compactors in place rather than a merged sorted array, so a sketch
+ * or req_sorted_view answers many queries of the same data faster.
+ */
+template<typename T, typename C = std::less<T>>
+class wrapped_req_sketch {
+  static_assert(std::is_arithmetic<T>::value, "items are read in place, so they must be of an arithmetic type");
+public:
+  /**
+   * This method wraps a serialized sketch as an array of bytes.
+   * @param bytes pointer to the array of bytes, which need not be aligned
+   * @param size the size of the array
+   * @return an instance of the view
+   */
+  static wrapped_req_sketch wrap(const void* bytes, size_t size);
+
+  uint16_t get_k() const;
+  bool is_HRA() const;
+  bool is_empty() const;
+  uint64_t get_n() const;
+  uint32_t get_num_retained() const;
+  bool is_estimation_mode() const;
+
+  // as those of req_sketch, which throw for an empty sketch of a type other than floating point
+  T get_min_value() const;
+  T get_max_value() const;
+  template<bool inclusive = false>
+  double get_rank(T item) const;
+  template<bool inclusive = false>
+  T get_quantile(double rank) const;
+
+private:
+  using sketch = req_sketch<T, C>;
+
+  static const size_t COMPACTOR_HEADER_SIZE_BYTES = 20;
+
+  // a serialized compactor
+  struct level {
+    uint8_t lg_weight;
+    uint64_t state;
+    bool sorted;
+    uint32_t num_items;
+    const char* items;
+
+    T item(uint32_t index) const;
+    // the number of items less than value, or not greater if inclusive
+    uint32_t count(T value, bool inclusive) const;
+    // the first index from the given one of a sorted compactor whose item fails the predicate
+    template<typename P>
+    uint32_t partition_point(uint32_t from, P predicate) const;
+    // where the next compactor starts
+    const char* end() const;
+  };
+
+  uint16_t k_;
+  bool hra_;
+  uint64_t n_;
+  uint8_t num_levels_;
+  uint32_t num_retained_;
+  T min_value_;
+  T max_value_;
+  bool raw_items_;
+  uint8_t num_raw_items_;
+  bool is_level_zero_sorted_;
+  // the first compactor, or the raw items
+  const char* compactors_;
+
+  template<typename TT, typename CC, typename SS, typename AA> friend class req_sketch;
+
+  wrapped_req_sketch(uint16_t k, bool hra);
+
+  // the header of the compactor at ptr, or the raw items
+  level read_level(const char* ptr, uint8_t lvl) const;
+  // the weight of the items less than value, or not greater if inclusive
+  uint64_t get_weight(T value, bool inclusive) const;
+  // whether the weight before the last copy of value in sorted order, with its own if inclusive,
+  // is at least the given one. The quantile calculator merges the compactors from the lowest
+  // up and keeps equal items in that order, so the last copy is one from the highest holding it.
+  template<bool inclusive>
+  bool reaches(T value, uint64_t weight) const;
+};
+
+} /* namespace datasketches */
+
+#include "req_wrapped_sketch_impl.hpp"
+
+#endif
@@ -0,0 +1,342 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef REQ_WRAPPED_SKETCH_IMPL_HPP_
+#define REQ_WRAPPED_SKETCH_IMPL_HPP_
+
+#include <limits>
+#include <stdexcept>
+#include <string>
+
+#include "memory_operations.hpp"
+
+namespace datasketches {
+
+template<typename T, typename C>
+wrapped_req_sketch<T, C>::wrapped_req_sketch(uint16_t k, bool hra):
+k_(k),
+hra_(hra),
+n_(0),
+num_levels_(0),
+num_retained_(0),
+min_value_(),
+max_value_(),
+raw_items_(false),
+num_raw_items_(0),
+is_level_zero_sorted_(false),
+compactors_(nullptr)
+{}
+
+template<typename T, typename C>
+wrapped_req_sketch<T, C> wrapped_req_sketch<T, C>::wrap(const void* bytes, size_t size) {
+  ensure_minimum_memory(size, 8);
+  const char* ptr = static_cast<const char*>(bytes);
+
+  uint8_t preamble_ints;
+  ptr += copy_from_mem(ptr, preamble_ints);
+  uint8_t serial_version;
+  ptr += copy_from_mem(ptr, serial_version);
+  uint8_t family_id;
+  ptr += copy_from_mem(ptr, family_id);
+  uint8_t flags_byte;
+  ptr += copy_from_mem(ptr, flags_byte);
+  uint16_t k;
+  ptr += copy_from_mem(ptr, k);
+  uint8_t num_levels;
+  ptr += copy_from_mem(ptr, num_levels);
+  uint8_t num_raw_items;
+  ptr += copy_from_mem(ptr, num_raw_items);
+
+  sketch::check_preamble_ints(preamble_ints, num_levels);
+  sketch::check_serial_version(serial_version);
+  sketch::check_family_id(family_id);
+
+  const bool is_empty = flags_byte & (1 << sketch::flags::IS_EMPTY);
+  const bool hra = flags_byte & (1 << sketch::flags::IS_HIGH_RANK);
+  wrapped_req_sketch wrapped(k, hra);
+  if (is_empty) return wrapped;
+
+  wrapped.raw_items_ = flags_byte & (1 << sketch::flags::RAW_ITEMS);
+  wrapped.num_raw_items_ = num_raw_items;
+  wrapped.is_level_zero_sorted_ = flags_byte & (1 << sketch::flags::IS_LEVEL_ZERO_SORTED);
+  wrapped.num_levels_ = wrapped.raw_items_ ? 1 : num_levels;
+  if (num_levels > 1) {
+    ensure_minimum_memory(size - (ptr - static_cast<const char*>(bytes)), sizeof(uint64_t) + 2 * sizeof(T));
+    ptr += copy_from_mem(ptr, wrapped.n_);
+    ptr += copy_from_mem(ptr, wrapped.min_value_);
+    ptr += copy_from_mem(ptr, wrapped.max_value_);
+  }
+
+  // every query reads the compactors, so they are checked to fit once here
+  wrapped.compactors_ = ptr;
+  for (uint8_t lvl = 0; lvl < wrapped.num_levels_; ++lvl) {
+    const size_t remaining = size - (ptr - static_cast<const char*>(bytes));
+    if (!wrapped.raw_items_) ensure_minimum_memory(remaining, COMPACTOR_HEADER_SIZE_BYTES);
+    const level compactor = wrapped.read_level(ptr, lvl);
+    ensure_minimum_memory(remaining, (compactor.items - ptr) + sizeof(T) * compactor.num_items);
+    wrapped.num_retained_ += compactor.num_items;
+    ptr = compactor.end();
+  }
+
+  if (wrapped.num_levels_ == 1) {
+    const level compactor = wrapped.read_level(wrapped.compactors_, 0);
+    if (compactor.num_items == 0) throw std::invalid_argument("Possible corruption: no items in a sketch that is not empty");
+    wrapped.n_ = compactor.num_items;
+    wrapped.min_value_ = compactor.item(0);
+    wrapped.max_value_ = wrapped.min_value_;
+    for (uint32_t i = 1; i < compactor.num_items; ++i) {
+      const T value = compactor.item(i);
+      if (C()(value, wrapped.min_value_)) wrapped.min_value_ = value;
+      if (C()(wrapped.max_value_, value)) wrapped.max_value_ = value;
+    }
+  }
+  return wrapped;
+}
+
+template<typename T, typename C>
+uint16_t wrapped_req_sketch<T, C>::get_k() const {
+  return k_;
+}
+
+template<typename T, typename C>
+bool wrapped_req_sketch<T, C>::is_HRA() const {
+  return hra_;
+}
+
+template<typename T, typename C>
+bool wrapped_req_sketch<T, C>::is_empty() const {
+  return n_ == 0;
+}
+
+template<typename T, typename C>
+uint64_t wrapped_req_sketch<T, C>::get_n() const {
+  return n_;
+}
+
+template<typename T, typename C>
+uint32_t wrapped_req_sketch<T, C>::get_num_retained() const {
+  return num_retained_;
+}
+
+template<typename T, typename C>
+bool wrapped_req_sketch<T, C>::is_estimation_mode() const {
+  return num_levels_ > 1;
+}
+
+template<typename T, typename C>
+T wrapped_req_sketch<T, C>::get_min_value() const {
+  if (is_empty()) return sketch::get_invalid_value();
+  return min_value_;
+}
+
+template<typename T, typename C>
+T wrapped_req_sketch<T, C>::get_max_value() const {
+  if (is_empty()) return sketch::get_invalid_value();
+  return max_value_;
+}
+
+template<typename T, typename C>
+template<bool inclusive>
+double wrapped_req_sketch<T, C>::get_rank(T item) const {
+  return static_cast<double>(get_weight(item, inclusive)) / n_;
+}
+
+template<typename T, typename C>
+template<bool inclusive>
+T wrapped_req_sketch<T, C>::get_quantile(double rank) const {
+  if (is_empty()) return sketch::get_invalid_value();
+  if (rank == 0.0) return min_value_;
+  if (rank == 1.0) return max_value_;
+  if ((rank < 0.0) || (rank > 1.0)) {
+    throw std::invalid_argument("Rank cannot be less than zero or greater than 1.0");
+  }
+  // as req_quantile_calculator::get_quantile: the least item whose weight reaches the rank's,
+  // or else the greatest item. That weight grows with the item, so the items are searched
+  // as if merged: each pivot splits the items between the bounds found so far, taken from
+  // the compactor holding the most of them.
+  const uint64_t weight = static_cast<uint64_t>(rank * n_);
+  bool has_lower = false;
+  bool has_upper = false;
+  T lower = min_value_;
+  T upper = max_value_;
+  const auto between = [&](T value) {
+    return (!has_lower || C()(lower, value)) && (!has_upper || C()(value, upper));
+  };
+  while (true) {
+    uint32_t most = 0;
+    T pivot = lower;
+    const char* ptr = compactors_;
+    for (uint8_t lvl = 0; lvl < num_levels_; ++lvl) {
+      const level compactor = read_level(ptr, lvl);
+      ptr = compactor.end();
+      if (!compactor.sorted) {
+        uint32_t num = 0;
+        for (uint32_t i = 0; i < compactor.num_items; ++i) {
+          if (between(compactor.item(i))) ++num;
+        }
+        if (num <= most) continue;
+        most = num;
+        // the middle one in the order they are stored in, which is as good as any
+        uint32_t skip = num / 2;
+        for (uint32_t i = 0; i < compactor.num_items; ++i) {
+          if (between(compactor.item(i)) && skip-- == 0) {
+            pivot = compactor.item(i);
+            break;
+          }
+        }
+      } else {
+        const uint32_t begin = has_lower ? compactor.partition_point(0, [&](T value) { return !C()(lower, value); }) : 0;
+        const uint32_t end = has_upper ? compactor.partition_point(begin, [&](T value) { return C()(value, upper); }) : compactor.num_items;
+        if (end - begin <= most) continue;
+        most = end - begin;
+        pivot = compactor.item(begin + most / 2);
+      }
+    }
+    if (most == 0) return has_upper ? upper : lower;
+    if (reaches<inclusive>(pivot, weight)) {
+      upper = pivot;
+      has_upper = true;
+    } else {
+      lower = pivot;
+      has_lower = true;
+    }
+  }
+}
+
+template<typename T, typename C>
+auto wrapped_req_sketch<T, C>::read_level(const char* ptr, uint8_t lvl) const -> level {
+  level compactor;
+  if (raw_items_) {
+    compactor.lg_weight = 0;
+    compactor.state = 0;
+    compactor.sorted = is_level_zero_sorted_;
+    compactor.num_items = num_raw_items_;
+    compactor.items = ptr;
+    return compactor;
+  }
+  ptr += copy_from_mem(ptr, compactor.state);
+  ptr += sizeof(float); // section size
+  ptr += copy_from_mem(ptr, compactor.lg_weight);
+  ptr += sizeof(uint8_t); // number of sections
+  ptr += sizeof(uint16_t); // padding
+  ptr += copy_from_mem(ptr, compactor.num_items);
+  compactor.sorted = lvl > 0 || is_level_zero_sorted_;
+  compactor.items = ptr;
+  return compactor;
+}
+
+template<typename T, typename C>
+uint64_t wrapped_req_sketch<T, C>::get_weight(T value, bool inclusive) const {
+  uint64_t weight = 0;
+  const char* ptr = compactors_;
+  for (uint8_t lvl = 0; lvl < num_levels_; ++lvl) {
+    const level compactor = read_level(ptr, lvl);
+    ptr = compactor.end();
+    weight += static_cast<uint64_t>(compactor.count(value, inclusive)) << compactor.lg_weight;
+  }
+  return weight;
+}
+
+template<typename T, typename C>
+template<bool inclusive>
+bool wrapped_req_sketch<T, C>::reaches(T value, uint64_t weight) const {
+  uint64_t not_greater = 0;
+  uint64_t last = 0;
+  const char* ptr = compactors_;
+  for (uint8_t lvl = 0; lvl < num_levels_; ++lvl) {
+    const level compactor = read_level(ptr, lvl);
+    ptr = compactor.end();
+    const uint32_t num_not_greater = compactor.count(value, true);
+    not_greater += static_cast<uint64_t>(num_not_greater) << compactor.lg_weight;
+    if (inclusive || num_not_greater == 0) continue;
+    // whether value is here, which is cheap to tell for a sorted compactor
+    const bool holds = compactor.sorted ? !C()(compactor.item(num_not_greater - 1), value) : num_not_greater > compactor.count(value, false);
+    if (holds) last = uint64_t(1) << compactor.lg_weight;
+  }
+  return not_greater - last >= weight;
+}
+
+template<typename T, typename C>
+T wrapped_req_sketch<T, C>::level::item(uint32_t index) const {
+  T value;
+  copy_from_mem(items + sizeof(T) * index, value);
+  return value;
+}
+
+template<typename T, typename C>
+uint32_t wrapped_req_sketch<T, C>::level::count(T value, bool inclusive) const {
+  if (!sorted) {
+    uint32_t num = 0;
+    for (uint32_t i = 0; i < num_items; ++i) {
+      if (inclusive ? !C()(value, item(i)) : C()(item(i), value)) ++num;
+    }
+    return num;
+  }
+  if (inclusive) return partition_point(0, [&](T other) { return !C()(value, other); });
+  return partition_point(0, [&](T other) { return C()(other, value); });
+}
+
+template<typename T, typename C>
+template<typename P>
+uint32_t wrapped_req_sketch<T, C>::level::partition_point(uint32_t from, P predicate) const {
+  uint32_t to = num_items;
+  while (from < to) {
+    const uint32_t mid = from + (to - from) / 2;
+    if (predicate(item(mid))) from = mid + 1;
+    else to = mid;
+  }
+  return from;
+}
+
+template<typename T, typename C>
+const char* wrapped_req_sketch<T, C>::level::end() const {
+  return items + sizeof(T) * num_items;
+}
+
+// req_sketch members that take a wrapped sketch, declared in req_sketch.hpp
+
+template<typename T, typename C, typename S, typename A>
+void req_sketch<T, C, S, A>::merge(wrapped_req_sketch<T, C> other) {
+  if (is_HRA() != other.is_HRA()) throw std::invalid_argument("merging HRA and LRA is not valid");
+  if (other.is_empty()) return;
+  if (is_empty()) {
+    min_value_ = new (allocator_.allocate(1)) T(other.min_value_);
+    max_value_ = new (allocator_.allocate(1)) T(other.max_value_);
+  } else {
+    if (C()(other.min_value_, *min_value_)) *min_value_ = other.min_value_;
+    if (C()(*max_value_, other.max_value_)) *max_value_ = other.max_value_;
+  }
+  // grow until this has at least as many compactors as other
+  while (get_num_levels() < other.num_levels_) grow();
+  // merge the items in all height compactors
+  const char* ptr = other.compactors_;
+  for (uint8_t i = 0; i < other.num_levels_; ++i) {
+    const auto compactor = other.read_level(ptr, i);
+    ptr = compactor.end();
+    compactors_[i].merge_serialized(compactor.lg_weight, compactor.state, compactor.sorted, compactor.items, compactor.num_items);
+  }
+  n_ += other.n_;
+  update_max_nom_size();
+  update_num_retained();
+  if (num_retained_ >= max_nom_size_) compress();
+}
+
+} /* namespace datasketches */
+
+#endif
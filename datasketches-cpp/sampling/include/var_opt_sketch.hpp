@@ -116,6 +116,18 @@ class var_opt_sketch {
     template<typename P>
     subset_summary estimate_subset_sum(P predicate) const;
 
+    /**
+     * Computes estimated subset sums, as estimate_subset_sum() does, for many disjoint
+     * subsets at once, in a single pass over the sample rather than one per subset.
+     * @param G a function from an item to the index of its subset, or to num_groups
+     *          or more for an item in none of them
+     * @param num_groups the number of subsets
+     * @return a subset_summary for each subset, in the order of their indices
+     */
+    template<typename G>
+    std::vector<subset_summary, typename std::allocator_traits<A>::template rebind_alloc<subset_summary>>
+    estimate_subset_sums(G group, uint32_t num_groups) const;
+
     /**
      * Returns true if the sketch is empty.
      * @return empty flag
@@ -303,8 +315,10 @@ class var_opt_sketch {
     void strip_marks();
     void force_set_k(uint32_t k); // used to resolve union gadget into sketch
     void downsample_candidate_set(double wt_cands, uint32_t num_cands);
+    inline void move_value(uint32_t src, uint32_t dst);
     inline void swap_values(uint32_t src, uint32_t dst);
     void grow_data_arrays();
+    void reserve(uint32_t num_items); // used to pre-size a union's gadget
     void allocate_data_arrays(uint32_t tgt_size, bool use_marks);
 
     // validation
@@ -327,8 +341,13 @@ class var_opt_sketch {
 };
 
 template<typename T, typename S, typename A>
-class var_opt_sketch<T, S, A>::const_iterator : public std::iterator<std::input_iterator_tag, T> {
+class var_opt_sketch<T, S, A>::const_iterator {
 public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T*;
+  using reference = T&;
   const_iterator(const const_iterator& other);
   const_iterator& operator++();
   const_iterator& operator++(int);
@@ -359,8 +378,13 @@ private:
 
 // non-const iterator for internal use
 template<typename T, typename S, typename A>
-class var_opt_sketch<T, S, A>::iterator : public std::iterator<std::input_iterator_tag, T> {
+class var_opt_sketch<T, S, A>::iterator {
 public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = T;
+  using difference_type = std::ptrdiff_t;
+  using pointer = T*;
+  using reference = T&;
   iterator(const iterator& other);
   iterator& operator++();
   iterator& operator++(int);
@@ -74,6 +74,16 @@ public:
    */
   void update(var_opt_sketch<T,S,A>&& sk);
 
+  /**
+   * Updates this union with each sketch in the given range, in order.
+   * The gadget is sized for all of their samples up front, so that it is not
+   * regrown along the way. Use std::make_move_iterator to move the items out.
+   * @param first iterator to the first sketch to add
+   * @param last iterator past the last sketch to add
+   */
+  template<typename InputIt>
+  void update(InputIt first, InputIt last);
+
   /**
    * Gets the varopt sketch resulting from the union of any input sketches.
    * @return a varopt sketch
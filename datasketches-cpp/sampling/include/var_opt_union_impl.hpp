@@ -317,6 +317,20 @@ void var_opt_union<T,S,A>::update(var_opt_sketch<T,S,A>&& sk) {
   resolve_tau(sk); // don't need items, so ok even if they've been moved out
 }
 
+template<typename T, typename S, typename A>
+template<typename InputIt>
+void var_opt_union<T,S,A>::update(InputIt first, InputIt last) {
+  uint64_t num_items = gadget_.h_;
+  for (InputIt it = first; it != last; ++it) {
+    num_items += (*it).get_num_samples();
+  }
+  gadget_.reserve(static_cast<uint32_t>(std::min<uint64_t>(num_items, max_k_ + 1)));
+
+  for (; first != last; ++first) {
+    update(*first);
+  }
+}
+
 template<typename T, typename S, typename A>
 double var_opt_union<T,S,A>::get_outer_tau() const {
   if (outer_tau_denom_ == 0) {
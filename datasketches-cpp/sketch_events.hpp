@@ -0,0 +1,12 @@
+#pragma once
+
+#include <cstdint>
+
+#include "common/include/event_counters.hpp"
+
+// Count of event, a datasketches::sketch_event, so far; events past the last
+// one have none. Always 0 unless built with DSRS_EVENT_STATS.
+inline uint64_t sketch_event_count(uint8_t event) {
+  if (event >= datasketches::NUM_SKETCH_EVENTS) return 0;
+  return datasketches::event_count(static_cast<datasketches::sketch_event>(event));
+}
@@ -2,74 +2,213 @@
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <stdexcept>
 
 #include "rust/cxx.h"
+#include "dsrs/src/bridge.rs.h"
 
 #include "theta/include/theta_sketch.hpp"
 #include "theta/include/theta_union.hpp"
 #include "theta/include/theta_intersection.hpp"
 #include "theta/include/theta_a_not_b.hpp"
+#include "theta/include/theta_jaccard_similarity_matrix.hpp"
+#include "batch.hpp"
 #include "theta.hpp"
 
-double OpaqueThetaSketch::estimate() const {
-  return this->inner_.get_estimate();
+template<typename Sketch>
+static EstimateBounds bounds_of(const Sketch& sketch, uint8_t num_std_devs) {
+  // exact sketches skip the bounds computation, which would check this
+  if (num_std_devs < 1 || num_std_devs > 3) {
+    throw std::invalid_argument("num_std_devs must be 1, 2 or 3");
+  }
+  EstimateBounds result;
+  result.lower_bound = sketch.get_lower_bound(num_std_devs);
+  result.estimate = sketch.get_estimate();
+  result.upper_bound = sketch.get_upper_bound(num_std_devs);
+  return result;
+}
+
+bool OpaqueThetaSketch::is_dirty() const {
+  return this->dirty_;
+}
+
+void OpaqueThetaSketch::update_u64_batch(rust::Slice<const uint64_t> values) {
+  this->dirty_ = true;
+  this->inner_.update_batch(values.data(), values.size());
+}
+
+void OpaqueThetaSketch::update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends) {
+  this->dirty_ = true;
+  const uint8_t* data = buf.data();
+  if (all_16_byte_keys(ends)) {
+    this->inner_.update_batch_16(data, ends.size());
+    return;
+  }
+  this->inner_.update_batch(data, ends.data(), ends.size());
+}
+
+void OpaqueThetaSketch::update_hashed(KeyHash hash) {
+  this->dirty_ = true;
+  this->inner_.update_hashes(&hash, 1);
 }
 
-void OpaqueThetaSketch::update(rust::Slice<const uint8_t> buf) {
-  this->inner_.update(buf.data(), buf.size());
+void OpaqueThetaSketch::update_hashed_batch(rust::Slice<const KeyHash> hashes) {
+  this->dirty_ = true;
+  this->inner_.update_hashes(hashes.data(), hashes.size());
 }
 
-void OpaqueThetaSketch::update_u64(uint64_t value) {
-  this->inner_.update(value);
+void OpaqueThetaSketch::reset() {
+  this->dirty_ = true;
+  this->inner_.reset();
 }
 
-std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaSketch::as_static() const{
-  auto compact = this->inner_.compact();
+size_t OpaqueThetaSketch::get_memory_usage_bytes() const {
+  return this->inner_.get_memory_usage_bytes();
+}
+
+EstimateBounds OpaqueThetaSketch::bounds(uint8_t num_std_devs) const {
+  return bounds_of(this->inner_, num_std_devs);
+}
+
+std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaSketch::as_static(bool ordered) const {
+  auto compact = this->inner_.compact(ordered);
   auto ptr = new OpaqueStaticThetaSketch{std::move(compact)};
   return std::unique_ptr<OpaqueStaticThetaSketch>(ptr);
 }
 
-OpaqueThetaSketch::OpaqueThetaSketch():
-  inner_{datasketches::update_theta_sketch::builder{}.build()} {
+static datasketches::theta_constants::resize_factor to_resize_factor(ThetaResizeFactor rf) {
+  switch (rf) {
+    case ThetaResizeFactor::X1: return datasketches::theta_constants::resize_factor::X1;
+    case ThetaResizeFactor::X2: return datasketches::theta_constants::resize_factor::X2;
+    case ThetaResizeFactor::X4: return datasketches::theta_constants::resize_factor::X4;
+    case ThetaResizeFactor::X8: return datasketches::theta_constants::resize_factor::X8;
+  }
+  throw std::invalid_argument("unknown theta resize factor");
+}
+
+OpaqueThetaSketch::OpaqueThetaSketch(update_theta_sketch&& theta):
+  inner_{std::move(theta)},
+  estimate_{0},
+  dirty_{true} {
 }
 
-OpaqueThetaSketch::OpaqueThetaSketch(datasketches::update_theta_sketch&& theta):
-  inner_{std::move(theta)} {
+std::unique_ptr<OpaqueThetaSketch> new_opaque_theta_sketch(uint8_t lg_k, ThetaResizeFactor rf, float p, uint64_t expected_n) {
+  auto theta = update_theta_sketch::builder{}
+    .set_lg_k(lg_k)
+    .set_resize_factor(to_resize_factor(rf))
+    .set_p(p)
+    .set_expected_n(expected_n)
+    .build();
+  return std::unique_ptr<OpaqueThetaSketch>(new OpaqueThetaSketch{std::move(theta)});
 }
 
-std::unique_ptr<OpaqueThetaSketch> new_opaque_theta_sketch() {
-  return std::unique_ptr<OpaqueThetaSketch>(new OpaqueThetaSketch{});
+ConcurrentThetaState::ConcurrentThetaState():
+  seed{datasketches::DEFAULT_SEED},
+  mutex{},
+  sketch{update_theta_sketch::builder{}.set_seed(seed).build()},
+  theta{sketch.get_theta64()} {
 }
 
-OpaqueStaticThetaSketch::OpaqueStaticThetaSketch(const datasketches::compact_theta_sketch& theta):
-  inner_{theta} {
+OpaqueConcurrentThetaSketch::OpaqueConcurrentThetaSketch():
+  state_{std::make_shared<ConcurrentThetaState>()} {
 }
 
-OpaqueStaticThetaSketch::OpaqueStaticThetaSketch(datasketches::compact_theta_sketch&& theta):
-  inner_{std::move(theta)} {
+double OpaqueConcurrentThetaSketch::estimate() const {
+  std::lock_guard<std::mutex> lock(this->state_->mutex);
+  return this->state_->sketch.get_estimate();
+}
+
+std::unique_ptr<OpaqueStaticThetaSketch> OpaqueConcurrentThetaSketch::as_static(bool ordered) const {
+  std::lock_guard<std::mutex> lock(this->state_->mutex);
+  auto compact = this->state_->sketch.compact(ordered);
+  return std::unique_ptr<OpaqueStaticThetaSketch>(new OpaqueStaticThetaSketch{std::move(compact)});
+}
+
+std::unique_ptr<OpaqueThetaBuffer> OpaqueConcurrentThetaSketch::buffer(size_t capacity) const {
+  return std::unique_ptr<OpaqueThetaBuffer>(new OpaqueThetaBuffer{this->state_, capacity});
+}
+
+std::unique_ptr<OpaqueConcurrentThetaSketch> new_opaque_concurrent_theta_sketch() {
+  return std::unique_ptr<OpaqueConcurrentThetaSketch>(new OpaqueConcurrentThetaSketch{});
+}
+
+OpaqueThetaBuffer::OpaqueThetaBuffer(std::shared_ptr<ConcurrentThetaState> state, size_t capacity):
+  state_{std::move(state)},
+  hashes_{},
+  capacity_{capacity > 0 ? capacity : 1} {
+  this->hashes_.reserve(this->capacity_);
+}
+
+OpaqueThetaBuffer::~OpaqueThetaBuffer() {
+  this->flush();
+}
+
+void OpaqueThetaBuffer::update_hash(uint64_t hash) {
+  // theta only decreases, so a stale value just screens less
+  if (hash >= this->state_->theta.load(std::memory_order_relaxed)) return;
+  this->hashes_.push_back(hash);
+  if (this->hashes_.size() >= this->capacity_) this->flush();
+}
+
+void OpaqueThetaBuffer::update(rust::Slice<const uint8_t> buf) {
+  this->update_hash(datasketches::compute_hash(buf.data(), buf.size(), this->state_->seed));
+}
+
+void OpaqueThetaBuffer::update_u64(uint64_t value) {
+  this->update_hash(datasketches::compute_hash(&value, sizeof(value), this->state_->seed));
+}
+
+void OpaqueThetaBuffer::flush() {
+  if (this->hashes_.empty()) return;
+  std::lock_guard<std::mutex> lock(this->state_->mutex);
+  auto& sketch = this->state_->sketch;
+  sketch.update_hashes(this->hashes_.data(), this->hashes_.size());
+  this->state_->theta.store(sketch.get_theta64(), std::memory_order_relaxed);
+  this->hashes_.clear();
+}
+
+OpaqueStaticThetaSketch::OpaqueStaticThetaSketch(const compact_theta_sketch& theta):
+  inner_{theta} {
 }
 
-OpaqueStaticThetaSketch::OpaqueStaticThetaSketch(std::istream& is):
-  inner_{datasketches::compact_theta_sketch::deserialize(is)} {
+OpaqueStaticThetaSketch::OpaqueStaticThetaSketch(compact_theta_sketch&& theta):
+  inner_{std::move(theta)} {
 }
 
 double OpaqueStaticThetaSketch::estimate() const {
   return this->inner_.get_estimate();
 }
 
+size_t OpaqueStaticThetaSketch::get_memory_usage_bytes() const {
+  return this->inner_.get_memory_usage_bytes();
+}
+
+EstimateBounds OpaqueStaticThetaSketch::bounds(uint8_t num_std_devs) const {
+  return bounds_of(this->inner_, num_std_devs);
+}
+
 std::unique_ptr<OpaqueStaticThetaSketch> OpaqueStaticThetaSketch::clone() const {
   return std::unique_ptr<OpaqueStaticThetaSketch>(new OpaqueStaticThetaSketch{this->inner_});
 }
 
 void OpaqueStaticThetaSketch::set_difference(const OpaqueStaticThetaSketch& other) {
-  datasketches::theta_a_not_b a_not_b;
+  theta_a_not_b a_not_b;
   auto result = a_not_b.compute(std::move(this->inner_), other.inner_);
   this->inner_ = std::move(result);
 }
 
+void OpaqueStaticThetaSketch::exclude(const OpaqueThetaExclusion& exclusion) {
+  auto result = exclusion.inner_.compute(std::move(this->inner_));
+  this->inner_ = std::move(result);
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueStaticThetaSketch::serialize_compressed() const {
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(this->inner_.serialize_compressed())));
+}
+
 std::unique_ptr<std::vector<uint8_t>> OpaqueStaticThetaSketch::serialize() const {
   auto v = this->inner_.serialize();
-  auto ptr = new std::vector<uint8_t>(std::move(v));
+  auto ptr = new std::vector<uint8_t>(into_std_vector(std::move(v)));
   return std::unique_ptr<std::vector<uint8_t>>(ptr);
   /*    // TODO: could use a custom streambuf to avoid the
   // stream -> vec copy https://stackoverflow.com/a/13059195/1779853
@@ -83,36 +222,256 @@ std::unique_ptr<std::vector<uint8_t>> OpaqueStaticThetaSketch::serialize() const
   s.seekg(0, std::ios::beg);
   s.read(reinterpret_cast<char*>(v.data()), std::streamsize(v.size()));
 
-  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(std::move(v)));
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(into_std_vector(std::move(v))));
   */
 }
 
 std::unique_ptr<OpaqueStaticThetaSketch> deserialize_opaque_static_theta_sketch(rust::Slice<const uint8_t> buf) {
-  // TODO: could use a custom streambuf to avoid the slice -> stream copy
-  std::stringstream s{};
-  s.write(const_cast<char*>(reinterpret_cast<const char*>(buf.data())), std::streamsize(buf.size()));
-  s.seekg(0, std::ios::beg);
-  return std::unique_ptr<OpaqueStaticThetaSketch>(new OpaqueStaticThetaSketch{s});
+  auto theta = compact_theta_sketch::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueStaticThetaSketch>(new OpaqueStaticThetaSketch{std::move(theta)});
+}
+
+OpaqueThetaExclusion::OpaqueThetaExclusion(const compact_theta_sketch& b):
+  inner_{b} {
+}
+
+std::unique_ptr<OpaqueThetaExclusion> new_opaque_theta_exclusion(const OpaqueStaticThetaSketch& b) {
+  return std::unique_ptr<OpaqueThetaExclusion>(new OpaqueThetaExclusion{b.inner_});
+}
+
+OpaqueWrappedThetaSketch::OpaqueWrappedThetaSketch(const wrapped_compact_theta_sketch& theta):
+  inner_{theta} {
+}
+
+double OpaqueWrappedThetaSketch::estimate() const {
+  return this->inner_.get_estimate();
+}
+
+std::unique_ptr<OpaqueStaticThetaSketch> OpaqueWrappedThetaSketch::to_static() const {
+  return std::unique_ptr<OpaqueStaticThetaSketch>(new OpaqueStaticThetaSketch{this->inner_.to_compact()});
+}
+
+std::unique_ptr<OpaqueWrappedThetaSketch> wrap_opaque_static_theta_sketch(rust::Slice<const uint8_t> buf) {
+  auto wrapped = wrapped_compact_theta_sketch::wrap(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueWrappedThetaSketch>(new OpaqueWrappedThetaSketch{wrapped});
+}
+
+// Compressed sketches cannot be wrapped, so the functions below decode them instead.
+
+double estimate_serialized_theta_sketch(rust::Slice<const uint8_t> buf) {
+  if (compact_theta_sketch::is_serialized_compressed(buf.data(), buf.size())) {
+    return compact_theta_sketch::deserialize(buf.data(), buf.size()).get_estimate();
+  }
+  // the view lives on the stack and never reads the hashes, so nothing is copied
+  return wrapped_compact_theta_sketch::wrap(buf.data(), buf.size()).get_estimate();
+}
+
+EstimateBounds bounds_serialized_theta_sketch(rust::Slice<const uint8_t> buf, uint8_t num_std_devs) {
+  if (compact_theta_sketch::is_serialized_compressed(buf.data(), buf.size())) {
+    return bounds_of(compact_theta_sketch::deserialize(buf.data(), buf.size()), num_std_devs);
+  }
+  return bounds_of(wrapped_compact_theta_sketch::wrap(buf.data(), buf.size()), num_std_devs);
+}
+
+// The number of hashes of a sketch and the theta its bounds are computed at, which is 1
+// unless it is in estimation mode, as the sketches' own bounds take it.
+template<typename Sketch>
+static void sample_of(const Sketch& sketch, uint64_t& num_retained, double& theta) {
+  num_retained = sketch.get_num_retained();
+  const bool estimation_mode = !sketch.is_empty() && sketch.get_theta64() < datasketches::theta_constants::MAX_THETA;
+  theta = estimation_mode ? static_cast<double>(sketch.get_theta64()) / datasketches::theta_constants::MAX_THETA : 1.0;
+}
+
+void bounds_serialized_theta_sketches(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, uint8_t num_std_devs, rust::Slice<EstimateBounds> out) {
+  const size_t n = ends.size();
+  std::vector<uint64_t> num_retained(n);
+  std::vector<double> thetas(n);
+  size_t start = 0;
+  for (size_t i = 0; i < n; ++i) {
+    const uint8_t* sketch = buf.data() + start;
+    const size_t size = ends[i] - start;
+    if (compact_theta_sketch::is_serialized_compressed(sketch, size)) {
+      sample_of(compact_theta_sketch::deserialize(sketch, size), num_retained[i], thetas[i]);
+    } else {
+      sample_of(wrapped_compact_theta_sketch::wrap(sketch, size), num_retained[i], thetas[i]);
+    }
+    start = ends[i];
+  }
+  std::vector<double> lower(n);
+  std::vector<double> upper(n);
+  datasketches::binomial_bounds::get_lower_bounds(num_retained.data(), thetas.data(), n, num_std_devs, lower.data());
+  datasketches::binomial_bounds::get_upper_bounds(num_retained.data(), thetas.data(), n, num_std_devs, upper.data());
+  for (size_t i = 0; i < n; ++i) {
+    out[i].lower_bound = lower[i];
+    out[i].estimate = num_retained[i] / thetas[i];
+    out[i].upper_bound = upper[i];
+  }
 }
 
 OpaqueThetaUnion::OpaqueThetaUnion():
-  inner_{datasketches::theta_union::builder{}.build()} {
+  inner_{theta_union::builder{}.build()} {
 }
 
-std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaUnion::sketch() const {
-  auto result = this->inner_.get_result();
-  auto ptr = new OpaqueStaticThetaSketch{std::move(result)};
+std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaUnion::sketch(bool ordered) const {
+  // an ordered result serves either request, an unordered one only its own
+  if (!this->result_ || (ordered && !this->result_->is_ordered())) {
+    this->result_.reset(new compact_theta_sketch{this->inner_.get_result(ordered)});
+  }
+  auto ptr = new OpaqueStaticThetaSketch{*this->result_};
+  return std::unique_ptr<OpaqueStaticThetaSketch>(ptr);
+}
+
+std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaUnion::take_sketch() {
+  this->result_.reset();
+  auto ptr = new OpaqueStaticThetaSketch{this->inner_.take_result()};
   return std::unique_ptr<OpaqueStaticThetaSketch>(ptr);
 }
 
 void OpaqueThetaUnion::union_with(std::unique_ptr<OpaqueStaticThetaSketch> to_union) {
+  this->result_.reset();
   this->inner_.update(std::move(to_union->inner_));
 }
 
+void OpaqueThetaUnion::union_with_ref(const OpaqueStaticThetaSketch& to_union) {
+  this->result_.reset();
+  this->inner_.update(to_union.inner_);
+}
+
+void OpaqueThetaUnion::union_with_wrapped(const OpaqueWrappedThetaSketch& to_union) {
+  this->result_.reset();
+  this->inner_.update(to_union.inner_);
+}
+
+void OpaqueThetaUnion::union_serialized(rust::Slice<const uint8_t> buf) {
+  this->result_.reset();
+  if (compact_theta_sketch::is_serialized_compressed(buf.data(), buf.size())) {
+    this->inner_.update(compact_theta_sketch::deserialize(buf.data(), buf.size()));
+    return;
+  }
+  this->inner_.update(wrapped_compact_theta_sketch::wrap(buf.data(), buf.size()));
+}
+
+void OpaqueThetaUnion::reset() {
+  this->result_.reset();
+  this->inner_.reset();
+}
+
 std::unique_ptr<OpaqueThetaUnion> new_opaque_theta_union() {
   return std::unique_ptr<OpaqueThetaUnion>(new OpaqueThetaUnion{});
 }
 
+OpaqueThetaWindow::OpaqueThetaWindow(uint8_t lg_k, float p, size_t num_slices):
+  num_slices_{num_slices},
+  newest_{update_theta_sketch::builder{}.set_lg_k(lg_k).set_p(p).build()},
+  back_{},
+  back_union_{theta_union::builder{}.set_lg_k(lg_k).build()},
+  front_{},
+  builder_{},
+  estimate_{0},
+  dirty_{true} {
+  this->builder_.set_lg_k(lg_k);
+}
+
+double OpaqueThetaWindow::estimate() const {
+  if (this->dirty_) {
+    this->estimate_ = this->sketch()->estimate();
+    this->dirty_ = false;
+  }
+  return this->estimate_;
+}
+
+bool OpaqueThetaWindow::is_dirty() const {
+  return this->dirty_;
+}
+
+std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaWindow::sketch() const {
+  auto window = this->builder_.build();
+  if (!this->front_.empty()) window.update(this->front_.back());
+  if (!this->back_.empty()) window.update(this->back_union_.get_result(false));
+  window.update(this->newest_);
+  return std::unique_ptr<OpaqueStaticThetaSketch>(new OpaqueStaticThetaSketch{window.take_result()});
+}
+
+void OpaqueThetaWindow::update(rust::Slice<const uint8_t> buf) {
+  this->dirty_ = true;
+  this->newest_.update(buf.data(), buf.size());
+}
+
+void OpaqueThetaWindow::update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends) {
+  this->dirty_ = true;
+  this->newest_.update_batch(buf.data(), ends.data(), ends.size());
+}
+
+void OpaqueThetaWindow::advance() {
+  this->dirty_ = true;
+  if (this->num_slices_ == 1) {
+    this->newest_.reset();
+    return;
+  }
+  this->back_.push_back(this->newest_.compact(false));
+  this->back_union_.update(this->back_.back());
+  this->newest_.reset();
+  if (this->front_.size() + this->back_.size() < this->num_slices_) return;
+
+  if (this->front_.empty()) {
+    // Each slice's union with all newer ones in the stack is its older
+    // neighbour's without it, so they are built newest first.
+    auto suffix = this->builder_.build();
+    for (auto it = this->back_.rbegin(); it != this->back_.rend(); ++it) {
+      suffix.update(std::move(*it));
+      this->front_.push_back(suffix.get_result(false));
+    }
+    this->back_.clear();
+    this->back_union_.reset();
+  }
+  this->front_.pop_back();
+}
+
+size_t OpaqueThetaWindow::get_num_slices() const {
+  return this->num_slices_;
+}
+
+std::unique_ptr<OpaqueThetaWindow> new_opaque_theta_window(uint8_t lg_k, float p, size_t num_slices) {
+  if (num_slices == 0) throw std::invalid_argument("num_slices must be positive");
+  return std::unique_ptr<OpaqueThetaWindow>(new OpaqueThetaWindow{lg_k, p, num_slices});
+}
+
+OpaqueKeyedThetaSketch::OpaqueKeyedThetaSketch(uint8_t lg_k):
+  inner_{lg_k} {
+}
+
+void OpaqueKeyedThetaSketch::update(uint32_t key_id, uint64_t key_hash, rust::Slice<const uint8_t> buf) {
+  this->inner_.update(key_id, key_hash, buf.data(), buf.size());
+}
+
+void OpaqueKeyedThetaSketch::counts(rust::Slice<uint32_t> counts) const {
+  this->inner_.get_counts(counts.data(), counts.size());
+}
+
+double OpaqueKeyedThetaSketch::theta() const {
+  return this->inner_.get_theta();
+}
+
+uint32_t OpaqueKeyedThetaSketch::num_retained() const {
+  return this->inner_.get_num_retained();
+}
+
+uint8_t OpaqueKeyedThetaSketch::get_lg_k() const {
+  return this->inner_.get_lg_k();
+}
+
+void OpaqueKeyedThetaSketch::merge(const OpaqueKeyedThetaSketch& other, rust::Slice<const uint32_t> key_map) {
+  this->inner_.merge(other.inner_, key_map.data(), key_map.size());
+}
+
+size_t OpaqueKeyedThetaSketch::get_memory_usage_bytes() const {
+  return this->inner_.get_memory_usage_bytes();
+}
+
+std::unique_ptr<OpaqueKeyedThetaSketch> new_opaque_keyed_theta_sketch(uint8_t lg_k) {
+  return std::unique_ptr<OpaqueKeyedThetaSketch>(new OpaqueKeyedThetaSketch{lg_k});
+}
+
 OpaqueThetaIntersection::OpaqueThetaIntersection():
   inner_{} {
 }
@@ -121,8 +480,15 @@ std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaIntersection::sketch() const
   if (!this->inner_.has_result()) {
     return std::unique_ptr<OpaqueStaticThetaSketch>(nullptr);
   }
-  auto value = this->inner_.get_result();
-  auto ptr = new OpaqueStaticThetaSketch{value};
+  auto ptr = new OpaqueStaticThetaSketch{this->inner_.get_result()};
+  return std::unique_ptr<OpaqueStaticThetaSketch>(ptr);
+}
+
+std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaIntersection::take_sketch() {
+  if (!this->inner_.has_result()) {
+    return std::unique_ptr<OpaqueStaticThetaSketch>(nullptr);
+  }
+  auto ptr = new OpaqueStaticThetaSketch{this->inner_.take_result()};
   return std::unique_ptr<OpaqueStaticThetaSketch>(ptr);
 }
 
@@ -130,6 +496,68 @@ void OpaqueThetaIntersection::intersect_with(std::unique_ptr<OpaqueStaticThetaSk
   this->inner_.update(std::move(to_intersect->inner_));
 }
 
+void OpaqueThetaIntersection::intersect_with_ref(const OpaqueStaticThetaSketch& to_intersect) {
+  this->inner_.update(to_intersect.inner_);
+}
+
+void OpaqueThetaIntersection::intersect_with_wrapped(const OpaqueWrappedThetaSketch& to_intersect) {
+  this->inner_.update(to_intersect.inner_);
+}
+
 std::unique_ptr<OpaqueThetaIntersection> new_opaque_theta_intersection() {
   return std::unique_ptr<OpaqueThetaIntersection>(new OpaqueThetaIntersection{});
 }
+
+OpaqueThetaExpression::OpaqueThetaExpression():
+  inner_{} {
+}
+
+void OpaqueThetaExpression::add_input(rust::Slice<const uint8_t> buf) {
+  this->inner_.add_input(buf.data(), buf.size());
+}
+
+std::unique_ptr<OpaqueStaticThetaSketch> OpaqueThetaExpression::evaluate(rust::Slice<const uint32_t> program) const {
+  auto result = this->inner_.evaluate(program.data(), program.size());
+  return std::unique_ptr<OpaqueStaticThetaSketch>(new OpaqueStaticThetaSketch{std::move(result)});
+}
+
+std::unique_ptr<OpaqueThetaExpression> new_opaque_theta_expression() {
+  return std::unique_ptr<OpaqueThetaExpression>(new OpaqueThetaExpression{});
+}
+
+OpaqueThetaJaccardMatrix::OpaqueThetaJaccardMatrix():
+  inner_{} {
+}
+
+void OpaqueThetaJaccardMatrix::add(const OpaqueStaticThetaSketch& sketch) {
+  this->inner_.update(sketch.inner_);
+}
+
+size_t OpaqueThetaJaccardMatrix::num_sketches() const {
+  return this->inner_.get_num_sketches();
+}
+
+EstimateBounds OpaqueThetaJaccardMatrix::jaccard(size_t i, size_t j) const {
+  const auto bounds = this->inner_.jaccard(i, j);
+  EstimateBounds result;
+  result.lower_bound = bounds[0];
+  result.estimate = bounds[1];
+  result.upper_bound = bounds[2];
+  return result;
+}
+
+void OpaqueThetaJaccardMatrix::jaccard_tile(size_t row_begin, size_t row_end, size_t col_begin, size_t col_end, rust::Slice<EstimateBounds> out) const {
+  std::vector<std::array<double, 3>> tile(out.size());
+  this->inner_.jaccard_tile(row_begin, row_end, col_begin, col_end, tile.data());
+  auto it = out.begin();
+  for (const auto& bounds: tile) {
+    it->lower_bound = bounds[0];
+    it->estimate = bounds[1];
+    it->upper_bound = bounds[2];
+    ++it;
+  }
+}
+
+std::unique_ptr<OpaqueThetaJaccardMatrix> new_opaque_theta_jaccard_matrix() {
+  return std::unique_ptr<OpaqueThetaJaccardMatrix>(new OpaqueThetaJaccardMatrix{});
+}
@@ -1,74 +1,348 @@
 #pragma once
 
+#include <atomic>
 #include <cstdint>
 #include <iostream>
 #include <vector>
 #include <memory>
+#include <mutex>
 
 #include "rust/cxx.h"
 
 #include "theta/include/theta_sketch.hpp"
 #include "theta/include/theta_union.hpp"
 #include "theta/include/theta_intersection.hpp"
+#include "theta/include/theta_a_not_b.hpp"
+#include "theta/include/theta_expression.hpp"
+#include "theta/include/theta_jaccard_similarity_matrix.hpp"
+#include "theta/include/keyed_theta_sketch.hpp"
+
+#include "alloc_stats.hpp"
+
+using theta_allocator = sketch_allocator<uint64_t, alloc_family::THETA>;
+using update_theta_sketch = datasketches::update_theta_sketch_alloc<theta_allocator>;
+using compact_theta_sketch = datasketches::compact_theta_sketch_alloc<theta_allocator>;
+using wrapped_compact_theta_sketch = datasketches::wrapped_compact_theta_sketch_alloc<theta_allocator>;
+using theta_union = datasketches::theta_union_alloc<theta_allocator>;
+using theta_intersection = datasketches::theta_intersection_alloc<theta_allocator>;
+using theta_a_not_b = datasketches::theta_a_not_b_alloc<theta_allocator>;
+using theta_a_not_b_prepared = datasketches::theta_a_not_b_prepared_alloc<theta_allocator>;
+using theta_expression = datasketches::theta_expression_alloc<theta_allocator>;
+using theta_jaccard_similarity_matrix = datasketches::theta_jaccard_similarity_matrix_alloc<theta_allocator>;
+using keyed_theta_sketch = datasketches::keyed_theta_sketch_alloc<theta_allocator>;
+
+enum class ThetaResizeFactor : uint8_t;
+struct EstimateBounds;
+struct KeyHash;
 
 class OpaqueStaticThetaSketch;
+class OpaqueThetaExclusion;
 
 class OpaqueThetaSketch {
+public:
+  // Cached between updates, as for OpaqueCpcSketch.
+  double estimate() const noexcept;
+  bool is_dirty() const;
+  void update(rust::Slice<const uint8_t> buf) noexcept;
+  void update_u64(uint64_t value) noexcept;
+  void update_u64_batch(rust::Slice<const uint64_t> values);
+  // Key i spans [ends[i-1], ends[i]) of buf, with ends[-1] taken as 0.
+  void update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends);
+  // In place of update(), with the hash_key() of its buf.
+  void update_hashed(KeyHash hash);
+  // In place of update_bytes_batch(), with the hash_keys() of its keys.
+  void update_hashed_batch(rust::Slice<const KeyHash> hashes);
+  // Empties the sketch, keeping its hash table for reuse.
+  void reset();
+  // Heap bytes held by the hash table.
+  size_t get_memory_usage_bytes() const;
+  // Throws std::invalid_argument unless num_std_devs is 1, 2 or 3.
+  EstimateBounds bounds(uint8_t num_std_devs) const;
+  // Unordered skips sorting the hashes, which only estimates, set operations
+  // and unions of unordered inputs can do without.
+  std::unique_ptr<OpaqueStaticThetaSketch> as_static(bool ordered) const;
+private:
+  OpaqueThetaSketch(update_theta_sketch&& theta);
+  friend std::unique_ptr<OpaqueThetaSketch> new_opaque_theta_sketch(uint8_t lg_k, ThetaResizeFactor rf, float p, uint64_t expected_n);
+  update_theta_sketch inner_;
+  // The last estimate(), which stays valid until the next update.
+  mutable double estimate_;
+  mutable bool dirty_;
+};
+
+// Defined here, as the same calls of OpaqueCpcSketch are, so that cxx's shims
+// inline them.
+
+inline double OpaqueThetaSketch::estimate() const noexcept {
+  if (this->dirty_) {
+    this->estimate_ = this->inner_.get_estimate();
+    this->dirty_ = false;
+  }
+  return this->estimate_;
+}
+
+inline void OpaqueThetaSketch::update(rust::Slice<const uint8_t> buf) noexcept {
+  this->dirty_ = true;
+  this->inner_.update(buf.data(), buf.size());
+}
+
+inline void OpaqueThetaSketch::update_u64(uint64_t value) noexcept {
+  this->dirty_ = true;
+  this->inner_.update(value);
+}
+
+// Throws std::invalid_argument unless MIN_LG_K <= lg_k <= MAX_LG_K and 0 < p <= 1.
+// A nonzero expected_n, the number of distinct values expected, sizes the hash
+// table for them up front; see theta_base_builder::set_expected_n.
+std::unique_ptr<OpaqueThetaSketch> new_opaque_theta_sketch(uint8_t lg_k, ThetaResizeFactor rf, float p, uint64_t expected_n);
+
+// State shared by a concurrent theta sketch and all of its buffers.
+struct ConcurrentThetaState {
+  ConcurrentThetaState();
+  const uint64_t seed;
+  std::mutex mutex;
+  update_theta_sketch sketch; // guarded by mutex
+  // sketch.get_theta64() as of the last propagation, read by buffers without the lock
+  std::atomic<uint64_t> theta;
+};
+
+class OpaqueThetaBuffer;
+
+// A theta sketch updated from many threads through per-thread OpaqueThetaBuffer
+// instances, similar to Java's ConcurrentHeapThetaBuffer. Hashes only become
+// visible to estimate() once their buffer propagates them.
+class OpaqueConcurrentThetaSketch {
 public:
   double estimate() const;
+  std::unique_ptr<OpaqueStaticThetaSketch> as_static(bool ordered) const;
+  std::unique_ptr<OpaqueThetaBuffer> buffer(size_t capacity) const;
+private:
+  OpaqueConcurrentThetaSketch();
+  friend std::unique_ptr<OpaqueConcurrentThetaSketch> new_opaque_concurrent_theta_sketch();
+  std::shared_ptr<ConcurrentThetaState> state_;
+};
+
+std::unique_ptr<OpaqueConcurrentThetaSketch> new_opaque_concurrent_theta_sketch();
+
+// Single-threaded front end of an OpaqueConcurrentThetaSketch. Updates hash and
+// screen against the published theta without locking; the lock is only taken to
+// propagate a full buffer, and on flush(), including on destruction.
+class OpaqueThetaBuffer {
+public:
+  ~OpaqueThetaBuffer();
   void update(rust::Slice<const uint8_t> buf);
   void update_u64(uint64_t value);
-  std::unique_ptr<OpaqueStaticThetaSketch> as_static() const;
+  void flush();
 private:
-  OpaqueThetaSketch();
-  OpaqueThetaSketch(datasketches::update_theta_sketch&& theta);
-  friend std::unique_ptr<OpaqueThetaSketch> new_opaque_theta_sketch();
-  datasketches::update_theta_sketch inner_;
+  OpaqueThetaBuffer(std::shared_ptr<ConcurrentThetaState> state, size_t capacity);
+  friend class OpaqueConcurrentThetaSketch;
+  inline void update_hash(uint64_t hash);
+  std::shared_ptr<ConcurrentThetaState> state_;
+  std::vector<uint64_t> hashes_;
+  size_t capacity_;
 };
 
-std::unique_ptr<OpaqueThetaSketch> new_opaque_theta_sketch();
-
 class OpaqueStaticThetaSketch {
 public:
   double estimate() const;
+  // Heap bytes held by the retained entries.
+  size_t get_memory_usage_bytes() const;
+  // Throws std::invalid_argument unless num_std_devs is 1, 2 or 3.
+  EstimateBounds bounds(uint8_t num_std_devs) const;
   std::unique_ptr<OpaqueStaticThetaSketch> clone() const;
   void set_difference(const OpaqueStaticThetaSketch& other);
+  void exclude(const OpaqueThetaExclusion& exclusion);
   std::unique_ptr<std::vector<uint8_t>> serialize() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize_compressed() const;
 private:
-  OpaqueStaticThetaSketch(const datasketches::compact_theta_sketch& theta);
-  OpaqueStaticThetaSketch(datasketches::compact_theta_sketch&& theta);
-  OpaqueStaticThetaSketch(std::istream& is);
+  OpaqueStaticThetaSketch(const compact_theta_sketch& theta);
+  OpaqueStaticThetaSketch(compact_theta_sketch&& theta);
   friend std::unique_ptr<OpaqueStaticThetaSketch> deserialize_opaque_static_theta_sketch(rust::Slice<const uint8_t> buf);
   friend class OpaqueThetaSketch;
+  friend class OpaqueConcurrentThetaSketch;
+  friend class OpaqueWrappedThetaSketch;
   friend class OpaqueThetaUnion;
   friend class OpaqueThetaIntersection;
-  datasketches::compact_theta_sketch inner_;
+  friend class OpaqueThetaExpression;
+  friend class OpaqueThetaWindow;
+  friend class OpaqueThetaJaccardMatrix;
+  friend std::unique_ptr<OpaqueThetaExclusion> new_opaque_theta_exclusion(const OpaqueStaticThetaSketch& b);
+  compact_theta_sketch inner_;
 };
 
 std::unique_ptr<OpaqueStaticThetaSketch> deserialize_opaque_static_theta_sketch(rust::Slice<const uint8_t> buf);
 
+// The B of set_difference, prepared to be subtracted from many sketches.
+class OpaqueThetaExclusion {
+private:
+  OpaqueThetaExclusion(const compact_theta_sketch& b);
+  friend class OpaqueStaticThetaSketch;
+  friend std::unique_ptr<OpaqueThetaExclusion> new_opaque_theta_exclusion(const OpaqueStaticThetaSketch& b);
+  theta_a_not_b_prepared inner_;
+};
+
+std::unique_ptr<OpaqueThetaExclusion> new_opaque_theta_exclusion(const OpaqueStaticThetaSketch& b);
+
+// A view of a serialized static sketch that reads hashes from the Rust-owned
+// buffer in place; the buffer must outlive it.
+class OpaqueWrappedThetaSketch {
+public:
+  double estimate() const;
+  std::unique_ptr<OpaqueStaticThetaSketch> to_static() const;
+private:
+  OpaqueWrappedThetaSketch(const wrapped_compact_theta_sketch& theta);
+  friend std::unique_ptr<OpaqueWrappedThetaSketch> wrap_opaque_static_theta_sketch(rust::Slice<const uint8_t> buf);
+  friend class OpaqueThetaUnion;
+  friend class OpaqueThetaIntersection;
+  wrapped_compact_theta_sketch inner_;
+};
+
+std::unique_ptr<OpaqueWrappedThetaSketch> wrap_opaque_static_theta_sketch(rust::Slice<const uint8_t> buf);
+// The estimate and bounds of a serialized static sketch, from its header alone.
+double estimate_serialized_theta_sketch(rust::Slice<const uint8_t> buf);
+EstimateBounds bounds_serialized_theta_sketch(rust::Slice<const uint8_t> buf, uint8_t num_std_devs);
+// bounds_serialized_theta_sketch() of each sketch packed into buf, sketch i ending at ends[i],
+// with the bounds of them all computed as one batch.
+void bounds_serialized_theta_sketches(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, uint8_t num_std_devs, rust::Slice<EstimateBounds> out);
+
 class OpaqueThetaUnion {
 public:
-  std::unique_ptr<OpaqueStaticThetaSketch> sketch() const;
+  // The result is ordered either way while every input has been, as the union
+  // then merges them in order; otherwise ordering it takes a sort. It is kept
+  // until the next union, so asking again only copies it.
+  std::unique_ptr<OpaqueStaticThetaSketch> sketch(bool ordered) const;
+  // Moves the result out instead of copying it, leaving the union empty.
+  std::unique_ptr<OpaqueStaticThetaSketch> take_sketch();
   void union_with(std::unique_ptr<OpaqueStaticThetaSketch> to_union);
+  void union_with_ref(const OpaqueStaticThetaSketch& to_union);
+  void union_with_wrapped(const OpaqueWrappedThetaSketch& to_union);
+  // Reads the hashes of a serialized static sketch in place, without building
+  // an OpaqueWrappedThetaSketch or OpaqueStaticThetaSketch for it.
+  void union_serialized(rust::Slice<const uint8_t> buf);
+  void reset();
 private:
   OpaqueThetaUnion();
-  datasketches::theta_union inner_;
+  theta_union inner_;
+  // The last sketch(), or null once an update may have changed it.
+  mutable std::unique_ptr<compact_theta_sketch> result_;
   friend std::unique_ptr<OpaqueThetaUnion> new_opaque_theta_union();
 };
 
 std::unique_ptr<OpaqueThetaUnion> new_opaque_theta_union();
 
+// Distinct counts over a sliding window of the last num_slices slices of a
+// stream, the newest of which is being updated. Closed slices are kept in two
+// stacks so that the window's sketch takes a constant number of unions rather
+// than one per slice: the back stack keeps the union of all its slices as they
+// are pushed, and the front stack holds, for each of its slices, the union of
+// it and every newer one in the stack. Once the front stack runs out, it is
+// rebuilt from the back stack, which costs one union per slice moved, so that
+// each slice is unioned twice in all.
+class OpaqueThetaWindow {
+public:
+  // Cached between updates and advances, as for OpaqueCpcSketch.
+  double estimate() const;
+  bool is_dirty() const;
+  std::unique_ptr<OpaqueStaticThetaSketch> sketch() const;
+  void update(rust::Slice<const uint8_t> buf);
+  // Key i spans [ends[i-1], ends[i]) of buf, with ends[-1] taken as 0.
+  void update_bytes_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends);
+  // Closes the newest slice and opens an empty one, dropping the oldest slice
+  // if the window is full.
+  void advance();
+  size_t get_num_slices() const;
+private:
+  OpaqueThetaWindow(uint8_t lg_k, float p, size_t num_slices);
+  friend std::unique_ptr<OpaqueThetaWindow> new_opaque_theta_window(uint8_t lg_k, float p, size_t num_slices);
+  size_t num_slices_;
+  update_theta_sketch newest_;
+  // Closed slices not yet moved to the front, oldest first, and their union.
+  std::vector<compact_theta_sketch> back_;
+  theta_union back_union_;
+  // Unions of the oldest slices, the oldest one and all after it on top.
+  std::vector<compact_theta_sketch> front_;
+  theta_union::builder builder_;
+  // The last estimate(), which stays valid until the next update or advance.
+  mutable double estimate_;
+  mutable bool dirty_;
+};
+
+// Throws std::invalid_argument unless MIN_LG_K <= lg_k <= MAX_LG_K, 0 < p <= 1 and
+// num_slices > 0. Each slice keeps values with probability p, as in new_opaque_theta_sketch.
+std::unique_ptr<OpaqueThetaWindow> new_opaque_theta_window(uint8_t lg_k, float p, size_t num_slices);
+
+// Distinct counts of many keys' values under one shared theta, in one table of
+// (hash, key id) pairs bounded for all the keys together.
+class OpaqueKeyedThetaSketch {
+public:
+  void update(uint32_t key_id, uint64_t key_hash, rust::Slice<const uint8_t> buf);
+  // The number of retained pairs of each key, into counts indexed by key id;
+  // throws std::out_of_range if a retained key id is not below counts.size().
+  void counts(rust::Slice<uint32_t> counts) const;
+  double theta() const;
+  uint32_t num_retained() const;
+  uint8_t get_lg_k() const;
+  // Merges other, renaming its key ids by key_map, as keyed_theta_sketch::merge().
+  void merge(const OpaqueKeyedThetaSketch& other, rust::Slice<const uint32_t> key_map);
+  size_t get_memory_usage_bytes() const;
+private:
+  OpaqueKeyedThetaSketch(uint8_t lg_k);
+  keyed_theta_sketch inner_;
+  friend std::unique_ptr<OpaqueKeyedThetaSketch> new_opaque_keyed_theta_sketch(uint8_t lg_k);
+};
+
+// Throws std::invalid_argument unless MIN_LG_K <= lg_k <= MAX_LG_K.
+std::unique_ptr<OpaqueKeyedThetaSketch> new_opaque_keyed_theta_sketch(uint8_t lg_k);
+
 class OpaqueThetaIntersection {
 public:
   // Null if the intersection is over an empty collection, i.e., the sketch
   // implicitly represents the full universe of items.
   std::unique_ptr<OpaqueStaticThetaSketch> sketch() const;
+  // As sketch(), but moves the result out instead of copying it, leaving the
+  // intersection over an empty collection again.
+  std::unique_ptr<OpaqueStaticThetaSketch> take_sketch();
   void intersect_with(std::unique_ptr<OpaqueStaticThetaSketch> to_intersect);
+  void intersect_with_ref(const OpaqueStaticThetaSketch& to_intersect);
+  void intersect_with_wrapped(const OpaqueWrappedThetaSketch& to_intersect);
 private:
   OpaqueThetaIntersection();
-  datasketches::theta_intersection inner_;
+  theta_intersection inner_;
   friend std::unique_ptr<OpaqueThetaIntersection> new_opaque_theta_intersection();
 };
 
 std::unique_ptr<OpaqueThetaIntersection> new_opaque_theta_intersection();
+
+// A set expression over serialized static sketches, evaluated in one pass. Ordered
+// inputs are read from the Rust-owned buffers in place; the buffers must outlive it.
+class OpaqueThetaExpression {
+public:
+  void add_input(rust::Slice<const uint8_t> buf);
+  // The postfix program of theta_expression.
+  std::unique_ptr<OpaqueStaticThetaSketch> evaluate(rust::Slice<const uint32_t> program) const;
+private:
+  OpaqueThetaExpression();
+  theta_expression inner_;
+  friend std::unique_ptr<OpaqueThetaExpression> new_opaque_theta_expression();
+};
+
+std::unique_ptr<OpaqueThetaExpression> new_opaque_theta_expression();
+
+// The Jaccard similarity of every pair of many static sketches, which keeps only
+// their hashes below the smallest theta of them all.
+class OpaqueThetaJaccardMatrix {
+public:
+  void add(const OpaqueStaticThetaSketch& sketch);
+  size_t num_sketches() const;
+  // The Jaccard index of sketches i and j, with bounds at 2 standard deviations.
+  EstimateBounds jaccard(size_t i, size_t j) const;
+  // jaccard() of each sketch of rows [row_begin, row_end) against each of columns
+  // [col_begin, col_end), into out row by row.
+  void jaccard_tile(size_t row_begin, size_t row_end, size_t col_begin, size_t col_end, rust::Slice<EstimateBounds> out) const;
+private:
+  OpaqueThetaJaccardMatrix();
+  theta_jaccard_similarity_matrix inner_;
+  friend std::unique_ptr<OpaqueThetaJaccardMatrix> new_opaque_theta_jaccard_matrix();
+};
+
+std::unique_ptr<OpaqueThetaJaccardMatrix> new_opaque_theta_jaccard_matrix();
@@ -72,6 +72,35 @@ public:
     return bounds_binomial_proportions::approximate_upper_bound_on_p(a, b, NUM_STD_DEVS * hacky_adjuster(f));
   }
 
+  /**
+   * Computes lower_bound_for_b_over_a() of each of n pairs (a[i], b[i]) into bounds, at the
+   * same inclusion probability f, whose adjusted number of standard deviations and tail
+   * probability are then computed once for the batch, as for the pairs of a similarity matrix.
+   */
+  static void lower_bounds_for_b_over_a(const uint64_t* a, const uint64_t* b, size_t n, double f, double* bounds) {
+    for (size_t i = 0; i < n; ++i) check_inputs(a[i], b[i], f);
+    if (f == 1.0) {
+      for (size_t i = 0; i < n; ++i) bounds[i] = a[i] == 0 ? 0.0 : static_cast<double>(b[i]) / static_cast<double>(a[i]);
+      return;
+    }
+    // a == 0 gives 0 here as above
+    bounds_binomial_proportions::approximate_lower_bounds_on_p(a, b, n, NUM_STD_DEVS * hacky_adjuster(f), bounds);
+  }
+
+  /**
+   * Computes upper_bound_for_b_over_a() of each of n pairs (a[i], b[i]) into bounds, as
+   * lower_bounds_for_b_over_a() does.
+   */
+  static void upper_bounds_for_b_over_a(const uint64_t* a, const uint64_t* b, size_t n, double f, double* bounds) {
+    for (size_t i = 0; i < n; ++i) check_inputs(a[i], b[i], f);
+    if (f == 1.0) {
+      for (size_t i = 0; i < n; ++i) bounds[i] = a[i] == 0 ? 1.0 : static_cast<double>(b[i]) / static_cast<double>(a[i]);
+      return;
+    }
+    // a == 0 gives 1 here as above
+    bounds_binomial_proportions::approximate_upper_bounds_on_p(a, b, n, NUM_STD_DEVS * hacky_adjuster(f), bounds);
+  }
+
   /**
    * Return the estimate of b over a
    * @param a See class javadoc
@@ -20,6 +20,7 @@
 #ifndef BOUNDS_ON_RATIOS_IN_THETA_SKETCHED_SETS_HPP_
 #define BOUNDS_ON_RATIOS_IN_THETA_SKETCHED_SETS_HPP_
 
+#include <array>
 #include <cstdint>
 #include <stdexcept>
 
@@ -113,6 +114,33 @@ public:
     return static_cast<double>(count_b) / static_cast<double>(count_a);
   }
 
+  /**
+   * Gets the lower bound, estimate and upper bound for B over A at once, counting the entries
+   * of A below the theta of B once rather than for each of them
+   * @param sketchA the sketch A
+   * @param sketchB the sketch B
+   * @return a double array {LowerBound, Estimate, UpperBound} of B over A
+   */
+  template<typename SketchA, typename SketchB>
+  static std::array<double, 3> bounds_for_b_over_a(const SketchA& sketch_a, const SketchB& sketch_b) {
+    const uint64_t theta64_a = sketch_a.get_theta64();
+    const uint64_t theta64_b = sketch_b.get_theta64();
+    check_thetas(theta64_a, theta64_b);
+
+    const uint64_t count_b = sketch_b.get_num_retained();
+    const uint64_t count_a = (theta64_a == theta64_b)
+        ? sketch_a.get_num_retained()
+        : count_less_than_theta64(sketch_a, theta64_b);
+
+    if (count_a == 0) return {0, 0.5, 1};
+    const double f = sketch_b.get_theta();
+    return {
+      bounds_on_ratios_in_sampled_sets::lower_bound_for_b_over_a(count_a, count_b, f),
+      static_cast<double>(count_b) / static_cast<double>(count_a),
+      bounds_on_ratios_in_sampled_sets::upper_bound_for_b_over_a(count_a, count_b, f)
+    };
+  }
+
 private:
 
   static inline void check_thetas(uint64_t theta_a, uint64_t theta_b) {
@@ -0,0 +1,111 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef KEYED_THETA_SKETCH_HPP_
+#define KEYED_THETA_SKETCH_HPP_
+
+#include <memory>
+#include <utility>
+
+#include "theta_update_sketch_base.hpp"
+
+namespace datasketches {
+
+/**
+ * Distinct counts of the values of many keys, as for a GROUP BY COUNT DISTINCT, in one
+ * hash table of at most 2^lg_k entries shared by all the keys rather than in a sketch
+ * per key. Each (key, value) pair is hashed, and the table keeps the pairs whose hashes
+ * are below a single theta, lowered as it fills up just as an update theta sketch's is,
+ * along with the key each belongs to. Every distinct pair is thus sampled with the same
+ * probability theta, and a key's distinct count is estimated as its number of retained
+ * pairs over theta.
+ *
+ * Memory is bounded for all the keys together, whatever their number, at the cost of
+ * accuracy for the smaller ones: a key of n distinct values is estimated from about
+ * n * theta samples, so its relative error is about 1 / sqrt(n * theta), and a key may
+ * have no samples at all and be estimated as 0.
+ *
+ * Keys are identified by dense ids of the caller's choosing, each given along with a
+ * hash of the key that seeds the hashes of its values. The hash must be the same for a
+ * key wherever it is counted, so that sketches of overlapping keys can be merged.
+ */
+template<typename Allocator = std::allocator<uint64_t>>
+class keyed_theta_sketch_alloc {
+public:
+  // the hash of a (key, value) pair and the id of its key
+  using Entry = std::pair<uint64_t, uint32_t>;
+
+  /**
+   * Constructs an empty sketch of at most 2^lg_k retained pairs.
+   * @param lg_k log2 of the nominal number of entries, from MIN_LG_K to MAX_LG_K
+   */
+  explicit keyed_theta_sketch_alloc(uint8_t lg_k, uint64_t seed = DEFAULT_SEED, const Allocator& allocator = Allocator());
+
+  /**
+   * Adds the value of the given bytes to the key of the given id and hash.
+   */
+  void update(uint32_t key_id, uint64_t key_hash, const void* data, size_t length);
+
+  uint8_t get_lg_k() const;
+  uint64_t get_theta64() const;
+  double get_theta() const;
+  uint32_t get_num_retained() const;
+
+  /**
+   * Adds the number of retained pairs of each key to counts[key_id].
+   * @throws std::out_of_range if a retained key id is not below num_keys
+   */
+  void get_counts(uint32_t* counts, size_t num_keys) const;
+
+  /**
+   * Merges the pairs of other, whose key ids are renamed to key_map[key_id], at the
+   * smaller theta of the two, and trims the result back to this sketch's 2^lg_k.
+   * @throws std::out_of_range if a retained key id of other is not below num_keys
+   */
+  void merge(const keyed_theta_sketch_alloc& other, const uint32_t* key_map, size_t num_keys);
+
+  /**
+   * @return heap bytes held by the table of pairs
+   */
+  size_t get_memory_usage_bytes() const;
+
+private:
+  struct extract_hash {
+    uint64_t& operator()(Entry& entry) const { return entry.first; }
+    const uint64_t& operator()(const Entry& entry) const { return entry.first; }
+  };
+  using AllocEntry = typename std::allocator_traits<Allocator>::template rebind_alloc<Entry>;
+  using table = theta_update_sketch_base<Entry, extract_hash, AllocEntry>;
+
+  table table_;
+
+  void insert(uint64_t hash, uint32_t key_id);
+  // drops the entries at or above theta, which must not exceed the table's
+  void lower_theta(uint64_t theta);
+};
+
+// alias with default allocator for convenience
+using keyed_theta_sketch = keyed_theta_sketch_alloc<std::allocator<uint64_t>>;
+
+} /* namespace datasketches */
+
+#include "keyed_theta_sketch_impl.hpp"
+
+#endif
@@ -0,0 +1,114 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef KEYED_THETA_SKETCH_IMPL_HPP_
+#define KEYED_THETA_SKETCH_IMPL_HPP_
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace datasketches {
+
+template<typename A>
+keyed_theta_sketch_alloc<A>::keyed_theta_sketch_alloc(uint8_t lg_k, uint64_t seed, const A& allocator):
+table_(theta_constants::MIN_LG_K, lg_k, theta_constants::resize_factor::X8, theta_constants::MAX_THETA, seed,
+    AllocEntry(allocator))
+{
+  if (lg_k < theta_constants::MIN_LG_K || lg_k > theta_constants::MAX_LG_K) {
+    throw std::invalid_argument("lg_k must be in [" + std::to_string(theta_constants::MIN_LG_K) + ", "
+        + std::to_string(theta_constants::MAX_LG_K) + "]: " + std::to_string(lg_k));
+  }
+}
+
+template<typename A>
+void keyed_theta_sketch_alloc<A>::update(uint32_t key_id, uint64_t key_hash, const void* data, size_t length) {
+  // seeding the value's hash with the key's samples the pairs of every key independently
+  const uint64_t hash = table_.screen(compute_hash(data, length, table_.seed_ ^ key_hash));
+  if (hash == 0) return;
+  insert(hash, key_id);
+}
+
+template<typename A>
+void keyed_theta_sketch_alloc<A>::insert(uint64_t hash, uint32_t key_id) {
+  auto result = table_.find(hash);
+  if (!result.second) table_.insert(result.first, Entry(hash, key_id));
+}
+
+template<typename A>
+uint8_t keyed_theta_sketch_alloc<A>::get_lg_k() const {
+  return table_.lg_nom_size_;
+}
+
+template<typename A>
+uint64_t keyed_theta_sketch_alloc<A>::get_theta64() const {
+  return table_.theta_;
+}
+
+template<typename A>
+double keyed_theta_sketch_alloc<A>::get_theta() const {
+  return static_cast<double>(table_.theta_) / theta_constants::MAX_THETA;
+}
+
+template<typename A>
+uint32_t keyed_theta_sketch_alloc<A>::get_num_retained() const {
+  return table_.num_entries_;
+}
+
+template<typename A>
+void keyed_theta_sketch_alloc<A>::get_counts(uint32_t* counts, size_t num_keys) const {
+  for (const Entry& entry: table_) {
+    if (entry.first == 0) continue;
+    if (entry.second >= num_keys) throw std::out_of_range("key id out of range: " + std::to_string(entry.second));
+    ++counts[entry.second];
+  }
+}
+
+template<typename A>
+void keyed_theta_sketch_alloc<A>::merge(const keyed_theta_sketch_alloc& other, const uint32_t* key_map, size_t num_keys) {
+  if (other.table_.seed_ != table_.seed_) throw std::invalid_argument("incompatible seeds");
+  if (other.table_.theta_ < table_.theta_) lower_theta(other.table_.theta_);
+  for (const Entry& entry: other.table_) {
+    // inserting may lower theta, which is checked again for every entry
+    if (entry.first == 0 || entry.first >= table_.theta_) continue;
+    if (entry.second >= num_keys) throw std::out_of_range("key id out of range: " + std::to_string(entry.second));
+    insert(entry.first, key_map[entry.second]);
+  }
+}
+
+template<typename A>
+void keyed_theta_sketch_alloc<A>::lower_theta(uint64_t theta) {
+  std::vector<Entry, AllocEntry> kept(table_.allocator_);
+  for (const Entry& entry: table_) {
+    if (entry.first != 0 && entry.first < theta) kept.push_back(entry);
+  }
+  table_.reset();
+  table_.theta_ = theta;
+  for (const Entry& entry: kept) insert(entry.first, entry.second);
+}
+
+template<typename A>
+size_t keyed_theta_sketch_alloc<A>::get_memory_usage_bytes() const {
+  return table_.get_memory_usage_bytes();
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -49,6 +49,38 @@ private:
 // alias with default allocator for convenience
 using theta_a_not_b = theta_a_not_b_alloc<std::allocator<uint64_t>>;
 
+/**
+ * The B of a-not-b, prepared once for subtracting it from many sketches.
+ * The hashes of B are put in a hash table when it is constructed, so each
+ * computation only scans A, however large B is.
+ */
+template<typename Allocator = std::allocator<uint64_t>>
+class theta_a_not_b_prepared_alloc {
+public:
+  using CompactSketch = compact_theta_sketch_alloc<Allocator>;
+  using hash_table = theta_update_sketch_base<uint64_t, trivial_extract_key, Allocator>;
+
+  template<typename Sketch>
+  explicit theta_a_not_b_prepared_alloc(const Sketch& b, uint64_t seed = DEFAULT_SEED, const Allocator& allocator = Allocator());
+
+  /**
+   * Computes the a-not-b set operation with the prepared B.
+   * @return the same result as theta_a_not_b::compute(a, b, ordered)
+   */
+  template<typename FwdSketch>
+  CompactSketch compute(FwdSketch&& a, bool ordered = true) const;
+
+private:
+  Allocator allocator_;
+  uint16_t seed_hash_;
+  bool b_is_empty_;
+  uint64_t b_theta_;
+  hash_table table_;
+};
+
+// alias with default allocator for convenience
+using theta_a_not_b_prepared = theta_a_not_b_prepared_alloc<std::allocator<uint64_t>>;
+
 } /* namespace datasketches */
 
 #include "theta_a_not_b_impl.hpp"
@@ -37,6 +37,42 @@ auto theta_a_not_b_alloc<A>::compute(FwdSketch&& a, const Sketch& b, bool ordere
   return state_.compute(std::forward<FwdSketch>(a), b, ordered);
 }
 
+template<typename A>
+template<typename Sketch>
+theta_a_not_b_prepared_alloc<A>::theta_a_not_b_prepared_alloc(const Sketch& b, uint64_t seed, const A& allocator):
+allocator_(allocator),
+seed_hash_(compute_seed_hash(seed)),
+b_is_empty_(b.is_empty()),
+b_theta_(b.get_theta64()),
+table_(lg_size_from_count(b.get_num_retained(), hash_table::REBUILD_THRESHOLD),
+    lg_size_from_count(b.get_num_retained(), hash_table::REBUILD_THRESHOLD) - 1,
+    hash_table::resize_factor::X1, 0, 0, allocator) // theta and seed are not used here
+{
+  if (!b_is_empty_ && b.get_seed_hash() != seed_hash_) throw std::invalid_argument("B seed hash mismatch");
+  for (const uint64_t hash: b) table_.insert(table_.find(hash).first, hash);
+}
+
+template<typename A>
+template<typename FwdSketch>
+auto theta_a_not_b_prepared_alloc<A>::compute(FwdSketch&& a, bool ordered) const -> CompactSketch {
+  if (a.is_empty() || a.get_num_retained() == 0 || b_is_empty_) return CompactSketch(a, ordered);
+  if (a.get_seed_hash() != seed_hash_) throw std::invalid_argument("A seed hash mismatch");
+
+  // B's hashes at or above this theta are never looked up, so the table can keep all of them
+  const uint64_t theta = std::min(a.get_theta64(), b_theta_);
+  std::vector<uint64_t, A> entries(allocator_);
+  for (const uint64_t hash: a) {
+    if (hash < theta) {
+      if (!table_.find(hash).second) entries.push_back(hash);
+    } else if (a.is_ordered()) {
+      break; // early stop
+    }
+  }
+  const bool is_empty = entries.empty() && theta == theta_constants::MAX_THETA;
+  if (ordered && !a.is_ordered()) std::sort(entries.begin(), entries.end());
+  return CompactSketch(is_empty, a.is_ordered() || ordered, seed_hash_, theta, std::move(entries));
+}
+
 } /* namespace datasketches */
 
 # endif
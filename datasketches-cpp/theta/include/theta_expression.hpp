@@ -0,0 +1,126 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef THETA_EXPRESSION_HPP_
+#define THETA_EXPRESSION_HPP_
+
+#include <vector>
+
+#include "theta_sketch.hpp"
+
+namespace datasketches {
+
+/**
+ * Evaluates a set expression, such as (A union B) intersect C minus D, over serialized
+ * compact sketches in one pass. All inputs are read in place and merged in hash order
+ * below the smallest theta of the inputs the expression uses, and each hash is kept
+ * if the expression holds for the inputs that contain it. There are no intermediate
+ * sketches, and unions are not trimmed to a nominal size, so the result is the exact
+ * expression over the hashes the inputs have in common below that theta.
+ *
+ * The expression is a postfix program of instructions made with instruction(), each
+ * pushing or popping operands on a stack: INPUT pushes the input with the given index,
+ * UNION and INTERSECTION replace the given number of operands on top of the stack by
+ * their union or intersection, and A_NOT_B replaces the top two, a then b, by a minus b.
+ */
+template<typename Allocator = std::allocator<uint64_t>>
+class theta_expression_alloc {
+public:
+  using CompactSketch = compact_theta_sketch_alloc<Allocator>;
+  using WrappedSketch = wrapped_compact_theta_sketch_alloc<Allocator>;
+
+  enum opcode { INPUT, UNION, INTERSECTION, A_NOT_B };
+  static const uint8_t OPCODE_BITS = 2;
+  static const uint32_t OPCODE_MASK = (1 << OPCODE_BITS) - 1;
+  // sets of inputs are tracked as 64-bit masks
+  static const uint32_t MAX_INPUTS = 64;
+  // evaluation recurses into the operands of each operation
+  static const uint32_t MAX_INSTRUCTIONS = 4096;
+
+  static uint32_t instruction(opcode op, uint32_t operand);
+
+  explicit theta_expression_alloc(uint64_t seed = DEFAULT_SEED, const Allocator& allocator = Allocator());
+
+  /**
+   * Adds the next input, a serialized compact sketch, whose index is the number of inputs
+   * added before it. Ordered sketches are wrapped, so the bytes must outlive this object;
+   * unordered ones are copied and sorted, and compressed ones decoded into a copy.
+   * @param bytes pointer to the serialized sketch, which need not be aligned
+   * @param size the size of the serialized sketch
+   */
+  void add_input(const void* bytes, size_t size);
+
+  /**
+   * Evaluates an expression over the inputs added so far.
+   * @param program pointer to the instructions of the expression
+   * @param size number of instructions
+   * @return the result of the expression, ordered
+   */
+  CompactSketch evaluate(const uint32_t* program, size_t size) const;
+
+private:
+  using AllocBytes = typename std::allocator_traits<Allocator>::template rebind_alloc<uint8_t>;
+  using vector_bytes = std::vector<uint8_t, AllocBytes>;
+  using AllocVectorBytes = typename std::allocator_traits<Allocator>::template rebind_alloc<vector_bytes>;
+  using AllocWrapped = typename std::allocator_traits<Allocator>::template rebind_alloc<WrappedSketch>;
+
+  uint64_t seed_;
+  Allocator allocator_;
+  std::vector<WrappedSketch, AllocWrapped> inputs_;
+  // ordered serialized copies of the unordered inputs, which inputs_ wrap instead
+  std::vector<vector_bytes, AllocVectorBytes> sorted_copies_;
+
+  // what evaluating part of a program leaves on the stack: whether it is empty, the inputs it
+  // uses, and inputs whose union holds every hash of its result (masks of input indices)
+  struct operand {
+    bool is_empty;
+    uint64_t used;
+    uint64_t cover;
+  };
+
+  // the hashes of an input below theta, from head on, head being MAX_THETA past the last of them
+  struct cursor {
+    typename WrappedSketch::const_iterator it;
+    uint32_t remaining;
+    uint64_t head;
+
+    cursor(const WrappedSketch& sketch, uint64_t theta);
+    // moves to the first hash not less than the given one
+    void seek(uint64_t hash, uint64_t theta);
+  };
+
+  // the number of hashes retained by the inputs in the mask
+  uint64_t cost(uint64_t inputs) const;
+  // checks the program, choosing the cheapest cover of each intersection, and sets starts[i]
+  // to where the operand that instruction i leaves on the stack starts
+  operand analyze(const uint32_t* program, size_t size, std::vector<uint32_t>& starts) const;
+  // whether the hash is in the operand that ends at instruction end, looking into each input
+  // only as far as needed
+  static bool holds(const uint32_t* program, const uint32_t* starts, uint32_t end, uint64_t hash, uint64_t theta,
+      std::vector<cursor>& cursors);
+};
+
+// alias with default allocator for convenience
+using theta_expression = theta_expression_alloc<std::allocator<uint64_t>>;
+
+} /* namespace datasketches */
+
+#include "theta_expression_impl.hpp"
+
+#endif
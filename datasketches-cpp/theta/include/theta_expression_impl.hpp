@@ -0,0 +1,222 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef THETA_EXPRESSION_IMPL_HPP_
+#define THETA_EXPRESSION_IMPL_HPP_
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+
+namespace datasketches {
+
+template<typename A>
+uint32_t theta_expression_alloc<A>::instruction(opcode op, uint32_t operand) {
+  return (operand << OPCODE_BITS) | op;
+}
+
+template<typename A>
+theta_expression_alloc<A>::theta_expression_alloc(uint64_t seed, const A& allocator):
+seed_(seed),
+allocator_(allocator),
+inputs_(AllocWrapped(allocator)),
+sorted_copies_(AllocVectorBytes(allocator))
+{}
+
+template<typename A>
+void theta_expression_alloc<A>::add_input(const void* bytes, size_t size) {
+  if (inputs_.size() == MAX_INPUTS) throw std::invalid_argument("too many inputs, the maximum is " + std::to_string(MAX_INPUTS));
+  if (CompactSketch::is_serialized_compressed(bytes, size)) {
+    // the hashes cannot be read in place, so an uncompressed copy is wrapped instead
+    sorted_copies_.push_back(CompactSketch::deserialize(bytes, size, seed_, allocator_).serialize());
+    const vector_bytes& copy = sorted_copies_.back();
+    inputs_.push_back(WrappedSketch::wrap(copy.data(), copy.size(), seed_));
+    return;
+  }
+  const WrappedSketch sketch = WrappedSketch::wrap(bytes, size, seed_);
+  if (sketch.is_ordered()) {
+    inputs_.push_back(sketch);
+    return;
+  }
+  std::vector<uint64_t, A> entries(sketch.begin(), sketch.end(), allocator_);
+  std::sort(entries.begin(), entries.end());
+  const CompactSketch sorted(sketch.is_empty(), true, sketch.get_seed_hash(), sketch.get_theta64(), std::move(entries));
+  sorted_copies_.push_back(sorted.serialize());
+  const vector_bytes& copy = sorted_copies_.back();
+  inputs_.push_back(WrappedSketch::wrap(copy.data(), copy.size(), seed_));
+}
+
+template<typename A>
+uint64_t theta_expression_alloc<A>::cost(uint64_t inputs) const {
+  uint64_t total = 0;
+  for (uint32_t i = 0; i < inputs_.size(); ++i) {
+    if ((inputs >> i) & 1) total += inputs_[i].get_num_retained();
+  }
+  return total;
+}
+
+template<typename A>
+auto theta_expression_alloc<A>::analyze(const uint32_t* program, size_t size, std::vector<uint32_t>& starts) const -> operand {
+  if (size > MAX_INSTRUCTIONS) throw std::invalid_argument("expression too long, the maximum is " + std::to_string(MAX_INSTRUCTIONS) + " instructions");
+  std::vector<operand> stack;
+  std::vector<uint32_t> stack_starts;
+  starts.resize(size);
+  for (uint32_t i = 0; i < size; ++i) {
+    const uint32_t op = program[i] & OPCODE_MASK;
+    const uint32_t arg = program[i] >> OPCODE_BITS;
+    if (op == INPUT) {
+      if (arg >= inputs_.size()) throw std::invalid_argument("expression refers to input " + std::to_string(arg) + " of " + std::to_string(inputs_.size()));
+      stack.push_back(operand{inputs_[arg].is_empty(), 1ULL << arg, 1ULL << arg});
+      stack_starts.push_back(i);
+      starts[i] = i;
+      continue;
+    }
+    const uint32_t arity = op == A_NOT_B ? 2 : arg;
+    if (arity == 0 || arity > stack.size()) throw std::invalid_argument("malformed expression, an operation has too few operands");
+    const auto first = stack.end() - arity;
+    // emptiness follows the set operations: a union is empty if all of its operands are,
+    // an intersection if any is, and a minus b if a is
+    operand result = *first;
+    for (auto it = first + 1; it != stack.end(); ++it) {
+      result.used |= it->used;
+      if (op == UNION) {
+        result.is_empty &= it->is_empty;
+        result.cover |= it->cover;
+      } else if (op == INTERSECTION) {
+        result.is_empty |= it->is_empty;
+        if (cost(it->cover) < cost(result.cover)) result.cover = it->cover;
+      }
+    }
+    starts[i] = *(stack_starts.end() - arity);
+    stack.erase(first, stack.end());
+    stack.push_back(result);
+    stack_starts.erase(stack_starts.end() - arity, stack_starts.end());
+    stack_starts.push_back(starts[i]);
+  }
+  if (stack.size() != 1) throw std::invalid_argument("malformed expression, it must leave exactly one result");
+  return stack.back();
+}
+
+template<typename A>
+theta_expression_alloc<A>::cursor::cursor(const WrappedSketch& sketch, uint64_t theta):
+it(sketch.begin()),
+remaining(sketch.get_num_retained()),
+head(remaining > 0 && *it < theta ? *it : theta_constants::MAX_THETA)
+{}
+
+template<typename A>
+void theta_expression_alloc<A>::cursor::seek(uint64_t hash, uint64_t theta) {
+  // gallop over offsets 1, 2, 4... from head, which is less than the hash, then search between
+  // the last two, so that skipping far ahead stays logarithmic
+  uint32_t low = 1;
+  uint32_t high = 1;
+  if (remaining > 1 && it[1] >= hash) {
+    // the usual step, to the next hash
+    ++it;
+    --remaining;
+    head = it[0] < theta ? it[0] : theta_constants::MAX_THETA;
+    return;
+  }
+  while (high < remaining && it[high] < hash) {
+    low = high + 1;
+    high *= 2;
+  }
+  if (high > remaining) high = remaining;
+  while (low < high) {
+    const uint32_t mid = low + (high - low) / 2;
+    if (it[mid] < hash) low = mid + 1;
+    else high = mid;
+  }
+  it += low;
+  remaining -= low;
+  head = remaining > 0 && it[0] < theta ? it[0] : theta_constants::MAX_THETA;
+}
+
+template<typename A>
+bool theta_expression_alloc<A>::holds(const uint32_t* program, const uint32_t* starts, uint32_t end, uint64_t hash,
+    uint64_t theta, std::vector<cursor>& cursors) {
+  const uint32_t op = program[end] & OPCODE_MASK;
+  const uint32_t arg = program[end] >> OPCODE_BITS;
+  if (op == INPUT) {
+    cursor& c = cursors[arg];
+    if (c.head < hash) c.seek(hash, theta);
+    return c.head == hash;
+  }
+  // the operands end just before the instruction and then before the start of each later one
+  if (op == A_NOT_B) {
+    const uint32_t b = end - 1;
+    return holds(program, starts, starts[b] - 1, hash, theta, cursors) && !holds(program, starts, b, hash, theta, cursors);
+  }
+  uint32_t operand_end = end - 1;
+  for (uint32_t i = 0; i < arg; ++i) {
+    // inputs are checked in place, they are most of the operands
+    bool operand_holds;
+    if ((program[operand_end] & OPCODE_MASK) == INPUT) {
+      cursor& c = cursors[program[operand_end] >> OPCODE_BITS];
+      if (c.head < hash) c.seek(hash, theta);
+      operand_holds = c.head == hash;
+    } else {
+      operand_holds = holds(program, starts, operand_end, hash, theta, cursors);
+    }
+    if (operand_holds == (op == UNION)) return op == UNION;
+    operand_end = starts[operand_end] - 1;
+  }
+  return op == INTERSECTION;
+}
+
+template<typename A>
+auto theta_expression_alloc<A>::evaluate(const uint32_t* program, size_t size) const -> CompactSketch {
+  std::vector<uint32_t> starts;
+  const operand expression = analyze(program, size, starts);
+  const uint16_t seed_hash = compute_seed_hash(seed_);
+  std::vector<uint64_t, A> entries(allocator_);
+  if (expression.is_empty) return CompactSketch(true, true, seed_hash, theta_constants::MAX_THETA, std::move(entries));
+
+  // empty inputs have nothing to sample, so their theta does not count
+  uint64_t theta = theta_constants::MAX_THETA;
+  for (uint32_t i = 0; i < inputs_.size(); ++i) {
+    if (((expression.used >> i) & 1) && !inputs_[i].is_empty()) theta = std::min(theta, inputs_[i].get_theta64());
+  }
+
+  // Every hash of the result is in one of the cover inputs, so only their hashes are checked,
+  // in order. The other inputs are only searched as far as checking them needs.
+  std::vector<cursor> cursors;
+  std::vector<uint32_t> cover;
+  cursors.reserve(inputs_.size());
+  for (uint32_t i = 0; i < inputs_.size(); ++i) {
+    cursors.push_back(cursor(inputs_[i], theta));
+    if ((expression.cover >> i) & 1) cover.push_back(i);
+  }
+  while (true) {
+    uint64_t hash = theta_constants::MAX_THETA;
+    for (const uint32_t i: cover) hash = std::min(hash, cursors[i].head);
+    if (hash == theta_constants::MAX_THETA) break;
+    if (holds(program, starts.data(), static_cast<uint32_t>(size - 1), hash, theta, cursors)) entries.push_back(hash);
+    for (const uint32_t i: cover) {
+      if (cursors[i].head == hash) cursors[i].seek(hash + 1, theta);
+    }
+  }
+  // as for an intersection, nothing retained in exact mode is the empty set
+  const bool no_entries = entries.empty() && theta == theta_constants::MAX_THETA;
+  return CompactSketch(no_entries, true, seed_hash, theta, std::move(entries));
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,101 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+// Kernels counting the hashes two sorted arrays of distinct hashes have in common,
+// used by theta_jaccard_similarity_matrix to intersect every pair of many sketches.
+//
+// On x86-64 (GCC/Clang) an AVX2 kernel is picked at runtime, as cpu_features.hpp
+// describes. It compares a block of one array against a block of the other, all
+// pairs at once, then moves past whichever block ends lower (or both), so every
+// common hash is counted exactly once, when the blocks holding it in the two arrays
+// are compared. The rest is left to the portable merge. Blocks of 8 with AVX-512
+// measured no faster, as they take twice the rotations to compare.
+
+#ifndef THETA_INTERSECT_OPS_HPP_
+#define THETA_INTERSECT_OPS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_features.hpp"
+
+namespace datasketches {
+
+namespace intersect_ops {
+
+// a branch-free merge, stepping past the lower of the two heads, or both if equal
+inline size_t portable_count_common(const uint64_t* a, size_t na, const uint64_t* b, size_t nb) {
+  size_t count = 0;
+  size_t i = 0;
+  size_t j = 0;
+  while (i < na && j < nb) {
+    const uint64_t x = a[i];
+    const uint64_t y = b[j];
+    count += x == y;
+    i += x <= y;
+    j += y <= x;
+  }
+  return count;
+}
+
+#ifdef DATASKETCHES_X86
+
+#define THETA_INTERSECT_AVX2 __attribute__((target("avx2,popcnt")))
+
+// blocks of 4, the block of b compared in each of its 4 rotations
+THETA_INTERSECT_AVX2 inline size_t avx2_count_common(const uint64_t* a, size_t na, const uint64_t* b, size_t nb) {
+  size_t count = 0;
+  size_t i = 0;
+  size_t j = 0;
+  while (i + 4 <= na && j + 4 <= nb) {
+    const __m256i va = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(a + i));
+    const __m256i vb = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(b + j));
+    const __m256i rot1 = _mm256_permute4x64_epi64(vb, 0x39);
+    const __m256i rot2 = _mm256_permute4x64_epi64(vb, 0x4e);
+    const __m256i rot3 = _mm256_permute4x64_epi64(vb, 0x93);
+    const __m256i eq = _mm256_or_si256(
+        _mm256_or_si256(_mm256_cmpeq_epi64(va, vb), _mm256_cmpeq_epi64(va, rot1)),
+        _mm256_or_si256(_mm256_cmpeq_epi64(va, rot2), _mm256_cmpeq_epi64(va, rot3)));
+    count += _mm_popcnt_u32(static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(eq))));
+    const uint64_t last_a = a[i + 3];
+    const uint64_t last_b = b[j + 3];
+    i += (last_a <= last_b) * 4;
+    j += (last_b <= last_a) * 4;
+  }
+  return count + portable_count_common(a + i, na - i, b + j, nb - j);
+}
+
+#undef THETA_INTERSECT_AVX2
+
+#endif // DATASKETCHES_X86
+
+} // namespace intersect_ops
+
+// the number of hashes in both a and b, each sorted and without repeats
+inline size_t count_common_hashes(const uint64_t* a, size_t na, const uint64_t* b, size_t nb) {
+#if defined(DATASKETCHES_X86)
+  if (cpu::best_isa() >= cpu::isa::AVX2) return intersect_ops::avx2_count_common(a, na, b, nb);
+#endif
+  return intersect_ops::portable_count_common(a, na, b, nb);
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -66,6 +66,15 @@ public:
    */
   CompactSketch get_result(bool ordered = true) const;
 
+  /**
+   * Produces the same result as get_result(), moving the retained entries out
+   * instead of copying them where possible, and returns the intersection to
+   * the "universe" state it was constructed in.
+   * @param ordered optional flag to specify if ordered sketch should be produced
+   * @return the result of the intersection
+   */
+  CompactSketch take_result(bool ordered = true);
+
   /**
    * Returns true if the state of the intersection is defined (not infinite "universe").
    * @return true if the state is valid
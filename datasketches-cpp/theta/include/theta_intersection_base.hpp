@@ -20,6 +20,8 @@
 #ifndef THETA_INTERSECTION_BASE_HPP_
 #define THETA_INTERSECTION_BASE_HPP_
 
+#include <vector>
+
 namespace datasketches {
 
 template<
@@ -41,6 +43,7 @@ public:
   void update(FwdSketch&& sketch);
 
   CompactSketch get_result(bool ordered = true) const;
+  CompactSketch take_result(bool ordered = true);
 
   bool has_result() const;
 
@@ -50,6 +53,16 @@ private:
   Policy policy_;
   bool is_valid_;
   hash_table table_;
+  // while every input has been ordered, the result is kept as sorted entries_ instead of in
+  // table_, which then only holds theta, the empty flag and the seed
+  bool sorted_;
+  std::vector<Entry, Allocator> entries_;
+
+  uint32_t num_retained() const;
+  template<typename FwdSketch>
+  void intersect_sorted(FwdSketch&& sketch);
+  size_t gallop(size_t from, uint64_t key) const;
+  void spill_sorted();
 };
 
 } /* namespace datasketches */
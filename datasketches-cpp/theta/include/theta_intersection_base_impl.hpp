@@ -29,7 +29,9 @@ template<typename EN, typename EK, typename P, typename S, typename CS, typename
 theta_intersection_base<EN, EK, P, S, CS, A>::theta_intersection_base(uint64_t seed, const P& policy, const A& allocator):
 policy_(policy),
 is_valid_(false),
-table_(0, 0, resize_factor::X1, theta_constants::MAX_THETA, seed, allocator, false)
+table_(0, 0, resize_factor::X1, theta_constants::MAX_THETA, seed, allocator, false),
+sorted_(true),
+entries_(allocator)
 {}
 
 template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
@@ -39,16 +41,24 @@ void theta_intersection_base<EN, EK, P, S, CS, A>::update(SS&& sketch) {
   if (!sketch.is_empty() && sketch.get_seed_hash() != compute_seed_hash(table_.seed_)) throw std::invalid_argument("seed hash mismatch");
   table_.is_empty_ |= sketch.is_empty();
   table_.theta_ = std::min(table_.theta_, sketch.get_theta64());
-  if (is_valid_ && table_.num_entries_ == 0) return;
+  if (is_valid_ && num_retained() == 0) return;
   if (sketch.get_num_retained() == 0) {
     is_valid_ = true;
     table_ = hash_table(0, 0, resize_factor::X1, table_.theta_, table_.seed_, table_.allocator_, table_.is_empty_);
+    entries_.clear();
     return;
   }
+  if (sorted_) {
+    if (sketch.is_ordered()) {
+      intersect_sorted(std::forward<SS>(sketch));
+      return;
+    }
+    spill_sorted();
+  }
   if (!is_valid_) { // first update, copy or move incoming sketch
     is_valid_ = true;
     const uint8_t lg_size = lg_size_from_count(sketch.get_num_retained(), theta_update_sketch_base<EN, EK, A>::REBUILD_THRESHOLD);
-    table_ = hash_table(lg_size, lg_size, resize_factor::X1, table_.theta_, table_.seed_, table_.allocator_, table_.is_empty_);
+    table_ = hash_table(lg_size, lg_size - 1, resize_factor::X1, table_.theta_, table_.seed_, table_.allocator_, table_.is_empty_);
     for (auto& entry: sketch) {
       auto result = table_.find(EK()(entry));
       if (result.second) {
@@ -87,7 +97,7 @@ void theta_intersection_base<EN, EK, P, S, CS, A>::update(SS&& sketch) {
       if (table_.theta_ == theta_constants::MAX_THETA) table_.is_empty_ = true;
     } else {
       const uint8_t lg_size = lg_size_from_count(match_count, theta_update_sketch_base<EN, EK, A>::REBUILD_THRESHOLD);
-      table_ = hash_table(lg_size, lg_size, resize_factor::X1, table_.theta_, table_.seed_, table_.allocator_, table_.is_empty_);
+      table_ = hash_table(lg_size, lg_size - 1, resize_factor::X1, table_.theta_, table_.seed_, table_.allocator_, table_.is_empty_);
       for (uint32_t i = 0; i < match_count; i++) {
         auto result = table_.find(EK()(matched_entries[i]));
         table_.insert(result.first, std::move(matched_entries[i]));
@@ -96,9 +106,84 @@ void theta_intersection_base<EN, EK, P, S, CS, A>::update(SS&& sketch) {
   }
 }
 
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+uint32_t theta_intersection_base<EN, EK, P, S, CS, A>::num_retained() const {
+  return sorted_ ? static_cast<uint32_t>(entries_.size()) : table_.num_entries_;
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+template<typename SS>
+void theta_intersection_base<EN, EK, P, S, CS, A>::intersect_sorted(SS&& sketch) {
+  if (!is_valid_) { // first update, copy or move incoming sketch
+    is_valid_ = true;
+    entries_.reserve(sketch.get_num_retained());
+    uint64_t previous = 0;
+    for (auto& entry: scan_entries(std::forward<SS>(sketch))) {
+      if (EK()(entry) <= previous) throw std::invalid_argument("duplicate or unordered key, possibly corrupted input sketch");
+      previous = EK()(entry);
+      entries_.push_back(EN(conditional_forward<SS>(entry)));
+    }
+    if (entries_.size() != sketch.get_num_retained()) throw std::invalid_argument("num entries mismatch, possibly corrupted input sketch");
+    return;
+  }
+  // matches are moved down over the entries already passed, so the result stays sorted in place
+  size_t num_matched = 0;
+  size_t index = 0;
+  uint32_t count = 0;
+  for (auto& entry: scan_entries(std::forward<SS>(sketch))) {
+    const uint64_t hash = EK()(entry);
+    if (hash >= table_.theta_) break;
+    ++count;
+    index = gallop(index, hash);
+    if (index == entries_.size()) break; // past the last entry, nothing more can match
+    if (EK()(entries_[index]) == hash) {
+      policy_(entries_[index], conditional_forward<SS>(entry));
+      if (num_matched != index) entries_[num_matched] = std::move(entries_[index]);
+      ++num_matched;
+      ++index;
+    }
+  }
+  if (count > sketch.get_num_retained()) throw std::invalid_argument(" more keys than expected, possibly corrupted input sketch");
+  entries_.erase(entries_.begin() + num_matched, entries_.end());
+  if (num_matched == 0 && table_.theta_ == theta_constants::MAX_THETA) table_.is_empty_ = true;
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+size_t theta_intersection_base<EN, EK, P, S, CS, A>::gallop(size_t from, uint64_t key) const {
+  // first index at or after from with an entry not less than the key, probing 1, 2, 4... entries
+  // ahead before the binary search, so that a small input costs O(log) per key in a large result
+  // while similar sizes cost little more than a linear merge
+  size_t low = from;
+  size_t high = from;
+  size_t step = 1;
+  while (high < entries_.size() && EK()(entries_[high]) < key) {
+    low = high + 1;
+    high += step;
+    step <<= 1;
+  }
+  if (high > entries_.size()) high = entries_.size();
+  return std::lower_bound(entries_.begin() + low, entries_.begin() + high, key,
+      [](const EN& entry, uint64_t k) { return EK()(entry) < k; }) - entries_.begin();
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+void theta_intersection_base<EN, EK, P, S, CS, A>::spill_sorted() {
+  sorted_ = false;
+  if (!is_valid_) return;
+  const uint8_t lg_size = lg_size_from_count(static_cast<uint32_t>(entries_.size()), theta_update_sketch_base<EN, EK, A>::REBUILD_THRESHOLD);
+  table_ = hash_table(lg_size, lg_size - 1, resize_factor::X1, table_.theta_, table_.seed_, table_.allocator_, table_.is_empty_);
+  for (auto& entry: entries_) {
+    auto result = table_.find(EK()(entry));
+    table_.insert(result.first, std::move(entry));
+  }
+  entries_.clear();
+}
+
 template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
 CS theta_intersection_base<EN, EK, P, S, CS, A>::get_result(bool ordered) const {
   if (!is_valid_) throw std::invalid_argument("calling get_result() before calling update() is undefined");
+  // the sorted entries are already ordered, so the result is ordered either way
+  if (sorted_) return CS(table_.is_empty_, true, compute_seed_hash(table_.seed_), table_.theta_, std::vector<EN, A>(entries_));
   std::vector<EN, A> entries(table_.allocator_);
   if (table_.num_entries_ > 0) {
     entries.reserve(table_.num_entries_);
@@ -108,6 +193,19 @@ CS theta_intersection_base<EN, EK, P, S, CS, A>::get_result(bool ordered) const
   return CS(table_.is_empty_, ordered, compute_seed_hash(table_.seed_), table_.theta_, std::move(entries));
 }
 
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+CS theta_intersection_base<EN, EK, P, S, CS, A>::take_result(bool ordered) {
+  if (!is_valid_) throw std::invalid_argument("calling take_result() before calling update() is undefined");
+  CS result = sorted_
+    ? CS(table_.is_empty_, true, compute_seed_hash(table_.seed_), table_.theta_, std::move(entries_))
+    : get_result(ordered);
+  is_valid_ = false;
+  table_ = hash_table(0, 0, resize_factor::X1, theta_constants::MAX_THETA, table_.seed_, table_.allocator_, false);
+  sorted_ = true;
+  entries_.clear();
+  return result;
+}
+
 template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
 bool theta_intersection_base<EN, EK, P, S, CS, A>::has_result() const {
   return is_valid_;
@@ -38,6 +38,11 @@ auto theta_intersection_alloc<A>::get_result(bool ordered) const -> CompactSketc
   return state_.get_result(ordered);
 }
 
+template<typename A>
+auto theta_intersection_alloc<A>::take_result(bool ordered) -> CompactSketch {
+  return state_.take_result(ordered);
+}
+
 template<typename A>
 bool theta_intersection_alloc<A>::has_result() const {
   return state_.has_result();
@@ -66,11 +66,7 @@ public:
     i.update(union_ab); // ensures that intersection is a subset of the union
     auto inter_abu = i.get_result(false);
 
-    return {
-      bounds_on_ratios_in_theta_sketched_sets<ExtractKey>::lower_bound_for_b_over_a(union_ab, inter_abu),
-      bounds_on_ratios_in_theta_sketched_sets<ExtractKey>::estimate_of_b_over_a(union_ab, inter_abu),
-      bounds_on_ratios_in_theta_sketched_sets<ExtractKey>::upper_bound_for_b_over_a(union_ab, inter_abu)
-    };
+    return bounds_on_ratios_in_theta_sketched_sets<ExtractKey>::bounds_for_b_over_a(union_ab, inter_abu);
   }
 
   /**
@@ -0,0 +1,113 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef THETA_JACCARD_SIMILARITY_MATRIX_HPP_
+#define THETA_JACCARD_SIMILARITY_MATRIX_HPP_
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "theta_sketch.hpp"
+
+namespace datasketches {
+
+/**
+ * Jaccard similarities of every pair of many sketches. Where theta_jaccard_similarity
+ * computes a union and an intersection for each pair, this keeps the hashes of every sketch
+ * below the smallest theta of them all as one sorted array, and finds the similarity of a
+ * pair from the number of hashes their arrays share, counted in one merge pass with the
+ * kernels of theta_intersect_ops.hpp.
+ *
+ * Every pair is thus compared at the common theta rather than at the smaller theta of the
+ * two. When all the sketches have the same theta, as when they are all exact, the estimates
+ * and bounds are those of theta_jaccard_similarity; otherwise pairs of sketches with larger
+ * thetas are compared on fewer hashes than they have, and their bounds are wider.
+ */
+template<typename Allocator = std::allocator<uint64_t>>
+class theta_jaccard_similarity_matrix_alloc {
+public:
+  explicit theta_jaccard_similarity_matrix_alloc(uint64_t seed = DEFAULT_SEED, const Allocator& allocator = Allocator());
+
+  /**
+   * Adds the next sketch, whose index is the number of sketches added before it.
+   * Its hashes are copied, so it need not outlive this object.
+   * @param sketch a theta sketch, ordered or not
+   */
+  template<typename Sketch>
+  void update(const Sketch& sketch);
+
+  /**
+   * @return the number of sketches added
+   */
+  size_t get_num_sketches() const;
+
+  /**
+   * @return the smallest theta of the sketches added, which all pairs are compared at
+   */
+  uint64_t get_theta64() const;
+
+  /**
+   * Computes the Jaccard similarity index of two of the sketches, as
+   * theta_jaccard_similarity::jaccard() does but at the common theta.
+   * @param i index of sketch A
+   * @param j index of sketch B
+   * @return a double array {LowerBound, Estimate, UpperBound} of the Jaccard index.
+   * The Upper and Lower bounds are for a confidence interval of 95.4% or +/- 2 standard deviations.
+   */
+  std::array<double, 3> jaccard(size_t i, size_t j) const;
+
+  /**
+   * Computes jaccard() of each sketch of rows [row_begin, row_end) against each of columns
+   * [col_begin, col_end) into out, row by row. All the pairs are compared at the common
+   * theta, so their bounds are computed as one batch, which converts it to a number of
+   * standard deviations once.
+   */
+  void jaccard_tile(size_t row_begin, size_t row_end, size_t col_begin, size_t col_end, std::array<double, 3>* out) const;
+
+private:
+  using AllocSize = typename std::allocator_traits<Allocator>::template rebind_alloc<size_t>;
+  using AllocBool = typename std::allocator_traits<Allocator>::template rebind_alloc<bool>;
+  using AllocDouble = typename std::allocator_traits<Allocator>::template rebind_alloc<double>;
+
+  uint16_t seed_hash_;
+  uint64_t theta_;
+  // the hashes of sketch i are hashes_[offsets_[i], offsets_[i + 1]), sorted; those of
+  // sketches added before theta_ last dropped may run past it
+  std::vector<uint64_t, Allocator> hashes_;
+  std::vector<size_t, AllocSize> offsets_;
+  std::vector<bool, AllocBool> is_empty_;
+
+  // the number of hashes of sketch i below theta_
+  size_t num_below_theta(size_t i) const;
+
+  // Sets result if the similarity of sketches i and j needs no bounds, returning true, and
+  // otherwise the counts of the hashes of their union and intersection.
+  bool trivial_jaccard(size_t i, size_t j, std::array<double, 3>& result, uint64_t& count_union, uint64_t& count_ij) const;
+};
+
+// alias with default allocator for convenience
+using theta_jaccard_similarity_matrix = theta_jaccard_similarity_matrix_alloc<std::allocator<uint64_t>>;
+
+} /* namespace datasketches */
+
+#include "theta_jaccard_similarity_matrix_impl.hpp"
+
+#endif
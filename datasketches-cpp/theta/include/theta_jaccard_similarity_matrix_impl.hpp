@@ -0,0 +1,152 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef THETA_JACCARD_SIMILARITY_MATRIX_IMPL_HPP_
+#define THETA_JACCARD_SIMILARITY_MATRIX_IMPL_HPP_
+
+#include <algorithm>
+#include <vector>
+#include <stdexcept>
+
+#include "bounds_on_ratios_in_sampled_sets.hpp"
+#include "theta_intersect_ops.hpp"
+
+namespace datasketches {
+
+template<typename A>
+theta_jaccard_similarity_matrix_alloc<A>::theta_jaccard_similarity_matrix_alloc(uint64_t seed, const A& allocator):
+seed_hash_(compute_seed_hash(seed)),
+theta_(theta_constants::MAX_THETA),
+hashes_(allocator),
+offsets_(1, 0, AllocSize(allocator)),
+is_empty_(AllocBool(allocator))
+{}
+
+template<typename A>
+template<typename SS>
+void theta_jaccard_similarity_matrix_alloc<A>::update(const SS& sketch) {
+  // as in a union, the theta of an empty sketch does not count
+  if (!sketch.is_empty()) {
+    if (sketch.get_seed_hash() != seed_hash_) throw std::invalid_argument("seed hash mismatch");
+    if (sketch.get_theta64() < theta_) theta_ = sketch.get_theta64();
+  }
+  const size_t start = hashes_.size();
+  // hashes past theta_ will never be compared, so they are not copied
+  for (const uint64_t hash: sketch) {
+    if (hash < theta_) {
+      hashes_.push_back(hash);
+    } else {
+      if (sketch.is_ordered()) break; // early stop
+    }
+  }
+  if (!sketch.is_ordered()) std::sort(hashes_.begin() + start, hashes_.end());
+  offsets_.push_back(hashes_.size());
+  is_empty_.push_back(sketch.is_empty());
+}
+
+template<typename A>
+size_t theta_jaccard_similarity_matrix_alloc<A>::get_num_sketches() const {
+  return is_empty_.size();
+}
+
+template<typename A>
+uint64_t theta_jaccard_similarity_matrix_alloc<A>::get_theta64() const {
+  return theta_;
+}
+
+template<typename A>
+size_t theta_jaccard_similarity_matrix_alloc<A>::num_below_theta(size_t i) const {
+  const auto begin = hashes_.begin() + offsets_[i];
+  const auto end = hashes_.begin() + offsets_[i + 1];
+  // usually all of them, unless theta_ dropped after sketch i was added
+  if (begin == end || *(end - 1) < theta_) return end - begin;
+  return std::lower_bound(begin, end, theta_) - begin;
+}
+
+template<typename A>
+bool theta_jaccard_similarity_matrix_alloc<A>::trivial_jaccard(size_t i, size_t j, std::array<double, 3>& result,
+    uint64_t& count_union, uint64_t& count_ij) const {
+  if (i == j || (is_empty_[i] && is_empty_[j])) {
+    result = {{1, 1, 1}};
+    return true;
+  }
+  if (is_empty_[i] || is_empty_[j]) {
+    result = {{0, 0, 0}};
+    return true;
+  }
+  const size_t count_i = num_below_theta(i);
+  const size_t count_j = num_below_theta(j);
+  count_ij = count_common_hashes(hashes_.data() + offsets_[i], count_i, hashes_.data() + offsets_[j], count_j);
+  count_union = count_i + count_j - count_ij;
+  if (count_ij == count_union) {
+    result = {{1, 1, 1}};
+    return true;
+  }
+  return false;
+}
+
+template<typename A>
+std::array<double, 3> theta_jaccard_similarity_matrix_alloc<A>::jaccard(size_t i, size_t j) const {
+  std::array<double, 3> result;
+  uint64_t count_union, count_ij;
+  if (trivial_jaccard(i, j, result, count_union, count_ij)) return result;
+
+  const double f = static_cast<double>(theta_) / theta_constants::MAX_THETA;
+  return {
+    bounds_on_ratios_in_sampled_sets::lower_bound_for_b_over_a(count_union, count_ij, f),
+    bounds_on_ratios_in_sampled_sets::get_estimate_of_b_over_a(count_union, count_ij),
+    bounds_on_ratios_in_sampled_sets::upper_bound_for_b_over_a(count_union, count_ij, f)
+  };
+}
+
+template<typename A>
+void theta_jaccard_similarity_matrix_alloc<A>::jaccard_tile(size_t row_begin, size_t row_end, size_t col_begin, size_t col_end,
+    std::array<double, 3>* out) const {
+  // the counts of the pairs with bounds to compute, and where each goes in out
+  std::vector<uint64_t, A> counts_union(hashes_.get_allocator());
+  std::vector<uint64_t, A> counts_ij(hashes_.get_allocator());
+  std::vector<size_t, AllocSize> slots(AllocSize(hashes_.get_allocator()));
+  size_t slot = 0;
+  for (size_t i = row_begin; i < row_end; ++i) {
+    for (size_t j = col_begin; j < col_end; ++j, ++slot) {
+      uint64_t count_union, count_ij;
+      if (trivial_jaccard(i, j, out[slot], count_union, count_ij)) continue;
+      counts_union.push_back(count_union);
+      counts_ij.push_back(count_ij);
+      slots.push_back(slot);
+    }
+  }
+  if (slots.empty()) return;
+
+  const size_t n = slots.size();
+  const double f = static_cast<double>(theta_) / theta_constants::MAX_THETA;
+  std::vector<double, AllocDouble> lower(n, 0, AllocDouble(hashes_.get_allocator()));
+  std::vector<double, AllocDouble> upper(n, 0, AllocDouble(hashes_.get_allocator()));
+  bounds_on_ratios_in_sampled_sets::lower_bounds_for_b_over_a(counts_union.data(), counts_ij.data(), n, f, lower.data());
+  bounds_on_ratios_in_sampled_sets::upper_bounds_for_b_over_a(counts_union.data(), counts_ij.data(), n, f, upper.data());
+  for (size_t p = 0; p < n; ++p) {
+    const double estimate = bounds_on_ratios_in_sampled_sets::get_estimate_of_b_over_a(counts_union[p], counts_ij[p]);
+    out[slots[p]] = {{lower[p], estimate, upper[p]}};
+  }
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,120 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+// Kernels screening a block of hashes against theta, used by the batched updates
+// of theta sketches to drop rejected hashes before any probe of the hash table.
+//
+// On x86-64 (GCC/Clang) AVX2 and AVX-512 kernels are picked at runtime, as
+// cpu_features.hpp describes, so the library still builds without any -m flags.
+// Every kernel computes exactly what the portable loop does.
+
+#ifndef THETA_SCREEN_OPS_HPP_
+#define THETA_SCREEN_OPS_HPP_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "cpu_features.hpp"
+
+namespace datasketches {
+
+namespace screen_ops {
+
+// a hash survives if 0 < hash < theta, hash == 0 marking empty slots in the table;
+// both bounds fold into one unsigned comparison of hash - 1 against theta - 1
+inline size_t portable_screen(const uint64_t* hashes, size_t n, uint64_t theta, uint64_t* survivors) {
+  const uint64_t bound = theta - 1;
+  size_t num = 0;
+  for (size_t i = 0; i < n; ++i) {
+    survivors[num] = hashes[i];
+    num += hashes[i] - 1 < bound;
+  }
+  return num;
+}
+
+#ifdef DATASKETCHES_X86
+
+#define THETA_SCREEN_AVX2 __attribute__((target("avx2")))
+#define THETA_SCREEN_AVX512 __attribute__((target("avx512f")))
+
+// GCC's own AVX-512 intrinsic headers trip -W(maybe-)uninitialized
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wuninitialized"
+#pragma GCC diagnostic ignored "-Wmaybe-uninitialized"
+#endif
+
+// AVX2 has no unsigned 64-bit comparison, so both sides are biased by the sign bit
+THETA_SCREEN_AVX2 inline size_t avx2_screen(const uint64_t* hashes, size_t n, uint64_t theta, uint64_t* survivors) {
+  const __m256i sign = _mm256_set1_epi64x(static_cast<long long>(1ULL << 63));
+  const __m256i one = _mm256_set1_epi64x(1);
+  const __m256i bound = _mm256_xor_si256(_mm256_set1_epi64x(static_cast<long long>(theta - 1)), sign);
+  size_t num = 0;
+  size_t i = 0;
+  for (; i + 4 <= n; i += 4) {
+    const __m256i h = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(hashes + i));
+    const __m256i biased = _mm256_xor_si256(_mm256_sub_epi64(h, one), sign);
+    unsigned mask = static_cast<unsigned>(_mm256_movemask_pd(_mm256_castsi256_pd(_mm256_cmpgt_epi64(bound, biased))));
+    while (mask != 0) {
+      survivors[num++] = hashes[i + __builtin_ctz(mask)];
+      mask &= mask - 1;
+    }
+  }
+  return num + portable_screen(hashes + i, n - i, theta, survivors + num);
+}
+
+THETA_SCREEN_AVX512 inline size_t avx512_screen(const uint64_t* hashes, size_t n, uint64_t theta, uint64_t* survivors) {
+  const __m512i one = _mm512_set1_epi64(1);
+  const __m512i bound = _mm512_set1_epi64(static_cast<long long>(theta - 1));
+  size_t num = 0;
+  size_t i = 0;
+  for (; i + 8 <= n; i += 8) {
+    const __m512i h = _mm512_loadu_si512(hashes + i);
+    const __mmask8 mask = _mm512_cmplt_epu64_mask(_mm512_sub_epi64(h, one), bound);
+    _mm512_mask_compressstoreu_epi64(survivors + num, mask, h);
+    num += __builtin_popcount(mask);
+  }
+  return num + portable_screen(hashes + i, n - i, theta, survivors + num);
+}
+
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC diagnostic pop
+#endif
+
+#undef THETA_SCREEN_AVX2
+#undef THETA_SCREEN_AVX512
+
+#endif // DATASKETCHES_X86
+
+} // namespace screen_ops
+
+// copies the hashes with 0 < hash < theta, in order, to survivors (room for n)
+// and returns how many there were
+inline size_t screen_hashes(const uint64_t* hashes, size_t n, uint64_t theta, uint64_t* survivors) {
+#if defined(DATASKETCHES_X86)
+  const cpu::isa best = cpu::best_isa();
+  if (best >= cpu::isa::AVX512) return screen_ops::avx512_screen(hashes, n, theta, survivors);
+  if (best >= cpu::isa::AVX2) return screen_ops::avx2_screen(hashes, n, theta, survivors);
+#endif
+  return screen_ops::portable_screen(hashes, n, theta, survivors);
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -45,6 +45,17 @@ public:
 private:
   Allocator allocator_;
   uint16_t seed_hash_;
+
+  // appends the entries of A below theta that are not in table, if any, to entries
+  template<typename FwdSketch>
+  static void copy_below(FwdSketch&& a, uint64_t theta, const hash_table* table, std::vector<Entry, Allocator>& entries, std::true_type);
+  template<typename FwdSketch>
+  static void copy_below(FwdSketch&& a, uint64_t theta, const hash_table* table, std::vector<Entry, Allocator>& entries, std::false_type);
+  // inserts the hashes of B below theta into table
+  template<typename Sketch>
+  static void insert_below(const Sketch& b, uint64_t theta, hash_table& table, std::true_type);
+  template<typename Sketch>
+  static void insert_below(const Sketch& b, uint64_t theta, hash_table& table, std::false_type);
 };
 
 } /* namespace datasketches */
@@ -44,35 +44,23 @@ CS theta_set_difference_base<EN, EK, CS, A>::compute(FwdSketch&& a, const Sketch
   std::vector<EN, A> entries(allocator_);
   bool is_empty = a.is_empty();
 
+  using a_span = std::integral_constant<bool,
+      has_hash_span<typename std::decay<FwdSketch>::type>::value && std::is_same<EN, uint64_t>::value>;
   if (b.get_num_retained() == 0) {
-    std::copy_if(forward_begin(std::forward<FwdSketch>(a)), forward_end(std::forward<FwdSketch>(a)), std::back_inserter(entries),
-        key_less_than<uint64_t, EN, EK>(theta));
+    copy_below(std::forward<FwdSketch>(a), theta, nullptr, entries, a_span());
   } else {
     if (a.is_ordered() && b.is_ordered()) { // sort-based
-      std::set_difference(forward_begin(std::forward<FwdSketch>(a)), forward_end(std::forward<FwdSketch>(a)), b.begin(), b.end(),
+      auto&& entries_a = scan_entries(std::forward<FwdSketch>(a));
+      auto&& entries_b = scan_entries(b);
+      std::set_difference(forward_begin(std::forward<decltype(entries_a)>(entries_a)), forward_end(std::forward<decltype(entries_a)>(entries_a)),
+          entries_b.begin(), entries_b.end(),
           conditional_back_inserter(entries, key_less_than<uint64_t, EN, EK>(theta)), comparator());
     } else { // hash-based
       const uint8_t lg_size = lg_size_from_count(b.get_num_retained(), hash_table::REBUILD_THRESHOLD);
-      hash_table table(lg_size, lg_size, hash_table::resize_factor::X1, 0, 0, allocator_); // theta and seed are not used here
-      for (const auto& entry: b) {
-        const uint64_t hash = EK()(entry);
-        if (hash < theta) {
-          table.insert(table.find(hash).first, hash);
-        } else if (b.is_ordered()) {
-          break; // early stop
-        }
-      }
-
+      hash_table table(lg_size, lg_size - 1, hash_table::resize_factor::X1, 0, 0, allocator_); // theta and seed are not used here
+      insert_below(b, theta, table, has_hash_span<Sketch>());
       // scan A lookup B
-      for (auto& entry: a) {
-        const uint64_t hash = EK()(entry);
-        if (hash < theta) {
-          auto result = table.find(hash);
-          if (!result.second) entries.push_back(conditional_forward<FwdSketch>(entry));
-        } else if (a.is_ordered()) {
-          break; // early stop
-        }
-      }
+      copy_below(std::forward<FwdSketch>(a), theta, &table, entries, a_span());
     }
   }
   if (entries.empty() && theta == theta_constants::MAX_THETA) is_empty = true;
@@ -80,6 +68,60 @@ CS theta_set_difference_base<EN, EK, CS, A>::compute(FwdSketch&& a, const Sketch
   return CS(is_empty, a.is_ordered() || ordered, seed_hash_, theta, std::move(entries));
 }
 
+template<typename EN, typename EK, typename CS, typename A>
+template<typename FwdSketch>
+void theta_set_difference_base<EN, EK, CS, A>::copy_below(FwdSketch&& a, uint64_t theta, const hash_table* table,
+    std::vector<EN, A>& entries, std::false_type) {
+  for (auto& entry: a) {
+    const uint64_t hash = EK()(entry);
+    if (hash < theta) {
+      if (table == nullptr || !table->find(hash).second) entries.push_back(conditional_forward<FwdSketch>(entry));
+    } else if (a.is_ordered()) {
+      break; // early stop
+    }
+  }
+}
+
+// The span is screened in place of stepping through A's iterators, which also drops the
+// empty slots of an update sketch's table; the survivors are then looked up in B's table.
+template<typename EN, typename EK, typename CS, typename A>
+template<typename FwdSketch>
+void theta_set_difference_base<EN, EK, CS, A>::copy_below(FwdSketch&& a, uint64_t theta, const hash_table* table,
+    std::vector<EN, A>& entries, std::true_type) {
+  const theta_hash_span span = a.get_hash_span();
+  entries.resize(span.size);
+  entries.resize(screen_hashes(span.data, span.size, theta, entries.data()));
+  if (table == nullptr) return;
+  entries.erase(std::remove_if(entries.begin(), entries.end(),
+      [table](uint64_t hash) { return table->find(hash).second; }), entries.end());
+}
+
+template<typename EN, typename EK, typename CS, typename A>
+template<typename Sketch>
+void theta_set_difference_base<EN, EK, CS, A>::insert_below(const Sketch& b, uint64_t theta, hash_table& table, std::false_type) {
+  for (const auto& entry: b) {
+    const uint64_t hash = EK()(entry);
+    if (hash < theta) {
+      table.insert(table.find(hash).first, hash);
+    } else if (b.is_ordered()) {
+      break; // early stop
+    }
+  }
+}
+
+template<typename EN, typename EK, typename CS, typename A>
+template<typename Sketch>
+void theta_set_difference_base<EN, EK, CS, A>::insert_below(const Sketch& b, uint64_t theta, hash_table& table, std::true_type) {
+  const theta_hash_span span = b.get_hash_span();
+  uint64_t survivors[murmur_batch::CHUNK_SIZE];
+  for (size_t start = 0; start < span.size; start += murmur_batch::CHUNK_SIZE) {
+    const size_t chunk = std::min(span.size - start, murmur_batch::CHUNK_SIZE);
+    const size_t num = screen_hashes(span.data + start, chunk, theta, survivors);
+    for (size_t i = 0; i < num; ++i) table.insert(table.find(survivors[i]).first, survivors[i]);
+    if (num < chunk && b.is_ordered()) break; // early stop
+  }
+}
+
 } /* namespace datasketches */
 
 #endif
@@ -175,6 +175,17 @@ public:
    */
   resize_factor get_rf() const;
 
+  /**
+   * @return heap memory held by the hash table, which is sized for the entries it may
+   * grow to hold before it resizes, in bytes
+   */
+  size_t get_memory_usage_bytes() const;
+
+  /**
+   * @return the hash table as one array, in which 0 marks an empty slot
+   */
+  theta_hash_span get_hash_span() const;
+
   /**
    * Update this sketch with a given string.
    * @param value string to update the sketch with
@@ -264,11 +275,63 @@ public:
    */
   void update(const void* data, size_t length);
 
+  /**
+   * Update this sketch with n uint64_t values.
+   * Equivalent to calling update(uint64_t) on each value in turn,
+   * but the hashes are computed several at a time.
+   * @param values pointer to the values
+   * @param n number of values
+   */
+  void update_batch(const uint64_t* values, size_t n);
+
+  /**
+   * Update this sketch with n consecutive 16-byte keys.
+   * Equivalent to calling update(const void*, size_t) on each 16-byte key in turn,
+   * but the hashes are computed several at a time.
+   * @param keys pointer to the first key
+   * @param n number of keys
+   */
+  void update_batch_16(const void* keys, size_t n);
+
+  /**
+   * Update this sketch with n items already hashed by MurmurHash3_x64_128 with this
+   * sketch's seed. Equivalent to calling update(const void*, size_t) on each
+   * item in turn, so an item hashed once can update several sketches.
+   * @param hashes pointer to the hashes, of any type with the h1 and h2 of HashState
+   * @param n number of hashes
+   */
+  template<typename H>
+  void update_hashes(const H* hashes, size_t n);
+
+  /**
+   * Update this sketch with n keys stored back to back, key i ending at offset ends[i].
+   * Equivalent to calling update(const void*, size_t) on each key in turn,
+   * but the hashes are screened and inserted several at a time.
+   * @param data pointer to the first key
+   * @param ends offsets just past the end of each key
+   * @param n number of keys
+   */
+  void update_batch(const void* data, const size_t* ends, size_t n);
+
+  /**
+   * Update this sketch with n hashes computed from the input by compute_hash() with this
+   * sketch's seed. This lets buffers that hash and pre-screen updates elsewhere, for instance
+   * on other threads against a previously published get_theta64(), propagate them in bulk.
+   * @param hashes pointer to the hashes
+   * @param n number of hashes
+   */
+  void update_hashes(const uint64_t* hashes, size_t n);
+
   /**
    * Remove retained entries in excess of the nominal size k (if any)
    */
   void trim();
 
+  /**
+   * Resets this sketch to the empty state, keeping the memory of its hash table for reuse.
+   */
+  void reset();
+
   /**
    * Converts this sketch to a compact sketch (ordered or unordered).
    * @param ordered optional flag to specify if ordered sketch should be produced
@@ -284,6 +347,16 @@ public:
 private:
   theta_table table_;
 
+  // insert a hash that has already been through table_.screen(), 0 meaning rejected
+  inline void update_screened(uint64_t hash);
+
+  // insert up to murmur_batch::CHUNK_SIZE hashes, screening them together and
+  // prefetching the probe slots of the survivors before any is inserted
+  inline void update_block(const uint64_t* hashes, size_t n);
+
+  // tables of up to 2^PREFETCH_LG_SIZE entries (128KB) are not prefetched
+  static const uint8_t PREFETCH_LG_SIZE = 14;
+
   // for builder
   update_theta_sketch_alloc(uint8_t lg_cur_size, uint8_t lg_nom_size, resize_factor rf, uint64_t theta,
       uint64_t seed, const Allocator& allocator);
@@ -304,6 +377,7 @@ public:
   using vector_bytes = std::vector<uint8_t, AllocBytes>;
 
   static const uint8_t SERIAL_VERSION = 3;
+  static const uint8_t COMPRESSED_SERIAL_VERSION = 4;
   static const uint8_t SKETCH_TYPE = 3;
 
   // Instances of this type can be obtained:
@@ -325,6 +399,16 @@ public:
   virtual uint32_t get_num_retained() const;
   virtual uint16_t get_seed_hash() const;
 
+  /**
+   * @return heap memory held by the retained entries, in bytes
+   */
+  size_t get_memory_usage_bytes() const;
+
+  /**
+   * @return the retained entries as one array
+   */
+  theta_hash_span get_hash_span() const;
+
   /**
    * This method serializes the sketch into a given stream in a binary form
    * @param os output stream
@@ -340,6 +424,24 @@ public:
    */
   vector_bytes serialize(unsigned header_size_bytes = 0) const;
 
+  /**
+   * This method serializes the sketch as a vector of bytes in the compressed format,
+   * which stores the deltas between consecutive ordered hashes, bit-packed to the width
+   * of the largest, instead of 8 bytes per hash. Unordered, empty and single-item sketches
+   * are serialized as by serialize(), which deserialize() tells apart.
+   * Compressed sketches cannot be wrapped, since their hashes must be decoded.
+   * @param header_size_bytes space to reserve in front of the sketch
+   */
+  vector_bytes serialize_compressed(unsigned header_size_bytes = 0) const;
+
+  /**
+   * @param bytes pointer to the array of bytes
+   * @param size the size of the array
+   * @return whether the bytes are of a sketch in the compressed format, which must be
+   * deserialized rather than wrapped
+   */
+  static bool is_serialized_compressed(const void* bytes, size_t size);
+
   virtual iterator begin();
   virtual iterator end();
   virtual const_iterator begin() const;
@@ -376,10 +478,121 @@ private:
   uint64_t theta_;
   std::vector<uint64_t, Allocator> entries_;
 
+  bool is_suitable_for_compression() const;
+  // the width of the widest delta between consecutive hashes, and so of all of them
+  uint8_t compute_entry_bits() const;
+  // the number of bytes the compressed format stores num_entries in
+  uint8_t get_num_entries_bytes() const;
+  // decodes num_entries bit-packed deltas from [ptr, end) into hashes
+  static void unpack_entries(const uint8_t* ptr, const uint8_t* end, uint8_t entry_bits,
+      uint32_t num_entries, uint64_t* entries);
+  static void check_compressed_preamble(uint8_t preamble_longs, uint8_t entry_bits, uint8_t num_entries_bytes);
+  static compact_theta_sketch_alloc deserialize_compressed(uint8_t preamble_longs, std::istream& is,
+      uint64_t seed, const Allocator& allocator);
+  static compact_theta_sketch_alloc deserialize_compressed(const void* bytes, size_t size,
+      uint64_t seed, const Allocator& allocator);
+
   using ostrstream = typename Base::ostrstream;
   virtual void print_specifics(ostrstream& os) const;
 };
 
+/**
+ * Read-only view of a serialized compact sketch, which reads hashes straight from
+ * the serialized bytes instead of copying them into an entries vector.
+ * The bytes must outlive the view.
+ * It has the interface that set operations expect, so it can be an input to
+ * a union or an intersection.
+ */
+template<typename Allocator = std::allocator<uint64_t>>
+class wrapped_compact_theta_sketch_alloc {
+public:
+  class const_iterator;
+
+  /**
+   * This method wraps a serialized compact sketch as an array of bytes.
+   * The sketch must not be in the compressed format, whose hashes cannot be read in place.
+   * @param bytes pointer to the array of bytes, which need not be aligned
+   * @param size the size of the array
+   * @param seed the seed for the hash function that was used to create the sketch
+   * @return an instance of the sketch
+   */
+  static const wrapped_compact_theta_sketch_alloc wrap(const void* bytes, size_t size, uint64_t seed = DEFAULT_SEED);
+
+  bool is_empty() const;
+  bool is_ordered() const;
+  uint16_t get_seed_hash() const;
+  uint64_t get_theta64() const;
+  uint32_t get_num_retained() const;
+
+  /**
+   * @return the estimate of the distinct count of the input stream
+   */
+  double get_estimate() const;
+
+  /**
+   * Returns the approximate lower error bound given a number of standard deviations,
+   * as compact_theta_sketch_alloc::get_lower_bound() does, without reading the hashes.
+   * @param num_std_devs number of Standard Deviations (1, 2 or 3)
+   * @return the lower bound
+   */
+  double get_lower_bound(uint8_t num_std_devs) const;
+
+  /**
+   * Returns the approximate upper error bound given a number of standard deviations,
+   * as compact_theta_sketch_alloc::get_upper_bound() does, without reading the hashes.
+   * @param num_std_devs number of Standard Deviations (1, 2 or 3)
+   * @return the upper bound
+   */
+  double get_upper_bound(uint8_t num_std_devs) const;
+
+  /**
+   * Copies the hashes out into a compact sketch.
+   * @return compact sketch
+   */
+  compact_theta_sketch_alloc<Allocator> to_compact(const Allocator& allocator = Allocator()) const;
+
+  const_iterator begin() const;
+  const_iterator end() const;
+
+private:
+  enum flags { IS_BIG_ENDIAN, IS_READ_ONLY, IS_EMPTY, IS_COMPACT, IS_ORDERED };
+
+  bool is_empty_;
+  bool is_ordered_;
+  uint16_t seed_hash_;
+  uint32_t num_entries_;
+  uint64_t theta_;
+  const char* entries_;
+
+  wrapped_compact_theta_sketch_alloc(bool is_empty, bool is_ordered, uint16_t seed_hash, uint32_t num_entries,
+      uint64_t theta, const char* entries);
+};
+
+// Loads each hash with a memcpy on dereference, as serialized entries may be unaligned.
+template<typename Allocator>
+class wrapped_compact_theta_sketch_alloc<Allocator>::const_iterator {
+public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = uint64_t;
+  using difference_type = std::ptrdiff_t;
+  using pointer = uint64_t*;
+  using reference = uint64_t&;
+  const_iterator(const char* ptr, uint32_t index);
+  const_iterator& operator++();
+  const_iterator operator++(int);
+  bool operator==(const const_iterator& other) const;
+  bool operator!=(const const_iterator& other) const;
+  const uint64_t& operator*() const;
+  // skipping ahead and looking ahead, for searches over the ordered hashes
+  const_iterator& operator+=(uint32_t n);
+  uint64_t operator[](uint32_t n) const;
+
+private:
+  const char* ptr_;
+  uint32_t index_;
+  mutable uint64_t value_;
+};
+
 template<typename Allocator>
 class update_theta_sketch_alloc<Allocator>::builder: public theta_base_builder<builder, Allocator> {
 public:
@@ -391,6 +604,7 @@ public:
 using theta_sketch = theta_sketch_alloc<std::allocator<uint64_t>>;
 using update_theta_sketch = update_theta_sketch_alloc<std::allocator<uint64_t>>;
 using compact_theta_sketch = compact_theta_sketch_alloc<std::allocator<uint64_t>>;
+using wrapped_compact_theta_sketch = wrapped_compact_theta_sketch_alloc<std::allocator<uint64_t>>;
 
 } /* namespace datasketches */
 
@@ -20,11 +20,14 @@
 #ifndef THETA_SKETCH_IMPL_HPP_
 #define THETA_SKETCH_IMPL_HPP_
 
+#include <algorithm>
 #include <sstream>
 #include <vector>
 
 #include "serde.hpp"
 #include "binomial_bounds.hpp"
+#include "bit_packing.hpp"
+#include "count_zeros.hpp"
 #include "theta_helpers.hpp"
 
 namespace datasketches {
@@ -130,6 +133,17 @@ auto update_theta_sketch_alloc<A>::get_rf() const -> resize_factor {
   return table_.rf_;
 }
 
+template<typename A>
+size_t update_theta_sketch_alloc<A>::get_memory_usage_bytes() const {
+  return table_.get_memory_usage_bytes();
+}
+
+template<typename A>
+theta_hash_span update_theta_sketch_alloc<A>::get_hash_span() const {
+  if (table_.entries_ == nullptr) return {nullptr, 0};
+  return {table_.entries_, size_t(1) << table_.lg_cur_size_};
+}
+
 template<typename A>
 void update_theta_sketch_alloc<A>::update(uint64_t value) {
   update(&value, sizeof(value));
@@ -188,7 +202,80 @@ void update_theta_sketch_alloc<A>::update(const std::string& value) {
 
 template<typename A>
 void update_theta_sketch_alloc<A>::update(const void* data, size_t length) {
-  const uint64_t hash = table_.hash_and_screen(data, length);
+  update_screened(table_.hash_and_screen(data, length));
+}
+
+template<typename A>
+void update_theta_sketch_alloc<A>::update_batch(const uint64_t* values, size_t n) {
+  HashState states[murmur_batch::CHUNK_SIZE];
+  uint64_t hashes[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    MurmurHash3_x64_128_batch_u64(values, chunk, table_.seed_, states);
+    for (size_t i = 0; i < chunk; ++i) hashes[i] = hash_from_state(states[i]);
+    update_block(hashes, chunk);
+    values += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+void update_theta_sketch_alloc<A>::update_batch_16(const void* keys, size_t n) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(keys);
+  HashState states[murmur_batch::CHUNK_SIZE];
+  uint64_t hashes[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    MurmurHash3_x64_128_batch_16(bytes, chunk, table_.seed_, states);
+    for (size_t i = 0; i < chunk; ++i) hashes[i] = hash_from_state(states[i]);
+    update_block(hashes, chunk);
+    bytes += 16 * chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+template<typename H>
+void update_theta_sketch_alloc<A>::update_hashes(const H* states, size_t n) {
+  uint64_t hashes[murmur_batch::CHUNK_SIZE];
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    for (size_t i = 0; i < chunk; ++i) hashes[i] = states[i].h1 >> 1; // as hash_from_state
+    update_block(hashes, chunk);
+    states += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+void update_theta_sketch_alloc<A>::update_batch(const void* data, const size_t* ends, size_t n) {
+  const uint8_t* bytes = static_cast<const uint8_t*>(data);
+  uint64_t hashes[murmur_batch::CHUNK_SIZE];
+  size_t start = 0;
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    for (size_t i = 0; i < chunk; ++i) {
+      hashes[i] = compute_hash(bytes + start, ends[i] - start, table_.seed_);
+      start = ends[i];
+    }
+    update_block(hashes, chunk);
+    ends += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+void update_theta_sketch_alloc<A>::update_hashes(const uint64_t* hashes, size_t n) {
+  while (n > 0) {
+    const size_t chunk = std::min(n, murmur_batch::CHUNK_SIZE);
+    update_block(hashes, chunk);
+    hashes += chunk;
+    n -= chunk;
+  }
+}
+
+template<typename A>
+void update_theta_sketch_alloc<A>::update_screened(uint64_t hash) {
   if (hash == 0) return;
   auto result = table_.find(hash);
   if (!result.second) {
@@ -196,11 +283,33 @@ void update_theta_sketch_alloc<A>::update(const void* data, size_t length) {
   }
 }
 
+template<typename A>
+void update_theta_sketch_alloc<A>::update_block(const uint64_t* hashes, size_t n) {
+  // probes of a table this small hit the cache anyway, and prefetching them costs more than it saves
+  const bool prefetch = table_.lg_cur_size_ > PREFETCH_LG_SIZE;
+  if (table_.theta_ == theta_constants::MAX_THETA) {
+    // nothing to screen out yet but the reserved 0, which update_screened() drops
+    if (prefetch) for (size_t i = 0; i < n; ++i) table_.prefetch(hashes[i]);
+    for (size_t i = 0; i < n; ++i) update_screened(table_.screen(hashes[i]));
+    return;
+  }
+  uint64_t survivors[murmur_batch::CHUNK_SIZE];
+  const size_t num = table_.screen_block(hashes, n, survivors);
+  if (prefetch) for (size_t i = 0; i < num; ++i) table_.prefetch(survivors[i]);
+  // inserting may rebuild the table and lower theta, so the survivors are screened again
+  for (size_t i = 0; i < num; ++i) update_screened(table_.screen(survivors[i]));
+}
+
 template<typename A>
 void update_theta_sketch_alloc<A>::trim() {
   table_.trim();
 }
 
+template<typename A>
+void update_theta_sketch_alloc<A>::reset() {
+  table_.reset();
+}
+
 template<typename A>
 auto update_theta_sketch_alloc<A>::begin() -> iterator {
   return iterator(table_.entries_, 1 << table_.lg_cur_size_, 0);
@@ -293,6 +402,16 @@ uint32_t compact_theta_sketch_alloc<A>::get_num_retained() const {
   return static_cast<uint32_t>(entries_.size());
 }
 
+template<typename A>
+size_t compact_theta_sketch_alloc<A>::get_memory_usage_bytes() const {
+  return entries_.capacity() * sizeof(uint64_t);
+}
+
+template<typename A>
+theta_hash_span compact_theta_sketch_alloc<A>::get_hash_span() const {
+  return {entries_.data(), entries_.size()};
+}
+
 template<typename A>
 uint16_t compact_theta_sketch_alloc<A>::get_seed_hash() const {
   return seed_hash_;
@@ -393,15 +512,131 @@ auto compact_theta_sketch_alloc<A>::serialize(unsigned header_size_bytes) const
   return bytes;
 }
 
+template<typename A>
+bool compact_theta_sketch_alloc<A>::is_suitable_for_compression() const {
+  // deltas are only small between sorted hashes, and a single hash is already 16 bytes
+  return this->is_ordered() && !entries_.empty() && !(entries_.size() == 1 && !this->is_estimation_mode());
+}
+
+template<typename A>
+uint8_t compact_theta_sketch_alloc<A>::compute_entry_bits() const {
+  uint64_t previous = 0;
+  uint64_t ored = 0;
+  for (const uint64_t entry: entries_) {
+    ored |= entry - previous;
+    previous = entry;
+  }
+  return 64 - count_leading_zeros_in_u64(ored);
+}
+
+template<typename A>
+uint8_t compact_theta_sketch_alloc<A>::get_num_entries_bytes() const {
+  const uint32_t num_entries = static_cast<uint32_t>(entries_.size());
+  const uint8_t bits = 64 - count_leading_zeros_in_u64(num_entries);
+  return (bits + 7) >> 3;
+}
+
+template<typename A>
+auto compact_theta_sketch_alloc<A>::serialize_compressed(unsigned header_size_bytes) const -> vector_bytes {
+  if (!is_suitable_for_compression()) return serialize(header_size_bytes);
+  const uint8_t preamble_longs = this->is_estimation_mode() ? 2 : 1;
+  const uint8_t entry_bits = compute_entry_bits();
+  const uint8_t num_entries_bytes = get_num_entries_bytes();
+  const size_t size = header_size_bytes + sizeof(uint64_t) * preamble_longs + num_entries_bytes
+      + (entry_bits * entries_.size() + 7) / 8;
+  vector_bytes bytes(size, 0, entries_.get_allocator());
+  uint8_t* ptr = bytes.data() + header_size_bytes;
+
+  ptr += copy_to_mem(preamble_longs, ptr);
+  const uint8_t serial_version = COMPRESSED_SERIAL_VERSION;
+  ptr += copy_to_mem(serial_version, ptr);
+  const uint8_t type = SKETCH_TYPE;
+  ptr += copy_to_mem(type, ptr);
+  ptr += copy_to_mem(entry_bits, ptr);
+  ptr += copy_to_mem(num_entries_bytes, ptr);
+  const uint8_t flags_byte(
+    (1 << flags::IS_COMPACT) |
+    (1 << flags::IS_READ_ONLY) |
+    (1 << flags::IS_ORDERED)
+  );
+  ptr += copy_to_mem(flags_byte, ptr);
+  const uint16_t seed_hash = get_seed_hash();
+  ptr += copy_to_mem(seed_hash, ptr);
+  if (this->is_estimation_mode()) {
+    ptr += copy_to_mem(theta_, ptr);
+  }
+  // in as few little-endian bytes as hold it
+  uint32_t num_entries = static_cast<uint32_t>(entries_.size());
+  for (unsigned i = 0; i < num_entries_bytes; ++i) {
+    *ptr++ = num_entries & 0xff;
+    num_entries >>= 8;
+  }
+
+  uint64_t previous = 0;
+  uint64_t deltas[8];
+  size_t i = 0;
+  for (; i + 8 <= entries_.size(); i += 8) {
+    for (unsigned j = 0; j < 8; ++j) {
+      deltas[j] = entries_[i + j] - previous;
+      previous = entries_[i + j];
+    }
+    pack_bits_block8(deltas, ptr, entry_bits);
+    ptr += entry_bits;
+  }
+  uint8_t offset = 0;
+  for (; i < entries_.size(); ++i) {
+    offset = pack_bits(entries_[i] - previous, entry_bits, ptr, offset);
+    previous = entries_[i];
+  }
+  return bytes;
+}
+
+template<typename A>
+bool compact_theta_sketch_alloc<A>::is_serialized_compressed(const void* bytes, size_t size) {
+  return size > 1 && static_cast<const uint8_t*>(bytes)[1] == COMPRESSED_SERIAL_VERSION;
+}
+
+template<typename A>
+void compact_theta_sketch_alloc<A>::unpack_entries(const uint8_t* ptr, const uint8_t* end, uint8_t entry_bits,
+    uint32_t num_entries, uint64_t* entries) {
+  uint32_t i = 0;
+  for (; i + 8 <= num_entries; i += 8) {
+    unpack_bits_block8(entries + i, ptr, entry_bits, end);
+    ptr += entry_bits;
+  }
+  uint8_t offset = 0;
+  for (; i < num_entries; ++i) offset = unpack_bits(entries[i], entry_bits, ptr, offset);
+  uint64_t previous = 0;
+  for (i = 0; i < num_entries; ++i) {
+    entries[i] += previous;
+    previous = entries[i];
+  }
+}
+
+template<typename A>
+void compact_theta_sketch_alloc<A>::check_compressed_preamble(uint8_t preamble_longs, uint8_t entry_bits,
+    uint8_t num_entries_bytes) {
+  if (preamble_longs < 1 || preamble_longs > 2) {
+    throw std::invalid_argument("Possible corruption: compressed preamble longs must be 1 or 2: " + std::to_string(preamble_longs));
+  }
+  if (entry_bits < 1 || entry_bits > 64) {
+    throw std::invalid_argument("Possible corruption: entry bits must be from 1 to 64: " + std::to_string(entry_bits));
+  }
+  if (num_entries_bytes < 1 || num_entries_bytes > 4) {
+    throw std::invalid_argument("Possible corruption: num entries bytes must be from 1 to 4: " + std::to_string(num_entries_bytes));
+  }
+}
+
 template<typename A>
 compact_theta_sketch_alloc<A> compact_theta_sketch_alloc<A>::deserialize(std::istream& is, uint64_t seed, const A& allocator) {
   const auto preamble_longs = read<uint8_t>(is);
   const auto serial_version = read<uint8_t>(is);
   const auto type = read<uint8_t>(is);
+  checker<true>::check_sketch_type(type, SKETCH_TYPE);
+  if (serial_version == COMPRESSED_SERIAL_VERSION) return deserialize_compressed(preamble_longs, is, seed, allocator);
   read<uint16_t>(is); // unused
   const auto flags_byte = read<uint8_t>(is);
   const auto seed_hash = read<uint16_t>(is);
-  checker<true>::check_sketch_type(type, SKETCH_TYPE);
   checker<true>::check_serial_version(serial_version, SERIAL_VERSION);
   const bool is_empty = flags_byte & (1 << flags::IS_EMPTY);
   if (!is_empty) checker<true>::check_seed_hash(seed_hash, compute_seed_hash(seed));
@@ -427,6 +662,31 @@ compact_theta_sketch_alloc<A> compact_theta_sketch_alloc<A>::deserialize(std::is
   return compact_theta_sketch_alloc(is_empty, is_ordered, seed_hash, theta, std::move(entries));
 }
 
+template<typename A>
+compact_theta_sketch_alloc<A> compact_theta_sketch_alloc<A>::deserialize_compressed(uint8_t preamble_longs, std::istream& is,
+    uint64_t seed, const A& allocator) {
+  const auto entry_bits = read<uint8_t>(is);
+  const auto num_entries_bytes = read<uint8_t>(is);
+  const auto flags_byte = read<uint8_t>(is);
+  const auto seed_hash = read<uint16_t>(is);
+  check_compressed_preamble(preamble_longs, entry_bits, num_entries_bytes);
+  checker<true>::check_seed_hash(seed_hash, compute_seed_hash(seed));
+  uint64_t theta = theta_constants::MAX_THETA;
+  if (preamble_longs > 1) theta = read<uint64_t>(is);
+  uint32_t num_entries = 0;
+  for (unsigned i = 0; i < num_entries_bytes; ++i) {
+    num_entries |= static_cast<uint32_t>(read<uint8_t>(is)) << (i << 3);
+  }
+  if (!is.good()) throw std::runtime_error("error reading from std::istream");
+  vector_bytes packed((static_cast<uint64_t>(entry_bits) * num_entries + 7) / 8, 0, allocator);
+  read(is, packed.data(), packed.size());
+  if (!is.good()) throw std::runtime_error("error reading from std::istream");
+  std::vector<uint64_t, A> entries(num_entries, 0, allocator);
+  unpack_entries(packed.data(), packed.data() + packed.size(), entry_bits, num_entries, entries.data());
+  const bool is_ordered = flags_byte & (1 << flags::IS_ORDERED);
+  return compact_theta_sketch_alloc(false, is_ordered, seed_hash, theta, std::move(entries));
+}
+
 template<typename A>
 compact_theta_sketch_alloc<A> compact_theta_sketch_alloc<A>::deserialize(const void* bytes, size_t size, uint64_t seed, const A& allocator) {
   ensure_minimum_memory(size, 8);
@@ -444,6 +704,7 @@ compact_theta_sketch_alloc<A> compact_theta_sketch_alloc<A>::deserialize(const v
   uint16_t seed_hash;
   ptr += copy_from_mem(ptr, seed_hash);
   checker<true>::check_sketch_type(type, SKETCH_TYPE);
+  if (serial_version == COMPRESSED_SERIAL_VERSION) return deserialize_compressed(bytes, size, seed, allocator);
   checker<true>::check_serial_version(serial_version, SERIAL_VERSION);
   const bool is_empty = flags_byte & (1 << flags::IS_EMPTY);
   if (!is_empty) checker<true>::check_seed_hash(seed_hash, compute_seed_hash(seed));
@@ -472,6 +733,205 @@ compact_theta_sketch_alloc<A> compact_theta_sketch_alloc<A>::deserialize(const v
   return compact_theta_sketch_alloc(is_empty, is_ordered, seed_hash, theta, std::move(entries));
 }
 
+template<typename A>
+compact_theta_sketch_alloc<A> compact_theta_sketch_alloc<A>::deserialize_compressed(const void* bytes, size_t size,
+    uint64_t seed, const A& allocator) {
+  const uint8_t* ptr = static_cast<const uint8_t*>(bytes);
+  const uint8_t* end = ptr + size;
+  uint8_t preamble_longs;
+  ptr += copy_from_mem(ptr, preamble_longs);
+  ptr += sizeof(uint8_t) * 2; // serial version and type, already checked
+  uint8_t entry_bits;
+  ptr += copy_from_mem(ptr, entry_bits);
+  uint8_t num_entries_bytes;
+  ptr += copy_from_mem(ptr, num_entries_bytes);
+  uint8_t flags_byte;
+  ptr += copy_from_mem(ptr, flags_byte);
+  uint16_t seed_hash;
+  ptr += copy_from_mem(ptr, seed_hash);
+  check_compressed_preamble(preamble_longs, entry_bits, num_entries_bytes);
+  checker<true>::check_seed_hash(seed_hash, compute_seed_hash(seed));
+  uint64_t theta = theta_constants::MAX_THETA;
+  ensure_minimum_memory(size, (preamble_longs << 3) + num_entries_bytes);
+  if (preamble_longs > 1) ptr += copy_from_mem(ptr, theta);
+  uint32_t num_entries = 0;
+  for (unsigned i = 0; i < num_entries_bytes; ++i) {
+    num_entries |= static_cast<uint32_t>(*ptr++) << (i << 3);
+  }
+  const size_t packed_size = (static_cast<uint64_t>(entry_bits) * num_entries + 7) / 8;
+  check_memory_size(ptr - static_cast<const uint8_t*>(bytes) + packed_size, size);
+  std::vector<uint64_t, A> entries(num_entries, 0, allocator);
+  unpack_entries(ptr, end, entry_bits, num_entries, entries.data());
+  const bool is_ordered = flags_byte & (1 << flags::IS_ORDERED);
+  return compact_theta_sketch_alloc(false, is_ordered, seed_hash, theta, std::move(entries));
+}
+
+template<typename A>
+wrapped_compact_theta_sketch_alloc<A>::wrapped_compact_theta_sketch_alloc(bool is_empty, bool is_ordered, uint16_t seed_hash,
+    uint32_t num_entries, uint64_t theta, const char* entries):
+is_empty_(is_empty),
+is_ordered_(is_ordered),
+seed_hash_(seed_hash),
+num_entries_(num_entries),
+theta_(theta),
+entries_(entries)
+{}
+
+template<typename A>
+const wrapped_compact_theta_sketch_alloc<A> wrapped_compact_theta_sketch_alloc<A>::wrap(const void* bytes, size_t size, uint64_t seed) {
+  // same checks as compact_theta_sketch_alloc<A>::deserialize(), minus the copy
+  ensure_minimum_memory(size, 8);
+  const char* ptr = static_cast<const char*>(bytes);
+  const char* base = ptr;
+  uint8_t preamble_longs;
+  ptr += copy_from_mem(ptr, preamble_longs);
+  uint8_t serial_version;
+  ptr += copy_from_mem(ptr, serial_version);
+  uint8_t type;
+  ptr += copy_from_mem(ptr, type);
+  ptr += sizeof(uint16_t); // unused
+  uint8_t flags_byte;
+  ptr += copy_from_mem(ptr, flags_byte);
+  uint16_t seed_hash;
+  ptr += copy_from_mem(ptr, seed_hash);
+  checker<true>::check_sketch_type(type, compact_theta_sketch_alloc<A>::SKETCH_TYPE);
+  if (serial_version == compact_theta_sketch_alloc<A>::COMPRESSED_SERIAL_VERSION) {
+    throw std::invalid_argument("compressed sketches cannot be wrapped, they must be deserialized");
+  }
+  checker<true>::check_serial_version(serial_version, compact_theta_sketch_alloc<A>::SERIAL_VERSION);
+  const bool is_empty = flags_byte & (1 << flags::IS_EMPTY);
+  if (!is_empty) checker<true>::check_seed_hash(seed_hash, compute_seed_hash(seed));
+
+  uint64_t theta = theta_constants::MAX_THETA;
+  uint32_t num_entries = 0;
+  if (!is_empty) {
+    if (preamble_longs == 1) {
+      num_entries = 1;
+    } else {
+      ensure_minimum_memory(size, 16);
+      ptr += copy_from_mem(ptr, num_entries);
+      ptr += sizeof(uint32_t); // unused
+      if (preamble_longs > 2) {
+        ensure_minimum_memory(size, (preamble_longs - 1) << 3);
+        ptr += copy_from_mem(ptr, theta);
+      }
+    }
+  }
+  const size_t entries_size_bytes = sizeof(uint64_t) * num_entries;
+  check_memory_size(ptr - base + entries_size_bytes, size);
+
+  const bool is_ordered = flags_byte & (1 << flags::IS_ORDERED);
+  return wrapped_compact_theta_sketch_alloc(is_empty, is_ordered, seed_hash, num_entries, theta, ptr);
+}
+
+template<typename A>
+bool wrapped_compact_theta_sketch_alloc<A>::is_empty() const {
+  return is_empty_;
+}
+
+template<typename A>
+bool wrapped_compact_theta_sketch_alloc<A>::is_ordered() const {
+  return is_ordered_;
+}
+
+template<typename A>
+uint16_t wrapped_compact_theta_sketch_alloc<A>::get_seed_hash() const {
+  return seed_hash_;
+}
+
+template<typename A>
+uint64_t wrapped_compact_theta_sketch_alloc<A>::get_theta64() const {
+  return theta_;
+}
+
+template<typename A>
+uint32_t wrapped_compact_theta_sketch_alloc<A>::get_num_retained() const {
+  return num_entries_;
+}
+
+template<typename A>
+double wrapped_compact_theta_sketch_alloc<A>::get_estimate() const {
+  return num_entries_ / (static_cast<double>(theta_) / theta_constants::MAX_THETA);
+}
+
+template<typename A>
+double wrapped_compact_theta_sketch_alloc<A>::get_lower_bound(uint8_t num_std_devs) const {
+  if (theta_ == theta_constants::MAX_THETA || is_empty_) return num_entries_;
+  return binomial_bounds::get_lower_bound(num_entries_, static_cast<double>(theta_) / theta_constants::MAX_THETA, num_std_devs);
+}
+
+template<typename A>
+double wrapped_compact_theta_sketch_alloc<A>::get_upper_bound(uint8_t num_std_devs) const {
+  if (theta_ == theta_constants::MAX_THETA || is_empty_) return num_entries_;
+  return binomial_bounds::get_upper_bound(num_entries_, static_cast<double>(theta_) / theta_constants::MAX_THETA, num_std_devs);
+}
+
+template<typename A>
+compact_theta_sketch_alloc<A> wrapped_compact_theta_sketch_alloc<A>::to_compact(const A& allocator) const {
+  std::vector<uint64_t, A> entries(num_entries_, 0, allocator);
+  copy_from_mem(entries_, entries.data(), sizeof(uint64_t) * num_entries_);
+  return compact_theta_sketch_alloc<A>(is_empty_, is_ordered_, seed_hash_, theta_, std::move(entries));
+}
+
+template<typename A>
+auto wrapped_compact_theta_sketch_alloc<A>::begin() const -> const_iterator {
+  return const_iterator(entries_, 0);
+}
+
+template<typename A>
+auto wrapped_compact_theta_sketch_alloc<A>::end() const -> const_iterator {
+  return const_iterator(entries_, num_entries_);
+}
+
+template<typename A>
+wrapped_compact_theta_sketch_alloc<A>::const_iterator::const_iterator(const char* ptr, uint32_t index):
+ptr_(ptr),
+index_(index),
+value_(0)
+{}
+
+template<typename A>
+auto wrapped_compact_theta_sketch_alloc<A>::const_iterator::operator++() -> const_iterator& {
+  ++index_;
+  return *this;
+}
+
+template<typename A>
+auto wrapped_compact_theta_sketch_alloc<A>::const_iterator::operator++(int) -> const_iterator {
+  const_iterator tmp(*this);
+  operator++();
+  return tmp;
+}
+
+template<typename A>
+bool wrapped_compact_theta_sketch_alloc<A>::const_iterator::operator==(const const_iterator& other) const {
+  return index_ == other.index_;
+}
+
+template<typename A>
+bool wrapped_compact_theta_sketch_alloc<A>::const_iterator::operator!=(const const_iterator& other) const {
+  return index_ != other.index_;
+}
+
+template<typename A>
+auto wrapped_compact_theta_sketch_alloc<A>::const_iterator::operator*() const -> const uint64_t& {
+  copy_from_mem(ptr_ + sizeof(uint64_t) * index_, value_);
+  return value_;
+}
+
+template<typename A>
+auto wrapped_compact_theta_sketch_alloc<A>::const_iterator::operator+=(uint32_t n) -> const_iterator& {
+  index_ += n;
+  return *this;
+}
+
+template<typename A>
+uint64_t wrapped_compact_theta_sketch_alloc<A>::const_iterator::operator[](uint32_t n) const {
+  uint64_t value;
+  copy_from_mem(ptr_ + sizeof(uint64_t) * (index_ + n), value);
+  return value;
+}
+
 } /* namespace datasketches */
 
 #endif
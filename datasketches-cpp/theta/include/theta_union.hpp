@@ -60,6 +60,19 @@ public:
    */
   CompactSketch get_result(bool ordered = true) const;
 
+  /**
+   * Produces the same result as get_result(), moving the retained entries out
+   * instead of copying them where possible, and resets this union.
+   * @param ordered optional flag to specify if ordered sketch should be produced
+   * @return the result of the union
+   */
+  CompactSketch take_result(bool ordered = true);
+
+  /**
+   * Resets this union to the empty state, keeping the memory of its hash table for reuse.
+   */
+  void reset();
+
 private:
   State state_;
 
@@ -20,6 +20,9 @@
 #ifndef THETA_UNION_BASE_HPP_
 #define THETA_UNION_BASE_HPP_
 
+#include <vector>
+#include <type_traits>
+
 #include "theta_update_sketch_base.hpp"
 
 namespace datasketches {
@@ -44,6 +47,9 @@ public:
   void update(FwdSketch&& sketch);
 
   CompactSketch get_result(bool ordered = true) const;
+  CompactSketch take_result(bool ordered = true);
+
+  void reset();
 
   const Policy& get_policy() const;
 
@@ -51,6 +57,46 @@ private:
   Policy policy_;
   hash_table table_;
   uint64_t union_theta_;
+  // while every input has been ordered, the union is kept as the sorted entries below
+  // union_theta_ (at most the nominal number of them) and table_ is left untouched
+  bool merging_;
+  std::vector<Entry, Allocator> merged_;
+  std::vector<Entry, Allocator> merge_buffer_;
+  // while merging, the entries of small inputs that were below union_theta_, unsorted and
+  // possibly repeated, which are sorted and merged into merged_ in batches
+  std::vector<Entry, Allocator> pending_;
+
+  // inputs of at most 1/2^LG_SMALL_INPUT_SHRINK the nominal entries are pended while merging
+  static const uint8_t LG_SMALL_INPUT_SHRINK = 3;
+  // pending entries are merged once there are 2^LG_PENDING_GROWTH times the nominal entries
+  static const uint8_t LG_PENDING_GROWTH = 2;
+
+  // inputs with hash spans are scanned through them, and the others through their iterators
+  template<typename FwdSketch>
+  using scans_span = std::integral_constant<bool,
+      has_hash_span<typename std::decay<FwdSketch>::type>::value && std::is_same<Entry, uint64_t>::value>;
+
+  template<typename FwdSketch>
+  void insert(FwdSketch&& sketch, std::true_type);
+  template<typename FwdSketch>
+  void insert(FwdSketch&& sketch, std::false_type);
+  template<typename FwdSketch>
+  void merge(FwdSketch&& sketch);
+  template<typename FwdSketch>
+  void pend(FwdSketch&& sketch, std::true_type);
+  template<typename FwdSketch>
+  void pend(FwdSketch&& sketch, std::false_type);
+  void merge_pending();
+  void spill_merged();
+
+  // merges the sorted, distinct entries into merged, lowering theta as merge() does
+  template<typename FwdEntries>
+  void merge_sorted(FwdEntries&& entries, size_t num_entries, std::vector<Entry, Allocator>& merged,
+      std::vector<Entry, Allocator>& buffer, uint64_t& theta) const;
+  // sorts the entries below theta and combines repeated keys through the policy
+  void sort_distinct(std::vector<Entry, Allocator>& entries, uint64_t theta) const;
+  static void sort_by_key(std::vector<Entry, Allocator>& entries, std::true_type);
+  static void sort_by_key(std::vector<Entry, Allocator>& entries, std::false_type);
 };
 
 } /* namespace datasketches */
@@ -31,7 +31,11 @@ theta_union_base<EN, EK, P, S, CS, A>::theta_union_base(uint8_t lg_cur_size, uin
     uint64_t theta, uint64_t seed, const P& policy, const A& allocator):
 policy_(policy),
 table_(lg_cur_size, lg_nom_size, rf, theta, seed, allocator),
-union_theta_(table_.theta_)
+union_theta_(table_.theta_),
+merging_(true),
+merged_(allocator),
+merge_buffer_(allocator),
+pending_(allocator)
 {}
 
 template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
@@ -41,6 +45,25 @@ void theta_union_base<EN, EK, P, S, CS, A>::update(SS&& sketch) {
   if (sketch.get_seed_hash() != compute_seed_hash(table_.seed_)) throw std::invalid_argument("seed hash mismatch");
   table_.is_empty_ = false;
   if (sketch.get_theta64() < union_theta_) union_theta_ = sketch.get_theta64();
+  if (merging_) {
+    if (sketch.get_num_retained() <= (1U << table_.lg_nom_size_) >> LG_SMALL_INPUT_SHRINK) {
+      pend(std::forward<SS>(sketch), scans_span<SS>());
+      return;
+    }
+    if (sketch.is_ordered()) {
+      merge(std::forward<SS>(sketch));
+      return;
+    }
+    merge_pending();
+    spill_merged();
+  }
+  insert(std::forward<SS>(sketch), scans_span<SS>());
+  if (table_.theta_ < union_theta_) union_theta_ = table_.theta_;
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+template<typename SS>
+void theta_union_base<EN, EK, P, S, CS, A>::insert(SS&& sketch, std::false_type) {
   for (auto& entry: sketch) {
     const uint64_t hash = EK()(entry);
     if (hash < union_theta_ && hash < table_.theta_) {
@@ -54,31 +77,217 @@ void theta_union_base<EN, EK, P, S, CS, A>::update(SS&& sketch) {
       if (sketch.is_ordered()) break; // early stop
     }
   }
-  if (table_.theta_ < union_theta_) union_theta_ = table_.theta_;
+}
+
+// The span is screened a block at a time, as update_theta_sketch_alloc::update_block does,
+// which also steps over the empty slots of an update sketch's table. An insertion can
+// rebuild the table and lower its theta, so survivors are checked against it again.
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+template<typename SS>
+void theta_union_base<EN, EK, P, S, CS, A>::insert(SS&& sketch, std::true_type) {
+  const theta_hash_span span = sketch.get_hash_span();
+  uint64_t survivors[murmur_batch::CHUNK_SIZE];
+  for (size_t start = 0; start < span.size; start += murmur_batch::CHUNK_SIZE) {
+    const size_t chunk = std::min(span.size - start, murmur_batch::CHUNK_SIZE);
+    const uint64_t theta = std::min(union_theta_, table_.theta_);
+    const size_t num = screen_hashes(span.data + start, chunk, theta, survivors);
+    for (size_t i = 0; i < num; ++i) {
+      if (survivors[i] >= table_.theta_) continue;
+      auto result = table_.find(survivors[i]);
+      if (!result.second) {
+        table_.insert(result.first, survivors[i]);
+      } else {
+        policy_(*result.first, survivors[i]);
+      }
+    }
+    if (num < chunk && sketch.is_ordered()) break; // early stop
+  }
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+template<typename SS>
+void theta_union_base<EN, EK, P, S, CS, A>::merge(SS&& sketch) {
+  const size_t num_entries = sketch.get_num_retained();
+  merge_sorted(scan_entries(std::forward<SS>(sketch)), num_entries, merged_, merge_buffer_, union_theta_);
+}
+
+// Small inputs, such as exact sketches of a few dozen keys, would each cost a pass over
+// all of merged_, so their entries are appended to pending_ instead, and sorted and merged
+// in one pass once it holds several times the nominal entries.
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+template<typename SS>
+void theta_union_base<EN, EK, P, S, CS, A>::pend(SS&& sketch, std::true_type) {
+  const theta_hash_span span = sketch.get_hash_span();
+  const size_t start = pending_.size();
+  pending_.resize(start + span.size);
+  pending_.resize(start + screen_hashes(span.data, span.size, union_theta_, pending_.data() + start));
+  if (pending_.size() >= size_t(1) << (table_.lg_nom_size_ + LG_PENDING_GROWTH)) merge_pending();
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+template<typename SS>
+void theta_union_base<EN, EK, P, S, CS, A>::pend(SS&& sketch, std::false_type) {
+  for (auto& entry: sketch) {
+    if (EK()(entry) < union_theta_) {
+      pending_.push_back(EN(conditional_forward<SS>(entry)));
+    } else {
+      if (sketch.is_ordered()) break; // early stop
+    }
+  }
+  if (pending_.size() >= size_t(1) << (table_.lg_nom_size_ + LG_PENDING_GROWTH)) merge_pending();
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+void theta_union_base<EN, EK, P, S, CS, A>::merge_pending() {
+  if (pending_.empty()) return;
+  sort_distinct(pending_, union_theta_);
+  const size_t num_entries = pending_.size();
+  merge_sorted(std::move(pending_), num_entries, merged_, merge_buffer_, union_theta_);
+  pending_.clear();
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+template<typename E>
+void theta_union_base<EN, EK, P, S, CS, A>::merge_sorted(E&& entries, size_t num_entries, std::vector<EN, A>& merged,
+    std::vector<EN, A>& buffer, uint64_t& theta) const {
+  // merge the sorted entries below theta into buffer, and once one more than
+  // the nominal number has been reached, make the last of them the new cutoff
+  const uint32_t nominal_num = 1 << table_.lg_nom_size_;
+  buffer.clear();
+  buffer.reserve(std::min<size_t>(nominal_num + 1, merged.size() + num_entries));
+  auto it = merged.begin();
+  auto emit = [&](EN&& entry) {
+    buffer.push_back(std::move(entry));
+    if (buffer.size() > nominal_num) {
+      theta = EK()(buffer.back());
+      buffer.pop_back();
+    }
+  };
+  for (auto& entry: entries) {
+    const uint64_t hash = EK()(entry);
+    while (it != merged.end() && EK()(*it) < hash && EK()(*it) < theta) emit(std::move(*it++));
+    if (hash >= theta) break;
+    if (it != merged.end() && EK()(*it) == hash) {
+      policy_(*it, conditional_forward<E>(entry));
+      emit(std::move(*it++));
+    } else {
+      emit(EN(conditional_forward<E>(entry)));
+    }
+  }
+  while (it != merged.end() && EK()(*it) < theta) emit(std::move(*it++));
+  std::swap(merged, buffer);
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+void theta_union_base<EN, EK, P, S, CS, A>::sort_distinct(std::vector<EN, A>& entries, uint64_t theta) const {
+  // theta may have dropped since the entries were pended
+  entries.erase(std::remove_if(entries.begin(), entries.end(),
+      [theta](const EN& entry) { return EK()(entry) >= theta; }), entries.end());
+  if (entries.empty()) return;
+  sort_by_key(entries, std::is_same<EN, uint64_t>());
+  auto last = entries.begin();
+  for (auto it = entries.begin() + 1; it != entries.end(); ++it) {
+    if (EK()(*it) == EK()(*last)) {
+      policy_(*last, std::move(*it));
+    } else if (++last != it) {
+      *last = std::move(*it);
+    }
+  }
+  entries.erase(last + 1, entries.end());
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+void theta_union_base<EN, EK, P, S, CS, A>::sort_by_key(std::vector<EN, A>& entries, std::false_type) {
+  std::sort(entries.begin(), entries.end(), comparator());
+}
+
+// LSD radix sort of the hashes, one byte per pass, skipping the passes over a byte that all
+// of them share, which for hashes below a small theta are the high ones.
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+void theta_union_base<EN, EK, P, S, CS, A>::sort_by_key(std::vector<EN, A>& entries, std::true_type) {
+  const size_t size = entries.size();
+  std::vector<uint64_t, A> scratch(size, 0, entries.get_allocator());
+  uint64_t* src = entries.data();
+  uint64_t* dst = scratch.data();
+  size_t counts[sizeof(uint64_t)][256] = {};
+  for (size_t i = 0; i < size; ++i) {
+    for (unsigned pass = 0; pass < sizeof(uint64_t); ++pass) counts[pass][(src[i] >> (8 * pass)) & 0xff]++;
+  }
+  for (unsigned pass = 0; pass < sizeof(uint64_t); ++pass) {
+    const unsigned shift = 8 * pass;
+    size_t* count = counts[pass];
+    if (count[(src[0] >> shift) & 0xff] == size) continue;
+    size_t offset = 0;
+    for (unsigned byte = 0; byte < 256; ++byte) {
+      const size_t c = count[byte];
+      count[byte] = offset;
+      offset += c;
+    }
+    for (size_t i = 0; i < size; ++i) dst[count[(src[i] >> shift) & 0xff]++] = src[i];
+    std::swap(src, dst);
+  }
+  if (src != entries.data()) std::copy(src, src + size, entries.data());
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+void theta_union_base<EN, EK, P, S, CS, A>::spill_merged() {
+  for (auto& entry: merged_) {
+    auto result = table_.find(EK()(entry));
+    table_.insert(result.first, std::move(entry));
+  }
+  merged_.clear();
+  merging_ = false;
 }
 
 template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
 CS theta_union_base<EN, EK, P, S, CS, A>::get_result(bool ordered) const {
   std::vector<EN, A> entries(table_.allocator_);
   if (table_.is_empty_) return CS(true, true, compute_seed_hash(table_.seed_), union_theta_, std::move(entries));
+  // the merged entries are already sorted, so the result is ordered either way
+  if (merging_ && pending_.empty()) return CS(false, true, compute_seed_hash(table_.seed_), union_theta_, std::vector<EN, A>(merged_));
+  if (merging_) {
+    // merge copies of the pending entries into a copy of the merged ones, leaving both as they are
+    std::vector<EN, A> pending(pending_);
+    uint64_t theta = union_theta_;
+    sort_distinct(pending, theta);
+    std::vector<EN, A> merged(merged_);
+    merge_sorted(std::move(pending), pending.size(), merged, entries, theta);
+    return CS(false, true, compute_seed_hash(table_.seed_), theta, std::move(merged));
+  }
   entries.reserve(table_.num_entries_);
   uint64_t theta = std::min(union_theta_, table_.theta_);
   const uint32_t nominal_num = 1 << table_.lg_nom_size_;
-  if (union_theta_ >= theta && table_.num_entries_ <= nominal_num) {
-    std::copy_if(table_.begin(), table_.end(), std::back_inserter(entries), key_not_zero<EN, EK>());
-  } else {
-    std::copy_if(table_.begin(), table_.end(), std::back_inserter(entries), key_not_zero_less_than<uint64_t, EN, EK>(theta));
-    if (entries.size() > nominal_num) {
-      std::nth_element(entries.begin(), entries.begin() + nominal_num, entries.end(), comparator());
-      theta = EK()(entries[nominal_num]);
-      entries.erase(entries.begin() + nominal_num, entries.end());
-      entries.shrink_to_fit();
-    }
+  // entries inserted before an input lowered union_theta_ may be above it
+  std::copy_if(table_.begin(), table_.end(), std::back_inserter(entries), key_not_zero_less_than<uint64_t, EN, EK>(theta));
+  if (entries.size() > nominal_num) {
+    std::nth_element(entries.begin(), entries.begin() + nominal_num, entries.end(), comparator());
+    theta = EK()(entries[nominal_num]);
+    entries.erase(entries.begin() + nominal_num, entries.end());
+    entries.shrink_to_fit();
   }
   if (ordered) std::sort(entries.begin(), entries.end(), comparator());
   return CS(table_.is_empty_, ordered, compute_seed_hash(table_.seed_), theta, std::move(entries));
 }
 
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+CS theta_union_base<EN, EK, P, S, CS, A>::take_result(bool ordered) {
+  if (merging_) merge_pending();
+  CS result = merging_ && !table_.is_empty_
+    ? CS(false, true, compute_seed_hash(table_.seed_), union_theta_, std::move(merged_))
+    : get_result(ordered);
+  reset();
+  return result;
+}
+
+template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
+void theta_union_base<EN, EK, P, S, CS, A>::reset() {
+  table_.reset();
+  union_theta_ = table_.theta_;
+  merging_ = true;
+  merged_.clear();
+  pending_.clear();
+}
+
 template<typename EN, typename EK, typename P, typename S, typename CS, typename A>
 const P& theta_union_base<EN, EK, P, S, CS, A>::get_policy() const {
   return policy_;
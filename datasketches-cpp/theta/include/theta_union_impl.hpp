@@ -38,6 +38,16 @@ auto theta_union_alloc<A>::get_result(bool ordered) const -> CompactSketch {
   return state_.get_result(ordered);
 }
 
+template<typename A>
+auto theta_union_alloc<A>::take_result(bool ordered) -> CompactSketch {
+  return state_.take_result(ordered);
+}
+
+template<typename A>
+void theta_union_alloc<A>::reset() {
+  state_.reset();
+}
+
 template<typename A>
 theta_union_alloc<A>::builder::builder(const A& allocator): theta_base_builder<builder, A>(allocator) {}
 
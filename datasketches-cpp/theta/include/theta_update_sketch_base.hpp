@@ -23,11 +23,15 @@
 #include <vector>
 #include <climits>
 #include <cmath>
+#include <type_traits>
+#include <utility>
 
 #include "common_defs.hpp"
 #include "MurmurHash3.h"
+#include "MurmurHash3_batch.h"
 #include "theta_comparators.hpp"
 #include "theta_constants.hpp"
+#include "theta_screen_ops.hpp"
 
 namespace datasketches {
 
@@ -51,6 +55,11 @@ struct theta_update_sketch_base {
   using iterator = Entry*;
 
   inline uint64_t hash_and_screen(const void* data, size_t length);
+  inline uint64_t screen(uint64_t hash);
+  // screens n hashes at once, copying the ones screen() would pass (other than 0) to survivors
+  inline size_t screen_block(const uint64_t* hashes, size_t n, uint64_t* survivors);
+  // asks for the first slot find() will probe for the key to be brought into the cache
+  inline void prefetch(uint64_t key) const;
 
   inline std::pair<iterator, bool> find(uint64_t key) const;
   static inline std::pair<iterator, bool> find(Entry* entries, uint8_t lg_size, uint64_t key);
@@ -59,6 +68,12 @@ struct theta_update_sketch_base {
   template<typename FwdEntry>
   inline void insert(iterator it, FwdEntry&& entry);
 
+  // empties the table, keeping its current size, and restores the starting theta
+  void reset();
+
+  // heap bytes held by the table of entries
+  size_t get_memory_usage_bytes() const;
+
   iterator begin() const;
   iterator end() const;
 
@@ -77,13 +92,23 @@ struct theta_update_sketch_base {
   resize_factor rf_;
   uint32_t num_entries_;
   uint64_t theta_;
+  uint64_t starting_theta_;
   uint64_t seed_;
   Entry* entries_;
 
   void resize();
   void rebuild();
+  // rebuild() of a table of bare hashes, and of any other entries
+  void rebuild(std::true_type);
+  void rebuild(std::false_type);
   void trim();
 
+  // buckets of the histogram of hashes by their high bits that rebuild() of bare
+  // hashes finds the new theta in
+  static const uint8_t LG_REBUILD_BUCKETS = 11;
+  // survivors of a rebuild ahead of the one inserted whose probe slot is prefetched
+  static const size_t REBUILD_PREFETCH_DISTANCE = 16;
+
   static inline uint32_t get_capacity(uint8_t lg_cur_size, uint8_t lg_nom_size);
   static inline uint32_t get_stride(uint64_t key, uint8_t lg_size);
   static void consolidate_non_empty(Entry* entries, size_t size, size_t num);
@@ -137,12 +162,24 @@ public:
    */
   Derived& set_seed(uint64_t seed);
 
+  /**
+   * Set the expected number of distinct items, if known, so that the hash table starts
+   * at the size it would have grown to for them rather than growing through every
+   * resize on the way, each of which rehashes all entries. The table never starts
+   * larger than the sketch can grow, so an overestimate only costs memory up to that.
+   * The default of 0 means no expectation: the table starts small.
+   * @param n expected number of distinct items
+   * @return this builder
+   */
+  Derived& set_expected_n(uint64_t n);
+
 protected:
   Allocator allocator_;
   uint8_t lg_k_;
   resize_factor rf_;
   float p_;
   uint64_t seed_;
+  uint64_t expected_n_;
 
   uint64_t starting_theta() const;
   uint8_t starting_lg_size() const;
@@ -179,6 +216,43 @@ private:
   Key key;
 };
 
+// contiguous hashes
+
+// The hashes of a theta sketch as one array, for set operations to scan in place of the
+// sketch's iterators, which step over the empty slots of a hash table one at a time.
+// An update sketch's array is its hash table, in which 0 marks an empty slot.
+struct theta_hash_span {
+  const uint64_t* data;
+  size_t size;
+  const uint64_t* begin() const { return data; }
+  const uint64_t* end() const { return data + size; }
+};
+
+// whether Sketch has get_hash_span(), as the theta sketches other than wrapped ones do
+template<typename Sketch, typename = void>
+struct has_hash_span: std::false_type {};
+
+template<typename Sketch>
+struct has_hash_span<Sketch, decltype(void(std::declval<const Sketch&>().get_hash_span()))>: std::true_type {};
+
+template<typename Sketch>
+theta_hash_span scan_entries(Sketch&& sketch, std::true_type) {
+  return sketch.get_hash_span();
+}
+
+template<typename Sketch>
+Sketch&& scan_entries(Sketch&& sketch, std::false_type) {
+  return std::forward<Sketch>(sketch);
+}
+
+// what to range over for the entries of a sketch without empty slots, such as any ordered
+// one: its hash span where it has one, else the sketch itself
+template<typename Sketch>
+auto scan_entries(Sketch&& sketch)
+-> decltype(scan_entries(std::forward<Sketch>(sketch), has_hash_span<typename std::decay<Sketch>::type>())) {
+  return scan_entries(std::forward<Sketch>(sketch), has_hash_span<typename std::decay<Sketch>::type>());
+}
+
 // MurMur3 hash functions
 
 static inline uint64_t compute_hash(const void* data, size_t length, uint64_t seed) {
@@ -187,11 +261,20 @@ static inline uint64_t compute_hash(const void* data, size_t length, uint64_t se
   return (hashes.h1 >> 1); // Java implementation does unsigned shift >>> to make values positive
 }
 
+static inline uint64_t hash_from_state(const HashState& hashes) {
+  return (hashes.h1 >> 1); // same as compute_hash, for hashes computed in batches
+}
+
 // iterators
 
 template<typename Entry, typename ExtractKey>
-class theta_iterator: public std::iterator<std::input_iterator_tag, Entry> {
+class theta_iterator {
 public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = Entry;
+  using difference_type = std::ptrdiff_t;
+  using pointer = Entry*;
+  using reference = Entry&;
   theta_iterator(Entry* entries, uint32_t size, uint32_t index);
   theta_iterator& operator++();
   theta_iterator operator++(int);
@@ -206,8 +289,13 @@ private:
 };
 
 template<typename Entry, typename ExtractKey>
-class theta_const_iterator: public std::iterator<std::input_iterator_tag, Entry> {
+class theta_const_iterator {
 public:
+  using iterator_category = std::input_iterator_tag;
+  using value_type = Entry;
+  using difference_type = std::ptrdiff_t;
+  using pointer = Entry*;
+  using reference = Entry&;
   theta_const_iterator(const Entry* entries, uint32_t size, uint32_t index);
   theta_const_iterator& operator++();
   theta_const_iterator operator++(int);
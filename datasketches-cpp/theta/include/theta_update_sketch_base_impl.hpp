@@ -24,6 +24,9 @@
 #include <sstream>
 #include <algorithm>
 
+#include "count_zeros.hpp"
+#include "event_counters.hpp"
+
 namespace datasketches {
 
 template<typename EN, typename EK, typename A>
@@ -35,6 +38,7 @@ lg_nom_size_(lg_nom_size),
 rf_(rf),
 num_entries_(0),
 theta_(theta),
+starting_theta_(theta),
 seed_(seed),
 entries_(nullptr)
 {
@@ -54,6 +58,7 @@ lg_nom_size_(other.lg_nom_size_),
 rf_(other.rf_),
 num_entries_(other.num_entries_),
 theta_(other.theta_),
+starting_theta_(other.starting_theta_),
 seed_(other.seed_),
 entries_(nullptr)
 {
@@ -79,12 +84,18 @@ lg_nom_size_(other.lg_nom_size_),
 rf_(other.rf_),
 num_entries_(other.num_entries_),
 theta_(other.theta_),
+starting_theta_(other.starting_theta_),
 seed_(other.seed_),
 entries_(other.entries_)
 {
   other.entries_ = nullptr;
 }
 
+template<typename EN, typename EK, typename A>
+size_t theta_update_sketch_base<EN, EK, A>::get_memory_usage_bytes() const {
+  return entries_ == nullptr ? 0 : sizeof(EN) << lg_cur_size_;
+}
+
 template<typename EN, typename EK, typename A>
 theta_update_sketch_base<EN, EK, A>::~theta_update_sketch_base()
 {
@@ -107,6 +118,7 @@ theta_update_sketch_base<EN, EK, A>& theta_update_sketch_base<EN, EK, A>::operat
   std::swap(rf_, copy.rf_);
   std::swap(num_entries_, copy.num_entries_);
   std::swap(theta_, copy.theta_);
+  std::swap(starting_theta_, copy.starting_theta_);
   std::swap(seed_, copy.seed_);
   std::swap(entries_, copy.entries_);
   return *this;
@@ -121,6 +133,7 @@ theta_update_sketch_base<EN, EK, A>& theta_update_sketch_base<EN, EK, A>::operat
   std::swap(rf_, other.rf_);
   std::swap(num_entries_, other.num_entries_);
   std::swap(theta_, other.theta_);
+  std::swap(starting_theta_, other.starting_theta_);
   std::swap(seed_, other.seed_);
   std::swap(entries_, other.entries_);
   return *this;
@@ -128,12 +141,32 @@ theta_update_sketch_base<EN, EK, A>& theta_update_sketch_base<EN, EK, A>::operat
 
 template<typename EN, typename EK, typename A>
 uint64_t theta_update_sketch_base<EN, EK, A>::hash_and_screen(const void* data, size_t length) {
+  return screen(compute_hash(data, length, seed_));
+}
+
+template<typename EN, typename EK, typename A>
+uint64_t theta_update_sketch_base<EN, EK, A>::screen(uint64_t hash) {
   is_empty_ = false;
-  const uint64_t hash = compute_hash(data, length, seed_);
   if (hash >= theta_) return 0; // hash == 0 is reserved to mark empty slots in the table
   return hash;
 }
 
+template<typename EN, typename EK, typename A>
+size_t theta_update_sketch_base<EN, EK, A>::screen_block(const uint64_t* hashes, size_t n, uint64_t* survivors) {
+  if (n > 0) is_empty_ = false;
+  return screen_hashes(hashes, n, theta_, survivors);
+}
+
+template<typename EN, typename EK, typename A>
+void theta_update_sketch_base<EN, EK, A>::prefetch(uint64_t key) const {
+#if defined(__GNUC__)
+  const uint32_t mask = (1 << lg_cur_size_) - 1;
+  __builtin_prefetch(&entries_[static_cast<uint32_t>(key) & mask]);
+#else
+  unused(key);
+#endif
+}
+
 template<typename EN, typename EK, typename A>
 auto theta_update_sketch_base<EN, EK, A>::find(uint64_t key) const -> std::pair<iterator, bool> {
   return find(entries_, lg_cur_size_, key);
@@ -197,6 +230,7 @@ uint32_t theta_update_sketch_base<EN, EK, A>::get_stride(uint64_t key, uint8_t l
 
 template<typename EN, typename EK, typename A>
 void theta_update_sketch_base<EN, EK, A>::resize() {
+  DATASKETCHES_COUNT_EVENT(THETA_RESIZE);
   const size_t old_size = 1ULL << lg_cur_size_;
   const uint8_t lg_new_size = std::min<uint8_t>(lg_cur_size_ + static_cast<uint8_t>(rf_), lg_nom_size_ + 1);
   const size_t new_size = 1ULL << lg_new_size;
@@ -219,6 +253,55 @@ void theta_update_sketch_base<EN, EK, A>::resize() {
 // assumes number of entries > nominal size
 template<typename EN, typename EK, typename A>
 void theta_update_sketch_base<EN, EK, A>::rebuild() {
+  DATASKETCHES_COUNT_EVENT(THETA_REBUILD);
+  rebuild(std::is_same<EN, uint64_t>());
+}
+
+// Rather than nth_element() over every hash, this counts the hashes by their
+// high bits, finds the bucket the new theta falls in from the counts, and only
+// selects it among the hashes of that bucket, about 2^-LG_REBUILD_BUCKETS of
+// them. The survivors below it are then screened to the front of the old table
+// with the SIMD kernels of the batched updates, and inserted into the new one
+// with their probe slots prefetched ahead.
+template<typename EN, typename EK, typename A>
+void theta_update_sketch_base<EN, EK, A>::rebuild(std::true_type) {
+  const size_t size = 1ULL << lg_cur_size_;
+  const uint32_t nominal_size = 1 << lg_nom_size_;
+
+  // every hash is below theta_, so its top bits index a bucket; empty slots
+  // fall in bucket 0 but are not counted
+  const uint8_t bits = 64 - count_leading_zeros_in_u64(theta_);
+  const uint8_t shift = bits > LG_REBUILD_BUCKETS ? bits - LG_REBUILD_BUCKETS : 0;
+  uint32_t counts[1 << LG_REBUILD_BUCKETS] = {};
+  for (size_t i = 0; i < size; ++i) counts[entries_[i] >> shift] += entries_[i] != 0;
+  // the new theta is the hash of rank nominal_size, in the bucket where the
+  // running count passes it
+  uint64_t bucket = 0;
+  uint32_t below = 0;
+  while (below + counts[bucket] <= nominal_size) below += counts[bucket++];
+  std::vector<uint64_t, A> candidates(allocator_);
+  candidates.reserve(counts[bucket]);
+  for (size_t i = 0; i < size; ++i) {
+    if (entries_[i] != 0 && entries_[i] >> shift == bucket) candidates.push_back(entries_[i]);
+  }
+  std::nth_element(candidates.begin(), candidates.begin() + (nominal_size - below), candidates.end());
+  this->theta_ = candidates[nominal_size - below];
+
+  // screening in place is safe, as each survivor is written at or before where it was read
+  uint64_t* old_entries = entries_;
+  const size_t num_survivors = screen_hashes(old_entries, size, theta_, old_entries);
+  entries_ = allocator_.allocate(size);
+  std::fill(entries_, entries_ + size, 0);
+  num_entries_ = static_cast<uint32_t>(num_survivors);
+  for (size_t i = 0; i < num_survivors; ++i) {
+    if (i + REBUILD_PREFETCH_DISTANCE < num_survivors) prefetch(old_entries[i + REBUILD_PREFETCH_DISTANCE]);
+    *find(old_entries[i]).first = old_entries[i];
+  }
+  allocator_.deallocate(old_entries, size);
+}
+
+template<typename EN, typename EK, typename A>
+void theta_update_sketch_base<EN, EK, A>::rebuild(std::false_type) {
   const size_t size = 1ULL << lg_cur_size_;
   const uint32_t nominal_size = 1 << lg_nom_size_;
 
@@ -242,6 +325,22 @@ void theta_update_sketch_base<EN, EK, A>::rebuild() {
   allocator_.deallocate(old_entries, size);
 }
 
+template<typename EN, typename EK, typename A>
+void theta_update_sketch_base<EN, EK, A>::reset() {
+  if (entries_ != nullptr) {
+    const size_t size = 1ULL << lg_cur_size_;
+    for (size_t i = 0; i < size; ++i) {
+      if (EK()(entries_[i]) != 0) {
+        entries_[i].~EN();
+        EK()(entries_[i]) = 0;
+      }
+    }
+  }
+  is_empty_ = true;
+  num_entries_ = 0;
+  theta_ = starting_theta_;
+}
+
 template<typename EN, typename EK, typename A>
 void theta_update_sketch_base<EN, EK, A>::trim() {
   if (num_entries_ > static_cast<uint32_t>(1 << lg_nom_size_)) rebuild();
@@ -271,7 +370,7 @@ void theta_update_sketch_base<EN, EK, A>::consolidate_non_empty(EN* entries, siz
 
 template<typename Derived, typename Allocator>
 theta_base_builder<Derived, Allocator>::theta_base_builder(const Allocator& allocator):
-allocator_(allocator), lg_k_(DEFAULT_LG_K), rf_(DEFAULT_RESIZE_FACTOR), p_(1), seed_(DEFAULT_SEED) {}
+allocator_(allocator), lg_k_(DEFAULT_LG_K), rf_(DEFAULT_RESIZE_FACTOR), p_(1), seed_(DEFAULT_SEED), expected_n_(0) {}
 
 template<typename Derived, typename Allocator>
 Derived& theta_base_builder<Derived, Allocator>::set_lg_k(uint8_t lg_k) {
@@ -304,6 +403,12 @@ Derived& theta_base_builder<Derived, Allocator>::set_seed(uint64_t seed) {
   return static_cast<Derived&>(*this);
 }
 
+template<typename Derived, typename Allocator>
+Derived& theta_base_builder<Derived, Allocator>::set_expected_n(uint64_t n) {
+  expected_n_ = n;
+  return static_cast<Derived&>(*this);
+}
+
 template<typename Derived, typename Allocator>
 uint64_t theta_base_builder<Derived, Allocator>::starting_theta() const {
   if (p_ < 1) return static_cast<uint64_t>(theta_constants::MAX_THETA * p_);
@@ -312,7 +417,12 @@ uint64_t theta_base_builder<Derived, Allocator>::starting_theta() const {
 
 template<typename Derived, typename Allocator>
 uint8_t theta_base_builder<Derived, Allocator>::starting_lg_size() const {
-  return starting_sub_multiple(lg_k_ + 1, MIN_LG_K, static_cast<uint8_t>(rf_));
+  uint8_t lg_size = starting_sub_multiple(lg_k_ + 1, MIN_LG_K, static_cast<uint8_t>(rf_));
+  // only a fraction p of the items is ever inserted, and a table below the
+  // nominal size grows once over half full
+  const double expected_entries = static_cast<double>(expected_n_) * p_;
+  while (lg_size < lg_k_ + 1 && static_cast<double>(1ULL << lg_size) / 2 < expected_entries) ++lg_size;
+  return lg_size;
 }
 
 template<typename Derived, typename Allocator>
@@ -0,0 +1,251 @@
+#include <cstdint>
+#include <vector>
+#include <memory>
+#include <stdexcept>
+
+#include "rust/cxx.h"
+#include "dsrs/src/bridge.rs.h"
+
+#include "tuple/include/array_of_doubles_sketch.hpp"
+#include "tuple/include/array_of_doubles_union.hpp"
+#include "tuple/include/array_of_doubles_intersection.hpp"
+#include "tuple/include/array_of_doubles_columns.hpp"
+#include "tuple/include/fixed_doubles_sketch.hpp"
+#include "tuple.hpp"
+
+class OpaqueAodSketch::table {
+public:
+  virtual ~table() = default;
+  virtual double estimate() const = 0;
+  virtual void update(const void* key, size_t length, const double* values) = 0;
+  virtual void update(uint64_t key, const double* values) = 0;
+  virtual datasketches::compact_array_of_doubles_sketch compact() const = 0;
+};
+
+template<uint8_t N>
+class OpaqueAodSketch::fixed_table: public OpaqueAodSketch::table {
+public:
+  explicit fixed_table(uint64_t expected_n):
+    sketch_{typename datasketches::update_fixed_doubles_sketch<N>::builder().set_expected_n(expected_n).build()} {
+  }
+  double estimate() const { return sketch_.get_estimate(); }
+  void update(const void* key, size_t length, const double* values) { sketch_.update(key, length, values); }
+  void update(uint64_t key, const double* values) { sketch_.update(key, values); }
+  datasketches::compact_array_of_doubles_sketch compact() const {
+    return datasketches::to_array_of_doubles<N, std::allocator<double>>(sketch_);
+  }
+private:
+  datasketches::update_fixed_doubles_sketch<N> sketch_;
+};
+
+class OpaqueAodSketch::aod_table: public OpaqueAodSketch::table {
+public:
+  aod_table(uint8_t num_values, uint64_t expected_n):
+    sketch_{datasketches::update_array_of_doubles_sketch::builder{datasketches::array_of_doubles_update_policy<>(num_values)}.set_expected_n(expected_n).build()} {
+  }
+  double estimate() const { return sketch_.get_estimate(); }
+  void update(const void* key, size_t length, const double* values) { sketch_.update(key, length, values); }
+  void update(uint64_t key, const double* values) { sketch_.update(key, values); }
+  datasketches::compact_array_of_doubles_sketch compact() const { return sketch_.compact(); }
+private:
+  datasketches::update_array_of_doubles_sketch sketch_;
+};
+
+OpaqueAodSketch::~OpaqueAodSketch() = default;
+
+double OpaqueAodSketch::estimate() const {
+  return this->inner_->estimate();
+}
+
+void OpaqueAodSketch::update(rust::Slice<const uint8_t> buf, rust::Slice<const double> values) {
+  this->inner_->update(buf.data(), buf.size(), values.data());
+}
+
+void OpaqueAodSketch::update_u64(uint64_t value, rust::Slice<const double> values) {
+  this->inner_->update(value, values.data());
+}
+
+std::unique_ptr<OpaqueStaticAodSketch> OpaqueAodSketch::as_static() const {
+  return std::unique_ptr<OpaqueStaticAodSketch>(new OpaqueStaticAodSketch{this->inner_->compact()});
+}
+
+OpaqueAodSketch::OpaqueAodSketch(uint8_t num_values, uint64_t expected_n) {
+  static_assert(MAX_FIXED_VALUES == 4, "a fixed_table for each number of values up to MAX_FIXED_VALUES");
+  switch (num_values) {
+    case 1: inner_.reset(new fixed_table<1>(expected_n)); break;
+    case 2: inner_.reset(new fixed_table<2>(expected_n)); break;
+    case 3: inner_.reset(new fixed_table<3>(expected_n)); break;
+    case 4: inner_.reset(new fixed_table<4>(expected_n)); break;
+    default: inner_.reset(new aod_table(num_values, expected_n));
+  }
+}
+
+std::unique_ptr<OpaqueAodSketch> new_opaque_aod_sketch(uint8_t num_values, uint64_t expected_n) {
+  return std::unique_ptr<OpaqueAodSketch>(new OpaqueAodSketch{num_values, expected_n});
+}
+
+OpaqueStaticAodSketch::OpaqueStaticAodSketch(datasketches::compact_array_of_doubles_sketch&& aod):
+  inner_{std::move(aod)} {
+}
+
+double OpaqueStaticAodSketch::estimate() const {
+  return this->inner_.get_estimate();
+}
+
+uint8_t OpaqueStaticAodSketch::num_values() const {
+  return this->inner_.get_num_values();
+}
+
+std::unique_ptr<std::vector<double>> OpaqueStaticAodSketch::estimate_sums() const {
+  std::unique_ptr<std::vector<double>> sums(new std::vector<double>(this->inner_.get_num_values()));
+  for (const auto& entry: this->inner_) {
+    for (uint8_t i = 0; i < entry.second.size(); ++i) (*sums)[i] += entry.second[i];
+  }
+  const double theta = this->inner_.get_theta();
+  for (double& sum: *sums) sum /= theta;
+  return sums;
+}
+
+std::unique_ptr<OpaqueStaticAodSketch> OpaqueStaticAodSketch::clone() const {
+  auto copy = this->inner_;
+  return std::unique_ptr<OpaqueStaticAodSketch>(new OpaqueStaticAodSketch{std::move(copy)});
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueStaticAodSketch::serialize() const {
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(std::move(v)));
+}
+
+std::unique_ptr<OpaqueAodColumns> OpaqueStaticAodSketch::to_columns() const {
+  return std::unique_ptr<OpaqueAodColumns>(new OpaqueAodColumns{datasketches::array_of_doubles_columns{this->inner_}});
+}
+
+std::unique_ptr<OpaqueStaticAodSketch> deserialize_opaque_static_aod_sketch(rust::Slice<const uint8_t> buf) {
+  auto aod = datasketches::compact_array_of_doubles_sketch::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueStaticAodSketch>(new OpaqueStaticAodSketch{std::move(aod)});
+}
+
+OpaqueAodUnion::OpaqueAodUnion(uint8_t num_values):
+  inner_{datasketches::array_of_doubles_union::builder{datasketches::array_of_doubles_union_policy(num_values)}.build()} {
+}
+
+std::unique_ptr<OpaqueStaticAodSketch> OpaqueAodUnion::sketch() const {
+  return std::unique_ptr<OpaqueStaticAodSketch>(new OpaqueStaticAodSketch{this->inner_.get_result()});
+}
+
+void OpaqueAodUnion::union_with(std::unique_ptr<OpaqueStaticAodSketch> to_union) {
+  this->inner_.update(std::move(to_union->inner_));
+}
+
+std::unique_ptr<OpaqueAodUnion> new_opaque_aod_union(uint8_t num_values) {
+  return std::unique_ptr<OpaqueAodUnion>(new OpaqueAodUnion{num_values});
+}
+
+OpaqueAodIntersection::OpaqueAodIntersection(uint8_t num_values):
+  inner_{datasketches::DEFAULT_SEED, datasketches::array_of_doubles_union_policy(num_values)} {
+}
+
+std::unique_ptr<OpaqueStaticAodSketch> OpaqueAodIntersection::sketch() const {
+  if (!this->inner_.has_result()) {
+    return std::unique_ptr<OpaqueStaticAodSketch>(nullptr);
+  }
+  return std::unique_ptr<OpaqueStaticAodSketch>(new OpaqueStaticAodSketch{this->inner_.get_result()});
+}
+
+void OpaqueAodIntersection::intersect_with(std::unique_ptr<OpaqueStaticAodSketch> to_intersect) {
+  this->inner_.update(std::move(to_intersect->inner_));
+}
+
+std::unique_ptr<OpaqueAodIntersection> new_opaque_aod_intersection(uint8_t num_values) {
+  return std::unique_ptr<OpaqueAodIntersection>(new OpaqueAodIntersection{num_values});
+}
+
+OpaqueAodColumns::OpaqueAodColumns(datasketches::array_of_doubles_columns&& columns):
+  inner_{std::move(columns)} {
+}
+
+double OpaqueAodColumns::estimate() const {
+  return this->inner_.get_estimate();
+}
+
+uint8_t OpaqueAodColumns::num_values() const {
+  return this->inner_.get_num_values();
+}
+
+rust::Slice<const uint64_t> OpaqueAodColumns::hashes() const {
+  return rust::Slice<const uint64_t>(this->inner_.get_hashes(), this->inner_.get_num_retained());
+}
+
+rust::Slice<const double> OpaqueAodColumns::column(uint8_t index) const {
+  return rust::Slice<const double>(this->inner_.get_column(index), this->inner_.get_num_retained());
+}
+
+std::unique_ptr<std::vector<double>> OpaqueAodColumns::estimate_sums() const {
+  auto sums = this->inner_.get_column_sums();
+  const double theta = this->inner_.get_theta();
+  for (double& sum: sums) sum /= theta;
+  return std::unique_ptr<std::vector<double>>(new std::vector<double>(std::move(sums)));
+}
+
+std::unique_ptr<OpaqueStaticAodSketch> OpaqueAodColumns::to_sketch() const {
+  return std::unique_ptr<OpaqueStaticAodSketch>(new OpaqueStaticAodSketch{this->inner_.to_compact()});
+}
+
+std::unique_ptr<OpaqueAodColumns> OpaqueAodColumns::clone() const {
+  auto copy = this->inner_;
+  return std::unique_ptr<OpaqueAodColumns>(new OpaqueAodColumns{std::move(copy)});
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueAodColumns::serialize() const {
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(std::move(v)));
+}
+
+std::unique_ptr<OpaqueAodColumns> deserialize_opaque_aod_columns(rust::Slice<const uint8_t> buf) {
+  auto columns = datasketches::array_of_doubles_columns::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueAodColumns>(new OpaqueAodColumns{std::move(columns)});
+}
+
+static datasketches::columns_combine to_columns_combine(AodCombine combine) {
+  switch (combine) {
+    case AodCombine::Sum: return datasketches::columns_combine::SUM;
+    case AodCombine::Min: return datasketches::columns_combine::MIN;
+    case AodCombine::Max: return datasketches::columns_combine::MAX;
+  }
+  throw std::invalid_argument("unknown combine");
+}
+
+OpaqueAodColumnsUnion::OpaqueAodColumnsUnion(uint8_t num_values, AodCombine combine):
+  inner_{num_values, to_columns_combine(combine)} {
+}
+
+std::unique_ptr<OpaqueAodColumns> OpaqueAodColumnsUnion::sketch() const {
+  return std::unique_ptr<OpaqueAodColumns>(new OpaqueAodColumns{this->inner_.get_result()});
+}
+
+void OpaqueAodColumnsUnion::union_with(const OpaqueAodColumns& to_union) {
+  this->inner_.update(to_union.inner_);
+}
+
+std::unique_ptr<OpaqueAodColumnsUnion> new_opaque_aod_columns_union(uint8_t num_values, AodCombine combine) {
+  return std::unique_ptr<OpaqueAodColumnsUnion>(new OpaqueAodColumnsUnion{num_values, combine});
+}
+
+OpaqueAodColumnsIntersection::OpaqueAodColumnsIntersection(uint8_t num_values, AodCombine combine):
+  inner_{num_values, to_columns_combine(combine)} {
+}
+
+std::unique_ptr<OpaqueAodColumns> OpaqueAodColumnsIntersection::sketch() const {
+  if (!this->inner_.has_result()) {
+    return std::unique_ptr<OpaqueAodColumns>(nullptr);
+  }
+  return std::unique_ptr<OpaqueAodColumns>(new OpaqueAodColumns{this->inner_.get_result()});
+}
+
+void OpaqueAodColumnsIntersection::intersect_with(const OpaqueAodColumns& to_intersect) {
+  this->inner_.update(to_intersect.inner_);
+}
+
+std::unique_ptr<OpaqueAodColumnsIntersection> new_opaque_aod_columns_intersection(uint8_t num_values, AodCombine combine) {
+  return std::unique_ptr<OpaqueAodColumnsIntersection>(new OpaqueAodColumnsIntersection{num_values, combine});
+}
@@ -0,0 +1,146 @@
+#pragma once
+
+#include <cstdint>
+#include <vector>
+#include <memory>
+
+#include "rust/cxx.h"
+
+#include "tuple/include/array_of_doubles_sketch.hpp"
+#include "tuple/include/array_of_doubles_union.hpp"
+#include "tuple/include/array_of_doubles_intersection.hpp"
+#include "tuple/include/array_of_doubles_columns.hpp"
+
+enum class AodCombine : uint8_t;
+
+class OpaqueStaticAodSketch;
+class OpaqueAodColumns;
+
+// A theta sketch whose retained keys each carry an array of num_values doubles,
+// which sum the values the key was updated with.
+class OpaqueAodSketch {
+public:
+  ~OpaqueAodSketch();
+  double estimate() const;
+  // values must hold one double for each of the sketch's num_values.
+  void update(rust::Slice<const uint8_t> buf, rust::Slice<const double> values);
+  void update_u64(uint64_t value, rust::Slice<const double> values);
+  std::unique_ptr<OpaqueStaticAodSketch> as_static() const;
+private:
+  // The sketch being updated, which keeps summaries of up to MAX_FIXED_VALUES doubles
+  // inline in its table, and only larger ones as separately allocated arrays.
+  class table;
+  template<uint8_t N> class fixed_table;
+  class aod_table;
+  static const uint8_t MAX_FIXED_VALUES = 4;
+  OpaqueAodSketch(uint8_t num_values, uint64_t expected_n);
+  friend std::unique_ptr<OpaqueAodSketch> new_opaque_aod_sketch(uint8_t num_values, uint64_t expected_n);
+  std::unique_ptr<table> inner_;
+};
+
+// A nonzero expected_n sizes the hash table for that many distinct values up
+// front, as for new_opaque_theta_sketch.
+std::unique_ptr<OpaqueAodSketch> new_opaque_aod_sketch(uint8_t num_values, uint64_t expected_n);
+
+class OpaqueStaticAodSketch {
+public:
+  double estimate() const;
+  uint8_t num_values() const;
+  // The estimated sum of each value over the whole stream, i.e., the retained
+  // sums scaled up by 1 / theta.
+  std::unique_ptr<std::vector<double>> estimate_sums() const;
+  std::unique_ptr<OpaqueStaticAodSketch> clone() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize() const;
+  std::unique_ptr<OpaqueAodColumns> to_columns() const;
+private:
+  OpaqueStaticAodSketch(datasketches::compact_array_of_doubles_sketch&& aod);
+  friend std::unique_ptr<OpaqueStaticAodSketch> deserialize_opaque_static_aod_sketch(rust::Slice<const uint8_t> buf);
+  friend class OpaqueAodSketch;
+  friend class OpaqueAodUnion;
+  friend class OpaqueAodIntersection;
+  friend class OpaqueAodColumns;
+  datasketches::compact_array_of_doubles_sketch inner_;
+};
+
+std::unique_ptr<OpaqueStaticAodSketch> deserialize_opaque_static_aod_sketch(rust::Slice<const uint8_t> buf);
+
+// Values of keys in more than one input are summed.
+class OpaqueAodUnion {
+public:
+  std::unique_ptr<OpaqueStaticAodSketch> sketch() const;
+  void union_with(std::unique_ptr<OpaqueStaticAodSketch> to_union);
+private:
+  OpaqueAodUnion(uint8_t num_values);
+  friend std::unique_ptr<OpaqueAodUnion> new_opaque_aod_union(uint8_t num_values);
+  datasketches::array_of_doubles_union inner_;
+};
+
+std::unique_ptr<OpaqueAodUnion> new_opaque_aod_union(uint8_t num_values);
+
+// Values of the keys in common are summed, as in a union.
+class OpaqueAodIntersection {
+public:
+  // Null if the intersection is over an empty collection, i.e., the sketch
+  // implicitly represents the full universe of items.
+  std::unique_ptr<OpaqueStaticAodSketch> sketch() const;
+  void intersect_with(std::unique_ptr<OpaqueStaticAodSketch> to_intersect);
+private:
+  OpaqueAodIntersection(uint8_t num_values);
+  friend std::unique_ptr<OpaqueAodIntersection> new_opaque_aod_intersection(uint8_t num_values);
+  datasketches::array_of_doubles_intersection<datasketches::array_of_doubles_union_policy> inner_;
+};
+
+std::unique_ptr<OpaqueAodIntersection> new_opaque_aod_intersection(uint8_t num_values);
+
+// The same sketch as OpaqueStaticAodSketch, with its hashes and each of its values in
+// columns of their own, which serializes the same way.
+class OpaqueAodColumns {
+public:
+  double estimate() const;
+  uint8_t num_values() const;
+  rust::Slice<const uint64_t> hashes() const;
+  // index must be less than num_values.
+  rust::Slice<const double> column(uint8_t index) const;
+  std::unique_ptr<std::vector<double>> estimate_sums() const;
+  std::unique_ptr<OpaqueStaticAodSketch> to_sketch() const;
+  std::unique_ptr<OpaqueAodColumns> clone() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize() const;
+private:
+  OpaqueAodColumns(datasketches::array_of_doubles_columns&& columns);
+  friend std::unique_ptr<OpaqueAodColumns> deserialize_opaque_aod_columns(rust::Slice<const uint8_t> buf);
+  friend class OpaqueStaticAodSketch;
+  friend class OpaqueAodColumnsUnion;
+  friend class OpaqueAodColumnsIntersection;
+  datasketches::array_of_doubles_columns inner_;
+};
+
+std::unique_ptr<OpaqueAodColumns> deserialize_opaque_aod_columns(rust::Slice<const uint8_t> buf);
+
+// Equivalent to OpaqueAodUnion, but over columns, whose values of keys in more than one
+// input are combined as combine says.
+class OpaqueAodColumnsUnion {
+public:
+  std::unique_ptr<OpaqueAodColumns> sketch() const;
+  void union_with(const OpaqueAodColumns& to_union);
+private:
+  OpaqueAodColumnsUnion(uint8_t num_values, AodCombine combine);
+  friend std::unique_ptr<OpaqueAodColumnsUnion> new_opaque_aod_columns_union(uint8_t num_values, AodCombine combine);
+  datasketches::array_of_doubles_columns_union inner_;
+};
+
+std::unique_ptr<OpaqueAodColumnsUnion> new_opaque_aod_columns_union(uint8_t num_values, AodCombine combine);
+
+// Equivalent to OpaqueAodIntersection, but over columns, whose values of the keys in common
+// are combined as combine says.
+class OpaqueAodColumnsIntersection {
+public:
+  // Null if the intersection is over an empty collection, as for OpaqueAodIntersection.
+  std::unique_ptr<OpaqueAodColumns> sketch() const;
+  void intersect_with(const OpaqueAodColumns& to_intersect);
+private:
+  OpaqueAodColumnsIntersection(uint8_t num_values, AodCombine combine);
+  friend std::unique_ptr<OpaqueAodColumnsIntersection> new_opaque_aod_columns_intersection(uint8_t num_values, AodCombine combine);
+  datasketches::array_of_doubles_columns_intersection inner_;
+};
+
+std::unique_ptr<OpaqueAodColumnsIntersection> new_opaque_aod_columns_intersection(uint8_t num_values, AodCombine combine);
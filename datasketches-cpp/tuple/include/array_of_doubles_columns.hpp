@@ -0,0 +1,190 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARRAY_OF_DOUBLES_COLUMNS_HPP_
+#define ARRAY_OF_DOUBLES_COLUMNS_HPP_
+
+#include <vector>
+#include <memory>
+
+#include "array_of_doubles_sketch.hpp"
+
+namespace datasketches {
+
+template<typename A> class array_of_doubles_columns_union_alloc;
+template<typename A> class array_of_doubles_columns_intersection_alloc;
+
+// how set operations over columns combine the values of a hash found in more than one input
+enum class columns_combine { SUM, MIN, MAX };
+
+/**
+ * A compact array of doubles sketch laid out as a structure of arrays: the sorted hashes
+ * in one column, and each of the values in a column of its own running parallel to them.
+ * compact_array_of_doubles_sketch keeps each entry's values in a separately allocated
+ * array, so scans over one value stride over all entries; here they are contiguous, and
+ * per-column aggregations and unions run over unit-stride arrays of doubles.
+ *
+ * The serialized form is that of an ordered compact_array_of_doubles_sketch, so either
+ * can deserialize the other.
+ */
+template<typename Allocator = std::allocator<double>>
+class array_of_doubles_columns_alloc {
+public:
+  using AllocU64 = typename std::allocator_traits<Allocator>::template rebind_alloc<uint64_t>;
+  using AllocU32 = typename std::allocator_traits<Allocator>::template rebind_alloc<uint32_t>;
+  using AllocBytes = typename std::allocator_traits<Allocator>::template rebind_alloc<uint8_t>;
+  using vector_bytes = std::vector<uint8_t, AllocBytes>;
+  using CompactSketch = compact_array_of_doubles_sketch_alloc<Allocator>;
+  using Flags = typename CompactSketch::flags;
+
+  explicit array_of_doubles_columns_alloc(const CompactSketch& sketch);
+
+  bool is_empty() const;
+  bool is_estimation_mode() const;
+  uint64_t get_theta64() const;
+  double get_theta() const;
+  double get_estimate() const;
+  uint32_t get_num_retained() const;
+  uint8_t get_num_values() const;
+  uint16_t get_seed_hash() const;
+
+  // the retained hashes in ascending order
+  const uint64_t* get_hashes() const;
+  // the values at the given index of the retained entries, parallel to get_hashes()
+  const double* get_column(uint8_t index) const;
+  // the sum of each column over the retained entries, unscaled by theta
+  std::vector<double, Allocator> get_column_sums() const;
+
+  CompactSketch to_compact() const;
+
+  vector_bytes serialize(unsigned header_size_bytes = 0) const;
+  static array_of_doubles_columns_alloc deserialize(const void* bytes, size_t size, uint64_t seed = DEFAULT_SEED,
+      const Allocator& allocator = Allocator());
+
+private:
+  array_of_doubles_columns_alloc(bool is_empty, uint16_t seed_hash, uint64_t theta, uint8_t num_values,
+      std::vector<uint64_t, AllocU64>&& hashes, std::vector<double, Allocator>&& values);
+  friend class array_of_doubles_columns_union_alloc<Allocator>;
+  friend class array_of_doubles_columns_intersection_alloc<Allocator>;
+
+  bool is_empty_;
+  uint16_t seed_hash_;
+  uint64_t theta_;
+  uint8_t num_values_;
+  std::vector<uint64_t, AllocU64> hashes_;
+  // column-major, num_values_ columns of hashes_.size() doubles each, and then a padding
+  // -0.0 ending each column, which unions add in for a hash missing from it
+  std::vector<double, Allocator> values_;
+};
+
+// alias with the default allocator for convenience
+using array_of_doubles_columns = array_of_doubles_columns_alloc<>;
+
+/**
+ * A union of array_of_doubles_columns, which combines the values of hashes in more than one
+ * input, summing them by default. Summing, its result matches that of an
+ * array_of_doubles_union given the same inputs as ordered compact sketches: each input is
+ * merged into the sorted state in one pass below the running theta, which becomes the
+ * (k+1)-th smallest hash once k hashes are held. The merge records where each hash came
+ * from, and then the values are combined one column at a time, without branches.
+ */
+template<typename Allocator = std::allocator<double>>
+class array_of_doubles_columns_union_alloc {
+public:
+  using Columns = array_of_doubles_columns_alloc<Allocator>;
+  using AllocU64 = typename Columns::AllocU64;
+  using AllocU32 = typename Columns::AllocU32;
+
+  // as for the union builders
+  static const uint8_t DEFAULT_LG_K = 12;
+
+  explicit array_of_doubles_columns_union_alloc(uint8_t num_values = 1, columns_combine combine = columns_combine::SUM,
+      uint8_t lg_k = DEFAULT_LG_K, uint64_t seed = DEFAULT_SEED, const Allocator& allocator = Allocator());
+
+  void update(const Columns& columns);
+  Columns get_result() const;
+  void reset();
+
+private:
+  uint8_t num_values_;
+  columns_combine combine_;
+  uint8_t lg_k_;
+  uint64_t seed_;
+  bool is_empty_;
+  uint64_t theta_;
+  // the sorted hashes below theta_, and their padded columns as in array_of_doubles_columns
+  std::vector<uint64_t, AllocU64> hashes_;
+  std::vector<double, Allocator> values_;
+  // scratch space for each merge, kept to reuse its memory
+  std::vector<uint64_t, AllocU64> merged_hashes_;
+  std::vector<double, Allocator> merged_values_;
+  std::vector<uint32_t, AllocU32> from_state_;
+  std::vector<uint32_t, AllocU32> from_input_;
+};
+
+// alias with the default allocator for convenience
+using array_of_doubles_columns_union = array_of_doubles_columns_union_alloc<>;
+
+/**
+ * An intersection of array_of_doubles_columns, which combines the values of the hashes in
+ * common, summing them by default, as an array_of_doubles_intersection with the union
+ * policy does. Each input is matched against the sorted state in one pass, recording the
+ * rows of each match on either side, and then the values are combined one column at a
+ * time as in the union.
+ */
+template<typename Allocator = std::allocator<double>>
+class array_of_doubles_columns_intersection_alloc {
+public:
+  using Columns = array_of_doubles_columns_alloc<Allocator>;
+  using AllocU64 = typename Columns::AllocU64;
+  using AllocU32 = typename Columns::AllocU32;
+
+  explicit array_of_doubles_columns_intersection_alloc(uint8_t num_values = 1, columns_combine combine = columns_combine::SUM,
+      uint64_t seed = DEFAULT_SEED, const Allocator& allocator = Allocator());
+
+  void update(const Columns& columns);
+  // whether there has been an update, before which the result would be the whole universe
+  bool has_result() const;
+  Columns get_result() const;
+
+private:
+  uint8_t num_values_;
+  columns_combine combine_;
+  uint64_t seed_;
+  bool is_valid_;
+  bool is_empty_;
+  uint64_t theta_;
+  // the sorted hashes in common so far, and their padded columns as in array_of_doubles_columns
+  std::vector<uint64_t, AllocU64> hashes_;
+  std::vector<double, Allocator> values_;
+  // scratch space for each update, kept to reuse its memory
+  std::vector<uint64_t, AllocU64> matched_hashes_;
+  std::vector<double, Allocator> matched_values_;
+  std::vector<uint32_t, AllocU32> from_state_;
+  std::vector<uint32_t, AllocU32> from_input_;
+};
+
+// alias with the default allocator for convenience
+using array_of_doubles_columns_intersection = array_of_doubles_columns_intersection_alloc<>;
+
+} /* namespace datasketches */
+
+#include "array_of_doubles_columns_impl.hpp"
+
+#endif
@@ -0,0 +1,499 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+#ifndef ARRAY_OF_DOUBLES_COLUMNS_IMPL_HPP_
+#define ARRAY_OF_DOUBLES_COLUMNS_IMPL_HPP_
+
+#include <algorithm>
+#include <limits>
+#include <numeric>
+#include <stdexcept>
+#include <string>
+
+#include "memory_operations.hpp"
+
+namespace datasketches {
+
+template<typename A>
+array_of_doubles_columns_alloc<A>::array_of_doubles_columns_alloc(bool is_empty, uint16_t seed_hash, uint64_t theta,
+    uint8_t num_values, std::vector<uint64_t, AllocU64>&& hashes, std::vector<double, A>&& values):
+is_empty_(is_empty),
+seed_hash_(seed_hash),
+theta_(theta),
+num_values_(num_values),
+hashes_(std::move(hashes)),
+values_(std::move(values))
+{}
+
+// Sorts the hashes and the rows of the columns with them.
+template<typename A, typename AllocU64, typename AllocU32>
+static void sort_columns(std::vector<uint64_t, AllocU64>& hashes, std::vector<double, A>& values, uint8_t num_values) {
+  const size_t n = hashes.size();
+  std::vector<uint32_t, AllocU32> order(n, 0, AllocU32(values.get_allocator()));
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&hashes](uint32_t a, uint32_t b) { return hashes[a] < hashes[b]; });
+  std::vector<uint64_t, AllocU64> sorted_hashes(n, 0, hashes.get_allocator());
+  for (size_t i = 0; i < n; ++i) sorted_hashes[i] = hashes[order[i]];
+  std::vector<double, A> sorted_values(values.size(), -0.0, values.get_allocator());
+  for (uint8_t c = 0; c < num_values; ++c) {
+    const double* column = values.data() + c * (n + 1);
+    double* sorted_column = sorted_values.data() + c * (n + 1);
+    for (size_t i = 0; i < n; ++i) sorted_column[i] = column[order[i]];
+  }
+  std::swap(hashes, sorted_hashes);
+  std::swap(values, sorted_values);
+}
+
+template<typename A>
+array_of_doubles_columns_alloc<A>::array_of_doubles_columns_alloc(const CompactSketch& sketch):
+is_empty_(sketch.is_empty()),
+seed_hash_(sketch.get_seed_hash()),
+theta_(sketch.get_theta64()),
+num_values_(sketch.get_num_values()),
+hashes_(sketch.get_num_retained(), 0, AllocU64(sketch.get_allocator())),
+values_((sketch.get_num_retained() + 1) * static_cast<size_t>(num_values_), -0.0, A(sketch.get_allocator()))
+{
+  const size_t n = hashes_.size();
+  size_t i = 0;
+  for (const auto& entry: sketch) {
+    hashes_[i] = entry.first;
+    for (uint8_t c = 0; c < num_values_; ++c) values_[c * (n + 1) + i] = entry.second[c];
+    ++i;
+  }
+  if (!sketch.is_ordered()) sort_columns<A, AllocU64, AllocU32>(hashes_, values_, num_values_);
+}
+
+template<typename A>
+bool array_of_doubles_columns_alloc<A>::is_empty() const {
+  return is_empty_;
+}
+
+template<typename A>
+bool array_of_doubles_columns_alloc<A>::is_estimation_mode() const {
+  return theta_ < theta_constants::MAX_THETA && !is_empty_;
+}
+
+template<typename A>
+uint64_t array_of_doubles_columns_alloc<A>::get_theta64() const {
+  return theta_;
+}
+
+template<typename A>
+double array_of_doubles_columns_alloc<A>::get_theta() const {
+  return static_cast<double>(theta_) / theta_constants::MAX_THETA;
+}
+
+template<typename A>
+double array_of_doubles_columns_alloc<A>::get_estimate() const {
+  return get_num_retained() / get_theta();
+}
+
+template<typename A>
+uint32_t array_of_doubles_columns_alloc<A>::get_num_retained() const {
+  return static_cast<uint32_t>(hashes_.size());
+}
+
+template<typename A>
+uint8_t array_of_doubles_columns_alloc<A>::get_num_values() const {
+  return num_values_;
+}
+
+template<typename A>
+uint16_t array_of_doubles_columns_alloc<A>::get_seed_hash() const {
+  return seed_hash_;
+}
+
+template<typename A>
+const uint64_t* array_of_doubles_columns_alloc<A>::get_hashes() const {
+  return hashes_.data();
+}
+
+template<typename A>
+const double* array_of_doubles_columns_alloc<A>::get_column(uint8_t index) const {
+  return values_.data() + index * (hashes_.size() + 1);
+}
+
+template<typename A>
+std::vector<double, A> array_of_doubles_columns_alloc<A>::get_column_sums() const {
+  const size_t n = hashes_.size();
+  std::vector<double, A> sums(num_values_, 0, values_.get_allocator());
+  for (uint8_t c = 0; c < num_values_; ++c) {
+    const double* column = get_column(c);
+    // independent partial sums, which the compiler keeps in one vector register
+    double lanes[4] = {0, 0, 0, 0};
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+      for (size_t lane = 0; lane < 4; ++lane) lanes[lane] += column[i + lane];
+    }
+    double sum = (lanes[0] + lanes[1]) + (lanes[2] + lanes[3]);
+    for (; i < n; ++i) sum += column[i];
+    sums[c] = sum;
+  }
+  return sums;
+}
+
+template<typename A>
+auto array_of_doubles_columns_alloc<A>::to_compact() const -> CompactSketch {
+  using Entry = typename CompactSketch::Entry;
+  using AllocEntry = typename CompactSketch::AllocEntry;
+  const size_t n = hashes_.size();
+  const AllocEntry entries_allocator(values_.get_allocator());
+  std::vector<Entry, AllocEntry> entries(entries_allocator);
+  entries.reserve(n);
+  for (size_t i = 0; i < n; ++i) {
+    aod<A> summary(num_values_, values_.get_allocator());
+    for (uint8_t c = 0; c < num_values_; ++c) summary[c] = values_[c * (n + 1) + i];
+    entries.push_back(Entry(hashes_[i], std::move(summary)));
+  }
+  return CompactSketch(is_empty_, true, seed_hash_, theta_, std::move(entries), num_values_);
+}
+
+template<typename A>
+auto array_of_doubles_columns_alloc<A>::serialize(unsigned header_size_bytes) const -> vector_bytes {
+  const uint8_t preamble_longs = 1;
+  const size_t n = hashes_.size();
+  const size_t size = header_size_bytes + 16 // preamble and theta
+      + (n > 0 ? 8 : 0)
+      + (sizeof(uint64_t) + sizeof(double) * num_values_) * n;
+  vector_bytes bytes(size, 0, AllocBytes(values_.get_allocator()));
+  uint8_t* ptr = bytes.data() + header_size_bytes;
+
+  ptr += copy_to_mem(preamble_longs, ptr);
+  const uint8_t serial_version = CompactSketch::SERIAL_VERSION;
+  ptr += copy_to_mem(serial_version, ptr);
+  const uint8_t family = CompactSketch::SKETCH_FAMILY;
+  ptr += copy_to_mem(family, ptr);
+  const uint8_t type = CompactSketch::SKETCH_TYPE;
+  ptr += copy_to_mem(type, ptr);
+  const uint8_t flags_byte(
+    (is_empty_ ? 1 << Flags::IS_EMPTY : 0) |
+    (n > 0 ? 1 << Flags::HAS_ENTRIES : 0) |
+    (1 << Flags::IS_ORDERED)
+  );
+  ptr += copy_to_mem(flags_byte, ptr);
+  ptr += copy_to_mem(num_values_, ptr);
+  ptr += copy_to_mem(seed_hash_, ptr);
+  ptr += copy_to_mem(theta_, ptr);
+  if (n > 0) {
+    const uint32_t num_entries = static_cast<uint32_t>(n);
+    ptr += copy_to_mem(num_entries, ptr);
+    ptr += sizeof(uint32_t); // unused
+    ptr += copy_to_mem(hashes_.data(), ptr, n * sizeof(uint64_t));
+    // the serialized values are row-major
+    for (size_t i = 0; i < n; ++i) {
+      for (uint8_t c = 0; c < num_values_; ++c) ptr += copy_to_mem(values_[c * (n + 1) + i], ptr);
+    }
+  }
+  return bytes;
+}
+
+template<typename A>
+array_of_doubles_columns_alloc<A> array_of_doubles_columns_alloc<A>::deserialize(const void* bytes, size_t size,
+    uint64_t seed, const A& allocator) {
+  ensure_minimum_memory(size, 16);
+  const char* ptr = static_cast<const char*>(bytes);
+  ptr += sizeof(uint8_t); // unused
+  uint8_t serial_version;
+  ptr += copy_from_mem(ptr, serial_version);
+  uint8_t family;
+  ptr += copy_from_mem(ptr, family);
+  uint8_t type;
+  ptr += copy_from_mem(ptr, type);
+  uint8_t flags_byte;
+  ptr += copy_from_mem(ptr, flags_byte);
+  uint8_t num_values;
+  ptr += copy_from_mem(ptr, num_values);
+  uint16_t seed_hash;
+  ptr += copy_from_mem(ptr, seed_hash);
+  checker<true>::check_serial_version(serial_version, CompactSketch::SERIAL_VERSION);
+  checker<true>::check_sketch_family(family, CompactSketch::SKETCH_FAMILY);
+  checker<true>::check_sketch_type(type, CompactSketch::SKETCH_TYPE);
+  const bool has_entries = flags_byte & (1 << Flags::HAS_ENTRIES);
+  if (has_entries) checker<true>::check_seed_hash(seed_hash, compute_seed_hash(seed));
+
+  uint64_t theta;
+  ptr += copy_from_mem(ptr, theta);
+  const AllocU64 hashes_allocator(allocator);
+  std::vector<uint64_t, AllocU64> hashes(hashes_allocator);
+  std::vector<double, A> values(num_values, -0.0, allocator);
+  if (has_entries) {
+    ensure_minimum_memory(size, 24);
+    uint32_t num_entries;
+    ptr += copy_from_mem(ptr, num_entries);
+    ptr += sizeof(uint32_t); // unused
+    ensure_minimum_memory(size, 24 + (sizeof(uint64_t) + sizeof(double) * num_values) * num_entries);
+    hashes.resize(num_entries);
+    ptr += copy_from_mem(ptr, hashes.data(), sizeof(uint64_t) * num_entries);
+    values.assign((num_entries + static_cast<size_t>(1)) * num_values, -0.0);
+    for (size_t i = 0; i < num_entries; ++i) {
+      for (uint8_t c = 0; c < num_values; ++c) ptr += copy_from_mem(ptr, values[c * (num_entries + 1) + i]);
+    }
+    const bool is_ordered = flags_byte & (1 << Flags::IS_ORDERED);
+    if (!is_ordered) sort_columns<A, AllocU64, AllocU32>(hashes, values, num_values);
+  }
+  const bool is_empty = flags_byte & (1 << Flags::IS_EMPTY);
+  return array_of_doubles_columns_alloc(is_empty, seed_hash, theta, num_values, std::move(hashes), std::move(values));
+}
+
+// combining columns
+
+struct combine_sum {
+  static double identity() { return -0.0; }
+  double operator()(double a, double b) const { return a + b; }
+};
+
+struct combine_min {
+  static double identity() { return std::numeric_limits<double>::infinity(); }
+  double operator()(double a, double b) const { return b < a ? b : a; }
+};
+
+struct combine_max {
+  static double identity() { return -std::numeric_limits<double>::infinity(); }
+  double operator()(double a, double b) const { return b > a ? b : a; }
+};
+
+// Sets out[t] to op(a[from_a[t]], b[from_b[t]]) for each of the k rows. Where Padded, a row
+// of a_padding or b_padding (the padding row of a column) stands for a hash missing from that
+// side, and takes the identity of op. The gathers, selects and op make a loop without branches.
+template<typename Op, bool Padded>
+static void combine_rows(const double* a, const uint32_t* from_a, uint32_t a_padding,
+    const double* b, const uint32_t* from_b, uint32_t b_padding, size_t k, double* out) {
+  const Op op;
+  const double identity = Op::identity();
+  for (size_t t = 0; t < k; ++t) {
+    double x = a[from_a[t]];
+    double y = b[from_b[t]];
+    if (Padded) {
+      x = from_a[t] == a_padding ? identity : x;
+      y = from_b[t] == b_padding ? identity : y;
+    }
+    out[t] = op(x, y);
+  }
+}
+
+// padding rows hold -0.0, the identity of a sum, so sums read them as they are
+static inline void combine_rows(columns_combine combine, bool padded, const double* a, const uint32_t* from_a, uint32_t a_padding,
+    const double* b, const uint32_t* from_b, uint32_t b_padding, size_t k, double* out) {
+  switch (combine) {
+    case columns_combine::SUM:
+      return combine_rows<combine_sum, false>(a, from_a, a_padding, b, from_b, b_padding, k, out);
+    case columns_combine::MIN:
+      if (padded) return combine_rows<combine_min, true>(a, from_a, a_padding, b, from_b, b_padding, k, out);
+      return combine_rows<combine_min, false>(a, from_a, a_padding, b, from_b, b_padding, k, out);
+    case columns_combine::MAX:
+      if (padded) return combine_rows<combine_max, true>(a, from_a, a_padding, b, from_b, b_padding, k, out);
+      return combine_rows<combine_max, false>(a, from_a, a_padding, b, from_b, b_padding, k, out);
+  }
+}
+
+// union
+
+template<typename A>
+array_of_doubles_columns_union_alloc<A>::array_of_doubles_columns_union_alloc(uint8_t num_values, columns_combine combine,
+    uint8_t lg_k, uint64_t seed, const A& allocator):
+num_values_(num_values),
+combine_(combine),
+lg_k_(lg_k),
+seed_(seed),
+is_empty_(true),
+theta_(theta_constants::MAX_THETA),
+hashes_(AllocU64(allocator)),
+values_(num_values, -0.0, allocator),
+merged_hashes_(AllocU64(allocator)),
+merged_values_(allocator),
+from_state_(AllocU32(allocator)),
+from_input_(AllocU32(allocator))
+{
+  if (lg_k < theta_constants::MIN_LG_K) {
+    throw std::invalid_argument("lg_k must not be less than " + std::to_string(theta_constants::MIN_LG_K) + ": " + std::to_string(lg_k));
+  }
+  if (lg_k > theta_constants::MAX_LG_K) {
+    throw std::invalid_argument("lg_k must not be greater than " + std::to_string(theta_constants::MAX_LG_K) + ": " + std::to_string(lg_k));
+  }
+}
+
+template<typename A>
+void array_of_doubles_columns_union_alloc<A>::update(const Columns& columns) {
+  if (columns.is_empty()) return;
+  if (columns.get_seed_hash() != compute_seed_hash(seed_)) throw std::invalid_argument("seed hash mismatch");
+  if (columns.get_num_values() != num_values_) throw std::invalid_argument("number of values mismatch");
+  is_empty_ = false;
+  if (columns.get_theta64() < theta_) theta_ = columns.get_theta64();
+
+  // merge the sorted hashes below theta_, noting the row each came from on either side,
+  // and once one more than the nominal number has been reached, make the last the cutoff;
+  // a hash missing from one side takes that side's padding row
+  const uint32_t nominal_num = 1 << lg_k_;
+  const uint32_t n = static_cast<uint32_t>(hashes_.size());
+  const uint32_t m = columns.get_num_retained();
+  const uint64_t* input = columns.get_hashes();
+  const size_t capacity = std::min<size_t>(nominal_num + 1, static_cast<size_t>(n) + m);
+  merged_hashes_.resize(capacity);
+  from_state_.resize(capacity);
+  from_input_.resize(capacity);
+  size_t k = 0;
+  auto emit = [&](uint64_t hash, uint32_t state_row, uint32_t input_row) {
+    merged_hashes_[k] = hash;
+    from_state_[k] = state_row;
+    from_input_[k] = input_row;
+    if (++k > nominal_num) {
+      theta_ = hash;
+      --k;
+    }
+  };
+  uint32_t i = 0;
+  for (uint32_t j = 0; j < m; ++j) {
+    const uint64_t hash = input[j];
+    while (i < n && hashes_[i] < hash && hashes_[i] < theta_) {
+      emit(hashes_[i], i, m);
+      ++i;
+    }
+    if (hash >= theta_) break;
+    if (i < n && hashes_[i] == hash) {
+      emit(hash, i, j);
+      ++i;
+    } else {
+      emit(hash, n, j);
+    }
+  }
+  while (i < n && hashes_[i] < theta_) {
+    emit(hashes_[i], i, m);
+    ++i;
+  }
+  merged_hashes_.resize(k);
+
+  // values of a hash on both sides are combined, state first, as the union policy sums them
+  merged_values_.resize((k + 1) * num_values_);
+  for (uint8_t c = 0; c < num_values_; ++c) {
+    const double* state_column = values_.data() + c * (n + static_cast<size_t>(1));
+    double* merged_column = merged_values_.data() + c * (k + 1);
+    combine_rows(combine_, true, state_column, from_state_.data(), n, columns.get_column(c), from_input_.data(), m, k, merged_column);
+    merged_column[k] = -0.0;
+  }
+  std::swap(hashes_, merged_hashes_);
+  std::swap(values_, merged_values_);
+}
+
+template<typename A>
+auto array_of_doubles_columns_union_alloc<A>::get_result() const -> Columns {
+  return Columns(is_empty_, compute_seed_hash(seed_), theta_, num_values_, std::vector<uint64_t, AllocU64>(hashes_),
+      std::vector<double, A>(values_));
+}
+
+template<typename A>
+void array_of_doubles_columns_union_alloc<A>::reset() {
+  is_empty_ = true;
+  theta_ = theta_constants::MAX_THETA;
+  hashes_.clear();
+  values_.assign(num_values_, -0.0);
+}
+
+// intersection
+
+template<typename A>
+array_of_doubles_columns_intersection_alloc<A>::array_of_doubles_columns_intersection_alloc(uint8_t num_values,
+    columns_combine combine, uint64_t seed, const A& allocator):
+num_values_(num_values),
+combine_(combine),
+seed_(seed),
+is_valid_(false),
+is_empty_(false),
+theta_(theta_constants::MAX_THETA),
+hashes_(AllocU64(allocator)),
+values_(num_values, -0.0, allocator),
+matched_hashes_(AllocU64(allocator)),
+matched_values_(allocator),
+from_state_(AllocU32(allocator)),
+from_input_(AllocU32(allocator))
+{}
+
+// Follows theta_intersection_base::update for ordered inputs.
+template<typename A>
+void array_of_doubles_columns_intersection_alloc<A>::update(const Columns& columns) {
+  if (is_empty_) return;
+  if (!columns.is_empty() && columns.get_seed_hash() != compute_seed_hash(seed_)) throw std::invalid_argument("seed hash mismatch");
+  if (columns.get_num_values() != num_values_) throw std::invalid_argument("number of values mismatch");
+  is_empty_ = columns.is_empty();
+  theta_ = std::min(theta_, columns.get_theta64());
+  if (is_valid_ && hashes_.empty()) return;
+  const bool first = !is_valid_;
+  is_valid_ = true;
+  if (columns.get_num_retained() == 0) {
+    hashes_.clear();
+    values_.assign(num_values_, -0.0);
+    return;
+  }
+  if (first) {
+    hashes_ = columns.hashes_;
+    values_ = columns.values_;
+    return;
+  }
+
+  // match the sorted hashes below theta_, noting the row each came from on either side
+  const uint32_t n = static_cast<uint32_t>(hashes_.size());
+  const uint32_t m = columns.get_num_retained();
+  const uint64_t* input = columns.get_hashes();
+  const size_t capacity = std::min(n, m);
+  matched_hashes_.resize(capacity);
+  from_state_.resize(capacity);
+  from_input_.resize(capacity);
+  size_t k = 0;
+  uint32_t i = 0;
+  for (uint32_t j = 0; j < m && i < n; ++j) {
+    const uint64_t hash = input[j];
+    if (hash >= theta_) break;
+    while (i < n && hashes_[i] < hash) ++i;
+    if (i < n && hashes_[i] == hash) {
+      matched_hashes_[k] = hash;
+      from_state_[k] = i;
+      from_input_[k] = j;
+      ++k;
+      ++i;
+    }
+  }
+  matched_hashes_.resize(k);
+
+  // every row is a match, none of them padding
+  matched_values_.resize((k + 1) * num_values_);
+  for (uint8_t c = 0; c < num_values_; ++c) {
+    const double* state_column = values_.data() + c * (n + static_cast<size_t>(1));
+    double* matched_column = matched_values_.data() + c * (k + 1);
+    combine_rows(combine_, false, state_column, from_state_.data(), n, columns.get_column(c), from_input_.data(), m, k, matched_column);
+    matched_column[k] = -0.0;
+  }
+  std::swap(hashes_, matched_hashes_);
+  std::swap(values_, matched_values_);
+  if (hashes_.empty() && theta_ == theta_constants::MAX_THETA) is_empty_ = true;
+}
+
+template<typename A>
+bool array_of_doubles_columns_intersection_alloc<A>::has_result() const {
+  return is_valid_;
+}
+
+template<typename A>
+auto array_of_doubles_columns_intersection_alloc<A>::get_result() const -> Columns {
+  if (!is_valid_) throw std::invalid_argument("calling get_result() before calling update() is undefined");
+  return Columns(is_empty_, compute_seed_hash(seed_), theta_, num_values_, std::vector<uint64_t, AllocU64>(hashes_),
+      std::vector<double, A>(values_));
+}
+
+} /* namespace datasketches */
+
+#endif
@@ -0,0 +1,95 @@
+/*
+ * Licensed to the Apache Software Foundation (ASF) under one
+ * or more contributor license agreements.  See the NOTICE file
+ * distributed with this work for additional information
+ * regarding copyright ownership.  The ASF licenses this file
+ * to you under the Apache License, Version 2.0 (the
+ * "License"); you may not use this file except in compliance
+ * with the License.  You may obtain a copy of the License at
+ *
+ *   http://www.apache.org/licenses/LICENSE-2.0
+ *
+ * Unless required by applicable law or agreed to in writing,
+ * software distributed under the License is distributed on an
+ * "AS IS" BASIS, WITHOUT WARRANTIES OR CONDITIONS OF ANY
+ * KIND, either express or implied.  See the License for the
+ * specific language governing permissions and limitations
+ * under the License.
+ */
+
+
+#ifndef FIXED_DOUBLES_SKETCH_HPP_
+#define FIXED_DOUBLES_SKETCH_HPP_
+
+#include <array>
+#include <memory>
+#include <vector>
+
+#include "array_of_doubles_sketch.hpp"
+#include "tuple_sketch.hpp"
+#include "tuple_union.hpp"
+
+namespace datasketches {
+
+// A summary of a number of doubles fixed at compile time, with a count of the updates that
+// were summed into them. Unlike aod, it holds its values itself, so the sketch's table keeps
+// summaries inline in its entries and neither updates nor unions allocate per key.
+template<uint8_t N>
+struct fixed_doubles {
+  std::array<double, N> values;
+  uint64_t count;
+};
+
+template<uint8_t N>
+class fixed_doubles_update_policy {
+public:
+  fixed_doubles<N> create() const {
+    return fixed_doubles<N>();
+  }
+  template<typename InputVector> // to allow any type with indexed access (such as double*)
+  void update(fixed_doubles<N>& summary, const InputVector& update) const {
+    for (uint8_t i = 0; i < N; ++i) summary.values[i] += update[i];
+    ++summary.count;
+  }
+};
+
+template<uint8_t N>
+struct fixed_doubles_union_policy {
+  void operator()(fixed_doubles<N>& summary, const fixed_doubles<N>& other) const {
+    for (uint8_t i = 0; i < N; ++i) summary.values[i] += other.values[i];
+    summary.count += other.count;
+  }
+};
+
+template<uint8_t N, typename A> using AllocFixedDoubles = typename std::allocator_traits<A>::template rebind_alloc<fixed_doubles<N>>;
+
+template<uint8_t N, typename A = std::allocator<double>>
+using update_fixed_doubles_sketch = update_tuple_sketch<fixed_doubles<N>, const double*, fixed_doubles_update_policy<N>,
+    AllocFixedDoubles<N, A>>;
+
+template<uint8_t N, typename A = std::allocator<double>>
+using compact_fixed_doubles_sketch = compact_tuple_sketch<fixed_doubles<N>, AllocFixedDoubles<N, A>>;
+
+template<uint8_t N, typename A = std::allocator<double>>
+using fixed_doubles_union = tuple_union<fixed_doubles<N>, fixed_doubles_union_policy<N>, AllocFixedDoubles<N, A>>;
+
+// The sketch with the sums of its summaries as arrays of doubles, without their counts,
+// for it to be serialized or combined with array of doubles sketches.
+template<uint8_t N, typename A>
+compact_array_of_doubles_sketch_alloc<A> to_array_of_doubles(const tuple_sketch<fixed_doubles<N>, AllocFixedDoubles<N, A>>& sketch,
+    bool ordered = true, const A& allocator = A()) {
+  using Sketch = compact_array_of_doubles_sketch_alloc<A>;
+  const compact_fixed_doubles_sketch<N, A> compact(sketch, ordered);
+  std::vector<typename Sketch::Entry, typename Sketch::AllocEntry> entries(allocator);
+  entries.reserve(compact.get_num_retained());
+  for (const auto& entry: compact) {
+    aod<A> values(N, allocator);
+    std::copy(entry.second.values.begin(), entry.second.values.end(), values.data());
+    entries.emplace_back(entry.first, std::move(values));
+  }
+  return Sketch(compact.is_empty(), compact.is_ordered(), compact.get_seed_hash(), compact.get_theta64(), std::move(entries), N);
+}
+
+} /* namespace datasketches */
+
+#endif
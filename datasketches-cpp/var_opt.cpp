@@ -0,0 +1,156 @@
+#include <cstdint>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "rust/cxx.h"
+
+#include "dsrs/src/bridge.rs.h"
+#include "sampling/include/var_opt_sketch.hpp"
+#include "sampling/include/var_opt_union.hpp"
+#include "var_opt.hpp"
+
+OpaqueVarOptSketch::OpaqueVarOptSketch(uint32_t k):
+  scratch_{},
+  inner_{k} {
+}
+
+OpaqueVarOptSketch::OpaqueVarOptSketch(sketch&& var_opt):
+  scratch_{},
+  inner_{std::move(var_opt)} {
+}
+
+uint32_t OpaqueVarOptSketch::get_k() const {
+  return this->inner_.get_k();
+}
+
+uint64_t OpaqueVarOptSketch::get_n() const {
+  return this->inner_.get_n();
+}
+
+uint32_t OpaqueVarOptSketch::get_num_samples() const {
+  return this->inner_.get_num_samples();
+}
+
+bool OpaqueVarOptSketch::is_empty() const {
+  return this->inner_.is_empty();
+}
+
+void OpaqueVarOptSketch::reset() {
+  this->inner_.reset();
+}
+
+void OpaqueVarOptSketch::update(rust::Slice<const uint8_t> item, double weight) {
+  this->scratch_.assign(reinterpret_cast<const char*>(item.data()), item.size());
+  this->inner_.update(this->scratch_, weight);
+}
+
+void OpaqueVarOptSketch::update_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, rust::Slice<const double> weights) {
+  if (!weights.empty() && weights.size() != ends.size()) {
+    throw std::invalid_argument("expected " + std::to_string(ends.size()) + " weights, got " + std::to_string(weights.size()));
+  }
+  const char* data = reinterpret_cast<const char*>(buf.data());
+  size_t start = 0;
+  for (size_t i = 0; i < ends.size(); ++i) {
+    this->scratch_.assign(data + start, ends[i] - start);
+    this->inner_.update(this->scratch_, weights.empty() ? 1.0 : weights[i]);
+    start = ends[i];
+  }
+}
+
+std::unique_ptr<std::vector<SampleRow>> OpaqueVarOptSketch::samples() const {
+  std::unique_ptr<std::vector<SampleRow>> rows(new std::vector<SampleRow>());
+  rows->reserve(this->inner_.get_num_samples());
+  for (auto sample: this->inner_) {
+    SampleRow row;
+    row.addr = reinterpret_cast<size_t>(sample.first.data());
+    row.len = sample.first.size();
+    row.weight = sample.second;
+    rows->push_back(row);
+  }
+  return rows;
+}
+
+SubsetSummary OpaqueVarOptSketch::estimate_subset_sum(rust::Slice<const bool> matches) const {
+  if (matches.size() != this->inner_.get_num_samples()) {
+    throw std::invalid_argument("expected " + std::to_string(this->inner_.get_num_samples()) + " matches, got " + std::to_string(matches.size()));
+  }
+  // the predicate sees the samples in the order the sketch iterates over them
+  size_t i = 0;
+  auto summary = this->inner_.estimate_subset_sum([&matches, &i](const std::string&) { return matches[i++]; });
+  SubsetSummary result;
+  result.lower_bound = summary.lower_bound;
+  result.estimate = summary.estimate;
+  result.upper_bound = summary.upper_bound;
+  result.total_sketch_weight = summary.total_sketch_weight;
+  return result;
+}
+
+std::unique_ptr<std::vector<SubsetSummary>> OpaqueVarOptSketch::estimate_subset_sums(rust::Slice<const uint32_t> groups, uint32_t num_groups) const {
+  if (groups.size() != this->inner_.get_num_samples()) {
+    throw std::invalid_argument("expected " + std::to_string(this->inner_.get_num_samples()) + " groups, got " + std::to_string(groups.size()));
+  }
+  size_t i = 0;
+  auto summaries = this->inner_.estimate_subset_sums([&groups, &i](const std::string&) { return groups[i++]; }, num_groups);
+  std::unique_ptr<std::vector<SubsetSummary>> result(new std::vector<SubsetSummary>(summaries.size()));
+  for (size_t g = 0; g < summaries.size(); ++g) {
+    auto& target = (*result)[g];
+    target.lower_bound = summaries[g].lower_bound;
+    target.estimate = summaries[g].estimate;
+    target.upper_bound = summaries[g].upper_bound;
+    target.total_sketch_weight = summaries[g].total_sketch_weight;
+  }
+  return result;
+}
+
+std::unique_ptr<OpaqueVarOptSketch> OpaqueVarOptSketch::clone() const {
+  auto copy = this->inner_;
+  return std::unique_ptr<OpaqueVarOptSketch>(new OpaqueVarOptSketch{std::move(copy)});
+}
+
+std::unique_ptr<std::vector<uint8_t>> OpaqueVarOptSketch::serialize() const {
+  auto v = this->inner_.serialize();
+  return std::unique_ptr<std::vector<uint8_t>>(new std::vector<uint8_t>(v.begin(), v.end()));
+}
+
+std::unique_ptr<OpaqueVarOptSketch> new_opaque_var_opt_sketch(uint32_t k) {
+  return std::unique_ptr<OpaqueVarOptSketch>(new OpaqueVarOptSketch{k});
+}
+
+std::unique_ptr<OpaqueVarOptSketch> deserialize_opaque_var_opt_sketch(rust::Slice<const uint8_t> buf) {
+  auto var_opt = OpaqueVarOptSketch::sketch::deserialize(buf.data(), buf.size());
+  return std::unique_ptr<OpaqueVarOptSketch>(new OpaqueVarOptSketch{std::move(var_opt)});
+}
+
+OpaqueVarOptUnion::OpaqueVarOptUnion(uint32_t max_k):
+  inner_{max_k} {
+}
+
+void OpaqueVarOptUnion::update(const OpaqueVarOptSketch& sketch) {
+  this->inner_.update(sketch.inner_);
+}
+
+void OpaqueVarOptUnion::update_serialized(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends) {
+  std::vector<OpaqueVarOptSketch::sketch> sketches;
+  sketches.reserve(ends.size());
+  size_t start = 0;
+  for (const size_t end : ends) {
+    sketches.push_back(OpaqueVarOptSketch::sketch::deserialize(buf.data() + start, end - start));
+    start = end;
+  }
+  this->inner_.update(std::make_move_iterator(sketches.begin()), std::make_move_iterator(sketches.end()));
+}
+
+std::unique_ptr<OpaqueVarOptSketch> OpaqueVarOptUnion::get_result() const {
+  return std::unique_ptr<OpaqueVarOptSketch>(new OpaqueVarOptSketch{this->inner_.get_result()});
+}
+
+void OpaqueVarOptUnion::reset() {
+  this->inner_.reset();
+}
+
+std::unique_ptr<OpaqueVarOptUnion> new_opaque_var_opt_union(uint32_t max_k) {
+  return std::unique_ptr<OpaqueVarOptUnion>(new OpaqueVarOptUnion{max_k});
+}
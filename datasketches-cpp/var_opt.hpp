@@ -0,0 +1,74 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+#include <memory>
+
+#include "rust/cxx.h"
+
+#include "sampling/include/var_opt_sketch.hpp"
+#include "sampling/include/var_opt_union.hpp"
+
+struct SampleRow;
+struct SubsetSummary;
+
+class OpaqueVarOptUnion;
+
+// A weighted sample of byte strings, with weights adjusted so that the sum over any
+// subset of the sample estimates that subset's weight in the stream. Items are copied
+// in from a scratch string, and the sketch copy-assigns them into slots whose strings
+// keep their buffers, so once the sample has filled updates rarely allocate.
+class OpaqueVarOptSketch {
+public:
+  typedef datasketches::var_opt_sketch<std::string> sketch;
+  uint32_t get_k() const;
+  uint64_t get_n() const;
+  uint32_t get_num_samples() const;
+  bool is_empty() const;
+  void reset();
+  // Throws unless the weight is finite and nonnegative.
+  void update(rust::Slice<const uint8_t> item, double weight);
+  // The ends are those of update_bytes_batch, already validated. weights is either
+  // empty, for a weight of 1 each, or has one per item. Throws at the first invalid
+  // weight, leaving the items before it in the sketch.
+  void update_batch(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends, rust::Slice<const double> weights);
+  // Row items point into the sketch and are only valid until it is next updated.
+  std::unique_ptr<std::vector<SampleRow>> samples() const;
+  // matches[i] says whether the i-th of samples() is in the subset.
+  SubsetSummary estimate_subset_sum(rust::Slice<const bool> matches) const;
+  // groups[i] is the index of the subset the i-th of samples() is in, or
+  // num_groups or more for none; returns the sums of all subsets from one pass.
+  std::unique_ptr<std::vector<SubsetSummary>> estimate_subset_sums(rust::Slice<const uint32_t> groups, uint32_t num_groups) const;
+  std::unique_ptr<OpaqueVarOptSketch> clone() const;
+  std::unique_ptr<std::vector<uint8_t>> serialize() const;
+private:
+  OpaqueVarOptSketch(uint32_t k);
+  OpaqueVarOptSketch(sketch&& var_opt);
+  friend class OpaqueVarOptUnion;
+  friend std::unique_ptr<OpaqueVarOptSketch> new_opaque_var_opt_sketch(uint32_t k);
+  friend std::unique_ptr<OpaqueVarOptSketch> deserialize_opaque_var_opt_sketch(rust::Slice<const uint8_t> buf);
+  // Each item is staged here, which keeps its buffer between updates.
+  std::string scratch_;
+  sketch inner_;
+};
+
+std::unique_ptr<OpaqueVarOptSketch> new_opaque_var_opt_sketch(uint32_t k);
+std::unique_ptr<OpaqueVarOptSketch> deserialize_opaque_var_opt_sketch(rust::Slice<const uint8_t> buf);
+
+class OpaqueVarOptUnion {
+public:
+  typedef datasketches::var_opt_union<std::string> var_opt_union;
+  void update(const OpaqueVarOptSketch& sketch);
+  // Sketch i is serialized in [ends[i-1], ends[i]) of buf, with ends[-1] taken as 0.
+  // All are deserialized before any is merged, so a bad one leaves this union as it was.
+  void update_serialized(rust::Slice<const uint8_t> buf, rust::Slice<const size_t> ends);
+  std::unique_ptr<OpaqueVarOptSketch> get_result() const;
+  void reset();
+private:
+  OpaqueVarOptUnion(uint32_t max_k);
+  friend std::unique_ptr<OpaqueVarOptUnion> new_opaque_var_opt_union(uint32_t max_k);
+  var_opt_union inner_;
+};
+
+std::unique_ptr<OpaqueVarOptUnion> new_opaque_var_opt_union(uint32_t max_k);
@@ -0,0 +1,23 @@
+#!/usr/bin/env bash
+# Builds and runs the C++ microbenchmarks of the vendored sketches, which
+# time the templates without the FFI in front of them (benches/speed.rs
+# times them through it). Arguments are passed to the benchmark, e.g.
+#
+#   scripts/cpp-bench.sh --filter cpc/ --lg-k 12 --n 1000000
+#
+# Takes CXX and CXXFLAGS as the crate's build does.
+
+set -euo pipefail
+cd "$(dirname "$0")/../datasketches-cpp"
+
+out=../target/cpp-bench
+mkdir -p "$out"
+includes=()
+for dir in common cpc theta hll kll req fi; do
+  includes+=(-I"$dir/include")
+done
+
+# shellcheck disable=SC2086
+${CXX:-c++} -std=c++11 -O3 -DNDEBUG ${CXXFLAGS:-} -Icommon/bench "${includes[@]}" \
+  common/bench/sketch_bench.cpp -o "$out/sketch_bench"
+"$out/sketch_bench" "$@"
@@ -0,0 +1,33 @@
+#!/usr/bin/env bash
+# Builds target/release-lto/dsrs for deployment: the release-lto profile with
+# the C++ sketches optimized together with their Rust callers at link time
+# (cross-language ThinLTO), and both sides optimized with a profile recorded
+# by running the benches.
+#
+# Takes clang, ld.lld and llvm-profdata from the LLVM release that rustc was
+# built with (the "LLVM version" of `rustc -vV`): mismatched bitcode or
+# profiles will not link or load. Set LLVM_SUFFIX for versioned binaries,
+# e.g. LLVM_SUFFIX=-17 for clang-17.
+#
+# The benches only train the optimizer; their timings here are meaningless.
+
+set -euo pipefail
+cd "$(dirname "$0")/.."
+
+suffix=${LLVM_SUFFIX:-}
+export CC=clang$suffix CXX=clang++$suffix
+lto_flags="-Clinker-plugin-lto -Clinker=clang$suffix -Clink-arg=-fuse-ld=lld$suffix"
+build=(--profile release-lto --features cross-lang-lto)
+
+pgo=$PWD/target/pgo
+rm -rf "$pgo"
+mkdir -p "$pgo"
+
+# clang and rustc write their raw profiles side by side, merged into one
+CXXFLAGS="-fprofile-generate=$pgo" RUSTFLAGS="$lto_flags -Cprofile-generate=$pgo" \
+  cargo bench "${build[@]}" -- --warm-up-time 1 --measurement-time 2
+llvm-profdata$suffix merge -o "$pgo/merged.profdata" "$pgo"
+
+CXXFLAGS="-fprofile-use=$pgo/merged.profdata" RUSTFLAGS="$lto_flags -Cprofile-use=$pgo/merged.profdata" \
+  cargo build "${build[@]}" --bin dsrs
+echo "built target/release-lto/dsrs"
@@ -0,0 +1,105 @@
+//! Counts of the allocations made by each family of C++ sketches, and of
+//! the bytes they asked for, for `dsrs --stats`.
+//!
+//! Allocations are only counted when built with the `alloc-stats`
+//! feature, and are otherwise all 0. Each thread counts its own, which
+//! are added to the totals when it exits, so the totals take in those of
+//! threads which have exited, such as the workers of a finished
+//! reduction, and those of the calling thread.
+//!
+//! The bytes still allocated, which are live, are counted alike, and their
+//! peak is kept for the calling thread alone, to measure the footprint of
+//! the sketches it builds.
+
+use crate::bridge::ffi;
+
+/// Whether allocations are counted.
+pub const ENABLED: bool = cfg!(feature = "alloc-stats");
+
+/// The families of sketches counted apart, in the order of `alloc_family`
+/// in `alloc_stats.hpp`; `hh` is the frequent items sketches of the
+/// heavy hitters.
+pub const FAMILIES: [&str; 6] = ["cpc", "theta", "hll", "kll", "req", "hh"];
+
+#[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+pub struct AllocCounts {
+    pub allocations: u64,
+    pub bytes: u64,
+}
+
+/// Returns the counts of each of [`FAMILIES`] so far, in order.
+pub fn counts() -> Vec<(&'static str, AllocCounts)> {
+    FAMILIES
+        .iter()
+        .enumerate()
+        .map(|(i, &family)| {
+            let counts = AllocCounts {
+                allocations: ffi::allocations_of(i as u8),
+                bytes: ffi::allocated_bytes_of(i as u8),
+            };
+            (family, counts)
+        })
+        .collect()
+}
+
+/// Returns the bytes allocated by sketches of `FAMILIES[family]` and not
+/// yet freed.
+pub fn live_bytes(family: usize) -> i64 {
+    ffi::live_bytes_of(family as u8)
+}
+
+/// Returns the most bytes live for sketches of `FAMILIES[family]` on this
+/// thread since it last called [`reset_peak_live_bytes`], counting only
+/// its own allocations and frees.
+pub fn peak_live_bytes(family: usize) -> i64 {
+    ffi::peak_live_bytes_of(family as u8)
+}
+
+/// Restarts the peaks of [`peak_live_bytes`] on this thread from the bytes
+/// live now.
+pub fn reset_peak_live_bytes() {
+    ffi::reset_peak_live_bytes()
+}
+
+#[cfg(test)]
+mod tests {
+    use std::thread;
+
+    use super::*;
+    use crate::KllFloatSketch;
+
+    #[test]
+    fn counts_exited_threads() {
+        let kll = || counts()[3].1;
+        let before = kll();
+        thread::spawn(|| {
+            let mut sketch = KllFloatSketch::new(200).unwrap();
+            (0..10_000).for_each(|i| sketch.update(i as f32));
+        })
+        .join()
+        .unwrap();
+        let after = kll();
+        if ENABLED {
+            assert!(after.allocations > before.allocations);
+            assert!(after.bytes > before.bytes);
+        } else {
+            assert_eq!(after, AllocCounts::default());
+        }
+    }
+
+    #[test]
+    fn peaks_on_this_thread() {
+        let kll = 3;
+        reset_peak_live_bytes();
+        let before = peak_live_bytes(kll);
+        {
+            let mut sketch = KllFloatSketch::new(200).unwrap();
+            (0..10_000).for_each(|i| sketch.update(i as f32));
+        }
+        if ENABLED {
+            assert!(peak_live_bytes(kll) > before);
+        } else {
+            assert_eq!(peak_live_bytes(kll), 0);
+        }
+    }
+}
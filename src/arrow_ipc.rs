@@ -0,0 +1,501 @@
+//! A writer of the [Arrow IPC streaming format][ipc], so that columns of
+//! results can be loaded into analytics engines as they are, rather than
+//! parsed out of text. Only what `dsrs` writes is supported: non-null
+//! columns of binary strings or 64-bit floats, in record batches after a
+//! schema.
+//!
+//! Each message is a flatbuffer of metadata followed by a body holding
+//! the columns' buffers, 8-byte aligned. The flatbuffers are small and
+//! fixed in shape, so they are laid out by hand by [`Builder`] rather
+//! than through a flatbuffers dependency, and the buffers of the body are
+//! written straight from the caller's slices.
+//!
+//! [ipc]: https://arrow.apache.org/docs/format/Columnar.html#serialization-and-interprocess-communication-ipc
+
+use std::convert::TryInto;
+use std::io::{Result, Write};
+
+/// Precedes the length of each message's metadata, and ends the stream
+/// followed by a length of 0.
+const CONTINUATION: [u8; 4] = [0xff; 4];
+
+/// `MetadataVersion.V5`.
+const METADATA_VERSION: i16 = 4;
+
+// `MessageHeader` union tags.
+const SCHEMA: u8 = 1;
+const RECORD_BATCH: u8 = 3;
+
+// `Type` union tags.
+const FLOATING_POINT: u8 = 3;
+const BINARY: u8 = 4;
+
+/// `Precision.DOUBLE`.
+const DOUBLE: i16 = 2;
+
+/// The type of a column.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum DataType {
+    /// Variable-length byte strings, with 32-bit offsets.
+    Binary,
+    Float64,
+}
+
+/// The values of one column of a record batch.
+pub enum Column<'a> {
+    /// Value `i` is `values[ends[i - 1]..ends[i]]`, where the first value
+    /// starts at offset 0. The values of a batch must take under 2GiB.
+    Binary {
+        values: &'a [u8],
+        ends: &'a [usize],
+    },
+    Float64(&'a [f64]),
+}
+
+impl Column<'_> {
+    fn len(&self) -> usize {
+        match self {
+            Self::Binary { ends, .. } => ends.len(),
+            Self::Float64(values) => values.len(),
+        }
+    }
+}
+
+/// Writes the schema message, which starts the stream, of columns with
+/// the given names and types.
+pub fn write_schema<W: Write>(out: &mut W, fields: &[(&str, DataType)]) -> Result<()> {
+    let metadata = message(SCHEMA, 0, |fb| {
+        let (schema, slots) = fb.table(&[None, Some(Slot::Offset)]);
+        let (vector, field_slots) = fb.offset_vector(fields.len());
+        fb.patch(slots[0], vector);
+        for (&(name, data_type), &slot) in fields.iter().zip(&field_slots) {
+            let (type_type, type_table) = match data_type {
+                DataType::Binary => (BINARY, Vec::new()),
+                DataType::Float64 => (FLOATING_POINT, vec![Some(Slot::Short(DOUBLE))]),
+            };
+            let (field, slots) = fb.table(&[
+                Some(Slot::Offset),
+                Some(Slot::Byte(0)),
+                Some(Slot::Byte(type_type)),
+                Some(Slot::Offset),
+                None,
+                Some(Slot::Offset),
+            ]);
+            fb.patch(slot, field);
+            let name = fb.string(name);
+            fb.patch(slots[0], name);
+            let (type_table, _) = fb.table(&type_table);
+            fb.patch(slots[1], type_table);
+            // readers expect the children of even a flat type
+            let (children, _) = fb.offset_vector(0);
+            fb.patch(slots[2], children);
+        }
+        schema
+    });
+    write_message(out, &metadata, &[])
+}
+
+/// Writes a record batch of `columns`, which must match the schema and
+/// have the same number of values.
+pub fn write_record_batch<W: Write>(out: &mut W, columns: &[Column<'_>]) -> Result<()> {
+    let rows = columns.first().map_or(0, |column| column.len());
+    assert!(
+        columns.iter().all(|column| column.len() == rows),
+        "columns of equal length"
+    );
+
+    // binary offsets and floats are encoded first, to be borrowed below
+    let encoded: Vec<Vec<u8>> = columns
+        .iter()
+        .map(|column| match column {
+            Column::Binary { ends, .. } => [0]
+                .iter()
+                .chain(ends.iter())
+                .flat_map(|&end| {
+                    let end: i32 = end.try_into().expect("values under 2GiB");
+                    end.to_le_bytes()
+                })
+                .collect(),
+            Column::Float64(values) => values.iter().flat_map(|v| v.to_le_bytes()).collect(),
+        })
+        .collect();
+    // every column has a validity buffer, empty as no value is null, and
+    // its values, after their offsets for binary ones
+    let mut buffers: Vec<&[u8]> = Vec::new();
+    for (column, encoded) in columns.iter().zip(&encoded) {
+        buffers.push(&[]);
+        buffers.push(encoded);
+        if let Column::Binary { values, ends } = column {
+            buffers.push(&values[..ends.last().copied().unwrap_or(0)]);
+        }
+    }
+
+    let mut offsets = Vec::with_capacity(buffers.len());
+    let mut body_len = 0;
+    for buffer in &buffers {
+        offsets.push([padded(body_len) as i64, buffer.len() as i64]);
+        body_len = padded(body_len) + buffer.len();
+    }
+    let body_len = padded(body_len);
+    let nodes: Vec<[i64; 2]> = columns.iter().map(|_| [rows as i64, 0]).collect();
+    let metadata = message(RECORD_BATCH, body_len, |fb| {
+        let (batch, slots) = fb.table(&[
+            Some(Slot::Long(rows as i64)),
+            Some(Slot::Offset),
+            Some(Slot::Offset),
+        ]);
+        let nodes = fb.struct_vector(&nodes);
+        fb.patch(slots[0], nodes);
+        let buffers = fb.struct_vector(&offsets);
+        fb.patch(slots[1], buffers);
+        batch
+    });
+    write_message(out, &metadata, &buffers)
+}
+
+/// Writes the end of the stream.
+pub fn write_end<W: Write>(out: &mut W) -> Result<()> {
+    out.write_all(&CONTINUATION)?;
+    out.write_all(&0i32.to_le_bytes())
+}
+
+fn padded(len: usize) -> usize {
+    (len + 7) & !7
+}
+
+/// Returns the flatbuffer of a message whose header `build` lays out and
+/// returns the position of, padded to 8 bytes.
+fn message(header_type: u8, body_len: usize, build: impl FnOnce(&mut Builder) -> usize) -> Vec<u8> {
+    let mut fb = Builder::new();
+    let (message, slots) = fb.table(&[
+        Some(Slot::Short(METADATA_VERSION)),
+        Some(Slot::Byte(header_type)),
+        Some(Slot::Offset),
+        Some(Slot::Long(body_len as i64)),
+    ]);
+    fb.patch(0, message);
+    let header = build(&mut fb);
+    fb.patch(slots[0], header);
+    fb.finish()
+}
+
+/// Writes `metadata`, already padded, and then each of `buffers`, padded
+/// to 8 bytes.
+fn write_message<W: Write>(out: &mut W, metadata: &[u8], buffers: &[&[u8]]) -> Result<()> {
+    let metadata_len: i32 = metadata.len().try_into().expect("small metadata");
+    out.write_all(&CONTINUATION)?;
+    out.write_all(&metadata_len.to_le_bytes())?;
+    out.write_all(metadata)?;
+    for buffer in buffers {
+        out.write_all(buffer)?;
+        out.write_all(&[0; 8][..padded(buffer.len()) - buffer.len()])?;
+    }
+    Ok(())
+}
+
+/// A field of a flatbuffer table, either inline or an offset to an object
+/// laid out later.
+enum Slot {
+    Byte(u8),
+    Short(i16),
+    Long(i64),
+    Offset,
+}
+
+impl Slot {
+    fn size(&self) -> usize {
+        match self {
+            Self::Byte(_) => 1,
+            Self::Short(_) => 2,
+            Self::Long(_) => 8,
+            Self::Offset => 4,
+        }
+    }
+}
+
+/// Lays out a flatbuffer front to back: each table after its vtable, and
+/// the objects it refers to after it, at offsets patched in once they are
+/// placed, since offsets only point forward. Positions are from the start
+/// of the buffer, which must be 8-byte aligned where it is written.
+struct Builder {
+    buf: Vec<u8>,
+}
+
+impl Builder {
+    /// Starts a buffer with room for the offset to its root table, which
+    /// is patched in at position 0.
+    fn new() -> Self {
+        Self { buf: vec![0; 4] }
+    }
+
+    /// Pads the buffer until `ahead` more bytes would end it on a multiple
+    /// of `align`.
+    fn pad(&mut self, align: usize, ahead: usize) {
+        while (self.buf.len() + ahead) % align != 0 {
+            self.buf.push(0);
+        }
+    }
+
+    /// Lays out a table of `fields`, indexed by field id with `None` for
+    /// those left out, and returns its position and the positions of its
+    /// offset fields, by field id, to [`Self::patch`].
+    fn table(&mut self, fields: &[Option<Slot>]) -> (usize, Vec<usize>) {
+        // largest first, which after the 4-byte vtable offset at a
+        // position 4 past a multiple of 8 leaves every field aligned
+        let mut order: Vec<usize> = (0..fields.len())
+            .filter(|&id| fields[id].is_some())
+            .collect();
+        order.sort_by_key(|&id| std::cmp::Reverse(fields[id].as_ref().map_or(0, Slot::size)));
+        let mut field_offsets = vec![0u16; fields.len()];
+        let mut size = 4;
+        for &id in &order {
+            field_offsets[id] = size as u16;
+            size += fields[id].as_ref().map_or(0, Slot::size);
+        }
+
+        self.pad(2, 0);
+        let vtable = self.buf.len();
+        let vtable_len = 4 + 2 * fields.len() as u16;
+        self.buf.extend_from_slice(&vtable_len.to_le_bytes());
+        self.buf.extend_from_slice(&(size as u16).to_le_bytes());
+        for offset in &field_offsets {
+            self.buf.extend_from_slice(&offset.to_le_bytes());
+        }
+
+        self.pad(8, 4);
+        let table = self.buf.len();
+        self.buf
+            .extend_from_slice(&((table - vtable) as i32).to_le_bytes());
+        let mut slots = vec![0; fields.len()];
+        for &id in &order {
+            match fields[id].as_ref().expect("present") {
+                Slot::Byte(v) => self.buf.push(*v),
+                Slot::Short(v) => self.buf.extend_from_slice(&v.to_le_bytes()),
+                Slot::Long(v) => self.buf.extend_from_slice(&v.to_le_bytes()),
+                Slot::Offset => {
+                    slots[id] = self.buf.len();
+                    self.buf.extend_from_slice(&[0; 4]);
+                }
+            }
+        }
+        let slots = (0..fields.len())
+            .filter(|&id| matches!(fields[id], Some(Slot::Offset)))
+            .map(|id| slots[id])
+            .collect();
+        (table, slots)
+    }
+
+    /// Lays out a string and returns its position.
+    fn string(&mut self, s: &str) -> usize {
+        self.pad(4, 0);
+        let pos = self.buf.len();
+        self.buf.extend_from_slice(&(s.len() as u32).to_le_bytes());
+        self.buf.extend_from_slice(s.as_bytes());
+        self.buf.push(0);
+        pos
+    }
+
+    /// Lays out a vector of `len` offsets, and returns its position and
+    /// those of its elements, to [`Self::patch`].
+    fn offset_vector(&mut self, len: usize) -> (usize, Vec<usize>) {
+        self.pad(4, 0);
+        let pos = self.buf.len();
+        self.buf.extend_from_slice(&(len as u32).to_le_bytes());
+        let slots = (0..len).map(|i| pos + 4 + 4 * i).collect();
+        self.buf.resize(pos + 4 + 4 * len, 0);
+        (pos, slots)
+    }
+
+    /// Lays out a vector of structs of two longs, such as `FieldNode` and
+    /// `Buffer`, and returns its position.
+    fn struct_vector(&mut self, structs: &[[i64; 2]]) -> usize {
+        self.pad(8, 4);
+        let pos = self.buf.len();
+        self.buf
+            .extend_from_slice(&(structs.len() as u32).to_le_bytes());
+        for s in structs {
+            self.buf.extend_from_slice(&s[0].to_le_bytes());
+            self.buf.extend_from_slice(&s[1].to_le_bytes());
+        }
+        pos
+    }
+
+    /// Points the offset at `slot` to the object at `target`.
+    fn patch(&mut self, slot: usize, target: usize) {
+        let offset: u32 = (target - slot).try_into().expect("small buffer");
+        self.buf[slot..slot + 4].copy_from_slice(&offset.to_le_bytes());
+    }
+
+    /// Returns the buffer, padded to 8 bytes.
+    fn finish(mut self) -> Vec<u8> {
+        self.pad(8, 0);
+        self.buf
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn u16_at(buf: &[u8], pos: usize) -> usize {
+        u16::from_le_bytes(buf[pos..pos + 2].try_into().unwrap()) as usize
+    }
+
+    fn u32_at(buf: &[u8], pos: usize) -> usize {
+        u32::from_le_bytes(buf[pos..pos + 4].try_into().unwrap()) as usize
+    }
+
+    fn i64_at(buf: &[u8], pos: usize) -> i64 {
+        i64::from_le_bytes(buf[pos..pos + 8].try_into().unwrap())
+    }
+
+    /// The position of field `id` of the table at `table`, read through
+    /// its vtable as a flatbuffers reader would.
+    fn field(buf: &[u8], table: usize, id: usize) -> Option<usize> {
+        let soffset = i32::from_le_bytes(buf[table..table + 4].try_into().unwrap());
+        let vtable = (table as i64 - i64::from(soffset)) as usize;
+        if 4 + 2 * id >= u16_at(buf, vtable) {
+            return None;
+        }
+        match u16_at(buf, vtable + 4 + 2 * id) {
+            0 => None,
+            offset => Some(table + offset),
+        }
+    }
+
+    fn deref(buf: &[u8], pos: usize) -> usize {
+        pos + u32_at(buf, pos)
+    }
+
+    /// Reads a message at the start of `stream`, returning its header
+    /// type, the flatbuffer, the position of its header, its body, and the
+    /// rest of the stream.
+    fn read_message(stream: &[u8]) -> (u8, &[u8], usize, &[u8], &[u8]) {
+        assert_eq!(stream[..4], CONTINUATION);
+        let len = u32_at(stream, 4);
+        assert_eq!(len % 8, 0);
+        let fb = &stream[8..8 + len];
+        let message = deref(fb, 0);
+        assert_eq!(message % 8, 4);
+        let version = field(fb, message, 0).unwrap();
+        assert_eq!(u16_at(fb, version), METADATA_VERSION as usize);
+        let header_type = fb[field(fb, message, 1).unwrap()];
+        let header = deref(fb, field(fb, message, 2).unwrap());
+        let body_len = i64_at(fb, field(fb, message, 3).unwrap()) as usize;
+        assert_eq!(field(fb, message, 3).unwrap() % 8, 0);
+        let rest = &stream[8 + len..];
+        (
+            header_type,
+            fb,
+            header,
+            &rest[..body_len],
+            &rest[body_len..],
+        )
+    }
+
+    #[test]
+    fn stream_reads_back() {
+        let keys = b"akeybb";
+        let key_ends = [1, 4, 4, 6];
+        let sketches: Vec<u8> = (0..=255).collect();
+        let sketch_ends = [10, 100, 101, 256];
+        let estimates = [1.5, -2.0, 0.0, 1e300];
+        let mut stream = Vec::new();
+        write_schema(
+            &mut stream,
+            &[
+                ("key", DataType::Binary),
+                ("estimate", DataType::Float64),
+                ("sketch", DataType::Binary),
+            ],
+        )
+        .unwrap();
+        let columns = [
+            Column::Binary {
+                values: keys,
+                ends: &key_ends,
+            },
+            Column::Float64(&estimates),
+            Column::Binary {
+                values: &sketches,
+                ends: &sketch_ends,
+            },
+        ];
+        write_record_batch(&mut stream, &columns).unwrap();
+        write_record_batch(&mut stream, &columns[..0]).unwrap();
+        write_end(&mut stream).unwrap();
+
+        let (header_type, fb, schema, body, rest) = read_message(&stream);
+        assert_eq!((header_type, body.len()), (SCHEMA, 0));
+        let fields = deref(fb, field(fb, schema, 1).unwrap());
+        assert_eq!(u32_at(fb, fields), 3);
+        let expected = [
+            ("key", BINARY),
+            ("estimate", FLOATING_POINT),
+            ("sketch", BINARY),
+        ];
+        for (i, &(name, type_type)) in expected.iter().enumerate() {
+            let field_table = deref(fb, fields + 4 + 4 * i);
+            let name_pos = deref(fb, field(fb, field_table, 0).unwrap());
+            let name_len = u32_at(fb, name_pos);
+            assert_eq!(&fb[name_pos + 4..name_pos + 4 + name_len], name.as_bytes());
+            assert_eq!(fb[name_pos + 4 + name_len], 0);
+            assert_eq!(fb[field(fb, field_table, 1).unwrap()], 0);
+            assert_eq!(fb[field(fb, field_table, 2).unwrap()], type_type);
+            let type_table = deref(fb, field(fb, field_table, 3).unwrap());
+            if type_type == FLOATING_POINT {
+                assert_eq!(
+                    u16_at(fb, field(fb, type_table, 0).unwrap()),
+                    DOUBLE as usize
+                );
+            }
+            assert!(field(fb, field_table, 4).is_none());
+            let children = deref(fb, field(fb, field_table, 5).unwrap());
+            assert_eq!(u32_at(fb, children), 0);
+        }
+
+        let (header_type, fb, batch, body, rest) = read_message(rest);
+        assert_eq!(header_type, RECORD_BATCH);
+        assert_eq!(body.len() % 8, 0);
+        assert_eq!(i64_at(fb, field(fb, batch, 0).unwrap()), 4);
+        let nodes = deref(fb, field(fb, batch, 1).unwrap());
+        assert_eq!((u32_at(fb, nodes), nodes % 8), (3, 4));
+        for i in 0..3 {
+            assert_eq!(i64_at(fb, nodes + 4 + 16 * i), 4);
+            assert_eq!(i64_at(fb, nodes + 12 + 16 * i), 0);
+        }
+        let buffers = deref(fb, field(fb, batch, 2).unwrap());
+        assert_eq!((u32_at(fb, buffers), buffers % 8), (8, 4));
+        let buffer = |i: usize| {
+            let offset = i64_at(fb, buffers + 4 + 16 * i) as usize;
+            let len = i64_at(fb, buffers + 12 + 16 * i) as usize;
+            assert_eq!(offset % 8, 0);
+            &body[offset..offset + len]
+        };
+        let binary = |offsets: &[u8], values: &[u8]| -> Vec<Vec<u8>> {
+            let offsets: Vec<usize> = offsets.chunks(4).map(|o| u32_at(o, 0)).collect();
+            offsets
+                .windows(2)
+                .map(|w| values[w[0]..w[1]].to_vec())
+                .collect()
+        };
+        assert!([0, 3, 5].iter().all(|&i| buffer(i).is_empty()));
+        assert_eq!(
+            binary(buffer(1), buffer(2)),
+            [&b"a"[..], b"key", b"", b"bb"]
+        );
+        let floats: Vec<f64> = buffer(4)
+            .chunks(8)
+            .map(|v| f64::from_le_bytes(v.try_into().unwrap()))
+            .collect();
+        assert_eq!(floats, estimates);
+        let split = binary(buffer(6), buffer(7));
+        assert_eq!(split.concat(), sketches);
+        assert_eq!(split[2], [100]);
+
+        let (header_type, fb, batch, body, rest) = read_message(rest);
+        assert_eq!((header_type, body.len()), (RECORD_BATCH, 0));
+        assert_eq!(i64_at(fb, field(fb, batch, 0).unwrap()), 0);
+        assert_eq!(rest, [0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0]);
+    }
+}
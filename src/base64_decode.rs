@@ -0,0 +1,248 @@
+//! Base64 decoding for the sketches `dsrs --merge` reads back from text
+//! lines, in the standard alphabet without `=` padding as
+//! [`Counter::serialize`] writes them.
+//!
+//! Unlike `base64::decode_config`, decoded bytes go to a reused
+//! per-thread buffer rather than a fresh `Vec` per line, and on x86_64
+//! CPUs with AVX2 whole 32-character blocks are translated and packed
+//! with vector instructions, leaving only the tail to the scalar table.
+//! Errors match the `base64` crate's, which the rest of the crate
+//! already converts.
+//!
+//! [`Counter::serialize`]: crate::counters::Counter::serialize
+
+use std::cell::RefCell;
+
+use base64::DecodeError;
+
+/// Marks bytes outside the alphabet in [`DECODE_TABLE`].
+const INVALID: u8 = 0xff;
+
+/// Six-bit value of each base64 character, or [`INVALID`].
+const DECODE_TABLE: [u8; 256] = decode_table();
+
+const fn decode_table() -> [u8; 256] {
+    let alphabet = b"ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+    let mut table = [INVALID; 256];
+    let mut i = 0;
+    while i < alphabet.len() {
+        table[alphabet[i] as usize] = i as u8;
+        i += 1;
+    }
+    table
+}
+
+thread_local! {
+    static SCRATCH: RefCell<Vec<u8>> = RefCell::new(Vec::new());
+}
+
+/// Decodes `input` into this thread's scratch buffer and hands the bytes
+/// to `f`, which must not itself call `with_decoded`.
+pub(crate) fn with_decoded<R>(input: &[u8], f: impl FnOnce(&[u8]) -> R) -> Result<R, DecodeError> {
+    SCRATCH.with(|scratch| {
+        let mut scratch = scratch.borrow_mut();
+        decode(input, &mut scratch)?;
+        Ok(f(&scratch))
+    })
+}
+
+/// Decodes `input` into `out`, replacing its contents.
+pub(crate) fn decode(input: &[u8], out: &mut Vec<u8>) -> Result<(), DecodeError> {
+    if input.len() % 4 == 1 {
+        return Err(DecodeError::InvalidLength);
+    }
+    out.clear();
+    // Room for the 8 bytes past the end that each vector store scribbles.
+    out.reserve(input.len() / 4 * 3 + 2 + 8);
+    let mut read = 0;
+    #[cfg(target_arch = "x86_64")]
+    {
+        if is_x86_feature_detected!("avx2") {
+            // Safety: AVX2 is available, and `out` has room for every
+            // block, as asserted in `decode_blocks`.
+            read = unsafe { avx2::decode_blocks(input, out) };
+        }
+    }
+    decode_scalar(input, read, out)
+}
+
+/// Decodes `input[start..]` onto the end of `out`, reporting offsets
+/// relative to the whole of `input`.
+fn decode_scalar(input: &[u8], start: usize, out: &mut Vec<u8>) -> Result<(), DecodeError> {
+    let value = |i: usize| match DECODE_TABLE[input[i] as usize] {
+        INVALID => Err(DecodeError::InvalidByte(i, input[i])),
+        v => Ok(u32::from(v)),
+    };
+
+    let whole = start + (input.len() - start) / 4 * 4;
+    for i in (start..whole).step_by(4) {
+        let word = value(i)? << 18 | value(i + 1)? << 12 | value(i + 2)? << 6 | value(i + 3)?;
+        out.extend_from_slice(&word.to_be_bytes()[1..]);
+    }
+
+    // The last 2 or 3 characters carry 1 or 2 bytes, and bits past them
+    // must be zero, as in the `base64` crate.
+    let (word, bytes, spare_mask) = match input.len() - whole {
+        0 => return Ok(()),
+        2 => (value(whole)? << 18 | value(whole + 1)? << 12, 1, 0xf),
+        3 => (
+            value(whole)? << 18 | value(whole + 1)? << 12 | value(whole + 2)? << 6,
+            2,
+            0x3,
+        ),
+        _ => unreachable!("length checked in decode"),
+    };
+    let last = input.len() - 1;
+    if u32::from(DECODE_TABLE[input[last] as usize]) & spare_mask != 0 {
+        return Err(DecodeError::InvalidLastSymbol(last, input[last]));
+    }
+    out.extend_from_slice(&word.to_be_bytes()[1..=bytes]);
+    Ok(())
+}
+
+#[cfg(target_arch = "x86_64")]
+mod avx2 {
+    use std::arch::x86_64::*;
+
+    /// Characters consumed per block.
+    const BLOCK: usize = 32;
+
+    /// Decodes the leading 32-character blocks of `input` onto the end of
+    /// `out`, returning how many characters were consumed. Stops early at
+    /// a block with a character outside the alphabet, which the scalar
+    /// decoder then reports at its exact offset. The final characters are
+    /// always left over, so that the scalar decoder checks the last
+    /// symbol.
+    ///
+    /// # Safety
+    ///
+    /// The CPU must support AVX2, and `out` must have spare capacity for
+    /// 8 bytes beyond the 24 decoded per block.
+    #[target_feature(enable = "avx2")]
+    pub(super) unsafe fn decode_blocks(input: &[u8], out: &mut Vec<u8>) -> usize {
+        let blocks = input.len().saturating_sub(1) / BLOCK;
+        assert!(out.capacity() - out.len() >= blocks * 24 + 8);
+
+        // Nibble tables from Muła and Lemire, "Faster Base64 Encoding and
+        // Decoding using AVX2 Instructions": a character is in the
+        // alphabet iff its low- and high-nibble classes share no bit, and
+        // its high nibble (bumped for '/') selects the offset to its value.
+        let lut_lo = _mm256_setr_epi8(
+            0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a, 0x1b, 0x1b,
+            0x1b, 0x1a, 0x15, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x11, 0x13, 0x1a,
+            0x1b, 0x1b, 0x1b, 0x1a,
+        );
+        let lut_hi = _mm256_setr_epi8(
+            0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x10, 0x10, 0x01, 0x02, 0x04, 0x08, 0x04, 0x08, 0x10, 0x10, 0x10, 0x10,
+            0x10, 0x10, 0x10, 0x10,
+        );
+        let lut_roll = _mm256_setr_epi8(
+            0, 16, 19, 4, -65, -65, -71, -71, 0, 0, 0, 0, 0, 0, 0, 0, 0, 16, 19, 4, -65, -65, -71,
+            -71, 0, 0, 0, 0, 0, 0, 0, 0,
+        );
+        let mask_2f = _mm256_set1_epi8(0x2f);
+        // Packs each four six-bit values into three big-endian bytes,
+        // then squeezes out the gaps within and between the lanes.
+        let merge_pairs = _mm256_set1_epi32(0x0140_0140);
+        let merge_quads = _mm256_set1_epi32(0x0001_1000);
+        let pack_lanes = _mm256_setr_epi8(
+            2, 1, 0, 6, 5, 4, 10, 9, 8, 14, 13, 12, -1, -1, -1, -1, 2, 1, 0, 6, 5, 4, 10, 9, 8, 14,
+            13, 12, -1, -1, -1, -1,
+        );
+        let pack_words = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, -1, -1);
+
+        let mut read = 0;
+        for _ in 0..blocks {
+            let chars = _mm256_loadu_si256(input.as_ptr().add(read) as *const __m256i);
+            let hi_nibbles = _mm256_and_si256(_mm256_srli_epi32(chars, 4), mask_2f);
+            let lo_nibbles = _mm256_and_si256(chars, mask_2f);
+            let hi = _mm256_shuffle_epi8(lut_hi, hi_nibbles);
+            let lo = _mm256_shuffle_epi8(lut_lo, lo_nibbles);
+            if _mm256_testz_si256(lo, hi) == 0 {
+                break;
+            }
+            let eq_2f = _mm256_cmpeq_epi8(chars, mask_2f);
+            let roll = _mm256_shuffle_epi8(lut_roll, _mm256_add_epi8(eq_2f, hi_nibbles));
+            let values = _mm256_add_epi8(chars, roll);
+
+            let pairs = _mm256_maddubs_epi16(values, merge_pairs);
+            let quads = _mm256_madd_epi16(pairs, merge_quads);
+            let packed = _mm256_shuffle_epi8(quads, pack_lanes);
+            let packed = _mm256_permutevar8x32_epi32(packed, pack_words);
+
+            let len = out.len();
+            _mm256_storeu_si256(out.as_mut_ptr().add(len) as *mut __m256i, packed);
+            out.set_len(len + 24);
+            read += BLOCK;
+        }
+        read
+    }
+}
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+    fn decoded(input: &[u8]) -> Result<Vec<u8>, DecodeError> {
+        let mut out = b"stale".to_vec();
+        decode(input, &mut out).map(|()| out)
+    }
+
+    fn check_scalar(input: &[u8]) {
+        let mut expected = Vec::new();
+        let scalar = decode_scalar(input, 0, &mut expected).map(|()| expected);
+        assert_eq!(decoded(input), scalar, "{:?}", input);
+    }
+
+    #[test]
+    fn matches_base64() {
+        for len in 0..300 {
+            let bytes: Vec<u8> = (0..len).map(|i| (i * 37 + len) as u8).collect();
+            let encoded = base64::encode_config(&bytes, base64::STANDARD_NO_PAD);
+            assert_eq!(decoded(encoded.as_bytes()).unwrap(), bytes);
+            check_scalar(encoded.as_bytes());
+        }
+        let all: Vec<u8> = (0..=255).collect();
+        let encoded = base64::encode_config(&all, base64::STANDARD_NO_PAD);
+        assert_eq!(decoded(encoded.as_bytes()).unwrap(), all);
+    }
+
+    #[test]
+    fn rejects_like_base64() {
+        let encoded = base64::encode_config(&[0xab; 100], base64::STANDARD_NO_PAD);
+        for &(offset, byte) in &[(0, b'='), (5, b'-'), (40, b'\n'), (70, 0x80), (133, b'.')] {
+            let mut input = encoded.clone().into_bytes();
+            input[offset] = byte;
+            assert_eq!(
+                decoded(&input),
+                Err(DecodeError::InvalidByte(offset, byte)),
+                "{}",
+                offset
+            );
+            check_scalar(&input);
+        }
+        assert_eq!(decoded(b"AAAAA"), Err(DecodeError::InvalidLength));
+        assert_eq!(decoded(b"AB"), Err(DecodeError::InvalidLastSymbol(1, b'B')));
+        assert_eq!(
+            decoded(b"AAB"),
+            Err(DecodeError::InvalidLastSymbol(2, b'B'))
+        );
+        assert_eq!(
+            base64::decode_config("AB", base64::STANDARD_NO_PAD),
+            Err(DecodeError::InvalidLastSymbol(1, b'B'))
+        );
+    }
+
+    #[test]
+    fn reuses_scratch() {
+        let encoded = base64::encode_config(&[7; 1000], base64::STANDARD_NO_PAD);
+        let first = with_decoded(encoded.as_bytes(), |bytes| bytes.as_ptr() as usize).unwrap();
+        let second = with_decoded(b"Bw", |bytes| {
+            assert_eq!(bytes, [7]);
+            bytes.as_ptr() as usize
+        });
+        assert_eq!(second, Ok(first));
+    }
+}
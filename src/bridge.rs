@@ -2,7 +2,7 @@
 //!
 //! See [`crate::wrapper`] for external Rust-friendly types.
 
-use crate::wrapper::hh::remove_from_hashset;
+use crate::wrapper::hh::{intern_into_hashset, remove_from_hashset};
 
 #[cxx::bridge]
 pub(crate) mod ffi {
@@ -14,8 +14,106 @@ pub(crate) mod ffi {
         ub: u64,
     }
 
+    /// An entry to the heavy hitters sketch with keys that refer to
+    /// `len` bytes at `addr`, owned by the sketch.
+    struct HeavyHitterRow {
+        addr: usize,
+        len: usize,
+        lb: u64,
+        ub: u64,
+    }
+
+    /// A sampled item of `len` bytes at `addr`, owned by the var_opt
+    /// sketch, and its adjusted weight.
+    struct SampleRow {
+        addr: usize,
+        len: usize,
+        weight: f64,
+    }
+
+    /// Bounds on the weight of a subset of a var_opt sketch's stream.
+    struct SubsetSummary {
+        lower_bound: f64,
+        estimate: f64,
+        upper_bound: f64,
+        total_sketch_weight: f64,
+    }
+
+    /// An estimate between its lower and upper bounds, of a distinct count
+    /// or a Jaccard index.
+    #[derive(Clone, Copy, Default)]
+    struct EstimateBounds {
+        lower_bound: f64,
+        estimate: f64,
+        upper_bound: f64,
+    }
+
+    /// The 128-bit MurmurHash3 of a key, as the CPC, theta and HLL sketches
+    /// hash it, so that one hash of a key can update several sketches.
+    #[derive(Clone, Copy, Debug, Default, PartialEq, Eq)]
+    struct KeyHash {
+        h1: u64,
+        h2: u64,
+    }
+
+    /// Bits per bucket in the HLL sketch's dense representation.
+    #[derive(Debug)]
+    enum HllType {
+        Hll4,
+        Hll6,
+        Hll8,
+    }
+
+    /// Factor by which the theta sketch's hash table grows on each resize.
+    #[derive(Debug)]
+    enum ThetaResizeFactor {
+        X1,
+        X2,
+        X4,
+        X8,
+    }
+
+    /// How set operations over array of doubles columns combine the
+    /// doubles of a value found in more than one input.
+    #[derive(Debug)]
+    enum AodCombine {
+        Sum,
+        Min,
+        Max,
+    }
+
     extern "Rust" {
         unsafe fn remove_from_hashset(hashset_addr: usize, addr: usize);
+        unsafe fn intern_into_hashset(hashset_addr: usize, addr: usize) -> usize;
+    }
+
+    unsafe extern "C++" {
+        include!("dsrs/datasketches-cpp/key_hash.hpp");
+
+        pub(crate) fn hash_key(buf: &[u8]) -> KeyHash;
+        pub(crate) fn hash_keys(buf: &[u8], ends: &[usize], hashes: &mut [KeyHash]);
+    }
+
+    unsafe extern "C++" {
+        include!("dsrs/datasketches-cpp/huge_pages.hpp");
+
+        pub(crate) fn set_huge_pages(enabled: bool);
+    }
+
+    unsafe extern "C++" {
+        include!("dsrs/datasketches-cpp/alloc_stats.hpp");
+
+        pub(crate) fn allocations_of(family: u8) -> u64;
+        pub(crate) fn allocated_bytes_of(family: u8) -> u64;
+        pub(crate) fn live_bytes_of(family: u8) -> i64;
+        pub(crate) fn peak_live_bytes_of(family: u8) -> i64;
+        pub(crate) fn reset_peak_live_bytes();
+    }
+
+    unsafe extern "C++" {
+        include!("dsrs/datasketches-cpp/sketch_events.hpp");
+
+        pub(crate) fn sketch_event_count(event: u8) -> u64;
     }
 
     unsafe extern "C++" {
@@ -23,61 +121,804 @@ pub(crate) mod ffi {
 
         pub(crate) type OpaqueCpcSketch;
 
-        pub(crate) fn new_opaque_cpc_sketch() -> UniquePtr<OpaqueCpcSketch>;
+        pub(crate) fn new_opaque_cpc_sketch(lg_k: u8) -> Result<UniquePtr<OpaqueCpcSketch>>;
         pub(crate) fn deserialize_opaque_cpc_sketch(
             buf: &[u8],
         ) -> Result<UniquePtr<OpaqueCpcSketch>>;
+        pub(crate) fn estimate_serialized_cpc_sketch(buf: &[u8]) -> Result<f64>;
+        pub(crate) fn bounds_serialized_cpc_sketch(buf: &[u8], kappa: u8)
+            -> Result<EstimateBounds>;
+        pub(crate) fn cpc_coupon(buf: &[u8], lg_k: u8) -> u32;
+        pub(crate) fn init_cpc();
         pub(crate) fn estimate(self: &OpaqueCpcSketch) -> f64;
+        pub(crate) fn is_dirty(self: &OpaqueCpcSketch) -> bool;
         pub(crate) fn update(self: Pin<&mut OpaqueCpcSketch>, buf: &[u8]);
         pub(crate) fn update_u64(self: Pin<&mut OpaqueCpcSketch>, value: u64);
+        pub(crate) fn update_u64_batch(self: Pin<&mut OpaqueCpcSketch>, values: &[u64]);
+        pub(crate) fn update_bytes_batch(
+            self: Pin<&mut OpaqueCpcSketch>,
+            buf: &[u8],
+            ends: &[usize],
+        );
+        pub(crate) fn update_hashed(self: Pin<&mut OpaqueCpcSketch>, hash: KeyHash);
+        pub(crate) fn update_hashed_batch(self: Pin<&mut OpaqueCpcSketch>, hashes: &[KeyHash]);
+        pub(crate) fn update_coupons(self: Pin<&mut OpaqueCpcSketch>, coupons: &[u32]);
+        pub(crate) fn reset(self: Pin<&mut OpaqueCpcSketch>);
+        pub(crate) fn get_lg_k(self: &OpaqueCpcSketch) -> u8;
         pub(crate) fn serialize(self: &OpaqueCpcSketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn serialize_without_hip(self: &OpaqueCpcSketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn get_serialized_size_bytes(self: &OpaqueCpcSketch, with_hip: bool) -> usize;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueCpcSketch) -> usize;
+        pub(crate) fn serialize_into(
+            self: &OpaqueCpcSketch,
+            buf: &mut [u8],
+            with_hip: bool,
+        ) -> usize;
 
         pub(crate) type OpaqueCpcUnion;
 
-        pub(crate) fn new_opaque_cpc_union() -> UniquePtr<OpaqueCpcUnion>;
+        pub(crate) fn new_opaque_cpc_union(lg_k: u8) -> Result<UniquePtr<OpaqueCpcUnion>>;
         pub(crate) fn sketch(self: &OpaqueCpcUnion) -> UniquePtr<OpaqueCpcSketch>;
         pub(crate) fn merge(self: Pin<&mut OpaqueCpcUnion>, to_add: UniquePtr<OpaqueCpcSketch>);
+        pub(crate) fn merge_serialized(self: Pin<&mut OpaqueCpcUnion>, buf: &[u8]) -> Result<()>;
+        pub(crate) fn reset(self: Pin<&mut OpaqueCpcUnion>);
+
+        pub(crate) type OpaqueCpcArena;
+
+        pub(crate) fn new_opaque_cpc_arena() -> UniquePtr<OpaqueCpcArena>;
+        pub(crate) fn sketch(self: &OpaqueCpcArena, lg_k: u8)
+            -> Result<UniquePtr<OpaqueCpcSketch>>;
 
         include!("dsrs/datasketches-cpp/theta.hpp");
 
         pub(crate) type OpaqueThetaSketch;
 
-        pub(crate) fn new_opaque_theta_sketch() -> UniquePtr<OpaqueThetaSketch>;
+        pub(crate) fn new_opaque_theta_sketch(
+            lg_k: u8,
+            resize_factor: ThetaResizeFactor,
+            p: f32,
+            expected_n: u64,
+        ) -> Result<UniquePtr<OpaqueThetaSketch>>;
         pub(crate) fn estimate(self: &OpaqueThetaSketch) -> f64;
+        pub(crate) fn bounds(self: &OpaqueThetaSketch, num_std_devs: u8) -> Result<EstimateBounds>;
+        pub(crate) fn is_dirty(self: &OpaqueThetaSketch) -> bool;
         pub(crate) fn update(self: Pin<&mut OpaqueThetaSketch>, buf: &[u8]);
         pub(crate) fn update_u64(self: Pin<&mut OpaqueThetaSketch>, value: u64);
-        pub(crate) fn as_static(self: &OpaqueThetaSketch) -> UniquePtr<OpaqueStaticThetaSketch>;
+        pub(crate) fn update_u64_batch(self: Pin<&mut OpaqueThetaSketch>, values: &[u64]);
+        pub(crate) fn update_bytes_batch(
+            self: Pin<&mut OpaqueThetaSketch>,
+            buf: &[u8],
+            ends: &[usize],
+        );
+        pub(crate) fn update_hashed(self: Pin<&mut OpaqueThetaSketch>, hash: KeyHash);
+        pub(crate) fn update_hashed_batch(self: Pin<&mut OpaqueThetaSketch>, hashes: &[KeyHash]);
+        pub(crate) fn reset(self: Pin<&mut OpaqueThetaSketch>);
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueThetaSketch) -> usize;
+        pub(crate) fn as_static(
+            self: &OpaqueThetaSketch,
+            ordered: bool,
+        ) -> UniquePtr<OpaqueStaticThetaSketch>;
+
+        pub(crate) type OpaqueConcurrentThetaSketch;
+
+        pub(crate) fn new_opaque_concurrent_theta_sketch() -> UniquePtr<OpaqueConcurrentThetaSketch>;
+        pub(crate) fn estimate(self: &OpaqueConcurrentThetaSketch) -> f64;
+        pub(crate) fn as_static(
+            self: &OpaqueConcurrentThetaSketch,
+            ordered: bool,
+        ) -> UniquePtr<OpaqueStaticThetaSketch>;
+        pub(crate) fn buffer(
+            self: &OpaqueConcurrentThetaSketch,
+            capacity: usize,
+        ) -> UniquePtr<OpaqueThetaBuffer>;
+
+        pub(crate) type OpaqueThetaBuffer;
+
+        pub(crate) fn update(self: Pin<&mut OpaqueThetaBuffer>, buf: &[u8]);
+        pub(crate) fn update_u64(self: Pin<&mut OpaqueThetaBuffer>, value: u64);
+        pub(crate) fn flush(self: Pin<&mut OpaqueThetaBuffer>);
 
         pub(crate) type OpaqueStaticThetaSketch;
 
         pub(crate) fn estimate(self: &OpaqueStaticThetaSketch) -> f64;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueStaticThetaSketch) -> usize;
+        pub(crate) fn bounds(
+            self: &OpaqueStaticThetaSketch,
+            num_std_devs: u8,
+        ) -> Result<EstimateBounds>;
         pub(crate) fn clone(self: &OpaqueStaticThetaSketch) -> UniquePtr<OpaqueStaticThetaSketch>;
         pub(crate) fn set_difference(
             self: Pin<&mut OpaqueStaticThetaSketch>,
             other: &OpaqueStaticThetaSketch,
         );
+        pub(crate) fn exclude(
+            self: Pin<&mut OpaqueStaticThetaSketch>,
+            exclusion: &OpaqueThetaExclusion,
+        );
         pub(crate) fn serialize(self: &OpaqueStaticThetaSketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn serialize_compressed(
+            self: &OpaqueStaticThetaSketch,
+        ) -> UniquePtr<CxxVector<u8>>;
         pub(crate) fn deserialize_opaque_static_theta_sketch(
             buf: &[u8],
         ) -> Result<UniquePtr<OpaqueStaticThetaSketch>>;
 
+        pub(crate) type OpaqueThetaExclusion;
+
+        pub(crate) fn new_opaque_theta_exclusion(
+            b: &OpaqueStaticThetaSketch,
+        ) -> UniquePtr<OpaqueThetaExclusion>;
+
+        pub(crate) type OpaqueWrappedThetaSketch;
+
+        /// The result points into `buf`, which must outlive it.
+        pub(crate) unsafe fn wrap_opaque_static_theta_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueWrappedThetaSketch>>;
+        pub(crate) fn estimate_serialized_theta_sketch(buf: &[u8]) -> Result<f64>;
+        pub(crate) fn bounds_serialized_theta_sketch(
+            buf: &[u8],
+            num_std_devs: u8,
+        ) -> Result<EstimateBounds>;
+        pub(crate) fn bounds_serialized_theta_sketches(
+            buf: &[u8],
+            ends: &[usize],
+            num_std_devs: u8,
+            out: &mut [EstimateBounds],
+        ) -> Result<()>;
+        pub(crate) fn estimate(self: &OpaqueWrappedThetaSketch) -> f64;
+        pub(crate) fn to_static(
+            self: &OpaqueWrappedThetaSketch,
+        ) -> UniquePtr<OpaqueStaticThetaSketch>;
+
         pub(crate) type OpaqueThetaUnion;
 
         pub(crate) fn new_opaque_theta_union() -> UniquePtr<OpaqueThetaUnion>;
-        pub(crate) fn sketch(self: &OpaqueThetaUnion) -> UniquePtr<OpaqueStaticThetaSketch>;
+        pub(crate) fn sketch(
+            self: &OpaqueThetaUnion,
+            ordered: bool,
+        ) -> UniquePtr<OpaqueStaticThetaSketch>;
+        pub(crate) fn take_sketch(
+            self: Pin<&mut OpaqueThetaUnion>,
+        ) -> UniquePtr<OpaqueStaticThetaSketch>;
         pub(crate) fn union_with(
             self: Pin<&mut OpaqueThetaUnion>,
             to_union: UniquePtr<OpaqueStaticThetaSketch>,
         );
+        pub(crate) fn union_with_ref(
+            self: Pin<&mut OpaqueThetaUnion>,
+            to_union: &OpaqueStaticThetaSketch,
+        );
+        pub(crate) fn union_with_wrapped(
+            self: Pin<&mut OpaqueThetaUnion>,
+            to_union: &OpaqueWrappedThetaSketch,
+        );
+        pub(crate) fn union_serialized(self: Pin<&mut OpaqueThetaUnion>, buf: &[u8]) -> Result<()>;
+        pub(crate) fn reset(self: Pin<&mut OpaqueThetaUnion>);
+
+        pub(crate) type OpaqueKeyedThetaSketch;
+
+        pub(crate) fn new_opaque_keyed_theta_sketch(
+            lg_k: u8,
+        ) -> Result<UniquePtr<OpaqueKeyedThetaSketch>>;
+        pub(crate) fn update(
+            self: Pin<&mut OpaqueKeyedThetaSketch>,
+            key_id: u32,
+            key_hash: u64,
+            buf: &[u8],
+        );
+        pub(crate) fn counts(self: &OpaqueKeyedThetaSketch, counts: &mut [u32]) -> Result<()>;
+        pub(crate) fn theta(self: &OpaqueKeyedThetaSketch) -> f64;
+        pub(crate) fn num_retained(self: &OpaqueKeyedThetaSketch) -> u32;
+        pub(crate) fn get_lg_k(self: &OpaqueKeyedThetaSketch) -> u8;
+        pub(crate) fn merge(
+            self: Pin<&mut OpaqueKeyedThetaSketch>,
+            other: &OpaqueKeyedThetaSketch,
+            key_map: &[u32],
+        ) -> Result<()>;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueKeyedThetaSketch) -> usize;
 
         pub(crate) type OpaqueThetaIntersection;
 
         pub(crate) fn new_opaque_theta_intersection() -> UniquePtr<OpaqueThetaIntersection>;
         pub(crate) fn sketch(self: &OpaqueThetaIntersection) -> UniquePtr<OpaqueStaticThetaSketch>;
+        pub(crate) fn take_sketch(
+            self: Pin<&mut OpaqueThetaIntersection>,
+        ) -> UniquePtr<OpaqueStaticThetaSketch>;
         pub(crate) fn intersect_with(
             self: Pin<&mut OpaqueThetaIntersection>,
             to_intersect: UniquePtr<OpaqueStaticThetaSketch>,
         );
+        pub(crate) fn intersect_with_ref(
+            self: Pin<&mut OpaqueThetaIntersection>,
+            to_intersect: &OpaqueStaticThetaSketch,
+        );
+        pub(crate) fn intersect_with_wrapped(
+            self: Pin<&mut OpaqueThetaIntersection>,
+            to_intersect: &OpaqueWrappedThetaSketch,
+        );
+
+        pub(crate) type OpaqueThetaWindow;
+
+        pub(crate) fn new_opaque_theta_window(
+            lg_k: u8,
+            p: f32,
+            num_slices: usize,
+        ) -> Result<UniquePtr<OpaqueThetaWindow>>;
+        pub(crate) fn estimate(self: &OpaqueThetaWindow) -> f64;
+        pub(crate) fn is_dirty(self: &OpaqueThetaWindow) -> bool;
+        pub(crate) fn sketch(self: &OpaqueThetaWindow) -> UniquePtr<OpaqueStaticThetaSketch>;
+        pub(crate) fn update(self: Pin<&mut OpaqueThetaWindow>, buf: &[u8]);
+        pub(crate) fn update_bytes_batch(
+            self: Pin<&mut OpaqueThetaWindow>,
+            buf: &[u8],
+            ends: &[usize],
+        );
+        pub(crate) fn advance(self: Pin<&mut OpaqueThetaWindow>);
+        pub(crate) fn get_num_slices(self: &OpaqueThetaWindow) -> usize;
+
+        pub(crate) type OpaqueThetaExpression;
+
+        pub(crate) fn new_opaque_theta_expression() -> UniquePtr<OpaqueThetaExpression>;
+        /// Ordered inputs are read in place from `buf`, which must outlive it.
+        pub(crate) unsafe fn add_input(
+            self: Pin<&mut OpaqueThetaExpression>,
+            buf: &[u8],
+        ) -> Result<()>;
+        pub(crate) fn evaluate(
+            self: &OpaqueThetaExpression,
+            program: &[u32],
+        ) -> Result<UniquePtr<OpaqueStaticThetaSketch>>;
+
+        pub(crate) type OpaqueThetaJaccardMatrix;
+
+        pub(crate) fn new_opaque_theta_jaccard_matrix() -> UniquePtr<OpaqueThetaJaccardMatrix>;
+        pub(crate) fn add(
+            self: Pin<&mut OpaqueThetaJaccardMatrix>,
+            sketch: &OpaqueStaticThetaSketch,
+        );
+        pub(crate) fn num_sketches(self: &OpaqueThetaJaccardMatrix) -> usize;
+        pub(crate) fn jaccard(
+            self: &OpaqueThetaJaccardMatrix,
+            i: usize,
+            j: usize,
+        ) -> EstimateBounds;
+        pub(crate) fn jaccard_tile(
+            self: &OpaqueThetaJaccardMatrix,
+            row_begin: usize,
+            row_end: usize,
+            col_begin: usize,
+            col_end: usize,
+            out: &mut [EstimateBounds],
+        );
+
+        include!("dsrs/datasketches-cpp/tuple.hpp");
+
+        pub(crate) type OpaqueAodSketch;
+
+        pub(crate) fn new_opaque_aod_sketch(
+            num_values: u8,
+            expected_n: u64,
+        ) -> UniquePtr<OpaqueAodSketch>;
+        pub(crate) fn estimate(self: &OpaqueAodSketch) -> f64;
+        /// `values` must hold `num_values` doubles.
+        pub(crate) unsafe fn update(self: Pin<&mut OpaqueAodSketch>, buf: &[u8], values: &[f64]);
+        /// `values` must hold `num_values` doubles.
+        pub(crate) unsafe fn update_u64(
+            self: Pin<&mut OpaqueAodSketch>,
+            value: u64,
+            values: &[f64],
+        );
+        pub(crate) fn as_static(self: &OpaqueAodSketch) -> UniquePtr<OpaqueStaticAodSketch>;
+
+        pub(crate) type OpaqueStaticAodSketch;
+
+        pub(crate) fn estimate(self: &OpaqueStaticAodSketch) -> f64;
+        pub(crate) fn num_values(self: &OpaqueStaticAodSketch) -> u8;
+        pub(crate) fn estimate_sums(self: &OpaqueStaticAodSketch) -> UniquePtr<CxxVector<f64>>;
+        pub(crate) fn clone(self: &OpaqueStaticAodSketch) -> UniquePtr<OpaqueStaticAodSketch>;
+        pub(crate) fn serialize(self: &OpaqueStaticAodSketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn to_columns(self: &OpaqueStaticAodSketch) -> UniquePtr<OpaqueAodColumns>;
+        pub(crate) fn deserialize_opaque_static_aod_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueStaticAodSketch>>;
+
+        pub(crate) type OpaqueAodUnion;
+
+        pub(crate) fn new_opaque_aod_union(num_values: u8) -> UniquePtr<OpaqueAodUnion>;
+        pub(crate) fn sketch(self: &OpaqueAodUnion) -> UniquePtr<OpaqueStaticAodSketch>;
+        pub(crate) fn union_with(
+            self: Pin<&mut OpaqueAodUnion>,
+            to_union: UniquePtr<OpaqueStaticAodSketch>,
+        );
+
+        pub(crate) type OpaqueAodIntersection;
+
+        pub(crate) fn new_opaque_aod_intersection(
+            num_values: u8,
+        ) -> UniquePtr<OpaqueAodIntersection>;
+        pub(crate) fn sketch(self: &OpaqueAodIntersection) -> UniquePtr<OpaqueStaticAodSketch>;
+        pub(crate) fn intersect_with(
+            self: Pin<&mut OpaqueAodIntersection>,
+            to_intersect: UniquePtr<OpaqueStaticAodSketch>,
+        );
+
+        pub(crate) type OpaqueAodColumns;
+
+        pub(crate) fn estimate(self: &OpaqueAodColumns) -> f64;
+        pub(crate) fn num_values(self: &OpaqueAodColumns) -> u8;
+        pub(crate) fn hashes(self: &OpaqueAodColumns) -> &[u64];
+        /// `index` must be less than `num_values`.
+        pub(crate) unsafe fn column(self: &OpaqueAodColumns, index: u8) -> &[f64];
+        pub(crate) fn estimate_sums(self: &OpaqueAodColumns) -> UniquePtr<CxxVector<f64>>;
+        pub(crate) fn to_sketch(self: &OpaqueAodColumns) -> UniquePtr<OpaqueStaticAodSketch>;
+        pub(crate) fn clone(self: &OpaqueAodColumns) -> UniquePtr<OpaqueAodColumns>;
+        pub(crate) fn serialize(self: &OpaqueAodColumns) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn deserialize_opaque_aod_columns(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueAodColumns>>;
+
+        pub(crate) type OpaqueAodColumnsUnion;
+
+        pub(crate) fn new_opaque_aod_columns_union(
+            num_values: u8,
+            combine: AodCombine,
+        ) -> UniquePtr<OpaqueAodColumnsUnion>;
+        pub(crate) fn sketch(self: &OpaqueAodColumnsUnion) -> UniquePtr<OpaqueAodColumns>;
+        pub(crate) fn union_with(
+            self: Pin<&mut OpaqueAodColumnsUnion>,
+            to_union: &OpaqueAodColumns,
+        );
+
+        pub(crate) type OpaqueAodColumnsIntersection;
+
+        pub(crate) fn new_opaque_aod_columns_intersection(
+            num_values: u8,
+            combine: AodCombine,
+        ) -> UniquePtr<OpaqueAodColumnsIntersection>;
+        pub(crate) fn sketch(self: &OpaqueAodColumnsIntersection) -> UniquePtr<OpaqueAodColumns>;
+        pub(crate) fn intersect_with(
+            self: Pin<&mut OpaqueAodColumnsIntersection>,
+            to_intersect: &OpaqueAodColumns,
+        );
+
+        include!("dsrs/datasketches-cpp/hll.hpp");
+
+        pub(crate) type OpaqueHllSketch;
+
+        pub(crate) fn new_opaque_hll_sketch(
+            lg_k: u8,
+            tgt_type: HllType,
+        ) -> Result<UniquePtr<OpaqueHllSketch>>;
+        pub(crate) fn deserialize_opaque_hll_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueHllSketch>>;
+        pub(crate) fn estimate_serialized_hll_sketch(buf: &[u8]) -> Result<f64>;
+        pub(crate) fn bounds_serialized_hll_sketch(
+            buf: &[u8],
+            num_std_dev: u8,
+        ) -> Result<EstimateBounds>;
+        pub(crate) fn estimate(self: &OpaqueHllSketch) -> f64;
+        pub(crate) fn update(self: Pin<&mut OpaqueHllSketch>, buf: &[u8]);
+        pub(crate) fn update_u64(self: Pin<&mut OpaqueHllSketch>, value: u64);
+        pub(crate) fn update_u64_batch(self: Pin<&mut OpaqueHllSketch>, values: &[u64]);
+        pub(crate) fn update_bytes_batch(
+            self: Pin<&mut OpaqueHllSketch>,
+            buf: &[u8],
+            ends: &[usize],
+        );
+        pub(crate) fn update_hashed(self: Pin<&mut OpaqueHllSketch>, hash: KeyHash);
+        pub(crate) fn update_hashed_batch(self: Pin<&mut OpaqueHllSketch>, hashes: &[KeyHash]);
+        pub(crate) fn reset(self: Pin<&mut OpaqueHllSketch>);
+        pub(crate) fn get_lg_config_k(self: &OpaqueHllSketch) -> u8;
+        pub(crate) fn get_target_type(self: &OpaqueHllSketch) -> HllType;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueHllSketch) -> usize;
+        pub(crate) fn serialize_compact(self: &OpaqueHllSketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn serialize_updatable(self: &OpaqueHllSketch) -> UniquePtr<CxxVector<u8>>;
+
+        pub(crate) type OpaqueHllUnion;
+
+        pub(crate) fn new_opaque_hll_union(lg_max_k: u8) -> Result<UniquePtr<OpaqueHllUnion>>;
+        pub(crate) fn sketch(
+            self: &OpaqueHllUnion,
+            tgt_type: HllType,
+        ) -> UniquePtr<OpaqueHllSketch>;
+        pub(crate) fn merge(self: Pin<&mut OpaqueHllUnion>, to_add: UniquePtr<OpaqueHllSketch>);
+        pub(crate) fn merge_serialized(self: Pin<&mut OpaqueHllUnion>, buf: &[u8]) -> Result<()>;
+        pub(crate) fn reset(self: Pin<&mut OpaqueHllUnion>);
+
+        pub(crate) type OpaqueHllMatrix;
+
+        pub(crate) fn new_opaque_hll_matrix(
+            lg_k: u8,
+            num_rows: usize,
+        ) -> Result<UniquePtr<OpaqueHllMatrix>>;
+        pub(crate) fn num_rows(self: &OpaqueHllMatrix) -> usize;
+        pub(crate) fn get_lg_config_k(self: &OpaqueHllMatrix) -> u8;
+        pub(crate) fn add_rows(self: Pin<&mut OpaqueHllMatrix>, n: usize);
+        pub(crate) fn update_hashed_batch(
+            self: Pin<&mut OpaqueHllMatrix>,
+            rows: &[u32],
+            hashes: &[KeyHash],
+        );
+        pub(crate) fn merge(self: Pin<&mut OpaqueHllMatrix>, other: &OpaqueHllMatrix)
+            -> Result<()>;
+        pub(crate) fn estimate(self: &OpaqueHllMatrix, row: usize) -> f64;
+        pub(crate) fn serialize_row(
+            self: &OpaqueHllMatrix,
+            row: usize,
+            tgt_type: HllType,
+        ) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn reset(self: Pin<&mut OpaqueHllMatrix>);
+
+        pub(crate) fn update_hll_registers(registers: &mut [u8], hashes: &[KeyHash]) -> Result<()>;
+        pub(crate) fn merge_serialized_hll_registers(
+            registers: &mut [u8],
+            buf: &[u8],
+        ) -> Result<()>;
+        pub(crate) fn estimate_hll_registers(registers: &[u8]) -> Result<f64>;
+        pub(crate) fn serialize_hll_registers(
+            registers: &[u8],
+            tgt_type: HllType,
+        ) -> Result<UniquePtr<CxxVector<u8>>>;
+
+        include!("dsrs/datasketches-cpp/kll.hpp");
+
+        pub(crate) fn seed_compaction_bits(seed: u64);
+        pub(crate) fn seed_thread_compaction_bits(seed: u64);
+
+        pub(crate) type OpaqueKllDoubleSketch;
+
+        pub(crate) fn new_opaque_kll_double_sketch(
+            k: u16,
+        ) -> Result<UniquePtr<OpaqueKllDoubleSketch>>;
+        pub(crate) fn deserialize_opaque_kll_double_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueKllDoubleSketch>>;
+        pub(crate) fn is_empty(self: &OpaqueKllDoubleSketch) -> bool;
+        pub(crate) fn get_k(self: &OpaqueKllDoubleSketch) -> u16;
+        pub(crate) fn get_n(self: &OpaqueKllDoubleSketch) -> u64;
+        pub(crate) fn get_num_retained(self: &OpaqueKllDoubleSketch) -> u32;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueKllDoubleSketch) -> usize;
+        pub(crate) fn is_estimation_mode(self: &OpaqueKllDoubleSketch) -> bool;
+        pub(crate) fn get_min_value(self: &OpaqueKllDoubleSketch) -> f64;
+        pub(crate) fn get_max_value(self: &OpaqueKllDoubleSketch) -> f64;
+        pub(crate) fn get_normalized_rank_error(self: &OpaqueKllDoubleSketch, pmf: bool) -> f64;
+        pub(crate) fn update(self: Pin<&mut OpaqueKllDoubleSketch>, value: f64);
+        pub(crate) fn update_batch(self: Pin<&mut OpaqueKllDoubleSketch>, values: &[f64]);
+        pub(crate) fn merge(self: Pin<&mut OpaqueKllDoubleSketch>, other: &OpaqueKllDoubleSketch);
+        pub(crate) fn merge_serialized(
+            self: Pin<&mut OpaqueKllDoubleSketch>,
+            buf: &[u8],
+            ends: &[usize],
+        ) -> Result<()>;
+        pub(crate) fn get_quantile(self: &OpaqueKllDoubleSketch, fraction: f64) -> Result<f64>;
+        pub(crate) fn get_quantiles(
+            self: &OpaqueKllDoubleSketch,
+            fractions: &[f64],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn get_rank(self: &OpaqueKllDoubleSketch, value: f64) -> f64;
+        pub(crate) fn get_cdf(
+            self: &OpaqueKllDoubleSketch,
+            split_points: &[f64],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn get_pmf(
+            self: &OpaqueKllDoubleSketch,
+            split_points: &[f64],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn ks_delta(self: &OpaqueKllDoubleSketch, other: &OpaqueKllDoubleSketch) -> f64;
+        pub(crate) fn ks_threshold(
+            self: &OpaqueKllDoubleSketch,
+            other: &OpaqueKllDoubleSketch,
+            p: f64,
+        ) -> f64;
+        pub(crate) fn ks_test(
+            self: &OpaqueKllDoubleSketch,
+            other: &OpaqueKllDoubleSketch,
+            p: f64,
+        ) -> bool;
+        pub(crate) fn clone(self: &OpaqueKllDoubleSketch) -> UniquePtr<OpaqueKllDoubleSketch>;
+        pub(crate) fn serialize(self: &OpaqueKllDoubleSketch) -> UniquePtr<CxxVector<u8>>;
+
+        pub(crate) type OpaqueWrappedKllDoubleSketch;
+
+        /// The result points into `buf`, which must outlive it.
+        pub(crate) unsafe fn wrap_opaque_kll_double_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueWrappedKllDoubleSketch>>;
+        pub(crate) fn is_empty(self: &OpaqueWrappedKllDoubleSketch) -> bool;
+        pub(crate) fn get_n(self: &OpaqueWrappedKllDoubleSketch) -> u64;
+        pub(crate) fn get_num_retained(self: &OpaqueWrappedKllDoubleSketch) -> u32;
+        pub(crate) fn get_min_value(self: &OpaqueWrappedKllDoubleSketch) -> f64;
+        pub(crate) fn get_max_value(self: &OpaqueWrappedKllDoubleSketch) -> f64;
+        pub(crate) fn get_quantile(
+            self: &OpaqueWrappedKllDoubleSketch,
+            fraction: f64,
+        ) -> Result<f64>;
+        pub(crate) fn get_rank(self: &OpaqueWrappedKllDoubleSketch, value: f64) -> f64;
+        pub(crate) fn merge_wrapped(
+            self: Pin<&mut OpaqueKllDoubleSketch>,
+            other: &OpaqueWrappedKllDoubleSketch,
+        ) -> Result<()>;
+
+        pub(crate) type OpaqueKllFloatSketch;
+
+        pub(crate) fn new_opaque_kll_float_sketch(
+            k: u16,
+        ) -> Result<UniquePtr<OpaqueKllFloatSketch>>;
+        pub(crate) fn deserialize_opaque_kll_float_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueKllFloatSketch>>;
+        pub(crate) fn is_empty(self: &OpaqueKllFloatSketch) -> bool;
+        pub(crate) fn get_k(self: &OpaqueKllFloatSketch) -> u16;
+        pub(crate) fn get_n(self: &OpaqueKllFloatSketch) -> u64;
+        pub(crate) fn get_num_retained(self: &OpaqueKllFloatSketch) -> u32;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueKllFloatSketch) -> usize;
+        pub(crate) fn is_estimation_mode(self: &OpaqueKllFloatSketch) -> bool;
+        pub(crate) fn get_min_value(self: &OpaqueKllFloatSketch) -> f32;
+        pub(crate) fn get_max_value(self: &OpaqueKllFloatSketch) -> f32;
+        pub(crate) fn get_normalized_rank_error(self: &OpaqueKllFloatSketch, pmf: bool) -> f64;
+        pub(crate) fn update(self: Pin<&mut OpaqueKllFloatSketch>, value: f32);
+        pub(crate) fn update_batch(self: Pin<&mut OpaqueKllFloatSketch>, values: &[f32]);
+        pub(crate) fn merge(self: Pin<&mut OpaqueKllFloatSketch>, other: &OpaqueKllFloatSketch);
+        pub(crate) fn merge_serialized(
+            self: Pin<&mut OpaqueKllFloatSketch>,
+            buf: &[u8],
+            ends: &[usize],
+        ) -> Result<()>;
+        pub(crate) fn get_quantile(self: &OpaqueKllFloatSketch, fraction: f64) -> Result<f32>;
+        pub(crate) fn get_quantiles(
+            self: &OpaqueKllFloatSketch,
+            fractions: &[f64],
+        ) -> Result<UniquePtr<CxxVector<f32>>>;
+        pub(crate) fn get_rank(self: &OpaqueKllFloatSketch, value: f32) -> f64;
+        pub(crate) fn get_cdf(
+            self: &OpaqueKllFloatSketch,
+            split_points: &[f32],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn get_pmf(
+            self: &OpaqueKllFloatSketch,
+            split_points: &[f32],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn ks_delta(self: &OpaqueKllFloatSketch, other: &OpaqueKllFloatSketch) -> f64;
+        pub(crate) fn ks_threshold(
+            self: &OpaqueKllFloatSketch,
+            other: &OpaqueKllFloatSketch,
+            p: f64,
+        ) -> f64;
+        pub(crate) fn ks_test(
+            self: &OpaqueKllFloatSketch,
+            other: &OpaqueKllFloatSketch,
+            p: f64,
+        ) -> bool;
+        pub(crate) fn clone(self: &OpaqueKllFloatSketch) -> UniquePtr<OpaqueKllFloatSketch>;
+        pub(crate) fn serialize(self: &OpaqueKllFloatSketch) -> UniquePtr<CxxVector<u8>>;
+
+        pub(crate) type OpaqueWrappedKllFloatSketch;
+
+        /// The result points into `buf`, which must outlive it.
+        pub(crate) unsafe fn wrap_opaque_kll_float_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueWrappedKllFloatSketch>>;
+        pub(crate) fn is_empty(self: &OpaqueWrappedKllFloatSketch) -> bool;
+        pub(crate) fn get_n(self: &OpaqueWrappedKllFloatSketch) -> u64;
+        pub(crate) fn get_num_retained(self: &OpaqueWrappedKllFloatSketch) -> u32;
+        pub(crate) fn get_min_value(self: &OpaqueWrappedKllFloatSketch) -> f32;
+        pub(crate) fn get_max_value(self: &OpaqueWrappedKllFloatSketch) -> f32;
+        pub(crate) fn get_quantile(
+            self: &OpaqueWrappedKllFloatSketch,
+            fraction: f64,
+        ) -> Result<f32>;
+        pub(crate) fn get_rank(self: &OpaqueWrappedKllFloatSketch, value: f32) -> f64;
+        pub(crate) fn merge_wrapped(
+            self: Pin<&mut OpaqueKllFloatSketch>,
+            other: &OpaqueWrappedKllFloatSketch,
+        ) -> Result<()>;
+
+        pub(crate) type OpaqueKllU32Sketch;
+
+        pub(crate) fn new_opaque_kll_u32_sketch(k: u16) -> Result<UniquePtr<OpaqueKllU32Sketch>>;
+        pub(crate) fn deserialize_opaque_kll_u32_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueKllU32Sketch>>;
+        pub(crate) fn is_empty(self: &OpaqueKllU32Sketch) -> bool;
+        pub(crate) fn get_k(self: &OpaqueKllU32Sketch) -> u16;
+        pub(crate) fn get_n(self: &OpaqueKllU32Sketch) -> u64;
+        pub(crate) fn get_num_retained(self: &OpaqueKllU32Sketch) -> u32;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueKllU32Sketch) -> usize;
+        pub(crate) fn is_estimation_mode(self: &OpaqueKllU32Sketch) -> bool;
+        /// The sketch must not be empty.
+        pub(crate) fn get_min_value(self: &OpaqueKllU32Sketch) -> u32;
+        /// The sketch must not be empty.
+        pub(crate) fn get_max_value(self: &OpaqueKllU32Sketch) -> u32;
+        pub(crate) fn get_normalized_rank_error(self: &OpaqueKllU32Sketch, pmf: bool) -> f64;
+        pub(crate) fn update(self: Pin<&mut OpaqueKllU32Sketch>, value: u32);
+        pub(crate) fn update_batch(self: Pin<&mut OpaqueKllU32Sketch>, values: &[u32]);
+        pub(crate) fn merge(self: Pin<&mut OpaqueKllU32Sketch>, other: &OpaqueKllU32Sketch);
+        pub(crate) fn merge_serialized(
+            self: Pin<&mut OpaqueKllU32Sketch>,
+            buf: &[u8],
+            ends: &[usize],
+        ) -> Result<()>;
+        pub(crate) fn get_quantile(self: &OpaqueKllU32Sketch, fraction: f64) -> Result<u32>;
+        pub(crate) fn get_quantiles(
+            self: &OpaqueKllU32Sketch,
+            fractions: &[f64],
+        ) -> Result<UniquePtr<CxxVector<u32>>>;
+        pub(crate) fn get_rank(self: &OpaqueKllU32Sketch, value: u32) -> f64;
+        pub(crate) fn get_cdf(
+            self: &OpaqueKllU32Sketch,
+            split_points: &[u32],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn get_pmf(
+            self: &OpaqueKllU32Sketch,
+            split_points: &[u32],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn clone(self: &OpaqueKllU32Sketch) -> UniquePtr<OpaqueKllU32Sketch>;
+        pub(crate) fn serialize(self: &OpaqueKllU32Sketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn serialize_compressed(self: &OpaqueKllU32Sketch) -> UniquePtr<CxxVector<u8>>;
+
+        pub(crate) type OpaqueKllU64Sketch;
+
+        pub(crate) fn new_opaque_kll_u64_sketch(k: u16) -> Result<UniquePtr<OpaqueKllU64Sketch>>;
+        pub(crate) fn deserialize_opaque_kll_u64_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueKllU64Sketch>>;
+        pub(crate) fn is_empty(self: &OpaqueKllU64Sketch) -> bool;
+        pub(crate) fn get_k(self: &OpaqueKllU64Sketch) -> u16;
+        pub(crate) fn get_n(self: &OpaqueKllU64Sketch) -> u64;
+        pub(crate) fn get_num_retained(self: &OpaqueKllU64Sketch) -> u32;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueKllU64Sketch) -> usize;
+        pub(crate) fn is_estimation_mode(self: &OpaqueKllU64Sketch) -> bool;
+        /// The sketch must not be empty.
+        pub(crate) fn get_min_value(self: &OpaqueKllU64Sketch) -> u64;
+        /// The sketch must not be empty.
+        pub(crate) fn get_max_value(self: &OpaqueKllU64Sketch) -> u64;
+        pub(crate) fn get_normalized_rank_error(self: &OpaqueKllU64Sketch, pmf: bool) -> f64;
+        pub(crate) fn update(self: Pin<&mut OpaqueKllU64Sketch>, value: u64);
+        pub(crate) fn update_batch(self: Pin<&mut OpaqueKllU64Sketch>, values: &[u64]);
+        pub(crate) fn merge(self: Pin<&mut OpaqueKllU64Sketch>, other: &OpaqueKllU64Sketch);
+        pub(crate) fn merge_serialized(
+            self: Pin<&mut OpaqueKllU64Sketch>,
+            buf: &[u8],
+            ends: &[usize],
+        ) -> Result<()>;
+        pub(crate) fn get_quantile(self: &OpaqueKllU64Sketch, fraction: f64) -> Result<u64>;
+        pub(crate) fn get_quantiles(
+            self: &OpaqueKllU64Sketch,
+            fractions: &[f64],
+        ) -> Result<UniquePtr<CxxVector<u64>>>;
+        pub(crate) fn get_rank(self: &OpaqueKllU64Sketch, value: u64) -> f64;
+        pub(crate) fn get_cdf(
+            self: &OpaqueKllU64Sketch,
+            split_points: &[u64],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn get_pmf(
+            self: &OpaqueKllU64Sketch,
+            split_points: &[u64],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn clone(self: &OpaqueKllU64Sketch) -> UniquePtr<OpaqueKllU64Sketch>;
+        pub(crate) fn serialize(self: &OpaqueKllU64Sketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn serialize_compressed(self: &OpaqueKllU64Sketch) -> UniquePtr<CxxVector<u8>>;
+
+        include!("dsrs/datasketches-cpp/req.hpp");
+
+        pub(crate) type OpaqueReqSketch;
+
+        pub(crate) fn new_opaque_req_sketch(
+            k: u16,
+            hra: bool,
+        ) -> Result<UniquePtr<OpaqueReqSketch>>;
+        pub(crate) fn deserialize_opaque_req_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueReqSketch>>;
+        pub(crate) fn is_empty(self: &OpaqueReqSketch) -> bool;
+        pub(crate) fn get_k(self: &OpaqueReqSketch) -> u16;
+        pub(crate) fn is_hra(self: &OpaqueReqSketch) -> bool;
+        pub(crate) fn get_n(self: &OpaqueReqSketch) -> u64;
+        pub(crate) fn get_num_retained(self: &OpaqueReqSketch) -> u32;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueReqSketch) -> usize;
+        pub(crate) fn is_estimation_mode(self: &OpaqueReqSketch) -> bool;
+        pub(crate) fn get_min_value(self: &OpaqueReqSketch) -> f32;
+        pub(crate) fn get_max_value(self: &OpaqueReqSketch) -> f32;
+        pub(crate) fn update(self: Pin<&mut OpaqueReqSketch>, value: f32);
+        pub(crate) fn update_batch(self: Pin<&mut OpaqueReqSketch>, values: &[f32]);
+        pub(crate) fn merge(self: Pin<&mut OpaqueReqSketch>, other: &OpaqueReqSketch)
+            -> Result<()>;
+        pub(crate) fn get_quantile(self: &OpaqueReqSketch, rank: f64) -> Result<f32>;
+        pub(crate) fn get_quantiles(
+            self: &OpaqueReqSketch,
+            ranks: &[f64],
+        ) -> Result<UniquePtr<CxxVector<f32>>>;
+        pub(crate) fn get_rank(self: &OpaqueReqSketch, value: f32) -> f64;
+        pub(crate) fn get_rank_lower_bound(
+            self: &OpaqueReqSketch,
+            rank: f64,
+            num_std_dev: u8,
+        ) -> f64;
+        pub(crate) fn get_rank_upper_bound(
+            self: &OpaqueReqSketch,
+            rank: f64,
+            num_std_dev: u8,
+        ) -> f64;
+        pub(crate) fn get_cdf(
+            self: &OpaqueReqSketch,
+            split_points: &[f32],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn get_pmf(
+            self: &OpaqueReqSketch,
+            split_points: &[f32],
+        ) -> Result<UniquePtr<CxxVector<f64>>>;
+        pub(crate) fn clone(self: &OpaqueReqSketch) -> UniquePtr<OpaqueReqSketch>;
+        pub(crate) fn serialize(self: &OpaqueReqSketch) -> UniquePtr<CxxVector<u8>>;
+
+        pub(crate) type OpaqueWrappedReqSketch;
+
+        /// The result points into `buf`, which must outlive it.
+        pub(crate) unsafe fn wrap_opaque_req_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueWrappedReqSketch>>;
+        pub(crate) fn is_empty(self: &OpaqueWrappedReqSketch) -> bool;
+        pub(crate) fn is_hra(self: &OpaqueWrappedReqSketch) -> bool;
+        pub(crate) fn get_n(self: &OpaqueWrappedReqSketch) -> u64;
+        pub(crate) fn get_num_retained(self: &OpaqueWrappedReqSketch) -> u32;
+        pub(crate) fn get_min_value(self: &OpaqueWrappedReqSketch) -> f32;
+        pub(crate) fn get_max_value(self: &OpaqueWrappedReqSketch) -> f32;
+        pub(crate) fn get_quantile(self: &OpaqueWrappedReqSketch, rank: f64) -> Result<f32>;
+        pub(crate) fn get_rank(self: &OpaqueWrappedReqSketch, value: f32) -> f64;
+        pub(crate) fn merge_wrapped(
+            self: Pin<&mut OpaqueReqSketch>,
+            other: &OpaqueWrappedReqSketch,
+        ) -> Result<()>;
+
+        include!("dsrs/datasketches-cpp/var_opt.hpp");
+
+        pub(crate) type OpaqueVarOptSketch;
+
+        pub(crate) fn new_opaque_var_opt_sketch(k: u32) -> Result<UniquePtr<OpaqueVarOptSketch>>;
+        pub(crate) fn deserialize_opaque_var_opt_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueVarOptSketch>>;
+        pub(crate) fn get_k(self: &OpaqueVarOptSketch) -> u32;
+        pub(crate) fn get_n(self: &OpaqueVarOptSketch) -> u64;
+        pub(crate) fn get_num_samples(self: &OpaqueVarOptSketch) -> u32;
+        pub(crate) fn is_empty(self: &OpaqueVarOptSketch) -> bool;
+        pub(crate) fn reset(self: Pin<&mut OpaqueVarOptSketch>);
+        pub(crate) fn update(
+            self: Pin<&mut OpaqueVarOptSketch>,
+            item: &[u8],
+            weight: f64,
+        ) -> Result<()>;
+        pub(crate) fn update_batch(
+            self: Pin<&mut OpaqueVarOptSketch>,
+            buf: &[u8],
+            ends: &[usize],
+            weights: &[f64],
+        ) -> Result<()>;
+        pub(crate) fn samples(self: &OpaqueVarOptSketch) -> UniquePtr<CxxVector<SampleRow>>;
+        pub(crate) fn estimate_subset_sum(
+            self: &OpaqueVarOptSketch,
+            matches: &[bool],
+        ) -> Result<SubsetSummary>;
+        pub(crate) fn estimate_subset_sums(
+            self: &OpaqueVarOptSketch,
+            groups: &[u32],
+            num_groups: u32,
+        ) -> Result<UniquePtr<CxxVector<SubsetSummary>>>;
+        pub(crate) fn clone(self: &OpaqueVarOptSketch) -> UniquePtr<OpaqueVarOptSketch>;
+        pub(crate) fn serialize(self: &OpaqueVarOptSketch) -> UniquePtr<CxxVector<u8>>;
+
+        pub(crate) type OpaqueVarOptUnion;
+
+        pub(crate) fn new_opaque_var_opt_union(max_k: u32) -> Result<UniquePtr<OpaqueVarOptUnion>>;
+        pub(crate) fn update(self: Pin<&mut OpaqueVarOptUnion>, sketch: &OpaqueVarOptSketch);
+        pub(crate) fn update_serialized(
+            self: Pin<&mut OpaqueVarOptUnion>,
+            buf: &[u8],
+            ends: &[usize],
+        ) -> Result<()>;
+        pub(crate) fn get_result(self: &OpaqueVarOptUnion) -> UniquePtr<OpaqueVarOptSketch>;
+        pub(crate) fn reset(self: Pin<&mut OpaqueVarOptUnion>);
 
         include!("dsrs/datasketches-cpp/hh.hpp");
 
@@ -93,10 +934,236 @@ pub(crate) mod ffi {
         pub(crate) fn estimate_no_fn(
             self: &OpaqueHhSketch,
         ) -> UniquePtr<CxxVector<ThinHeavyHitterRow>>;
-        pub(crate) fn state(self: &OpaqueHhSketch) -> UniquePtr<CxxVector<ThinHeavyHitterRow>>;
         pub(crate) fn update(self: Pin<&mut OpaqueHhSketch>, value: usize, weight: u64);
-        pub(crate) fn set_weights(self: Pin<&mut OpaqueHhSketch>, total_weight: u64, weight: u64);
-        pub(crate) fn get_total_weight(self: &OpaqueHhSketch) -> u64;
-        pub(crate) fn get_offset(self: &OpaqueHhSketch) -> u64;
+        pub(crate) fn merge(self: Pin<&mut OpaqueHhSketch>, other: &OpaqueHhSketch);
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueHhSketch) -> usize;
+
+        pub(crate) type OpaqueNativeHhSketch;
+
+        pub(crate) fn new_opaque_native_hh_sketch(lg2_k: u8) -> UniquePtr<OpaqueNativeHhSketch>;
+        pub(crate) fn estimate_no_fp(
+            self: &OpaqueNativeHhSketch,
+        ) -> UniquePtr<CxxVector<HeavyHitterRow>>;
+        pub(crate) fn estimate_no_fn(
+            self: &OpaqueNativeHhSketch,
+        ) -> UniquePtr<CxxVector<HeavyHitterRow>>;
+        pub(crate) fn top_no_fn(
+            self: &OpaqueNativeHhSketch,
+            k: usize,
+        ) -> UniquePtr<CxxVector<HeavyHitterRow>>;
+        pub(crate) fn update(self: Pin<&mut OpaqueNativeHhSketch>, value: &[u8], weight: u64);
+        pub(crate) fn update_bytes_batch(
+            self: Pin<&mut OpaqueNativeHhSketch>,
+            buf: &[u8],
+            ends: &[usize],
+            weights: &[u64],
+        );
+        pub(crate) fn merge(self: Pin<&mut OpaqueNativeHhSketch>, other: &OpaqueNativeHhSketch);
+        pub(crate) fn clone(self: &OpaqueNativeHhSketch) -> UniquePtr<OpaqueNativeHhSketch>;
+        pub(crate) fn serialize(self: &OpaqueNativeHhSketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueNativeHhSketch) -> usize;
+        pub(crate) fn deserialize_opaque_native_hh_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueNativeHhSketch>>;
+
+        pub(crate) type OpaqueHhDictionary;
+
+        pub(crate) fn new_opaque_hh_dictionary() -> UniquePtr<OpaqueHhDictionary>;
+        pub(crate) fn get_num_keys(self: &OpaqueHhDictionary) -> usize;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueHhDictionary) -> usize;
+
+        pub(crate) type OpaqueCompactHhSketch;
+
+        pub(crate) fn new_opaque_compact_hh_sketch(
+            lg2_k: u8,
+            dictionary_addr: usize,
+        ) -> UniquePtr<OpaqueCompactHhSketch>;
+        pub(crate) fn estimate_no_fp(
+            self: &OpaqueCompactHhSketch,
+        ) -> UniquePtr<CxxVector<HeavyHitterRow>>;
+        pub(crate) fn estimate_no_fn(
+            self: &OpaqueCompactHhSketch,
+        ) -> UniquePtr<CxxVector<HeavyHitterRow>>;
+        pub(crate) fn top_no_fn(
+            self: &OpaqueCompactHhSketch,
+            k: usize,
+        ) -> UniquePtr<CxxVector<HeavyHitterRow>>;
+        pub(crate) fn update(
+            self: Pin<&mut OpaqueCompactHhSketch>,
+            value: &[u8],
+            weight: u32,
+        ) -> Result<()>;
+        pub(crate) fn merge(
+            self: Pin<&mut OpaqueCompactHhSketch>,
+            other: &OpaqueCompactHhSketch,
+        ) -> Result<()>;
+        pub(crate) fn merge_native(
+            self: Pin<&mut OpaqueCompactHhSketch>,
+            other: &OpaqueNativeHhSketch,
+        ) -> Result<()>;
+        pub(crate) fn to_native(self: &OpaqueCompactHhSketch) -> UniquePtr<OpaqueNativeHhSketch>;
+        pub(crate) fn get_total_weight(self: &OpaqueCompactHhSketch) -> u64;
+        pub(crate) fn get_memory_usage_bytes(self: &OpaqueCompactHhSketch) -> usize;
+
+        include!("dsrs/datasketches-cpp/count_min.hpp");
+
+        pub(crate) type OpaqueCountMinSketch;
+
+        pub(crate) fn new_opaque_count_min_sketch(
+            lg_num_blocks: u8,
+            num_hashes: u8,
+        ) -> Result<UniquePtr<OpaqueCountMinSketch>>;
+        pub(crate) fn estimate(self: &OpaqueCountMinSketch, buf: &[u8]) -> u64;
+        pub(crate) fn get_total_weight(self: &OpaqueCountMinSketch) -> u64;
+        pub(crate) fn get_lg_num_blocks(self: &OpaqueCountMinSketch) -> u8;
+        pub(crate) fn get_num_hashes(self: &OpaqueCountMinSketch) -> u8;
+        pub(crate) fn update(self: Pin<&mut OpaqueCountMinSketch>, buf: &[u8], weight: u64);
+        pub(crate) fn update_bytes_batch(
+            self: Pin<&mut OpaqueCountMinSketch>,
+            buf: &[u8],
+            ends: &[usize],
+            weight: u64,
+        );
+        pub(crate) fn merge(
+            self: Pin<&mut OpaqueCountMinSketch>,
+            other: &OpaqueCountMinSketch,
+        ) -> Result<()>;
+        pub(crate) fn clone(self: &OpaqueCountMinSketch) -> UniquePtr<OpaqueCountMinSketch>;
+        pub(crate) fn serialize(self: &OpaqueCountMinSketch) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn deserialize_opaque_count_min_sketch(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueCountMinSketch>>;
+
+        include!("dsrs/datasketches-cpp/bloom.hpp");
+
+        pub(crate) type OpaqueBloomFilter;
+
+        pub(crate) fn new_opaque_bloom_filter(
+            lg_num_blocks: u8,
+        ) -> Result<UniquePtr<OpaqueBloomFilter>>;
+        pub(crate) fn suggest_bloom_lg_num_blocks(num_items: u64, bits_per_item: u32)
+            -> Result<u8>;
+        pub(crate) fn contains(self: &OpaqueBloomFilter, buf: &[u8]) -> bool;
+        pub(crate) fn contains_batch(
+            self: &OpaqueBloomFilter,
+            buf: &[u8],
+            ends: &[usize],
+            found: &mut [u8],
+        );
+        pub(crate) fn estimate(self: &OpaqueBloomFilter) -> f64;
+        pub(crate) fn get_lg_num_blocks(self: &OpaqueBloomFilter) -> u8;
+        pub(crate) fn update(self: Pin<&mut OpaqueBloomFilter>, buf: &[u8]);
+        pub(crate) fn update_u64(self: Pin<&mut OpaqueBloomFilter>, value: u64);
+        pub(crate) fn update_u64_batch(self: Pin<&mut OpaqueBloomFilter>, values: &[u64]);
+        pub(crate) fn update_bytes_batch(
+            self: Pin<&mut OpaqueBloomFilter>,
+            buf: &[u8],
+            ends: &[usize],
+        );
+        pub(crate) fn merge(
+            self: Pin<&mut OpaqueBloomFilter>,
+            other: &OpaqueBloomFilter,
+        ) -> Result<()>;
+        pub(crate) fn clone(self: &OpaqueBloomFilter) -> UniquePtr<OpaqueBloomFilter>;
+        pub(crate) fn serialize(self: &OpaqueBloomFilter) -> UniquePtr<CxxVector<u8>>;
+        pub(crate) fn deserialize_opaque_bloom_filter(
+            buf: &[u8],
+        ) -> Result<UniquePtr<OpaqueBloomFilter>>;
     }
 }
+
+// The opaque C++ types own all of their state and have no thread affinity,
+// so they can be moved to (but not shared between) threads. CPC sketches
+// may share an arena, but it is internally locked.
+unsafe impl Send for ffi::OpaqueCpcSketch {}
+unsafe impl Send for ffi::OpaqueCpcUnion {}
+unsafe impl Send for ffi::OpaqueCpcArena {}
+unsafe impl Send for ffi::OpaqueThetaSketch {}
+unsafe impl Send for ffi::OpaqueConcurrentThetaSketch {}
+unsafe impl Send for ffi::OpaqueThetaBuffer {}
+unsafe impl Send for ffi::OpaqueStaticThetaSketch {}
+unsafe impl Send for ffi::OpaqueThetaExclusion {}
+unsafe impl Send for ffi::OpaqueWrappedThetaSketch {}
+unsafe impl Send for ffi::OpaqueThetaUnion {}
+unsafe impl Send for ffi::OpaqueThetaIntersection {}
+unsafe impl Send for ffi::OpaqueThetaWindow {}
+unsafe impl Send for ffi::OpaqueKeyedThetaSketch {}
+unsafe impl Send for ffi::OpaqueThetaJaccardMatrix {}
+unsafe impl Send for ffi::OpaqueAodSketch {}
+unsafe impl Send for ffi::OpaqueStaticAodSketch {}
+unsafe impl Send for ffi::OpaqueAodUnion {}
+unsafe impl Send for ffi::OpaqueAodIntersection {}
+unsafe impl Send for ffi::OpaqueAodColumns {}
+unsafe impl Send for ffi::OpaqueAodColumnsUnion {}
+unsafe impl Send for ffi::OpaqueAodColumnsIntersection {}
+unsafe impl Send for ffi::OpaqueHllSketch {}
+unsafe impl Send for ffi::OpaqueHllUnion {}
+unsafe impl Send for ffi::OpaqueHllMatrix {}
+unsafe impl Send for ffi::OpaqueKllDoubleSketch {}
+unsafe impl Send for ffi::OpaqueKllFloatSketch {}
+unsafe impl Send for ffi::OpaqueWrappedKllDoubleSketch {}
+unsafe impl Send for ffi::OpaqueWrappedKllFloatSketch {}
+unsafe impl Send for ffi::OpaqueKllU32Sketch {}
+unsafe impl Send for ffi::OpaqueKllU64Sketch {}
+unsafe impl Send for ffi::OpaqueReqSketch {}
+unsafe impl Send for ffi::OpaqueWrappedReqSketch {}
+unsafe impl Send for ffi::OpaqueVarOptSketch {}
+unsafe impl Send for ffi::OpaqueVarOptUnion {}
+unsafe impl Send for ffi::OpaqueHhSketch {}
+unsafe impl Send for ffi::OpaqueNativeHhSketch {}
+// The dictionary of compact sketches is only used through the sketches, and
+// those through CompactHhSketches, which owns it along with all of them.
+unsafe impl Send for ffi::OpaqueHhDictionary {}
+unsafe impl Send for ffi::OpaqueCompactHhSketch {}
+unsafe impl Send for ffi::OpaqueCountMinSketch {}
+unsafe impl Send for ffi::OpaqueBloomFilter {}
+
+// Each of these can be queried from many threads at once, through the const
+// methods named beside it.
+// Every method of the concurrent theta sketch takes its lock.
+unsafe impl Sync for ffi::OpaqueConcurrentThetaSketch {}
+// computing a difference only reads the exclusion's hash table
+unsafe impl Sync for ffi::OpaqueThetaExclusion {}
+// estimate() caches in atomics, and serializing goes through the one global
+// compressor, whose decoding tables are built under std::call_once.
+unsafe impl Sync for ffi::OpaqueCpcSketch {}
+// sketch() allocates from the shared arena, which takes its mutex.
+unsafe impl Sync for ffi::OpaqueCpcArena {}
+// estimate(), bounds() and serializing read the compact sketch, which has no
+// cache; the update sketches that do are not Sync.
+unsafe impl Sync for ffi::OpaqueStaticThetaSketch {}
+// estimate() and to_static() only read the borrowed buffer.
+unsafe impl Sync for ffi::OpaqueWrappedThetaSketch {}
+// jaccard() and jaccard_tile() only count over the stored hashes.
+unsafe impl Sync for ffi::OpaqueThetaJaccardMatrix {}
+// estimate(), estimate_sums() and to_columns() only read the entries.
+unsafe impl Sync for ffi::OpaqueStaticAodSketch {}
+// The column slices and estimate_sums() only read the columns.
+unsafe impl Sync for ffi::OpaqueAodColumns {}
+// estimate() and serialize_*() only read the coupons or registers.
+unsafe impl Sync for ffi::OpaqueHllSketch {}
+// estimate() and serialize_row() copy the row into a local sketch.
+unsafe impl Sync for ffi::OpaqueHllMatrix {}
+// The quantile, rank, CDF and PMF queries read a sorted view built under
+// view_mutex_, which copies level zero rather than sorting it in place.
+unsafe impl Sync for ffi::OpaqueKllDoubleSketch {}
+unsafe impl Sync for ffi::OpaqueKllFloatSketch {}
+unsafe impl Sync for ffi::OpaqueKllU32Sketch {}
+unsafe impl Sync for ffi::OpaqueKllU64Sketch {}
+// get_quantile() and get_rank() only read the borrowed buffer.
+unsafe impl Sync for ffi::OpaqueWrappedKllDoubleSketch {}
+unsafe impl Sync for ffi::OpaqueWrappedKllFloatSketch {}
+// As for KLL, the queries read a sorted view built under view_mutex_, and the
+// rank bounds are arithmetic on k, the level count and n.
+unsafe impl Sync for ffi::OpaqueReqSketch {}
+// get_quantile() and get_rank() only read the borrowed buffer.
+unsafe impl Sync for ffi::OpaqueWrappedReqSketch {}
+// samples() and estimate_subset_sum(s)() only read the reservoir.
+unsafe impl Sync for ffi::OpaqueVarOptSketch {}
+// estimate_no_fp(), estimate_no_fn() and top_no_fn() only read the map.
+unsafe impl Sync for ffi::OpaqueNativeHhSketch {}
+// estimate() only reads the counters.
+unsafe impl Sync for ffi::OpaqueCountMinSketch {}
+// contains(), contains_batch() and estimate() only read the blocks; the
+// const_cast is in the non-const blocks() accessor.
+unsafe impl Sync for ffi::OpaqueBloomFilter {}
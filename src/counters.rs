@@ -2,57 +2,515 @@
 //! hitters sketches, aimed at servicing the `dsrs` command-line tool
 //! for deduplicating byte lines of input.
 
-use std::collections::HashMap;
+use std::cell::RefCell;
+use std::cmp::{Ordering, Reverse};
+use std::collections::BinaryHeap;
 use std::convert::TryInto;
+use std::io;
+use std::mem;
+use std::ops::RangeInclusive;
 use std::str;
+use std::str::FromStr;
 
 use base64;
 use memchr;
 
-use crate::stream_reducer::LineReducer;
-use crate::{CpcSketch, CpcUnion, DataSketchesError, HhSketch};
+use crate::base64_decode::with_decoded;
+use crate::frames::{split_frames, write_frame};
+#[cfg(unix)]
+use crate::hll_store::HllStore;
+use crate::key_table::{HashTable, KeyTable};
+use crate::profile::{self, Stage};
+use crate::spill::{merge_runs, Run};
+use crate::stream_reducer::{
+    packed_lines, Checkpoint, KeyValueReducer, LineReducer, ParallelLineReducer,
+    PipelinedLineReducer,
+};
+use crate::wrapper::serialize_many;
+use crate::{
+    ArrayOfDoublesSketch, ArrayOfDoublesUnion, BloomFilter, CompactHhSketches, CpcArena, CpcSketch,
+    CpcUnion, DataSketchesError, FrozenCpcSketch, HllSketch, HllType, HllUnion, KeyHash,
+    KeyedThetaSketch, KllFloatSketch, NativeHhSketch, StaticArrayOfDoublesSketch, ThetaWindow,
+    VarOptSketch, VarOptUnion,
+};
+
+thread_local! {
+    /// Holds each CPC sketch [`Counter::with_serialized`] serializes, so that
+    /// printing the counters of many keys reuses one buffer.
+    static SERIALIZED: RefCell<Vec<u8>> = RefCell::new(Vec::new());
+}
+
+/// The distinct count sketch family backing a [`Counter`].
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Algo {
+    /// [`CpcSketch`], the most accurate per serialized byte.
+    Cpc,
+    /// [`HllSketch`] with [`HllType::Hll4`] buckets, the smallest in memory.
+    Hll,
+}
+
+impl Algo {
+    /// The `lg_k` values that `algo` counters can be configured with.
+    pub fn lg_k_range(self) -> RangeInclusive<u8> {
+        match self {
+            Self::Cpc => 4..=26,
+            Self::Hll => 4..=21,
+        }
+    }
+}
+
+impl Default for Algo {
+    fn default() -> Self {
+        Self::Cpc
+    }
+}
+
+impl FromStr for Algo {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        match s {
+            "cpc" => Ok(Self::Cpc),
+            "hll" => Ok(Self::Hll),
+            _ => Err(format!("unknown algo '{}', expected cpc or hll", s)),
+        }
+    }
+}
+
+/// `lg_k` of counters unless configured otherwise, which is
+/// [`CpcSketch::DEFAULT_LG_K`]. HLL counters use it too, so a dense one
+/// takes about 1KB.
+pub const DEFAULT_LG_K: u8 = CpcSketch::DEFAULT_LG_K;
+
+const HLL_TYPE: HllType = HllType::Hll4;
+
+/// CPC counters hold the coupons of the distinct values they see, and
+/// only become a [`CpcSketch`] at this many. Below it, the coupons take a
+/// fraction of the memory of even a sparse sketch, and most keys of a
+/// keyed count never get past it.
+const COUPON_LIMIT: usize = 128;
+
+/// [`COUPON_LIMIT`], lowered for small `lg_k` to stay under the
+/// `3 * 2^lg_k / 32` coupons at which a sketch stops being sparse.
+fn coupon_limit(lg_k: u8) -> usize {
+    COUPON_LIMIT.min(3 << lg_k >> 5)
+}
+
+enum Sketch {
+    /// The novel coupons offered to an empty CPC sketch so far, in the
+    /// order they came in, which replays into exactly that sketch.
+    Coupons(Vec<u32>),
+    Cpc(CpcSketch),
+    /// A CPC sketch [`Counter::freeze`] froze, thawed on the next update.
+    Frozen(FrozenCpcSketch),
+    Hll(HllSketch),
+}
+
+/// The `lg_k` CPC sketch that saw `coupons`, allocated from `arena` if given.
+fn sketch_of(coupons: &[u32], lg_k: u8, arena: Option<&CpcArena>) -> CpcSketch {
+    let mut cpc = match arena {
+        Some(arena) => arena.sketch_with_lg_k(lg_k),
+        None => CpcSketch::with_lg_k(lg_k),
+    }
+    .expect("valid lg_k");
+    cpc.update_coupons(coupons);
+    cpc
+}
+
+/// Equals `sketch_of(coupons, lg_k, None).estimate()`, which is the HIP
+/// estimate of a sketch that has not been merged, accumulated again here.
+fn estimate_of(coupons: &[u32], lg_k: u8) -> f64 {
+    let k = (1u32 << lg_k) as f64;
+    let mut kxp = k;
+    let mut hip = 0.0;
+    for &coupon in coupons {
+        hip += k / kxp;
+        kxp -= 2f64.powi(-((coupon & 63) as i32 + 1));
+    }
+    hip
+}
+
+/// Bounds [`estimate_of`] from above in constant time: each coupon takes
+/// at most a half from `kxp`, so the `i`-th adds at most `k / (k - i/2)`.
+fn estimate_bound_of(coupons: &[u32], lg_k: u8) -> f64 {
+    let k = (1u32 << lg_k) as f64;
+    let n = coupons.len() as f64;
+    n * k / (k - (n - 1.0).max(0.0) / 2.0)
+}
 
 pub struct Counter {
-    sketch: CpcSketch,
+    sketch: Sketch,
+    // The `lg_k` of the sketches this counter starts, and of its forks.
+    lg_k: u8,
 }
 
 impl Default for Counter {
     fn default() -> Self {
-        Self {
-            sketch: CpcSketch::new(),
-        }
+        Self::new(Algo::default(), DEFAULT_LG_K)
     }
 }
 
 impl Counter {
+    /// Creates an empty counter backed by an `algo` sketch with `lg_k`.
+    ///
+    /// Panics unless `lg_k` is in [`Algo::lg_k_range`].
+    pub fn new(algo: Algo, lg_k: u8) -> Self {
+        let sketch = match algo {
+            Algo::Cpc => {
+                assert!(algo.lg_k_range().contains(&lg_k), "valid lg_k");
+                Sketch::Coupons(Vec::new())
+            }
+            Algo::Hll => Sketch::Hll(HllSketch::new(lg_k, HLL_TYPE).expect("valid lg_k")),
+        };
+        Self { sketch, lg_k }
+    }
+
     /// Serializes to base64 string with no newlines or `=` padding.
     pub fn serialize(&self) -> String {
-        let bytes = self.sketch.serialize();
-        base64::encode_config(bytes, base64::STANDARD_NO_PAD)
+        self.with_serialized(false, |bytes| {
+            base64::encode_config(bytes, base64::STANDARD_NO_PAD)
+        })
+    }
+
+    /// Like [`Self::serialize`], but leaves out what only the counter's own
+    /// estimate needs, see [`CpcSketch::serialize_without_hip`]. Merging
+    /// the result gives the same counts, while the sketch of a key with a
+    /// few values takes up to half the space. HLL counters have nothing to
+    /// leave out and serialize as usual.
+    pub fn serialize_for_merge(&self) -> String {
+        self.with_serialized(true, |bytes| {
+            base64::encode_config(bytes, base64::STANDARD_NO_PAD)
+        })
+    }
+
+    /// Writes the serialized sketch, without base64, as one frame for
+    /// [`Merger::merge_serialized`] to read back, leaving out what only the
+    /// counter's own estimate needs if `for_merge`, as
+    /// [`Self::serialize_for_merge`] does.
+    pub fn write_frame<W: io::Write>(&self, out: &mut W, for_merge: bool) -> io::Result<()> {
+        self.with_serialized(for_merge, |bytes| write_frame(out, bytes))
+    }
+
+    /// Appends the bytes behind [`Self::serialize`] to `out`, or those
+    /// behind [`Self::serialize_for_merge`] if `for_merge`, without base64.
+    pub fn append_serialized(&self, out: &mut Vec<u8>, for_merge: bool) {
+        self.with_serialized(for_merge, |bytes| out.extend_from_slice(bytes))
+    }
+
+    /// Appends each of `counters` to one buffer as [`Self::append_serialized`]
+    /// does, on `threads` threads, and returns it with the end of each
+    /// counter's bytes, as [`CpcSketch::serialize_many`] does.
+    ///
+    /// Panics if `threads` is 0.
+    pub fn serialize_many(
+        counters: &[&Counter],
+        for_merge: bool,
+        threads: usize,
+    ) -> (Vec<u8>, Vec<usize>) {
+        CpcSketch::init();
+        serialize_many(counters, threads, |ctr, buf| {
+            ctr.append_serialized(buf, for_merge)
+        })
+    }
+
+    /// Returns the estimate of each of `serialized`, as `algo` counters
+    /// are serialized, with lower and upper bounds of 2 standard
+    /// deviations, on `threads` threads, from the sketches' preambles
+    /// where they hold it.
+    pub fn bounds_many(
+        serialized: &[&[u8]],
+        algo: Algo,
+        threads: usize,
+    ) -> Result<Vec<(f64, f64, f64)>, DataSketchesError> {
+        match algo {
+            Algo::Cpc => CpcSketch::estimate_many(serialized, 2, threads),
+            Algo::Hll => HllSketch::estimate_many(serialized, 2, threads),
+        }
+    }
+
+    /// Calls `f` on the serialized sketch, which leaves out the HIP state
+    /// of CPC sketches if `for_merge`. `f` must not serialize counters
+    /// itself.
+    fn with_serialized<R>(&self, for_merge: bool, f: impl FnOnce(&[u8]) -> R) -> R {
+        let _serialize = profile::span(Stage::Serialize, 0);
+        let coupon_sketch;
+        let cpc = match &self.sketch {
+            Sketch::Coupons(coupons) => {
+                coupon_sketch = sketch_of(coupons, self.lg_k, None);
+                &coupon_sketch
+            }
+            Sketch::Cpc(cpc) => cpc,
+            // the frozen bytes keep the HIP state, so only a merge thaws
+            Sketch::Frozen(frozen) if !for_merge => {
+                profile::add_bytes(Stage::Serialize, frozen.as_bytes().len());
+                return f(frozen.as_bytes());
+            }
+            Sketch::Frozen(frozen) => {
+                coupon_sketch = frozen.thaw();
+                &coupon_sketch
+            }
+            Sketch::Hll(hll) => {
+                let bytes = hll.serialize();
+                profile::add_bytes(Stage::Serialize, bytes.as_ref().len());
+                return f(bytes.as_ref());
+            }
+        };
+        let serialize_into = |buf: &mut [u8]| {
+            if for_merge {
+                cpc.serialize_without_hip_into(buf)
+            } else {
+                cpc.serialize_into(buf)
+            }
+        };
+        SERIALIZED.with(|buf| {
+            let mut buf = buf.borrow_mut();
+            let len = serialize_into(&mut buf);
+            if len > buf.len() {
+                buf.resize(len, 0);
+                serialize_into(&mut buf);
+            }
+            profile::add_bytes(Stage::Serialize, len);
+            f(&buf[..len])
+        })
+    }
+
+    /// Deserializes from base64 string with no newlines or `=` padding,
+    /// which must hold a serialized `algo` sketch. The counter takes on
+    /// the sketch's `lg_k`.
+    pub fn deserialize(s: &str, algo: Algo) -> Result<Self, DataSketchesError> {
+        with_decoded(s.as_bytes(), |bytes| Self::deserialize_bytes(bytes, algo))?
     }
 
-    /// Deserializes from base64 string with no newlines or `=` padding.
-    pub fn deserialize(s: &str) -> Result<Self, DataSketchesError> {
-        let bytes = base64::decode_config(s, base64::STANDARD_NO_PAD)?;
-        let sketch = CpcSketch::deserialize(bytes.as_ref())?;
-        Ok(Self { sketch })
+    /// Like [`Self::deserialize`], but from the bytes of the sketch, as
+    /// [`Self::write_frame`] writes them.
+    pub fn deserialize_bytes(bytes: &[u8], algo: Algo) -> Result<Self, DataSketchesError> {
+        let (sketch, lg_k) = match algo {
+            Algo::Cpc => {
+                let cpc = CpcSketch::deserialize(bytes)?;
+                let lg_k = cpc.lg_k();
+                (Sketch::Cpc(cpc), lg_k)
+            }
+            Algo::Hll => {
+                let hll = HllSketch::deserialize(bytes)?;
+                let lg_k = hll.lg_k();
+                (Sketch::Hll(hll), lg_k)
+            }
+        };
+        Ok(Self { sketch, lg_k })
     }
 
     /// Returns the current row estimate
     pub fn estimate(&self) -> f64 {
-        self.sketch.estimate()
+        match &self.sketch {
+            Sketch::Coupons(coupons) => estimate_of(coupons, self.lg_k),
+            Sketch::Cpc(cpc) => cpc.estimate(),
+            Sketch::Frozen(frozen) => frozen.estimate(),
+            Sketch::Hll(hll) => hll.estimate(),
+        }
+    }
+
+    /// Returns a bound on [`Self::estimate`] which is cheaper to compute,
+    /// for counters that have not yet built a sketch, and otherwise the
+    /// estimate itself.
+    fn estimate_bound(&self) -> f64 {
+        match &self.sketch {
+            Sketch::Coupons(coupons) => estimate_bound_of(coupons, self.lg_k),
+            _ => self.estimate(),
+        }
+    }
+
+    /// Empties the counter, keeping its sketch's memory for reuse, unless
+    /// it was frozen.
+    pub fn reset(&mut self) {
+        match &mut self.sketch {
+            Sketch::Coupons(coupons) => coupons.clear(),
+            Sketch::Cpc(cpc) => cpc.reset(),
+            Sketch::Frozen(_) => self.sketch = Sketch::Coupons(Vec::new()),
+            Sketch::Hll(hll) => hll.reset(),
+        }
+    }
+
+    /// Freezes the counter's CPC sketch into a [`FrozenCpcSketch`], which
+    /// takes a fraction of its memory and still estimates and merges, but
+    /// is thawed back into a sketch by the next update. Coupons are
+    /// trimmed to their length, and HLL sketches, whose registers are
+    /// compact already, are left as they are.
+    pub fn freeze(&mut self) {
+        match &mut self.sketch {
+            Sketch::Coupons(coupons) => coupons.shrink_to_fit(),
+            Sketch::Cpc(cpc) => self.sketch = Sketch::Frozen(cpc.freeze()),
+            Sketch::Frozen(_) | Sketch::Hll(_) => {}
+        }
+    }
+
+    /// Returns the heap memory held by the counter's coupons or sketch, in
+    /// bytes, which a [`Self::reset`] keeps.
+    pub fn memory_usage_bytes(&self) -> usize {
+        match &self.sketch {
+            Sketch::Coupons(coupons) => coupons.capacity() * mem::size_of::<u32>(),
+            Sketch::Cpc(cpc) => cpc.memory_usage_bytes(),
+            Sketch::Frozen(frozen) => frozen.memory_usage_bytes(),
+            Sketch::Hll(hll) => hll.memory_usage_bytes(),
+        }
+    }
+
+    /// Observes `value`, turning the coupons into a sketch from `arena`,
+    /// if given, once there are [`coupon_limit`] of them.
+    fn update(&mut self, value: &[u8], arena: Option<&CpcArena>) {
+        let lg_k = self.lg_k;
+        match &mut self.sketch {
+            Sketch::Coupons(coupons) => {
+                let coupon = CpcSketch::coupon(value, lg_k);
+                if coupons.contains(&coupon) {
+                    return;
+                }
+                coupons.push(coupon);
+                if coupons.len() == coupon_limit(lg_k) {
+                    self.sketch = Sketch::Cpc(sketch_of(coupons, lg_k, arena));
+                }
+            }
+            Sketch::Cpc(cpc) => cpc.update(value),
+            Sketch::Frozen(frozen) => {
+                let mut cpc = frozen.thaw();
+                cpc.update(value);
+                self.sketch = Sketch::Cpc(cpc);
+            }
+            Sketch::Hll(hll) => hll.update(value),
+        }
+    }
+
+    /// Updates the CPC or HLL sketch with each line packed in `buf`.
+    fn update_batch(&mut self, buf: &[u8], ends: &[usize]) {
+        match &mut self.sketch {
+            Sketch::Coupons(_) => unreachable!("coupons are read one by one"),
+            Sketch::Cpc(cpc) => cpc.update_batch(buf, ends),
+            Sketch::Frozen(frozen) => {
+                let mut cpc = frozen.thaw();
+                cpc.update_batch(buf, ends);
+                self.sketch = Sketch::Cpc(cpc);
+            }
+            Sketch::Hll(hll) => hll.update_batch(buf, ends),
+        }
+    }
+
+    fn algo(&self) -> Algo {
+        match self.sketch {
+            Sketch::Coupons(_) | Sketch::Cpc(_) | Sketch::Frozen(_) => Algo::Cpc,
+            Sketch::Hll(_) => Algo::Hll,
+        }
     }
 }
 
 impl LineReducer for Counter {
     fn read_line(&mut self, line: &[u8]) {
-        self.sketch.update(line);
+        self.update(line, None)
+    }
+
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        if let Sketch::Coupons(_) = self.sketch {
+            let mut start = 0;
+            for (i, &end) in ends.iter().enumerate() {
+                if let Sketch::Cpc(_) = self.sketch {
+                    // batch the rest now that there is a sketch to take it
+                    let rest: Vec<usize> = ends[i..].iter().map(|&end| end - start).collect();
+                    return self.read_lines(&buf[start..], &rest);
+                }
+                self.update(&buf[start..end], None);
+                start = end;
+            }
+            return;
+        }
+        // a repeat of the line before it changes neither sketch, so when
+        // there are any, each stretch between them is batched on its own
+        let lines = || packed_lines(buf, ends);
+        if !lines()
+            .zip(lines().skip(1))
+            .any(|(last, line)| last == line)
+        {
+            return self.update_batch(buf, ends);
+        }
+        let mut stretch_ends = Vec::new();
+        let (mut stretch, mut last) = (0, None);
+        for (line, &end) in lines().zip(ends) {
+            if last == Some(line) {
+                if !stretch_ends.is_empty() {
+                    self.update_batch(&buf[stretch..end - line.len()], &stretch_ends);
+                    stretch_ends.clear();
+                }
+                stretch = end;
+            } else {
+                stretch_ends.push(end - stretch);
+            }
+            last = Some(line);
+        }
+        if !stretch_ends.is_empty() {
+            self.update_batch(&buf[stretch..], &stretch_ends);
+        }
+    }
+
+    fn read_repeated(&mut self, line: &[u8], _count: u64) {
+        self.read_line(line)
+    }
+}
+
+impl ParallelLineReducer for Counter {
+    fn fork(&self) -> Self {
+        Self::new(self.algo(), self.lg_k)
+    }
+
+    fn combine(&mut self, other: Self) {
+        let mut merger = Merger::new(self.algo(), self.lg_k);
+        merger.merge(mem::take(self));
+        merger.merge(other);
+        *self = merger.counter();
+    }
+}
+
+/// Saves the serialized sketch, HIP state included, so that a restored
+/// counter estimates as if it had read every line itself.
+impl Checkpoint for Counter {
+    fn save(&self, out: &mut Vec<u8>) {
+        self.append_serialized(out, false)
+    }
+
+    fn save_config(&self, out: &mut Vec<u8>) {
+        out.extend_from_slice(&[b'u', self.algo() as u8, self.lg_k]);
+    }
+
+    fn restore(&mut self, saved: &[u8]) -> io::Result<()> {
+        *self = Self::deserialize_bytes(saved, self.algo()).map_err(invalid_data)?;
+        Ok(())
     }
 }
 
-#[derive(Default)]
+fn invalid_data(e: DataSketchesError) -> io::Error {
+    io::Error::new(io::ErrorKind::InvalidData, e)
+}
+
 pub struct KeyedCounter {
-    sketches: HashMap<Vec<u8>, Counter>,
+    algo: Algo,
+    lg_k: u8,
+    // Backs the CPC counters here which outgrow their coupons, since there
+    // may be millions of them. Counters combined in from a fork keep the
+    // fork's arena alive.
+    arena: CpcArena,
+    sketches: KeyTable<Counter>,
+    // Emptied counters from cleared keys, handed out to new keys before
+    // any fresh ones are allocated.
+    pool: Vec<Counter>,
+    // Keys held in `sketches` before they are spilled to a run.
+    max_keys: usize,
+    // Bytes of keys and counters held in `sketches` before they are
+    // spilled, and those held, which are only tracked under a budget.
+    max_bytes: usize,
+    held_bytes: usize,
+    runs: Vec<Run>,
+}
+
+impl Default for KeyedCounter {
+    fn default() -> Self {
+        Self::new(Algo::default(), DEFAULT_LG_K)
+    }
 }
 
 impl LineReducer for KeyedCounter {
@@ -64,63 +522,399 @@ impl LineReducer for KeyedCounter {
             )
         });
         let (key, value) = (&line[0..space_ix], &line[space_ix + 1..]);
-        if !self.sketches.contains_key(key) {
-            self.sketches.insert(key.to_owned(), Counter::default());
-        }
-        self.sketches
-            .get_mut(key)
-            .expect("key present")
-            .read_line(value);
+        self.read_key_value(key, value);
     }
 }
 
-impl KeyedCounter {
-    /// Returns an iterator over all contained keys and their sketches.
-    pub fn state(&self) -> impl Iterator<Item = (&[u8], &Counter)> {
-        self.sketches.iter().map(|(key, ctr)| (key.as_ref(), ctr))
+impl KeyValueReducer for KeyedCounter {
+    fn read_key_value(&mut self, key: &[u8], value: &[u8]) {
+        self.update_key(key, |ctr, arena| ctr.update(value, Some(arena)))
     }
 }
 
-pub struct Merger {
-    sketch: CpcUnion,
+impl ParallelLineReducer for KeyedCounter {
+    fn fork(&self) -> Self {
+        let mut fork = Self::new(self.algo, self.lg_k).spilling(self.max_keys);
+        fork.max_bytes = self.max_bytes;
+        fork
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.sketches
+            .merge(other.sketches, |ctr, other| ctr.combine(other));
+        self.pool.extend(other.pool);
+        self.runs.extend(other.runs);
+        self.track_held_bytes();
+        if self.sketches.len() > self.max_keys || self.held_bytes > self.max_bytes {
+            self.spill().expect("no io error");
+        }
+    }
 }
 
-impl Default for Merger {
-    fn default() -> Self {
+/// Saves each key and its counter, as [`Counter`] saves it, in a pair of
+/// frames, which `--key --merge --format binary` could read as well.
+///
+/// Panics on saving a counter which has spilled keys, see
+/// [`KeyedCounter::spilling`].
+impl Checkpoint for KeyedCounter {
+    fn save(&self, out: &mut Vec<u8>) {
+        assert!(self.runs.is_empty(), "cannot save spilled keys");
+        for (key, ctr) in self.state() {
+            write_frame(out, key).expect("no io error");
+            ctr.write_frame(out, false).expect("no io error");
+        }
+    }
+
+    fn save_config(&self, out: &mut Vec<u8>) {
+        out.extend_from_slice(&[b'k', self.algo as u8, self.lg_k]);
+    }
+
+    fn restore(&mut self, saved: &[u8]) -> io::Result<()> {
+        let frames =
+            split_frames(saved).map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))?;
+        if frames.len() % 2 != 0 {
+            return Err(io::Error::new(
+                io::ErrorKind::InvalidData,
+                "key frame without a counter frame",
+            ));
+        }
+        for record in frames.chunks(2) {
+            let (key, saved) = (record[0], record[1]);
+            let ctr = Counter::deserialize_bytes(saved, self.algo).map_err(invalid_data)?;
+            let mut ctr = Some(ctr);
+            let slot = self
+                .sketches
+                .get_or_insert_with(key, || ctr.take().expect("one key"));
+            if let Some(ctr) = ctr {
+                slot.combine(ctr);
+            }
+        }
+        self.track_held_bytes();
+        Ok(())
+    }
+}
+
+impl KeyedCounter {
+    /// Creates an empty keyed counter whose per-key counters are `algo`
+    /// sketches with `lg_k`.
+    ///
+    /// Panics unless `lg_k` is in [`Algo::lg_k_range`].
+    pub fn new(algo: Algo, lg_k: u8) -> Self {
+        assert!(algo.lg_k_range().contains(&lg_k), "valid lg_k");
         Self {
-            sketch: CpcUnion::new(),
+            algo,
+            lg_k,
+            arena: CpcArena::new(),
+            sketches: KeyTable::default(),
+            pool: Vec::new(),
+            max_keys: usize::MAX,
+            max_bytes: usize::MAX,
+            held_bytes: 0,
+            runs: Vec::new(),
+        }
+    }
+
+    /// Bounds the keys this counter holds in memory to `max_keys`. Past
+    /// that, the counters of every key held are sorted by key and written
+    /// to a temporary file, and the memory is reused for the keys read
+    /// next, which may repeat spilled ones. [`Self::for_each_key`] then
+    /// merges each key's counters back together.
+    ///
+    /// Panics if `max_keys` is 0.
+    pub fn spilling(mut self, max_keys: usize) -> Self {
+        assert!(max_keys > 0, "need room for at least one key");
+        self.max_keys = max_keys;
+        self
+    }
+
+    /// Like [`Self::spilling`], but bounds the bytes of the keys held in
+    /// memory and of their counters, as [`Self::memory_usage_bytes`] counts
+    /// them, to `max_bytes`. Both bounds may be set, and keys are spilled
+    /// as soon as either is passed.
+    pub fn spilling_bytes(mut self, max_bytes: usize) -> Self {
+        self.max_bytes = max_bytes;
+        self.track_held_bytes();
+        self
+    }
+
+    /// Returns the bytes of the keys this counter holds in memory and the
+    /// heap memory of their counters. Emptied counters kept for reuse, and
+    /// the overhead of the table of keys, are not counted.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.state()
+            .map(|(key, ctr)| key.len() + ctr.memory_usage_bytes())
+            .sum()
+    }
+
+    /// Recounts the bytes held, if they are tracked for a budget, after
+    /// counters changed other than through [`Self::read_key_value`].
+    fn track_held_bytes(&mut self) {
+        if self.max_bytes != usize::MAX {
+            self.held_bytes = self.memory_usage_bytes();
+        }
+    }
+
+    /// Returns an iterator over all contained keys and their sketches,
+    /// other than those spilled by [`Self::spilling`].
+    pub fn state(&self) -> impl Iterator<Item = (&[u8], &Counter)> {
+        self.sketches.iter()
+    }
+
+    /// Returns the counter of `key`, unless it is not held in memory.
+    pub fn get(&self, key: &[u8]) -> Option<&Counter> {
+        self.sketches.get(key)
+    }
+
+    /// Merges `ctr`, of this counter's algo, into the counter of `key`, as
+    /// if that had read `ctr`'s lines as well.
+    ///
+    /// Panics if `ctr` is of another algo.
+    pub fn merge_counter(&mut self, key: &[u8], ctr: Counter) {
+        self.update_key(key, |held, _| held.combine(ctr))
+    }
+
+    /// Calls `update` on the counter of `key`, inserting one if needed,
+    /// along with the arena its sketch should come from, and then spills
+    /// if the counter holds more than it should.
+    fn update_key(&mut self, key: &[u8], update: impl FnOnce(&mut Counter, &CpcArena)) {
+        let (pool, algo, lg_k) = (&mut self.pool, self.algo, self.lg_k);
+        let mut inserted = false;
+        let ctr = self.sketches.get_or_insert_with(key, || {
+            inserted = true;
+            pool.pop().unwrap_or_else(|| Counter::new(algo, lg_k))
+        });
+        if self.max_bytes == usize::MAX {
+            update(ctr, &self.arena);
+        } else {
+            // a counter taken from the pool was not held until now
+            let before = if inserted {
+                self.held_bytes += key.len();
+                0
+            } else {
+                ctr.memory_usage_bytes()
+            };
+            update(ctr, &self.arena);
+            self.held_bytes = self.held_bytes + ctr.memory_usage_bytes() - before;
         }
+        if self.sketches.len() > self.max_keys || self.held_bytes > self.max_bytes {
+            self.spill().expect("no io error");
+        }
+    }
+
+    /// Returns whether any keys were spilled by [`Self::spilling`], which
+    /// [`Self::state`] leaves out.
+    pub fn has_spilled(&self) -> bool {
+        !self.runs.is_empty()
+    }
+
+    /// Freezes the counter of every key held in memory, see
+    /// [`Counter::freeze`], for a store which is mostly read from here on.
+    /// The arena which backed their CPC sketches, and the emptied counters
+    /// kept for reuse, are let go, so that their memory is returned; keys
+    /// read after this are sketched from a fresh arena.
+    pub fn freeze(&mut self) {
+        self.sketches.values_mut().for_each(Counter::freeze);
+        self.pool = Vec::new();
+        self.arena = CpcArena::new();
+        self.track_held_bytes();
+    }
+
+    /// Calls `f` on every key and its counter, like [`Self::state`] but
+    /// including keys spilled by [`Self::spilling`]. If any were, keys
+    /// come in ascending order, and the counters of keys which were
+    /// merged from several spills estimate as merged sketches do.
+    pub fn for_each_key(mut self, mut f: impl FnMut(&[u8], &Counter)) -> io::Result<()> {
+        if self.runs.is_empty() {
+            self.state().for_each(|(key, ctr)| f(key, ctr));
+            return Ok(());
+        }
+        self.spill()?;
+        let mut merger = Merger::new(self.algo, self.lg_k);
+        merge_runs(&self.runs, |key, sketches| {
+            merger.reset();
+            for sketch in sketches {
+                merger
+                    .merge_serialized(sketch)
+                    .expect("properly deserialized counter");
+            }
+            f(key, &merger.counter());
+        })
+    }
+
+    /// Removes all keys, keeping their emptied counters to back the keys
+    /// read next, so one keyed counter can serve window after window
+    /// without allocating sketches for each.
+    pub fn clear(&mut self) {
+        self.runs.clear();
+        self.recycle();
+    }
+
+    /// Writes every key held in memory to a new run, in order, and then
+    /// recycles their counters.
+    fn spill(&mut self) -> io::Result<()> {
+        let mut keys: Vec<(&[u8], &Counter)> = self.sketches.iter().collect();
+        if keys.is_empty() {
+            return Ok(());
+        }
+        keys.sort_unstable_by_key(|&(key, _)| key);
+        let run = Run::write(|out| {
+            for (key, ctr) in keys {
+                write_frame(out, key)?;
+                ctr.write_frame(out, true)?;
+            }
+            Ok(())
+        })?;
+        self.runs.push(run);
+        self.recycle();
+        Ok(())
+    }
+
+    fn recycle(&mut self) {
+        self.held_bytes = 0;
+        let pool = &mut self.pool;
+        pool.extend(self.sketches.drain().map(|mut ctr| {
+            ctr.reset();
+            ctr
+        }));
     }
 }
 
-impl Merger {
-    pub fn counter(&self) -> Counter {
-        let sketch = self.sketch.sketch();
-        Counter { sketch }
+/// Counts distinct lines for each key as [`KeyedCounter`] does, but keeps
+/// only a 64-bit hash of each key, see [`Self::key_hash`], rather than
+/// the key itself. Keys then take 8 bytes each however long they are,
+/// and are looked up in a flat table of hashes. Two keys whose hashes
+/// collide are counted as one, which among a million keys happens with
+/// probability about `2^-25`.
+///
+/// Keys can still be printed for a sample of them, see
+/// [`Self::with_dictionary`].
+pub struct HashedKeyedCounter {
+    algo: Algo,
+    lg_k: u8,
+    // As in `KeyedCounter`.
+    arena: CpcArena,
+    sketches: HashTable<Counter>,
+    pool: Vec<Counter>,
+    // Keys are kept for hashes that are multiples of this, if non-zero.
+    one_in: u64,
+    dictionary: HashTable<Box<[u8]>>,
+}
+
+impl Default for HashedKeyedCounter {
+    fn default() -> Self {
+        Self::new(Algo::default(), DEFAULT_LG_K)
     }
 }
 
-impl LineReducer for Merger {
+impl LineReducer for HashedKeyedCounter {
     fn read_line(&mut self, line: &[u8]) {
-        let line = str::from_utf8(line).unwrap_or_else(|e| {
+        let space_ix = memchr::memchr(b' ', line).unwrap_or_else(|| {
             panic!(
-                "invalid UTF-8: {}\n{}\n{:?}",
-                e,
-                String::from_utf8_lossy(line),
-                line
+                "line missing space: '{}'",
+                str::from_utf8(line).unwrap_or("BAD UTF-8")
             )
         });
-        let counter = Counter::deserialize(line).expect("properly deserialized counter");
-        self.sketch.merge(counter.sketch);
+        let (key, value) = (&line[0..space_ix], &line[space_ix + 1..]);
+        self.read_key_value(key, value);
     }
 }
 
-#[derive(Default)]
-pub struct KeyedMerger {
-    sketches: HashMap<Vec<u8>, Merger>,
+impl KeyValueReducer for HashedKeyedCounter {
+    fn read_key_value(&mut self, key: &[u8], value: &[u8]) {
+        let hash = Self::key_hash(key);
+        let (pool, algo, lg_k) = (&mut self.pool, self.algo, self.lg_k);
+        let ctr = self.sketches.get_or_insert_with(hash, || {
+            pool.pop().unwrap_or_else(|| Counter::new(algo, lg_k))
+        });
+        ctr.update(value, Some(&self.arena));
+        if self.one_in != 0 && hash % self.one_in == 0 {
+            self.dictionary
+                .get_or_insert_with(hash, || key.to_vec().into_boxed_slice());
+        }
+    }
 }
 
-impl LineReducer for KeyedMerger {
+impl ParallelLineReducer for HashedKeyedCounter {
+    fn fork(&self) -> Self {
+        Self::new(self.algo, self.lg_k).with_dictionary(self.one_in)
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.sketches
+            .merge(other.sketches, |ctr, other| ctr.combine(other));
+        self.pool.extend(other.pool);
+        self.dictionary.merge(other.dictionary, |_, _| {});
+    }
+}
+
+impl HashedKeyedCounter {
+    /// Creates an empty keyed counter whose per-key counters are `algo`
+    /// sketches with `lg_k`, and which keeps no keys.
+    ///
+    /// Panics unless `lg_k` is in [`Algo::lg_k_range`].
+    pub fn new(algo: Algo, lg_k: u8) -> Self {
+        assert!(algo.lg_k_range().contains(&lg_k), "valid lg_k");
+        Self {
+            algo,
+            lg_k,
+            arena: CpcArena::new(),
+            sketches: HashTable::default(),
+            pool: Vec::new(),
+            one_in: 0,
+            dictionary: HashTable::default(),
+        }
+    }
+
+    /// Keeps the keys whose hashes are multiples of `one_in`, about one in
+    /// that many keys, so that [`Self::state`] can name them. The sample is
+    /// picked by hash, so every fork keeps the same keys. An `one_in` of 0
+    /// keeps none, and 1 keeps them all.
+    pub fn with_dictionary(mut self, one_in: u64) -> Self {
+        self.one_in = one_in;
+        self
+    }
+
+    /// The hash a key is counted under: the first 64 bits of its 128-bit
+    /// MurmurHash3 (x64 variant) with seed 9001, as sketches hash values,
+    /// so that other tools can compute it to join the counts back.
+    pub fn key_hash(key: &[u8]) -> u64 {
+        KeyHash::new(key).h1
+    }
+
+    /// Returns an iterator over all contained key hashes, their keys if
+    /// sampled into the dictionary, and their sketches.
+    pub fn state(&self) -> impl Iterator<Item = (u64, Option<&[u8]>, &Counter)> {
+        let dictionary = &self.dictionary;
+        self.sketches
+            .iter()
+            .map(move |(hash, ctr)| (hash, dictionary.get(hash).map(|key| &key[..]), ctr))
+    }
+
+    /// Removes all keys, keeping their emptied counters to back the keys
+    /// read next, as [`KeyedCounter::clear`] does.
+    pub fn clear(&mut self) {
+        let pool = &mut self.pool;
+        pool.extend(self.sketches.drain().map(|mut ctr| {
+            ctr.reset();
+            ctr
+        }));
+        self.dictionary.drain().for_each(drop);
+    }
+}
+
+/// Counts distinct values for each key as [`KeyedCounter`] does, but into
+/// one [`KeyedThetaSketch`] shared by all the keys rather than a sketch
+/// per key, so that the sketch takes the same memory, set by its `lg_k`,
+/// however many keys there are. Only the keys themselves grow with their
+/// number. Keys with many values are estimated about as well as by a
+/// theta sketch each, and keys with few much less well, down to 0.
+pub struct SharedThetaKeyedCounter {
+    // The id and hash of each key, ids counting up in insertion order.
+    keys: KeyTable<(u32, u64)>,
+    sketch: KeyedThetaSketch,
+}
+
+impl LineReducer for SharedThetaKeyedCounter {
     fn read_line(&mut self, line: &[u8]) {
         let space_ix = memchr::memchr(b' ', line).unwrap_or_else(|| {
             panic!(
@@ -129,74 +923,1895 @@ impl LineReducer for KeyedMerger {
             )
         });
         let (key, value) = (&line[0..space_ix], &line[space_ix + 1..]);
-        if !self.sketches.contains_key(key) {
-            self.sketches.insert(key.to_owned(), Merger::default());
-        }
-        self.sketches
-            .get_mut(key)
-            .expect("key present")
-            .read_line(value);
+        self.read_key_value(key, value);
     }
 }
 
-impl KeyedMerger {
-    /// Returns an iterator over all contained keys and their sketches.
-    pub fn state(&self) -> impl Iterator<Item = (&[u8], Counter)> {
-        self.sketches
+impl KeyValueReducer for SharedThetaKeyedCounter {
+    fn read_key_value(&mut self, key: &[u8], value: &[u8]) {
+        let (id, hash) = self.key_id(key, || KeyHash::new(key).h1);
+        self.sketch.update(id, hash, value);
+    }
+}
+
+impl ParallelLineReducer for SharedThetaKeyedCounter {
+    fn fork(&self) -> Self {
+        Self::new(self.sketch.lg_k())
+    }
+
+    fn combine(&mut self, other: Self) {
+        let key_map: Vec<u32> = other
+            .keys
             .iter()
-            .map(|(key, mrgr)| (key.as_ref(), mrgr.counter()))
+            .map(|(key, &(_, hash))| self.key_id(key, || hash).0)
+            .collect();
+        self.sketch
+            .merge(&other.sketch, &key_map)
+            .expect("every key of other mapped");
     }
 }
 
-pub struct HeavyHitter {
-    sketch: HhSketch,
-    k: u64,
+impl SharedThetaKeyedCounter {
+    /// Creates an empty keyed counter whose keys share a sketch of about
+    /// `2^lg_k` sampled (key, value) pairs.
+    ///
+    /// Panics unless `5 <= lg_k <= 26`.
+    pub fn new(lg_k: u8) -> Self {
+        Self {
+            keys: KeyTable::default(),
+            sketch: KeyedThetaSketch::new(lg_k).expect("valid lg_k"),
+        }
+    }
+
+    /// Returns the id and hash of `key`, first assigning it the next id and
+    /// the hash `hash()` if it is new.
+    fn key_id(&mut self, key: &[u8], hash: impl FnOnce() -> u64) -> (u32, u64) {
+        let next = self.keys.len().try_into().expect("under 4G keys");
+        *self.keys.get_or_insert_with(key, || (next, hash()))
+    }
+
+    /// Returns an iterator over all keys, in the order they were first
+    /// read, and their estimated distinct counts.
+    pub fn estimates(&self) -> impl Iterator<Item = (&[u8], f64)> {
+        let estimates = self
+            .sketch
+            .estimates(self.keys.len())
+            .expect("ids below the number of keys");
+        self.keys
+            .iter()
+            .map(move |(key, &(id, _))| (key, estimates[id as usize]))
+    }
+
+    /// Heap bytes held by the shared sketch, not counting the keys.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.sketch.memory_usage_bytes()
+    }
 }
 
-// https://users.rust-lang.org/t/logarithm-of-integers/8506/5
+/// An estimate ordered by [`f64::total_cmp`], for [`TopKeys`]' heap.
+#[derive(PartialEq)]
+struct Estimate(f64);
 
-fn log2_floor(x: u64) -> usize {
-    const fn num_bits<T>() -> usize {
-        std::mem::size_of::<T>() * 8
+impl Eq for Estimate {}
+
+impl PartialOrd for Estimate {
+    fn partial_cmp(&self, other: &Self) -> Option<Ordering> {
+        Some(self.cmp(other))
     }
-    assert!(x > 0);
-    num_bits::<u64>() - x.leading_zeros() as usize - 1
 }
 
-impl HeavyHitter {
-    /// Creates a new heavy hitter sketch targeting elements in the top-k
-    /// by reserving O(k) space.
-    pub fn new(k: u64) -> Self {
-        let lg2_k_with_room = log2_floor(k as u64).max(1) + 2;
+impl Ord for Estimate {
+    fn cmp(&self, other: &Self) -> Ordering {
+        self.0.total_cmp(&other.0)
+    }
+}
+
+/// Keeps the `n` keys offered with the highest estimates, ties going to
+/// the smaller key, without holding on to any other key or counter.
+///
+/// Once `n` keys are held, a key is first checked against a bound on its
+/// estimate, which is cheap for the many keys of a keyed job with only a
+/// few values each, and is skipped without computing its estimate unless
+/// the bound makes the cut.
+pub struct TopKeys {
+    n: usize,
+    // Min-heap of the kept keys, whose root is the next to be displaced.
+    heap: BinaryHeap<Reverse<(Estimate, Reverse<Vec<u8>>)>>,
+}
+
+impl TopKeys {
+    pub fn new(n: usize) -> Self {
         Self {
-            sketch: HhSketch::new(lg2_k_with_room.try_into().unwrap()),
-            k,
+            n,
+            heap: BinaryHeap::with_capacity(n + 1),
         }
     }
 
-    /// Serializes to base64 string with no newlines or `=` padding.
-    pub fn serialize(&self) -> String {
-        unimplemented!()
+    /// Considers `key` with the estimate of `ctr`.
+    pub fn offer(&mut self, key: &[u8], ctr: &Counter) {
+        if self.n == 0 || !self.makes_cut(key, ctr.estimate_bound()) {
+            return;
+        }
+        self.offer_estimate(key, ctr.estimate())
     }
 
-    /// Deserializes from base64 string with no newlines or `=` padding.
-    pub fn deserialize(_s: &str) -> Result<Self, base64::DecodeError> {
-        unimplemented!()
+    /// Considers `key` with an `estimate` computed elsewhere.
+    pub fn offer_estimate(&mut self, key: &[u8], estimate: f64) {
+        if self.n == 0 || !self.makes_cut(key, estimate) {
+            return;
+        }
+        if self.heap.len() == self.n {
+            self.heap.pop();
+        }
+        self.heap
+            .push(Reverse((Estimate(estimate), Reverse(key.to_owned()))));
     }
 
-    /// Returns pairs (heavy hitter slice, estimate of count size)
-    pub fn estimate(&self) -> impl Iterator<Item = (&[u8], u64)> {
-        let mut v = self.sketch.estimate_no_fn();
-        v.sort_by_key(|row| row.ub);
-        v.into_iter()
-            .rev()
-            .take(self.k as usize)
-            .map(|row| (row.key, row.ub))
+    fn makes_cut(&self, key: &[u8], estimate: f64) -> bool {
+        match self.heap.peek() {
+            Some(Reverse((Estimate(min), Reverse(min_key)))) if self.heap.len() == self.n => {
+                estimate > *min || (estimate == *min && key < &min_key[..])
+            }
+            _ => true,
+        }
+    }
+
+    /// Returns the kept keys and their estimates, highest first.
+    pub fn into_sorted(self) -> Vec<(Vec<u8>, f64)> {
+        self.heap
+            .into_sorted_vec()
+            .into_iter()
+            .map(|Reverse((Estimate(estimate), Reverse(key)))| (key, estimate))
+            .collect()
     }
 }
 
-impl LineReducer for HeavyHitter {
-    fn read_line(&mut self, line: &[u8]) {
-        self.sketch.update(line, 1);
+enum Union {
+    Cpc(CpcUnion),
+    Hll(HllUnion),
+}
+
+pub struct Merger {
+    union: Union,
+    lg_k: u8,
+}
+
+impl Default for Merger {
+    fn default() -> Self {
+        Self::new(Algo::default(), DEFAULT_LG_K)
+    }
+}
+
+impl Merger {
+    /// Creates an empty merger of serialized `algo` counters, whose
+    /// union has `lg_k`, or that of the smallest counter merged in.
+    ///
+    /// Panics unless `lg_k` is in [`Algo::lg_k_range`].
+    pub fn new(algo: Algo, lg_k: u8) -> Self {
+        let union = match algo {
+            Algo::Cpc => Union::Cpc(CpcUnion::with_lg_k(lg_k).expect("valid lg_k")),
+            Algo::Hll => Union::Hll(HllUnion::new(lg_k).expect("valid lg_k")),
+        };
+        Self { union, lg_k }
+    }
+
+    /// Empties the merger, keeping its union's memory for reuse.
+    pub fn reset(&mut self) {
+        match &mut self.union {
+            Union::Cpc(union) => union.reset(),
+            Union::Hll(union) => union.reset(),
+        }
+    }
+
+    fn algo(&self) -> Algo {
+        match self.union {
+            Union::Cpc(_) => Algo::Cpc,
+            Union::Hll(_) => Algo::Hll,
+        }
+    }
+
+    pub fn counter(&self) -> Counter {
+        let sketch = match &self.union {
+            Union::Cpc(union) => Sketch::Cpc(union.sketch()),
+            Union::Hll(union) => Sketch::Hll(union.sketch(HLL_TYPE)),
+        };
+        Counter {
+            sketch,
+            lg_k: self.lg_k,
+        }
+    }
+
+    /// Merges in the sketch of a counter of the same algo as this merger,
+    /// as [`Counter::write_frame`] writes it, straight from `buf`.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        match &mut self.union {
+            Union::Cpc(union) => union.merge_serialized(buf),
+            Union::Hll(union) => union.merge_serialized(buf),
+        }
+    }
+
+    /// Merges in a counter of the same algo as this merger.
+    fn merge(&mut self, counter: Counter) {
+        match (&mut self.union, counter.sketch) {
+            (Union::Cpc(union), Sketch::Coupons(coupons)) => {
+                union.merge(sketch_of(&coupons, counter.lg_k, None))
+            }
+            (Union::Cpc(union), Sketch::Cpc(cpc)) => union.merge(cpc),
+            (Union::Cpc(union), Sketch::Frozen(frozen)) => union.merge_frozen(&frozen),
+            (Union::Hll(union), Sketch::Hll(hll)) => union.merge(hll),
+            _ => panic!("merged counter algo must match the merger's"),
+        }
+    }
+}
+
+impl LineReducer for Merger {
+    fn read_line(&mut self, line: &[u8]) {
+        with_decoded(line, |bytes| self.merge_serialized(bytes))
+            .map_err(DataSketchesError::from)
+            .and_then(|merged| merged)
+            .unwrap_or_else(|e| {
+                panic!(
+                    "properly deserialized counter: {}\n{}",
+                    e,
+                    String::from_utf8_lossy(line)
+                )
+            });
+    }
+}
+
+impl ParallelLineReducer for Merger {
+    fn fork(&self) -> Self {
+        Self::new(self.algo(), self.lg_k)
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.merge(other.counter());
+    }
+}
+
+impl PipelinedLineReducer for Merger {
+    type Preparer = Algo;
+    type Prepared = Result<Counter, DataSketchesError>;
+
+    fn preparer(&self) -> Algo {
+        self.algo()
+    }
+
+    /// Decodes and deserializes the counter on `line`, leaving only its
+    /// union to [`Self::read_prepared`].
+    fn prepare(algo: &Algo, line: &[u8]) -> Self::Prepared {
+        with_decoded(line, |bytes| Counter::deserialize_bytes(bytes, *algo))
+            .map_err(DataSketchesError::from)
+            .and_then(|ctr| ctr)
+    }
+
+    fn read_prepared(&mut self, line: &[u8], prepared: Self::Prepared) {
+        let ctr = prepared.unwrap_or_else(|e| {
+            panic!(
+                "properly deserialized counter: {}\n{}",
+                e,
+                String::from_utf8_lossy(line)
+            )
+        });
+        self.merge(ctr);
+    }
+}
+
+pub struct KeyedMerger {
+    algo: Algo,
+    lg_k: u8,
+    sketches: KeyTable<Merger>,
+    // Emptied mergers from cleared keys, as in `KeyedCounter`.
+    pool: Vec<Merger>,
+}
+
+impl Default for KeyedMerger {
+    fn default() -> Self {
+        Self::new(Algo::default(), DEFAULT_LG_K)
+    }
+}
+
+impl LineReducer for KeyedMerger {
+    fn read_line(&mut self, line: &[u8]) {
+        let space_ix = memchr::memchr(b' ', line).unwrap_or_else(|| {
+            panic!(
+                "line missing space: '{}'",
+                str::from_utf8(line).unwrap_or("BAD UTF-8")
+            )
+        });
+        let (key, value) = (&line[0..space_ix], &line[space_ix + 1..]);
+        self.merger(key).read_line(value);
+    }
+}
+
+impl ParallelLineReducer for KeyedMerger {
+    fn fork(&self) -> Self {
+        Self::new(self.algo, self.lg_k)
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.sketches
+            .merge(other.sketches, |mrgr, other| mrgr.combine(other));
+        self.pool.extend(other.pool);
+    }
+}
+
+impl KeyedMerger {
+    /// Merges the serialized sketch in `buf` into `key`'s, as
+    /// [`Merger::merge_serialized`] does.
+    pub fn merge_serialized(&mut self, key: &[u8], buf: &[u8]) -> Result<(), DataSketchesError> {
+        self.merger(key).merge_serialized(buf)
+    }
+
+    /// The merger for `key`, which starts empty if `key` is new.
+    fn merger(&mut self, key: &[u8]) -> &mut Merger {
+        let (pool, algo, lg_k) = (&mut self.pool, self.algo, self.lg_k);
+        self.sketches.get_or_insert_with(key, || {
+            pool.pop().unwrap_or_else(|| Merger::new(algo, lg_k))
+        })
+    }
+
+    /// Creates an empty keyed merger of serialized `algo` counters, with
+    /// `lg_k` as in [`Merger::new`].
+    ///
+    /// Panics unless `lg_k` is in [`Algo::lg_k_range`].
+    pub fn new(algo: Algo, lg_k: u8) -> Self {
+        assert!(algo.lg_k_range().contains(&lg_k), "valid lg_k");
+        Self {
+            algo,
+            lg_k,
+            sketches: KeyTable::default(),
+            pool: Vec::new(),
+        }
+    }
+
+    /// Returns an iterator over all contained keys and their sketches.
+    pub fn state(&self) -> impl Iterator<Item = (&[u8], Counter)> {
+        self.sketches
+            .iter()
+            .map(|(key, mrgr)| (key, mrgr.counter()))
+    }
+
+    /// Removes all keys, keeping their emptied mergers to back the keys
+    /// read next, as [`KeyedCounter::clear`] does.
+    pub fn clear(&mut self) {
+        let pool = &mut self.pool;
+        pool.extend(self.sketches.drain().map(|mut mrgr| {
+            mrgr.reset();
+            mrgr
+        }));
+    }
+}
+
+/// Merges the serialized sketches of each key as [`KeyedMerger`] does, for
+/// inputs in which all the lines of a key are consecutive, such as those
+/// sorted by key. Only the current key's union is held, and it is handed
+/// to a callback as soon as the next key starts, so memory does not grow
+/// with the number of keys and keys are compared rather than hashed. A
+/// key that comes back after another is handed over again.
+pub struct SortedKeyedMerger<F> {
+    merger: Merger,
+    key: Vec<u8>,
+    // Whether `key` has been read, as opposed to being empty.
+    started: bool,
+    on_key: F,
+}
+
+impl<F: FnMut(&[u8], Counter)> SortedKeyedMerger<F> {
+    /// Creates an empty merger of serialized `algo` counters, with `lg_k`
+    /// as in [`Merger::new`], which hands each key and its merged counter
+    /// to `on_key` once the key's lines are over.
+    ///
+    /// Panics unless `lg_k` is in [`Algo::lg_k_range`].
+    pub fn new(algo: Algo, lg_k: u8, on_key: F) -> Self {
+        Self {
+            merger: Merger::new(algo, lg_k),
+            key: Vec::new(),
+            started: false,
+            on_key,
+        }
+    }
+
+    /// Merges the serialized sketch in `buf` into `key`'s, as
+    /// [`Merger::merge_serialized`] does, first ending the previous key if
+    /// `key` differs from it.
+    pub fn merge_serialized(&mut self, key: &[u8], buf: &[u8]) -> Result<(), DataSketchesError> {
+        self.merger(key).merge_serialized(buf)
+    }
+
+    /// The merger for `key`, which is emptied if `key` starts here.
+    fn merger(&mut self, key: &[u8]) -> &mut Merger {
+        if !self.started || self.key != key {
+            self.end_key();
+            self.key.clear();
+            self.key.extend_from_slice(key);
+            self.started = true;
+        }
+        &mut self.merger
+    }
+
+    /// Hands the current key, if any, to `on_key`, and empties its merger.
+    fn end_key(&mut self) {
+        if self.started {
+            (self.on_key)(&self.key, self.merger.counter());
+            self.merger.reset();
+        }
+    }
+
+    /// Ends the last key read, as there are no lines left.
+    pub fn finish(mut self) {
+        self.end_key();
+    }
+}
+
+/// Splits `line` into the key before its first space and the value after.
+///
+/// Panics if `line` has no space.
+fn split_key(line: &[u8]) -> (&[u8], &[u8]) {
+    let space_ix = memchr::memchr(b' ', line).unwrap_or_else(|| {
+        panic!(
+            "line missing space: '{}'",
+            str::from_utf8(line).unwrap_or("BAD UTF-8")
+        )
+    });
+    (&line[0..space_ix], &line[space_ix + 1..])
+}
+
+impl<F: FnMut(&[u8], Counter)> LineReducer for SortedKeyedMerger<F> {
+    fn read_line(&mut self, line: &[u8]) {
+        let (key, value) = split_key(line);
+        self.merger(key).read_line(value);
+    }
+}
+
+impl<F: FnMut(&[u8], Counter)> PipelinedLineReducer for SortedKeyedMerger<F> {
+    type Preparer = Algo;
+    type Prepared = Result<Counter, DataSketchesError>;
+
+    fn preparer(&self) -> Algo {
+        self.merger.algo()
+    }
+
+    fn prepare(algo: &Algo, line: &[u8]) -> Self::Prepared {
+        // a line missing a space is reported by read_prepared
+        let value = memchr::memchr(b' ', line).map_or(line, |i| &line[i + 1..]);
+        Merger::prepare(algo, value)
+    }
+
+    fn read_prepared(&mut self, line: &[u8], prepared: Self::Prepared) {
+        let (key, value) = split_key(line);
+        self.merger(key).read_prepared(value, prepared);
+    }
+}
+
+/// Counts the distinct values of each key into an [`HllStore`], so that
+/// counts carry over from the runs before, or merges the serialized HLL
+/// sketches of each key into it if `merge`. Lines are a key, a space, and
+/// a value or base64 sketch, as for [`KeyedCounter`] and [`KeyedMerger`].
+#[cfg(unix)]
+pub struct StoredKeyedCounter {
+    store: HllStore,
+    merge: bool,
+}
+
+#[cfg(unix)]
+impl StoredKeyedCounter {
+    pub fn new(store: HllStore, merge: bool) -> Self {
+        Self { store, merge }
+    }
+
+    /// Merges the serialized HLL sketch in `buf` into `key`'s, as
+    /// [`HllStore::merge_serialized`] does.
+    pub fn merge_serialized(&mut self, key: &[u8], buf: &[u8]) -> io::Result<()> {
+        self.store.merge_serialized(key, buf)
+    }
+
+    /// Calls `f` on each key updated since the store was opened, along
+    /// with a counter of its sketch in the store, which spans every run.
+    pub fn for_each_updated(&self, mut f: impl FnMut(&[u8], &Counter)) {
+        self.store.for_each_updated(|key| {
+            let serialized = self.store.serialize(key, HLL_TYPE).expect("key in store");
+            let ctr = Counter::deserialize_bytes(serialized.as_ref(), Algo::Hll)
+                .expect("store serializes HLL sketches");
+            f(key, &ctr)
+        })
+    }
+
+    /// Writes the store's updates back to its files, see [`HllStore::flush`].
+    pub fn flush(&mut self) -> io::Result<()> {
+        self.store.flush()
+    }
+}
+
+#[cfg(unix)]
+impl LineReducer for StoredKeyedCounter {
+    fn read_line(&mut self, line: &[u8]) {
+        let space_ix = memchr::memchr(b' ', line).unwrap_or_else(|| {
+            panic!(
+                "line missing space: '{}'",
+                str::from_utf8(line).unwrap_or("BAD UTF-8")
+            )
+        });
+        let (key, value) = (&line[0..space_ix], &line[space_ix + 1..]);
+        if !self.merge {
+            return self.store.update(key, value).expect("no io error");
+        }
+        with_decoded(value, |bytes| self.store.merge_serialized(key, bytes))
+            .map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))
+            .and_then(|merged| merged)
+            .unwrap_or_else(|e| {
+                panic!(
+                    "properly deserialized counter: {}\n{}",
+                    e,
+                    String::from_utf8_lossy(line)
+                )
+            });
+    }
+}
+
+/// Splits the last `num_values` space-delimited doubles off `line` into
+/// `values`, returning the rest of the line, the value they are summed for.
+fn split_values<'a>(line: &'a [u8], num_values: u8, values: &mut Vec<f64>) -> &'a [u8] {
+    values.clear();
+    let mut rest = line;
+    for _ in 0..num_values {
+        let space_ix = memchr::memrchr(b' ', rest).unwrap_or_else(|| {
+            panic!(
+                "line missing {} values: '{}'",
+                num_values,
+                str::from_utf8(line).unwrap_or("BAD UTF-8")
+            )
+        });
+        let word = &rest[space_ix + 1..];
+        let value = str::from_utf8(word)
+            .ok()
+            .and_then(|word| word.parse().ok())
+            .unwrap_or_else(|| {
+                panic!(
+                    "invalid value '{}' in line '{}'",
+                    String::from_utf8_lossy(word),
+                    String::from_utf8_lossy(line)
+                )
+            });
+        values.push(value);
+        rest = &rest[..space_ix];
+    }
+    values.reverse();
+    rest
+}
+
+/// Counts distinct values and sums the doubles that follow each of them
+/// on its line, in one [`ArrayOfDoublesSketch`].
+pub struct Summer {
+    sketch: ArrayOfDoublesSketch,
+    // Sketches of the forks combined into this one, unioned in only when
+    // the result is asked for, since the update sketch cannot take them.
+    combined: Vec<StaticArrayOfDoublesSketch>,
+    num_values: u8,
+    expected_n: u64,
+    values: Vec<f64>,
+}
+
+impl Summer {
+    /// Creates an empty summer of the last `num_values` words of each line.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn new(num_values: u8) -> Self {
+        Self::with_expected_n(num_values, 0)
+    }
+
+    /// Like [`Self::new`], but sizes its sketch, and those of its forks, for
+    /// about `expected_n` distinct values up front; see
+    /// [`ArrayOfDoublesSketch::with_expected_n`].
+    pub fn with_expected_n(num_values: u8, expected_n: u64) -> Self {
+        Self {
+            sketch: ArrayOfDoublesSketch::with_expected_n(num_values, expected_n),
+            combined: Vec::new(),
+            num_values,
+            expected_n,
+            values: Vec::with_capacity(num_values as usize),
+        }
+    }
+
+    /// Returns the sketch of all values read, whose estimate is the
+    /// distinct count and whose estimated sums are those of the doubles.
+    pub fn sketch(&self) -> StaticArrayOfDoublesSketch {
+        if self.combined.is_empty() {
+            return self.sketch.as_static();
+        }
+        let mut union = ArrayOfDoublesUnion::new(self.num_values);
+        union.merge(self.sketch.as_static());
+        self.combined
+            .iter()
+            .for_each(|sketch| union.merge(sketch.clone()));
+        union.sketch()
+    }
+}
+
+impl LineReducer for Summer {
+    fn read_line(&mut self, line: &[u8]) {
+        let value = split_values(line, self.num_values, &mut self.values);
+        self.sketch.update(value, &self.values);
+    }
+}
+
+impl ParallelLineReducer for Summer {
+    fn fork(&self) -> Self {
+        Self::with_expected_n(self.num_values, self.expected_n)
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.combined.push(other.sketch.as_static());
+        self.combined.extend(other.combined);
+    }
+}
+
+/// A [`Summer`] for each key, the first word on a line, as
+/// [`KeyedCounter`] keeps a [`Counter`].
+pub struct KeyedSummer {
+    num_values: u8,
+    sketches: KeyTable<Summer>,
+}
+
+impl KeyedSummer {
+    /// Creates an empty keyed summer of the last `num_values` words of each line.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn new(num_values: u8) -> Self {
+        assert!(num_values > 0, "need at least one value");
+        Self {
+            num_values,
+            sketches: KeyTable::default(),
+        }
+    }
+
+    /// Returns an iterator over all contained keys and their summers.
+    pub fn state(&self) -> impl Iterator<Item = (&[u8], &Summer)> {
+        self.sketches.iter()
+    }
+}
+
+impl LineReducer for KeyedSummer {
+    fn read_line(&mut self, line: &[u8]) {
+        let space_ix = memchr::memchr(b' ', line).unwrap_or_else(|| {
+            panic!(
+                "line missing space: '{}'",
+                str::from_utf8(line).unwrap_or("BAD UTF-8")
+            )
+        });
+        let (key, value) = (&line[0..space_ix], &line[space_ix + 1..]);
+        let num_values = self.num_values;
+        self.sketches
+            .get_or_insert_with(key, || Summer::new(num_values))
+            .read_line(value);
+    }
+}
+
+impl ParallelLineReducer for KeyedSummer {
+    fn fork(&self) -> Self {
+        Self::new(self.num_values)
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.sketches
+            .merge(other.sketches, |summer, other| summer.combine(other));
+    }
+}
+
+/// Lines a [`HeavyHitter`] reads at a time, combining duplicates into one
+/// weighted update. Heavy hitter input is skewed, so a window has far
+/// fewer distinct lines than lines.
+const HH_WINDOW: usize = 4096;
+
+pub struct HeavyHitter {
+    sketch: NativeHhSketch,
+    k: u64,
+    // The counts of the lines in the current window, along with their
+    // ends in the table's packed keys, all reused across windows.
+    window: KeyTable<u64>,
+    ends: Vec<usize>,
+    weights: Vec<u64>,
+}
+
+// https://users.rust-lang.org/t/logarithm-of-integers/8506/5
+
+fn log2_floor(x: u64) -> usize {
+    const fn num_bits<T>() -> usize {
+        std::mem::size_of::<T>() * 8
+    }
+    assert!(x > 0);
+    num_bits::<u64>() - x.leading_zeros() as usize - 1
+}
+
+impl HeavyHitter {
+    /// Creates a new heavy hitter sketch targeting elements in the top-k
+    /// by reserving O(k) space.
+    pub fn new(k: u64) -> Self {
+        let lg2_k_with_room = log2_floor(k as u64).max(1) + 2;
+        Self {
+            sketch: NativeHhSketch::new(lg2_k_with_room.try_into().unwrap()),
+            k,
+            window: KeyTable::default(),
+            ends: Vec::new(),
+            weights: Vec::new(),
+        }
+    }
+
+    /// Updates the sketch with each distinct line of `buf` from `start`,
+    /// whose lines end at offsets `ends`, weighted by its count.
+    fn read_window(&mut self, buf: &[u8], mut start: usize, ends: &[usize]) {
+        // runs of a repeated line are looked up in the window once
+        let mut run: Option<(&[u8], u64)> = None;
+        for &end in ends {
+            let line = &buf[start..end];
+            match &mut run {
+                Some((last, count)) if *last == line => *count += 1,
+                _ => {
+                    if let Some((last, count)) = run.replace((line, 1)) {
+                        *self.window.get_or_insert_with(last, || 0) += count;
+                    }
+                }
+            }
+            start = end;
+        }
+        if let Some((last, count)) = run {
+            *self.window.get_or_insert_with(last, || 0) += count;
+        }
+        self.ends.clear();
+        self.weights.clear();
+        let mut end = 0;
+        for (key, &count) in self.window.iter() {
+            end += key.len();
+            self.ends.push(end);
+            self.weights.push(count);
+        }
+        self.sketch
+            .update_weighted_batch(self.window.packed_keys(), &self.ends, &self.weights);
+        self.window.drain().for_each(drop);
+    }
+
+    /// Serializes to base64 string with no newlines or `=` padding.
+    pub fn serialize(&self) -> String {
+        base64::encode_config(self.sketch.serialize(), base64::STANDARD_NO_PAD)
+    }
+
+    /// Writes the serialized sketch, without base64, as one frame for
+    /// [`Self::merge_serialized`] to read back.
+    pub fn write_frame<W: io::Write>(&self, out: &mut W) -> io::Result<()> {
+        write_frame(out, self.sketch.serialize().as_ref())
+    }
+
+    /// Deserializes from base64 string with no newlines or `=` padding,
+    /// into a heavy hitter that reports the top `k`.
+    pub fn deserialize(s: &str, k: u64) -> Result<Self, DataSketchesError> {
+        let mut hh = Self::new(k);
+        with_decoded(s.as_bytes(), |bytes| hh.merge_serialized(bytes))??;
+        Ok(hh)
+    }
+
+    /// Merges in the sketch of another heavy hitter, as
+    /// [`Self::write_frame`] writes it, straight from `buf`.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        self.sketch.merge(&NativeHhSketch::deserialize(buf)?);
+        Ok(())
+    }
+
+    /// Returns pairs (heavy hitter slice, estimate of count size) of the
+    /// top `k`, highest first.
+    pub fn estimate(&self) -> impl Iterator<Item = (&[u8], u64)> {
+        let k = self.k.try_into().unwrap_or(usize::MAX);
+        self.sketch
+            .top_no_fn(k)
+            .into_iter()
+            .map(|row| (row.key, row.ub))
+    }
+}
+
+impl LineReducer for HeavyHitter {
+    fn read_line(&mut self, line: &[u8]) {
+        self.sketch.update(line, 1);
+    }
+
+    fn read_repeated(&mut self, line: &[u8], count: u64) {
+        self.sketch.update(line, count);
+    }
+
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        let mut start = 0;
+        for lines in ends.chunks(HH_WINDOW) {
+            self.read_window(buf, start, lines);
+            start = lines[lines.len() - 1];
+        }
+    }
+}
+
+impl ParallelLineReducer for HeavyHitter {
+    fn fork(&self) -> Self {
+        Self::new(self.k)
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.sketch.merge(&other.sketch);
+    }
+}
+
+/// Merges the serialized heavy hitter sketches on each line, as
+/// [`HeavyHitter::serialize`] writes them.
+pub struct HeavyHitterMerger {
+    hh: HeavyHitter,
+}
+
+impl HeavyHitterMerger {
+    /// Creates an empty merger, whose heavy hitter reports the top `k`.
+    pub fn new(k: u64) -> Self {
+        Self {
+            hh: HeavyHitter::new(k),
+        }
+    }
+
+    /// Merges in a sketch as [`HeavyHitter::write_frame`] writes it.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        self.hh.merge_serialized(buf)
+    }
+
+    /// Returns the heavy hitter of all sketches merged.
+    pub fn into_heavy_hitter(self) -> HeavyHitter {
+        self.hh
+    }
+}
+
+impl LineReducer for HeavyHitterMerger {
+    fn read_line(&mut self, line: &[u8]) {
+        with_decoded(line, |bytes| self.merge_serialized(bytes))
+            .map_err(DataSketchesError::from)
+            .and_then(|merged| merged)
+            .unwrap_or_else(|e| {
+                panic!(
+                    "properly deserialized heavy hitter: {}\n{}",
+                    e,
+                    String::from_utf8_lossy(line)
+                )
+            });
+    }
+}
+
+impl ParallelLineReducer for HeavyHitterMerger {
+    fn fork(&self) -> Self {
+        Self::new(self.hh.k)
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.hh.combine(other.hh);
+    }
+}
+
+/// A [`HeavyHitter`] of the rest of each line for each key, its first
+/// word, as [`KeyedSummer`] keeps a [`Summer`]. The keys' sketches are
+/// [`CompactHhSketches`], which store each line once however many keys
+/// hold it, so that millions of keys fit in memory. Each key can be on at
+/// most `u32::MAX` lines.
+pub struct KeyedHeavyHitter {
+    k: u64,
+    sketches: CompactHhSketches,
+    // the index of each key's sketch
+    keys: KeyTable<usize>,
+}
+
+impl KeyedHeavyHitter {
+    /// Creates an empty keyed heavy hitter, which reports the top `k` lines
+    /// of each key.
+    pub fn new(k: u64) -> Self {
+        let lg2_k_with_room = log2_floor(k as u64).max(1) + 2;
+        Self {
+            k,
+            sketches: CompactHhSketches::new(lg2_k_with_room.try_into().unwrap()),
+            keys: KeyTable::default(),
+        }
+    }
+
+    /// Returns each key along with pairs (heavy hitter slice, estimate of
+    /// count size) of its top `k`, highest first.
+    pub fn state(&self) -> impl Iterator<Item = (&[u8], Vec<(&[u8], u64)>)> {
+        let k = self.k.try_into().unwrap_or(usize::MAX);
+        self.keys.iter().map(move |(key, &i)| {
+            let top = self
+                .sketches
+                .top_no_fn(i, k)
+                .into_iter()
+                .map(|row| (row.key, row.ub))
+                .collect();
+            (key, top)
+        })
+    }
+
+    /// Returns the heap memory held by the sketches and their shared
+    /// lines, in bytes, not counting the table of keys.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.sketches.memory_usage_bytes()
+    }
+}
+
+impl LineReducer for KeyedHeavyHitter {
+    fn read_line(&mut self, line: &[u8]) {
+        let space_ix = memchr::memchr(b' ', line).unwrap_or_else(|| {
+            panic!(
+                "line missing space: '{}'",
+                str::from_utf8(line).unwrap_or("BAD UTF-8")
+            )
+        });
+        let (key, value) = (&line[0..space_ix], &line[space_ix + 1..]);
+        let sketches = &mut self.sketches;
+        let i = *self.keys.get_or_insert_with(key, || sketches.push());
+        sketches.update(i, value, 1);
+    }
+}
+
+impl ParallelLineReducer for KeyedHeavyHitter {
+    fn fork(&self) -> Self {
+        Self::new(self.k)
+    }
+
+    fn combine(&mut self, other: Self) {
+        let sketches = &mut self.sketches;
+        for (key, &j) in other.keys.iter() {
+            let i = *self.keys.get_or_insert_with(key, || sketches.push());
+            sketches.merge(i, &other.sketches, j);
+        }
+    }
+}
+
+/// Keeps a sample of at most `k` lines, each of weight 1, in a
+/// [`VarOptSketch`].
+pub struct Sampler {
+    sketch: VarOptSketch,
+}
+
+impl Sampler {
+    /// Creates an empty sampler of at most `k` lines.
+    ///
+    /// Panics unless `1 <= k < 2^31 - 1`.
+    pub fn new(k: u32) -> Self {
+        Self {
+            sketch: VarOptSketch::new(k).expect("valid sample size"),
+        }
+    }
+
+    /// Returns the sketch of all lines read, whose samples are lines
+    /// with their adjusted weights.
+    pub fn sketch(&self) -> &VarOptSketch {
+        &self.sketch
+    }
+}
+
+impl LineReducer for Sampler {
+    fn read_line(&mut self, line: &[u8]) {
+        self.sketch.update(line, 1.0).expect("unit weight is valid")
+    }
+
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        self.sketch.update_batch(buf, ends)
+    }
+}
+
+impl ParallelLineReducer for Sampler {
+    fn fork(&self) -> Self {
+        Self::new(self.sketch.k())
+    }
+
+    fn combine(&mut self, other: Self) {
+        let mut union = VarOptUnion::new(self.sketch.k()).expect("valid sample size");
+        union.merge(&self.sketch);
+        union.merge(&other.sketch);
+        self.sketch = union.sketch();
+    }
+}
+
+/// Returns the first word of `line`, up to its first space, or all of it.
+fn first_word(line: &[u8]) -> &[u8] {
+    memchr::memchr(b' ', line).map_or(line, |space_ix| &line[..space_ix])
+}
+
+/// Packs the first word of each line of `buf`, whose lines end at offsets
+/// `ends`, into `words`, with their ends in `word_ends`, so that they can
+/// be hashed as one batch.
+fn pack_first_words(buf: &[u8], ends: &[usize], words: &mut Vec<u8>, word_ends: &mut Vec<usize>) {
+    words.clear();
+    word_ends.clear();
+    for line in packed_lines(buf, ends) {
+        words.extend_from_slice(first_word(line));
+        word_ends.push(words.len());
+    }
+}
+
+/// Adds each line to a [`BloomFilter`], or with [`Self::keyed`] its first
+/// word, so that another input can later be filtered down to the lines
+/// that may be among them with [`BloomProbe`].
+pub struct BloomBuilder {
+    filter: BloomFilter,
+    keyed: bool,
+    // the first words of the current batch, reused across batches
+    words: Vec<u8>,
+    word_ends: Vec<usize>,
+}
+
+impl BloomBuilder {
+    /// Creates an empty builder of a filter sized for `num_items` distinct
+    /// lines, as [`BloomFilter::for_items`] sizes it.
+    pub fn new(num_items: u64) -> Self {
+        Self::with_filter(BloomFilter::for_items(num_items))
+    }
+
+    fn with_filter(filter: BloomFilter) -> Self {
+        Self {
+            filter,
+            keyed: false,
+            words: Vec::new(),
+            word_ends: Vec::new(),
+        }
+    }
+
+    /// Adds the first word of each line, up to its first space, rather
+    /// than the whole line.
+    pub fn keyed(mut self) -> Self {
+        self.keyed = true;
+        self
+    }
+
+    /// Returns the filter of all lines read.
+    pub fn filter(&self) -> &BloomFilter {
+        &self.filter
+    }
+
+    /// Serializes to base64 string with no newlines or `=` padding.
+    pub fn serialize(&self) -> String {
+        base64::encode_config(self.filter.serialize(), base64::STANDARD_NO_PAD)
+    }
+
+    /// Writes the serialized filter, without base64, as one frame for
+    /// [`Self::merge_serialized`] to read back.
+    pub fn write_frame<W: io::Write>(&self, out: &mut W) -> io::Result<()> {
+        write_frame(out, self.filter.serialize().as_ref())
+    }
+
+    /// Deserializes a filter from base64 string with no newlines or `=`
+    /// padding.
+    pub fn deserialize(s: &str) -> Result<BloomFilter, DataSketchesError> {
+        with_decoded(s.as_bytes(), BloomFilter::deserialize)?
+    }
+
+    /// ORs in a filter of the same size, as [`Self::write_frame`] writes
+    /// it, straight from `buf`.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        self.filter.merge(&BloomFilter::deserialize(buf)?)
+    }
+}
+
+impl LineReducer for BloomBuilder {
+    fn read_line(&mut self, line: &[u8]) {
+        let item = if self.keyed { first_word(line) } else { line };
+        self.filter.update(item);
+    }
+
+    fn read_repeated(&mut self, line: &[u8], _count: u64) {
+        self.read_line(line);
+    }
+
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        if self.keyed {
+            pack_first_words(buf, ends, &mut self.words, &mut self.word_ends);
+            self.filter.update_batch(&self.words, &self.word_ends);
+        } else {
+            self.filter.update_batch(buf, ends);
+        }
+    }
+}
+
+impl ParallelLineReducer for BloomBuilder {
+    fn fork(&self) -> Self {
+        let filter = BloomFilter::new(self.filter.lg_num_blocks()).expect("valid size");
+        Self {
+            keyed: self.keyed,
+            ..Self::with_filter(filter)
+        }
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.filter.merge(&other.filter).expect("same size");
+    }
+}
+
+/// Merges the serialized Bloom filters on each line, as
+/// [`BloomBuilder::serialize`] writes them, all of the same size.
+pub struct BloomMerger {
+    builder: BloomBuilder,
+}
+
+impl BloomMerger {
+    /// Creates an empty merger of filters sized for `num_items`, as
+    /// [`BloomBuilder::new`] sizes them.
+    pub fn new(num_items: u64) -> Self {
+        Self {
+            builder: BloomBuilder::new(num_items),
+        }
+    }
+
+    /// Merges in a filter as [`BloomBuilder::write_frame`] writes it.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        self.builder.merge_serialized(buf)
+    }
+
+    /// Returns the builder of all filters merged.
+    pub fn into_builder(self) -> BloomBuilder {
+        self.builder
+    }
+}
+
+impl LineReducer for BloomMerger {
+    fn read_line(&mut self, line: &[u8]) {
+        with_decoded(line, |bytes| self.merge_serialized(bytes))
+            .map_err(DataSketchesError::from)
+            .and_then(|merged| merged)
+            .unwrap_or_else(|e| {
+                panic!(
+                    "properly deserialized Bloom filter of the same size: {}\n{}",
+                    e,
+                    String::from_utf8_lossy(line)
+                )
+            });
+    }
+}
+
+impl ParallelLineReducer for BloomMerger {
+    fn fork(&self) -> Self {
+        Self {
+            builder: self.builder.fork(),
+        }
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.builder.combine(other.builder);
+    }
+}
+
+/// Writes each line that a [`BloomFilter`] may hold, or with
+/// [`Self::keyed`] whose first word it may hold, to `out` in input order,
+/// dropping those it certainly does not. Lines are written with `\n`
+/// terminators.
+pub struct BloomProbe<W> {
+    filter: BloomFilter,
+    keyed: bool,
+    out: W,
+    // the first words and results of the current batch, reused across
+    // batches
+    words: Vec<u8>,
+    word_ends: Vec<usize>,
+    found: Vec<bool>,
+}
+
+impl<W: io::Write> BloomProbe<W> {
+    pub fn new(filter: BloomFilter, out: W) -> Self {
+        Self {
+            filter,
+            keyed: false,
+            out,
+            words: Vec::new(),
+            word_ends: Vec::new(),
+            found: Vec::new(),
+        }
+    }
+
+    /// Tests the first word of each line, up to its first space, rather
+    /// than the whole line.
+    pub fn keyed(mut self) -> Self {
+        self.keyed = true;
+        self
+    }
+
+    /// Returns the output, for the caller to flush.
+    pub fn into_inner(self) -> W {
+        self.out
+    }
+
+    fn write_line(&mut self, line: &[u8]) {
+        self.out
+            .write_all(line)
+            .and_then(|_| self.out.write_all(b"\n"))
+            .expect("no io error");
+    }
+}
+
+impl<W: io::Write> LineReducer for BloomProbe<W> {
+    fn read_line(&mut self, line: &[u8]) {
+        let item = if self.keyed { first_word(line) } else { line };
+        if self.filter.contains(item) {
+            self.write_line(line);
+        }
+    }
+
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        let mut found = mem::take(&mut self.found);
+        if self.keyed {
+            pack_first_words(buf, ends, &mut self.words, &mut self.word_ends);
+            self.filter
+                .contains_batch(&self.words, &self.word_ends, &mut found);
+        } else {
+            self.filter.contains_batch(buf, ends, &mut found);
+        }
+        for (line, &found) in packed_lines(buf, ends).zip(found.iter()) {
+            if found {
+                self.write_line(line);
+            }
+        }
+        self.found = found;
+    }
+}
+
+/// The KLL `k` of [`LineStats`], for a rank error of about 1.65%.
+const LENGTHS_K: u16 = 200;
+
+/// Reduces lines to their distinct count, their heavy hitters and the
+/// quantiles of their lengths at once, so that reading and splitting the
+/// input is paid for once. Each batch of lines is hashed once for the
+/// [`CpcSketch`], and its lengths are copied into the [`KllFloatSketch`]
+/// in one update.
+pub struct LineStats {
+    distinct: CpcSketch,
+    hh: HeavyHitter,
+    lengths: KllFloatSketch,
+    // The hashes and lengths of the current batch, reused across batches.
+    hashes: Vec<KeyHash>,
+    batch_lengths: Vec<f32>,
+}
+
+impl LineStats {
+    /// Creates empty statistics, counting distinct lines with a CPC
+    /// sketch of `lg_k` and reporting the top `k` lines.
+    ///
+    /// Panics unless `lg_k` is in [`Algo::lg_k_range`] of [`Algo::Cpc`].
+    pub fn new(lg_k: u8, k: u64) -> Self {
+        Self {
+            distinct: CpcSketch::with_lg_k(lg_k).expect("valid lg_k"),
+            hh: HeavyHitter::new(k),
+            lengths: KllFloatSketch::new(LENGTHS_K).expect("valid k"),
+            hashes: Vec::new(),
+            batch_lengths: Vec::new(),
+        }
+    }
+
+    /// Returns the estimate of the number of distinct lines.
+    pub fn estimate(&self) -> f64 {
+        self.distinct.estimate()
+    }
+
+    /// Returns the heavy hitters, as [`HeavyHitter::estimate`] does.
+    pub fn heavy_hitters(&self) -> impl Iterator<Item = (&[u8], u64)> {
+        self.hh.estimate()
+    }
+
+    /// Returns the sketch of the lengths of the lines in bytes, without
+    /// their line terminators.
+    pub fn lengths(&self) -> &KllFloatSketch {
+        &self.lengths
+    }
+}
+
+impl LineReducer for LineStats {
+    fn read_line(&mut self, line: &[u8]) {
+        self.distinct.update_hashed(KeyHash::new(line));
+        self.hh.read_line(line);
+        self.lengths.update(line.len() as f32);
+    }
+
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        self.hashes.clear();
+        KeyHash::extend_batch(&mut self.hashes, buf, ends);
+        self.distinct.update_hashed_batch(&self.hashes);
+        self.hh.read_lines(buf, ends);
+        self.batch_lengths.clear();
+        let mut start = 0;
+        for &end in ends {
+            self.batch_lengths.push((end - start) as f32);
+            start = end;
+        }
+        self.lengths.update_batch(&self.batch_lengths);
+    }
+}
+
+impl ParallelLineReducer for LineStats {
+    fn fork(&self) -> Self {
+        Self {
+            distinct: CpcSketch::with_lg_k(self.distinct.lg_k()).expect("valid lg_k"),
+            hh: self.hh.fork(),
+            lengths: KllFloatSketch::new(LENGTHS_K).expect("valid k"),
+            hashes: Vec::new(),
+            batch_lengths: Vec::new(),
+        }
+    }
+
+    fn combine(&mut self, other: Self) {
+        let mut union = CpcUnion::with_lg_k(self.distinct.lg_k()).expect("valid lg_k");
+        union.merge(mem::replace(&mut self.distinct, CpcSketch::new()));
+        union.merge(other.distinct);
+        self.distinct = union.sketch();
+        self.hh.combine(other.hh);
+        self.lengths.merge(&other.lengths);
+    }
+}
+
+/// Counts distinct values over a sliding window of the last `num_slices`
+/// slices of the input, in a [`ThetaWindow`]. Each line is a slice number
+/// and then, after a space, its value. Slice numbers, such as the second
+/// of each value, must never decrease, and slices without lines still
+/// take their place in the window.
+pub struct WindowCounter<F> {
+    window: ThetaWindow,
+    slice: Option<u64>,
+    on_slice: F,
+}
+
+impl<F: FnMut(u64, f64)> WindowCounter<F> {
+    /// Creates an empty counter whose window has theta sketches of `lg_k`,
+    /// which hands the number and window estimate of each slice read to
+    /// `on_slice` once the slice is over.
+    ///
+    /// Panics unless `5 <= lg_k <= 26` and `num_slices > 0`.
+    pub fn new(lg_k: u8, num_slices: usize, on_slice: F) -> Self {
+        Self::with_p(lg_k, 1.0, num_slices, on_slice)
+    }
+
+    /// Like [`Self::new`], but the sketches only keep values with
+    /// probability `p`, see [`ThetaWindow::with_p`].
+    ///
+    /// Panics unless also `0 < p <= 1`.
+    pub fn with_p(lg_k: u8, p: f32, num_slices: usize, on_slice: F) -> Self {
+        Self {
+            window: ThetaWindow::with_p(lg_k, p, num_slices).expect("valid window"),
+            slice: None,
+            on_slice,
+        }
+    }
+
+    /// Ends the last slice read, as there are no lines left.
+    pub fn finish(mut self) {
+        if let Some(slice) = self.slice {
+            (self.on_slice)(slice, self.window.estimate());
+        }
+    }
+}
+
+impl<F: FnMut(u64, f64)> LineReducer for WindowCounter<F> {
+    fn read_line(&mut self, line: &[u8]) {
+        let space_ix = memchr::memchr(b' ', line).unwrap_or_else(|| {
+            panic!(
+                "line missing space: '{}'",
+                str::from_utf8(line).unwrap_or("BAD UTF-8")
+            )
+        });
+        let (slice, value) = (&line[0..space_ix], &line[space_ix + 1..]);
+        let slice: u64 = str::from_utf8(slice)
+            .ok()
+            .and_then(|slice| slice.parse().ok())
+            .unwrap_or_else(|| {
+                panic!(
+                    "invalid slice '{}' in line '{}'",
+                    String::from_utf8_lossy(slice),
+                    String::from_utf8_lossy(line)
+                )
+            });
+        match self.slice {
+            Some(current) if current == slice => {}
+            Some(current) => {
+                assert!(current < slice, "slice {} after slice {}", slice, current);
+                (self.on_slice)(current, self.window.estimate());
+                // past num_slices, the window is empty whatever the gap
+                let gap = (slice - current).min(self.window.num_slices() as u64);
+                (0..gap).for_each(|_| self.window.advance());
+                self.slice = Some(slice);
+            }
+            None => self.slice = Some(slice),
+        }
+        self.window.update(value);
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn read_window<R: LineReducer>(reducer: &mut R, window: u64) {
+        for i in 0..1000 {
+            let line = format!("k{} {}", i % 3, window * 1000 + i);
+            reducer.read_line(line.as_bytes());
+        }
+    }
+
+    fn sorted<'a>(state: impl Iterator<Item = (&'a [u8], String)>) -> Vec<(Vec<u8>, String)> {
+        let mut state: Vec<_> = state.map(|(key, s)| (key.to_owned(), s)).collect();
+        state.sort();
+        state
+    }
+
+    #[test]
+    fn checkpoint_restores_counters() {
+        let lines: Vec<String> = (0..20 * 1000)
+            .map(|i| match i % 100 {
+                0 => format!("rare{} {}", i % 3, i),
+                _ => format!("k{} {}", i % 5, i),
+            })
+            .collect();
+        for algo in [Algo::Cpc, Algo::Hll] {
+            let mut whole = KeyedCounter::new(algo, 10);
+            lines.iter().for_each(|l| whole.read_line(l.as_bytes()));
+
+            let mut first = KeyedCounter::new(algo, 10);
+            lines[..9000]
+                .iter()
+                .for_each(|l| first.read_line(l.as_bytes()));
+            let mut saved = Vec::new();
+            first.save(&mut saved);
+            let mut resumed = KeyedCounter::new(algo, 10);
+            resumed.restore(&saved).unwrap();
+            lines[9000..]
+                .iter()
+                .for_each(|l| resumed.read_line(l.as_bytes()));
+
+            let estimates = |ctr: &KeyedCounter| {
+                sorted(
+                    ctr.state()
+                        .map(|(key, ctr)| (key, format!("{:.6}", ctr.estimate()))),
+                )
+            };
+            assert_eq!(estimates(&whole), estimates(&resumed));
+            assert_eq!(estimates(&whole).len(), 8);
+        }
+        // a bad sketch, a frame cut short, and a key without a sketch
+        for saved in [
+            &[3, 0, 0, 0, b'k', b'e', b'y', 1, 0, 0, 0, 0][..],
+            &[3, 0, 0, 0, b'k', b'e', b'y', 1, 0, 0, 0],
+            &[3, 0, 0, 0, b'k', b'e', b'y'],
+        ] {
+            let err = KeyedCounter::default().restore(saved).unwrap_err();
+            assert_eq!(err.kind(), io::ErrorKind::InvalidData);
+        }
+
+        fn config<T: Checkpoint>(ctr: &T) -> Vec<u8> {
+            let mut config = Vec::new();
+            ctr.save_config(&mut config);
+            config
+        }
+        let keyed = config(&KeyedCounter::new(Algo::Cpc, 10));
+        assert_eq!(keyed, config(&KeyedCounter::new(Algo::Cpc, 10)));
+        assert_ne!(keyed, config(&KeyedCounter::new(Algo::Hll, 10)));
+        assert_ne!(keyed, config(&KeyedCounter::new(Algo::Cpc, 11)));
+        assert_ne!(keyed, config(&Counter::new(Algo::Cpc, 10)));
+    }
+
+    #[test]
+    fn coupons_match_sketch() {
+        // on both sides of the coupon limit, read one line or a batch at a time
+        for &lg_k in &[4, 8, DEFAULT_LG_K] {
+            for &n in &[0, 1, 10, 23, 24, 25, 127, 128, 129, 1000, 100000] {
+                let mut cpc = CpcSketch::with_lg_k(lg_k).unwrap();
+                let mut single = Counter::new(Algo::Cpc, lg_k);
+                let (mut buf, mut ends) = (Vec::new(), Vec::new());
+                for i in 0..2 * n {
+                    let line = format!("line {}", i % n);
+                    cpc.update(line.as_bytes());
+                    single.read_line(line.as_bytes());
+                    buf.extend(line.as_bytes());
+                    ends.push(buf.len());
+                }
+                let mut batched = Counter::new(Algo::Cpc, lg_k);
+                batched.read_lines(&buf, &ends);
+                let expected = base64::encode_config(cpc.serialize(), base64::STANDARD_NO_PAD);
+                for ctr in &[single, batched] {
+                    assert_eq!(ctr.serialize(), expected);
+                    assert_eq!(ctr.estimate(), cpc.estimate());
+                }
+            }
+        }
+    }
+
+    #[test]
+    fn serialize_many_matches_each() {
+        // coupon lists, sketches they were promoted to, and HLL sketches
+        let mut ctrs = Vec::new();
+        for algo in [Algo::Cpc, Algo::Hll] {
+            for i in 0..200 {
+                let mut ctr = Counter::new(algo, 10);
+                (0..i * 10).for_each(|j| ctr.read_line(format!("line {}", j).as_bytes()));
+                ctrs.push(ctr);
+            }
+        }
+        let ctrs: Vec<&Counter> = ctrs.iter().collect();
+        for &for_merge in &[false, true] {
+            let (mut expected, mut expected_ends) = (Vec::new(), Vec::new());
+            for ctr in &ctrs {
+                ctr.append_serialized(&mut expected, for_merge);
+                expected_ends.push(expected.len());
+            }
+            for &threads in &[1, 3, 8] {
+                let (buf, ends) = Counter::serialize_many(&ctrs, for_merge, threads);
+                assert!(buf == expected, "threads {}", threads);
+                assert_eq!(ends, expected_ends);
+            }
+        }
+    }
+
+    #[test]
+    fn repeats_read_as_runs() {
+        // runs of up to 5 of a line, some spanning the end of a batch
+        let lines: Vec<String> = (0..30 * 1000)
+            .map(|i| format!("line {}", i / (1 + i % 5)))
+            .collect();
+        for algo in [Algo::Cpc, Algo::Hll] {
+            let mut single = Counter::new(algo, 10);
+            lines.iter().for_each(|l| single.read_line(l.as_bytes()));
+            let mut batched = Counter::new(algo, 10);
+            let mut repeated = Counter::new(algo, 10);
+            lines
+                .iter()
+                .for_each(|l| repeated.read_repeated(l.as_bytes(), 2));
+            for batch in lines.chunks(1000) {
+                let (mut buf, mut ends) = (Vec::new(), Vec::new());
+                for line in batch {
+                    buf.extend(line.as_bytes());
+                    ends.push(buf.len());
+                }
+                batched.read_lines(&buf, &ends);
+            }
+            for ctr in &[batched, repeated] {
+                assert_eq!(ctr.serialize(), single.serialize());
+                assert_eq!(ctr.estimate(), single.estimate());
+            }
+        }
+
+        let mut single = HeavyHitter::new(10);
+        let mut repeated = HeavyHitter::new(10);
+        for (i, key) in [&b"a"[..], b"b", b"a", b"c"].iter().enumerate() {
+            for _ in 0..=i {
+                single.read_line(key);
+            }
+            repeated.read_repeated(key, i as u64 + 1);
+        }
+        let estimates = |hh: &HeavyHitter| {
+            let mut est: Vec<_> = hh.estimate().map(|(k, n)| (k.to_vec(), n)).collect();
+            est.sort();
+            est
+        };
+        assert_eq!(estimates(&repeated), estimates(&single));
+    }
+
+    #[test]
+    fn cleared_keyed_counters_match_new() {
+        for &algo in &[Algo::Cpc, Algo::Hll] {
+            let mut reused = KeyedCounter::new(algo, DEFAULT_LG_K);
+            let mut reused_merger = KeyedMerger::new(algo, DEFAULT_LG_K);
+            for window in 0..4 {
+                reused.clear();
+                reused_merger.clear();
+                let mut fresh = KeyedCounter::new(algo, DEFAULT_LG_K);
+                read_window(&mut reused, window);
+                read_window(&mut fresh, window);
+                let state = sorted(reused.state().map(|(key, ctr)| (key, ctr.serialize())));
+                assert_eq!(state.len(), 3);
+                assert_eq!(
+                    state,
+                    sorted(fresh.state().map(|(key, ctr)| (key, ctr.serialize())))
+                );
+
+                let mut fresh_merger = KeyedMerger::new(algo, DEFAULT_LG_K);
+                for (key, ser) in &state {
+                    let mut line = key.clone();
+                    line.push(b' ');
+                    line.extend(ser.as_bytes());
+                    reused_merger.read_line(&line);
+                    fresh_merger.read_line(&line);
+                }
+                assert_eq!(
+                    sorted(
+                        reused_merger
+                            .state()
+                            .map(|(key, ctr)| (key, ctr.serialize()))
+                    ),
+                    sorted(
+                        fresh_merger
+                            .state()
+                            .map(|(key, ctr)| (key, ctr.serialize()))
+                    )
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn shared_theta_counts_forked_keys() {
+        // key i has 100 * i distinct values, and the forks share most keys
+        let lines: Vec<String> = (1..=50)
+            .flat_map(|i| (0..100 * i).map(move |v| format!("key{} {}", i, v)))
+            .collect();
+        let mut whole = SharedThetaKeyedCounter::new(12);
+        lines
+            .iter()
+            .for_each(|line| whole.read_line(line.as_bytes()));
+        let mut forked = whole.fork();
+        for chunk in lines.chunks(1000) {
+            let mut fork = forked.fork();
+            chunk
+                .iter()
+                .for_each(|line| fork.read_line(line.as_bytes()));
+            forked.combine(fork);
+        }
+        for counter in [&whole, &forked] {
+            let estimates: Vec<(&[u8], f64)> = counter.estimates().collect();
+            assert_eq!(estimates.len(), 50);
+            let mut total = 0.0;
+            for (key, est) in estimates {
+                let i: f64 = str::from_utf8(&key[3..]).unwrap().parse().unwrap();
+                // theta stays above 4096 / 127500, so key i has at least
+                // 3.2 * i samples
+                assert!(
+                    (est - 100.0 * i).abs() < 100.0 * i * 4.0 / i.sqrt(),
+                    "{} {}",
+                    i,
+                    est
+                );
+                total += est;
+            }
+            assert!((total - 127500.0).abs() < 127500.0 * 0.05, "{}", total);
+            assert!(counter.memory_usage_bytes() <= 16 << 13);
+        }
+    }
+
+    #[test]
+    fn frozen_keyed_counters_match_live() {
+        let lines: Vec<String> = (0..50 * 1000)
+            .map(|i| format!("key{} value{}", i % 7, i % (1000 << (i % 7))))
+            .collect();
+        let mut live = KeyedCounter::new(Algo::Cpc, DEFAULT_LG_K);
+        let mut frozen = KeyedCounter::new(Algo::Cpc, DEFAULT_LG_K);
+        lines.iter().for_each(|l| live.read_line(l.as_bytes()));
+        lines.iter().for_each(|l| frozen.read_line(l.as_bytes()));
+        frozen.freeze();
+        assert!(frozen.memory_usage_bytes() < live.memory_usage_bytes());
+        let state = |keyed: &KeyedCounter| {
+            let mut state: Vec<_> = keyed
+                .state()
+                .map(|(key, ctr)| {
+                    let mut for_merge = Vec::new();
+                    ctr.append_serialized(&mut for_merge, true);
+                    (key.to_vec(), ctr.serialize(), for_merge, ctr.estimate())
+                })
+                .collect();
+            state.sort_by(|a, b| a.0.cmp(&b.0));
+            state
+        };
+        assert_eq!(state(&frozen), state(&live));
+
+        // frozen counters thaw to take more lines
+        for l in &lines[..1000] {
+            let line = format!("{}more", l);
+            live.read_line(line.as_bytes());
+            frozen.read_line(line.as_bytes());
+        }
+        assert_eq!(state(&frozen), state(&live));
+    }
+
+    #[test]
+    fn sorted_merger_matches_keyed() {
+        let mut keyed = KeyedMerger::new(Algo::Cpc, DEFAULT_LG_K);
+        let mut merged = Vec::new();
+        let mut streamed = SortedKeyedMerger::new(Algo::Cpc, DEFAULT_LG_K, |key, ctr| {
+            merged.push((key.to_owned(), ctr.serialize()))
+        });
+        for (key, n) in &[("a", 10), ("b", 300), ("c", 1)] {
+            for shard in 0..3 {
+                let mut ctr = Counter::default();
+                for i in 0..*n {
+                    ctr.update(format!("{} {}", shard, i).as_bytes(), None);
+                }
+                let line = format!("{} {}", key, ctr.serialize());
+                keyed.read_line(line.as_bytes());
+                streamed.read_line(line.as_bytes());
+            }
+        }
+        // a key coming back is handed over again
+        let line = format!("a {}", Counter::default().serialize());
+        streamed.read_line(line.as_bytes());
+        streamed.finish();
+
+        let last = merged.pop().expect("repeated key");
+        assert_eq!(last.0, b"a");
+        let keyed = sorted(keyed.state().map(|(key, ctr)| (key, ctr.serialize())));
+        assert_eq!(merged, keyed);
+    }
+
+    #[test]
+    fn spilled_keys_match_in_memory() {
+        for &algo in &[Algo::Cpc, Algo::Hll] {
+            let mut whole = KeyedCounter::new(algo, DEFAULT_LG_K);
+            let mut spilled = KeyedCounter::new(algo, DEFAULT_LG_K).spilling(3);
+            let mut fork = spilled.fork();
+            for i in 0..2000 {
+                // few values per key, which every estimator counts exactly
+                let line = format!("k{} {}", i % 10, i % 7);
+                whole.read_line(line.as_bytes());
+                if i % 3 == 0 {
+                    fork.read_line(line.as_bytes());
+                } else {
+                    spilled.read_line(line.as_bytes());
+                }
+            }
+            spilled.combine(fork);
+            assert!(spilled.state().count() <= 3);
+
+            let expected = sorted(
+                whole
+                    .state()
+                    .map(|(key, ctr)| (key, ctr.estimate().round().to_string())),
+            );
+            let mut actual = Vec::new();
+            spilled
+                .for_each_key(|key, ctr| {
+                    actual.push((key.to_owned(), ctr.estimate().round().to_string()))
+                })
+                .unwrap();
+            assert_eq!(actual, expected);
+        }
+    }
+
+    #[test]
+    fn memory_budget_bounds_held_keys() {
+        for &algo in &[Algo::Cpc, Algo::Hll] {
+            let budget = 8 * 1024;
+            let mut whole = KeyedCounter::new(algo, DEFAULT_LG_K);
+            let mut spilled = KeyedCounter::new(algo, DEFAULT_LG_K).spilling_bytes(budget);
+            let mut fork = spilled.fork();
+            for i in 0..20 * 1000 {
+                let line = format!("k{} {}", i % 20, i % 1000);
+                whole.read_line(line.as_bytes());
+                let ctr = if i % 3 == 0 { &mut fork } else { &mut spilled };
+                ctr.read_line(line.as_bytes());
+                assert_eq!(ctr.held_bytes, ctr.memory_usage_bytes());
+                assert!(ctr.held_bytes <= budget);
+            }
+            spilled.combine(fork);
+            assert_eq!(spilled.held_bytes, spilled.memory_usage_bytes());
+            assert!(spilled.held_bytes <= budget);
+            assert!(!spilled.runs.is_empty());
+            // the sketches of 20 keys of 1000 values take more than the budget
+            assert!(whole.memory_usage_bytes() > budget);
+
+            let mut expected: Vec<_> = whole
+                .state()
+                .map(|(key, ctr)| (key.to_owned(), ctr.estimate()))
+                .collect();
+            expected.sort_by(|a, b| a.0.cmp(&b.0));
+            let mut actual = Vec::new();
+            spilled
+                .for_each_key(|key, ctr| actual.push((key.to_owned(), ctr.estimate())))
+                .unwrap();
+            assert_eq!(actual.len(), expected.len());
+            for ((key, est), (expected_key, expected_est)) in actual.iter().zip(&expected) {
+                assert_eq!(key, expected_key);
+                assert!((est - expected_est).abs() < 0.1 * expected_est);
+            }
+        }
+    }
+
+    #[test]
+    fn top_keys_match_sorted_estimates() {
+        for &algo in &[Algo::Cpc, Algo::Hll] {
+            let mut keyed = KeyedCounter::new(algo, 8);
+            for i in 0..300 * 1000 {
+                // key k has about 3k distinct values, past the coupons for large k
+                let key = i % 300;
+                let line = format!("{} {}", key, i % (3 * key + 1));
+                keyed.read_line(line.as_bytes());
+            }
+            let mut all: Vec<(Vec<u8>, f64)> = keyed
+                .state()
+                .map(|(key, ctr)| (key.to_owned(), ctr.estimate()))
+                .collect();
+            all.sort_by(|(k1, e1), (k2, e2)| e2.total_cmp(e1).then(k1.cmp(k2)));
+            for &n in &[0, 1, 10, 299, 300, 500] {
+                let mut top = TopKeys::new(n);
+                keyed.state().for_each(|(key, ctr)| top.offer(key, ctr));
+                let expected = &all[..n.min(all.len())];
+                assert_eq!(top.into_sorted(), expected, "{}", n);
+            }
+        }
+    }
+
+    #[test]
+    fn coupon_bounds_hold() {
+        for &lg_k in &[4, 8, DEFAULT_LG_K] {
+            let mut ctr = Counter::new(Algo::Cpc, lg_k);
+            for i in 0..coupon_limit(lg_k) - 1 {
+                ctr.read_line(format!("{}", i).as_bytes());
+                assert!(ctr.estimate() <= ctr.estimate_bound());
+            }
+        }
+    }
+
+    #[test]
+    fn forked_samplers_cover_stream() {
+        let mut sampler = Sampler::new(100);
+        let mut fork = sampler.fork();
+        let (mut buf, mut ends) = (Vec::new(), Vec::new());
+        for i in 0..1000 {
+            let line = format!("line {}", i);
+            if i % 2 == 0 {
+                sampler.read_line(line.as_bytes());
+            } else {
+                buf.extend(line.as_bytes());
+                ends.push(buf.len());
+            }
+        }
+        fork.read_lines(&buf, &ends);
+        sampler.combine(fork);
+        let sketch = sampler.sketch();
+        assert_eq!(sketch.n(), 1000);
+        assert_eq!(sketch.num_samples(), 100);
+        let total: f64 = sketch.samples().iter().map(|(_, weight)| weight).sum();
+        assert!((total - 1000.0).abs() < 1e-6);
+    }
+
+    #[test]
+    fn line_stats_cover_stream() {
+        let mut stats = LineStats::new(DEFAULT_LG_K, 1);
+        let mut fork = stats.fork();
+        let (mut buf, mut ends) = (Vec::new(), Vec::new());
+        for i in 0..2000 {
+            // 150 distinct odd lines behind one hot line
+            let line = if i % 2 == 0 {
+                "hot".to_owned()
+            } else {
+                format!("line {}", i % 300)
+            };
+            if i < 1000 {
+                stats.read_line(line.as_bytes());
+            } else {
+                buf.extend(line.as_bytes());
+                ends.push(buf.len());
+            }
+        }
+        fork.read_lines(&buf, &ends);
+        stats.combine(fork);
+
+        assert!((stats.estimate() - 151.0).abs() < 3.0);
+        let top: Vec<_> = stats.heavy_hitters().collect();
+        assert_eq!(top.len(), 1);
+        assert_eq!(top[0].0, b"hot");
+        assert!(top[0].1 >= 1000);
+        let lengths = stats.lengths();
+        assert_eq!(lengths.n(), 2000);
+        assert_eq!(lengths.min(), 3.0);
+        assert_eq!(lengths.max(), 8.0);
+    }
+
+    #[test]
+    fn window_counter_skips_gaps() {
+        let mut slices = Vec::new();
+        let mut window = WindowCounter::new(12, 3, |slice, est| slices.push((slice, est)));
+        // slices 10, 11, 12 and 20 each have 100 values, shared by 11 and 12
+        for &(slice, start) in &[(10, 0), (11, 1000), (12, 1000), (20, 5000)] {
+            for i in start..start + 100 {
+                window.read_line(format!("{} value {}", slice, i).as_bytes());
+            }
+        }
+        window.finish();
+        assert_eq!(
+            slices,
+            vec![(10, 100.0), (11, 200.0), (12, 200.0), (20, 100.0)]
+        );
+    }
+
+    #[test]
+    #[should_panic(expected = "slice 4 after slice 5")]
+    fn window_counter_decreasing_slice() {
+        let mut window = WindowCounter::new(12, 3, |_, _| {});
+        window.read_line(b"5 a");
+        window.read_line(b"4 b");
     }
 }
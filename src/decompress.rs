@@ -0,0 +1,348 @@
+//! Decompression of zstd and gzip inputs, recognized by their magic
+//! numbers, on threads of their own, so that decompressing does not hold
+//! up splitting lines.
+//!
+//! Inputs in memory of several zstd frames, such as those written by
+//! `pzstd` or by concatenating `zstd` outputs, have their frames
+//! decompressed by several threads at once. Other inputs are decompressed
+//! by a single thread.
+
+use std::io::{self, BufRead, Error, ErrorKind, Read, Write};
+use std::mem;
+use std::panic;
+use std::sync::mpsc::{self, Receiver, SyncSender};
+use std::sync::Arc;
+use std::thread;
+
+use flate2::read::MultiGzDecoder;
+use zstd;
+
+use crate::profile::{self, Queue, QueueGauge, Stage};
+
+/// Decompressed bytes are handed over in chunks of about this many.
+const CHUNK_BYTES: usize = 1 << 20;
+
+/// Chunks each decompressing thread may get ahead by.
+const CHUNKS_IN_FLIGHT: usize = 4;
+
+/// A compressed format that inputs are recognized in.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Compression {
+    Zstd,
+    Gzip,
+}
+
+impl Compression {
+    /// Returns the compression whose magic number `data` starts with, if
+    /// any.
+    pub fn detect(data: &[u8]) -> Option<Self> {
+        if data.starts_with(&[0x28, 0xb5, 0x2f, 0xfd]) {
+            Some(Self::Zstd)
+        } else if data.starts_with(&[0x1f, 0x8b]) {
+            Some(Self::Gzip)
+        } else {
+            None
+        }
+    }
+
+    /// Returns a reader of the decompression of `compressed`, which may
+    /// hold several zstd frames or gzip members one after the other.
+    pub fn reader<'a, R: Read + 'a>(self, compressed: R) -> Result<Box<dyn Read + 'a>, Error> {
+        Ok(match self {
+            Self::Zstd => Box::new(zstd::Decoder::new(compressed)?),
+            Self::Gzip => Box::new(MultiGzDecoder::new(compressed)),
+        })
+    }
+}
+
+/// Hands what is written to it to a [`Decompressed`] in chunks.
+struct ChunkSender {
+    tx: SyncSender<Result<Vec<u8>, Error>>,
+    chunk: Vec<u8>,
+    gauge: Arc<QueueGauge>,
+}
+
+impl ChunkSender {
+    fn send(&mut self, chunk: Result<Vec<u8>, Error>) -> Result<(), Error> {
+        self.gauge.sent();
+        let _wait = profile::span(Stage::Wait, 0);
+        self.tx
+            .send(chunk)
+            .map_err(|_| Error::new(ErrorKind::BrokenPipe, "decompressed bytes unread"))
+    }
+
+    /// Decompresses `compressed` into chunks, followed by an empty one to
+    /// mark its end or an error.
+    fn decompress<R: Read>(
+        &mut self,
+        compressed: R,
+        compression: Compression,
+    ) -> Result<(), Error> {
+        let copy = || {
+            let mut reader = compression.reader(compressed)?;
+            io::copy(&mut reader, self)?;
+            self.flush()
+        };
+        let decompress = profile::span(Stage::Decompress, 0);
+        let copied = copy();
+        drop(decompress);
+        match copied {
+            Ok(()) => self.send(Ok(Vec::new())),
+            // the reader is gone, and nobody is left to tell
+            Err(e) if e.kind() == ErrorKind::BrokenPipe => Err(e),
+            Err(e) => self.send(Err(e)),
+        }
+    }
+}
+
+impl Write for ChunkSender {
+    fn write(&mut self, buf: &[u8]) -> Result<usize, Error> {
+        profile::add_bytes(Stage::Decompress, buf.len());
+        self.chunk.extend_from_slice(buf);
+        if self.chunk.len() >= CHUNK_BYTES {
+            self.flush()?;
+        }
+        Ok(buf.len())
+    }
+
+    fn flush(&mut self) -> Result<(), Error> {
+        if self.chunk.is_empty() {
+            return Ok(());
+        }
+        let chunk = mem::replace(&mut self.chunk, Vec::with_capacity(CHUNK_BYTES));
+        self.send(Ok(chunk))
+    }
+}
+
+/// A [`BufRead`] over the decompressed parts of an input, in order, each
+/// of which is handed over in chunks by the thread decompressing it.
+/// Part `i` comes from the thread `i % threads`.
+pub struct Decompressed {
+    rxs: Vec<Receiver<Result<Vec<u8>, Error>>>,
+    gauge: Arc<QueueGauge>,
+    parts: usize,
+    part: usize,
+    chunk: Vec<u8>,
+    pos: usize,
+}
+
+impl BufRead for Decompressed {
+    fn fill_buf(&mut self) -> Result<&[u8], Error> {
+        while self.pos == self.chunk.len() && self.part < self.parts {
+            let rx = &self.rxs[self.part % self.rxs.len()];
+            let chunk = rx
+                .recv()
+                .unwrap_or_else(|_| Err(Error::new(ErrorKind::Other, "decompression stopped")));
+            self.gauge.received();
+            let chunk = chunk?;
+            if chunk.is_empty() {
+                self.part += 1;
+            }
+            self.chunk = chunk;
+            self.pos = 0;
+        }
+        Ok(&self.chunk[self.pos..])
+    }
+
+    fn consume(&mut self, amt: usize) {
+        self.pos += amt;
+    }
+}
+
+impl Read for Decompressed {
+    fn read(&mut self, out: &mut [u8]) -> Result<usize, Error> {
+        let buf = self.fill_buf()?;
+        let n = buf.len().min(out.len());
+        out[..n].copy_from_slice(&buf[..n]);
+        self.consume(n);
+        Ok(n)
+    }
+}
+
+/// Calls `f` with the decompression of `data`. Its zstd frames are
+/// decompressed by `threads` threads, each taking every `threads`-th
+/// frame, while gzip is decompressed by one.
+///
+/// Panics in a decompressing thread are propagated to the caller.
+pub fn decompress_slice<T, F: FnOnce(Decompressed) -> T>(
+    data: &[u8],
+    compression: Compression,
+    threads: usize,
+    f: F,
+) -> T {
+    assert!(threads > 0, "need at least one thread");
+    let mut parts = Vec::new();
+    let mut rest = data;
+    if compression == Compression::Zstd {
+        // anything that does not parse is left to the decoder to report
+        while let Ok(len) = zstd::zstd_safe::find_frame_compressed_size(rest) {
+            if len == 0 || len >= rest.len() {
+                break;
+            }
+            parts.push(&rest[..len]);
+            rest = &rest[len..];
+        }
+    }
+    parts.push(rest);
+    let threads = threads.min(parts.len());
+    let nparts = parts.len();
+
+    let gauge = Arc::new(QueueGauge::new(Queue::Decompressed));
+    thread::scope(|scope| {
+        let mut rxs = Vec::with_capacity(threads);
+        let mut decompressors = Vec::with_capacity(threads);
+        for thread in 0..threads {
+            let (tx, rx) = mpsc::sync_channel(CHUNKS_IN_FLIGHT);
+            rxs.push(rx);
+            let parts: Vec<&[u8]> = parts
+                .iter()
+                .skip(thread)
+                .step_by(threads)
+                .cloned()
+                .collect();
+            let gauge = Arc::clone(&gauge);
+            decompressors.push(scope.spawn(move || {
+                let mut sender = ChunkSender {
+                    tx,
+                    chunk: Vec::with_capacity(CHUNK_BYTES),
+                    gauge,
+                };
+                for part in parts {
+                    if sender.decompress(part, compression).is_err() {
+                        break;
+                    }
+                }
+            }));
+        }
+        let reduced = f(Decompressed {
+            rxs,
+            gauge,
+            parts: nparts,
+            part: 0,
+            chunk: Vec::new(),
+            pos: 0,
+        });
+        for decompressor in decompressors {
+            if let Err(e) = decompressor.join() {
+                panic::resume_unwind(e);
+            }
+        }
+        reduced
+    })
+}
+
+/// Like [`decompress_slice`], but for a stream, which is decompressed by
+/// one thread.
+pub fn decompress_stream<R: Read + Send, T, F: FnOnce(Decompressed) -> T>(
+    stream: R,
+    compression: Compression,
+    f: F,
+) -> T {
+    let gauge = Arc::new(QueueGauge::new(Queue::Decompressed));
+    thread::scope(|scope| {
+        let (tx, rx) = mpsc::sync_channel(CHUNKS_IN_FLIGHT);
+        let sender_gauge = Arc::clone(&gauge);
+        let decompressor = scope.spawn(move || {
+            let mut sender = ChunkSender {
+                tx,
+                chunk: Vec::with_capacity(CHUNK_BYTES),
+                gauge: sender_gauge,
+            };
+            let _ = sender.decompress(stream, compression);
+        });
+        let reduced = f(Decompressed {
+            rxs: vec![rx],
+            gauge,
+            parts: 1,
+            part: 0,
+            chunk: Vec::new(),
+            pos: 0,
+        });
+        if let Err(e) = decompressor.join() {
+            panic::resume_unwind(e);
+        }
+        reduced
+    })
+}
+
+#[cfg(test)]
+mod tests {
+    use flate2::write::GzEncoder;
+
+    use super::*;
+
+    fn lines(n: usize) -> Vec<u8> {
+        (0..n)
+            .flat_map(|i| format!("line {}\n", i).into_bytes())
+            .collect()
+    }
+
+    fn gzip(data: &[u8]) -> Vec<u8> {
+        let mut encoder = GzEncoder::new(Vec::new(), flate2::Compression::fast());
+        encoder.write_all(data).unwrap();
+        encoder.finish().unwrap()
+    }
+
+    fn read_all(mut decompressed: Decompressed) -> Result<Vec<u8>, Error> {
+        let mut out = Vec::new();
+        decompressed.read_to_end(&mut out)?;
+        Ok(out)
+    }
+
+    #[test]
+    fn detects_magic_numbers() {
+        let data = lines(10);
+        assert_eq!(Compression::detect(&data), None);
+        assert_eq!(Compression::detect(&[]), None);
+        assert_eq!(Compression::detect(&gzip(&data)), Some(Compression::Gzip));
+        let zstd = zstd::encode_all(&data[..], 1).unwrap();
+        assert_eq!(Compression::detect(&zstd), Some(Compression::Zstd));
+    }
+
+    #[test]
+    fn decompresses_frames_in_order() {
+        // frames of uneven sizes, some empty, one spanning several chunks
+        let parts: Vec<Vec<u8>> = [1000, 0, 300 * 1000, 1, 50, 0, 7000]
+            .iter()
+            .map(|&n| lines(n))
+            .collect();
+        let expected = parts.concat();
+        let zstd: Vec<u8> = parts
+            .iter()
+            .flat_map(|part| zstd::encode_all(&part[..], 1).unwrap())
+            .collect();
+        let gzip: Vec<u8> = parts.iter().flat_map(|part| gzip(part)).collect();
+        for &threads in &[1, 2, 3, 16] {
+            let decompressed = decompress_slice(&zstd, Compression::Zstd, threads, read_all);
+            assert_eq!(decompressed.unwrap(), expected);
+            let decompressed = decompress_slice(&gzip, Compression::Gzip, threads, read_all);
+            assert_eq!(decompressed.unwrap(), expected);
+        }
+        for &(data, compression) in &[(&zstd, Compression::Zstd), (&gzip, Compression::Gzip)] {
+            let decompressed = decompress_stream(&data[..], compression, read_all);
+            assert_eq!(decompressed.unwrap(), expected);
+            let mut reader = compression.reader(&data[..]).unwrap();
+            let mut read = Vec::new();
+            reader.read_to_end(&mut read).unwrap();
+            assert_eq!(read, expected);
+        }
+    }
+
+    #[test]
+    fn reports_corruption() {
+        let mut zstd = zstd::encode_all(&lines(1000)[..], 1).unwrap();
+        zstd.extend(zstd::encode_all(&lines(1000)[..], 1).unwrap());
+        let len = zstd.len();
+        zstd[len - 20] ^= 0xff;
+        zstd.truncate(len - 5);
+        for &threads in &[1, 2] {
+            assert!(decompress_slice(&zstd, Compression::Zstd, threads, read_all).is_err());
+        }
+        assert!(decompress_stream(&zstd[..], Compression::Zstd, read_all).is_err());
+        // stopping early leaves the decompressing threads to finish
+        let partial = decompress_slice(&zstd, Compression::Zstd, 2, |mut decompressed| {
+            decompressed.fill_buf().map(|buf| buf.len())
+        });
+        assert!(partial.unwrap() > 0);
+    }
+}
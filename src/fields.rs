@@ -0,0 +1,231 @@
+//! Keys and values taken from delimited fields of lines, such as the
+//! columns of TSV or CSV files, rather than from either side of the first
+//! space.
+
+use std::io::Error;
+use std::str;
+
+use memchr;
+
+use crate::profile::{self, Stage};
+use crate::stream_reducer::{Checkpoint, KeyValueReducer, LineReducer, ParallelLineReducer};
+
+/// Which fields of a line, split at every `delimiter`, are its key and
+/// its value. Fields are numbered from 0, and delimiters are not escaped
+/// or quoted, so a quoted CSV field holding the delimiter is split too.
+#[derive(Clone, Copy, Debug)]
+pub struct FieldSelector {
+    delimiter: u8,
+    key_field: usize,
+    value_field: usize,
+}
+
+impl FieldSelector {
+    pub fn new(delimiter: u8, key_field: usize, value_field: usize) -> Self {
+        Self {
+            delimiter,
+            key_field,
+            value_field,
+        }
+    }
+
+    /// Returns field `n` of `line`, if it has that many.
+    fn field<'a>(&self, line: &'a [u8], n: usize) -> Option<&'a [u8]> {
+        let mut delims = memchr::memchr_iter(self.delimiter, line);
+        let mut start = 0;
+        for _ in 0..n {
+            start = delims.next()? + 1;
+        }
+        // the last field runs to the end of the line
+        let end = delims.next().unwrap_or(line.len());
+        Some(&line[start..end])
+    }
+
+    /// Returns the key and value of `line`, which starts at `offset` in a
+    /// buffer where its delimiters are at `delims`.
+    ///
+    /// Panics if `line` is missing either field.
+    fn key_value<'a>(
+        &self,
+        line: &'a [u8],
+        offset: usize,
+        delims: &[usize],
+    ) -> (&'a [u8], &'a [u8]) {
+        let field = |n: usize| {
+            if n > delims.len() {
+                panic!(
+                    "line missing field {}: '{}'",
+                    n + 1,
+                    str::from_utf8(line).unwrap_or("BAD UTF-8")
+                );
+            }
+            let start = if n == 0 {
+                0
+            } else {
+                delims[n - 1] + 1 - offset
+            };
+            let end = delims.get(n).map_or(line.len(), |&end| end - offset);
+            &line[start..end]
+        };
+        (field(self.key_field), field(self.value_field))
+    }
+}
+
+/// Reduces lines with `T` after picking out their key and value fields
+/// as `selector` says.
+pub struct Fields<T> {
+    selector: FieldSelector,
+    inner: T,
+    /// Offsets of the delimiters of a line or buffer being read.
+    delims: Vec<usize>,
+}
+
+impl<T: KeyValueReducer> Fields<T> {
+    pub fn new(selector: FieldSelector, inner: T) -> Self {
+        Self {
+            selector,
+            inner,
+            delims: Vec::new(),
+        }
+    }
+
+    pub fn into_inner(self) -> T {
+        self.inner
+    }
+}
+
+impl<T: KeyValueReducer> LineReducer for Fields<T> {
+    fn read_line(&mut self, line: &[u8]) {
+        self.delims.clear();
+        self.delims
+            .extend(memchr::memchr_iter(self.selector.delimiter, line));
+        let (key, value) = self.selector.key_value(line, 0, &self.delims);
+        self.inner.read_key_value(key, value);
+    }
+
+    /// Finds the delimiters of all of `buf` in one vectorized scan, and
+    /// then walks them line by line.
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        let key_extract = profile::span(Stage::KeyExtract, buf.len());
+        self.delims.clear();
+        self.delims
+            .extend(memchr::memchr_iter(self.selector.delimiter, buf));
+        drop(key_extract);
+        let (mut start, mut first) = (0, 0);
+        for &end in ends {
+            let last = first + self.delims[first..].partition_point(|&delim| delim < end);
+            let line = &buf[start..end];
+            let (key, value) = self
+                .selector
+                .key_value(line, start, &self.delims[first..last]);
+            self.inner.read_key_value(key, value);
+            start = end;
+            first = last;
+        }
+    }
+}
+
+impl<T: KeyValueReducer + ParallelLineReducer> ParallelLineReducer for Fields<T> {
+    fn fork(&self) -> Self {
+        Self::new(self.selector, self.inner.fork())
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.inner.combine(other.inner)
+    }
+
+    /// Routes lines by their key field, or by the whole line if it has
+    /// none, leaving the reducer to report it.
+    fn partition_key<'a>(&self, line: &'a [u8]) -> &'a [u8] {
+        self.selector
+            .field(line, self.selector.key_field)
+            .unwrap_or(line)
+    }
+}
+
+impl<T: KeyValueReducer + Checkpoint> Checkpoint for Fields<T> {
+    fn save(&self, out: &mut Vec<u8>) {
+        self.inner.save(out)
+    }
+
+    fn save_config(&self, out: &mut Vec<u8>) {
+        self.inner.save_config(out);
+        let selector = &self.selector;
+        out.push(selector.delimiter);
+        out.extend_from_slice(&(selector.key_field as u64).to_le_bytes());
+        out.extend_from_slice(&(selector.value_field as u64).to_le_bytes());
+    }
+
+    fn restore(&mut self, saved: &[u8]) -> Result<(), Error> {
+        self.inner.restore(saved)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::panic;
+
+    use super::*;
+    use crate::stream_reducer::packed_lines;
+
+    #[derive(Default)]
+    struct Pairs {
+        pairs: Vec<(Vec<u8>, Vec<u8>)>,
+    }
+
+    impl LineReducer for Pairs {
+        fn read_line(&mut self, _line: &[u8]) {
+            unreachable!("lines are split by Fields")
+        }
+    }
+
+    impl KeyValueReducer for Pairs {
+        fn read_key_value(&mut self, key: &[u8], value: &[u8]) {
+            self.pairs.push((key.to_vec(), value.to_vec()));
+        }
+    }
+
+    #[test]
+    fn picks_fields() {
+        let lines: &[&[u8]] = &[b"a\tb\tc", b"\t\t", b"x y\t1\t2\textra", b"k\tv\t"];
+        let (mut buf, mut ends) = (Vec::new(), Vec::new());
+        for line in lines {
+            buf.extend_from_slice(line);
+            ends.push(buf.len());
+        }
+        let expected: Vec<(&[u8], &[u8])> =
+            vec![(b"c", b"a"), (b"", b""), (b"2", b"x y"), (b"", b"k")];
+        let selector = FieldSelector::new(b'\t', 2, 0);
+
+        let mut batched = Fields::new(selector, Pairs::default());
+        batched.read_lines(&buf, &ends);
+        let mut single = Fields::new(selector, Pairs::default());
+        packed_lines(&buf, &ends).for_each(|line| single.read_line(line));
+        for fields in [batched, single] {
+            let pairs: Vec<(&[u8], &[u8])> = fields
+                .inner
+                .pairs
+                .iter()
+                .map(|(key, value)| (&key[..], &value[..]))
+                .collect();
+            assert_eq!(pairs, expected);
+        }
+
+        for (line, (key, _)) in lines.iter().zip(&expected) {
+            assert_eq!(selector.field(line, 2), Some(*key));
+        }
+        assert_eq!(selector.field(b"a\tb", 2), None);
+        assert_eq!(selector.field(b"", 0), Some(&b""[..]));
+    }
+
+    #[test]
+    fn missing_field_panics() {
+        let selector = FieldSelector::new(b',', 0, 3);
+        let mut fields = Fields::new(selector, Pairs::default());
+        let missing = panic::catch_unwind(panic::AssertUnwindSafe(|| {
+            fields.read_lines(b"a,b,c,da,b,c", &[7, 12])
+        }));
+        assert!(missing.is_err());
+        assert_eq!(fields.inner.pairs, vec![(b"a".to_vec(), b"d".to_vec())]);
+    }
+}
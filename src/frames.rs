@@ -0,0 +1,330 @@
+//! Length-prefixed binary frames, which `dsrs --format binary` passes
+//! serialized sketches in from `--raw` to `--merge`, instead of base64
+//! lines. A frame is its length as a little-endian `u32` followed by
+//! that many bytes, so unlike a line it may hold any bytes at all.
+
+use std::convert::TryInto;
+use std::io::{Error, ErrorKind, Read, Write};
+use std::panic;
+use std::thread;
+
+use crate::stream_reducer::ParallelLineReducer;
+
+/// Bytes in the length prefix of each frame.
+const PREFIX_BYTES: usize = 4;
+
+/// Writes `frame` to `out` after its length.
+///
+/// Panics if `frame` is 4GiB or more.
+pub fn write_frame<W: Write>(out: &mut W, frame: &[u8]) -> Result<(), Error> {
+    let len: u32 = frame.len().try_into().expect("frame under 4GiB");
+    out.write_all(&len.to_le_bytes())?;
+    out.write_all(frame)
+}
+
+/// Reads the next frame of `input` into `frame`, replacing its contents,
+/// for inputs that are streamed rather than held in memory. Returns
+/// `false`, leaving `frame` empty, if `input` has ended before the frame.
+///
+/// Fails with [`ErrorKind::UnexpectedEof`] on a frame cut short.
+pub fn read_frame<R: Read>(input: &mut R, frame: &mut Vec<u8>) -> Result<bool, Error> {
+    read_frame_limited(input, frame, usize::MAX)
+}
+
+/// Like [`read_frame`], but for frames from a peer, whose length is not
+/// trusted: fails with [`ErrorKind::InvalidData`] on a frame longer than
+/// `max_len` bytes, after reading only its length.
+pub fn read_frame_limited<R: Read>(
+    input: &mut R,
+    frame: &mut Vec<u8>,
+    max_len: usize,
+) -> Result<bool, Error> {
+    frame.clear();
+    let mut prefix = [0u8; PREFIX_BYTES];
+    let mut read = 0;
+    while read < PREFIX_BYTES {
+        match input.read(&mut prefix[read..]) {
+            Ok(0) if read == 0 => return Ok(false),
+            Ok(0) => return Err(ErrorKind::UnexpectedEof.into()),
+            Ok(n) => read += n,
+            Err(e) if e.kind() == ErrorKind::Interrupted => {}
+            Err(e) => return Err(e),
+        }
+    }
+    let len = u32::from_le_bytes(prefix) as usize;
+    if len > max_len {
+        return Err(Error::new(
+            ErrorKind::InvalidData,
+            format!("frame of {} bytes is over the limit of {}", len, max_len),
+        ));
+    }
+    frame.resize(len, 0);
+    input.read_exact(frame)?;
+    Ok(true)
+}
+
+/// Iterates over frames written back to back by [`write_frame`], each
+/// borrowed in place from the underlying buffer.
+///
+/// Panics on a frame cut short by the end of the buffer.
+pub struct Frames<'a> {
+    data: &'a [u8],
+}
+
+impl<'a> Frames<'a> {
+    pub fn new(data: &'a [u8]) -> Self {
+        Self { data }
+    }
+}
+
+impl<'a> Iterator for Frames<'a> {
+    type Item = &'a [u8];
+
+    fn next(&mut self) -> Option<&'a [u8]> {
+        if self.data.is_empty() {
+            return None;
+        }
+        assert!(self.data.len() >= PREFIX_BYTES, "truncated frame length");
+        let (prefix, rest) = self.data.split_at(PREFIX_BYTES);
+        let len = u32::from_le_bytes(prefix.try_into().expect("prefix bytes")) as usize;
+        assert!(
+            rest.len() >= len,
+            "truncated frame, {} of {} bytes",
+            rest.len(),
+            len
+        );
+        let (frame, rest) = rest.split_at(len);
+        self.data = rest;
+        Some(frame)
+    }
+}
+
+/// Splits `data` into the frames written back to back in it, like
+/// [`Frames`], but for frames from a peer which may not be well formed.
+///
+/// Fails with [`ErrorKind::UnexpectedEof`] on a frame cut short by the end
+/// of `data`.
+pub fn split_frames(mut data: &[u8]) -> Result<Vec<&[u8]>, Error> {
+    let mut frames = Vec::new();
+    while !data.is_empty() {
+        if data.len() < PREFIX_BYTES {
+            return Err(ErrorKind::UnexpectedEof.into());
+        }
+        let (prefix, rest) = data.split_at(PREFIX_BYTES);
+        let len = u32::from_le_bytes(prefix.try_into().expect("prefix bytes")) as usize;
+        if rest.len() < len {
+            return Err(ErrorKind::UnexpectedEof.into());
+        }
+        let (frame, rest) = rest.split_at(len);
+        frames.push(frame);
+        data = rest;
+    }
+    Ok(frames)
+}
+
+/// Hands each record of `data`, made of `record_frames` consecutive
+/// frames, to `read_record` along with `reducer` or one of its forks.
+/// With several `threads`, each reduces a fork over a contiguous share
+/// of the records, and the forks are combined into `reducer` at the end,
+/// as in [`reduce_slice_parallel`].
+///
+/// Panics if the frames do not split evenly into records, and propagates
+/// panics in the workers.
+///
+/// [`reduce_slice_parallel`]: crate::stream_reducer::reduce_slice_parallel
+pub fn reduce_frames_parallel<T, F>(
+    data: &[u8],
+    record_frames: usize,
+    mut reducer: T,
+    threads: usize,
+    read_record: F,
+) -> T
+where
+    T: ParallelLineReducer,
+    F: Fn(&mut T, &[&[u8]]) + Sync,
+{
+    assert!(threads > 0, "need at least one thread");
+    assert!(record_frames > 0, "records need at least one frame");
+    let frames: Vec<&[u8]> = Frames::new(data).collect();
+    assert!(
+        frames.len() % record_frames == 0,
+        "{} frames do not make whole records of {}",
+        frames.len(),
+        record_frames
+    );
+    if threads == 1 {
+        for record in frames.chunks(record_frames) {
+            read_record(&mut reducer, record);
+        }
+        return reducer;
+    }
+
+    let records = frames.len() / record_frames;
+    let share = (records + threads - 1) / threads * record_frames;
+    let read_record = &read_record;
+    thread::scope(|scope| {
+        let workers: Vec<_> = frames
+            .chunks(share.max(1))
+            .map(|share| {
+                let mut fork = reducer.fork();
+                scope.spawn(move || {
+                    for record in share.chunks(record_frames) {
+                        read_record(&mut fork, record);
+                    }
+                    fork
+                })
+            })
+            .collect();
+
+        for worker in workers {
+            match worker.join() {
+                Ok(fork) => reducer.combine(fork),
+                Err(e) => panic::resume_unwind(e),
+            }
+        }
+    });
+    reducer
+}
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+    use crate::stream_reducer::LineReducer;
+
+    #[derive(Default)]
+    struct DumbReducer {
+        records: Vec<Vec<u8>>,
+    }
+
+    impl LineReducer for DumbReducer {
+        fn read_line(&mut self, line: &[u8]) {
+            self.records.push(line.to_owned());
+        }
+    }
+
+    impl ParallelLineReducer for DumbReducer {
+        fn fork(&self) -> Self {
+            Self::default()
+        }
+
+        fn combine(&mut self, other: Self) {
+            self.records.extend(other.records);
+        }
+    }
+
+    #[test]
+    fn frames_round_trip() {
+        let written: Vec<Vec<u8>> = (0..1000)
+            .map(|i| (0..i % 300).map(|j| (i * j) as u8).collect())
+            .collect();
+        let mut data = Vec::new();
+        for frame in &written {
+            write_frame(&mut data, frame).unwrap();
+        }
+        assert_eq!(Frames::new(&data).collect::<Vec<_>>(), written);
+        assert_eq!(Frames::new(b"").count(), 0);
+    }
+
+    #[test]
+    fn reads_streamed_frames() {
+        let mut data = Vec::new();
+        for frame in &[&b"abc"[..], b"", b"de"] {
+            write_frame(&mut data, frame).unwrap();
+        }
+        let mut input = &data[..];
+        let mut frame = b"stale".to_vec();
+        let mut read = Vec::new();
+        while read_frame(&mut input, &mut frame).unwrap() {
+            read.push(frame.clone());
+        }
+        assert_eq!(read, vec![b"abc".to_vec(), vec![], b"de".to_vec()]);
+        assert!(frame.is_empty());
+
+        for cut in 1..data.len() {
+            let mut input = &data[..cut];
+            let err = loop {
+                match read_frame(&mut input, &mut frame) {
+                    Ok(true) => {}
+                    Ok(false) => break None,
+                    Err(e) => break Some(e.kind()),
+                }
+            };
+            // only cuts between frames end cleanly
+            let expected = if [7, 11].contains(&cut) {
+                None
+            } else {
+                Some(ErrorKind::UnexpectedEof)
+            };
+            assert_eq!(err, expected, "{}", cut);
+        }
+    }
+
+    #[test]
+    fn limits_streamed_frames() {
+        let mut data = Vec::new();
+        write_frame(&mut data, b"abc").unwrap();
+        write_frame(&mut data, b"defg").unwrap();
+        let mut input = &data[..];
+        let mut frame = Vec::new();
+        assert!(read_frame_limited(&mut input, &mut frame, 3).unwrap());
+        assert_eq!(frame, b"abc");
+        let err = read_frame_limited(&mut input, &mut frame, 3).unwrap_err();
+        assert_eq!(err.kind(), ErrorKind::InvalidData);
+        // the frame itself is left unread
+        assert_eq!(input, b"defg");
+
+        // a length that would not fit in memory is refused all the same
+        let mut input = &u32::MAX.to_le_bytes()[..];
+        let err = read_frame_limited(&mut input, &mut frame, 1 << 20).unwrap_err();
+        assert_eq!(err.kind(), ErrorKind::InvalidData);
+        assert!(frame.is_empty());
+    }
+
+    #[test]
+    fn splits_frames_of_peers() {
+        let mut data = Vec::new();
+        for frame in &[&b"abc"[..], b"", b"de"] {
+            write_frame(&mut data, frame).unwrap();
+        }
+        assert_eq!(
+            split_frames(&data).unwrap(),
+            Frames::new(&data).collect::<Vec<_>>()
+        );
+        for cut in (1..data.len()).filter(|cut| ![7, 11].contains(cut)) {
+            let err = split_frames(&data[..cut]).unwrap_err();
+            assert_eq!(err.kind(), ErrorKind::UnexpectedEof, "{}", cut);
+        }
+    }
+
+    #[test]
+    #[should_panic(expected = "truncated frame")]
+    fn truncated_frame() {
+        let mut data = Vec::new();
+        write_frame(&mut data, b"abc").unwrap();
+        data.pop();
+        Frames::new(&data).for_each(drop);
+    }
+
+    #[test]
+    fn reduces_records_parallel() {
+        // keys and values in alternating frames, as keyed dsrs output is
+        let mut data = Vec::new();
+        for i in 0..1000 {
+            write_frame(&mut data, format!("k{}", i).as_bytes()).unwrap();
+            write_frame(&mut data, format!("v\n{}", i).as_bytes()).unwrap();
+        }
+        let join = |reducer: &mut DumbReducer, record: &[&[u8]]| {
+            reducer.read_line(&[record[0], &b" "[..], record[1]].concat())
+        };
+        let expected = reduce_frames_parallel(&data, 2, DumbReducer::default(), 1, join);
+        assert_eq!(expected.records.len(), 1000);
+        assert_eq!(expected.records[7], b"k7 v\n7");
+        for &threads in &[2, 7, 2000] {
+            let reducer = reduce_frames_parallel(&data, 2, DumbReducer::default(), threads, join);
+            assert_eq!(reducer.records, expected.records);
+        }
+        let empty = reduce_frames_parallel(b"", 2, DumbReducer::default(), 3, join);
+        assert!(empty.records.is_empty());
+    }
+}
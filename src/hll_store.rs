@@ -0,0 +1,425 @@
+//! A keyed store of HLL sketches on disk, updated in place, so that a job
+//! rerun every day folds the day's values into each key's sketch without
+//! deserializing and serializing every sketch of the days before.
+//!
+//! A store at `path` is two files. `path` holds the registers of each
+//! key's sketch in a slot of `2^lg_k` bytes, as an [`HllMatrix`] row, in
+//! the order keys were added. It is mapped into memory and updated there,
+//! so a run only reads and writes back the pages of the keys it sees.
+//! `path.keys` holds [`MAGIC`] and `lg_k`, and then each key as a
+//! [frame](crate::frames) in slot order. It is read into memory when the
+//! store is opened and only ever appended to.
+//!
+//! [`HllMatrix`]: crate::HllMatrix
+
+use std::ffi::OsString;
+use std::fs::{File, OpenOptions};
+use std::io::{BufReader, BufWriter, Error, ErrorKind, Read, Write};
+use std::os::unix::io::AsRawFd;
+use std::path::{Path, PathBuf};
+
+use cxx;
+use libc;
+
+use crate::bridge::ffi;
+use crate::frames::{read_frame, write_frame};
+use crate::key_table::KeyTable;
+use crate::mapped_file::MappedFileMut;
+use crate::{HllType, KeyHash};
+
+/// The first bytes of the keys file of every store.
+pub const MAGIC: &[u8; 8] = b"dsrshll1";
+
+/// Slots a store maps before it first grows.
+const MIN_SLOTS: usize = 64;
+
+/// HLL sketches of byte-string keys, kept in files as described in the
+/// [module docs](self), which all share one `lg_k`.
+///
+/// Slots hold bare HLL_8 registers, with no list or set mode, so each key
+/// takes `2^lg_k` bytes however few values it has seen, and estimates are
+/// those of a merged sketch, as for [`crate::HllMatrix`]. Keys are counted
+/// as `--algo hll` counts them, and serialize to compact HLL sketches that
+/// `dsrs --merge --algo hll` reads.
+///
+/// Only one store may have the files open at a time, which an exclusive
+/// lock on the keys file enforces. Keys added since the store was opened
+/// reach the keys file by [`Self::flush`], which dropping the store also
+/// calls, so if a run stops before then, the store keeps the keys of the
+/// last flush, some with only part of the run's updates.
+pub struct HllStore {
+    lg_k: u8,
+    // Each key's slot, whose index in insertion order it also is.
+    index: KeyTable<u32>,
+    // Whether each slot was updated since the store was opened.
+    updated: Vec<bool>,
+    // Keys below this slot are already in the keys file.
+    flushed_keys: usize,
+    keys: BufWriter<File>,
+    slots: File,
+    // All of `slots`, which is grown ahead of the keys in slots of `2^lg_k`.
+    registers: MappedFileMut,
+    hashes: Vec<KeyHash>,
+}
+
+impl HllStore {
+    /// Opens the store at `path`, or creates an empty one there with
+    /// `2^lg_k` registers per key. An existing store keeps the `lg_k` it
+    /// was created with, see [`Self::lg_k`].
+    ///
+    /// Fails if the files cannot be opened, if they do not hold a store,
+    /// if another store has them open, or unless `4 <= lg_k <= 21`.
+    pub fn open(path: &Path, lg_k: u8) -> Result<Self, Error> {
+        if !(4..=21).contains(&lg_k) {
+            return Err(Error::new(
+                ErrorKind::InvalidInput,
+                "lg_k must be between 4 and 21",
+            ));
+        }
+        let mut keys = OpenOptions::new()
+            .read(true)
+            .append(true)
+            .create(true)
+            .open(keys_path(path))?;
+        if unsafe { libc::flock(keys.as_raw_fd(), libc::LOCK_EX | libc::LOCK_NB) } != 0 {
+            let e = Error::last_os_error();
+            if e.kind() != ErrorKind::WouldBlock {
+                return Err(e);
+            }
+            return Err(Error::new(
+                ErrorKind::WouldBlock,
+                format!("{} is open in another store", path.display()),
+            ));
+        }
+        let mut header = [0u8; MAGIC.len() + 1];
+        let lg_k = match keys.read_exact(&mut header) {
+            Ok(())
+                if header[..MAGIC.len()] == MAGIC[..]
+                    && (4..=21).contains(&header[MAGIC.len()]) =>
+            {
+                header[MAGIC.len()]
+            }
+            Err(e) if e.kind() == ErrorKind::UnexpectedEof && keys.metadata()?.len() == 0 => {
+                keys.write_all(MAGIC)?;
+                keys.write_all(&[lg_k])?;
+                lg_k
+            }
+            Ok(()) | Err(_) => {
+                return Err(Error::new(
+                    ErrorKind::InvalidData,
+                    format!("{} is not an HLL store", path.display()),
+                ))
+            }
+        };
+
+        let mut index = KeyTable::default();
+        let mut end = header.len() as u64;
+        let mut input = BufReader::new(&keys);
+        let mut key = Vec::new();
+        loop {
+            match read_frame(&mut input, &mut key) {
+                Ok(true) => {}
+                Ok(false) => break,
+                // a key cut short by a run that stopped while flushing it
+                Err(e) if e.kind() == ErrorKind::UnexpectedEof => {
+                    keys.set_len(end)?;
+                    break;
+                }
+                Err(e) => return Err(e),
+            }
+            let slot = index.len() as u32;
+            index.get_or_insert_with(&key, || slot);
+            end += 4 + key.len() as u64;
+        }
+        let num_keys = index.len();
+
+        let slots = OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .open(path)?;
+        // shrinking first zeroes the slots past the last key, which a run
+        // that stopped before flushing may have left behind
+        slots.set_len((num_keys << lg_k) as u64)?;
+        slots.set_len((num_keys.max(MIN_SLOTS) << lg_k) as u64)?;
+        // the lock keeps other stores from the files
+        let registers = unsafe { MappedFileMut::map(&slots) }?;
+        Ok(Self {
+            lg_k,
+            index,
+            updated: vec![false; num_keys],
+            flushed_keys: num_keys,
+            keys: BufWriter::new(keys),
+            slots,
+            registers,
+            hashes: Vec::new(),
+        })
+    }
+
+    pub fn lg_k(&self) -> u8 {
+        self.lg_k
+    }
+
+    /// Returns the number of keys in the store.
+    pub fn len(&self) -> usize {
+        self.updated.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.updated.is_empty()
+    }
+
+    /// Observes `value` for `key`, adding `key` if it is new. Two values
+    /// must have the exact same bytes to be considered equal.
+    ///
+    /// Fails only if the store cannot grow to a new key.
+    pub fn update(&mut self, key: &[u8], value: &[u8]) -> Result<(), Error> {
+        let hash = KeyHash::new(value);
+        let registers = self.registers_mut(key)?;
+        ffi::update_hll_registers(registers, &[hash]).expect("2^lg_k registers");
+        Ok(())
+    }
+
+    /// Equivalent to calling [`Self::update`] with `key` on each value
+    /// packed into `buf`, where value `i` is `buf[ends[i - 1]..ends[i]]`
+    /// and the first value starts at offset 0.
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn update_batch(&mut self, key: &[u8], buf: &[u8], ends: &[usize]) -> Result<(), Error> {
+        let mut hashes = std::mem::take(&mut self.hashes);
+        hashes.clear();
+        KeyHash::extend_batch(&mut hashes, buf, ends);
+        let updated = self.registers_mut(key).map(|registers| {
+            ffi::update_hll_registers(registers, &hashes).expect("2^lg_k registers")
+        });
+        self.hashes = hashes;
+        updated
+    }
+
+    /// Merges the serialized HLL sketch in `buf` into `key`'s, adding
+    /// `key` if it is new.
+    ///
+    /// Fails if `buf` does not hold an HLL sketch, or holds one with a
+    /// smaller `lg_k` than the store's, in which case `key` is added but
+    /// not updated, or if the store cannot grow to a new key.
+    pub fn merge_serialized(&mut self, key: &[u8], buf: &[u8]) -> Result<(), Error> {
+        let registers = self.registers_mut(key)?;
+        ffi::merge_serialized_hll_registers(registers, buf)
+            .map_err(|e| Error::new(ErrorKind::InvalidData, e.what()))
+    }
+
+    /// Returns the estimate of distinct values seen for `key`, if it is in
+    /// the store.
+    pub fn estimate(&self, key: &[u8]) -> Option<f64> {
+        let registers = self.registers(*self.index.get(key)?);
+        Some(ffi::estimate_hll_registers(registers).expect("2^lg_k registers"))
+    }
+
+    /// Serializes the sketch of `key`, if it is in the store, as a compact
+    /// HLL sketch with buckets of type `tgt_type`.
+    pub fn serialize(&self, key: &[u8], tgt_type: HllType) -> Option<impl AsRef<[u8]>> {
+        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+        impl AsRef<[u8]> for UPtrVec {
+            fn as_ref(&self) -> &[u8] {
+                self.0.as_slice()
+            }
+        }
+        let registers = self.registers(*self.index.get(key)?);
+        let serialized =
+            ffi::serialize_hll_registers(registers, tgt_type).expect("2^lg_k registers");
+        Some(UPtrVec(serialized))
+    }
+
+    /// Calls `f` on each key updated since the store was opened, in the
+    /// order the keys were added to the store.
+    pub fn for_each_updated(&self, mut f: impl FnMut(&[u8])) {
+        for (key, &slot) in self.index.iter() {
+            if self.updated[slot as usize] {
+                f(key)
+            }
+        }
+    }
+
+    /// Appends the keys added since the last flush to the keys file, and
+    /// writes the updated slots back, returning once both are on disk.
+    pub fn flush(&mut self) -> Result<(), Error> {
+        for (key, _) in self.index.iter().skip(self.flushed_keys) {
+            write_frame(&mut self.keys, key)?;
+        }
+        // the slots go first, so the keys file never names a slot that
+        // is not yet on disk
+        self.registers.flush()?;
+        self.keys.flush()?;
+        self.keys.get_ref().sync_data()?;
+        self.flushed_keys = self.len();
+        Ok(())
+    }
+
+    fn registers(&self, slot: u32) -> &[u8] {
+        let start = (slot as usize) << self.lg_k;
+        &self.registers[start..start + (1 << self.lg_k)]
+    }
+
+    /// Returns the registers of `key`, first adding `key` in a new slot,
+    /// and marks them updated.
+    fn registers_mut(&mut self, key: &[u8]) -> Result<&mut [u8], Error> {
+        let next = self.len() as u32;
+        let slot = *self.index.get_or_insert_with(key, || next);
+        if slot == next {
+            if self.registers.len() >> self.lg_k == self.len() {
+                self.grow()?;
+            }
+            self.updated.push(false);
+        }
+        self.updated[slot as usize] = true;
+        let start = (slot as usize) << self.lg_k;
+        Ok(&mut self.registers[start..start + (1 << self.lg_k)])
+    }
+
+    /// Doubles the slots in the file, and maps them all.
+    fn grow(&mut self) -> Result<(), Error> {
+        let len = self.registers.len() * 2;
+        self.slots.set_len(len as u64)?;
+        self.registers = unsafe { MappedFileMut::map(&self.slots) }?;
+        Ok(())
+    }
+}
+
+impl Drop for HllStore {
+    fn drop(&mut self) {
+        let _ = self.flush();
+        let _ = self.slots.set_len((self.flushed_keys << self.lg_k) as u64);
+    }
+}
+
+/// Returns the path of the keys file of the store at `path`.
+fn keys_path(path: &Path) -> PathBuf {
+    let mut keys = OsString::from(path.as_os_str());
+    keys.push(".keys");
+    PathBuf::from(keys)
+}
+
+#[cfg(test)]
+mod tests {
+    use std::env;
+    use std::fs;
+    use std::process;
+
+    use byte_slice_cast::AsByteSlice;
+
+    use super::*;
+    use crate::{HllSketch, HllUnion};
+
+    /// A path for a store that is removed when dropped.
+    struct TempStore(PathBuf);
+
+    impl TempStore {
+        fn new(name: &str) -> Self {
+            let path = env::temp_dir().join(format!("dsrs-store-{}-{}", process::id(), name));
+            Self(path)
+        }
+    }
+
+    impl Drop for TempStore {
+        fn drop(&mut self) {
+            let _ = fs::remove_file(&self.0);
+            let _ = fs::remove_file(keys_path(&self.0));
+        }
+    }
+
+    fn key(i: u64) -> Vec<u8> {
+        format!("key{}", i).into_bytes()
+    }
+
+    #[test]
+    fn persists_across_opens() {
+        let tmp = TempStore::new("persists");
+        let mut sketches: Vec<HllSketch> = (0..250)
+            .map(|_| HllSketch::new(8, HllType::Hll8).unwrap())
+            .collect();
+        for day in 0..3u64 {
+            let mut store = HllStore::open(&tmp.0, 8).unwrap();
+            assert_eq!(store.len(), [0, 150, 200][day as usize]);
+            // each day adds 50 keys to 100 it shares with the day before
+            let keys = day * 50..day * 50 + 150;
+            for k in keys.clone() {
+                for v in 0..(k % 20 + 1) * 50 {
+                    let value = [day * 1000 * 1000 + v];
+                    store.update(&key(k), value.as_byte_slice()).unwrap();
+                    sketches[k as usize].update(value.as_byte_slice());
+                }
+            }
+            let mut updated = Vec::new();
+            store.for_each_updated(|key| updated.push(key.to_vec()));
+            assert_eq!(updated.len(), keys.count());
+        }
+
+        // with another lg_k asked, the store keeps its own
+        let store = HllStore::open(&tmp.0, 12).unwrap();
+        assert_eq!(store.lg_k(), 8);
+        assert_eq!(store.len(), 250);
+        store.for_each_updated(|_| panic!("nothing updated"));
+        for (k, sketch) in sketches.iter().enumerate() {
+            let key = key(k as u64);
+            let mut union = HllUnion::new(8).unwrap();
+            union.merge_serialized(sketch.serialize().as_ref()).unwrap();
+            union
+                .merge_serialized(store.serialize(&key, HllType::Hll4).unwrap().as_ref())
+                .unwrap();
+            // the key's own sketch adds no register to the store's, whose
+            // HLL_8 registers follow a 40-byte header
+            let merged = union.sketch(HllType::Hll8).serialize();
+            let stored = store.serialize(&key, HllType::Hll8).unwrap();
+            assert_eq!(stored.as_ref().len(), 40 + 256);
+            assert_eq!(merged.as_ref()[40..], stored.as_ref()[40..]);
+            let estimate = HllSketch::deserialize(stored.as_ref()).unwrap().estimate();
+            assert_eq!(store.estimate(&key), Some(estimate));
+        }
+        assert!(store.estimate(b"missing").is_none());
+        assert!(store.serialize(b"missing", HllType::Hll4).is_none());
+    }
+
+    #[test]
+    fn merges_serialized_sketches() {
+        let tmp = TempStore::new("merges");
+        let mut store = HllStore::open(&tmp.0, 10).unwrap();
+        let mut batched = HllSketch::new(10, HllType::Hll8).unwrap();
+        let mut union = HllUnion::new(10).unwrap();
+        for (i, n) in [1u64, 100, 10 * 1000].iter().enumerate() {
+            let mut hll = HllSketch::new(10 + i as u8, HllType::Hll4).unwrap();
+            (0..*n).for_each(|v| hll.update_u64(v * 7 + i as u64));
+            store
+                .merge_serialized(b"k", hll.serialize().as_ref())
+                .unwrap();
+            union.merge(hll);
+        }
+        let values: Vec<u64> = (0..5000).collect();
+        let ends: Vec<usize> = (1..=values.len()).map(|i| i * 8).collect();
+        store
+            .update_batch(b"k", values.as_byte_slice(), &ends)
+            .unwrap();
+        batched.update_u64_batch(&values);
+        union.merge(batched);
+        let expected = union.sketch(HllType::Hll8).estimate();
+        assert!((store.estimate(b"k").unwrap() - expected).abs() < expected * 1e-9);
+
+        let small = HllSketch::new(9, HllType::Hll4).unwrap();
+        assert!(store
+            .merge_serialized(b"k", small.serialize().as_ref())
+            .is_err());
+        assert!(store.merge_serialized(b"k", &[1, 2, 3]).is_err());
+    }
+
+    #[test]
+    fn rejects_bad_files() {
+        let tmp = TempStore::new("bad");
+        assert!(HllStore::open(&tmp.0, 3).is_err());
+        let store = HllStore::open(&tmp.0, 4).unwrap();
+        // the keys file is locked while the store is open
+        assert!(HllStore::open(&tmp.0, 4).is_err());
+        drop(store);
+        assert!(HllStore::open(&tmp.0, 4).is_ok());
+        fs::write(keys_path(&tmp.0), b"not a store").unwrap();
+        assert!(HllStore::open(&tmp.0, 4).is_err());
+    }
+}
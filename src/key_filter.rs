@@ -0,0 +1,163 @@
+//! Filters on the keys of `dsrs --key --merge` input, from `--keys` and
+//! `--key-prefix`. A line's key is matched on its raw bytes before the
+//! sketch after it is decoded, so the lines of other keys cost only the
+//! scan for their first space.
+
+use std::io::{BufRead, Error};
+use std::sync::Arc;
+
+use bstr::io::BufReadExt;
+use memchr;
+
+use crate::key_table::KeyTable;
+use crate::stream_reducer::{packed_lines, LineReducer, ParallelLineReducer, PipelinedLineReducer};
+
+/// Keeps the keys that start with a prefix and, if a set of keys is
+/// given, are in it.
+#[derive(Default)]
+pub struct KeyFilter {
+    prefix: Vec<u8>,
+    keys: Option<KeyTable<()>>,
+}
+
+impl KeyFilter {
+    /// Keeps the keys starting with `prefix`, which may be empty.
+    pub fn new(prefix: &[u8]) -> Self {
+        Self {
+            prefix: prefix.to_vec(),
+            keys: None,
+        }
+    }
+
+    /// Keeps only the keys that are also whole lines of `keys`.
+    pub fn with_keys<R: BufRead>(mut self, mut keys: R) -> Result<Self, Error> {
+        let mut table = KeyTable::default();
+        keys.for_byte_line(|key| {
+            table.get_or_insert_with(key, || ());
+            Ok(true)
+        })?;
+        self.keys = Some(table);
+        Ok(self)
+    }
+
+    pub fn matches(&self, key: &[u8]) -> bool {
+        key.starts_with(&self.prefix)
+            && self
+                .keys
+                .as_ref()
+                .map_or(true, |keys| keys.get(key).is_some())
+    }
+
+    /// Whether to read `line`, a key, a space and a sketch. Lines missing
+    /// the space are read, for the reducer to report.
+    fn keeps(&self, line: &[u8]) -> bool {
+        memchr::memchr(b' ', line).map_or(true, |i| self.matches(&line[..i]))
+    }
+}
+
+/// Reduces with `T` only the lines whose keys a [`KeyFilter`] keeps.
+pub struct KeyFiltered<T> {
+    filter: Arc<KeyFilter>,
+    inner: T,
+}
+
+impl<T: LineReducer> KeyFiltered<T> {
+    pub fn new(filter: Arc<KeyFilter>, inner: T) -> Self {
+        Self { filter, inner }
+    }
+
+    pub fn into_inner(self) -> T {
+        self.inner
+    }
+}
+
+impl<T: LineReducer> LineReducer for KeyFiltered<T> {
+    fn read_line(&mut self, line: &[u8]) {
+        if self.filter.keeps(line) {
+            self.inner.read_line(line);
+        }
+    }
+
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        for line in packed_lines(buf, ends) {
+            self.read_line(line);
+        }
+    }
+}
+
+impl<T: ParallelLineReducer> ParallelLineReducer for KeyFiltered<T> {
+    fn fork(&self) -> Self {
+        Self::new(self.filter.clone(), self.inner.fork())
+    }
+
+    fn combine(&mut self, other: Self) {
+        self.inner.combine(other.inner)
+    }
+
+    fn partition_key<'a>(&self, line: &'a [u8]) -> &'a [u8] {
+        self.inner.partition_key(line)
+    }
+}
+
+/// Filters lines on the threads that prepare them, so that no sketch of
+/// a dropped line is decoded.
+impl<T: PipelinedLineReducer> PipelinedLineReducer for KeyFiltered<T> {
+    type Preparer = (Arc<KeyFilter>, T::Preparer);
+    type Prepared = Option<T::Prepared>;
+
+    fn preparer(&self) -> Self::Preparer {
+        (self.filter.clone(), self.inner.preparer())
+    }
+
+    fn prepare((filter, preparer): &Self::Preparer, line: &[u8]) -> Self::Prepared {
+        if filter.keeps(line) {
+            Some(T::prepare(preparer, line))
+        } else {
+            None
+        }
+    }
+
+    fn read_prepared(&mut self, line: &[u8], prepared: Self::Prepared) {
+        if let Some(prepared) = prepared {
+            self.inner.read_prepared(line, prepared);
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[derive(Default)]
+    struct Lines(Vec<Vec<u8>>);
+
+    impl LineReducer for Lines {
+        fn read_line(&mut self, line: &[u8]) {
+            self.0.push(line.to_vec());
+        }
+    }
+
+    #[test]
+    fn keeps_matching_keys() {
+        let lines: &[&[u8]] = &[b"ab x", b"abc y", b"b z", b"a", b"ab", b"abd w"];
+        let keys: &[u8] = b"ab\nb\r\nabd\n";
+        let filters = [
+            (KeyFilter::new(b""), vec![0, 1, 2, 3, 4, 5]),
+            (KeyFilter::new(b"ab"), vec![0, 1, 3, 4, 5]),
+            (
+                KeyFilter::new(b"").with_keys(keys).unwrap(),
+                vec![0, 2, 3, 4, 5],
+            ),
+            (
+                KeyFilter::new(b"a").with_keys(keys).unwrap(),
+                vec![0, 3, 4, 5],
+            ),
+        ];
+        for (filter, kept) in filters {
+            let mut filtered = KeyFiltered::new(Arc::new(filter), Lines::default());
+            lines.iter().for_each(|line| filtered.read_line(line));
+            let expected: Vec<Vec<u8>> = kept.iter().map(|&i| lines[i].to_vec()).collect();
+            assert_eq!(filtered.into_inner().0, expected);
+        }
+    }
+}
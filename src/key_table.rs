@@ -0,0 +1,458 @@
+//! An insert-only hash map from byte-string keys, which backs the keyed
+//! reducers in [`crate::counters`].
+//!
+//! Keys are copied back to back into one growing byte arena rather than
+//! into a `Vec` each, and a lookup hashes its key once, whether it finds
+//! or inserts it. Slots are probed linearly and hold a tag of the hash
+//! next to the entry index, so most mismatches are ruled out without
+//! touching the entries. Entries remember their hashes, so neither
+//! growing the table nor merging another into it rehashes any key.
+//!
+//! The hash is unseeded, so crafted keys could collide on purpose; the
+//! keys `dsrs` reads come from its own user.
+//!
+//! [`HashTable`] is the same map for reducers that keep only a 64-bit
+//! hash of each key, which its slots hold in place of a tag, so that a
+//! lookup compares hashes without touching the entries at all.
+
+use std::convert::TryInto;
+
+/// Marks an empty slot, since occupied ones hold an entry index plus one.
+const EMPTY: u64 = 0;
+
+/// Slots in a table before its first growth.
+const MIN_SLOTS: usize = 16;
+
+struct Entry<V> {
+    hash: u64,
+    start: usize,
+    end: usize,
+    value: V,
+}
+
+pub(crate) struct KeyTable<V> {
+    // Every key, back to back in insertion order.
+    arena: Vec<u8>,
+    entries: Vec<Entry<V>>,
+    // Each either EMPTY or an entry's index plus one in the upper 32 bits
+    // and the upper 32 bits of its hash in the lower ones.
+    slots: Vec<u64>,
+}
+
+impl<V> Default for KeyTable<V> {
+    fn default() -> Self {
+        Self {
+            arena: Vec::new(),
+            entries: Vec::new(),
+            slots: Vec::new(),
+        }
+    }
+}
+
+impl<V> KeyTable<V> {
+    pub(crate) fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// Returns the value for `key`, first inserting `insert()` for it if
+    /// `key` is new.
+    pub(crate) fn get_or_insert_with(&mut self, key: &[u8], insert: impl FnOnce() -> V) -> &mut V {
+        let hash = hash(key);
+        let ix = match self.find(hash, key) {
+            Ok(ix) => ix,
+            Err(slot) => {
+                let start = self.arena.len();
+                self.arena.extend_from_slice(key);
+                self.push(slot, hash, start, insert())
+            }
+        };
+        &mut self.entries[ix].value
+    }
+
+    /// Returns the value for `key`, if any.
+    pub(crate) fn get(&self, key: &[u8]) -> Option<&V> {
+        if self.slots.is_empty() {
+            return None;
+        }
+        let ix = self.probe(hash(key), key).ok()?;
+        Some(&self.entries[ix].value)
+    }
+
+    /// Moves every entry of `other` into this table, handing values whose
+    /// keys are in both to `combine` along with this table's value.
+    pub(crate) fn merge(&mut self, other: Self, mut combine: impl FnMut(&mut V, V)) {
+        if self.entries.is_empty() {
+            *self = other;
+            return;
+        }
+        for entry in other.entries {
+            let key = &other.arena[entry.start..entry.end];
+            match self.find(entry.hash, key) {
+                Ok(ix) => combine(&mut self.entries[ix].value, entry.value),
+                Err(slot) => {
+                    let start = self.arena.len();
+                    self.arena.extend_from_slice(key);
+                    self.push(slot, entry.hash, start, entry.value);
+                }
+            }
+        }
+    }
+
+    /// Iterates over keys and their values, in the order they were
+    /// inserted.
+    pub(crate) fn iter(&self) -> impl Iterator<Item = (&[u8], &V)> {
+        let arena = &self.arena;
+        self.entries
+            .iter()
+            .map(move |entry| (&arena[entry.start..entry.end], &entry.value))
+    }
+
+    /// Iterates over the values, in the order they were inserted, to
+    /// change them in place.
+    pub(crate) fn values_mut(&mut self) -> impl Iterator<Item = &mut V> {
+        self.entries.iter_mut().map(|entry| &mut entry.value)
+    }
+
+    /// Returns every key back to back, in the order [`Self::iter`] yields
+    /// them.
+    pub(crate) fn packed_keys(&self) -> &[u8] {
+        &self.arena
+    }
+
+    /// Removes every key, returning their values, while keeping the
+    /// table's memory for the keys inserted next.
+    pub(crate) fn drain(&mut self) -> impl Iterator<Item = V> + '_ {
+        self.arena.clear();
+        self.slots.iter_mut().for_each(|slot| *slot = EMPTY);
+        self.entries.drain(..).map(|entry| entry.value)
+    }
+
+    /// Finds the index of the entry for `key`, or else the slot to insert
+    /// it at, which is only valid until the table is next modified.
+    fn find(&mut self, hash: u64, key: &[u8]) -> Result<usize, usize> {
+        if (self.entries.len() + 1) * 4 > self.slots.len() * 3 {
+            self.grow();
+        }
+        self.probe(hash, key)
+    }
+
+    /// [`Self::find`] in a table with at least one empty slot.
+    fn probe(&self, hash: u64, key: &[u8]) -> Result<usize, usize> {
+        let mask = self.slots.len() - 1;
+        let tag = hash >> 32;
+        let mut slot = hash as usize & mask;
+        loop {
+            match self.slots[slot] {
+                EMPTY => return Err(slot),
+                occupied if occupied & 0xffff_ffff == tag => {
+                    let ix = (occupied >> 32) as usize - 1;
+                    let entry = &self.entries[ix];
+                    if &self.arena[entry.start..entry.end] == key {
+                        return Ok(ix);
+                    }
+                }
+                _ => {}
+            }
+            slot = (slot + 1) & mask;
+        }
+    }
+
+    /// Appends an entry whose key is at the end of the arena from `start`,
+    /// at `slot` as returned by `find`, and returns its index.
+    fn push(&mut self, slot: usize, hash: u64, start: usize, value: V) -> usize {
+        let ix = self.entries.len();
+        let occupied: u32 = (ix + 1).try_into().expect("under 4G keys");
+        self.slots[slot] = u64::from(occupied) << 32 | hash >> 32;
+        self.entries.push(Entry {
+            hash,
+            start,
+            end: self.arena.len(),
+            value,
+        });
+        ix
+    }
+
+    fn grow(&mut self) {
+        let len = (self.slots.len() * 2).max(MIN_SLOTS);
+        let mask = len - 1;
+        self.slots.clear();
+        self.slots.resize(len, EMPTY);
+        for (ix, entry) in self.entries.iter().enumerate() {
+            let mut slot = entry.hash as usize & mask;
+            while self.slots[slot] != EMPTY {
+                slot = (slot + 1) & mask;
+            }
+            self.slots[slot] = (ix as u64 + 1) << 32 | entry.hash >> 32;
+        }
+    }
+}
+
+/// A slot of a [`HashTable`], empty while `ix` is 0.
+#[derive(Clone, Copy, Default)]
+struct HashSlot {
+    hash: u64,
+    // The index of the slot's entry plus one.
+    ix: u32,
+}
+
+/// An insert-only hash map from 64-bit key hashes, which are taken as
+/// already well mixed.
+pub(crate) struct HashTable<V> {
+    entries: Vec<(u64, V)>,
+    slots: Vec<HashSlot>,
+}
+
+impl<V> Default for HashTable<V> {
+    fn default() -> Self {
+        Self {
+            entries: Vec::new(),
+            slots: Vec::new(),
+        }
+    }
+}
+
+impl<V> HashTable<V> {
+    pub(crate) fn len(&self) -> usize {
+        self.entries.len()
+    }
+
+    /// Returns the value for `hash`, first inserting `insert()` for it if
+    /// `hash` is new.
+    pub(crate) fn get_or_insert_with(&mut self, hash: u64, insert: impl FnOnce() -> V) -> &mut V {
+        let ix = match self.find(hash) {
+            Ok(ix) => ix,
+            Err(slot) => self.push(slot, hash, insert()),
+        };
+        &mut self.entries[ix].1
+    }
+
+    /// Returns the value for `hash`, if any.
+    pub(crate) fn get(&self, hash: u64) -> Option<&V> {
+        if self.slots.is_empty() {
+            return None;
+        }
+        let mask = self.slots.len() - 1;
+        let mut slot = hash as usize & mask;
+        loop {
+            match self.slots[slot] {
+                HashSlot { ix: 0, .. } => return None,
+                HashSlot { hash: h, ix } if h == hash => {
+                    return Some(&self.entries[ix as usize - 1].1)
+                }
+                _ => slot = (slot + 1) & mask,
+            }
+        }
+    }
+
+    /// Moves every entry of `other` into this table, handing values whose
+    /// hashes are in both to `combine` along with this table's value.
+    pub(crate) fn merge(&mut self, other: Self, mut combine: impl FnMut(&mut V, V)) {
+        if self.entries.is_empty() {
+            *self = other;
+            return;
+        }
+        for (hash, value) in other.entries {
+            match self.find(hash) {
+                Ok(ix) => combine(&mut self.entries[ix].1, value),
+                Err(slot) => {
+                    self.push(slot, hash, value);
+                }
+            }
+        }
+    }
+
+    /// Iterates over hashes and their values, in the order they were
+    /// inserted.
+    pub(crate) fn iter(&self) -> impl Iterator<Item = (u64, &V)> {
+        self.entries.iter().map(|(hash, value)| (*hash, value))
+    }
+
+    /// Removes every hash, returning their values, while keeping the
+    /// table's memory for the hashes inserted next.
+    pub(crate) fn drain(&mut self) -> impl Iterator<Item = V> + '_ {
+        self.slots
+            .iter_mut()
+            .for_each(|slot| *slot = HashSlot::default());
+        self.entries.drain(..).map(|(_, value)| value)
+    }
+
+    /// Finds the index of the entry for `hash`, or else the slot to insert
+    /// it at, which is only valid until the table is next modified.
+    fn find(&mut self, hash: u64) -> Result<usize, usize> {
+        if (self.entries.len() + 1) * 4 > self.slots.len() * 3 {
+            self.grow();
+        }
+        let mask = self.slots.len() - 1;
+        let mut slot = hash as usize & mask;
+        loop {
+            match self.slots[slot] {
+                HashSlot { ix: 0, .. } => return Err(slot),
+                HashSlot { hash: h, ix } if h == hash => return Ok(ix as usize - 1),
+                _ => slot = (slot + 1) & mask,
+            }
+        }
+    }
+
+    /// Appends an entry for `hash` at `slot` as returned by `find`, and
+    /// returns its index.
+    fn push(&mut self, slot: usize, hash: u64, value: V) -> usize {
+        let ix = self.entries.len();
+        let occupied: u32 = (ix + 1).try_into().expect("under 4G keys");
+        self.slots[slot] = HashSlot { hash, ix: occupied };
+        self.entries.push((hash, value));
+        ix
+    }
+
+    fn grow(&mut self) {
+        let len = (self.slots.len() * 2).max(MIN_SLOTS);
+        let mask = len - 1;
+        self.slots.clear();
+        self.slots.resize(len, HashSlot::default());
+        for (ix, &(hash, _)) in self.entries.iter().enumerate() {
+            let mut slot = hash as usize & mask;
+            while self.slots[slot].ix != 0 {
+                slot = (slot + 1) & mask;
+            }
+            self.slots[slot] = HashSlot {
+                hash,
+                ix: ix as u32 + 1,
+            };
+        }
+    }
+}
+
+/// Picks which of `parts` partitions `key` belongs to from the top bits
+/// of its hash, so that the keys of any one partition still spread over
+/// all the slots of a table.
+pub(crate) fn partition(key: &[u8], parts: usize) -> usize {
+    ((u128::from(hash(key)) * parts as u128) >> 64) as usize
+}
+
+/// Hashes `key` a word at a time, then mixes the result so that both the
+/// low bits, which pick a slot, and the high bits, which tag it, depend
+/// on every byte.
+fn hash(key: &[u8]) -> u64 {
+    const K: u64 = 0x9e37_79b9_7f4a_7c15;
+    let step = |h: u64, word: u64| (h.rotate_left(5) ^ word).wrapping_mul(K);
+    let mut h = key.len() as u64;
+    let mut words = key.chunks_exact(8);
+    for word in &mut words {
+        h = step(h, u64::from_le_bytes(word.try_into().expect("8 bytes")));
+    }
+    let rest = words.remainder();
+    if !rest.is_empty() {
+        let mut word = [0u8; 8];
+        word[..rest.len()].copy_from_slice(rest);
+        h = step(h, u64::from_le_bytes(word));
+    }
+    h ^= h >> 32;
+    h = h.wrapping_mul(K);
+    h ^ h >> 29
+}
+
+#[cfg(test)]
+mod tests {
+
+    use std::collections::HashMap;
+
+    use super::*;
+
+    fn key(i: usize) -> Vec<u8> {
+        // keys of every length up to 20, which share long prefixes
+        format!("{:0width$}", i, width = i % 21).into_bytes()
+    }
+
+    #[test]
+    fn matches_hash_map() {
+        let mut table = KeyTable::default();
+        assert_eq!(table.get(b"x"), None);
+        let mut expected = HashMap::new();
+        for i in 0..100 * 1000 {
+            let k = key(i % 30000);
+            *table.get_or_insert_with(&k, || 0) += i;
+            *expected.entry(k).or_insert(0) += i;
+        }
+        assert_eq!(table.len(), expected.len());
+        let actual: HashMap<Vec<u8>, usize> = table.iter().map(|(k, &v)| (k.to_vec(), v)).collect();
+        assert_eq!(actual, expected);
+        for (k, v) in &expected {
+            assert_eq!(table.get(k), Some(v));
+        }
+        assert_eq!(table.get(b"x"), None);
+        assert_eq!(table.get_or_insert_with(b"", || 7), &7);
+    }
+
+    #[test]
+    fn merge_combines_shared_keys() {
+        let mut left = KeyTable::default();
+        let mut right = KeyTable::default();
+        for i in 0..2000 {
+            left.get_or_insert_with(&key(i), || vec![i]);
+            right.get_or_insert_with(&key(i + 1000), || vec![i + 1000]);
+        }
+        left.merge(right, |mine, theirs| mine.extend(theirs));
+        assert_eq!(left.len(), 3000);
+        for (i, (k, v)) in left.iter().enumerate() {
+            assert_eq!(k, &key(i)[..]);
+            let expected: Vec<usize> = if (1000..2000).contains(&i) {
+                vec![i, i]
+            } else {
+                vec![i]
+            };
+            assert_eq!(v, &expected);
+        }
+
+        let mut empty = KeyTable::default();
+        empty.merge(left, |_, _| unreachable!("no shared keys"));
+        assert_eq!(empty.len(), 3000);
+    }
+
+    #[test]
+    fn partitions_evenly() {
+        let mut sizes = [0usize; 7];
+        for i in 0..70 * 1000 {
+            sizes[partition(&key(i), sizes.len())] += 1;
+        }
+        assert!(sizes.iter().all(|&size| (9000..11000).contains(&size)));
+        assert_eq!(partition(b"any", 1), 0);
+    }
+
+    #[test]
+    fn drain_keeps_memory() {
+        let mut table = KeyTable::default();
+        for i in 0..1000 {
+            table.get_or_insert_with(&key(i), || i);
+        }
+        let slots = table.slots.len();
+        let mut drained: Vec<usize> = table.drain().collect();
+        drained.sort_unstable();
+        assert_eq!(drained, (0..1000).collect::<Vec<_>>());
+        assert_eq!(table.len(), 0);
+        assert_eq!(table.iter().count(), 0);
+        assert_eq!(table.slots.len(), slots);
+        assert_eq!(table.get_or_insert_with(&key(5), || 42), &42);
+    }
+
+    #[test]
+    fn hash_table_matches_hash_map() {
+        let mut table = HashTable::default();
+        let mut other = HashTable::default();
+        let mut expected = HashMap::new();
+        for i in 0..100 * 1000u64 {
+            // hash 0 is a key like any other
+            let h = hash(&key(i as usize % 30000)).wrapping_mul(i % 7);
+            let half = if i % 2 == 0 { &mut table } else { &mut other };
+            *half.get_or_insert_with(h, || 0) += i;
+            *expected.entry(h).or_insert(0) += i;
+        }
+        table.merge(other, |mine, theirs| *mine += theirs);
+        assert_eq!(table.len(), expected.len());
+        let actual: HashMap<u64, u64> = table.iter().map(|(h, &v)| (h, v)).collect();
+        assert_eq!(actual, expected);
+        assert_eq!(table.get(0), expected.get(&0));
+        assert_eq!(table.get(1), None);
+        assert_eq!(table.drain().count(), expected.len());
+        assert_eq!(table.get(0), None);
+        assert_eq!(HashTable::<u64>::default().get(0), None);
+    }
+}
@@ -1,16 +1,85 @@
 //! `dsrs` contains bindings for a subset of [Apache DataSketches](https://github.com/apache/datasketches-cpp).
 
+pub mod alloc_stats;
+pub mod arrow_ipc;
+mod base64_decode;
 mod bridge;
 pub mod counters;
+pub mod decompress;
 mod error;
+pub mod fields;
+pub mod frames;
+#[cfg(unix)]
+pub mod hll_store;
+pub mod key_filter;
+mod key_table;
+#[cfg(unix)]
+pub mod mapped_file;
+pub mod numa;
+pub mod profile;
+pub mod raw_lines;
+#[cfg(unix)]
+pub mod segment_store;
+pub mod serve;
+pub mod sketch_events;
+mod spill;
 pub mod stream_reducer;
+#[cfg(target_os = "linux")]
+mod uring;
 mod wrapper;
 
 pub use error::DataSketchesError;
+pub use wrapper::AodCombine;
+pub use wrapper::ArrayOfDoublesColumns;
+pub use wrapper::ArrayOfDoublesColumnsIntersection;
+pub use wrapper::ArrayOfDoublesColumnsUnion;
+pub use wrapper::ArrayOfDoublesIntersection;
+pub use wrapper::ArrayOfDoublesSketch;
+pub use wrapper::ArrayOfDoublesUnion;
+pub use wrapper::BloomFilter;
+pub use wrapper::CompactHhSketches;
+pub use wrapper::ConcurrentThetaSketch;
+pub use wrapper::ConcurrentHhSketch;
+pub use wrapper::ConcurrentKllDoubleSketch;
+pub use wrapper::ConcurrentKllFloatSketch;
+pub use wrapper::CountMinSketch;
+pub use wrapper::CpcArena;
 pub use wrapper::CpcSketch;
 pub use wrapper::CpcUnion;
+pub use wrapper::FrozenCpcSketch;
+pub use wrapper::HhBuffer;
 pub use wrapper::HhSketch;
+pub use wrapper::HllMatrix;
+pub use wrapper::HllSketch;
+pub use wrapper::HllType;
+pub use wrapper::HllUnion;
+pub use wrapper::KeyHash;
+pub use wrapper::KeyedThetaSketch;
+pub use wrapper::KllDoubleBuffer;
+pub use wrapper::KllDoubleSketch;
+pub use wrapper::KllFloatBuffer;
+pub use wrapper::KllFloatSketch;
+pub use wrapper::KllU32Sketch;
+pub use wrapper::KllU64Sketch;
+pub use wrapper::NativeHhSketch;
+pub use wrapper::ReqSketch;
+pub use wrapper::ShardedCpcSketch;
+pub use wrapper::StaticArrayOfDoublesSketch;
 pub use wrapper::StaticThetaSketch;
+pub use wrapper::SubsetSummary;
+pub use wrapper::ThetaBuffer;
+pub use wrapper::ThetaExclusion;
+pub use wrapper::ThetaExpression;
 pub use wrapper::ThetaIntersection;
+pub use wrapper::ThetaJaccardMatrix;
+pub use wrapper::ThetaResizeFactor;
 pub use wrapper::ThetaSketch;
 pub use wrapper::ThetaUnion;
+pub use wrapper::ThetaWindow;
+pub use wrapper::VarOptSketch;
+pub use wrapper::VarOptUnion;
+pub use wrapper::WrappedKllDoubleSketch;
+pub use wrapper::WrappedKllFloatSketch;
+pub use wrapper::WrappedReqSketch;
+pub use wrapper::WrappedThetaSketch;
+pub use wrapper::{seed_compaction_rng, seed_thread_compaction_rng, set_huge_pages};
@@ -1,23 +1,85 @@
 //! `dsrs` main executable, which provides count-distinct functionality
 //! on the command line.
 
+use std::borrow::Borrow;
+use std::collections::HashMap;
+use std::fmt::Display;
+use std::fs::File;
 use std::io;
-use std::iter;
+use std::io::{BufRead, Read, Write};
+use std::net::TcpListener;
+#[cfg(unix)]
+use std::os::unix::net::UnixListener;
+use std::path::{Path, PathBuf};
 use std::str;
+use std::str::FromStr;
+use std::sync::Arc;
+use std::thread;
 
-use dsrs::counters::{Counter, HeavyHitter, KeyedCounter, KeyedMerger, Merger};
-use dsrs::stream_reducer::reduce_stream;
+use dsrs::alloc_stats;
+#[cfg(unix)]
+use dsrs::counters::StoredKeyedCounter;
+use dsrs::counters::{
+    Algo, BloomBuilder, BloomMerger, BloomProbe, Counter, HashedKeyedCounter, HeavyHitter,
+    HeavyHitterMerger, KeyedCounter, KeyedHeavyHitter, KeyedMerger, KeyedSummer, LineStats, Merger,
+    Sampler, SharedThetaKeyedCounter, SortedKeyedMerger, Summer, TopKeys, WindowCounter,
+    DEFAULT_LG_K,
+};
+#[cfg(unix)]
+use dsrs::decompress::decompress_slice;
+use dsrs::decompress::{decompress_stream, Compression};
+use dsrs::fields::{FieldSelector, Fields};
+use dsrs::frames::{read_frame, reduce_frames_parallel, write_frame};
+#[cfg(unix)]
+use dsrs::hll_store::HllStore;
+use dsrs::key_filter::{KeyFilter, KeyFiltered};
+#[cfg(unix)]
+use dsrs::mapped_file::MappedFile;
+use dsrs::numa;
+use dsrs::profile;
+use dsrs::raw_lines::RawLines;
+#[cfg(unix)]
+use dsrs::segment_store::SegmentStore;
+use dsrs::serve::Server;
+use dsrs::sketch_events;
+#[cfg(unix)]
+use dsrs::stream_reducer::reduce_slice_parallel;
+use dsrs::stream_reducer::{
+    lines_read, reduce_files_parallel, reduce_stream, reduce_stream_checkpointed,
+    reduce_stream_parallel, reduce_stream_partitioned, reduce_stream_pipelined, Checkpoint,
+    KeyValueReducer, LineReducer, ParallelLineReducer,
+};
+use dsrs::{set_huge_pages, BloomFilter, CpcSketch, StaticArrayOfDoublesSketch};
 use structopt::StructOpt;
 
 /// `dsrs` provides both count-distinct and heavy hitter functionality
 /// to the command line.
 ///
-/// `dsrs --hh k` returns the approximate top-k most popular lines from
-/// stdin. It can be viewed as essentially a separate command.
+/// `dsrs --hh k [--key]` returns the approximate top-k most popular lines
+/// from stdin, or of each key. It can be viewed as essentially a separate
+/// command.
 ///
 /// `dsrs [--key] [--raw] [--merge]` returns the count of unique lines
 /// from stdin.
 ///
+/// `dsrs --sample k [--key]` returns a sample of at most k lines from
+/// stdin, each after the weight it stands for, or the estimated number of
+/// lines of each key with bounds on it.
+///
+/// `dsrs --sum n [--key]` returns the count of unique lines without their
+/// last `n` words, which are numbers, followed by the sum of each of them.
+///
+/// `dsrs --window n` returns, as each slice of lines ends, the count of
+/// unique values in the last `n` slices, where lines are slice numbers
+/// followed by values.
+///
+/// `dsrs --all k` returns the count of unique lines, quantiles of their
+/// lengths and the approximate top-k lines, all from one pass over stdin.
+///
+/// `dsrs --bloom n [--raw]` returns the count of unique lines estimated
+/// from a Bloom filter of them, or the filter, and
+/// `dsrs --contains FILTER` returns the lines of stdin it may hold.
+///
 /// It has three important options (key, raw, merge), which all interact
 /// and have different I/O expectations.
 ///
@@ -112,6 +174,25 @@ struct Opt {
     #[structopt(long)]
     key: bool,
 
+    /// If set with `--key`, the key of each line is this field of it
+    /// rather than its first word, counting from 1, where fields are
+    /// separated by `--delimiter`, and the value is `--value-field`, so
+    /// that columns of TSV or CSV files are counted as they are. Fields
+    /// are found by scanning a whole buffer of lines for delimiters at
+    /// once, and are not quoted, so a delimiter always ends a field. It
+    /// cannot be combined with `--merge` or `--store`.
+    #[structopt(long)]
+    key_field: Option<usize>,
+
+    /// The field of each line holding its value with `--key-field`,
+    /// counting from 1.
+    #[structopt(long, default_value = "2")]
+    value_field: usize,
+
+    /// The ASCII character separating fields with `--key-field`.
+    #[structopt(long, default_value = "\t")]
+    delimiter: char,
+
     /// If set, the raw flag results in a base64 serialized printout of
     /// the sketch at the end of computation rather than the approximate
     /// distinct count. This is useful when combined with a downstream
@@ -119,6 +200,29 @@ struct Opt {
     #[structopt(long)]
     raw: bool,
 
+    /// If set with `--raw`, leaves out the parts of each serialized sketch
+    /// that only its own estimate uses, which `--merge` ignores. A `cpc`
+    /// sketch of a few values shrinks by up to half, which adds up with
+    /// `--key`, where most keys tend to have few values. Merged counts are
+    /// unchanged, but the sketches alone give slightly worse estimates.
+    #[structopt(long)]
+    slim: bool,
+
+    /// How serialized sketches are written by `--raw` and read by
+    /// `--merge`: `text` (the default) for a base64 line each, after its
+    /// key with `--key`, or `binary` for length-prefixed frames, in which a
+    /// sketch takes 3/4 of the bytes and needs no decoding. Each frame is
+    /// a little-endian `u32` length followed by that many bytes, and with
+    /// `--key` each sketch frame follows a frame holding its key.
+    ///
+    /// With `--key --raw`, `arrow` writes an Arrow IPC stream instead, for
+    /// loading into analytics engines, of record batches with columns
+    /// `key` and `sketch` (binary) and `estimate`, `lower_bound` and
+    /// `upper_bound` (float64) of each sketch, bounds being 2 standard
+    /// deviations. `--merge` still reads text.
+    #[structopt(long, default_value = "text")]
+    format: Format,
+
     /// If set, expects inputs to contain a base64 serialized printout of
     /// sketches generated by upstream `dsrs --raw` commands. Then `dsrs`
     /// will merge the deserialized sketches to compute distinct counts
@@ -126,70 +230,1688 @@ struct Opt {
     #[structopt(long)]
     merge: bool,
 
-    /// Can only be set if all other flags are disabled. Returns a
-    /// upper bound estimate for the number of times a line is expected
-    /// to have appeared, along with the line itself.
-    #[structopt(long)]
-    hh: Option<u64>,
+    /// If set with `--key --merge`, the lines (or frames) of each key must
+    /// be consecutive, as after `sort`. The sketches of one key are then
+    /// merged at a time, and each key is printed as soon as the next one
+    /// starts, so memory stays constant however many keys there are.
+    /// Keys are printed in input order, and a key that comes back after
+    /// another is printed again. Sketches are merged in input order on one
+    /// thread, but with `--threads n`, n other threads decode and
+    /// deserialize the lines ahead of the merges. Frames are read on one
+    /// thread, so `--format binary` cannot be combined with `--threads`.
+    #[structopt(long)]
+    sorted: bool,
+
+    /// If set with `--key --merge`, only merges the keys that are lines of
+    /// this file. The lines (or frames) of other keys are dropped by their
+    /// raw key, before their sketches are decoded.
+    #[structopt(long, parse(from_os_str))]
+    keys: Option<PathBuf>,
+
+    /// If set with `--key --merge`, only merges the keys starting with
+    /// this prefix, dropping others as `--keys` does. With `--keys` too,
+    /// keys must satisfy both.
+    #[structopt(long)]
+    key_prefix: Option<String>,
+
+    /// The distinct count sketch to use, `cpc` (the default) or `hll`.
+    ///
+    /// `hll` sketches take roughly half the memory of `cpc` ones but have
+    /// about 1.7 times the error, about 2.3% rather than 1.3% relative
+    /// standard error. The memory matters most for `--key` jobs with many
+    /// keys.
+    ///
+    /// Serialized sketches from `--raw` can only be merged by a `--merge`
+    /// invocation with the same `--algo`.
+    #[structopt(long, default_value = "cpc")]
+    algo: Algo,
+
+    /// Log2 of the size of each distinct count sketch, from 4 up to 26
+    /// for `cpc` or 21 for `hll`. Each increment halves the variance of
+    /// the estimates and doubles the memory, so the default of 11 gives
+    /// the errors quoted for `--algo`. With `--merge`, the merged sketch
+    /// takes the smallest `--lg-k` among this one and those of the
+    /// sketches read.
+    #[structopt(long, default_value = "11")]
+    lg_k: u8,
+
+    /// Number of threads reducing input lines, in addition to the one
+    /// reading stdin. Each thread keeps its own sketches, which are merged
+    /// once the input is exhausted, so estimates may differ slightly with
+    /// the thread count. With `--key`, the reading thread instead hands
+    /// all the lines of a key to the same thread, so each key has just
+    /// one sketch and its estimate does not depend on the thread count.
+    /// The sketches of `--key --raw` are serialized, and their base64
+    /// lines encoded, on as many threads.
+    #[structopt(long, default_value = "1")]
+    threads: usize,
+
+    /// On Linux hosts with several NUMA nodes, split the `--threads`
+    /// among the nodes and pin each to the CPUs of its node, so that the
+    /// sketches each thread grows are allocated on its node. The sketches
+    /// of each node's threads are merged on that node before those of the
+    /// nodes are merged. Elsewhere, this does nothing.
+    #[structopt(long)]
+    numa: bool,
+
+    /// On Linux, back the sketch tables of 2MB or more, such as the map
+    /// of the `--top` sketch or CPC tables at a large `--lg-k`, with 2MB
+    /// huge pages, which cut the TLB misses of their random probes. Pages
+    /// reserved through `vm.nr_hugepages` are used while any are left,
+    /// and transparent huge pages after that.
+    #[structopt(long)]
+    hugepages: bool,
+
+    /// Once done, print to stderr, as one JSON object, the lines read, the
+    /// wall and CPU time taken, and the time and bytes of each stage of
+    /// the pipeline (read, decompress, split, key_extract, hash, update,
+    /// merge, serialize, and wait for time blocked on queues between
+    /// threads), with the mean and largest depths found by what is sent
+    /// on those queues. In `dsrs` built with `--features alloc-stats`,
+    /// it also has how many allocations each family of sketches made and
+    /// how many bytes they asked for, and with `--features event-stats`
+    /// how often the sketches resized, purged or promoted their tables,
+    /// in all and per million lines read, to catch regressions.
+    #[structopt(long)]
+    stats: bool,
+
+    /// Read lines from this file rather than stdin. The file is mapped
+    /// into memory and its lines are reduced in place, split among the
+    /// `--threads` without a separate reading thread, except that with
+    /// `--key` they are handed out as from stdin. The file must not
+    /// change while `dsrs` runs.
+    ///
+    /// Several files, such as those of a shell glob, are read as if their
+    /// lines came one after the other, each ending in a line break. Each
+    /// of the `--threads` then reads whole files, taking the next largest
+    /// as it finishes one, through large buffers, which on Linux are read
+    /// into several at a time with io_uring where it is available, and
+    /// their sketches are merged at the end. With `--key`, the files are read in turn. Reading
+    /// in order, as `--window`, `--checkpoint`, `--store` and merges of
+    /// `--format binary` sketches do, takes at most one file.
+    ///
+    /// Counts, `--hh`, `--sample`, `--all` and `--sum` decompress inputs,
+    /// stdin included, that are zstd or gzip compressed, on threads of
+    /// their own. The frames of a file of several zstd frames, such as
+    /// `pzstd` writes, are decompressed by as many as `--threads` threads.
+    #[structopt(long, parse(from_os_str))]
+    input: Vec<PathBuf>,
+
+    /// If set to `n` with `--key`, each thread holds the sketches of at
+    /// most `n` keys in memory, writing them out to sorted runs in the
+    /// temporary directory when it would hold more, so that inputs with
+    /// more keys than fit in memory can still be counted. The runs are
+    /// merged once the input is exhausted, and keys are then printed in
+    /// sorted order, with the estimates of their merged sketches. It
+    /// cannot be combined with `--merge` or `--sum`.
+    #[structopt(long)]
+    spill_keys: Option<usize>,
+
+    /// If set to `n` with `--key`, prints only the `n` keys with the
+    /// highest estimates, highest first, rather than every key. Keys are
+    /// vetted against a cheap bound on their estimates before the
+    /// estimates themselves are computed. It cannot be combined with
+    /// `--raw`.
+    #[structopt(long)]
+    top: Option<usize>,
+
+    /// If set with `--key`, keys are not kept, only a 64-bit hash of each,
+    /// and are printed as that hash in 16 hex digits. The hash is the
+    /// first 64 bits of the key's 128-bit x64 MurmurHash3 with seed 9001,
+    /// read as a little-endian integer, so counts can be joined back to
+    /// keys elsewhere. Keys then take 8 bytes each in memory however long
+    /// they are, while keys whose hashes collide are counted as one. The
+    /// hex keys of `--raw` lines can be merged by `--key --merge`. It
+    /// cannot be combined with `--spill-keys`.
+    #[structopt(long)]
+    hash_keys: bool,
+
+    /// If set to `n` with `--hash-keys`, keeps the keys of about one in
+    /// `n` key hashes, picked by hash, and prints each such key after its
+    /// count. It cannot be combined with `--raw` or `--top`.
+    #[structopt(long)]
+    key_sample: Option<u64>,
+
+    /// If set to `lg_k` with `--key`, counts the values of all the keys
+    /// in one theta sketch of about `2^lg_k` (key, value) pairs, sampled
+    /// under a single threshold, rather than in a sketch per key. The
+    /// sketch then takes `2^(lg_k + 5)` bytes at most however many keys
+    /// there are, and each key is estimated as its number of sampled pairs
+    /// over the threshold: keys with many values about as well as with
+    /// `--algo`, and keys with few much less well, down to 0. It can be
+    /// combined with `--top`, but not with `--merge`, `--raw`, `--algo`,
+    /// `--lg-k`, `--spill-keys`, `--hash-keys`, `--store`, `--segments`
+    /// or `--checkpoint`.
+    #[structopt(long)]
+    shared_theta: Option<u8>,
+
+    /// If set with `--key --algo hll`, counts into a store of sketches at
+    /// this path, created if missing, so that counts add up across runs,
+    /// such as one a day over each day's lines. The store is this file,
+    /// holding `2^lg_k` bytes of registers per key, and the same path with
+    /// `.keys` appended. Registers are updated in place through a memory
+    /// map, so a run only touches those of the keys on its lines, and never
+    /// deserializes or rewrites the others. Each key on the lines is then
+    /// printed with the estimate of its sketch in the store, or that sketch
+    /// with `--raw`, which `--merge --algo hll` reads. With `--merge`, the
+    /// lines hold sketches to merge into the store instead.
+    ///
+    /// A new store takes `--lg-k`, while an existing one keeps its own.
+    /// Keys of few values are estimated as after a `--merge`, which can
+    /// differ slightly from a plain `--algo hll`. Lines are read in one
+    /// thread, so it cannot be combined with `--threads`, `--sorted`,
+    /// `--spill-keys` or `--hash-keys`. It is only available on unix.
+    #[structopt(long, parse(from_os_str))]
+    store: Option<PathBuf>,
+
+    /// If set with `--key`, appends the keys counted, or merged with
+    /// `--merge`, to a store of sketches in this directory, created if
+    /// missing, so that counts add up across runs of any `--algo`. Each
+    /// run writes its sketches as one sorted segment file, which no later
+    /// run rewrites, and once the directory holds 8 segments, a background
+    /// thread merges them into one, unioning each key's sketches. Each key
+    /// of the run is then printed with the estimate of the union of its
+    /// sketches in the store, or that union with `--raw`, reading only the
+    /// segments that span the run's keys.
+    ///
+    /// The store keeps the `--algo` and `--lg-k` it was created with, and
+    /// later runs must give the same. It cannot be combined with
+    /// `--store`, `--sorted`, `--spill-keys`, `--hash-keys` or
+    /// `--checkpoint`. It is only available on unix.
+    #[structopt(long, parse(from_os_str))]
+    segments: Option<PathBuf>,
+
+    /// If set, distinct counts save their sketches and how far they have
+    /// read to a checkpoint at this path every `--checkpoint-bytes` of
+    /// input, and a run that finds a checkpoint there resumes from it
+    /// rather than from the start of the input, which must be the same as
+    /// the interrupted run's. A checkpoint is refused rather than resumed
+    /// if it was saved with another `--key`, `--algo`, `--lg-k`,
+    /// `--key-field`, `--value-field` or `--delimiter`, or while reading
+    /// an `--input` of another path or length, or stdin instead of a file
+    /// or the other way around. Checkpoints are written on a background
+    /// thread, skipping any that come due while the last is still being
+    /// written, and removed once the input is over. Lines are read in one
+    /// thread, so it cannot be combined with `--threads`, nor with
+    /// `--merge`, `--spill-keys`, `--hash-keys` or `--store`.
+    #[structopt(long, parse(from_os_str))]
+    checkpoint: Option<PathBuf>,
+
+    /// If set, rather than reading stdin, `dsrs` keeps keyed distinct
+    /// counts in memory and serves them over this socket until it is
+    /// killed, so that frequent small batches each skip starting `dsrs`
+    /// and rebuilding its sketches. The socket is a TCP address such as
+    /// `127.0.0.1:7070`, whose bound address is printed, or a Unix domain
+    /// socket at `PATH` for `unix:PATH`, on unix.
+    ///
+    /// Clients send batches of `--key` lines, or of the frames of
+    /// `--key --raw --format binary` sketches, and ask for the estimates
+    /// of keys, each in a frame of its own as described in the `serve`
+    /// module of the crate. Requests over 256MiB are refused. Each
+    /// connection is served on a thread of its own, up to 256 at once,
+    /// beyond which clients are refused, and estimates are answered while
+    /// batches of other keys are counted. Of the other flags, it can only
+    /// be combined with `--algo`, `--lg-k` and `--hugepages`.
+    #[structopt(long)]
+    serve: Option<String>,
+
+    /// Bytes of input read between checkpoints with `--checkpoint`.
+    #[structopt(long, default_value = "1073741824")]
+    checkpoint_bytes: u64,
+
+    /// If set to `n`, the last `n` words of each line are numbers, and
+    /// `dsrs` sums each of them while counting the distinct values left
+    /// on the lines without them, printing the count and then the `n`
+    /// sums, in one pass over a Tuple sketch.
+    ///
+    /// This corresponds to an approximate version of
+    /// `SELECT COUNT(DISTINCT VALUE), SUM(X1), ..., SUM(Xn) FROM stdin-lines`
+    /// and can be combined with `--key` to group by the first word. The
+    /// sums are exact while the counts are, and estimated from the same
+    /// sample as them beyond that. It cannot be combined with `--raw`,
+    /// `--merge`, `--algo`, or `--lg-k`.
+    #[structopt(long)]
+    sum: Option<u8>,
+
+    /// Returns a upper bound estimate for the number of times a line is
+    /// expected to have appeared, along with the line itself, for the `k`
+    /// most frequent lines. Of the other flags, it can only be combined
+    /// with `--raw` and `--merge`, which work as for counts, so that heavy
+    /// hitters of shards can be merged, and `--format`, `--threads` and
+    /// `--input`. With `--key` instead, it prints the `k` most frequent
+    /// rests of lines of each key, each line after its key.
+    #[structopt(long)]
+    hh: Option<u64>,
+
+    /// If set to `k`, reads the input once for the count of distinct
+    /// lines, the quantiles of their lengths and the top `k` lines, which
+    /// would otherwise take a plain `dsrs`, a quantile tool and
+    /// `dsrs --hh k` over the same input. It prints a `distinct` line with
+    /// the count, a `lengths` line with the minimum, median, 90th and 99th
+    /// percentiles and maximum of the line lengths in bytes, without line
+    /// terminators, and then a `top` line for each heavy hitter, with its
+    /// count and the line as `--hh` prints them. The lengths are estimated
+    /// with about 1.65% rank error. Of the other flags, it can only be
+    /// combined with `--lg-k`, `--threads` and `--input`.
+    #[structopt(long)]
+    all: Option<u64>,
+
+    /// If set to `k`, prints a uniform sample of at most `k` lines, each
+    /// after its adjusted weight, the number of input lines it stands
+    /// for. Summing the weights of the sampled lines matching some
+    /// filter estimates how many input lines match it. With `--key`, it
+    /// instead prints each key of the sampled lines, their first word,
+    /// after the estimated number of input lines of that key, and lower
+    /// and upper bounds on it. Like `--hh`, it cannot be combined with the
+    /// other flags.
+    #[structopt(long)]
+    sample: Option<u32>,
+
+    /// If set to `n`, adds every line to a Bloom filter sized for `n`
+    /// distinct lines, at 16 bits each for about 0.09% false positives,
+    /// and prints the number of distinct lines estimated from its bits.
+    /// With `--raw` it prints the filter itself for `--contains` to read,
+    /// and with `--merge` the lines are instead filters for `n` to union.
+    /// With `--key`, only the first word of each line is added. Of the
+    /// other flags, it can only be combined with `--format`, `--threads`
+    /// and `--input`.
+    #[structopt(long)]
+    bloom: Option<u64>,
+
+    /// If set to a file holding a filter printed by `dsrs --bloom n --raw`,
+    /// prints the lines of the input that may have been added to it, in
+    /// order, and drops those that certainly were not, for example to cut
+    /// one side of a join down to the keys of the other before sorting.
+    /// With `--key`, lines are tested by their first word. With
+    /// `--format binary`, the file holds the filter as a frame. Lines are
+    /// read in one thread, from stdin or one `--input`.
+    #[structopt(long, parse(from_os_str))]
+    contains: Option<PathBuf>,
+
+    /// If set to `n`, each line is a slice number, such as the second it
+    /// was logged in, followed by a value after a space, and `dsrs` counts
+    /// the distinct values in a sliding window of the last `n` slices. As
+    /// each slice ends, it prints the slice and the count of the window
+    /// ending with it, so that, for example, the distinct users of the
+    /// last 15 minutes are updated every second with `--window 900`.
+    ///
+    /// Slice numbers must never decrease, and only slices with lines are
+    /// printed. Lines are read and counts printed as they come, in one
+    /// thread, over theta sketches of `--lg-k`, from 5 up to 26. Of the
+    /// other flags, it can only be combined with `--lg-k`, `--p` and
+    /// `--input`.
+    #[structopt(long)]
+    window: Option<usize>,
+
+    /// With `--window`, the theta sketches keep each value with this
+    /// probability, in `(0, 1]`. Most values are then dropped after
+    /// hashing, so reading them gets cheaper about in proportion. Windows
+    /// of more than `2^lg_k / p` distinct values are estimated about as
+    /// accurately as without it, but smaller ones are no longer counted
+    /// exactly, only from a sample of rate `p`.
+    #[structopt(long, default_value = "1")]
+    p: f32,
+}
+
+/// The encoding of serialized sketches for `--raw` and `--merge`.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+enum Format {
+    Text,
+    Binary,
+    /// Only written, by keyed `--raw`.
+    Arrow,
+}
+
+impl FromStr for Format {
+    type Err = String;
+
+    fn from_str(s: &str) -> Result<Self, Self::Err> {
+        match s {
+            "text" => Ok(Self::Text),
+            "binary" => Ok(Self::Binary),
+            "arrow" => Ok(Self::Arrow),
+            _ => Err(format!(
+                "unknown format '{}', expected text, binary or arrow",
+                s
+            )),
+        }
+    }
+}
+
+fn main() {
+    let opt = Opt::from_args();
+    let stats = opt.stats;
+    if stats {
+        profile::enable();
+    }
+    run(opt);
+    if stats {
+        print_stats();
+    }
+}
+
+fn run(opt: Opt) {
+    assert!(opt.threads > 0, "--threads must be positive");
+    assert!(opt.raw || !opt.slim, "--slim requires --raw");
+    assert!(
+        opt.key || opt.spill_keys.is_none(),
+        "--spill-keys requires --key"
+    );
+    assert!(opt.spill_keys != Some(0), "--spill-keys must be positive");
+    assert!(opt.key || opt.top.is_none(), "--top requires --key");
+    assert!(
+        !opt.raw || opt.top.is_none(),
+        "--top and --raw cannot be set simultaneously"
+    );
+    assert!(
+        opt.raw || opt.merge || opt.contains.is_some() || opt.format != Format::Binary,
+        "--format binary requires --raw, --merge or --contains"
+    );
+    assert!(
+        opt.window.is_some() || opt.p == 1.0,
+        "--p requires --window"
+    );
+    assert!(opt.key || !opt.hash_keys, "--hash-keys requires --key");
+    assert!(
+        opt.hash_keys || opt.key_sample.is_none(),
+        "--key-sample requires --hash-keys"
+    );
+    assert!(
+        opt.key_sample.is_none() || !opt.raw && opt.top.is_none(),
+        "--key-sample cannot be combined with --raw or --top"
+    );
+    assert!(opt.key_sample != Some(0), "--key-sample must be positive");
+    assert!(
+        !opt.sorted || (opt.key && opt.merge),
+        "--sorted requires --key and --merge"
+    );
+    assert!(
+        !opt.sorted || opt.threads == 1 || opt.format != Format::Binary,
+        "--threads and --sorted --format binary cannot be set simultaneously"
+    );
+    if opt.key_field.is_some() {
+        assert!(
+            opt.key
+                && opt.window.is_none()
+                && opt.all.is_none()
+                && opt.hh.is_none()
+                && opt.sample.is_none()
+                && opt.bloom.is_none()
+                && opt.contains.is_none()
+                && opt.sum.is_none(),
+            "--key-field requires --key and only applies to distinct counts"
+        );
+        assert!(
+            !opt.merge,
+            "--merge and --key-field cannot be set simultaneously"
+        );
+        assert!(
+            opt.store.is_none(),
+            "--store and --key-field cannot be set simultaneously"
+        );
+        assert!(
+            opt.key_field != Some(0) && opt.value_field != 0,
+            "fields are counted from 1"
+        );
+        assert!(opt.delimiter.is_ascii(), "--delimiter must be ASCII");
+    }
+    if opt.checkpoint.is_some() {
+        assert!(
+            opt.window.is_none()
+                && opt.all.is_none()
+                && opt.hh.is_none()
+                && opt.sample.is_none()
+                && opt.bloom.is_none()
+                && opt.contains.is_none()
+                && opt.sum.is_none(),
+            "--checkpoint only applies to distinct counts"
+        );
+        assert!(
+            opt.threads == 1,
+            "--threads and --checkpoint cannot be set simultaneously"
+        );
+        assert!(
+            !opt.merge,
+            "--merge and --checkpoint cannot be set simultaneously"
+        );
+        assert!(
+            opt.spill_keys.is_none(),
+            "--spill-keys and --checkpoint cannot be set simultaneously"
+        );
+        assert!(
+            !opt.hash_keys,
+            "--hash-keys and --checkpoint cannot be set simultaneously"
+        );
+        assert!(
+            opt.store.is_none(),
+            "--store and --checkpoint cannot be set simultaneously"
+        );
+        assert!(
+            opt.segments.is_none(),
+            "--segments and --checkpoint cannot be set simultaneously"
+        );
+    }
+    assert!(
+        opt.checkpoint_bytes > 0,
+        "--checkpoint-bytes must be positive"
+    );
+    if opt.store.is_some() {
+        assert!(cfg!(unix), "--store is only available on unix");
+        assert!(
+            opt.key && opt.algo == Algo::Hll,
+            "--store requires --key and --algo hll"
+        );
+        assert!(
+            opt.threads == 1,
+            "--threads and --store cannot be set simultaneously"
+        );
+        assert!(
+            !opt.sorted,
+            "--sorted and --store cannot be set simultaneously"
+        );
+        assert!(
+            opt.spill_keys.is_none(),
+            "--spill-keys and --store cannot be set simultaneously"
+        );
+        assert!(
+            !opt.hash_keys,
+            "--hash-keys and --store cannot be set simultaneously"
+        );
+    }
+    if opt.keys.is_some() || opt.key_prefix.is_some() {
+        assert!(
+            opt.key
+                && opt.merge
+                && opt.window.is_none()
+                && opt.all.is_none()
+                && opt.hh.is_none()
+                && opt.sample.is_none()
+                && opt.bloom.is_none()
+                && opt.sum.is_none(),
+            "--keys and --key-prefix require --key --merge and only apply to distinct counts"
+        );
+        assert!(
+            opt.store.is_none() && opt.segments.is_none(),
+            "--keys and --key-prefix cannot be combined with --store or --segments"
+        );
+    }
+    if opt.format == Format::Arrow {
+        assert!(
+            opt.key
+                && opt.raw
+                && opt.window.is_none()
+                && opt.all.is_none()
+                && opt.hh.is_none()
+                && opt.sample.is_none()
+                && opt.bloom.is_none()
+                && opt.sum.is_none(),
+            "--format arrow requires --key --raw and only applies to distinct counts"
+        );
+    }
+    if opt.shared_theta.is_some() {
+        assert!(
+            opt.key
+                && opt.window.is_none()
+                && opt.all.is_none()
+                && opt.hh.is_none()
+                && opt.sample.is_none()
+                && opt.bloom.is_none()
+                && opt.contains.is_none()
+                && opt.sum.is_none(),
+            "--shared-theta requires --key and only applies to distinct counts"
+        );
+        assert!(
+            !opt.merge && !opt.raw,
+            "--shared-theta cannot be combined with --merge or --raw"
+        );
+        assert!(
+            opt.algo == Algo::default() && opt.lg_k == DEFAULT_LG_K,
+            "--algo and --lg-k do not apply to --shared-theta"
+        );
+        assert!(
+            opt.spill_keys.is_none()
+                && !opt.hash_keys
+                && opt.store.is_none()
+                && opt.segments.is_none()
+                && opt.checkpoint.is_none(),
+            "--shared-theta cannot be combined with --spill-keys, --hash-keys, --store, --segments or --checkpoint"
+        );
+    }
+    if opt.segments.is_some() {
+        assert!(cfg!(unix), "--segments is only available on unix");
+        assert!(
+            opt.key
+                && opt.window.is_none()
+                && opt.all.is_none()
+                && opt.hh.is_none()
+                && opt.sample.is_none()
+                && opt.bloom.is_none()
+                && opt.contains.is_none()
+                && opt.sum.is_none(),
+            "--segments requires --key and only applies to distinct counts"
+        );
+        assert!(
+            opt.store.is_none(),
+            "--store and --segments cannot be set simultaneously"
+        );
+        assert!(
+            !opt.sorted,
+            "--sorted and --segments cannot be set simultaneously"
+        );
+        assert!(
+            opt.spill_keys.is_none(),
+            "--spill-keys and --segments cannot be set simultaneously"
+        );
+        assert!(
+            !opt.hash_keys,
+            "--hash-keys and --segments cannot be set simultaneously"
+        );
+    }
+
+    if opt.serve.is_some() {
+        assert!(
+            !opt.key
+                && opt.key_field.is_none()
+                && !opt.raw
+                && !opt.merge
+                && opt.input.is_empty()
+                && opt.threads == 1
+                && !opt.numa
+                && opt.spill_keys.is_none()
+                && opt.top.is_none()
+                && !opt.hash_keys
+                && opt.store.is_none()
+                && opt.segments.is_none()
+                && opt.checkpoint.is_none()
+                && opt.sum.is_none()
+                && opt.hh.is_none()
+                && opt.all.is_none()
+                && opt.sample.is_none()
+                && opt.bloom.is_none()
+                && opt.contains.is_none()
+                && opt.window.is_none(),
+            "--serve can only be combined with --algo, --lg-k and --hugepages"
+        );
+    }
+
+    if opt.numa {
+        numa::enable();
+    }
+    if opt.hugepages {
+        set_huge_pages(true);
+    }
+    if opt.threads > 1 && opt.algo == Algo::Cpc {
+        // so that no worker waits on another making the decoding tables
+        CpcSketch::init();
+    }
+
+    if opt.bloom.is_some() || opt.contains.is_some() {
+        assert!(
+            opt.bloom.is_none() || opt.contains.is_none(),
+            "--bloom and --contains cannot be set simultaneously"
+        );
+        assert!(
+            opt.window.is_none()
+                && opt.all.is_none()
+                && opt.hh.is_none()
+                && opt.sample.is_none()
+                && opt.sum.is_none(),
+            "--bloom and --contains cannot be combined with other modes"
+        );
+        assert!(
+            opt.algo == Algo::default() && opt.lg_k == DEFAULT_LG_K,
+            "--algo and --lg-k do not apply to --bloom or --contains"
+        );
+        assert!(
+            !opt.slim && !opt.sorted && opt.top.is_none() && !opt.hash_keys,
+            "--slim, --sorted, --top and --hash-keys do not apply to --bloom or --contains"
+        );
+    }
+
+    if let Some(path) = &opt.contains {
+        assert!(
+            !opt.raw,
+            "--raw and --contains cannot be set simultaneously"
+        );
+        assert!(
+            !opt.merge,
+            "--merge and --contains cannot be set simultaneously"
+        );
+        assert!(
+            opt.threads == 1,
+            "--threads and --contains cannot be set simultaneously"
+        );
+        let filter = read_bloom_filter(path, opt.format);
+        let stdout = io::stdout();
+        let mut probe = BloomProbe::new(filter, io::BufWriter::new(stdout.lock()));
+        if opt.key {
+            probe = probe.keyed();
+        }
+        let probe = match single_input(&opt) {
+            Some(path) => {
+                let file = File::open(path)
+                    .unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+                reduce_stream(io::BufReader::new(file), probe)
+            }
+            None => with_stdin(|stdin| reduce_stream(stdin, probe)),
+        };
+        probe
+            .expect("no io error")
+            .into_inner()
+            .flush()
+            .expect("no io error");
+        return;
+    }
+
+    if let Some(n) = opt.bloom {
+        assert!(
+            !opt.key || !opt.merge,
+            "--key and --bloom --merge cannot be set simultaneously"
+        );
+        let reduced = if !opt.merge {
+            let builder = BloomBuilder::new(n);
+            reduce(&opt, if opt.key { builder.keyed() } else { builder })
+        } else if opt.format == Format::Binary {
+            reduce_frames(&opt, 1, BloomMerger::new(n), |mrgr, record| {
+                mrgr.merge_serialized(record[0])
+                    .expect("properly deserialized Bloom filter of the same size")
+            })
+            .into_builder()
+        } else {
+            reduce(&opt, BloomMerger::new(n)).into_builder()
+        };
+        let stdout = io::stdout();
+        let mut out = io::BufWriter::new(stdout.lock());
+        if opt.raw && opt.format == Format::Binary {
+            reduced.write_frame(&mut out).expect("no io error");
+        } else if opt.raw {
+            writeln!(out, "{}", reduced.serialize()).expect("no io error");
+        } else {
+            writeln!(out, "{}", reduced.filter().estimate().round()).expect("no io error");
+        }
+        out.flush().expect("no io error");
+        return;
+    }
+
+    if let Some(n) = opt.window {
+        assert!(
+            opt.hh.is_none(),
+            "--hh and --window cannot be set simultaneously"
+        );
+        assert!(
+            opt.all.is_none(),
+            "--all and --window cannot be set simultaneously"
+        );
+        assert!(
+            opt.sample.is_none(),
+            "--sample and --window cannot be set simultaneously"
+        );
+        assert!(
+            opt.sum.is_none(),
+            "--sum and --window cannot be set simultaneously"
+        );
+        assert!(!opt.key, "--key and --window cannot be set simultaneously");
+        assert!(!opt.raw, "--raw and --window cannot be set simultaneously");
+        assert!(
+            !opt.merge,
+            "--merge and --window cannot be set simultaneously"
+        );
+        assert!(
+            opt.algo == Algo::default(),
+            "--algo and --window cannot be set simultaneously"
+        );
+        assert!(
+            opt.threads == 1,
+            "--threads and --window cannot be set simultaneously"
+        );
+        assert!(n > 0, "--window must be positive");
+        assert!(
+            (5..=26).contains(&opt.lg_k),
+            "--lg-k must be in 5..=26 for --window"
+        );
+        assert!(opt.p > 0.0 && opt.p <= 1.0, "--p must be in (0, 1]");
+        let stdout = io::stdout();
+        // stdout is line buffered, so each count is printed as its slice ends
+        let mut out = stdout.lock();
+        let print = |slice, estimate: f64| {
+            writeln!(out, "{} {}", slice, estimate.round()).expect("no io error")
+        };
+        let window = WindowCounter::with_p(opt.lg_k, opt.p, n, print);
+        let window = match single_input(&opt) {
+            Some(path) => {
+                let file = File::open(path)
+                    .unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+                reduce_stream(io::BufReader::new(file), window)
+            }
+            None => reduce_stream(io::stdin().lock(), window),
+        };
+        window.expect("no io error").finish();
+        return;
+    }
+
+    if let Some(k) = opt.all {
+        assert!(
+            opt.hh.is_none(),
+            "--hh and --all cannot be set simultaneously"
+        );
+        assert!(
+            opt.sample.is_none(),
+            "--sample and --all cannot be set simultaneously"
+        );
+        assert!(
+            opt.sum.is_none(),
+            "--sum and --all cannot be set simultaneously"
+        );
+        assert!(!opt.key, "--key and --all cannot be set simultaneously");
+        assert!(!opt.raw, "--raw and --all cannot be set simultaneously");
+        assert!(!opt.merge, "--merge and --all cannot be set simultaneously");
+        assert!(
+            opt.algo == Algo::default(),
+            "--algo and --all cannot be set simultaneously"
+        );
+        assert!(
+            Algo::Cpc.lg_k_range().contains(&opt.lg_k),
+            "--lg-k must be in {:?} for --all",
+            Algo::Cpc.lg_k_range()
+        );
+        assert!(k > 0, "--all must be positive");
+        let reduced = reduce(&opt, LineStats::new(opt.lg_k, k));
+        let stdout = io::stdout();
+        let mut out = io::BufWriter::new(stdout.lock());
+        writeln!(out, "distinct {}", reduced.estimate().round()).expect("no io error");
+        write!(out, "lengths").expect("no io error");
+        let lengths = reduced
+            .lengths()
+            .quantiles(&[0.0, 0.5, 0.9, 0.99, 1.0])
+            .expect("valid fractions");
+        for length in lengths {
+            write!(out, " {}", length).expect("no io error");
+        }
+        writeln!(out).expect("no io error");
+        for (line, count) in reduced.heavy_hitters() {
+            let line = str::from_utf8(line).expect("valid UTF-8");
+            writeln!(out, "top {} {}", count, line).expect("no io error");
+        }
+        out.flush().expect("no io error");
+        return;
+    }
+
+    if let Some(k) = opt.hh {
+        assert!(!opt.slim, "--slim and --hh cannot be set simultaneously");
+        assert!(
+            opt.sample.is_none(),
+            "--sample and --hh cannot be set simultaneously"
+        );
+        assert!(
+            opt.algo == Algo::default(),
+            "--algo and --hh cannot be set simultaneously"
+        );
+        assert!(
+            opt.lg_k == DEFAULT_LG_K,
+            "--lg-k and --hh cannot be set simultaneously"
+        );
+        if k == 0 {
+            return;
+        }
+        if opt.key {
+            assert!(
+                !opt.raw,
+                "--raw and --hh --key cannot be set simultaneously"
+            );
+            assert!(
+                !opt.merge,
+                "--merge and --hh --key cannot be set simultaneously"
+            );
+            let reduced = reduce_keyed(&opt, KeyedHeavyHitter::new(k));
+            let stdout = io::stdout();
+            let mut out = io::BufWriter::new(stdout.lock());
+            for (key, top) in reduced.state() {
+                let key = str::from_utf8(key).expect("valid UTF-8");
+                for (line, count) in top {
+                    let line = str::from_utf8(line).expect("valid UTF-8");
+                    writeln!(out, "{} {} {}", key, count, line).expect("no io error");
+                }
+            }
+            out.flush().expect("no io error");
+            return;
+        }
+        let reduced = if !opt.merge {
+            reduce(&opt, HeavyHitter::new(k))
+        } else if opt.format == Format::Binary {
+            reduce_frames(&opt, 1, HeavyHitterMerger::new(k), |mrgr, record| {
+                mrgr.merge_serialized(record[0])
+                    .expect("properly deserialized heavy hitter")
+            })
+            .into_heavy_hitter()
+        } else {
+            reduce(&opt, HeavyHitterMerger::new(k)).into_heavy_hitter()
+        };
+        let stdout = io::stdout();
+        let mut out = io::BufWriter::new(stdout.lock());
+        if opt.raw && opt.format == Format::Binary {
+            reduced.write_frame(&mut out).expect("no io error");
+        } else if opt.raw {
+            writeln!(out, "{}", reduced.serialize()).expect("no io error");
+        } else {
+            for (line, count) in reduced.estimate() {
+                let line = str::from_utf8(line).expect("valid UTF-8");
+                writeln!(out, "{} {}", count, line).expect("no io error");
+            }
+        }
+        out.flush().expect("no io error");
+        return;
+    }
+
+    if let Some(k) = opt.sample {
+        assert!(
+            opt.hh.is_none(),
+            "--hh and --sample cannot be set simultaneously"
+        );
+        assert!(!opt.raw, "--raw and --sample cannot be set simultaneously");
+        assert!(
+            !opt.merge,
+            "--merge and --sample cannot be set simultaneously"
+        );
+        assert!(
+            opt.algo == Algo::default(),
+            "--algo and --sample cannot be set simultaneously"
+        );
+        assert!(
+            opt.lg_k == DEFAULT_LG_K,
+            "--lg-k and --sample cannot be set simultaneously"
+        );
+        assert!(
+            opt.sum.is_none(),
+            "--sum and --sample cannot be set simultaneously"
+        );
+        if k == 0 {
+            return;
+        }
+        let reduced = reduce(&opt, Sampler::new(k));
+        let sketch = reduced.sketch();
+        if opt.key {
+            // every key's lines are summed in one pass over the sample
+            let first_word = |line: &[u8]| line.split(|&c| c == b' ').next().expect("a word");
+            let mut keys = Vec::new();
+            let mut index = HashMap::new();
+            for (line, _) in sketch.samples() {
+                index.entry(first_word(line)).or_insert_with(|| {
+                    keys.push(first_word(line));
+                    keys.len() - 1
+                });
+            }
+            let sums = sketch
+                .estimate_subset_sums(keys.len(), |line| index.get(first_word(line)).copied());
+            for (key, sum) in keys.into_iter().zip(sums) {
+                println!(
+                    "{} {} {} {}",
+                    str::from_utf8(key).expect("valid UTF-8"),
+                    sum.estimate.round(),
+                    sum.lower_bound.round(),
+                    sum.upper_bound.round()
+                );
+            }
+            return;
+        }
+        for (line, weight) in sketch.samples() {
+            println!("{} {}", weight, str::from_utf8(line).expect("valid UTF-8"));
+        }
+        return;
+    }
+
+    if let Some(n) = opt.sum {
+        assert!(
+            opt.hh.is_none(),
+            "--hh and --sum cannot be set simultaneously"
+        );
+        assert!(!opt.raw, "--raw and --sum cannot be set simultaneously");
+        assert!(!opt.merge, "--merge and --sum cannot be set simultaneously");
+        assert!(
+            opt.algo == Algo::default(),
+            "--algo and --sum cannot be set simultaneously"
+        );
+        assert!(
+            opt.lg_k == DEFAULT_LG_K,
+            "--lg-k and --sum cannot be set simultaneously"
+        );
+        assert!(n > 0, "--sum must be positive");
+        assert!(
+            !opt.hash_keys,
+            "--hash-keys and --sum cannot be set simultaneously"
+        );
+        assert!(
+            opt.spill_keys.is_none(),
+            "--spill-keys and --sum cannot be set simultaneously"
+        );
+        if opt.key {
+            let reduced = reduce_keyed(&opt, KeyedSummer::new(n));
+            for (key, summer) in reduced.state() {
+                print!("{} ", str::from_utf8(key).expect("valid UTF-8"));
+                print_sums(&summer.sketch());
+            }
+        } else {
+            // at most one distinct value per line, so a file's lines bound
+            // how large the sketch's table gets
+            let summer = if opt.input.is_empty() {
+                Summer::new(n)
+            } else {
+                let lines = opt.input.iter().map(|path| expected_lines(path)).sum();
+                Summer::with_expected_n(n, lines)
+            };
+            print_sums(&reduce(&opt, summer).sketch());
+        }
+        return;
+    }
+
+    assert!(
+        opt.algo.lg_k_range().contains(&opt.lg_k),
+        "--lg-k must be in {:?} for --algo {:?}",
+        opt.algo.lg_k_range(),
+        opt.algo
+    );
+    if let Some(addr) = &opt.serve {
+        serve(addr, opt.algo, opt.lg_k);
+    }
+    let stdout = io::stdout();
+    let mut out = io::BufWriter::new(stdout.lock());
+    let binary = opt.format == Format::Binary;
+    assert!(
+        !opt.merge || opt.spill_keys.is_none(),
+        "--spill-keys and --merge cannot be set simultaneously"
+    );
+    assert!(
+        !opt.merge || !opt.hash_keys,
+        "--hash-keys and --merge cannot be set simultaneously"
+    );
+    assert!(
+        !opt.hash_keys || opt.spill_keys.is_none(),
+        "--hash-keys and --spill-keys cannot be set simultaneously"
+    );
+    match (opt.key, opt.merge) {
+        #[cfg(unix)]
+        (true, _) if opt.store.is_some() => {
+            let path = opt.store.as_ref().expect("--store set");
+            let store = HllStore::open(path, opt.lg_k)
+                .unwrap_or_else(|e| panic!("cannot open store {}: {}", path.display(), e));
+            let stored = StoredKeyedCounter::new(store, opt.merge);
+            let mut stored = reduce_in_order(&opt, stored, |stored, key, sketch| {
+                stored
+                    .merge_serialized(key, sketch)
+                    .expect("properly deserialized counter")
+            });
+            stored.flush().expect("no io error");
+            let mut top = opt.top.map(TopKeys::new);
+            let mut lines = raw_lines(&opt, 1);
+            stored.for_each_updated(|key, ctr| match &mut top {
+                Some(top) => top.offer(key, ctr),
+                None => print_key(&mut out, &mut lines, key, ctr, &opt),
+            });
+            lines.finish(&mut out).expect("no io error");
+            if let Some(top) = top {
+                print_top(&mut out, top);
+            }
+        }
+        #[cfg(unix)]
+        (true, merge) if opt.segments.is_some() => {
+            let dir = opt.segments.as_ref().expect("--segments set");
+            let mut store = SegmentStore::open(dir, opt.algo, opt.lg_k)
+                .unwrap_or_else(|e| panic!("cannot open segments {}: {}", dir.display(), e));
+            let mut records: Vec<(Vec<u8>, Vec<u8>)> = Vec::new();
+            let mut push = |key: &[u8], ctr: &Counter| {
+                let mut sketch = Vec::new();
+                ctr.append_serialized(&mut sketch, true);
+                records.push((key.to_vec(), sketch));
+            };
+            if merge {
+                let mrgr = KeyedMerger::new(opt.algo, opt.lg_k);
+                let reduced = if binary {
+                    reduce_frames(&opt, 2, mrgr, |mrgr, record| {
+                        mrgr.merge_serialized(record[0], record[1])
+                            .expect("properly deserialized counter")
+                    })
+                } else {
+                    reduce_keyed(&opt, mrgr)
+                };
+                reduced.state().for_each(|(key, ctr)| push(key, &ctr));
+            } else {
+                let reduced = reduce_key_values(&opt, KeyedCounter::new(opt.algo, opt.lg_k));
+                reduced.state().for_each(|(key, ctr)| push(key, ctr));
+            }
+            store.append(&mut records).expect("no io error");
+            let mut top = opt.top.map(TopKeys::new);
+            let mut lines = raw_lines(&opt, 1);
+            // appending sorted the run's keys
+            let mut run_keys = records.iter().map(|(key, _)| key.as_slice()).peekable();
+            if let (Some(first), Some(last)) = (records.first(), records.last()) {
+                store
+                    .range(first.0.as_slice()..=last.0.as_slice(), |key, ctr| {
+                        while run_keys.next_if(|&run_key| run_key < key).is_some() {}
+                        if run_keys.next_if_eq(&key).is_none() {
+                            return;
+                        }
+                        match &mut top {
+                            Some(top) => top.offer(key, &ctr),
+                            None => print_key(&mut out, &mut lines, key, &ctr, &opt),
+                        }
+                    })
+                    .expect("no io error");
+            }
+            lines.finish(&mut out).expect("no io error");
+            if let Some(top) = top {
+                print_top(&mut out, top);
+            }
+        }
+        (true, false) if opt.shared_theta.is_some() => {
+            let lg_k = opt.shared_theta.expect("--shared-theta set");
+            assert!((5..=26).contains(&lg_k), "--shared-theta must be in 5..=26");
+            let reduced = reduce_key_values(&opt, SharedThetaKeyedCounter::new(lg_k));
+            let mut top = opt.top.map(TopKeys::new);
+            for (key, estimate) in reduced.estimates() {
+                match &mut top {
+                    Some(top) => top.offer_estimate(key, estimate),
+                    None => {
+                        let as_str = str::from_utf8(key).expect("valid UTF-8");
+                        writeln!(out, "{} {}", as_str, estimate.round()).expect("no io error");
+                    }
+                }
+            }
+            if let Some(top) = top {
+                print_top(&mut out, top);
+            }
+        }
+        (true, false) if opt.hash_keys => {
+            let ctr = HashedKeyedCounter::new(opt.algo, opt.lg_k)
+                .with_dictionary(opt.key_sample.unwrap_or(0));
+            let mut top = opt.top.map(TopKeys::new);
+            let mut lines = raw_lines(&opt, opt.threads);
+            let reduced = reduce_key_values(&opt, ctr);
+            if top.is_none() && opt.raw {
+                // --key-sample cannot be set with --raw, so no keys are kept
+                let keyed = reduced
+                    .state()
+                    .map(|(hash, _, ctr)| (format!("{:016x}", hash), ctr));
+                print_keys(&mut out, &mut lines, keyed, &opt);
+            } else {
+                for (hash, key, ctr) in reduced.state() {
+                    let hex = format!("{:016x}", hash);
+                    match (&mut top, key) {
+                        (Some(top), _) => top.offer(hex.as_bytes(), ctr),
+                        (None, Some(key)) => {
+                            let key = str::from_utf8(key).expect("valid UTF-8");
+                            writeln!(out, "{} {} {}", hex, ctr.estimate().round(), key)
+                                .expect("no io error");
+                        }
+                        (None, None) => print_key(&mut out, &mut lines, hex.as_bytes(), ctr, &opt),
+                    }
+                }
+            }
+            lines.finish(&mut out).expect("no io error");
+            if let Some(top) = top {
+                print_top(&mut out, top);
+            }
+        }
+        (true, true) if opt.sorted => {
+            let mut top = opt.top.map(TopKeys::new);
+            let mut lines = raw_lines(&opt, 1);
+            let filter = key_filter(&opt);
+            let mrgr = SortedKeyedMerger::new(opt.algo, opt.lg_k, |key, ctr| match &mut top {
+                Some(top) => top.offer(key, &ctr),
+                None => print_key(&mut out, &mut lines, key, &ctr, &opt),
+            });
+            let mrgr = match (binary, filter) {
+                (true, filter) => reduce_in_order(&opt, mrgr, |mrgr, key, sketch| {
+                    if filter.as_ref().map_or(true, |filter| filter.matches(key)) {
+                        mrgr.merge_serialized(key, sketch)
+                            .expect("properly deserialized counter")
+                    }
+                }),
+                (false, Some(filter)) => {
+                    let filtered = KeyFiltered::new(filter, mrgr);
+                    reduce_stream_pipelined(in_order_input(&opt), filtered, opt.threads)
+                        .expect("no io error")
+                        .into_inner()
+                }
+                (false, None) => reduce_stream_pipelined(in_order_input(&opt), mrgr, opt.threads)
+                    .expect("no io error"),
+            };
+            mrgr.finish();
+            lines.finish(&mut out).expect("no io error");
+            if let Some(top) = top {
+                print_top(&mut out, top);
+            }
+        }
+        (true, false) => {
+            let mut ctr = KeyedCounter::new(opt.algo, opt.lg_k);
+            if let Some(n) = opt.spill_keys {
+                ctr = ctr.spilling(n);
+            }
+            let reduced = match (&opt.checkpoint, field_selector(&opt)) {
+                (Some(path), Some(selector)) => {
+                    reduce_checkpointed(&opt, Fields::new(selector, ctr), path).into_inner()
+                }
+                (Some(path), None) => reduce_checkpointed(&opt, ctr, path),
+                (None, _) => reduce_key_values(&opt, ctr),
+            };
+            let mut top = opt.top.map(TopKeys::new);
+            let mut lines = raw_lines(&opt, opt.threads);
+            if top.is_none() && !reduced.has_spilled() {
+                print_keys(&mut out, &mut lines, reduced.state(), &opt);
+            } else {
+                reduced
+                    .for_each_key(|key, ctr| match &mut top {
+                        Some(top) => top.offer(key, ctr),
+                        None => print_key(&mut out, &mut lines, key, ctr, &opt),
+                    })
+                    .expect("no io error");
+            }
+            lines.finish(&mut out).expect("no io error");
+            if let Some(top) = top {
+                print_top(&mut out, top);
+            }
+        }
+        (false, false) => {
+            let ctr = Counter::new(opt.algo, opt.lg_k);
+            let reduced = match &opt.checkpoint {
+                Some(path) => reduce_checkpointed(&opt, ctr, path),
+                None => reduce(&opt, ctr),
+            };
+            print_single(&mut out, &reduced, &opt);
+        }
+        (true, true) => {
+            let mrgr = KeyedMerger::new(opt.algo, opt.lg_k);
+            let filter = key_filter(&opt);
+            let reduced = match (binary, filter) {
+                (true, filter) => reduce_frames(&opt, 2, mrgr, |mrgr, record| {
+                    if filter
+                        .as_ref()
+                        .map_or(true, |filter| filter.matches(record[0]))
+                    {
+                        mrgr.merge_serialized(record[0], record[1])
+                            .expect("properly deserialized counter")
+                    }
+                }),
+                (false, Some(filter)) => {
+                    reduce_keyed(&opt, KeyFiltered::new(filter, mrgr)).into_inner()
+                }
+                (false, None) => reduce_keyed(&opt, mrgr),
+            };
+            let mut top = opt.top.map(TopKeys::new);
+            let mut lines = raw_lines(&opt, opt.threads);
+            match &mut top {
+                Some(top) => reduced.state().for_each(|(key, ctr)| top.offer(key, &ctr)),
+                None => print_keys(&mut out, &mut lines, reduced.state(), &opt),
+            }
+            lines.finish(&mut out).expect("no io error");
+            if let Some(top) = top {
+                print_top(&mut out, top);
+            }
+        }
+        (false, true) => {
+            let mrgr = Merger::new(opt.algo, opt.lg_k);
+            let reduced = if binary {
+                reduce_frames(&opt, 1, mrgr, |mrgr, record| {
+                    mrgr.merge_serialized(record[0])
+                        .expect("properly deserialized counter")
+                })
+            } else {
+                reduce(&opt, mrgr)
+            };
+            print_single(&mut out, &reduced.counter(), &opt)
+        }
+    }
+    out.flush().expect("no io error");
+}
+
+/// Serves keyed counts on `addr` for `--serve`, until accepting a
+/// connection fails.
+fn serve(addr: &str, algo: Algo, lg_k: u8) -> ! {
+    let threads = thread::available_parallelism().map_or(1, |n| n.get());
+    let server = Arc::new(Server::new(algo, lg_k, threads));
+    let e = match addr.strip_prefix("unix:") {
+        #[cfg(unix)]
+        Some(path) => {
+            let listener =
+                UnixListener::bind(path).unwrap_or_else(|e| panic!("cannot bind {}: {}", path, e));
+            server.serve_unix(listener)
+        }
+        #[cfg(not(unix))]
+        Some(_) => panic!("unix: sockets are only available on unix"),
+        None => {
+            let listener =
+                TcpListener::bind(addr).unwrap_or_else(|e| panic!("cannot bind {}: {}", addr, e));
+            // so that a client of port 0 finds the one picked
+            println!("{}", listener.local_addr().expect("bound address"));
+            server.serve_tcp(listener)
+        }
+    };
+    panic!("cannot accept connections: {}", e)
+}
+
+/// Reduces the records of frames in `--input` if given, or else in
+/// stdin, which is read into memory first.
+fn reduce_frames<T, F>(opt: &Opt, record_frames: usize, reducer: T, read_record: F) -> T
+where
+    T: ParallelLineReducer,
+    F: Fn(&mut T, &[&[u8]]) + Sync,
+{
+    let reduce = |data: &[u8]| {
+        reduce_frames_parallel(data, record_frames, reducer, opt.threads, read_record)
+    };
+    match single_input(opt) {
+        Some(path) => {
+            #[cfg(unix)]
+            let data = {
+                let file = File::open(path)
+                    .unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+                // dsrs only reads the file, and documents that it must not change
+                unsafe { MappedFile::map(&file) }.expect("no io error")
+            };
+            #[cfg(not(unix))]
+            let data = std::fs::read(path)
+                .unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+            reduce(&data[..])
+        }
+        None => {
+            let mut data = Vec::new();
+            io::stdin()
+                .lock()
+                .read_to_end(&mut data)
+                .expect("no io error");
+            reduce(&data[..])
+        }
+    }
+}
+
+/// Reduces the lines of `--input` if given, or else of stdin, in order on
+/// this thread, or with `--merge --format binary` hands its records of a
+/// key frame and a sketch frame to `merge_record`.
+fn reduce_in_order<T, F>(opt: &Opt, mut reducer: T, merge_record: F) -> T
+where
+    T: LineReducer,
+    F: Fn(&mut T, &[u8], &[u8]),
+{
+    let mut input = in_order_input(opt);
+    if !opt.merge || opt.format != Format::Binary {
+        return reduce_stream(input, reducer).expect("no io error");
+    }
+    let (mut key, mut sketch) = (Vec::new(), Vec::new());
+    while read_frame(&mut input, &mut key).expect("no io error") {
+        assert!(
+            read_frame(&mut input, &mut sketch).expect("no io error"),
+            "key frame without a sketch frame"
+        );
+        merge_record(&mut reducer, &key, &sketch);
+    }
+    reducer
+}
+
+/// Returns the one `--input`, if given, or else stdin, for reading in
+/// order.
+fn in_order_input(opt: &Opt) -> Box<dyn io::BufRead> {
+    match single_input(opt) {
+        Some(path) => {
+            let file = File::open(path)
+                .unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+            Box::new(io::BufReader::new(file))
+        }
+        None => Box::new(io::stdin().lock()),
+    }
+}
+
+/// Reduces the lines of `--input` if given, or else of stdin, on this
+/// thread, checkpointing to `path` as `--checkpoint` describes. Its
+/// checkpoints only resume a run reading the same file, by its full path
+/// and length, or else stdin again.
+fn reduce_checkpointed<T: Checkpoint>(opt: &Opt, line_reader: T, path: &Path) -> T {
+    let every = opt.checkpoint_bytes;
+    let reduced = match single_input(opt) {
+        Some(input) => {
+            let file = File::open(input)
+                .unwrap_or_else(|e| panic!("cannot open {}: {}", input.display(), e));
+            let full_path = std::fs::canonicalize(input).expect("opened path");
+            let len = file.metadata().expect("no io error").len();
+            let identity = format!("{} {}", full_path.display(), len);
+            let stream = io::BufReader::new(file);
+            reduce_stream_checkpointed(stream, line_reader, path, identity.as_bytes(), every)
+        }
+        None => reduce_stream_checkpointed(io::stdin().lock(), line_reader, path, b"-", every),
+    };
+    reduced.unwrap_or_else(|e| panic!("checkpoint {}: {}", path.display(), e))
+}
+
+/// Reads the filter of `dsrs --bloom n --raw` from `path`, a base64 line
+/// or, with `--format binary`, a frame.
+fn read_bloom_filter(path: &Path, format: Format) -> BloomFilter {
+    let mut file =
+        File::open(path).unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+    let filter = match format {
+        Format::Text => {
+            let mut line = String::new();
+            file.read_to_string(&mut line).expect("no io error");
+            BloomBuilder::deserialize(line.trim_end())
+        }
+        Format::Binary => {
+            let mut frame = Vec::new();
+            read_frame(&mut file, &mut frame).expect("no io error");
+            BloomFilter::deserialize(&frame)
+        }
+        Format::Arrow => unreachable!("--format arrow is only written"),
+    };
+    filter.unwrap_or_else(|e| panic!("bad Bloom filter in {}: {}", path.display(), e))
+}
+
+/// Returns the one `--input`, if any, for reading in order.
+fn single_input(opt: &Opt) -> Option<&Path> {
+    assert!(
+        opt.input.len() <= 1,
+        "only one --input can be read in order"
+    );
+    opt.input.first().map(PathBuf::as_path)
+}
+
+/// Calls `f` with the lines of stdin, decompressed on another thread if
+/// they are compressed.
+fn with_stdin<T>(f: impl FnOnce(&mut dyn io::BufRead) -> T) -> T {
+    let stdin = io::stdin();
+    let magic = stdin.lock().fill_buf().expect("no io error").to_vec();
+    match Compression::detect(&magic) {
+        Some(compression) => decompress_stream(stdin, compression, |mut lines| f(&mut lines)),
+        None => f(&mut stdin.lock()),
+    }
+}
+
+/// Reduces the lines of `--input` if given, or else of stdin.
+fn reduce<T: ParallelLineReducer>(opt: &Opt, line_reader: T) -> T {
+    match &opt.input[..] {
+        [] => with_stdin(|stdin| reduce_stream_parallel(stdin, line_reader, opt.threads))
+            .expect("no io error"),
+        [path] => {
+            let file = File::open(path)
+                .unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+            reduce_file(&file, line_reader, opt.threads)
+        }
+        paths => reduce_files_parallel(paths, line_reader, opt.threads)
+            .unwrap_or_else(|e| panic!("cannot read {}", e)),
+    }
+}
+
+/// Estimates the number of lines of the file at `path` as its length over
+/// the average length of the lines in its first few kilobytes. Returns 0
+/// if the file cannot be read, leaving the error to whatever reads it
+/// next.
+fn expected_lines(path: &Path) -> u64 {
+    const SAMPLE_BYTES: u64 = 64 * 1024;
+    let file = match File::open(path) {
+        Ok(file) => file,
+        Err(_) => return 0,
+    };
+    let len = file.metadata().map_or(0, |metadata| metadata.len());
+    let mut sample = Vec::new();
+    if file.take(SAMPLE_BYTES).read_to_end(&mut sample).is_err() || sample.is_empty() {
+        return 0;
+    }
+    // a sample without a newline is part of a single line
+    let lines = sample.iter().filter(|&&c| c == b'\n').count().max(1);
+    (u128::from(len) * lines as u128 / sample.len() as u128) as u64
+}
+
+/// Like [`reduce`], but for keyed reducers, whose keys are each reduced
+/// by one thread for each file.
+fn reduce_keyed<T: ParallelLineReducer>(opt: &Opt, line_reader: T) -> T {
+    if opt.input.is_empty() {
+        return with_stdin(|stdin| reduce_stream_partitioned(stdin, line_reader, opt.threads))
+            .expect("no io error");
+    }
+    opt.input.iter().fold(line_reader, |line_reader, path| {
+        reduce_keyed_file(path, line_reader, opt.threads)
+    })
+}
+
+/// Returns the filter of `--keys` and `--key-prefix`, if either is set.
+fn key_filter(opt: &Opt) -> Option<Arc<KeyFilter>> {
+    if opt.keys.is_none() && opt.key_prefix.is_none() {
+        return None;
+    }
+    let filter = KeyFilter::new(opt.key_prefix.as_deref().unwrap_or("").as_bytes());
+    let filter = match &opt.keys {
+        Some(path) => {
+            let file = File::open(path)
+                .unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+            filter
+                .with_keys(io::BufReader::new(file))
+                .unwrap_or_else(|e| panic!("cannot read {}: {}", path.display(), e))
+        }
+        None => filter,
+    };
+    Some(Arc::new(filter))
+}
+
+/// Returns the fields of `--key-field`, if set, and `--value-field`.
+fn field_selector(opt: &Opt) -> Option<FieldSelector> {
+    let key_field = opt.key_field?;
+    Some(FieldSelector::new(
+        opt.delimiter as u8,
+        key_field - 1,
+        opt.value_field - 1,
+    ))
+}
+
+/// Like [`reduce_keyed`], but takes keys and values from the fields of
+/// `--key-field`, if set.
+fn reduce_key_values<T: KeyValueReducer + ParallelLineReducer>(opt: &Opt, line_reader: T) -> T {
+    match field_selector(opt) {
+        Some(selector) => reduce_keyed(opt, Fields::new(selector, line_reader)).into_inner(),
+        None => reduce_keyed(opt, line_reader),
+    }
+}
+
+fn reduce_keyed_file<T: ParallelLineReducer>(path: &Path, line_reader: T, threads: usize) -> T {
+    let file = File::open(path).unwrap_or_else(|e| panic!("cannot open {}: {}", path.display(), e));
+    #[cfg(unix)]
+    let reduced = {
+        // dsrs only reads the file, and documents that it must not change
+        let mapped = unsafe { MappedFile::map(&file) }.expect("no io error");
+        match Compression::detect(&mapped) {
+            Some(compression) => decompress_slice(&mapped, compression, threads, |lines| {
+                reduce_stream_partitioned(lines, line_reader, threads)
+            }),
+            None => reduce_stream_partitioned(&mapped[..], line_reader, threads),
+        }
+    };
+    #[cfg(not(unix))]
+    let reduced = with_file(&file, |lines| {
+        reduce_stream_partitioned(lines, line_reader, threads)
+    });
+    reduced.expect("no io error")
+}
+
+#[cfg(unix)]
+fn reduce_file<T: ParallelLineReducer>(file: &File, line_reader: T, threads: usize) -> T {
+    // dsrs only reads the file, and documents that it must not change
+    let mapped = unsafe { MappedFile::map(file) }.expect("no io error");
+    match Compression::detect(&mapped) {
+        Some(compression) => decompress_slice(&mapped, compression, threads, |lines| {
+            reduce_stream_parallel(lines, line_reader, threads)
+        })
+        .expect("no io error"),
+        None => reduce_slice_parallel(&mapped, line_reader, threads),
+    }
+}
+
+#[cfg(not(unix))]
+fn reduce_file<T: ParallelLineReducer>(file: &File, line_reader: T, threads: usize) -> T {
+    with_file(file, |lines| {
+        reduce_stream_parallel(lines, line_reader, threads)
+    })
+    .expect("no io error")
+}
+
+/// Like [`with_stdin`], but for the lines of `file`.
+#[cfg(not(unix))]
+fn with_file<T>(file: &File, f: impl FnOnce(&mut dyn io::BufRead) -> T) -> T {
+    let mut lines = io::BufReader::new(file);
+    let magic = lines.fill_buf().expect("no io error").to_vec();
+    match Compression::detect(&magic) {
+        Some(compression) => decompress_stream(lines, compression, |mut lines| f(&mut lines)),
+        None => f(&mut lines),
+    }
+}
+
+/// Returns the queue of keyed `--raw` text lines or Arrow batches, encoded
+/// on up to `threads` threads.
+fn raw_lines(opt: &Opt, threads: usize) -> RawLines {
+    match opt.format {
+        Format::Arrow => RawLines::arrow(threads, opt.algo),
+        Format::Text | Format::Binary => RawLines::new(threads),
+    }
+}
+
+/// Prints `key` and then its counter as [`print_single`] does, except that
+/// `--raw` text lines or Arrow rows are queued in `lines`, which the
+/// caller finishes to `out` after the last key.
+fn print_key<W: Write>(out: &mut W, lines: &mut RawLines, key: &[u8], ctr: &Counter, opt: &Opt) {
+    if opt.raw && opt.format != Format::Binary {
+        lines
+            .push(out, key, |buf| ctr.append_serialized(buf, opt.slim))
+            .expect("no io error");
+        return;
+    }
+    if opt.raw {
+        write_frame(out, key).expect("no io error");
+    } else {
+        let as_str = str::from_utf8(key).expect("valid UTF-8");
+        write!(out, "{} ", as_str).expect("no io error");
+    }
+    print_single(out, ctr, opt);
 }
 
-fn main() {
-    let opt = Opt::from_args();
+/// Keys whose counters [`print_keys`] serializes at once.
+const PRINT_BATCH: usize = 1 << 14;
 
-    if let Some(k) = opt.hh {
-        assert!(!opt.key, "--key and --hh cannot be set simultaneously");
-        assert!(!opt.raw, "--raw and --hh cannot be set simultaneously");
-        assert!(!opt.merge, "--merge and --hh cannot be set simultaneously");
-        if k == 0 {
-            return;
-        }
-        let reduced = reduce_stream(io::stdin().lock(), HeavyHitter::new(k)).expect("no io error");
-        for (line, count) in reduced.estimate() {
-            println!("{} {}", count, str::from_utf8(line).expect("valid UTF-8"));
-        }
+/// Prints each key and its counter as [`print_key`] does, except that the
+/// counters of `--raw` text lines or Arrow rows are serialized [`PRINT_BATCH`] at a time
+/// on `--threads` threads, rather than one by one as they are queued.
+fn print_keys<W, K, C>(
+    out: &mut W,
+    lines: &mut RawLines,
+    mut keyed: impl Iterator<Item = (K, C)>,
+    opt: &Opt,
+) where
+    W: Write,
+    K: AsRef<[u8]>,
+    C: Borrow<Counter>,
+{
+    if !opt.raw || opt.format == Format::Binary {
+        keyed.for_each(|(key, ctr)| print_key(out, lines, key.as_ref(), ctr.borrow(), opt));
         return;
     }
-
-    match (opt.key, opt.merge) {
-        (true, false) => {
-            let reduced =
-                reduce_stream(io::stdin().lock(), KeyedCounter::default()).expect("no io error");
-            print_dict(reduced.state(), opt.raw)
-        }
-        (false, false) => {
-            let reduced =
-                reduce_stream(io::stdin().lock(), Counter::default()).expect("no io error");
-            print_single(&reduced, opt.raw);
-        }
-        (true, true) => {
-            let reduced =
-                reduce_stream(io::stdin().lock(), KeyedMerger::default()).expect("no io error");
-            for (key, ctr) in reduced.state() {
-                print_dict(iter::once((key, &ctr)), opt.raw)
-            }
+    loop {
+        let batch: Vec<(K, C)> = keyed.by_ref().take(PRINT_BATCH).collect();
+        if batch.is_empty() {
+            return;
         }
-        (false, true) => {
-            let reduced =
-                reduce_stream(io::stdin().lock(), Merger::default()).expect("no io error");
-            print_single(&reduced.counter(), opt.raw)
+        let ctrs: Vec<&Counter> = batch.iter().map(|(_, ctr)| ctr.borrow()).collect();
+        let (serialized, ends) = Counter::serialize_many(&ctrs, opt.slim, opt.threads);
+        let mut start = 0;
+        for ((key, _), &end) in batch.iter().zip(&ends) {
+            lines
+                .push(out, key.as_ref(), |buf| {
+                    buf.extend_from_slice(&serialized[start..end])
+                })
+                .expect("no io error");
+            start = end;
         }
     }
 }
 
-fn print_dict<'a>(it: impl Iterator<Item = (&'a [u8], &'a Counter)>, raw: bool) {
-    for (key, ctr) in it {
-        let as_str = str::from_utf8(key).expect("valid UTF-8");
-        print!("{} ", as_str);
-        print_single(ctr, raw);
+fn print_top<W: Write>(out: &mut W, top: TopKeys) {
+    for (key, estimate) in top.into_sorted() {
+        let as_str = str::from_utf8(&key).expect("valid UTF-8");
+        writeln!(out, "{} {}", as_str, estimate.round()).expect("no io error");
     }
 }
 
-fn print_single(c: &Counter, raw: bool) {
-    if raw {
-        println!("{}", c.serialize());
+fn print_single<W: Write>(out: &mut W, c: &Counter, opt: &Opt) {
+    let written = if opt.raw && opt.format == Format::Binary {
+        c.write_frame(out, opt.slim)
+    } else if opt.slim {
+        writeln!(out, "{}", c.serialize_for_merge())
+    } else if opt.raw {
+        writeln!(out, "{}", c.serialize())
     } else {
-        println!("{}", c.estimate().round());
+        writeln!(out, "{}", c.estimate().round())
+    };
+    written.expect("no io error");
+}
+
+/// Formats `fields` as a JSON object, of values already formatted.
+fn json_object<K: Display, V: Display>(fields: impl IntoIterator<Item = (K, V)>) -> String {
+    let fields: Vec<String> = fields
+        .into_iter()
+        .map(|(key, value)| format!("\"{}\":{}", key, value))
+        .collect();
+    format!("{{{}}}", fields.join(","))
+}
+
+/// Prints what `--stats` reports to stderr, as one JSON object.
+fn print_stats() {
+    let lines = lines_read();
+    let per_million = |n: u64| format!("{:.1}", n as f64 * 1e6 / lines.max(1) as f64);
+    let stages = profile::stages().into_iter().map(|(stage, totals)| {
+        let totals = json_object(vec![
+            ("seconds", format!("{:.6}", totals.seconds)),
+            ("bytes", totals.bytes.to_string()),
+            ("spans", totals.spans.to_string()),
+        ]);
+        (stage.name(), totals)
+    });
+    let queues = profile::queues().into_iter().map(|(queue, depths)| {
+        let depths = json_object(vec![
+            ("sends", depths.sends.to_string()),
+            ("mean_depth", format!("{:.2}", depths.mean_depth)),
+            ("max_depth", depths.max_depth.to_string()),
+        ]);
+        (queue.name(), depths)
+    });
+    let cpu_seconds = profile::cpu_seconds().map_or("null".to_string(), |s| format!("{:.6}", s));
+    let mut stats = vec![
+        ("lines", lines.to_string()),
+        ("wall_seconds", format!("{:.6}", profile::wall_seconds())),
+        ("cpu_seconds", cpu_seconds),
+        ("stages", json_object(stages)),
+        ("queues", json_object(queues)),
+    ];
+    if sketch_events::ENABLED {
+        let events = sketch_events::counts().into_iter().map(|(event, count)| {
+            let counts = json_object(vec![
+                ("count", count.to_string()),
+                ("per_mline", per_million(count)),
+            ]);
+            (event, counts)
+        });
+        stats.push(("events", json_object(events)));
+    }
+    if alloc_stats::ENABLED {
+        let families = alloc_stats::counts().into_iter().map(|(family, counts)| {
+            let counts = json_object(vec![
+                ("allocations", counts.allocations.to_string()),
+                ("bytes", counts.bytes.to_string()),
+                ("allocations_per_mline", per_million(counts.allocations)),
+                ("bytes_per_mline", per_million(counts.bytes)),
+            ]);
+            (family, counts)
+        });
+        stats.push(("allocations", json_object(families)));
+    }
+    eprintln!("{}", json_object(stats));
+}
+
+fn print_sums(sketch: &StaticArrayOfDoublesSketch) {
+    print!("{}", sketch.estimate().round());
+    for sum in sketch.estimate_sums() {
+        print!(" {}", sum);
     }
+    println!();
 }
 
 #[cfg(test)]
@@ -245,7 +1967,16 @@ mod tests {
     /// Asserts that the outputs of dsrs and unix tools when
     /// fed the input from datagen are equal.
     fn validate_equal(datagen: &str, keyed: bool, unix: &str) {
-        let ref args = if keyed { vec!["--key"] } else { vec![] };
+        validate_equal_algo(datagen, keyed, unix, "cpc")
+    }
+
+    /// As [`validate_equal`], but with every dsrs call using `--algo algo`.
+    fn validate_equal_algo(datagen: &str, keyed: bool, unix: &str, algo: &str) {
+        let mut args = vec!["--algo", algo];
+        if keyed {
+            args.push("--key");
+        }
+        let ref args = args;
         validate_equal_cmd(datagen, args, unix);
         let stdin = eval_bash(datagen);
         let dsrs_stdout = communicate(stdin.clone(), args);
@@ -267,7 +1998,7 @@ mod tests {
                     .join(&b'\n')
             })
             .collect();
-        let modulo_stdout = reduce_with_merge(groups, keyed);
+        let modulo_stdout = reduce_with_merge(groups, args);
         assert_eq!(
             &modulo_stdout,
             &dsrs_stdout,
@@ -289,7 +2020,7 @@ mod tests {
                     .join(&b'\n')
             })
             .collect();
-        let chunked_stdout = reduce_with_merge(groups, keyed);
+        let chunked_stdout = reduce_with_merge(groups, args);
         assert_eq!(
             &chunked_stdout,
             &dsrs_stdout,
@@ -299,25 +2030,18 @@ mod tests {
         );
     }
 
-    fn reduce_with_merge(groups: Vec<Vec<u8>>, keyed: bool) -> Vec<u8> {
+    fn reduce_with_merge(groups: Vec<Vec<u8>>, args: &[&str]) -> Vec<u8> {
+        let with_flag = |flag| {
+            let mut flags = args.to_vec();
+            flags.push(flag);
+            flags
+        };
         let raw: Vec<_> = groups
             .into_iter()
-            .map(|stdin| {
-                let flags: &[&str] = if keyed {
-                    &["--key", "--raw"]
-                } else {
-                    &["--raw"]
-                };
-                communicate(stdin, flags)
-            })
+            .map(|stdin| communicate(stdin, &with_flag("--raw")))
             .flatten()
             .collect();
-        let flags: &[&str] = if keyed {
-            &["--key", "--merge"]
-        } else {
-            &["--merge"]
-        };
-        let stdout = communicate(raw, flags);
+        let stdout = communicate(raw, &with_flag("--merge"));
         sort_lines(stdout)
     }
 
@@ -343,6 +2067,11 @@ mod tests {
         validate_equal("echo ; echo ; echo 1", false, UNIX_COUNT_DISTINCT)
     }
 
+    #[test]
+    fn hll_unique_lines() {
+        validate_equal_algo("seq 100 | xargs -L1 seq", false, UNIX_COUNT_DISTINCT, "hll")
+    }
+
     /// Only works for single-char keys due to -w1, note col order swap.
     const UNIX_GROUPBY_COUNT_DISTINCT: &'static str =
         "sort --unique | uniq -w1 -c | awk '{print$2\" \"$1}'";
@@ -381,6 +2110,706 @@ mod tests {
         )
     }
 
+    #[test]
+    fn hll_keyed_dup_lines() {
+        validate_equal_algo(
+            "(seq 100 | xargs -L1 echo 1) && \
+             (seq 50  | xargs -L1 echo 2) && \
+             (seq 100 | xargs -L1 echo 1)",
+            true,
+            UNIX_GROUPBY_COUNT_DISTINCT,
+            "hll",
+        )
+    }
+
+    #[test]
+    fn spilled_keys_count_the_same() {
+        let datagen = "(seq 100 | xargs -L1 echo 1) && \
+             (seq 50  | xargs -L1 echo 2) && \
+             (seq 100 | xargs -L1 echo 3) && \
+             (seq 25  | xargs -L1 echo 4) && \
+             (seq 100 | xargs -L1 echo 1)";
+        for threads in &["1", "3"] {
+            validate_equal_cmd(
+                datagen,
+                &["--key", "--spill-keys", "1", "--threads", threads],
+                UNIX_GROUPBY_COUNT_DISTINCT,
+            );
+        }
+        validate_equal_cmd(
+            datagen,
+            &["--key", "--spill-keys", "2", "--algo", "hll"],
+            UNIX_GROUPBY_COUNT_DISTINCT,
+        );
+    }
+
+    #[test]
+    fn top_keys() {
+        let stdin = eval_bash(
+            "(seq 25 | xargs -L1 echo 3) && \
+             (seq 100 | xargs -L1 echo 1) && \
+             (seq 50 | xargs -L1 echo 4) && \
+             (seq 10 | xargs -L1 echo 2) && \
+             (seq 50 | xargs -L1 echo 2)",
+        );
+        let expected = b"1 100\n2 50\n4 50\n".to_vec();
+        for threads in &["1", "3"] {
+            let flags = ["--key", "--top", "3", "--threads", threads];
+            assert_eq!(communicate(stdin.clone(), &flags), expected);
+            let spilled = [&flags[..], &["--spill-keys", "1"]].concat();
+            assert_eq!(communicate(stdin.clone(), &spilled), expected);
+        }
+        let raw = communicate(stdin, &["--key", "--raw"]);
+        assert_eq!(
+            communicate(raw, &["--key", "--merge", "--top", "3"]),
+            expected
+        );
+    }
+
+    #[test]
+    fn slim_raw_merges_the_same() {
+        let stdin = eval_bash("(seq 100 | xargs -L1 echo 1) && (seq 3 | xargs -L1 echo 2)");
+        let raw = communicate(stdin.clone(), &["--key", "--raw"]);
+        let slim = communicate(stdin, &["--key", "--raw", "--slim"]);
+        assert!(slim.len() < raw.len());
+        assert_eq!(
+            sort_lines(communicate(raw, &["--key", "--merge"])),
+            sort_lines(communicate(slim, &["--key", "--merge"]))
+        );
+    }
+
+    #[test]
+    fn binary_raw_merges_like_text() {
+        let stdin = eval_bash("(seq 100 | xargs -L1 echo 1) && (seq 50 | xargs -L1 echo 2)");
+        for key in &[&[][..], &["--key"][..]] {
+            let with = |flags: &[&'static str]| [*key, flags].concat();
+            let text = communicate(stdin.clone(), &with(&["--raw"]));
+            let binary = communicate(stdin.clone(), &with(&["--raw", "--format", "binary"]));
+            assert!(binary.len() < text.len());
+            let expected = sort_lines(communicate(text, &with(&["--merge"])));
+            for threads in &["1", "3"] {
+                let merged = communicate(
+                    binary.clone(),
+                    &with(&["--merge", "--format", "binary", "--threads", threads]),
+                );
+                assert_eq!(sort_lines(merged), expected);
+            }
+        }
+    }
+
+    #[test]
+    fn hashed_keys_count_like_keys() {
+        let stdin = eval_bash("(seq 100 | xargs -L1 echo a) && (seq 50 | xargs -L1 echo bb)");
+        let expected = sort_lines(communicate(stdin.clone(), &["--key"]));
+        let named = communicate(
+            stdin.clone(),
+            &["--key", "--hash-keys", "--key-sample", "1"],
+        );
+        let named: Vec<u8> = str::from_utf8(&named)
+            .expect("valid UTF-8")
+            .lines()
+            .flat_map(|line| {
+                let words: Vec<&str> = line.split(' ').collect();
+                assert_eq!(words[0].len(), 16);
+                format!("{} {}\n", words[2], words[1]).into_bytes()
+            })
+            .collect();
+        assert_eq!(sort_lines(named), expected);
+
+        let hashed = sort_lines(communicate(stdin.clone(), &["--key", "--hash-keys"]));
+        let raw = communicate(stdin, &["--key", "--hash-keys", "--raw"]);
+        assert_eq!(sort_lines(communicate(raw, &["--key", "--merge"])), hashed);
+    }
+
+    #[test]
+    fn shared_theta_counts_like_keys() {
+        // fewer pairs than the sketch holds, so every one is kept
+        let stdin = eval_bash("(seq 100 | xargs -L1 echo a) && (seq 50 | xargs -L1 echo bb)");
+        let expected = sort_lines(communicate(stdin.clone(), &["--key"]));
+        for threads in &["1", "2"] {
+            let shared = communicate(
+                stdin.clone(),
+                &["--key", "--shared-theta", "10", "--threads", threads],
+            );
+            assert_eq!(sort_lines(shared), expected);
+        }
+        let top = communicate(stdin, &["--key", "--shared-theta", "10", "--top", "1"]);
+        assert_eq!(top, b"a 100\n");
+    }
+
+    #[test]
+    fn sorted_merges_like_unsorted() {
+        let shards = [
+            "(seq 90 | xargs -L1 echo 1) && (seq 50 | xargs -L1 echo 2)",
+            "(seq 50 100 | xargs -L1 echo 2) && (seq 20 | xargs -L1 echo 4)",
+        ];
+        let raw: Vec<u8> = shards
+            .iter()
+            .flat_map(|shard| communicate(eval_bash(shard), &["--key", "--raw"]))
+            .collect();
+        let expected = sort_lines(communicate(raw.clone(), &["--key", "--merge"]));
+        let sorted = sort_lines(raw);
+        // keys come out in input order, which is sorted here
+        let merged = communicate(sorted.clone(), &["--key", "--merge", "--sorted"]);
+        assert_eq!(merged, expected);
+        let pipelined = communicate(
+            sorted.clone(),
+            &["--key", "--merge", "--sorted", "--threads", "3"],
+        );
+        assert_eq!(pipelined, expected);
+        let top = communicate(sorted, &["--key", "--merge", "--sorted", "--top", "1"]);
+        assert!(top.starts_with(b"2 "), "{}", String::from_utf8_lossy(&top));
+
+        let binary = communicate(
+            eval_bash(shards[0]),
+            &["--key", "--raw", "--format", "binary"],
+        );
+        let flags = ["--key", "--merge", "--format", "binary"];
+        let expected = sort_lines(communicate(binary.clone(), &flags));
+        let sorted_flags = [&flags[..], &["--sorted"]].concat();
+        assert_eq!(sort_lines(communicate(binary, &sorted_flags)), expected);
+    }
+
+    #[test]
+    fn key_filters_drop_other_keys() {
+        let raw = communicate(
+            eval_bash(
+                "(seq 300 | xargs -L1 echo a1) && (seq 100 | xargs -L1 echo a2) && \
+                 (seq 50 | xargs -L1 echo b1)",
+            ),
+            &["--key", "--raw"],
+        );
+        let all = String::from_utf8(sort_lines(communicate(raw.clone(), &["--key", "--merge"])))
+            .expect("valid UTF-8");
+        let only = |keys: &[&str]| -> Vec<u8> {
+            all.lines()
+                .filter(|line| {
+                    keys.iter()
+                        .any(|key| line.starts_with(&format!("{} ", key)))
+                })
+                .map(|line| format!("{}\n", line))
+                .collect::<String>()
+                .into_bytes()
+        };
+        let keys = std::env::temp_dir().join(format!("dsrs-keys-{}", process::id()));
+        std::fs::write(&keys, "a2\nb1\n").expect("keys written");
+        let keys = keys.to_str().expect("valid UTF-8");
+
+        let merged = |stdin: Vec<u8>, flags: &[&str]| {
+            let flags = [&["--key", "--merge"], flags].concat();
+            sort_lines(communicate(stdin, &flags))
+        };
+        assert_eq!(
+            merged(raw.clone(), &["--key-prefix", "a"]),
+            only(&["a1", "a2"])
+        );
+        assert_eq!(merged(raw.clone(), &["--keys", keys]), only(&["a2", "b1"]));
+        let both = ["--keys", keys, "--key-prefix", "a", "--threads", "3"];
+        assert_eq!(merged(raw.clone(), &both), only(&["a2"]));
+        let sorted = ["--sorted", "--key-prefix", "b", "--threads", "2"];
+        assert_eq!(merged(sort_lines(raw), &sorted), only(&["b1"]));
+
+        let binary = communicate(
+            eval_bash("seq 20 | xargs -L1 echo a1 && seq 10 | xargs -L1 echo b1"),
+            &["--key", "--raw", "--format", "binary"],
+        );
+        let filtered = merged(binary, &["--format", "binary", "--key-prefix", "b"]);
+        assert_eq!(filtered, b"b1 10\n");
+        std::fs::remove_file(keys).expect("keys removed");
+    }
+
+    #[test]
+    fn arrow_holds_raw_sketches() {
+        let stdin = eval_bash("(seq 300 | xargs -L1 echo 1) && (seq 100 | xargs -L1 echo 2)");
+        let flags = ["--key", "--raw", "--format", "arrow"];
+        let text = communicate(stdin.clone(), &flags[..2]);
+        let arrow = communicate(stdin, &flags);
+        let end = [0xff, 0xff, 0xff, 0xff, 0, 0, 0, 0];
+        assert_eq!(arrow[..4], [0xff; 4]);
+        assert!(arrow.ends_with(&end));
+        // the sketch column holds the same serialized sketches
+        for line in str::from_utf8(&text).expect("valid UTF-8").lines() {
+            let (key, sketch) = line.split_once(' ').expect("key and sketch");
+            let sketch = base64::decode_config(sketch, base64::STANDARD_NO_PAD).expect("base64");
+            assert!(
+                arrow.windows(sketch.len()).any(|w| w == sketch.as_slice()),
+                "key {}",
+                key
+            );
+        }
+
+        // a schema starts even an empty stream
+        let empty = communicate(Vec::new(), &flags);
+        assert!(empty.len() > end.len() && empty.ends_with(&end));
+        assert!(empty.len() < arrow.len());
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn store_accumulates_across_runs() {
+        let days = [
+            "(seq 300 | xargs -L1 echo 1) && (seq 100 | xargs -L1 echo 2)",
+            "(seq 200 400 | xargs -L1 echo 1) && (seq 100 | xargs -L1 echo 3)",
+        ];
+        let path = |name: &str| {
+            let path = std::env::temp_dir().join(format!("dsrs-store-{}-{}", process::id(), name));
+            path.to_str().expect("valid UTF-8").to_owned()
+        };
+        let (counted, merged) = (path("counted"), path("merged"));
+        let parse = |stdout: Vec<u8>| -> Vec<(String, f64)> {
+            let stdout = String::from_utf8(stdout).expect("valid UTF-8");
+            stdout
+                .lines()
+                .map(|line| {
+                    let (key, estimate) = line.split_once(' ').expect("key and estimate");
+                    (key.to_owned(), estimate.parse().expect("estimate"))
+                })
+                .collect()
+        };
+
+        let first = communicate(
+            eval_bash(days[0]),
+            &["--key", "--algo", "hll", "--store", counted.as_str()],
+        );
+        let first = parse(first);
+        assert_eq!(first.len(), 2);
+        let mut outputs = Vec::new();
+        for store in [&counted, &merged] {
+            let store_flags = ["--key", "--algo", "hll", "--store", store.as_str()];
+            if store == &merged {
+                for day in &days {
+                    let raw = communicate(eval_bash(day), &["--key", "--algo", "hll", "--raw"]);
+                    outputs.push(communicate(raw, &[&store_flags[..], &["--merge"]].concat()));
+                }
+            } else {
+                outputs.push(communicate(eval_bash(days[1]), &store_flags));
+            }
+            let raw = communicate(Vec::new(), &[&store_flags[..], &["--raw"]].concat());
+            // nothing is read, so nothing is updated
+            assert!(raw.is_empty());
+        }
+        let second = parse(outputs[0].clone());
+        // keys updated the second day, in the order they joined the store
+        let keys: Vec<&str> = second.iter().map(|(key, _)| key.as_str()).collect();
+        assert_eq!(keys, ["1", "3"]);
+        for ((_, estimate), expected) in second.iter().zip([400.0, 100.0]) {
+            assert!(
+                (estimate - expected).abs() < expected * 0.05,
+                "{}",
+                estimate
+            );
+        }
+        // merging the days' sketches builds the same registers
+        assert_eq!(outputs[2], outputs[0]);
+        let raw = communicate(
+            eval_bash(days[1]),
+            &[
+                "--key",
+                "--algo",
+                "hll",
+                "--store",
+                merged.as_str(),
+                "--raw",
+            ],
+        );
+        let remerged = parse(communicate(raw, &["--key", "--merge", "--algo", "hll"]));
+        for ((key, estimate), (expected_key, expected)) in remerged.iter().zip(&second) {
+            assert_eq!(key, expected_key);
+            assert!((estimate - expected).abs() <= 1.0);
+        }
+        for store in [counted, merged] {
+            std::fs::remove_file(&store).unwrap();
+            std::fs::remove_file(format!("{}.keys", store)).unwrap();
+        }
+    }
+
+    #[cfg(unix)]
+    #[test]
+    fn segments_accumulate_across_runs() {
+        let days = [
+            "(seq 300 | xargs -L1 echo 1) && (seq 100 | xargs -L1 echo 2)",
+            "(seq 200 400 | xargs -L1 echo 1) && (seq 100 | xargs -L1 echo 3)",
+        ];
+        let dir = std::env::temp_dir().join(format!("dsrs-segments-{}", process::id()));
+        let dir = dir.to_str().expect("valid UTF-8");
+        let raw: Vec<u8> = days
+            .iter()
+            .flat_map(|day| communicate(eval_bash(day), &["--key", "--raw"]))
+            .collect();
+        let merged = sort_lines(communicate(raw, &["--key", "--merge"]));
+        // the keys of the second day, with the sketches of both
+        let expected: Vec<u8> = str::from_utf8(&merged)
+            .expect("valid UTF-8")
+            .lines()
+            .filter(|line| !line.starts_with("2 "))
+            .flat_map(|line| format!("{}\n", line).into_bytes())
+            .collect();
+
+        let first = communicate(eval_bash(days[0]), &["--key", "--segments", dir]);
+        assert_eq!(first.iter().filter(|&&b| b == b'\n').count(), 2);
+        let second = communicate(eval_bash(days[1]), &["--key", "--segments", dir]);
+        assert_eq!(second, expected);
+        // unions are idempotent, so merging in the second day again
+        // changes no count
+        let raw = communicate(eval_bash(days[1]), &["--key", "--raw"]);
+        let again = communicate(raw, &["--key", "--merge", "--segments", dir]);
+        assert_eq!(again, expected);
+        std::fs::remove_dir_all(dir).unwrap();
+    }
+
+    /// Returns the `--stats` of dsrs run with `flags` on `stdin`.
+    fn stats_of(stdin: Vec<u8>, flags: &[&str]) -> String {
+        let out = assert_cmd::Command::cargo_bin(env!("CARGO_PKG_NAME"))
+            .expect("command created")
+            .arg("--stats")
+            .args(flags)
+            .write_stdin(stdin)
+            .assert()
+            .success()
+            .get_output()
+            .clone();
+        String::from_utf8(out.stderr).expect("valid UTF-8")
+    }
+
+    /// Returns the number at `path`, a list of nested keys, in `json`.
+    fn json_number(json: &str, path: &[&str]) -> f64 {
+        let mut rest = json;
+        for key in path {
+            let quoted = format!("\"{}\":", key);
+            let at = rest
+                .find(&quoted)
+                .unwrap_or_else(|| panic!("{} in {}", key, json));
+            rest = &rest[at + quoted.len()..];
+        }
+        let end = rest.find(|c| c == ',' || c == '}').expect("number ends");
+        rest[..end].parse().expect("a number")
+    }
+
+    #[test]
+    fn profiled_stats() {
+        let input = eval_bash("seq 100000");
+        let stats = stats_of(input.clone(), &["--threads", "2"]);
+        assert_eq!(json_number(&stats, &["lines"]), 100000.0);
+        assert_eq!(
+            json_number(&stats, &["stages", "read", "bytes"]),
+            input.len() as f64
+        );
+        assert!(json_number(&stats, &["stages", "update", "bytes"]) > 0.0);
+        assert!(json_number(&stats, &["stages", "update", "seconds"]) > 0.0);
+        assert!(json_number(&stats, &["queues", "lines", "sends"]) > 0.0);
+
+        let gzipped = eval_bash("seq 100000 | gzip");
+        let stats = stats_of(gzipped, &[]);
+        assert_eq!(
+            json_number(&stats, &["stages", "decompress", "bytes"]),
+            input.len() as f64
+        );
+        assert!(json_number(&stats, &["queues", "decompressed", "max_depth"]) >= 1.0);
+    }
+
+    #[cfg(feature = "alloc-stats")]
+    #[test]
+    fn allocation_stats() {
+        let stats = stats_of(eval_bash("seq 1000"), &["--threads", "2"]);
+        assert_eq!(json_number(&stats, &["lines"]), 1000.0);
+        assert!(json_number(&stats, &["allocations", "cpc", "allocations"]) > 0.0);
+    }
+
+    #[cfg(feature = "event-stats")]
+    #[test]
+    fn event_stats() {
+        let stats = stats_of(eval_bash("seq 20000"), &[]);
+        assert!(json_number(&stats, &["events", "cpc_move_window", "count"]) > 0.0);
+    }
+
+    #[test]
+    fn checkpointed_counts() {
+        let path = std::env::temp_dir().join(format!("dsrs-checkpoint-{}", process::id()));
+        let path = path.to_str().expect("valid UTF-8");
+        let flags = ["--checkpoint", path, "--checkpoint-bytes", "100"];
+        validate_equal_cmd("seq 100 | xargs -L1 seq", &flags, UNIX_COUNT_DISTINCT);
+        assert!(!std::path::Path::new(path).exists());
+        validate_equal_cmd(
+            "(seq 100 | xargs -L1 echo 1) && (seq 50 | xargs -L1 echo 2)",
+            &[&["--key"], &flags[..]].concat(),
+            UNIX_GROUPBY_COUNT_DISTINCT,
+        );
+        assert!(!std::path::Path::new(path).exists());
+    }
+
+    #[test]
+    fn field_keyed_lines() {
+        // the key is the third column, the value the first, and the second
+        // holds spaces that neither may be split at
+        let datagen = "seq 300 | awk '{print $1 % 50 \"\\ta b\\t\" $1 % 7}'";
+        let unix = "awk -F'\\t' '{ if (!(($3, $1) in seen)) { seen[$3, $1]; n[$3]++ } } \
+                    END { for (k in n) print k, n[k] }' | sort";
+        let fields = ["--key", "--key-field", "3", "--value-field", "1"];
+        validate_equal_cmd(datagen, &fields, unix);
+        validate_equal_cmd(datagen, &[&fields[..], &["--threads", "3"]].concat(), unix);
+        validate_equal_cmd(
+            &format!("{} | tr '\\t' ,", datagen),
+            &[&fields[..], &["--delimiter", ","]].concat(),
+            &format!("tr , '\\t' | {}", unix),
+        );
+    }
+
+    #[test]
+    fn threaded_lines() {
+        let datagen = "seq 100 | xargs -L1 seq";
+        validate_equal_cmd(datagen, &["--threads", "3"], UNIX_COUNT_DISTINCT);
+        validate_equal_cmd(datagen, &["--threads", "3", "--numa"], UNIX_COUNT_DISTINCT);
+        validate_equal_cmd(
+            datagen,
+            &["--threads", "3", "--hugepages"],
+            UNIX_COUNT_DISTINCT,
+        );
+        validate_equal_cmd(
+            "(seq 100 | xargs -L1 echo 1) && (seq 50 | xargs -L1 echo 2)",
+            &["--key", "--threads", "3"],
+            UNIX_GROUPBY_COUNT_DISTINCT,
+        );
+        validate_unix_hh_flags("seq 1000 | sed 's/$/\\n1\\n2\\n3/'", 3, &["--threads", "3"]);
+    }
+
+    #[test]
+    fn keyed_threads_build_the_same_sketches() {
+        // each key's lines reach a single thread, in order, however many there are
+        let stdin = eval_bash("seq 100000 | awk '{print $1 % 7, $1 % 5000}'");
+        for args in &[
+            &["--key", "--raw"][..],
+            &["--key", "--raw", "--algo", "hll"],
+        ] {
+            let expected = sort_lines(communicate(stdin.clone(), args));
+            let mut threaded = args.to_vec();
+            threaded.extend_from_slice(&["--threads", "4"]);
+            assert_eq!(sort_lines(communicate(stdin.clone(), &threaded)), expected);
+        }
+    }
+
+    #[test]
+    fn input_file_lines() {
+        let datagen = "(seq 100 | xargs -L1 echo 1) && (seq 50 | xargs -L1 echo 2) && printf 3";
+        let stdin = eval_bash(datagen);
+        let path = std::env::temp_dir().join(format!("dsrs-input-{}", process::id()));
+        std::fs::write(&path, &stdin).expect("temp file written");
+        let path_str = path.to_str().expect("valid UTF-8");
+        for args in &[&["--key"][..], &["--hh", "2"], &[]] {
+            let expected = sort_lines(communicate(stdin.clone(), args));
+            for threads in &["1", "3"] {
+                let mut file_args = args.to_vec();
+                file_args.extend_from_slice(&["--input", path_str, "--threads", threads]);
+                let actual = sort_lines(communicate(Vec::new(), &file_args));
+                assert_eq!(actual, expected, "{:?}", file_args);
+            }
+        }
+        std::fs::remove_file(&path).expect("temp file removed");
+    }
+
+    #[test]
+    fn input_files_lines() {
+        let datagens = [
+            "(seq 100 | xargs -L1 echo 1) && (seq 50 | xargs -L1 echo 2)",
+            "seq 30 | xargs -L1 echo 3",
+            "printf '1 7\\n4 2'",
+        ];
+        let mut stdin = Vec::new();
+        let mut paths = Vec::new();
+        for (i, datagen) in datagens.iter().enumerate() {
+            let lines = eval_bash(datagen);
+            stdin.extend_from_slice(&lines);
+            if !lines.ends_with(b"\n") {
+                stdin.push(b'\n');
+            }
+            let path = std::env::temp_dir().join(format!("dsrs-inputs-{}-{}", process::id(), i));
+            std::fs::write(&path, &lines).expect("temp file written");
+            paths.push(path.to_str().expect("valid UTF-8").to_owned());
+        }
+        for args in &[&["--key"][..], &["--hh", "2"], &["--sum", "1"], &[]] {
+            let expected = sort_lines(communicate(stdin.clone(), args));
+            for threads in &["1", "2", "5"] {
+                let mut file_args = args.to_vec();
+                file_args.push("--input");
+                file_args.extend(paths.iter().map(String::as_str));
+                file_args.extend_from_slice(&["--threads", threads]);
+                let actual = sort_lines(communicate(Vec::new(), &file_args));
+                assert_eq!(actual, expected, "{:?}", file_args);
+            }
+        }
+        for path in &paths {
+            std::fs::remove_file(path).expect("temp file removed");
+        }
+    }
+
+    #[test]
+    fn compressed_lines() {
+        let datagen = "(seq 100 | xargs -L1 echo 1) && (seq 50 | xargs -L1 echo 2)";
+        let stdin = eval_bash(datagen);
+        // two gzip members, as from concatenated files
+        let gzipped = eval_bash(&format!(
+            "({0}) | sed -n 1,100p | gzip; ({0}) | sed 1,100d | gzip",
+            datagen
+        ));
+        let path = std::env::temp_dir().join(format!("dsrs-gzipped-{}", process::id()));
+        std::fs::write(&path, &gzipped).expect("temp file written");
+        let path_str = path.to_str().expect("valid UTF-8");
+        for args in &[&["--key"][..], &["--hh", "2"], &[]] {
+            let expected = sort_lines(communicate(stdin.clone(), args));
+            assert_eq!(sort_lines(communicate(gzipped.clone(), args)), expected);
+            for threads in &["1", "3"] {
+                let mut file_args = args.to_vec();
+                file_args.extend_from_slice(&["--input", path_str, "--threads", threads]);
+                let actual = sort_lines(communicate(Vec::new(), &file_args));
+                assert_eq!(actual, expected, "{:?}", file_args);
+            }
+        }
+        std::fs::remove_file(&path).expect("temp file removed");
+    }
+
+    #[test]
+    fn summed_lines() {
+        let datagen = "seq 100 | awk '{print $1 % 10, $1, 2}'";
+        let unix = "awk '{ if (!($1 in seen)) { seen[$1]; n++ } s += $2; t += $3 } \
+                    END { print n, s, t }'";
+        validate_equal_cmd(datagen, &["--sum", "2"], unix);
+        validate_equal_cmd(datagen, &["--sum", "2", "--threads", "3"], unix);
+    }
+
+    #[test]
+    fn summed_input_file() {
+        let datagen = "seq 10000 | awk '{print $1 % 1000, $1}'";
+        let stdin = eval_bash(datagen);
+        let path = std::env::temp_dir().join(format!("dsrs-summed-{}", process::id()));
+        std::fs::write(&path, &stdin).expect("temp file written");
+        let expected = communicate(stdin, &["--sum", "1"]);
+        let path_str = path.to_str().expect("valid UTF-8");
+        for threads in &["1", "3"] {
+            let args = ["--sum", "1", "--input", path_str, "--threads", threads];
+            assert_eq!(communicate(Vec::new(), &args), expected);
+        }
+        assert!((9000..11000).contains(&super::expected_lines(&path)));
+        std::fs::remove_file(&path).expect("temp file removed");
+        assert_eq!(super::expected_lines(&path), 0);
+    }
+
+    #[test]
+    fn keyed_summed_lines() {
+        let datagen = "seq 100 | awk '{print $1 % 3, $1 % 10, $1}'";
+        let unix = "awk '{ if (!(($1, $2) in seen)) { seen[$1, $2]; n[$1]++ } s[$1] += $3 } \
+                    END { for (k in n) print k, n[k], s[k] }' | sort";
+        validate_equal_cmd(datagen, &["--key", "--sum", "1"], unix);
+        validate_equal_cmd(datagen, &["--key", "--sum", "1", "--threads", "3"], unix);
+    }
+
+    #[test]
+    fn sampled_lines() {
+        // below k, the sample is every line, with weight 1
+        let datagen = "seq 100";
+        let unix = "sed 's/^/1 /' | sort";
+        validate_equal_cmd(datagen, &["--sample", "200"], unix);
+        validate_equal_cmd(datagen, &["--sample", "200", "--threads", "3"], unix);
+
+        let stdin = eval_bash("seq 10000");
+        for threads in &["1", "3"] {
+            let stdout = communicate(stdin.clone(), &["--sample", "50", "--threads", threads]);
+            let lines: Vec<&str> = str::from_utf8(&stdout)
+                .expect("valid UTF-8")
+                .lines()
+                .collect();
+            assert_eq!(lines.len(), 50);
+            let total: f64 = lines
+                .iter()
+                .map(|line| line.split(' ').next().unwrap().parse::<f64>().unwrap())
+                .sum();
+            assert!((total - 10000.0).abs() < 1e-6, "{}", total);
+        }
+    }
+
+    #[test]
+    fn bloom_filtered_lines() {
+        let stdin = eval_bash("seq 0 2 2000");
+        let raw = communicate(stdin.clone(), &["--bloom", "1000", "--raw"]);
+        for threads in &["1", "3"] {
+            let args = ["--bloom", "1000", "--raw", "--threads", threads];
+            assert_eq!(communicate(stdin.clone(), &args), raw);
+        }
+        let estimate = communicate(stdin, &["--bloom", "1000"]);
+        let estimate: f64 = str::from_utf8(&estimate).unwrap().trim().parse().unwrap();
+        assert!((estimate - 1001.0).abs() < 30.0, "{}", estimate);
+
+        // the filters of two halves merge into the filter of the whole
+        let halves = [
+            communicate(eval_bash("seq 0 4 2000"), &["--bloom", "1000", "--raw"]),
+            communicate(eval_bash("seq 2 4 2000"), &["--bloom", "1000", "--raw"]),
+        ]
+        .concat();
+        let merged = communicate(halves, &["--bloom", "1000", "--raw", "--merge"]);
+        assert_eq!(merged, raw);
+
+        let path = std::env::temp_dir().join(format!("dsrs-bloom-{}", process::id()));
+        std::fs::write(&path, &raw).expect("temp file written");
+        let path_str = path.to_str().expect("valid UTF-8");
+        let probed = communicate(eval_bash("seq 2000"), &["--contains", path_str]);
+        let probed: Vec<u64> = str::from_utf8(&probed)
+            .expect("valid UTF-8")
+            .lines()
+            .map(|line| line.parse().unwrap())
+            .collect();
+        let evens: Vec<u64> = probed.iter().copied().filter(|i| i % 2 == 0).collect();
+        assert_eq!(evens, (2..=2000).step_by(2).collect::<Vec<u64>>());
+        assert!(probed.len() < 1010, "{}", probed.len());
+
+        // with --key, lines are tested by their first word
+        let keyed = eval_bash("seq 2000 | awk '{print $1, \"x\"}'");
+        let probed = communicate(keyed, &["--contains", path_str, "--key"]);
+        let probed = str::from_utf8(&probed).expect("valid UTF-8");
+        assert!(probed.lines().all(|line| line.ends_with(" x")));
+        assert!(probed.lines().any(|line| line == "2000 x"));
+        std::fs::remove_file(&path).expect("temp file removed");
+    }
+
+    #[test]
+    fn sampled_key_sums() {
+        // below k, every key's count is exact
+        let datagen = "seq 100 | awk '{print $1 % 3, $1}'";
+        let unix = "awk '{ n[$1]++ } END { for (k in n) print k, n[k], n[k], n[k] }' | sort";
+        validate_equal_cmd(datagen, &["--sample", "200", "--key"], unix);
+    }
+
+    #[test]
+    fn window_counts_last_slices() {
+        // slice s has lines s to s + 19, so the last 3 slices have 22
+        // distinct values once there are 3 of them
+        let datagen = "for s in $(seq 10); do seq $s $((s + 19)) | sed \"s/^/$s /\"; done";
+        let stdin = eval_bash(datagen);
+        let expected: Vec<u8> = (1..=10)
+            .flat_map(|s| format!("{} {}\n", s, 19 + s.min(3)).into_bytes())
+            .collect();
+        assert_eq!(communicate(stdin.clone(), &["--window", "3"]), expected);
+        let expected: Vec<u8> = (1..=10)
+            .flat_map(|s| format!("{} 20\n", s).into_bytes())
+            .collect();
+        assert_eq!(communicate(stdin, &["--window", "1"]), expected);
+    }
+
+    #[test]
+    fn sampled_window_counts_last_slices() {
+        // slice s has lines 10000 * s to 10000 * s + 19999
+        let datagen =
+            "for s in $(seq 5); do seq $((s * 10000)) $((s * 10000 + 19999)) | sed \"s/^/$s /\"; done";
+        let stdout = communicate(eval_bash(datagen), &["--window", "2", "--p", "0.25"]);
+        let counts: Vec<f64> = str::from_utf8(&stdout)
+            .expect("valid UTF-8")
+            .lines()
+            .map(|line| line.split(' ').nth(1).unwrap().parse().unwrap())
+            .collect();
+        assert_eq!(counts.len(), 5);
+        for (i, &count) in counts.iter().enumerate() {
+            let exact = if i == 0 { 20000.0 } else { 30000.0 };
+            assert!((exact * 0.9..exact * 1.1).contains(&count), "{}", count);
+        }
+    }
+
     fn validate_equal_cmd(datagen: &str, args: &[&str], unix: &str) {
         let stdin = eval_bash(datagen);
         let dsrs_stdout = communicate(stdin.clone(), args);
@@ -403,10 +2832,15 @@ mod tests {
     }
 
     fn validate_unix_hh(datagen: &str, k: usize) {
+        validate_unix_hh_flags(datagen, k, &[])
+    }
+
+    fn validate_unix_hh_flags(datagen: &str, k: usize, flags: &[&str]) {
         let unix = unix_hh(k);
         let kstr = format!("{}", k);
-        let dsrs = &["--hh", &kstr];
-        validate_equal_cmd(datagen, dsrs, &unix);
+        let mut dsrs = vec!["--hh", &kstr];
+        dsrs.extend_from_slice(flags);
+        validate_equal_cmd(datagen, &dsrs, &unix);
     }
 
     #[test]
@@ -419,8 +2853,77 @@ mod tests {
         validate_unix_hh("seq 1000 | sed 's/$/\\n1\\n2\\n3/'", 3);
     }
 
+    #[test]
+    fn hh_dup_lines_over_windows() {
+        // duplicates are combined a window of lines at a time
+        validate_unix_hh("seq 10000 | sed 's/$/\\n1\\n2/'", 2);
+    }
+
+    #[test]
+    fn hh_raw_merges() {
+        let datagen = "seq 1000 | sed 's/$/\\n1\\n2\\n3/'";
+        let expected = sort_lines(eval_bash(&format!("{} | {}", datagen, unix_hh(3))));
+        let stdin = eval_bash(datagen);
+        let half = stdin[..stdin.len() / 2]
+            .iter()
+            .rposition(|&c| c == b'\n')
+            .expect("a line")
+            + 1;
+        let shards = [&stdin[..half], &stdin[half..]];
+        for format in &["text", "binary"] {
+            let raw: Vec<u8> = shards
+                .iter()
+                .flat_map(|shard| {
+                    communicate(shard.to_vec(), &["--hh", "3", "--raw", "--format", format])
+                })
+                .collect();
+            for threads in &["1", "2"] {
+                let merged = communicate(
+                    raw.clone(),
+                    &[
+                        "--hh",
+                        "3",
+                        "--merge",
+                        "--format",
+                        format,
+                        "--threads",
+                        threads,
+                    ],
+                );
+                assert_eq!(sort_lines(merged), expected, "{} {}", format, threads);
+            }
+        }
+    }
+
     #[test]
     fn hh_count_empty() {
         validate_unix_hh("echo ; echo ; echo 1", 1)
     }
+
+    #[test]
+    fn hh_keyed() {
+        // each key has five lines twice and the rest once
+        let datagen =
+            "for k in a b c; do seq 10 | sed \"s/^/$k /\"; seq 5 | sed \"s/^/$k /\"; done";
+        let unix =
+            "sort | uniq -c | sort -k2,2 -k1,1rn | awk 'n[$2]++ < 5 { print $2, $1, $3 }' | sort";
+        for threads in &["1", "2"] {
+            validate_equal_cmd(datagen, &["--hh", "5", "--key", "--threads", threads], unix);
+        }
+    }
+
+    #[test]
+    fn all_in_one_pass() {
+        // 200 lines, few enough for exact length quantiles
+        let stdin = eval_bash("seq 50 | sed 's/$/\\n1\\n2\\n3/'");
+        let expected = "distinct 50\nlengths 1 1 2 2 2\ntop 51 1\ntop 51 2\ntop 51 3\n";
+        assert_eq!(
+            sort_lines(communicate(stdin, &["--all", "3"])),
+            expected.as_bytes()
+        );
+        assert_eq!(
+            communicate(Vec::new(), &["--all", "3"]),
+            b"distinct 0\nlengths\n"
+        );
+    }
 }
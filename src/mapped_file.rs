@@ -0,0 +1,209 @@
+//! Memory maps of whole files, on unix: read-only ones of input files,
+//! and shared writable ones of files updated in place.
+
+use std::fs::File;
+use std::io::Error;
+use std::ops::{Deref, DerefMut};
+use std::os::unix::io::AsRawFd;
+use std::ptr;
+use std::slice;
+
+use libc;
+
+/// A whole file mapped read-only into memory, which derefs to its bytes,
+/// for reducing large inputs with [`reduce_slice`] without copying them
+/// through read buffers.
+///
+/// [`reduce_slice`]: crate::stream_reducer::reduce_slice
+pub struct MappedFile {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+// The mapping is read-only, and never remapped while borrowed.
+unsafe impl Send for MappedFile {}
+unsafe impl Sync for MappedFile {}
+
+impl MappedFile {
+    /// Maps all of `file`, hinting to the kernel that it will be read from
+    /// front to back.
+    ///
+    /// # Safety
+    ///
+    /// The file must not be modified or truncated while mapped, which
+    /// would change the bytes behind the returned slices or fault on them.
+    pub unsafe fn map(file: &File) -> Result<Self, Error> {
+        let len = file.metadata()?.len() as usize;
+        if len == 0 {
+            // mmap rejects empty mappings
+            return Ok(Self {
+                ptr: ptr::null_mut(),
+                len,
+            });
+        }
+        let ptr = map_file(file, len, libc::PROT_READ, libc::MAP_PRIVATE)?;
+        // only a hint, so failure is harmless
+        libc::madvise(ptr, len, libc::MADV_SEQUENTIAL);
+        Ok(Self { ptr, len })
+    }
+}
+
+impl Deref for MappedFile {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        if self.len == 0 {
+            return &[];
+        }
+        unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+}
+
+impl Drop for MappedFile {
+    fn drop(&mut self) {
+        if self.len > 0 {
+            unsafe {
+                libc::munmap(self.ptr, self.len);
+            }
+        }
+    }
+}
+
+/// Maps the first `len > 0` bytes of `file` with protection `prot` and
+/// `flags`.
+unsafe fn map_file(
+    file: &File,
+    len: usize,
+    prot: libc::c_int,
+    flags: libc::c_int,
+) -> Result<*mut libc::c_void, Error> {
+    let ptr = libc::mmap(ptr::null_mut(), len, prot, flags, file.as_raw_fd(), 0);
+    if ptr == libc::MAP_FAILED {
+        return Err(Error::last_os_error());
+    }
+    Ok(ptr)
+}
+
+/// A whole file mapped shared and writable, which derefs mutably to its
+/// bytes, so that writes through it reach the file without a write call
+/// and only the pages written to are ever read or written back.
+pub struct MappedFileMut {
+    ptr: *mut libc::c_void,
+    len: usize,
+}
+
+// The mapping is only written through `&mut self`.
+unsafe impl Send for MappedFileMut {}
+
+impl MappedFileMut {
+    /// Maps all of `file`, which must be open for reading and writing.
+    ///
+    /// # Safety
+    ///
+    /// Nothing else may truncate the file while mapped, which would fault
+    /// on the returned slices, nor write to it, which would change the
+    /// bytes behind them.
+    pub unsafe fn map(file: &File) -> Result<Self, Error> {
+        let len = file.metadata()?.len() as usize;
+        if len == 0 {
+            return Ok(Self {
+                ptr: ptr::null_mut(),
+                len,
+            });
+        }
+        let ptr = map_file(
+            file,
+            len,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_SHARED,
+        )?;
+        // updates touch scattered pages, so reading ahead only wastes IO
+        libc::madvise(ptr, len, libc::MADV_RANDOM);
+        Ok(Self { ptr, len })
+    }
+
+    /// Writes the pages written to so far back to the file, returning once
+    /// they are on disk.
+    pub fn flush(&self) -> Result<(), Error> {
+        if self.len > 0 && unsafe { libc::msync(self.ptr, self.len, libc::MS_SYNC) } != 0 {
+            return Err(Error::last_os_error());
+        }
+        Ok(())
+    }
+}
+
+impl Deref for MappedFileMut {
+    type Target = [u8];
+
+    fn deref(&self) -> &[u8] {
+        if self.len == 0 {
+            return &[];
+        }
+        unsafe { slice::from_raw_parts(self.ptr as *const u8, self.len) }
+    }
+}
+
+impl DerefMut for MappedFileMut {
+    fn deref_mut(&mut self) -> &mut [u8] {
+        if self.len == 0 {
+            return &mut [];
+        }
+        unsafe { slice::from_raw_parts_mut(self.ptr as *mut u8, self.len) }
+    }
+}
+
+impl Drop for MappedFileMut {
+    fn drop(&mut self) {
+        if self.len > 0 {
+            unsafe {
+                libc::munmap(self.ptr, self.len);
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::env;
+    use std::fs;
+    use std::process;
+
+    use super::*;
+
+    #[test]
+    fn maps_whole_file() {
+        for &len in &[0usize, 1, 5000, 1 << 20] {
+            let path = env::temp_dir().join(format!("dsrs-mapped-{}-{}", process::id(), len));
+            let bytes: Vec<u8> = (0..len).map(|i| (i % 251) as u8).collect();
+            fs::write(&path, &bytes).unwrap();
+            let mapped = unsafe { MappedFile::map(&File::open(&path).unwrap()) }.unwrap();
+            fs::remove_file(&path).unwrap();
+            // the mapping outlives the file's name
+            assert_eq!(&mapped[..], &bytes[..]);
+        }
+    }
+
+    #[test]
+    fn writes_through_to_file() {
+        let path = env::temp_dir().join(format!("dsrs-mapped-mut-{}", process::id()));
+        let file = fs::OpenOptions::new()
+            .read(true)
+            .write(true)
+            .create(true)
+            .truncate(true)
+            .open(&path)
+            .unwrap();
+        assert!(unsafe { MappedFileMut::map(&file) }.unwrap().is_empty());
+        file.set_len(3 << 12).unwrap();
+        let mut mapped = unsafe { MappedFileMut::map(&file) }.unwrap();
+        mapped[5] = 1;
+        mapped[(2 << 12) + 7] = 2;
+        mapped.flush().unwrap();
+        drop(mapped);
+        let bytes = fs::read(&path).unwrap();
+        fs::remove_file(&path).unwrap();
+        assert_eq!(bytes.len(), 3 << 12);
+        assert_eq!((bytes[5], bytes[(2 << 12) + 7]), (1, 2));
+        assert_eq!(bytes.iter().map(|&b| b as usize).sum::<usize>(), 3);
+    }
+}
@@ -0,0 +1,171 @@
+//! Placement of the worker threads of the parallel reducers in
+//! [`crate::stream_reducer`] on NUMA nodes.
+//!
+//! Once [`enable`]d, workers are split into contiguous blocks, one per
+//! node, and each is pinned to the CPUs of its node. Linux allocates a
+//! page on the node of the thread that first touches it, so the sketches
+//! and key tables that each worker grows stay local to it. Each node's
+//! workers are then combined on that node, and only the per-node results
+//! are combined across nodes.
+//!
+//! Elsewhere than on Linux, and on hosts with a single node, this does
+//! nothing.
+
+use std::panic;
+use std::sync::OnceLock;
+use std::thread;
+
+use crate::profile::{self, Stage};
+use crate::stream_reducer::ParallelLineReducer;
+
+/// The CPUs of each node with any, in node order, once enabled.
+static NODES: OnceLock<Vec<Vec<usize>>> = OnceLock::new();
+
+/// Places workers from now on, and returns the number of nodes found.
+pub fn enable() -> usize {
+    NODES.get_or_init(read_nodes).len()
+}
+
+/// Returns the node of worker `worker` of `workers`, if they are placed.
+fn node_of(worker: usize, workers: usize) -> Option<usize> {
+    let nodes = NODES.get().filter(|nodes| nodes.len() > 1)?;
+    Some(worker * nodes.len() / workers)
+}
+
+/// Pins the calling thread, worker `worker` of `workers`, to the CPUs of
+/// its node, if workers are placed.
+pub(crate) fn place_worker(worker: usize, workers: usize) {
+    if let Some(node) = node_of(worker, workers) {
+        pin_to(node);
+    }
+}
+
+/// Combines `reducers`, those of workers 0, 1, ... in order, into `into`.
+/// When workers are placed, those of each node are first combined on a
+/// thread pinned to that node, with the nodes in parallel.
+///
+/// Panics while combining are propagated to the caller.
+pub(crate) fn combine_workers<T: ParallelLineReducer>(into: &mut T, reducers: Vec<T>) {
+    let _merge = profile::span(Stage::Merge, 0);
+    let workers = reducers.len();
+    if workers == 0 || node_of(0, workers).is_none() {
+        reducers
+            .into_iter()
+            .for_each(|reducer| into.combine(reducer));
+        return;
+    }
+    let mut groups: Vec<(usize, Vec<T>)> = Vec::new();
+    for (worker, reducer) in reducers.into_iter().enumerate() {
+        let node = node_of(worker, workers).expect("placed workers");
+        match groups.last_mut() {
+            Some((last, group)) if *last == node => group.push(reducer),
+            _ => groups.push((node, vec![reducer])),
+        }
+    }
+    thread::scope(|scope| {
+        let combiners: Vec<_> = groups
+            .into_iter()
+            .map(|(node, group)| {
+                scope.spawn(move || {
+                    let _merge = profile::span(Stage::Merge, 0);
+                    pin_to(node);
+                    let mut group = group.into_iter();
+                    let mut combined = group.next().expect("nonempty group");
+                    group.for_each(|reducer| combined.combine(reducer));
+                    combined
+                })
+            })
+            .collect();
+        for combiner in combiners {
+            match combiner.join() {
+                Ok(combined) => into.combine(combined),
+                Err(e) => panic::resume_unwind(e),
+            }
+        }
+    });
+}
+
+#[cfg(target_os = "linux")]
+fn read_nodes() -> Vec<Vec<usize>> {
+    use std::fs;
+
+    let mut nodes: Vec<(usize, Vec<usize>)> = fs::read_dir("/sys/devices/system/node")
+        .into_iter()
+        .flatten()
+        .filter_map(|entry| {
+            let entry = entry.ok()?;
+            let node = entry
+                .file_name()
+                .to_str()?
+                .strip_prefix("node")?
+                .parse()
+                .ok()?;
+            let cpulist = fs::read_to_string(entry.path().join("cpulist")).ok()?;
+            Some((node, parse_cpulist(&cpulist)?))
+        })
+        // nodes of memory alone have no CPUs to run workers on
+        .filter(|(_, cpus)| !cpus.is_empty())
+        .collect();
+    nodes.sort();
+    nodes.into_iter().map(|(_, cpus)| cpus).collect()
+}
+
+#[cfg(not(target_os = "linux"))]
+fn read_nodes() -> Vec<Vec<usize>> {
+    Vec::new()
+}
+
+/// Parses a list of CPUs such as `0-3,8,10-11`.
+#[cfg_attr(not(target_os = "linux"), allow(dead_code))]
+fn parse_cpulist(cpulist: &str) -> Option<Vec<usize>> {
+    let mut cpus = Vec::new();
+    for range in cpulist.trim().split(',').filter(|range| !range.is_empty()) {
+        let (first, last): (usize, usize) = match range.split_once('-') {
+            Some((first, last)) => (first.parse().ok()?, last.parse().ok()?),
+            None => {
+                let cpu = range.parse().ok()?;
+                (cpu, cpu)
+            }
+        };
+        cpus.extend(first..=last);
+    }
+    Some(cpus)
+}
+
+/// Pins the calling thread to the CPUs of `node`. Failure only costs
+/// locality, so it is ignored.
+#[cfg(target_os = "linux")]
+fn pin_to(node: usize) {
+    let cpus = match NODES.get().and_then(|nodes| nodes.get(node)) {
+        Some(cpus) => cpus,
+        None => return,
+    };
+    unsafe {
+        let mut set: libc::cpu_set_t = std::mem::zeroed();
+        for &cpu in cpus {
+            if cpu < libc::CPU_SETSIZE as usize {
+                libc::CPU_SET(cpu, &mut set);
+            }
+        }
+        libc::sched_setaffinity(0, std::mem::size_of::<libc::cpu_set_t>(), &set);
+    }
+}
+
+#[cfg(not(target_os = "linux"))]
+fn pin_to(_node: usize) {}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn parses_cpulists() {
+        assert_eq!(
+            parse_cpulist("0-3,8,10-11\n"),
+            Some(vec![0, 1, 2, 3, 8, 10, 11])
+        );
+        assert_eq!(parse_cpulist("5"), Some(vec![5]));
+        assert_eq!(parse_cpulist("\n"), Some(vec![]));
+        assert_eq!(parse_cpulist("0-x"), None);
+    }
+}
@@ -0,0 +1,430 @@
+//! Wall time and bytes spent in each stage of the `dsrs` pipeline, and
+//! the depths of the queues between its threads, for `dsrs --stats`.
+//!
+//! Nothing is recorded until [`enable`] is called, and until then a
+//! [`span`] costs a relaxed load. Once enabled, a span reads the time
+//! stamp counter where there is one at either end, and adds its time to
+//! counters of its own thread, so threads never write to the same cache
+//! lines. Spans nest, and the time of a span excludes that of the spans
+//! within it, so the stages add up to the time of all spans.
+//!
+//! Spans wrap whole buffers or sketches rather than lines. Time blocked
+//! on a queue is its own [`Stage::Wait`], so the time of the other stages
+//! is time spent working.
+
+use std::cell::Cell;
+use std::io::{BufRead, Read, Result};
+use std::sync::atomic::{AtomicBool, AtomicU64, AtomicUsize, Ordering};
+use std::sync::{Arc, Mutex, OnceLock};
+use std::time::Instant;
+
+/// A stage of the pipeline.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Stage {
+    /// Reading input, from the time a reader asks for more bytes until it
+    /// has them, decompressed if need be.
+    Read,
+    /// Decompressing input, on the threads doing so.
+    Decompress,
+    /// Splitting input into lines and packing them into buffers for the
+    /// worker threads.
+    Split,
+    /// Finding the key and value fields of lines.
+    KeyExtract,
+    /// Hashing batches of keys.
+    Hash,
+    /// Updating sketches with lines, and anything else reducers do with
+    /// them that no other stage covers.
+    Update,
+    /// Combining the reducers of the worker threads.
+    Merge,
+    /// Serializing sketches.
+    Serialize,
+    /// Blocked on a queue between threads.
+    Wait,
+}
+
+impl Stage {
+    /// Every stage, in the order they are reported.
+    pub const ALL: [Stage; 9] = [
+        Stage::Read,
+        Stage::Decompress,
+        Stage::Split,
+        Stage::KeyExtract,
+        Stage::Hash,
+        Stage::Update,
+        Stage::Merge,
+        Stage::Serialize,
+        Stage::Wait,
+    ];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Stage::Read => "read",
+            Stage::Decompress => "decompress",
+            Stage::Split => "split",
+            Stage::KeyExtract => "key_extract",
+            Stage::Hash => "hash",
+            Stage::Update => "update",
+            Stage::Merge => "merge",
+            Stage::Serialize => "serialize",
+            Stage::Wait => "wait",
+        }
+    }
+}
+
+const STAGES: usize = Stage::ALL.len();
+
+static ENABLED: AtomicBool = AtomicBool::new(false);
+
+/// When recording started, as an instant and in ticks.
+static START: OnceLock<(Instant, u64)> = OnceLock::new();
+
+/// The totals of every thread that has recorded anything.
+static THREADS: Mutex<Vec<Arc<ThreadTotals>>> = Mutex::new(Vec::new());
+
+#[derive(Default)]
+struct ThreadTotals {
+    ticks: [AtomicU64; STAGES],
+    bytes: [AtomicU64; STAGES],
+    spans: [AtomicU64; STAGES],
+}
+
+thread_local! {
+    static TOTALS: Arc<ThreadTotals> = {
+        let totals = Arc::new(ThreadTotals::default());
+        THREADS.lock().expect("lock never poisoned").push(Arc::clone(&totals));
+        totals
+    };
+    /// Ticks of the spans within the innermost open span of this thread.
+    static NESTED: Cell<u64> = Cell::new(0);
+}
+
+/// Starts recording.
+pub fn enable() {
+    START.get_or_init(|| (Instant::now(), ticks()));
+    ENABLED.store(true, Ordering::Relaxed);
+}
+
+#[inline]
+fn enabled() -> bool {
+    ENABLED.load(Ordering::Relaxed)
+}
+
+#[cfg(target_arch = "x86_64")]
+#[inline]
+fn ticks() -> u64 {
+    unsafe { core::arch::x86_64::_rdtsc() }
+}
+
+/// Nanoseconds since recording started, elsewhere than on x86-64.
+#[cfg(not(target_arch = "x86_64"))]
+#[inline]
+fn ticks() -> u64 {
+    START
+        .get()
+        .map_or(0, |(start, _)| start.elapsed().as_nanos() as u64)
+}
+
+fn add(totals: &[AtomicU64; STAGES], stage: Stage, n: u64) {
+    totals[stage as usize].fetch_add(n, Ordering::Relaxed);
+}
+
+/// Adds `bytes` to those of `stage`, for bytes that are not handled
+/// within a single span.
+pub fn add_bytes(stage: Stage, bytes: usize) {
+    if enabled() {
+        TOTALS.with(|totals| add(&totals.bytes, stage, bytes as u64));
+    }
+}
+
+/// Time spent in a stage until dropped; see [`span`].
+#[must_use]
+pub struct Span {
+    open: Option<OpenSpan>,
+}
+
+struct OpenSpan {
+    stage: Stage,
+    start: u64,
+    bytes: u64,
+    /// The nested ticks of the enclosing span.
+    outer_nested: u64,
+}
+
+/// Starts timing `stage`, which handles `bytes` bytes, until the returned
+/// span is dropped.
+#[inline]
+pub fn span(stage: Stage, bytes: usize) -> Span {
+    if !enabled() {
+        return Span { open: None };
+    }
+    Span {
+        open: Some(OpenSpan {
+            stage,
+            start: ticks(),
+            bytes: bytes as u64,
+            outer_nested: NESTED.with(|nested| nested.replace(0)),
+        }),
+    }
+}
+
+impl Drop for Span {
+    fn drop(&mut self) {
+        if let Some(open) = &self.open {
+            let elapsed = ticks().wrapping_sub(open.start);
+            let nested = NESTED.with(|nested| nested.replace(open.outer_nested + elapsed));
+            TOTALS.with(|totals| {
+                add(&totals.ticks, open.stage, elapsed.saturating_sub(nested));
+                add(&totals.bytes, open.stage, open.bytes);
+                add(&totals.spans, open.stage, 1);
+            });
+        }
+    }
+}
+
+/// A reader whose reads, and waits for bytes to read, are timed as
+/// [`Stage::Read`].
+pub struct TimedRead<R> {
+    inner: R,
+}
+
+impl<R> TimedRead<R> {
+    pub fn new(inner: R) -> Self {
+        Self { inner }
+    }
+}
+
+impl<R: Read> Read for TimedRead<R> {
+    fn read(&mut self, buf: &mut [u8]) -> Result<usize> {
+        let _span = span(Stage::Read, 0);
+        let n = self.inner.read(buf)?;
+        add_bytes(Stage::Read, n);
+        Ok(n)
+    }
+}
+
+impl<R: BufRead> BufRead for TimedRead<R> {
+    fn fill_buf(&mut self) -> Result<&[u8]> {
+        let _span = span(Stage::Read, 0);
+        self.inner.fill_buf()
+    }
+
+    fn consume(&mut self, amt: usize) {
+        add_bytes(Stage::Read, amt);
+        self.inner.consume(amt)
+    }
+}
+
+/// The queues whose depths are reported.
+#[derive(Clone, Copy, Debug, PartialEq, Eq)]
+pub enum Queue {
+    /// Buffers of lines handed to worker threads.
+    Lines,
+    /// Chunks of decompressed input handed to the reader.
+    Decompressed,
+}
+
+impl Queue {
+    pub const ALL: [Queue; 2] = [Queue::Lines, Queue::Decompressed];
+
+    pub fn name(self) -> &'static str {
+        match self {
+            Queue::Lines => "lines",
+            Queue::Decompressed => "decompressed",
+        }
+    }
+}
+
+struct QueueTotals {
+    sends: AtomicU64,
+    depth_sum: AtomicU64,
+    max_depth: AtomicU64,
+}
+
+const NO_SENDS: QueueTotals = QueueTotals {
+    sends: AtomicU64::new(0),
+    depth_sum: AtomicU64::new(0),
+    max_depth: AtomicU64::new(0),
+};
+
+static QUEUES: [QueueTotals; Queue::ALL.len()] = [NO_SENDS; Queue::ALL.len()];
+
+/// Tracks the items in flight on one queue, such as a channel, and
+/// records the depth that each one sent finds, itself included.
+pub struct QueueGauge {
+    queue: Queue,
+    depth: AtomicUsize,
+}
+
+impl QueueGauge {
+    pub fn new(queue: Queue) -> Self {
+        Self {
+            queue,
+            depth: AtomicUsize::new(0),
+        }
+    }
+
+    /// Records an item about to be sent.
+    pub fn sent(&self) {
+        if !enabled() {
+            return;
+        }
+        let depth = self.depth.fetch_add(1, Ordering::Relaxed) as u64 + 1;
+        let totals = &QUEUES[self.queue as usize];
+        totals.sends.fetch_add(1, Ordering::Relaxed);
+        totals.depth_sum.fetch_add(depth, Ordering::Relaxed);
+        totals.max_depth.fetch_max(depth, Ordering::Relaxed);
+    }
+
+    /// Records an item received.
+    pub fn received(&self) {
+        if enabled() {
+            // saturating, in case recording started with items in flight
+            let _ = self
+                .depth
+                .fetch_update(Ordering::Relaxed, Ordering::Relaxed, |depth| {
+                    depth.checked_sub(1)
+                });
+        }
+    }
+}
+
+/// The totals of one stage over all threads.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct StageTotals {
+    pub seconds: f64,
+    pub bytes: u64,
+    pub spans: u64,
+}
+
+/// The depths found by the items sent on one queue.
+#[derive(Clone, Copy, Debug, Default, PartialEq)]
+pub struct QueueDepths {
+    pub sends: u64,
+    pub mean_depth: f64,
+    pub max_depth: u64,
+}
+
+/// Returns the wall time since recording started, in seconds.
+pub fn wall_seconds() -> f64 {
+    START
+        .get()
+        .map_or(0.0, |(start, _)| start.elapsed().as_secs_f64())
+}
+
+/// Returns the ticks per second, measured over the time since recording
+/// started.
+fn ticks_per_second() -> f64 {
+    match START.get() {
+        Some((start, start_ticks)) => {
+            let seconds = start.elapsed().as_secs_f64();
+            let elapsed = ticks().wrapping_sub(*start_ticks) as f64;
+            if seconds > 0.0 && elapsed > 0.0 {
+                elapsed / seconds
+            } else {
+                1e9
+            }
+        }
+        None => 1e9,
+    }
+}
+
+/// Returns the totals of each of [`Stage::ALL`] so far, in order, over
+/// all threads.
+pub fn stages() -> Vec<(Stage, StageTotals)> {
+    let per_second = ticks_per_second();
+    let threads = THREADS.lock().expect("lock never poisoned");
+    Stage::ALL
+        .iter()
+        .map(|&stage| {
+            let sum = |counts: fn(&ThreadTotals) -> &[AtomicU64; STAGES]| -> u64 {
+                threads
+                    .iter()
+                    .map(|totals| counts(totals)[stage as usize].load(Ordering::Relaxed))
+                    .sum()
+            };
+            let totals = StageTotals {
+                seconds: sum(|totals| &totals.ticks) as f64 / per_second,
+                bytes: sum(|totals| &totals.bytes),
+                spans: sum(|totals| &totals.spans),
+            };
+            (stage, totals)
+        })
+        .collect()
+}
+
+/// Returns the depths of each of [`Queue::ALL`] so far, in order.
+pub fn queues() -> Vec<(Queue, QueueDepths)> {
+    Queue::ALL
+        .iter()
+        .map(|&queue| {
+            let totals = &QUEUES[queue as usize];
+            let sends = totals.sends.load(Ordering::Relaxed);
+            let depths = QueueDepths {
+                sends,
+                mean_depth: totals.depth_sum.load(Ordering::Relaxed) as f64 / sends.max(1) as f64,
+                max_depth: totals.max_depth.load(Ordering::Relaxed),
+            };
+            (queue, depths)
+        })
+        .collect()
+}
+
+/// Returns the CPU time of the process so far, user and system, in
+/// seconds, where it is known.
+#[cfg(unix)]
+pub fn cpu_seconds() -> Option<f64> {
+    let mut usage: libc::rusage = unsafe { std::mem::zeroed() };
+    if unsafe { libc::getrusage(libc::RUSAGE_SELF, &mut usage) } != 0 {
+        return None;
+    }
+    let seconds = |tv: libc::timeval| tv.tv_sec as f64 + tv.tv_usec as f64 * 1e-6;
+    Some(seconds(usage.ru_utime) + seconds(usage.ru_stime))
+}
+
+#[cfg(not(unix))]
+pub fn cpu_seconds() -> Option<f64> {
+    None
+}
+
+#[cfg(test)]
+mod tests {
+    use std::thread;
+    use std::time::Duration;
+
+    use super::*;
+
+    #[test]
+    fn nested_spans_are_exclusive() {
+        enable();
+        let before = stages();
+        thread::spawn(|| {
+            let _outer = span(Stage::Merge, 10);
+            thread::sleep(Duration::from_millis(20));
+            let _inner = span(Stage::Wait, 0);
+            thread::sleep(Duration::from_millis(40));
+        })
+        .join()
+        .unwrap();
+        let after = stages();
+        let delta = |stage: Stage| {
+            let (b, a) = (before[stage as usize].1, after[stage as usize].1);
+            (a.seconds - b.seconds, a.bytes - b.bytes, a.spans - b.spans)
+        };
+        let (merge, merge_bytes, merge_spans) = delta(Stage::Merge);
+        let (wait, _, wait_spans) = delta(Stage::Wait);
+        assert_eq!((merge_bytes, merge_spans, wait_spans), (10, 1, 1));
+        assert!(wait >= 0.035, "wait {}", wait);
+        assert!(merge >= 0.015 && merge < wait, "merge {}", merge);
+
+        let gauge = QueueGauge::new(Queue::Decompressed);
+        let sends = queues()[1].1.sends;
+        gauge.sent();
+        gauge.sent();
+        gauge.received();
+        let depths = queues()[1].1;
+        assert_eq!(depths.sends, sends + 2);
+        assert!(depths.max_depth >= 2);
+    }
+}
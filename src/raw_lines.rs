@@ -0,0 +1,278 @@
+//! Text output of `dsrs --key --raw`, a line of each key and its base64
+//! serialized sketch. Sketches are serialized back to back into one
+//! buffer as they come, and base64 encoded a chunk at a time, split
+//! among several threads, rather than into a `String` per key.
+//!
+//! With `--format arrow`, the same buffer instead becomes the sketch
+//! column of an Arrow record batch as it is, next to the keys and the
+//! estimates and bounds read from each sketch.
+
+use std::io::{self, Result, Write};
+use std::str;
+use std::thread;
+
+use base64;
+
+use crate::arrow_ipc::{self, Column, DataType};
+use crate::counters::{Algo, Counter};
+
+/// Serialized bytes gathered per thread before a chunk is encoded.
+const CHUNK_BYTES: usize = 1 << 20;
+
+/// Serialized bytes gathered before an Arrow record batch is written,
+/// large for engines reading them but well under the 2GiB that the 32-bit
+/// offsets of a binary column can address.
+const RECORD_BATCH_BYTES: usize = 1 << 26;
+
+/// The columns of `--format arrow` output.
+const ARROW_SCHEMA: [(&str, DataType); 5] = [
+    ("key", DataType::Binary),
+    ("estimate", DataType::Float64),
+    ("lower_bound", DataType::Float64),
+    ("upper_bound", DataType::Float64),
+    ("sketch", DataType::Binary),
+];
+
+/// The keys of queued Arrow rows, whose sketches are kept apart from them
+/// to be written as one column.
+struct ArrowRows {
+    algo: Algo,
+    /// Whether the schema, which starts the stream, is written.
+    started: bool,
+    keys: Vec<u8>,
+    key_ends: Vec<usize>,
+    sketch_ends: Vec<usize>,
+}
+
+/// Buffers keyed lines for [`Self::flush`] to encode and write in order.
+pub struct RawLines {
+    threads: usize,
+    /// Keys and their serialized sketches, back to back.
+    pending: Vec<u8>,
+    /// The end of each key in `pending`, and of its sketch after it.
+    records: Vec<(usize, usize)>,
+    /// The lines each thread encoded last, kept for their capacity.
+    encoded: Vec<String>,
+    /// Set to write Arrow rows, of sketches alone in `pending`, instead.
+    arrow: Option<ArrowRows>,
+}
+
+impl RawLines {
+    /// Encodes on up to `threads` threads.
+    pub fn new(threads: usize) -> Self {
+        assert!(threads > 0, "need at least one thread");
+        Self {
+            threads,
+            pending: Vec::new(),
+            records: Vec::new(),
+            encoded: vec![String::new(); threads],
+            arrow: None,
+        }
+    }
+
+    /// Writes an Arrow IPC stream of rows instead, reading the bounds of
+    /// the serialized `algo` counters on up to `threads` threads.
+    pub fn arrow(threads: usize, algo: Algo) -> Self {
+        let mut lines = Self::new(threads);
+        lines.arrow = Some(ArrowRows {
+            algo,
+            started: false,
+            keys: Vec::new(),
+            key_ends: Vec::new(),
+            sketch_ends: Vec::new(),
+        });
+        lines
+    }
+
+    /// Queues the line of `key` and the sketch that `serialize` appends
+    /// to the buffer it is given, and writes out a chunk of lines to `out`
+    /// once enough are queued.
+    ///
+    /// Panics if `key` is not UTF-8, unless writing Arrow rows.
+    pub fn push<W: Write>(
+        &mut self,
+        out: &mut W,
+        key: &[u8],
+        serialize: impl FnOnce(&mut Vec<u8>),
+    ) -> Result<()> {
+        if let Some(rows) = &mut self.arrow {
+            rows.keys.extend_from_slice(key);
+            rows.key_ends.push(rows.keys.len());
+            serialize(&mut self.pending);
+            rows.sketch_ends.push(self.pending.len());
+            if self.pending.len() + rows.keys.len() >= RECORD_BATCH_BYTES {
+                self.flush(out)?;
+            }
+            return Ok(());
+        }
+        str::from_utf8(key).expect("valid UTF-8");
+        self.pending.extend_from_slice(key);
+        let key_end = self.pending.len();
+        serialize(&mut self.pending);
+        self.records.push((key_end, self.pending.len()));
+        if self.pending.len() >= CHUNK_BYTES * self.threads {
+            self.flush(out)?;
+        }
+        Ok(())
+    }
+
+    /// Encodes and writes every queued line to `out`, in order.
+    pub fn flush<W: Write>(&mut self, out: &mut W) -> Result<()> {
+        if self.arrow.is_some() {
+            return self.flush_arrow(out);
+        }
+        // split the records among the threads by their bytes, not count,
+        // so one thread does not get all the large sketches
+        let share = self.pending.len() / self.threads + 1;
+        let mut shares = Vec::with_capacity(self.threads);
+        let mut first = 0;
+        let mut start = 0;
+        for (i, &(_, end)) in self.records.iter().enumerate() {
+            if end - start >= share || i + 1 == self.records.len() {
+                shares.push((first, i + 1, start));
+                first = i + 1;
+                start = end;
+            }
+        }
+
+        let (pending, records) = (&self.pending, &self.records);
+        let encode = |(first, last, start): (usize, usize, usize), lines: &mut String| {
+            lines.clear();
+            let mut start = start;
+            for &(key_end, end) in &records[first..last] {
+                lines.push_str(str::from_utf8(&pending[start..key_end]).expect("valid UTF-8"));
+                lines.push(' ');
+                base64::encode_config_buf(&pending[key_end..end], base64::STANDARD_NO_PAD, lines);
+                lines.push('\n');
+                start = end;
+            }
+        };
+        let mut encoded = self.encoded.iter_mut();
+        if shares.len() <= 1 {
+            let lines = encoded.next().expect("one thread");
+            shares.into_iter().for_each(|share| encode(share, lines));
+        } else {
+            let encode = &encode;
+            thread::scope(|scope| {
+                for (share, lines) in shares.into_iter().zip(encoded) {
+                    scope.spawn(move || encode(share, lines));
+                }
+            });
+        }
+
+        // threads left without a share have nothing from earlier flushes
+        for lines in &mut self.encoded {
+            out.write_all(lines.as_bytes())?;
+            lines.clear();
+        }
+        self.pending.clear();
+        self.records.clear();
+        Ok(())
+    }
+
+    /// Flushes what is queued to `out`, and ends an Arrow stream, which
+    /// then has a schema even if no rows were pushed.
+    pub fn finish<W: Write>(mut self, out: &mut W) -> Result<()> {
+        self.flush(out)?;
+        if let Some(rows) = &mut self.arrow {
+            if !rows.started {
+                arrow_ipc::write_schema(out, &ARROW_SCHEMA)?;
+            }
+            arrow_ipc::write_end(out)?;
+        }
+        Ok(())
+    }
+
+    /// Writes the queued Arrow rows as one record batch, with the sketches
+    /// straight from where they were serialized.
+    fn flush_arrow<W: Write>(&mut self, out: &mut W) -> Result<()> {
+        let rows = self.arrow.as_mut().expect("writing Arrow rows");
+        if !rows.started {
+            arrow_ipc::write_schema(out, &ARROW_SCHEMA)?;
+            rows.started = true;
+        }
+        if rows.sketch_ends.is_empty() {
+            return Ok(());
+        }
+        let pending = &self.pending;
+        let starts = [0].iter().chain(&rows.sketch_ends);
+        let sketches: Vec<&[u8]> = starts
+            .zip(&rows.sketch_ends)
+            .map(|(&start, &end)| &pending[start..end])
+            .collect();
+        let bounds = Counter::bounds_many(&sketches, rows.algo, self.threads)
+            .map_err(|e| io::Error::new(io::ErrorKind::InvalidData, e))?;
+        let column =
+            |pick: fn(&(f64, f64, f64)) -> f64| bounds.iter().map(pick).collect::<Vec<_>>();
+        let (estimates, lower, upper) = (column(|b| b.0), column(|b| b.1), column(|b| b.2));
+        arrow_ipc::write_record_batch(
+            out,
+            &[
+                Column::Binary {
+                    values: &rows.keys,
+                    ends: &rows.key_ends,
+                },
+                Column::Float64(&estimates),
+                Column::Float64(&lower),
+                Column::Float64(&upper),
+                Column::Binary {
+                    values: &self.pending,
+                    ends: &rows.sketch_ends,
+                },
+            ],
+        )?;
+        self.pending.clear();
+        rows.keys.clear();
+        rows.key_ends.clear();
+        rows.sketch_ends.clear();
+        Ok(())
+    }
+}
+
+#[cfg(test)]
+mod tests {
+
+    use super::*;
+
+    fn sketch(i: usize) -> Vec<u8> {
+        // a few sketches large enough to get a share to themselves
+        let len = if i % 1000 == 0 {
+            3 * CHUNK_BYTES / 2
+        } else {
+            i % 50
+        };
+        (0..len).map(|j| (i + j) as u8).collect()
+    }
+
+    #[test]
+    fn lines_in_order() {
+        let n = 20 * 1000;
+        let mut expected = Vec::new();
+        for i in 0..n {
+            let encoded = base64::encode_config(&sketch(i), base64::STANDARD_NO_PAD);
+            expected.extend_from_slice(format!("key{} {}\n", i, encoded).as_bytes());
+        }
+        for &threads in &[1, 2, 3, 8] {
+            let mut lines = RawLines::new(threads);
+            let mut out = Vec::new();
+            for i in 0..n {
+                let key = format!("key{}", i);
+                lines
+                    .push(&mut out, key.as_bytes(), |buf| {
+                        buf.extend_from_slice(&sketch(i))
+                    })
+                    .unwrap();
+            }
+            lines.flush(&mut out).unwrap();
+            lines.flush(&mut out).unwrap();
+            assert!(out == expected, "threads {}", threads);
+        }
+    }
+
+    #[test]
+    #[should_panic]
+    fn non_utf8_key() {
+        let mut lines = RawLines::new(2);
+        let _ = lines.push(&mut Vec::new(), &[0xff], |_| {});
+    }
+}
@@ -0,0 +1,751 @@
+//! A keyed store of serialized sketches on disk, appended to in whole
+//! batches, so that keyed counts of many runs add up without any run
+//! rewriting the sketches of the runs before.
+//!
+//! A store is a directory of segments. Each segment is a file holding
+//! [`MAGIC`], the algo and `lg_k` of its sketches, and then a sorted run
+//! of records as [`crate::counters::KeyedCounter`] spills them: a key
+//! [frame](crate::frames) followed by a frame holding its serialized
+//! sketch, in ascending key order, with every key at most once. Appending
+//! a batch writes one new segment, to a temporary file renamed into place
+//! once complete. A key's sketch is the union of its sketches across all
+//! segments, so queries merge those of the segments whose keys span it,
+//! found from the first and last key of each, and read only around the
+//! key, found from a sparse index of every [`INDEX_EVERY`]-th key.
+//!
+//! Once a store has [`SegmentStore::DEFAULT_MAX_SEGMENTS`] segments, an
+//! append starts merging them all into one on a background thread, the
+//! sketches of each key unioned into one, while queries carry on over the
+//! segments it reads. The merged segment is renamed into place before the
+//! ones it replaces are removed, so a run stopped in between leaves a
+//! key's sketches in both, which only unions them twice and changes no
+//! count.
+
+use std::cmp::Ordering as KeyOrdering;
+use std::fs::{self, File, OpenOptions};
+use std::io::{self, BufReader, BufWriter, Error, ErrorKind, Read, Write};
+use std::mem;
+use std::ops::{Bound, RangeBounds};
+use std::os::unix::fs::FileExt;
+use std::os::unix::io::AsRawFd;
+use std::path::{Path, PathBuf};
+use std::sync::atomic::{AtomicBool, AtomicU64, Ordering};
+use std::sync::{Arc, Mutex};
+use std::thread::{self, JoinHandle};
+
+use libc;
+
+use crate::counters::{Algo, Counter, Merger};
+use crate::frames::{read_frame, write_frame};
+use crate::spill::merge_sorted;
+
+/// The first bytes of every segment.
+pub const MAGIC: &[u8; 8] = b"dsrsseg1";
+
+/// Bytes of a segment before its first record.
+const HEADER_BYTES: u64 = MAGIC.len() as u64 + 2;
+
+/// Keys of a segment between those of its sparse index.
+pub const INDEX_EVERY: usize = 64;
+
+/// A segment, with its key range and sparse index held in memory.
+struct Segment {
+    id: u64,
+    path: PathBuf,
+    // Read at offsets, so that queries on several threads share it.
+    file: File,
+    last: Vec<u8>,
+    // Every INDEX_EVERY-th key, from the first, and the offset of its record.
+    index: Vec<(Vec<u8>, u64)>,
+}
+
+impl Segment {
+    fn first(&self) -> &[u8] {
+        &self.index[0].0
+    }
+
+    /// Returns whether the segment may hold keys in `range`.
+    fn overlaps<'a>(&self, range: &impl RangeBounds<&'a [u8]>) -> bool {
+        let after_start = match range.start_bound() {
+            Bound::Included(start) => self.last.as_slice() >= *start,
+            Bound::Excluded(start) => self.last.as_slice() > *start,
+            Bound::Unbounded => true,
+        };
+        let before_end = match range.end_bound() {
+            Bound::Included(end) => self.first() <= *end,
+            Bound::Excluded(end) => self.first() < *end,
+            Bound::Unbounded => true,
+        };
+        after_start && before_end
+    }
+
+    /// Reads the records of the segment from the last indexed key at or
+    /// before `key`, or from the first if `key` is unbounded.
+    fn records_from(&self, key: Bound<&[u8]>) -> impl Read + '_ {
+        let offset = match key {
+            Bound::Included(key) | Bound::Excluded(key) => {
+                let after = self
+                    .index
+                    .partition_point(|(indexed, _)| indexed.as_slice() <= key);
+                self.index[after.max(1) - 1].1
+            }
+            Bound::Unbounded => HEADER_BYTES,
+        };
+        BufReader::new(ReadAt {
+            file: &self.file,
+            offset,
+        })
+    }
+
+    /// Returns the sketch of `key` in the segment, if it has one.
+    fn get(&self, key: &[u8]) -> Result<Option<Vec<u8>>, Error> {
+        if key < self.first() || key > self.last.as_slice() {
+            return Ok(None);
+        }
+        let mut records = self.records_from(Bound::Included(key));
+        let (mut next, mut value) = (Vec::new(), Vec::new());
+        while read_record(&mut records, &mut next, &mut value)? {
+            match next.as_slice().cmp(key) {
+                KeyOrdering::Less => {}
+                KeyOrdering::Equal => return Ok(Some(value)),
+                KeyOrdering::Greater => break,
+            }
+        }
+        Ok(None)
+    }
+}
+
+/// Reads a file from an offset without moving its cursor.
+struct ReadAt<'a> {
+    file: &'a File,
+    offset: u64,
+}
+
+impl Read for ReadAt<'_> {
+    fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+        let n = self.file.read_at(buf, self.offset)?;
+        self.offset += n as u64;
+        Ok(n)
+    }
+}
+
+/// Reads the next record of `input`, returning `false` at the end of the
+/// segment.
+fn read_record<R: Read>(input: &mut R, key: &mut Vec<u8>, value: &mut Vec<u8>) -> io::Result<bool> {
+    if !read_frame(input, key)? {
+        return Ok(false);
+    }
+    if !read_frame(input, value)? {
+        return Err(ErrorKind::UnexpectedEof.into());
+    }
+    Ok(true)
+}
+
+fn algo_byte(algo: Algo) -> u8 {
+    match algo {
+        Algo::Cpc => 0,
+        Algo::Hll => 1,
+    }
+}
+
+/// Writes a segment's records, indexing them as it goes.
+struct SegmentWriter {
+    out: BufWriter<File>,
+    offset: u64,
+    records: usize,
+    last: Vec<u8>,
+    index: Vec<(Vec<u8>, u64)>,
+}
+
+impl SegmentWriter {
+    fn new(file: File, algo: Algo, lg_k: u8) -> io::Result<Self> {
+        let mut out = BufWriter::new(file);
+        out.write_all(MAGIC)?;
+        out.write_all(&[algo_byte(algo), lg_k])?;
+        Ok(Self {
+            out,
+            offset: HEADER_BYTES,
+            records: 0,
+            last: Vec::new(),
+            index: Vec::new(),
+        })
+    }
+
+    /// Writes the record of `key`, which must come after the last one's.
+    fn push(&mut self, key: &[u8], value: &[u8]) -> io::Result<()> {
+        debug_assert!(self.records == 0 || key > self.last.as_slice());
+        if self.records % INDEX_EVERY == 0 {
+            self.index.push((key.to_vec(), self.offset));
+        }
+        write_frame(&mut self.out, key)?;
+        write_frame(&mut self.out, value)?;
+        self.offset += 8 + (key.len() + value.len()) as u64;
+        self.records += 1;
+        self.last.clear();
+        self.last.extend_from_slice(key);
+        Ok(())
+    }
+}
+
+/// What a store shares with its background compaction.
+struct Shared {
+    dir: PathBuf,
+    algo: Algo,
+    lg_k: u8,
+    segments: Mutex<Vec<Arc<Segment>>>,
+    next_id: AtomicU64,
+    compacting: AtomicBool,
+}
+
+impl Shared {
+    fn segment_path(&self, id: u64) -> PathBuf {
+        self.dir.join(format!("{:016x}.seg", id))
+    }
+
+    /// Creates the segment whose records `write` pushes, unless it pushes
+    /// none, through a temporary file that only becomes a segment whole.
+    fn write_segment(
+        &self,
+        write: impl FnOnce(&mut SegmentWriter) -> io::Result<()>,
+    ) -> io::Result<Option<Segment>> {
+        let id = self.next_id.fetch_add(1, Ordering::Relaxed);
+        let tmp = self.dir.join(format!("{:016x}.tmp", id));
+        let written = File::create(&tmp)
+            .and_then(|file| SegmentWriter::new(file, self.algo, self.lg_k))
+            .and_then(|mut writer| {
+                write(&mut writer)?;
+                if writer.records == 0 {
+                    return Ok(None);
+                }
+                let file = writer.out.into_inner().map_err(|e| e.into_error())?;
+                file.sync_all()?;
+                Ok(Some((writer.last, writer.index)))
+            });
+        let (last, index) = match written {
+            Ok(Some(written)) => written,
+            unwritten => {
+                let _ = fs::remove_file(&tmp);
+                return unwritten.map(|_| None);
+            }
+        };
+        let path = self.segment_path(id);
+        fs::rename(&tmp, &path)?;
+        Ok(Some(Segment {
+            id,
+            file: File::open(&path)?,
+            path,
+            last,
+            index,
+        }))
+    }
+
+    /// Reads the segment at `path`, which must hold sketches of the
+    /// store's algo and `lg_k`.
+    fn read_segment(&self, id: u64, path: PathBuf) -> io::Result<Segment> {
+        let file = File::open(&path)?;
+        let mut input = BufReader::new(&file);
+        let mut header = [0u8; HEADER_BYTES as usize];
+        input.read_exact(&mut header)?;
+        if header[..MAGIC.len()] != MAGIC[..] {
+            return Err(Error::new(
+                ErrorKind::InvalidData,
+                format!("{} is not a segment", path.display()),
+            ));
+        }
+        if header[MAGIC.len()..] != [algo_byte(self.algo), self.lg_k] {
+            return Err(Error::new(
+                ErrorKind::InvalidInput,
+                format!(
+                    "{} holds sketches of another algo or lg_k than {:?} with lg_k {}",
+                    path.display(),
+                    self.algo,
+                    self.lg_k
+                ),
+            ));
+        }
+        let (mut key, mut last, mut value) = (Vec::new(), Vec::new(), Vec::new());
+        let mut index = Vec::new();
+        let mut offset = HEADER_BYTES;
+        let mut records = 0;
+        while read_record(&mut input, &mut key, &mut value)? {
+            if records % INDEX_EVERY == 0 {
+                index.push((key.clone(), offset));
+            }
+            offset += 8 + (key.len() + value.len()) as u64;
+            records += 1;
+            mem::swap(&mut key, &mut last);
+        }
+        if records == 0 {
+            return Err(Error::new(
+                ErrorKind::InvalidData,
+                format!("{} is an empty segment", path.display()),
+            ));
+        }
+        drop(input);
+        Ok(Segment {
+            id,
+            path,
+            file,
+            last,
+            index,
+        })
+    }
+
+    fn snapshot(&self) -> Vec<Arc<Segment>> {
+        self.segments.lock().expect("segments lock").clone()
+    }
+
+    /// Merges `inputs` into one segment, which takes their place.
+    fn compact(&self, inputs: Vec<Arc<Segment>>) -> io::Result<()> {
+        if inputs.len() < 2 {
+            return Ok(());
+        }
+        let mut merger = Merger::new(self.algo, self.lg_k);
+        let mut merged = Vec::new();
+        let compacted = self.write_segment(|writer| {
+            let records: Vec<_> = inputs
+                .iter()
+                .map(|segment| segment.records_from(Bound::Unbounded))
+                .collect();
+            merge_sorted(records, |key, values| {
+                // a key in one segment keeps its bytes, which merge the same
+                if let [value] = values {
+                    writer.push(key, value)?;
+                    return Ok(true);
+                }
+                merge_into(&mut merger, values)?;
+                merged.clear();
+                merger.counter().append_serialized(&mut merged, true);
+                writer.push(key, &merged)?;
+                Ok(true)
+            })
+        })?;
+        let compacted = compacted.expect("records of nonempty segments");
+        {
+            let mut segments = self.segments.lock().expect("segments lock");
+            segments.retain(|segment| inputs.iter().all(|input| input.id != segment.id));
+            segments.push(Arc::new(compacted));
+        }
+        // queries still reading a removed segment keep its open file
+        for input in &inputs {
+            fs::remove_file(&input.path)?;
+        }
+        Ok(())
+    }
+}
+
+/// Unions the serialized sketches `values` in a reset `merger`.
+fn merge_into(merger: &mut Merger, values: &[impl AsRef<[u8]>]) -> io::Result<()> {
+    merger.reset();
+    for value in values {
+        merger
+            .merge_serialized(value.as_ref())
+            .map_err(|e| Error::new(ErrorKind::InvalidData, e.to_string()))?;
+    }
+    Ok(())
+}
+
+/// Sketches of byte-string keys, kept in a directory of segments as
+/// described in the [module docs](self), which all share one algo and
+/// `lg_k`.
+///
+/// Every estimate is that of a union of the key's sketches, even for a
+/// key in one segment, so compaction changes none of them, and keys of
+/// few values are estimated as after a `dsrs --merge`.
+///
+/// Only one store may have the directory open at a time, which an
+/// exclusive lock on its `LOCK` file enforces. Dropping the store waits
+/// for its background compaction, if any.
+pub struct SegmentStore {
+    shared: Arc<Shared>,
+    max_segments: usize,
+    compaction: Option<JoinHandle<io::Result<()>>>,
+    merger: Merger,
+    // Held for its lock.
+    _lock: File,
+}
+
+impl SegmentStore {
+    /// Segments at which an append starts a background compaction,
+    /// unless configured otherwise with [`Self::with_max_segments`].
+    pub const DEFAULT_MAX_SEGMENTS: usize = 8;
+
+    /// Opens the store in directory `dir`, or creates an empty one there
+    /// of `algo` sketches with `lg_k`.
+    ///
+    /// Fails if the directory cannot be opened, if its segments hold
+    /// sketches of another algo or `lg_k`, if another store has it open,
+    /// or unless `lg_k` is in [`Algo::lg_k_range`].
+    pub fn open(dir: &Path, algo: Algo, lg_k: u8) -> io::Result<Self> {
+        if !algo.lg_k_range().contains(&lg_k) {
+            return Err(Error::new(
+                ErrorKind::InvalidInput,
+                format!("lg_k must be in {:?}", algo.lg_k_range()),
+            ));
+        }
+        fs::create_dir_all(dir)?;
+        let lock = OpenOptions::new()
+            .write(true)
+            .create(true)
+            .open(dir.join("LOCK"))?;
+        if unsafe { libc::flock(lock.as_raw_fd(), libc::LOCK_EX | libc::LOCK_NB) } != 0 {
+            let e = Error::last_os_error();
+            if e.kind() != ErrorKind::WouldBlock {
+                return Err(e);
+            }
+            return Err(Error::new(
+                ErrorKind::WouldBlock,
+                format!("{} is open in another store", dir.display()),
+            ));
+        }
+
+        let mut shared = Shared {
+            dir: dir.to_path_buf(),
+            algo,
+            lg_k,
+            segments: Mutex::new(Vec::new()),
+            next_id: AtomicU64::new(0),
+            compacting: AtomicBool::new(false),
+        };
+        let mut segments = Vec::new();
+        for entry in fs::read_dir(dir)? {
+            let path = entry?.path();
+            let id = path
+                .file_stem()
+                .and_then(|stem| stem.to_str())
+                .and_then(|stem| u64::from_str_radix(stem, 16).ok());
+            let extension = path.extension().and_then(|extension| extension.to_str());
+            match (id, extension) {
+                (Some(id), Some("seg")) => segments.push(Arc::new(shared.read_segment(id, path)?)),
+                // left by a run that stopped while writing it
+                (Some(_), Some("tmp")) => fs::remove_file(&path)?,
+                _ => {}
+            }
+        }
+        let next_id = segments.iter().map(|segment| segment.id + 1).max();
+        shared
+            .next_id
+            .store(next_id.unwrap_or(0), Ordering::Relaxed);
+        *shared.segments.get_mut().expect("segments lock") = segments;
+        Ok(Self {
+            shared: Arc::new(shared),
+            max_segments: Self::DEFAULT_MAX_SEGMENTS,
+            compaction: None,
+            merger: Merger::new(algo, lg_k),
+            _lock: lock,
+        })
+    }
+
+    /// Starts background compactions once the store has `max_segments`,
+    /// rather than [`Self::DEFAULT_MAX_SEGMENTS`].
+    ///
+    /// Panics if `max_segments` is less than 2.
+    pub fn with_max_segments(mut self, max_segments: usize) -> Self {
+        assert!(max_segments >= 2, "compaction needs 2 segments");
+        self.max_segments = max_segments;
+        self
+    }
+
+    pub fn algo(&self) -> Algo {
+        self.shared.algo
+    }
+
+    pub fn lg_k(&self) -> u8 {
+        self.shared.lg_k
+    }
+
+    /// Returns the number of segments in the store.
+    pub fn num_segments(&self) -> usize {
+        self.shared.segments.lock().expect("segments lock").len()
+    }
+
+    /// Appends a segment of `records`, each a key and its sketch as
+    /// [`Counter::write_frame`] writes it, sorting them by key and unioning
+    /// the sketches of a key given more than once. Then starts a background
+    /// compaction if the store has enough segments and none is running.
+    ///
+    /// Sketches are only read by queries and compactions, which fail on
+    /// those that do not deserialize as the store's algo.
+    pub fn append<K, V>(&mut self, records: &mut [(K, V)]) -> io::Result<()>
+    where
+        K: AsRef<[u8]>,
+        V: AsRef<[u8]>,
+    {
+        records.sort_unstable_by(|a, b| a.0.as_ref().cmp(b.0.as_ref()));
+        let merger = &mut self.merger;
+        let mut merged = Vec::new();
+        let segment = self.shared.write_segment(|writer| {
+            for same_key in records.chunk_by(|a, b| a.0.as_ref() == b.0.as_ref()) {
+                let key = same_key[0].0.as_ref();
+                if let [(_, value)] = same_key {
+                    writer.push(key, value.as_ref())?;
+                    continue;
+                }
+                let values: Vec<&[u8]> = same_key.iter().map(|(_, value)| value.as_ref()).collect();
+                merge_into(merger, &values)?;
+                merged.clear();
+                merger.counter().append_serialized(&mut merged, true);
+                writer.push(key, &merged)?;
+            }
+            Ok(())
+        })?;
+        if let Some(segment) = segment {
+            let mut segments = self.shared.segments.lock().expect("segments lock");
+            segments.push(Arc::new(segment));
+        }
+        self.maybe_compact()
+    }
+
+    /// Starts merging all segments into one in the background, if there
+    /// are at least `max_segments` and no compaction is running, after
+    /// returning the error of the last compaction, if it failed.
+    fn maybe_compact(&mut self) -> io::Result<()> {
+        if self.shared.compacting.load(Ordering::Acquire) {
+            return Ok(());
+        }
+        self.wait()?;
+        let inputs = self.shared.snapshot();
+        if inputs.len() < self.max_segments {
+            return Ok(());
+        }
+        self.shared.compacting.store(true, Ordering::Release);
+        let shared = Arc::clone(&self.shared);
+        self.compaction = Some(thread::spawn(move || {
+            let compacted = shared.compact(inputs);
+            shared.compacting.store(false, Ordering::Release);
+            compacted
+        }));
+        Ok(())
+    }
+
+    /// Waits for the background compaction, if any, returning its error.
+    pub fn wait(&mut self) -> io::Result<()> {
+        match self.compaction.take() {
+            Some(compaction) => compaction.join().expect("compaction panicked"),
+            None => Ok(()),
+        }
+    }
+
+    /// Merges all segments into one, after waiting for the background
+    /// compaction, if any.
+    pub fn compact(&mut self) -> io::Result<()> {
+        self.wait()?;
+        self.shared.compact(self.shared.snapshot())
+    }
+
+    /// Returns the union of `key`'s sketches, reading only the segments
+    /// whose keys span it, or `None` if no segment has it.
+    pub fn get(&mut self, key: &[u8]) -> io::Result<Option<Counter>> {
+        let mut values = Vec::new();
+        for segment in self.shared.snapshot() {
+            if let Some(value) = segment.get(key)? {
+                values.push(value);
+            }
+        }
+        if values.is_empty() {
+            return Ok(None);
+        }
+        merge_into(&mut self.merger, &values)?;
+        Ok(Some(self.merger.counter()))
+    }
+
+    /// Calls `f` on each key in `range`, in ascending order, with the
+    /// union of its sketches, reading only the segments whose keys overlap
+    /// `range`, and those only from about where it starts.
+    pub fn range<'a>(
+        &mut self,
+        range: impl RangeBounds<&'a [u8]>,
+        mut f: impl FnMut(&[u8], Counter),
+    ) -> io::Result<()> {
+        let segments: Vec<Arc<Segment>> = self
+            .shared
+            .snapshot()
+            .into_iter()
+            .filter(|segment| segment.overlaps(&range))
+            .collect();
+        let start = range.start_bound().map(|start| *start);
+        let records: Vec<_> = segments
+            .iter()
+            .map(|segment| segment.records_from(start))
+            .collect();
+        let merger = &mut self.merger;
+        merge_sorted(records, |key, values| {
+            if !range.contains(&key) {
+                // only keys before the start come before those in range
+                return Ok(match range.end_bound() {
+                    Bound::Included(end) => key <= *end,
+                    Bound::Excluded(end) => key < *end,
+                    Bound::Unbounded => true,
+                });
+            }
+            merge_into(merger, values)?;
+            f(key, merger.counter());
+            Ok(true)
+        })
+    }
+}
+
+impl Drop for SegmentStore {
+    fn drop(&mut self) {
+        let _ = self.wait();
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::BTreeMap;
+    use std::process;
+
+    use super::*;
+    use crate::stream_reducer::LineReducer;
+
+    fn temp_dir(name: &str) -> PathBuf {
+        let dir = std::env::temp_dir().join(format!("dsrs-segments-{}-{}", name, process::id()));
+        let _ = fs::remove_dir_all(&dir);
+        dir
+    }
+
+    fn sketch_of(algo: Algo, values: impl Iterator<Item = u64>) -> Vec<u8> {
+        let mut ctr = Counter::new(algo, 10);
+        values.for_each(|v| ctr.read_line(v.to_string().as_bytes()));
+        let mut bytes = Vec::new();
+        ctr.append_serialized(&mut bytes, true);
+        bytes
+    }
+
+    fn key(i: u64) -> Vec<u8> {
+        format!("key{:05}", i).into_bytes()
+    }
+
+    /// Appends a segment of the keys `i` for which `i % day == 0`, each
+    /// with values `day * 100..day * 100 + i % 50`, and returns the
+    /// estimates of every key so far.
+    fn fill(store: &mut SegmentStore, days: u64) -> BTreeMap<Vec<u8>, f64> {
+        let algo = store.algo();
+        let mut merged: BTreeMap<Vec<u8>, Merger> = BTreeMap::new();
+        for day in 1..=days {
+            let mut records: Vec<(Vec<u8>, Vec<u8>)> = (0..1000)
+                .filter(|i| i % day == 0)
+                .map(|i| (key(i), sketch_of(algo, day * 100..day * 100 + i % 50 + 1)))
+                .collect();
+            for (key, sketch) in &records {
+                merged
+                    .entry(key.clone())
+                    .or_insert_with(|| Merger::new(algo, 10))
+                    .merge_serialized(sketch)
+                    .unwrap();
+            }
+            // repeated keys in a batch are unioned
+            records.push((key(0), sketch_of(algo, 5000..5010)));
+            merged
+                .get_mut(&key(0))
+                .unwrap()
+                .merge_serialized(&records.last().unwrap().1)
+                .unwrap();
+            store.append(&mut records).unwrap();
+        }
+        merged
+            .into_iter()
+            .map(|(key, m)| (key, m.counter().estimate()))
+            .collect()
+    }
+
+    fn all(store: &mut SegmentStore) -> BTreeMap<Vec<u8>, f64> {
+        let mut all = BTreeMap::new();
+        store
+            .range(.., |key, ctr| {
+                all.insert(key.to_vec(), ctr.estimate());
+            })
+            .unwrap();
+        all
+    }
+
+    #[test]
+    fn queries_union_segments() {
+        for algo in [Algo::Cpc, Algo::Hll] {
+            let dir = temp_dir(&format!("{:?}", algo));
+            let mut store = SegmentStore::open(&dir, algo, 10)
+                .unwrap()
+                .with_max_segments(100);
+            let expected = fill(&mut store, 5);
+            assert_eq!(store.num_segments(), 5);
+            assert_eq!(all(&mut store), expected);
+            for i in [0, 1, 63, 64, 65, 500, 999] {
+                let est = store.get(&key(i)).unwrap().unwrap().estimate();
+                assert_eq!(est, expected[&key(i)]);
+            }
+            assert!(store.get(b"key").unwrap().is_none());
+            assert!(store.get(b"zzz").unwrap().is_none());
+
+            let (start, end) = (key(130), key(270));
+            let mut in_range = BTreeMap::new();
+            store
+                .range(start.as_slice()..end.as_slice(), |key, ctr| {
+                    in_range.insert(key.to_vec(), ctr.estimate());
+                })
+                .unwrap();
+            let expected_range: BTreeMap<_, _> = expected
+                .range(start.clone()..end.clone())
+                .map(|(key, est)| (key.clone(), *est))
+                .collect();
+            assert_eq!(in_range, expected_range);
+            let mut none = 0;
+            store
+                .range(&b"a"[..]..=&b"b"[..], |_, _| none += 1)
+                .unwrap();
+            assert_eq!(none, 0);
+
+            // a compaction and a reopening change no estimate
+            store.compact().unwrap();
+            assert_eq!(store.num_segments(), 1);
+            assert_eq!(all(&mut store), expected);
+            drop(store);
+            let mut store = SegmentStore::open(&dir, algo, 10).unwrap();
+            assert_eq!(all(&mut store), expected);
+            drop(store);
+            fs::remove_dir_all(&dir).unwrap();
+        }
+    }
+
+    #[test]
+    fn compacts_in_background() {
+        let dir = temp_dir("background");
+        let mut store = SegmentStore::open(&dir, Algo::Cpc, 10)
+            .unwrap()
+            .with_max_segments(3);
+        let expected = fill(&mut store, 10);
+        store.wait().unwrap();
+        assert!(store.num_segments() < 10);
+        assert_eq!(all(&mut store), expected);
+        let segment_files = fs::read_dir(&dir)
+            .unwrap()
+            .filter(|entry| entry.as_ref().unwrap().path().extension() == Some("seg".as_ref()))
+            .count();
+        assert_eq!(segment_files, store.num_segments());
+        drop(store);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+
+    #[test]
+    fn open_checks_store() {
+        let dir = temp_dir("open");
+        let mut store = SegmentStore::open(&dir, Algo::Hll, 10).unwrap();
+        store
+            .append(&mut [(b"a", sketch_of(Algo::Hll, 0..3))])
+            .unwrap();
+        store.append::<&[u8], &[u8]>(&mut []).unwrap();
+        assert_eq!(store.num_segments(), 1);
+        let locked = SegmentStore::open(&dir, Algo::Hll, 10).err().unwrap();
+        assert_eq!(locked.kind(), ErrorKind::WouldBlock);
+        drop(store);
+        assert!(SegmentStore::open(&dir, Algo::Cpc, 10).is_err());
+        assert!(SegmentStore::open(&dir, Algo::Hll, 11).is_err());
+        assert!(SegmentStore::open(&dir, Algo::Hll, 22).is_err());
+        fs::write(dir.join("0000000000000007.tmp"), b"partial").unwrap();
+        let store = SegmentStore::open(&dir, Algo::Hll, 10).unwrap();
+        assert_eq!(store.num_segments(), 1);
+        assert!(!dir.join("0000000000000007.tmp").exists());
+        drop(store);
+        fs::remove_dir_all(&dir).unwrap();
+    }
+}
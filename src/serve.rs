@@ -0,0 +1,501 @@
+//! Keyed distinct counts kept resident by `dsrs --serve`, which are fed
+//! batches and asked for estimates over sockets, so that a stream of
+//! small batches pays for starting a process, making the CPC decoding
+//! tables and rebuilding its keys' table once rather than per batch.
+//!
+//! A client sends requests as [frames](crate::frames) and gets a frame
+//! back for each, in order. The first byte of a request is its kind:
+//!
+//! - `l`, followed by lines of a key and a value after a space, each
+//!   ending in a line break, which are counted as `dsrs --key` counts
+//!   them;
+//! - `s`, followed by frames of keys and serialized sketches in turn, as
+//!   `dsrs --key --raw --format binary` writes them, each merged into its
+//!   key's sketch as `dsrs --key --merge` merges them;
+//! - `e`, followed by a key, whose estimate the reply holds as a
+//!   little-endian `f64`, which is 0 for a key never seen.
+//!
+//! The first byte of a reply is 0 if the request was served, followed by
+//! the estimate for an `e`, or else 1 followed by the error, after which
+//! the connection is closed. A batch with an error is not counted at all.
+//!
+//! Requests over [`DEFAULT_MAX_REQUEST`] bytes are refused with an error
+//! from their length alone, so that a batch must be split to fit. Each
+//! connection is served on a thread of its own, up to
+//! [`DEFAULT_MAX_CONNECTIONS`] at once; a client connecting beyond that
+//! gets an error reply straight away and is disconnected.
+
+use std::io::{Error, ErrorKind, Read, Write};
+use std::net::TcpListener;
+#[cfg(unix)]
+use std::os::unix::net::UnixListener;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Arc, RwLock};
+use std::thread;
+
+use memchr;
+
+use crate::counters::{Algo, Counter, KeyedCounter};
+use crate::frames::{read_frame_limited, split_frames, write_frame};
+use crate::key_table::partition;
+use crate::stream_reducer::KeyValueReducer;
+use crate::CpcSketch;
+
+/// Shards of keys for each thread serving connections, so that threads
+/// taking in batches at once seldom wait on the same shard.
+const SHARDS_PER_THREAD: usize = 4;
+
+/// Bytes in the largest request served by default, which bounds the
+/// memory a connection holds for its request.
+pub const DEFAULT_MAX_REQUEST: usize = 1 << 28;
+
+/// Connections served at once by default, each on a thread of its own.
+pub const DEFAULT_MAX_CONNECTIONS: usize = 256;
+
+/// Keyed counters shared by every connection, as described in the
+/// [module docs](self).
+///
+/// Keys are split among shards by hash, each a [`KeyedCounter`] behind a
+/// lock of its own. A batch is split by shard before any lock is taken,
+/// and then takes each shard's lock once, while estimates share the lock
+/// of their key's shard with each other, so they are only held up by a
+/// batch writing to that very shard.
+pub struct Server {
+    algo: Algo,
+    shards: Vec<RwLock<KeyedCounter>>,
+    max_request: usize,
+    max_connections: usize,
+}
+
+impl Server {
+    /// Creates a server of `algo` sketches of `lg_k`, sharded for about
+    /// `threads` connections taking in batches at once.
+    ///
+    /// Panics unless `lg_k` is in [`Algo::lg_k_range`].
+    pub fn new(algo: Algo, lg_k: u8, threads: usize) -> Self {
+        assert!(
+            algo.lg_k_range().contains(&lg_k),
+            "lg_k must be in {:?}",
+            algo.lg_k_range()
+        );
+        let shards = (0..threads.max(1) * SHARDS_PER_THREAD)
+            .map(|_| RwLock::new(KeyedCounter::new(algo, lg_k)))
+            .collect();
+        Self {
+            algo,
+            shards,
+            max_request: DEFAULT_MAX_REQUEST,
+            max_connections: DEFAULT_MAX_CONNECTIONS,
+        }
+    }
+
+    /// Refuses requests over `bytes` rather than [`DEFAULT_MAX_REQUEST`].
+    pub fn with_max_request(mut self, bytes: usize) -> Self {
+        self.max_request = bytes;
+        self
+    }
+
+    /// Serves up to `connections` at once rather than
+    /// [`DEFAULT_MAX_CONNECTIONS`].
+    ///
+    /// Panics if `connections` is 0.
+    pub fn with_max_connections(mut self, connections: usize) -> Self {
+        assert!(connections > 0, "need at least one connection");
+        self.max_connections = connections;
+        self
+    }
+
+    /// Counts each line of `batch`, a key and a value after a space, into
+    /// the counter of its key. Line breaks, `\n` or `\r\n`, are not part
+    /// of the values, and empty lines are skipped.
+    ///
+    /// Fails with [`ErrorKind::InvalidData`], counting none of the lines,
+    /// if any has no space.
+    pub fn read_lines(&self, batch: &[u8]) -> Result<(), Error> {
+        let mut parts = vec![Vec::new(); self.shards.len()];
+        for line in batch.split(|&b| b == b'\n') {
+            let line = line.strip_suffix(b"\r").unwrap_or(line);
+            if line.is_empty() {
+                continue;
+            }
+            let space_ix = memchr::memchr(b' ', line).ok_or_else(|| {
+                invalid_data(format!(
+                    "line missing space: '{}'",
+                    String::from_utf8_lossy(line)
+                ))
+            })?;
+            let key = &line[..space_ix];
+            parts[partition(key, self.shards.len())].push((key, &line[space_ix + 1..]));
+        }
+        for (shard, part) in self.shards.iter().zip(parts) {
+            if part.is_empty() {
+                continue;
+            }
+            let mut shard = shard.write().expect("shard lock");
+            for (key, value) in part {
+                shard.read_key_value(key, value);
+            }
+        }
+        Ok(())
+    }
+
+    /// Merges each sketch of `batch`, frames of keys and serialized
+    /// sketches in turn, into the counter of its key. Sketches are
+    /// deserialized before any lock is taken.
+    ///
+    /// Fails, merging none of the sketches, on frames cut short, a key
+    /// without a sketch, or a sketch that does not deserialize.
+    pub fn merge_sketches(&self, batch: &[u8]) -> Result<(), Error> {
+        let frames = split_frames(batch)?;
+        if frames.len() % 2 != 0 {
+            return Err(invalid_data("last key has no sketch".to_string()));
+        }
+        let mut parts: Vec<Vec<(&[u8], Counter)>> =
+            (0..self.shards.len()).map(|_| Vec::new()).collect();
+        for record in frames.chunks(2) {
+            let ctr = Counter::deserialize_bytes(record[1], self.algo)
+                .map_err(|e| invalid_data(e.to_string()))?;
+            parts[partition(record[0], self.shards.len())].push((record[0], ctr));
+        }
+        for (shard, part) in self.shards.iter().zip(parts) {
+            if part.is_empty() {
+                continue;
+            }
+            let mut shard = shard.write().expect("shard lock");
+            for (key, ctr) in part {
+                shard.merge_counter(key, ctr);
+            }
+        }
+        Ok(())
+    }
+
+    /// Returns the estimate of `key`'s distinct values, or 0 if it was
+    /// never seen.
+    pub fn estimate(&self, key: &[u8]) -> f64 {
+        let shard = self.shards[partition(key, self.shards.len())]
+            .read()
+            .expect("shard lock");
+        shard.get(key).map_or(0.0, Counter::estimate)
+    }
+
+    /// Serves the requests read from `stream` until it ends or fails, or
+    /// a request does.
+    pub fn handle<S: Read + Write>(&self, mut stream: S) -> Result<(), Error> {
+        let (mut request, mut reply) = (Vec::new(), Vec::new());
+        loop {
+            reply.clear();
+            reply.push(0);
+            let served = match read_frame_limited(&mut stream, &mut request, self.max_request) {
+                Ok(true) => self.serve_request(&request, &mut reply),
+                Ok(false) => return Ok(()),
+                // too long, and refused before reading any of it
+                Err(e) if e.kind() == ErrorKind::InvalidData => Err(e),
+                Err(e) => return Err(e),
+            };
+            if let Err(e) = &served {
+                reply.clear();
+                reply.push(1);
+                reply.extend_from_slice(e.to_string().as_bytes());
+            }
+            write_reply(&mut stream, &reply)?;
+            served?;
+        }
+    }
+
+    fn serve_request(&self, request: &[u8], reply: &mut Vec<u8>) -> Result<(), Error> {
+        match request.split_first() {
+            Some((b'l', batch)) => self.read_lines(batch),
+            Some((b's', batch)) => self.merge_sketches(batch),
+            Some((b'e', key)) => {
+                reply.extend_from_slice(&self.estimate(key).to_le_bytes());
+                Ok(())
+            }
+            Some((&kind, _)) => Err(invalid_data(format!("unknown request '{}'", kind as char))),
+            None => Err(invalid_data("empty request".to_string())),
+        }
+    }
+
+    /// Serves connections to `listener`, as described in the
+    /// [module docs](self), until accepting one fails, and returns that
+    /// error.
+    pub fn serve_tcp(self: Arc<Self>, listener: TcpListener) -> Error {
+        self.serve(move || {
+            let (stream, _) = listener.accept()?;
+            // replies are small, and clients wait on each
+            stream.set_nodelay(true)?;
+            Ok(stream)
+        })
+    }
+
+    /// Like [`Self::serve_tcp`], but on a Unix domain socket.
+    #[cfg(unix)]
+    pub fn serve_unix(self: Arc<Self>, listener: UnixListener) -> Error {
+        self.serve(move || Ok(listener.accept()?.0))
+    }
+
+    fn serve<S, A>(self: Arc<Self>, mut accept: A) -> Error
+    where
+        S: Read + Write + Send + 'static,
+        A: FnMut() -> Result<S, Error>,
+    {
+        if self.algo == Algo::Cpc {
+            // so that no connection waits on another making the tables
+            CpcSketch::init();
+        }
+        let connections = Arc::new(AtomicUsize::new(0));
+        loop {
+            let mut stream = match accept() {
+                Ok(stream) => stream,
+                Err(e) => return e,
+            };
+            if connections.fetch_add(1, Ordering::SeqCst) >= self.max_connections {
+                connections.fetch_sub(1, Ordering::SeqCst);
+                let refusal = format!("over {} connections", self.max_connections);
+                let _ = write_reply(&mut stream, &[&[1], refusal.as_bytes()].concat());
+                continue;
+            }
+            let (server, connections) = (self.clone(), connections.clone());
+            thread::spawn(move || {
+                // a connection failing, or its client hanging up, ends
+                // only that connection
+                let _ = server.handle(stream);
+                connections.fetch_sub(1, Ordering::SeqCst);
+            });
+        }
+    }
+}
+
+/// Writes `reply` to `stream` in a frame, at once, so that it leaves as
+/// one packet.
+fn write_reply<W: Write>(stream: &mut W, reply: &[u8]) -> Result<(), Error> {
+    let mut out = Vec::with_capacity(reply.len() + 4);
+    write_frame(&mut out, reply)?;
+    stream.write_all(&out)
+}
+
+fn invalid_data(message: String) -> Error {
+    Error::new(ErrorKind::InvalidData, message)
+}
+
+#[cfg(test)]
+mod tests {
+    use std::convert::TryInto;
+    use std::io;
+    use std::net::TcpStream;
+    use std::time::Duration;
+
+    use super::*;
+    use crate::counters::{KeyedMerger, DEFAULT_LG_K};
+    use crate::frames::read_frame;
+    use crate::stream_reducer::LineReducer;
+
+    /// A stream that reads prepared requests and keeps the replies.
+    struct Duplex<'a> {
+        input: &'a [u8],
+        output: Vec<u8>,
+    }
+
+    impl Read for Duplex<'_> {
+        fn read(&mut self, buf: &mut [u8]) -> io::Result<usize> {
+            self.input.read(buf)
+        }
+    }
+
+    impl Write for Duplex<'_> {
+        fn write(&mut self, buf: &[u8]) -> io::Result<usize> {
+            self.output.write(buf)
+        }
+
+        fn flush(&mut self) -> io::Result<()> {
+            Ok(())
+        }
+    }
+
+    fn request(kind: u8, body: &[u8]) -> Vec<u8> {
+        let mut frame = Vec::new();
+        write_frame(&mut frame, &[&[kind][..], body].concat()).unwrap();
+        frame
+    }
+
+    /// The estimate of a served `e` request, rounded as `dsrs` prints it.
+    fn estimate_of(reply: &[u8]) -> f64 {
+        assert_eq!(reply[0], 0, "{}", String::from_utf8_lossy(&reply[1..]));
+        f64::from_le_bytes(reply[1..].try_into().expect("an f64")).round()
+    }
+
+    fn lines(keys: u64, values: u64) -> Vec<u8> {
+        (0..values)
+            .map(|i| format!("key{} value{}\n", i % keys, i))
+            .collect::<String>()
+            .into_bytes()
+    }
+
+    #[test]
+    fn estimates_match_keyed_counter() {
+        let batch = lines(10, 20 * 1000);
+        let server = Server::new(Algo::Cpc, DEFAULT_LG_K, 2);
+        let mut expected = KeyedCounter::new(Algo::Cpc, DEFAULT_LG_K);
+        for chunk in batch
+            .split_inclusive(|&b| b == b'\n')
+            .collect::<Vec<_>>()
+            .chunks(999)
+        {
+            server.read_lines(&chunk.concat()).unwrap();
+        }
+        batch
+            .split(|&b| b == b'\n')
+            .filter(|line| !line.is_empty())
+            .for_each(|line| expected.read_line(line));
+        for (key, ctr) in expected.state() {
+            assert_eq!(server.estimate(key), ctr.estimate());
+        }
+        assert_eq!(server.estimate(b"missing"), 0.0);
+
+        // sketches of each key, merged as --key --merge merges them
+        let mut sketches = Vec::new();
+        let mut merger = KeyedMerger::new(Algo::Cpc, DEFAULT_LG_K);
+        for (key, ctr) in expected.state() {
+            write_frame(&mut sketches, key).unwrap();
+            let mut sketch = Vec::new();
+            ctr.append_serialized(&mut sketch, true);
+            write_frame(&mut sketches, &sketch).unwrap();
+            merger.merge_serialized(key, &sketch).unwrap();
+        }
+        let merged = Server::new(Algo::Cpc, DEFAULT_LG_K, 2);
+        merged.merge_sketches(&sketches).unwrap();
+        for (key, ctr) in merger.state() {
+            assert_eq!(merged.estimate(key), ctr.estimate());
+        }
+    }
+
+    #[test]
+    fn bad_batches_count_nothing() {
+        let server = Server::new(Algo::Hll, DEFAULT_LG_K, 1);
+        let err = server.read_lines(b"a 1\nb2\n").unwrap_err();
+        assert_eq!(err.kind(), ErrorKind::InvalidData);
+        assert_eq!(server.estimate(b"a"), 0.0);
+
+        let mut sketches = Vec::new();
+        write_frame(&mut sketches, b"a").unwrap();
+        write_frame(&mut sketches, b"not a sketch").unwrap();
+        assert!(server.merge_sketches(&sketches).is_err());
+        assert!(server
+            .merge_sketches(&sketches[..sketches.len() - 1])
+            .is_err());
+        write_frame(&mut sketches, b"b").unwrap();
+        assert!(server.merge_sketches(&sketches).is_err());
+    }
+
+    #[test]
+    fn replies_in_order() {
+        let server = Server::new(Algo::Cpc, DEFAULT_LG_K, 1);
+        let input = [
+            request(b'l', b"a 1\r\na 2\nb 1\n"),
+            request(b'e', b"a"),
+            request(b'e', b"c"),
+            request(b'x', b""),
+            // never read, since the bad request closes the connection
+            request(b'e', b"b"),
+        ]
+        .concat();
+        let mut stream = Duplex {
+            input: &input,
+            output: Vec::new(),
+        };
+        assert!(server.handle(&mut stream).is_err());
+        let mut output = &stream.output[..];
+        let mut replies = Vec::new();
+        let mut reply = Vec::new();
+        while read_frame(&mut output, &mut reply).unwrap() {
+            replies.push(reply.clone());
+        }
+        assert_eq!(replies.len(), 4);
+        assert_eq!(replies[0], [0]);
+        assert_eq!(estimate_of(&replies[1]), 2.0);
+        assert_eq!(estimate_of(&replies[2]), 0.0);
+        assert_eq!(replies[3][0], 1);
+    }
+
+    #[test]
+    fn refuses_long_requests() {
+        let server = Server::new(Algo::Hll, DEFAULT_LG_K, 1).with_max_request(8);
+        let input = [request(b'l', b"a 1\n"), request(b'l', b"a 1\nb 2\n")].concat();
+        let mut stream = Duplex {
+            input: &input,
+            output: Vec::new(),
+        };
+        let err = server.handle(&mut stream).unwrap_err();
+        assert_eq!(err.kind(), ErrorKind::InvalidData);
+        let mut output = &stream.output[..];
+        let mut reply = Vec::new();
+        assert!(read_frame(&mut output, &mut reply).unwrap());
+        assert_eq!(reply, [0]);
+        assert!(read_frame(&mut output, &mut reply).unwrap());
+        assert_eq!(reply[0], 1);
+        assert_eq!(server.estimate(b"b"), 0.0);
+    }
+
+    #[test]
+    fn serves_tcp_connections() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let addr = listener.local_addr().unwrap();
+        let server = Arc::new(Server::new(Algo::Cpc, DEFAULT_LG_K, 2));
+        thread::spawn({
+            let server = server.clone();
+            move || server.serve_tcp(listener)
+        });
+        // more clients than the server has shards for, all connected at
+        // once, are served
+        let clients: Vec<_> = (0..4u64)
+            .map(|client| {
+                let mut stream = TcpStream::connect(addr).unwrap();
+                let batch = format!("client{} {}\nshared {}\n", client, client, client);
+                stream.write_all(&request(b'l', batch.as_bytes())).unwrap();
+                stream
+            })
+            .collect();
+        for mut stream in clients {
+            let mut reply = Vec::new();
+            assert!(read_frame(&mut stream, &mut reply).unwrap());
+            assert_eq!(reply, [0]);
+        }
+
+        let mut stream = TcpStream::connect(addr).unwrap();
+        stream.write_all(&request(b'e', b"shared")).unwrap();
+        let mut reply = Vec::new();
+        assert!(read_frame(&mut stream, &mut reply).unwrap());
+        assert_eq!(estimate_of(&reply), 4.0);
+        assert_eq!(server.estimate(b"client3").round(), 1.0);
+    }
+
+    #[test]
+    fn refuses_connections_over_limit() {
+        let listener = TcpListener::bind("127.0.0.1:0").unwrap();
+        let addr = listener.local_addr().unwrap();
+        let server = Arc::new(Server::new(Algo::Hll, DEFAULT_LG_K, 1).with_max_connections(1));
+        thread::spawn(move || server.serve_tcp(listener));
+        let mut reply = Vec::new();
+        let mut first = TcpStream::connect(addr).unwrap();
+        first.write_all(&request(b'e', b"a")).unwrap();
+        assert!(read_frame(&mut first, &mut reply).unwrap());
+        assert_eq!(estimate_of(&reply), 0.0);
+
+        let mut second = TcpStream::connect(addr).unwrap();
+        assert!(read_frame(&mut second, &mut reply).unwrap());
+        assert_eq!(reply[0], 1);
+
+        // the first is served still, and once it hangs up the next is
+        first.write_all(&request(b'e', b"a")).unwrap();
+        assert!(read_frame(&mut first, &mut reply).unwrap());
+        assert_eq!(reply[0], 0);
+        drop(first);
+        // its slot is freed once the server sees it hang up
+        let served = (0..100).any(|_| {
+            thread::sleep(Duration::from_millis(10));
+            let mut third = TcpStream::connect(addr).unwrap();
+            let _ = third.write_all(&request(b'e', b"a"));
+            read_frame(&mut third, &mut reply).unwrap_or(false) && reply[0] == 0
+        });
+        assert!(served);
+    }
+}
@@ -0,0 +1,52 @@
+//! Counts of the internal transitions of the C++ sketches behind slow
+//! updates, for `dsrs --stats`: theta hash tables resized or rebuilt,
+//! heavy hitters maps purged, CPC windows moved, and HLL sketches promoted
+//! from a list of coupons to a set or to an array of registers.
+//!
+//! Events are only counted when built with the `event-stats` feature, and
+//! are otherwise all 0. As with [`crate::alloc_stats`], each thread
+//! counts its own, which are added to the totals when it exits.
+
+use crate::bridge::ffi;
+
+/// Whether events are counted.
+pub const ENABLED: bool = cfg!(feature = "event-stats");
+
+/// The events counted, in the order of `sketch_event` in
+/// `event_counters.hpp`.
+pub const EVENTS: [&str; 6] = [
+    "theta_resize",
+    "theta_rebuild",
+    "hh_purge",
+    "cpc_move_window",
+    "hll_list_to_set",
+    "hll_to_array",
+];
+
+/// Returns the count of each of [`EVENTS`] so far, in order.
+pub fn counts() -> Vec<(&'static str, u64)> {
+    EVENTS
+        .iter()
+        .enumerate()
+        .map(|(i, &event)| (event, ffi::sketch_event_count(i as u8)))
+        .collect()
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::{HllSketch, HllType};
+
+    #[test]
+    fn counts_promotions() {
+        let to_array = || counts()[5].1;
+        let before = to_array();
+        let mut sketch = HllSketch::new(12, HllType::Hll4).unwrap();
+        (0..10_000).for_each(|i| sketch.update_u64(i));
+        if ENABLED {
+            assert!(to_array() > before);
+        } else {
+            assert!(counts().iter().all(|&(_, count)| count == 0));
+        }
+    }
+}
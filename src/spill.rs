@@ -0,0 +1,178 @@
+//! Sorted runs of keyed records spilled to temporary files, for keyed
+//! reducers with more keys than fit in memory.
+//!
+//! A run is a sequence of records in ascending key order, each a key
+//! frame followed by a value frame as written by
+//! [`write_frame`](crate::frames::write_frame), with every key at most
+//! once. [`merge_runs`] reads any number of runs back in one pass,
+//! gathering the values of each key across runs, as [`merge_sorted`] does
+//! for runs read from elsewhere.
+
+use std::cmp::Reverse;
+use std::collections::BinaryHeap;
+use std::env;
+use std::fs::{self, File};
+use std::io::{BufReader, BufWriter, Error, Read, Write};
+use std::mem;
+use std::path::PathBuf;
+use std::process;
+use std::sync::atomic::{AtomicUsize, Ordering};
+
+use crate::frames::read_frame;
+
+/// Numbers the runs of this process, which are named after it.
+static NEXT_RUN: AtomicUsize = AtomicUsize::new(0);
+
+/// A run in a temporary file, which is removed when the run is dropped.
+pub(crate) struct Run {
+    path: PathBuf,
+}
+
+impl Run {
+    /// Creates a run in [`env::temp_dir`] whose records are written by
+    /// `write`, which must write them in ascending key order.
+    pub(crate) fn write(
+        write: impl FnOnce(&mut BufWriter<File>) -> Result<(), Error>,
+    ) -> Result<Self, Error> {
+        let run = NEXT_RUN.fetch_add(1, Ordering::Relaxed);
+        let path = env::temp_dir().join(format!("dsrs-spill-{}-{}", process::id(), run));
+        // removes the file should writing fail
+        let run = Self { path };
+        let mut out = BufWriter::new(File::create(&run.path)?);
+        write(&mut out)?;
+        out.flush()?;
+        Ok(run)
+    }
+}
+
+impl Drop for Run {
+    fn drop(&mut self) {
+        let _ = fs::remove_file(&self.path);
+    }
+}
+
+/// Reads the next record of `input` into `key` and `value`, returning
+/// `false` at the end of the run.
+fn read_record<R: Read>(
+    input: &mut R,
+    key: &mut Vec<u8>,
+    value: &mut Vec<u8>,
+) -> Result<bool, Error> {
+    if !read_frame(input, key)? {
+        return Ok(false);
+    }
+    assert!(read_frame(input, value)?, "spilled key without a value");
+    Ok(true)
+}
+
+/// Calls `f` on every key in `runs`, in ascending order, along with its
+/// values from each run that has it.
+pub(crate) fn merge_runs(runs: &[Run], mut f: impl FnMut(&[u8], &[Vec<u8>])) -> Result<(), Error> {
+    let inputs = runs
+        .iter()
+        .map(|run| File::open(&run.path).map(BufReader::new))
+        .collect::<Result<Vec<_>, _>>()?;
+    merge_sorted(inputs, |key, values| {
+        f(key, values);
+        Ok(true)
+    })
+}
+
+/// Calls `f` on every key in the runs read from `inputs`, in ascending
+/// order, along with its values from each run that has it, until `f`
+/// returns `false`.
+pub(crate) fn merge_sorted<R: Read>(
+    mut inputs: Vec<R>,
+    mut f: impl FnMut(&[u8], &[Vec<u8>]) -> Result<bool, Error>,
+) -> Result<(), Error> {
+    // the next value of each run, under its key in `heads`
+    let mut next_values = Vec::with_capacity(inputs.len());
+    let mut heads = BinaryHeap::with_capacity(inputs.len());
+    for (i, input) in inputs.iter_mut().enumerate() {
+        let (mut key, mut value) = (Vec::new(), Vec::new());
+        if read_record(input, &mut key, &mut value)? {
+            heads.push(Reverse((key, i)));
+        }
+        next_values.push(value);
+    }
+
+    let mut values = Vec::new();
+    while let Some(Reverse((key, i))) = heads.pop() {
+        values.clear();
+        let mut next = Some(i);
+        while let Some(i) = next {
+            values.push(mem::take(&mut next_values[i]));
+            let mut next_key = Vec::new();
+            if read_record(&mut inputs[i], &mut next_key, &mut next_values[i])? {
+                heads.push(Reverse((next_key, i)));
+            }
+            next = match heads.peek() {
+                Some(Reverse((head, _))) if *head == key => heads.pop().map(|Reverse((_, i))| i),
+                _ => None,
+            };
+        }
+        if !f(&key, &values)? {
+            break;
+        }
+    }
+    Ok(())
+}
+
+#[cfg(test)]
+mod tests {
+
+    use std::collections::BTreeMap;
+
+    use super::*;
+    use crate::frames::write_frame;
+
+    fn run_of(records: &BTreeMap<Vec<u8>, Vec<u8>>) -> Run {
+        Run::write(|out| {
+            for (key, value) in records {
+                write_frame(out, key)?;
+                write_frame(out, value)?;
+            }
+            Ok(())
+        })
+        .unwrap()
+    }
+
+    #[test]
+    fn merges_sorted_runs() {
+        let mut expected: BTreeMap<Vec<u8>, Vec<Vec<u8>>> = BTreeMap::new();
+        let runs: Vec<Run> = (1..6)
+            .map(|r| {
+                let records: BTreeMap<Vec<u8>, Vec<u8>> = (0..1000)
+                    .filter(|k| k % r == 0)
+                    .map(|k| (format!("{}", k).into_bytes(), vec![r as u8; k % 7]))
+                    .collect();
+                for (key, value) in &records {
+                    expected.entry(key.clone()).or_default().push(value.clone());
+                }
+                run_of(&records)
+            })
+            .collect();
+        let empty = run_of(&BTreeMap::new());
+
+        let mut merged = Vec::new();
+        merge_runs(&runs, |key, values| {
+            merged.push((key.to_vec(), values.to_vec()))
+        })
+        .unwrap();
+        assert_eq!(merged, expected.into_iter().collect::<Vec<_>>());
+
+        let mut none = 0;
+        merge_runs(&[empty], |_, _| none += 1).unwrap();
+        merge_runs(&[], |_, _| none += 1).unwrap();
+        assert_eq!(none, 0);
+    }
+
+    #[test]
+    fn drop_removes_file() {
+        let run = run_of(&BTreeMap::new());
+        let path = run.path.clone();
+        assert!(path.exists());
+        drop(run);
+        assert!(!path.exists());
+    }
+}
@@ -6,31 +6,1085 @@
 //!
 //! [1]: https://docs.rs/grep-searcher/0.1.8/grep_searcher/index.html
 
-use std::io::{BufRead, Error};
+use std::ffi::OsString;
+use std::fs::{self, File};
+#[cfg(feature = "async")]
+use std::future;
+use std::io::{BufRead, BufReader, Error, ErrorKind, Read, Seek, SeekFrom, Write};
+use std::mem;
+use std::panic;
+use std::path::{Path, PathBuf};
+#[cfg(feature = "async")]
+use std::pin::Pin;
+use std::sync::atomic::{AtomicU64, AtomicUsize, Ordering};
+use std::sync::{mpsc, Arc, Mutex};
+#[cfg(feature = "async")]
+use std::task::{ready, Context, Poll};
+use std::thread;
 
 use bstr::io::BufReadExt;
+#[cfg(feature = "async")]
+use futures_io::AsyncBufRead;
+#[cfg(feature = "async")]
+use futures_sink::Sink;
+use memchr;
+
+use crate::decompress::Compression;
+use crate::frames::{read_frame, write_frame};
+use crate::key_table;
+use crate::numa;
+use crate::profile::{self, Queue, QueueGauge, Stage, TimedRead};
+#[cfg(target_os = "linux")]
+use crate::uring::UringReader;
 
 pub trait LineReducer {
     fn read_line(&mut self, line: &[u8]);
+
+    /// Reads each line packed into `buf`, where line `i` is
+    /// `buf[ends[i - 1]..ends[i]]` and the first line starts at offset 0.
+    /// Reducers may override this to batch their sketch updates.
+    fn read_lines(&mut self, buf: &[u8], ends: &[usize]) {
+        packed_lines(buf, ends).for_each(|line| self.read_line(line));
+    }
+
+    /// Reads `count` consecutive copies of `line`. Reducers for which a
+    /// repeat adds nothing, or which take weighted updates, may override
+    /// this to read the run at once.
+    fn read_repeated(&mut self, line: &[u8], count: u64) {
+        for _ in 0..count {
+            self.read_line(line);
+        }
+    }
+}
+
+/// A [`LineReducer`] which can be split across threads, each reducing a
+/// disjoint part of the stream, and then recombined.
+pub trait ParallelLineReducer: LineReducer + Send {
+    /// Returns an empty reducer configured like `self`.
+    fn fork(&self) -> Self;
+
+    /// Folds in `other`, which reduced lines disjoint from those of `self`.
+    fn combine(&mut self, other: Self);
+
+    /// Returns the key of `line`, by which [`reduce_stream_partitioned`]
+    /// routes it, the bytes before its first space by default.
+    fn partition_key<'a>(&self, line: &'a [u8]) -> &'a [u8] {
+        memchr::memchr(b' ', line).map_or(line, |i| &line[..i])
+    }
+}
+
+/// A [`LineReducer`] of lines holding a key and a value, which can also
+/// be handed the key and value of a line split some other way, as
+/// [`Fields`] does.
+///
+/// [`Fields`]: crate::fields::Fields
+pub trait KeyValueReducer: LineReducer {
+    fn read_key_value(&mut self, key: &[u8], value: &[u8]);
+}
+
+/// A [`LineReducer`] which turns each line into a value, such as a
+/// decoded and deserialized sketch, before folding it into its state, so
+/// that [`reduce_stream_pipelined`] can prepare lines on other threads
+/// while this one reads them, in order.
+pub trait PipelinedLineReducer: LineReducer {
+    /// What the workers prepare lines with, shared among them.
+    type Preparer: Sync;
+    /// A prepared line.
+    type Prepared: Send;
+
+    fn preparer(&self) -> Self::Preparer;
+
+    fn prepare(preparer: &Self::Preparer, line: &[u8]) -> Self::Prepared;
+
+    /// Reads `line`, which [`Self::prepare`] turned into `prepared`, as
+    /// [`LineReducer::read_line`] would.
+    fn read_prepared(&mut self, line: &[u8], prepared: Self::Prepared);
 }
 
+/// A [`LineReducer`] whose state can be saved, for
+/// [`reduce_stream_checkpointed`] to resume it from.
+pub trait Checkpoint: LineReducer {
+    /// Appends the reducer's state to `out`.
+    fn save(&self, out: &mut Vec<u8>);
+
+    /// Appends what the reducer was configured with, such as its kind of
+    /// state and its parameters, so that a checkpoint is only restored
+    /// into a reducer configured alike.
+    fn save_config(&self, out: &mut Vec<u8>);
+
+    /// Takes on the state appended by [`Self::save`] of a reducer
+    /// configured like this one, which has not read any lines yet.
+    fn restore(&mut self, saved: &[u8]) -> Result<(), Error>;
+}
+
+/// Iterates over the lines packed into `buf` as described in
+/// [`LineReducer::read_lines`].
+pub fn packed_lines<'a>(buf: &'a [u8], ends: &'a [usize]) -> impl Iterator<Item = &'a [u8]> {
+    let starts = Some(0).into_iter().chain(ends.iter().cloned());
+    starts
+        .zip(ends.iter())
+        .map(move |(start, &end)| &buf[start..end])
+}
+
+/// Lines read by the reductions here so far, over all threads, for
+/// `dsrs --stats`. Each adds its lines once it is done, or once per
+/// buffer if it hands buffers to workers.
+static LINES_READ: AtomicU64 = AtomicU64::new(0);
+
+/// Returns the number of lines read by the reductions here so far.
+pub fn lines_read() -> u64 {
+    LINES_READ.load(Ordering::Relaxed)
+}
+
+fn count_lines(lines: u64) {
+    LINES_READ.fetch_add(lines, Ordering::Relaxed);
+}
+
+/// Reduces the lines of `stream`, split on `\n`, with a `\r\n` or `\n`
+/// terminator stripped, and the last line kept even if unterminated. The
+/// lines of each buffer the stream fills are found in one pass and handed
+/// to [`LineReducer::read_lines`] at once, as soon as they are read.
 pub fn reduce_stream<R: BufRead, T: LineReducer>(
     stream: R,
     mut line_reader: T,
 ) -> Result<T, Error> {
-    // TODO: consider 2-threaded approach, building up a
-    // contiguous vec buffer with offsets, by creating a "LineBuffer" struct out here
-    // which mutably fills up inside the below, then get sent over on completion.
-    stream.for_byte_line(|line| {
-        line_reader.read_line(line);
-        Ok(true)
-    })?;
+    let (mut lines, mut bytes) = (0, 0);
+    let update = profile::span(Stage::Update, 0);
+    let read = for_each_batch(TimedRead::new(stream), 0, |batch| {
+        line_reader.read_lines(&batch.buf, &batch.ends);
+        lines += batch.ends.len() as u64;
+        bytes += batch.buf.len();
+        true
+    });
+    drop(update);
+    count_lines(lines);
+    profile::add_bytes(Stage::Update, bytes);
+    read?;
     Ok(line_reader)
 }
 
+/// The first bytes of every checkpoint, followed by the stream offset as a
+/// little-endian `u64`, a frame of the reducer's configuration, a frame
+/// identifying the stream, and then the saved state.
+const CHECKPOINT_MAGIC: &[u8; 8] = b"dsrsckp2";
+
+/// Like [`reduce_stream`], but saves the state of `line_reader` to a
+/// checkpoint at `path` about every `every` bytes of the stream, along
+/// with the number of bytes read so far. If `path` holds a checkpoint at
+/// the start, `line_reader` is restored from it and as many bytes of the
+/// stream are skipped, so a reduction which stopped partway through the
+/// same stream goes on from its last checkpoint. The checkpoint is
+/// removed once the stream is over.
+///
+/// Checkpoints record the configuration of `line_reader`, see
+/// [`Checkpoint::save_config`], and `input`, which identifies the stream,
+/// such as by its path and length. A checkpoint recording either unlike
+/// this call's is refused with [`ErrorKind::InvalidData`], as is one
+/// that is corrupt.
+///
+/// States are saved to memory on the calling thread, which takes as much
+/// memory again as the state, but written out and synced on a background
+/// thread. Checkpoints which come due while the last one is still being
+/// written are skipped, so writing never holds up reading. Each one
+/// replaces the last in a single rename, so a crash at any point leaves
+/// a whole checkpoint behind, if any.
+///
+/// Panics if `every` is 0.
+pub fn reduce_stream_checkpointed<R: BufRead, T: Checkpoint>(
+    stream: R,
+    mut line_reader: T,
+    path: &Path,
+    input: &[u8],
+    every: u64,
+) -> Result<T, Error> {
+    assert!(every > 0, "need a positive checkpoint interval");
+    let mut stream = TimedRead::new(stream);
+    let mut offset = 0;
+    let mut header = Vec::new();
+    let mut config = Vec::new();
+    line_reader.save_config(&mut config);
+    write_frame(&mut header, &config)?;
+    write_frame(&mut header, input)?;
+    if let Some((saved_offset, state)) = read_checkpoint(path, &header)? {
+        line_reader.restore(&state)?;
+        skip(&mut stream, saved_offset)?;
+        offset = saved_offset;
+    }
+
+    thread::scope(|scope| {
+        // owned here, so that a panic while reading drops the sender and
+        // lets the writer finish before the scope joins it
+        let (saved_tx, saved_rx) = mpsc::channel::<(u64, Vec<u8>)>();
+        let (free_tx, free_rx) = mpsc::channel();
+        free_tx.send(Vec::new()).expect("receiver alive");
+        let header = &header;
+        let writer = scope.spawn(move || -> Result<(), Error> {
+            for (offset, state) in saved_rx {
+                write_checkpoint(path, offset, header, &state)?;
+                // recycled by the reader, which may have already finished
+                let _ = free_tx.send(state);
+            }
+            Ok(())
+        });
+
+        let mut due = offset + every;
+        let mut lines = 0;
+        let update = profile::span(Stage::Update, 0);
+        let read = stream.for_byte_line_with_terminator(|line| {
+            offset += line.len() as u64;
+            lines += 1;
+            let line = line.strip_suffix(b"\n").unwrap_or(line);
+            line_reader.read_line(line.strip_suffix(b"\r").unwrap_or(line));
+            if offset >= due {
+                due = offset + every;
+                if let Ok(mut state) = free_rx.try_recv() {
+                    let _serialize = profile::span(Stage::Serialize, 0);
+                    state.clear();
+                    line_reader.save(&mut state);
+                    // fails only if the writer failed, which join reports
+                    let _ = saved_tx.send((offset, state));
+                }
+            }
+            Ok(true)
+        });
+        drop(update);
+        count_lines(lines);
+        drop(saved_tx);
+        let written = writer.join().unwrap_or_else(|e| panic::resume_unwind(e));
+        read.and(written)
+    })?;
+
+    match fs::remove_file(path) {
+        Err(e) if e.kind() != ErrorKind::NotFound => Err(e),
+        _ => Ok(line_reader),
+    }
+}
+
+/// Reads the offset and state of the checkpoint at `path`, if there is
+/// one, checking that it was written with `header`, the frames of the
+/// configuration and input that [`write_checkpoint`] is given.
+fn read_checkpoint(path: &Path, header: &[u8]) -> Result<Option<(u64, Vec<u8>)>, Error> {
+    let mut saved = match fs::read(path) {
+        Ok(saved) => saved,
+        Err(e) if e.kind() == ErrorKind::NotFound => return Ok(None),
+        Err(e) => return Err(e),
+    };
+    let refuse = |why: &str| {
+        Err(Error::new(
+            ErrorKind::InvalidData,
+            format!("{} {}", path.display(), why),
+        ))
+    };
+    let magic = CHECKPOINT_MAGIC.len();
+    if saved.len() < magic + 8 || &saved[..magic] != CHECKPOINT_MAGIC {
+        return refuse("is not a checkpoint");
+    }
+    let mut offset = [0u8; 8];
+    offset.copy_from_slice(&saved[magic..magic + 8]);
+
+    let mut rest = &saved[magic + 8..];
+    let (mut config, mut input) = (Vec::new(), Vec::new());
+    let (mut expected_config, mut expected_input) = (Vec::new(), Vec::new());
+    let mut expected = header;
+    read_frame(&mut expected, &mut expected_config)?;
+    read_frame(&mut expected, &mut expected_input)?;
+    match (
+        read_frame(&mut rest, &mut config),
+        read_frame(&mut rest, &mut input),
+    ) {
+        (Ok(true), Ok(true)) => {}
+        _ => return refuse("is not a whole checkpoint"),
+    }
+    if config != expected_config {
+        return refuse("was saved by a run with other flags");
+    }
+    if input != expected_input {
+        return refuse("was saved reading other input");
+    }
+    let header = saved.len() - rest.len();
+    saved.drain(..header);
+    Ok(Some((u64::from_le_bytes(offset), saved)))
+}
+
+/// Writes a checkpoint to `path` beside it first, and then renames it over
+/// whatever checkpoint was there.
+fn write_checkpoint(path: &Path, offset: u64, header: &[u8], state: &[u8]) -> Result<(), Error> {
+    let mut partial = OsString::from(path.as_os_str());
+    partial.push(".partial");
+    let partial = PathBuf::from(partial);
+    let mut out = File::create(&partial)?;
+    out.write_all(CHECKPOINT_MAGIC)?;
+    out.write_all(&offset.to_le_bytes())?;
+    out.write_all(header)?;
+    out.write_all(state)?;
+    out.sync_all()?;
+    fs::rename(&partial, path)
+}
+
+/// Skips the first `n` bytes of `stream`.
+fn skip<R: BufRead>(stream: &mut R, mut n: u64) -> Result<(), Error> {
+    while n > 0 {
+        let available = stream.fill_buf()?.len() as u64;
+        if available == 0 {
+            return Err(Error::new(
+                ErrorKind::UnexpectedEof,
+                "stream ends before its checkpoint",
+            ));
+        }
+        let len = available.min(n);
+        stream.consume(len as usize);
+        n -= len;
+    }
+    Ok(())
+}
+
+/// Calls `f` on each line of `data`, split as [`reduce_stream`] splits
+/// its stream: on `\n`, with a `\r\n` or `\n` terminator stripped, and
+/// the last line kept even if unterminated.
+fn for_each_line<'a>(mut data: &'a [u8], mut f: impl FnMut(&'a [u8])) {
+    while !data.is_empty() {
+        match memchr::memchr(b'\n', data) {
+            Some(i) => {
+                let line = &data[..i];
+                f(line.strip_suffix(b"\r").unwrap_or(line));
+                data = &data[i + 1..];
+            }
+            None => {
+                f(data);
+                return;
+            }
+        }
+    }
+}
+
+/// Calls `f` on each run of equal consecutive lines of `data`, split as
+/// [`for_each_line`] splits them, with the length of the run.
+fn for_each_run(data: &[u8], mut f: impl FnMut(&[u8], u64)) {
+    let mut run: Option<(&[u8], u64)> = None;
+    for_each_line(data, |line| match &mut run {
+        Some((last, count)) if *last == line => *count += 1,
+        _ => {
+            if let Some((last, count)) = run.replace((line, 1)) {
+                f(last, count);
+            }
+        }
+    });
+    if let Some((last, count)) = run {
+        f(last, count);
+    }
+}
+
+/// Like [`reduce_stream`], but over lines already in memory, such as a
+/// [`MappedFile`](crate::mapped_file::MappedFile), which are handed to `line_reader` in place.
+pub fn reduce_slice<T: LineReducer>(data: &[u8], mut line_reader: T) -> T {
+    let _update = profile::span(Stage::Update, data.len());
+    let mut lines = 0;
+    for_each_run(data, |line, count| {
+        line_reader.read_repeated(line, count);
+        lines += count;
+    });
+    count_lines(lines);
+    line_reader
+}
+
+/// Reduces a stream pushed to it in chunks, rather than pulled from a
+/// [`BufRead`], for callers such as async services that are handed bytes
+/// as they arrive. Lines are split as [`reduce_stream`] splits them, and
+/// read in place from each chunk, except for a line cut by the end of a
+/// chunk, which is kept until the chunk that ends it.
+///
+/// With the `async` feature, this is also a [`Sink`] of chunks, whose
+/// sends never wait.
+pub struct LineSink<T> {
+    line_reader: T,
+    // The start of a line the last chunk did not end.
+    partial: Vec<u8>,
+}
+
+impl<T: LineReducer> LineSink<T> {
+    pub fn new(line_reader: T) -> Self {
+        Self {
+            line_reader,
+            partial: Vec::new(),
+        }
+    }
+
+    /// Reads the lines ended in `chunk`, which takes time in proportion
+    /// to its length, so callers sharing a thread can bound it.
+    pub fn push(&mut self, chunk: &[u8]) {
+        let _update = profile::span(Stage::Update, chunk.len());
+        let last = match memchr::memrchr(b'\n', chunk) {
+            Some(last) => last,
+            None => {
+                self.partial.extend_from_slice(chunk);
+                return;
+            }
+        };
+        let mut lines = 0;
+        let mut whole = &chunk[..=last];
+        if !self.partial.is_empty() {
+            let first = memchr::memchr(b'\n', whole).expect("a line break");
+            self.partial.extend_from_slice(&whole[..first]);
+            let line = &self.partial;
+            self.line_reader
+                .read_line(line.strip_suffix(b"\r").unwrap_or(line));
+            self.partial.clear();
+            lines += 1;
+            whole = &whole[first + 1..];
+        }
+        let line_reader = &mut self.line_reader;
+        for_each_run(whole, |line, count| {
+            line_reader.read_repeated(line, count);
+            lines += count;
+        });
+        count_lines(lines);
+        self.partial.extend_from_slice(&chunk[last + 1..]);
+    }
+
+    /// Reads the last line, if the stream did not end it, and returns the
+    /// reducer.
+    pub fn finish(mut self) -> T {
+        if !self.partial.is_empty() {
+            // unterminated, so a \r ending it is its own
+            self.line_reader.read_line(&self.partial);
+            count_lines(1);
+        }
+        self.line_reader
+    }
+}
+
+#[cfg(feature = "async")]
+impl<T: LineReducer + Unpin, B: AsRef<[u8]>> Sink<B> for LineSink<T> {
+    type Error = Error;
+
+    fn poll_ready(self: Pin<&mut Self>, _: &mut Context<'_>) -> Poll<Result<(), Error>> {
+        Poll::Ready(Ok(()))
+    }
+
+    fn start_send(self: Pin<&mut Self>, chunk: B) -> Result<(), Error> {
+        self.get_mut().push(chunk.as_ref());
+        Ok(())
+    }
+
+    fn poll_flush(self: Pin<&mut Self>, _: &mut Context<'_>) -> Poll<Result<(), Error>> {
+        Poll::Ready(Ok(()))
+    }
+
+    fn poll_close(self: Pin<&mut Self>, _: &mut Context<'_>) -> Poll<Result<(), Error>> {
+        Poll::Ready(Ok(()))
+    }
+}
+
+/// Bytes [`reduce_async`] reads before it yields to other tasks, which
+/// takes tens of microseconds of updates.
+#[cfg(feature = "async")]
+const YIELD_BYTES: usize = 64 << 10;
+
+/// Like [`reduce_stream`], but reads an async stream, through a
+/// [`LineSink`]. It yields to the executor whenever it has read
+/// [`YIELD_BYTES`] without waiting on the stream, so that many reductions
+/// can share a thread of the executor, none holding it for long.
+///
+/// The stream is a [`futures_io::AsyncBufRead`]; a Tokio one can be
+/// adapted with `tokio_util::compat`.
+#[cfg(feature = "async")]
+pub async fn reduce_async<R: AsyncBufRead + Unpin, T: LineReducer>(
+    mut stream: R,
+    line_reader: T,
+) -> Result<T, Error> {
+    let mut sink = LineSink::new(line_reader);
+    future::poll_fn(|cx| {
+        let mut budget = YIELD_BYTES;
+        loop {
+            let buf = ready!(Pin::new(&mut stream).poll_fill_buf(cx))?;
+            if buf.is_empty() {
+                return Poll::Ready(Ok(()));
+            }
+            if budget == 0 {
+                cx.waker().wake_by_ref();
+                return Poll::Pending;
+            }
+            let len = buf.len().min(budget);
+            sink.push(&buf[..len]);
+            Pin::new(&mut stream).consume(len);
+            budget -= len;
+        }
+    })
+    .await?;
+    Ok(sink.finish())
+}
+
+/// Lines are handed to worker threads in buffers of at least this many bytes.
+const BUFFER_BYTES: usize = 1 << 20;
+
+/// Full buffers allowed in flight per worker before the reader blocks,
+/// bounding memory to about `threads * BUFFERS_PER_THREAD * BUFFER_BYTES`.
+const BUFFERS_PER_THREAD: usize = 4;
+
+/// Contiguous storage for a batch of lines, laid out for
+/// [`LineReducer::read_lines`].
+#[derive(Default)]
+struct LineBuffer {
+    buf: Vec<u8>,
+    ends: Vec<usize>,
+}
+
+impl LineBuffer {
+    fn push(&mut self, line: &[u8]) {
+        self.buf.extend_from_slice(line);
+        self.ends.push(self.buf.len());
+    }
+
+    /// Pushes each line of `data`, which ends in a line break, with its
+    /// `\r\n` or `\n` stripped. The breaks are found with one vectorized
+    /// scan over all of `data` rather than one search per line.
+    fn push_all(&mut self, data: &[u8]) {
+        debug_assert_eq!(data.last(), Some(&b'\n'));
+        self.buf.reserve(data.len());
+        let mut start = 0;
+        for end in memchr::memchr_iter(b'\n', data) {
+            let line = &data[start..end];
+            self.push(line.strip_suffix(b"\r").unwrap_or(line));
+            start = end + 1;
+        }
+    }
+
+    fn clear(&mut self) {
+        self.buf.clear();
+        self.ends.clear();
+    }
+}
+
+/// Packs the lines of `stream`, split as [`reduce_stream`] splits them,
+/// into a [`LineBuffer`], and calls `f` on it each time it holds at least
+/// `min_bytes`, and once more on the lines left at the end, until `f`
+/// returns `false`. The buffer is emptied after each call, so `f` may
+/// also swap it for another empty one.
+fn for_each_batch<R: BufRead>(
+    mut stream: R,
+    min_bytes: usize,
+    mut f: impl FnMut(&mut LineBuffer) -> bool,
+) -> Result<(), Error> {
+    let mut lines = LineBuffer::default();
+    // the start of a line the last buffer of the stream did not end
+    let mut partial = Vec::new();
+    loop {
+        let chunk = match stream.fill_buf() {
+            Ok(chunk) => chunk,
+            Err(e) if e.kind() == ErrorKind::Interrupted => continue,
+            Err(e) => return Err(e),
+        };
+        if chunk.is_empty() {
+            break;
+        }
+        let len = chunk.len();
+        match memchr::memrchr(b'\n', chunk) {
+            Some(last) => {
+                let mut whole = &chunk[..=last];
+                if !partial.is_empty() {
+                    let first = memchr::memchr(b'\n', whole).expect("a line break");
+                    partial.extend_from_slice(&whole[..first]);
+                    lines.push(partial.strip_suffix(b"\r").unwrap_or(&partial));
+                    partial.clear();
+                    whole = &whole[first + 1..];
+                }
+                lines.push_all(whole);
+                partial.extend_from_slice(&chunk[last + 1..]);
+            }
+            None => partial.extend_from_slice(chunk),
+        }
+        stream.consume(len);
+        if !lines.ends.is_empty() && lines.buf.len() >= min_bytes {
+            if !f(&mut lines) {
+                return Ok(());
+            }
+            lines.clear();
+        }
+    }
+    if !partial.is_empty() {
+        // unterminated, so a \r ending it is its own
+        lines.push(&partial);
+    }
+    if !lines.ends.is_empty() {
+        f(&mut lines);
+    }
+    Ok(())
+}
+
+/// Like [`reduce_stream`], but the calling thread only splits the stream
+/// into [`LineBuffer`]s, which are reduced by `threads` worker threads
+/// that each own a [`ParallelLineReducer::fork`] of `line_reader`. The
+/// workers are combined into `line_reader` at the end.
+///
+/// Panics in a worker are propagated to the caller.
+pub fn reduce_stream_parallel<R: BufRead, T: ParallelLineReducer>(
+    stream: R,
+    mut line_reader: T,
+    threads: usize,
+) -> Result<T, Error> {
+    assert!(threads > 0, "need at least one thread");
+    if threads == 1 {
+        return reduce_stream(stream, line_reader);
+    }
+
+    let (full_tx, full_rx) = mpsc::sync_channel(threads * BUFFERS_PER_THREAD);
+    let (empty_tx, empty_rx) = mpsc::channel();
+    let gauge = QueueGauge::new(Queue::Lines);
+    // Shared by the workers only, so if they all exit early (on panic) the
+    // receiver is dropped and the reader stops instead of blocking forever.
+    let full_rx = Arc::new(Mutex::new(full_rx));
+
+    thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads)
+            .map(|worker| {
+                let mut reducer = line_reader.fork();
+                let full_rx = Arc::clone(&full_rx);
+                let empty_tx = empty_tx.clone();
+                let gauge = &gauge;
+                scope.spawn(move || {
+                    numa::place_worker(worker, threads);
+                    loop {
+                        let wait = profile::span(Stage::Wait, 0);
+                        // the lock guard is dropped before the buffer is reduced
+                        let next = full_rx.lock().expect("lock never poisoned").recv();
+                        drop(wait);
+                        let mut lines: LineBuffer = match next {
+                            Ok(lines) => lines,
+                            Err(_) => break,
+                        };
+                        gauge.received();
+                        let update = profile::span(Stage::Update, lines.buf.len());
+                        reducer.read_lines(&lines.buf, &lines.ends);
+                        drop(update);
+                        count_lines(lines.ends.len() as u64);
+                        lines.clear();
+                        // recycled by the reader, which may have already finished
+                        let _ = empty_tx.send(lines);
+                    }
+                    reducer
+                })
+            })
+            .collect();
+        drop(full_rx);
+        drop(empty_tx);
+
+        let split = profile::span(Stage::Split, 0);
+        let read = for_each_batch(TimedRead::new(stream), BUFFER_BYTES, |lines| {
+            let next = empty_rx.try_recv().unwrap_or_default();
+            profile::add_bytes(Stage::Split, lines.buf.len());
+            gauge.sent();
+            let _wait = profile::span(Stage::Wait, 0);
+            full_tx.send(mem::replace(lines, next)).is_ok()
+        });
+        drop(split);
+        drop(full_tx);
+
+        let reducers = workers
+            .into_iter()
+            .map(|worker| worker.join().unwrap_or_else(|e| panic::resume_unwind(e)))
+            .collect();
+        numa::combine_workers(&mut line_reader, reducers);
+        read.map(|()| line_reader)
+    })
+}
+
+/// Like [`reduce_stream_parallel`], but for reducers keyed on the first
+/// space-delimited word of each line, such as
+/// [`KeyedCounter`](crate::counters::KeyedCounter). Rather than sharing
+/// buffers among the workers, the calling thread routes each line by the
+/// hash of its key to the one worker that owns that key, through a
+/// bounded channel of [`LineBuffer`]s per worker. So each key is reduced
+/// by a single fork, in the order of its lines, and combining the forks
+/// only gathers disjoint keys, without merging any per-key state.
+///
+/// Panics in a worker are propagated to the caller.
+pub fn reduce_stream_partitioned<R: BufRead, T: ParallelLineReducer>(
+    stream: R,
+    mut line_reader: T,
+    threads: usize,
+) -> Result<T, Error> {
+    assert!(threads > 0, "need at least one thread");
+    if threads == 1 {
+        return reduce_stream(stream, line_reader);
+    }
+
+    // the buffers in flight to all the workers
+    let gauge = QueueGauge::new(Queue::Lines);
+    thread::scope(|scope| {
+        // the lines being collected for each worker, and its channels
+        let mut routes = Vec::with_capacity(threads);
+        let workers: Vec<_> = (0..threads)
+            .map(|worker| {
+                let mut reducer = line_reader.fork();
+                let (full_tx, full_rx) = mpsc::sync_channel::<LineBuffer>(BUFFERS_PER_THREAD);
+                let (empty_tx, empty_rx) = mpsc::channel();
+                routes.push((LineBuffer::default(), full_tx, empty_rx));
+                let gauge = &gauge;
+                scope.spawn(move || {
+                    numa::place_worker(worker, threads);
+                    loop {
+                        let wait = profile::span(Stage::Wait, 0);
+                        let next = full_rx.recv();
+                        drop(wait);
+                        let mut lines = match next {
+                            Ok(lines) => lines,
+                            Err(_) => break,
+                        };
+                        gauge.received();
+                        let update = profile::span(Stage::Update, lines.buf.len());
+                        reducer.read_lines(&lines.buf, &lines.ends);
+                        drop(update);
+                        count_lines(lines.ends.len() as u64);
+                        lines.clear();
+                        // recycled by the reader, which may have already finished
+                        let _ = empty_tx.send(lines);
+                    }
+                    reducer
+                })
+            })
+            .collect();
+
+        let mut workers_alive = true;
+        let split = profile::span(Stage::Split, 0);
+        let read = TimedRead::new(stream).for_byte_line(|line| {
+            let key = line_reader.partition_key(line);
+            let (lines, full_tx, empty_rx) = &mut routes[key_table::partition(key, threads)];
+            lines.push(line);
+            if lines.buf.len() >= BUFFER_BYTES {
+                let next = empty_rx.try_recv().unwrap_or_default();
+                profile::add_bytes(Stage::Split, lines.buf.len());
+                gauge.sent();
+                let _wait = profile::span(Stage::Wait, 0);
+                workers_alive = full_tx.send(mem::replace(lines, next)).is_ok();
+            }
+            Ok(workers_alive)
+        });
+        drop(split);
+        for (lines, full_tx, _) in routes {
+            if workers_alive && !lines.ends.is_empty() {
+                profile::add_bytes(Stage::Split, lines.buf.len());
+                gauge.sent();
+                let _ = full_tx.send(lines);
+            }
+        }
+
+        let reducers = workers
+            .into_iter()
+            .map(|worker| worker.join().unwrap_or_else(|e| panic::resume_unwind(e)))
+            .collect();
+        numa::combine_workers(&mut line_reader, reducers);
+        read.map(|()| line_reader)
+    })
+}
+
+/// Buffers sent to the workers of [`reduce_stream_pipelined`] in turn,
+/// each with its own pair of bounded channels, and read back in the same
+/// turn, which restores their order without any reordering.
+struct InOrder<'a, P> {
+    routes: Vec<(
+        mpsc::SyncSender<LineBuffer>,
+        mpsc::Receiver<(LineBuffer, Vec<P>)>,
+    )>,
+    gauge: &'a QueueGauge,
+    sent: usize,
+    read: usize,
+}
+
+impl<P> InOrder<'_, P> {
+    /// Sends `lines` to the next worker, replacing them with an empty
+    /// buffer, after first reading back the oldest buffer if
+    /// [`BUFFERS_PER_THREAD`] per worker are in flight. Returns whether the
+    /// workers are still running.
+    fn send<T>(&mut self, lines: &mut LineBuffer, line_reader: &mut T) -> bool
+    where
+        T: PipelinedLineReducer<Prepared = P>,
+    {
+        let mut next = LineBuffer::default();
+        if self.sent - self.read == self.routes.len() * BUFFERS_PER_THREAD {
+            match self.read_back(line_reader) {
+                Some(lines) => next = lines,
+                None => return false,
+            }
+        }
+        profile::add_bytes(Stage::Split, lines.buf.len());
+        self.gauge.sent();
+        let full = mem::replace(lines, next);
+        // a worker has at most BUFFERS_PER_THREAD in flight, so this never waits
+        let sent = self.routes[self.sent % self.routes.len()].0.send(full);
+        self.sent += 1;
+        sent.is_ok()
+    }
+
+    /// Hands the prepared lines of the oldest buffer in flight to
+    /// `line_reader`, and returns the buffer, emptied, unless its worker
+    /// has stopped.
+    fn read_back<T>(&mut self, line_reader: &mut T) -> Option<LineBuffer>
+    where
+        T: PipelinedLineReducer<Prepared = P>,
+    {
+        let wait = profile::span(Stage::Wait, 0);
+        let (mut lines, prepared) = self.routes[self.read % self.routes.len()].1.recv().ok()?;
+        drop(wait);
+        self.read += 1;
+        let _update = profile::span(Stage::Update, lines.buf.len());
+        for (line, prepared) in packed_lines(&lines.buf, &lines.ends).zip(prepared) {
+            line_reader.read_prepared(line, prepared);
+        }
+        count_lines(lines.ends.len() as u64);
+        lines.clear();
+        Some(lines)
+    }
+}
+
+/// Like [`reduce_stream`], but `threads` worker threads prepare the lines
+/// of each [`LineBuffer`] with [`PipelinedLineReducer::prepare`], such as
+/// by decoding and deserializing the sketches on them, while the calling
+/// thread splits the stream and hands the prepared lines to `line_reader`.
+/// Unlike [`reduce_stream_parallel`], there is one reducer, which sees
+/// every line in the order of the stream, as merges of sorted keys need,
+/// and only the preparing is spread out.
+///
+/// Panics in a worker are propagated to the caller.
+pub fn reduce_stream_pipelined<R: BufRead, T: PipelinedLineReducer>(
+    stream: R,
+    mut line_reader: T,
+    threads: usize,
+) -> Result<T, Error> {
+    assert!(threads > 0, "need at least one thread");
+    if threads == 1 {
+        return reduce_stream(stream, line_reader);
+    }
+
+    let preparer = line_reader.preparer();
+    let gauge = QueueGauge::new(Queue::Lines);
+    thread::scope(|scope| {
+        let mut routes = Vec::with_capacity(threads);
+        let workers: Vec<_> = (0..threads)
+            .map(|worker| {
+                let (full_tx, full_rx) = mpsc::sync_channel::<LineBuffer>(BUFFERS_PER_THREAD);
+                let (prepared_tx, prepared_rx) = mpsc::sync_channel(BUFFERS_PER_THREAD);
+                routes.push((full_tx, prepared_rx));
+                let (preparer, gauge) = (&preparer, &gauge);
+                scope.spawn(move || {
+                    numa::place_worker(worker, threads);
+                    for lines in full_rx {
+                        gauge.received();
+                        let update = profile::span(Stage::Update, lines.buf.len());
+                        let prepared: Vec<T::Prepared> = packed_lines(&lines.buf, &lines.ends)
+                            .map(|line| T::prepare(preparer, line))
+                            .collect();
+                        drop(update);
+                        if prepared_tx.send((lines, prepared)).is_err() {
+                            break;
+                        }
+                    }
+                })
+            })
+            .collect();
+
+        let mut in_order = InOrder {
+            routes,
+            gauge: &gauge,
+            sent: 0,
+            read: 0,
+        };
+        let mut workers_alive = true;
+        let split = profile::span(Stage::Split, 0);
+        let read = for_each_batch(TimedRead::new(stream), BUFFER_BYTES, |lines| {
+            workers_alive = in_order.send(lines, &mut line_reader);
+            workers_alive
+        });
+        drop(split);
+        while workers_alive && in_order.read < in_order.sent {
+            workers_alive = in_order.read_back(&mut line_reader).is_some();
+        }
+        // disconnects the workers
+        drop(in_order);
+
+        for worker in workers {
+            worker.join().unwrap_or_else(|e| panic::resume_unwind(e));
+        }
+        read.map(|()| line_reader)
+    })
+}
+
+/// Like [`reduce_stream_parallel`], but over lines already in memory.
+/// Rather than copying them into buffers, `data` is cut at the first line
+/// break after every [`BUFFER_BYTES`], and the workers take turns claiming
+/// the next chunk, reducing its lines in place.
+///
+/// Panics in a worker are propagated to the caller.
+pub fn reduce_slice_parallel<T: ParallelLineReducer>(
+    data: &[u8],
+    mut line_reader: T,
+    threads: usize,
+) -> T {
+    assert!(threads > 0, "need at least one thread");
+    if threads == 1 {
+        return reduce_slice(data, line_reader);
+    }
+
+    let mut chunk_ends = Vec::new();
+    let mut end = 0;
+    while end < data.len() {
+        let cut = (end + BUFFER_BYTES).min(data.len());
+        end = match memchr::memchr(b'\n', &data[cut..]) {
+            Some(i) => cut + i + 1,
+            None => data.len(),
+        };
+        chunk_ends.push(end);
+    }
+    let next_chunk = AtomicUsize::new(0);
+
+    thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads)
+            .map(|worker| {
+                let mut reducer = line_reader.fork();
+                let (chunk_ends, next_chunk) = (&chunk_ends, &next_chunk);
+                scope.spawn(move || {
+                    numa::place_worker(worker, threads);
+                    loop {
+                        let i = next_chunk.fetch_add(1, Ordering::Relaxed);
+                        if i >= chunk_ends.len() {
+                            break;
+                        }
+                        let start = if i == 0 { 0 } else { chunk_ends[i - 1] };
+                        let chunk = &data[start..chunk_ends[i]];
+                        let _update = profile::span(Stage::Update, chunk.len());
+                        let mut lines = 0;
+                        for_each_run(chunk, |line, count| {
+                            reducer.read_repeated(line, count);
+                            lines += count;
+                        });
+                        count_lines(lines);
+                    }
+                    reducer
+                })
+            })
+            .collect();
+
+        let reducers = workers
+            .into_iter()
+            .map(|worker| worker.join().unwrap_or_else(|e| panic::resume_unwind(e)))
+            .collect();
+        numa::combine_workers(&mut line_reader, reducers);
+    });
+    line_reader
+}
+
+/// Files are read through buffers of this many bytes, larger than the
+/// default so that each read fetches more of the file.
+const FILE_BUFFER_BYTES: usize = 4 << 20;
+
+/// Like [`reduce_stream_parallel`], but over the lines of each of `paths`
+/// in turn, without a separate reading thread. Each of the `threads`
+/// workers claims the next unread file, reads it through its own buffer
+/// and reduces its lines, until none are left. Files are claimed largest
+/// first, so that one left over for last is small, and a worker that is
+/// done with many small files takes the next while another is still on a
+/// large one. Files compressed with zstd or gzip are decompressed as they
+/// are read. The workers are combined into `line_reader` at the end.
+///
+/// Every file is taken to end in a line break, so the last line of one
+/// never runs into the first line of the next. Returns the first error
+/// opening or reading a file, with its path, after which no further files
+/// are claimed. Panics in a worker are propagated to the caller.
+pub fn reduce_files_parallel<P: AsRef<Path> + Sync, T: ParallelLineReducer>(
+    paths: &[P],
+    mut line_reader: T,
+    threads: usize,
+) -> Result<T, Error> {
+    assert!(threads > 0, "need at least one thread");
+    let with_path =
+        |path: &Path, e: Error| Error::new(e.kind(), format!("{}: {}", path.display(), e));
+    let mut sized = Vec::with_capacity(paths.len());
+    for path in paths {
+        let path = path.as_ref();
+        let len = fs::metadata(path).map_err(|e| with_path(path, e))?.len();
+        sized.push((len, path));
+    }
+    sized.sort_by(|a, b| b.0.cmp(&a.0));
+    let next_file = AtomicUsize::new(0);
+
+    thread::scope(|scope| {
+        let nworkers = threads.min(sized.len());
+        let workers: Vec<_> = (0..nworkers)
+            .map(|worker| {
+                let mut reducer = line_reader.fork();
+                let (sized, next_file) = (&sized, &next_file);
+                scope.spawn(move || -> Result<T, Error> {
+                    numa::place_worker(worker, nworkers);
+                    loop {
+                        let i = next_file.fetch_add(1, Ordering::Relaxed);
+                        if i >= sized.len() {
+                            return Ok(reducer);
+                        }
+                        let path = sized[i].1;
+                        reducer = reduce_file(path, reducer).map_err(|e| {
+                            // stop the other workers after their current files
+                            next_file.store(sized.len(), Ordering::Relaxed);
+                            with_path(path, e)
+                        })?;
+                    }
+                })
+            })
+            .collect();
+
+        let (mut read, mut reducers) = (Ok(()), Vec::with_capacity(workers.len()));
+        for worker in workers {
+            match worker.join() {
+                Ok(Ok(reducer)) => reducers.push(reducer),
+                Ok(Err(e)) => {
+                    if read.is_ok() {
+                        read = Err(e)
+                    }
+                }
+                Err(e) => panic::resume_unwind(e),
+            }
+        }
+        numa::combine_workers(&mut line_reader, reducers);
+        read.map(|()| line_reader)
+    })
+}
+
+/// Reduces the lines of the file at `path` on this thread, decompressing
+/// it first if it is compressed, or else telling the kernel that it will
+/// be read once from front to back. On Linux, the
+/// file is read with several reads in flight through a [`UringReader`]
+/// where io_uring is available.
+fn reduce_file<T: LineReducer>(path: &Path, line_reader: T) -> Result<T, Error> {
+    let mut file = File::open(path)?;
+    let mut magic = [0; 4];
+    let magic_len = file.read(&mut magic)?;
+    file.seek(SeekFrom::Start(0))?;
+    if let Some(compression) = Compression::detect(&magic[..magic_len]) {
+        let decompressed = compression.reader(file)?;
+        let lines = BufReader::with_capacity(FILE_BUFFER_BYTES, decompressed);
+        return reduce_stream(lines, line_reader);
+    }
+    #[cfg(target_os = "linux")]
+    {
+        use std::os::unix::io::AsRawFd;
+        // only a hint, so failure is harmless
+        unsafe {
+            libc::posix_fadvise(file.as_raw_fd(), 0, 0, libc::POSIX_FADV_SEQUENTIAL);
+        }
+        if let Ok(reader) = UringReader::new(&file, FILE_BUFFER_BYTES) {
+            return reduce_stream(reader, line_reader);
+        }
+    }
+    reduce_stream(
+        BufReader::with_capacity(FILE_BUFFER_BYTES, file),
+        line_reader,
+    )
+}
+
 #[cfg(test)]
 mod tests {
 
+    use std::collections::HashMap;
+    use std::env;
+    use std::process;
     use std::u8;
 
     use proptest::{collection, prop_assert_eq, proptest, sample};
@@ -49,6 +1103,469 @@ mod tests {
         }
     }
 
+    impl ParallelLineReducer for DumbReducer {
+        fn fork(&self) -> Self {
+            Self::default()
+        }
+
+        fn combine(&mut self, other: Self) {
+            self.all.extend(other.all);
+        }
+    }
+
+    impl Checkpoint for DumbReducer {
+        fn save(&self, out: &mut Vec<u8>) {
+            out.extend_from_slice(&self.all);
+        }
+
+        fn save_config(&self, out: &mut Vec<u8>) {
+            out.extend_from_slice(b"dumb");
+        }
+
+        fn restore(&mut self, saved: &[u8]) -> Result<(), Error> {
+            self.all = saved.to_vec();
+            Ok(())
+        }
+    }
+
+    impl PipelinedLineReducer for DumbReducer {
+        type Preparer = ();
+        type Prepared = usize;
+
+        fn preparer(&self) {}
+
+        fn prepare(_: &(), line: &[u8]) -> usize {
+            line.len()
+        }
+
+        fn read_prepared(&mut self, line: &[u8], len: usize) {
+            assert_eq!(line.len(), len);
+            self.read_line(line)
+        }
+    }
+
+    /// Reads lines as its `DumbReducer` does, but panics on the line
+    /// `crash_at`, counting from 0.
+    struct CrashingReducer {
+        inner: DumbReducer,
+        lines: usize,
+        crash_at: usize,
+    }
+
+    impl LineReducer for CrashingReducer {
+        fn read_line(&mut self, line: &[u8]) {
+            assert!(self.lines != self.crash_at, "crash");
+            self.lines += 1;
+            self.inner.read_line(line)
+        }
+    }
+
+    impl Checkpoint for CrashingReducer {
+        fn save(&self, out: &mut Vec<u8>) {
+            self.inner.save(out)
+        }
+
+        fn save_config(&self, out: &mut Vec<u8>) {
+            self.inner.save_config(out)
+        }
+
+        fn restore(&mut self, saved: &[u8]) -> Result<(), Error> {
+            self.inner.restore(saved)
+        }
+    }
+
+    /// Saves its configuration as `config`, and otherwise saves and
+    /// restores as a `DumbReducer`.
+    struct ConfiguredReducer {
+        inner: DumbReducer,
+        config: Vec<u8>,
+    }
+
+    impl LineReducer for ConfiguredReducer {
+        fn read_line(&mut self, line: &[u8]) {
+            self.inner.read_line(line)
+        }
+    }
+
+    impl Checkpoint for ConfiguredReducer {
+        fn save(&self, out: &mut Vec<u8>) {
+            self.inner.save(out)
+        }
+
+        fn save_config(&self, out: &mut Vec<u8>) {
+            out.extend_from_slice(&self.config)
+        }
+
+        fn restore(&mut self, saved: &[u8]) -> Result<(), Error> {
+            self.inner.restore(saved)
+        }
+    }
+
+    /// The header of the checkpoints of a reducer configured as `config`
+    /// reading `input`.
+    fn header(config: &[u8], input: &[u8]) -> Vec<u8> {
+        let mut header = Vec::new();
+        write_frame(&mut header, config).unwrap();
+        write_frame(&mut header, input).unwrap();
+        header
+    }
+
+    #[test]
+    fn resumes_from_checkpoint() {
+        let path = env::temp_dir().join(format!("dsrs-checkpoint-{}", process::id()));
+        let stream: Vec<u8> = (0..10 * 1000)
+            .map(|i| format!("line{}{}", i, if i % 3 == 0 { "\r\n" } else { "\n" }))
+            .collect::<String>()
+            .into_bytes();
+        let expected = reduce_stream(&stream[..], DumbReducer::default())
+            .unwrap()
+            .all;
+
+        for &crash_at in &[4000, 9000] {
+            let crashing = CrashingReducer {
+                inner: DumbReducer::default(),
+                lines: 0,
+                crash_at,
+            };
+            let crashed = panic::catch_unwind(panic::AssertUnwindSafe(|| {
+                reduce_stream_checkpointed(&stream[..], crashing, &path, b"in", 1000)
+            }));
+            assert!(crashed.is_err());
+            // at least one checkpoint was written, at a line boundary
+            let (offset, state) = read_checkpoint(&path, &header(b"dumb", b"in"))
+                .unwrap()
+                .unwrap();
+            assert!(offset > 0 && stream[offset as usize - 1] == b'\n');
+            assert_eq!(
+                state.iter().filter(|&&b| b == b'\n').count(),
+                stream[..offset as usize]
+                    .iter()
+                    .filter(|&&b| b == b'\n')
+                    .count()
+            );
+
+            let resumed =
+                reduce_stream_checkpointed(&stream[..], DumbReducer::default(), &path, b"in", 1000)
+                    .unwrap();
+            assert_eq!(resumed.all, expected);
+            assert!(!path.exists());
+        }
+
+        fs::write(&path, b"garbage").unwrap();
+        let err = reduce_stream_checkpointed(&stream[..], DumbReducer::default(), &path, b"in", 1)
+            .err()
+            .unwrap();
+        assert_eq!(err.kind(), ErrorKind::InvalidData);
+        fs::remove_file(&path).unwrap();
+    }
+
+    #[test]
+    fn refuses_other_checkpoints() {
+        let path = env::temp_dir().join(format!("dsrs-checkpoint-other-{}", process::id()));
+        let reducer = |config: &[u8]| ConfiguredReducer {
+            inner: DumbReducer::default(),
+            config: config.to_vec(),
+        };
+        let save = || write_checkpoint(&path, 2, &header(b"a", b"in"), b"x\n").unwrap();
+        let stream = b"x\ny\n";
+        save();
+        for (config, input) in &[(&b"b"[..], &b"in"[..]), (b"a", b"other")] {
+            let err = reduce_stream_checkpointed(&stream[..], reducer(config), &path, input, 1)
+                .err()
+                .unwrap();
+            assert_eq!(err.kind(), ErrorKind::InvalidData);
+            assert!(path.exists());
+        }
+        // cut anywhere before its state
+        for cut in 1..27 {
+            fs::write(&path, &fs::read(&path).unwrap()[..cut]).unwrap();
+            let err = reduce_stream_checkpointed(&stream[..], reducer(b"a"), &path, b"in", 1)
+                .err()
+                .unwrap();
+            assert_eq!(err.kind(), ErrorKind::InvalidData, "{}", cut);
+            save();
+        }
+        let resumed =
+            reduce_stream_checkpointed(&stream[..], reducer(b"a"), &path, b"in", 1).unwrap();
+        assert_eq!(resumed.inner.all, b"x\ny\n");
+        assert!(!path.exists());
+    }
+
+    fn sorted_lines(all: &[u8]) -> Vec<&[u8]> {
+        let mut lines: Vec<_> = all.split(|c| *c == b'\n').collect();
+        lines.sort_unstable();
+        lines
+    }
+
+    #[test]
+    fn reduces_stream_parallel() {
+        // enough lines for several buffers per thread
+        let file: Vec<u8> = (0..500 * 1000)
+            .flat_map(|i| format!("line {}\r\n", i).into_bytes())
+            .collect();
+        let expected = reduce_stream(&file[..], DumbReducer::default()).unwrap();
+        for &threads in &[1, 2, 7] {
+            let reducer = reduce_stream_parallel(&file[..], DumbReducer::default(), threads);
+            let reducer = reducer.unwrap();
+            assert_eq!(sorted_lines(&reducer.all), sorted_lines(&expected.all));
+        }
+    }
+
+    #[test]
+    fn reduces_stream_pipelined() {
+        // enough lines to fill every worker's buffers several times over
+        let file: Vec<u8> = (0..2000 * 1000)
+            .flat_map(|i| format!("line {}\r\n", i).into_bytes())
+            .collect();
+        let expected = reduce_stream(&file[..], DumbReducer::default()).unwrap();
+        for &threads in &[1, 2, 7] {
+            let reducer = reduce_stream_pipelined(&file[..], DumbReducer::default(), threads);
+            // in order, unlike reduce_stream_parallel
+            assert_eq!(reducer.unwrap().all, expected.all);
+        }
+    }
+
+    /// Keeps the lines of each key, in order, and checks that forks never
+    /// share a key.
+    #[derive(Default)]
+    struct KeyedReducer {
+        lines: HashMap<Vec<u8>, Vec<Vec<u8>>>,
+    }
+
+    impl LineReducer for KeyedReducer {
+        fn read_line(&mut self, line: &[u8]) {
+            let key = line.split(|c| *c == b' ').next().expect("key");
+            self.lines
+                .entry(key.to_vec())
+                .or_default()
+                .push(line.to_vec());
+        }
+    }
+
+    impl ParallelLineReducer for KeyedReducer {
+        fn fork(&self) -> Self {
+            Self::default()
+        }
+
+        fn combine(&mut self, other: Self) {
+            for (key, lines) in other.lines {
+                assert!(self.lines.insert(key, lines).is_none(), "key reduced twice");
+            }
+        }
+    }
+
+    #[test]
+    fn reduces_stream_partitioned() {
+        // keys with many lines each, some without a space or a value
+        let file: Vec<u8> = (0..500 * 1000)
+            .map(|i| match i % 7 {
+                0 => format!("key{}\n", i % 1000),
+                1 => format!("key{} \r\n", i % 1000),
+                _ => format!("key{} value {}\n", i % 1000, i),
+            })
+            .flat_map(String::into_bytes)
+            .collect();
+        let expected = reduce_stream(&file[..], KeyedReducer::default()).unwrap();
+        assert_eq!(expected.lines.len(), 1000);
+        for &threads in &[1, 2, 7] {
+            let reducer = reduce_stream_partitioned(&file[..], KeyedReducer::default(), threads);
+            assert_eq!(reducer.unwrap().lines, expected.lines);
+        }
+        let empty = reduce_stream_partitioned(&b""[..], KeyedReducer::default(), 3);
+        assert!(empty.unwrap().lines.is_empty());
+    }
+
+    #[test]
+    fn reduces_slice_like_stream() {
+        // an unterminated last line, a lone \r that is not a terminator,
+        // and runs of repeated lines, some differing only in terminator
+        let mut file: Vec<u8> = (0..500 * 1000)
+            .flat_map(|i| {
+                format!("line {}{}\n", i / 4, if i % 3 == 0 { "\r" } else { "" }).into_bytes()
+            })
+            .collect();
+        file.extend_from_slice(b"\n\rlast\r");
+        let expected = reduce_stream(&file[..], DumbReducer::default()).unwrap();
+        assert_eq!(
+            reduce_slice(&file, DumbReducer::default()).all,
+            expected.all
+        );
+        for &threads in &[1, 2, 7] {
+            let reducer = reduce_slice_parallel(&file, DumbReducer::default(), threads);
+            assert_eq!(sorted_lines(&reducer.all), sorted_lines(&expected.all));
+        }
+        assert!(reduce_slice_parallel(b"", DumbReducer::default(), 3)
+            .all
+            .is_empty());
+    }
+
+    #[test]
+    fn line_sink_matches_stream() {
+        let mut file: Vec<u8> = (0..20 * 1000)
+            .flat_map(|i| {
+                format!("line {}{}\n", i / 4, if i % 3 == 0 { "\r" } else { "" }).into_bytes()
+            })
+            .collect();
+        file.extend_from_slice(b"\n\rlast\r");
+        let expected = reduce_stream(&file[..], DumbReducer::default()).unwrap();
+        // chunks that cut lines, and \r\n terminators, anywhere
+        for &chunk in &[1, 2, 7, 1000, file.len()] {
+            let mut sink = LineSink::new(DumbReducer::default());
+            file.chunks(chunk).for_each(|c| sink.push(c));
+            assert!(sink.finish().all == expected.all, "chunks of {}", chunk);
+        }
+        assert!(LineSink::new(DumbReducer::default())
+            .finish()
+            .all
+            .is_empty());
+    }
+
+    #[test]
+    fn splits_lines_across_buffers() {
+        let mut file: Vec<u8> = (0..20 * 1000)
+            .flat_map(|i| {
+                format!("line {}{}\n", i, if i % 3 == 0 { "\r" } else { "" }).into_bytes()
+            })
+            .collect();
+        file.extend_from_slice(b"\n\rlast\r");
+        let expected = reduce_slice(&file, DumbReducer::default());
+        // buffers that cut lines, and \r\n terminators, anywhere
+        for &capacity in &[1, 2, 7, 1000, file.len()] {
+            let stream = BufReader::with_capacity(capacity, &file[..]);
+            let reducer = reduce_stream(stream, DumbReducer::default()).unwrap();
+            assert!(reducer.all == expected.all, "buffers of {}", capacity);
+        }
+        assert!(reduce_stream(&b""[..], DumbReducer::default())
+            .unwrap()
+            .all
+            .is_empty());
+    }
+
+    #[cfg(feature = "async")]
+    #[test]
+    fn reduces_async_like_stream() {
+        use futures::executor::block_on;
+        use futures::io::{AllowStdIo, BufReader};
+        use futures::SinkExt;
+
+        let file: Vec<u8> = (0..100 * 1000)
+            .flat_map(|i| format!("line {}\n", i / 4).into_bytes())
+            .collect();
+        let expected = reduce_stream(&file[..], DumbReducer::default()).unwrap();
+        // a reader buffer past YIELD_BYTES, so the reduction yields
+        let stream = BufReader::with_capacity(3 * YIELD_BYTES, AllowStdIo::new(&file[..]));
+        let reduced = block_on(reduce_async(stream, DumbReducer::default())).unwrap();
+        assert!(reduced.all == expected.all);
+
+        let mut sink = LineSink::new(DumbReducer::default());
+        block_on(async {
+            for chunk in file.chunks(999) {
+                sink.send(chunk).await.unwrap();
+            }
+        });
+        assert!(sink.finish().all == expected.all);
+    }
+
+    #[test]
+    fn reduces_files_parallel() {
+        // files of uneven sizes, one empty and one without a final newline
+        let dir = env::temp_dir();
+        let mut paths = Vec::new();
+        let mut expected = DumbReducer::default();
+        for (i, &lines) in [0, 1, 10, 100 * 1000, 1000, 7].iter().enumerate() {
+            let mut file: Vec<u8> = (0..lines)
+                .flat_map(|j| format!("file {} line {}\n", i, j).into_bytes())
+                .collect();
+            if i == 2 {
+                file.pop();
+            }
+            expected = reduce_stream(&file[..], expected).unwrap();
+            let path = dir.join(format!("dsrs-files-{}-{}", process::id(), i));
+            fs::write(&path, file).unwrap();
+            paths.push(path);
+        }
+        for &threads in &[1, 2, 7] {
+            let reducer = reduce_files_parallel(&paths, DumbReducer::default(), threads);
+            assert_eq!(
+                sorted_lines(&reducer.unwrap().all),
+                sorted_lines(&expected.all)
+            );
+        }
+        assert!(
+            reduce_files_parallel(&paths[..0], DumbReducer::default(), 3)
+                .unwrap()
+                .all
+                .is_empty()
+        );
+
+        let missing = dir.join(format!("dsrs-files-{}-missing", process::id()));
+        paths.push(missing.clone());
+        let err = reduce_files_parallel(&paths, DumbReducer::default(), 2).err();
+        assert!(err
+            .unwrap()
+            .to_string()
+            .contains(&*missing.to_string_lossy()));
+        for path in &paths[..paths.len() - 1] {
+            fs::remove_file(path).unwrap();
+        }
+    }
+
+    #[test]
+    fn packs_lines() {
+        let buf = b"abcdef";
+        let lines: Vec<_> = packed_lines(buf, &[0, 2, 2, 6]).collect();
+        assert_eq!(lines, vec![&b""[..], b"ab", b"", b"cdef"]);
+    }
+
+    struct PanickyReducer;
+
+    impl LineReducer for PanickyReducer {
+        fn read_line(&mut self, line: &[u8]) {
+            assert!(line != b"boom", "boom");
+        }
+    }
+
+    impl ParallelLineReducer for PanickyReducer {
+        fn fork(&self) -> Self {
+            Self
+        }
+
+        fn combine(&mut self, _other: Self) {}
+    }
+
+    #[test]
+    #[should_panic(expected = "boom")]
+    fn parallel_propagates_panics() {
+        // every worker panics early, the reader must not block on the rest
+        let file: Vec<u8> = (0..1000 * 1000)
+            .flat_map(|i| {
+                if i % 1000 == 0 {
+                    "boom\n".to_owned()
+                } else {
+                    format!("{}\n", i)
+                }
+                .into_bytes()
+            })
+            .collect();
+        let _ = reduce_stream_parallel(&file[..], PanickyReducer, 4);
+    }
+
+    #[test]
+    #[should_panic(expected = "boom")]
+    fn partitioned_propagates_panics() {
+        let file: Vec<u8> = (0..1000 * 1000)
+            .flat_map(|i| {
+                if i % 1000 == 0 {
+                    "boom\n".to_owned()
+                } else {
+                    format!("{}\n", i)
+                }
+                .into_bytes()
+            })
+            .collect();
+        let _ = reduce_stream_partitioned(&file[..], PanickyReducer, 4);
+    }
+
     fn non_newlines() -> Vec<u8> {
         (0..u8::MAX).filter(|x| *x != b'\n').collect()
     }
@@ -0,0 +1,507 @@
+//! An input file reader over io_uring, on Linux, which keeps several
+//! large reads of a file in flight at once, into buffers registered with
+//! the kernel, and hands out each filled buffer in turn as it is, with no
+//! copies.
+//!
+//! The ring is driven directly through its system calls, so the layouts
+//! below follow `linux/io_uring.h`.
+
+use std::collections::VecDeque;
+use std::fs::File;
+use std::io::{BufRead, Error, ErrorKind, Read};
+use std::mem;
+use std::os::unix::io::AsRawFd;
+use std::ptr;
+use std::sync::atomic::{AtomicU32, Ordering};
+
+use libc;
+
+const IORING_OFF_SQ_RING: libc::off_t = 0;
+const IORING_OFF_CQ_RING: libc::off_t = 0x800_0000;
+const IORING_OFF_SQES: libc::off_t = 0x1000_0000;
+const IORING_OP_READ_FIXED: u8 = 4;
+const IORING_ENTER_GETEVENTS: libc::c_uint = 1;
+const IORING_REGISTER_BUFFERS: libc::c_uint = 0;
+
+#[repr(C)]
+#[derive(Default)]
+struct SqringOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    flags: u32,
+    dropped: u32,
+    array: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct CqringOffsets {
+    head: u32,
+    tail: u32,
+    ring_mask: u32,
+    ring_entries: u32,
+    overflow: u32,
+    cqes: u32,
+    flags: u32,
+    resv1: u32,
+    user_addr: u64,
+}
+
+#[repr(C)]
+#[derive(Default)]
+struct Params {
+    sq_entries: u32,
+    cq_entries: u32,
+    flags: u32,
+    sq_thread_cpu: u32,
+    sq_thread_idle: u32,
+    features: u32,
+    wq_fd: u32,
+    resv: [u32; 3],
+    sq_off: SqringOffsets,
+    cq_off: CqringOffsets,
+}
+
+#[repr(C)]
+struct Sqe {
+    opcode: u8,
+    flags: u8,
+    ioprio: u16,
+    fd: i32,
+    off: u64,
+    addr: u64,
+    len: u32,
+    rw_flags: u32,
+    user_data: u64,
+    buf_index: u16,
+    personality: u16,
+    splice_fd_in: i32,
+    pad: [u64; 2],
+}
+
+#[repr(C)]
+struct Cqe {
+    user_data: u64,
+    res: i32,
+    flags: u32,
+}
+
+/// A region mapped from the ring's file descriptor.
+struct Region {
+    ptr: *mut u8,
+    len: usize,
+}
+
+impl Region {
+    unsafe fn map(fd: libc::c_int, len: usize, offset: libc::off_t) -> Result<Self, Error> {
+        let ptr = libc::mmap(
+            ptr::null_mut(),
+            len,
+            libc::PROT_READ | libc::PROT_WRITE,
+            libc::MAP_SHARED | libc::MAP_POPULATE,
+            fd,
+            offset,
+        );
+        if ptr == libc::MAP_FAILED {
+            return Err(Error::last_os_error());
+        }
+        Ok(Self {
+            ptr: ptr as *mut u8,
+            len,
+        })
+    }
+
+    /// The `u32` at byte `offset`, which the kernel may access too.
+    unsafe fn atomic(&self, offset: u32) -> &AtomicU32 {
+        &*(self.ptr.add(offset as usize) as *const AtomicU32)
+    }
+}
+
+impl Drop for Region {
+    fn drop(&mut self) {
+        unsafe {
+            libc::munmap(self.ptr as *mut libc::c_void, self.len);
+        }
+    }
+}
+
+/// A submission and completion queue pair, used from one thread.
+struct Ring {
+    fd: libc::c_int,
+    sq: Region,
+    cq: Region,
+    sqes: Region,
+    params: Params,
+    /// Entries pushed since the last [`Ring::submit_and_wait`].
+    unsubmitted: u32,
+}
+
+impl Ring {
+    fn new(entries: u32) -> Result<Self, Error> {
+        let mut params = Params::default();
+        let fd = unsafe {
+            libc::syscall(
+                libc::SYS_io_uring_setup,
+                entries,
+                &mut params as *mut Params,
+            )
+        };
+        if fd < 0 {
+            return Err(Error::last_os_error());
+        }
+        let fd = fd as libc::c_int;
+        let mapped = unsafe {
+            let sq_len = params.sq_off.array as usize + params.sq_entries as usize * 4;
+            let cq_len =
+                params.cq_off.cqes as usize + params.cq_entries as usize * mem::size_of::<Cqe>();
+            let sqes_len = params.sq_entries as usize * mem::size_of::<Sqe>();
+            Region::map(fd, sq_len, IORING_OFF_SQ_RING).and_then(|sq| {
+                let cq = Region::map(fd, cq_len, IORING_OFF_CQ_RING)?;
+                let sqes = Region::map(fd, sqes_len, IORING_OFF_SQES)?;
+                Ok((sq, cq, sqes))
+            })
+        };
+        match mapped {
+            Ok((sq, cq, sqes)) => Ok(Self {
+                fd,
+                sq,
+                cq,
+                sqes,
+                params,
+                unsubmitted: 0,
+            }),
+            Err(e) => {
+                unsafe { libc::close(fd) };
+                Err(e)
+            }
+        }
+    }
+
+    /// Registers `bufs` for [`IORING_OP_READ_FIXED`], by their index.
+    fn register_buffers(&self, bufs: &mut [Box<[u8]>]) -> Result<(), Error> {
+        let iovecs: Vec<libc::iovec> = bufs
+            .iter_mut()
+            .map(|buf| libc::iovec {
+                iov_base: buf.as_mut_ptr() as *mut libc::c_void,
+                iov_len: buf.len(),
+            })
+            .collect();
+        let registered = unsafe {
+            libc::syscall(
+                libc::SYS_io_uring_register,
+                self.fd,
+                IORING_REGISTER_BUFFERS,
+                iovecs.as_ptr(),
+                iovecs.len() as libc::c_uint,
+            )
+        };
+        if registered < 0 {
+            return Err(Error::last_os_error());
+        }
+        Ok(())
+    }
+
+    /// Queues `sqe`, which is submitted with the next wait. Callers keep
+    /// fewer entries in flight than the ring holds, so there is always
+    /// room.
+    fn push(&mut self, sqe: Sqe) {
+        let off = &self.params.sq_off;
+        unsafe {
+            let mask = *(self.sq.ptr.add(off.ring_mask as usize) as *const u32);
+            let tail = self.sq.atomic(off.tail).load(Ordering::Relaxed);
+            let index = tail & mask;
+            ptr::write((self.sqes.ptr as *mut Sqe).add(index as usize), sqe);
+            *(self.sq.ptr.add(off.array as usize) as *mut u32).add(index as usize) = index;
+            // publish the entry before the tail that covers it
+            self.sq
+                .atomic(off.tail)
+                .store(tail.wrapping_add(1), Ordering::Release);
+        }
+        self.unsubmitted += 1;
+    }
+
+    /// Submits the queued entries, then returns the user data and result
+    /// of the next completion, waiting for one if need be.
+    fn submit_and_wait(&mut self) -> Result<(u64, i32), Error> {
+        loop {
+            if let Some(cqe) = self.pop() {
+                if self.unsubmitted == 0 {
+                    return Ok(cqe);
+                }
+                // submit what is queued before handing out the completion
+                self.enter(0)?;
+                return Ok(cqe);
+            }
+            self.enter(1)?;
+        }
+    }
+
+    fn enter(&mut self, min_complete: u32) -> Result<(), Error> {
+        let flags = if min_complete > 0 {
+            IORING_ENTER_GETEVENTS
+        } else {
+            0
+        };
+        let submitted = unsafe {
+            libc::syscall(
+                libc::SYS_io_uring_enter,
+                self.fd,
+                self.unsubmitted,
+                min_complete,
+                flags,
+                ptr::null::<libc::c_void>(),
+                0usize,
+            )
+        };
+        if submitted < 0 {
+            let e = Error::last_os_error();
+            return match e.kind() {
+                ErrorKind::Interrupted => Ok(()),
+                _ => Err(e),
+            };
+        }
+        self.unsubmitted -= submitted as u32;
+        Ok(())
+    }
+
+    fn pop(&mut self) -> Option<(u64, i32)> {
+        let off = &self.params.cq_off;
+        unsafe {
+            let head = self.cq.atomic(off.head).load(Ordering::Relaxed);
+            // entries up to the tail are written once it is seen
+            if head == self.cq.atomic(off.tail).load(Ordering::Acquire) {
+                return None;
+            }
+            let mask = *(self.cq.ptr.add(off.ring_mask as usize) as *const u32);
+            let cqe =
+                &*(self.cq.ptr.add(off.cqes as usize) as *const Cqe).add((head & mask) as usize);
+            let completed = (cqe.user_data, cqe.res);
+            self.cq
+                .atomic(off.head)
+                .store(head.wrapping_add(1), Ordering::Release);
+            Some(completed)
+        }
+    }
+}
+
+impl Drop for Ring {
+    fn drop(&mut self) {
+        unsafe {
+            libc::close(self.fd);
+        }
+    }
+}
+
+/// Reads in flight at once.
+const READS_IN_FLIGHT: usize = 4;
+
+/// A [`BufRead`] over a regular file, which reads ahead through a ring of
+/// [`READS_IN_FLIGHT`] reads of `read_bytes` each, at consecutive offsets.
+/// Each buffer is handed out whole once its read completes, and read into
+/// again past the last read once it is consumed, so the kernel fills the
+/// next buffers while the caller works through this one.
+pub struct UringReader<'a> {
+    file: &'a File,
+    ring: Ring,
+    bufs: Vec<Box<[u8]>>,
+    /// File offset and bytes read so far of each buffer, and whether its
+    /// read is over.
+    reads: Vec<(u64, usize, bool)>,
+    /// Buffers in file order, the first being read from.
+    order: VecDeque<usize>,
+    /// Bytes of the first buffer consumed.
+    pos: usize,
+    next_offset: u64,
+    eof: bool,
+    in_flight: usize,
+}
+
+impl<'a> UringReader<'a> {
+    /// Starts reading `file` from its start, `read_bytes` at a time.
+    /// Returns an error if io_uring is unavailable, such as before Linux
+    /// 5.1 or where it is disabled, so callers can read it otherwise.
+    pub fn new(file: &'a File, read_bytes: usize) -> Result<Self, Error> {
+        assert!(read_bytes > 0 && read_bytes <= u32::MAX as usize);
+        let ring = Ring::new(READS_IN_FLIGHT as u32)?;
+        let mut bufs: Vec<Box<[u8]>> = (0..READS_IN_FLIGHT)
+            .map(|_| vec![0; read_bytes].into_boxed_slice())
+            .collect();
+        ring.register_buffers(&mut bufs)?;
+        let mut reader = Self {
+            file,
+            ring,
+            bufs,
+            reads: vec![(0, 0, true); READS_IN_FLIGHT],
+            order: VecDeque::with_capacity(READS_IN_FLIGHT),
+            pos: 0,
+            next_offset: 0,
+            eof: false,
+            in_flight: 0,
+        };
+        for i in 0..READS_IN_FLIGHT {
+            reader.start(i);
+        }
+        Ok(reader)
+    }
+
+    /// Starts reading the next bytes of the file into buffer `i`.
+    fn start(&mut self, i: usize) {
+        let offset = self.next_offset;
+        self.next_offset += self.bufs[i].len() as u64;
+        self.reads[i] = (offset, 0, false);
+        self.order.push_back(i);
+        self.submit(i);
+    }
+
+    /// Queues the read of the rest of buffer `i`.
+    fn submit(&mut self, i: usize) {
+        let (offset, filled, _) = self.reads[i];
+        let buf = &mut self.bufs[i][filled..];
+        self.ring.push(Sqe {
+            opcode: IORING_OP_READ_FIXED,
+            flags: 0,
+            ioprio: 0,
+            fd: self.file.as_raw_fd(),
+            off: offset + filled as u64,
+            addr: buf.as_mut_ptr() as u64,
+            len: buf.len() as u32,
+            rw_flags: 0,
+            user_data: i as u64,
+            buf_index: i as u16,
+            personality: 0,
+            splice_fd_in: 0,
+            pad: [0; 2],
+        });
+        self.in_flight += 1;
+    }
+
+    /// Waits for the next completion, reading on into its buffer if the
+    /// read came up short of both its end and the end of the file.
+    fn complete(&mut self) -> Result<(), Error> {
+        let (i, res) = self.ring.submit_and_wait()?;
+        self.in_flight -= 1;
+        let i = i as usize;
+        let (_, filled, done) = &mut self.reads[i];
+        match res {
+            res if res < 0 => {
+                let e = Error::from_raw_os_error(-res);
+                if e.kind() != ErrorKind::Interrupted {
+                    return Err(e);
+                }
+            }
+            0 => {
+                *done = true;
+                self.eof = true;
+                return Ok(());
+            }
+            res => *filled += res as usize,
+        }
+        if *filled == self.bufs[i].len() {
+            *done = true;
+        } else {
+            self.submit(i);
+        }
+        Ok(())
+    }
+}
+
+impl BufRead for UringReader<'_> {
+    fn fill_buf(&mut self) -> Result<&[u8], Error> {
+        loop {
+            let i = match self.order.front() {
+                Some(&i) => i,
+                None => return Ok(&[]),
+            };
+            let (_, filled, done) = self.reads[i];
+            if !done {
+                self.complete()?;
+                continue;
+            }
+            if self.pos < filled {
+                return Ok(&self.bufs[i][self.pos..filled]);
+            }
+            self.order.pop_front();
+            self.pos = 0;
+            if !self.eof {
+                self.start(i);
+            }
+        }
+    }
+
+    fn consume(&mut self, amt: usize) {
+        self.pos += amt;
+    }
+}
+
+impl Read for UringReader<'_> {
+    fn read(&mut self, out: &mut [u8]) -> Result<usize, Error> {
+        let buf = self.fill_buf()?;
+        let n = buf.len().min(out.len());
+        out[..n].copy_from_slice(&buf[..n]);
+        self.consume(n);
+        Ok(n)
+    }
+}
+
+impl Drop for UringReader<'_> {
+    fn drop(&mut self) {
+        // the kernel may still write to the buffers until their reads end
+        while self.in_flight > 0 {
+            match self.ring.submit_and_wait() {
+                Ok(_) => self.in_flight -= 1,
+                Err(_) => break,
+            }
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::env;
+    use std::fs;
+    use std::process;
+
+    use super::*;
+
+    #[test]
+    fn reads_whole_file() {
+        for &(len, read_bytes) in &[
+            (0usize, 16),
+            (1, 16),
+            (100, 7),
+            (5000, 64),
+            (3 << 20, 1 << 20),
+        ] {
+            let path = env::temp_dir().join(format!("dsrs-uring-{}-{}", process::id(), len));
+            let bytes: Vec<u8> = (0..len).map(|i| (i % 251) as u8).collect();
+            fs::write(&path, &bytes).unwrap();
+            let file = File::open(&path).unwrap();
+            fs::remove_file(&path).unwrap();
+            let mut reader = match UringReader::new(&file, read_bytes) {
+                Ok(reader) => reader,
+                // io_uring is disabled here, and readers fall back on reads
+                Err(_) => return,
+            };
+            let mut read = Vec::new();
+            reader.read_to_end(&mut read).unwrap();
+            assert_eq!(read, bytes);
+            assert!(reader.fill_buf().unwrap().is_empty());
+        }
+    }
+
+    #[test]
+    fn drops_with_reads_in_flight() {
+        let path = env::temp_dir().join(format!("dsrs-uring-drop-{}", process::id()));
+        fs::write(&path, vec![b'\n'; 1 << 20]).unwrap();
+        let file = File::open(&path).unwrap();
+        fs::remove_file(&path).unwrap();
+        let reader = UringReader::new(&file, 1 << 12);
+        if let Ok(mut reader) = reader {
+            assert_eq!(reader.fill_buf().unwrap(), &[b'\n'; 1 << 12][..]);
+        }
+    }
+}
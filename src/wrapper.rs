@@ -5,10 +5,299 @@
 //! lack of inlining, though this may be improved with cross-language
 //! LTO, see dtolnay/cxx#371.
 
+use std::panic;
+use std::sync::atomic::{AtomicBool, AtomicUsize, Ordering};
+use std::thread;
+
+use crate::DataSketchesError;
+
+mod bloom;
+mod count_min;
 mod cpc;
 pub(crate) mod hh;
+mod hll;
+mod key_hash;
+mod kll;
+mod req;
 mod theta;
+mod tuple;
+mod var_opt;
+
+pub use bloom::BloomFilter;
+pub use count_min::CountMinSketch;
+pub use cpc::{CpcArena, CpcSketch, CpcUnion, FrozenCpcSketch, ShardedCpcSketch};
+pub use hh::{CompactHhSketches, ConcurrentHhSketch, HhBuffer, HhSketch, NativeHhSketch};
+pub use hll::{HllMatrix, HllSketch, HllType, HllUnion};
+pub use key_hash::KeyHash;
+pub use kll::{
+    ConcurrentKllDoubleSketch, ConcurrentKllFloatSketch, KllDoubleBuffer, KllDoubleSketch,
+    KllFloatBuffer, KllFloatSketch, KllU32Sketch, KllU64Sketch, WrappedKllDoubleSketch,
+    WrappedKllFloatSketch,
+};
+pub use req::{ReqSketch, WrappedReqSketch};
+pub use theta::{
+    ConcurrentThetaSketch, KeyedThetaSketch, StaticThetaSketch, ThetaBuffer, ThetaExclusion,
+    ThetaExpression, ThetaIntersection, ThetaJaccardMatrix, ThetaResizeFactor, ThetaSketch,
+    ThetaUnion, ThetaWindow, WrappedThetaSketch,
+};
+pub use tuple::{
+    AodCombine, ArrayOfDoublesColumns, ArrayOfDoublesColumnsIntersection,
+    ArrayOfDoublesColumnsUnion, ArrayOfDoublesIntersection, ArrayOfDoublesSketch,
+    ArrayOfDoublesUnion, StaticArrayOfDoublesSketch,
+};
+pub use var_opt::{SubsetSummary, VarOptSketch, VarOptUnion};
+
+/// Backs the large tables allocated from now on, such as the registers of
+/// an [`HllMatrix`] or the map of a [`NativeHhSketch`] of 2MB or more,
+/// with 2MB huge pages, or stops doing so. Explicit huge pages reserved
+/// through `vm.nr_hugepages` are used while any are left, and transparent
+/// ones otherwise. This only has an effect on Linux.
+pub fn set_huge_pages(enabled: bool) {
+    crate::bridge::ffi::set_huge_pages(enabled)
+}
+
+/// Seeds the coin flips that KLL and REQ sketches compact with, which
+/// otherwise differ from run to run, so that benchmarks are reproducible.
+///
+/// The seed is global to the process. Each thread flips its own coins:
+/// this reseeds the calling thread's, and seeds those of threads that
+/// flip their first coin afterwards from `seed` and the order in which
+/// they do, so no two threads flip alike. `None` restores seeding from
+/// the clock. Seed a single thread with [`seed_thread_compaction_rng`].
+pub fn seed_compaction_rng(seed: Option<u64>) {
+    if let Some(seed) = seed {
+        assert!(seed != 0, "seed must be nonzero");
+    }
+    crate::bridge::ffi::seed_compaction_bits(seed.unwrap_or(0))
+}
+
+/// Reseeds the compaction coin flips of the calling thread only, e.g.,
+/// for a test that should not affect sketches on other threads.
+pub fn seed_thread_compaction_rng(seed: u64) {
+    crate::bridge::ffi::seed_thread_compaction_bits(seed)
+}
+
+/// Panics unless `ends` is a valid list of key end offsets into `buf`, i.e.,
+/// non-decreasing and bounded by `buf.len()`. The C++ batch updates trust
+/// these offsets, so this check is what keeps them memory-safe.
+pub(crate) fn check_batch_ends(buf: &[u8], ends: &[usize]) {
+    let mut start = 0;
+    for &end in ends {
+        assert!(
+            start <= end && end <= buf.len(),
+            "invalid batch end offset {} (previous {}, buffer length {})",
+            end,
+            start,
+            buf.len()
+        );
+        start = end;
+    }
+}
+
+/// Inputs claimed at once by a [`union_many`] or [`map_many`] worker.
+const UNION_CHUNK: usize = 64;
+
+/// A union that [`union_many`] can build up from serialized sketches.
+pub(crate) trait SerializedUnion: Sized + Send {
+    type Sketch: Send;
+
+    /// Deserializes `buf` and merges it in.
+    fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError>;
+
+    /// Deserializes and merges in each of `bufs`, for unions that can
+    /// merge many sketches at once faster than one by one.
+    fn merge_all_serialized(&mut self, bufs: &[&[u8]]) -> Result<(), DataSketchesError> {
+        bufs.iter().try_for_each(|buf| self.merge_serialized(buf))
+    }
+
+    fn merge_sketch(&mut self, sketch: Self::Sketch);
+
+    fn result(&self) -> Self::Sketch;
+}
+
+/// Unions the serialized sketches on `threads` threads. Each thread keeps
+/// its own union, made by `empty`, and claims chunks of [`UNION_CHUNK`]
+/// inputs from a shared cursor until none are left, so slow chunks do not
+/// hold up the others. The partial unions are then combined pairwise,
+/// halving their number each round.
+///
+/// Returns the first deserialization error, after which threads stop
+/// claiming new chunks.
+pub(crate) fn union_many<U: SerializedUnion>(
+    serialized: &[&[u8]],
+    threads: usize,
+    empty: impl Fn() -> U + Sync,
+) -> Result<U::Sketch, DataSketchesError> {
+    assert!(threads > 0, "need at least one thread");
+    let threads = threads.min((serialized.len() + UNION_CHUNK - 1) / UNION_CHUNK);
+    if threads <= 1 {
+        let mut union = empty();
+        union.merge_all_serialized(serialized)?;
+        return Ok(union.result());
+    }
+
+    let cursor = AtomicUsize::new(0);
+    let failed = AtomicBool::new(false);
+    let mut partials = thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads)
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut union = empty();
+                    while !failed.load(Ordering::Relaxed) {
+                        let start = cursor.fetch_add(UNION_CHUNK, Ordering::Relaxed);
+                        if start >= serialized.len() {
+                            break;
+                        }
+                        let end = serialized.len().min(start + UNION_CHUNK);
+                        if let Err(e) = union.merge_all_serialized(&serialized[start..end]) {
+                            failed.store(true, Ordering::Relaxed);
+                            return Err(e);
+                        }
+                    }
+                    Ok(union)
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .map(|worker| match worker.join() {
+                Ok(partial) => partial,
+                Err(e) => panic::resume_unwind(e),
+            })
+            .collect::<Result<Vec<U>, _>>()
+    })?;
+
+    while partials.len() > 1 {
+        let rhs = partials.split_off((partials.len() + 1) / 2);
+        thread::scope(|scope| {
+            for (lhs, rhs) in partials.iter_mut().zip(rhs) {
+                scope.spawn(move || lhs.merge_sketch(rhs.result()));
+            }
+        });
+    }
+    Ok(partials.pop().expect("at least one partial union").result())
+}
+
+/// Appends what `serialize` writes of each of the inputs, such as sketches,
+/// to one buffer on `threads` threads, which claim chunks of
+/// [`UNION_CHUNK`] inputs as in [`map_many`], and returns it with the end
+/// of each input's bytes in it, so that input `i` spans
+/// `ends[i - 1]..ends[i]`, taking `ends[-1]` as 0.
+///
+/// Panics if `threads` is 0.
+pub(crate) fn serialize_many<I: Sync>(
+    inputs: &[I],
+    threads: usize,
+    serialize: impl Fn(&I, &mut Vec<u8>) + Sync,
+) -> (Vec<u8>, Vec<usize>) {
+    let serialize_chunk = |chunk: &[I]| {
+        let mut buf = Vec::new();
+        let ends = chunk
+            .iter()
+            .map(|input| {
+                serialize(input, &mut buf);
+                buf.len()
+            })
+            .collect();
+        (buf, ends)
+    };
+    assert!(threads > 0, "need at least one thread");
+    let threads = threads.min((inputs.len() + UNION_CHUNK - 1) / UNION_CHUNK);
+    if threads <= 1 {
+        return serialize_chunk(inputs);
+    }
+
+    let cursor = AtomicUsize::new(0);
+    let mut chunks = thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads)
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut chunks = Vec::new();
+                    loop {
+                        let start = cursor.fetch_add(UNION_CHUNK, Ordering::Relaxed);
+                        if start >= inputs.len() {
+                            return chunks;
+                        }
+                        let end = inputs.len().min(start + UNION_CHUNK);
+                        chunks.push((start, serialize_chunk(&inputs[start..end])));
+                    }
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .flat_map(|worker| match worker.join() {
+                Ok(chunks) => chunks,
+                Err(e) => panic::resume_unwind(e),
+            })
+            .collect::<Vec<_>>()
+    });
+
+    chunks.sort_unstable_by_key(|&(start, _)| start);
+    let mut buf = Vec::with_capacity(chunks.iter().map(|(_, (bytes, _))| bytes.len()).sum());
+    let mut ends = Vec::with_capacity(inputs.len());
+    for (_, (bytes, chunk_ends)) in chunks {
+        let offset = buf.len();
+        buf.extend_from_slice(&bytes);
+        ends.extend(chunk_ends.into_iter().map(|end| offset + end));
+    }
+    (buf, ends)
+}
+
+/// Applies `f` to each of the inputs, such as serialized sketches, on
+/// `threads` threads, which claim chunks of [`UNION_CHUNK`] inputs from a
+/// shared cursor as in [`union_many`]. The results are in input order.
+///
+/// Returns the first error, after which threads stop claiming new chunks.
+pub(crate) fn map_many<I: Sync, T: Send>(
+    inputs: &[I],
+    threads: usize,
+    f: impl Fn(&I) -> Result<T, DataSketchesError> + Sync,
+) -> Result<Vec<T>, DataSketchesError> {
+    assert!(threads > 0, "need at least one thread");
+    let threads = threads.min((inputs.len() + UNION_CHUNK - 1) / UNION_CHUNK);
+    if threads <= 1 {
+        return inputs.iter().map(|input| f(input)).collect();
+    }
+
+    let cursor = AtomicUsize::new(0);
+    let failed = AtomicBool::new(false);
+    let partials = thread::scope(|scope| {
+        let workers: Vec<_> = (0..threads)
+            .map(|_| {
+                scope.spawn(|| {
+                    let mut chunks = Vec::new();
+                    while !failed.load(Ordering::Relaxed) {
+                        let start = cursor.fetch_add(UNION_CHUNK, Ordering::Relaxed);
+                        if start >= inputs.len() {
+                            break;
+                        }
+                        let end = inputs.len().min(start + UNION_CHUNK);
+                        match inputs[start..end].iter().map(|input| f(input)).collect() {
+                            Ok(results) => chunks.push((start, results)),
+                            Err(e) => {
+                                failed.store(true, Ordering::Relaxed);
+                                return Err(e);
+                            }
+                        }
+                    }
+                    Ok(chunks)
+                })
+            })
+            .collect();
+        workers
+            .into_iter()
+            .map(|worker| match worker.join() {
+                Ok(chunks) => chunks,
+                Err(e) => panic::resume_unwind(e),
+            })
+            .collect::<Result<Vec<Vec<(usize, Vec<T>)>>, _>>()
+    })?;
 
-pub use cpc::{CpcSketch, CpcUnion};
-pub use hh::HhSketch;
-pub use theta::{StaticThetaSketch, ThetaIntersection, ThetaSketch, ThetaUnion};
+    let mut chunks: Vec<_> = partials.into_iter().flatten().collect();
+    chunks.sort_unstable_by_key(|&(start, _)| start);
+    Ok(chunks
+        .into_iter()
+        .flat_map(|(_, results)| results)
+        .collect())
+}
@@ -0,0 +1,230 @@
+//! Wrapper type for the count-min sketch.
+
+use cxx;
+
+use crate::bridge::ffi;
+use crate::wrapper::check_batch_ends;
+use crate::DataSketchesError;
+
+/// A [count-min sketch][cm-wiki] answers point queries: an upper bound on
+/// the total weight of any byte string, in fixed memory. Unlike the heavy
+/// hitter sketches, which only keep the heaviest items, it has an estimate
+/// for every item, but cannot list them.
+///
+/// Estimates never undercount, and overcount by the weight of the items
+/// whose counters collide with the queried one's. Each item takes one
+/// counter in each of `num_hashes` stripes of a single 64-byte block, so an
+/// update or query touches one cache line however many hashes it takes.
+/// With `2^lg_num_blocks` blocks of 8 counters, an estimate overcounts by
+/// at most `e * num_hashes / (8 * 2^lg_num_blocks)` of the total weight
+/// with probability about `1 - 1/e` per hash; more hashes narrow the
+/// stripes, which only pays off once collisions are rare.
+///
+/// Sketches with the same shape merge exactly, by adding their counters.
+///
+/// [cm-wiki]: https://en.wikipedia.org/wiki/Count%E2%80%93min_sketch
+pub struct CountMinSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueCountMinSketch>,
+}
+
+impl CountMinSketch {
+    /// Create an empty sketch of `2^lg_num_blocks` blocks of 64 bytes,
+    /// taking `num_hashes` counters per item. Fails unless
+    /// `lg_num_blocks <= 26` and `num_hashes` is 1, 2, 4 or 8.
+    pub fn new(lg_num_blocks: u8, num_hashes: u8) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_count_min_sketch(lg_num_blocks, num_hashes)?,
+        })
+    }
+
+    /// Adds `weight` to `value`. Two values must have the exact same bytes
+    /// and lengths to be considered equal.
+    pub fn update(&mut self, value: &[u8], weight: u64) {
+        self.inner.pin_mut().update(value, weight)
+    }
+
+    /// Equivalent to calling [`Self::update`] with `weight` on each key
+    /// packed into `buf`, but crosses into C++ only once, and overlaps the
+    /// cache misses of consecutive keys. Key `i` is
+    /// `buf[ends[i - 1]..ends[i]]`, where the first key starts at offset 0.
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn update_batch(&mut self, buf: &[u8], ends: &[usize], weight: u64) {
+        check_batch_ends(buf, ends);
+        self.inner.pin_mut().update_bytes_batch(buf, ends, weight)
+    }
+
+    /// Returns an upper bound on the total weight `value` was updated with.
+    pub fn estimate(&self, value: &[u8]) -> u64 {
+        self.inner.estimate(value)
+    }
+
+    /// Returns the total weight of all updates, which bounds every estimate.
+    pub fn total_weight(&self) -> u64 {
+        self.inner.get_total_weight()
+    }
+
+    pub fn lg_num_blocks(&self) -> u8 {
+        self.inner.get_lg_num_blocks()
+    }
+
+    pub fn num_hashes(&self) -> u8 {
+        self.inner.get_num_hashes()
+    }
+
+    /// Adds the counters of `other` into this sketch's, which leaves it as
+    /// if it had seen the updates of both. Fails unless the sketches have
+    /// the same shape.
+    pub fn merge(&mut self, other: &Self) -> Result<(), DataSketchesError> {
+        Ok(self
+            .inner
+            .pin_mut()
+            .merge(other.inner.as_ref().expect("non-null"))?)
+    }
+
+    /// Serializes the sketch's shape and every counter, so the result is
+    /// `16 + 64 * 2^lg_num_blocks` bytes however many items it has seen.
+    pub fn serialize(&self) -> impl AsRef<[u8]> {
+        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+        impl AsRef<[u8]> for UPtrVec {
+            fn as_ref(&self) -> &[u8] {
+                self.0.as_slice()
+            }
+        }
+        UPtrVec(self.inner.serialize())
+    }
+
+    pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::deserialize_opaque_count_min_sketch(buf)?,
+        })
+    }
+}
+
+impl Clone for CountMinSketch {
+    fn clone(&self) -> Self {
+        Self {
+            inner: self.inner.clone(),
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use std::collections::HashMap;
+
+    use super::*;
+
+    fn key(i: u64) -> Vec<u8> {
+        format!("key{}", i).into_bytes()
+    }
+
+    #[test]
+    fn estimates_bound_counts() {
+        for &num_hashes in &[1, 2, 4, 8] {
+            let mut cm = CountMinSketch::new(10, num_hashes).unwrap();
+            let mut counts = HashMap::new();
+            for i in 0..100 * 1000 {
+                // a few heavy keys among many light ones
+                let k = if i % 10 == 0 { i % 50 } else { i % 20000 };
+                cm.update(&key(k), 1 + i % 3);
+                *counts.entry(k).or_insert(0) += 1 + i % 3;
+            }
+            let total: u64 = counts.values().sum();
+            assert_eq!(cm.total_weight(), total);
+            for (&k, &count) in &counts {
+                let est = cm.estimate(&key(k));
+                assert!(count <= est && est <= total, "{} {}", count, est);
+            }
+            assert!(cm.estimate(b"absent") <= total);
+        }
+    }
+
+    #[test]
+    fn exact_when_sparse() {
+        let mut cm = CountMinSketch::new(16, 2).unwrap();
+        for i in 0..100 {
+            cm.update(&key(i), i);
+        }
+        let exact = (0..100).filter(|&i| cm.estimate(&key(i)) == i).count();
+        assert!(exact >= 99, "{}", exact);
+        assert_eq!(CountMinSketch::new(4, 4).unwrap().estimate(b""), 0);
+    }
+
+    #[test]
+    fn batch_update_matches_single() {
+        let mut single = CountMinSketch::new(8, 4).unwrap();
+        let mut buf = Vec::new();
+        let mut ends = Vec::new();
+        for i in 0..10 * 1000 {
+            single.update(&key(i % 777), 3);
+            buf.extend_from_slice(&key(i % 777));
+            ends.push(buf.len());
+        }
+        let mut batched = CountMinSketch::new(8, 4).unwrap();
+        batched.update_batch(&buf, &ends, 3);
+        assert_eq!(single.serialize().as_ref(), batched.serialize().as_ref());
+    }
+
+    #[test]
+    #[should_panic]
+    fn batch_update_bad_ends() {
+        CountMinSketch::new(4, 1)
+            .unwrap()
+            .update_batch(&[1, 2, 3], &[2, 1], 1);
+    }
+
+    #[test]
+    fn merge_matches_combined() {
+        let mut left = CountMinSketch::new(10, 2).unwrap();
+        let mut right = CountMinSketch::new(10, 2).unwrap();
+        let mut both = CountMinSketch::new(10, 2).unwrap();
+        for i in 0..10 * 1000 {
+            let sketch = if i % 3 == 0 { &mut left } else { &mut right };
+            sketch.update(&key(i % 1234), 1);
+            both.update(&key(i % 1234), 1);
+        }
+        let copy = left.clone();
+        left.merge(&right).unwrap();
+        assert_eq!(left.serialize().as_ref(), both.serialize().as_ref());
+        assert_eq!(copy.total_weight() + right.total_weight(), 10 * 1000);
+
+        assert!(left.merge(&CountMinSketch::new(9, 2).unwrap()).is_err());
+        assert!(left.merge(&CountMinSketch::new(10, 4).unwrap()).is_err());
+    }
+
+    #[test]
+    fn serialization_round_trip() {
+        let mut cm = CountMinSketch::new(6, 4).unwrap();
+        for i in 0..1000 {
+            cm.update(&key(i), i % 5);
+        }
+        let bytes = cm.serialize();
+        assert_eq!(bytes.as_ref().len(), 16 + 64 * 64);
+        let cpy = CountMinSketch::deserialize(bytes.as_ref()).unwrap();
+        assert_eq!(cpy.serialize().as_ref(), bytes.as_ref());
+        assert_eq!((cpy.lg_num_blocks(), cpy.num_hashes()), (6, 4));
+        assert_eq!(cpy.total_weight(), cm.total_weight());
+        for i in 0..1000 {
+            assert_eq!(cpy.estimate(&key(i)), cm.estimate(&key(i)));
+        }
+
+        let bytes = bytes.as_ref();
+        assert!(matches!(
+            CountMinSketch::deserialize(&bytes[..bytes.len() - 1]),
+            Err(DataSketchesError::CXXError(_))
+        ));
+        assert!(matches!(
+            CountMinSketch::deserialize(&[9, 9, 9, 9]),
+            Err(DataSketchesError::CXXError(_))
+        ));
+    }
+
+    #[test]
+    fn invalid_shape() {
+        assert!(CountMinSketch::new(27, 2).is_err());
+        assert!(CountMinSketch::new(10, 0).is_err());
+        assert!(CountMinSketch::new(10, 3).is_err());
+        assert!(CountMinSketch::new(10, 16).is_err());
+    }
+}
@@ -1,8 +1,15 @@
 //! Wrapper types for the CPC sketch.
 
+use std::mem;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::sync::{Mutex, MutexGuard, PoisonError, TryLockError};
+use std::time::{Duration, Instant};
+
 use cxx;
 
 use crate::bridge::ffi;
+use crate::bridge::ffi::KeyHash;
+use crate::wrapper::{check_batch_ends, map_many, serialize_many, union_many, SerializedUnion};
 use crate::DataSketchesError;
 
 /// The [Compressed Probability Counting][orig-docs] (CPC) sketch is
@@ -27,18 +34,38 @@ pub struct CpcSketch {
 }
 
 impl CpcSketch {
-    /// Create a CPC sketch representing the empty set.
+    /// The `lg_k` of sketches from [`Self::new`].
+    pub const DEFAULT_LG_K: u8 = 11;
+
+    /// Create a CPC sketch representing the empty set, with
+    /// [`Self::DEFAULT_LG_K`].
     pub fn new() -> Self {
-        Self {
-            inner: ffi::new_opaque_cpc_sketch(),
-        }
+        Self::with_lg_k(Self::DEFAULT_LG_K).expect("valid lg_k")
+    }
+
+    /// Create a CPC sketch representing the empty set, whose relative
+    /// error is about `0.6 / sqrt(2^lg_k)`, so each increment of `lg_k`
+    /// roughly doubles its size. Fails unless `4 <= lg_k <= 26`.
+    pub fn with_lg_k(lg_k: u8) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_cpc_sketch(lg_k)?,
+        })
     }
 
-    /// Return the current estimate of distinct values seen.
+    /// Return the current estimate of distinct values seen. The estimate
+    /// is cached until the next update, so polling it between updates
+    /// costs next to nothing.
     pub fn estimate(&self) -> f64 {
         self.inner.estimate()
     }
 
+    /// Whether the sketch was updated since [`Self::estimate`] last
+    /// computed its estimate, for pollers to skip unchanged sketches. An
+    /// update need not change the estimate, as its value may be a repeat.
+    pub fn is_dirty(&self) -> bool {
+        self.inner.is_dirty()
+    }
+
     /// Observe a new value. Two values must have the exact same
     /// bytes and lengths to be considered equal.
     pub fn update(&mut self, value: &[u8]) {
@@ -54,21 +81,190 @@ impl CpcSketch {
         self.inner.pin_mut().update_u64(value)
     }
 
+    /// Equivalent to calling [`Self::update_u64`] on each of `values`, but
+    /// crosses into C++ only once.
+    pub fn update_u64_batch(&mut self, values: &[u64]) {
+        self.inner.pin_mut().update_u64_batch(values)
+    }
+
+    /// Equivalent to calling [`Self::update`] on each key packed into `buf`,
+    /// but crosses into C++ only once. Key `i` is `buf[ends[i - 1]..ends[i]]`,
+    /// where the first key starts at offset 0.
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn update_batch(&mut self, buf: &[u8], ends: &[usize]) {
+        check_batch_ends(buf, ends);
+        self.inner.pin_mut().update_bytes_batch(buf, ends)
+    }
+
+    /// Equivalent to [`Self::update`] with the key `hash` was made from.
+    pub fn update_hashed(&mut self, hash: KeyHash) {
+        self.inner.pin_mut().update_hashed(hash)
+    }
+
+    /// Equivalent to [`Self::update_hashed`] on each of `hashes`, but
+    /// crosses into C++ only once.
+    pub fn update_hashed_batch(&mut self, hashes: &[KeyHash]) {
+        self.inner.pin_mut().update_hashed_batch(hashes)
+    }
+
+    /// The coupon that [`Self::update`] derives from `value` in a sketch
+    /// with this `lg_k`, with its 6-bit column in the low bits and its row
+    /// above them.
+    pub(crate) fn coupon(value: &[u8], lg_k: u8) -> u32 {
+        ffi::cpc_coupon(value, lg_k)
+    }
+
+    /// Replays held back updates from their [`Self::coupon`]s, which leaves
+    /// the sketch exactly as the updates would have, given the coupons in
+    /// the same order.
+    pub(crate) fn update_coupons(&mut self, coupons: &[u32]) {
+        self.inner.pin_mut().update_coupons(coupons)
+    }
+
+    /// Empty this sketch so it represents the empty set again, keeping its
+    /// buffers (and its [`CpcArena`], if any) to be reused by later updates.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+
+    /// Return the `lg_k` this sketch was configured with.
+    pub fn lg_k(&self) -> u8 {
+        self.inner.get_lg_k()
+    }
+
     pub fn serialize(&self) -> impl AsRef<[u8]> {
-        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
-        impl AsRef<[u8]> for UPtrVec {
-            fn as_ref(&self) -> &[u8] {
-                self.0.as_slice()
-            }
-        }
         UPtrVec(self.inner.serialize())
     }
 
+    /// Like [`Self::serialize`], but leaves out the state behind the
+    /// estimates of a sketch that was never merged, which saves 16 bytes,
+    /// about half of the sketch of a single value. Merging the result into
+    /// a [`CpcUnion`] is the same as merging `self`, since unions ignore
+    /// that state, but the deserialized sketch estimates with the less
+    /// accurate estimator of merged sketches.
+    pub fn serialize_without_hip(&self) -> impl AsRef<[u8]> {
+        UPtrVec(self.inner.serialize_without_hip())
+    }
+
+    /// Returns the length of [`Self::serialize`], which takes compressing
+    /// the sketch, so it costs about as much as serializing it.
+    pub fn serialized_size_bytes(&self) -> usize {
+        self.inner.get_serialized_size_bytes(true)
+    }
+
+    /// Returns the heap memory this sketch holds, in bytes: its table of
+    /// surprising values and its sliding window, counted at their capacity,
+    /// so a sketch that was [`Self::reset`] still counts what it kept.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.inner.get_memory_usage_bytes()
+    }
+
+    /// Writes [`Self::serialize`] into the front of `buf` without
+    /// allocating, and returns its length. If that is more than
+    /// `buf.len()`, nothing is written, so that one buffer can be reused
+    /// across many sketches, and grown to the returned length whenever a
+    /// sketch does not fit.
+    pub fn serialize_into(&self, buf: &mut [u8]) -> usize {
+        self.inner.serialize_into(buf, true)
+    }
+
+    /// Like [`Self::serialize_into`], but writes
+    /// [`Self::serialize_without_hip`].
+    pub fn serialize_without_hip_into(&self, buf: &mut [u8]) -> usize {
+        self.inner.serialize_into(buf, false)
+    }
+
     pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
         Ok(Self {
             inner: ffi::deserialize_opaque_cpc_sketch(buf)?,
         })
     }
+
+    /// Freezes the sketch into a [`FrozenCpcSketch`], which holds just the
+    /// bytes of [`Self::serialize`].
+    pub fn freeze(&self) -> FrozenCpcSketch {
+        FrozenCpcSketch {
+            bytes: self.serialize().as_ref().into(),
+        }
+    }
+
+    /// Makes the decoding tables shared by all CPC sketches, which are
+    /// otherwise made as (de)serializing first needs each of them. Making
+    /// them is thread-safe either way, but calling this before spawning
+    /// threads keeps any of them from waiting on another to make a table.
+    pub fn init() {
+        ffi::init_cpc()
+    }
+
+    /// Equivalent to `CpcSketch::deserialize(buf)?.estimate()`, but only
+    /// reads the preamble of `buf` instead of decompressing the sketch.
+    pub fn estimate_serialized(buf: &[u8]) -> Result<f64, DataSketchesError> {
+        Ok(ffi::estimate_serialized_cpc_sketch(buf)?)
+    }
+
+    /// Returns the estimate of each of `serialized` with its lower and upper
+    /// bounds at `kappa` (1, 2 or 3) standard deviations, as
+    /// `(estimate, lower, upper)`. Like [`Self::estimate_serialized`], only
+    /// the preambles are read, and the sketches are split among `threads`
+    /// threads.
+    ///
+    /// Panics if `threads` is 0.
+    pub fn estimate_many(
+        serialized: &[&[u8]],
+        kappa: u8,
+        threads: usize,
+    ) -> Result<Vec<(f64, f64, f64)>, DataSketchesError> {
+        map_many(serialized, threads, |buf| {
+            let bounds = ffi::bounds_serialized_cpc_sketch(buf, kappa)?;
+            Ok((bounds.estimate, bounds.lower_bound, bounds.upper_bound))
+        })
+    }
+
+    /// Serializes each of `sketches` back to back into one buffer, as
+    /// [`Self::serialize`] does, or as [`Self::serialize_without_hip`] does
+    /// unless `with_hip`, compressing them on `threads` threads. Returns the
+    /// buffer and the end of each sketch in it, so that sketch `i` spans
+    /// `ends[i - 1]..ends[i]`, taking `ends[-1]` as 0.
+    ///
+    /// Panics if `threads` is 0.
+    pub fn serialize_many(
+        sketches: &[&CpcSketch],
+        with_hip: bool,
+        threads: usize,
+    ) -> (Vec<u8>, Vec<usize>) {
+        Self::init();
+        serialize_many(sketches, threads, |sketch, buf| {
+            sketch.append_serialized(buf, with_hip)
+        })
+    }
+
+    /// Appends [`Self::serialize`], or [`Self::serialize_without_hip`]
+    /// unless `with_hip`, to `buf`, compressing straight into its end.
+    pub(crate) fn append_serialized(&self, buf: &mut Vec<u8>, with_hip: bool) {
+        let start = buf.len();
+        // most sketches fit this much, which spares compressing them twice
+        buf.resize(start + APPEND_GUESS_BYTES, 0);
+        let len = self.inner.serialize_into(&mut buf[start..], with_hip);
+        if len > APPEND_GUESS_BYTES {
+            buf.resize(start + len, 0);
+            self.inner.serialize_into(&mut buf[start..], with_hip);
+        }
+        buf.truncate(start + len);
+    }
+}
+
+/// Room [`CpcSketch::append_serialized`] makes for a sketch before
+/// compressing it, which is more than a sketch of `lg_k` 11 takes at any
+/// cardinality.
+const APPEND_GUESS_BYTES: usize = 1 << 12;
+
+struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+
+impl AsRef<[u8]> for UPtrVec {
+    fn as_ref(&self) -> &[u8] {
+        self.0.as_slice()
+    }
 }
 
 pub struct CpcUnion {
@@ -77,27 +273,282 @@ pub struct CpcUnion {
 
 impl CpcUnion {
     /// Create a CPC union over nothing, which corresponds to the
-    /// empty set.
+    /// empty set, with [`CpcSketch::DEFAULT_LG_K`].
     pub fn new() -> Self {
-        Self {
-            inner: ffi::new_opaque_cpc_union(),
-        }
+        Self::with_lg_k(CpcSketch::DEFAULT_LG_K).expect("valid lg_k")
+    }
+
+    /// Create a CPC union over nothing with `lg_k`, which drops to that
+    /// of any smaller sketch merged in. Fails unless `4 <= lg_k <= 26`.
+    pub fn with_lg_k(lg_k: u8) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_cpc_union(lg_k)?,
+        })
     }
 
     pub fn merge(&mut self, sketch: CpcSketch) {
         self.inner.pin_mut().merge(sketch.inner)
     }
 
-    /// Retrieve the current unioned sketch as a copy.
+    /// Equivalent to `self.merge(CpcSketch::deserialize(buf)?)`, but merges
+    /// straight from the compressed form in `buf` without building the
+    /// sketch in between.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        Ok(self.inner.pin_mut().merge_serialized(buf)?)
+    }
+
+    /// Equivalent to `self.merge(frozen.thaw())`, but merges straight from
+    /// the compressed form, as [`Self::merge_serialized`] does.
+    pub fn merge_frozen(&mut self, frozen: &FrozenCpcSketch) {
+        self.merge_serialized(&frozen.bytes)
+            .expect("frozen sketches deserialize")
+    }
+
+    /// Empty this union so it represents the empty set again, keeping what
+    /// it has allocated where it can.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+
+    /// Retrieve the current unioned sketch as a copy. The union keeps it
+    /// until the next merge or reset, so asking again only copies it.
     pub fn sketch(&self) -> CpcSketch {
         CpcSketch {
             inner: self.inner.sketch(),
         }
     }
+
+    /// Deserializes and unions all of `serialized` on `threads` threads,
+    /// each merging its share into a union of its own before the partial
+    /// unions are combined pairwise.
+    ///
+    /// Panics if `threads` is 0.
+    pub fn union_many(
+        serialized: &[&[u8]],
+        threads: usize,
+    ) -> Result<CpcSketch, DataSketchesError> {
+        CpcSketch::init();
+        union_many(serialized, threads, Self::new)
+    }
+}
+
+impl SerializedUnion for CpcUnion {
+    type Sketch = CpcSketch;
+
+    fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        CpcUnion::merge_serialized(self, buf)
+    }
+
+    fn merge_sketch(&mut self, sketch: CpcSketch) {
+        self.merge(sketch)
+    }
+
+    fn result(&self) -> CpcSketch {
+        self.sketch()
+    }
+}
+
+/// A [`CpcSketch`] frozen into its compressed serialization, for sketches
+/// kept resident long after their last update. The serialization takes a
+/// fraction of the memory of the updatable sketch, whose table of
+/// surprising values has slack to grow into, yet the estimate and its
+/// bounds are read from its preamble alone, and it merges into a
+/// [`CpcUnion`] without decompressing. [`Self::thaw`] turns it back into a
+/// sketch to update.
+#[derive(Clone)]
+pub struct FrozenCpcSketch {
+    bytes: Box<[u8]>,
+}
+
+impl FrozenCpcSketch {
+    /// Returns the estimate of the sketch that was frozen.
+    pub fn estimate(&self) -> f64 {
+        CpcSketch::estimate_serialized(&self.bytes).expect("frozen sketches deserialize")
+    }
+
+    /// Returns the estimate with its lower and upper bounds at `kappa`
+    /// (1, 2 or 3) standard deviations, as `(estimate, lower, upper)`.
+    pub fn bounds(&self, kappa: u8) -> Result<(f64, f64, f64), DataSketchesError> {
+        let bounds = ffi::bounds_serialized_cpc_sketch(&self.bytes, kappa)?;
+        Ok((bounds.estimate, bounds.lower_bound, bounds.upper_bound))
+    }
+
+    /// Returns the heap memory the frozen sketch holds, in bytes, which is
+    /// the length of its serialization.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.bytes.len()
+    }
+
+    /// Returns the frozen sketch's serialization, as
+    /// [`CpcSketch::serialize`] made it.
+    pub fn as_bytes(&self) -> &[u8] {
+        &self.bytes
+    }
+
+    /// Decompresses the frozen sketch back into one that can be updated.
+    pub fn thaw(&self) -> CpcSketch {
+        CpcSketch::deserialize(&self.bytes).expect("frozen sketches deserialize")
+    }
+}
+
+/// A memory pool for CPC sketches, for when there are millions of them.
+/// Sketches from an arena have their buffers carved out of large shared
+/// blocks instead of allocating each one separately, which saves most of
+/// the allocator's per-buffer overhead and fragmentation.
+///
+/// The sketches behave exactly like ones from [`CpcSketch::new`], and may
+/// be mixed with them freely. The arena's memory is released all at once,
+/// after both it and every sketch allocated from it are dropped.
+///
+/// An arena may be shared between threads, each allocating its own sketches.
+pub struct CpcArena {
+    inner: cxx::UniquePtr<ffi::OpaqueCpcArena>,
+}
+
+impl CpcArena {
+    /// Create an empty arena. Memory is only reserved once sketches
+    /// are allocated from it.
+    pub fn new() -> Self {
+        Self {
+            inner: ffi::new_opaque_cpc_arena(),
+        }
+    }
+
+    /// Create a CPC sketch representing the empty set, in this arena.
+    pub fn sketch(&self) -> CpcSketch {
+        self.sketch_with_lg_k(CpcSketch::DEFAULT_LG_K)
+            .expect("valid lg_k")
+    }
+
+    /// Like [`CpcSketch::with_lg_k`], but in this arena.
+    pub fn sketch_with_lg_k(&self, lg_k: u8) -> Result<CpcSketch, DataSketchesError> {
+        Ok(CpcSketch {
+            inner: self.inner.sketch(lg_k)?,
+        })
+    }
+}
+
+/// Hands out the shard each thread prefers in every [`ShardedCpcSketch`].
+static NEXT_THREAD: AtomicUsize = AtomicUsize::new(0);
+
+thread_local! {
+    static THREAD: usize = NEXT_THREAD.fetch_add(1, Ordering::Relaxed);
+}
+
+/// A CPC sketch which many threads can update at once. Its values are
+/// spread over several shards, each a [`CpcSketch`] of its own. Threads
+/// each prefer a different shard, so with no more threads than shards
+/// updates take an uncontended lock and otherwise cost what
+/// [`CpcSketch::update`] does. A thread whose shard is busy updates
+/// the first idle one instead.
+///
+/// Reads move the shards' values into a [`CpcUnion`], and
+/// [`Self::estimate`] caches the result for a given refresh interval, so
+/// that frequent reads do not keep merging. Merged sketches estimate as
+/// unions do, without the HIP estimator of a single sketch.
+pub struct ShardedCpcSketch {
+    lg_k: u8,
+    shards: Box<[Mutex<CpcSketch>]>,
+    refresh: Duration,
+    merged: Mutex<MergedShards>,
+}
+
+struct MergedShards {
+    union: CpcUnion,
+    estimate: f64,
+    // When the shards were last merged, if ever.
+    at: Option<Instant>,
+}
+
+impl ShardedCpcSketch {
+    /// Create a sharded CPC sketch representing the empty set, whose
+    /// `shards` shards have `lg_k` as in [`CpcSketch::with_lg_k`]. Its
+    /// estimate is refreshed at most once per `refresh`.
+    ///
+    /// Panics if `shards` is 0.
+    pub fn new(lg_k: u8, shards: usize, refresh: Duration) -> Result<Self, DataSketchesError> {
+        assert!(shards > 0, "need at least one shard");
+        let shards = (0..shards)
+            .map(|_| Ok(Mutex::new(CpcSketch::with_lg_k(lg_k)?)))
+            .collect::<Result<_, DataSketchesError>>()?;
+        Ok(Self {
+            lg_k,
+            shards,
+            refresh,
+            merged: Mutex::new(MergedShards {
+                union: CpcUnion::with_lg_k(lg_k)?,
+                estimate: 0.0,
+                at: None,
+            }),
+        })
+    }
+
+    /// Observe a new value, as [`CpcSketch::update`] does.
+    pub fn update(&self, value: &[u8]) {
+        self.shard().update(value)
+    }
+
+    /// Observe a new `u64`, as [`CpcSketch::update_u64`] does.
+    pub fn update_u64(&self, value: u64) {
+        self.shard().update_u64(value)
+    }
+
+    /// Return the estimate of distinct values as of the last merge of the
+    /// shards, merging them first if that was at least a refresh
+    /// interval ago.
+    pub fn estimate(&self) -> f64 {
+        let mut merged = lock(&self.merged);
+        if merged.at.map_or(true, |at| at.elapsed() >= self.refresh) {
+            self.merge_shards(&mut merged);
+        }
+        merged.estimate
+    }
+
+    /// Return a sketch of every value observed so far, merging the shards
+    /// regardless of the refresh interval.
+    pub fn sketch(&self) -> CpcSketch {
+        let mut merged = lock(&self.merged);
+        self.merge_shards(&mut merged);
+        merged.union.sketch()
+    }
+
+    /// Moves the values of each shard into the union, leaving it empty.
+    fn merge_shards(&self, merged: &mut MergedShards) {
+        for shard in self.shards.iter() {
+            let empty = CpcSketch::with_lg_k(self.lg_k).expect("valid lg_k");
+            let shard = mem::replace(&mut *lock(shard), empty);
+            merged.union.merge(shard);
+        }
+        merged.estimate = merged.union.sketch().estimate();
+        merged.at = Some(Instant::now());
+    }
+
+    /// Locks the calling thread's shard, or the first idle one after it if
+    /// that is busy, or waits for it if all are.
+    fn shard(&self) -> MutexGuard<'_, CpcSketch> {
+        let n = self.shards.len();
+        let first = THREAD.with(|&thread| thread % n);
+        for i in 0..n {
+            match self.shards[(first + i) % n].try_lock() {
+                Ok(shard) => return shard,
+                Err(TryLockError::Poisoned(e)) => return e.into_inner(),
+                Err(TryLockError::WouldBlock) => continue,
+            }
+        }
+        lock(&self.shards[first])
+    }
+}
+
+/// Locks `mutex`, whose sketches stay valid even if a thread panicked
+/// while holding it.
+fn lock<T>(mutex: &Mutex<T>) -> MutexGuard<'_, T> {
+    mutex.lock().unwrap_or_else(PoisonError::into_inner)
 }
 
 #[cfg(test)]
 mod tests {
+    use std::thread;
+
     use byte_slice_cast::AsByteSlice;
 
     use super::*;
@@ -105,6 +556,7 @@ mod tests {
     fn check_cycle(s: &CpcSketch) {
         let est = s.estimate();
         let bytes = s.serialize();
+        assert_eq!(est, CpcSketch::estimate_serialized(bytes.as_ref()).unwrap());
         let cpy = CpcSketch::deserialize(bytes.as_ref()).unwrap();
         let cpy2 = CpcSketch::deserialize(bytes.as_ref()).unwrap();
         let cpy3 = CpcSketch::deserialize(bytes.as_ref()).unwrap();
@@ -133,6 +585,105 @@ mod tests {
         }
     }
 
+    #[test]
+    fn batch_update_matches_single() {
+        let n = 10 * 1000;
+        let keys: Vec<u64> = (0..n).collect();
+        let mut single = CpcSketch::new();
+        keys.iter().for_each(|&k| single.update_u64(k));
+
+        let mut batched = CpcSketch::new();
+        batched.update_u64_batch(&keys);
+        assert_eq!(single.serialize().as_ref(), batched.serialize().as_ref());
+
+        let mut buf = Vec::new();
+        let mut ends = Vec::new();
+        for &k in &keys {
+            buf.extend_from_slice([k].as_byte_slice());
+            ends.push(buf.len());
+        }
+        let mut packed = CpcSketch::new();
+        packed.update_batch(&buf, &ends);
+        assert_eq!(single.serialize().as_ref(), packed.serialize().as_ref());
+    }
+
+    #[test]
+    fn batch_update_16_byte_keys() {
+        let n = 10 * 1000;
+        let mut buf = Vec::new();
+        let mut ends = Vec::new();
+        let mut single = CpcSketch::new();
+        for k in 0..n as u64 {
+            let key = [k, !k];
+            single.update(key.as_byte_slice());
+            buf.extend_from_slice(key.as_byte_slice());
+            ends.push(buf.len());
+        }
+        let mut packed = CpcSketch::new();
+        packed.update_batch(&buf, &ends);
+        assert_eq!(single.serialize().as_ref(), packed.serialize().as_ref());
+    }
+
+    #[test]
+    #[should_panic]
+    fn batch_update_bad_ends() {
+        CpcSketch::new().update_batch(&[1, 2, 3], &[2, 1]);
+    }
+
+    #[test]
+    fn coupon_batches_match_single_updates() {
+        // enough values to move a lg_k 5 window past offset 8, where kxp is
+        // refreshed, and coupons in one long batch and several short ones
+        let n = 100 * 1000;
+        let mut single = CpcSketch::with_lg_k(5).unwrap();
+        let mut coupons = Vec::new();
+        for key in 0u64..n {
+            let bytes = key.to_ne_bytes();
+            single.update(&bytes);
+            coupons.push(CpcSketch::coupon(&bytes, 5));
+        }
+        let mut replayed = CpcSketch::with_lg_k(5).unwrap();
+        replayed.update_coupons(&coupons);
+        assert_eq!(single.serialize().as_ref(), replayed.serialize().as_ref());
+        let mut chunked = CpcSketch::with_lg_k(5).unwrap();
+        coupons.chunks(77).for_each(|c| chunked.update_coupons(c));
+        assert_eq!(single.serialize().as_ref(), chunked.serialize().as_ref());
+    }
+
+    #[test]
+    fn estimate_cached_until_update() {
+        let mut cpc = CpcSketch::new();
+        assert!(cpc.is_dirty());
+        assert_eq!(cpc.estimate(), 0.0);
+        assert!(!cpc.is_dirty());
+        for batch in 0u64..10 {
+            let keys: Vec<u64> = (batch * 1000..(batch + 1) * 1000).collect();
+            cpc.update_u64_batch(&keys);
+            assert!(cpc.is_dirty());
+            let est = cpc.estimate();
+            assert!(!cpc.is_dirty());
+            assert_eq!(est, cpc.estimate());
+            let copy = CpcSketch::deserialize(cpc.serialize().as_ref()).unwrap();
+            assert_eq!(est, copy.estimate());
+        }
+        cpc.reset();
+        assert!(cpc.is_dirty());
+        assert_eq!(cpc.estimate(), 0.0);
+    }
+
+    #[test]
+    fn memory_usage_kept_by_reset() {
+        let mut cpc = CpcSketch::new();
+        let empty = cpc.memory_usage_bytes();
+        let keys: Vec<u64> = (0..100 * 1000).collect();
+        cpc.update_u64_batch(&keys);
+        let full = cpc.memory_usage_bytes();
+        // the window alone has a byte per row of the 2^11 of the sketch
+        assert!(full >= 2048 && full > empty);
+        cpc.reset();
+        assert_eq!(full, cpc.memory_usage_bytes());
+    }
+
     #[test]
     fn cpc_empty() {
         let cpc = CpcSketch::new();
@@ -196,11 +747,444 @@ mod tests {
         }
     }
 
+    #[test]
+    fn arena_sketches_match_heap() {
+        let arena = CpcArena::new();
+        let mut sketches: Vec<CpcSketch> = (0..100).map(|_| arena.sketch()).collect();
+        // sketches outlive their arena handle
+        drop(arena);
+        let mut union = CpcUnion::new();
+        for (i, cpc) in sketches.iter_mut().enumerate() {
+            let mut heap = CpcSketch::new();
+            for key in 0u64..(i as u64 * 100) {
+                cpc.update_u64(key);
+                heap.update_u64(key);
+            }
+            assert_eq!(cpc.serialize().as_ref(), heap.serialize().as_ref());
+            union.merge(heap);
+        }
+        for cpc in sketches {
+            union.merge(cpc);
+        }
+        let merged = union.sketch();
+        check_cycle(&merged);
+        let n = 99.0 * 100.0;
+        assert!((n * 0.95..n * 1.05).contains(&merged.estimate()));
+    }
+
+    #[test]
+    fn arena_shared_across_threads() {
+        let arena = CpcArena::new();
+        let sketches: Vec<CpcSketch> = thread::scope(|scope| {
+            let workers: Vec<_> = (0..4u64)
+                .map(|t| {
+                    let arena = &arena;
+                    scope.spawn(move || {
+                        let mut cpc = arena.sketch();
+                        (t * 1000..(t + 1) * 1000).for_each(|key| cpc.update_u64(key));
+                        cpc
+                    })
+                })
+                .collect();
+            workers.into_iter().map(|w| w.join().unwrap()).collect()
+        });
+        let mut union = CpcUnion::new();
+        sketches.into_iter().for_each(|cpc| union.merge(cpc));
+        let est = union.sketch().estimate();
+        assert!((4000.0 * 0.95..4000.0 * 1.05).contains(&est));
+    }
+
+    #[test]
+    fn decodes_across_threads() {
+        // sketches in many phases, whose window tables are made by whichever
+        // thread decodes one first
+        let serialized: Vec<Vec<u8>> = (0..16u64)
+            .map(|i| {
+                let mut cpc = CpcSketch::with_lg_k(8).unwrap();
+                (0..(i + 1) * 500).for_each(|key| cpc.update_u64(key));
+                cpc.serialize().as_ref().to_vec()
+            })
+            .collect();
+        let decode = |buf: &Vec<u8>| CpcSketch::deserialize(buf).unwrap().estimate();
+        let decoded: Vec<f64> = thread::scope(|scope| {
+            let workers: Vec<_> = serialized
+                .iter()
+                .map(|buf| scope.spawn(move || decode(buf)))
+                .collect();
+            workers.into_iter().map(|w| w.join().unwrap()).collect()
+        });
+        CpcSketch::init();
+        let expected: Vec<f64> = serialized.iter().map(decode).collect();
+        assert_eq!(decoded, expected);
+    }
+
+    #[test]
+    fn sharded_matches_union() {
+        let sharded = ShardedCpcSketch::new(10, 3, Duration::from_secs(3600)).unwrap();
+        assert_eq!(sharded.estimate(), 0.0);
+        // more threads than shards, updating overlapping ranges
+        thread::scope(|scope| {
+            for t in 0..8u64 {
+                let sharded = &sharded;
+                scope.spawn(move || {
+                    (t * 1000..(t + 2) * 1000).for_each(|key| sharded.update_u64(key));
+                });
+            }
+        });
+        // the estimate from before the updates is still cached
+        assert_eq!(sharded.estimate(), 0.0);
+
+        let mut heap = CpcSketch::with_lg_k(10).unwrap();
+        (0..9 * 1000).for_each(|key| heap.update_u64(key));
+        let mut union = CpcUnion::with_lg_k(10).unwrap();
+        union.merge(heap);
+        let expected = union.sketch().estimate();
+        assert_eq!(sharded.sketch().estimate(), expected);
+
+        let fresh = ShardedCpcSketch::new(10, 2, Duration::from_secs(0)).unwrap();
+        (0..9 * 1000).for_each(|key| fresh.update_u64(key));
+        assert_eq!(fresh.estimate(), expected);
+        (9 * 1000..10 * 1000u64).for_each(|key| fresh.update(&key.to_le_bytes()));
+        assert!(fresh.estimate() > expected);
+    }
+
+    #[test]
+    fn serialize_without_hip() {
+        for &n in &[0, 1, 10, 1000, 100000] {
+            let mut cpc = CpcSketch::new();
+            (0..n).for_each(|key| cpc.update_u64(key));
+            let full = cpc.serialize();
+            let slim = cpc.serialize_without_hip();
+            if n > 0 {
+                assert_eq!(slim.as_ref().len() + 16, full.as_ref().len());
+            }
+            let slim = CpcSketch::deserialize(slim.as_ref()).unwrap();
+            check_cycle(&slim);
+
+            let mut union = CpcUnion::new();
+            union.merge(cpc);
+            let mut slim_union = CpcUnion::new();
+            slim_union.merge(slim);
+            assert_eq!(
+                union.sketch().serialize().as_ref(),
+                slim_union.sketch().serialize().as_ref()
+            );
+        }
+    }
+
+    #[test]
+    fn serialize_many_matches_each() {
+        // sketches past the room made for them at a large lg_k
+        let sketches: Vec<CpcSketch> = (0..300u64)
+            .map(|i| {
+                let mut cpc = CpcSketch::with_lg_k(8 + (i % 3) as u8 * 5).unwrap();
+                (0..(i % 30) * 1000).for_each(|key| cpc.update_u64(i << 32 | key));
+                cpc
+            })
+            .collect();
+        let sketches: Vec<&CpcSketch> = sketches.iter().collect();
+        for &with_hip in &[true, false] {
+            for &threads in &[1, 3, 8] {
+                let (buf, ends) = CpcSketch::serialize_many(&sketches, with_hip, threads);
+                assert_eq!(ends.len(), sketches.len());
+                let mut start = 0;
+                for (cpc, &end) in sketches.iter().zip(&ends) {
+                    let expected = if with_hip {
+                        cpc.serialize().as_ref().to_vec()
+                    } else {
+                        cpc.serialize_without_hip().as_ref().to_vec()
+                    };
+                    assert!(buf[start..end] == expected[..], "threads {}", threads);
+                    start = end;
+                }
+                assert_eq!(start, buf.len());
+            }
+        }
+        assert_eq!(CpcSketch::serialize_many(&[], true, 4), (vec![], vec![]));
+    }
+
+    #[test]
+    fn serialize_into_reused_buffer() {
+        let mut buf = Vec::new();
+        for &n in &[0, 1, 10, 1000, 100000, 5] {
+            let mut cpc = CpcSketch::new();
+            (0..n).for_each(|key| cpc.update_u64(key));
+            let full = cpc.serialize();
+            let full = full.as_ref();
+            assert_eq!(cpc.serialized_size_bytes(), full.len());
+
+            // a buffer that is too small is left alone
+            let before = buf.clone();
+            if full.len() > buf.len() {
+                assert_eq!(cpc.serialize_into(&mut buf), full.len());
+                assert_eq!(buf, before);
+                buf.resize(full.len(), 0);
+            }
+            assert_eq!(cpc.serialize_into(&mut buf), full.len());
+            assert_eq!(&buf[..full.len()], full);
+
+            let slim = cpc.serialize_without_hip();
+            let len = cpc.serialize_without_hip_into(&mut buf);
+            assert_eq!(&buf[..len], slim.as_ref());
+        }
+    }
+
+    #[test]
+    fn custom_lg_k() {
+        assert!(CpcSketch::with_lg_k(3).is_err());
+        assert!(CpcSketch::with_lg_k(27).is_err());
+        assert!(CpcUnion::with_lg_k(27).is_err());
+        assert!(CpcArena::new().sketch_with_lg_k(3).is_err());
+
+        let n = 10000;
+        let mut small = CpcSketch::with_lg_k(8).unwrap();
+        let mut replayed = CpcArena::new().sketch_with_lg_k(8).unwrap();
+        let mut large = CpcSketch::with_lg_k(16).unwrap();
+        let mut coupons = Vec::new();
+        for key in 0u64..n {
+            let bytes = key.to_ne_bytes();
+            small.update(&bytes);
+            large.update(&bytes);
+            let coupon = CpcSketch::coupon(&bytes, 8);
+            if !coupons.contains(&coupon) {
+                coupons.push(coupon);
+            }
+        }
+        replayed.update_coupons(&coupons);
+        assert_eq!(small.serialize().as_ref(), replayed.serialize().as_ref());
+        check_cycle(&small);
+        check_cycle(&large);
+        assert_eq!(small.lg_k(), 8);
+        assert_eq!(
+            CpcSketch::deserialize(large.serialize().as_ref())
+                .unwrap()
+                .lg_k(),
+            16
+        );
+        let n = n as f64;
+        assert!((n * 0.8..n * 1.2).contains(&small.estimate()));
+        assert!((n * 0.98..n * 1.02).contains(&large.estimate()));
+
+        let mut union = CpcUnion::with_lg_k(16).unwrap();
+        union.merge(large);
+        assert_eq!(union.sketch().lg_k(), 16);
+        union.merge(small);
+        assert_eq!(union.sketch().lg_k(), 8);
+    }
+
+    #[test]
+    fn union_many_matches_fold() {
+        let n = 1000;
+        let serialized: Vec<Vec<u8>> = (0..n)
+            .map(|i| {
+                let mut cpc = CpcSketch::new();
+                ((i * 50)..(i * 50 + 100)).for_each(|key| cpc.update_u64(key));
+                cpc.serialize().as_ref().to_vec()
+            })
+            .collect();
+        let slices: Vec<&[u8]> = serialized.iter().map(|buf| buf.as_slice()).collect();
+
+        let mut union = CpcUnion::new();
+        for buf in &slices {
+            union.merge(CpcSketch::deserialize(buf).unwrap());
+        }
+        let folded = union.sketch().estimate();
+        let lb = (n * 50) as f64 * 0.95;
+        let ub = (n * 50) as f64 * 1.05;
+        for &threads in &[1, 2, 3, 8] {
+            let merged = CpcUnion::union_many(&slices, threads).unwrap();
+            check_cycle(&merged);
+            // CPC unions are order-independent
+            assert_eq!(folded, merged.estimate());
+            assert!((lb..ub).contains(&merged.estimate()));
+        }
+        assert_eq!(CpcUnion::union_many(&[], 4).unwrap().estimate(), 0.0);
+
+        let mut bad = slices.clone();
+        bad[n as usize / 2] = &[9, 9, 9, 9];
+        assert!(matches!(
+            CpcUnion::union_many(&bad, 4),
+            Err(DataSketchesError::CXXError(_))
+        ));
+    }
+
+    #[test]
+    fn estimate_many_matches_deserialized() {
+        // merged sketches have no HIP state, so they take the ICON bounds
+        let serialized: Vec<Vec<u8>> = (0..300u64)
+            .map(|i| {
+                let mut cpc = CpcSketch::new();
+                (0..i * i).for_each(|key| cpc.update_u64(key));
+                if i % 2 == 0 {
+                    let mut union = CpcUnion::new();
+                    union.merge(cpc);
+                    cpc = union.sketch();
+                }
+                cpc.serialize().as_ref().to_vec()
+            })
+            .collect();
+        let slices: Vec<&[u8]> = serialized.iter().map(|buf| buf.as_slice()).collect();
+
+        let narrow = CpcSketch::estimate_many(&slices, 1, 1).unwrap();
+        for &threads in &[1, 3, 8] {
+            let wide = CpcSketch::estimate_many(&slices, 3, threads).unwrap();
+            assert_eq!(wide.len(), slices.len());
+            for ((buf, &(est, lb, ub)), &(_, narrow_lb, narrow_ub)) in
+                slices.iter().zip(&wide).zip(&narrow)
+            {
+                assert_eq!(est, CpcSketch::deserialize(buf).unwrap().estimate());
+                assert!(lb <= narrow_lb && narrow_lb <= est);
+                assert!(est <= narrow_ub && narrow_ub <= ub);
+            }
+        }
+        assert_eq!(narrow[0], (0.0, 0.0, 0.0));
+        assert!(CpcSketch::estimate_many(&[], 2, 4).unwrap().is_empty());
+
+        assert!(CpcSketch::estimate_many(&slices, 4, 2).is_err());
+        let mut bad = slices.clone();
+        bad[150] = &[9, 9, 9, 9];
+        assert!(matches!(
+            CpcSketch::estimate_many(&bad, 2, 4),
+            Err(DataSketchesError::CXXError(_))
+        ));
+    }
+
+    #[test]
+    fn merge_serialized_matches_merge() {
+        // from empty and sparse through to sliding sketches, so every flavor
+        // takes its own path through the compressed merge
+        let mut union = CpcUnion::new();
+        let mut from_bytes = CpcUnion::new();
+        for (i, &n) in [0u64, 10, 300, 1500, 5000, 40000, 200000]
+            .iter()
+            .enumerate()
+        {
+            let mut cpc = CpcSketch::new();
+            let start = i as u64 * 100000;
+            (start..start + n).for_each(|key| cpc.update_u64(key));
+            let bytes = cpc.serialize();
+            union.merge(CpcSketch::deserialize(bytes.as_ref()).unwrap());
+            from_bytes.merge_serialized(bytes.as_ref()).unwrap();
+            assert_eq!(
+                union.sketch().serialize().as_ref(),
+                from_bytes.sketch().serialize().as_ref()
+            );
+        }
+        check_cycle(&from_bytes.sketch());
+        assert!(matches!(
+            from_bytes.merge_serialized(&[9, 9, 9, 9]),
+            Err(DataSketchesError::CXXError(_))
+        ));
+    }
+
+    #[test]
+    fn reset_matches_new() {
+        // reused from every flavor, each sketch and union must be
+        // indistinguishable from a fresh one
+        let mut cpc = CpcSketch::new();
+        let arena = CpcArena::new();
+        let mut in_arena = arena.sketch();
+        let mut union = CpcUnion::new();
+        for (i, &n) in [0u64, 10, 300, 1500, 5000, 40000].iter().enumerate() {
+            cpc.reset();
+            in_arena.reset();
+            union.reset();
+            let mut fresh = CpcSketch::new();
+            let start = i as u64 * 100000;
+            for key in start..start + n {
+                cpc.update_u64(key);
+                in_arena.update_u64(key);
+                fresh.update_u64(key);
+            }
+            let bytes = fresh.serialize();
+            assert_eq!(cpc.serialize().as_ref(), bytes.as_ref());
+            assert_eq!(in_arena.serialize().as_ref(), bytes.as_ref());
+
+            let mut fresh_union = CpcUnion::new();
+            fresh_union.merge_serialized(bytes.as_ref()).unwrap();
+            union.merge_serialized(bytes.as_ref()).unwrap();
+            assert_eq!(
+                union.sketch().serialize().as_ref(),
+                fresh_union.sketch().serialize().as_ref()
+            );
+        }
+        cpc.reset();
+        union.reset();
+        assert_eq!(cpc.estimate(), 0.0);
+        assert_eq!(union.sketch().estimate(), 0.0);
+    }
+
+    #[test]
+    fn union_result_cached_until_merge() {
+        let mut union = CpcUnion::new();
+        let mut fresh_bytes = Vec::new();
+        for i in 0..5u64 {
+            let mut cpc = CpcSketch::new();
+            (i * 3000..i * 3000 + (10 << (2 * i))).for_each(|key| cpc.update_u64(key));
+            let bytes = cpc.serialize();
+            union.merge_serialized(bytes.as_ref()).unwrap();
+            fresh_bytes.push(bytes);
+            let mut fresh = CpcUnion::new();
+            for bytes in &fresh_bytes {
+                fresh.merge_serialized(bytes.as_ref()).unwrap();
+            }
+            let expected = fresh.sketch().serialize();
+            for _ in 0..2 {
+                assert_eq!(union.sketch().serialize().as_ref(), expected.as_ref());
+            }
+        }
+    }
+
+    #[test]
+    fn frozen_sketch_matches_live() {
+        for &n in &[0u64, 10, 1000, 100 * 1000] {
+            let mut cpc = CpcSketch::new();
+            (0..n).for_each(|key| cpc.update_u64(key));
+            let frozen = cpc.freeze();
+            assert_eq!(frozen.estimate(), cpc.estimate());
+            assert_eq!(
+                frozen.bounds(2).unwrap(),
+                CpcSketch::estimate_many(&[cpc.serialize().as_ref()], 2, 1).unwrap()[0]
+            );
+            assert_eq!(frozen.as_bytes(), cpc.serialize().as_ref());
+            if n >= 1000 {
+                assert!(frozen.memory_usage_bytes() < cpc.memory_usage_bytes());
+            }
+
+            let mut thawed = frozen.thaw();
+            assert_eq!(thawed.serialize().as_ref(), cpc.serialize().as_ref());
+            thawed.update_u64(n);
+            cpc.update_u64(n);
+            assert_eq!(thawed.serialize().as_ref(), cpc.serialize().as_ref());
+
+            let mut merged_frozen = CpcUnion::new();
+            merged_frozen.merge_frozen(&cpc.freeze());
+            let mut merged = CpcUnion::new();
+            merged.merge(cpc);
+            assert_eq!(
+                merged_frozen.sketch().serialize().as_ref(),
+                merged.sketch().serialize().as_ref()
+            );
+        }
+    }
+
     #[test]
     fn cpc_deserialization_error() {
         assert!(matches!(
             CpcSketch::deserialize(&[9, 9, 9, 9]),
             Err(DataSketchesError::CXXError(_))
         ));
+        assert!(matches!(
+            CpcSketch::estimate_serialized(&[9, 9, 9, 9]),
+            Err(DataSketchesError::CXXError(_))
+        ));
+        let mut cpc = CpcSketch::new();
+        (0..1000).for_each(|key| cpc.update_u64(key));
+        let bytes = cpc.serialize();
+        let bytes = bytes.as_ref();
+        assert!(matches!(
+            CpcSketch::estimate_serialized(&bytes[..bytes.len() - 1]),
+            Err(DataSketchesError::CXXError(_))
+        ));
     }
 }
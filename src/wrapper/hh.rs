@@ -5,11 +5,15 @@ use std::collections::HashSet;
 use std::hash::{Hash, Hasher};
 use std::ptr::NonNull;
 use std::slice;
+use std::sync::{Mutex, MutexGuard, PoisonError};
 
 use cxx;
 use thin_dst::{ThinBox, ThinRef};
 
 use crate::bridge::ffi;
+use crate::key_table::KeyTable;
+use crate::wrapper::check_batch_ends;
+use crate::DataSketchesError;
 
 /// A type around a thin box to a byte buffer. Still basically just a pointer,
 /// but lets us implement `Borrow<[u8]>` semantics for use as hash structure keys.
@@ -66,7 +70,7 @@ impl Eq for ThinByteBox {}
 /// at the cost of constant additional per-string overhead (at 90% Rust HashMap load
 /// factor, about ~11 bytes) and needless hashing overhead on the C++ side. While the C++ side
 /// does not own the string values, when it removes a key from the hash, the key is deleted from
-/// the Rust side as well.
+/// the Rust side as well. [`NativeHhSketch`] makes the opposite tradeoff.
 ///
 /// [orig-docs]: https://datasketches.apache.org/docs/Frequency/FrequentItemsOverview.html
 /// [mg]: https://en.wikipedia.org/wiki/Misra%E2%80%93Gries_summary
@@ -124,6 +128,37 @@ pub(crate) unsafe fn remove_from_hashset(hashset_addr: usize, addr: usize) {
     assert!(did_remove, "thinbox {:?}", thinref);
 }
 
+/// Interns the key at `addr`, which belongs to another [`HhSketch`], into the
+/// hashset at `hashset_addr`, returning the address of the interned key.
+///
+/// Function is only safe to call under the conditions of [`remove_from_hashset`],
+/// for the sketch being merged into, while the sketch owning `addr` is borrowed.
+pub(crate) unsafe fn intern_into_hashset(hashset_addr: usize, addr: usize) -> usize {
+    let hs = addr_to_hashset(hashset_addr);
+    let thinref = addr_to_thinref(addr);
+    intern(hs, &thinref.slice)
+}
+
+/// Returns the address of the key in `intern` equal to `value`, inserting one
+/// if there is none.
+fn intern(intern: &mut HashSet<ThinByteBox>, value: &[u8]) -> usize {
+    // TODO: once this hash_set_entry API merges, this approach can save
+    // on two (!) needless hash re-computations.
+    // #![feature(hash_set_entry)]
+    // let key = intern.get_or_insert_with::<[u8], _>(value, |buf| {
+    // ThinByteBox(ThinBox::new((), buf.iter().cloned()))
+    // });
+    let key = if let Some(key) = intern.get(value) {
+        &*key.0
+    } else {
+        let key = ThinByteBox(ThinBox::new((), value.iter().cloned()));
+        intern.insert(key);
+        &*intern.get(value).expect("present key").0
+    };
+    let thinref = ThinRef::<(), u8>::from(key);
+    ThinRef::<(), u8>::erase(thinref).as_ptr() as *const _ as usize
+}
+
 impl HhSketch {
     /// Create a HH sketch representing the empty set. The sketch size `k` is set below,
     /// and together with the (runtime-determined) stream size `n` the heavy hitters
@@ -170,33 +205,22 @@ impl HhSketch {
 
     /// Observe a new value.
     pub fn update(&mut self, value: &[u8], weight: u64) {
-        // TODO: once this hash_set_entry API merges, this approach can save
-        // on two (!) needless hash re-computations.
-        // #![feature(hash_set_entry)]
-        // let key = self.intern.get_or_insert_with::<[u8], _>(value, |buf| {
-        // ThinByteBox(ThinBox::new((), buf.iter().cloned()))
-        // });
-        let key = if let Some(key) = self.intern.get(value) {
-            &*key.0
-        } else {
-            let key = ThinByteBox(ThinBox::new((), value.iter().cloned()));
-            self.intern.insert(key);
-            &*self.intern.get(value).expect("present key").0
-        };
-        let thinref = ThinRef::<(), u8>::from(key);
-        let key = ThinRef::<(), u8>::erase(thinref).as_ptr() as *const _ as usize;
+        let key = intern(&mut self.intern, value);
         self.inner.pin_mut().update(key, weight)
     }
 
+    /// Merges `other` into this sketch in one pass over its hash map, interning
+    /// each of its keys into this sketch's as it goes.
     pub fn merge(&mut self, other: &Self) {
-        let state = other.inner.state();
-        let total_weight = self.inner.get_total_weight() + other.inner.get_total_weight();
-        for row in state.iter() {
-            let row = other.thin_row_to_owned(row);
-            self.update(row.key, row.lb);
-        }
-        let offset = self.inner.get_offset() + other.inner.get_offset();
-        self.inner.pin_mut().set_weights(total_weight, offset);
+        self.inner
+            .pin_mut()
+            .merge(other.inner.as_ref().expect("non-null"))
+    }
+
+    /// Returns the heap memory held by the sketch's hash map, in bytes,
+    /// not counting the interned keys it refers to.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.inner.get_memory_usage_bytes()
     }
 }
 
@@ -208,10 +232,393 @@ impl Clone for HhSketch {
     }
 }
 
+/// A heavy hitter sketch with the same guarantees and interface as
+/// [`HhSketch`], but which *DOES* give ownership of the observed keys to the
+/// C++ side. Keys are copied into a memory pool owned by the sketch and
+/// hashed once, on the C++ side, so neither updates nor purges need any
+/// calls back into Rust or any Rust-side hashing. This makes updates
+/// several times faster than [`HhSketch`]'s.
+pub struct NativeHhSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueNativeHhSketch>,
+}
+
+impl NativeHhSketch {
+    /// Create a HH sketch representing the empty set, with size `k` as
+    /// described in [`HhSketch::new`].
+    pub fn new(lg2_k: u8) -> Self {
+        Self {
+            inner: ffi::new_opaque_native_hh_sketch(lg2_k),
+        }
+    }
+
+    fn row_to_owned<'a>(&'a self, row: &ffi::HeavyHitterRow) -> HhRow<'a> {
+        // The key is owned by the sketch, which cannot be updated while
+        // borrowed for 'a.
+        let key = unsafe { slice::from_raw_parts(row.addr as *const u8, row.len) };
+        HhRow {
+            key,
+            lb: row.lb,
+            ub: row.ub,
+        }
+    }
+
+    /// Return the heavy hitters with no false positives, their
+    /// frequency lower bound, and their frequency upper bound.
+    pub fn estimate_no_fp(&self) -> Vec<HhRow> {
+        self.inner
+            .estimate_no_fp()
+            .into_iter()
+            .map(|x| self.row_to_owned(x))
+            .collect()
+    }
+
+    /// Return the heavy hitters with no false negatives; this is less
+    /// conservative than [`Self::estimate_no_fp`].
+    pub fn estimate_no_fn(&self) -> Vec<HhRow> {
+        self.inner
+            .estimate_no_fn()
+            .into_iter()
+            .map(|x| self.row_to_owned(x))
+            .collect()
+    }
+
+    /// Return the rows of [`Self::estimate_no_fn`] with the `k` highest
+    /// upper bounds, highest first. Only those `k` are sorted or cross the
+    /// bridge, so this is much cheaper than sorting all rows for small `k`.
+    pub fn top_no_fn(&self, k: usize) -> Vec<HhRow> {
+        self.inner
+            .top_no_fn(k)
+            .into_iter()
+            .map(|x| self.row_to_owned(x))
+            .collect()
+    }
+
+    /// Observe a new value.
+    pub fn update(&mut self, value: &[u8], weight: u64) {
+        self.inner.pin_mut().update(value, weight)
+    }
+
+    /// Equivalent to calling [`Self::update`] with weight 1 on each key packed
+    /// into `buf`, but crosses into C++ only once, and prefetches the sketch
+    /// slots of the keys a block ahead. Key `i` is `buf[ends[i - 1]..ends[i]]`,
+    /// where the first key starts at offset 0.
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn update_batch(&mut self, buf: &[u8], ends: &[usize]) {
+        check_batch_ends(buf, ends);
+        self.inner.pin_mut().update_bytes_batch(buf, ends, &[])
+    }
+
+    /// Observe keys as [`Self::update_batch`] does, each with its weight in
+    /// `weights`, as [`Self::update`] would.
+    ///
+    /// Panics if `ends` does not describe consecutive keys in `buf` or there
+    /// is not one weight per key.
+    pub fn update_weighted_batch(&mut self, buf: &[u8], ends: &[usize], weights: &[u64]) {
+        check_batch_ends(buf, ends);
+        assert_eq!(ends.len(), weights.len(), "need one weight per key");
+        self.inner.pin_mut().update_bytes_batch(buf, ends, weights)
+    }
+
+    pub fn merge(&mut self, other: &Self) {
+        self.inner
+            .pin_mut()
+            .merge(other.inner.as_ref().expect("non-null"))
+    }
+
+    /// Serializes the sketch along with its keys, each as its length and
+    /// bytes.
+    pub fn serialize(&self) -> impl AsRef<[u8]> {
+        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+        impl AsRef<[u8]> for UPtrVec {
+            fn as_ref(&self) -> &[u8] {
+                self.0.as_slice()
+            }
+        }
+        UPtrVec(self.inner.serialize())
+    }
+
+    /// Deserializes a sketch written by [`Self::serialize`], copying its
+    /// keys out of `buf`.
+    pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::deserialize_opaque_native_hh_sketch(buf)?,
+        })
+    }
+
+    /// Returns the heap memory held by the sketch's hash map, in bytes,
+    /// not counting the copies of its keys.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.inner.get_memory_usage_bytes()
+    }
+}
+
+impl Clone for NativeHhSketch {
+    fn clone(&self) -> Self {
+        Self {
+            inner: self.inner.clone(),
+        }
+    }
+}
+
+/// Many heavy hitter sketches, as [`NativeHhSketch`] but with 32-bit
+/// weights and their keys interned under 32-bit ids in one dictionary that
+/// all the sketches share. A key held by many sketches is stored once, and
+/// each sketch slot takes 12 bytes rather than [`NativeHhSketch`]'s 40, so
+/// that a sketch per key of a keyed job, across millions of keys, fits in
+/// memory.
+///
+/// Sketches are referred to by their index, in the order they were
+/// [pushed](Self::push), and are kept until the whole set is dropped. The
+/// total weight of each sketch must fit in 32 bits.
+pub struct CompactHhSketches {
+    // Declared first, so that the sketches are dropped before the
+    // dictionary they refer to.
+    sketches: Vec<cxx::UniquePtr<ffi::OpaqueCompactHhSketch>>,
+    dictionary: cxx::UniquePtr<ffi::OpaqueHhDictionary>,
+    lg2_k: u8,
+}
+
+impl CompactHhSketches {
+    /// Creates an empty set, whose sketches have size `k` as described in
+    /// [`HhSketch::new`].
+    pub fn new(lg2_k: u8) -> Self {
+        Self {
+            sketches: Vec::new(),
+            dictionary: ffi::new_opaque_hh_dictionary(),
+            lg2_k,
+        }
+    }
+
+    /// Adds an empty sketch, returning its index.
+    pub fn push(&mut self) -> usize {
+        // the dictionary is boxed on the C++ side, so its address is stable
+        let addr = self.dictionary.as_ref().expect("non-null") as *const _ as usize;
+        self.sketches
+            .push(ffi::new_opaque_compact_hh_sketch(self.lg2_k, addr));
+        self.sketches.len() - 1
+    }
+
+    /// Returns the number of sketches.
+    pub fn len(&self) -> usize {
+        self.sketches.len()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.sketches.is_empty()
+    }
+
+    fn row_to_owned<'a>(&'a self, row: &ffi::HeavyHitterRow) -> HhRow<'a> {
+        // The key is owned by the dictionary, which no sketch can update
+        // while the set is borrowed for 'a.
+        let key = unsafe { slice::from_raw_parts(row.addr as *const u8, row.len) };
+        HhRow {
+            key,
+            lb: row.lb,
+            ub: row.ub,
+        }
+    }
+
+    /// Returns the heavy hitters of sketch `i` as
+    /// [`NativeHhSketch::estimate_no_fp`] does.
+    pub fn estimate_no_fp(&self, i: usize) -> Vec<HhRow> {
+        self.sketches[i]
+            .estimate_no_fp()
+            .into_iter()
+            .map(|x| self.row_to_owned(x))
+            .collect()
+    }
+
+    /// Returns the heavy hitters of sketch `i` as
+    /// [`NativeHhSketch::estimate_no_fn`] does.
+    pub fn estimate_no_fn(&self, i: usize) -> Vec<HhRow> {
+        self.sketches[i]
+            .estimate_no_fn()
+            .into_iter()
+            .map(|x| self.row_to_owned(x))
+            .collect()
+    }
+
+    /// Returns the top `k` heavy hitters of sketch `i` as
+    /// [`NativeHhSketch::top_no_fn`] does.
+    pub fn top_no_fn(&self, i: usize, k: usize) -> Vec<HhRow> {
+        self.sketches[i]
+            .top_no_fn(k)
+            .into_iter()
+            .map(|x| self.row_to_owned(x))
+            .collect()
+    }
+
+    /// Observes a new value in sketch `i`.
+    ///
+    /// Panics if the total weight of the sketch would overflow a `u32`.
+    pub fn update(&mut self, i: usize, value: &[u8], weight: u32) {
+        self.sketches[i]
+            .pin_mut()
+            .update(value, weight)
+            .expect("total weight fits in 32 bits")
+    }
+
+    /// Merges sketch `j` of `other` into sketch `i` of this set.
+    ///
+    /// Panics if the total weight of sketch `i` would overflow a `u32`.
+    pub fn merge(&mut self, i: usize, other: &Self, j: usize) {
+        self.sketches[i]
+            .pin_mut()
+            .merge(other.sketches[j].as_ref().expect("non-null"))
+            .expect("total weight fits in 32 bits")
+    }
+
+    /// Merges `other` into sketch `i`, failing if the total weight of the
+    /// sketch would overflow a `u32`.
+    pub fn merge_native(
+        &mut self,
+        i: usize,
+        other: &NativeHhSketch,
+    ) -> Result<(), DataSketchesError> {
+        self.sketches[i]
+            .pin_mut()
+            .merge_native(other.inner.as_ref().expect("non-null"))?;
+        Ok(())
+    }
+
+    /// Returns a copy of sketch `i` as a [`NativeHhSketch`] of the same
+    /// size, with the same estimates. This is how sketches are serialized.
+    pub fn to_native(&self, i: usize) -> NativeHhSketch {
+        NativeHhSketch {
+            inner: self.sketches[i].to_native(),
+        }
+    }
+
+    /// Returns the total weight of the values sketch `i` has observed.
+    pub fn total_weight(&self, i: usize) -> u64 {
+        self.sketches[i].get_total_weight()
+    }
+
+    /// Returns the number of distinct keys held by any of the sketches.
+    pub fn num_keys(&self) -> usize {
+        self.dictionary.get_num_keys()
+    }
+
+    /// Returns the heap memory held by the sketches' hash maps and by the
+    /// dictionary, including its copies of their keys, in bytes.
+    pub fn memory_usage_bytes(&self) -> usize {
+        let maps: usize = self
+            .sketches
+            .iter()
+            .map(|sketch| sketch.get_memory_usage_bytes())
+            .sum();
+        maps + self.dictionary.get_memory_usage_bytes()
+    }
+}
+
+/// Distinct keys each [`HhBuffer`] counts before flushing them.
+const HH_BUFFER_KEYS: usize = 4096;
+
+/// A [`NativeHhSketch`] which many threads can update at once. Each thread
+/// updates through its own [`HhBuffer`], which sums the weights of its keys
+/// exactly in a small local table. Once that holds a few thousand distinct
+/// keys, it is flushed into the shared sketch as one weighted batch, so
+/// only flushing takes a lock, and a skewed stream's many repeats of its
+/// heaviest keys cost a local table increment each.
+///
+/// As for [`ConcurrentThetaSketch`](crate::ConcurrentThetaSketch),
+/// estimates only reflect keys whose buffers have flushed them; call
+/// [`HhBuffer::flush`] (or drop the buffer) to catch up.
+pub struct ConcurrentHhSketch {
+    inner: Mutex<NativeHhSketch>,
+}
+
+impl ConcurrentHhSketch {
+    /// Create a concurrent HH sketch representing the empty set, with size
+    /// `k` as described in [`HhSketch::new`].
+    pub fn new(lg2_k: u8) -> Self {
+        Self {
+            inner: Mutex::new(NativeHhSketch::new(lg2_k)),
+        }
+    }
+
+    /// Create a new buffer for updating this sketch from one thread.
+    pub fn buffer(&self) -> HhBuffer<'_> {
+        HhBuffer {
+            sketch: self,
+            counts: KeyTable::default(),
+            ends: Vec::new(),
+            weights: Vec::new(),
+        }
+    }
+
+    /// Return a copy of the keys flushed so far.
+    pub fn sketch(&self) -> NativeHhSketch {
+        self.lock().clone()
+    }
+
+    /// Return the keys flushed so far, once no buffers are left.
+    pub fn into_inner(self) -> NativeHhSketch {
+        self.inner
+            .into_inner()
+            .unwrap_or_else(PoisonError::into_inner)
+    }
+
+    // A sketch stays valid even if a thread panicked while holding it.
+    fn lock(&self) -> MutexGuard<'_, NativeHhSketch> {
+        self.inner.lock().unwrap_or_else(PoisonError::into_inner)
+    }
+}
+
+/// A single-threaded handle for updating a [`ConcurrentHhSketch`], see there.
+/// Keys still buffered are flushed when this is dropped.
+pub struct HhBuffer<'a> {
+    sketch: &'a ConcurrentHhSketch,
+    counts: KeyTable<u64>,
+    // The ends of the keys in the table's packed keys, and their weights,
+    // reused across flushes.
+    ends: Vec<usize>,
+    weights: Vec<u64>,
+}
+
+impl HhBuffer<'_> {
+    /// Observe a new value, as [`NativeHhSketch::update`] does.
+    pub fn update(&mut self, value: &[u8], weight: u64) {
+        *self.counts.get_or_insert_with(value, || 0) += weight;
+        if self.counts.len() >= HH_BUFFER_KEYS {
+            self.flush();
+        }
+    }
+
+    /// Flush all buffered keys into the shared sketch.
+    pub fn flush(&mut self) {
+        if self.counts.len() == 0 {
+            return;
+        }
+        self.ends.clear();
+        self.weights.clear();
+        let mut end = 0;
+        for (key, &weight) in self.counts.iter() {
+            end += key.len();
+            self.ends.push(end);
+            self.weights.push(weight);
+        }
+        self.sketch.lock().update_weighted_batch(
+            self.counts.packed_keys(),
+            &self.ends,
+            &self.weights,
+        );
+        self.counts.drain().for_each(drop);
+    }
+}
+
+impl Drop for HhBuffer<'_> {
+    fn drop(&mut self) {
+        self.flush()
+    }
+}
+
 #[cfg(test)]
 mod tests {
     use std::collections::HashMap;
     use std::iter;
+    use std::thread;
 
     use byte_slice_cast::{AsByteSlice, AsSliceOf};
 
@@ -409,6 +816,34 @@ mod tests {
         }
     }
 
+    #[test]
+    fn merge_with_purges() {
+        // both sides hold many light keys, some shared, so merging purges
+        // this sketch midway through interning the other's keys
+        let lg2_k = 4;
+        let max = 1u64 << lg2_k;
+        let heavy_weight = max * 8;
+        let mut hhs = vec![HhSketch::new(lg2_k), HhSketch::new(lg2_k)];
+        for (j, hh) in hhs.iter_mut().enumerate() {
+            for i in 0u64..(max * 4) {
+                let slice = [i + j as u64 * max * 2];
+                hh.update(slice.as_byte_slice(), 1 + i % 3);
+            }
+            let slice = [u64::MAX - j as u64];
+            hh.update(slice.as_byte_slice(), heavy_weight);
+        }
+        let other = hhs.pop().expect("two sketches");
+        let mut hh = hhs.pop().expect("two sketches");
+        hh.merge(&other);
+        drop(other);
+        matches(
+            &hh,
+            &[(u64::MAX, heavy_weight), (u64::MAX - 1, heavy_weight)],
+        );
+        assert!(hh.intern.len() <= 3 << lg2_k >> 2);
+        check_cycle(&hh);
+    }
+
     // lg2_k in 4,5
     // stream_multiplier in 2, 5, 20
     // n = stream_multiplier * k
@@ -562,5 +997,285 @@ mod tests {
         assert!(hh.estimate_no_fp().is_empty());
         assert!(hh.estimate_no_fn().is_empty());
         check_cycle(&hh);
+        let hh = NativeHhSketch::new(12);
+        assert!(hh.estimate_no_fp().is_empty());
+        assert!(hh.estimate_no_fn().is_empty());
+    }
+
+    fn sorted(mut rows: Vec<HhRow>) -> Vec<HhRow> {
+        rows.sort_unstable();
+        rows
+    }
+
+    #[test]
+    fn native_retains_all() {
+        for &lg2_k in &[3, 4, 5] {
+            let mut native = NativeHhSketch::new(lg2_k + 1);
+            let mut interned = HhSketch::new(lg2_k + 1);
+            for i in 0u64..(1 << lg2_k) {
+                let slice = [i];
+                native.update(slice.as_byte_slice(), i + 1);
+                interned.update(slice.as_byte_slice(), i + 1);
+            }
+            // with no purges, both are exact
+            assert_eq!(
+                sorted(native.estimate_no_fn()),
+                sorted(interned.estimate_no_fn())
+            );
+            let cpy = native.clone();
+            native.merge(&cpy);
+            interned.merge(&interned.clone());
+            assert_eq!(
+                sorted(native.estimate_no_fn()),
+                sorted(interned.estimate_no_fn())
+            );
+            assert_eq!(sorted(cpy.estimate_no_fp()).len(), 1 << lg2_k);
+        }
+    }
+
+    #[test]
+    fn native_batch_update_matches_single() {
+        // enough keys for the map to grow past the size it prefetches at
+        let lg2_k = 14;
+        let mut single = NativeHhSketch::new(lg2_k);
+        let mut batched = NativeHhSketch::new(lg2_k);
+        let mut weighted_single = NativeHhSketch::new(lg2_k);
+        let mut weighted = NativeHhSketch::new(lg2_k);
+        let (mut buf, mut ends, mut weights) = (Vec::new(), Vec::new(), Vec::new());
+        for i in 0u64..200 * 1000 {
+            let key = [i % 30000, i % 7];
+            let key = &key.as_byte_slice()[..(i % 16) as usize];
+            single.update(key, 1);
+            weighted_single.update(key, i % 5);
+            buf.extend_from_slice(key);
+            ends.push(buf.len());
+            weights.push(i % 5);
+        }
+        batched.update_batch(&buf, &ends);
+        weighted.update_weighted_batch(&buf, &ends, &weights);
+        let sorted = |mut rows: Vec<HhRow>| {
+            rows.sort_unstable();
+            rows.into_iter()
+                .map(|row| (row.key.to_vec(), row.lb, row.ub))
+                .collect::<Vec<_>>()
+        };
+        assert_eq!(
+            sorted(single.estimate_no_fn()),
+            sorted(batched.estimate_no_fn())
+        );
+        assert_eq!(
+            sorted(weighted_single.estimate_no_fn()),
+            sorted(weighted.estimate_no_fn())
+        );
+    }
+
+    #[test]
+    fn native_top_matches_sorted_estimates() {
+        let mut hh = NativeHhSketch::new(6);
+        for i in 0u64..20 * 1000 {
+            hh.update([i % 300].as_byte_slice(), i % 300 + 1);
+        }
+        let mut all = hh.estimate_no_fn();
+        all.sort_by_key(|row| std::cmp::Reverse(row.ub));
+        // rows tied on their bounds may come in either order
+        let ubs = |rows: &[HhRow]| rows.iter().map(|row| row.ub).collect::<Vec<_>>();
+        for &k in &[0, 1, 10, all.len(), all.len() + 5] {
+            let top = hh.top_no_fn(k);
+            assert_eq!(ubs(&top), ubs(&all[..k.min(all.len())]), "{}", k);
+            assert!(top.iter().all(|row| all.contains(row)));
+        }
+    }
+
+    #[test]
+    fn native_serialization_round_trips() {
+        let lg2_k = 5;
+        let mut hh = NativeHhSketch::new(lg2_k);
+        for i in 0u64..10 * 1000 {
+            let key = [i % 50, i % 3];
+            hh.update(&key.as_byte_slice()[..(i % 16) as usize], i % 4);
+        }
+        let rows = |hh: &NativeHhSketch| {
+            let mut rows: Vec<_> = hh
+                .estimate_no_fn()
+                .into_iter()
+                .map(|row| (row.key.to_vec(), row.lb, row.ub))
+                .collect();
+            rows.sort_unstable();
+            rows
+        };
+        let bytes = hh.serialize();
+        let copy = NativeHhSketch::deserialize(bytes.as_ref()).unwrap();
+        assert_eq!(rows(&hh), rows(&copy));
+        assert_eq!(copy.serialize().as_ref().len(), bytes.as_ref().len());
+        drop(bytes);
+        // keys no longer point into the dropped bytes
+        assert_eq!(rows(&hh), rows(&copy.clone()));
+
+        let empty = NativeHhSketch::new(lg2_k);
+        let copy = NativeHhSketch::deserialize(empty.serialize().as_ref()).unwrap();
+        assert!(copy.estimate_no_fn().is_empty());
+
+        let bytes = hh.serialize();
+        let bytes = bytes.as_ref();
+        assert!(NativeHhSketch::deserialize(&bytes[..bytes.len() - 1]).is_err());
+        assert!(NativeHhSketch::deserialize(&[]).is_err());
+    }
+
+    fn owned_rows(rows: Vec<HhRow>) -> Vec<(Vec<u8>, u64, u64)> {
+        let mut rows: Vec<_> = rows
+            .into_iter()
+            .map(|row| (row.key.to_vec(), row.lb, row.ub))
+            .collect();
+        rows.sort_unstable();
+        rows
+    }
+
+    #[test]
+    fn compact_matches_native() {
+        let lg2_k = 9;
+        let mut compact = CompactHhSketches::new(lg2_k);
+        let mut native = NativeHhSketch::new(lg2_k);
+        assert_eq!(compact.push(), 0);
+        for i in 0u64..10 * 1000 {
+            let key = [i % 40, i % 3];
+            let key = &key.as_byte_slice()[..(i % 16) as usize];
+            compact.update(0, key, (i % 4) as u32);
+            native.update(key, i % 4);
+        }
+        // with no purges, both are exact
+        assert_eq!(
+            owned_rows(compact.estimate_no_fn(0)),
+            owned_rows(native.estimate_no_fn())
+        );
+        assert_eq!(compact.total_weight(0), 15 * 1000);
+        let bytes = compact.to_native(0).serialize();
+        let copy = NativeHhSketch::deserialize(bytes.as_ref()).unwrap();
+        assert_eq!(
+            owned_rows(copy.estimate_no_fn()),
+            owned_rows(native.estimate_no_fn())
+        );
+        let ubs = |rows: Vec<HhRow>| rows.iter().map(|row| row.ub).collect::<Vec<_>>();
+        assert_eq!(ubs(compact.top_no_fn(0, 5)), ubs(native.top_no_fn(5)));
+    }
+
+    #[test]
+    fn compact_shares_keys_across_sketches() {
+        let lg2_k = 4;
+        let n = (1u64 << lg2_k) * 9;
+        let heavy = |j: u64| [b"heavy".as_ref(), &[(j % 3) as u8]].concat();
+        let heavy_weight = n / 3 * 5;
+        let check_heavy = |rows: Vec<HhRow>, weight: u64| {
+            let rows = owned_rows(rows);
+            assert_eq!(rows.len(), 3);
+            for (key, lb, ub) in rows {
+                assert!(key.starts_with(b"heavy"));
+                assert!(lb <= weight && weight <= ub);
+            }
+        };
+        // two sketches of the same heavy keys, among distinct light ones
+        // which force purges
+        let mut compact = CompactHhSketches::new(lg2_k);
+        let mut native = NativeHhSketch::new(lg2_k);
+        for i in 0..2 {
+            assert_eq!(compact.push(), i);
+            for j in 0..n {
+                let light = [i as u64, j];
+                compact.update(i, light.as_byte_slice(), 1);
+                compact.update(i, &heavy(j), 5);
+                if i == 0 {
+                    native.update(light.as_byte_slice(), 1);
+                    native.update(&heavy(j), 5);
+                }
+            }
+            check_heavy(compact.estimate_no_fp(i), heavy_weight);
+            assert_eq!(compact.total_weight(i), n * 6);
+        }
+        // purged keys are freed, and shared ones stored once
+        let held: HashSet<Vec<u8>> = (0..2)
+            .flat_map(|i| owned_rows(compact.estimate_no_fn(i)))
+            .map(|(key, _, _)| key)
+            .collect();
+        assert_eq!(compact.num_keys(), held.len());
+
+        // merges across dictionaries, and from native sketches
+        let mut other = CompactHhSketches::new(lg2_k);
+        other.push();
+        other.merge(0, &compact, 1);
+        other.merge_native(0, &native).unwrap();
+        check_heavy(other.estimate_no_fp(0), heavy_weight * 2);
+        assert_eq!(other.total_weight(0), n * 12);
+
+        let mut big = NativeHhSketch::new(lg2_k);
+        big.update(b"big", u32::MAX as u64);
+        assert!(other.merge_native(0, &big).is_err());
+    }
+
+    #[test]
+    fn concurrent_matches_native() {
+        let lg2_k = 8;
+        // a few heavy keys among many light ones, spread over threads
+        let key = |i: u64| match i % 4 {
+            0 => vec![b'h', (i % 3) as u8],
+            _ => [b"light".as_ref(), [i].as_byte_slice()].concat(),
+        };
+        let concurrent = ConcurrentHhSketch::new(lg2_k);
+        thread::scope(|scope| {
+            for t in 0..4u64 {
+                let concurrent = &concurrent;
+                scope.spawn(move || {
+                    let mut buffer = concurrent.buffer();
+                    (t * 5000..(t + 1) * 5000).for_each(|i| buffer.update(&key(i), 1));
+                });
+            }
+        });
+        let mut single = NativeHhSketch::new(lg2_k);
+        (0..4 * 5000).for_each(|i| single.update(&key(i), 1));
+
+        let mut counts = HashMap::new();
+        (0..4 * 5000).for_each(|i| *counts.entry(key(i)).or_insert(0) += 1);
+        let heavy = |hh: &NativeHhSketch| {
+            let mut keys: Vec<Vec<u8>> = hh
+                .estimate_no_fp()
+                .into_iter()
+                .map(|row| {
+                    let count = counts[row.key];
+                    assert!(row.lb <= count && count <= row.ub);
+                    row.key.to_vec()
+                })
+                .collect();
+            keys.sort();
+            keys
+        };
+        let expected = vec![vec![b'h', 0], vec![b'h', 1], vec![b'h', 2]];
+        assert_eq!(heavy(&single), expected);
+        assert_eq!(heavy(&concurrent.sketch()), expected);
+        assert_eq!(heavy(&concurrent.into_inner()), expected);
+    }
+
+    #[test]
+    fn native_heavy_with_purges() {
+        let lg2_k = 4;
+        let max = 1u64 << lg2_k;
+        let heavies = [b"heavy-a".to_vec(), b"heavy-bb".to_vec(), vec![]];
+        let heavy_weight = max * 2 + 1;
+        let mut hh = NativeHhSketch::new(lg2_k);
+        for _ in 0..3 {
+            // many distinct light keys of varied lengths force purges
+            for i in 0u64..(max * 4) {
+                let key = vec![b'x'; (i % 40) as usize + 1];
+                hh.update(&[key.as_slice(), [i].as_byte_slice()].concat(), 1);
+            }
+            for key in &heavies {
+                hh.update(key, heavy_weight);
+            }
+        }
+        // a clone copies the keys out of the purged sketch's pool
+        let cpy = hh.clone();
+        let rows = cpy.estimate_no_fp();
+        for key in &heavies {
+            let row = rows.iter().find(|row| row.key == key.as_slice());
+            let row = row.expect("heavy key present");
+            assert!(row.lb <= heavy_weight * 3 && heavy_weight * 3 <= row.ub);
+        }
     }
 }
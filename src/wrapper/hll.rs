@@ -0,0 +1,683 @@
+//! Wrapper types for the HLL sketch.
+
+use cxx;
+
+use crate::bridge::ffi;
+pub use crate::bridge::ffi::HllType;
+use crate::bridge::ffi::KeyHash;
+use crate::wrapper::{check_batch_ends, map_many};
+use crate::DataSketchesError;
+
+/// The [HyperLogLog][orig-docs] (HLL) sketch is a fixed-size distinct count
+/// sketch. Its dense representation stores one bucket of `HllType` bits for
+/// each of the `2^lg_k` buckets:
+///
+///  * [`HllType::Hll4`] is the most compact, using about `2^lg_k / 2` bytes,
+///    at the cost of the slowest updates.
+///  * [`HllType::Hll6`] uses about `2^lg_k * 3 / 4` bytes.
+///  * [`HllType::Hll8`] uses `2^lg_k` bytes and has the fastest updates.
+///
+/// All three types give the same estimates. For the same `lg_k`, HLL is
+/// less accurate than [`crate::CpcSketch`], but an `Hll4` sketch takes
+/// roughly half of CPC's in-memory size.
+///
+/// This sketch supports merging through an intermediate type, [`HllUnion`].
+///
+/// [orig-docs]: https://datasketches.apache.org/docs/HLL/HLL.html
+pub struct HllSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueHllSketch>,
+}
+
+impl HllSketch {
+    /// Create an HLL sketch representing the empty set, with `2^lg_k`
+    /// buckets of type `tgt_type`. Fails unless `4 <= lg_k <= 21`.
+    pub fn new(lg_k: u8, tgt_type: HllType) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_hll_sketch(lg_k, tgt_type)?,
+        })
+    }
+
+    /// Return the current estimate of distinct values seen.
+    pub fn estimate(&self) -> f64 {
+        self.inner.estimate()
+    }
+
+    /// Observe a new value. Two values must have the exact same
+    /// bytes and lengths to be considered equal.
+    pub fn update(&mut self, value: &[u8]) {
+        self.inner.pin_mut().update(value)
+    }
+
+    /// Observe a new `u64`. If the native-endian byte ordered bytes
+    /// are equal to any other value seen by `update()`, this will be considered
+    /// equal. If you are intending to use serialized sketches across
+    /// platforms with different endianness, make sure to convert this
+    /// `value` to network order first.
+    pub fn update_u64(&mut self, value: u64) {
+        self.inner.pin_mut().update_u64(value)
+    }
+
+    /// Equivalent to calling [`Self::update_u64`] on each of `values`, but
+    /// crosses into C++ only once.
+    pub fn update_u64_batch(&mut self, values: &[u64]) {
+        self.inner.pin_mut().update_u64_batch(values)
+    }
+
+    /// Equivalent to calling [`Self::update`] on each key packed into `buf`,
+    /// but crosses into C++ only once. Key `i` is `buf[ends[i - 1]..ends[i]]`,
+    /// where the first key starts at offset 0.
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn update_batch(&mut self, buf: &[u8], ends: &[usize]) {
+        check_batch_ends(buf, ends);
+        self.inner.pin_mut().update_bytes_batch(buf, ends)
+    }
+
+    /// Equivalent to [`Self::update`] with the key `hash` was made from.
+    pub fn update_hashed(&mut self, hash: KeyHash) {
+        self.inner.pin_mut().update_hashed(hash)
+    }
+
+    /// Equivalent to [`Self::update_hashed`] on each of `hashes`, but
+    /// crosses into C++ only once.
+    pub fn update_hashed_batch(&mut self, hashes: &[KeyHash]) {
+        self.inner.pin_mut().update_hashed_batch(hashes)
+    }
+
+    /// Empty this sketch so it represents the empty set again, with the
+    /// same `lg_k` and target type.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+
+    /// Return the log2 of the number of buckets this sketch was configured with.
+    pub fn lg_k(&self) -> u8 {
+        self.inner.get_lg_config_k()
+    }
+
+    /// Return the bucket type this sketch was configured with.
+    pub fn target_type(&self) -> HllType {
+        self.inner.get_target_type()
+    }
+
+    /// Returns the heap memory this sketch holds, in bytes: its list or
+    /// set of coupons while sparse, and then its buckets, along with the
+    /// exceptions of [`HllType::Hll4`] buckets.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.inner.get_memory_usage_bytes()
+    }
+
+    /// Serialize to the compact form, which is the smallest one and
+    /// the one to use for storage or transfer.
+    pub fn serialize(&self) -> impl AsRef<[u8]> {
+        UPtrVec(self.inner.serialize_compact())
+    }
+
+    /// Serialize to the updatable form, which is larger than
+    /// [`Self::serialize`] but can be wrapped by other DataSketches
+    /// implementations without copying.
+    pub fn serialize_updatable(&self) -> impl AsRef<[u8]> {
+        UPtrVec(self.inner.serialize_updatable())
+    }
+
+    /// Deserialize either of the serialized forms.
+    pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::deserialize_opaque_hll_sketch(buf)?,
+        })
+    }
+
+    /// Equivalent to `HllSketch::deserialize(buf)?.estimate()`, but only
+    /// reads the header of `buf` instead of copying out the registers.
+    pub fn estimate_serialized(buf: &[u8]) -> Result<f64, DataSketchesError> {
+        Ok(ffi::estimate_serialized_hll_sketch(buf)?)
+    }
+
+    /// Returns the estimate of each of `serialized` with its lower and upper
+    /// bounds at `num_std_dev` (1, 2 or 3) standard deviations, as
+    /// `(estimate, lower, upper)`. Like [`Self::estimate_serialized`], only
+    /// the headers are read, and the sketches are split among `threads`
+    /// threads.
+    ///
+    /// Panics if `threads` is 0.
+    pub fn estimate_many(
+        serialized: &[&[u8]],
+        num_std_dev: u8,
+        threads: usize,
+    ) -> Result<Vec<(f64, f64, f64)>, DataSketchesError> {
+        map_many(serialized, threads, |buf| {
+            let bounds = ffi::bounds_serialized_hll_sketch(buf, num_std_dev)?;
+            Ok((bounds.estimate, bounds.lower_bound, bounds.upper_bound))
+        })
+    }
+}
+
+struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+
+impl AsRef<[u8]> for UPtrVec {
+    fn as_ref(&self) -> &[u8] {
+        self.0.as_slice()
+    }
+}
+
+pub struct HllUnion {
+    inner: cxx::UniquePtr<ffi::OpaqueHllUnion>,
+}
+
+impl HllUnion {
+    /// Create an HLL union over nothing, which corresponds to the
+    /// empty set. Merged sketches with a larger `lg_k` are downsampled
+    /// to `lg_max_k`. Fails unless `4 <= lg_max_k <= 21`.
+    pub fn new(lg_max_k: u8) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_hll_union(lg_max_k)?,
+        })
+    }
+
+    pub fn merge(&mut self, sketch: HllSketch) {
+        self.inner.pin_mut().merge(sketch.inner)
+    }
+
+    /// Equivalent to `self.merge(HllSketch::deserialize(buf)?)`, but once
+    /// the union holds buckets, those of `buf` and its coupons are merged
+    /// from where they lie, without a sketch being built in between. Only
+    /// the first sketch that the union takes buckets from is copied.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        Ok(self.inner.pin_mut().merge_serialized(buf)?)
+    }
+
+    /// Empty this union so it represents the empty set again.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+
+    /// Retrieve the current unioned sketch as a copy, with buckets of
+    /// type `tgt_type`.
+    pub fn sketch(&self, tgt_type: HllType) -> HllSketch {
+        HllSketch {
+            inner: self.inner.sketch(tgt_type),
+        }
+    }
+}
+
+/// The registers of many HLL sketches sharing one `lg_k`, packed into a
+/// single array of `2^lg_k` bytes per row. Row `i` stands for the sketch of
+/// key id `i`, so a job tracking a distinct count per key needs neither a
+/// heap object nor a mode switch per key.
+///
+/// Rows are always dense, so this pays off once most rows see more than a
+/// few hundred values. Their estimates come from the registers alone, as
+/// those of a sketch produced by [`HllUnion`] do; a row's estimate thus
+/// matches what merging its values' sketches would give, not necessarily
+/// that of one [`HllSketch`] fed all of them.
+///
+/// Rows serialize to ordinary compact HLL sketches, which
+/// [`HllSketch::deserialize`] and [`HllUnion::merge_serialized`] read.
+pub struct HllMatrix {
+    inner: cxx::UniquePtr<ffi::OpaqueHllMatrix>,
+}
+
+impl HllMatrix {
+    /// Create `num_rows` rows each representing the empty set, with `2^lg_k`
+    /// buckets each. Fails unless `4 <= lg_k <= 21`.
+    pub fn new(lg_k: u8, num_rows: usize) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_hll_matrix(lg_k, num_rows)?,
+        })
+    }
+
+    pub fn num_rows(&self) -> usize {
+        self.inner.num_rows()
+    }
+
+    pub fn lg_k(&self) -> u8 {
+        self.inner.get_lg_config_k()
+    }
+
+    /// Append `n` rows representing the empty set.
+    pub fn add_rows(&mut self, n: usize) {
+        self.inner.pin_mut().add_rows(n)
+    }
+
+    /// Observe `value` in row `row`, as [`HllSketch::update`] would.
+    ///
+    /// Panics if `row` is not below [`Self::num_rows`].
+    pub fn update(&mut self, row: u32, value: &[u8]) {
+        self.update_hashed_batch(&[row], &[KeyHash::new(value)])
+    }
+
+    /// Observe `hashes[i]` in row `rows[i]` for each `i`. Batches whose
+    /// updates to a row sit next to each other touch each row's registers
+    /// once rather than once per update.
+    ///
+    /// Panics if `rows` and `hashes` differ in length, or if any row is not
+    /// below [`Self::num_rows`].
+    pub fn update_hashed_batch(&mut self, rows: &[u32], hashes: &[KeyHash]) {
+        assert_eq!(rows.len(), hashes.len(), "one row per hash");
+        let num_rows = self.num_rows();
+        assert!(
+            rows.iter().all(|&row| (row as usize) < num_rows),
+            "row out of range"
+        );
+        self.inner.pin_mut().update_hashed_batch(rows, hashes)
+    }
+
+    /// Merge each row of `other` into the same row here, first appending
+    /// empty rows if `other` has more. Fails if the two differ in `lg_k`.
+    pub fn merge(&mut self, other: &Self) -> Result<(), DataSketchesError> {
+        Ok(self.inner.pin_mut().merge(&other.inner)?)
+    }
+
+    /// Return the estimate of distinct values seen by row `row`.
+    ///
+    /// Panics if `row` is not below [`Self::num_rows`].
+    pub fn estimate(&self, row: usize) -> f64 {
+        assert!(row < self.num_rows(), "row out of range");
+        self.inner.estimate(row)
+    }
+
+    /// Serialize row `row` as a compact HLL sketch with buckets of type
+    /// `tgt_type`.
+    ///
+    /// Panics if `row` is not below [`Self::num_rows`].
+    pub fn serialize_row(&self, row: usize, tgt_type: HllType) -> impl AsRef<[u8]> {
+        assert!(row < self.num_rows(), "row out of range");
+        UPtrVec(self.inner.serialize_row(row, tgt_type))
+    }
+
+    /// Empty every row so each represents the empty set again.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use byte_slice_cast::AsByteSlice;
+
+    use super::*;
+
+    const TYPES: [HllType; 3] = [HllType::Hll4, HllType::Hll6, HllType::Hll8];
+
+    fn check_cycle(s: &HllSketch) {
+        let est = s.estimate();
+        let compact = s.serialize();
+        let updatable = s.serialize_updatable();
+        assert!(compact.as_ref().len() <= updatable.as_ref().len());
+        for bytes in [compact.as_ref(), updatable.as_ref()] {
+            assert_eq!(est, HllSketch::estimate_serialized(bytes).unwrap());
+            let cpy = HllSketch::deserialize(bytes).unwrap();
+            assert_eq!(est, cpy.estimate());
+            assert_eq!(s.lg_k(), cpy.lg_k());
+            assert!(s.target_type() == cpy.target_type());
+        }
+    }
+
+    #[test]
+    fn basic_count_distinct() {
+        let mut slice = [0u64];
+        let n = 100 * 1000;
+        for tgt_type in TYPES {
+            let mut hll = HllSketch::new(12, tgt_type).unwrap();
+            for _ in 0..10 {
+                for key in 0u64..n {
+                    slice[0] = key;
+                    // updates should be equal
+                    hll.update(slice.as_byte_slice());
+                    hll.update_u64(key);
+                }
+                check_cycle(&hll);
+                let est = hll.estimate();
+                let lb = n as f64 * 0.95;
+                let ub = n as f64 * 1.05;
+                assert!((lb..ub).contains(&est));
+            }
+        }
+    }
+
+    #[test]
+    fn batch_update_matches_single() {
+        // through list and set modes into HLL mode, where HLL_4 raises its
+        // floor and spills into exceptions along the way
+        let n = 100 * 1000;
+        let keys: Vec<u64> = (0..n).collect();
+        for tgt_type in TYPES {
+            let mut single = HllSketch::new(12, tgt_type).unwrap();
+            keys.iter().for_each(|&k| single.update_u64(k));
+
+            let mut batched = HllSketch::new(12, tgt_type).unwrap();
+            keys.chunks(999).for_each(|c| batched.update_u64_batch(c));
+            assert_eq!(
+                single.serialize_updatable().as_ref(),
+                batched.serialize_updatable().as_ref()
+            );
+            assert_eq!(single.estimate(), batched.estimate());
+
+            let mut buf = Vec::new();
+            let mut ends = Vec::new();
+            for &k in &keys {
+                buf.extend_from_slice([k].as_byte_slice());
+                ends.push(buf.len());
+            }
+            let mut packed = HllSketch::new(12, tgt_type).unwrap();
+            packed.update_batch(&buf, &ends);
+            assert_eq!(
+                single.serialize_updatable().as_ref(),
+                packed.serialize_updatable().as_ref()
+            );
+        }
+    }
+
+    #[test]
+    fn batch_update_16_byte_keys() {
+        let n = 10 * 1000;
+        let mut buf = Vec::new();
+        let mut ends = Vec::new();
+        let mut single = HllSketch::new(12, HllType::Hll4).unwrap();
+        for k in 0..n as u64 {
+            let key = [k, !k];
+            single.update(key.as_byte_slice());
+            buf.extend_from_slice(key.as_byte_slice());
+            ends.push(buf.len());
+        }
+        let mut packed = HllSketch::new(12, HllType::Hll4).unwrap();
+        packed.update_batch(&buf, &ends);
+        assert_eq!(single.serialize().as_ref(), packed.serialize().as_ref());
+    }
+
+    #[test]
+    #[should_panic]
+    fn batch_update_bad_ends() {
+        HllSketch::new(12, HllType::Hll4)
+            .unwrap()
+            .update_batch(&[1, 2, 3], &[2, 1]);
+    }
+
+    #[test]
+    fn hll_empty() {
+        for tgt_type in TYPES {
+            let hll = HllSketch::new(8, tgt_type).unwrap();
+            assert_eq!(hll.estimate(), 0.0);
+            check_cycle(&hll);
+        }
+    }
+
+    #[test]
+    fn hll4_exceptions_match_hll8() {
+        // tens of buckets end up 15 or more above the least one, which HLL_4
+        // keeps as exceptions
+        let mut hll4 = HllSketch::new(16, HllType::Hll4).unwrap();
+        let mut hll8 = HllSketch::new(16, HllType::Hll8).unwrap();
+        for key in 0u64..1000 * 1000 {
+            hll4.update_u64(key);
+            hll8.update_u64(key);
+        }
+        assert!(hll4.serialize().as_ref().len() > (1 << 15) + 40);
+        check_cycle(&hll4);
+        let cpy = HllSketch::deserialize(hll4.serialize_updatable().as_ref()).unwrap();
+
+        let mut from4 = HllUnion::new(16).unwrap();
+        from4.merge(cpy);
+        let mut from8 = HllUnion::new(16).unwrap();
+        from8.merge(hll8);
+        assert_eq!(
+            from4.sketch(HllType::Hll8).serialize().as_ref(),
+            from8.sketch(HllType::Hll8).serialize().as_ref()
+        );
+    }
+
+    #[test]
+    fn reset_matches_new() {
+        let mut union = HllUnion::new(12).unwrap();
+        for tgt_type in TYPES {
+            let mut hll = HllSketch::new(12, tgt_type).unwrap();
+            for &n in &[100000u64, 10] {
+                hll.reset();
+                union.reset();
+                let mut fresh = HllSketch::new(12, tgt_type).unwrap();
+                for key in 0u64..n {
+                    hll.update_u64(key);
+                    fresh.update_u64(key);
+                }
+                assert_eq!(hll.serialize().as_ref(), fresh.serialize().as_ref());
+                union.merge(hll);
+                hll = fresh;
+                assert_eq!(union.sketch(tgt_type).estimate(), hll.estimate());
+            }
+        }
+    }
+
+    #[test]
+    fn bad_lg_k() {
+        assert!(HllSketch::new(3, HllType::Hll4).is_err());
+        assert!(HllSketch::new(22, HllType::Hll8).is_err());
+        assert!(HllUnion::new(0).is_err());
+    }
+
+    #[test]
+    fn bad_deserialize() {
+        assert!(HllSketch::deserialize(&[]).is_err());
+        assert!(HllSketch::deserialize(&[1, 2, 3]).is_err());
+        assert!(HllSketch::estimate_serialized(&[]).is_err());
+        assert!(HllSketch::estimate_serialized(&[1, 2, 3]).is_err());
+        for tgt_type in TYPES {
+            // list, set and HLL modes
+            for n in [10, 1000, 100 * 1000] {
+                let mut hll = HllSketch::new(12, tgt_type).unwrap();
+                (0..n).for_each(|key| hll.update_u64(key));
+                let bytes = hll.serialize();
+                let bytes = bytes.as_ref();
+                assert!(HllSketch::estimate_serialized(&bytes[..bytes.len() - 1]).is_err());
+            }
+        }
+    }
+
+    #[test]
+    fn estimate_many_matches_deserialized() {
+        // list, set and HLL modes, with unioned HLL sketches out of order
+        let mut serialized = Vec::new();
+        for tgt_type in TYPES {
+            for (i, &n) in [0u64, 10, 1000, 100 * 1000].iter().enumerate() {
+                let mut hll = HllSketch::new(10 + 2 * i as u8, tgt_type).unwrap();
+                (0..n).for_each(|key| hll.update_u64(key));
+                serialized.push(hll.serialize_updatable().as_ref().to_vec());
+                let mut union = HllUnion::new(12).unwrap();
+                union.merge(hll);
+                serialized.push(union.sketch(tgt_type).serialize().as_ref().to_vec());
+            }
+        }
+        let slices: Vec<&[u8]> = serialized.iter().map(|buf| buf.as_slice()).collect();
+        let slices = slices.repeat(10);
+
+        let narrow = HllSketch::estimate_many(&slices, 1, 1).unwrap();
+        for &threads in &[1, 3, 8] {
+            let wide = HllSketch::estimate_many(&slices, 3, threads).unwrap();
+            assert_eq!(wide.len(), slices.len());
+            for ((buf, &(est, lb, ub)), &(_, narrow_lb, narrow_ub)) in
+                slices.iter().zip(&wide).zip(&narrow)
+            {
+                assert_eq!(est, HllSketch::deserialize(buf).unwrap().estimate());
+                assert!(lb <= narrow_lb && narrow_lb <= est);
+                assert!(est <= narrow_ub && narrow_ub <= ub);
+            }
+        }
+        assert_eq!(narrow[0], (0.0, 0.0, 0.0));
+
+        assert!(HllSketch::estimate_many(&slices, 0, 2).is_err());
+        let mut bad = slices.clone();
+        bad[100] = &[1, 2, 3];
+        assert!(HllSketch::estimate_many(&bad, 2, 4).is_err());
+    }
+
+    #[test]
+    fn basic_union_overlap() {
+        let n = 100 * 1000;
+        let mut union = HllUnion::new(12).unwrap();
+        for (i, tgt_type) in TYPES.iter().cycle().take(10).enumerate() {
+            // sketches of mixed lg_k and type can all be merged
+            let mut hll = HllSketch::new(11 + (i % 3) as u8, *tgt_type).unwrap();
+            for key in 0u64..n {
+                hll.update_u64(key);
+            }
+            union.merge(hll);
+            let merged = union.sketch(HllType::Hll4);
+            assert!(merged.lg_k() <= 12);
+            check_cycle(&merged);
+            let est = merged.estimate();
+            let lb = n as f64 * 0.95;
+            let ub = n as f64 * 1.05;
+            assert!((lb..ub).contains(&est));
+        }
+    }
+
+    #[test]
+    fn union_merge_serialized() {
+        let mut owned = HllUnion::new(12).unwrap();
+        let mut serialized = HllUnion::new(12).unwrap();
+        for (i, tgt_type) in TYPES.iter().enumerate() {
+            // list, set and HLL modes
+            for n in [10, 1000, 100 * 1000] {
+                let mut hll = HllSketch::new(11 + i as u8, *tgt_type).unwrap();
+                (0..n).for_each(|key| hll.update_u64(key * 3 + i as u64));
+                serialized
+                    .merge_serialized(hll.serialize().as_ref())
+                    .unwrap();
+                serialized
+                    .merge_serialized(hll.serialize_updatable().as_ref())
+                    .unwrap();
+                owned.merge(HllSketch::deserialize(hll.serialize().as_ref()).unwrap());
+                owned.merge(hll);
+            }
+        }
+        assert_eq!(
+            owned.sketch(HllType::Hll8).serialize().as_ref(),
+            serialized.sketch(HllType::Hll8).serialize().as_ref()
+        );
+        assert!(serialized.merge_serialized(&[]).is_err());
+        assert!(serialized.merge_serialized(&[1, 2, 3]).is_err());
+    }
+
+    #[test]
+    fn union_merge_serialized_downsamples() {
+        let mut owned = HllUnion::new(14).unwrap();
+        let mut serialized = HllUnion::new(14).unwrap();
+        // a union of lg_k 14 in HLL mode, then sketches of smaller lg_k,
+        // with HLL_4 exceptions among their buckets
+        for (lg_k, n) in [(14, 100 * 1000), (12, 50 * 1000), (10, 200 * 1000)] {
+            for tgt_type in TYPES.iter() {
+                let mut hll = HllSketch::new(lg_k, *tgt_type).unwrap();
+                (0..n).for_each(|key| hll.update_u64(key + lg_k as u64));
+                serialized
+                    .merge_serialized(hll.serialize_updatable().as_ref())
+                    .unwrap();
+                owned.merge(hll);
+            }
+            assert_eq!(
+                owned.sketch(HllType::Hll8).serialize().as_ref(),
+                serialized.sketch(HllType::Hll8).serialize().as_ref()
+            );
+        }
+        assert_eq!(serialized.sketch(HllType::Hll8).lg_k(), 10);
+
+        let mut hll = HllSketch::new(12, HllType::Hll4).unwrap();
+        (0..10 * 1000).for_each(|key| hll.update_u64(key));
+        let buf = hll.serialize();
+        let buf = buf.as_ref();
+        assert!(serialized.merge_serialized(&buf[..buf.len() - 1]).is_err());
+    }
+
+    #[test]
+    fn matrix_rows_match_sketches() {
+        let rows = 5u32;
+        let n = 20 * 1000;
+        let mut matrix = HllMatrix::new(10, rows as usize).unwrap();
+        let mut sketches: Vec<_> = (0..rows)
+            .map(|_| HllSketch::new(10, HllType::Hll8).unwrap())
+            .collect();
+        let mut ids = Vec::new();
+        let mut hashes = Vec::new();
+        // row 0 stays empty, row r sees r * n / rows values
+        for row in 1..rows {
+            for key in 0..row as u64 * n / rows as u64 {
+                let hash = KeyHash::new([key].as_byte_slice());
+                ids.push(row);
+                hashes.push(hash);
+                sketches[row as usize].update_hashed(hash);
+            }
+        }
+        matrix.update_hashed_batch(&ids, &hashes);
+
+        assert_eq!(0.0, matrix.estimate(0));
+        for (row, sketch) in sketches.iter().enumerate() {
+            let mut union = HllUnion::new(10).unwrap();
+            union.merge_serialized(sketch.serialize().as_ref()).unwrap();
+            let merged = union.sketch(HllType::Hll8);
+            for tgt_type in TYPES {
+                let bytes = matrix.serialize_row(row, tgt_type);
+                let cpy = HllSketch::deserialize(bytes.as_ref()).unwrap();
+                assert!(cpy.target_type() == tgt_type);
+                assert_eq!(merged.estimate(), cpy.estimate());
+            }
+            let est = matrix.estimate(row);
+            let expected = row as f64 * n as f64 / rows as f64;
+            assert!((expected * 0.9..=expected * 1.1 + 1.0).contains(&est));
+        }
+    }
+
+    #[test]
+    fn matrix_merge() {
+        let mut whole = HllMatrix::new(8, 3).unwrap();
+        let mut left = HllMatrix::new(8, 2).unwrap();
+        let mut right = HllMatrix::new(8, 3).unwrap();
+        for key in 0u64..30 * 1000 {
+            let row = (key % 3) as u32;
+            let value = [key];
+            whole.update(row, value.as_byte_slice());
+            if key % 2 == 0 && row < 2 {
+                left.update(row, value.as_byte_slice());
+            } else {
+                right.update(row, value.as_byte_slice());
+            }
+        }
+        left.merge(&right).unwrap();
+        assert_eq!(3, left.num_rows());
+        for row in 0..3 {
+            assert_eq!(
+                whole.serialize_row(row, HllType::Hll4).as_ref(),
+                left.serialize_row(row, HllType::Hll4).as_ref()
+            );
+        }
+        assert!(left.merge(&HllMatrix::new(9, 1).unwrap()).is_err());
+        assert!(HllMatrix::new(3, 1).is_err());
+
+        left.reset();
+        left.add_rows(1);
+        assert_eq!(4, left.num_rows());
+        assert_eq!(0.0, left.estimate(3));
+    }
+
+    #[test]
+    fn matrix_on_huge_pages() {
+        // 1024 rows of 2^12 registers take two huge pages
+        let mut small_pages = HllMatrix::new(12, 1024).unwrap();
+        crate::set_huge_pages(true);
+        let mut huge_pages = HllMatrix::new(12, 1024).unwrap();
+        for key in 0u64..100 * 1000 {
+            let row = (key % 1024) as u32;
+            small_pages.update(row, [key].as_byte_slice());
+            huge_pages.update(row, [key].as_byte_slice());
+        }
+        // growing past the mapping moves the registers to a new one
+        huge_pages.add_rows(1024);
+        crate::set_huge_pages(false);
+        small_pages.merge(&huge_pages).unwrap();
+        assert_eq!(2048, small_pages.num_rows());
+        for row in [0, 511, 1023] {
+            assert_eq!(
+                huge_pages.serialize_row(row, HllType::Hll8).as_ref(),
+                small_pages.serialize_row(row, HllType::Hll8).as_ref()
+            );
+        }
+        assert_eq!(0.0, small_pages.estimate(2047));
+    }
+}
@@ -0,0 +1,111 @@
+//! Hashes of keys shared between sketches.
+
+use crate::bridge::ffi;
+pub use crate::bridge::ffi::KeyHash;
+use crate::profile::{self, Stage};
+use crate::wrapper::check_batch_ends;
+
+impl KeyHash {
+    /// Hashes `key` as the CPC, theta and HLL sketches' `update` does, so
+    /// that their `update_hashed` can take the hash in its place. Every
+    /// such sketch here hashes with the same seed, so one hash serves all
+    /// of them.
+    pub fn new(key: &[u8]) -> Self {
+        ffi::hash_key(key)
+    }
+
+    /// Appends to `hashes` the hash of each key packed into `buf`, as for
+    /// the sketches' `update_batch`: key `i` is `buf[ends[i - 1]..ends[i]]`,
+    /// where the first key starts at offset 0.
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn extend_batch(hashes: &mut Vec<Self>, buf: &[u8], ends: &[usize]) {
+        check_batch_ends(buf, ends);
+        let _hash = profile::span(Stage::Hash, buf.len());
+        let start = hashes.len();
+        hashes.resize(start + ends.len(), Self::default());
+        ffi::hash_keys(buf, ends, &mut hashes[start..])
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+    use crate::wrapper::{CpcSketch, HllSketch, HllType, ThetaSketch};
+
+    fn check_shared_hashes(keys: &[Vec<u8>]) {
+        let mut buf = Vec::new();
+        let mut ends = Vec::new();
+        for key in keys {
+            buf.extend_from_slice(key);
+            ends.push(buf.len());
+        }
+        let mut hashes = vec![KeyHash::new(b"already there")];
+        KeyHash::extend_batch(&mut hashes, &buf, &ends);
+        let hashes = &hashes[1..];
+        assert_eq!(hashes.len(), keys.len());
+
+        let mut cpc = CpcSketch::new();
+        let mut theta = ThetaSketch::new();
+        let mut hll = HllSketch::new(12, HllType::Hll4).unwrap();
+        let mut cpc_hashed = CpcSketch::new();
+        let mut theta_hashed = ThetaSketch::new();
+        let mut hll_hashed = HllSketch::new(12, HllType::Hll4).unwrap();
+        let mut cpc_batched = CpcSketch::new();
+        let mut theta_batched = ThetaSketch::new();
+        let mut hll_batched = HllSketch::new(12, HllType::Hll4).unwrap();
+        for (key, &hash) in keys.iter().zip(hashes) {
+            assert_eq!(KeyHash::new(key), hash);
+            cpc.update(key);
+            theta.update(key);
+            hll.update(key);
+            cpc_hashed.update_hashed(hash);
+            theta_hashed.update_hashed(hash);
+            hll_hashed.update_hashed(hash);
+        }
+        cpc_batched.update_hashed_batch(hashes);
+        theta_batched.update_hashed_batch(hashes);
+        hll_batched.update_hashed_batch(hashes);
+
+        for other in &[cpc_hashed, cpc_batched] {
+            assert_eq!(cpc.serialize().as_ref(), other.serialize().as_ref());
+        }
+        for other in &[theta_hashed, theta_batched] {
+            assert_eq!(
+                theta.as_static().serialize().as_ref(),
+                other.as_static().serialize().as_ref()
+            );
+        }
+        for other in &[hll_hashed, hll_batched] {
+            assert_eq!(
+                hll.serialize_updatable().as_ref(),
+                other.serialize_updatable().as_ref()
+            );
+        }
+    }
+
+    #[test]
+    fn hashed_updates_match_updates() {
+        let keys: Vec<_> = (0..20 * 1000)
+            .map(|i| format!("key{}", i % 15000).into_bytes())
+            .collect();
+        check_shared_hashes(&keys);
+        check_shared_hashes(&[]);
+        check_shared_hashes(&[Vec::new()]);
+    }
+
+    #[test]
+    fn hashed_16_byte_keys() {
+        // takes the batched 16-byte hash
+        let keys: Vec<_> = (0..5000u128)
+            .map(|i| (i * 7919).to_le_bytes().to_vec())
+            .collect();
+        check_shared_hashes(&keys);
+    }
+
+    #[test]
+    #[should_panic]
+    fn batch_bad_ends() {
+        KeyHash::extend_batch(&mut Vec::new(), &[1, 2, 3], &[2, 4]);
+    }
+}
@@ -0,0 +1,1014 @@
+//! Wrapper types for the KLL quantiles sketch.
+
+use std::marker::PhantomData;
+use std::sync::{Mutex, MutexGuard, PoisonError};
+
+use cxx;
+
+use crate::bridge::ffi;
+use crate::wrapper::{map_many, union_many, SerializedUnion};
+use crate::DataSketchesError;
+
+macro_rules! kll_sketch {
+    (
+        $(#[$doc:meta])* $name:ident,
+        $opaque:ident,
+        $(#[$wrapped_doc:meta])* $wrapped:ident,
+        $opaque_wrapped:ident,
+        $item:ty,
+        $new:ident,
+        $deserialize:ident,
+        $wrap:ident
+    ) => {
+        $(#[$doc])*
+        pub struct $name {
+            inner: cxx::UniquePtr<ffi::$opaque>,
+        }
+
+        impl $name {
+            /// Create a sketch of the empty stream with accuracy parameter
+            /// `k`. Its normalized rank error is about `1.65 / k`, so the
+            /// default of 200 gives 1.65%. Fails unless `8 <= k`.
+            pub fn new(k: u16) -> Result<Self, DataSketchesError> {
+                Ok(Self {
+                    inner: ffi::$new(k)?,
+                })
+            }
+
+            /// Return the accuracy parameter this sketch was created with.
+            pub fn k(&self) -> u16 {
+                self.inner.get_k()
+            }
+
+            /// Return the number of values seen, excluding NaNs.
+            pub fn n(&self) -> u64 {
+                self.inner.get_n()
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.inner.is_empty()
+            }
+
+            /// Return the number of values the sketch keeps to represent
+            /// the ones it has seen.
+            pub fn num_retained(&self) -> u32 {
+                self.inner.get_num_retained()
+            }
+
+            /// Returns the heap memory the sketch holds, in bytes: its
+            /// items, including room for more, and the sorted view that
+            /// queries build, until the next update drops it.
+            pub fn memory_usage_bytes(&self) -> usize {
+                self.inner.get_memory_usage_bytes()
+            }
+
+            /// Return whether the sketch has compacted any of the values
+            /// it saw, so its answers are approximate.
+            pub fn is_estimation_mode(&self) -> bool {
+                self.inner.is_estimation_mode()
+            }
+
+            /// Return the smallest value seen, or NaN if there were none.
+            pub fn min(&self) -> $item {
+                self.inner.get_min_value()
+            }
+
+            /// Return the largest value seen, or NaN if there were none.
+            pub fn max(&self) -> $item {
+                self.inner.get_max_value()
+            }
+
+            /// Return the normalized rank error of the sketch: that of
+            /// [`Self::pmf`] if `pmf` is set, and of the other queries
+            /// otherwise.
+            pub fn normalized_rank_error(&self, pmf: bool) -> f64 {
+                self.inner.get_normalized_rank_error(pmf)
+            }
+
+            /// Observe a new value. NaNs are ignored.
+            pub fn update(&mut self, value: $item) {
+                self.inner.pin_mut().update(value)
+            }
+
+            /// Observe each of `values` in turn, as [`Self::update`] does,
+            /// in one call across the bridge. The values are copied into
+            /// the sketch's lowest level in bulk between compactions.
+            pub fn update_batch(&mut self, values: &[$item]) {
+                self.inner.pin_mut().update_batch(values)
+            }
+
+            /// Merge in the values `other` has seen.
+            pub fn merge(&mut self, other: &Self) {
+                self.inner.pin_mut().merge(&other.inner)
+            }
+
+            /// Merge in the values the sketch `other` wraps. Equivalent to
+            /// merging its deserialization, without the copy. Fails if the
+            /// wrapped sketch was made with a different minimum level
+            /// width than this one.
+            pub fn merge_wrapped(&mut self, other: &$wrapped<'_>) -> Result<(), DataSketchesError> {
+                let other = other.inner.as_ref().expect("non-null");
+                Ok(self.inner.pin_mut().merge_wrapped(other)?)
+            }
+
+            /// Deserialize a sketch from `buf` and merge it in.
+            pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+                self.merge_all_serialized(&[buf])
+            }
+
+            /// Deserialize and merge in all of `serialized`. Runs of small
+            /// sketches are merged together, compressing the result once
+            /// per run instead of once per sketch. Nothing is merged if any
+            /// of them fails to deserialize.
+            pub fn merge_all_serialized(
+                &mut self,
+                serialized: &[&[u8]],
+            ) -> Result<(), DataSketchesError> {
+                let mut buf = Vec::with_capacity(serialized.iter().map(|s| s.len()).sum());
+                let ends: Vec<usize> = serialized
+                    .iter()
+                    .map(|s| {
+                        buf.extend_from_slice(s);
+                        buf.len()
+                    })
+                    .collect();
+                Ok(self.inner.pin_mut().merge_serialized(&buf, &ends)?)
+            }
+
+            /// Deserializes and merges all of `serialized` into a new
+            /// sketch with accuracy parameter `k` on `threads` threads.
+            /// Each thread merges its share with
+            /// [`Self::merge_all_serialized`] before the partial sketches
+            /// are merged pairwise.
+            ///
+            /// Panics if `threads` is 0.
+            pub fn merge_many(
+                k: u16,
+                serialized: &[&[u8]],
+                threads: usize,
+            ) -> Result<Self, DataSketchesError> {
+                Self::new(k)?;
+                union_many(serialized, threads, || Self::new(k).expect("valid k"))
+            }
+
+            /// Return the approximate value at normalized rank `fraction`,
+            /// such that about that fraction of the values seen are less
+            /// than it. Ranks 0 and 1 give the exact [`Self::min`] and
+            /// [`Self::max`], and an empty sketch gives NaN. Fails unless
+            /// `0 <= fraction <= 1`.
+            ///
+            /// The first query after an update sorts the retained values
+            /// once, and later queries reuse them until the next update
+            /// or merge, so asking many quantiles of the same sketch is
+            /// cheap.
+            pub fn quantile(&self, fraction: f64) -> Result<$item, DataSketchesError> {
+                Ok(self.inner.get_quantile(fraction)?)
+            }
+
+            /// Return the [`Self::quantile`] of each of `fractions`, which is
+            /// empty if the sketch is.
+            pub fn quantiles(&self, fractions: &[f64]) -> Result<Vec<$item>, DataSketchesError> {
+                Ok(self.inner.get_quantiles(fractions)?.iter().copied().collect())
+            }
+
+            /// Return the approximate fraction of the values seen which are
+            /// less than `value`, or NaN if the sketch is empty.
+            pub fn rank(&self, value: $item) -> f64 {
+                self.inner.get_rank(value)
+            }
+
+            /// Return the approximate fraction of the values seen less than
+            /// each of `split_points`, followed by 1. Fails unless the
+            /// split points are increasing and not NaN. Empty if the sketch
+            /// is.
+            pub fn cdf(&self, split_points: &[$item]) -> Result<Vec<f64>, DataSketchesError> {
+                Ok(self.inner.get_cdf(split_points)?.iter().copied().collect())
+            }
+
+            /// Return the approximate fraction of the values seen in each
+            /// of the intervals the `split_points` delimit, starting with
+            /// the values below the first and ending with those at or above
+            /// the last. The split points are checked as for [`Self::cdf`].
+            pub fn pmf(&self, split_points: &[$item]) -> Result<Vec<f64>, DataSketchesError> {
+                Ok(self.inner.get_pmf(split_points)?.iter().copied().collect())
+            }
+
+            /// Return the Kolmogorov-Smirnov distance between the
+            /// distributions this sketch and `other` summarize, the largest
+            /// difference between their approximate CDFs. It is found in
+            /// one pass over the sorted values of both, which are kept for
+            /// later queries as [`Self::quantile`] keeps them.
+            pub fn ks_delta(&self, other: &Self) -> f64 {
+                self.inner.ks_delta(&other.inner)
+            }
+
+            /// Return the [`Self::ks_delta`] past which [`Self::ks_test`]
+            /// rejects at p-value `p`, widened by the rank errors of both
+            /// sketches.
+            pub fn ks_threshold(&self, other: &Self, p: f64) -> f64 {
+                self.inner.ks_threshold(&other.inner, p)
+            }
+
+            /// Return whether the Kolmogorov-Smirnov test rejects, at
+            /// p-value `p`, typically 0.001 to 0.1, the hypothesis that this
+            /// sketch and `other` summarize the same distribution. Sketches
+            /// of too few values never reject it.
+            pub fn ks_test(&self, other: &Self, p: f64) -> bool {
+                self.inner.ks_test(&other.inner, p)
+            }
+
+            /// Return [`Self::ks_test`] of each of `pairs`, in order, on
+            /// `threads` threads, which claim chunks of pairs from a shared
+            /// cursor. A sketch in many pairs sorts its values once for all
+            /// of them.
+            ///
+            /// Panics if `threads` is 0.
+            pub fn ks_test_many(pairs: &[(&Self, &Self)], p: f64, threads: usize) -> Vec<bool> {
+                map_many(pairs, threads, |(a, b)| Ok(a.ks_test(b, p)))
+                    .expect("tests do not fail")
+            }
+
+            pub fn serialize(&self) -> impl AsRef<[u8]> {
+                struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+                impl AsRef<[u8]> for UPtrVec {
+                    fn as_ref(&self) -> &[u8] {
+                        self.0.as_slice()
+                    }
+                }
+                UPtrVec(self.inner.serialize())
+            }
+
+            pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+                Ok(Self {
+                    inner: ffi::$deserialize(buf)?,
+                })
+            }
+        }
+
+        impl SerializedUnion for $name {
+            type Sketch = Self;
+
+            fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+                $name::merge_serialized(self, buf)
+            }
+
+            fn merge_all_serialized(&mut self, bufs: &[&[u8]]) -> Result<(), DataSketchesError> {
+                $name::merge_all_serialized(self, bufs)
+            }
+
+            fn merge_sketch(&mut self, sketch: Self) {
+                self.merge(&sketch)
+            }
+
+            fn result(&self) -> Self {
+                self.clone()
+            }
+        }
+
+        impl Clone for $name {
+            fn clone(&self) -> Self {
+                Self {
+                    inner: self.inner.clone(),
+                }
+            }
+        }
+
+        $(#[$wrapped_doc])*
+        pub struct $wrapped<'a> {
+            inner: cxx::UniquePtr<ffi::$opaque_wrapped>,
+            buf: PhantomData<&'a [u8]>,
+        }
+
+        impl<'a> $wrapped<'a> {
+            /// Wrap a serialized sketch, which is validated the same way
+            /// deserializing it does.
+            pub fn wrap(buf: &'a [u8]) -> Result<Self, DataSketchesError> {
+                // Safety: the view cannot outlive 'a, and so the bytes it points into.
+                let inner = unsafe { ffi::$wrap(buf)? };
+                Ok(Self {
+                    inner,
+                    buf: PhantomData,
+                })
+            }
+
+            /// Return the number of values the wrapped sketch saw.
+            pub fn n(&self) -> u64 {
+                self.inner.get_n()
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.inner.is_empty()
+            }
+
+            /// Return the number of values the wrapped sketch retains.
+            pub fn num_retained(&self) -> u32 {
+                self.inner.get_num_retained()
+            }
+
+            /// Return the smallest value seen, or NaN if there were none.
+            pub fn min(&self) -> $item {
+                self.inner.get_min_value()
+            }
+
+            /// Return the largest value seen, or NaN if there were none.
+            pub fn max(&self) -> $item {
+                self.inner.get_max_value()
+            }
+
+            /// Return the same value as the `quantile` of the deserialized
+            /// sketch. Rather than sorting the retained values,
+            /// each query narrows the answer down by counting the values
+            /// below a candidate in every level, so it allocates nothing
+            /// but costs more than a query of a sketch that has sorted
+            /// them once.
+            pub fn quantile(&self, fraction: f64) -> Result<$item, DataSketchesError> {
+                Ok(self.inner.get_quantile(fraction)?)
+            }
+
+            /// Return the same rank as the `rank` of the deserialized
+            /// sketch, from a binary search of each sorted level.
+            pub fn rank(&self, value: $item) -> f64 {
+                self.inner.get_rank(value)
+            }
+        }
+    };
+}
+
+kll_sketch!(
+    /// The [KLL][orig-docs] sketch summarizes a stream of `f64` values so
+    /// that it can answer quantile and rank queries with a bounded
+    /// normalized rank error, like "what is the 99th percentile latency?".
+    ///
+    /// [orig-docs]: https://datasketches.apache.org/docs/KLL/KLLSketch.html
+    KllDoubleSketch,
+    OpaqueKllDoubleSketch,
+    /// A read-only view of a serialized [`KllDoubleSketch`], which reads its
+    /// levels straight out of the borrowed bytes rather than copying them.
+    /// The bytes need not be aligned, so this works directly on slices of a
+    /// larger buffer such as a memory-mapped file.
+    ///
+    /// Use it where a sketch is only queried a few times or merged once,
+    /// e.g. with [`KllDoubleSketch::merge_wrapped`], to skip
+    /// [`KllDoubleSketch::deserialize`]'s allocation and copy.
+    WrappedKllDoubleSketch,
+    OpaqueWrappedKllDoubleSketch,
+    f64,
+    new_opaque_kll_double_sketch,
+    deserialize_opaque_kll_double_sketch,
+    wrap_opaque_kll_double_sketch
+);
+
+kll_sketch!(
+    /// A [`KllDoubleSketch`] of `f32` values, which retains them in half
+    /// the memory.
+    KllFloatSketch,
+    OpaqueKllFloatSketch,
+    /// A [`WrappedKllDoubleSketch`] of a serialized [`KllFloatSketch`].
+    WrappedKllFloatSketch,
+    OpaqueWrappedKllFloatSketch,
+    f32,
+    new_opaque_kll_float_sketch,
+    deserialize_opaque_kll_float_sketch,
+    wrap_opaque_kll_float_sketch
+);
+
+macro_rules! kll_integer_sketch {
+    ($(#[$doc:meta])* $name:ident, $opaque:ident, $item:ty, $new:ident, $deserialize:ident) => {
+        $(#[$doc])*
+        pub struct $name {
+            inner: cxx::UniquePtr<ffi::$opaque>,
+        }
+
+        impl $name {
+            /// Create a sketch of the empty stream with accuracy parameter
+            /// `k`, as for [`KllDoubleSketch::new`].
+            pub fn new(k: u16) -> Result<Self, DataSketchesError> {
+                Ok(Self {
+                    inner: ffi::$new(k)?,
+                })
+            }
+
+            /// Return the accuracy parameter this sketch was created with.
+            pub fn k(&self) -> u16 {
+                self.inner.get_k()
+            }
+
+            /// Return the number of values seen.
+            pub fn n(&self) -> u64 {
+                self.inner.get_n()
+            }
+
+            pub fn is_empty(&self) -> bool {
+                self.inner.is_empty()
+            }
+
+            /// Return the number of values the sketch keeps to represent
+            /// the ones it has seen.
+            pub fn num_retained(&self) -> u32 {
+                self.inner.get_num_retained()
+            }
+
+            /// Returns the heap memory the sketch holds, in bytes, as for
+            /// [`KllDoubleSketch::memory_usage_bytes`].
+            pub fn memory_usage_bytes(&self) -> usize {
+                self.inner.get_memory_usage_bytes()
+            }
+
+            /// Return whether the sketch has compacted any of the values
+            /// it saw, so its answers are approximate.
+            pub fn is_estimation_mode(&self) -> bool {
+                self.inner.is_estimation_mode()
+            }
+
+            /// Return the smallest value seen, if any.
+            pub fn min(&self) -> Option<$item> {
+                if self.is_empty() {
+                    return None;
+                }
+                Some(self.inner.get_min_value())
+            }
+
+            /// Return the largest value seen, if any.
+            pub fn max(&self) -> Option<$item> {
+                if self.is_empty() {
+                    return None;
+                }
+                Some(self.inner.get_max_value())
+            }
+
+            /// Return the normalized rank error of the sketch, as for
+            /// [`KllDoubleSketch::normalized_rank_error`].
+            pub fn normalized_rank_error(&self, pmf: bool) -> f64 {
+                self.inner.get_normalized_rank_error(pmf)
+            }
+
+            /// Observe a new value.
+            pub fn update(&mut self, value: $item) {
+                self.inner.pin_mut().update(value)
+            }
+
+            /// Observe each of `values` in turn, in one call across the
+            /// bridge.
+            pub fn update_batch(&mut self, values: &[$item]) {
+                self.inner.pin_mut().update_batch(values)
+            }
+
+            /// Merge in the values `other` has seen.
+            pub fn merge(&mut self, other: &Self) {
+                self.inner.pin_mut().merge(&other.inner)
+            }
+
+            /// Deserialize a sketch from `buf` and merge it in.
+            pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+                self.merge_all_serialized(&[buf])
+            }
+
+            /// Deserialize and merge in all of `serialized`, as
+            /// [`KllDoubleSketch::merge_all_serialized`] does.
+            pub fn merge_all_serialized(
+                &mut self,
+                serialized: &[&[u8]],
+            ) -> Result<(), DataSketchesError> {
+                let mut buf = Vec::with_capacity(serialized.iter().map(|s| s.len()).sum());
+                let ends: Vec<usize> = serialized
+                    .iter()
+                    .map(|s| {
+                        buf.extend_from_slice(s);
+                        buf.len()
+                    })
+                    .collect();
+                Ok(self.inner.pin_mut().merge_serialized(&buf, &ends)?)
+            }
+
+            /// Return the approximate value at normalized rank `fraction`,
+            /// as [`KllDoubleSketch::quantile`] does, or `None` if the
+            /// sketch is empty. Fails unless `0 <= fraction <= 1`.
+            pub fn quantile(&self, fraction: f64) -> Result<Option<$item>, DataSketchesError> {
+                let quantile = self.inner.get_quantile(fraction)?;
+                Ok(if self.is_empty() { None } else { Some(quantile) })
+            }
+
+            /// Return the [`Self::quantile`] of each of `fractions`, which is
+            /// empty if the sketch is.
+            pub fn quantiles(&self, fractions: &[f64]) -> Result<Vec<$item>, DataSketchesError> {
+                Ok(self.inner.get_quantiles(fractions)?.iter().copied().collect())
+            }
+
+            /// Return the approximate fraction of the values seen which are
+            /// less than `value`, or NaN if the sketch is empty.
+            pub fn rank(&self, value: $item) -> f64 {
+                self.inner.get_rank(value)
+            }
+
+            /// Return the approximate fraction of the values seen less than
+            /// each of `split_points`, followed by 1. Fails unless the
+            /// split points are increasing. Empty if the sketch is.
+            pub fn cdf(&self, split_points: &[$item]) -> Result<Vec<f64>, DataSketchesError> {
+                Ok(self.inner.get_cdf(split_points)?.iter().copied().collect())
+            }
+
+            /// Return the approximate fraction of the values seen in each
+            /// of the intervals the `split_points` delimit, as
+            /// [`KllDoubleSketch::pmf`] does.
+            pub fn pmf(&self, split_points: &[$item]) -> Result<Vec<f64>, DataSketchesError> {
+                Ok(self.inner.get_pmf(split_points)?.iter().copied().collect())
+            }
+
+            /// Serialize the sketch in the format of the other KLL sketches,
+            /// with each value in its full width.
+            pub fn serialize(&self) -> impl AsRef<[u8]> {
+                struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+                impl AsRef<[u8]> for UPtrVec {
+                    fn as_ref(&self) -> &[u8] {
+                        self.0.as_slice()
+                    }
+                }
+                UPtrVec(self.inner.serialize())
+            }
+
+            /// Like [`Self::serialize`], but writes each level sorted, as
+            /// varint-encoded differences between consecutive values, so
+            /// values of similar magnitude take a byte or two each instead
+            /// of their full width. Empty sketches, ones of a single value
+            /// and ones whose values spread too widely for this to save
+            /// space are serialized as by [`Self::serialize`].
+            ///
+            /// [`Self::deserialize`] reads either form. Other DataSketches
+            /// libraries do not read the compressed one, which is marked
+            /// by a serial version none of them uses.
+            pub fn serialize_compressed(&self) -> impl AsRef<[u8]> {
+                struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+                impl AsRef<[u8]> for UPtrVec {
+                    fn as_ref(&self) -> &[u8] {
+                        self.0.as_slice()
+                    }
+                }
+                UPtrVec(self.inner.serialize_compressed())
+            }
+
+            /// Deserialize the output of [`Self::serialize`] or
+            /// [`Self::serialize_compressed`].
+            pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+                Ok(Self {
+                    inner: ffi::$deserialize(buf)?,
+                })
+            }
+        }
+
+        impl Clone for $name {
+            fn clone(&self) -> Self {
+                Self {
+                    inner: self.inner.clone(),
+                }
+            }
+        }
+    };
+}
+
+kll_integer_sketch!(
+    /// A KLL sketch of `u64` values, for integer metrics like byte counts
+    /// or microseconds, which answers the same queries as a
+    /// [`KllDoubleSketch`] without rounding values past 2^53.
+    ///
+    /// Its levels are sorted by radix on the values' bits, and
+    /// [`Self::serialize_compressed`] stores them as varint-encoded
+    /// differences, which for values of similar magnitude takes a fraction
+    /// of the bytes of [`Self::serialize`].
+    KllU64Sketch,
+    OpaqueKllU64Sketch,
+    u64,
+    new_opaque_kll_u64_sketch,
+    deserialize_opaque_kll_u64_sketch
+);
+
+kll_integer_sketch!(
+    /// A [`KllU64Sketch`] of `u32` values, which retains them in half the
+    /// memory.
+    KllU32Sketch,
+    OpaqueKllU32Sketch,
+    u32,
+    new_opaque_kll_u32_sketch,
+    deserialize_opaque_kll_u32_sketch
+);
+
+/// Values each buffer of a concurrent KLL sketch collects before flushing
+/// them.
+const KLL_BUFFER_CAPACITY: usize = 4096;
+
+macro_rules! concurrent_kll_sketch {
+    ($(#[$doc:meta])* $name:ident, $buffer:ident, $sketch:ident, $item:ty) => {
+        $(#[$doc])*
+        pub struct $name {
+            inner: Mutex<$sketch>,
+        }
+
+        impl $name {
+            /// Create a concurrent sketch of the empty stream with
+            /// accuracy parameter `k`, as for the sketch it wraps.
+            pub fn new(k: u16) -> Result<Self, DataSketchesError> {
+                Ok(Self {
+                    inner: Mutex::new($sketch::new(k)?),
+                })
+            }
+
+            /// Create a new buffer for updating this sketch from one
+            /// thread.
+            pub fn buffer(&self) -> $buffer<'_> {
+                $buffer {
+                    sketch: self,
+                    values: Vec::with_capacity(KLL_BUFFER_CAPACITY),
+                }
+            }
+
+            /// Return a copy of the values flushed so far, to query.
+            pub fn sketch(&self) -> $sketch {
+                self.lock().clone()
+            }
+
+            /// Return the values flushed so far, once no buffers are left.
+            pub fn into_inner(self) -> $sketch {
+                self.inner
+                    .into_inner()
+                    .unwrap_or_else(PoisonError::into_inner)
+            }
+
+            // A sketch stays valid even if a thread panicked while holding it.
+            fn lock(&self) -> MutexGuard<'_, $sketch> {
+                self.inner.lock().unwrap_or_else(PoisonError::into_inner)
+            }
+        }
+
+        /// A single-threaded handle for updating a concurrent KLL sketch,
+        /// see there. Values still buffered are flushed when this is
+        /// dropped.
+        pub struct $buffer<'a> {
+            sketch: &'a $name,
+            values: Vec<$item>,
+        }
+
+        impl $buffer<'_> {
+            /// Observe a new value. NaNs are ignored.
+            pub fn update(&mut self, value: $item) {
+                self.values.push(value);
+                if self.values.len() >= KLL_BUFFER_CAPACITY {
+                    self.flush();
+                }
+            }
+
+            /// Flush all buffered values into the shared sketch.
+            pub fn flush(&mut self) {
+                if self.values.is_empty() {
+                    return;
+                }
+                self.sketch.lock().update_batch(&self.values);
+                self.values.clear();
+            }
+        }
+
+        impl Drop for $buffer<'_> {
+            fn drop(&mut self) {
+                self.flush()
+            }
+        }
+    };
+}
+
+concurrent_kll_sketch!(
+    /// A [`KllDoubleSketch`] which many threads can update at once, e.g. to
+    /// record request latencies from every worker. Each thread updates
+    /// through its own [`KllDoubleBuffer`], which appends values to a
+    /// local array without locking. Once that holds a few thousand, they
+    /// are copied into the shared sketch's lowest level with one
+    /// [`KllDoubleSketch::update_batch`], so only the flush takes a lock.
+    ///
+    /// As for [`ConcurrentThetaSketch`](crate::ConcurrentThetaSketch),
+    /// queries of [`Self::sketch`] only reflect values whose buffers have
+    /// flushed them; call [`KllDoubleBuffer::flush`] (or drop the buffer)
+    /// to catch up.
+    ConcurrentKllDoubleSketch,
+    KllDoubleBuffer,
+    KllDoubleSketch,
+    f64
+);
+
+concurrent_kll_sketch!(
+    /// A [`ConcurrentKllDoubleSketch`] of `f32` values.
+    ConcurrentKllFloatSketch,
+    KllFloatBuffer,
+    KllFloatSketch,
+    f32
+);
+
+#[cfg(test)]
+mod tests {
+    use std::thread;
+
+    use super::*;
+
+    #[test]
+    fn exact_quantiles() {
+        let mut kll = KllDoubleSketch::new(200).unwrap();
+        assert!(kll.quantile(0.5).unwrap().is_nan());
+        assert!(kll.quantiles(&[0.5]).unwrap().is_empty());
+        let values: Vec<f64> = (1..=100).map(f64::from).collect();
+        kll.update_batch(&values);
+        kll.update(f64::NAN);
+        assert_eq!(kll.n(), 100);
+        assert!(!kll.is_estimation_mode());
+        assert_eq!(kll.min(), 1.0);
+        assert_eq!(kll.max(), 100.0);
+        assert_eq!(kll.quantile(0.5).unwrap(), 51.0);
+        assert_eq!(
+            kll.quantiles(&[0.0, 0.25, 1.0]).unwrap(),
+            vec![1.0, 26.0, 100.0]
+        );
+        assert_eq!(kll.rank(51.0), 0.5);
+        assert_eq!(kll.cdf(&[11.0, 51.0]).unwrap(), vec![0.1, 0.5, 1.0]);
+        assert_eq!(kll.pmf(&[11.0, 51.0]).unwrap(), vec![0.1, 0.4, 0.5]);
+        assert!(kll.quantile(1.5).is_err());
+        assert!(kll.cdf(&[2.0, 1.0]).is_err());
+
+        // the cached view is dropped on update
+        kll.update_batch(&values);
+        assert_eq!(kll.n(), 200);
+        assert_eq!(kll.rank(51.0), 0.5);
+        kll.update(0.0);
+        assert_eq!(kll.quantile(0.0).unwrap(), 0.0);
+    }
+
+    #[test]
+    fn approximate_quantiles() {
+        let n = 1000 * 1000;
+        let mut kll = KllFloatSketch::new(200).unwrap();
+        let values: Vec<f32> = (0..n).map(|i| i as f32).collect();
+        values
+            .chunks(4096)
+            .for_each(|chunk| kll.update_batch(chunk));
+        assert!(kll.is_estimation_mode());
+        let eps = kll.normalized_rank_error(false);
+        for &fraction in &[0.01, 0.5, 0.99, 0.999] {
+            let quantile = kll.quantile(fraction).unwrap();
+            let rank = quantile as f64 / n as f64;
+            assert!((rank - fraction).abs() <= eps, "{} {}", fraction, rank);
+            assert_eq!(kll.rank(quantile), kll.cdf(&[quantile]).unwrap()[0]);
+        }
+    }
+
+    #[test]
+    fn merge_and_serialize() {
+        let mut a = KllDoubleSketch::new(100).unwrap();
+        let mut b = KllDoubleSketch::new(100).unwrap();
+        for i in 0..10000 {
+            a.update(i as f64);
+            b.update((i + 10000) as f64);
+        }
+        let before = a.quantile(0.5).unwrap();
+        a.merge(&b);
+        assert_eq!(a.n(), 20000);
+        assert!(a.quantile(0.5).unwrap() > before);
+        let bytes = a.serialize();
+        let cycled = KllDoubleSketch::deserialize(bytes.as_ref()).unwrap();
+        assert_eq!(cycled.n(), a.n());
+        let fractions: Vec<f64> = (0..=50).map(|i| i as f64 / 50.0).collect();
+        assert_eq!(
+            cycled.quantiles(&fractions).unwrap(),
+            a.quantiles(&fractions).unwrap()
+        );
+        assert_eq!(a.clone().serialize().as_ref(), bytes.as_ref());
+        assert!(KllDoubleSketch::deserialize(&bytes.as_ref()[..16]).is_err());
+        assert!(KllFloatSketch::new(1).is_err());
+    }
+
+    #[test]
+    fn seeded_compactions_repeat() {
+        let compacted = |seed| {
+            crate::seed_thread_compaction_rng(seed);
+            let mut kll = KllFloatSketch::new(100).unwrap();
+            (0..100 * 1000).for_each(|i| kll.update(((i * 7919) % 100_000) as f32));
+            kll.serialize().as_ref().to_vec()
+        };
+        assert_eq!(compacted(42), compacted(42));
+        assert_ne!(compacted(42), compacted(43));
+    }
+
+    #[test]
+    fn wrapped() {
+        let mut kll = KllDoubleSketch::new(200).unwrap();
+        let values: Vec<f64> = (0..100_000)
+            .map(|i| ((i * 7919) % 100_000) as f64)
+            .collect();
+        kll.update_batch(&values);
+        let bytes = kll.serialize();
+        // misaligned, as a slice of a larger buffer would be
+        let mut buf = vec![0u8];
+        buf.extend_from_slice(bytes.as_ref());
+        let wrapped = WrappedKllDoubleSketch::wrap(&buf[1..]).unwrap();
+        assert_eq!(wrapped.n(), kll.n());
+        assert_eq!(wrapped.num_retained(), kll.num_retained());
+        assert_eq!(wrapped.min(), 0.0);
+        assert_eq!(wrapped.max(), 99_999.0);
+        for i in 0..=100 {
+            let fraction = i as f64 / 100.0;
+            assert_eq!(
+                wrapped.quantile(fraction).unwrap(),
+                kll.quantile(fraction).unwrap()
+            );
+            let value = (i * 1000) as f64;
+            assert_eq!(wrapped.rank(value), kll.rank(value));
+        }
+        assert!(wrapped.quantile(1.5).is_err());
+
+        // compaction is randomized, so only the bounds are exact
+        let mut merged = KllDoubleSketch::new(200).unwrap();
+        merged.update(-1.0);
+        merged.merge_wrapped(&wrapped).unwrap();
+        assert_eq!(merged.n(), kll.n() + 1);
+        assert_eq!(merged.min(), -1.0);
+        assert_eq!(merged.max(), 99_999.0);
+        let rank = merged.quantile(0.5).unwrap() / 100_000.0;
+        assert!((rank - 0.5).abs() <= merged.normalized_rank_error(false));
+        assert!(WrappedKllDoubleSketch::wrap(&bytes.as_ref()[..16]).is_err());
+
+        let empty = KllFloatSketch::new(200).unwrap().serialize();
+        let wrapped = WrappedKllFloatSketch::wrap(empty.as_ref()).unwrap();
+        assert!(wrapped.is_empty());
+        assert!(wrapped.quantile(0.5).unwrap().is_nan());
+    }
+
+    #[test]
+    fn integer_sketches() {
+        let mut kll = KllU64Sketch::new(200).unwrap();
+        assert_eq!(kll.min(), None);
+        assert_eq!(kll.quantile(0.5).unwrap(), None);
+        assert!(kll.rank(1).is_nan());
+        let empty = kll.serialize_compressed();
+        assert_eq!(empty.as_ref(), kll.serialize().as_ref());
+        assert!(KllU64Sketch::deserialize(empty.as_ref())
+            .unwrap()
+            .is_empty());
+
+        // microsecond latencies around a second, past what an f64 holds exactly
+        let base = 1u64 << 60;
+        let values: Vec<u64> = (0..1_000_000u64)
+            .map(|i| base + (i * 7919) % 1_000_000)
+            .collect();
+        kll.update_batch(&values);
+        assert_eq!(kll.n(), 1_000_000);
+        assert_eq!(kll.min(), Some(base));
+        assert_eq!(kll.max(), Some(base + 999_999));
+        let eps = kll.normalized_rank_error(false);
+        for &fraction in &[0.1, 0.5, 0.9] {
+            let quantile = kll.quantile(fraction).unwrap().unwrap();
+            let rank = (quantile - base) as f64 / 1e6;
+            assert!((rank - fraction).abs() <= eps, "{} {}", fraction, rank);
+        }
+
+        let plain = kll.serialize();
+        let compressed = kll.serialize_compressed();
+        assert!(compressed.as_ref().len() < plain.as_ref().len() / 2);
+        let fractions: Vec<f64> = (0..=50).map(|i| i as f64 / 50.0).collect();
+        for buf in &[plain.as_ref(), compressed.as_ref()] {
+            let cycled = KllU64Sketch::deserialize(buf).unwrap();
+            assert_eq!(cycled.n(), kll.n());
+            assert_eq!(
+                cycled.quantiles(&fractions).unwrap(),
+                kll.quantiles(&fractions).unwrap()
+            );
+        }
+        let cut = compressed.as_ref().len() - 1;
+        assert!(KllU64Sketch::deserialize(&compressed.as_ref()[..cut]).is_err());
+        assert!(KllDoubleSketch::deserialize(compressed.as_ref()).is_err());
+        assert!(WrappedKllDoubleSketch::wrap(compressed.as_ref()).is_err());
+
+        let mut small = KllU32Sketch::new(200).unwrap();
+        small.update_batch(&[3, 1, 2]);
+        let mut other = small.clone();
+        other
+            .merge_serialized(small.serialize_compressed().as_ref())
+            .unwrap();
+        assert_eq!(other.n(), 6);
+        assert_eq!(other.quantile(0.5).unwrap(), Some(2));
+        assert_eq!(other.cdf(&[2]).unwrap(), vec![1.0 / 3.0, 1.0]);
+    }
+
+    #[test]
+    fn kolmogorov_smirnov() {
+        let sketch = |offset: usize| {
+            let mut kll = KllDoubleSketch::new(200).unwrap();
+            let values: Vec<f64> = (0..10_000).map(|i| (i + offset) as f64).collect();
+            kll.update_batch(&values);
+            kll
+        };
+        let base = sketch(0);
+        let same = base.clone();
+        let shifted = sketch(5000);
+        assert_eq!(base.ks_delta(&same), 0.0);
+        assert!(!base.ks_test(&same, 0.05));
+        assert!((base.ks_delta(&shifted) - 0.5).abs() < 0.05);
+        assert!(base.ks_delta(&shifted) > base.ks_threshold(&shifted, 0.05));
+        assert!(base.ks_test(&shifted, 0.05));
+
+        // more pairs than one thread's chunk, sharing their sketches
+        let pairs: Vec<(&KllDoubleSketch, &KllDoubleSketch)> = (0..300)
+            .map(|i| {
+                if i % 3 == 0 {
+                    (&base, &shifted)
+                } else {
+                    (&base, &same)
+                }
+            })
+            .collect();
+        for &threads in &[1, 4] {
+            let rejected = KllDoubleSketch::ks_test_many(&pairs, 0.05, threads);
+            let expected: Vec<bool> = (0..300).map(|i| i % 3 == 0).collect();
+            assert_eq!(rejected, expected);
+        }
+    }
+
+    #[test]
+    fn concurrent() {
+        let n = 100_000;
+        let concurrent = ConcurrentKllDoubleSketch::new(200).unwrap();
+        thread::scope(|scope| {
+            for t in 0..4 {
+                let concurrent = &concurrent;
+                scope.spawn(move || {
+                    let mut buffer = concurrent.buffer();
+                    (t..n).step_by(4).for_each(|i| buffer.update(i as f64));
+                    buffer.update(f64::NAN);
+                });
+            }
+        });
+        let kll = concurrent.sketch();
+        assert_eq!(kll.n(), n as u64);
+        assert_eq!(kll.min(), 0.0);
+        assert_eq!(kll.max(), (n - 1) as f64);
+        let eps = kll.normalized_rank_error(false);
+        for &fraction in &[0.1, 0.5, 0.9] {
+            let rank = kll.quantile(fraction).unwrap() / n as f64;
+            assert!((rank - fraction).abs() <= eps, "{} {}", fraction, rank);
+        }
+
+        // values are only seen once flushed
+        let concurrent = ConcurrentKllFloatSketch::new(200).unwrap();
+        let mut buffer = concurrent.buffer();
+        buffer.update(1.0);
+        assert!(concurrent.sketch().is_empty());
+        buffer.flush();
+        assert_eq!(concurrent.sketch().n(), 1);
+        buffer.update(2.0);
+        drop(buffer);
+        assert_eq!(concurrent.into_inner().max(), 2.0);
+        assert!(ConcurrentKllFloatSketch::new(1).is_err());
+    }
+
+    #[test]
+    fn merge_many_serialized() {
+        // small sketches, which merge in groups, then ones in estimation mode
+        for &size in &[50, 5000] {
+            let serialized: Vec<Vec<u8>> = (0..600)
+                .map(|i| {
+                    let mut kll = KllDoubleSketch::new(200).unwrap();
+                    let values: Vec<f64> = (0..size).map(|j| (i * size + j) as f64).collect();
+                    kll.update_batch(&values);
+                    kll.serialize().as_ref().to_vec()
+                })
+                .collect();
+            let slices: Vec<&[u8]> = serialized.iter().map(|buf| buf.as_slice()).collect();
+            let n = 600 * size as u64;
+
+            let mut folded = KllDoubleSketch::new(200).unwrap();
+            for buf in &slices {
+                folded.merge(&KllDoubleSketch::deserialize(buf).unwrap());
+            }
+            let mut batched = KllDoubleSketch::new(200).unwrap();
+            batched.merge_all_serialized(&slices).unwrap();
+            let mut merged = vec![folded, batched];
+            for &threads in &[1, 3, 8] {
+                merged.push(KllDoubleSketch::merge_many(200, &slices, threads).unwrap());
+            }
+            for kll in &merged {
+                assert_eq!(kll.n(), n);
+                assert_eq!(kll.min(), 0.0);
+                assert_eq!(kll.max(), (n - 1) as f64);
+                let eps = kll.normalized_rank_error(false);
+                for &fraction in &[0.1, 0.5, 0.9] {
+                    let rank = kll.quantile(fraction).unwrap() / n as f64;
+                    assert!((rank - fraction).abs() <= eps, "{} {}", fraction, rank);
+                }
+            }
+        }
+
+        let mut kll = KllFloatSketch::new(200).unwrap();
+        kll.update(1.0);
+        let other = kll.serialize();
+        assert!(kll
+            .merge_all_serialized(&[other.as_ref(), &[9, 9, 9, 9]])
+            .is_err());
+        assert_eq!(kll.n(), 1);
+        kll.merge_serialized(other.as_ref()).unwrap();
+        assert_eq!(kll.n(), 2);
+        assert!(KllFloatSketch::merge_many(0, &[], 4).is_err());
+        assert!(KllFloatSketch::merge_many(200, &[], 4).unwrap().is_empty());
+    }
+}
@@ -0,0 +1,395 @@
+//! Wrapper type for the REQ relative-error quantiles sketch.
+
+use std::marker::PhantomData;
+
+use cxx;
+
+use crate::bridge::ffi;
+use crate::DataSketchesError;
+
+/// The [REQ][orig-docs] sketch summarizes a stream of `f32` values to answer
+/// quantile and rank queries, like [`crate::KllFloatSketch`], but with an
+/// error relative to the distance from one end of the rank range instead
+/// of a fixed one.
+///
+/// In high rank accuracy (HRA) mode the error shrinks toward rank 1, so
+/// the tail quantiles behind latency objectives, like p99.9 and p99.99,
+/// are the most accurate. In low rank accuracy (LRA) mode the error
+/// shrinks toward rank 0 instead.
+///
+/// [orig-docs]: https://datasketches.apache.org/docs/REQ/ReqSketch.html
+pub struct ReqSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueReqSketch>,
+}
+
+impl ReqSketch {
+    /// Create a sketch of the empty stream with accuracy parameter `k`,
+    /// accurate toward rank 1 if `hra` is set and toward rank 0 otherwise.
+    /// The default `k` of 12 gives a relative rank error of about 1%.
+    /// Fails unless `k` is even and `4 <= k <= 1024`.
+    pub fn new(k: u16, hra: bool) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_req_sketch(k, hra)?,
+        })
+    }
+
+    /// Return the accuracy parameter this sketch was created with.
+    pub fn k(&self) -> u16 {
+        self.inner.get_k()
+    }
+
+    /// Return whether the sketch is in high rank accuracy mode.
+    pub fn is_hra(&self) -> bool {
+        self.inner.is_hra()
+    }
+
+    /// Return the number of values seen, excluding NaNs.
+    pub fn n(&self) -> u64 {
+        self.inner.get_n()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.inner.is_empty()
+    }
+
+    /// Return the number of values the sketch keeps to represent the ones
+    /// it has seen.
+    pub fn num_retained(&self) -> u32 {
+        self.inner.get_num_retained()
+    }
+
+    /// Returns the heap memory the sketch holds in its compactors, in
+    /// bytes, including room for more items, and the sorted view that
+    /// queries build, until the next update drops it.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.inner.get_memory_usage_bytes()
+    }
+
+    /// Return whether the sketch has compacted any of the values it saw,
+    /// so its answers are approximate.
+    pub fn is_estimation_mode(&self) -> bool {
+        self.inner.is_estimation_mode()
+    }
+
+    /// Return the smallest value seen, or NaN if there were none.
+    pub fn min(&self) -> f32 {
+        self.inner.get_min_value()
+    }
+
+    /// Return the largest value seen, or NaN if there were none.
+    pub fn max(&self) -> f32 {
+        self.inner.get_max_value()
+    }
+
+    /// Observe a new value. NaNs are ignored.
+    pub fn update(&mut self, value: f32) {
+        self.inner.pin_mut().update(value)
+    }
+
+    /// Observe each of `values` in turn, as [`Self::update`] does, in one
+    /// call across the bridge. The values are appended to the sketch's
+    /// lowest level in bulk between compactions, and each compaction only
+    /// sorts the ones appended since the last.
+    pub fn update_batch(&mut self, values: &[f32]) {
+        self.inner.pin_mut().update_batch(values)
+    }
+
+    /// Merge in the values `other` has seen. Fails unless both sketches
+    /// are in the same mode.
+    pub fn merge(&mut self, other: &Self) -> Result<(), DataSketchesError> {
+        Ok(self.inner.pin_mut().merge(&other.inner)?)
+    }
+
+    /// Merge in the values the sketch `other` wraps. Equivalent to merging
+    /// its deserialization, without the copy, and fails as [`Self::merge`]
+    /// does.
+    pub fn merge_wrapped(&mut self, other: &WrappedReqSketch<'_>) -> Result<(), DataSketchesError> {
+        let other = other.inner.as_ref().expect("non-null");
+        Ok(self.inner.pin_mut().merge_wrapped(other)?)
+    }
+
+    /// Return the approximate value at normalized rank `fraction`, such
+    /// that about that fraction of the values seen are less than it. Ranks
+    /// 0 and 1 give the exact [`Self::min`] and [`Self::max`], and an empty
+    /// sketch gives NaN. Fails unless `0 <= fraction <= 1`.
+    pub fn quantile(&self, fraction: f64) -> Result<f32, DataSketchesError> {
+        Ok(self.inner.get_quantile(fraction)?)
+    }
+
+    /// Return the [`Self::quantile`] of each of `fractions`, which is empty
+    /// if the sketch is. Like the other queries, these are binary searches
+    /// of the retained values, which the first query after an update sorts
+    /// once for all that follow.
+    pub fn quantiles(&self, fractions: &[f64]) -> Result<Vec<f32>, DataSketchesError> {
+        Ok(self
+            .inner
+            .get_quantiles(fractions)?
+            .iter()
+            .copied()
+            .collect())
+    }
+
+    /// Return the approximate fraction of the values seen which are less
+    /// than `value`, or NaN if the sketch is empty.
+    pub fn rank(&self, value: f32) -> f64 {
+        self.inner.get_rank(value)
+    }
+
+    /// Return a lower bound on the true rank of a value the sketch gave
+    /// rank `rank`, with a confidence of `num_std_dev` standard deviations,
+    /// which should be 1, 2 or 3.
+    pub fn rank_lower_bound(&self, rank: f64, num_std_dev: u8) -> f64 {
+        self.inner.get_rank_lower_bound(rank, num_std_dev)
+    }
+
+    /// Return the upper bound matching [`Self::rank_lower_bound`].
+    pub fn rank_upper_bound(&self, rank: f64, num_std_dev: u8) -> f64 {
+        self.inner.get_rank_upper_bound(rank, num_std_dev)
+    }
+
+    /// Return the approximate fraction of the values seen less than each
+    /// of `split_points`, followed by 1. Fails unless the split points are
+    /// increasing and not NaN. Empty if the sketch is.
+    pub fn cdf(&self, split_points: &[f32]) -> Result<Vec<f64>, DataSketchesError> {
+        Ok(self.inner.get_cdf(split_points)?.iter().copied().collect())
+    }
+
+    /// Return the approximate fraction of the values seen in each of the
+    /// intervals the `split_points` delimit, starting with the values below
+    /// the first and ending with those at or above the last. The split
+    /// points are checked as for [`Self::cdf`].
+    ///
+    /// The split points of both are found in one pass over the sorted
+    /// retained values, so many of them cost little more than a few.
+    pub fn pmf(&self, split_points: &[f32]) -> Result<Vec<f64>, DataSketchesError> {
+        Ok(self.inner.get_pmf(split_points)?.iter().copied().collect())
+    }
+
+    pub fn serialize(&self) -> impl AsRef<[u8]> {
+        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+        impl AsRef<[u8]> for UPtrVec {
+            fn as_ref(&self) -> &[u8] {
+                self.0.as_slice()
+            }
+        }
+        UPtrVec(self.inner.serialize())
+    }
+
+    pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::deserialize_opaque_req_sketch(buf)?,
+        })
+    }
+}
+
+impl Clone for ReqSketch {
+    fn clone(&self) -> Self {
+        Self {
+            inner: self.inner.clone(),
+        }
+    }
+}
+
+/// A read-only view of a serialized [`ReqSketch`], which reads its
+/// compactors straight out of the borrowed bytes rather than copying them.
+/// The bytes need not be aligned, so this works directly on slices of a
+/// larger buffer such as a memory-mapped file.
+///
+/// Use it where a sketch is only queried a few times or merged once, e.g.
+/// with [`ReqSketch::merge_wrapped`], to skip [`ReqSketch::deserialize`]'s
+/// allocation and copy.
+pub struct WrappedReqSketch<'a> {
+    inner: cxx::UniquePtr<ffi::OpaqueWrappedReqSketch>,
+    buf: PhantomData<&'a [u8]>,
+}
+
+impl<'a> WrappedReqSketch<'a> {
+    /// Wrap the output of [`ReqSketch::serialize`], which is validated the
+    /// same way [`ReqSketch::deserialize`] does.
+    pub fn wrap(buf: &'a [u8]) -> Result<Self, DataSketchesError> {
+        // Safety: the view cannot outlive 'a, and so the bytes it points into.
+        let inner = unsafe { ffi::wrap_opaque_req_sketch(buf)? };
+        Ok(Self {
+            inner,
+            buf: PhantomData,
+        })
+    }
+
+    /// Return whether the wrapped sketch is in high rank accuracy mode.
+    pub fn is_hra(&self) -> bool {
+        self.inner.is_hra()
+    }
+
+    /// Return the number of values the wrapped sketch saw.
+    pub fn n(&self) -> u64 {
+        self.inner.get_n()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.inner.is_empty()
+    }
+
+    /// Return the number of values the wrapped sketch retains.
+    pub fn num_retained(&self) -> u32 {
+        self.inner.get_num_retained()
+    }
+
+    /// Return the smallest value seen, or NaN if there were none.
+    pub fn min(&self) -> f32 {
+        self.inner.get_min_value()
+    }
+
+    /// Return the largest value seen, or NaN if there were none.
+    pub fn max(&self) -> f32 {
+        self.inner.get_max_value()
+    }
+
+    /// Return the same value as [`ReqSketch::quantile`] of the deserialized
+    /// sketch. Rather than sorting the retained values, each query narrows
+    /// the answer down by weighing a candidate against every compactor, so
+    /// it allocates nothing but costs more than a query of a sketch that
+    /// has sorted them once.
+    pub fn quantile(&self, fraction: f64) -> Result<f32, DataSketchesError> {
+        Ok(self.inner.get_quantile(fraction)?)
+    }
+
+    /// Return the same rank as [`ReqSketch::rank`] of the deserialized
+    /// sketch, from a binary search of each sorted compactor.
+    pub fn rank(&self, value: f32) -> f64 {
+        self.inner.get_rank(value)
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    #[test]
+    fn exact_quantiles() {
+        let mut req = ReqSketch::new(12, true).unwrap();
+        assert!(req.quantile(0.5).unwrap().is_nan());
+        assert!(req.quantiles(&[0.5]).unwrap().is_empty());
+        let values: Vec<f32> = (1..=20).map(|i| i as f32).collect();
+        req.update_batch(&values);
+        req.update(f32::NAN);
+        assert_eq!(req.n(), 20);
+        assert!(!req.is_estimation_mode());
+        assert_eq!(req.min(), 1.0);
+        assert_eq!(req.max(), 20.0);
+        assert_eq!(req.quantile(0.5).unwrap(), 11.0);
+        assert_eq!(
+            req.quantiles(&[0.0, 0.25, 1.0]).unwrap(),
+            vec![1.0, 6.0, 20.0]
+        );
+        assert_eq!(req.rank(11.0), 0.5);
+        assert_eq!(req.cdf(&[3.0, 11.0]).unwrap(), vec![0.1, 0.5, 1.0]);
+        assert_eq!(req.pmf(&[3.0, 11.0]).unwrap(), vec![0.1, 0.4, 0.5]);
+        assert!(req.quantile(-0.5).is_err());
+        assert!(req.cdf(&[11.0, 3.0]).is_err());
+
+        // the cached view is dropped on update
+        req.update_batch(&values);
+        assert_eq!(req.n(), 40);
+        assert_eq!(req.rank(11.0), 0.5);
+        req.update(0.0);
+        assert_eq!(req.quantile(0.0).unwrap(), 0.0);
+        assert!(ReqSketch::new(13, true).is_err());
+        assert!(ReqSketch::new(2, false).is_err());
+    }
+
+    #[test]
+    fn accurate_tails() {
+        let n = 1000 * 1000;
+        let values: Vec<f32> = (0..n).map(|i| i as f32).collect();
+        let mut hra = ReqSketch::new(12, true).unwrap();
+        let mut lra = ReqSketch::new(12, false).unwrap();
+        values.chunks(4096).for_each(|chunk| {
+            hra.update_batch(chunk);
+            lra.update_batch(chunk);
+        });
+        assert!(hra.is_estimation_mode());
+        for &fraction in &[0.99f64, 0.999, 0.9999] {
+            // the error is relative to the distance from rank 1
+            let rank = hra.quantile(fraction).unwrap() as f64 / n as f64;
+            let tail = 1.0 - fraction;
+            assert!(
+                (rank - fraction).abs() <= 0.05 * tail,
+                "{} {}",
+                fraction,
+                rank
+            );
+            assert!(hra.rank_lower_bound(fraction, 2) <= fraction);
+            assert!(hra.rank_upper_bound(fraction, 2) >= fraction);
+            let rank = lra.quantile(tail).unwrap() as f64 / n as f64;
+            assert!((rank - tail).abs() <= 0.05 * tail, "{} {}", tail, rank);
+        }
+        assert!(hra.merge(&lra).is_err());
+    }
+
+    #[test]
+    fn wrapped() {
+        let mut req = ReqSketch::new(12, true).unwrap();
+        let values: Vec<f32> = (0..100_000)
+            .map(|i| ((i * 7919) % 100_000) as f32)
+            .collect();
+        req.update_batch(&values);
+        let bytes = req.serialize();
+        // misaligned, as a slice of a larger buffer would be
+        let mut buf = vec![0u8];
+        buf.extend_from_slice(bytes.as_ref());
+        let wrapped = WrappedReqSketch::wrap(&buf[1..]).unwrap();
+        assert!(wrapped.is_hra());
+        assert_eq!(wrapped.n(), req.n());
+        assert_eq!(wrapped.num_retained(), req.num_retained());
+        assert_eq!(wrapped.min(), 0.0);
+        assert_eq!(wrapped.max(), 99_999.0);
+        for i in 0..=100 {
+            let fraction = i as f64 / 100.0;
+            assert_eq!(
+                wrapped.quantile(fraction).unwrap(),
+                req.quantile(fraction).unwrap()
+            );
+            let value = (i * 1000) as f32;
+            assert_eq!(wrapped.rank(value), req.rank(value));
+        }
+        assert!(wrapped.quantile(-0.5).is_err());
+
+        // compaction is randomized, so only the bounds are exact
+        let mut merged = ReqSketch::new(12, true).unwrap();
+        merged.update(-1.0);
+        merged.merge_wrapped(&wrapped).unwrap();
+        assert_eq!(merged.n(), req.n() + 1);
+        assert_eq!(merged.min(), -1.0);
+        assert_eq!(merged.max(), 99_999.0);
+        assert!(ReqSketch::new(12, false)
+            .unwrap()
+            .merge_wrapped(&wrapped)
+            .is_err());
+        assert!(WrappedReqSketch::wrap(&bytes.as_ref()[..4]).is_err());
+    }
+
+    #[test]
+    fn merge_and_serialize() {
+        let mut a = ReqSketch::new(20, true).unwrap();
+        let mut b = ReqSketch::new(20, true).unwrap();
+        for i in 0..10000 {
+            a.update(i as f32);
+            b.update((i + 10000) as f32);
+        }
+        let before = a.quantile(0.5).unwrap();
+        a.merge(&b).unwrap();
+        assert_eq!(a.n(), 20000);
+        assert!(a.quantile(0.5).unwrap() > before);
+        let bytes = a.serialize();
+        let cycled = ReqSketch::deserialize(bytes.as_ref()).unwrap();
+        assert_eq!(cycled.n(), a.n());
+        assert!(cycled.is_hra());
+        let fractions: Vec<f64> = (0..=50).map(|i| i as f64 / 50.0).collect();
+        assert_eq!(
+            cycled.quantiles(&fractions).unwrap(),
+            a.quantiles(&fractions).unwrap()
+        );
+        assert_eq!(a.clone().serialize().as_ref(), bytes.as_ref());
+        assert!(ReqSketch::deserialize(&bytes.as_ref()[..4]).is_err());
+    }
+}
@@ -1,8 +1,17 @@
 //! Wrapper types for the Theta sketch.
 
+use std::convert::TryFrom;
+use std::marker::PhantomData;
+use std::panic;
+use std::sync::atomic::{AtomicUsize, Ordering};
+use std::thread;
+
 use cxx;
 
 use crate::bridge::ffi;
+use crate::bridge::ffi::KeyHash;
+pub use crate::bridge::ffi::ThetaResizeFactor;
+use crate::wrapper::{check_batch_ends, map_many, union_many, SerializedUnion};
 use crate::DataSketchesError;
 
 /// The [Theta][orig-docs] sketch is, essentially, an adaptive random sample
@@ -24,18 +33,74 @@ pub struct ThetaSketch {
 }
 
 impl ThetaSketch {
-    /// Create a Theta sketch representing the empty set.
+    /// The `lg_k` of sketches from [`Self::new`].
+    pub const DEFAULT_LG_K: u8 = 12;
+
+    /// Create a Theta sketch representing the empty set, with
+    /// [`Self::DEFAULT_LG_K`], a hash table growing by
+    /// [`ThetaResizeFactor::X8`], and no up-front sampling.
     pub fn new() -> Self {
-        Self {
-            inner: ffi::new_opaque_theta_sketch(),
-        }
+        Self::with_params(Self::DEFAULT_LG_K, ThetaResizeFactor::X8, 1.0).expect("valid parameters")
     }
 
-    /// Return the current estimate of distinct values seen.
+    /// Create a Theta sketch representing the empty set, which keeps about
+    /// `2^lg_k` hashes once it is in estimation mode. Its hash table starts
+    /// small and grows by `resize_factor` as it fills. Each value is only
+    /// kept with probability `p`, which trades accuracy for speed and size
+    /// on streams known to be large. Fails unless `5 <= lg_k <= 26` and
+    /// `0 < p <= 1`.
+    ///
+    /// With `p < 1`, most values are rejected by a single comparison of
+    /// their hash, before the hash table is touched, so updates get cheaper
+    /// about in proportion. The sketch is then never exact: it estimates
+    /// from a sample of rate `p` from the start, and [`Self::bounds`] widen
+    /// accordingly, which matters most while it has seen fewer than about
+    /// `2^lg_k / p` distinct values. Beyond that, the sketch keeps
+    /// `2^lg_k` hashes either way, and the bounds are as for `p = 1`.
+    pub fn with_params(
+        lg_k: u8,
+        resize_factor: ThetaResizeFactor,
+        p: f32,
+    ) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_theta_sketch(lg_k, resize_factor, p, 0)?,
+        })
+    }
+
+    /// Like [`Self::with_params`] with a [`ThetaResizeFactor::X8`] table
+    /// and no up-front sampling, but for about `expected_n` distinct
+    /// values: the hash table starts at the size it would grow to for
+    /// them, rather than rehashing its entries at every resize on the
+    /// way. It never starts larger than `lg_k` lets it grow, so
+    /// overestimating only costs memory up to that.
+    pub fn with_expected_n(lg_k: u8, expected_n: u64) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_theta_sketch(lg_k, ThetaResizeFactor::X8, 1.0, expected_n)?,
+        })
+    }
+
+    /// Return the current estimate of distinct values seen. The estimate
+    /// is cached until the next update, so polling it between updates
+    /// costs next to nothing.
     pub fn estimate(&self) -> f64 {
         self.inner.estimate()
     }
 
+    /// Whether the sketch was updated since [`Self::estimate`] last
+    /// computed its estimate.
+    pub fn is_dirty(&self) -> bool {
+        self.inner.is_dirty()
+    }
+
+    /// Returns the estimate with approximate lower and upper bounds at
+    /// `num_std_devs` (1, 2 or 3) standard deviations, as
+    /// `(estimate, lower, upper)`. The bounds equal the estimate while the
+    /// sketch is exact. Fails on any other `num_std_devs`.
+    pub fn bounds(&self, num_std_devs: u8) -> Result<(f64, f64, f64), DataSketchesError> {
+        let bounds = self.inner.bounds(num_std_devs)?;
+        Ok((bounds.estimate, bounds.lower_bound, bounds.upper_bound))
+    }
+
     /// Observe a new value. Two values must have the exact same
     /// bytes and lengths to be considered equal.
     pub fn update(&mut self, value: &[u8]) {
@@ -51,9 +116,60 @@ impl ThetaSketch {
         self.inner.pin_mut().update_u64(value)
     }
 
+    /// Equivalent to calling [`Self::update_u64`] on each of `values`, but
+    /// crosses into C++ only once.
+    pub fn update_u64_batch(&mut self, values: &[u64]) {
+        self.inner.pin_mut().update_u64_batch(values)
+    }
+
+    /// Equivalent to calling [`Self::update`] on each key packed into `buf`,
+    /// but crosses into C++ only once. Key `i` is `buf[ends[i - 1]..ends[i]]`,
+    /// where the first key starts at offset 0.
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn update_batch(&mut self, buf: &[u8], ends: &[usize]) {
+        check_batch_ends(buf, ends);
+        self.inner.pin_mut().update_bytes_batch(buf, ends)
+    }
+
+    /// Equivalent to [`Self::update`] with the key `hash` was made from.
+    pub fn update_hashed(&mut self, hash: KeyHash) {
+        self.inner.pin_mut().update_hashed(hash)
+    }
+
+    /// Equivalent to [`Self::update_hashed`] on each of `hashes`, but
+    /// crosses into C++ only once.
+    pub fn update_hashed_batch(&mut self, hashes: &[KeyHash]) {
+        self.inner.pin_mut().update_hashed_batch(hashes)
+    }
+
+    /// Empty this sketch so it represents the empty set again, keeping its
+    /// hash table to be reused by later updates.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+
+    /// Returns the heap memory held by this sketch's hash table, in bytes,
+    /// which is sized for more entries than it holds, up to twice `2^lg_k`.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.inner.get_memory_usage_bytes()
+    }
+
+    /// Returns a static copy of this sketch, with its hashes sorted, as
+    /// serialization, compression and unions merging sorted inputs want.
     pub fn as_static(&self) -> StaticThetaSketch {
         StaticThetaSketch {
-            inner: self.inner.as_static(),
+            inner: self.inner.as_static(true),
+        }
+    }
+
+    /// Like [`Self::as_static`], but skips sorting the hashes, for copies
+    /// that are only estimated, set against others, or merged into unions
+    /// already holding unordered ones. They serialize as readily, but
+    /// [`StaticThetaSketch::serialize_compressed`] cannot compress them.
+    pub fn as_static_unordered(&self) -> StaticThetaSketch {
+        StaticThetaSketch {
+            inner: self.inner.as_static(false),
         }
     }
 }
@@ -68,6 +184,17 @@ impl StaticThetaSketch {
         self.inner.estimate()
     }
 
+    /// Returns the heap memory held by this sketch's entries, in bytes.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.inner.get_memory_usage_bytes()
+    }
+
+    /// Returns the estimate and its bounds, as [`ThetaSketch::bounds`] does.
+    pub fn bounds(&self, num_std_devs: u8) -> Result<(f64, f64, f64), DataSketchesError> {
+        let bounds = self.inner.bounds(num_std_devs)?;
+        Ok((bounds.estimate, bounds.lower_bound, bounds.upper_bound))
+    }
+
     /// Return the sketch representing the set of elements present
     /// in `self` without any of the elements also present in `other`.
     pub fn set_difference(&mut self, other: &StaticThetaSketch) {
@@ -76,6 +203,14 @@ impl StaticThetaSketch {
             .set_difference(other.inner.as_ref().expect("non-null"));
     }
 
+    /// Equivalent to [`Self::set_difference`] with the sketch `exclusion`
+    /// was prepared from, which only scans the hashes of `self`.
+    pub fn exclude(&mut self, exclusion: &ThetaExclusion) {
+        self.inner
+            .pin_mut()
+            .exclude(exclusion.inner.as_ref().expect("non-null"));
+    }
+
     pub fn serialize(&self) -> impl AsRef<[u8]> {
         struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
         impl AsRef<[u8]> for UPtrVec {
@@ -86,11 +221,86 @@ impl StaticThetaSketch {
         UPtrVec(self.inner.serialize())
     }
 
+    /// Like [`Self::serialize`], but stores the differences between
+    /// consecutive sorted hashes, bit-packed to the width of the largest,
+    /// instead of 8 bytes per hash. Sketches of `2^lg_k` hashes save about
+    /// `lg_k` bits per hash, at the cost of decoding them on deserialization.
+    /// Empty sketches, exact ones of a single hash, and unordered ones are
+    /// serialized as by [`Self::serialize`].
+    ///
+    /// [`Self::deserialize`] reads either form, but compressed sketches
+    /// cannot be wrapped with [`WrappedThetaSketch::wrap`].
+    pub fn serialize_compressed(&self) -> impl AsRef<[u8]> {
+        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+        impl AsRef<[u8]> for UPtrVec {
+            fn as_ref(&self) -> &[u8] {
+                self.0.as_slice()
+            }
+        }
+        UPtrVec(self.inner.serialize_compressed())
+    }
+
+    /// Deserialize the output of [`Self::serialize`] or
+    /// [`Self::serialize_compressed`].
     pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
         Ok(Self {
             inner: ffi::deserialize_opaque_static_theta_sketch(buf)?,
         })
     }
+
+    /// Equivalent to `StaticThetaSketch::deserialize(buf)?.estimate()`, but
+    /// only reads theta and the number of hashes from the header of `buf`,
+    /// without allocating. The rest of `buf` is only checked to be long
+    /// enough to hold the hashes. Compressed sketches are still decoded.
+    pub fn estimate_serialized(buf: &[u8]) -> Result<f64, DataSketchesError> {
+        Ok(ffi::estimate_serialized_theta_sketch(buf)?)
+    }
+
+    /// Like [`Self::estimate_serialized`], but also returns the lower and
+    /// upper bounds at `num_std_devs` (1, 2 or 3) standard deviations, as
+    /// `(estimate, lower, upper)`.
+    pub fn bounds_serialized(
+        buf: &[u8],
+        num_std_devs: u8,
+    ) -> Result<(f64, f64, f64), DataSketchesError> {
+        let bounds = ffi::bounds_serialized_theta_sketch(buf, num_std_devs)?;
+        Ok((bounds.estimate, bounds.lower_bound, bounds.upper_bound))
+    }
+
+    /// Returns [`Self::bounds_serialized`] of each sketch packed into
+    /// `buf`, crossing into C++ once and computing the bounds of all of
+    /// them as one batch, in which a sketch with the same number of hashes
+    /// and theta as the one before it reuses its bounds. Sketch `i` is
+    /// `buf[ends[i - 1]..ends[i]]`, where the first starts at offset 0.
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn bounds_serialized_batch(
+        buf: &[u8],
+        ends: &[usize],
+        num_std_devs: u8,
+    ) -> Result<Vec<(f64, f64, f64)>, DataSketchesError> {
+        check_batch_ends(buf, ends);
+        let mut out = vec![ffi::EstimateBounds::default(); ends.len()];
+        ffi::bounds_serialized_theta_sketches(buf, ends, num_std_devs, &mut out)?;
+        Ok(out
+            .iter()
+            .map(|bounds| (bounds.estimate, bounds.lower_bound, bounds.upper_bound))
+            .collect())
+    }
+
+    /// Returns [`Self::bounds_serialized`] of each of `serialized`, which
+    /// are split among `threads` threads.
+    ///
+    /// Panics if `threads` is 0.
+    pub fn estimate_many(
+        serialized: &[&[u8]],
+        num_std_devs: u8,
+        threads: usize,
+    ) -> Result<Vec<(f64, f64, f64)>, DataSketchesError> {
+        map_many(serialized, threads, |buf| {
+            Self::bounds_serialized(buf, num_std_devs)
+        })
+    }
 }
 
 impl Clone for StaticThetaSketch {
@@ -101,6 +311,63 @@ impl Clone for StaticThetaSketch {
     }
 }
 
+/// A [`StaticThetaSketch`] prepared to be subtracted from many others with
+/// [`StaticThetaSketch::exclude`]. [`StaticThetaSketch::set_difference`]
+/// reads all of `other` on every call, whereas the exclusion hashes it into
+/// a lookup table once, so subtracting one large sketch from many small ones
+/// costs in proportion to the small ones.
+pub struct ThetaExclusion {
+    inner: cxx::UniquePtr<ffi::OpaqueThetaExclusion>,
+}
+
+impl ThetaExclusion {
+    pub fn new(sketch: &StaticThetaSketch) -> Self {
+        Self {
+            inner: ffi::new_opaque_theta_exclusion(sketch.inner.as_ref().expect("non-null")),
+        }
+    }
+}
+
+/// A read-only view of a serialized [`StaticThetaSketch`], which reads its
+/// hashes straight out of the borrowed bytes rather than copying them. The
+/// bytes need not be aligned, so this works directly on slices of a larger
+/// buffer such as a memory-mapped file.
+///
+/// Use it where a sketch is only estimated or merged once, e.g. with
+/// [`ThetaUnion::merge_wrapped`], to skip [`StaticThetaSketch::deserialize`]'s
+/// allocation and copy.
+pub struct WrappedThetaSketch<'a> {
+    inner: cxx::UniquePtr<ffi::OpaqueWrappedThetaSketch>,
+    buf: PhantomData<&'a [u8]>,
+}
+
+impl<'a> WrappedThetaSketch<'a> {
+    /// Wrap the output of [`StaticThetaSketch::serialize`], which is
+    /// validated the same way [`StaticThetaSketch::deserialize`] does.
+    /// Fails on the output of [`StaticThetaSketch::serialize_compressed`],
+    /// whose hashes must be decoded before they can be read.
+    pub fn wrap(buf: &'a [u8]) -> Result<Self, DataSketchesError> {
+        // Safety: the view cannot outlive 'a, and so the bytes it points into.
+        let inner = unsafe { ffi::wrap_opaque_static_theta_sketch(buf)? };
+        Ok(Self {
+            inner,
+            buf: PhantomData,
+        })
+    }
+
+    /// Return the estimate of distinct values of the wrapped sketch.
+    pub fn estimate(&self) -> f64 {
+        self.inner.estimate()
+    }
+
+    /// Copy the wrapped sketch out into one that owns its hashes.
+    pub fn to_static(&self) -> StaticThetaSketch {
+        StaticThetaSketch {
+            inner: self.inner.to_static(),
+        }
+    }
+}
+
 pub struct ThetaUnion {
     inner: cxx::UniquePtr<ffi::OpaqueThetaUnion>,
 }
@@ -118,12 +385,86 @@ impl ThetaUnion {
         self.inner.pin_mut().union_with(sketch.inner)
     }
 
-    /// Retrieve the current unioned sketch as a copy.
+    /// Equivalent to `self.merge(sketch.clone())`, without the clone.
+    pub fn merge_ref(&mut self, sketch: &StaticThetaSketch) {
+        self.inner
+            .pin_mut()
+            .union_with_ref(sketch.inner.as_ref().expect("non-null"))
+    }
+
+    /// Equivalent to merging `sketch.to_static()`, without the copy.
+    pub fn merge_wrapped(&mut self, sketch: &WrappedThetaSketch<'_>) {
+        self.inner
+            .pin_mut()
+            .union_with_wrapped(sketch.inner.as_ref().expect("non-null"))
+    }
+
+    /// Equivalent to `self.merge_wrapped(&WrappedThetaSketch::wrap(buf)?)`,
+    /// but reads `buf` in place without allocating a wrapper for it.
+    /// Compressed sketches, which cannot be wrapped, are deserialized.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        Ok(self.inner.pin_mut().union_serialized(buf)?)
+    }
+
+    /// Empty this union so it represents the empty set again, keeping its
+    /// hash table to be reused by later merges.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+
+    /// Retrieve the current unioned sketch as a copy. The union keeps it
+    /// until the next merge or reset, so asking again only copies it.
     pub fn sketch(&self) -> StaticThetaSketch {
         StaticThetaSketch {
-            inner: self.inner.sketch(),
+            inner: self.inner.sketch(true),
+        }
+    }
+
+    /// Like [`Self::sketch`], but only sorts the result's hashes if that
+    /// costs nothing, which it does while every sketch merged so far was
+    /// ordered, unlike those of [`ThetaSketch::as_static_unordered`].
+    pub fn sketch_unordered(&self) -> StaticThetaSketch {
+        StaticThetaSketch {
+            inner: self.inner.sketch(false),
         }
     }
+
+    /// Equivalent to [`Self::sketch`], but moves the union's retained
+    /// hashes into the result rather than copying them.
+    pub fn into_sketch(mut self) -> StaticThetaSketch {
+        StaticThetaSketch {
+            inner: self.inner.pin_mut().take_sketch(),
+        }
+    }
+
+    /// Unions all of the serialized static sketches in `serialized` on
+    /// `threads` threads, each merging its share into a union of its own
+    /// before the partial unions are combined pairwise. The inputs are
+    /// read in place, as by [`Self::merge_wrapped`].
+    ///
+    /// Panics if `threads` is 0.
+    pub fn union_many(
+        serialized: &[&[u8]],
+        threads: usize,
+    ) -> Result<StaticThetaSketch, DataSketchesError> {
+        union_many(serialized, threads, Self::new)
+    }
+}
+
+impl SerializedUnion for ThetaUnion {
+    type Sketch = StaticThetaSketch;
+
+    fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        ThetaUnion::merge_serialized(self, buf)
+    }
+
+    fn merge_sketch(&mut self, sketch: StaticThetaSketch) {
+        self.merge(sketch)
+    }
+
+    fn result(&self) -> StaticThetaSketch {
+        self.sketch()
+    }
 }
 
 pub struct ThetaIntersection {
@@ -142,6 +483,20 @@ impl ThetaIntersection {
         self.inner.pin_mut().intersect_with(sketch.inner);
     }
 
+    /// Equivalent to `self.merge(sketch.clone())`, without the clone.
+    pub fn merge_ref(&mut self, sketch: &StaticThetaSketch) {
+        self.inner
+            .pin_mut()
+            .intersect_with_ref(sketch.inner.as_ref().expect("non-null"));
+    }
+
+    /// Equivalent to merging `sketch.to_static()`, without the copy.
+    pub fn merge_wrapped(&mut self, sketch: &WrappedThetaSketch<'_>) {
+        self.inner
+            .pin_mut()
+            .intersect_with_wrapped(sketch.inner.as_ref().expect("non-null"));
+    }
+
     /// Retrieve the current intersected sketch as a copy. Returns `None`
     /// if the sketch represents the universal set (which it does before
     /// at least one call to `merge()`.)
@@ -150,10 +505,446 @@ impl ThetaIntersection {
         let valid = !inner.is_null();
         valid.then(|| StaticThetaSketch { inner })
     }
+
+    /// Equivalent to [`Self::sketch`], but moves the intersection's
+    /// retained hashes into the result rather than copying them.
+    pub fn into_sketch(mut self) -> Option<StaticThetaSketch> {
+        let inner = self.inner.pin_mut().take_sketch();
+        let valid = !inner.is_null();
+        valid.then(|| StaticThetaSketch { inner })
+    }
+}
+
+/// Distinct counts over a sliding window of the last `num_slices` slices
+/// of a stream, such as the last 900 seconds of a stream of events, when
+/// the newest slice is the current second. Updates go to the newest slice,
+/// and [`Self::advance`] closes it, dropping the oldest slice once the
+/// window is full.
+///
+/// The window's sketch is the union of its slices, but is not recomputed
+/// from all of them: closed slices are kept in two stacks whose partial
+/// unions are maintained as slices come and go, so that the window takes
+/// a constant number of unions, and each slice is unioned twice over its
+/// lifetime however often the window is estimated.
+pub struct ThetaWindow {
+    inner: cxx::UniquePtr<ffi::OpaqueThetaWindow>,
+}
+
+impl ThetaWindow {
+    /// Create an empty window of `num_slices` slices, each a theta sketch
+    /// with `lg_k` as in [`ThetaSketch::with_params`], and so is the
+    /// window's. Fails unless `5 <= lg_k <= 26` and `num_slices > 0`.
+    pub fn new(lg_k: u8, num_slices: usize) -> Result<Self, DataSketchesError> {
+        Self::with_p(lg_k, 1.0, num_slices)
+    }
+
+    /// Like [`Self::new`], but each slice only keeps values with
+    /// probability `p`, as in [`ThetaSketch::with_params`]. Fails unless
+    /// also `0 < p <= 1`.
+    pub fn with_p(lg_k: u8, p: f32, num_slices: usize) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_theta_window(lg_k, p, num_slices)?,
+        })
+    }
+
+    /// Return the estimate of distinct values seen in the window, which
+    /// is cached until the next update or advance, so polling it costs
+    /// next to nothing between them, unlike [`Self::sketch`].
+    pub fn estimate(&self) -> f64 {
+        self.inner.estimate()
+    }
+
+    /// Whether the window was updated or advanced since [`Self::estimate`]
+    /// last computed its estimate.
+    pub fn is_dirty(&self) -> bool {
+        self.inner.is_dirty()
+    }
+
+    /// Retrieve the union of the slices in the window.
+    pub fn sketch(&self) -> StaticThetaSketch {
+        StaticThetaSketch {
+            inner: self.inner.sketch(),
+        }
+    }
+
+    /// Observe a new value in the newest slice.
+    pub fn update(&mut self, value: &[u8]) {
+        self.inner.pin_mut().update(value)
+    }
+
+    /// Equivalent to calling [`Self::update`] on each key packed into `buf`,
+    /// as in [`ThetaSketch::update_batch`].
+    ///
+    /// Panics if `ends` is decreasing anywhere or runs past `buf`.
+    pub fn update_batch(&mut self, buf: &[u8], ends: &[usize]) {
+        check_batch_ends(buf, ends);
+        self.inner.pin_mut().update_bytes_batch(buf, ends)
+    }
+
+    /// Close the newest slice and open an empty one, dropping the oldest
+    /// slice if the window already has `num_slices`.
+    pub fn advance(&mut self) {
+        self.inner.pin_mut().advance()
+    }
+
+    pub fn num_slices(&self) -> usize {
+        self.inner.get_num_slices()
+    }
+}
+
+/// Distinct counts of the values of many keys, as for a `GROUP BY` with
+/// `COUNT(DISTINCT)`, kept under one theta shared by all the keys rather
+/// than in a sketch per key. Its table holds at most about `2^lg_k` (key,
+/// value) pairs all told, sampled by the hash of each pair below the
+/// common theta, so memory is bounded however many keys there are.
+///
+/// A key's count is estimated as its number of retained pairs over theta,
+/// so a key of `n` distinct values is estimated from about `n * theta` of
+/// them, with a relative error of about `1 / sqrt(n * theta)`: large keys
+/// are estimated about as well as by a [`ThetaSketch`] of the same `lg_k`
+/// each, while small ones may have no pairs left and be estimated as 0.
+///
+/// Keys are named by dense ids from 0, which the caller assigns, along
+/// with a hash of each key, which seeds the hashes of its values and must
+/// be the same wherever the key is counted, so that sketches can be merged
+/// by [`Self::merge`].
+pub struct KeyedThetaSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueKeyedThetaSketch>,
+}
+
+impl KeyedThetaSketch {
+    /// Create an empty sketch of about `2^lg_k` pairs for all its keys.
+    /// Fails unless `5 <= lg_k <= 26`.
+    pub fn new(lg_k: u8) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_keyed_theta_sketch(lg_k)?,
+        })
+    }
+
+    /// Observe `value` for the key of id `key_id` and hash `key_hash`.
+    pub fn update(&mut self, key_id: u32, key_hash: u64, value: &[u8]) {
+        self.inner.pin_mut().update(key_id, key_hash, value)
+    }
+
+    /// The fraction of distinct pairs retained, 1 until the table first
+    /// fills up.
+    pub fn theta(&self) -> f64 {
+        self.inner.theta()
+    }
+
+    pub fn num_retained(&self) -> u32 {
+        self.inner.num_retained()
+    }
+
+    pub fn lg_k(&self) -> u8 {
+        self.inner.get_lg_k()
+    }
+
+    /// Returns the estimated distinct count of each key of id below
+    /// `num_keys`, indexed by id. Fails if the sketch holds pairs of a key
+    /// of id `num_keys` or more.
+    pub fn estimates(&self, num_keys: usize) -> Result<Vec<f64>, DataSketchesError> {
+        let mut counts = vec![0u32; num_keys];
+        self.inner.counts(&mut counts)?;
+        let theta = self.theta();
+        Ok(counts.iter().map(|&n| f64::from(n) / theta).collect())
+    }
+
+    /// Merges the pairs of `other`, whose key of id `i` is this sketch's
+    /// key of id `key_map[i]`, so that this sketch counts the values of
+    /// both, at the smaller theta of the two and this sketch's `lg_k`.
+    /// Fails if `other` holds pairs of a key of id `key_map.len()` or more.
+    pub fn merge(&mut self, other: &Self, key_map: &[u32]) -> Result<(), DataSketchesError> {
+        Ok(self
+            .inner
+            .pin_mut()
+            .merge(other.inner.as_ref().expect("non-null"), key_map)?)
+    }
+
+    /// Heap bytes held by the table of pairs.
+    pub fn memory_usage_bytes(&self) -> usize {
+        self.inner.get_memory_usage_bytes()
+    }
+}
+
+/// A set expression over serialized static sketches, which
+/// [`Self::evaluate`] computes in a single pass over their hashes. Rather
+/// than chaining [`ThetaUnion`], [`ThetaIntersection`] and
+/// [`StaticThetaSketch::set_difference`], which each build an intermediate
+/// sketch, every input is cut down to the smallest theta among them up
+/// front, and only the hashes which could be in the result are looked up
+/// in the other inputs.
+///
+/// Unlike a [`ThetaUnion`], the union of an expression is not trimmed to
+/// the union's nominal size, so its result may retain more hashes.
+#[derive(Clone, Debug, PartialEq)]
+pub enum ThetaExpression {
+    /// The sketch at this index of the inputs.
+    Input(usize),
+    Union(Vec<ThetaExpression>),
+    Intersection(Vec<ThetaExpression>),
+    /// The first set minus the second.
+    Difference(Box<ThetaExpression>, Box<ThetaExpression>),
+}
+
+impl ThetaExpression {
+    // opcodes of the C++ theta_expression's program, in its low bits
+    const OPCODE_BITS: u32 = 2;
+    const INPUT: u32 = 0;
+    const UNION: u32 = 1;
+    const INTERSECTION: u32 = 2;
+    const A_NOT_B: u32 = 3;
+
+    /// Evaluate the expression over the outputs of
+    /// [`StaticThetaSketch::serialize`] in `inputs`, which are read in
+    /// place. There may be at most 64 inputs, and every operation must have
+    /// an operand.
+    pub fn evaluate(&self, inputs: &[&[u8]]) -> Result<StaticThetaSketch, DataSketchesError> {
+        let mut program = Vec::new();
+        self.compile(&mut program);
+        let mut expression = ffi::new_opaque_theta_expression();
+        for buf in inputs {
+            // Safety: the expression is dropped before this returns, while
+            // the inputs are still borrowed.
+            unsafe { expression.pin_mut().add_input(buf)? };
+        }
+        let inner = expression.evaluate(&program)?;
+        Ok(StaticThetaSketch { inner })
+    }
+
+    /// Append the postfix program computing this expression to `program`.
+    fn compile(&self, program: &mut Vec<u32>) {
+        let (opcode, operand) = match self {
+            Self::Input(index) => (Self::INPUT, *index),
+            Self::Union(operands) => {
+                operands.iter().for_each(|e| e.compile(program));
+                (Self::UNION, operands.len())
+            }
+            Self::Intersection(operands) => {
+                operands.iter().for_each(|e| e.compile(program));
+                (Self::INTERSECTION, operands.len())
+            }
+            Self::Difference(a, b) => {
+                a.compile(program);
+                b.compile(program);
+                (Self::A_NOT_B, 0)
+            }
+        };
+        // out-of-range operands saturate, which the evaluation rejects
+        let operand = u32::try_from(operand)
+            .ok()
+            .filter(|&operand| operand < 1 << (32 - Self::OPCODE_BITS))
+            .unwrap_or(u32::MAX >> Self::OPCODE_BITS);
+        program.push(operand << Self::OPCODE_BITS | opcode);
+    }
+}
+
+/// Sketches on each side of a tile of [`ThetaJaccardMatrix::all_pairs`],
+/// so that the hashes of the tile's rows and columns stay in cache while
+/// every pair of them is compared.
+const JACCARD_TILE: usize = 64;
+
+/// The Jaccard similarity of every pair of many [`StaticThetaSketch`]es,
+/// such as the overlap of each pair of segments of users. Comparing each
+/// pair on its own takes a union and an intersection of the two sketches;
+/// instead, the hashes of every sketch below the smallest theta of them
+/// all are copied once, sorted, and each pair's similarity is worked out
+/// from how many hashes the two have in common, counted in one merge pass.
+///
+/// Every pair is compared at that common theta, so when the sketches'
+/// thetas differ, pairs of sketches with larger thetas are compared on
+/// fewer hashes than they hold, and their bounds are wider. When they are
+/// all the same, as when every sketch is exact, the similarities are those
+/// the pairs' union and intersection would give.
+pub struct ThetaJaccardMatrix {
+    inner: cxx::UniquePtr<ffi::OpaqueThetaJaccardMatrix>,
+}
+
+impl ThetaJaccardMatrix {
+    /// Copy the hashes of `sketches`, whose indices in the matrix are their
+    /// positions in the iteration.
+    pub fn new<'a>(sketches: impl IntoIterator<Item = &'a StaticThetaSketch>) -> Self {
+        let mut inner = ffi::new_opaque_theta_jaccard_matrix();
+        for sketch in sketches {
+            inner
+                .pin_mut()
+                .add(sketch.inner.as_ref().expect("non-null"));
+        }
+        Self { inner }
+    }
+
+    /// Return the number of sketches.
+    pub fn len(&self) -> usize {
+        self.inner.num_sketches()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.len() == 0
+    }
+
+    /// Return the Jaccard index of sketches `i` and `j`, the size of their
+    /// intersection over that of their union, with its lower and upper
+    /// bounds at 2 standard deviations, as `(estimate, lower, upper)`. A
+    /// sketch is identical to itself, and so is any pair of empty ones.
+    ///
+    /// Panics if either index is out of range.
+    pub fn jaccard(&self, i: usize, j: usize) -> (f64, f64, f64) {
+        let n = self.len();
+        assert!(i < n && j < n, "index out of range for {} sketches", n);
+        let bounds = self.inner.jaccard(i, j);
+        (bounds.estimate, bounds.lower_bound, bounds.upper_bound)
+    }
+
+    /// Return [`Self::jaccard`] of every pair, row by row, so that the
+    /// similarity of `i` and `j` is at `i * len() + j`. The matrix is
+    /// symmetric, so only the tiles on and above its diagonal are computed,
+    /// which `threads` threads claim one at a time.
+    ///
+    /// Panics if `threads` is 0.
+    pub fn all_pairs(&self, threads: usize) -> Vec<(f64, f64, f64)> {
+        assert!(threads > 0, "need at least one thread");
+        let n = self.len();
+        let side = (n + JACCARD_TILE - 1) / JACCARD_TILE;
+        let tiles: Vec<(usize, usize)> = (0..side)
+            .flat_map(|row| (row..side).map(move |col| (row, col)))
+            .collect();
+        let span = |tile: usize| tile * JACCARD_TILE..n.min((tile + 1) * JACCARD_TILE);
+        let compute = |&(row, col): &(usize, usize)| {
+            let (rows, cols) = (span(row), span(col));
+            let mut out = vec![ffi::EstimateBounds::default(); rows.len() * cols.len()];
+            self.inner
+                .jaccard_tile(rows.start, rows.end, cols.start, cols.end, &mut out);
+            out
+        };
+
+        let threads = threads.min(tiles.len());
+        let computed: Vec<(usize, Vec<ffi::EstimateBounds>)> = if threads <= 1 {
+            tiles.iter().map(compute).enumerate().collect()
+        } else {
+            let cursor = AtomicUsize::new(0);
+            thread::scope(|scope| {
+                let workers: Vec<_> = (0..threads)
+                    .map(|_| {
+                        scope.spawn(|| {
+                            let mut done = Vec::new();
+                            loop {
+                                let index = cursor.fetch_add(1, Ordering::Relaxed);
+                                match tiles.get(index) {
+                                    Some(tile) => done.push((index, compute(tile))),
+                                    None => return done,
+                                }
+                            }
+                        })
+                    })
+                    .collect();
+                workers
+                    .into_iter()
+                    .flat_map(|worker| match worker.join() {
+                        Ok(done) => done,
+                        Err(e) => panic::resume_unwind(e),
+                    })
+                    .collect()
+            })
+        };
+
+        let mut matrix = vec![(0.0, 0.0, 0.0); n * n];
+        for (index, out) in computed {
+            let (rows, cols) = (span(tiles[index].0), span(tiles[index].1));
+            let mut values = out.iter();
+            for i in rows {
+                for j in cols.clone() {
+                    let bounds = values.next().expect("a value per pair");
+                    let value = (bounds.estimate, bounds.lower_bound, bounds.upper_bound);
+                    matrix[i * n + j] = value;
+                    matrix[j * n + i] = value;
+                }
+            }
+        }
+        matrix
+    }
+}
+
+/// Hashes each [`ThetaBuffer`] collects before propagating them.
+const THETA_BUFFER_CAPACITY: usize = 64;
+
+/// A theta sketch which many threads can update at once, similar to the
+/// Java library's concurrent theta sketch. Each thread updates through its
+/// own [`ThetaBuffer`], which hashes values and screens them against the
+/// sketch's last published theta without locking. The retained hashes are
+/// propagated into the shared sketch in batches, so only the propagation
+/// takes a lock.
+///
+/// Estimates only reflect values whose buffers have propagated them, so they
+/// may lag by up to a buffer's capacity per thread; call
+/// [`ThetaBuffer::flush`] (or drop the buffer) to catch up.
+pub struct ConcurrentThetaSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueConcurrentThetaSketch>,
+}
+
+impl ConcurrentThetaSketch {
+    /// Create a concurrent theta sketch representing the empty set.
+    pub fn new() -> Self {
+        Self {
+            inner: ffi::new_opaque_concurrent_theta_sketch(),
+        }
+    }
+
+    /// Return the current estimate of distinct values propagated so far.
+    pub fn estimate(&self) -> f64 {
+        self.inner.estimate()
+    }
+
+    /// Return a copy of the values propagated so far.
+    pub fn as_static(&self) -> StaticThetaSketch {
+        StaticThetaSketch {
+            inner: self.inner.as_static(true),
+        }
+    }
+
+    /// Like [`Self::as_static`], with the hashes left unsorted as by
+    /// [`ThetaSketch::as_static_unordered`].
+    pub fn as_static_unordered(&self) -> StaticThetaSketch {
+        StaticThetaSketch {
+            inner: self.inner.as_static(false),
+        }
+    }
+
+    /// Create a new buffer for updating this sketch from one thread.
+    pub fn buffer(&self) -> ThetaBuffer {
+        ThetaBuffer {
+            inner: self.inner.buffer(THETA_BUFFER_CAPACITY),
+        }
+    }
+}
+
+/// A single-threaded handle for updating a [`ConcurrentThetaSketch`], see there.
+/// Values still buffered are propagated when this is dropped.
+pub struct ThetaBuffer {
+    inner: cxx::UniquePtr<ffi::OpaqueThetaBuffer>,
+}
+
+impl ThetaBuffer {
+    /// Observe a new value. Two values must have the exact same
+    /// bytes and lengths to be considered equal.
+    pub fn update(&mut self, value: &[u8]) {
+        self.inner.pin_mut().update(value)
+    }
+
+    /// Observe a new `u64`, as in [`ThetaSketch::update_u64`].
+    pub fn update_u64(&mut self, value: u64) {
+        self.inner.pin_mut().update_u64(value)
+    }
+
+    /// Propagate all buffered values into the shared sketch.
+    pub fn flush(&mut self) {
+        self.inner.pin_mut().flush()
+    }
 }
 
 #[cfg(test)]
 mod tests {
+    use std::thread;
+
     use byte_slice_cast::AsByteSlice;
 
     use super::*;
@@ -178,6 +969,14 @@ mod tests {
         assert_eq!(est, cpy.estimate());
         assert_eq!(est, cpy2.estimate());
         assert_eq!(est, cpy3.estimate());
+        assert_eq!(
+            est,
+            StaticThetaSketch::estimate_serialized(bytes.as_ref()).unwrap()
+        );
+        let (bounds_est, lower, upper) =
+            StaticThetaSketch::bounds_serialized(bytes.as_ref(), 2).unwrap();
+        assert_eq!(est, bounds_est);
+        assert!(lower <= est && est <= upper);
 
         let mut union = ThetaUnion::new();
         union.merge(cpy.clone());
@@ -192,6 +991,19 @@ mod tests {
         intersection.merge(cpy3);
         let est2 = intersection.sketch().expect("non-infinite").estimate();
         assert!((lb..ub).contains(&est2));
+
+        let wrapped = WrappedThetaSketch::wrap(bytes.as_ref()).unwrap();
+        assert_eq!(est, wrapped.estimate());
+        assert_eq!(est, wrapped.to_static().estimate());
+        let mut union = ThetaUnion::new();
+        union.merge_wrapped(&wrapped);
+        union.merge_wrapped(&wrapped);
+        assert_eq!(est2, union.sketch().estimate());
+        let mut intersection = ThetaIntersection::new();
+        intersection.merge_wrapped(&wrapped);
+        intersection.merge_wrapped(&wrapped);
+        let est3 = intersection.sketch().expect("non-infinite").estimate();
+        assert_eq!(est2, est3);
     }
 
     #[test]
@@ -214,6 +1026,231 @@ mod tests {
         }
     }
 
+    #[test]
+    fn custom_params() {
+        assert!(ThetaSketch::with_params(4, ThetaResizeFactor::X8, 1.0).is_err());
+        assert!(ThetaSketch::with_params(27, ThetaResizeFactor::X8, 1.0).is_err());
+        assert!(ThetaSketch::with_params(12, ThetaResizeFactor::X8, 0.0).is_err());
+        assert!(ThetaSketch::with_params(12, ThetaResizeFactor::X8, 1.5).is_err());
+
+        let n = 100 * 1000;
+        let mut default = ThetaSketch::new();
+        let mut x1 = ThetaSketch::with_params(12, ThetaResizeFactor::X1, 1.0).unwrap();
+        let mut sampled = ThetaSketch::with_params(16, ThetaResizeFactor::X2, 0.5).unwrap();
+        for key in 0u64..n {
+            default.update_u64(key);
+            x1.update_u64(key);
+            sampled.update_u64(key);
+        }
+        // the resize factor only changes how the table gets to its full size
+        assert_eq!(
+            default.as_static().serialize().as_ref(),
+            x1.as_static().serialize().as_ref()
+        );
+        check_cycle(&sampled);
+        let lb = n as f64 * 0.95;
+        let ub = n as f64 * 1.05;
+        assert!((lb..ub).contains(&sampled.estimate()));
+    }
+
+    #[test]
+    fn sampled_bounds() {
+        let n = 10 * 1000;
+        let mut exact = ThetaSketch::new();
+        let mut sampled = ThetaSketch::with_params(12, ThetaResizeFactor::X8, 0.1).unwrap();
+        assert_eq!(sampled.bounds(2).unwrap(), (0.0, 0.0, 0.0));
+        for key in 0u64..n {
+            exact.update_u64(key);
+            sampled.update_u64(key);
+        }
+        assert_eq!(exact.bounds(1).unwrap(), (n as f64, n as f64, n as f64));
+
+        // fewer than 2^lg_k hashes are kept, but the sketch is not exact
+        let (est, lower, upper) = sampled.bounds(3).unwrap();
+        assert_eq!(est, sampled.estimate());
+        assert!(
+            lower < n as f64 && (n as f64) < upper,
+            "{} {}",
+            lower,
+            upper
+        );
+        let (_, narrow_lower, narrow_upper) = sampled.bounds(1).unwrap();
+        assert!(lower < narrow_lower && narrow_upper < upper);
+        assert_eq!(sampled.as_static().bounds(3).unwrap(), (est, lower, upper));
+
+        assert!(sampled.bounds(0).is_err());
+        assert!(sampled.as_static().bounds(4).is_err());
+    }
+
+    #[test]
+    fn expected_n_only_sizes_table() {
+        assert!(ThetaSketch::with_expected_n(4, 100).is_err());
+        for &n in &[0u64, 10, 3000, 100 * 1000] {
+            let mut default = ThetaSketch::new();
+            for key in 0u64..n {
+                default.update_u64(key);
+            }
+            for &expected_n in &[1, n, 10 * n, u64::MAX] {
+                let mut hinted = ThetaSketch::with_expected_n(12, expected_n).unwrap();
+                for key in 0u64..n {
+                    hinted.update_u64(key);
+                }
+                assert_eq!(
+                    default.as_static().serialize().as_ref(),
+                    hinted.as_static().serialize().as_ref()
+                );
+            }
+        }
+    }
+
+    #[test]
+    fn unordered_static_sketches() {
+        let mut theta = ThetaSketch::new();
+        (0..100 * 1000).for_each(|key| theta.update_u64(key));
+        let ordered = theta.as_static();
+        let unordered = theta.as_static_unordered();
+        assert_eq!(unordered.estimate(), ordered.estimate());
+        // unordered hashes are not compressed
+        assert_eq!(
+            unordered.serialize_compressed().as_ref(),
+            unordered.serialize().as_ref()
+        );
+        assert!(ordered.serialize_compressed().as_ref().len() < ordered.serialize().as_ref().len());
+        let cycled = StaticThetaSketch::deserialize(unordered.serialize().as_ref()).unwrap();
+        assert_eq!(cycled.estimate(), ordered.estimate());
+
+        let mut other = ThetaSketch::new();
+        (50 * 1000..150 * 1000).for_each(|key| other.update_u64(key));
+        let mut sorted = ThetaUnion::new();
+        sorted.merge(theta.as_static());
+        sorted.merge(other.as_static());
+        let mut unsorted = ThetaUnion::new();
+        unsorted.merge(theta.as_static_unordered());
+        unsorted.merge(other.as_static_unordered());
+        assert_eq!(
+            unsorted.sketch_unordered().estimate(),
+            unsorted.sketch().estimate()
+        );
+        let relerr = (unsorted.sketch().estimate() / 150_000.0 - 1.0).abs();
+        assert!(relerr < 0.05, "{}", relerr);
+        // merging ordered sketches keeps the union's result ordered
+        assert_eq!(
+            sorted.sketch_unordered().serialize_compressed().as_ref(),
+            sorted.sketch().serialize_compressed().as_ref()
+        );
+    }
+
+    #[test]
+    fn static_sketch_shared_across_threads() {
+        let mut b = ThetaSketch::new();
+        (0..10 * 1000).for_each(|key| b.update_u64(key));
+        let b = b.as_static();
+        let difference = |t: u64| {
+            let mut a = ThetaSketch::new();
+            (t * 5000..(t + 1) * 5000).for_each(|key| a.update_u64(key));
+            let mut a = a.as_static();
+            a.set_difference(&b);
+            (b.estimate(), a.serialize().as_ref().to_vec())
+        };
+        let expected: Vec<_> = (0..4).map(difference).collect();
+        let shared: Vec<_> = thread::scope(|scope| {
+            let workers: Vec<_> = (0..4).map(|t| scope.spawn(move || difference(t))).collect();
+            workers.into_iter().map(|w| w.join().unwrap()).collect()
+        });
+        assert_eq!(shared, expected);
+    }
+
+    #[test]
+    fn batch_update_matches_single() {
+        let n = 10 * 1000;
+        let keys: Vec<u64> = (0..n).collect();
+        let mut single = ThetaSketch::new();
+        keys.iter().for_each(|&k| single.update_u64(k));
+        let single = single.as_static();
+
+        let mut batched = ThetaSketch::new();
+        batched.update_u64_batch(&keys);
+        let batched = batched.as_static();
+        assert_eq!(single.serialize().as_ref(), batched.serialize().as_ref());
+
+        let mut buf = Vec::new();
+        let mut ends = Vec::new();
+        for &k in &keys {
+            buf.extend_from_slice([k].as_byte_slice());
+            ends.push(buf.len());
+        }
+        let mut packed = ThetaSketch::new();
+        packed.update_batch(&buf, &ends);
+        let packed = packed.as_static();
+        assert_eq!(single.serialize().as_ref(), packed.serialize().as_ref());
+    }
+
+    #[test]
+    fn batch_update_16_byte_keys() {
+        let n = 10 * 1000;
+        let mut buf = Vec::new();
+        let mut ends = Vec::new();
+        let mut single = ThetaSketch::new();
+        for k in 0..n as u64 {
+            let key = [k, !k];
+            single.update(key.as_byte_slice());
+            buf.extend_from_slice(key.as_byte_slice());
+            ends.push(buf.len());
+        }
+        let single = single.as_static();
+        let mut packed = ThetaSketch::new();
+        packed.update_batch(&buf, &ends);
+        let packed = packed.as_static();
+        assert_eq!(single.serialize().as_ref(), packed.serialize().as_ref());
+    }
+
+    #[test]
+    #[should_panic]
+    fn batch_update_bad_ends() {
+        ThetaSketch::new().update_batch(&[1, 2, 3], &[4]);
+    }
+
+    #[test]
+    fn concurrent_buffers_propagate() {
+        let theta = ConcurrentThetaSketch::new();
+        let mut buffer = theta.buffer();
+        for key in 0u64..10 {
+            buffer.update_u64(key);
+        }
+        assert_eq!(theta.estimate(), 0.0);
+        buffer.flush();
+        assert_eq!(theta.estimate(), 10.0);
+        let mut other = theta.buffer();
+        other.update([10u64].as_byte_slice());
+        drop(other);
+        assert_eq!(theta.estimate(), 11.0);
+        check_cycle_static(&theta.as_static());
+    }
+
+    #[test]
+    fn concurrent_count_distinct() {
+        let n = 100 * 1000;
+        let threads = 8;
+        let theta = ConcurrentThetaSketch::new();
+        std::thread::scope(|scope| {
+            for t in 0..threads {
+                let theta = &theta;
+                scope.spawn(move || {
+                    let mut buffer = theta.buffer();
+                    // overlapping ranges, so every key is seen by two threads
+                    for key in (t * n / threads)..((t + 2) * n / threads) {
+                        buffer.update_u64(key % n);
+                    }
+                });
+            }
+        });
+        let est = theta.estimate();
+        let lb = n as f64 * 0.95;
+        let ub = n as f64 * 1.05;
+        assert!((lb..ub).contains(&est), "{}", est);
+        check_cycle_static(&theta.as_static());
+    }
+
     #[test]
     fn basic_intersect_overlap() {
         let mut slice = [0u64];
@@ -269,11 +1306,596 @@ mod tests {
         }
     }
 
+    #[test]
+    fn intersect_order_independent() {
+        // sketches of very different sizes, which all contain the keys from 19 to 999
+        let sketches: Vec<StaticThetaSketch> = (0..20)
+            .map(|i| {
+                let mut theta = ThetaSketch::new();
+                (0..(1000 << (i % 8))).for_each(|key| theta.update_u64(key + i));
+                theta.as_static()
+            })
+            .collect();
+        let mut forward = ThetaIntersection::new();
+        sketches.iter().for_each(|s| forward.merge(s.clone()));
+        let mut backward = ThetaIntersection::new();
+        sketches.iter().rev().for_each(|s| backward.merge_ref(s));
+        let merged = forward.sketch().expect("non-inf");
+        check_cycle_static(&merged);
+        assert_eq!(
+            merged.serialize().as_ref(),
+            backward
+                .into_sketch()
+                .expect("non-inf")
+                .serialize()
+                .as_ref()
+        );
+    }
+
+    fn theta_of(keys: impl Iterator<Item = u64>) -> StaticThetaSketch {
+        let mut theta = ThetaSketch::new();
+        keys.for_each(|key| theta.update_u64(key));
+        theta.as_static()
+    }
+
+    #[test]
+    fn expression_matches_chained_ops() {
+        use ThetaExpression::*;
+        // (a | b) & c - d, exactly for small inputs and approximately for large ones
+        for &n in &[1000u64, 100 * 1000] {
+            let sketches: Vec<StaticThetaSketch> = (0..4)
+                .map(|i| theta_of((i * n / 3)..(i * n / 3 + n)))
+                .collect();
+            let serialized: Vec<Vec<u8>> = sketches
+                .iter()
+                .map(|s| s.serialize().as_ref().to_vec())
+                .collect();
+            let inputs: Vec<&[u8]> = serialized.iter().map(|b| b.as_slice()).collect();
+            let expression = Difference(
+                Box::new(Intersection(vec![
+                    Union(vec![Input(0), Input(1)]),
+                    Input(2),
+                ])),
+                Box::new(Input(3)),
+            );
+            let result = expression.evaluate(&inputs).unwrap();
+            check_cycle_static(&result);
+
+            let mut union = ThetaUnion::new();
+            union.merge_ref(&sketches[0]);
+            union.merge_ref(&sketches[1]);
+            let mut intersection = ThetaIntersection::new();
+            intersection.merge(union.into_sketch());
+            intersection.merge_ref(&sketches[2]);
+            let mut chained = intersection.into_sketch().expect("non-inf");
+            chained.set_difference(&sketches[3]);
+            let est = result.estimate();
+            let value = chained.estimate();
+            assert!(
+                (value * 0.95..=value * 1.05).contains(&est),
+                "n {} chained {} expression {}",
+                n,
+                value,
+                est
+            );
+            if n == 1000 {
+                assert_eq!(est, value);
+            }
+        }
+    }
+
+    #[test]
+    fn union_result_cached_until_merge() {
+        // each sketch() must match a union that never cached anything,
+        // whether merges go through the sorted path or the hash table
+        let mut union = ThetaUnion::new();
+        let mut merged = Vec::new();
+        for i in 0..6u64 {
+            let mut theta = ThetaSketch::new();
+            (i * 3000..i * 3000 + (10 << (2 * i))).for_each(|key| theta.update_u64(key));
+            let input = if i == 4 {
+                theta.as_static_unordered()
+            } else {
+                theta.as_static()
+            };
+            union.merge_ref(&input);
+            merged.push(input);
+            let mut fresh = ThetaUnion::new();
+            merged.iter().for_each(|input| fresh.merge_ref(input));
+            let expected = fresh.sketch();
+            assert_eq!(union.sketch_unordered().estimate(), expected.estimate());
+            for _ in 0..2 {
+                assert_eq!(
+                    union.sketch().serialize().as_ref(),
+                    expected.serialize().as_ref()
+                );
+            }
+        }
+        union.reset();
+        assert_eq!(union.sketch().estimate(), 0.0);
+    }
+
+    #[test]
+    fn expression_errors() {
+        use ThetaExpression::*;
+        let bytes = theta_of(0..10).serialize().as_ref().to_vec();
+        let inputs = [bytes.as_slice()];
+        assert!(Input(1).evaluate(&inputs).is_err());
+        assert!(Union(vec![]).evaluate(&inputs).is_err());
+        assert!(Input(0).evaluate(&[&b"junk"[..]]).is_err());
+        assert_eq!(
+            Union(vec![Input(0)]).evaluate(&inputs).unwrap().estimate(),
+            10.0
+        );
+    }
+
+    #[test]
+    fn exclusion_matches_set_difference() {
+        let exclusion = theta_of(0..100 * 1000);
+        let prepared = ThetaExclusion::new(&exclusion);
+        for i in 0..20 {
+            let cohort = theta_of((i * 7919)..(i * 7919 + (1000 << (i % 8))));
+            let mut expected = cohort.clone();
+            expected.set_difference(&exclusion);
+            let mut excluded = cohort;
+            excluded.exclude(&prepared);
+            assert_eq!(excluded.serialize().as_ref(), expected.serialize().as_ref());
+        }
+        let mut empty = ThetaSketch::new().as_static();
+        empty.exclude(&prepared);
+        assert_eq!(empty.estimate(), 0.0);
+    }
+
+    #[test]
+    fn wrapped_unaligned_union() {
+        let n = 10 * 1000;
+        let mut owned = ThetaUnion::new();
+        let mut wrapped = ThetaUnion::new();
+        let mut serialized = ThetaUnion::new();
+        // serialized sketches packed back to back, at odd offsets
+        let mut buf = vec![0u8];
+        let mut ends = Vec::new();
+        for i in 0..5 {
+            let mut theta = ThetaSketch::new();
+            for key in (i * n)..(i * n + 2 * n) {
+                theta.update_u64(key);
+            }
+            owned.merge(theta.as_static());
+            buf.extend_from_slice(theta.as_static().serialize().as_ref());
+            ends.push(buf.len());
+        }
+        let mut start = 1;
+        for end in ends {
+            wrapped.merge_wrapped(&WrappedThetaSketch::wrap(&buf[start..end]).unwrap());
+            serialized.merge_serialized(&buf[start..end]).unwrap();
+            start = end;
+        }
+        assert_eq!(owned.sketch().estimate(), wrapped.sketch().estimate());
+        assert_eq!(
+            wrapped.sketch().serialize().as_ref(),
+            serialized.sketch().serialize().as_ref()
+        );
+        assert!(serialized.merge_serialized(&buf[1..10]).is_err());
+    }
+
+    #[test]
+    fn into_sketch_matches_sketch() {
+        assert!(ThetaIntersection::new().into_sketch().is_none());
+        let empty = ThetaUnion::new().into_sketch();
+        assert_eq!(
+            empty.serialize().as_ref(),
+            ThetaUnion::new().sketch().serialize().as_ref()
+        );
+        for &n in &[0u64, 10, 100 * 1000] {
+            let mut union = ThetaUnion::new();
+            let mut intersection = ThetaIntersection::new();
+            for i in 0..3 {
+                let theta = theta_of((i * n / 2)..(i * n / 2 + n));
+                union.merge_ref(&theta);
+                intersection.merge(theta);
+            }
+            let copied = union.sketch();
+            assert_eq!(
+                union.into_sketch().serialize().as_ref(),
+                copied.serialize().as_ref()
+            );
+            let copied = intersection.sketch().expect("non-inf");
+            assert_eq!(
+                intersection
+                    .into_sketch()
+                    .expect("non-inf")
+                    .serialize()
+                    .as_ref(),
+                copied.serialize().as_ref()
+            );
+        }
+    }
+
+    #[test]
+    fn union_of_parts_matches_whole() {
+        // each part is exact, so the union keeps the same k smallest hashes as a
+        // union of a single sketch of every key
+        let n = 1000;
+        let mut whole = ThetaSketch::new();
+        let mut parts = ThetaUnion::new();
+        for i in 0..20 {
+            let mut part = ThetaSketch::new();
+            for key in (i * n / 2)..(i * n / 2 + n) {
+                part.update_u64(key);
+                whole.update_u64(key);
+            }
+            parts.merge(part.as_static());
+        }
+        let mut union = ThetaUnion::new();
+        union.merge(whole.as_static());
+        let merged = parts.sketch();
+        check_cycle_static(&merged);
+        assert_eq!(
+            merged.serialize().as_ref(),
+            union.sketch().serialize().as_ref()
+        );
+    }
+
+    #[test]
+    fn union_of_tiny_parts_matches_whole() {
+        // parts of a few dozen keys are pended and merged in batches, ordered or not,
+        // and a result taken between batches still sees the pended ones
+        let n = 30;
+        let mut whole = ThetaSketch::new();
+        let mut parts = ThetaUnion::new();
+        for i in 0..10_000 {
+            let mut part = ThetaSketch::new();
+            for key in (i * n / 2)..(i * n / 2 + n) {
+                part.update_u64(key);
+                whole.update_u64(key);
+            }
+            if i % 3 == 0 {
+                parts.merge(part.as_static_unordered());
+            } else {
+                parts.merge(part.as_static());
+            }
+            if i == 100 {
+                assert_eq!(parts.sketch().estimate(), (100 * n / 2 + n) as f64);
+            }
+        }
+        let mut union = ThetaUnion::new();
+        union.merge(whole.as_static());
+        let merged = parts.sketch();
+        check_cycle_static(&merged);
+        assert_eq!(
+            merged.serialize().as_ref(),
+            union.sketch().serialize().as_ref()
+        );
+    }
+
+    #[test]
+    fn jaccard_matrix_of_exact_sketches() {
+        // sketch i holds keys [100 i, 100 i + 1000), so pairs 10 or more apart
+        // are disjoint, over a few tiles of the matrix
+        let n = 150;
+        let mut sketches: Vec<StaticThetaSketch> = (0..n)
+            .map(|i| {
+                let mut sketch = ThetaSketch::new();
+                (i * 100..i * 100 + 1000).for_each(|key| sketch.update_u64(key));
+                sketch.as_static()
+            })
+            .collect();
+        sketches.push(ThetaSketch::new().as_static());
+        let matrix = ThetaJaccardMatrix::new(&sketches);
+        let len = n as usize + 1;
+        assert_eq!(matrix.len(), len);
+
+        let all_pairs = matrix.all_pairs(1);
+        assert_eq!(all_pairs, matrix.all_pairs(3));
+        for i in 0..len {
+            for j in 0..len {
+                let expected = if i == j {
+                    1.0
+                } else if i == n as usize || j == n as usize {
+                    0.0
+                } else {
+                    let overlap = 1000.0 - 100.0 * (i as f64 - j as f64).abs();
+                    overlap.max(0.0) / (2000.0 - overlap.max(0.0))
+                };
+                assert_eq!(matrix.jaccard(i, j), (expected, expected, expected));
+                assert_eq!(all_pairs[i * len + j], (expected, expected, expected));
+            }
+        }
+        assert!(ThetaJaccardMatrix::new(&[]).all_pairs(4).is_empty());
+    }
+
+    #[test]
+    fn union_many_distinct() {
+        let n = 1000;
+        let serialized: Vec<Vec<u8>> = (0..n)
+            .map(|i| {
+                let mut theta = ThetaSketch::new();
+                ((i * 50)..(i * 50 + 100)).for_each(|key| theta.update_u64(key));
+                theta.as_static().serialize().as_ref().to_vec()
+            })
+            .collect();
+        let slices: Vec<&[u8]> = serialized.iter().map(|buf| buf.as_slice()).collect();
+        let lb = (n * 50) as f64 * 0.95;
+        let ub = (n * 50) as f64 * 1.05;
+        for &threads in &[1, 2, 3, 8] {
+            let merged = ThetaUnion::union_many(&slices, threads).unwrap();
+            check_cycle_static(&merged);
+            assert!((lb..ub).contains(&merged.estimate()));
+        }
+        assert_eq!(ThetaUnion::union_many(&[], 4).unwrap().estimate(), 0.0);
+
+        let mut bad = slices.clone();
+        bad[n as usize / 2] = &[9, 9, 9, 9];
+        assert!(matches!(
+            ThetaUnion::union_many(&bad, 4),
+            Err(DataSketchesError::CXXError(_))
+        ));
+    }
+
+    #[test]
+    fn estimate_many_matches_deserialized() {
+        // exact sketches, whose bounds are the estimate, and sampled ones
+        let serialized: Vec<Vec<u8>> = (0..300u64)
+            .map(|i| {
+                let mut theta = ThetaSketch::new();
+                (0..i * i).for_each(|key| theta.update_u64(key));
+                theta.as_static().serialize().as_ref().to_vec()
+            })
+            .collect();
+        let slices: Vec<&[u8]> = serialized.iter().map(|buf| buf.as_slice()).collect();
+
+        let narrow = StaticThetaSketch::estimate_many(&slices, 1, 1).unwrap();
+        for &threads in &[1, 3, 8] {
+            let wide = StaticThetaSketch::estimate_many(&slices, 3, threads).unwrap();
+            assert_eq!(wide.len(), slices.len());
+            for ((buf, &(est, lb, ub)), &(_, narrow_lb, narrow_ub)) in
+                slices.iter().zip(&wide).zip(&narrow)
+            {
+                assert_eq!(est, StaticThetaSketch::deserialize(buf).unwrap().estimate());
+                assert!(lb <= narrow_lb && narrow_lb <= est);
+                assert!(est <= narrow_ub && narrow_ub <= ub);
+            }
+        }
+        assert_eq!(narrow[10], (100.0, 100.0, 100.0));
+        assert!(narrow[299].1 < narrow[299].0 && narrow[299].0 < narrow[299].2);
+
+        let packed = serialized.concat();
+        let ends: Vec<usize> = serialized
+            .iter()
+            .scan(0, |end, buf| {
+                *end += buf.len();
+                Some(*end)
+            })
+            .collect();
+        let batch = StaticThetaSketch::bounds_serialized_batch(&packed, &ends, 1).unwrap();
+        assert_eq!(batch, narrow);
+        assert!(StaticThetaSketch::bounds_serialized_batch(&packed, &ends, 4).is_err());
+
+        assert!(StaticThetaSketch::estimate_many(&slices, 4, 2).is_err());
+        let mut bad = slices.clone();
+        bad[150] = &[9, 9, 9, 9];
+        assert!(matches!(
+            StaticThetaSketch::estimate_many(&bad, 2, 4),
+            Err(DataSketchesError::CXXError(_))
+        ));
+    }
+
+    #[test]
+    fn compressed_serialization_round_trip() {
+        use ThetaExpression::*;
+        for &n in &[0u64, 1, 2, 9, 1000, 100 * 1000] {
+            let theta = theta_of(0..n);
+            let plain = theta.serialize();
+            let compressed = theta.serialize_compressed();
+            let compressed = compressed.as_ref();
+            if n <= 1 {
+                assert_eq!(compressed, plain.as_ref());
+                continue;
+            }
+            assert!(compressed.len() < plain.as_ref().len());
+            let cpy = StaticThetaSketch::deserialize(compressed).unwrap();
+            assert_eq!(cpy.serialize().as_ref(), plain.as_ref());
+            assert_eq!(cpy.serialize_compressed().as_ref(), compressed);
+
+            let est = theta.estimate();
+            assert_eq!(
+                est,
+                StaticThetaSketch::estimate_serialized(compressed).unwrap()
+            );
+            assert_eq!(
+                StaticThetaSketch::bounds_serialized(compressed, 2).unwrap(),
+                StaticThetaSketch::bounds_serialized(plain.as_ref(), 2).unwrap()
+            );
+            let mut union = ThetaUnion::new();
+            union.merge_serialized(compressed).unwrap();
+            assert_eq!(est, union.sketch().estimate());
+            let merged = ThetaUnion::union_many(&[compressed, plain.as_ref()], 2).unwrap();
+            assert_eq!(est, merged.estimate());
+            let expression = Intersection(vec![Input(0), Input(1)]);
+            let result = expression.evaluate(&[compressed, plain.as_ref()]).unwrap();
+            assert_eq!(est, result.estimate());
+
+            assert!(matches!(
+                WrappedThetaSketch::wrap(compressed),
+                Err(DataSketchesError::CXXError(_))
+            ));
+            assert!(StaticThetaSketch::deserialize(&compressed[..compressed.len() - 1]).is_err());
+        }
+    }
+
+    #[test]
+    fn reset_matches_new() {
+        let mut theta = ThetaSketch::new();
+        let mut union = ThetaUnion::new();
+        for (i, &n) in [0u64, 10, 5000, 200000, 100].iter().enumerate() {
+            theta.reset();
+            union.reset();
+            let mut fresh = ThetaSketch::new();
+            let start = i as u64 * 1000000;
+            for key in start..start + n {
+                theta.update_u64(key);
+                fresh.update_u64(key);
+            }
+            let bytes = fresh.as_static().serialize();
+            assert_eq!(theta.as_static().serialize().as_ref(), bytes.as_ref());
+
+            let mut fresh_union = ThetaUnion::new();
+            fresh_union.merge(fresh.as_static());
+            union.merge(theta.as_static());
+            assert_eq!(
+                union.sketch().serialize().as_ref(),
+                fresh_union.sketch().serialize().as_ref()
+            );
+        }
+    }
+
+    #[test]
+    fn estimate_cached_until_update() {
+        let mut theta = ThetaSketch::new();
+        let mut window = ThetaWindow::new(ThetaSketch::DEFAULT_LG_K, 2).unwrap();
+        assert!(theta.is_dirty() && window.is_dirty());
+        assert_eq!((theta.estimate(), window.estimate()), (0.0, 0.0));
+        assert!(!theta.is_dirty() && !window.is_dirty());
+        for key in 0u64..10000 {
+            theta.update_u64(key);
+            window.update(&key.to_ne_bytes());
+        }
+        assert!(theta.is_dirty() && window.is_dirty());
+        let est = theta.estimate();
+        assert_eq!(est, theta.as_static().estimate());
+        assert_eq!(window.estimate(), window.sketch().estimate());
+        assert!(!theta.is_dirty() && !window.is_dirty());
+        window.advance();
+        assert!(window.is_dirty());
+        window.advance();
+        assert_eq!(window.estimate(), 0.0);
+        theta.reset();
+        assert!(theta.is_dirty());
+        assert_eq!(theta.estimate(), 0.0);
+    }
+
+    #[test]
+    fn window_matches_union_of_slices() {
+        // slice s has values [100 * s, 100 * s + 3000), so consecutive
+        // slices overlap and the window is in estimation mode
+        let slice = |s: u64| {
+            let mut theta = ThetaSketch::new();
+            (100 * s..100 * s + 3000).for_each(|key| theta.update(&key.to_ne_bytes()));
+            theta
+        };
+        for &n in &[1, 2, 5, 16] {
+            let mut window = ThetaWindow::new(ThetaSketch::DEFAULT_LG_K, n).unwrap();
+            assert_eq!(window.num_slices(), n);
+            assert_eq!(window.estimate(), 0.0);
+            for s in 0..50u64 {
+                let keys: Vec<u8> = (100 * s..100 * s + 3000)
+                    .flat_map(|key| key.to_ne_bytes())
+                    .collect();
+                let ends: Vec<usize> = (1..=3000).map(|i| i * 8).collect();
+                window.update_batch(&keys, &ends);
+
+                let mut union = ThetaUnion::new();
+                let oldest = (s + 1).saturating_sub(n as u64);
+                (oldest..=s).for_each(|s| union.merge(slice(s).as_static()));
+                let expected = union.sketch().estimate();
+                let est = window.estimate();
+                assert!(
+                    (est - expected).abs() <= expected * 0.02,
+                    "{} {}",
+                    est,
+                    expected
+                );
+                assert_eq!(window.sketch().estimate(), est);
+                let exact = (100 * (s + 1 - oldest) + 2900) as f64;
+                assert!((exact * 0.95..exact * 1.05).contains(&est));
+                window.advance();
+            }
+        }
+        assert!(ThetaWindow::new(ThetaSketch::DEFAULT_LG_K, 0).is_err());
+        assert!(ThetaWindow::new(4, 10).is_err());
+        assert!(ThetaWindow::with_p(ThetaSketch::DEFAULT_LG_K, 0.0, 10).is_err());
+    }
+
+    #[test]
+    fn sampled_window() {
+        let mut window = ThetaWindow::with_p(ThetaSketch::DEFAULT_LG_K, 0.25, 3).unwrap();
+        for slice in 0u64..10 {
+            for key in (slice * 1000)..(slice * 1000 + 2000) {
+                window.update(&key.to_ne_bytes());
+            }
+            window.advance();
+        }
+        // the window holds slices 8 and 9, of keys 8000..11000, and an empty one
+        let (est, lower, upper) = window.sketch().bounds(3).unwrap();
+        assert_eq!(est, window.estimate());
+        assert!(lower < 3000.0 && 3000.0 < upper, "{} {}", lower, upper);
+    }
+
+    #[test]
+    fn keyed_theta_shares_theta() {
+        // key i has 10 * (i + 1) values, 5M pairs in all
+        let key_hash = |i: u32| KeyHash::new(&i.to_ne_bytes()).h1;
+        let mut all = KeyedThetaSketch::new(14).unwrap();
+        let mut odd = KeyedThetaSketch::new(14).unwrap();
+        // even names key i as 999 - i
+        let mut even = KeyedThetaSketch::new(14).unwrap();
+        for i in 0..1000u32 {
+            for value in 0..10 * (u64::from(i) + 1) {
+                all.update(i, key_hash(i), &value.to_ne_bytes());
+                match value % 2 {
+                    1 => odd.update(i, key_hash(i), &value.to_ne_bytes()),
+                    _ => even.update(999 - i, key_hash(i), &value.to_ne_bytes()),
+                }
+            }
+        }
+        assert!(all.theta() < 0.01);
+        assert!(all.num_retained() < 2 << 14);
+        assert!(all.memory_usage_bytes() <= 16 << 15);
+        let estimates = all.estimates(1000).unwrap();
+        let large: f64 = estimates[900..].iter().sum();
+        let exact = (901..=1000).map(|i| 10.0 * f64::from(i)).sum::<f64>();
+        assert!((large - exact).abs() < exact * 0.05, "{} {}", large, exact);
+        assert!(all.estimates(999).is_err());
+
+        let key_map: Vec<u32> = (0..1000).rev().collect();
+        odd.merge(&even, &key_map).unwrap();
+        let merged: f64 = odd.estimates(1000).unwrap()[900..].iter().sum();
+        assert!(
+            (merged - exact).abs() < exact * 0.05,
+            "{} {}",
+            merged,
+            exact
+        );
+        assert!(odd.merge(&even, &key_map[..10]).is_err());
+        assert!(KeyedThetaSketch::new(4).is_err());
+        assert_eq!(
+            KeyedThetaSketch::new(5).unwrap().estimates(3).unwrap(),
+            [0.0; 3]
+        );
+    }
+
     #[test]
     fn theta_static_deserialization_error() {
         assert!(matches!(
             StaticThetaSketch::deserialize(&[9, 9, 9, 9]),
             Err(DataSketchesError::CXXError(_))
         ));
+        assert!(matches!(
+            WrappedThetaSketch::wrap(&[9, 9, 9, 9]),
+            Err(DataSketchesError::CXXError(_))
+        ));
+        assert!(matches!(
+            StaticThetaSketch::estimate_serialized(&[9, 9, 9, 9]),
+            Err(DataSketchesError::CXXError(_))
+        ));
+
+        // the hashes are not read, but must all be there
+        let mut theta = ThetaSketch::new();
+        (0..100).for_each(|key| theta.update_u64(key));
+        let bytes = theta.as_static().serialize();
+        let bytes = bytes.as_ref();
+        assert!(StaticThetaSketch::estimate_serialized(&bytes[..bytes.len() - 1]).is_err());
+        assert!(StaticThetaSketch::bounds_serialized(&bytes[..bytes.len() - 1], 2).is_err());
+        assert!(StaticThetaSketch::bounds_serialized(bytes, 0).is_err());
     }
 }
@@ -0,0 +1,555 @@
+//! Wrapper types for the Tuple sketch, with arrays of doubles as summaries.
+
+use cxx;
+
+use crate::bridge::ffi;
+pub use crate::bridge::ffi::AodCombine;
+use crate::DataSketchesError;
+
+/// An array of doubles [Tuple][orig-docs] sketch is a
+/// [`crate::ThetaSketch`] whose retained values each carry a fixed number
+/// of doubles, which sum what the value was updated with. It estimates a
+/// distinct count and, from the same sample, sums of metrics over the
+/// stream, e.g. the number of users and their total spend.
+///
+/// Values hash as they would for a [`crate::ThetaSketch`], so both sample
+/// the same values of a stream.
+///
+/// [orig-docs]: https://datasketches.apache.org/docs/Tuple/TupleOverview.html
+pub struct ArrayOfDoublesSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueAodSketch>,
+    num_values: u8,
+}
+
+impl ArrayOfDoublesSketch {
+    /// Create a sketch of the empty set, whose values each carry
+    /// `num_values` doubles.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn new(num_values: u8) -> Self {
+        Self::with_expected_n(num_values, 0)
+    }
+
+    /// Like [`Self::new`], but sizes the hash table for about `expected_n`
+    /// distinct values up front, as [`crate::ThetaSketch::with_expected_n`]
+    /// does.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn with_expected_n(num_values: u8, expected_n: u64) -> Self {
+        assert!(num_values > 0, "need at least one value");
+        Self {
+            inner: ffi::new_opaque_aod_sketch(num_values, expected_n),
+            num_values,
+        }
+    }
+
+    /// Return the current estimate of distinct values seen.
+    pub fn estimate(&self) -> f64 {
+        self.inner.estimate()
+    }
+
+    /// Observe a new value, adding `values` to its sums. Two values must
+    /// have the exact same bytes and lengths to be considered equal.
+    ///
+    /// Panics unless there are `num_values` of `values`.
+    pub fn update(&mut self, value: &[u8], values: &[f64]) {
+        self.check_values(values);
+        // Safety: the C++ update reads exactly `num_values` doubles.
+        unsafe { self.inner.pin_mut().update(value, values) }
+    }
+
+    /// Observe a new `u64`, as [`crate::ThetaSketch::update_u64`] does,
+    /// adding `values` to its sums.
+    pub fn update_u64(&mut self, value: u64, values: &[f64]) {
+        self.check_values(values);
+        // Safety: as for `update`.
+        unsafe { self.inner.pin_mut().update_u64(value, values) }
+    }
+
+    pub fn as_static(&self) -> StaticArrayOfDoublesSketch {
+        StaticArrayOfDoublesSketch {
+            inner: self.inner.as_static(),
+        }
+    }
+
+    fn check_values(&self, values: &[f64]) {
+        assert_eq!(
+            values.len(),
+            self.num_values as usize,
+            "wrong number of values"
+        );
+    }
+}
+
+/// The immutable form of an [`ArrayOfDoublesSketch`], which can be
+/// serialized and combined with others.
+pub struct StaticArrayOfDoublesSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueStaticAodSketch>,
+}
+
+impl StaticArrayOfDoublesSketch {
+    /// Return the current estimate of distinct values seen.
+    pub fn estimate(&self) -> f64 {
+        self.inner.estimate()
+    }
+
+    /// Return the number of doubles each value carries.
+    pub fn num_values(&self) -> u8 {
+        self.inner.num_values()
+    }
+
+    /// Return the estimated sum of each of the doubles over all values in
+    /// the stream, which is exact while the distinct count is.
+    pub fn estimate_sums(&self) -> Vec<f64> {
+        self.inner.estimate_sums().iter().copied().collect()
+    }
+
+    pub fn serialize(&self) -> impl AsRef<[u8]> {
+        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+        impl AsRef<[u8]> for UPtrVec {
+            fn as_ref(&self) -> &[u8] {
+                self.0.as_slice()
+            }
+        }
+        UPtrVec(self.inner.serialize())
+    }
+
+    pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::deserialize_opaque_static_aod_sketch(buf)?,
+        })
+    }
+
+    /// Copy the sketch into [`ArrayOfDoublesColumns`].
+    pub fn to_columns(&self) -> ArrayOfDoublesColumns {
+        ArrayOfDoublesColumns {
+            inner: self.inner.to_columns(),
+        }
+    }
+}
+
+impl Clone for StaticArrayOfDoublesSketch {
+    fn clone(&self) -> Self {
+        Self {
+            inner: self.inner.clone(),
+        }
+    }
+}
+
+/// Panics unless `sketch` carries `num_values` doubles like the set
+/// operation it is merged into, which the C++ summaries do not check.
+fn check_num_values(sketch: &StaticArrayOfDoublesSketch, num_values: u8) {
+    assert_eq!(
+        sketch.num_values(),
+        num_values,
+        "merged sketch has the wrong number of values"
+    );
+}
+
+/// A union of [`StaticArrayOfDoublesSketch`]es, in which the doubles of a
+/// value in several of them are summed.
+pub struct ArrayOfDoublesUnion {
+    inner: cxx::UniquePtr<ffi::OpaqueAodUnion>,
+    num_values: u8,
+}
+
+impl ArrayOfDoublesUnion {
+    /// Create a union over nothing, which corresponds to the empty set,
+    /// of sketches with `num_values` doubles.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn new(num_values: u8) -> Self {
+        assert!(num_values > 0, "need at least one value");
+        Self {
+            inner: ffi::new_opaque_aod_union(num_values),
+            num_values,
+        }
+    }
+
+    /// Panics unless `sketch` has as many doubles as the union.
+    pub fn merge(&mut self, sketch: StaticArrayOfDoublesSketch) {
+        check_num_values(&sketch, self.num_values);
+        self.inner.pin_mut().union_with(sketch.inner)
+    }
+
+    /// Retrieve the current unioned sketch as a copy.
+    pub fn sketch(&self) -> StaticArrayOfDoublesSketch {
+        StaticArrayOfDoublesSketch {
+            inner: self.inner.sketch(),
+        }
+    }
+}
+
+/// An intersection of [`StaticArrayOfDoublesSketch`]es, in which the
+/// doubles of the values they have in common are summed.
+pub struct ArrayOfDoublesIntersection {
+    inner: cxx::UniquePtr<ffi::OpaqueAodIntersection>,
+    num_values: u8,
+}
+
+impl ArrayOfDoublesIntersection {
+    /// Create an intersection of sketches with `num_values` doubles.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn new(num_values: u8) -> Self {
+        assert!(num_values > 0, "need at least one value");
+        Self {
+            inner: ffi::new_opaque_aod_intersection(num_values),
+            num_values,
+        }
+    }
+
+    /// Panics unless `sketch` has as many doubles as the intersection.
+    pub fn merge(&mut self, sketch: StaticArrayOfDoublesSketch) {
+        check_num_values(&sketch, self.num_values);
+        self.inner.pin_mut().intersect_with(sketch.inner);
+    }
+
+    /// Retrieve the current intersected sketch as a copy. Returns `None`
+    /// if the sketch represents the universal set (which it does before
+    /// at least one call to `merge()`.)
+    pub fn sketch(&self) -> Option<StaticArrayOfDoublesSketch> {
+        let inner = self.inner.sketch();
+        let valid = !inner.is_null();
+        valid.then(|| StaticArrayOfDoublesSketch { inner })
+    }
+}
+
+/// A [`StaticArrayOfDoublesSketch`] laid out as columns: the sorted hashes
+/// of its retained values, and for each of the doubles a column of them
+/// parallel to the hashes. Sums over a column and unions read contiguous
+/// doubles, rather than a separate array for each retained value.
+///
+/// It serializes exactly as an ordered [`StaticArrayOfDoublesSketch`],
+/// so either can deserialize the other.
+pub struct ArrayOfDoublesColumns {
+    inner: cxx::UniquePtr<ffi::OpaqueAodColumns>,
+}
+
+impl ArrayOfDoublesColumns {
+    /// Return the current estimate of distinct values seen.
+    pub fn estimate(&self) -> f64 {
+        self.inner.estimate()
+    }
+
+    /// Return the number of doubles each value carries.
+    pub fn num_values(&self) -> u8 {
+        self.inner.num_values()
+    }
+
+    /// Return the hashes of the retained values, in ascending order.
+    pub fn hashes(&self) -> &[u64] {
+        self.inner.hashes()
+    }
+
+    /// Return the `index`-th double of each retained value, in the order
+    /// of [`Self::hashes`].
+    ///
+    /// Panics unless `index` is less than [`Self::num_values`].
+    pub fn column(&self, index: u8) -> &[f64] {
+        assert!(index < self.num_values(), "column index out of range");
+        // Safety: the index was just checked.
+        unsafe { self.inner.column(index) }
+    }
+
+    /// As [`StaticArrayOfDoublesSketch::estimate_sums`].
+    pub fn estimate_sums(&self) -> Vec<f64> {
+        self.inner.estimate_sums().iter().copied().collect()
+    }
+
+    /// Copy the columns back into a [`StaticArrayOfDoublesSketch`].
+    pub fn to_sketch(&self) -> StaticArrayOfDoublesSketch {
+        StaticArrayOfDoublesSketch {
+            inner: self.inner.to_sketch(),
+        }
+    }
+
+    pub fn serialize(&self) -> impl AsRef<[u8]> {
+        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+        impl AsRef<[u8]> for UPtrVec {
+            fn as_ref(&self) -> &[u8] {
+                self.0.as_slice()
+            }
+        }
+        UPtrVec(self.inner.serialize())
+    }
+
+    /// Deserialize the columns of a serialized
+    /// [`StaticArrayOfDoublesSketch`], without materializing one.
+    pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::deserialize_opaque_aod_columns(buf)?,
+        })
+    }
+}
+
+impl Clone for ArrayOfDoublesColumns {
+    fn clone(&self) -> Self {
+        Self {
+            inner: self.inner.clone(),
+        }
+    }
+}
+
+/// An [`ArrayOfDoublesUnion`] over [`ArrayOfDoublesColumns`], with the
+/// same results. The doubles of the merged values are summed a column at
+/// a time, or combined as another [`AodCombine`] says.
+pub struct ArrayOfDoublesColumnsUnion {
+    inner: cxx::UniquePtr<ffi::OpaqueAodColumnsUnion>,
+    num_values: u8,
+}
+
+impl ArrayOfDoublesColumnsUnion {
+    /// Create a union over nothing, which corresponds to the empty set,
+    /// of columns with `num_values` doubles.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn new(num_values: u8) -> Self {
+        Self::with_combine(num_values, AodCombine::Sum)
+    }
+
+    /// Like [`Self::new`], but combines the doubles of values in more
+    /// than one input as `combine` says rather than summing them.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn with_combine(num_values: u8, combine: AodCombine) -> Self {
+        assert!(num_values > 0, "need at least one value");
+        Self {
+            inner: ffi::new_opaque_aod_columns_union(num_values, combine),
+            num_values,
+        }
+    }
+
+    /// Panics unless `columns` has as many doubles as the union.
+    pub fn merge(&mut self, columns: &ArrayOfDoublesColumns) {
+        assert_eq!(
+            columns.num_values(),
+            self.num_values,
+            "merged sketch has the wrong number of values"
+        );
+        self.inner.pin_mut().union_with(&columns.inner)
+    }
+
+    /// Retrieve the current unioned columns as a copy.
+    pub fn columns(&self) -> ArrayOfDoublesColumns {
+        ArrayOfDoublesColumns {
+            inner: self.inner.sketch(),
+        }
+    }
+}
+
+/// An [`ArrayOfDoublesIntersection`] over [`ArrayOfDoublesColumns`], with
+/// the same results. The doubles of the values in common are summed a
+/// column at a time, or combined as another [`AodCombine`] says.
+pub struct ArrayOfDoublesColumnsIntersection {
+    inner: cxx::UniquePtr<ffi::OpaqueAodColumnsIntersection>,
+    num_values: u8,
+}
+
+impl ArrayOfDoublesColumnsIntersection {
+    /// Create an intersection over nothing, which corresponds to the
+    /// full universe, of columns with `num_values` doubles.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn new(num_values: u8) -> Self {
+        Self::with_combine(num_values, AodCombine::Sum)
+    }
+
+    /// Like [`Self::new`], but combines the doubles of the values in
+    /// common as `combine` says rather than summing them.
+    ///
+    /// Panics if `num_values` is 0.
+    pub fn with_combine(num_values: u8, combine: AodCombine) -> Self {
+        assert!(num_values > 0, "need at least one value");
+        Self {
+            inner: ffi::new_opaque_aod_columns_intersection(num_values, combine),
+            num_values,
+        }
+    }
+
+    /// Panics unless `columns` has as many doubles as the intersection.
+    pub fn merge(&mut self, columns: &ArrayOfDoublesColumns) {
+        assert_eq!(
+            columns.num_values(),
+            self.num_values,
+            "merged sketch has the wrong number of values"
+        );
+        self.inner.pin_mut().intersect_with(&columns.inner)
+    }
+
+    /// Retrieve the current intersected columns as a copy, or [`None`]
+    /// if nothing has been merged, as for
+    /// [`ArrayOfDoublesIntersection::sketch`].
+    pub fn columns(&self) -> Option<ArrayOfDoublesColumns> {
+        let inner = self.inner.sketch();
+        if inner.is_null() {
+            None
+        } else {
+            Some(ArrayOfDoublesColumns { inner })
+        }
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn aod_of(keys: impl Iterator<Item = u64>) -> ArrayOfDoublesSketch {
+        let mut aod = ArrayOfDoublesSketch::new(2);
+        keys.for_each(|key| aod.update_u64(key, &[1.0, key as f64]));
+        aod
+    }
+
+    #[test]
+    fn exact_sums() {
+        let mut aod = aod_of(0..1000);
+        // repeated values still count once, but add to their sums
+        aod.update_u64(7, &[1.0, 7.0]);
+        let sketch = aod.as_static();
+        assert_eq!(sketch.estimate(), 1000.0);
+        assert_eq!(sketch.estimate_sums(), vec![1001.0, 499507.0]);
+        let bytes = sketch.serialize();
+        let cycled = StaticArrayOfDoublesSketch::deserialize(bytes.as_ref()).unwrap();
+        assert_eq!(cycled.num_values(), 2);
+        assert_eq!(cycled.estimate_sums(), sketch.estimate_sums());
+        assert!(StaticArrayOfDoublesSketch::deserialize(&bytes.as_ref()[1..]).is_err());
+    }
+
+    #[test]
+    fn estimated_sums() {
+        let n = 1000 * 1000;
+        let sums = aod_of(0..n).as_static().estimate_sums();
+        let count = n as f64;
+        assert!(
+            (count * 0.95..count * 1.05).contains(&sums[0]),
+            "{}",
+            sums[0]
+        );
+        let total = (n * (n - 1) / 2) as f64;
+        assert!(
+            (total * 0.95..total * 1.05).contains(&sums[1]),
+            "{}",
+            sums[1]
+        );
+    }
+
+    #[test]
+    fn union_and_intersection() {
+        let a = aod_of(0..1000).as_static();
+        let b = aod_of(500..2000).as_static();
+        let mut union = ArrayOfDoublesUnion::new(2);
+        union.merge(a.clone());
+        union.merge(b.clone());
+        let merged = union.sketch();
+        assert_eq!(merged.estimate(), 2000.0);
+        // the overlap is counted twice in the sums
+        assert_eq!(merged.estimate_sums()[0], 2500.0);
+
+        let mut intersection = ArrayOfDoublesIntersection::new(2);
+        assert!(intersection.sketch().is_none());
+        intersection.merge(a);
+        intersection.merge(b);
+        let common = intersection.sketch().expect("non-inf");
+        assert_eq!(common.estimate(), 500.0);
+        assert_eq!(common.estimate_sums()[0], 1000.0);
+    }
+
+    #[test]
+    fn columns_match_sketch() {
+        let a = aod_of(0..1000).as_static();
+        let b = aod_of((500..100 * 1000).map(|key| key * 7)).as_static();
+        let columns = b.to_columns();
+        assert_eq!(columns.estimate(), b.estimate());
+        assert!(columns.hashes().windows(2).all(|w| w[0] < w[1]));
+        assert_eq!(columns.column(1).len(), columns.hashes().len());
+        let sums = columns.estimate_sums();
+        let expected = b.estimate_sums();
+        for (sum, expected) in sums.iter().zip(expected.iter()) {
+            assert!((sum - expected).abs() <= 1e-9 * expected, "{}", sum);
+        }
+        // the serialized forms are interchangeable
+        let bytes = columns.serialize();
+        assert_eq!(bytes.as_ref(), b.serialize().as_ref());
+        let cycled = StaticArrayOfDoublesSketch::deserialize(bytes.as_ref()).unwrap();
+        assert_eq!(cycled.estimate_sums(), b.estimate_sums());
+        let cycled = ArrayOfDoublesColumns::deserialize(bytes.as_ref()).unwrap();
+        assert_eq!(cycled.hashes(), columns.hashes());
+        assert_eq!(cycled.to_sketch().estimate_sums(), b.estimate_sums());
+        assert!(ArrayOfDoublesColumns::deserialize(&bytes.as_ref()[1..]).is_err());
+
+        let mut union = ArrayOfDoublesUnion::new(2);
+        let mut columns_union = ArrayOfDoublesColumnsUnion::new(2);
+        for sketch in &[a, b] {
+            union.merge(sketch.clone());
+            columns_union.merge(&sketch.to_columns());
+        }
+        assert_eq!(
+            columns_union.columns().serialize().as_ref(),
+            union.sketch().serialize().as_ref()
+        );
+    }
+
+    #[test]
+    fn columns_intersection_and_combines() {
+        let a = aod_of(0..1000).as_static();
+        let b = aod_of((500..100 * 1000).map(|key| key * 7)).as_static();
+        let mut intersection = ArrayOfDoublesIntersection::new(2);
+        let mut columns_intersection = ArrayOfDoublesColumnsIntersection::new(2);
+        assert!(columns_intersection.columns().is_none());
+        for sketch in &[a.clone(), b.clone()] {
+            intersection.merge(sketch.clone());
+            columns_intersection.merge(&sketch.to_columns());
+        }
+        assert_eq!(
+            columns_intersection
+                .columns()
+                .expect("merged")
+                .serialize()
+                .as_ref(),
+            intersection.sketch().expect("merged").serialize().as_ref()
+        );
+
+        // each value counts 1.0 in the one sketch and 2.0 in the other
+        let mut twice = ArrayOfDoublesSketch::new(2);
+        (500..2000).for_each(|key| twice.update_u64(key, &[2.0, key as f64]));
+        let twice = twice.as_static().to_columns();
+        let once = a.to_columns();
+        for &(combine, common) in &[
+            (AodCombine::Sum, 3.0),
+            (AodCombine::Min, 1.0),
+            (AodCombine::Max, 2.0),
+        ] {
+            let mut union = ArrayOfDoublesColumnsUnion::with_combine(2, combine);
+            let mut intersection = ArrayOfDoublesColumnsIntersection::with_combine(2, combine);
+            union.merge(&once);
+            union.merge(&twice);
+            intersection.merge(&once);
+            intersection.merge(&twice);
+            let merged = union.columns();
+            assert_eq!(merged.hashes().len(), 2000);
+            for (hash, &count) in merged.hashes().iter().zip(merged.column(0)) {
+                let expected = match (
+                    once.hashes().binary_search(hash).is_ok(),
+                    twice.hashes().binary_search(hash).is_ok(),
+                ) {
+                    (true, true) => common,
+                    (true, false) => 1.0,
+                    _ => 2.0,
+                };
+                assert_eq!(count, expected, "{:?}", combine);
+            }
+            let common_columns = intersection.columns().expect("merged");
+            assert_eq!(common_columns.hashes().len(), 500);
+            assert!(common_columns
+                .column(0)
+                .iter()
+                .all(|&count| count == common));
+        }
+    }
+
+    #[test]
+    #[should_panic(expected = "wrong number of values")]
+    fn wrong_num_values() {
+        ArrayOfDoublesSketch::new(2).update(b"a", &[1.0]);
+    }
+}
@@ -0,0 +1,430 @@
+//! Wrapper types for the var_opt weighted sampling sketch.
+
+use std::convert::TryInto;
+use std::slice;
+
+use cxx;
+
+use crate::bridge::ffi;
+use crate::wrapper::{check_batch_ends, union_many, SerializedUnion};
+use crate::DataSketchesError;
+
+/// The [var_opt][orig-docs] sketch keeps a weighted sample of at most `k`
+/// byte strings from a stream of weighted ones. Each sampled item carries
+/// an adjusted weight, so that summing the adjusted weights of the items
+/// in any subset of the sample estimates that subset's total weight in
+/// the stream with optimal variance, which [`Self::estimate_subset_sum`]
+/// does along with bounds.
+///
+/// Items heavier than the sample would otherwise allow are kept exactly
+/// with their own weight; the rest share one adjusted weight.
+///
+/// [orig-docs]: https://datasketches.apache.org/docs/Sampling/VarOptSampling.html
+pub struct VarOptSketch {
+    inner: cxx::UniquePtr<ffi::OpaqueVarOptSketch>,
+}
+
+/// Bounds on the total weight of some subset of the stream a
+/// [`VarOptSketch`] sampled, as given by [`VarOptSketch::estimate_subset_sum`].
+#[derive(Clone, Copy, Debug, PartialEq)]
+pub struct SubsetSummary {
+    pub lower_bound: f64,
+    pub estimate: f64,
+    pub upper_bound: f64,
+    /// The total weight of the stream, which the sample's adjusted
+    /// weights sum to.
+    pub total_sketch_weight: f64,
+}
+
+impl SubsetSummary {
+    fn from_ffi(summary: &ffi::SubsetSummary) -> Self {
+        Self {
+            lower_bound: summary.lower_bound,
+            estimate: summary.estimate,
+            upper_bound: summary.upper_bound,
+            total_sketch_weight: summary.total_sketch_weight,
+        }
+    }
+}
+
+impl VarOptSketch {
+    /// Create a sketch of the empty stream which samples at most `k`
+    /// items. Fails unless `1 <= k < 2^31 - 1`.
+    pub fn new(k: u32) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_var_opt_sketch(k)?,
+        })
+    }
+
+    /// Return the most items this sketch samples.
+    pub fn k(&self) -> u32 {
+        self.inner.get_k()
+    }
+
+    /// Return the number of items seen with a positive weight.
+    pub fn n(&self) -> u64 {
+        self.inner.get_n()
+    }
+
+    /// Return the number of items in the sample, which is at most
+    /// [`Self::k`].
+    pub fn num_samples(&self) -> u32 {
+        self.inner.get_num_samples()
+    }
+
+    pub fn is_empty(&self) -> bool {
+        self.inner.is_empty()
+    }
+
+    /// Empty the sketch, as if it were new.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+
+    /// Observe `item` with the given weight. Items with weight 0 are
+    /// ignored. Fails unless `weight` is finite and nonnegative.
+    pub fn update(&mut self, item: &[u8], weight: f64) -> Result<(), DataSketchesError> {
+        Ok(self.inner.pin_mut().update(item, weight)?)
+    }
+
+    /// Observe each of the items packed into `buf`, which end at the
+    /// offsets in `ends`, with weight 1, in one call across the bridge.
+    /// Items are staged in a buffer the sketch reuses, so the ones it
+    /// does not sample are never allocated.
+    ///
+    /// Panics if `ends` does not describe consecutive items in `buf`.
+    pub fn update_batch(&mut self, buf: &[u8], ends: &[usize]) {
+        check_batch_ends(buf, ends);
+        self.inner
+            .pin_mut()
+            .update_batch(buf, ends, &[])
+            .expect("unit weights are valid")
+    }
+
+    /// Observe items as [`Self::update_batch`] does, each with its weight
+    /// in `weights`. Fails at the first invalid weight, as
+    /// [`Self::update`] would, having observed the items before it.
+    ///
+    /// Panics if `ends` does not describe consecutive items in `buf` or
+    /// there is not one weight per item.
+    pub fn update_weighted_batch(
+        &mut self,
+        buf: &[u8],
+        ends: &[usize],
+        weights: &[f64],
+    ) -> Result<(), DataSketchesError> {
+        check_batch_ends(buf, ends);
+        assert_eq!(ends.len(), weights.len(), "need one weight per item");
+        Ok(self.inner.pin_mut().update_batch(buf, ends, weights)?)
+    }
+
+    /// Return the sampled items with their adjusted weights, exactly kept
+    /// heavy items first.
+    pub fn samples(&self) -> Vec<(&[u8], f64)> {
+        self.inner
+            .samples()
+            .iter()
+            .map(|row| {
+                // The item is owned by the sketch, which cannot be updated
+                // while borrowed.
+                let item = unsafe { slice::from_raw_parts(row.addr as *const u8, row.len) };
+                (item, row.weight)
+            })
+            .collect()
+    }
+
+    /// Estimate the total weight of the items in the stream for which
+    /// `predicate` holds, from the sampled ones.
+    pub fn estimate_subset_sum(&self, mut predicate: impl FnMut(&[u8]) -> bool) -> SubsetSummary {
+        let matches: Vec<bool> = self
+            .samples()
+            .into_iter()
+            .map(|(item, _)| predicate(item))
+            .collect();
+        let summary = self
+            .inner
+            .estimate_subset_sum(&matches)
+            .expect("one match per sample");
+        SubsetSummary::from_ffi(&summary)
+    }
+
+    /// Estimate the total weights of many disjoint subsets of the stream,
+    /// as [`Self::estimate_subset_sum`] would for each, but in one pass
+    /// over the sample however many there are. `group` returns the index
+    /// of the subset a sampled item is in, below `num_groups`, if any.
+    /// Returns the summary of each subset by index.
+    ///
+    /// Panics if `group` returns an index of `num_groups` or more, or if
+    /// `num_groups` does not fit in a `u32`.
+    pub fn estimate_subset_sums(
+        &self,
+        num_groups: usize,
+        mut group: impl FnMut(&[u8]) -> Option<usize>,
+    ) -> Vec<SubsetSummary> {
+        let num_groups: u32 = num_groups.try_into().expect("fewer than 2^32 groups");
+        let groups: Vec<u32> = self
+            .samples()
+            .into_iter()
+            .map(|(item, _)| match group(item) {
+                Some(g) => {
+                    assert!(g < num_groups as usize, "group {} out of range", g);
+                    g as u32
+                }
+                None => u32::MAX,
+            })
+            .collect();
+        self.inner
+            .estimate_subset_sums(&groups, num_groups)
+            .expect("one group per sample")
+            .iter()
+            .map(SubsetSummary::from_ffi)
+            .collect()
+    }
+
+    /// Serializes to the format of `var_opt_sketch<std::string>`, which
+    /// other datasketches libraries can read as string samples.
+    pub fn serialize(&self) -> impl AsRef<[u8]> {
+        struct UPtrVec(cxx::UniquePtr<cxx::CxxVector<u8>>);
+        impl AsRef<[u8]> for UPtrVec {
+            fn as_ref(&self) -> &[u8] {
+                self.0.as_slice()
+            }
+        }
+        UPtrVec(self.inner.serialize())
+    }
+
+    pub fn deserialize(buf: &[u8]) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::deserialize_opaque_var_opt_sketch(buf)?,
+        })
+    }
+}
+
+impl Clone for VarOptSketch {
+    fn clone(&self) -> Self {
+        Self {
+            inner: self.inner.clone(),
+        }
+    }
+}
+
+/// The union of [`VarOptSketch`]es, such as those of shards of a stream
+/// sampled in parallel, which is a sample of their combined streams.
+pub struct VarOptUnion {
+    inner: cxx::UniquePtr<ffi::OpaqueVarOptUnion>,
+}
+
+impl VarOptUnion {
+    /// Create an empty union whose result samples at most `max_k` items.
+    /// Fails unless `1 <= max_k < 2^31 - 1`.
+    pub fn new(max_k: u32) -> Result<Self, DataSketchesError> {
+        Ok(Self {
+            inner: ffi::new_opaque_var_opt_union(max_k)?,
+        })
+    }
+
+    pub fn merge(&mut self, sketch: &VarOptSketch) {
+        self.inner.pin_mut().update(&sketch.inner)
+    }
+
+    /// Deserialize a sketch from `buf` and merge it in.
+    pub fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        self.merge_all_serialized(&[buf])
+    }
+
+    /// Deserialize and merge in all of `serialized`, in one call across
+    /// the bridge, with the union sized for all of their samples up front.
+    /// Nothing is merged if any of them fails to deserialize.
+    pub fn merge_all_serialized(&mut self, serialized: &[&[u8]]) -> Result<(), DataSketchesError> {
+        let mut buf = Vec::with_capacity(serialized.iter().map(|s| s.len()).sum());
+        let ends: Vec<usize> = serialized
+            .iter()
+            .map(|s| {
+                buf.extend_from_slice(s);
+                buf.len()
+            })
+            .collect();
+        Ok(self.inner.pin_mut().update_serialized(&buf, &ends)?)
+    }
+
+    /// Return the sample of everything merged so far. The union may keep
+    /// being merged into afterwards.
+    pub fn sketch(&self) -> VarOptSketch {
+        VarOptSketch {
+            inner: self.inner.get_result(),
+        }
+    }
+
+    /// Empty the union, as if it were new.
+    pub fn reset(&mut self) {
+        self.inner.pin_mut().reset()
+    }
+
+    /// Deserializes and unions all of `serialized` into a sample of at
+    /// most `max_k` items on `threads` threads, each merging its share
+    /// with [`Self::merge_all_serialized`] into a union of its own before
+    /// the partial unions are combined pairwise.
+    ///
+    /// Panics if `threads` is 0.
+    pub fn union_many(
+        max_k: u32,
+        serialized: &[&[u8]],
+        threads: usize,
+    ) -> Result<VarOptSketch, DataSketchesError> {
+        Self::new(max_k)?;
+        union_many(serialized, threads, || {
+            Self::new(max_k).expect("valid max_k")
+        })
+    }
+}
+
+impl SerializedUnion for VarOptUnion {
+    type Sketch = VarOptSketch;
+
+    fn merge_serialized(&mut self, buf: &[u8]) -> Result<(), DataSketchesError> {
+        VarOptUnion::merge_serialized(self, buf)
+    }
+
+    fn merge_all_serialized(&mut self, bufs: &[&[u8]]) -> Result<(), DataSketchesError> {
+        VarOptUnion::merge_all_serialized(self, bufs)
+    }
+
+    fn merge_sketch(&mut self, sketch: VarOptSketch) {
+        self.merge(&sketch)
+    }
+
+    fn result(&self) -> VarOptSketch {
+        self.sketch()
+    }
+}
+
+#[cfg(test)]
+mod tests {
+    use super::*;
+
+    fn lines(n: usize) -> (Vec<u8>, Vec<usize>) {
+        let mut buf = Vec::new();
+        let ends = (0..n)
+            .map(|i| {
+                let level = if i % 10 == 0 { "error" } else { "info" };
+                buf.extend_from_slice(format!("{} line {}", level, i).as_bytes());
+                buf.len()
+            })
+            .collect();
+        (buf, ends)
+    }
+
+    #[test]
+    fn exact_below_k() {
+        let mut sketch = VarOptSketch::new(100).unwrap();
+        assert!(sketch.is_empty());
+        let (buf, ends) = lines(50);
+        sketch.update_batch(&buf, &ends);
+        sketch.update(b"zero", 0.0).unwrap();
+        assert!(sketch.update(b"negative", -1.0).is_err());
+        assert!(sketch.update(b"nan", f64::NAN).is_err());
+        assert_eq!(sketch.n(), 50);
+        assert_eq!(sketch.num_samples(), 50);
+        let mut samples = sketch.samples();
+        samples.sort_by(|a, b| a.0.cmp(b.0));
+        assert_eq!(samples[0], (&b"error line 0"[..], 1.0));
+        let errors = sketch.estimate_subset_sum(|item| item.starts_with(b"error"));
+        assert_eq!(errors.estimate, 5.0);
+        assert_eq!(errors.lower_bound, 5.0);
+        assert_eq!(errors.upper_bound, 5.0);
+        assert_eq!(errors.total_sketch_weight, 50.0);
+        sketch.reset();
+        assert!(sketch.is_empty());
+        assert!(VarOptSketch::new(0).is_err());
+    }
+
+    #[test]
+    fn weighted_subset_sums() {
+        let mut sketch = VarOptSketch::new(200).unwrap();
+        let (buf, ends) = lines(100 * 1000);
+        let weights: Vec<f64> = (0..ends.len())
+            .map(|i| if i % 10 == 0 { 5.0 } else { 1.0 })
+            .collect();
+        sketch.update_weighted_batch(&buf, &ends, &weights).unwrap();
+        assert_eq!(sketch.num_samples(), 200);
+        let total: f64 = weights.iter().sum();
+        let errors = sketch.estimate_subset_sum(|item| item.starts_with(b"error"));
+        assert!((errors.total_sketch_weight - total).abs() < 1e-6 * total);
+        assert!(errors.lower_bound <= errors.estimate && errors.estimate <= errors.upper_bound);
+        assert!(errors.lower_bound <= 50000.0 && 50000.0 <= errors.upper_bound);
+        let sum: f64 = sketch.samples().iter().map(|(_, weight)| weight).sum();
+        assert!((sum - total).abs() < 1e-6 * total);
+
+        let mut bad = weights.clone();
+        bad[10] = -1.0;
+        let mut partial = VarOptSketch::new(200).unwrap();
+        assert!(partial.update_weighted_batch(&buf, &ends, &bad).is_err());
+        assert_eq!(partial.n(), 10);
+    }
+
+    #[test]
+    fn grouped_subset_sums_match_single_ones() {
+        // the last digit of the line number, but none for 9
+        let group = |item: &[u8]| match item[item.len() - 1] {
+            b'9' => None,
+            digit => Some((digit - b'0') as usize),
+        };
+        for &k in &[20, 5000] {
+            let mut sketch = VarOptSketch::new(k).unwrap();
+            assert_eq!(sketch.estimate_subset_sums(3, group)[2].estimate, 0.0);
+            let (buf, ends) = lines(20 * 1000);
+            let weights: Vec<f64> = (0..ends.len()).map(|i| (i % 7) as f64).collect();
+            sketch.update_weighted_batch(&buf, &ends, &weights).unwrap();
+            let sums = sketch.estimate_subset_sums(9, group);
+            assert_eq!(sums.len(), 9);
+            for (g, sum) in sums.iter().enumerate() {
+                let single = sketch.estimate_subset_sum(|item| group(item) == Some(g));
+                assert_eq!(*sum, single, "{} {}", k, g);
+            }
+        }
+    }
+
+    #[test]
+    fn union_and_serialize() {
+        let (buf, ends) = lines(10 * 1000);
+        let mut shards: Vec<VarOptSketch> =
+            (0..4).map(|_| VarOptSketch::new(100).unwrap()).collect();
+        let mut start = 0;
+        for (i, &end) in ends.iter().enumerate() {
+            shards[i % 4].update(&buf[start..end], 1.0).unwrap();
+            start = end;
+        }
+        let serialized: Vec<Vec<u8>> = shards
+            .iter()
+            .map(|shard| shard.serialize().as_ref().to_vec())
+            .collect();
+        let cycled = VarOptSketch::deserialize(&serialized[0]).unwrap();
+        assert_eq!(cycled.samples(), shards[0].samples());
+        assert_eq!(shards[0].clone().serialize().as_ref(), &serialized[0][..]);
+        assert!(VarOptSketch::deserialize(&serialized[0][..serialized[0].len() - 1]).is_err());
+
+        let mut union = VarOptUnion::new(100).unwrap();
+        shards.iter().for_each(|shard| union.merge(shard));
+        let mut batched = VarOptUnion::new(100).unwrap();
+        let truncated = &serialized[3][..serialized[3].len() - 1];
+        assert!(batched
+            .merge_all_serialized(&[&serialized[0][..], truncated])
+            .is_err());
+        assert!(batched.sketch().is_empty());
+        let slices: Vec<&[u8]> = serialized.iter().map(|buf| buf.as_slice()).collect();
+        for merged in vec![
+            union.sketch(),
+            {
+                batched.merge_all_serialized(&slices).unwrap();
+                batched.sketch()
+            },
+            VarOptUnion::union_many(100, &slices, 1).unwrap(),
+            VarOptUnion::union_many(100, &slices, 3).unwrap(),
+        ] {
+            assert_eq!(merged.n(), 10 * 1000);
+            assert_eq!(merged.num_samples(), 100);
+            let all = merged.estimate_subset_sum(|_| true);
+            assert!((all.estimate - 10000.0).abs() < 1e-6);
+        }
+    }
+}